@@ -154,7 +154,7 @@ MUSIC_OBJS= bgmusic.obj &
 	snd_modplug.obj &
 	snd_xmp.obj &
 	snd_umx.obj
-COMOBJ_SND = snd_dma.obj snd_mix.obj snd_mem.obj $(MUSIC_OBJS)
+COMOBJ_SND = snd_dma.obj snd_mix.obj snd_mixkernels.obj snd_mem.obj $(MUSIC_OBJS)
 SYSOBJ_SND = snd_sdl.obj
 SYSOBJ_CDA = cd_sdl.obj
 SYSOBJ_INPUT = in_sdl.obj
@@ -188,6 +188,7 @@ GLOBJS = &
 	r_sprite.obj &
 	r_alias.obj &
 	r_brush.obj &
+	r_lightkernels.obj &
 	gl_model.obj
 
 OBJS = strlcat.obj &
@@ -201,10 +202,12 @@ OBJS = strlcat.obj &
 	net_dgrm.obj &
 	net_loop.obj &
 	net_main.obj &
+	loadtest.obj &
 	chase.obj &
 	cl_demo.obj &
 	cl_input.obj &
 	cl_main.obj &
+	cl_pred.obj &
 	cl_parse.obj &
 	cl_tent.obj &
 	console.obj &
@@ -217,18 +220,24 @@ OBJS = strlcat.obj &
 	common.obj &
 	miniz.obj &
 	crc.obj &
+	gzip.obj &
 	cvar.obj &
+	tasks.obj &
+	trace.obj &
 	cfgfile.obj &
 	host.obj &
 	host_cmd.obj &
 	mathlib.obj &
+	mathkernels.obj &
 	pr_cmds.obj &
 	pr_edict.obj &
 	pr_exec.obj &
+	pr_jit.obj &
 	sv_main.obj &
 	sv_move.obj &
 	sv_phys.obj &
 	sv_user.obj &
+	sv_replay.obj &
 	world.obj &
 	zone.obj &
 	$(SYSOBJ_SYS) $(SYSOBJ_MAIN)
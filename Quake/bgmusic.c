@@ -74,6 +74,226 @@ static music_handler_t *music_handlers = NULL;
 
 static snd_stream_t *bgmstream = NULL;
 
+/*
+==============================================================================
+
+STREAM DECODER
+
+A thread decodes bgmstream into a ring of raw file samples, so a slow
+frame doesn't starve the music and the codecs take no time from the main
+thread; BGM_UpdateStream only copies out of the ring.  While the thread
+runs it owns the codec, the main thread stops it before closing or
+seeking the stream.  Without the thread the stream is read directly.
+==============================================================================
+*/
+
+#define	BGM_RING_SIZE		(256 * 1024)	/* about 1.5 seconds of 44.1 kHz 16 bit stereo */
+#define	BGM_DECODE_CHUNK	16384
+
+typedef enum
+{
+	BGM_DECODING,
+	BGM_DECODE_EOF,		/* not looping, or looped into EOF again */
+	BGM_DECODE_LOOPEOF,
+	BGM_DECODE_SEEKERROR,
+	BGM_DECODE_READERROR
+} bgmdecodestatus_t;
+
+static byte		*bgm_ring;
+static size_t		bgm_ringhead;		/* total bytes decoded, decoder thread */
+static size_t		bgm_ringtail;		/* total bytes used, main thread */
+static bgmdecodestatus_t	bgm_decodestatus;	/* set by the decoder when it stops */
+static int		bgm_decodeerror;	/* the codec's error code */
+static qboolean		bgm_decodequit;
+static qboolean		bgm_didrewind;
+static SDL_mutex	*bgm_ringlock;
+static SDL_cond		*bgm_ringcond;
+static SDL_Thread	*bgm_decoder;
+
+static qboolean		bgm_flowing;		/* music has come out of the ring, main thread */
+static int		bgm_underruns;		/* frames the ring ran dry while decoding */
+static int		bgm_underrunbytes;	/* music that was wanted those frames */
+
+/*
+=================
+BGM_Decode
+
+Reads up to bytes from the stream, rewinding it at the end if it loops.
+Returns the bytes read, 0 once there is nothing more.  Safe on the
+decoder thread.
+=================
+*/
+static int BGM_Decode (byte *buf, int bytes)
+{
+	int	res;
+
+	while (1)
+	{
+		res = S_CodecReadStream (bgmstream, bytes, buf);
+		if (res > 0)
+		{
+			bgm_didrewind = false;
+			return res;
+		}
+		if (res < 0)
+		{
+			bgm_decodestatus = BGM_DECODE_READERROR;
+			bgm_decodeerror = res;
+			return 0;
+		}
+
+	/* EOF */
+		if (!bgmloop)
+		{
+			bgm_decodestatus = BGM_DECODE_EOF;
+			return 0;
+		}
+		if (bgm_didrewind)
+		{
+			bgm_decodestatus = BGM_DECODE_LOOPEOF;
+			return 0;
+		}
+		res = S_CodecRewindStream (bgmstream);
+		if (res != 0)
+		{
+			bgm_decodestatus = BGM_DECODE_SEEKERROR;
+			bgm_decodeerror = res;
+			return 0;
+		}
+		bgm_didrewind = true;
+	}
+}
+
+#if defined(USE_SDL2)
+static int SDLCALL BGM_DecoderThread (void *unused)
+{
+	size_t	start, n;
+	int	res;
+
+	SDL_LockMutex (bgm_ringlock);
+	while (!bgm_decodequit)
+	{
+		if (BGM_RING_SIZE - (bgm_ringhead - bgm_ringtail) < BGM_DECODE_CHUNK)
+		{	/* full enough, wait for the main thread to use some */
+			SDL_CondWait (bgm_ringcond, bgm_ringlock);
+			continue;
+		}
+
+		/* decode into the contiguous part */
+		start = bgm_ringhead % BGM_RING_SIZE;
+		n = q_min(BGM_DECODE_CHUNK, BGM_RING_SIZE - start);
+		SDL_UnlockMutex (bgm_ringlock);
+
+		res = BGM_Decode (bgm_ring + start, (int) n);
+
+		SDL_LockMutex (bgm_ringlock);
+		if (!res)
+			break;	/* bgm_decodestatus tells why */
+		bgm_ringhead += res;
+	}
+	SDL_UnlockMutex (bgm_ringlock);
+
+	return 0;
+}
+#endif
+
+static void BGM_StartDecoder (void)
+{
+	bgm_ringhead = bgm_ringtail = 0;
+	bgm_decodestatus = BGM_DECODING;
+	bgm_decodequit = false;
+	bgm_didrewind = false;
+	bgm_flowing = false;
+
+#if defined(USE_SDL2)
+	if (!bgm_ring)
+		bgm_ring = (byte *) malloc (BGM_RING_SIZE);
+	if (!bgm_ringlock)
+		bgm_ringlock = SDL_CreateMutex ();
+	if (!bgm_ringcond)
+		bgm_ringcond = SDL_CreateCond ();
+	if (!bgm_ring || !bgm_ringlock || !bgm_ringcond)
+		return;
+
+	bgm_decoder = SDL_CreateThread (BGM_DecoderThread, "bgmdecoder", NULL);
+#endif
+}
+
+/* the ring keeps whatever was decoded, BGM_StartDecoder empties it */
+static void BGM_StopDecoder (void)
+{
+	if (!bgm_decoder)
+		return;
+
+	SDL_LockMutex (bgm_ringlock);
+	bgm_decodequit = true;
+	SDL_CondBroadcast (bgm_ringcond);
+	SDL_UnlockMutex (bgm_ringlock);
+	SDL_WaitThread (bgm_decoder, NULL);
+	bgm_decoder = NULL;
+}
+
+/*
+=================
+BGM_ReadDecoded
+
+Takes up to bytes of whole sample frames out of the ring.  Returns 0 if
+none are ready, bgm_decodestatus then says if more are coming.
+=================
+*/
+static int BGM_ReadDecoded (byte *buf, int bytes, int framesize)
+{
+	size_t	start, n, avail;
+	int	total;
+
+	if (!bgm_decoder)
+		return BGM_Decode (buf, bytes);
+
+	SDL_LockMutex (bgm_ringlock);
+	avail = bgm_ringhead - bgm_ringtail;
+	avail -= avail % framesize;
+	bytes = (int) q_min((size_t) bytes, avail);
+	for (total = 0; total < bytes; total += n)
+	{
+		start = bgm_ringtail % BGM_RING_SIZE;
+		n = q_min((size_t) (bytes - total), BGM_RING_SIZE - start);
+		memcpy (buf + total, bgm_ring + start, n);
+		bgm_ringtail += n;
+	}
+	if (total)
+		SDL_CondSignal (bgm_ringcond);
+	SDL_UnlockMutex (bgm_ringlock);
+
+	return total;
+}
+
+/* decoding has stopped and all of it has been used */
+static qboolean BGM_DecodeFinished (void)
+{
+	qboolean	finished;
+
+	if (!bgm_decoder)
+		return bgm_decodestatus != BGM_DECODING;
+
+	SDL_LockMutex (bgm_ringlock);
+	finished = bgm_decodestatus != BGM_DECODING && bgm_ringhead - bgm_ringtail < (size_t) (bgmstream->info.width * bgmstream->info.channels);
+	SDL_UnlockMutex (bgm_ringlock);
+
+	return finished;
+}
+
+static void BGM_Stats_f (void)
+{
+	Con_Printf ("music decoder: %s\n", bgm_decoder ? "thread" : "main thread");
+	if (bgmstream && bgm_decoder)
+	{
+		SDL_LockMutex (bgm_ringlock);
+		Con_Printf ("%i of %i KB decoded ahead\n", (int) ((bgm_ringhead - bgm_ringtail) / 1024), BGM_RING_SIZE / 1024);
+		SDL_UnlockMutex (bgm_ringlock);
+	}
+	Con_Printf ("%i underruns, %i KB of music missed\n", bgm_underruns, bgm_underrunbytes / 1024);
+}
+
 static void BGM_Play_f (void)
 {
 	if (Cmd_Argc() == 2) {
@@ -126,7 +346,9 @@ static void BGM_Jump_f (void)
 		Con_Printf ("music_jump <ordernum>\n");
 	}
 	else if (bgmstream) {
+		BGM_StopDecoder ();
 		S_CodecJumpToOrder(bgmstream, atoi(Cmd_Argv(1)));
+		BGM_StartDecoder ();	/* drops what was decoded before the jump */
 	}
 }
 
@@ -142,6 +364,7 @@ qboolean BGM_Init (void)
 	Cmd_AddCommand("music_loop", BGM_Loop_f);
 	Cmd_AddCommand("music_stop", BGM_Stop_f);
 	Cmd_AddCommand("music_jump", BGM_Jump_f);
+	Cmd_AddCommand("music_stats", BGM_Stats_f);
 
 	if (COM_CheckParm("-noextmusic") != 0)
 		no_extmusic = true;
@@ -217,7 +440,10 @@ static void BGM_Play_noext (const char *filename, unsigned int allowed_types)
 		case BGM_STREAMER:
 			bgmstream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
 			if (bgmstream)
+			{
+				BGM_StartDecoder ();
 				return;		/* success */
+			}
 			break;
 		case BGM_NONE:
 		default:
@@ -275,7 +501,10 @@ void BGM_Play (const char *filename)
 	case BGM_STREAMER:
 		bgmstream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
 		if (bgmstream)
+		{
+			BGM_StartDecoder ();
 			return;		/* success */
+		}
 		break;
 	case BGM_NONE:
 	default:
@@ -341,13 +570,21 @@ void BGM_PlayCDtrack (byte track, qboolean looping)
 		bgmstream = S_CodecOpenStreamType(tmp, type, bgmloop);
 		if (! bgmstream)
 			Con_Printf("Couldn't handle music file %s\n", tmp);
+		else
+			BGM_StartDecoder ();
 	}
 }
 
+void BGM_PrefetchCDtrack (byte track)
+{
+	/* codec streams open quickly enough on demand */
+}
+
 void BGM_Stop (void)
 {
 	if (bgmstream)
 	{
+		BGM_StopDecoder ();
 		bgmstream->status = STREAM_NONE;
 		S_CodecCloseStream(bgmstream);
 		bgmstream = NULL;
@@ -375,11 +612,11 @@ void BGM_Resume (void)
 
 static void BGM_UpdateStream (void)
 {
-	qboolean did_rewind = false;
 	int	res;	/* Number of bytes read. */
 	int	bufferSamples;
 	int	fileSamples;
 	int	fileBytes;
+	int	framesize;
 	byte	raw[16384];
 
 	if (bgmstream->status != STREAM_PLAY)
@@ -393,6 +630,7 @@ static void BGM_UpdateStream (void)
 	if (s_rawend < paintedtime)
 		s_rawend = paintedtime;
 
+	framesize = bgmstream->info.width * bgmstream->info.channels;
 	while (s_rawend < paintedtime + MAX_RAW_SAMPLES)
 	{
 		bufferSamples = MAX_RAW_SAMPLES - (s_rawend - paintedtime);
@@ -403,62 +641,52 @@ static void BGM_UpdateStream (void)
 			return;
 
 		/* our max buffer size */
-		fileBytes = fileSamples * (bgmstream->info.width * bgmstream->info.channels);
+		fileBytes = fileSamples * framesize;
 		if (fileBytes > (int) sizeof(raw))
 		{
 			fileBytes = (int) sizeof(raw);
-			fileSamples = fileBytes /
-					  (bgmstream->info.width * bgmstream->info.channels);
+			fileSamples = fileBytes / framesize;
 		}
 
 		/* Read */
-		res = S_CodecReadStream(bgmstream, fileBytes, raw);
-		if (res < fileBytes)
-		{
-			fileBytes = res;
-			fileSamples = res / (bgmstream->info.width * bgmstream->info.channels);
-		}
-
+		res = BGM_ReadDecoded(raw, fileBytes, framesize);
 		if (res > 0)	/* data: add to raw buffer */
 		{
+			fileSamples = res / framesize;
+			bgm_flowing = true;
 			S_RawSamples(fileSamples, bgmstream->info.rate,
 							bgmstream->info.width,
 							bgmstream->info.channels,
 							raw, bgmvolume.value);
-			did_rewind = false;
+			continue;
 		}
-		else if (res == 0)	/* EOF */
-		{
-			if (bgmloop)
-			{
-				if (did_rewind)
-				{
-					Con_Printf("Stream keeps returning EOF.\n");
-					BGM_Stop();
-					return;
-				}
-
-				res = S_CodecRewindStream(bgmstream);
-				if (res != 0)
-				{
-					Con_Printf("Stream seek error (%i), stopping.\n", res);
-					BGM_Stop();
-					return;
-				}
-				did_rewind = true;
-			}
-			else
-			{
-				BGM_Stop();
-				return;
+
+		if (!BGM_DecodeFinished())
+		{	/* the decoder is behind, try again next frame */
+			if (bgm_flowing)
+			{	/* not just starting up */
+				bgm_underruns++;
+				bgm_underrunbytes += fileBytes;
 			}
+			return;
 		}
-		else	/* res < 0: some read error */
+
+		switch (bgm_decodestatus)
 		{
-			Con_Printf("Stream read error (%i), stopping.\n", res);
-			BGM_Stop();
-			return;
+		case BGM_DECODE_LOOPEOF:
+			Con_Printf("Stream keeps returning EOF.\n");
+			break;
+		case BGM_DECODE_SEEKERROR:
+			Con_Printf("Stream seek error (%i), stopping.\n", bgm_decodeerror);
+			break;
+		case BGM_DECODE_READERROR:
+			Con_Printf("Stream read error (%i), stopping.\n", bgm_decodeerror);
+			break;
+		default:
+			break;
 		}
+		BGM_Stop();
+		return;
 	}
 }
 
@@ -38,6 +38,13 @@ void BGM_Pause (void);
 void BGM_Resume (void);
 
 void BGM_PlayCDtrack (byte track, qboolean looping);
+void BGM_PrefetchCDtrack (byte track);	/* starts opening a track that will likely be played soon */
+
+#if USE_FMOD
+qboolean BGM_IsStarving (void);
+void BGM_Detach (void);		/* releases the music before snd_restart closes FMOD */
+void BGM_Reattach (void);	/* and starts the track again on the new system */
+#endif
 
 #endif	/* _BGMUSIC_H_ */
 
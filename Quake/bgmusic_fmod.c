@@ -44,6 +44,36 @@ extern FMOD_SYSTEM *fmod_system;
 static FMOD_CHANNELGROUP *bgm_channelGroup = NULL;
 static FMOD_CHANNEL *bgm_channel = NULL;
 static FMOD_SOUND *bgm_sound = NULL;
+static char bgm_path[MAX_QPATH];
+
+/*
+Streams are opened with FMOD_NONBLOCKING and only start playing once they are ready, so changing
+tracks never stalls the main thread. A track can also be prefetched ahead of time (the listen server
+does this for the next map's cdtrack while it is still loading), in which case it starts instantly.
+On a track change, the old track fades out while the new one fades in, both scheduled on the
+DSP clock. Requesting the track that is already playing keeps it going without a restart.
+*/
+#define BGM_CROSSFADE_TIME	1.0	// seconds
+
+static FMOD_SOUND *bgm_nextSound = NULL;	// opening in the background
+static char bgm_nextPath[MAX_QPATH];
+static qboolean bgm_nextPlay;			// false if only prefetched
+
+static FMOD_CHANNEL *bgm_oldChannel = NULL;	// fading out
+static FMOD_SOUND *bgm_oldSound = NULL;
+
+// Extension probes are cached, as they go through the file system for every extension
+#define MAX_BGM_PATHS	32
+
+typedef struct
+{
+	char name[MAX_QPATH];
+	char path[MAX_QPATH];	// empty if no file was found
+} bgmpath_t;
+
+static bgmpath_t bgm_paths[MAX_BGM_PATHS];
+static int bgm_numpaths, bgm_nextpath;
+static char bgm_pathsGamedir[MAX_OSPATH];
 
 static const char *extensions[] =
 {
@@ -98,10 +128,22 @@ static void BGM_Stop_f (void)
 	BGM_Stop();
 }
 
-qboolean BGM_Init (void)
+static qboolean BGM_CreateChannelGroup (void)
 {
 	FMOD_RESULT result;
 
+	result = FMOD_System_CreateChannelGroup(fmod_system, "BGM", &bgm_channelGroup);
+	if (result != FMOD_OK)
+	{
+		Con_Printf("Failed to create FMOD music channel group: %s\n", FMOD_ErrorString(result));
+		return false;
+	}
+
+	return true;
+}
+
+qboolean BGM_Init (void)
+{
 	Cvar_RegisterVariable(&bgm_extmusic);
 	Cmd_AddCommand("music", BGM_Play_f);
 	Cmd_AddCommand("music_pause", BGM_Pause_f);
@@ -120,14 +162,7 @@ qboolean BGM_Init (void)
 		return false;
 	}
 
-	result = FMOD_System_CreateChannelGroup(fmod_system, "BGM", &bgm_channelGroup);
-	if (result != FMOD_OK)
-	{
-		Con_Printf("Failed to create FMOD music channel group: %s\n", FMOD_ErrorString(result));
-		return false;
-	}
-
-	return true;
+	return BGM_CreateChannelGroup();
 }
 
 void BGM_Shutdown (void)
@@ -141,10 +176,223 @@ void BGM_Shutdown (void)
 	}
 }
 
-static qboolean BGM_PlayStream(const char *filename)
+static const char *BGM_FindCachedPath (const char *name)
 {
-	char netpath[MAX_OSPATH];
+	int i;
+
+	if (strcmp(bgm_pathsGamedir, com_gamedir))
+	{
+		// Search paths changed, start over
+		q_strlcpy(bgm_pathsGamedir, com_gamedir, sizeof(bgm_pathsGamedir));
+		bgm_numpaths = bgm_nextpath = 0;
+		return NULL;
+	}
+
+	for (i = 0; i < bgm_numpaths; i++)
+	{
+		if (!strcmp(bgm_paths[i].name, name))
+			return bgm_paths[i].path;
+	}
+	return NULL;
+}
+
+static const char *BGM_CachePath (const char *name, const char *path)
+{
+	bgmpath_t *p;
+
+	p = &bgm_paths[bgm_nextpath];
+	bgm_nextpath = (bgm_nextpath + 1) % MAX_BGM_PATHS;
+	if (bgm_numpaths < MAX_BGM_PATHS)
+		bgm_numpaths++;
+
+	q_strlcpy(p->name, name, sizeof(p->name));
+	q_strlcpy(p->path, path, sizeof(p->path));
+	return p->path;
+}
+
+/*
+==================
+BGM_ResolveNoExt
+
+Finds the music file for a name without extension. The first extension in list order wins.
+==================
+*/
+static const char *BGM_ResolveNoExt (const char *filename)
+{
+	char tmp[MAX_QPATH];
+	const char *path;
+
+	path = BGM_FindCachedPath(filename);
+	if (path)
+		return path;
+
+	for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+	{
+		q_snprintf(tmp, sizeof(tmp), "%s/%s.%s", MUSIC_DIRNAME, filename, extensions[i]);
+		if (COM_FileExists(tmp, NULL))
+			return BGM_CachePath(filename, tmp);
+	}
+
+	return BGM_CachePath(filename, "");
+}
+
+/*
+==================
+BGM_ResolveCDtrack
+
+instead of searching by the order of music_handlers, do so by
+the order of searchpath priority: the file from the searchpath
+with the highest path_id is most likely from our own gamedir
+itself. This way, if a mod has track02 as a *.mp3 file, which
+is below *.ogg in the music_handler order, the mp3 will still
+have priority over track02.ogg from, say, id1.
+==================
+*/
+static const char *BGM_ResolveCDtrack (byte track)
+{
+	char name[16], tmp[MAX_QPATH];
+	const char *ext, *path;
+	unsigned int path_id, prev_id;
+
+	q_snprintf(name, sizeof(name), "#track%02d", (int)track);
+	path = BGM_FindCachedPath(name);
+	if (path)
+		return path;
+
+	prev_id = 0;
+	ext  = NULL;
+
+	for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+	{
+		q_snprintf(tmp, sizeof(tmp), "%s/track%02d.%s", MUSIC_DIRNAME, (int)track, extensions[i]);
+		if (!COM_FileExists(tmp, &path_id))
+			continue;
+
+		if (path_id > prev_id)
+		{
+			prev_id = path_id;
+			ext = extensions[i];
+		}
+	}
+
+	if (ext == NULL)
+		return BGM_CachePath(name, "");
+
+	q_snprintf(tmp, sizeof(tmp), "%s/track%02d.%s", MUSIC_DIRNAME, (int)track, ext);
+	return BGM_CachePath(name, tmp);
+}
+
+static void BGM_ReleaseNext (void)
+{
+	if (bgm_nextSound)
+	{
+		FMOD_Sound_Release(bgm_nextSound);
+		bgm_nextSound = NULL;
+	}
+	bgm_nextPath[0] = 0;
+	bgm_nextPlay = false;
+}
+
+static void BGM_ReleaseOld (void)
+{
+	if (bgm_oldChannel)
+	{
+		FMOD_Channel_Stop(bgm_oldChannel);
+		bgm_oldChannel = NULL;
+	}
+	if (bgm_oldSound)
+	{
+		FMOD_Sound_Release(bgm_oldSound);
+		bgm_oldSound = NULL;
+	}
+}
+
+/*
+==================
+BGM file callbacks
+
+Streams are read through the engine's file system, so music can live in
+pak and zip files too.  The file is opened on the main thread and handed
+to FMOD through fileuserdata; FMOD reads and closes it from its own
+thread, so the handle is malloc'd rather than zone allocated.
+==================
+*/
+static FMOD_RESULT F_CALL BGM_FileOpen (const char *name, unsigned int *filesize, void **handle, void *userdata)
+{
+	fshandle_t *fh = (fshandle_t *) userdata;
+
+	if (!fh)
+		return FMOD_ERR_FILE_NOTFOUND;
+	*filesize = (unsigned int) fh->length;
+	*handle = fh;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALL BGM_FileClose (void *handle, void *userdata)
+{
+	fshandle_t *fh = (fshandle_t *) handle;
+
+	fclose(fh->file);
+	free(fh);
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALL BGM_FileRead (void *handle, void *buffer, unsigned int sizebytes, unsigned int *bytesread, void *userdata)
+{
+	fshandle_t *fh = (fshandle_t *) handle;
+
+	*bytesread = (unsigned int) FS_fread(buffer, 1, sizebytes, fh);
+	if (*bytesread < sizebytes)
+		return FMOD_ERR_FILE_EOF;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALL BGM_FileSeek (void *handle, unsigned int pos, void *userdata)
+{
+	fshandle_t *fh = (fshandle_t *) handle;
+
+	if (FS_fseek(fh, (long) pos, SEEK_SET) != 0)
+		return FMOD_ERR_FILE_COULDNOTSEEK;
+	return FMOD_OK;
+}
+
+static fshandle_t *BGM_FileOpenHandle (const char *filename)
+{
+	fshandle_t *fh;
+	FILE *f;
+	long length;
+
+	length = (long) COM_FOpenFile(filename, &f, NULL);
+	if (length == -1 || !f)
+		return NULL;
+
+	fh = (fshandle_t *) malloc(sizeof(fshandle_t));
+	if (!fh)
+	{
+		fclose(f);
+		return NULL;
+	}
+	fh->file = f;
+	fh->pak = file_from_pak;
+	fh->start = ftell(f);
+	fh->pos = 0;
+	fh->length = length;
+	return fh;
+}
+
+/*
+==================
+BGM_OpenStream
+
+Starts opening a stream in the background, unless it's already playing or being opened.
+==================
+*/
+static qboolean BGM_OpenStream (const char *filename, qboolean play)
+{
+	FMOD_CREATESOUNDEXINFO exinfo;
+	fshandle_t *fh;
 	FMOD_RESULT result;
+	FMOD_BOOL playing;
 
 	if (!fmod_system || !bgm_channelGroup)
 	{
@@ -152,54 +400,129 @@ static qboolean BGM_PlayStream(const char *filename)
 		return false;
 	}
 
-	if (!COM_FullFilePath(filename, netpath, sizeof(netpath)))
+	if (bgm_channel && !strcmp(bgm_path, filename) && FMOD_Channel_IsPlaying(bgm_channel, &playing) == FMOD_OK && playing)
+	{
+		// Already playing, keep it going
+		if (play)
+			BGM_ReleaseNext();
+		return true;
+	}
+
+	if (bgm_nextSound && !strcmp(bgm_nextPath, filename))
+	{
+		bgm_nextPlay |= play;
+		return true;
+	}
+
+	fh = BGM_FileOpenHandle(filename);
+	if (!fh)
 	{
 		Con_Printf("Could not open BGM file %s, file not found\n", filename);
 		return false;
 	}
 
-	result = FMOD_System_CreateSound(fmod_system, netpath, FMOD_CREATESTREAM | FMOD_2D, NULL, &bgm_sound);
-	if (result != FMOD_OK || !bgm_sound)
+	BGM_ReleaseNext();
+
+	memset(&exinfo, 0, sizeof(exinfo));
+	exinfo.cbsize = sizeof(exinfo);
+	exinfo.fileuseropen = BGM_FileOpen;
+	exinfo.fileuserclose = BGM_FileClose;
+	exinfo.fileuserread = BGM_FileRead;
+	exinfo.fileuserseek = BGM_FileSeek;
+	exinfo.fileuserdata = fh;
+
+	result = FMOD_System_CreateSound(fmod_system, filename, FMOD_CREATESTREAM | FMOD_2D | FMOD_NONBLOCKING, &exinfo, &bgm_nextSound);
+	if (result != FMOD_OK || !bgm_nextSound)
 	{
+		// a failed request never reaches the open callback, so the file is still ours
+		fclose(fh->file);
+		free(fh);
 		Con_Printf("Failed to create FMOD sound: %s\n", FMOD_ErrorString(result));
-		BGM_Stop();
+		bgm_nextSound = NULL;
 		return false;
 	}
 
-	Con_DPrintf("BGM_PlayStream: Successfully loaded %s\n", filename);
+	q_strlcpy(bgm_nextPath, filename, sizeof(bgm_nextPath));
+	bgm_nextPlay = play;
+	return true;
+}
+
+/*
+==================
+BGM_StartNext
+
+Switches over to the stream that has just finished opening
+==================
+*/
+static void BGM_StartNext (void)
+{
+	FMOD_CHANNEL *channel;
+	FMOD_RESULT result;
+	unsigned long long dspclock, fade;
+	int rate;
 
-	result = FMOD_System_PlaySound(fmod_system, bgm_sound, bgm_channelGroup, false, &bgm_channel);
-	if (result != FMOD_OK || !bgm_channel)
+	result = FMOD_System_PlaySound(fmod_system, bgm_nextSound, bgm_channelGroup, true, &channel);
+	if (result != FMOD_OK || !channel)
 	{
 		Con_Printf("Failed to play FMOD sound: %s\n", FMOD_ErrorString(result));
-		BGM_Stop();
-		return false;
+		BGM_ReleaseNext();
+		return;
 	}
 
+	Con_DPrintf("BGM_StartNext: Successfully loaded %s\n", bgm_nextPath);
+
 	if (bgmloop)
 	{
-		FMOD_Channel_SetMode(bgm_channel, FMOD_LOOP_NORMAL);
+		FMOD_Channel_SetMode(channel, FMOD_LOOP_NORMAL);
 	}
 	else
 	{
-		FMOD_Channel_SetMode(bgm_channel, FMOD_LOOP_OFF);
-		FMOD_Channel_SetLoopCount(bgm_channel, 0);
+		FMOD_Channel_SetMode(channel, FMOD_LOOP_OFF);
+		FMOD_Channel_SetLoopCount(channel, 0);
 	}
 
-	return true;
+	if (bgm_channel)
+	{
+		// Crossfade from the current track
+		BGM_ReleaseOld();
+
+		FMOD_System_GetSoftwareFormat(fmod_system, &rate, NULL, NULL);
+		FMOD_ChannelGroup_GetDSPClock(bgm_channelGroup, &dspclock, NULL);
+		fade = (unsigned long long)(BGM_CROSSFADE_TIME * rate);
+
+		FMOD_Channel_AddFadePoint(bgm_channel, dspclock, 1.0f);
+		FMOD_Channel_AddFadePoint(bgm_channel, dspclock + fade, 0.0f);
+		FMOD_Channel_SetDelay(bgm_channel, 0, dspclock + fade, true);
+		bgm_oldChannel = bgm_channel;
+		bgm_oldSound = bgm_sound;
+
+		FMOD_Channel_AddFadePoint(channel, dspclock, 0.0f);
+		FMOD_Channel_AddFadePoint(channel, dspclock + fade, 1.0f);
+	}
+	else if (bgm_sound)
+	{
+		FMOD_Sound_Release(bgm_sound);
+	}
+
+	FMOD_Channel_SetPaused(channel, false);
+
+	bgm_channel = channel;
+	bgm_sound = bgm_nextSound;
+	q_strlcpy(bgm_path, bgm_nextPath, sizeof(bgm_path));
+	bgm_nextSound = NULL;
+	bgm_nextPath[0] = 0;
+	bgm_nextPlay = false;
 }
 
 static void BGM_Play_noext (const char *filename)
 {
-	char tmp[MAX_QPATH];
+	const char *path;
 
-	for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
-	{
-		q_snprintf(tmp, sizeof(tmp), "%s/%s.%s", MUSIC_DIRNAME, filename, extensions[i]);
-		if (BGM_PlayStream(tmp))
-			return;
-	}
+	path = BGM_ResolveNoExt(filename);
+	if (*path && BGM_OpenStream(path, true))
+		return;
 
+	BGM_Stop();
 	Con_Printf("Couldn't handle music file %s\n", filename);
 }
 
@@ -208,10 +531,9 @@ void BGM_Play (const char *filename)
 	char tmp[MAX_QPATH];
 	const char *ext;
 
-	BGM_Stop();
-
 	if (!filename || !*filename)
 	{
+		BGM_Stop();
 		Con_DPrintf("null music file name\n");
 		return;
 	}
@@ -224,61 +546,61 @@ void BGM_Play (const char *filename)
 	}
 
 	q_snprintf(tmp, sizeof(tmp), "%s/%s", MUSIC_DIRNAME, filename);
-	if (BGM_PlayStream(tmp))
+	if (BGM_OpenStream(tmp, true))
 		return;
 
+	BGM_Stop();
 	Con_Printf("Couldn't handle music file %s\n", filename);
 }
 
 void BGM_PlayCDtrack (byte track, qboolean looping)
 {
-/* instead of searching by the order of music_handlers, do so by
- * the order of searchpath priority: the file from the searchpath
- * with the highest path_id is most likely from our own gamedir
- * itself. This way, if a mod has track02 as a *.mp3 file, which
- * is below *.ogg in the music_handler order, the mp3 will still
- * have priority over track02.ogg from, say, id1.
- */
-	char tmp[MAX_QPATH];
-	const char *ext;
-	unsigned int path_id, prev_id;
+	const char *path;
 
-	BGM_Stop();
 	if (CDAudio_Play(track, looping) == 0)
+	{
+		BGM_Stop();
 		return;			/* success */
+	}
 
 	if (no_extmusic || !bgm_extmusic.value)
-		return;
-
-	prev_id = 0;
-	ext  = NULL;
-	
-	for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
 	{
-		q_snprintf(tmp, sizeof(tmp), "%s/track%02d.%s", MUSIC_DIRNAME, (int)track, extensions[i]);
-		if (!COM_FileExists(tmp, &path_id))
-			continue;
-
-		if (path_id > prev_id)
-		{
-			prev_id = path_id;
-			ext = extensions[i];
-		}
+		BGM_Stop();
+		return;
 	}
 
-	if (ext == NULL)
+	path = BGM_ResolveCDtrack(track);
+	if (!*path)
 	{
+		BGM_Stop();
 		Con_Printf("Couldn't find a cdrip for track %d\n", (int)track);
 		return;
 	}
 
-	q_snprintf(tmp, sizeof(tmp), "%s/track%02d.%s", MUSIC_DIRNAME, (int)track, ext);
-	if (!BGM_PlayStream(tmp))
-		Con_Printf("Couldn't handle music file %s\n", tmp);
+	if (!BGM_OpenStream(path, true))
+	{
+		BGM_Stop();
+		Con_Printf("Couldn't handle music file %s\n", path);
+	}
+}
+
+void BGM_PrefetchCDtrack (byte track)
+{
+	const char *path;
+
+	if (no_extmusic || !bgm_extmusic.value || !fmod_system || !bgm_channelGroup)
+		return;
+
+	path = BGM_ResolveCDtrack(track);
+	if (*path)
+		BGM_OpenStream(path, false);
 }
 
 void BGM_Stop(void)
 {
+	BGM_ReleaseNext();
+	BGM_ReleaseOld();
+
 	if (bgm_channel)
 	{
 		FMOD_Channel_Stop(bgm_channel);
@@ -290,6 +612,7 @@ void BGM_Stop(void)
 		FMOD_Sound_Release(bgm_sound);
 		bgm_sound = NULL;
 	}
+	bgm_path[0] = 0;
 }
 
 void BGM_Pause (void)
@@ -298,6 +621,10 @@ void BGM_Pause (void)
 	{
 		FMOD_Channel_SetPaused(bgm_channel, true);
 	}
+	if (bgm_oldChannel)
+	{
+		FMOD_Channel_SetPaused(bgm_oldChannel, true);
+	}
 }
 
 void BGM_Resume (void)
@@ -306,6 +633,54 @@ void BGM_Resume (void)
 	{
 		FMOD_Channel_SetPaused(bgm_channel, false);
 	}
+	if (bgm_oldChannel)
+	{
+		FMOD_Channel_SetPaused(bgm_oldChannel, false);
+	}
+}
+
+qboolean BGM_IsStarving (void)
+{
+	FMOD_OPENSTATE openstate;
+	FMOD_BOOL starving;
+
+	if (!bgm_sound || FMOD_Sound_GetOpenState(bgm_sound, &openstate, NULL, &starving, NULL) != FMOD_OK)
+		return false;
+
+	return starving != 0;
+}
+
+/*
+==================
+BGM_Detach / BGM_Reattach
+
+snd_restart replaces the FMOD system the music plays on. The wanted track is remembered,
+and opened again from the start once the new system is up.
+==================
+*/
+static char bgm_restartPath[MAX_QPATH];
+
+void BGM_Detach (void)
+{
+	FMOD_BOOL playing;
+
+	bgm_restartPath[0] = 0;
+	if (bgm_nextSound && bgm_nextPlay)
+		q_strlcpy(bgm_restartPath, bgm_nextPath, sizeof(bgm_restartPath));
+	else if (bgm_channel && FMOD_Channel_IsPlaying(bgm_channel, &playing) == FMOD_OK && playing)
+		q_strlcpy(bgm_restartPath, bgm_path, sizeof(bgm_restartPath));
+
+	BGM_Shutdown();
+}
+
+void BGM_Reattach (void)
+{
+	if (!fmod_system || bgm_channelGroup || !BGM_CreateChannelGroup())
+		return;
+
+	if (bgm_restartPath[0])
+		BGM_OpenStream(bgm_restartPath, true);
+	bgm_restartPath[0] = 0;
 }
 
 void BGM_Update (void)
@@ -324,6 +699,32 @@ void BGM_Update (void)
 	{
 		FMOD_ChannelGroup_SetVolume(bgm_channelGroup, bgmvolume.value);
 	}
+
+	if (bgm_nextSound)
+	{
+		FMOD_OPENSTATE openstate;
+
+		if (FMOD_Sound_GetOpenState(bgm_nextSound, &openstate, NULL, NULL, NULL) != FMOD_OK || openstate == FMOD_OPENSTATE_ERROR)
+		{
+			Con_Printf("Couldn't handle music file %s\n", bgm_nextPath);
+			BGM_ReleaseNext();
+		}
+		else if (openstate == FMOD_OPENSTATE_READY && bgm_nextPlay)
+		{
+			BGM_StartNext();
+		}
+	}
+
+	if (bgm_oldChannel)
+	{
+		FMOD_BOOL playing;
+
+		if (FMOD_Channel_IsPlaying(bgm_oldChannel, &playing) != FMOD_OK || !playing)
+		{
+			bgm_oldChannel = NULL;
+			BGM_ReleaseOld();
+		}
+	}
 }
 
 #else
@@ -363,4 +764,8 @@ void BGM_PlayCDtrack(byte track, qboolean looping)
 	CDAudio_Play(track, looping);
 }
 
+void BGM_PrefetchCDtrack(byte track)
+{
+}
+
 #endif	// USE_FMOD
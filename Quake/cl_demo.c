@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 
 static void CL_FinishTimeDemo (void);
+static void CL_ResetDemoIndex (void);
+static void CL_BenchmarkDemoDone (qboolean failed, int frames, double seconds);
 
 /*
 ==============================================================================
@@ -40,6 +42,136 @@ read from the demo file.
 static byte	demo_head[3][MAX_MSGLEN];
 static int	demo_head_size[2];
 
+// playback reads the whole demo into memory up front
+static byte	*demo_data;
+static long	demo_size;
+static long	demo_pos;
+
+/*
+==============================================================================
+
+DEMO WRITER
+
+Recording copies each message into a ring buffer, and a thread writes the
+ring out to cls.demofile, so a slow disk never holds up a frame.  The main
+thread only blocks if the whole ring fills up.  Without the thread the
+messages are written directly.
+==============================================================================
+*/
+
+#define	DEMO_RING_SIZE		(4 * 1024 * 1024)
+
+static byte		*demo_ring;
+static size_t		demo_ringhead;		// total bytes queued, main thread
+static size_t		demo_ringtail;		// total bytes written, writer thread
+static qboolean		demo_ringquit;
+static qboolean		demo_writeerror;
+static SDL_mutex	*demo_ringlock;
+static SDL_cond		*demo_ringcond;
+static SDL_Thread	*demo_writer;
+
+static int SDLCALL CL_DemoWriterThread (void *unused)
+{
+	size_t	start, n;
+
+	SDL_LockMutex (demo_ringlock);
+	while (1)
+	{
+		if (demo_ringtail == demo_ringhead)
+		{
+			if (demo_ringquit)
+				break;
+			SDL_CondWait (demo_ringcond, demo_ringlock);
+			continue;
+		}
+
+		// write out the contiguous part
+		start = demo_ringtail % DEMO_RING_SIZE;
+		n = q_min(demo_ringhead - demo_ringtail, DEMO_RING_SIZE - start);
+		SDL_UnlockMutex (demo_ringlock);
+
+		if (fwrite (demo_ring + start, 1, n, cls.demofile) != n)
+			demo_writeerror = true;
+
+		SDL_LockMutex (demo_ringlock);
+		demo_ringtail += n;
+		SDL_CondBroadcast (demo_ringcond);
+	}
+	SDL_UnlockMutex (demo_ringlock);
+
+	return 0;
+}
+
+static void CL_StartDemoWriter (void)
+{
+	demo_ringhead = demo_ringtail = 0;
+	demo_ringquit = false;
+	demo_writeerror = false;
+
+	if (!demo_ring)
+		demo_ring = (byte *) malloc (DEMO_RING_SIZE);
+	if (!demo_ringlock)
+		demo_ringlock = SDL_CreateMutex ();
+	if (!demo_ringcond)
+		demo_ringcond = SDL_CreateCond ();
+	if (!demo_ring || !demo_ringlock || !demo_ringcond)
+		return;
+
+#if defined(USE_SDL2)
+	demo_writer = SDL_CreateThread (CL_DemoWriterThread, "demowriter", NULL);
+#else
+	demo_writer = SDL_CreateThread (CL_DemoWriterThread, NULL);
+#endif
+}
+
+static void CL_DemoWrite (const void *data, size_t len)
+{
+	size_t	start, n;
+
+	if (!demo_writer)
+	{
+		fwrite (data, 1, len, cls.demofile);
+		return;
+	}
+
+	SDL_LockMutex (demo_ringlock);
+	while (len)
+	{
+		while (demo_ringhead - demo_ringtail == DEMO_RING_SIZE)
+			SDL_CondWait (demo_ringcond, demo_ringlock);
+
+		start = demo_ringhead % DEMO_RING_SIZE;
+		n = q_min(len, DEMO_RING_SIZE - start);
+		n = q_min(n, DEMO_RING_SIZE - (demo_ringhead - demo_ringtail));
+		memcpy (demo_ring + start, data, n);
+		demo_ringhead += n;
+		data = (const byte *) data + n;
+		len -= n;
+		SDL_CondSignal (demo_ringcond);
+	}
+	SDL_UnlockMutex (demo_ringlock);
+}
+
+// waits for everything queued to be written and closes the file
+static void CL_CloseDemoFile (void)
+{
+	if (demo_writer)
+	{
+		SDL_LockMutex (demo_ringlock);
+		demo_ringquit = true;
+		SDL_CondBroadcast (demo_ringcond);
+		SDL_UnlockMutex (demo_ringlock);
+		SDL_WaitThread (demo_writer, NULL);
+		demo_writer = NULL;
+	}
+
+	if (demo_writeerror)
+		Con_Printf ("ERROR: couldn't write all of the demo\n");
+
+	fclose (cls.demofile);
+	cls.demofile = NULL;
+}
+
 /*
 ==============
 CL_StopPlayback
@@ -52,10 +184,12 @@ void CL_StopPlayback (void)
 	if (!cls.demoplayback)
 		return;
 
-	fclose (cls.demofile);
+	free (demo_data);
+	demo_data = NULL;
+	demo_size = demo_pos = 0;
+	CL_ResetDemoIndex ();
 	cls.demoplayback = false;
 	cls.demopaused = false;
-	cls.demofile = NULL;
 	cls.state = ca_disconnected;
 
 	if (cls.timedemo)
@@ -71,31 +205,220 @@ Dumps the current net message, prefixed by the length and view angles
 */
 static void CL_WriteDemoMessage (void)
 {
-	int	len;
+	int	header[4];
 	int	i;
 	float	f;
 
-	len = LittleLong (net_message.cursize);
-	fwrite (&len, 4, 1, cls.demofile);
+	header[0] = LittleLong (net_message.cursize);
 	for (i = 0; i < 3; i++)
 	{
 		f = LittleFloat (cl.viewangles[i]);
-		fwrite (&f, 4, 1, cls.demofile);
+		memcpy (&header[1 + i], &f, 4);
+	}
+	CL_DemoWrite (header, sizeof(header));
+	CL_DemoWrite (net_message.data, net_message.cursize);
+}
+
+/*
+==============================================================================
+
+DEMO SEEKING
+
+While a demo plays, the full client state is copied aside every
+cl_demokeyframe seconds of demo time, along with the file offset of the
+next message.  demoseek restores the nearest keyframe before the target
+and fast forwards from there, parsing messages without timing and with
+sounds muted.  Keyframes point into the hunk, so they only last until the
+next svc_serverinfo; seeking back into an earlier map replays it from the
+offset of its serverinfo message instead.
+
+Demo time is the sum of the forward steps of cl.mtime[0], so it keeps
+counting across map changes.
+==============================================================================
+*/
+
+#define	MAX_DEMO_KEYFRAMES	1024
+#define	MAX_DEMO_MAPS		256
+
+typedef struct
+{
+	double		clock;		// demo time it was taken at
+	double		lastmtime;
+	long		offset;		// where the next message starts
+	client_state_t	*cl;
+	entity_t	*entities;	// [cl->num_entities]
+	scoreboard_t	*scores;	// [cl->maxclients]
+	lightstyle_t	lightstyles[MAX_LIGHTSTYLES];
+	entframe_t	entframes[ENTFRAMES];
+} demokeyframe_t;
+
+typedef struct
+{
+	double		clock;
+	long		offset;		// of the message holding svc_serverinfo
+} demomap_t;
+
+static demokeyframe_t	*demo_keyframes[MAX_DEMO_KEYFRAMES];
+static int		demo_numkeyframes;
+static demomap_t	demo_maps[MAX_DEMO_MAPS];
+static int		demo_nummaps;
+
+static double	demo_clock;
+static double	demo_lastmtime;		// -1 = the next step doesn't count
+static long	demo_msgoffset;		// start of the message being parsed
+static double	demo_seektime;
+
+static void CL_FreeDemoKeyframes (void)
+{
+	int	i;
+
+	for (i = 0; i < demo_numkeyframes; i++)
+	{
+		CL_FreeEntFrames (demo_keyframes[i]->entframes);
+		free (demo_keyframes[i]);
+		demo_keyframes[i] = NULL;
 	}
-	fwrite (net_message.data, net_message.cursize, 1, cls.demofile);
-	fflush (cls.demofile);
+	demo_numkeyframes = 0;
+}
+
+static void CL_ResetDemoIndex (void)
+{
+	CL_FreeDemoKeyframes ();
+	demo_nummaps = 0;
+	demo_clock = 0;
+	demo_lastmtime = -1;
+	demo_msgoffset = 0;
+	cls.demoseeking = false;
+}
+
+/*
+====================
+CL_DemoNewMap
+
+Called from CL_ParseServerInfo during playback
+====================
+*/
+void CL_DemoNewMap (void)
+{
+	CL_FreeDemoKeyframes ();
+	demo_lastmtime = -1;
+
+	if (demo_nummaps && demo_maps[demo_nummaps - 1].offset >= demo_msgoffset)
+		return;	// replaying a map already seen
+	if (demo_nummaps == MAX_DEMO_MAPS)
+		return;
+	demo_maps[demo_nummaps].clock = demo_clock;
+	demo_maps[demo_nummaps].offset = demo_msgoffset;
+	demo_nummaps++;
+}
+
+static void CL_TakeDemoKeyframe (void)
+{
+	demokeyframe_t	*kf;
+	size_t		size;
+
+	size = sizeof(demokeyframe_t) + sizeof(client_state_t) + cl.num_entities * sizeof(entity_t) + cl.maxclients * sizeof(scoreboard_t);
+	kf = (demokeyframe_t *) malloc (size);
+	if (!kf)
+		return;
+
+	kf->clock = demo_clock;
+	kf->lastmtime = demo_lastmtime;
+	kf->offset = demo_pos;
+	kf->cl = (client_state_t *) (kf + 1);
+	kf->entities = (entity_t *) (kf->cl + 1);
+	kf->scores = (scoreboard_t *) (kf->entities + cl.num_entities);
+
+	memcpy (kf->cl, &cl, sizeof(client_state_t));
+	memcpy (kf->entities, cl_entities, cl.num_entities * sizeof(entity_t));
+	memcpy (kf->scores, cl.scores, cl.maxclients * sizeof(scoreboard_t));
+	memcpy (kf->lightstyles, cl_lightstyle, sizeof(cl_lightstyle));
+	CL_SaveEntFrames (kf->entframes);
+
+	demo_keyframes[demo_numkeyframes++] = kf;
+}
+
+static void CL_RestoreDemoKeyframe (demokeyframe_t *kf)
+{
+	demo_pos = kf->offset;
+
+	memcpy (&cl, kf->cl, sizeof(client_state_t));
+	CL_GrowEntities (q_max (cl.num_entities - 1, cl.viewentity));
+	memcpy (cl_entities, kf->entities, cl.num_entities * sizeof(entity_t));
+	CL_RebuildActiveEntities ();
+	memcpy (cl.scores, kf->scores, cl.maxclients * sizeof(scoreboard_t));
+	memcpy (cl_lightstyle, kf->lightstyles, sizeof(cl_lightstyle));
+	CL_RestoreEntFrames (kf->entframes);
+
+	demo_clock = kf->clock;
+	demo_lastmtime = kf->lastmtime;
+}
+
+/*
+====================
+CL_UpdateDemoClock
+
+Accounts for the message parsed last, called before reading the next one
+====================
+*/
+static void CL_UpdateDemoClock (void)
+{
+	double	step;
+
+	if (cl.mtime[0] != demo_lastmtime)
+	{
+		step = cl.mtime[0] - demo_lastmtime;
+		if (demo_lastmtime >= 0 && step > 0)
+			demo_clock += step;
+		demo_lastmtime = cl.mtime[0];
+	}
+
+	if (cls.signon != SIGNONS || cl_demokeyframe.value <= 0 || demo_numkeyframes == MAX_DEMO_KEYFRAMES)
+		return;
+	if (demo_numkeyframes && demo_clock - demo_keyframes[demo_numkeyframes - 1]->clock < cl_demokeyframe.value)
+		return;
+	CL_TakeDemoKeyframe ();
+}
+
+/*
+====================
+CL_FinishDemoSeek
+
+Drops what fast forwarding left behind and lines the view time up
+====================
+*/
+static void CL_FinishDemoSeek (void)
+{
+	cls.demoseeking = false;
+	demo_seektime = -1;
+
+	memset (cl_dlights, 0, sizeof(cl_dlights));
+	memset (cl_beams, 0, sizeof(cl_beams));
+	R_ClearParticles ();
+
+	cl.time = cl.oldtime = cl.mtime[0];
+	Con_Printf ("Demo at %.1f seconds\n", demo_clock);
 }
 
 static int CL_GetDemoMessage (void)
 {
-	int	r, i;
+	int	header[4];
+	int	i;
 	float	f;
 
-	if (cls.demopaused)
+	CL_UpdateDemoClock ();
+
+	if (cls.demoseeking && demo_clock >= demo_seektime)
+	{
+		CL_FinishDemoSeek ();
+		return 0;
+	}
+
+	if (cls.demopaused && !cls.demoseeking)
 		return 0;
 
 	// decide if it is time to grab the next message
-	if (cls.signon == SIGNONS)	// always grab until fully connected
+	if (cls.signon == SIGNONS && !cls.demoseeking)	// always grab until fully connected
 	{
 		if (cls.timedemo)
 		{
@@ -114,23 +437,32 @@ static int CL_GetDemoMessage (void)
 	}
 
 // get the next message
-	fread (&net_message.cursize, 4, 1, cls.demofile);
+	demo_msgoffset = demo_pos;
+	if (demo_size - demo_pos < (long)sizeof(header))
+	{
+		CL_StopPlayback ();
+		return 0;
+	}
+	memcpy (header, demo_data + demo_pos, sizeof(header));
+	demo_pos += sizeof(header);
+
 	VectorCopy (cl.mviewangles[0], cl.mviewangles[1]);
 	for (i = 0 ; i < 3 ; i++)
 	{
-		r = fread (&f, 4, 1, cls.demofile);
+		memcpy (&f, &header[1 + i], 4);
 		cl.mviewangles[0][i] = LittleFloat (f);
 	}
 
-	net_message.cursize = LittleLong (net_message.cursize);
+	net_message.cursize = LittleLong (header[0]);
 	if (net_message.cursize > MAX_MSGLEN)
 		Sys_Error ("Demo message > MAX_MSGLEN");
-	r = fread (net_message.data, net_message.cursize, 1, cls.demofile);
-	if (r != 1)
+	if (net_message.cursize < 0 || demo_size - demo_pos < net_message.cursize)
 	{
 		CL_StopPlayback ();
 		return 0;
 	}
+	memcpy (net_message.data, demo_data + demo_pos, net_message.cursize);
+	demo_pos += net_message.cursize;
 
 	return 1;
 }
@@ -202,10 +534,10 @@ void CL_Stop_f (void)
 	CL_WriteDemoMessage ();
 
 // finish up
-	fclose (cls.demofile);
-	cls.demofile = NULL;
+	CL_CloseDemoFile ();
 	cls.demorecording = false;
 	Con_Printf ("Completed demo\n");
+	COM_FlushDirCache ();
 	
 // ericw -- update demo tab-completion list
 	DemoList_Rebuild ();
@@ -296,6 +628,7 @@ void CL_Record_f (void)
 
 	cls.forcetrack = track;
 	fprintf (cls.demofile, "%i\n", cls.forcetrack);
+	CL_StartDemoWriter ();
 
 	cls.demorecording = true;
 
@@ -306,6 +639,10 @@ void CL_Record_f (void)
 		int cursize = net_message.cursize;
 		int i;
 
+		// PROTOCOL_DELTA: the demo only has the baselines to start from
+		cl.entframeack = 0;
+		cl.entframerestart = true;
+
 		for (i = 0; i < 2; i++)
 		{
 			net_message.data = demo_head[i];
@@ -382,6 +719,8 @@ play [demoname]
 void CL_PlayDemo_f (void)
 {
 	char	name[MAX_OSPATH];
+	long	start;
+	int	length;
 
 	if (cmd_source != src_command)
 		return;
@@ -401,7 +740,7 @@ void CL_PlayDemo_f (void)
 
 	Con_Printf ("Playing demo from %s.\n", name);
 
-	COM_FOpenFile (name, &cls.demofile, NULL);
+	length = COM_FOpenFile (name, &cls.demofile, NULL);
 	if (!cls.demofile)
 	{
 		Con_Printf ("ERROR: couldn't open %s\n", name);
@@ -413,6 +752,7 @@ void CL_PlayDemo_f (void)
 // O.S.: if a space character e.g. 0x20 (' ') follows '\n',
 // fscanf skips that byte too and screws up further reads.
 //	fscanf (cls.demofile, "%i\n", &cls.forcetrack);
+	start = ftell (cls.demofile);
 	if (fscanf (cls.demofile, "%i", &cls.forcetrack) != 1 || fgetc (cls.demofile) != '\n')
 	{
 		fclose (cls.demofile);
@@ -422,9 +762,27 @@ void CL_PlayDemo_f (void)
 		return;
 	}
 
+// read the rest of it in one go
+	demo_size = length - (ftell (cls.demofile) - start);
+	demo_pos = 0;
+	demo_data = (demo_size >= 0) ? (byte *) malloc (q_max(demo_size, 1)) : NULL;
+	if (!demo_data || fread (demo_data, 1, demo_size, cls.demofile) != (size_t)demo_size)
+	{
+		free (demo_data);
+		demo_data = NULL;
+		fclose (cls.demofile);
+		cls.demofile = NULL;
+		cls.demonum = -1;	// stop demo loop
+		Con_Printf ("ERROR: couldn't read demo \"%s\"\n", name);
+		return;
+	}
+	fclose (cls.demofile);
+	cls.demofile = NULL;
+
 	cls.demoplayback = true;
 	cls.demopaused = false;
 	cls.state = ca_connected;
+	CL_ResetDemoIndex ();
 
 // get rid of the menu and/or console
 	key_dest = key_game;
@@ -449,6 +807,9 @@ static void CL_FinishTimeDemo (void)
 	if (!time)
 		time = 1;
 	Con_Printf ("%i frames %5.1f seconds %5.1f fps\n", frames, time, frames/time);
+
+	if (cls.benchmarking)
+		CL_BenchmarkDemoDone (false, frames, time);
 }
 
 /*
@@ -470,8 +831,12 @@ void CL_TimeDemo_f (void)
 	}
 
 	CL_PlayDemo_f ();
-	if (!cls.demofile)
+	if (!cls.demoplayback)
+	{
+		if (cls.benchmarking)
+			CL_BenchmarkDemoDone (true, 0, 0);
 		return;
+	}
 
 // cls.td_starttime will be grabbed at the second frame of the demo, so
 // all the loading time doesn't get counted
@@ -481,3 +846,396 @@ void CL_TimeDemo_f (void)
 	cls.td_lastframe = -1;	// get a new message this frame
 }
 
+/*
+====================
+CL_DemoSeek_f
+
+demoseek <seconds> | +<seconds> | -<seconds>
+====================
+*/
+void CL_DemoSeek_f (void)
+{
+	const char	*arg;
+	double		target;
+	demokeyframe_t	*kf;
+	int		i;
+
+	if (cmd_source != src_command)
+		return;
+
+	if (!cls.demoplayback)
+	{
+		Con_Printf ("Not playing a demo.\n");
+		return;
+	}
+
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf ("demoseek <seconds | +seconds | -seconds> : now at %.1f\n", demo_clock);
+		return;
+	}
+
+	if (cls.timedemo)
+	{
+		Con_Printf ("Can't seek during timedemo\n");
+		return;
+	}
+
+	arg = Cmd_Argv(1);
+	target = atof (arg);
+	if (arg[0] == '+' || arg[0] == '-')
+		target += demo_clock;
+	target = q_max(target, 0.0);
+
+	// newest keyframe at or before the target
+	kf = NULL;
+	for (i = demo_numkeyframes - 1; i >= 0; i--)
+	{
+		if (demo_keyframes[i]->clock <= target)
+		{
+			kf = demo_keyframes[i];
+			break;
+		}
+	}
+
+	if (kf && (kf->clock > demo_clock || target < demo_clock))
+		CL_RestoreDemoKeyframe (kf);
+	else if (target < demo_clock)
+	{
+		// before the first keyframe of this map, replay from the map it is in
+		for (i = demo_nummaps - 1; i > 0; i--)
+		{
+			if (demo_maps[i].clock <= target)
+				break;
+		}
+		if (i < 0)
+			return;
+		demo_pos = demo_maps[i].offset;
+		demo_clock = demo_maps[i].clock;
+		demo_lastmtime = -1;
+	}
+
+	demo_seektime = target;
+	cls.demoseeking = true;
+}
+
+/*
+==============================================================================
+
+BENCHMARK
+
+benchmark [-quit] <demo> [demo...] runs each demo as a timedemo and keeps
+every frame's time, split the way host_speeds splits it, along with the
+peak hunk, zone and texture memory and, where timer queries are available,
+the GPU time of each render pass.  The summary goes to benchmark.json in
+the game directory and the frame times to benchmark.csv.  -benchmark on the
+command line does the same and quits when done.
+==============================================================================
+*/
+
+#define	MAX_BENCH_DEMOS		32
+
+typedef struct
+{
+	float	total, server, client, gfx, swap, snd;	// milliseconds
+} benchframe_t;
+
+typedef struct
+{
+	char		name[MAX_QPATH];
+	qboolean	failed;
+	int		frames;
+	double		seconds;
+	double		minms, avgms, maxms, p99ms, low1fps;
+	double		server, client, gfx, swap, snd;	// average milliseconds
+	int		peakhunk, peakzone;
+	float		peaktexmb;
+	int		gpuframes;	// frames with gpu timer results
+	double		gpu[GPU_NUMPASSES];	// average gpu milliseconds per pass
+} benchresult_t;
+
+static benchresult_t	bench_results[MAX_BENCH_DEMOS];
+static int		bench_numdemos;
+static int		bench_current;
+static qboolean		bench_quit;
+static benchframe_t	*bench_frames;
+static int		bench_numframes, bench_maxframes;
+static FILE		*bench_csv;
+
+/*
+====================
+CL_BenchmarkFrame
+
+Called from _Host_Frame with the parts of the frame in seconds;
+update covers everything up to rendering, the server included
+====================
+*/
+void CL_BenchmarkFrame (double update, double server, double render, double swap, double sound)
+{
+	benchresult_t	*r;
+	benchframe_t	*f;
+	float		texmb;
+	int		i;
+
+	if (!cls.timedemo || host_framecount <= cls.td_startframe + 1)
+		return;	// the first frames don't count, see CL_FinishTimeDemo
+
+	if (bench_numframes == bench_maxframes)
+	{
+		bench_maxframes = bench_maxframes ? bench_maxframes * 2 : 4096;
+		bench_frames = (benchframe_t *) realloc (bench_frames, bench_maxframes * sizeof(benchframe_t));
+		if (!bench_frames)
+			Sys_Error ("CL_BenchmarkFrame: out of memory");
+	}
+
+	f = &bench_frames[bench_numframes++];
+	f->total = (update + render + sound) * 1000;
+	f->server = server * 1000;
+	f->client = (update - server) * 1000;
+	f->gfx = (render - swap) * 1000;
+	f->swap = swap * 1000;
+	f->snd = sound * 1000;
+
+	r = &bench_results[bench_current];
+	r->peakhunk = q_max(r->peakhunk, Hunk_Used ());
+	r->peakzone = q_max(r->peakzone, Z_Used ());
+	texmb = TexMgr_FrameUsage ();
+	r->peaktexmb = q_max(r->peaktexmb, texmb);
+
+	if (gpu_timing)
+	{
+		for (i = 0; i < GPU_NUMPASSES; i++)
+			r->gpu[i] += gpu_passms[i];
+		r->gpuframes++;
+	}
+}
+
+static int CL_BenchmarkCompare (const void *a, const void *b)
+{
+	float	fa = *(const float *)a, fb = *(const float *)b;
+
+	return (fa > fb) - (fa < fb);
+}
+
+static void CL_BenchmarkStats (benchresult_t *r)
+{
+	float	*sorted;
+	double	sum;
+	int	i, n, slow;
+
+	n = bench_numframes;
+	if (!n)
+		return;
+
+	sorted = (float *) malloc (n * sizeof(float));
+	if (!sorted)
+		Sys_Error ("CL_BenchmarkStats: out of memory");
+
+	for (i = 0; i < n; i++)
+	{
+		sorted[i] = bench_frames[i].total;
+		r->server += bench_frames[i].server;
+		r->client += bench_frames[i].client;
+		r->gfx += bench_frames[i].gfx;
+		r->swap += bench_frames[i].swap;
+		r->snd += bench_frames[i].snd;
+	}
+	r->server /= n;
+	r->client /= n;
+	r->gfx /= n;
+	r->swap /= n;
+	r->snd /= n;
+	for (i = 0; i < GPU_NUMPASSES && r->gpuframes; i++)
+		r->gpu[i] /= r->gpuframes;
+
+	qsort (sorted, n, sizeof(float), CL_BenchmarkCompare);
+	for (i = 0, sum = 0; i < n; i++)
+		sum += sorted[i];
+	r->minms = sorted[0];
+	r->maxms = sorted[n - 1];
+	r->avgms = sum / n;
+	r->p99ms = sorted[(int)(0.99 * (n - 1))];
+
+	// 1% low: the average rate over the slowest hundredth of the frames
+	slow = q_max(n / 100, 1);
+	for (i = n - slow, sum = 0; i < n; i++)
+		sum += sorted[i];
+	r->low1fps = sum > 0 ? 1000.0 * slow / sum : 0;
+
+	free (sorted);
+}
+
+static void CL_BenchmarkWriteString (FILE *f, const char *s)
+{
+	fputc ('"', f);
+	for ( ; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fputc ('\\', f);
+		if ((unsigned char)*s >= ' ')
+			fputc (*s, f);
+	}
+	fputc ('"', f);
+}
+
+static void CL_BenchmarkWriteReport (void)
+{
+	benchresult_t	*r;
+	FILE	*f;
+	int	i, j;
+
+	f = fopen (va("%s/benchmark.json", com_gamedir), "w");
+	if (!f)
+	{
+		Con_Printf ("Couldn't write benchmark.json.\n");
+		return;
+	}
+
+	fprintf (f, "{\n\t\"version\": \"" QUAKESPASM_VER_STRING "\",\n\t\"demos\": [\n");
+	for (i = 0, r = bench_results; i < bench_numdemos; i++, r++)
+	{
+		fprintf (f, "\t\t{\n\t\t\t\"name\": ");
+		CL_BenchmarkWriteString (f, r->name);
+		fprintf (f, ",\n\t\t\t\"failed\": %s,\n", r->failed ? "true" : "false");
+		fprintf (f, "\t\t\t\"frames\": %i,\n\t\t\t\"seconds\": %.3f,\n", r->frames, r->seconds);
+		fprintf (f, "\t\t\t\"fps_avg\": %.2f,\n\t\t\t\"fps_1pct_low\": %.2f,\n", r->seconds > 0 ? r->frames / r->seconds : 0, r->low1fps);
+		fprintf (f, "\t\t\t\"ms_min\": %.3f,\n\t\t\t\"ms_avg\": %.3f,\n\t\t\t\"ms_max\": %.3f,\n\t\t\t\"ms_p99\": %.3f,\n", r->minms, r->avgms, r->maxms, r->p99ms);
+		fprintf (f, "\t\t\t\"ms_server\": %.3f,\n\t\t\t\"ms_client\": %.3f,\n\t\t\t\"ms_gfx\": %.3f,\n\t\t\t\"ms_swap\": %.3f,\n\t\t\t\"ms_snd\": %.3f,\n", r->server, r->client, r->gfx, r->swap, r->snd);
+		fprintf (f, "\t\t\t\"peak_hunk\": %i,\n\t\t\t\"peak_zone\": %i,\n\t\t\t\"peak_texture_mb\": %.2f", r->peakhunk, r->peakzone, r->peaktexmb);
+		if (r->gpuframes)
+		{ // only when timer queries were available
+			fprintf (f, ",\n\t\t\t\"gpu_ms\": {");
+			for (j = 0; j < GPU_NUMPASSES; j++)
+				fprintf (f, "%s\"%s\": %.3f", j ? ", " : " ", gpu_passnames[j], r->gpu[j]);
+			fprintf (f, " }");
+		}
+		fprintf (f, "\n");
+		fprintf (f, "\t\t}%s\n", i < bench_numdemos - 1 ? "," : "");
+	}
+	fprintf (f, "\t]\n}\n");
+	fclose (f);
+
+	Con_Printf ("wrote %s/benchmark.json\n", com_gamedir);
+}
+
+static void CL_BenchmarkFinish (void)
+{
+	benchresult_t	*r;
+	int	i;
+
+	Con_Printf ("\n%-20s %7s %7s %7s %7s %7s\n", "demo", "fps", "1% low", "min ms", "avg ms", "99% ms");
+	for (i = 0, r = bench_results; i < bench_numdemos; i++, r++)
+	{
+		if (r->failed)
+			Con_Printf ("%-20s  failed\n", r->name);
+		else
+			Con_Printf ("%-20s %7.1f %7.1f %7.2f %7.2f %7.2f\n", r->name,
+				r->seconds > 0 ? r->frames / r->seconds : 0, r->low1fps, r->minms, r->avgms, r->p99ms);
+	}
+
+	CL_BenchmarkWriteReport ();
+
+	if (bench_csv)
+	{
+		fclose (bench_csv);
+		bench_csv = NULL;
+	}
+	free (bench_frames);
+	bench_frames = NULL;
+	bench_numframes = bench_maxframes = 0;
+	cls.benchmarking = false;
+
+	if (bench_quit)
+		Cbuf_AddText ("quit\n");
+}
+
+/*
+====================
+CL_BenchmarkDemoDone
+
+Called when a timedemo of the benchmark ends or fails to start
+====================
+*/
+static void CL_BenchmarkDemoDone (qboolean failed, int frames, double seconds)
+{
+	benchresult_t	*r;
+	benchframe_t	*f;
+	int	i;
+
+	r = &bench_results[bench_current];
+	r->failed = failed;
+	r->frames = frames;
+	r->seconds = seconds;
+	if (!failed)
+		CL_BenchmarkStats (r);
+
+	if (bench_csv)
+	{
+		for (i = 0, f = bench_frames; i < bench_numframes; i++, f++)
+			fprintf (bench_csv, "%s,%i,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", r->name, i, f->total, f->server, f->client, f->gfx, f->swap, f->snd);
+	}
+	bench_numframes = 0;
+
+	if (++bench_current == bench_numdemos)
+	{
+		CL_BenchmarkFinish ();
+		return;
+	}
+
+	Cbuf_AddText (va("timedemo %s\n", bench_results[bench_current].name));
+}
+
+/*
+====================
+CL_Benchmark_f
+
+benchmark [-quit] <demo> [demo...]
+====================
+*/
+void CL_Benchmark_f (void)
+{
+	int	i;
+
+	if (cmd_source != src_command)
+		return;
+
+	if (cls.benchmarking)
+	{
+		Con_Printf ("Benchmark already running\n");
+		return;
+	}
+
+	bench_quit = false;
+	bench_numdemos = 0;
+	for (i = 1; i < Cmd_Argc(); i++)
+	{
+		if (!strcmp (Cmd_Argv(i), "-quit"))
+			bench_quit = true;
+		else if (bench_numdemos < MAX_BENCH_DEMOS)
+		{
+			memset (&bench_results[bench_numdemos], 0, sizeof(benchresult_t));
+			q_strlcpy (bench_results[bench_numdemos].name, Cmd_Argv(i), MAX_QPATH);
+			bench_numdemos++;
+		}
+	}
+
+	if (!bench_numdemos)
+	{
+		Con_Printf ("benchmark [-quit] <demo> [demo...] : timedemos with a report in benchmark.json\n");
+		if (bench_quit)
+			Cbuf_AddText ("quit\n");
+		return;
+	}
+
+	bench_csv = fopen (va("%s/benchmark.csv", com_gamedir), "w");
+	if (bench_csv)
+		fprintf (bench_csv, "demo,frame,total_ms,server_ms,client_ms,gfx_ms,swap_ms,snd_ms\n");
+	else
+		Con_Printf ("Couldn't write benchmark.csv.\n");
+
+	cls.demonum = -1;	// stop the demo loop
+	cls.benchmarking = true;
+	bench_current = 0;
+	bench_numframes = 0;
+	Cbuf_AddText (va("timedemo %s\n", bench_results[0].name));
+}
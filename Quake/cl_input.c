@@ -234,6 +234,8 @@ cvar_t	cl_anglespeedkey = {"cl_anglespeedkey","1.5",CVAR_NONE};
 
 cvar_t	cl_alwaysrun = {"cl_alwaysrun","0",CVAR_ARCHIVE}; // QuakeSpasm -- new always run
 
+cvar_t	cl_moveredundancy = {"cl_moveredundancy","2",CVAR_ARCHIVE}; // earlier moves resent with each one, PROTOCOL_DELTA only
+
 /*
 ================
 CL_AdjustAngles
@@ -332,15 +334,46 @@ void CL_BaseMove (usercmd_t *cmd)
 }
 
 
+/*
+==============
+CL_WriteMove
+==============
+*/
+static void CL_WriteMove (sizebuf_t *buf, const sentmove_t *move)
+{
+	int		i;
+
+	for (i=0 ; i<3 ; i++)
+		//johnfitz -- 16-bit angles for PROTOCOL_FITZQUAKE
+		if (cl.protocol == PROTOCOL_NETQUAKE)
+			MSG_WriteAngle (buf, move->angles[i], cl.protocolflags);
+		else
+			MSG_WriteAngle16 (buf, move->angles[i], cl.protocolflags);
+		//johnfitz
+
+	MSG_WriteShort (buf, move->forwardmove);
+	MSG_WriteShort (buf, move->sidemove);
+	MSG_WriteShort (buf, move->upmove);
+
+	MSG_WriteByte (buf, move->bits);
+	MSG_WriteByte (buf, move->impulse);
+}
+
 /*
 ==============
 CL_SendMove
+
+For PROTOCOL_DELTA with cl_moveredundancy set, the move goes out as
+clc_moves together with the ones sent before it, and the server applies
+each numbered move once, so input that was in a lost packet still arrives
+with the next one.
 ==============
 */
 void CL_SendMove (const usercmd_t *cmd)
 {
 	int		i;
-	int		bits;
+	int		count, redundancy;
+	sentmove_t	move;
 	sizebuf_t	buf;
 	byte	data[128];
 
@@ -350,46 +383,29 @@ void CL_SendMove (const usercmd_t *cmd)
 
 	cl.cmd = *cmd;
 
-//
-// send the movement message
-//
-	MSG_WriteByte (&buf, clc_move);
-
-	MSG_WriteFloat (&buf, cl.mtime[0]);	// so server can get ping times
-
-	for (i=0 ; i<3 ; i++)
-		//johnfitz -- 16-bit angles for PROTOCOL_FITZQUAKE
-		if (cl.protocol == PROTOCOL_NETQUAKE)
-			MSG_WriteAngle (&buf, cl.viewangles[i], cl.protocolflags);
-		else
-			MSG_WriteAngle16 (&buf, cl.viewangles[i], cl.protocolflags);
-		//johnfitz
-
-	MSG_WriteShort (&buf, cmd->forwardmove);
-	MSG_WriteShort (&buf, cmd->sidemove);
-	MSG_WriteShort (&buf, cmd->upmove);
+	VectorCopy (cl.viewangles, move.angles);
+	move.forwardmove = cmd->forwardmove;
+	move.sidemove = cmd->sidemove;
+	move.upmove = cmd->upmove;
 
 //
-// send button bits
+// collect button bits
 //
-	bits = 0;
+	move.bits = 0;
 
 	if ( in_attack.state & 3 )
-		bits |= 1;
+		move.bits |= 1;
 	in_attack.state &= ~2;
 
 	if (in_jump.state & 3)
-		bits |= 2;
+		move.bits |= 2;
 	in_jump.state &= ~2;
 
-	MSG_WriteByte (&buf, bits);
-
-	MSG_WriteByte (&buf, in_impulse);
+	move.impulse = in_impulse;
 	in_impulse = 0;
 
-//
-// deliver the message
-//
+	CL_PredictSaveMove (cmd, (move.bits & 2) != 0);
+
 	if (cls.demoplayback)
 		return;
 
@@ -400,6 +416,42 @@ void CL_SendMove (const usercmd_t *cmd)
 	if (++cl.movemessages <= 2)
 		return;
 
+//
+// send the movement message
+//
+	redundancy = 0;
+	if (cl.protocol == PROTOCOL_DELTA)
+		redundancy = CLAMP (0, (int)cl_moveredundancy.value, MAX_SENTMOVES - 1);
+
+	if (redundancy)
+	{
+		cls.movesequence++;
+		cl.sentmoves[cls.movesequence & (MAX_SENTMOVES - 1)] = move;
+		cl.numsentmoves = q_min (cl.numsentmoves + 1, MAX_SENTMOVES);
+		count = q_min (cl.numsentmoves, redundancy + 1);
+
+		MSG_WriteByte (&buf, clc_moves);
+		MSG_WriteFloat (&buf, cl.mtime[0]);	// so server can get ping times
+		MSG_WriteByte (&buf, count);
+		MSG_WriteLong (&buf, cls.movesequence);
+		for (i = count - 1; i >= 0; i--)
+			CL_WriteMove (&buf, &cl.sentmoves[(cls.movesequence - i) & (MAX_SENTMOVES - 1)]);
+	}
+	else
+	{
+		cl.numsentmoves = 0;	// a later clc_moves mustn't resend moves from before
+
+		MSG_WriteByte (&buf, clc_move);
+		MSG_WriteFloat (&buf, cl.mtime[0]);	// so server can get ping times
+		CL_WriteMove (&buf, &move);
+	}
+
+	if (cl.protocol == PROTOCOL_DELTA)
+		MSG_WriteLong (&buf, cl.entframeack);	// last complete entity frame
+
+//
+// deliver the message
+//
 	if (NET_SendUnreliableMessage (cls.netcon, &buf) == -1)
 	{
 		Con_Printf ("CL_SendMove: lost server connection\n");
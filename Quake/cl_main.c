@@ -33,6 +33,9 @@ cvar_t	cl_color = {"_cl_color", "0", CVAR_ARCHIVE};
 
 cvar_t	cl_shownet = {"cl_shownet","0",CVAR_NONE};	// can be 0, 1, or 2
 cvar_t	cl_nolerp = {"cl_nolerp","0",CVAR_NONE};
+cvar_t	cl_jitterbuffer = {"cl_jitterbuffer","1",CVAR_ARCHIVE};
+cvar_t	cl_extrapolate = {"cl_extrapolate","0.1",CVAR_ARCHIVE};	// seconds at most
+cvar_t	cl_netgraph = {"cl_netgraph","0",CVAR_NONE};
 
 cvar_t	cfg_unbindall = {"cfg_unbindall", "1", CVAR_ARCHIVE};
 
@@ -49,6 +52,7 @@ cvar_t	cl_maxpitch = {"cl_maxpitch", "90", CVAR_ARCHIVE}; //johnfitz -- variable
 cvar_t	cl_minpitch = {"cl_minpitch", "-90", CVAR_ARCHIVE}; //johnfitz -- variable pitch clamping
 
 cvar_t	cl_startdemos = {"cl_startdemos", "1", CVAR_ARCHIVE};
+cvar_t	cl_demokeyframe = {"cl_demokeyframe", "30", CVAR_NONE};	// seconds between demoseek keyframes
 
 client_static_t	cls;
 client_state_t	cl;
@@ -57,14 +61,119 @@ entity_t		cl_static_entities[MAX_STATIC_ENTITIES];
 lightstyle_t	cl_lightstyle[MAX_LIGHTSTYLES];
 dlight_t		cl_dlights[MAX_DLIGHTS];
 
-entity_t		*cl_entities; //johnfitz -- was a static array, now on hunk
+entity_t		*cl_entities; //johnfitz -- was a static array, now committed as it grows
 int				cl_max_edicts; //johnfitz -- only changes when new map loads
 
+// cl_entities and cl_snapshots are reserved for MAX_EDICTS once, and memory
+// is committed behind them as cl.num_entities grows, see CL_GrowEntities
+#define	CL_ENTCOMMIT	0x10000		// bytes committed at a time, a multiple of the page size
+
+static int		cl_entcommitted;	// slots with memory behind them
+static int		cl_entbytes;		// committed in cl_entities
+static int		cl_snapbytes;		// committed in cl_snapshots
+
+// slots that may have a model, so CL_RelinkEntities doesn't visit empty ones
+static int		*cl_activeents;
+static byte		*cl_entactive;		// [cl_max_edicts], set if on the list
+static int		cl_numactiveents;
+static qboolean	cl_activeunsorted;
+
+/*
+jitter buffer: on a remote server, entities are placed along the last few
+states they were sent in, at a playout time that trails the server clock by
+an interval plus twice the arrival jitter, instead of between the last two
+messages at whatever time they happened to arrive.  The view entity keeps
+the old lerp, it shouldn't lag any further behind the input.
+*/
+#define	CL_SNAPSHOTS		4	// power of two
+#define	CL_NETGRAPH_SAMPLES	128	// power of two
+
+typedef struct
+{
+	double		time;
+	vec3_t		origin;
+	vec3_t		angles;
+} clsnapshot_t;
+
+typedef struct
+{
+	clsnapshot_t	snaps[CL_SNAPSHOTS];
+	int		count;		// total saved, the newest is count - 1
+} clsnapshots_t;
+
+static clsnapshots_t	*cl_snapshots;	// [cl_max_edicts]
+
+static double	jb_lastmtime;
+static double	jb_offset;		// server time - realtime
+static double	jb_jitter;
+static double	jb_interval;		// between updates
+static double	jb_playout;		// server time entities are placed at, 0 if not running
+static float	jb_lateness[CL_NETGRAPH_SAMPLES];	// per update, seconds
+static int	jb_numsamples;
+static int	jb_extrapolated;	// entities extrapolated last frame
+
 int				cl_numvisedicts;
 entity_t		*cl_visedicts[MAX_VISEDICTS];
 
 extern cvar_t	r_lerpmodels, r_lerpmove; //johnfitz
 
+/*
+=====================
+CL_ResetEntities
+
+Drops the memory behind the entity slots of the last server, the slots
+come back zeroed as they are committed again.
+=====================
+*/
+static void CL_ResetEntities (void)
+{
+	if (!cl_entities)
+	{
+		cl_entities = (entity_t *) Sys_MemReserve (MAX_EDICTS*sizeof(entity_t));
+		cl_snapshots = (clsnapshots_t *) Sys_MemReserve (MAX_EDICTS*sizeof(clsnapshots_t));
+		if (!cl_entities || !cl_snapshots)
+			Sys_Error ("CL_ResetEntities: couldn't reserve address space for %i entities", MAX_EDICTS);
+	}
+
+	if (cl_entbytes)
+		Sys_MemDecommit (cl_entities, cl_entbytes);
+	if (cl_snapbytes)
+		Sys_MemDecommit (cl_snapshots, cl_snapbytes);
+	cl_entbytes = cl_snapbytes = 0;
+	cl_entcommitted = 0;
+
+	CL_GrowEntities (0);	// the world
+}
+
+static void CL_CommitEntityBytes (void *base, int *committed, int size)
+{
+	size = (size + CL_ENTCOMMIT - 1) & ~(CL_ENTCOMMIT - 1);
+	if (size <= *committed)
+		return;
+	if (!Sys_MemCommit ((byte *) base + *committed, size - *committed))
+		Sys_Error ("CL_GrowEntities: couldn't commit %i bytes", size - *committed);
+	*committed = size;
+}
+
+/*
+=====================
+CL_GrowEntities
+
+Puts memory behind the entity slots up to and including num.
+=====================
+*/
+void CL_GrowEntities (int num)
+{
+	if (num < cl_entcommitted)
+		return;
+	if (num >= MAX_EDICTS)
+		Sys_Error ("CL_GrowEntities: %i is past MAX_EDICTS", num);
+
+	CL_CommitEntityBytes (cl_entities, &cl_entbytes, (num + 1) * sizeof(entity_t));
+	CL_CommitEntityBytes (cl_snapshots, &cl_snapbytes, (num + 1) * sizeof(clsnapshots_t));
+	cl_entcommitted = q_min (cl_entbytes / (int) sizeof(entity_t), cl_snapbytes / (int) sizeof(clsnapshots_t));
+}
+
 /*
 =====================
 CL_ClearState
@@ -89,8 +198,243 @@ void CL_ClearState (void)
 
 	//johnfitz -- cl_entities is now dynamically allocated
 	cl_max_edicts = CLAMP (MIN_EDICTS,(int)max_edicts.value,MAX_EDICTS);
-	cl_entities = (entity_t *) Hunk_AllocName (cl_max_edicts*sizeof(entity_t), "cl_entities");
+	CL_ResetEntities ();
 	//johnfitz
+
+	cl_activeents = (int *) Hunk_AllocName (cl_max_edicts*sizeof(int), "cl_active");
+	cl_entactive = (byte *) Hunk_AllocName (cl_max_edicts, "cl_active");
+	cl_numactiveents = 0;
+	cl_activeunsorted = false;
+
+	jb_lastmtime = jb_playout = 0;
+	jb_numsamples = 0;
+
+	CL_PredictReset ();
+}
+
+/*
+=====================
+CL_SaveSnapshot
+
+Called with every new entity state, reset starts the history over so
+nothing gets lerped across a teleport or a reused slot.
+=====================
+*/
+void CL_SaveSnapshot (int num, const entity_t *ent, qboolean reset)
+{
+	clsnapshots_t	*h;
+	clsnapshot_t	*s;
+	vec3_t		delta;
+
+	if (num < 0 || num >= cl_max_edicts)
+		return;
+	h = &cl_snapshots[num];
+
+	if (h->count)
+	{
+		s = &h->snaps[(h->count - 1) & (CL_SNAPSHOTS - 1)];
+		VectorSubtract (ent->msg_origins[0], s->origin, delta);
+		if (fabs (delta[0]) > 100 || fabs (delta[1]) > 100 || fabs (delta[2]) > 100)
+			reset = true;
+		else if (ent->msgtime <= s->time)
+			h->count--;	// replaces the state for the same time
+	}
+	if (reset)
+		h->count = 0;
+
+	s = &h->snaps[h->count & (CL_SNAPSHOTS - 1)];
+	s->time = ent->msgtime;
+	VectorCopy (ent->msg_origins[0], s->origin);
+	VectorCopy (ent->msg_angles[0], s->angles);
+	h->count++;
+}
+
+/*
+=====================
+CL_JitterSample
+
+Called with every svc_time, tracks the server clock against the local one.
+Updates that come early pull the offset up quickly, late ones only slowly,
+so it settles at about the earliest arrivals and the jitter is how late
+the rest are.
+=====================
+*/
+void CL_JitterSample (void)
+{
+	double	sample, late;
+
+	if (cl.mtime[0] == jb_lastmtime)
+		return;
+
+	sample = cl.mtime[0] - realtime;
+	if (!jb_lastmtime || fabs (sample - jb_offset) > 1)
+	{ // first update, or the server clock jumped
+		jb_offset = sample;
+		jb_jitter = 0;
+		jb_interval = 0.05;
+		jb_playout = 0;
+	}
+	else
+	{
+		jb_interval += (CLAMP (0.01, cl.mtime[0] - jb_lastmtime, 0.1) - jb_interval) * 0.1;
+		late = jb_offset - sample;
+		jb_offset += (sample - jb_offset) * (late < 0 ? 0.5 : 0.02);
+		jb_jitter += (fabs (late) - jb_jitter) * 0.1;
+		jb_lateness[jb_numsamples++ & (CL_NETGRAPH_SAMPLES - 1)] = late;
+	}
+	jb_lastmtime = cl.mtime[0];
+}
+
+/*
+=====================
+CL_PlayoutTime
+
+Advances the playout time by the frame, steering it by at most half the
+frame time towards where the clock estimate says it should be.
+Returns 0 if entities should be lerped between the last two messages.
+=====================
+*/
+static double CL_PlayoutTime (void)
+{
+	double	target, err, step;
+
+	if (!cl_jitterbuffer.value || cl_nolerp.value || sv.active || cls.demoplayback || !jb_lastmtime)
+	{
+		jb_playout = 0;
+		return 0;
+	}
+
+	target = realtime + jb_offset - q_min (jb_interval + 2 * jb_jitter, 0.3);
+	err = target - (jb_playout + host_frametime);
+	if (!jb_playout || fabs (err) > 0.25)
+		jb_playout = target;
+	else
+	{
+		step = host_frametime * 0.5;
+		jb_playout += host_frametime + CLAMP (-step, err * 0.1, step);
+	}
+
+	return jb_playout;
+}
+
+/*
+=====================
+CL_PlaySnapshots
+
+Places ent at time along the states it was sent in, false if there
+aren't enough of them.
+=====================
+*/
+static qboolean CL_PlaySnapshots (int num, entity_t *ent, double time)
+{
+	clsnapshots_t	*h = &cl_snapshots[num];
+	clsnapshot_t	*from, *to;
+	float		f, d;
+	int		i, j, first;
+
+	if (h->count < 2)
+		return false;
+	if (r_lerpmove.value && (ent->lerpflags & LERP_MOVESTEP))
+		return false;	// r_lerpmove does these
+
+	first = q_max (h->count - CL_SNAPSHOTS, 0);
+	for (i = h->count - 1; i > first; i--)
+	{
+		if (h->snaps[(i - 1) & (CL_SNAPSHOTS - 1)].time <= time)
+			break;
+	}
+	from = &h->snaps[(i - 1) & (CL_SNAPSHOTS - 1)];
+	to = &h->snaps[i & (CL_SNAPSHOTS - 1)];
+	if (to->time <= from->time)
+		return false;
+
+	f = (time - from->time) / (to->time - from->time);
+	if (f < 0)
+		f = 0;
+	else if (f > 1)
+	{ // ran out of states, carry on along the last move for a bit
+		f = 1 + q_min (time - to->time, cl_extrapolate.value) / (to->time - from->time);
+		jb_extrapolated++;
+	}
+
+	for (j = 0; j < 3; j++)
+	{
+		ent->origin[j] = from->origin[j] + f * (to->origin[j] - from->origin[j]);
+
+		d = to->angles[j] - from->angles[j];
+		if (d > 180)
+			d -= 360;
+		else if (d < -180)
+			d += 360;
+		ent->angles[j] = from->angles[j] + q_min (f, 1) * d;
+	}
+
+	return true;
+}
+
+/*
+=====================
+CL_NetGraph
+
+For the netgraph overlay: copies up to max arrival latenesses, oldest
+first, and returns how many there were.
+=====================
+*/
+int CL_NetGraph (float *lateness, int max, float *delay, float *jitter, int *extrapolated)
+{
+	int	i, n;
+
+	n = q_min (q_min (jb_numsamples, CL_NETGRAPH_SAMPLES), max);
+	for (i = 0; i < n; i++)
+		lateness[i] = jb_lateness[(jb_numsamples - n + i) & (CL_NETGRAPH_SAMPLES - 1)];
+	*delay = jb_playout ? q_min (jb_interval + 2 * jb_jitter, 0.3) : 0;
+	*jitter = jb_jitter;
+	*extrapolated = jb_extrapolated;
+	return n;
+}
+
+/*
+=====================
+CL_ActivateEntity
+
+Called whenever an entity gets a new state, puts it on the list
+CL_RelinkEntities walks.
+=====================
+*/
+void CL_ActivateEntity (int num)
+{
+	if (num < 1 || num >= cl_max_edicts || cl_entactive[num])
+		return;
+	cl_entactive[num] = true;
+	if (cl_numactiveents && cl_activeents[cl_numactiveents - 1] > num)
+		cl_activeunsorted = true;
+	cl_activeents[cl_numactiveents++] = num;
+}
+
+/*
+=====================
+CL_RebuildActiveEntities
+
+For when cl_entities was overwritten wholesale, like a demo seek.
+=====================
+*/
+void CL_RebuildActiveEntities (void)
+{
+	int	i;
+
+	memset (cl_entactive, 0, cl_max_edicts);
+	cl_numactiveents = 0;
+	cl_activeunsorted = false;
+	for (i = 1; i < cl.num_entities; i++)
+	{
+		if (cl_entities[i].model)
+			CL_ActivateEntity (i);
+	}
+}
+
+static int CL_ActiveEntCompare (const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
 }
 
 /*
@@ -133,6 +477,7 @@ void CL_Disconnect (void)
 
 	cls.demoplayback = cls.timedemo = false;
 	cls.demopaused = false;
+	cls.demoseeking = false;
 	cls.signon = 0;
 	cl.intermission = 0;
 }
@@ -408,8 +753,9 @@ CL_RelinkEntities
 void CL_RelinkEntities (void)
 {
 	entity_t	*ent;
-	int			i, j;
+	int			i, j, k, numactive;
 	float		frac, f, d;
+	double		playout;
 	vec3_t		delta;
 	float		bobjrotate;
 	vec3_t		oldorg;
@@ -417,6 +763,8 @@ void CL_RelinkEntities (void)
 
 // determine partial update time
 	frac = CL_LerpPoint ();
+	playout = CL_PlayoutTime ();
+	jb_extrapolated = 0;
 
 	cl_numvisedicts = 0;
 
@@ -443,9 +791,18 @@ void CL_RelinkEntities (void)
 
 	bobjrotate = anglemod(100*cl.time);
 
-// start on the entity after the world
-	for (i=1,ent=cl_entities+1 ; i<cl.num_entities ; i++,ent++)
+// walk the slots in use in index order, as the visedicts were always built
+	if (cl_activeunsorted)
+	{
+		qsort (cl_activeents, cl_numactiveents, sizeof(int), CL_ActiveEntCompare);
+		cl_activeunsorted = false;
+	}
+
+	for (k=0, numactive=0 ; k<cl_numactiveents ; k++)
 	{
+		i = cl_activeents[k];
+		ent = &cl_entities[i];
+
 		if (!ent->model)
 		{	// empty slot
 			
@@ -453,6 +810,7 @@ void CL_RelinkEntities (void)
 			// ent can't be static, so this is a no-op.
 			//if (ent->forcelink)
 			//	R_RemoveEfrags (ent);	// just became empty
+			cl_entactive[i] = false;
 			continue;
 		}
 
@@ -461,12 +819,18 @@ void CL_RelinkEntities (void)
 		{
 			ent->model = NULL;
 			ent->lerpflags |= LERP_RESETMOVE|LERP_RESETANIM; //johnfitz -- next time this entity slot is reused, the lerp will need to be reset
+			cl_entactive[i] = false;
 			continue;
 		}
 
+		cl_activeents[numactive++] = i;
+
 		VectorCopy (ent->origin, oldorg);
 
-		if (ent->forcelink)
+		if (playout && i != cl.viewentity && CL_PlaySnapshots (i, ent, playout))
+		{	// placed by the jitter buffer, which bridges lost updates too
+		}
+		else if (ent->forcelink)
 		{	// the entity was not updated in the last message
 			// so move to the final spot
 			VectorCopy (ent->msg_origins[0], ent->origin);
@@ -603,6 +967,7 @@ void CL_RelinkEntities (void)
 			cl_numvisedicts++;
 		}
 	}
+	cl_numactiveents = numactive;
 }
 
 
@@ -643,6 +1008,7 @@ int CL_ReadFromServer (void)
 		Con_Printf ("\n");
 
 	CL_RelinkEntities ();
+	CL_PredictMove ();
 	CL_UpdateTEnts ();
 
 //johnfitz -- devstats
@@ -797,6 +1163,7 @@ void CL_Init (void)
 
 	CL_InitInput ();
 	CL_InitTEnts ();
+	CL_InitPrediction ();
 
 	Cvar_RegisterVariable (&cl_name);
 	Cvar_RegisterVariable (&cl_color);
@@ -810,11 +1177,15 @@ void CL_Init (void)
 	Cvar_RegisterVariable (&cl_anglespeedkey);
 	Cvar_RegisterVariable (&cl_shownet);
 	Cvar_RegisterVariable (&cl_nolerp);
+	Cvar_RegisterVariable (&cl_jitterbuffer);
+	Cvar_RegisterVariable (&cl_extrapolate);
+	Cvar_RegisterVariable (&cl_netgraph);
 	Cvar_RegisterVariable (&lookspring);
 	Cvar_RegisterVariable (&lookstrafe);
 	Cvar_RegisterVariable (&sensitivity);
 	
 	Cvar_RegisterVariable (&cl_alwaysrun);
+	Cvar_RegisterVariable (&cl_moveredundancy);
 
 	Cvar_RegisterVariable (&m_pitch);
 	Cvar_RegisterVariable (&m_yaw);
@@ -827,6 +1198,7 @@ void CL_Init (void)
 	Cvar_RegisterVariable (&cl_minpitch); //johnfitz -- variable pitch clamping
 
 	Cvar_RegisterVariable (&cl_startdemos);
+	Cvar_RegisterVariable (&cl_demokeyframe);
 
 	Cmd_AddCommand ("entities", CL_PrintEntities_f);
 	Cmd_AddCommand ("disconnect", CL_Disconnect_f);
@@ -834,6 +1206,8 @@ void CL_Init (void)
 	Cmd_AddCommand ("stop", CL_Stop_f);
 	Cmd_AddCommand ("playdemo", CL_PlayDemo_f);
 	Cmd_AddCommand ("timedemo", CL_TimeDemo_f);
+	Cmd_AddCommand ("demoseek", CL_DemoSeek_f);
+	Cmd_AddCommand ("benchmark", CL_Benchmark_f);
 
 	Cmd_AddCommand ("tracepos", CL_Tracepos_f); //johnfitz
 	Cmd_AddCommand ("viewpos", CL_Viewpos_f); //johnfitz
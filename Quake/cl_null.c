@@ -0,0 +1,192 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cl_null.c -- client stubs for the headless dedicated server ("make dedicated")
+
+// The shared code only reaches the client, video, sound and input through
+// cls.state != ca_dedicated or !isDedicated checks, so none of these run.
+// They stand in for the client objects so the server links without GL,
+// the sound drivers and the music codecs.
+
+#include "quakedef.h"
+#include "bgmusic.h"
+
+client_static_t	cls;
+client_state_t	cl;
+
+// same initial values the client has before registering them
+cvar_t	cl_name = {"_cl_name", "player", CVAR_ARCHIVE};
+cvar_t	cl_color = {"_cl_color", "0", CVAR_ARCHIVE};
+cvar_t	cl_startdemos = {"cl_startdemos", "1", CVAR_ARCHIVE};
+cvar_t	gl_subdivide_size = {"gl_subdivide_size", "128", CVAR_ARCHIVE};
+cvar_t	r_nolerp_list = {"r_nolerp_list", "progs/flame.mdl,progs/flame2.mdl,progs/braztall.mdl,progs/brazshrt.mdl,progs/longtrch.mdl,progs/flame_pyre.mdl,progs/v_saw.mdl,progs/v_xfist.mdl,progs/h2stuff/newfire.mdl", CVAR_NONE};
+cvar_t	r_noshadow_list = {"r_noshadow_list", "progs/flame2.mdl,progs/flame.mdl,progs/bolt1.mdl,progs/bolt2.mdl,progs/bolt3.mdl,progs/laser.mdl", CVAR_NONE};
+
+kbutton_t	in_mlook;
+
+keydest_t	key_dest;
+char		key_lines[CMDLINES][MAXCMDLINE];
+int		edit_line;
+int		history_line;
+int		key_linepos;
+int		key_insert;
+double		key_blinktime;
+qboolean	chat_team;
+qboolean	keydown[MAX_KEYS];
+
+enum m_state_e	m_state;
+enum m_state_e	m_return_state;
+qboolean	m_return_onerror;
+char		m_return_reason[32];
+
+viddef_t	vid;
+modestate_t	modestate = MS_UNINIT;
+int		glx, gly, glwidth, glheight;
+int		clearnotify;
+qboolean	scr_disabled_for_loading;
+double		scr_swaptime;
+float		scr_centertime_off;
+int		scr_tileclear_updates;
+qpic_t		*pic_ovr, *pic_ins;
+vec3_t		r_origin, vpn, vright, vup;
+unsigned int	d_8to24table[256];
+int		gl_warpimagesize;
+int		gl_memory[GLMEM_NUMTYPES];
+
+//
+// client
+//
+void CL_Init (void) {}
+void CL_Disconnect (void) {}
+void CL_Disconnect_f (void) {}
+void CL_EstablishConnection (const char *host) {}
+void CL_NextDemo (void) {}
+int  CL_ReadFromServer (void) { return 0; }
+void CL_SendCmd (void) {}
+void CL_StopPlayback (void) {}
+void CL_DecayLights (void) {}
+void CL_RunParticles (void) {}
+void CL_BenchmarkFrame (double update, double server, double render, double swap, double sound) {}
+void Chase_Init (void) {}
+void V_Init (void) {}
+void Sbar_Init (void) {}
+
+// cl_rollangle is never registered on a dedicated server, so the real
+// V_CalcRoll always gives 0 there too
+float V_CalcRoll (vec3_t angles, vec3_t velocity)
+{
+	return 0;
+}
+
+//
+// keys and menu
+//
+void Key_Init (void) {}
+void Key_WriteBindings (FILE *f) {}
+void Key_UpdateForDest (void) {}
+void Key_BeginInputGrab (void) {}
+void Key_EndInputGrab (void) {}
+void Key_GetGrabbedInput (int *lastkey, int *lastchar)
+{
+	*lastkey = 0;
+	*lastchar = 0;
+}
+const char *Key_GetChatBuffer (void) { return ""; }
+int Key_GetChatMsgLen (void) { return 0; }
+void History_Shutdown (void) {}
+void M_Init (void) {}
+void M_Menu_Main_f (void) {}
+void M_Menu_Quit_f (void) {}
+void M_NoteSavegame (const char *path, const char *comment) {}
+
+//
+// video and input
+//
+void VID_Init (void) {}
+void VID_Shutdown (void) {}
+void VID_Lock (void) {}
+void *VID_GetWindow (void) { return NULL; }
+void IN_Init (void) {}
+void IN_Shutdown (void) {}
+void IN_Commands (void) {}
+void IN_SendKeyEvents (void) {}
+void IN_Activate (void) {}
+void IN_Deactivate (qboolean free_cursor) {}
+void IN_UpdateInputMode (void) {}
+
+//
+// rendering
+//
+void R_Init (void) {}
+void R_NewGame (void) {}
+const char *R_LightmapKernelsName (void) { return "none"; }
+void D_FlushCaches (void) {}
+void SCR_Init (void) {}
+void SCR_UpdateScreen (void) {}
+void SCR_BeginLoadingPlaque (void) {}
+void SCR_EndLoadingPlaque (void) {}
+void SCR_CaptureFinish (void) {}
+void Draw_Init (void) {}
+void Draw_NewGame (void) {}
+void Draw_Character (int x, int y, int num) {}
+void Draw_String (int x, int y, const char *str) {}
+void Draw_Pic (int x, int y, qpic_t *pic) {}
+void Draw_ConsoleBackground (void) {}
+void GL_SetCanvas (canvastype newcanvas) {}
+void Sky_ClearAll (void) {}
+void Sky_LoadTexture (texture_t *mt) {}
+void Sky_LoadTextureQ64 (texture_t *mt) {}
+
+// the model loader still builds what the server needs, it just skips
+// the render-only parts
+void GL_SubdivideSurface (msurface_t *fa) {}
+void GL_MakeAliasModelDisplayLists (qmodel_t *m, aliashdr_t *hdr) {}
+void GLMesh_DeleteVertexBuffers (void) {}
+void TexMgr_Init (void) {}
+void TexMgr_NewGame (void) {}
+void TexMgr_BeginBatch (void) {}
+void TexMgr_EndBatch (void) {}
+void TexMgr_FreeTexturesForOwner (qmodel_t *owner) {}
+void TexMgr_FreeLightmapsForOwner (qmodel_t *owner) {}
+int TexMgr_PadConditional (int s) { return s; }
+double TexMgr_MemoryUsed (void) { return 0; }
+gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int height, enum srcformat format,
+			       byte *data, const char *source_file, src_offset_t source_offset, unsigned flags)
+{
+	return NULL;
+}
+byte *Image_LoadImage (const char *name, int *width, int *height) { return NULL; }
+qboolean Image_Prefetch (const char *name) { return false; }
+void Image_FlushPrefetch (void) {}
+
+//
+// sound and music
+//
+void S_Init (void) {}
+void S_Shutdown (void) {}
+void S_FinishStartup (void) {}
+void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up) {}
+void S_LocalSound (const char *name) {}
+qboolean S_GetMemoryStats (int *current, int *peak) { *current = *peak = 0; return false; }
+const char *SND_MixKernelsName (void) { return "none"; }
+qboolean BGM_Init (void) { return false; }
+void BGM_Shutdown (void) {}
+void BGM_Update (void) {}
+void BGM_PrefetchCDtrack (byte track) {}
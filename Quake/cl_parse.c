@@ -80,7 +80,7 @@ const char *svc_strings[] =
 	"svc_spawnbaseline2", //42			// support for large modelindex, large framenum, alpha, using flags
 	"svc_spawnstatic2", // 43			// support for large modelindex, large framenum, alpha, using flags
 	"svc_spawnstaticsound2", //	44		// [coord3] [short] samp [byte] vol [byte] aten
-	"", // 45
+	"svc_entityframe", // 45			// [long] frame [long] reference frame
 	"", // 46
 	"", // 47
 	"", // 48
@@ -118,6 +118,7 @@ entity_t	*CL_EntityNum (int num)
 	{
 		if (num >= cl_max_edicts) //johnfitz -- no more MAX_EDICTS
 			Host_Error ("CL_EntityNum: %i is an invalid number",num);
+		CL_GrowEntities (num);
 		while (cl.num_entities<=num)
 		{
 			cl_entities[cl.num_entities].colormap = vid.colormap;
@@ -253,6 +254,179 @@ void CL_KeepaliveMessage (void)
 	SZ_Clear (&cls.message);
 }
 
+static entframe_t	cl_entframes[ENTFRAMES];	// PROTOCOL_DELTA
+static int			cl_entframeseq;		// frame being parsed, 0 = none
+static int			cl_entframerefseq;
+static entframe_t	*cl_entframe;		// where it goes, NULL if it can't be kept
+static entframe_t	*cl_entframeref;	// what it is a change from, NULL = baselines
+static int			cl_entframemark;
+static int			cl_entframeseen[MAX_EDICTS];	// cl_entframemark of the last frame that mentioned each entity
+
+/*
+==================
+CL_ResetEntFrames
+==================
+*/
+static void CL_ResetEntFrames (void)
+{
+	int		i;
+
+	for (i = 0; i < ENTFRAMES; i++)
+	{
+		cl_entframes[i].sequence = 0;
+		cl_entframes[i].numents = 0;
+	}
+	cl_entframeseq = 0;
+	cl_entframe = cl_entframeref = NULL;
+}
+
+/*
+==================
+CL_EntFrameAdd
+==================
+*/
+static entframeent_t *CL_EntFrameAdd (entframe_t *frame)
+{
+	if (frame->numents == frame->maxents)
+	{
+		frame->maxents = frame->maxents ? frame->maxents * 2 : 64;
+		frame->ents = (entframeent_t *) realloc (frame->ents, frame->maxents * sizeof(entframeent_t));
+		if (!frame->ents)
+			Sys_Error ("CL_EntFrameAdd: out of memory");
+	}
+
+	return &frame->ents[frame->numents++];
+}
+
+/*
+==================
+CL_SaveEntFrames
+
+Copies the PROTOCOL_DELTA frames aside for a demo keyframe.
+A frame that can't be copied is left out, updates against it are dropped.
+==================
+*/
+void CL_SaveEntFrames (entframe_t *frames)
+{
+	int		i;
+
+	for (i = 0; i < ENTFRAMES; i++)
+	{
+		frames[i] = cl_entframes[i];
+		frames[i].maxents = frames[i].numents;
+		frames[i].ents = NULL;
+		if (!frames[i].numents)
+			continue;
+		frames[i].ents = (entframeent_t *) malloc (frames[i].numents * sizeof(entframeent_t));
+		if (!frames[i].ents)
+		{
+			frames[i].sequence = 0;
+			frames[i].numents = frames[i].maxents = 0;
+			continue;
+		}
+		memcpy (frames[i].ents, cl_entframes[i].ents, frames[i].numents * sizeof(entframeent_t));
+	}
+}
+
+void CL_RestoreEntFrames (const entframe_t *frames)
+{
+	int		i, j;
+
+	CL_ResetEntFrames ();
+	for (i = 0; i < ENTFRAMES; i++)
+	{
+		for (j = 0; j < frames[i].numents; j++)
+			*CL_EntFrameAdd (&cl_entframes[i]) = frames[i].ents[j];
+		cl_entframes[i].sequence = frames[i].sequence;
+	}
+}
+
+void CL_FreeEntFrames (entframe_t *frames)
+{
+	int		i;
+
+	for (i = 0; i < ENTFRAMES; i++)
+	{
+		free (frames[i].ents);
+		frames[i].ents = NULL;
+		frames[i].numents = frames[i].maxents = 0;
+	}
+}
+
+/*
+==================
+CL_EntFrameFind
+
+Binary search, frames are sorted by entity number
+==================
+*/
+static entframeent_t *CL_EntFrameFind (entframe_t *frame, int num)
+{
+	int		lo, hi, mid;
+
+	lo = 0;
+	hi = frame->numents - 1;
+	while (lo <= hi)
+	{
+		mid = (lo + hi) >> 1;
+		if (frame->ents[mid].num == num)
+			return &frame->ents[mid];
+		if (frame->ents[mid].num < num)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return NULL;
+}
+
+static int CL_EntFrameCompare (const void *a, const void *b)
+{
+	return ((const entframeent_t *)a)->num - ((const entframeent_t *)b)->num;
+}
+
+/*
+==================
+Entity update decoding
+
+The field encodings only change with the protocol, so the readers are
+picked once when the server info arrives.  CL_ParseUpdate works out how
+long the fields after the bits are, checks the bounds once and decodes
+them straight from the message.
+==================
+*/
+typedef struct
+{
+	msgcodec_t	codec;
+	qboolean	fitzbits;	// U_EXTEND1, U_EXTEND2 and their fields
+} updatedecoder_t;
+
+static updatedecoder_t	cl_updatedecoder;
+
+/*
+==================
+CL_SetUpdateDecoder
+
+Called once cl.protocol and cl.protocolflags are known.
+==================
+*/
+static void CL_SetUpdateDecoder (void)
+{
+	updatedecoder_t	*d = &cl_updatedecoder;
+
+	MSG_InitCodec (&d->codec, cl.protocolflags);
+	d->fitzbits = (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ || cl.protocol == PROTOCOL_DELTA);
+}
+
+static int CL_CountBits (int bits)
+{
+	int	n;
+
+	for (n = 0; bits; n++)
+		bits &= bits - 1;
+	return n;
+}
+
 /*
 ==================
 CL_ParseServerInfo
@@ -281,13 +455,17 @@ void CL_ParseServerInfo (void)
 // parse protocol version number
 	i = MSG_ReadLong ();
 	//johnfitz -- support multiple protocols
-	if (i != PROTOCOL_NETQUAKE && i != PROTOCOL_FITZQUAKE && i != PROTOCOL_RMQ) {
+	if (i != PROTOCOL_NETQUAKE && i != PROTOCOL_FITZQUAKE && i != PROTOCOL_RMQ && i != PROTOCOL_DELTA) {
 		Con_Printf ("\n"); //because there's no newline after serverinfo print
-		Host_Error ("Server returned version %i, not %i or %i or %i", i, PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ);
+		Host_Error ("Server returned version %i, not %i or %i or %i or %i", i, PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ, PROTOCOL_DELTA);
 	}
 	cl.protocol = i;
 	//johnfitz
 
+	CL_ResetEntFrames ();
+	if (cls.demoplayback)
+		CL_DemoNewMap ();
+
 	if (cl.protocol == PROTOCOL_RMQ)
 	{
 		const unsigned int supportedflags = (PRFL_SHORTANGLE | PRFL_FLOATANGLE | PRFL_24BITCOORD | PRFL_FLOATCOORD | PRFL_EDICTSCALE | PRFL_INT32COORD);
@@ -301,6 +479,7 @@ void CL_ParseServerInfo (void)
 		}
 	}
 	else cl.protocolflags = 0;
+	CL_SetUpdateDecoder ();
 	
 // parse maxclients
 	cl.maxclients = MSG_ReadByte ();
@@ -309,6 +488,7 @@ void CL_ParseServerInfo (void)
 		Host_Error ("Bad maxclients (%u) from server", cl.maxclients);
 	}
 	cl.scores = (scoreboard_t *) Hunk_AllocName (cl.maxclients*sizeof(*cl.scores), "scores");
+	CL_GrowEntities (cl.maxclients);	// player slots are looked at before they arrive
 
 // parse gametype
 	cl.gametype = MSG_ReadByte ();
@@ -375,6 +555,11 @@ void CL_ParseServerInfo (void)
 	// copy the naked name of the map file to the cl structure -- O.S
 	COM_StripExtension (COM_SkipPath(model_precache[1]), cl.mapname, sizeof(cl.mapname));
 
+	// read the files ahead on the task workers, parsing stays in order here
+	Mod_FlushPrefetch ();
+	for (i = 1; i < nummodels; i++)
+		Mod_Prefetch (model_precache[i]);
+
 	for (i = 1; i < nummodels; i++)
 	{
 		cl.model_precache[i] = Mod_ForName (model_precache[i], false);
@@ -384,6 +569,7 @@ void CL_ParseServerInfo (void)
 		}
 		CL_KeepaliveMessage ();
 	}
+	Mod_FlushPrefetch ();
 
 	S_BeginPrecaching ();
 	for (i = 1; i < numsounds; i++)
@@ -415,6 +601,203 @@ void CL_ParseServerInfo (void)
 	memset(&dev_overflows, 0, sizeof(dev_overflows));
 }
 
+/*
+==================
+CL_UpdateEntity
+
+Applies a new state to an entity, whether it was in the message or not
+==================
+*/
+static void CL_UpdateEntity (entity_t *ent, int num, const entity_state_t *state, int bits, float lerpfinish)
+{
+	int		i;
+	qmodel_t	*model;
+	qboolean	forcelink, resetsnaps;
+
+	if (ent->msgtime != cl.mtime[1])
+		forcelink = true;	// no previous frame to lerp from
+	else
+		forcelink = false;
+
+	resetsnaps = ent->msgtime + 0.5 < cl.mtime[0];	// a few lost packets can be bridged
+
+	//johnfitz -- lerping
+	if (ent->msgtime + 0.2 < cl.mtime[0]) //more than 0.2 seconds since the last message (most entities think every 0.1 sec)
+		ent->lerpflags |= LERP_RESETANIM; //if we missed a think, we'd be lerping from the wrong frame
+	//johnfitz
+
+	ent->msgtime = cl.mtime[0];
+	CL_ActivateEntity (num);
+
+	if (state->modelindex >= MAX_MODELS)
+		Host_Error ("CL_ParseModel: bad modnum");
+
+	ent->frame = state->frame;
+
+	i = state->colormap;
+	if (!i)
+		ent->colormap = vid.colormap;
+	else
+	{
+		if (i > cl.maxclients)
+			Sys_Error ("i >= cl.maxclients");
+		ent->colormap = cl.scores[i-1].translations;
+	}
+	if (state->skin != ent->skinnum)
+	{
+		ent->skinnum = state->skin;
+		if (num > 0 && num <= cl.maxclients)
+			R_TranslateNewPlayerSkin (num - 1); //johnfitz -- was R_TranslatePlayerSkin
+	}
+	ent->effects = state->effects;
+
+// shift the known values for interpolation
+	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
+	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
+
+	VectorCopy (state->origin, ent->msg_origins[0]);
+	VectorCopy (state->angles, ent->msg_angles[0]);
+	CL_SaveSnapshot (num, ent, resetsnaps);
+
+	//johnfitz -- lerping for movetype_step entities
+	if (bits & U_STEP)
+	{
+		ent->lerpflags |= LERP_MOVESTEP;
+		ent->forcelink = true;
+	}
+	else
+		ent->lerpflags &= ~LERP_MOVESTEP;
+	//johnfitz
+
+	ent->alpha = state->alpha;
+
+	if (bits & U_LERPFINISH)
+	{
+		ent->lerpfinish = ent->msgtime + lerpfinish;
+		ent->lerpflags |= LERP_FINISH;
+	}
+	else
+		ent->lerpflags &= ~LERP_FINISH;
+
+	//johnfitz -- moved here from above
+	model = cl.model_precache[state->modelindex];
+	if (model != ent->model)
+	{
+		ent->model = model;
+	// automatic animation (torches, etc) can be either all together
+	// or randomized
+		if (model)
+		{
+			if (model->synctype == ST_RAND)
+				ent->syncbase = (float)(rand()&0x7fff) / 0x7fff;
+			else
+				ent->syncbase = 0.0;
+		}
+		else
+			forcelink = true;	// hack to make null model players work
+		if (num > 0 && num <= cl.maxclients)
+			R_TranslateNewPlayerSkin (num - 1); //johnfitz -- was R_TranslatePlayerSkin
+
+		ent->lerpflags |= LERP_RESETANIM; //johnfitz -- don't lerp animation across model changes
+	}
+	//johnfitz
+
+	if ( forcelink )
+	{	// didn't have an update last message
+		VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
+		VectorCopy (ent->msg_origins[0], ent->origin);
+		VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
+		VectorCopy (ent->msg_angles[0], ent->angles);
+		ent->forcelink = true;
+	}
+}
+
+/*
+==================
+CL_ParseEntityFrame
+
+PROTOCOL_DELTA: the entity updates that follow are changes from the reference frame
+==================
+*/
+static void CL_ParseEntityFrame (void)
+{
+	int		seq, refseq;
+
+	seq = MSG_ReadLong ();
+	refseq = MSG_ReadLong ();
+
+	if (cl.protocol != PROTOCOL_DELTA)
+		Host_Error ("CL_ParseEntityFrame: svc_entityframe in protocol %i", cl.protocol);
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	cl_entframeseq = seq;
+	cl_entframerefseq = refseq;
+	cl_entframemark++;
+	cl_entframe = &cl_entframes[seq & (ENTFRAMES - 1)];
+	cl_entframeref = NULL;
+	if (refseq)
+	{
+		cl_entframeref = &cl_entframes[refseq & (ENTFRAMES - 1)];
+		if (seq - refseq <= 0 || seq - refseq >= ENTFRAMES || cl_entframeref->sequence != refseq)
+		{ // don't have it, parse against the baselines and keep what's in the ring
+			Con_DPrintf ("entity frame %i: missing reference frame %i\n", seq, refseq);
+			cl_entframe = cl_entframeref = NULL;
+			return;
+		}
+	}
+
+	cl_entframe->sequence = 0;
+	cl_entframe->numents = 0;
+}
+
+/*
+==================
+CL_FinishEntityFrame
+
+Called at the end of each message.  Entities of the reference frame that
+weren't mentioned are still there unchanged.
+==================
+*/
+static void CL_FinishEntityFrame (void)
+{
+	entframeent_t	*refent;
+	int				i;
+
+	if (!cl_entframeseq)
+		return;
+
+	if (cl_entframeref)
+	{
+		for (i = 0, refent = cl_entframeref->ents; i < cl_entframeref->numents; i++, refent++)
+		{
+			if (cl_entframeseen[refent->num] == cl_entframemark)
+				continue;
+			CL_UpdateEntity (CL_EntityNum (refent->num), refent->num, &refent->state, refent->bits, 0);
+			*CL_EntFrameAdd (cl_entframe) = *refent;
+		}
+	}
+
+	if (cl_entframe)
+	{
+		qsort (cl_entframe->ents, cl_entframe->numents, sizeof(entframeent_t), CL_EntFrameCompare);
+		cl_entframe->sequence = cl_entframeseq;
+
+		// while recording a demo started mid-game, wait for one from the baselines
+		if (!cl_entframerefseq)
+			cl.entframerestart = false;
+		if (!cl.entframerestart)
+			cl.entframeack = cl_entframeseq;
+	}
+
+	cl_entframeseq = 0;
+	cl_entframe = cl_entframeref = NULL;
+}
+
 /*
 ==================
 CL_ParseUpdate
@@ -427,12 +810,15 @@ relinked.  Other attributes can change without relinking.
 void CL_ParseUpdate (int bits)
 {
 	int		i;
-	qmodel_t	*model;
-	int		modnum;
-	qboolean	forcelink;
 	entity_t	*ent;
 	int		num;
-	int		skin;
+	entity_state_t	state;
+	entframeent_t	*refent, *rec;
+	float	lerpfinish;
+	const updatedecoder_t	*d = &cl_updatedecoder;
+	const msgcodec_t	*c = &d->codec;
+	const byte	*p;
+	int		size;
 
 	if (cls.signon == SIGNONS - 1)
 	{	// first update is the final signon stage
@@ -447,7 +833,7 @@ void CL_ParseUpdate (int bits)
 	}
 
 	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
+	if (d->fitzbits)
 	{
 		if (bits & U_EXTEND1)
 			bits |= MSG_ReadByte() << 16;
@@ -461,122 +847,67 @@ void CL_ParseUpdate (int bits)
 	else
 		num = MSG_ReadByte ();
 
-	ent = CL_EntityNum (num);
+	if (cl_entframeseq && (bits & U_REMOVE))
+	{ // gone since the reference frame, it won't be carried over
+		if (num < 0 || num >= cl_max_edicts)
+			Host_Error ("CL_ParseUpdate: %i is an invalid number", num);
+		cl_entframeseen[num] = cl_entframemark;
+		return;
+	}
 
-	if (ent->msgtime != cl.mtime[1])
-		forcelink = true;	// no previous frame to lerp from
-	else
-		forcelink = false;
+	ent = CL_EntityNum (num);
 
-	//johnfitz -- lerping
-	if (ent->msgtime + 0.2 < cl.mtime[0]) //more than 0.2 seconds since the last message (most entities think every 0.1 sec)
-		ent->lerpflags |= LERP_RESETANIM; //if we missed a think, we'd be lerping from the wrong frame
-	//johnfitz
+	// fields that aren't sent are the same as in the reference frame, or the baseline
+	refent = cl_entframeref ? CL_EntFrameFind (cl_entframeref, num) : NULL;
+	state = refent ? refent->state : ent->baseline;
+	lerpfinish = 0;
 
-	ent->msgtime = cl.mtime[0];
+	// every field up to the Nehahra ones has a fixed size
+	size = CL_CountBits (bits & (U_MODEL|U_FRAME|U_COLORMAP|U_SKIN|U_EFFECTS))
+		+ CL_CountBits (bits & (U_ORIGIN1|U_ORIGIN2|U_ORIGIN3)) * c->coordsize
+		+ CL_CountBits (bits & (U_ANGLE1|U_ANGLE2|U_ANGLE3)) * c->anglesize;
+	if (d->fitzbits)
+		size += CL_CountBits (bits & (U_ALPHA|U_SCALE|U_FRAME2|U_MODEL2|U_LERPFINISH));
+	if (!(p = MSG_ReadData (size)))
+		return;	// CL_ParseServerMessage reports it
 
 	if (bits & U_MODEL)
-	{
-		modnum = MSG_ReadByte ();
-		if (modnum >= MAX_MODELS)
-			Host_Error ("CL_ParseModel: bad modnum");
-	}
-	else
-		modnum = ent->baseline.modelindex;
-
+		state.modelindex = *p++;
 	if (bits & U_FRAME)
-		ent->frame = MSG_ReadByte ();
-	else
-		ent->frame = ent->baseline.frame;
-
+		state.frame = *p++;
 	if (bits & U_COLORMAP)
-		i = MSG_ReadByte();
-	else
-		i = ent->baseline.colormap;
-	if (!i)
-		ent->colormap = vid.colormap;
-	else
-	{
-		if (i > cl.maxclients)
-			Sys_Error ("i >= cl.maxclients");
-		ent->colormap = cl.scores[i-1].translations;
-	}
+		state.colormap = *p++;
 	if (bits & U_SKIN)
-		skin = MSG_ReadByte();
-	else
-		skin = ent->baseline.skin;
-	if (skin != ent->skinnum)
-	{
-		ent->skinnum = skin;
-		if (num > 0 && num <= cl.maxclients)
-			R_TranslateNewPlayerSkin (num - 1); //johnfitz -- was R_TranslatePlayerSkin
-	}
+		state.skin = *p++;
 	if (bits & U_EFFECTS)
-		ent->effects = MSG_ReadByte();
-	else
-		ent->effects = ent->baseline.effects;
-
-// shift the known values for interpolation
-	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
-	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
+		state.effects = *p++;
 
 	if (bits & U_ORIGIN1)
-		ent->msg_origins[0][0] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][0] = ent->baseline.origin[0];
+		state.origin[0] = c->readcoord (p), p += c->coordsize;
 	if (bits & U_ANGLE1)
-		ent->msg_angles[0][0] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][0] = ent->baseline.angles[0];
-
+		state.angles[0] = c->readangle (p), p += c->anglesize;
 	if (bits & U_ORIGIN2)
-		ent->msg_origins[0][1] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][1] = ent->baseline.origin[1];
+		state.origin[1] = c->readcoord (p), p += c->coordsize;
 	if (bits & U_ANGLE2)
-		ent->msg_angles[0][1] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][1] = ent->baseline.angles[1];
-
+		state.angles[1] = c->readangle (p), p += c->anglesize;
 	if (bits & U_ORIGIN3)
-		ent->msg_origins[0][2] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][2] = ent->baseline.origin[2];
+		state.origin[2] = c->readcoord (p), p += c->coordsize;
 	if (bits & U_ANGLE3)
-		ent->msg_angles[0][2] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][2] = ent->baseline.angles[2];
-
-	//johnfitz -- lerping for movetype_step entities
-	if (bits & U_STEP)
-	{
-		ent->lerpflags |= LERP_MOVESTEP;
-		ent->forcelink = true;
-	}
-	else
-		ent->lerpflags &= ~LERP_MOVESTEP;
-	//johnfitz
+		state.angles[2] = c->readangle (p), p += c->anglesize;
 
 	//johnfitz -- PROTOCOL_FITZQUAKE and PROTOCOL_NEHAHRA
-	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
+	if (d->fitzbits)
 	{
 		if (bits & U_ALPHA)
-			ent->alpha = MSG_ReadByte();
-		else
-			ent->alpha = ent->baseline.alpha;
+			state.alpha = *p++;
 		if (bits & U_SCALE)
-			MSG_ReadByte(); // PROTOCOL_RMQ: currently ignored
+			p++; // PROTOCOL_RMQ: currently ignored
 		if (bits & U_FRAME2)
-			ent->frame = (ent->frame & 0x00FF) | (MSG_ReadByte() << 8);
+			state.frame = (state.frame & 0x00FF) | (*p++ << 8);
 		if (bits & U_MODEL2)
-			modnum = (modnum & 0x00FF) | (MSG_ReadByte() << 8);
+			state.modelindex = (state.modelindex & 0x00FF) | (*p++ << 8);
 		if (bits & U_LERPFINISH)
-		{
-			ent->lerpfinish = ent->msgtime + ((float)(MSG_ReadByte()) / 255);
-			ent->lerpflags |= LERP_FINISH;
-		}
-		else
-			ent->lerpflags &= ~LERP_FINISH;
+			lerpfinish = (float)(*p++) / 255;
 	}
 	else if (cl.protocol == PROTOCOL_NETQUAKE)
 	{
@@ -595,43 +926,23 @@ void CL_ParseUpdate (int bits)
 			b = MSG_ReadFloat(); //alpha
 			if (a == 2)
 				MSG_ReadFloat(); //fullbright (not using this yet)
-			ent->alpha = ENTALPHA_ENCODE(b);
+			state.alpha = ENTALPHA_ENCODE(b);
 		}
-		else
-			ent->alpha = ent->baseline.alpha;
 	}
 	//johnfitz
 
-	//johnfitz -- moved here from above
-	model = cl.model_precache[modnum];
-	if (model != ent->model)
+	CL_UpdateEntity (ent, num, &state, bits, lerpfinish);
+
+	if (cl_entframeseq)
 	{
-		ent->model = model;
-	// automatic animation (torches, etc) can be either all together
-	// or randomized
-		if (model)
+		cl_entframeseen[num] = cl_entframemark;
+		if (cl_entframe)
 		{
-			if (model->synctype == ST_RAND)
-				ent->syncbase = (float)(rand()&0x7fff) / 0x7fff;
-			else
-				ent->syncbase = 0.0;
+			rec = CL_EntFrameAdd (cl_entframe);
+			rec->num = num;
+			rec->bits = bits & U_STEP;
+			rec->state = state;
 		}
-		else
-			forcelink = true;	// hack to make null model players work
-		if (num > 0 && num <= cl.maxclients)
-			R_TranslateNewPlayerSkin (num - 1); //johnfitz -- was R_TranslatePlayerSkin
-
-		ent->lerpflags |= LERP_RESETANIM; //johnfitz -- don't lerp animation across model changes
-	}
-	//johnfitz
-
-	if ( forcelink )
-	{	// didn't have an update last message
-		VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
-		VectorCopy (ent->msg_origins[0], ent->origin);
-		VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
-		VectorCopy (ent->msg_angles[0], ent->angles);
-		ent->forcelink = true;
 	}
 }
 
@@ -955,6 +1266,8 @@ void CL_ParseServerMessage (void)
 	else if (cl_shownet.value == 2)
 		Con_Printf ("------------------\n");
 
+	TRACE_BEGIN ("CL_ParseServerMessage");
+
 	cl.onground = false;	// unless the server says otherwise
 //
 // parse the message
@@ -972,6 +1285,8 @@ void CL_ParseServerMessage (void)
 		if (cmd == -1)
 		{
 			SHOWNET("END OF MESSAGE");
+			CL_FinishEntityFrame ();
+			TRACE_END ("CL_ParseServerMessage");
 			return;		// end of message
 		}
 
@@ -999,6 +1314,7 @@ void CL_ParseServerMessage (void)
 		case svc_time:
 			cl.mtime[1] = cl.mtime[0];
 			cl.mtime[0] = MSG_ReadFloat ();
+			CL_JitterSample ();
 			break;
 
 		case svc_clientdata:
@@ -1008,9 +1324,10 @@ void CL_ParseServerMessage (void)
 		case svc_version:
 			i = MSG_ReadLong ();
 			//johnfitz -- support multiple protocols
-			if (i != PROTOCOL_NETQUAKE && i != PROTOCOL_FITZQUAKE && i != PROTOCOL_RMQ)
-				Host_Error ("Server returned version %i, not %i or %i or %i", i, PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ);
+			if (i != PROTOCOL_NETQUAKE && i != PROTOCOL_FITZQUAKE && i != PROTOCOL_RMQ && i != PROTOCOL_DELTA)
+				Host_Error ("Server returned version %i, not %i or %i or %i or %i", i, PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ, PROTOCOL_DELTA);
 			cl.protocol = i;
+			CL_SetUpdateDecoder ();
 			//johnfitz
 			break;
 
@@ -1049,6 +1366,9 @@ void CL_ParseServerMessage (void)
 
 		case svc_setview:
 			cl.viewentity = MSG_ReadShort ();
+			if (cl.viewentity < 0 || cl.viewentity >= cl_max_edicts)
+				Host_Error ("CL_ParseServerMessage: svc_setview %i is an invalid number", cl.viewentity);
+			CL_GrowEntities (cl.viewentity);
 			break;
 
 		case svc_lightstyle:
@@ -1247,6 +1567,10 @@ void CL_ParseServerMessage (void)
 			break;
 		//johnfitz
 
+		case svc_entityframe: //PROTOCOL_DELTA
+			CL_ParseEntityFrame ();
+			break;
+
 		//used by the 2021 rerelease
 		case svc_achievement:
 			str = MSG_ReadString();
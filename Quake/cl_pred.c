@@ -0,0 +1,539 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cl_pred.c -- client side player movement prediction
+
+/*
+The server only ever sends where the player was, so on a remote server the
+view lags a whole round trip behind the input.  With cl_predict set, every
+frame starts again from the last origin and velocity the server sent and
+replays the moves the server can't have seen yet through a copy of the
+MOVETYPE_WALK physics in sv_user.c and sv_phys.c, clipped against the world
+hull only.  Nothing is sent that a vanilla server wouldn't expect: the
+round trip comes from the reliable acks of the connection, kept fresh with
+an occasional clc_nop.
+
+Brush entities (doors, lifts) and monsters aren't known here, so near them
+the prediction is wrong until the next update corrects it; corrections are
+eased in over cl_predict_smooth seconds instead of snapping the view.
+*/
+
+#include "quakedef.h"
+
+cvar_t	cl_predict = {"cl_predict", "0", CVAR_ARCHIVE};
+cvar_t	cl_predict_smooth = {"cl_predict_smooth", "0.1", CVAR_ARCHIVE};
+
+// the server's defaults, the client isn't told the real values
+#define	PRED_GRAVITY		800
+#define	PRED_MAXSPEED		320
+#define	PRED_FRICTION		4
+#define	PRED_EDGEFRICTION	2
+#define	PRED_STOPSPEED		100
+#define	PRED_ACCELERATE		10
+#define	PRED_JUMPSPEED		270	// PlayerJump in the progs
+#define	PRED_STEPSIZE		18
+#define	PRED_MAXSTEP		(1.0 / 72)	// longest physics step of a replay
+#define	PRED_PROBE		2.0	// seconds between latency probes
+
+#define	MAX_PRED_MOVES		256	// power of two
+
+typedef struct
+{
+	double		time;		// realtime when sent
+	usercmd_t	cmd;
+	qboolean	jump;
+} predmove_t;
+
+typedef struct
+{
+	vec3_t		origin;
+	vec3_t		velocity;
+	qboolean	onground;
+	qboolean	jumpreleased;
+} predstate_t;
+
+static predmove_t	pred_moves[MAX_PRED_MOVES];
+static int		pred_nummoves;		// total ever saved, the newest is pred_nummoves - 1
+
+static double		pred_mtime;		// server time of the update the replay starts from
+static predstate_t	pred_base;		// the player in that update
+static double		pred_recvtime;		// realtime it arrived
+static double		pred_lastprobe;
+static vec3_t		pred_error;		// correction still to be eased in
+static qboolean		pred_active;
+
+static const vec3_t	pred_mins = {-16, -16, -24};
+
+/*
+=================
+CL_PredTrace
+
+Clips a move of the player box against the world, points use hull 0.
+=================
+*/
+static trace_t CL_PredTrace (vec3_t start, vec3_t end, qboolean point)
+{
+	trace_t	trace;
+	hull_t	*hull;
+
+	memset (&trace, 0, sizeof(trace_t));
+	trace.fraction = 1;
+	trace.allsolid = true;
+	VectorCopy (end, trace.endpos);
+
+	hull = &cl.worldmodel->hulls[point ? 0 : 1];
+	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start, end, &trace);
+
+	return trace;
+}
+
+/*
+=================
+CL_PredFlyMove
+
+SV_FlyMove without the impacts, returns the same blocked flags.
+=================
+*/
+#define	MAX_CLIP_PLANES	5
+static int CL_PredFlyMove (predstate_t *ps, float time)
+{
+	int		bumpcount, numplanes, i, j, blocked;
+	vec3_t		dir, end, planes[MAX_CLIP_PLANES];
+	vec3_t		primal_velocity, original_velocity, new_velocity;
+	float		d, time_left;
+	trace_t		trace;
+
+	blocked = 0;
+	VectorCopy (ps->velocity, original_velocity);
+	VectorCopy (ps->velocity, primal_velocity);
+	numplanes = 0;
+	time_left = time;
+
+	for (bumpcount = 0; bumpcount < 4; bumpcount++)
+	{
+		if (!ps->velocity[0] && !ps->velocity[1] && !ps->velocity[2])
+			break;
+
+		for (i = 0; i < 3; i++)
+			end[i] = ps->origin[i] + time_left * ps->velocity[i];
+
+		trace = CL_PredTrace (ps->origin, end, false);
+
+		if (trace.allsolid)
+		{
+			VectorCopy (vec3_origin, ps->velocity);
+			return 3;
+		}
+
+		if (trace.fraction > 0)
+		{
+			VectorCopy (trace.endpos, ps->origin);
+			VectorCopy (ps->velocity, original_velocity);
+			numplanes = 0;
+		}
+
+		if (trace.fraction == 1)
+			break;
+
+		if (trace.plane.normal[2] > 0.7)
+		{
+			blocked |= 1;
+			ps->onground = true;
+		}
+		if (!trace.plane.normal[2])
+			blocked |= 2;
+
+		time_left -= time_left * trace.fraction;
+
+		if (numplanes >= MAX_CLIP_PLANES)
+		{
+			VectorCopy (vec3_origin, ps->velocity);
+			return 3;
+		}
+
+		VectorCopy (trace.plane.normal, planes[numplanes]);
+		numplanes++;
+
+		for (i = 0; i < numplanes; i++)
+		{
+			ClipVelocity (original_velocity, planes[i], new_velocity, 1);
+			for (j = 0; j < numplanes; j++)
+			{
+				if (j != i && DotProduct (new_velocity, planes[j]) < 0)
+					break;
+			}
+			if (j == numplanes)
+				break;
+		}
+
+		if (i != numplanes)
+		{
+			VectorCopy (new_velocity, ps->velocity);
+		}
+		else
+		{
+			if (numplanes != 2)
+			{
+				VectorCopy (vec3_origin, ps->velocity);
+				return 7;
+			}
+			CrossProduct (planes[0], planes[1], dir);
+			d = DotProduct (dir, ps->velocity);
+			VectorScale (dir, d, ps->velocity);
+		}
+
+		if (DotProduct (ps->velocity, primal_velocity) <= 0)
+		{
+			VectorCopy (vec3_origin, ps->velocity);
+			return blocked;
+		}
+	}
+
+	return blocked;
+}
+
+/*
+=================
+CL_PredWalkMove
+
+SV_WalkMove: slide, and step up when blocked by something low enough.
+=================
+*/
+static void CL_PredWalkMove (predstate_t *ps, float time)
+{
+	vec3_t		oldorg, oldvel, nosteporg, nostepvel, end;
+	qboolean	oldonground;
+	trace_t		trace;
+	int		clip;
+
+	oldonground = ps->onground;
+	ps->onground = false;
+
+	VectorCopy (ps->origin, oldorg);
+	VectorCopy (ps->velocity, oldvel);
+
+	clip = CL_PredFlyMove (ps, time);
+
+	if (!(clip & 2) || !oldonground)
+		return;
+
+	VectorCopy (ps->origin, nosteporg);
+	VectorCopy (ps->velocity, nostepvel);
+
+// move up
+	VectorCopy (oldorg, end);
+	end[2] += PRED_STEPSIZE;
+	trace = CL_PredTrace (oldorg, end, false);
+	VectorCopy (trace.endpos, ps->origin);
+
+// move forward
+	ps->velocity[0] = oldvel[0];
+	ps->velocity[1] = oldvel[1];
+	ps->velocity[2] = 0;
+	CL_PredFlyMove (ps, time);
+
+// move down
+	VectorCopy (ps->origin, end);
+	end[2] += -PRED_STEPSIZE + oldvel[2] * time;
+	trace = CL_PredTrace (ps->origin, end, false);
+	VectorCopy (trace.endpos, ps->origin);
+
+	if (trace.plane.normal[2] > 0.7)
+		ps->onground = true;
+	else
+	{
+		VectorCopy (nosteporg, ps->origin);
+		VectorCopy (nostepvel, ps->velocity);
+	}
+}
+
+/*
+=================
+CL_PredFriction
+
+SV_UserFriction
+=================
+*/
+static void CL_PredFriction (predstate_t *ps, float time)
+{
+	float	speed, newspeed, control, friction;
+	vec3_t	start, stop;
+	trace_t	trace;
+
+	speed = sqrt (ps->velocity[0] * ps->velocity[0] + ps->velocity[1] * ps->velocity[1]);
+	if (!speed)
+		return;
+
+// if the leading edge is over a dropoff, increase friction
+	start[0] = stop[0] = ps->origin[0] + ps->velocity[0] / speed * 16;
+	start[1] = stop[1] = ps->origin[1] + ps->velocity[1] / speed * 16;
+	start[2] = ps->origin[2] + pred_mins[2];
+	stop[2] = start[2] - 34;
+
+	trace = CL_PredTrace (start, stop, true);
+	friction = PRED_FRICTION;
+	if (trace.fraction == 1.0)
+		friction *= PRED_EDGEFRICTION;
+
+	control = speed < PRED_STOPSPEED ? PRED_STOPSPEED : speed;
+	newspeed = speed - time * control * friction;
+	if (newspeed < 0)
+		newspeed = 0;
+	newspeed /= speed;
+
+	VectorScale (ps->velocity, newspeed, ps->velocity);
+}
+
+/*
+=================
+CL_PredThink
+
+SV_ClientThink and the MOVETYPE_WALK part of SV_Physics_Client for
+one step of a move.
+=================
+*/
+static void CL_PredThink (predstate_t *ps, const predmove_t *move, float time)
+{
+	vec3_t	angles, forward, right, up;
+	vec3_t	wishvel, wishdir;
+	float	wishspeed, addspeed, accelspeed, currentspeed;
+	int	i;
+
+// the progs jump, PlayerPreThink runs before the move
+	if (!move->jump)
+		ps->jumpreleased = true;
+	else if (ps->onground && ps->jumpreleased)
+	{
+		ps->jumpreleased = false;
+		ps->onground = false;
+		ps->velocity[2] += PRED_JUMPSPEED;
+	}
+
+	angles[PITCH] = -move->cmd.viewangles[PITCH] / 3;
+	angles[YAW] = move->cmd.viewangles[YAW];
+	angles[ROLL] = 0;
+	AngleVectors (angles, forward, right, up);
+
+	for (i = 0; i < 2; i++)
+		wishvel[i] = forward[i] * move->cmd.forwardmove + right[i] * move->cmd.sidemove;
+	wishvel[2] = 0;
+
+	VectorCopy (wishvel, wishdir);
+	wishspeed = VectorNormalize (wishdir);
+	if (wishspeed > PRED_MAXSPEED)
+	{
+		VectorScale (wishvel, PRED_MAXSPEED / wishspeed, wishvel);
+		wishspeed = PRED_MAXSPEED;
+	}
+
+	if (ps->onground)
+	{
+		CL_PredFriction (ps, time);
+
+		currentspeed = DotProduct (ps->velocity, wishdir);
+		addspeed = wishspeed - currentspeed;
+		if (addspeed > 0)
+		{
+			accelspeed = q_min (PRED_ACCELERATE * time * wishspeed, addspeed);
+			VectorMA (ps->velocity, accelspeed, wishdir, ps->velocity);
+		}
+	}
+	else
+	{ // SV_AirAccelerate
+		currentspeed = DotProduct (ps->velocity, wishdir);
+		addspeed = q_min (wishspeed, 30) - currentspeed;
+		if (addspeed > 0)
+		{
+			accelspeed = q_min (PRED_ACCELERATE * wishspeed * time, addspeed);
+			VectorMA (ps->velocity, accelspeed, wishdir, ps->velocity);
+		}
+	}
+
+	ps->velocity[2] -= PRED_GRAVITY * time;
+	CL_PredWalkMove (ps, time);
+}
+
+/*
+=================
+CL_PredictSaveMove
+
+Called from CL_SendMove with every move sent to the server.
+=================
+*/
+void CL_PredictSaveMove (const usercmd_t *cmd, qboolean jump)
+{
+	predmove_t	*move;
+
+	move = &pred_moves[pred_nummoves & (MAX_PRED_MOVES - 1)];
+	move->time = realtime;
+	move->cmd = *cmd;
+	move->jump = jump;
+	pred_nummoves++;
+}
+
+/*
+=================
+CL_PredictReset
+=================
+*/
+void CL_PredictReset (void)
+{
+	pred_nummoves = 0;
+	pred_mtime = 0;
+	pred_active = false;
+	VectorCopy (vec3_origin, pred_error);
+}
+
+/*
+=================
+CL_PredReplay
+
+Runs the moves the server hadn't seen when the update it sent at
+recvtime - latency / 2 was made from ps, up to now.
+=================
+*/
+static void CL_PredReplay (predstate_t *ps, double recvtime, double latency)
+{
+	predmove_t	*move;
+	double		start, end, t, step;
+	int		i;
+
+	start = recvtime - latency;
+	for (i = q_max (pred_nummoves - MAX_PRED_MOVES, 0); i < pred_nummoves; i++)
+	{
+		move = &pred_moves[i & (MAX_PRED_MOVES - 1)];
+		end = (i + 1 < pred_nummoves) ? pred_moves[(i + 1) & (MAX_PRED_MOVES - 1)].time : realtime;
+		if (end <= start)
+		{
+			ps->jumpreleased = !move->jump;
+			continue;
+		}
+
+		for (t = q_max (move->time, start); t < end; t += step)
+		{
+			step = q_min (end - t, PRED_MAXSTEP);
+			CL_PredThink (ps, move, step);
+		}
+	}
+}
+
+/*
+=================
+CL_PredictMove
+
+Replaces the lerped origin of the view entity with the predicted one,
+called once the entities are relinked.
+=================
+*/
+void CL_PredictMove (void)
+{
+	entity_t	*ent;
+	predstate_t	ps, old;
+	double		latency;
+	vec3_t		delta;
+	float		f;
+
+	if (!cl_predict.value || cls.state != ca_connected || cls.signon != SIGNONS || cls.demoplayback ||
+		sv.active || cl.intermission || cl.paused || !cl.worldmodel || cl.stats[STAT_HEALTH] <= 0 ||
+		cl.inwater || cl.viewentity < 1 || cl.viewentity >= cl.num_entities)
+	{
+		pred_active = false;
+		return;
+	}
+
+	// keep the round trip measured, vanilla servers just drop the nop
+	if (realtime - pred_lastprobe > PRED_PROBE && !cls.message.cursize)
+	{
+		MSG_WriteByte (&cls.message, clc_nop);
+		pred_lastprobe = realtime;
+	}
+
+	latency = NET_Latency (cls.netcon);
+	ent = &cl_entities[cl.viewentity];
+	if (latency <= 0 || ent->msgtime != cl.mtime[0])
+	{
+		pred_active = false;
+		return;
+	}
+
+	if (!pred_active || pred_mtime != cl.mtime[0])
+	{
+		// what the last update would have predicted for now, to ease in the change
+		if (pred_active)
+		{
+			old = pred_base;
+			CL_PredReplay (&old, pred_recvtime, latency);
+		}
+
+		pred_mtime = cl.mtime[0];
+		pred_recvtime = realtime;
+		VectorCopy (ent->msg_origins[0], pred_base.origin);
+		VectorCopy (cl.mvelocity[0], pred_base.velocity);
+		pred_base.onground = cl.onground;
+		pred_base.jumpreleased = false;
+
+		ps = pred_base;
+		CL_PredReplay (&ps, pred_recvtime, latency);
+
+		if (pred_active)
+		{
+			VectorSubtract (old.origin, ps.origin, delta);
+			if (VectorLength (delta) < 64)
+			{
+				VectorAdd (pred_error, delta, pred_error);
+			}
+			else
+			{
+				VectorCopy (vec3_origin, pred_error);	// teleported
+			}
+		}
+		else
+		{
+			VectorCopy (vec3_origin, pred_error);
+		}
+		pred_active = true;
+	}
+	else
+	{
+		ps = pred_base;
+		CL_PredReplay (&ps, pred_recvtime, latency);
+	}
+
+	if (cl_predict_smooth.value > 0)
+		f = q_max (0, 1 - host_frametime / cl_predict_smooth.value);
+	else
+		f = 0;
+	VectorScale (pred_error, f, pred_error);
+
+	VectorAdd (ps.origin, pred_error, ent->origin);
+	VectorCopy (ps.velocity, cl.velocity);
+}
+
+/*
+=================
+CL_InitPrediction
+=================
+*/
+void CL_InitPrediction (void)
+{
+	Cvar_RegisterVariable (&cl_predict);
+	Cvar_RegisterVariable (&cl_predict_smooth);
+}
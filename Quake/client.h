@@ -118,6 +118,8 @@ typedef struct
 // did the user pause demo playback? (separate from cl.paused because we don't
 // want a svc_setpause inside the demo to actually pause demo playback).
 	qboolean	demopaused;
+	qboolean	demoseeking;	// fast forwarding to a demoseek target
+	qboolean	benchmarking;	// timedemos run by the benchmark command
 
 	qboolean	timedemo;
 	int		forcetrack;		// -1 = use normal cd track
@@ -130,11 +132,23 @@ typedef struct
 	int		signon;			// 0 to SIGNONS
 	struct qsocket_s	*netcon;
 	sizebuf_t	message;		// writing buffer to send to server
+	int		movesequence;		// PROTOCOL_DELTA: last move sent, only ever counts up
 
 } client_static_t;
 
 extern client_static_t	cls;
 
+// PROTOCOL_DELTA -- moves are numbered, and each clc_moves resends the
+// last few so that a lost packet doesn't lose a frame of input
+#define	MAX_SENTMOVES	4	// power of two
+
+typedef struct
+{
+	vec3_t	angles;
+	float	forwardmove, sidemove, upmove;
+	byte	bits, impulse;
+} sentmove_t;
+
 //
 // the client_state_t structure is wiped completely at every
 // server signon
@@ -224,6 +238,12 @@ typedef struct
 
 	unsigned	protocol; //johnfitz
 	unsigned	protocolflags;
+
+	int			entframeack;		// PROTOCOL_DELTA: last complete entity frame
+	qboolean	entframerestart;	// only acknowledge frames from baselines until one arrives
+
+	sentmove_t	sentmoves[MAX_SENTMOVES];	// PROTOCOL_DELTA: by cls.movesequence
+	int			numsentmoves;		// to this server, up to MAX_SENTMOVES
 } client_state_t;
 
 
@@ -246,11 +266,13 @@ extern	cvar_t	cl_pitchspeed;
 extern	cvar_t	cl_anglespeedkey;
 
 extern	cvar_t	cl_alwaysrun; // QuakeSpasm
+extern	cvar_t	cl_moveredundancy;
 
 extern	cvar_t	cl_autofire;
 
 extern	cvar_t	cl_shownet;
 extern	cvar_t	cl_nolerp;
+extern	cvar_t	cl_netgraph;
 
 extern	cvar_t	cfg_unbindall;
 
@@ -265,6 +287,7 @@ extern	cvar_t	m_forward;
 extern	cvar_t	m_side;
 
 extern	cvar_t	cl_startdemos;
+extern	cvar_t	cl_demokeyframe;
 
 
 #define	MAX_TEMP_ENTITIES	256		//johnfitz -- was 64
@@ -282,8 +305,9 @@ extern	beam_t			cl_beams[MAX_BEAMS];
 extern	entity_t		*cl_visedicts[MAX_VISEDICTS];
 extern	int				cl_numvisedicts;
 
-extern	entity_t		*cl_entities; //johnfitz -- was a static array, now on hunk
+extern	entity_t		*cl_entities; //johnfitz -- was a static array, now committed as it grows
 extern	int				cl_max_edicts; //johnfitz -- only changes when new map loads
+void CL_GrowEntities (int num);
 
 //=============================================================================
 
@@ -292,6 +316,11 @@ extern	int				cl_max_edicts; //johnfitz -- only changes when new map loads
 //
 dlight_t *CL_AllocDlight (int key);
 void	CL_DecayLights (void);
+void	CL_ActivateEntity (int num);
+void	CL_RebuildActiveEntities (void);
+void	CL_SaveSnapshot (int num, const entity_t *ent, qboolean reset);
+void	CL_JitterSample (void);
+int	CL_NetGraph (float *lateness, int max, float *delay, float *jitter, int *extrapolated);
 
 void CL_Init (void);
 
@@ -339,11 +368,18 @@ void CL_Stop_f (void);
 void CL_Record_f (void);
 void CL_PlayDemo_f (void);
 void CL_TimeDemo_f (void);
+void CL_DemoSeek_f (void);
+void CL_Benchmark_f (void);
+void CL_BenchmarkFrame (double update, double server, double render, double swap, double sound);
+void CL_DemoNewMap (void);
 
 //
 // cl_parse.c
 //
 void CL_ParseServerMessage (void);
+void CL_SaveEntFrames (entframe_t *frames);
+void CL_RestoreEntFrames (const entframe_t *frames);
+void CL_FreeEntFrames (entframe_t *frames);
 void CL_NewTranslation (int slot);
 
 //
@@ -362,6 +398,14 @@ void V_SetContentsColor (int contents);
 // cl_tent
 //
 void CL_InitTEnts (void);
+
+//
+// cl_pred
+//
+void CL_InitPrediction (void);
+void CL_PredictReset (void);
+void CL_PredictSaveMove (const usercmd_t *cmd, qboolean jump);
+void CL_PredictMove (void);
 void CL_SignonReply (void);
 
 //
@@ -33,11 +33,33 @@ void Cmd_ForwardToServer (void);
 typedef struct cmdalias_s
 {
 	struct cmdalias_s	*next;
+	struct cmdalias_s	*hashnext;
 	char	name[MAX_ALIAS_NAME];
 	char	*value;
 } cmdalias_t;
 
 cmdalias_t	*cmd_alias;
+static cmdalias_t	*cmd_aliashash[CMD_HASHSIZE];
+
+#define	Cmd_HashSlot(name)	(COM_HashStringNoCase (name) & (CMD_HASHSIZE - 1))
+
+/*
+===============
+Cmd_FindAlias
+===============
+*/
+static cmdalias_t *Cmd_FindAlias (const char *name, qboolean nocase)
+{
+	cmdalias_t	*a;
+
+	for (a = cmd_aliashash[Cmd_HashSlot (name)]; a; a = a->hashnext)
+	{
+		if (nocase ? !q_strcasecmp (name, a->name) : !strcmp (name, a->name))
+			return a;
+	}
+
+	return NULL;
+}
 
 qboolean	cmd_wait;
 
@@ -65,7 +87,23 @@ void Cmd_Wait_f (void)
 =============================================================================
 */
 
-sizebuf_t	cmd_text;
+// the buffer is a list of chunks: added text goes into the last one,
+// inserted text gets a chunk of its own at the front
+#define	CBUF_MAXSIZE	(1<<18)		// space for commands and script files. spike -- was 8192, but modern configs can be _HUGE_, at least if they contain lots of comments/docs for things.
+#define	CBUF_CHUNKSIZE	4096
+
+typedef struct cbufchunk_s
+{
+	struct cbufchunk_s	*next;
+	int		start, end;	// text still to execute is data[start..end)
+	int		size;
+	char		data[1];
+} cbufchunk_t;
+
+static cbufchunk_t	*cbuf_head, *cbuf_tail;
+static int		cbuf_size;	// bytes still to execute
+
+static cvar_t	cmd_budget = {"cmd_budget", "0", CVAR_NONE};	// ms per frame, 0 = no limit
 
 /*
 ============
@@ -74,9 +112,19 @@ Cbuf_Init
 */
 void Cbuf_Init (void)
 {
-	SZ_Alloc (&cmd_text, 1<<18);		// space for commands and script files. spike -- was 8192, but modern configs can be _HUGE_, at least if they contain lots of comments/docs for things.
+	cbuf_head = cbuf_tail = NULL;
+	cbuf_size = 0;
 }
 
+static cbufchunk_t *Cbuf_NewChunk (int size)
+{
+	cbufchunk_t	*chunk;
+
+	size = q_max(size, CBUF_CHUNKSIZE);
+	chunk = (cbufchunk_t *) Z_Malloc (sizeof(cbufchunk_t) + size);
+	chunk->size = size;
+	return chunk;
+}
 
 /*
 ============
@@ -87,17 +135,33 @@ Adds command text at the end of the buffer
 */
 void Cbuf_AddText (const char *text)
 {
+	cbufchunk_t	*chunk;
 	int		l;
 
 	l = Q_strlen (text);
 
-	if (cmd_text.cursize + l >= cmd_text.maxsize)
+	if (cbuf_size + l >= CBUF_MAXSIZE)
 	{
 		Con_Printf ("Cbuf_AddText: overflow\n");
 		return;
 	}
 
-	SZ_Write (&cmd_text, text, Q_strlen (text));
+	chunk = cbuf_tail;
+	if (chunk && chunk->start == chunk->end)
+		chunk->start = chunk->end = 0;	// all executed, reuse it
+	if (!chunk || chunk->size - chunk->end < l)
+	{
+		chunk = Cbuf_NewChunk (l);
+		if (cbuf_tail)
+			cbuf_tail->next = chunk;
+		else
+			cbuf_head = chunk;
+		cbuf_tail = chunk;
+	}
+
+	memcpy (chunk->data + chunk->end, text, l);
+	chunk->end += l;
+	cbuf_size += l;
 }
 
 
@@ -107,87 +171,99 @@ Cbuf_InsertText
 
 Adds command text immediately after the current command
 Adds a \n to the text
-FIXME: actually change the command buffer to do less copying
 ============
 */
 void Cbuf_InsertText (const char *text)
 {
-	char	*temp;
-	int		templen;
+	cbufchunk_t	*chunk;
+	int		l;
 
-// copy off any commands still remaining in the exec buffer
-	templen = cmd_text.cursize;
-	if (templen)
-	{
-		temp = (char *) Z_Malloc (templen);
-		Q_memcpy (temp, cmd_text.data, templen);
-		SZ_Clear (&cmd_text);
-	}
-	else
-		temp = NULL;	// shut up compiler
+	l = Q_strlen (text);
 
-// add the entire text of the file
-	Cbuf_AddText (text);
-	SZ_Write (&cmd_text, "\n", 1);
-// add the copied off data
-	if (templen)
+	if (cbuf_size + l + 1 >= CBUF_MAXSIZE)
 	{
-		SZ_Write (&cmd_text, temp, templen);
-		Z_Free (temp);
+		Con_Printf ("Cbuf_InsertText: overflow\n");
+		return;
 	}
+
+	chunk = Cbuf_NewChunk (l + 1);
+	memcpy (chunk->data, text, l);
+	chunk->data[l] = '\n';
+	chunk->end = l + 1;
+	cbuf_size += l + 1;
+
+	chunk->next = cbuf_head;
+	cbuf_head = chunk;
+	if (!cbuf_tail)
+		cbuf_tail = chunk;
 }
 
 /*
 ============
-Cbuf_Execute
+Cbuf_GetLine
+
+Takes the text up to the next \n or unquoted ; off the buffer,
+lines can span chunks
 ============
 */
-void Cbuf_Execute (void)
+static void Cbuf_GetLine (char *line, int size)
 {
-	int		i;
-	char	*text;
-	char	line[1024];
-	int		quotes;
-
-	while (cmd_text.cursize)
+	cbufchunk_t	*chunk;
+	int		len, quotes;
+	qboolean	done;
+	char		c;
+
+	len = quotes = 0;
+	done = false;
+	while (!done && (chunk = cbuf_head) != NULL)
 	{
-// find a \n or ; line break
-		text = (char *)cmd_text.data;
-
-		quotes = 0;
-		for (i=0 ; i< cmd_text.cursize ; i++)
+		while (chunk->start < chunk->end)
 		{
-			if (text[i] == '"')
+			c = chunk->data[chunk->start++];
+			cbuf_size--;
+			if (c == '"')
 				quotes++;
-			if ( !(quotes&1) &&  text[i] == ';')
-				break;	// don't break if inside a quoted string
-			if (text[i] == '\n')
+			if ((!(quotes&1) && c == ';') || c == '\n')
+			{	// don't break if inside a quoted string
+				done = true;
 				break;
+			}
+			if (len < size - 1)
+				line[len++] = c;
 		}
 
-		if (i > (int)sizeof(line) - 1)
+		if (chunk->start == chunk->end)
 		{
-			memcpy (line, text, sizeof(line) - 1);
-			line[sizeof(line) - 1] = 0;
-		}
-		else
-		{
-			memcpy (line, text, i);
-			line[i] = 0;
+			cbuf_head = chunk->next;
+			if (!cbuf_head)
+				cbuf_tail = NULL;
+			Z_Free (chunk);
 		}
+	}
 
-// delete the text from the command buffer and move remaining commands down
-// this is necessary because commands (exec, alias) can insert data at the
-// beginning of the text buffer
+	line[len] = 0;
+}
 
-		if (i == cmd_text.cursize)
-			cmd_text.cursize = 0;
-		else
-		{
-			i++;
-			cmd_text.cursize -= i;
-			memmove (text, text + i, cmd_text.cursize);
-		}
+/*
+============
+Cbuf_Execute
+
+With cmd_budget set, whatever is left once the frame's time is up
+waits for the next frame, like it does after a wait
+============
+*/
+void Cbuf_Execute (void)
+{
+	char	line[1024];
+	double	endtime;
+
+	endtime = 0;
+	if (host_initialized && cmd_budget.value > 0)
+		endtime = Sys_DoubleTime () + cmd_budget.value / 1000.0;
+
+	while (cbuf_head)
+	{
+		Cbuf_GetLine (line, sizeof(line));
 
 // execute the command line
 		Cmd_ExecuteString (line, src_command);
@@ -198,6 +274,9 @@ void Cbuf_Execute (void)
 			cmd_wait = false;
 			break;
 		}
+
+		if (endtime && Sys_DoubleTime () > endtime)
+			break;
 	}
 }
 
@@ -328,9 +407,9 @@ void Cmd_Alias_f (void)
 			Con_SafePrintf ("no alias commands found\n");
 		break;
 	case 2: //output current alias string
-		for (a = cmd_alias ; a ; a=a->next)
-			if (!strcmp(Cmd_Argv(1), a->name))
-				Con_Printf ("   %s: %s", a->name, a->value);
+		a = Cmd_FindAlias (Cmd_Argv(1), false);
+		if (a)
+			Con_Printf ("   %s: %s", a->name, a->value);
 		break;
 	default: //set alias string
 		s = Cmd_Argv(1);
@@ -341,22 +420,19 @@ void Cmd_Alias_f (void)
 		}
 
 		// if the alias already exists, reuse it
-		for (a = cmd_alias ; a ; a=a->next)
-		{
-			if (!strcmp(s, a->name))
-			{
-				Z_Free (a->value);
-				break;
-			}
-		}
-
-		if (!a)
+		a = Cmd_FindAlias (s, false);
+		if (a)
+			Z_Free (a->value);
+		else
 		{
 			a = (cmdalias_t *) Z_Malloc (sizeof(cmdalias_t));
 			a->next = cmd_alias;
 			cmd_alias = a;
+			strcpy (a->name, s);
+			a->hashnext = cmd_aliashash[Cmd_HashSlot (s)];
+			cmd_aliashash[Cmd_HashSlot (s)] = a;
+			Con_AddTabName (a->name, "alias");
 		}
-		strcpy (a->name, s);
 
 		// copy the rest of the command line
 		cmd[0] = 0;		// start out with a null string
@@ -386,7 +462,7 @@ Cmd_Unalias_f -- johnfitz
 */
 void Cmd_Unalias_f (void)
 {
-	cmdalias_t	*a, *prev;
+	cmdalias_t	*a, *prev, **link;
 
 	switch (Cmd_Argc())
 	{
@@ -405,6 +481,11 @@ void Cmd_Unalias_f (void)
 				else
 					cmd_alias  = a->next;
 
+				for (link = &cmd_aliashash[Cmd_HashSlot (a->name)]; *link != a; link = &(*link)->hashnext)
+					;
+				*link = a->hashnext;
+				Con_RemoveTabName (a->name, "alias");
+
 				Z_Free (a->value);
 				Z_Free (a);
 				return;
@@ -432,6 +513,8 @@ void Cmd_Unaliasall_f (void)
 		Z_Free(cmd_alias);
 		cmd_alias = blah;
 	}
+	memset (cmd_aliashash, 0, sizeof(cmd_aliashash));
+	Con_RemoveTabNames ("alias");
 }
 
 /*
@@ -445,6 +528,7 @@ void Cmd_Unaliasall_f (void)
 typedef struct cmd_function_s
 {
 	struct cmd_function_s	*next;
+	struct cmd_function_s	*hashnext;
 	const char		*name;
 	xcommand_t		function;
 } cmd_function_t;
@@ -463,6 +547,25 @@ cmd_source_t	cmd_source;
 //static	cmd_function_t	*cmd_functions;		// possible commands to execute
 cmd_function_t	*cmd_functions;		// possible commands to execute
 //johnfitz
+static cmd_function_t	*cmd_hash[CMD_HASHSIZE];
+
+/*
+============
+Cmd_FindCommand
+============
+*/
+static cmd_function_t *Cmd_FindCommand (const char *name, qboolean nocase)
+{
+	cmd_function_t	*cmd;
+
+	for (cmd = cmd_hash[Cmd_HashSlot (name)]; cmd; cmd = cmd->hashnext)
+	{
+		if (nocase ? !q_strcasecmp (name, cmd->name) : !Q_strcmp (name, cmd->name))
+			return cmd;
+	}
+
+	return NULL;
+}
 
 /*
 ============
@@ -581,6 +684,8 @@ void Cmd_Init (void)
 
 	Cmd_AddCommand ("apropos", Cmd_Apropos_f);
 	Cmd_AddCommand ("find", Cmd_Apropos_f);
+
+	Cvar_RegisterVariable (&cmd_budget);
 }
 
 /*
@@ -688,18 +793,18 @@ void	Cmd_AddCommand (const char *cmd_name, xcommand_t function)
 	}
 
 // fail if the command already exists
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	if (Cmd_FindCommand (cmd_name, false))
 	{
-		if (!Q_strcmp (cmd_name, cmd->name))
-		{
-			Con_Printf ("Cmd_AddCommand: %s already defined\n", cmd_name);
-			return;
-		}
+		Con_Printf ("Cmd_AddCommand: %s already defined\n", cmd_name);
+		return;
 	}
 
 	cmd = (cmd_function_t *) Hunk_Alloc (sizeof(cmd_function_t));
 	cmd->name = cmd_name;
 	cmd->function = function;
+	cmd->hashnext = cmd_hash[Cmd_HashSlot (cmd_name)];
+	cmd_hash[Cmd_HashSlot (cmd_name)] = cmd;
+	Con_AddTabName (cmd->name, "command");
 
 	//johnfitz -- insert each entry in alphabetical order
 	if (cmd_functions == NULL || strcmp(cmd->name, cmd_functions->name) < 0) //insert at front
@@ -729,15 +834,7 @@ Cmd_Exists
 */
 qboolean	Cmd_Exists (const char *cmd_name)
 {
-	cmd_function_t	*cmd;
-
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
-	{
-		if (!Q_strcmp (cmd_name,cmd->name))
-			return true;
-	}
-
-	return false;
+	return Cmd_FindCommand (cmd_name, false) != NULL;
 }
 
 
@@ -770,7 +867,6 @@ const char *Cmd_CompleteCommand (const char *partial)
 Cmd_ExecuteString
 
 A complete command line has been parsed, so try to execute it
-FIXME: lookupnoadd the token to speed search?
 ============
 */
 void	Cmd_ExecuteString (const char *text, cmd_source_t src)
@@ -786,23 +882,19 @@ void	Cmd_ExecuteString (const char *text, cmd_source_t src)
 		return;		// no tokens
 
 // check functions
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	cmd = Cmd_FindCommand (cmd_argv[0], true);
+	if (cmd)
 	{
-		if (!q_strcasecmp (cmd_argv[0],cmd->name))
-		{
-			cmd->function ();
-			return;
-		}
+		cmd->function ();
+		return;
 	}
 
 // check alias
-	for (a=cmd_alias ; a ; a=a->next)
+	a = Cmd_FindAlias (cmd_argv[0], true);
+	if (a)
 	{
-		if (!q_strcasecmp (cmd_argv[0], a->name))
-		{
-			Cbuf_InsertText (a->value);
-			return;
-		}
+		Cbuf_InsertText (a->value);
+		return;
 	}
 
 // check cvars
@@ -40,7 +40,7 @@ The game starts with a Cbuf_AddText ("exec quake.rc\n"); Cbuf_Execute ();
 */
 
 void Cbuf_Init (void);
-// allocates an initial text buffer that will grow as needed
+// the buffer grows in chunks as needed
 
 void Cbuf_AddText (const char *text);
 // as new commands are generated from the console or keybindings,
@@ -53,7 +53,8 @@ void Cbuf_InsertText (const char *text);
 
 void Cbuf_Execute (void);
 // Pulls off \n terminated lines of text from the command buffer and sends
-// them through Cmd_ExecuteString.  Stops when the buffer is empty.
+// them through Cmd_ExecuteString.  Stops when the buffer is empty, or once
+// the frame has used up cmd_budget milliseconds.
 // Normally called once per frame, but may be explicitly invoked.
 // Do not call inside a command function!
 
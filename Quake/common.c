@@ -25,6 +25,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "q_ctype.h"
 #include <errno.h>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
 
 #include "miniz.h"
 
@@ -772,6 +775,23 @@ void MSG_BeginReading (void)
 	msg_badread = false;
 }
 
+// checks the bounds once for a run of fields the caller decodes itself
+const byte *MSG_ReadData (int size)
+{
+	const byte	*data;
+
+	if (size < 0 || msg_readcount+size > net_message.cursize)
+	{
+		msg_badread = true;
+		return NULL;
+	}
+
+	data = net_message.data + msg_readcount;
+	msg_readcount += size;
+
+	return data;
+}
+
 // returns -1 and sets msg_badread if no more characters are available
 int MSG_ReadChar (void)
 {
@@ -931,6 +951,175 @@ float MSG_ReadAngle16 (unsigned int flags)
 }
 //johnfitz
 
+//
+// per-protocol field codecs
+//
+// The same encodings as MSG_WriteCoord, MSG_ReadCoord and friends, for
+// callers that write or decode a run of fields in place instead of going
+// through the sizebuf and net_message one field at a time.
+//
+
+static byte *MSG_PutShort (byte *p, int c)
+{
+	p[0] = c&0xff;
+	p[1] = (c>>8)&0xff;
+	return p + 2;
+}
+
+static byte *MSG_PutLong (byte *p, int c)
+{
+	p[0] = c&0xff;
+	p[1] = (c>>8)&0xff;
+	p[2] = (c>>16)&0xff;
+	p[3] = c>>24;
+	return p + 4;
+}
+
+static byte *MSG_PutFloat (byte *p, float f)
+{
+	union
+	{
+		float	f;
+		int	l;
+	} dat;
+
+	dat.f = f;
+	dat.l = LittleLong (dat.l);
+	memcpy (p, &dat.l, 4);
+	return p + 4;
+}
+
+static byte *MSG_PutCoord16 (byte *p, float f)
+{
+	return MSG_PutShort (p, Q_rint(f*8));
+}
+
+static byte *MSG_PutCoord24 (byte *p, float f)
+{
+	p = MSG_PutShort (p, f);
+	*p++ = (int)(f*255)%255;
+	return p;
+}
+
+static byte *MSG_PutCoordInt32 (byte *p, float f)
+{
+	return MSG_PutLong (p, Q_rint (f * 16));
+}
+
+static byte *MSG_PutAngle8 (byte *p, float f)
+{
+	*p++ = Q_rint(f * 256.0 / 360.0) & 255;
+	return p;
+}
+
+static byte *MSG_PutAngle16 (byte *p, float f)
+{
+	return MSG_PutShort (p, Q_rint(f * 65536.0 / 360.0) & 65535);
+}
+
+static float MSG_GetShort (const byte *p)
+{
+	return (short)(p[0] | (p[1] << 8));
+}
+
+static float MSG_GetFloat (const byte *p)
+{
+	union
+	{
+		byte	b[4];
+		float	f;
+		int	l;
+	} dat;
+
+	dat.b[0] = p[0];
+	dat.b[1] = p[1];
+	dat.b[2] = p[2];
+	dat.b[3] = p[3];
+	dat.l = LittleLong (dat.l);
+
+	return dat.f;
+}
+
+static float MSG_GetCoord16 (const byte *p)
+{
+	return MSG_GetShort (p) * (1.0/8);
+}
+
+static float MSG_GetCoord24 (const byte *p)
+{
+	return MSG_GetShort (p) + p[2] * (1.0/255);
+}
+
+static float MSG_GetCoordInt32 (const byte *p)
+{
+	return (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24)) * (1.0 / 16.0);
+}
+
+static float MSG_GetAngle8 (const byte *p)
+{
+	return (signed char)p[0] * (360.0 / 256);
+}
+
+static float MSG_GetAngle16 (const byte *p)
+{
+	return MSG_GetShort (p) * (360.0 / 65536);
+}
+
+/*
+================
+MSG_InitCodec
+
+Picks the coord and angle encodings for a set of protocol flags, the
+same choices MSG_WriteCoord and MSG_WriteAngle make on every call.
+================
+*/
+void MSG_InitCodec (msgcodec_t *codec, unsigned int flags)
+{
+	if (flags & PRFL_FLOATCOORD)
+	{
+		codec->coordsize = 4;
+		codec->writecoord = MSG_PutFloat;
+		codec->readcoord = MSG_GetFloat;
+	}
+	else if (flags & PRFL_INT32COORD)
+	{
+		codec->coordsize = 4;
+		codec->writecoord = MSG_PutCoordInt32;
+		codec->readcoord = MSG_GetCoordInt32;
+	}
+	else if (flags & PRFL_24BITCOORD)
+	{
+		codec->coordsize = 3;
+		codec->writecoord = MSG_PutCoord24;
+		codec->readcoord = MSG_GetCoord24;
+	}
+	else
+	{
+		codec->coordsize = 2;
+		codec->writecoord = MSG_PutCoord16;
+		codec->readcoord = MSG_GetCoord16;
+	}
+
+	if (flags & PRFL_FLOATANGLE)
+	{
+		codec->anglesize = 4;
+		codec->writeangle = MSG_PutFloat;
+		codec->readangle = MSG_GetFloat;
+	}
+	else if (flags & PRFL_SHORTANGLE)
+	{
+		codec->anglesize = 2;
+		codec->writeangle = MSG_PutAngle16;
+		codec->readangle = MSG_GetAngle16;
+	}
+	else
+	{
+		codec->anglesize = 1;
+		codec->writeangle = MSG_PutAngle8;
+		codec->readangle = MSG_GetAngle8;
+	}
+}
+
 //===========================================================================
 
 void SZ_Alloc (sizebuf_t *buf, int startsize)
@@ -979,6 +1168,29 @@ void *SZ_GetSpace (sizebuf_t *buf, int length)
 	return data;
 }
 
+/*
+================
+SZ_Reserve
+
+Returns room for up to maxlength bytes without counting any of it, or
+NULL if it doesn't fit.  The caller fills in what it needs and hands the
+end of it to SZ_Commit.  Nothing is cleared or reported on overflow, so
+it is safe from a task.
+================
+*/
+byte *SZ_Reserve (sizebuf_t *buf, int maxlength)
+{
+	if (buf->cursize + maxlength > buf->maxsize)
+		return NULL;
+
+	return buf->data + buf->cursize;
+}
+
+void SZ_Commit (sizebuf_t *buf, const byte *end)
+{
+	buf->cursize = end - buf->data;
+}
+
 void SZ_Write (sizebuf_t *buf, const void *data, int length)
 {
 	Q_memcpy (SZ_GetSpace(buf,length),data,length);
@@ -999,6 +1211,68 @@ void SZ_Print (sizebuf_t *buf, const char *data)
 }
 
 
+#define	SB_STARTSIZE	0x10000
+
+static void SB_Reserve (strbuf_t *sb, size_t extra)
+{
+	size_t	newsize;
+	char	*newdata;
+
+	if (sb->len + extra <= sb->maxlen)
+		return;
+
+	newsize = q_max (sb->maxlen * 2, sb->len + extra);
+	newsize = q_max (newsize, SB_STARTSIZE);
+	newdata = (char *) realloc (sb->data, newsize);
+	if (!newdata)
+		Sys_Error ("SB_Reserve: failed on %u bytes", (unsigned int) newsize);
+	sb->data = newdata;
+	sb->maxlen = newsize;
+}
+
+void SB_Clear (strbuf_t *sb)
+{
+	SB_Reserve (sb, 1);
+	sb->len = 0;
+	sb->data[0] = 0;
+}
+
+void SB_Free (strbuf_t *sb)
+{
+	free (sb->data);
+	sb->data = NULL;
+	sb->len = sb->maxlen = 0;
+}
+
+void SB_Write (strbuf_t *sb, const void *data, size_t len)
+{
+	SB_Reserve (sb, len + 1);
+	memcpy (sb->data + sb->len, data, len);
+	sb->len += len;
+	sb->data[sb->len] = 0;
+}
+
+void SB_Printf (strbuf_t *sb, const char *fmt, ...)
+{
+	va_list		argptr;
+	size_t		avail;
+	int		len;
+
+	SB_Reserve (sb, 1);
+	for (;;)
+	{
+		avail = sb->maxlen - sb->len;
+		va_start (argptr, fmt);
+		len = q_vsnprintf (sb->data + sb->len, avail, fmt, argptr);
+		va_end (argptr);
+		if ((size_t) len < avail)
+			break;
+		SB_Reserve (sb, len + 1);	// old vsnprintf versions don't report the needed size, this doubles at least
+	}
+	sb->len += len;
+}
+
+
 //============================================================================
 
 /*
@@ -1494,6 +1768,7 @@ typedef struct
 } dpackheader_t;
 
 #define MAX_FILES_IN_PACK	2048
+#define MAX_FILES_IN_ZIP	65534	// pack_t hash slots are unsigned short
 
 char	com_gamedir[MAX_OSPATH];
 char	com_basedir[MAX_OSPATH];
@@ -1502,6 +1777,11 @@ int	file_from_pak;		// ZOID: global indicating that file came from a pak
 searchpath_t	*com_searchpaths;
 searchpath_t	*com_base_searchpaths;
 
+static unsigned int	com_lookups, com_misses;	// COM_FindFile statistics
+
+static pack_t		*com_deflatedpack;	// set by COM_FindFile2 when the caller
+static packfile_t	*com_deflatedfile;	// has to inflate the returned file itself
+
 /*
 ============
 COM_Path_f
@@ -1516,11 +1796,12 @@ static void COM_Path_f (void)
 	{
 		if (s->pack)
 		{
-			Con_Printf ("%s (%i files)\n", s->pack->filename, s->pack->numfiles);
+			Con_Printf ("%s (%i files, %u hits)\n", s->pack->filename, s->pack->numfiles, s->hits);
 		}
 		else
-			Con_Printf ("%s\n", s->filename);
+			Con_Printf ("%s (%u hits)\n", s->filename, s->hits);
 	}
+	Con_Printf ("%u lookups, %u misses\n", com_lookups, com_misses);
 }
 
 /*
@@ -1549,6 +1830,8 @@ void COM_WriteFile (const char *filename, const void *data, int len)
 	Sys_Printf ("COM_WriteFile: %s\n", name);
 	Sys_FileWrite (handle, data, len);
 	Sys_FileClose (handle);
+
+	COM_FlushDirCache ();
 }
 
 /*
@@ -1589,117 +1872,479 @@ long COM_filelength (FILE *f)
 }
 
 /*
-===========
-COM_FindFile
+=================
+COM_FindPackFile
 
-Finds the file in the search path.
-Sets com_filesize and one of handle or file
-If neither of file or handle is set, this
-can be used for detecting a file's presence.
-===========
+Looks up a file in the hashed directory of a pak file.
+If a pak contains duplicate names, the first one wins.
+=================
 */
-static int COM_FindFile2(const char *filename, int *handle, FILE **file, unsigned int *path_id, char *netpath, size_t size)
+static packfile_t *COM_FindPackFile (pack_t *pak, const char *filename)
 {
-	searchpath_t	*search;
-	pack_t		*pak;
-	int		i, findtime;
+	unsigned	pos, mask;
+	packfile_t	*pf;
 
-	if (file && handle)
-		Sys_Error ("COM_FindFile: both handle and file set");
+	mask = pak->hashsize - 1;
+	for (pos = COM_HashString (filename) & mask; pak->hash[pos]; pos = (pos + 1) & mask)
+	{
+		pf = &pak->files[pak->hash[pos] - 1];
+		if (!strcmp (pf->name, filename))
+			return pf;
+	}
 
-	file_from_pak = 0;
-	memset(netpath, 0, size);
+	return NULL;
+}
 
-//
-// search through the path, one element at a time
-//
-	for (search = com_searchpaths; search; search = search->next)
-	{
-		if (search->pack)	/* look through all the pak file elements */
-		{
-			pak = search->pack;
-			for (i = 0; i < pak->numfiles; i++)
-			{
-				if (strcmp(pak->files[i].name, filename) != 0)
-					continue;
-				// found it!
-				com_filesize = pak->files[i].filelen;
-				file_from_pak = 1;
-				if (path_id)
-					*path_id = search->path_id;
-				if (handle)
-				{
-					*handle = pak->handle;
-					Sys_FileSeek (pak->handle, pak->files[i].filepos);
-					return com_filesize;
-				}
-				else if (file)
-				{ /* open a new file on the pakfile */
-					*file = fopen (pak->filename, "rb");
-					if (*file)
-						fseek (*file, pak->files[i].filepos, SEEK_SET);
-					return com_filesize;
-				}
-				else /* for COM_FileExists() */
-				{
-					return com_filesize;
-				}
-			}
-		}
-		else	/* check a file in the directory tree */
-		{
-			if (!registered.value)
-			{ /* if not a registered version, don't ever go beyond base */
-				if ( strchr (filename, '/') || strchr (filename,'\\'))
-					continue;
-			}
+/*
+=================
+COM_ZipFilePos
 
-			q_snprintf (netpath, size, "%s/%s",search->filename, filename);
-			findtime = Sys_FileTime (netpath);
-			if (findtime == -1)
-				continue;
+Zip directory entries only know where the local header of a file is,
+the data itself starts after the variable length name and extra field
+of that header. Resolved on first access, -1 if the header is damaged.
+=================
+*/
+static int COM_ZipFilePos (pack_t *pak, packfile_t *pf)
+{
+	mz_zip_archive_file_stat	stat;
+	byte	header[30];
 
-			if (path_id)
-				*path_id = search->path_id;
-			if (handle)
-			{
-				com_filesize = Sys_FileOpenRead (netpath, &i);
-				*handle = i;
-				return com_filesize;
-			}
-			else if (file)
-			{
-				*file = fopen (netpath, "rb");
-				com_filesize = (*file == NULL) ? -1 : COM_filelength (*file);
-				return com_filesize;
-			}
-			else
-			{
-				return 0; /* dummy valid value for COM_FileExists() */
-			}
-		}
-	}
+	if (pf->filepos != -1)
+		return pf->filepos;
+	if (!mz_zip_reader_file_stat ((mz_zip_archive *) pak->zip, pf->zipindex, &stat))
+		return -1;
 
-	if (strcmp(COM_FileGetExtension(filename), "pcx") != 0
-		&& strcmp(COM_FileGetExtension(filename), "tga") != 0
-		&& strcmp(COM_FileGetExtension(filename), "lit") != 0
-		&& strcmp(COM_FileGetExtension(filename), "vis") != 0
-		&& strcmp(COM_FileGetExtension(filename), "ent") != 0)
-		Con_DPrintf ("FindFile: can't find %s\n", filename);
-	else	Con_DPrintf2("FindFile: can't find %s\n", filename);
+	Sys_FileSeek (pak->handle, (int) stat.m_local_header_ofs);
+	if (Sys_FileRead (pak->handle, header, sizeof(header)) != sizeof(header))
+		return -1;
+	if (header[0] != 'P' || header[1] != 'K' || header[2] != 3 || header[3] != 4)
+		return -1;
 
-	if (handle)
-		*handle = -1;
-	if (file)
-		*file = NULL;
-	com_filesize = -1;
-	return com_filesize;
+	pf->filepos = (int) stat.m_local_header_ofs + sizeof(header) +
+			(header[26] | (header[27] << 8)) + (header[28] | (header[29] << 8));
+	return pf->filepos;
 }
 
-static int COM_FindFile(const char *filename, int *handle, FILE **file, unsigned int *path_id)
-{
+/*
+=================
+COM_ZipExtract
+
+Inflates a deflated zip entry into buf, which must hold filelen bytes.
+=================
+*/
+static qboolean COM_ZipExtract (pack_t *pak, packfile_t *pf, void *buf)
+{
+	return mz_zip_reader_extract_to_mem ((mz_zip_archive *) pak->zip, pf->zipindex, buf, pf->filelen, 0);
+}
+
+/*
+=================
+COM_ZipExtractTemp
+
+Callers that want a seekable handle or FILE * on a deflated zip entry
+get an anonymous temp file with the inflated contents instead.
+=================
+*/
+static qboolean COM_ZipExtractTemp (pack_t *pak, packfile_t *pf, int *handle, FILE **file)
+{
+	byte		*buf;
+	FILE		*f;
+	int		h;
+	qboolean	ok;
+
+	buf = (byte *) malloc (pf->filelen + 1);
+	if (!buf || !COM_ZipExtract (pak, pf, buf))
+	{
+		free (buf);
+		return false;
+	}
+
+	if (handle)
+	{
+		h = Sys_FileOpenTemp ();
+		ok = (h != -1 && Sys_FileWrite (h, buf, pf->filelen) == pf->filelen);
+		if (ok)
+		{
+			Sys_FileSeek (h, 0);
+			*handle = h;
+		}
+		else if (h != -1)
+			Sys_FileClose (h);
+	}
+	else
+	{
+		f = tmpfile ();
+		ok = (f && fwrite (buf, 1, pf->filelen, f) == (size_t) pf->filelen);
+		if (ok)
+		{
+			rewind (f);
+			*file = f;
+		}
+		else if (f)
+			fclose (f);
+	}
+
+	free (buf);
+	return ok;
+}
+
+/*
+=================
+Directory listing cache
+
+Loose game directories keep a cached listing of every subdirectory
+that has been searched, so that most lookups don't have to hit the
+OS. The cache is flushed on game change, when a new map is started
+and whenever we write a file ourselves.
+=================
+*/
+typedef struct dircache_s
+{
+	struct dircache_s	*next;
+	unsigned	hashsize;	// power of two
+	int		*hash;		// offset into names + 1, 0 == empty
+	char	*names;		// nul-separated entry names
+	char	path[MAX_OSPATH];	// relative to the search path
+} dircache_t;
+
+#ifdef _WIN32	// file names are case insensitive
+#define COM_DirNameCmp	q_strcasecmp
+#else
+#define COM_DirNameCmp	strcmp
+#endif
+
+static unsigned COM_DirNameHash (const char *name)
+{
+#ifdef _WIN32
+	char	lower[MAX_OSPATH];
+
+	q_strlcpy (lower, name, sizeof(lower));
+	q_strlwr (lower);
+	return COM_HashString (lower);
+#else
+	return COM_HashString (name);
+#endif
+}
+
+static void COM_DirCacheAdd (dircache_t *dc, const char *name, int *namesize, int *namesmax, int *count)
+{
+	int	len;
+
+	if (!strcmp (name, ".") || !strcmp (name, ".."))
+		return;
+
+	len = strlen (name) + 1;
+	if (*namesize + len > *namesmax)
+	{
+		*namesmax = q_max (*namesmax * 2, *namesize + len);
+		dc->names = (char *) realloc (dc->names, *namesmax);
+		if (!dc->names)
+			Sys_Error ("COM_DirCacheAdd: out of memory");
+	}
+	memcpy (dc->names + *namesize, name, len);
+	*namesize += len;
+	(*count)++;
+}
+
+static dircache_t *COM_ReadDirCache (searchpath_t *search, const char *dir)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA	fdat;
+	HANDLE		fhnd;
+#else
+	DIR		*dir_p;
+	struct dirent	*dir_t;
+#endif
+	char		dirpath[MAX_OSPATH];
+	dircache_t	*dc;
+	int		namesize, namesmax, count, ofs;
+	unsigned	pos;
+
+	dc = (dircache_t *) calloc (1, sizeof(dircache_t));
+	if (!dc)
+		Sys_Error ("COM_ReadDirCache: out of memory");
+	q_strlcpy (dc->path, dir, sizeof(dc->path));
+
+	namesize = namesmax = count = 0;
+#ifdef _WIN32
+	q_snprintf (dirpath, sizeof(dirpath), "%s/%s*", search->filename, dir);
+	fhnd = FindFirstFile(dirpath, &fdat);
+	if (fhnd != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			COM_DirCacheAdd (dc, fdat.cFileName, &namesize, &namesmax, &count);
+		} while (FindNextFile(fhnd, &fdat));
+		FindClose(fhnd);
+	}
+#else
+	q_snprintf (dirpath, sizeof(dirpath), "%s/%s", search->filename, dir);
+	dir_p = opendir(dirpath);
+	if (dir_p != NULL)
+	{
+		while ((dir_t = readdir(dir_p)) != NULL)
+			COM_DirCacheAdd (dc, dir_t->d_name, &namesize, &namesmax, &count);
+		closedir(dir_p);
+	}
+#endif
+
+	for (dc->hashsize = 1; dc->hashsize < (unsigned)count * 2; dc->hashsize <<= 1)
+		;
+	dc->hash = (int *) calloc (dc->hashsize, sizeof(int));
+	if (!dc->hash)
+		Sys_Error ("COM_ReadDirCache: out of memory");
+
+	for (ofs = 0; ofs < namesize; ofs += strlen (dc->names + ofs) + 1)
+	{
+		pos = COM_DirNameHash (dc->names + ofs) & (dc->hashsize - 1);
+		while (dc->hash[pos])
+			pos = (pos + 1) & (dc->hashsize - 1);
+		dc->hash[pos] = ofs + 1;
+	}
+
+	dc->next = search->dircache;
+	search->dircache = dc;
+	return dc;
+}
+
+static void COM_FreeDirCache (searchpath_t *search)
+{
+	dircache_t	*dc;
+
+	while (search->dircache)
+	{
+		dc = search->dircache->next;
+		free (search->dircache->hash);
+		free (search->dircache->names);
+		free (search->dircache);
+		search->dircache = dc;
+	}
+}
+
+/*
+=================
+COM_FlushDirCache
+
+Discards the cached listings of all loose game directories.
+=================
+*/
+void COM_FlushDirCache (void)
+{
+	searchpath_t	*search;
+
+	for (search = com_searchpaths; search; search = search->next)
+		COM_FreeDirCache (search);
+}
+
+/*
+=================
+COM_DirCacheHasFile
+
+Checks whether filename exists below a loose game directory,
+using (and filling) the cached listing of its parent directory.
+=================
+*/
+static qboolean COM_DirCacheHasFile (searchpath_t *search, const char *filename)
+{
+	char		dir[MAX_OSPATH];
+	const char	*name;
+	dircache_t	*dc;
+	unsigned	pos, mask;
+
+	name = strrchr (filename, '/');
+	if (name)
+	{
+		name++;
+		if ((size_t)(name - filename) >= sizeof(dir))
+			return false;
+		memcpy (dir, filename, name - filename);
+		dir[name - filename] = 0;
+	}
+	else
+	{
+		name = filename;
+		dir[0] = 0;
+	}
+
+	if (!*name)
+		return false;
+
+	for (dc = search->dircache; dc; dc = dc->next)
+	{
+		if (!COM_DirNameCmp (dc->path, dir))
+			break;
+	}
+	if (!dc)
+		dc = COM_ReadDirCache (search, dir);
+
+	mask = dc->hashsize - 1;
+	for (pos = COM_DirNameHash (name) & mask; dc->hash[pos]; pos = (pos + 1) & mask)
+	{
+		if (!COM_DirNameCmp (dc->names + dc->hash[pos] - 1, name))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+===========
+COM_FindFile
+
+Finds the file in the search path.
+Sets com_filesize and one of handle or file
+If neither of file or handle is set, this
+can be used for detecting a file's presence.
+Deflated zip entries are extracted to a temp
+file, unless extract is false and a handle is
+requested: then the pak handle is returned and
+com_deflatedfile is set for the caller to inflate.
+===========
+*/
+static int COM_FindFile2(const char *filename, int *handle, FILE **file, unsigned int *path_id, char *netpath, size_t size, qboolean extract)
+{
+	searchpath_t	*search;
+	pack_t		*pak;
+	packfile_t	*pf;
+	qboolean	usedircache;
+	int		i, findtime;
+
+	if (file && handle)
+		Sys_Error ("COM_FindFile: both handle and file set");
+
+	file_from_pak = 0;
+	com_deflatedpack = NULL;
+	com_deflatedfile = NULL;
+	memset(netpath, 0, size);
+
+	com_lookups++;
+
+	// only plain relative paths can be answered from the directory listing cache
+	usedircache = !strchr (filename, '\\') && !strchr (filename, ':') && !strstr (filename, "..");
+
+//
+// search through the path, one element at a time
+//
+	for (search = com_searchpaths; search; search = search->next)
+	{
+		if (search->pack)	/* look through all the pak file elements */
+		{
+			pak = search->pack;
+			pf = COM_FindPackFile (pak, filename);
+			if (pf)
+			{
+				if (pak->zip && (handle || file))
+				{
+					if (pf->deflated)
+					{
+						if ((file || extract) && !COM_ZipExtractTemp (pak, pf, handle, file))
+						{
+							Con_Printf ("Couldn't extract %s from %s\n", filename, pak->filename);
+							continue;
+						}
+					}
+					else if (COM_ZipFilePos (pak, pf) == -1)
+					{
+						Con_Printf ("Bad local header for %s in %s\n", filename, pak->filename);
+						continue;
+					}
+				}
+
+				// found it!
+				search->hits++;
+				com_filesize = pf->filelen;
+				file_from_pak = 1;
+				if (path_id)
+					*path_id = search->path_id;
+				if (pf->deflated && (handle || file))
+				{
+					if (handle && !extract)
+					{ /* the caller inflates it from the archive */
+						*handle = pak->handle;
+						com_deflatedpack = pak;
+						com_deflatedfile = pf;
+					}
+					return com_filesize;
+				}
+				if (handle)
+				{
+					*handle = pak->handle;
+					Sys_FileSeek (pak->handle, pf->filepos);
+					return com_filesize;
+				}
+				else if (file)
+				{ /* open a new file on the pakfile */
+					*file = fopen (pak->filename, "rb");
+					if (*file)
+						fseek (*file, pf->filepos, SEEK_SET);
+					return com_filesize;
+				}
+				else /* for COM_FileExists() */
+				{
+					return com_filesize;
+				}
+			}
+		}
+		else	/* check a file in the directory tree */
+		{
+			if (!registered.value)
+			{ /* if not a registered version, don't ever go beyond base */
+				if ( strchr (filename, '/') || strchr (filename,'\\'))
+					continue;
+			}
+
+			if (usedircache && !COM_DirCacheHasFile (search, filename))
+				continue;
+
+			q_snprintf (netpath, size, "%s/%s",search->filename, filename);
+			findtime = Sys_FileTime (netpath);
+			if (findtime == -1)
+				continue;
+
+			search->hits++;
+			if (path_id)
+				*path_id = search->path_id;
+			if (handle)
+			{
+				com_filesize = Sys_FileOpenRead (netpath, &i);
+				*handle = i;
+				return com_filesize;
+			}
+			else if (file)
+			{
+				*file = fopen (netpath, "rb");
+				com_filesize = (*file == NULL) ? -1 : COM_filelength (*file);
+				return com_filesize;
+			}
+			else
+			{
+				return 0; /* dummy valid value for COM_FileExists() */
+			}
+		}
+	}
+
+	if (strcmp(COM_FileGetExtension(filename), "pcx") != 0
+		&& strcmp(COM_FileGetExtension(filename), "tga") != 0
+		&& strcmp(COM_FileGetExtension(filename), "lit") != 0
+		&& strcmp(COM_FileGetExtension(filename), "vis") != 0
+		&& strcmp(COM_FileGetExtension(filename), "ent") != 0)
+		Con_DPrintf ("FindFile: can't find %s\n", filename);
+	else	Con_DPrintf2("FindFile: can't find %s\n", filename);
+
+	com_misses++;
+
+	if (handle)
+		*handle = -1;
+	if (file)
+		*file = NULL;
+	com_filesize = -1;
+	return com_filesize;
+}
+
+static int COM_FindFile(const char *filename, int *handle, FILE **file, unsigned int *path_id)
+{
 	char netpath[MAX_OSPATH];
-	return COM_FindFile2(filename, handle, file, path_id, netpath, sizeof(netpath));
+	return COM_FindFile2(filename, handle, file, path_id, netpath, sizeof(netpath), true);
 }
 
 /*
@@ -1770,7 +2415,7 @@ If it is inside a pak file, this returns false.
 */
 qboolean COM_FullFilePath(const char *filename, char *netpath, size_t size)
 {
-	int ret = COM_FindFile2(filename, NULL, NULL, NULL, netpath, size);
+	int ret = COM_FindFile2(filename, NULL, NULL, NULL, netpath, size, true);
 	if (ret < 0 || !*netpath || file_from_pak)
 		return false;
 
@@ -1801,14 +2446,19 @@ byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 	int		h;
 	byte	*buf;
 	char	base[32];
+	char	netpath[MAX_OSPATH];
 	int		len;
+	pack_t	*zippak;
+	packfile_t	*zipfile;
 
 	buf = NULL;	// quiet compiler warning
 
 // look for it in the filesystem or pack files
-	len = COM_OpenFile (path, &h, path_id);
+	len = COM_FindFile2 (path, &h, NULL, path_id, netpath, sizeof(netpath), false);
 	if (h == -1)
 		return NULL;
+	zippak = com_deflatedpack;
+	zipfile = com_deflatedfile;
 
 // extract the filename base name for hunk tag
 	COM_FileBase (path, base, sizeof(base));
@@ -1825,7 +2475,7 @@ byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 		buf = (byte *) Z_Malloc (len+1);
 		break;
 	case LOADFILE_CACHE:
-		buf = (byte *) Cache_Alloc (loadcache, len+1, base);
+		buf = (byte *) Cache_Alloc (loadcache, len+1, base, CACHE_FILE);
 		break;
 	case LOADFILE_STACK:
 		if (len < loadsize)
@@ -1845,7 +2495,13 @@ byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 
 	((byte *)buf)[len] = 0;
 
-	Sys_FileRead (h, buf, len);
+	if (zipfile)
+	{ // inflate straight into the destination buffer
+		if (!COM_ZipExtract (zippak, zipfile, buf))
+			Sys_Error ("COM_LoadFile: couldn't extract %s from %s", path, zippak->filename);
+	}
+	else
+		Sys_FileRead (h, buf, len);
 	COM_CloseFile (h);
 
 	return buf;
@@ -1890,35 +2546,139 @@ byte *COM_LoadMallocFile (const char *path, unsigned int *path_id)
 	return COM_LoadFile (path, LOADFILE_MALLOC, path_id);
 }
 
-byte *COM_LoadMallocFile_TextMode_OSPath (const char *path, long *len_out)
+/*
+============
+COM_MapFile
+
+Maps a file into memory instead of reading it, if it's large enough to
+be worth it. Views are copy-on-write, so loaders that byte swap their
+input in place keep working without touching the pak file.
+============
+*/
+#define	MAPFILE_MIN_SIZE	(64 * 1024)	// smaller files are cheaper to just read
+#define	MAX_MAPPED_FILES	16
+
+typedef struct
+{
+	byte	*data;
+	int	length;
+} mappedfile_t;
+
+static mappedfile_t	com_mappedfiles[MAX_MAPPED_FILES];
+static qboolean		com_nommap;
+
+static byte *COM_MapView (const char *path, unsigned int *path_id, int minsize, int *length)
+{
+	int	h, len;
+	byte	*buf;
+	char	netpath[MAX_OSPATH];
+
+	len = COM_FindFile2 (path, &h, NULL, path_id, netpath, sizeof(netpath), false);
+	if (h == -1)
+		return NULL;
+
+	buf = NULL;
+	if (len >= minsize && len > 0 && !com_deflatedfile)	// deflated zip entries have to be loaded
+		buf = (byte *) Sys_FileMapView (h, len);
+	COM_CloseFile (h);
+
+	*length = len;
+	return buf;
+}
+
+byte *COM_MapFile (const char *path, unsigned int *path_id)
+{
+	int	len, i;
+	byte	*buf;
+
+	if (com_nommap)
+		return NULL;
+
+	for (i = 0; i < MAX_MAPPED_FILES; i++)
+	{
+		if (!com_mappedfiles[i].data)
+			break;
+	}
+	if (i == MAX_MAPPED_FILES)
+		return NULL;
+
+	buf = COM_MapView (path, path_id, MAPFILE_MIN_SIZE, &len);
+	if (buf)
+	{
+		com_mappedfiles[i].data = buf;
+		com_mappedfiles[i].length = len;
+	}
+
+	return buf;
+}
+
+void COM_UnmapFile (byte *data)
+{
+	int	i;
+
+	for (i = 0; i < MAX_MAPPED_FILES; i++)
+	{
+		if (com_mappedfiles[i].data == data)
+		{
+			Sys_FileUnmapView (data, com_mappedfiles[i].length);
+			com_mappedfiles[i].data = NULL;
+			return;
+		}
+	}
+
+	Sys_Error ("COM_UnmapFile: %p is not mapped", data);
+}
+
+/*
+============
+COM_MapFileView
+
+For data that stays mapped for as long as it's in use, such as sound
+samples that are played straight from the pak. Files of any size are
+mapped, and the view isn't tracked, so it doesn't count against
+MAX_MAPPED_FILES. It remains valid after the pak itself is closed.
+============
+*/
+byte *COM_MapFileView (const char *path, int *length)
+{
+	if (com_nommap)
+		return NULL;
+
+	return COM_MapView (path, NULL, 0, length);
+}
+
+void COM_UnmapFileView (byte *data, int length)
+{
+	Sys_FileUnmapView (data, length);
+}
+
+static byte *COM_LoadMallocFile_Mode_OSPath (const char *path, const char *mode, long *len_out)
 {
 	FILE	*f;
 	byte	*data;
 	long	len, actuallen;
 	
-	// ericw -- this is used by Host_Loadgame_f. Translate CRLF to LF on load games,
-	// othewise multiline messages have a garbage character at the end of each line.
-	// TODO: could handle in a way that allows loading CRLF savegames on mac/linux
-	// without the junk characters appearing.
-	f = fopen (path, "rt");
+	f = fopen (path, mode);
 	if (f == NULL)
 		return NULL;
 	
 	len = COM_filelength (f);
-	if (len < 0)
-		return NULL;
-	
-	data = (byte *) malloc (len + 1);
+	data = (len < 0) ? NULL : (byte *) malloc (len + 1);
 	if (data == NULL)
+	{
+		fclose (f);
 		return NULL;
+	}
 
 	// (actuallen < len) if CRLF to LF translation was performed
 	actuallen = fread (data, 1, len, f);
 	if (ferror(f))
 	{
+		fclose (f);
 		free (data);
 		return NULL;
 	}
+	fclose (f);
 	data[actuallen] = '\0';
 	
 	if (len_out != NULL)
@@ -1926,6 +2686,20 @@ byte *COM_LoadMallocFile_TextMode_OSPath (const char *path, long *len_out)
 	return data;
 }
 
+byte *COM_LoadMallocFile_TextMode_OSPath (const char *path, long *len_out)
+{
+	// ericw -- this is used by Host_Loadgame_f. Translate CRLF to LF on load games,
+	// othewise multiline messages have a garbage character at the end of each line.
+	// TODO: could handle in a way that allows loading CRLF savegames on mac/linux
+	// without the junk characters appearing.
+	return COM_LoadMallocFile_Mode_OSPath (path, "rt", len_out);
+}
+
+byte *COM_LoadMallocFile_OSPath (const char *path, long *len_out)
+{
+	return COM_LoadMallocFile_Mode_OSPath (path, "rb", len_out);
+}
+
 const char *COM_ParseIntNewline(const char *buffer, int *value)
 {
 	int consumed = 0;
@@ -1948,6 +2722,34 @@ const char *COM_ParseStringNewline(const char *buffer)
 	return buffer + consumed;
 }
 
+/*
+=================
+COM_HashPackFiles
+
+Hashes the directory of a pak or zip file for COM_FindPackFile.
+=================
+*/
+static void COM_HashPackFiles (pack_t *pack)
+{
+	unsigned	pos, mask;
+	int		i;
+
+	for (pack->hashsize = 1; pack->hashsize < pack->numfiles * 2; pack->hashsize <<= 1)
+		;
+	pack->hash = (unsigned short *) calloc (pack->hashsize, sizeof(unsigned short));
+	if (!pack->hash)
+		Sys_Error ("COM_HashPackFiles: out of memory for %s", pack->filename);
+
+	mask = pack->hashsize - 1;
+	for (i = 0; i < pack->numfiles; i++)
+	{
+		pos = COM_HashString (pack->files[i].name) & mask;
+		while (pack->hash[pos])
+			pos = (pos + 1) & mask;
+		pack->hash[pos] = i + 1;
+	}
+}
+
 /*
 =================
 COM_LoadPackFile -- johnfitz -- modified based on topaz's tutorial
@@ -1998,7 +2800,9 @@ static pack_t *COM_LoadPackFile (const char *packfile)
 	if (numpackfiles != PAK0_COUNT)
 		com_modified = true;	// not the original file
 
-	newfiles = (packfile_t *) Z_Malloc(numpackfiles * sizeof(packfile_t));
+	newfiles = (packfile_t *) calloc (numpackfiles, sizeof(packfile_t));
+	if (!newfiles)
+		Sys_Error ("COM_LoadPackFile: out of memory for %s", packfile);
 
 	Sys_FileSeek (packhandle, header.dirofs);
 	Sys_FileRead (packhandle, (void *)info, header.dirlen);
@@ -2023,11 +2827,191 @@ static pack_t *COM_LoadPackFile (const char *packfile)
 	pack->handle = packhandle;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
+	COM_HashPackFiles (pack);
 
 	//Sys_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
 	return pack;
 }
 
+static size_t COM_ZipRead (void *opaque, mz_uint64 ofs, void *buf, size_t n)
+{
+	pack_t	*pak = (pack_t *) opaque;
+	int	r;
+
+	Sys_FileSeek (pak->handle, (int) ofs);
+	r = Sys_FileRead (pak->handle, buf, (int) n);
+	return (r < 0) ? 0 : (size_t) r;
+}
+
+/*
+=================
+COM_LoadZipFile
+
+Takes an explicit path to a .pk3 or .zip file and reads its central
+directory. Stored entries are read in place like pak files, deflated
+ones are inflated when they are loaded. Entries that are directories,
+encrypted or use other compression methods are skipped.
+=================
+*/
+static pack_t *COM_LoadZipFile (const char *zipfile)
+{
+	mz_zip_archive_file_stat	stat;
+	mz_zip_archive	*zip;
+	packfile_t	*newfiles;
+	pack_t		*pack;
+	int		packhandle, len, i, numzipfiles, numpackfiles;
+
+	len = Sys_FileOpenRead (zipfile, &packhandle);
+	if (len == -1)
+		return NULL;
+
+	pack = (pack_t *) Z_Malloc (sizeof (pack_t));
+	q_strlcpy (pack->filename, zipfile, sizeof(pack->filename));
+	pack->handle = packhandle;
+
+	zip = (mz_zip_archive *) calloc (1, sizeof(mz_zip_archive));
+	if (!zip)
+		Sys_Error ("COM_LoadZipFile: out of memory for %s", zipfile);
+	zip->m_pRead = COM_ZipRead;
+	zip->m_pIO_opaque = pack;
+	newfiles = NULL;
+
+	if (!mz_zip_reader_init (zip, len, MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY))
+	{
+		Sys_Printf ("WARNING: %s is not a valid zip file, ignored\n", zipfile);
+		goto fail;
+	}
+
+	numzipfiles = mz_zip_reader_get_num_files (zip);
+	if (numzipfiles > MAX_FILES_IN_ZIP)
+	{
+		Sys_Printf ("WARNING: %s has %i files, ignored\n", zipfile, numzipfiles);
+		goto fail;
+	}
+
+	newfiles = (packfile_t *) calloc (q_max (numzipfiles, 1), sizeof(packfile_t));
+	if (!newfiles)
+		Sys_Error ("COM_LoadZipFile: out of memory for %s", zipfile);
+
+	for (i = numpackfiles = 0; i < numzipfiles; i++)
+	{
+		if (!mz_zip_reader_file_stat (zip, i, &stat))
+			continue;
+		if (stat.m_is_directory || stat.m_is_encrypted || !stat.m_is_supported)
+			continue;
+		if (stat.m_method != 0 && stat.m_method != MZ_DEFLATED)
+			continue;
+		if (stat.m_uncomp_size > 0x7fffffff || stat.m_local_header_ofs > 0x7fffffff)
+			continue;
+		if (strlen (stat.m_filename) >= sizeof(newfiles[0].name))
+			continue;
+
+		q_strlcpy (newfiles[numpackfiles].name, stat.m_filename, sizeof(newfiles[0].name));
+		newfiles[numpackfiles].filepos = -1;
+		newfiles[numpackfiles].filelen = (int) stat.m_uncomp_size;
+		newfiles[numpackfiles].zipindex = i;
+		newfiles[numpackfiles].deflated = (stat.m_method == MZ_DEFLATED);
+		numpackfiles++;
+	}
+
+	if (!numpackfiles)
+	{
+		Sys_Printf ("WARNING: %s has no usable files, ignored\n", zipfile);
+		goto fail;
+	}
+
+	com_modified = true;	// not the original game data
+
+	pack->numfiles = numpackfiles;
+	pack->files = newfiles;
+	pack->zip = zip;
+	COM_HashPackFiles (pack);
+
+	//Sys_Printf ("Added zipfile %s (%i files)\n", zipfile, numpackfiles);
+	return pack;
+
+fail:
+	mz_zip_reader_end (zip);
+	free (zip);
+	free (newfiles);
+	Sys_FileClose (packhandle);
+	Z_Free (pack);
+	return NULL;
+}
+
+/*
+=================
+COM_FreePack
+=================
+*/
+static void COM_FreePack (pack_t *pack)
+{
+	if (pack->zip)
+	{
+		mz_zip_reader_end ((mz_zip_archive *) pack->zip);
+		free (pack->zip);
+	}
+	Sys_FileClose (pack->handle);
+	free (pack->hash);
+	free (pack->files);
+	Z_Free (pack);
+}
+
+static int COM_ZipNameCmp (const void *a, const void *b)
+{
+	return q_strcasecmp (*(const char **) a, *(const char **) b);
+}
+
+/*
+=================
+COM_AddZipFiles
+
+Adds every .pk3 and .zip file in a loose game directory, in
+alphabetical order so that later names override earlier ones.
+=================
+*/
+static void COM_AddZipFiles (searchpath_t *dirsearch)
+{
+	dircache_t	*dc;
+	const char	**names, *name, *ext;
+	char		zipfile[MAX_OSPATH];
+	searchpath_t	*search;
+	pack_t		*pak;
+	unsigned	pos;
+	int		i, count;
+
+	dc = COM_ReadDirCache (dirsearch, "");
+	names = (const char **) malloc (q_max (dc->hashsize, 1) * sizeof(*names));
+	if (!names)
+		Sys_Error ("COM_AddZipFiles: out of memory");
+
+	for (pos = count = 0; pos < dc->hashsize; pos++)
+	{
+		if (!dc->hash[pos])
+			continue;
+		name = dc->names + dc->hash[pos] - 1;
+		ext = COM_FileGetExtension (name);
+		if (!q_strcasecmp (ext, "pk3") || !q_strcasecmp (ext, "zip"))
+			names[count++] = name;
+	}
+	qsort (names, count, sizeof(*names), COM_ZipNameCmp);
+
+	for (i = 0; i < count; i++)
+	{
+		q_snprintf (zipfile, sizeof(zipfile), "%s/%s", dirsearch->filename, names[i]);
+		pak = COM_LoadZipFile (zipfile);
+		if (!pak)
+			continue;
+		search = (searchpath_t *) Z_Malloc(sizeof(searchpath_t));
+		search->path_id = dirsearch->path_id;
+		search->pack = pak;
+		search->next = com_searchpaths;
+		com_searchpaths = search;
+	}
+
+	free (names);
+}
+
 /*
 =================
 COM_AddGameDirectory -- johnfitz -- modified based on topaz's tutorial
@@ -2040,6 +3024,7 @@ static void COM_AddGameDirectory (const char *base, const char *dir)
 	searchpath_t *search;
 	pack_t *pak, *qspak;
 	char pakfile[MAX_OSPATH];
+	searchpath_t *dirsearch;
 	qboolean been_here = false;
 
 	q_strlcpy (com_gamedir, va("%s/%s", base, dir), sizeof(com_gamedir));
@@ -2056,6 +3041,7 @@ _add_path:
 	q_strlcpy (search->filename, com_gamedir, sizeof(search->filename));
 	search->next = com_searchpaths;
 	com_searchpaths = search;
+	dirsearch = search;
 
 	// add any pak files in the format pak0.pak pak1.pak, ...
 	for (i = 0; ; i++)
@@ -2088,6 +3074,9 @@ _add_path:
 		if (!pak) break;
 	}
 
+	// add any pk3 / zip files, overriding the pak files
+	COM_AddZipFiles (dirsearch);
+
 	if (!been_here && host_parms->userdir != host_parms->basedir)
 	{
 		been_here = true;
@@ -2158,6 +3147,9 @@ static void COM_Game_f (void)
 		CL_Disconnect ();
 		Host_ShutdownServer(true);
 
+		//Finish writing screenshots into the old gamedir
+		SCR_CaptureFinish ();
+
 		//Write config file
 		Host_WriteConfiguration ();
 
@@ -2165,11 +3157,9 @@ static void COM_Game_f (void)
 		while (com_searchpaths != com_base_searchpaths)
 		{
 			if (com_searchpaths->pack)
-			{
-				Sys_FileClose (com_searchpaths->pack->handle);
-				Z_Free (com_searchpaths->pack->files);
-				Z_Free (com_searchpaths->pack);
-			}
+				COM_FreePack (com_searchpaths->pack);
+			else
+				COM_FreeDirCache (com_searchpaths);
 			search = com_searchpaths->next;
 			Z_Free (com_searchpaths);
 			com_searchpaths = search;
@@ -2212,6 +3202,7 @@ static void COM_Game_f (void)
 		}
 
 		//clear out and reload appropriate data
+		COM_FlushDirCache ();
 		Cache_Flush ();
 		Mod_ResetAll();
 		Sky_ClearAll();
@@ -2248,6 +3239,8 @@ void COM_InitFilesystem (void) //johnfitz -- modified based on topaz's tutorial
 	Cmd_AddCommand ("path", COM_Path_f);
 	Cmd_AddCommand ("game", COM_Game_f); //johnfitz
 
+	com_nommap = COM_CheckParm ("-nommap") != 0;
+
 	i = COM_CheckParm ("-basedir");
 	if (i && i < com_argc-1)
 		q_strlcpy (com_basedir, com_argv[i + 1], sizeof(com_basedir));
@@ -2514,6 +3507,38 @@ unsigned COM_HashString (const char *str)
 	return hash;
 }
 
+/*
+================
+COM_HashStringNoCase
+================
+*/
+unsigned COM_HashStringNoCase (const char *str)
+{
+	unsigned hash = 0x811c9dc5u;
+	while (*str)
+	{
+		hash ^= q_tolower (*str++);
+		hash *= 0x01000193u;
+	}
+	return hash;
+}
+
+/*
+================
+COM_HashBlock64
+================
+*/
+uint64_t COM_HashBlock64 (uint64_t hash, const void *data, size_t len)
+{
+	const byte *p = (const byte *) data;
+	while (len--)
+	{
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
 static size_t mz_zip_file_read_func(void *opaque, mz_uint64 ofs, void *buf, size_t n)
 {
 	if (SDL_RWseek((SDL_RWops*)opaque, (Sint64)ofs, RW_SEEK_SET) < 0)
@@ -60,9 +60,25 @@ void SZ_Alloc (sizebuf_t *buf, int startsize);
 void SZ_Free (sizebuf_t *buf);
 void SZ_Clear (sizebuf_t *buf);
 void *SZ_GetSpace (sizebuf_t *buf, int length);
+byte *SZ_Reserve (sizebuf_t *buf, int maxlength);	// NULL if it doesn't fit, nothing counted until SZ_Commit
+void SZ_Commit (sizebuf_t *buf, const byte *end);
 void SZ_Write (sizebuf_t *buf, const void *data, int length);
 void SZ_Print (sizebuf_t *buf, const char *data);	// strcats onto the sizebuf
 
+// malloc'ed text buffer that grows as needed, the memory is kept across
+// SB_Clear calls so a reused buffer stops allocating once it is big enough
+typedef struct strbuf_s
+{
+	char	*data;
+	size_t	len;		// not counting the trailing 0
+	size_t	maxlen;
+} strbuf_t;
+
+void SB_Clear (strbuf_t *sb);
+void SB_Free (strbuf_t *sb);
+void SB_Printf (strbuf_t *sb, const char *fmt, ...) FUNC_PRINTF(2,3);
+void SB_Write (strbuf_t *sb, const void *data, size_t len);	// binary data, still 0 terminated
+
 //============================================================================
 
 typedef struct link_s
@@ -114,11 +130,25 @@ int MSG_ReadShort (void);
 int MSG_ReadLong (void);
 float MSG_ReadFloat (void);
 const char *MSG_ReadString (void);
+const byte *MSG_ReadData (int size);	// NULL and msg_badread if there aren't size bytes left
 
 float MSG_ReadCoord (unsigned int flags);
 float MSG_ReadAngle (unsigned int flags);
 float MSG_ReadAngle16 (unsigned int flags); //johnfitz
 
+// coord and angle encodings for one set of protocol flags, so code that
+// writes or decodes whole updates in place doesn't test the flags per field
+typedef struct
+{
+	int	coordsize, anglesize;
+	byte	*(*writecoord) (byte *p, float f);	// return the byte after the field
+	byte	*(*writeangle) (byte *p, float f);
+	float	(*readcoord) (const byte *p);
+	float	(*readangle) (const byte *p);
+} msgcodec_t;
+
+void MSG_InitCodec (msgcodec_t *codec, unsigned int flags);
+
 //============================================================================
 
 void Q_memset (void *dest, int fill, size_t count);
@@ -191,6 +221,14 @@ char *va (const char *format, ...) FUNC_PRINTF(1,2);
 // does a varargs printf into a temp buffer
 
 unsigned COM_HashString (const char *str);
+unsigned COM_HashStringNoCase (const char *str);	// same hash for any letter case
+
+// 64 bit FNV-1a, for keying on-disk caches; chain calls to hash several blocks
+#define	COM_HASH64_INIT	0xcbf29ce484222325ULL
+uint64_t COM_HashBlock64 (uint64_t hash, const void *data, size_t len);
+
+// commands, aliases and cvars are indexed by COM_HashStringNoCase
+#define	CMD_HASHSIZE	256	// power of two
 
 // localization support for 2021 rerelease version:
 void LOC_Init (void);
@@ -206,7 +244,9 @@ size_t LOC_Format (const char *format, const char* (*getarg_fn)(int idx, void* u
 typedef struct
 {
 	char	name[MAX_QPATH];
-	int		filepos, filelen;
+	int		filepos, filelen;	// filepos is -1 until resolved for zip entries
+	int		zipindex;		// central directory index, zip files only
+	qboolean	deflated;
 } packfile_t;
 
 typedef struct pack_s
@@ -215,8 +255,13 @@ typedef struct pack_s
 	int		handle;
 	int		numfiles;
 	packfile_t	*files;
+	int		hashsize;		// power of two
+	unsigned short	*hash;		// index into files + 1, 0 == empty
+	void	*zip;			// mz_zip_archive for .pk3/.zip files, NULL for .pak
 } pack_t;
 
+struct dircache_s;
+
 typedef struct searchpath_s
 {
 	unsigned int path_id;	// identifier assigned to the game directory
@@ -224,6 +269,8 @@ typedef struct searchpath_s
 					// <userdir>/game1 have the same id.
 	char	filename[MAX_OSPATH];
 	pack_t	*pack;			// only one of filename / pack will be used
+	struct dircache_s	*dircache;	// cached directory listings, loose directories only
+	unsigned int	hits;		// number of files found in this path
 	struct searchpath_s	*next;
 } searchpath_t;
 
@@ -238,6 +285,8 @@ extern	char	com_gamedir[MAX_OSPATH];
 extern	int	file_from_pak;	// global indicating that file came from a pak
 
 void COM_WriteFile (const char *filename, const void *data, int len);
+qboolean COM_WriteGZ (const char *name, const byte *data, size_t size);	// full path, thread safe; in gzip.c
+void COM_FlushDirCache (void);
 int COM_OpenFile (const char *filename, int *handle, unsigned int *path_id);
 int COM_FOpenFile (const char *filename, FILE **file, unsigned int *path_id);
 qboolean COM_FileExists (const char *filename, unsigned int *path_id);
@@ -264,10 +313,24 @@ void COM_LoadCacheFile (const char *path, struct cache_user_s *cu,
 byte *COM_LoadMallocFile (const char *path, unsigned int *path_id);
 	// allocates the buffer on the system mem (malloc).
 
+// maps the file into memory as a private copy-on-write view, which the
+// caller may modify. returns NULL if the file is too small to be worth
+// mapping or can't be mapped; the caller should then fall back to one of
+// the above. the view is not zero terminated. release with COM_UnmapFile.
+byte *COM_MapFile (const char *path, unsigned int *path_id);
+void COM_UnmapFile (byte *data);
+
+// the same, for views that are kept around: maps files of any size and
+// returns the length of the view, which must be passed back to
+// COM_UnmapFileView. the view outlives the pak it was mapped from.
+byte *COM_MapFileView (const char *path, int *length);
+void COM_UnmapFileView (byte *data, int length);
+
 // Opens the given path directly, ignoring search paths.
 // Returns NULL on failure, or else a '\0'-terminated malloc'ed buffer.
 // Loads in "t" mode so CRLF to LF translation is performed on Windows.
 byte *COM_LoadMallocFile_TextMode_OSPath (const char *path, long *len_out);
+byte *COM_LoadMallocFile_OSPath (const char *path, long *len_out);	// the same without translation
 
 // Attempts to parse an int, followed by a newline.
 // Returns advanced buffer position.
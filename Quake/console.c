@@ -48,6 +48,9 @@ int		con_backscroll;		// lines up from bottom to display
 int		con_current;		// where next message will be printed
 int		con_x;				// offset in current line for next print
 char		*con_text = NULL;
+static unsigned short	*con_linelen;	// printed columns of each line, the rest is blank
+
+#define	CON_MINWIDTH	38		// 320 wide
 
 cvar_t		con_notifytime = {"con_notifytime","3",CVAR_NONE};	//seconds
 cvar_t		con_logcenterprint = {"con_logcenterprint", "1", CVAR_NONE}; //johnfitz
@@ -141,6 +144,8 @@ static void Con_Clear_f (void)
 {
 	if (con_text)
 		Q_memset (con_text, ' ', con_buffersize); //johnfitz -- con_buffersize replaces CON_TEXTSIZE
+	if (con_linelen)
+		Q_memset (con_linelen, 0, con_totallines * sizeof(unsigned short));
 	con_backscroll = 0; //johnfitz -- if console is empty, being scrolled up is confusing
 }
 
@@ -250,11 +255,13 @@ If the line width has changed, reformat the buffer.
 */
 void Con_CheckResize (void)
 {
-	int	i, j, width, oldwidth, oldtotallines, numlines, numchars;
+	int	i, width, oldwidth, oldtotallines, numlines, numchars, src, len;
 	char	*tbuf; //johnfitz -- tbuf no longer a static array
+	unsigned short	*oldlen;
 	int mark; //johnfitz
 
 	width = (vid.conwidth >> 3) - 2; //johnfitz -- use vid.conwidth instead of vid.width
+	width = q_max(width, CON_MINWIDTH);	// con_linelen is sized for this
 
 	if (width == con_linewidth)
 		return;
@@ -274,18 +281,21 @@ void Con_CheckResize (void)
 		numchars = con_linewidth;
 
 	mark = Hunk_LowMark (); //johnfitz
-	tbuf = (char *) Hunk_Alloc (con_buffersize); //johnfitz
+	tbuf = (char *) Hunk_Alloc (con_buffersize + oldtotallines * sizeof(unsigned short)); //johnfitz
+	oldlen = (unsigned short *) (tbuf + con_buffersize);
 
 	Q_memcpy (tbuf, con_text, con_buffersize);//johnfitz -- con_buffersize replaces CON_TEXTSIZE
 	Q_memset (con_text, ' ', con_buffersize);//johnfitz -- con_buffersize replaces CON_TEXTSIZE
+	Q_memcpy (oldlen, con_linelen, oldtotallines * sizeof(unsigned short));
+	Q_memset (con_linelen, 0, con_totallines * sizeof(unsigned short));
 
+	// only the printed part of each line needs to move
 	for (i = 0; i < numlines; i++)
 	{
-		for (j = 0; j < numchars; j++)
-		{
-			con_text[(con_totallines - 1 - i) * con_linewidth + j] =
-					tbuf[((con_current - i + oldtotallines) % oldtotallines) * oldwidth + j];
-		}
+		src = (con_current - i + oldtotallines) % oldtotallines;
+		len = q_min(oldlen[src], numchars);
+		Q_memcpy (con_text + (con_totallines - 1 - i) * con_linewidth, tbuf + src * oldwidth, len);
+		con_linelen[con_totallines - 1 - i] = len;
 	}
 
 	Hunk_FreeToLowMark (mark); //johnfitz
@@ -297,6 +307,53 @@ void Con_CheckResize (void)
 }
 
 
+#define	MAXPRINTMSG	4096
+
+/*
+Con_Printf from a thread other than the main one (the music decoder)
+only holds on to the message, the main thread prints it from
+Con_PrintHeld once a frame.
+*/
+static unsigned long	con_mainthread;
+static SDL_mutex	*con_heldlock;
+static char		con_held[MAXPRINTMSG];
+static int		con_heldlen;
+
+// returns true if msg was held for the main thread
+static qboolean Con_HoldPrint (const char *msg)
+{
+	int	len;
+
+	if (!con_heldlock || (unsigned long) SDL_ThreadID () == con_mainthread)
+		return false;
+
+	len = Q_strlen (msg);
+	SDL_LockMutex (con_heldlock);
+	if (con_heldlen + len < (int) sizeof(con_held))
+	{	// else dropped, the main thread hasn't kept up
+		memcpy (con_held + con_heldlen, msg, len + 1);
+		con_heldlen += len;
+	}
+	SDL_UnlockMutex (con_heldlock);
+
+	return true;
+}
+
+void Con_PrintHeld (void)
+{
+	char	msg[MAXPRINTMSG];
+
+	if (!con_heldlock || !con_heldlen)
+		return;
+
+	SDL_LockMutex (con_heldlock);
+	memcpy (msg, con_held, con_heldlen + 1);
+	con_heldlen = 0;
+	SDL_UnlockMutex (con_heldlock);
+
+	Con_SafePrintf ("%s", msg);
+}
+
 /*
 ================
 Con_Init
@@ -306,6 +363,9 @@ void Con_Init (void)
 {
 	int i;
 
+	con_mainthread = (unsigned long) SDL_ThreadID ();
+	con_heldlock = SDL_CreateMutex ();
+
 	//johnfitz -- user settable console buffer size
 	i = COM_CheckParm("-consize");
 	if (i && i < com_argc-1)
@@ -316,10 +376,11 @@ void Con_Init (void)
 
 	con_text = (char *) Hunk_AllocName (con_buffersize, "context");//johnfitz -- con_buffersize replaces CON_TEXTSIZE
 	Q_memset (con_text, ' ', con_buffersize);//johnfitz -- con_buffersize replaces CON_TEXTSIZE
+	con_linelen = (unsigned short *) Hunk_AllocName (con_buffersize / CON_MINWIDTH * sizeof(unsigned short), "conlines");
 	con_linewidth = -1;
 
 	//johnfitz -- no need to run Con_CheckResize here
-	con_linewidth = 38;
+	con_linewidth = CON_MINWIDTH;
 	con_totallines = con_buffersize / con_linewidth;//johnfitz -- con_buffersize replaces CON_TEXTSIZE
 	con_backscroll = 0;
 	con_current = con_totallines - 1;
@@ -356,6 +417,7 @@ static void Con_Linefeed (void)
 	con_x = 0;
 	con_current++;
 	Q_memset (&con_text[(con_current%con_totallines)*con_linewidth], ' ', con_linewidth);
+	con_linelen[con_current%con_totallines] = 0;
 }
 
 /*
@@ -444,6 +506,8 @@ static void Con_Print (const char *txt)
 			y = con_current % con_totallines;
 			con_text[y*con_linewidth+con_x] = c | mask;
 			con_x++;
+			if (con_linelen[y] < con_x)
+				con_linelen[y] = con_x;
 			if (con_x >= con_linewidth)
 				con_x = 0;
 			break;
@@ -457,6 +521,188 @@ static void Con_Print (const char *txt)
 static char	logfilename[MAX_OSPATH];	// current logfile name
 static int	log_fd = -1;			// log file descriptor
 
+cvar_t	log_timestamps = {"log_timestamps", "0", CVAR_NONE};	// start each line of qconsole.log with the time
+cvar_t	log_maxsize = {"log_maxsize", "0", CVAR_NONE};		// KB before qconsole.log is rotated, 0 = never
+cvar_t	log_compress = {"log_compress", "0", CVAR_NONE};	// gzip the rotated logs
+
+/*
+==============================================================================
+
+LOG WRITER
+
+Con_DebugLog copies the text into a ring and a thread writes the ring out
+in batches every LOG_FLUSH_MSEC, so a print never waits on the disk.  The
+main thread is the only one that fills the ring (other threads' prints are
+held for it) and the writer the only one that empties it, so the head and
+tail are all the locking there is.  If the writer falls a whole ring behind
+the text is dropped and the log says how much.  Before the thread starts,
+and without SDL2, the text is written directly.
+
+The writer also rotates the log: past log_maxsize KB qconsole.log becomes
+qconsole.1.log, the older ones move up to LOG_KEEP, and with log_compress
+they're gzipped on the way.
+==============================================================================
+*/
+
+#define	LOG_RING_SIZE		(1024 * 1024)	// power of two
+#define	LOG_FLUSH_MSEC		100
+#define	LOG_KEEP			5
+
+#if defined(USE_SDL2)
+static char			*log_ring;
+static SDL_atomic_t	log_head;		// total bytes queued, main thread
+static SDL_atomic_t	log_tail;		// total bytes written, writer thread
+static SDL_atomic_t	log_quit;
+static SDL_atomic_t	log_rotatesize;	// bytes, from log_maxsize
+static SDL_atomic_t	log_gzip;
+static SDL_Thread	*log_writer;
+static SDL_threadID	log_mainthread;
+static int			log_dropped;	// bytes, main thread
+#endif
+static long			log_size;		// of the open file, whoever writes it
+static qboolean		log_linestart = true;
+static time_t		log_stamptime;
+static char			log_stamp[32];
+
+// replaces from with a gzipped copy, leaves it alone if that fails
+static void LOG_GzipFile (const char *from, const char *to)
+{
+	FILE	*f;
+	long	len;
+	byte	*data;
+	qboolean	ok;
+
+	f = fopen (from, "rb");
+	if (!f)
+		return;
+	fseek (f, 0, SEEK_END);
+	len = ftell (f);
+	fseek (f, 0, SEEK_SET);
+	data = (byte *) malloc (len > 0 ? len : 1);
+	ok = data && fread (data, 1, len, f) == (size_t)len && COM_WriteGZ (to, data, len);
+	fclose (f);
+	free (data);
+	if (ok)
+		remove (from);
+}
+
+static void LOG_Rotate (qboolean gzip)
+{
+	char	from[MAX_OSPATH], to[MAX_OSPATH];
+	int		base, i, z;
+
+	close (log_fd);
+
+	base = (int) strlen (logfilename) - 4;	// without .log
+	for (i = LOG_KEEP - 1; i > 0; i--)
+	{
+		for (z = 0; z < 2; z++)
+		{
+			q_snprintf (from, sizeof(from), "%.*s.%d.log%s", base, logfilename, i, z ? ".gz" : "");
+			q_snprintf (to, sizeof(to), "%.*s.%d.log%s", base, logfilename, i + 1, z ? ".gz" : "");
+			remove (to);
+			rename (from, to);
+		}
+	}
+
+	q_snprintf (from, sizeof(from), "%.*s.1.log", base, logfilename);
+	remove (from);
+	rename (logfilename, from);
+	if (gzip)
+	{
+		q_snprintf (to, sizeof(to), "%.*s.1.log.gz", base, logfilename);
+		LOG_GzipFile (from, to);
+	}
+
+	log_fd = open (logfilename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	log_size = 0;
+}
+
+#if defined(USE_SDL2)
+static void LOG_Flush (void)
+{
+	unsigned int	head, tail, start, n;
+	int				rotate;
+
+	tail = SDL_AtomicGet (&log_tail);
+	head = SDL_AtomicGet (&log_head);
+	SDL_MemoryBarrierAcquire ();
+	while (tail != head)
+	{
+		start = tail & (LOG_RING_SIZE - 1);
+		n = q_min (head - tail, LOG_RING_SIZE - start);
+		if (log_fd != -1 && write (log_fd, log_ring + start, n) > 0)
+			log_size += n;
+		tail += n;
+	}
+	SDL_AtomicSet (&log_tail, tail);
+
+	rotate = SDL_AtomicGet (&log_rotatesize);
+	if (log_fd != -1 && rotate > 0 && log_size >= rotate)
+		LOG_Rotate (SDL_AtomicGet (&log_gzip) != 0);
+}
+
+static int SDLCALL LOG_WriterThread (void *unused)
+{
+	while (!SDL_AtomicGet (&log_quit))
+	{
+		SDL_Delay (LOG_FLUSH_MSEC);
+		LOG_Flush ();
+	}
+	return 0;
+}
+
+static void LOG_Settings_f (cvar_t *var)
+{
+	SDL_AtomicSet (&log_rotatesize, q_max (0, (int) log_maxsize.value) * 1024);
+	SDL_AtomicSet (&log_gzip, log_compress.value != 0);
+}
+#endif
+
+// queues text, or writes it when there is no writer
+static void LOG_Write (const char *text, int len)
+{
+#if defined(USE_SDL2)
+	unsigned int	head, start, n;
+	char			note[64];
+
+	if (log_writer && SDL_ThreadID () == log_mainthread)
+	{
+		head = SDL_AtomicGet (&log_head);
+		if (log_dropped && LOG_RING_SIZE - (head - SDL_AtomicGet (&log_tail)) >= (unsigned) sizeof(note) + len)
+		{
+			n = q_snprintf (note, sizeof(note), "[%d bytes of log dropped]\n", log_dropped);
+			log_dropped = 0;
+			LOG_Write (note, n);
+			head = SDL_AtomicGet (&log_head);
+		}
+		if (LOG_RING_SIZE - (head - SDL_AtomicGet (&log_tail)) < (unsigned) len)
+		{
+			log_dropped += len;
+			return;
+		}
+		while (len)
+		{
+			start = head & (LOG_RING_SIZE - 1);
+			n = q_min ((unsigned) len, LOG_RING_SIZE - start);
+			memcpy (log_ring + start, text, n);
+			head += n;
+			text += n;
+			len -= n;
+		}
+		SDL_MemoryBarrierRelease ();
+		SDL_AtomicSet (&log_head, head);
+		return;
+	}
+	if (log_writer)
+		return;		// an odd thread printing on a dedicated server, the file is the writer's
+#endif
+	if (write (log_fd, text, len) > 0)
+		log_size += len;
+	if (log_maxsize.value > 0 && log_size >= log_maxsize.value * 1024)
+		LOG_Rotate (log_compress.value != 0);
+}
+
 /*
 ================
 Con_DebugLog
@@ -464,10 +710,31 @@ Con_DebugLog
 */
 void Con_DebugLog(const char *msg)
 {
+	const char	*end;
+	time_t		now;
+
 	if (log_fd == -1)
 		return;
 
-	write(log_fd, msg, strlen(msg));
+	while (*msg)
+	{
+		if (log_linestart && log_timestamps.value)
+		{
+			now = time (NULL);
+			if (now != log_stamptime)
+			{
+				log_stamptime = now;
+				strftime (log_stamp, sizeof(log_stamp), "[%Y-%m-%d %H:%M:%S] ", localtime (&now));
+			}
+			LOG_Write (log_stamp, strlen (log_stamp));
+		}
+
+		end = strchr (msg, '\n');
+		log_linestart = (end != NULL);
+		end = end ? end + 1 : msg + strlen (msg);
+		LOG_Write (msg, end - msg);
+		msg = end;
+	}
 }
 
 
@@ -478,7 +745,6 @@ Con_Printf
 Handles cursor positioning, line wrapping, etc
 ================
 */
-#define	MAXPRINTMSG	4096
 void Con_Printf (const char *fmt, ...)
 {
 	va_list		argptr;
@@ -489,6 +755,9 @@ void Con_Printf (const char *fmt, ...)
 	q_vsnprintf (msg, sizeof(msg), fmt, argptr);
 	va_end (argptr);
 
+	if (Con_HoldPrint (msg))
+		return;
+
 // also echo to debugging console
 	Sys_Printf ("%s", msg);
 
@@ -623,6 +892,9 @@ void Con_SafePrintf (const char *fmt, ...)
 	q_vsnprintf (msg, sizeof(msg), fmt, argptr);
 	va_end (argptr);
 
+	if (Con_HoldPrint (msg))
+		return;
+
 	temp = scr_disabled_for_loading;
 	scr_disabled_for_loading = true;
 	Con_Printf ("%s", msg);
@@ -717,21 +989,96 @@ tab_t	*tablist;
 
 //defs from elsewhere
 extern qboolean	keydown[256];
-typedef struct cmd_function_s
+
+/*
+==============================================================================
+
+COMPLETION INDEX
+
+Command, cvar and alias names are kept in one array sorted with strcmp,
+updated as they are added and removed, so that the names starting with a
+partial are found with a binary search instead of a walk over every list.
+
+==============================================================================
+*/
+
+typedef struct
 {
-	struct cmd_function_s	*next;
-	const char		*name;
-	xcommand_t		function;
-} cmd_function_t;
-extern	cmd_function_t	*cmd_functions;
-#define	MAX_ALIAS_NAME	32
-typedef struct cmdalias_s
+	const char	*name;
+	const char	*type;
+} tabname_t;
+
+static tabname_t	*tab_names;
+static int		tab_numnames, tab_maxnames;
+
+// index of the first name that doesn't sort before name
+static int Con_FindTabName (const char *name)
 {
-	struct cmdalias_s	*next;
-	char	name[MAX_ALIAS_NAME];
-	char	*value;
-} cmdalias_t;
-extern	cmdalias_t	*cmd_alias;
+	int	lo, hi, mid;
+
+	lo = 0;
+	hi = tab_numnames;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (strcmp (tab_names[mid].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+============
+Con_AddTabName
+
+name must stay valid until it's removed again
+============
+*/
+void Con_AddTabName (const char *name, const char *type)
+{
+	int	i;
+
+	if (tab_numnames == tab_maxnames)
+	{
+		tab_maxnames = tab_maxnames ? tab_maxnames * 2 : 1024;
+		tab_names = (tabname_t *) Z_Realloc (tab_names, tab_maxnames * sizeof(tabname_t));
+	}
+
+	i = Con_FindTabName (name);
+	memmove (&tab_names[i + 1], &tab_names[i], (tab_numnames - i) * sizeof(tabname_t));
+	tab_names[i].name = name;
+	tab_names[i].type = type;
+	tab_numnames++;
+}
+
+void Con_RemoveTabName (const char *name, const char *type)
+{
+	int	i;
+
+	for (i = Con_FindTabName (name); i < tab_numnames && !strcmp (tab_names[i].name, name); i++)
+	{
+		if (!strcmp (tab_names[i].type, type))
+		{
+			tab_numnames--;
+			memmove (&tab_names[i], &tab_names[i + 1], (tab_numnames - i) * sizeof(tabname_t));
+			return;
+		}
+	}
+}
+
+void Con_RemoveTabNames (const char *type)
+{
+	int	i, j;
+
+	for (i = j = 0; i < tab_numnames; i++)
+	{
+		if (strcmp (tab_names[i].type, type))
+			tab_names[j++] = tab_names[i];
+	}
+	tab_numnames = j;
+}
 
 /*
 ============
@@ -781,6 +1128,13 @@ void AddToTabList (const char *name, const char *type)
 		t->next = t;
 		t->prev = t;
 	}
+	else if (strcmp(name, tablist->prev->name) >= 0) //append, names come in order from the index
+	{
+		t->next = tablist;
+		t->prev = tablist->prev;
+		t->next->prev = t;
+		t->prev->next = t;
+	}
 	else if (strcmp(name, tablist->name) < 0) //insert at front
 	{
 		t->next = tablist;
@@ -810,16 +1164,17 @@ typedef struct arg_completion_type_s
 {
 	const char		*command;
 	filelist_item_t	**filelist;
+	int			*count;
 } arg_completion_type_t;
 
 static const arg_completion_type_t arg_completion_types[] =
 {
-	{ "map ", &extralevels },
-	{ "changelevel ", &extralevels },
-	{ "game ", &modlist },
-	{ "record ", &demolist },
-	{ "playdemo ", &demolist },
-	{ "timedemo ", &demolist }
+	{ "map ", &extralevels, &numextralevels },
+	{ "changelevel ", &extralevels, &numextralevels },
+	{ "game ", &modlist, &nummods },
+	{ "record ", &demolist, &numdemos },
+	{ "playdemo ", &demolist, &numdemos },
+	{ "timedemo ", &demolist, &numdemos }
 };
 
 static const int num_arg_completion_types =
@@ -828,20 +1183,35 @@ static const int num_arg_completion_types =
 /*
 ============
 FindCompletion -- stevenaaus
+
+The file lists are arrays sorted without regard to case, so the names
+starting with partial in any case are one run found by a binary search.
 ============
 */
-const char *FindCompletion (const char *partial, filelist_item_t *filelist, int *nummatches_out)
+const char *FindCompletion (const char *partial, filelist_item_t *filelist, int count, int *nummatches_out)
 {
 	static char matched[32];
 	char *i_matched, *i_name;
-	filelist_item_t	*file;
-	int   init, match, plen;
+	filelist_item_t	*file, *first;
+	int   init, match, plen, lo, hi, mid;
 
 	memset(matched, 0, sizeof(matched));
 	plen = strlen(partial);
 	match = 0;
 
-	for (file = filelist, init = 0; file; file = file->next)
+	lo = 0;
+	hi = filelist ? count : 0;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (q_strncasecmp(filelist[mid].name, partial, plen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = (lo < count && filelist) ? &filelist[lo] : NULL;
+
+	for (file = first, init = 0; file && !q_strncasecmp(file->name, partial, plen); file = file->next)
 	{
 		if (!strncmp(file->name, partial, plen))
 		{
@@ -870,7 +1240,7 @@ const char *FindCompletion (const char *partial, filelist_item_t *filelist, int
 
 	if (match > 1)
 	{
-		for (file = filelist; file; file = file->next)
+		for (file = first; file && !q_strncasecmp(file->name, partial, plen); file = file->next)
 		{
 			if (!strncmp(file->name, partial, plen))
 				Con_SafePrintf ("   %s\n", file->name);
@@ -888,10 +1258,7 @@ BuildTabList -- johnfitz
 */
 void BuildTabList (const char *partial)
 {
-	cmdalias_t		*alias;
-	cvar_t			*cvar;
-	cmd_function_t		*cmd;
-	int		len;
+	int		i, len;
 
 	tablist = NULL;
 	len = strlen(partial);
@@ -899,18 +1266,8 @@ void BuildTabList (const char *partial)
 	bash_partial[0] = 0;
 	bash_singlematch = 1;
 
-	cvar = Cvar_FindVarAfter ("", CVAR_NONE);
-	for ( ; cvar ; cvar=cvar->next)
-		if (!Q_strncmp (partial, cvar->name, len))
-			AddToTabList (cvar->name, "cvar");
-
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
-		if (!Q_strncmp (partial,cmd->name, len))
-			AddToTabList (cmd->name, "command");
-
-	for (alias=cmd_alias ; alias ; alias=alias->next)
-		if (!Q_strncmp (partial, alias->name, len))
-			AddToTabList (alias->name, "alias");
+	for (i = Con_FindTabName (partial); i < tab_numnames && !Q_strncmp (partial, tab_names[i].name, len); i++)
+		AddToTabList (tab_names[i].name, tab_names[i].type);
 }
 
 /*
@@ -955,7 +1312,7 @@ void Con_TabComplete (void)
 		if (!strncmp (key_lines[edit_line] + 1, command_name, strlen(command_name)))
 		{
 			int nummatches = 0;
-			const char *matched_map = FindCompletion(partial, *arg_completion.filelist, &nummatches);
+			const char *matched_map = FindCompletion(partial, *arg_completion.filelist, *arg_completion.count, &nummatches);
 			if (!*matched_map)
 				return;
 			q_strlcpy (partial, matched_map, MAXCMDLINE);
@@ -1096,7 +1453,7 @@ void Con_DrawNotify (void)
 
 		clearnotify = 0;
 
-		for (x = 0; x < con_linewidth; x++)
+		for (x = 0; x < con_linelen[i % con_totallines]; x++)
 			Draw_Character ((x+1)<<3, v, text[x]);
 
 		v += 8;
@@ -1208,7 +1565,7 @@ void Con_DrawConsole (int lines, qboolean drawinput)
 			j = 0;
 		text = con_text + (j % con_totallines)*con_linewidth;
 
-		for (x = 0; x < con_linewidth; x++)
+		for (x = 0; x < con_linelen[j % con_totallines]; x++)
 			Draw_Character ( (x + 1)<<3, y, text[x]);
 	}
 
@@ -1277,6 +1634,10 @@ void LOG_Init (quakeparms_t *parms)
 	time_t	inittime;
 	char	session[24];
 
+	Cvar_RegisterVariable (&log_timestamps);
+	Cvar_RegisterVariable (&log_maxsize);
+	Cvar_RegisterVariable (&log_compress);
+
 	if (!COM_CheckParm("-condebug"))
 		return;
 
@@ -1298,11 +1659,50 @@ void LOG_Init (quakeparms_t *parms)
 
 }
 
+/*
+================
+LOG_StartWriter
+
+Called once -instances has forked, threads don't survive it
+================
+*/
+void LOG_StartWriter (void)
+{
+#if defined(USE_SDL2)
+	if (log_fd == -1 || log_writer)
+		return;
+
+	Cvar_SetCallback (&log_maxsize, LOG_Settings_f);
+	Cvar_SetCallback (&log_compress, LOG_Settings_f);
+	LOG_Settings_f (NULL);
+
+	if (!log_ring)
+		log_ring = (char *) malloc (LOG_RING_SIZE);
+	if (!log_ring)
+		return;
+	SDL_AtomicSet (&log_head, 0);
+	SDL_AtomicSet (&log_tail, 0);
+	SDL_AtomicSet (&log_quit, 0);
+	log_mainthread = SDL_ThreadID ();
+	log_writer = SDL_CreateThread (LOG_WriterThread, "logwriter", NULL);
+#endif
+}
+
 void LOG_Close (void)
 {
 	if (log_fd == -1)
 		return;
-	close (log_fd);
+#if defined(USE_SDL2)
+	if (log_writer)
+	{
+		SDL_AtomicSet (&log_quit, 1);
+		SDL_WaitThread (log_writer, NULL);
+		log_writer = NULL;
+		LOG_Flush ();	// whatever the thread didn't get to
+	}
+#endif
+	if (log_fd != -1)
+		close (log_fd);
 	log_fd = -1;
 }
 
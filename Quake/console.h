@@ -45,6 +45,7 @@ void Con_Warning (const char *fmt, ...) FUNC_PRINTF(1,2); //johnfitz
 void Con_DPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 void Con_DPrintf2 (const char *fmt, ...) FUNC_PRINTF(1,2); //johnfitz
 void Con_SafePrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
+void Con_PrintHeld (void);	// prints what other threads printed
 void Con_DrawNotify (void);
 void Con_ClearNotify (void);
 void Con_ToggleConsole_f (void);
@@ -56,12 +57,16 @@ void Con_Hide (void);
 
 const char *Con_Quakebar (int len);
 void Con_TabComplete (void);
+void Con_AddTabName (const char *name, const char *type);
+void Con_RemoveTabName (const char *name, const char *type);
+void Con_RemoveTabNames (const char *type);
 void Con_LogCenterPrint (const char *str);
 
 //
 // debuglog
 //
 void LOG_Init (quakeparms_t *parms);
+void LOG_StartWriter (void);
 void LOG_Close (void);
 void Con_DebugLog (const char *msg);
 
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 
 static cvar_t	*cvar_vars;
+static cvar_t	*cvar_hash[CMD_HASHSIZE];
 static char	cvar_null_string[] = "";
 
 //==============================================================================
@@ -249,7 +250,7 @@ cvar_t *Cvar_FindVar (const char *var_name)
 {
 	cvar_t	*var;
 
-	for (var = cvar_vars ; var ; var = var->next)
+	for (var = cvar_hash[COM_HashStringNoCase (var_name) & (CMD_HASHSIZE - 1)] ; var ; var = var->hashnext)
 	{
 		if (!Q_strcmp(var_name, var->name))
 			return var;
@@ -534,6 +535,7 @@ void Cvar_RegisterVariable (cvar_t *variable)
 	char	value[512];
 	qboolean	set_rom;
 	cvar_t	*cursor,*prev; //johnfitz -- sorted list insert
+	cvar_t	**bucket;
 
 // first check to see if it has already been defined
 	if (Cvar_FindVar (variable->name))
@@ -570,7 +572,12 @@ void Cvar_RegisterVariable (cvar_t *variable)
 		prev->next = variable;
 	}
 	//johnfitz
+
+	bucket = &cvar_hash[COM_HashStringNoCase (variable->name) & (CMD_HASHSIZE - 1)];
+	variable->hashnext = *bucket;
+	*bucket = variable;
 	variable->flags |= CVAR_REGISTERED;
+	Con_AddTabName (variable->name, "cvar");
 
 // copy the value off, because future sets will Z_Free it
 	q_strlcpy (value, variable->string, sizeof(value));
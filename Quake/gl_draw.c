@@ -144,7 +144,8 @@ gltexture_t	*scrap_textures[MAX_SCRAPS]; //johnfitz
 ================
 Scrap_AllocBlock
 
-returns an index into scrap_texnums[] and the position inside it
+returns an index into scrap_texnums[] and the position inside it,
+or -1 if no scrap has room
 ================
 */
 int Scrap_AllocBlock (int w, int h, int *x, int *y)
@@ -184,8 +185,7 @@ int Scrap_AllocBlock (int w, int h, int *x, int *y)
 		return texnum;
 	}
 
-	Sys_Error ("Scrap_AllocBlock: full"); //johnfitz -- correct function name
-	return 0; //johnfitz -- shut up compiler
+	return -1;	// full, caller gives the pic its own texture
 }
 
 /*
@@ -208,6 +208,42 @@ void Scrap_Upload (void)
 	scrap_dirty = false;
 }
 
+/*
+================
+Scrap_AddPic
+
+Copies a small pic into the scrap so it can share a texture (and a 2D
+batch) with the others.  Returns false if it doesn't fit.
+================
+*/
+static qboolean Scrap_AddPic (int width, int height, const byte *data, glpic_t *gl)
+{
+	int		x, y;
+	int		i, j, k;
+	int		texnum;
+
+	if (width >= 64 || height >= 64)
+		return false;
+	texnum = Scrap_AllocBlock (width, height, &x, &y);
+	if (texnum < 0)
+		return false;
+
+	scrap_dirty = true;
+	k = 0;
+	for (i=0 ; i<height ; i++)
+	{
+		for (j=0 ; j<width ; j++, k++)
+			scrap_texels[texnum][(y+i)*BLOCK_WIDTH + x + j] = data[k];
+	}
+	gl->gltexture = scrap_textures[texnum]; //johnfitz -- changed to an array
+	//johnfitz -- no longer go from 0.01 to 0.99
+	gl->sl = x/(float)BLOCK_WIDTH;
+	gl->sh = (x+width)/(float)BLOCK_WIDTH;
+	gl->tl = y/(float)BLOCK_WIDTH;
+	gl->th = (y+height)/(float)BLOCK_WIDTH;
+	return true;
+}
+
 /*
 ================
 Draw_PicFromWad
@@ -223,28 +259,7 @@ qpic_t *Draw_PicFromWad (const char *name)
 	if (!p) return pic_nul; //johnfitz
 
 	// load little ones into the scrap
-	if (p->width < 64 && p->height < 64)
-	{
-		int		x, y;
-		int		i, j, k;
-		int		texnum;
-
-		texnum = Scrap_AllocBlock (p->width, p->height, &x, &y);
-		scrap_dirty = true;
-		k = 0;
-		for (i=0 ; i<p->height ; i++)
-		{
-			for (j=0 ; j<p->width ; j++, k++)
-				scrap_texels[texnum][(y+i)*BLOCK_WIDTH + x + j] = p->data[k];
-		}
-		gl.gltexture = scrap_textures[texnum]; //johnfitz -- changed to an array
-		//johnfitz -- no longer go from 0.01 to 0.99
-		gl.sl = x/(float)BLOCK_WIDTH;
-		gl.sh = (x+p->width)/(float)BLOCK_WIDTH;
-		gl.tl = y/(float)BLOCK_WIDTH;
-		gl.th = (y+p->height)/(float)BLOCK_WIDTH;
-	}
-	else
+	if (!Scrap_AddPic (p->width, p->height, p->data, &gl))
 	{
 		char texturename[64]; //johnfitz
 		q_snprintf (texturename, sizeof(texturename), "%s:%s", WADFILENAME, name); //johnfitz
@@ -303,12 +318,17 @@ qpic_t	*Draw_CachePic (const char *path)
 	pic->pic.width = dat->width;
 	pic->pic.height = dat->height;
 
-	gl.gltexture = TexMgr_LoadImage (NULL, path, dat->width, dat->height, SRC_INDEXED, dat->data, path,
-									  sizeof(int)*2, TEXPREF_ALPHA | TEXPREF_PAD | TEXPREF_NOPICMIP); //johnfitz -- TexMgr
-	gl.sl = 0;
-	gl.sh = (float)dat->width/(float)TexMgr_PadConditional(dat->width); //johnfitz
-	gl.tl = 0;
-	gl.th = (float)dat->height/(float)TexMgr_PadConditional(dat->height); //johnfitz
+	// little ones go into the scrap too, except the player pic which
+	// Draw_TransPicTranslate reloads with its own colors
+	if (!strcmp (path, "gfx/menuplyr.lmp") || !Scrap_AddPic (dat->width, dat->height, dat->data, &gl))
+	{
+		gl.gltexture = TexMgr_LoadImage (NULL, path, dat->width, dat->height, SRC_INDEXED, dat->data, path,
+										  sizeof(int)*2, TEXPREF_ALPHA | TEXPREF_PAD | TEXPREF_NOPICMIP); //johnfitz -- TexMgr
+		gl.sl = 0;
+		gl.sh = (float)dat->width/(float)TexMgr_PadConditional(dat->width); //johnfitz
+		gl.tl = 0;
+		gl.th = (float)dat->height/(float)TexMgr_PadConditional(dat->height); //johnfitz
+	}
 	memcpy (pic->pic.data, &gl, sizeof(glpic_t));
 
 	return &pic->pic;
@@ -380,6 +400,7 @@ void Draw_NewGame (void)
 	memset(scrap_texels, 255, sizeof(scrap_texels));
 
 	Scrap_Upload (); //creates 2 empty gltextures
+	Draw_CancelRecord (); // it points at the old textures
 
 	// reload wad pics
 	W_LoadWadFile (); //johnfitz -- filename is now hard-coded for honesty
@@ -423,12 +444,214 @@ void Draw_Init (void)
 //
 //==============================================================================
 
+/*
+================
+Draw_Flush
+
+Quads from the Draw_* functions are queued and drawn together; the batch
+only breaks when the texture or the blending changes, on a canvas change,
+or at the end of 2D.  Anything outside of gl_draw.c that changes GL state
+while 2D is being drawn has to call Draw_Flush first.
+================
+*/
+#define	MAX_BATCH_QUADS	4096
+
+typedef struct
+{
+	float	x, y, w, h;
+	float	sl, tl, sh, th;
+	byte	color[4];
+} batchquad_t;
+
+static batchquad_t	draw_quads[MAX_BATCH_QUADS];
+static int		draw_numquads;
+static gltexture_t	*draw_texture;		// NULL for untextured fills
+static qboolean		draw_blend;
+
+/*
+Draw_BeginRecord / Draw_EndRecord keep a copy of every quad queued in
+between, so a status bar that hasn't changed can be put back with
+Draw_Replay instead of walking all of the Sbar_Draw* code again.
+*/
+#define	MAX_RECORD_QUADS	1024
+
+typedef struct
+{
+	canvastype	canvas;
+	gltexture_t	*texture;
+	qboolean	blend;
+	batchquad_t	quad;
+} recordquad_t;
+
+static recordquad_t	record_quads[MAX_RECORD_QUADS];
+static int		record_numquads;
+static canvastype	record_endcanvas;
+static qboolean		recording;
+static qboolean		record_valid;
+
+static void GL_StreamVertex2f (streamvert_t *sv, float x, float y, float s, float t, const byte *color)
+{
+	sv->xyz[0] = x;
+	sv->xyz[1] = y;
+	sv->xyz[2] = 0;
+	sv->st[0] = s;
+	sv->st[1] = t;
+	memcpy (sv->color, color, 4);
+}
+
+void Draw_Flush (void)
+{
+	streamvert_t	*sv;
+	batchquad_t	*q;
+	int		i;
+
+	if (!draw_numquads)
+		return;
+
+	sv = GL_StreamVerts (draw_numquads * 4);
+	for (i = 0, q = draw_quads; i < draw_numquads; i++, q++, sv += 4)
+	{
+		GL_StreamVertex2f (&sv[0], q->x, q->y, q->sl, q->tl, q->color);
+		GL_StreamVertex2f (&sv[1], q->x + q->w, q->y, q->sh, q->tl, q->color);
+		GL_StreamVertex2f (&sv[2], q->x + q->w, q->y + q->h, q->sh, q->th, q->color);
+		GL_StreamVertex2f (&sv[3], q->x, q->y + q->h, q->sl, q->th, q->color);
+	}
+
+	if (draw_texture)
+		GL_Bind (draw_texture);
+	else
+		glDisable (GL_TEXTURE_2D);
+	if (draw_blend)
+	{
+		glEnable (GL_BLEND);
+		glDisable (GL_ALPHA_TEST);
+	}
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	GL_DrawStreamVerts (GL_QUADS, draw_numquads * 4, STREAM_TEXCOORDS | STREAM_COLORS);
+
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	if (draw_blend)
+	{
+		glEnable (GL_ALPHA_TEST);
+		glDisable (GL_BLEND);
+	}
+	if (!draw_texture)
+		glEnable (GL_TEXTURE_2D);
+	glColor4f (1,1,1,1);
+
+	draw_numquads = 0;
+}
+
+static void Draw_AddQuad (gltexture_t *tex, qboolean blend, float x, float y, float w, float h,
+			  float sl, float tl, float sh, float th, const byte *color)
+{
+	batchquad_t	*q;
+
+	if (draw_numquads && (tex != draw_texture || blend != draw_blend))
+		Draw_Flush ();
+	else if (draw_numquads == MAX_BATCH_QUADS)
+		Draw_Flush ();
+	draw_texture = tex;
+	draw_blend = blend;
+
+	q = &draw_quads[draw_numquads++];
+	q->x = x;
+	q->y = y;
+	q->w = w;
+	q->h = h;
+	q->sl = sl;
+	q->tl = tl;
+	q->sh = sh;
+	q->th = th;
+	memcpy (q->color, color, 4);
+
+	if (recording)
+	{
+		if (record_numquads == MAX_RECORD_QUADS)
+			record_valid = false;	// too much to keep, draw it the long way next time
+		else
+		{
+			record_quads[record_numquads].canvas = currentcanvas;
+			record_quads[record_numquads].texture = tex;
+			record_quads[record_numquads].blend = blend;
+			record_quads[record_numquads].quad = *q;
+			record_numquads++;
+		}
+	}
+}
+
+/*
+================
+Draw_BeginRecord
+================
+*/
+void Draw_BeginRecord (void)
+{
+	record_numquads = 0;
+	record_valid = true;
+	recording = true;
+}
+
+/*
+================
+Draw_EndRecord
+================
+*/
+void Draw_EndRecord (void)
+{
+	record_endcanvas = currentcanvas;
+	recording = false;
+}
+
+/*
+================
+Draw_CancelRecord
+
+For drawing that depends on GL state the recording can't hold, like a
+scissor rectangle.
+================
+*/
+void Draw_CancelRecord (void)
+{
+	record_valid = false;
+}
+
+/*
+================
+Draw_Replay
+
+Queues the last recording again, returns false if there is nothing usable.
+================
+*/
+qboolean Draw_Replay (void)
+{
+	recordquad_t	*r;
+	batchquad_t	*q;
+	int		i;
+
+	if (recording || !record_valid || !record_numquads)
+		return false;
+
+	for (i = 0, r = record_quads; i < record_numquads; i++, r++)
+	{
+		GL_SetCanvas (r->canvas);
+		q = &r->quad;
+		Draw_AddQuad (r->texture, r->blend, q->x, q->y, q->w, q->h, q->sl, q->tl, q->sh, q->th, q->color);
+	}
+	GL_SetCanvas (record_endcanvas);
+
+	return true;
+}
+
+static const byte draw_white[4] = {255, 255, 255, 255};
+
 /*
 ================
 Draw_CharacterQuad -- johnfitz -- seperate function to spit out verts
 ================
 */
-void Draw_CharacterQuad (int x, int y, char num)
+static void Draw_CharacterQuad (int x, int y, int num)
 {
 	int				row, col;
 	float			frow, fcol, size;
@@ -440,14 +663,7 @@ void Draw_CharacterQuad (int x, int y, char num)
 	fcol = col*0.0625;
 	size = 0.0625;
 
-	glTexCoord2f (fcol, frow);
-	glVertex2f (x, y);
-	glTexCoord2f (fcol + size, frow);
-	glVertex2f (x+8, y);
-	glTexCoord2f (fcol + size, frow + size);
-	glVertex2f (x+8, y+8);
-	glTexCoord2f (fcol, frow + size);
-	glVertex2f (x, y+8);
+	Draw_AddQuad (char_texture, false, x, y, 8, 8, fcol, frow, fcol + size, frow + size, draw_white);
 }
 
 /*
@@ -465,12 +681,7 @@ void Draw_Character (int x, int y, int num)
 	if (num == 32)
 		return; //don't waste verts on spaces
 
-	GL_Bind (char_texture);
-	glBegin (GL_QUADS);
-
-	Draw_CharacterQuad (x, y, (char) num);
-
-	glEnd ();
+	Draw_CharacterQuad (x, y, num);
 }
 
 /*
@@ -483,18 +694,13 @@ void Draw_String (int x, int y, const char *str)
 	if (y <= -8)
 		return;			// totally off screen
 
-	GL_Bind (char_texture);
-	glBegin (GL_QUADS);
-
 	while (*str)
 	{
 		if (*str != 32) //don't waste verts on spaces
-			Draw_CharacterQuad (x, y, *str);
+			Draw_CharacterQuad (x, y, (byte) *str);
 		str++;
 		x += 8;
 	}
-
-	glEnd ();
 }
 
 /*
@@ -509,17 +715,26 @@ void Draw_Pic (int x, int y, qpic_t *pic)
 	if (scrap_dirty)
 		Scrap_Upload ();
 	gl = (glpic_t *)pic->data;
-	GL_Bind (gl->gltexture);
-	glBegin (GL_QUADS);
-	glTexCoord2f (gl->sl, gl->tl);
-	glVertex2f (x, y);
-	glTexCoord2f (gl->sh, gl->tl);
-	glVertex2f (x+pic->width, y);
-	glTexCoord2f (gl->sh, gl->th);
-	glVertex2f (x+pic->width, y+pic->height);
-	glTexCoord2f (gl->sl, gl->th);
-	glVertex2f (x, y+pic->height);
-	glEnd ();
+	Draw_AddQuad (gl->gltexture, false, x, y, pic->width, pic->height, gl->sl, gl->tl, gl->sh, gl->th, draw_white);
+}
+
+/*
+=============
+Draw_PicAlpha
+
+Draw_Pic blended by alpha
+=============
+*/
+void Draw_PicAlpha (int x, int y, qpic_t *pic, float alpha)
+{
+	glpic_t			*gl;
+	byte			color[4] = {255, 255, 255, 255};
+
+	if (scrap_dirty)
+		Scrap_Upload ();
+	gl = (glpic_t *)pic->data;
+	color[3] = CLAMP (0, alpha, 1) * 255;
+	Draw_AddQuad (gl->gltexture, true, x, y, pic->width, pic->height, gl->sl, gl->tl, gl->sh, gl->th, color);
 }
 
 /*
@@ -540,6 +755,7 @@ void Draw_TransPicTranslate (int x, int y, qpic_t *pic, int top, int bottom)
 		gltexture_t *glt = p->gltexture;
 		oldtop = top;
 		oldbottom = bottom;
+		Draw_Flush (); // queued quads may use the old colors
 		TexMgr_ReloadImage (glt, top, bottom);
 	}
 	Draw_Pic (x, y, pic);
@@ -566,22 +782,9 @@ void Draw_ConsoleBackground (void)
 	if (alpha > 0.0)
 	{
 		if (alpha < 1.0)
-		{
-			glEnable (GL_BLEND);
-			glColor4f (1,1,1,alpha);
-			glDisable (GL_ALPHA_TEST);
-			glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		}
-
-		Draw_Pic (0, 0, pic);
-
-		if (alpha < 1.0)
-		{
-			glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-			glEnable (GL_ALPHA_TEST);
-			glDisable (GL_BLEND);
-			glColor4f (1,1,1,1);
-		}
+			Draw_PicAlpha (0, 0, pic, alpha);
+		else
+			Draw_Pic (0, 0, pic);
 	}
 }
 
@@ -600,18 +803,7 @@ void Draw_TileClear (int x, int y, int w, int h)
 
 	gl = (glpic_t *)draw_backtile->data;
 
-	glColor3f (1,1,1);
-	GL_Bind (gl->gltexture);
-	glBegin (GL_QUADS);
-	glTexCoord2f (x/64.0, y/64.0);
-	glVertex2f (x, y);
-	glTexCoord2f ( (x+w)/64.0, y/64.0);
-	glVertex2f (x+w, y);
-	glTexCoord2f ( (x+w)/64.0, (y+h)/64.0);
-	glVertex2f (x+w, y+h);
-	glTexCoord2f ( x/64.0, (y+h)/64.0 );
-	glVertex2f (x, y+h);
-	glEnd ();
+	Draw_AddQuad (gl->gltexture, false, x, y, w, h, x/64.0, y/64.0, (x+w)/64.0, (y+h)/64.0, draw_white);
 }
 
 /*
@@ -624,23 +816,14 @@ Fills a box of pixels with a single color
 void Draw_Fill (int x, int y, int w, int h, int c, float alpha) //johnfitz -- added alpha
 {
 	byte *pal = (byte *)d_8to24table; //johnfitz -- use d_8to24table instead of host_basepal
+	byte color[4];
 
-	glDisable (GL_TEXTURE_2D);
-	glEnable (GL_BLEND); //johnfitz -- for alpha
-	glDisable (GL_ALPHA_TEST); //johnfitz -- for alpha
-	glColor4f (pal[c*4]/255.0, pal[c*4+1]/255.0, pal[c*4+2]/255.0, alpha); //johnfitz -- added alpha
-
-	glBegin (GL_QUADS);
-	glVertex2f (x,y);
-	glVertex2f (x+w, y);
-	glVertex2f (x+w, y+h);
-	glVertex2f (x, y+h);
-	glEnd ();
-
-	glColor3f (1,1,1);
-	glDisable (GL_BLEND); //johnfitz -- for alpha
-	glEnable (GL_ALPHA_TEST); //johnfitz -- for alpha
-	glEnable (GL_TEXTURE_2D);
+	color[0] = pal[c*4];
+	color[1] = pal[c*4+1];
+	color[2] = pal[c*4+2];
+	color[3] = CLAMP (0, alpha, 1) * 255; //johnfitz -- added alpha
+
+	Draw_AddQuad (NULL, true, x, y, w, h, 0, 0, 0, 0, color);
 }
 
 /*
@@ -650,24 +833,11 @@ Draw_FadeScreen -- johnfitz -- revised
 */
 void Draw_FadeScreen (void)
 {
-	GL_SetCanvas (CANVAS_DEFAULT);
+	static const byte color[4] = {0, 0, 0, 128};
 
-	glEnable (GL_BLEND);
-	glDisable (GL_ALPHA_TEST);
-	glDisable (GL_TEXTURE_2D);
-	glColor4f (0, 0, 0, 0.5);
-	glBegin (GL_QUADS);
-
-	glVertex2f (0,0);
-	glVertex2f (glwidth, 0);
-	glVertex2f (glwidth, glheight);
-	glVertex2f (0, glheight);
+	GL_SetCanvas (CANVAS_DEFAULT);
 
-	glEnd ();
-	glColor4f (1,1,1,1);
-	glEnable (GL_TEXTURE_2D);
-	glEnable (GL_ALPHA_TEST);
-	glDisable (GL_BLEND);
+	Draw_AddQuad (NULL, true, 0, 0, glwidth, glheight, 0, 0, 0, 0, color);
 
 	Sbar_Changed();
 }
@@ -686,6 +856,8 @@ void GL_SetCanvas (canvastype newcanvas)
 	if (newcanvas == currentcanvas)
 		return;
 
+	Draw_Flush ();
+
 	currentcanvas = newcanvas;
 
 	glMatrixMode(GL_PROJECTION);
@@ -287,6 +287,401 @@ void BuildTris (void)
 	alltris += pheader->numtris;
 }
 
+/*
+=================================================================
+
+VERTEX CACHE ORDERING
+
+GPUs keep the last few transformed vertices in a FIFO, so an index list
+that reuses vertices soon after their first use transforms fewer of
+them.  The quality of an order is its average cache miss ratio (ACMR):
+vertices transformed per triangle, between 0.5 for a large regular grid
+and 3 for no reuse at all.
+
+=================================================================
+*/
+
+void VCache_Reset (vcache_t *c)
+{
+	int i;
+
+	for (i = 0; i < VCACHE_SIZE; i++)
+		c->slot[i] = -1;
+	c->next = 0;
+	c->misses = 0;
+}
+
+void VCache_Touch (vcache_t *c, int v)
+{
+	int i;
+
+	for (i = 0; i < VCACHE_SIZE; i++)
+		if (c->slot[i] == v)
+			return;
+	c->slot[c->next] = v;
+	c->next = (c->next + 1) % VCACHE_SIZE;
+	c->misses++;
+}
+
+static float GLMesh_ACMR (const unsigned short *indexes, int numindexes)
+{
+	vcache_t	c;
+	int		i;
+
+	if (numindexes < 3)
+		return 0;
+	VCache_Reset (&c);
+	for (i = 0; i < numindexes; i++)
+		VCache_Touch (&c, indexes[i]);
+	return (float) c.misses / (numindexes / 3);
+}
+
+/*
+================
+GLMesh_OptimizeIndexes
+
+Reorders the triangles of an indexed mesh with Tipsify (Sander, Nehab and
+Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+Overdraw"): it fans out around one vertex at a time, moving on to a
+vertex of the last fan that is still in the cache and still has
+triangles left, or back along the recently used vertices when there is
+none.  The vertices are then renumbered in order of first use, with desc
+moved to match, so the vertex fetches run forwards through the buffer.
+================
+*/
+static void GLMesh_OptimizeIndexes (unsigned short *indexes, int numindexes, aliasmesh_t *desc, int numverts)
+{
+	int		numtris, i, j, v, t, f, cursor, best, bestpri, pri;
+	int		timestamp, numout, stackdepth, numcand;
+	int		*live, *cachetime, *adjofs, *adj, *stack, *cand, *remap;
+	byte		*emitted;
+	unsigned short	*out;
+	aliasmesh_t	*olddesc;
+
+	numtris = numindexes / 3;
+	if (numtris < 2 || numverts < 3)
+		return;
+
+	live = (int *) calloc (numverts, sizeof(int));
+	cachetime = (int *) calloc (numverts, sizeof(int));
+	adjofs = (int *) calloc (numverts + 1, sizeof(int));
+	adj = (int *) malloc (numindexes * sizeof(int));
+	stack = (int *) malloc (numindexes * sizeof(int));
+	cand = (int *) malloc (numindexes * sizeof(int));
+	remap = (int *) malloc (numverts * sizeof(int));
+	emitted = (byte *) calloc (numtris, 1);
+	out = (unsigned short *) malloc (numindexes * sizeof(unsigned short));
+	olddesc = (aliasmesh_t *) malloc (numverts * sizeof(aliasmesh_t));
+	if (!live || !cachetime || !adjofs || !adj || !stack || !cand || !remap || !emitted || !out || !olddesc)
+		goto done;
+
+// triangles around each vertex
+	for (i = 0; i < numtris * 3; i++)
+		live[indexes[i]]++;
+	for (v = 0; v < numverts; v++)
+		adjofs[v + 1] = adjofs[v] + live[v];
+	for (v = 0; v < numverts; v++)
+		remap[v] = adjofs[v];
+	for (i = 0; i < numtris * 3; i++)
+		adj[remap[indexes[i]]++] = i / 3;
+
+	timestamp = VCACHE_SIZE + 1;	// everything starts out of the cache
+	numout = stackdepth = 0;
+	cursor = 1;
+	f = 0;
+	while (f >= 0)
+	{
+	// emit the remaining triangles around f
+		numcand = 0;
+		for (j = adjofs[f]; j < adjofs[f + 1]; j++)
+		{
+			t = adj[j];
+			if (emitted[t])
+				continue;
+			emitted[t] = true;
+			for (i = 0; i < 3; i++)
+			{
+				v = indexes[t*3 + i];
+				out[numout++] = v;
+				stack[stackdepth++] = v;
+				cand[numcand++] = v;
+				live[v]--;
+				if (timestamp - cachetime[v] > VCACHE_SIZE)
+					cachetime[v] = timestamp++;
+			}
+		}
+
+	// the next fanning vertex: the oldest one of the fan that will still be
+	// in the cache by the time its own triangles are out
+		best = -1;
+		bestpri = -1;
+		for (i = 0; i < numcand; i++)
+		{
+			v = cand[i];
+			if (live[v] <= 0)
+				continue;
+			pri = 0;
+			if (timestamp - cachetime[v] + 2 * live[v] <= VCACHE_SIZE)
+				pri = timestamp - cachetime[v];
+			if (pri > bestpri)
+			{
+				bestpri = pri;
+				best = v;
+			}
+		}
+
+	// dead end: back up through the recent vertices, then any with triangles left
+		while (best < 0 && stackdepth > 0)
+		{
+			v = stack[--stackdepth];
+			if (live[v] > 0)
+				best = v;
+		}
+		while (best < 0 && cursor < numverts)
+		{
+			if (live[cursor] > 0)
+				best = cursor;
+			cursor++;
+		}
+		f = best;
+	}
+
+// renumber the vertices by first use
+	for (v = 0; v < numverts; v++)
+		remap[v] = -1;
+	memcpy (olddesc, desc, numverts * sizeof(aliasmesh_t));
+	for (i = 0, j = 0; i < numout; i++)
+	{
+		v = out[i];
+		if (remap[v] < 0)
+		{
+			desc[j] = olddesc[v];
+			remap[v] = j++;
+		}
+		indexes[i] = remap[v];
+	}
+	for (v = 0; v < numverts; v++)	// unreferenced, which the merging never makes
+		if (remap[v] < 0)
+			desc[j++] = olddesc[v];
+
+done:
+	free (live);
+	free (cachetime);
+	free (adjofs);
+	free (adj);
+	free (stack);
+	free (cand);
+	free (remap);
+	free (emitted);
+	free (out);
+	free (olddesc);
+}
+
+/*
+=================================================================
+
+ALIAS MESH CACHE
+
+BuildTris and the VBO vertex merging only depend on the triangles, the
+s/t verts and the skin size, so their results are kept in
+<userdir>/meshcache under a hash of exactly those inputs.  Loading the
+same mesh again, from any model file or mod, copies them back instead.
+
+=================================================================
+*/
+
+#define	MESHCACHE_DIR		"meshcache"
+#define	MESHCACHE_MAGIC		(('C'<<24)|('M'<<16)|('S'<<8)|'Q')	// "QSMC"
+#define	MESHCACHE_VERSION	2	// 2: vertex cache ordered indexes
+
+typedef struct
+{
+	int		magic;
+	int		version;
+	uint32_t	key[2];
+	int		numcommands;
+	int		numorder;
+	int		numverts_vbo;	// -1 if the vbo mesh wasn't built
+	int		numindexes;
+} meshcacheheader_t;
+
+static meshcacheheader_t	meshcache;	// for the model being meshed
+static aliasmesh_t	*meshcache_desc;	// cached vbo mesh, malloc'ed
+static unsigned short	*meshcache_indexes;
+static qboolean		meshcache_dirty;	// something was built, write it back
+
+static uint64_t GLMesh_CacheKey (void)
+{
+	uint64_t	hash = COM_HASH64_INIT;
+	int		sizes[4];
+
+	sizes[0] = pheader->numverts;
+	sizes[1] = pheader->numtris;
+	sizes[2] = pheader->skinwidth;
+	sizes[3] = pheader->skinheight;
+	hash = COM_HashBlock64 (hash, sizes, sizeof(sizes));
+	hash = COM_HashBlock64 (hash, stverts, pheader->numverts * sizeof(stvert_t));
+	hash = COM_HashBlock64 (hash, triangles, pheader->numtris * sizeof(mtriangle_t));
+	return hash;
+}
+
+static void GLMesh_CachePath (char *path, size_t size)
+{
+	q_snprintf (path, size, "%s/" MESHCACHE_DIR "/%08x%08x.ms3", host_parms->userdir,
+			(unsigned int) meshcache.key[0], (unsigned int) meshcache.key[1]);
+}
+
+// a damaged file must not send the pose copies out of bounds
+static qboolean GLMesh_CheckCache (const meshcacheheader_t *header)
+{
+	int	i, count, pos, total;
+
+	for (i = 0; i < header->numorder; i++)
+	{
+		if (vertexorder[i] < 0 || vertexorder[i] >= pheader->numverts)
+			return false;
+	}
+
+	for (pos = total = 0; pos < header->numcommands && (count = commands[pos]) != 0; )
+	{
+		count = abs (count);
+		total += count;
+		pos += 1 + count * 2;
+	}
+	if (pos != header->numcommands - 1 || total != header->numorder)
+		return false;
+
+	if (meshcache_desc)
+	{
+		for (i = 0; i < header->numverts_vbo; i++)
+		{
+			if (meshcache_desc[i].vertindex >= pheader->numverts)
+				return false;
+		}
+		for (i = 0; i < header->numindexes; i++)
+		{
+			if (meshcache_indexes[i] >= header->numverts_vbo)
+				return false;
+		}
+	}
+	return true;
+}
+
+/*
+================
+GLMesh_LoadCache
+
+Fills commands and vertexorder from the cache, false on a miss.  The
+cached vbo mesh, if any, is left in meshcache_desc/meshcache_indexes.
+================
+*/
+static qboolean GLMesh_LoadCache (uint64_t key)
+{
+	char			path[MAX_OSPATH];
+	meshcacheheader_t	header;
+	FILE			*f;
+	qboolean		ok;
+
+	meshcache.key[0] = (uint32_t) (key >> 32);
+	meshcache.key[1] = (uint32_t) key;
+	meshcache_desc = NULL;
+	meshcache_indexes = NULL;
+	meshcache_dirty = false;
+
+	GLMesh_CachePath (path, sizeof(path));
+	f = fopen (path, "rb");
+	if (!f)
+		return false;
+
+	ok = fread (&header, sizeof(header), 1, f) == 1 &&
+		header.magic == MESHCACHE_MAGIC && header.version == MESHCACHE_VERSION &&
+		header.key[0] == meshcache.key[0] && header.key[1] == meshcache.key[1] &&
+		header.numcommands > 0 && header.numcommands <= (int) (sizeof(commands) / sizeof(commands[0])) &&
+		header.numorder > 0 && header.numorder <= (int) (sizeof(vertexorder) / sizeof(vertexorder[0])) &&
+		header.numindexes <= pheader->numtris * 3 && header.numverts_vbo <= pheader->numtris * 3 &&
+		fread (commands, sizeof(int), header.numcommands, f) == (size_t) header.numcommands &&
+		fread (vertexorder, sizeof(int), header.numorder, f) == (size_t) header.numorder;
+
+	if (ok && header.numverts_vbo >= 0)
+	{
+		meshcache_desc = (aliasmesh_t *) malloc (q_max (header.numverts_vbo, 1) * sizeof(aliasmesh_t));
+		meshcache_indexes = (unsigned short *) malloc (q_max (header.numindexes, 1) * sizeof(unsigned short));
+		if (!meshcache_desc || !meshcache_indexes ||
+		    fread (meshcache_desc, sizeof(aliasmesh_t), header.numverts_vbo, f) != (size_t) header.numverts_vbo ||
+		    fread (meshcache_indexes, sizeof(unsigned short), header.numindexes, f) != (size_t) header.numindexes)
+		{
+			free (meshcache_desc);
+			free (meshcache_indexes);
+			meshcache_desc = NULL;
+			meshcache_indexes = NULL;
+		}
+	}
+	fclose (f);
+
+	if (ok && !GLMesh_CheckCache (&header))
+	{
+		free (meshcache_desc);
+		free (meshcache_indexes);
+		meshcache_desc = NULL;
+		meshcache_indexes = NULL;
+		ok = false;
+	}
+	if (!ok)
+		return false;
+
+	meshcache = header;
+	numcommands = header.numcommands;
+	numorder = header.numorder;
+	allverts += numorder;
+	alltris += pheader->numtris;
+	return true;
+}
+
+static void GLMesh_SaveCache (void)
+{
+	char		path[MAX_OSPATH];
+	FILE		*f;
+	qboolean	ok;
+
+	if (!meshcache_dirty)
+		return;
+
+	meshcache.magic = MESHCACHE_MAGIC;
+	meshcache.version = MESHCACHE_VERSION;
+	meshcache.numcommands = numcommands;
+	meshcache.numorder = numorder;
+	if (gl_glsl_alias_able)
+	{
+		meshcache.numverts_vbo = pheader->numverts_vbo;
+		meshcache.numindexes = pheader->numindexes;
+	}
+	else
+		meshcache.numverts_vbo = meshcache.numindexes = -1;
+
+	q_snprintf (path, sizeof(path), "%s/" MESHCACHE_DIR, host_parms->userdir);
+	Sys_mkdir (path);
+	GLMesh_CachePath (path, sizeof(path));
+	f = fopen (path, "wb");
+	if (!f)
+		return;
+
+	ok = fwrite (&meshcache, sizeof(meshcache), 1, f) == 1 &&
+		fwrite (commands, sizeof(int), numcommands, f) == (size_t) numcommands &&
+		fwrite (vertexorder, sizeof(int), numorder, f) == (size_t) numorder;
+	if (ok && meshcache.numverts_vbo >= 0)
+	{
+		ok = fwrite ((byte *) pheader + pheader->meshdesc, sizeof(aliasmesh_t), pheader->numverts_vbo, f) == (size_t) pheader->numverts_vbo &&
+			fwrite ((byte *) pheader + pheader->indexes, sizeof(unsigned short), pheader->numindexes, f) == (size_t) pheader->numindexes;
+	}
+	fclose (f);
+
+	if (!ok)
+	{
+		Con_DPrintf ("couldn't write %s\n", path);
+		remove (path);
+	}
+}
+
 static void GL_MakeAliasModelDisplayLists_VBO (void);
 static void GLMesh_LoadVertexBuffer (qmodel_t *m, const aliashdr_t *hdr);
 
@@ -313,8 +708,12 @@ void GL_MakeAliasModelDisplayLists (qmodel_t *m, aliashdr_t *hdr)
 	paliashdr = hdr;	// (aliashdr_t *)Mod_Extradata (m);
 
 //johnfitz -- generate meshes
-	Con_DPrintf2 ("meshing %s...\n",m->name);
-	BuildTris ();
+	if (!GLMesh_LoadCache (GLMesh_CacheKey ()))
+	{
+		Con_DPrintf2 ("meshing %s...\n",m->name);
+		BuildTris ();
+		meshcache_dirty = true;
+	}
 
 	// save the data out
 
@@ -351,6 +750,12 @@ void GL_MakeAliasModelDisplayLists (qmodel_t *m, aliashdr_t *hdr)
 
 	// ericw
 	GL_MakeAliasModelDisplayLists_VBO ();
+
+	GLMesh_SaveCache ();
+	free (meshcache_desc);
+	free (meshcache_indexes);
+	meshcache_desc = NULL;
+	meshcache_indexes = NULL;
 }
 
 unsigned int r_meshindexbuffer = 0;
@@ -373,6 +778,7 @@ void GL_MakeAliasModelDisplayLists_VBO (void)
 	trivertx_t *verts;
 	unsigned short *indexes;
 	aliasmesh_t *desc;
+	float acmr;
 
 	if (!gl_glsl_alias_able)
 		return;
@@ -396,6 +802,19 @@ void GL_MakeAliasModelDisplayLists_VBO (void)
 	pheader->numindexes = 0;
 	pheader->numverts_vbo = 0;
 
+	if (meshcache_desc)
+	{ // merged already
+		memcpy (desc, meshcache_desc, meshcache.numverts_vbo * sizeof(aliasmesh_t));
+		memcpy (indexes, meshcache_indexes, meshcache.numindexes * sizeof(unsigned short));
+		pheader->numverts_vbo = meshcache.numverts_vbo;
+		pheader->numindexes = meshcache.numindexes;
+		Con_DPrintf ("%s: %d tris, ACMR %.2f\n", aliasmodel->name, pheader->numindexes / 3,
+			GLMesh_ACMR (indexes, pheader->numindexes));
+		GLMesh_LoadVertexBuffer (aliasmodel, pheader);
+		return;
+	}
+	meshcache_dirty = true;
+
 	for (i = 0; i < pheader->numtris; i++)
 	{
 		for (j = 0; j < 3; j++)
@@ -437,7 +856,12 @@ void GL_MakeAliasModelDisplayLists_VBO (void)
 			}
 		}
 	}
-	
+
+	acmr = GLMesh_ACMR (indexes, pheader->numindexes);
+	GLMesh_OptimizeIndexes (indexes, pheader->numindexes, desc, pheader->numverts_vbo);
+	Con_DPrintf ("%s: %d tris, ACMR %.2f -> %.2f\n", aliasmodel->name, pheader->numindexes / 3,
+		acmr, GLMesh_ACMR (indexes, pheader->numindexes));
+
 	// upload immediately
 	GLMesh_LoadVertexBuffer (aliasmodel, pheader);
 }
@@ -522,7 +946,7 @@ static void GLMesh_LoadVertexBuffer (qmodel_t *m, const aliashdr_t *hdr)
 			xyz[v].normal[0] = 127 * r_avertexnormals[trivert.lightnormalindex][0];
 			xyz[v].normal[1] = 127 * r_avertexnormals[trivert.lightnormalindex][1];
 			xyz[v].normal[2] = 127 * r_avertexnormals[trivert.lightnormalindex][2];
-			xyz[v].normal[3] = 0;	// unused; for 4-byte alignment
+			xyz[v].normal[3] = (signed char) trivert.lightnormalindex;	// read back unsigned for the shadedots lookup
 		}
 	}
 
@@ -550,6 +974,10 @@ static void GLMesh_LoadVertexBuffer (qmodel_t *m, const aliashdr_t *hdr)
 	GL_BindBufferFunc (GL_ARRAY_BUFFER, m->meshvbo);
 	GL_BufferDataFunc (GL_ARRAY_BUFFER, totalvbosize, vbodata, GL_STATIC_DRAW);
 
+	gl_memory[GLMEM_ALIAS] -= m->vbosize;
+	m->vbosize = totalvbosize + hdr->numindexes * sizeof (unsigned short);
+	gl_memory[GLMEM_ALIAS] += m->vbosize;
+
 	free (vbodata);
 
 // invalidate the cached bindings
@@ -608,7 +1036,9 @@ void GLMesh_DeleteVertexBuffers (void)
 
 		GL_DeleteBuffersFunc (1, &m->meshindexesvbo);
 		m->meshindexesvbo = 0;
+		m->vbosize = 0;
 	}
+	gl_memory[GLMEM_ALIAS] = 0;
 	
 	GL_ClearBufferBindings ();
 }
@@ -26,16 +26,33 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
 qmodel_t	*loadmodel;
 char	loadname[32];	// for hunk tags
 
 void Mod_LoadSpriteModel (qmodel_t *mod, void *buffer);
 void Mod_LoadBrushModel (qmodel_t *mod, void *buffer);
 void Mod_LoadAliasModel (qmodel_t *mod, void *buffer);
+static void Mod_WaitStages (void);
+static void Mod_PointBench_f (void);
+static byte *Mod_TakePrefetch (qmodel_t *mod);
+static void Mod_ReleasePrefetch (byte *data);
 qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash);
 
 cvar_t	external_ents = {"external_ents", "1", CVAR_ARCHIVE};
 cvar_t	external_vis = {"external_vis", "1", CVAR_ARCHIVE};
+cvar_t	mod_pointgrid = {"mod_pointgrid", "1", CVAR_NONE};
+cvar_t	mod_pvsmatrix = {"mod_pvsmatrix", "16", CVAR_ARCHIVE};	// megabytes, 0 disables
+cvar_t	mod_cache = {"mod_cache", "0", CVAR_ARCHIVE};
 
 static byte	*mod_novis;
 static int	mod_novis_capacity;
@@ -47,6 +64,11 @@ static int	mod_decompressed_capacity;
 qmodel_t	mod_known[MAX_MOD_KNOWN];
 int		mod_numknown;
 
+#define	MOD_HASH_SIZE	(MAX_MOD_KNOWN * 2)	// 50% load factor, must be a power of two
+static unsigned short	mod_hash[MOD_HASH_SIZE];	// index into mod_known + 1, 0 == empty
+
+int		mod_lookups;	// Mod_FindName calls, for devstats
+
 texture_t	*r_notexture_mip; //johnfitz -- moved here from r_main.c
 texture_t	*r_notexture_mip2; //johnfitz -- used for non-lightmapped surfs with a missing texture
 
@@ -60,15 +82,21 @@ void Mod_Init (void)
 	Cvar_RegisterVariable (&gl_subdivide_size);
 	Cvar_RegisterVariable (&external_vis);
 	Cvar_RegisterVariable (&external_ents);
+	Cvar_RegisterVariable (&mod_pointgrid);
+	Cvar_RegisterVariable (&mod_pvsmatrix);
+	Cvar_RegisterVariable (&mod_cache);
+	Cmd_AddCommand ("mod_pointbench", Mod_PointBench_f);
 
 	//johnfitz -- create notexture miptex
 	r_notexture_mip = (texture_t *) Hunk_AllocName (sizeof(texture_t), "r_notexture_mip");
 	strcpy (r_notexture_mip->name, "notexture");
 	r_notexture_mip->height = r_notexture_mip->width = 32;
+	r_notexture_mip->texarray = -1;
 
 	r_notexture_mip2 = (texture_t *) Hunk_AllocName (sizeof(texture_t), "r_notexture_mip2");
 	strcpy (r_notexture_mip2->name, "notexture2");
 	r_notexture_mip2->height = r_notexture_mip2->width = 32;
+	r_notexture_mip2->texarray = -1;
 	//johnfitz
 }
 
@@ -94,6 +122,36 @@ void *Mod_Extradata (qmodel_t *mod)
 	return mod->cache.data;
 }
 
+/*
+===============
+Mod_PointGridNode
+
+Returns the node a point lookup can start from, the deepest one whose
+splits above it the point's grid cell lies wholly on one side of
+===============
+*/
+mnode_t *Mod_PointGridNode (const vec3_t p, qmodel_t *model)
+{
+	float	f;
+	int	i, c[3], n;
+
+	if (!model->pointgrid || !mod_pointgrid.value)
+		return model->nodes;
+
+	for (i = 0; i < 3; i++)
+	{
+		f = (p[i] - model->pointgridmins[i]) * model->pointgridscale;
+		if (!(f >= 0 && f < model->pointgridsize[i]))	// also catches NaNs
+			return model->nodes;
+		c[i] = (int)f;
+	}
+
+	n = model->pointgrid[(c[2] * model->pointgridsize[1] + c[1]) * model->pointgridsize[0] + c[0]];
+	if (n < 0)
+		return (mnode_t *)(model->leafs + (-1 - n));
+	return model->nodes + n;
+}
+
 /*
 ===============
 Mod_PointInLeaf
@@ -108,7 +166,7 @@ mleaf_t *Mod_PointInLeaf (vec3_t p, qmodel_t *model)
 	if (!model || !model->nodes)
 		Sys_Error ("Mod_PointInLeaf: bad model");
 
-	node = model->nodes;
+	node = Mod_PointGridNode (p, model);
 	while (1)
 	{
 		if (node->contents < 0)
@@ -186,8 +244,90 @@ byte *Mod_DecompressVis (byte *in, qmodel_t *model)
 	return mod_decompressed;
 }
 
+/*
+===================
+Mod_PVSRow
+
+The leaf's row in the decompressed PVS table, NULL when the model has no
+table or the leaf is not one of the visleafs it covers.
+===================
+*/
+static byte *Mod_PVSRow (mleaf_t *leaf, qmodel_t *model)
+{
+	int	leafnum;
+
+	if (!model->pvsmatrix || model->numleafs != model->pvsleafs)
+		return NULL;
+	leafnum = leaf - model->leafs;
+	if (leafnum < 1 || leafnum > model->pvsleafs)
+		return NULL;
+	return model->pvsmatrix + (leafnum - 1) * model->pvsstride;
+}
+
+/*
+===================
+Mod_OrPVSRow
+
+out |= row over bytes; row comes from the PVS table and is 16 byte aligned.
+===================
+*/
+static void Mod_OrPVSRow (byte *out, const byte *row, int bytes)
+{
+	int i = 0;
+#if defined(USE_SSE2)
+	for ( ; i + 16 <= bytes; i += 16)
+		_mm_storeu_si128 ((__m128i *) (out + i), _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (out + i)),
+								 _mm_load_si128 ((const __m128i *) (row + i))));
+#elif defined(USE_NEON)
+	for ( ; i + 16 <= bytes; i += 16)
+		vst1q_u8 (out + i, vorrq_u8 (vld1q_u8 (out + i), vld1q_u8 (row + i)));
+#endif
+	for ( ; i < bytes; i++)
+		out[i] |= row[i];
+}
+
+/*
+===================
+Mod_PVSRowTouches
+
+True if pvs & row has any bit set over bytes.
+===================
+*/
+static qboolean Mod_PVSRowTouches (const byte *pvs, const byte *row, int bytes)
+{
+	int i = 0;
+#if defined(USE_SSE2)
+	__m128i	m;
+
+	for ( ; i + 16 <= bytes; i += 16)
+	{
+		m = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) (pvs + i)), _mm_load_si128 ((const __m128i *) (row + i)));
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (m, _mm_setzero_si128 ())) != 0xffff)
+			return true;
+	}
+#elif defined(USE_NEON)
+	uint64x2_t	m;
+
+	for ( ; i + 16 <= bytes; i += 16)
+	{
+		m = vreinterpretq_u64_u8 (vandq_u8 (vld1q_u8 (pvs + i), vld1q_u8 (row + i)));
+		if (vgetq_lane_u64 (m, 0) | vgetq_lane_u64 (m, 1))
+			return true;
+	}
+#endif
+	for ( ; i < bytes; i++)
+		if (pvs[i] & row[i])
+			return true;
+	return false;
+}
+
 byte *Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model)
 {
+	byte	*row;
+
+	row = Mod_PVSRow (leaf, model);
+	if (row)
+		return row;
 	if (leaf == model->leafs)
 		return Mod_NoVisPVS (model);
 	return Mod_DecompressVis (leaf->compressed_vis, model);
@@ -210,6 +350,111 @@ byte *Mod_NoVisPVS (qmodel_t *model)
 	return mod_novis;
 }
 
+/*
+===================
+Mod_OrCompressedVis
+
+ORs a run length compressed row into out, stops early on corrupt data.
+===================
+*/
+static void Mod_OrCompressedVis (const byte *in, byte *out, int row)
+{
+	int		c;
+	byte	*outend;
+
+	outend = out + row;
+	while (out < outend)
+	{
+		if (*in)
+		{
+			*out++ |= *in++;
+			continue;
+		}
+
+		c = in[1];
+		in += 2;
+		if (c > outend - out)
+			return;
+		out += c;
+	}
+}
+
+/*
+===================
+Mod_AddLeafPVS
+
+ORs the leaf's PVS into out.  Decompresses straight into it instead of going
+through the shared buffer of Mod_DecompressVis, so it can run on a worker
+thread; corrupt vis data is just cut short, Mod_DecompressVis warns about it.
+===================
+*/
+void Mod_AddLeafPVS (mleaf_t *leaf, qmodel_t *model, byte *out)
+{
+	int		row;
+	byte	*pvsrow;
+
+	row = (model->numleafs+7)>>3;
+	pvsrow = Mod_PVSRow (leaf, model);
+	if (pvsrow)
+	{
+		Mod_OrPVSRow (out, pvsrow, row);
+		return;
+	}
+	if (leaf == model->leafs || !leaf->compressed_vis)
+	{
+		memset (out, 0xff, row);
+		return;
+	}
+	Mod_OrCompressedVis (leaf->compressed_vis, out, row);
+}
+
+/*
+===================
+Mod_LeafPVSTouches
+
+True if any leaf in the leaf's PVS is set in pvs.  Uses the PVS table when
+the map has one, otherwise works on the compressed rows, so the runs of
+zeros that make up most of them are skipped whole.
+===================
+*/
+qboolean Mod_LeafPVSTouches (mleaf_t *leaf, qmodel_t *model, const byte *pvs)
+{
+	int		c, row;
+	byte	*in;
+	const byte	*end;
+
+	row = (model->numleafs+7)>>3;
+	in = Mod_PVSRow (leaf, model);
+	if (in)
+		return Mod_PVSRowTouches (pvs, in, row);
+	in = leaf->compressed_vis;
+	end = pvs + row;
+	if (leaf == model->leafs || !in)
+	{
+		for ( ; pvs < end; pvs++)
+			if (*pvs)
+				return true;
+		return false;
+	}
+
+	while (pvs < end)
+	{
+		if (*in)
+		{
+			if (*pvs++ & *in++)
+				return true;
+			continue;
+		}
+
+		c = in[1];
+		in += 2;
+		if (c > end - pvs)
+			break;
+		pvs += c;
+	}
+	return false;
+}
+
 /*
 ===================
 Mod_ClearAll
@@ -220,6 +465,8 @@ void Mod_ClearAll (void)
 	int		i;
 	qmodel_t	*mod;
 
+	Mod_WaitStages ();
+
 	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
 		if (mod->type != mod_alias)
 		{
@@ -228,6 +475,33 @@ void Mod_ClearAll (void)
 		}
 }
 
+/*
+===================
+Mod_ClearAllButWorld
+
+For reloading the same map: the world and its inline submodels stay
+loaded, only the lightmaps go since R_NewMap builds them again.
+===================
+*/
+void Mod_ClearAllButWorld (qmodel_t *world)
+{
+	int		i;
+	qmodel_t	*mod;
+
+	Mod_WaitStages ();
+
+	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
+	{
+		if (mod->type == mod_alias)
+			continue;
+		if (mod == world || mod->name[0] == '*')
+			continue;
+		mod->needload = true;
+		TexMgr_FreeTexturesForOwner (mod);
+	}
+	TexMgr_FreeLightmapsForOwner (world);
+}
+
 void Mod_ResetAll (void)
 {
 	int		i;
@@ -243,6 +517,7 @@ void Mod_ResetAll (void)
 		memset(mod, 0, sizeof(qmodel_t));
 	}
 	mod_numknown = 0;
+	memset (mod_hash, 0, sizeof(mod_hash));
 }
 
 /*
@@ -253,28 +528,31 @@ Mod_FindName
 */
 qmodel_t *Mod_FindName (const char *name)
 {
-	int		i;
+	unsigned	pos;
 	qmodel_t	*mod;
 
 	if (!name[0])
 		Sys_Error ("Mod_FindName: NULL name"); //johnfitz -- was "Mod_ForName"
 
+	mod_lookups++;
+
 //
 // search the currently loaded models
 //
-	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
-		if (!strcmp (mod->name, name) )
-			break;
-
-	if (i == mod_numknown)
+	for (pos = COM_HashString (name) & (MOD_HASH_SIZE - 1); mod_hash[pos]; pos = (pos + 1) & (MOD_HASH_SIZE - 1))
 	{
-		if (mod_numknown == MAX_MOD_KNOWN)
-			Sys_Error ("mod_numknown == MAX_MOD_KNOWN");
-		q_strlcpy (mod->name, name, MAX_QPATH);
-		mod->needload = true;
-		mod_numknown++;
+		mod = &mod_known[mod_hash[pos] - 1];
+		if (!strcmp (mod->name, name))
+			return mod;
 	}
 
+	if (mod_numknown == MAX_MOD_KNOWN)
+		Sys_Error ("mod_numknown == MAX_MOD_KNOWN");
+	mod = &mod_known[mod_numknown++];
+	q_strlcpy (mod->name, name, MAX_QPATH);
+	mod->needload = true;
+	mod_hash[pos] = mod_numknown;
+
 	return mod;
 }
 
@@ -307,8 +585,10 @@ Loads a model into the cache
 qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 {
 	byte	*buf;
+	byte	*prefetched;
 	byte	stackbuf[1024];		// avoid dirtying the cache heap
 	int	mod_type;
+	qboolean	mapped;
 
 	if (!mod->needload)
 	{
@@ -332,7 +612,16 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 //
 // load the file
 //
-	buf = COM_LoadStackFile (mod->name, stackbuf, sizeof(stackbuf), & mod->path_id);
+	prefetched = Mod_TakePrefetch (mod);
+	buf = prefetched;
+	mapped = false;
+	if (!buf)
+	{
+		buf = COM_MapFile (mod->name, & mod->path_id);
+		mapped = (buf != NULL);
+	}
+	if (!buf)
+		buf = COM_LoadStackFile (mod->name, stackbuf, sizeof(stackbuf), & mod->path_id);
 	if (!buf)
 	{
 		if (crash)
@@ -370,9 +659,194 @@ qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 		break;
 	}
 
+	if (mapped)
+		COM_UnmapFile (buf);
+	Mod_ReleasePrefetch (prefetched);
+
 	return mod;
 }
 
+/*
+===============================================================================
+
+					MODEL PREFETCH
+
+===============================================================================
+*/
+
+#define	MAX_MOD_PREFETCH	MAX_MODELS
+#define	MOD_PREFETCH_AHEAD	16	// read or reading, and not asked for yet
+
+typedef struct
+{
+	char		name[MAX_QPATH];
+	qboolean	started;
+	qboolean	used;
+	FILE		*file;
+	int		filesize;
+	unsigned int	path_id;
+	byte		*data;		// malloced file contents, NULL if the read failed
+	task_t		task;
+} modprefetch_t;
+
+static modprefetch_t	mod_prefetch[MAX_MOD_PREFETCH];
+static int		mod_prefetch_count;
+static int		mod_prefetch_next;	// first one not started
+static int		mod_prefetch_inflight;
+
+static void Mod_ReadTask (void *data)
+{
+	modprefetch_t	*p = (modprefetch_t *) data;
+
+	p->data = (byte *) malloc (p->filesize > 0 ? p->filesize : 1);
+	if (p->data && (int) fread (p->data, 1, p->filesize, p->file) != p->filesize)
+	{
+		free (p->data);
+		p->data = NULL;
+	}
+	fclose (p->file);
+	p->file = NULL;
+}
+
+/*
+=================
+Mod_StartPrefetches
+
+Keeps MOD_PREFETCH_AHEAD reads going. The files are opened here on the
+main thread, the workers only read them into memory.
+=================
+*/
+static void Mod_StartPrefetches (void)
+{
+	modprefetch_t	*p;
+
+	while (mod_prefetch_next < mod_prefetch_count && mod_prefetch_inflight < MOD_PREFETCH_AHEAD)
+	{
+		p = &mod_prefetch[mod_prefetch_next++];
+		if (p->used)
+			continue;
+
+		COM_FOpenFile (p->name, &p->file, &p->path_id);
+		if (!p->file)
+			continue;	// Mod_LoadModel will report it
+		p->filesize = com_filesize;
+		p->started = true;
+		mod_prefetch_inflight++;
+		p->task = Task_Run (Mod_ReadTask, p, NULL, 0);
+	}
+}
+
+/*
+=================
+Mod_Prefetch
+
+Queues the file of a model that is about to be loaded with Mod_ForName
+to be read on a worker thread, so the signon precache list reads ahead
+while the main thread parses and uploads the models before it. Brush
+submodels and models that are still loaded are skipped.
+=================
+*/
+void Mod_Prefetch (const char *name)
+{
+	qmodel_t	*mod;
+	modprefetch_t	*p;
+
+	if (!Tasks_NumWorkers () || mod_prefetch_count == MAX_MOD_PREFETCH)
+		return;
+	if (!name[0] || name[0] == '*')
+		return;
+
+	mod = Mod_FindName (name);
+	if (!mod->needload && (mod->type != mod_alias || Cache_Check (&mod->cache)))
+		return;
+
+	p = &mod_prefetch[mod_prefetch_count++];
+	memset (p, 0, sizeof(*p));
+	q_strlcpy (p->name, name, sizeof(p->name));
+	Mod_StartPrefetches ();
+}
+
+/*
+=================
+Mod_FlushPrefetch
+
+Drops whatever was queued and not loaded.
+=================
+*/
+void Mod_FlushPrefetch (void)
+{
+	modprefetch_t	*p;
+	int		i;
+
+	for (i = 0, p = mod_prefetch; i < mod_prefetch_count; i++, p++)
+	{
+		if (p->started)
+		{
+			Task_Wait (p->task);
+			free (p->data);	// still set if a load was aborted
+		}
+	}
+
+	mod_prefetch_count = mod_prefetch_next = mod_prefetch_inflight = 0;
+}
+
+/*
+=================
+Mod_TakePrefetch
+
+Returns the prefetched contents of mod's file, or NULL if it wasn't
+queued or couldn't be read; the caller loads it the usual way then.
+The buffer stays owned by the queue until Mod_ReleasePrefetch, so a
+load aborted by Host_Error doesn't leak it.
+=================
+*/
+static byte *Mod_TakePrefetch (qmodel_t *mod)
+{
+	modprefetch_t	*p;
+	int		i;
+
+	for (i = 0, p = mod_prefetch; i < mod_prefetch_count; i++, p++)
+	{
+		if (!p->used && !strcmp (p->name, mod->name))
+			break;
+	}
+	if (i == mod_prefetch_count)
+		return NULL;
+
+	// anything asked for out of order just gets loaded here
+	p->used = true;
+	if (!p->started)
+		return NULL;
+
+	Task_Wait (p->task);
+	mod_prefetch_inflight--;
+	Mod_StartPrefetches ();
+
+	if (!p->data)
+		return NULL;
+	mod->path_id = p->path_id;
+	com_filesize = p->filesize;
+	return p->data;
+}
+
+static void Mod_ReleasePrefetch (byte *data)
+{
+	modprefetch_t	*p;
+	int		i;
+
+	if (!data)
+		return;
+	for (i = 0, p = mod_prefetch; i < mod_prefetch_count; i++, p++)
+	{
+		if (p->data == data)
+		{
+			free (p->data);
+			p->data = NULL;
+			return;
+		}
+	}
+}
+
 /*
 ==================
 Mod_ForName
@@ -400,16 +874,222 @@ qmodel_t *Mod_ForName (const char *name, qboolean crash)
 
 byte	*mod_base;
 
+/*
+=================
+Brush model load stages
+
+Lumps that only need converting are filled in by the task workers,
+while the main thread carries on with the stages that allocate from
+the hunk, upload textures or read other files. Allocation and error
+reporting always stay on the main thread: a fill that finds bad data
+only records an error, which Mod_FinishStages raises.
+=================
+*/
+#define	MAX_MOD_STAGES	32
+
+typedef struct modstage_s
+{
+	const char	*name;
+	void		(*fill) (struct modstage_s *stage);
+	const byte	*in;
+	void		*out;
+	int		count;
+	int		limit;		// for bounds checks done by fill
+	qboolean	bsp2;
+	const char	*error;		// set by fill
+	double		time;		// seconds
+	qboolean	threaded;
+	task_t		task;
+} modstage_t;
+
+static modstage_t	mod_stages[MAX_MOD_STAGES];
+static int		mod_numstages;
+static modstage_t	*mod_visstage;	// fills visdata, NULL once it is in place
+
+static void Mod_RunStage (void *data)
+{
+	modstage_t	*stage = (modstage_t *) data;
+	double		start;
+
+	start = Sys_DoubleTime ();
+	stage->fill (stage);
+	stage->time = Sys_DoubleTime () - start;
+}
+
+static modstage_t *Mod_NewStage (const char *name)
+{
+	modstage_t	*stage;
+
+	if (mod_numstages == MAX_MOD_STAGES)
+		Sys_Error ("Mod_NewStage: too many stages");
+	stage = &mod_stages[mod_numstages++];
+	memset (stage, 0, sizeof(*stage));
+	stage->name = name;
+	return stage;
+}
+
+/*
+=================
+Mod_StartStage
+
+Queues fill for the task workers, the output must already be allocated.
+Stages that need more parameters are set up with Mod_NewStage and
+queued with Mod_QueueStage instead.
+=================
+*/
+static modstage_t *Mod_QueueStage (modstage_t *stage)
+{
+	stage->threaded = true;
+	stage->task = Task_Run (Mod_RunStage, stage, NULL, 0);
+	return stage;
+}
+
+// same, but fill only starts once the fills of the stages in after are
+// done, NULL entries are skipped
+static modstage_t *Mod_QueueStageAfterAll (modstage_t *stage, const modstage_t *const *after, int numafter)
+{
+	task_t	deps[4];
+	int	i, numdeps;
+
+	if (numafter > (int) (sizeof(deps) / sizeof(deps[0])))
+		Sys_Error ("Mod_QueueStageAfterAll: %i stages", numafter);
+	for (i = numdeps = 0; i < numafter; i++)
+	{
+		if (after[i])
+			deps[numdeps++] = after[i]->task;
+	}
+	stage->threaded = true;
+	stage->task = Task_Run (Mod_RunStage, stage, deps, numdeps);
+	return stage;
+}
+
+static modstage_t *Mod_QueueStageAfter (modstage_t *stage, const modstage_t *after)
+{
+	return Mod_QueueStageAfterAll (stage, &after, 1);
+}
+
+static modstage_t *Mod_StartStage (const char *name, void (*fill) (modstage_t *stage), const void *in, void *out, int count)
+{
+	modstage_t	*stage;
+
+	stage = Mod_NewStage (name);
+	stage->fill = fill;
+	stage->in = (const byte *) in;
+	stage->out = out;
+	stage->count = count;
+	return Mod_QueueStage (stage);
+}
+
+/*
+=================
+Mod_StageTime
+
+Records the time of a stage that ran on the main thread since start,
+returns the current time so stages can be timed back to back.
+=================
+*/
+static double Mod_StageTime (const char *name, double start)
+{
+	double	now;
+
+	now = Sys_DoubleTime ();
+	Mod_NewStage (name)->time = now - start;
+	return now;
+}
+
+static void Mod_WaitStage (modstage_t *stage)
+{
+	if (stage)
+		Task_Wait (stage->task);
+}
+
+/*
+=================
+Mod_WaitStages
+
+Waits for every queued fill, also used to drain the stages of a load
+that was aborted by Host_Error before its hunk memory goes away.
+=================
+*/
+static void Mod_WaitStages (void)
+{
+	int	i;
+
+	for (i = 0; i < mod_numstages; i++)
+		Mod_WaitStage (&mod_stages[i]);
+	mod_numstages = 0;
+	mod_visstage = NULL;
+}
+
+/*
+=================
+Mod_FinishStages
+=================
+*/
+static void Mod_FinishStages (double start)
+{
+	modstage_t	*stage;
+	int		i, numstages;
+
+	numstages = mod_numstages;
+	Mod_WaitStages ();
+
+	for (i = 0, stage = mod_stages; i < numstages; i++, stage++)
+	{
+		if (stage->error)
+			Host_Error ("%s in %s", stage->error, loadmodel->name);
+	}
+
+	if (!developer.value)
+		return;
+	Con_DPrintf ("%s: %.1f ms, %i task workers\n", loadmodel->name, (Sys_DoubleTime () - start) * 1000.0, Tasks_NumWorkers ());
+	for (i = 0, stage = mod_stages; i < numstages; i++, stage++)
+		Con_DPrintf ("  %-13s %7.1f ms%s\n", stage->name, stage->time * 1000.0, stage->threaded ? " (task)" : "");
+}
+
 /*
 =================
 Mod_CheckFullbrights -- johnfitz
+
+The vector paths take the max of each 64 byte block and stop at the
+first block that has a fullbright.
 =================
 */
 qboolean Mod_CheckFullbrights (byte *pixels, int count)
 {
-	int i;
-	for (i = 0; i < count; i++)
-		if (*pixels++ > 223)
+	int i = 0;
+#if defined(USE_SSE2)
+	__m128i	m;
+
+	for ( ; i + 64 <= count; i += 64)
+	{
+		m = _mm_max_epu8 (_mm_loadu_si128 ((const __m128i *) (pixels + i)),
+				  _mm_loadu_si128 ((const __m128i *) (pixels + i + 16)));
+		m = _mm_max_epu8 (m, _mm_loadu_si128 ((const __m128i *) (pixels + i + 32)));
+		m = _mm_max_epu8 (m, _mm_loadu_si128 ((const __m128i *) (pixels + i + 48)));
+		// m > 223 where max (m, 224) == m
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_max_epu8 (m, _mm_set1_epi8 ((char) 224)), m)))
+			return true;
+	}
+#elif defined(USE_NEON)
+	uint8x16_t	m;
+	uint8x8_t	h;
+
+	for ( ; i + 64 <= count; i += 64)
+	{
+		m = vmaxq_u8 (vld1q_u8 (pixels + i), vld1q_u8 (pixels + i + 16));
+		m = vmaxq_u8 (m, vld1q_u8 (pixels + i + 32));
+		m = vmaxq_u8 (m, vld1q_u8 (pixels + i + 48));
+		h = vmax_u8 (vget_low_u8 (m), vget_high_u8 (m));
+		h = vpmax_u8 (h, h);
+		h = vpmax_u8 (h, h);
+		h = vpmax_u8 (h, h);
+		if (vget_lane_u8 (h, 0) > 223)
+			return true;
+	}
+#endif
+	for ( ; i < count; i++)
+		if (pixels[i] > 223)
 			return true;
 	return false;
 }
@@ -434,6 +1114,59 @@ qboolean Mod_CheckAnimTextureArrayQ64(texture_t *anims[], int numTex)
 	return true;
 }
 
+/*
+=================
+Mod_PrefetchTextures
+
+Starts decoding the external textures Mod_LoadTextures is about to ask
+for, in the order it asks, following the same fallbacks.
+=================
+*/
+static void Mod_PrefetchTextures (dmiptexlump_t *m, int nummiptex)
+{
+	char		mapname[MAX_QPATH];
+	char		texname[17];
+	char		filename[MAX_OSPATH], filename2[MAX_OSPATH];
+	miptex_t	*mt;
+	int		i, ofs;
+
+	if (isDedicated || !Tasks_NumWorkers ())
+		return;
+
+	COM_StripExtension (loadmodel->name + 5, mapname, sizeof(mapname));
+	for (i=0 ; i<nummiptex ; i++)
+	{
+		ofs = LittleLong (m->dataofs[i]);
+		if (ofs == -1)
+			continue;
+		mt = (miptex_t *)((byte *)m + ofs);
+		memcpy (texname, mt->name, 16);
+		texname[16] = 0;
+
+		if (!q_strncasecmp (texname, "sky", 3))
+			continue;
+		if (texname[0] == '*')
+			texname[0] = '#';
+
+		q_snprintf (filename, sizeof(filename), "textures/%s/%s", mapname, texname);
+		if (!Image_Prefetch (filename))
+		{
+			q_snprintf (filename, sizeof(filename), "textures/%s", texname);
+			if (!Image_Prefetch (filename))
+				continue;
+		}
+
+		if (texname[0] == '#')
+			continue;	// no glow map for warping textures
+		q_snprintf (filename2, sizeof(filename2), "%s_glow", filename);
+		if (!Image_Prefetch (filename2))
+		{
+			q_snprintf (filename2, sizeof(filename2), "%s_luma", filename);
+			Image_Prefetch (filename2);
+		}
+	}
+}
+
 /*
 =================
 Mod_LoadTextures
@@ -475,6 +1208,8 @@ void Mod_LoadTextures (lump_t *l)
 	loadmodel->numtextures = nummiptex + 2; //johnfitz -- need 2 dummy texture chains for missing textures
 	loadmodel->textures = (texture_t **) Hunk_AllocName (loadmodel->numtextures * sizeof(*loadmodel->textures) , loadname);
 
+	Mod_PrefetchTextures (m, nummiptex);
+
 	for (i=0 ; i<nummiptex ; i++)
 	{
 		m->dataofs[i] = LittleLong(m->dataofs[i]);
@@ -499,6 +1234,7 @@ void Mod_LoadTextures (lump_t *l)
 		memcpy (tx->name, mt->name, sizeof(tx->name));
 		tx->width = mt->width;
 		tx->height = mt->height;
+		tx->texarray = -1; // set by GL_BuildBModelVertexBuffer
 		// the pixels immediately follow the structures
 
 		// ericw -- check for pixels extending past the end of the lump.
@@ -612,7 +1348,7 @@ void Mod_LoadTextures (lump_t *l)
 
 					if (data)
 						tx->fullbright = TexMgr_LoadImage (loadmodel, filename2, fwidth, fheight,
-							SRC_RGBA, data, filename, 0, TEXPREF_MIPMAP | extraflags );
+							SRC_RGBA, data, filename2, 0, TEXPREF_MIPMAP | extraflags );
 				}
 				else //use the texture from the bsp file
 				{
@@ -638,6 +1374,8 @@ void Mod_LoadTextures (lump_t *l)
 		//johnfitz
 	}
 
+	Image_FlushPrefetch ();
+
 	//johnfitz -- last 2 slots in array should be filled with dummy textures
 	loadmodel->textures[loadmodel->numtextures-2] = r_notexture_mip; //for lightmapped surfs
 	loadmodel->textures[loadmodel->numtextures-1] = r_notexture_mip2; //for SURF_DRAWTILED surfs
@@ -739,6 +1477,49 @@ void Mod_LoadTextures (lump_t *l)
 	}
 }
 
+/*
+=================
+Mod_FillLighting
+
+Expands the white lighting data to color.
+=================
+*/
+static void Mod_FillLighting (modstage_t *stage)
+{
+	const byte *in = stage->in;
+	byte *out = (byte *) stage->out;
+	byte d;
+	int i;
+
+	for (i = 0;i < stage->count;i++)
+	{
+		d = *in++;
+		*out++ = d;
+		*out++ = d;
+		*out++ = d;
+	}
+}
+
+static void Mod_FillLighting64 (modstage_t *stage)
+{
+	const byte *in = stage->in;
+	byte *out = (byte *) stage->out;
+	byte q64_b0, q64_b1;
+	int i;
+
+	// RGB lightmap samples are packed in 16bits.
+	// RRRRR GGGGG BBBBBB
+	for (i = 0;i < stage->count;i++)
+	{
+		q64_b0 = *in++;
+		q64_b1 = *in++;
+
+		*out++ = q64_b0 & 0xf8;/* 0b11111000 */
+		*out++ = ((q64_b0 & 0x07) << 5) + ((q64_b1 & 0xc0) >> 5);/* 0b00000111, 0b11000000 */
+		*out++ = (q64_b1 & 0x3f) << 2;/* 0b00111111 */
+	}
+}
+
 /*
 =================
 Mod_LoadLighting -- johnfitz -- replaced with lit support code via lordhavoc
@@ -747,8 +1528,7 @@ Mod_LoadLighting -- johnfitz -- replaced with lit support code via lordhavoc
 void Mod_LoadLighting (lump_t *l)
 {
 	int i, mark;
-	byte *in, *out, *data;
-	byte d, q64_b0, q64_b1;
+	byte *data;
 	char litfilename[MAX_OSPATH];
 	unsigned int path_id;
 
@@ -802,36 +1582,13 @@ void Mod_LoadLighting (lump_t *l)
 	// Quake64 bsp lighmap data
 	if (loadmodel->bspversion == BSPVERSION_QUAKE64)
 	{
-		// RGB lightmap samples are packed in 16bits.
-		// RRRRR GGGGG BBBBBB
-
 		loadmodel->lightdata = (byte *) Hunk_AllocName ( (l->filelen / 2)*3, litfilename);
-		in = mod_base + l->fileofs;
-		out = loadmodel->lightdata;
-
-		for (i = 0;i < (l->filelen / 2) ;i++)
-		{
-			q64_b0 = *in++;
-			q64_b1 = *in++;
-
-			*out++ = q64_b0 & 0xf8;/* 0b11111000 */
-			*out++ = ((q64_b0 & 0x07) << 5) + ((q64_b1 & 0xc0) >> 5);/* 0b00000111, 0b11000000 */
-			*out++ = (q64_b1 & 0x3f) << 2;/* 0b00111111 */
-		}
+		Mod_StartStage ("lighting", Mod_FillLighting64, mod_base + l->fileofs, loadmodel->lightdata, l->filelen / 2);
 		return;
 	}
 
 	loadmodel->lightdata = (byte *) Hunk_AllocName ( l->filelen*3, litfilename);
-	in = loadmodel->lightdata + l->filelen*2; // place the file at the end, so it will not be overwritten until the very last write
-	out = loadmodel->lightdata;
-	memcpy (in, mod_base + l->fileofs, l->filelen);
-	for (i = 0;i < l->filelen;i++)
-	{
-		d = *in++;
-		*out++ = d;
-		*out++ = d;
-		*out++ = d;
-	}
+	Mod_StartStage ("lighting", Mod_FillLighting, mod_base + l->fileofs, loadmodel->lightdata, l->filelen);
 }
 
 
@@ -840,6 +1597,11 @@ void Mod_LoadLighting (lump_t *l)
 Mod_LoadVisibility
 =================
 */
+static void Mod_FillCopy (modstage_t *stage)
+{
+	memcpy (stage->out, stage->in, stage->count);
+}
+
 void Mod_LoadVisibility (lump_t *l)
 {
 	loadmodel->viswarn = false;
@@ -849,7 +1611,82 @@ void Mod_LoadVisibility (lump_t *l)
 		return;
 	}
 	loadmodel->visdata = (byte *) Hunk_AllocName ( l->filelen, loadname);
-	memcpy (loadmodel->visdata, mod_base + l->fileofs, l->filelen);
+	mod_visstage = Mod_StartStage ("visibility", Mod_FillCopy, mod_base + l->fileofs, loadmodel->visdata, l->filelen);
+}
+
+/*
+=================
+Mod_StartPVSMatrix
+
+Decompresses the PVS of every visleaf into a table on the hunk, so
+Mod_LeafPVS and the fat PVS merges of the server become plain row reads
+instead of run length decoding.  Rows are padded to 16 bytes for the
+vector paths.  The table is square in the leaf count, so big maps that
+would take more than mod_pvsmatrix megabytes keep decoding as before.
+The rows are split between the task workers and only start once the
+visibility lump has been copied.
+=================
+*/
+#define	PVSMATRIX_CHUNKS	4
+
+static void Mod_FillPVSMatrix (modstage_t *stage)
+{
+	const mleaf_t	*leaf = (const mleaf_t *) stage->in;
+	byte	*out = (byte *) stage->out;
+	int		i, row, stride;
+
+	row = stage->limit;
+	stride = (row + 15) & ~15;
+	for (i = 0; i < stage->count; i++, leaf++, out += stride)
+	{
+		if (!leaf->compressed_vis)
+			memset (out, 0xff, row);
+		else
+			Mod_OrCompressedVis (leaf->compressed_vis, out, row);
+	}
+}
+
+static void Mod_StartPVSMatrix (void)
+{
+	modstage_t	*stage;
+	int		visleafs, row, stride, chunks, first, count, i;
+	double	size;
+
+	loadmodel->pvsmatrix = NULL;
+	loadmodel->pvsleafs = loadmodel->pvsstride = 0;
+	if (!loadmodel->visdata || !loadmodel->numsubmodels || mod_pvsmatrix.value <= 0)
+		return;
+
+	visleafs = q_min (loadmodel->submodels[0].visleafs, loadmodel->numleafs - 1);
+	if (visleafs <= 0)
+		return;
+	row = (visleafs + 7) >> 3;
+	stride = (row + 15) & ~15;
+	size = (double) stride * visleafs;
+	if (size > mod_pvsmatrix.value * 1024.0 * 1024.0)
+	{
+		Con_DPrintf ("%s: %.1f MB PVS table exceeds mod_pvsmatrix, decoding rows instead\n", loadmodel->name, size / (1024.0 * 1024.0));
+		return;
+	}
+
+	loadmodel->pvsmatrix = (byte *) Hunk_AllocName ((int) size, loadname);
+	loadmodel->pvsleafs = visleafs;
+	loadmodel->pvsstride = stride;
+
+	chunks = q_max (1, q_min (Tasks_NumWorkers (), PVSMATRIX_CHUNKS));
+	for (i = 0, first = 0; i < chunks; i++, first += count)
+	{
+		count = (visleafs - first) / (chunks - i);
+		if (!count)
+			continue;
+		stage = Mod_NewStage ("pvs table");
+		stage->fill = Mod_FillPVSMatrix;
+		stage->in = (const byte *) &loadmodel->leafs[1 + first];
+		stage->out = loadmodel->pvsmatrix + first * stride;
+		stage->count = count;
+		stage->limit = row;
+		Mod_QueueStageAfter (stage, mod_visstage);
+	}
 }
 
 
@@ -922,11 +1759,25 @@ _load_embedded:
 Mod_LoadVertexes
 =================
 */
-void Mod_LoadVertexes (lump_t *l)
+static void Mod_FillVertexes (modstage_t *stage)
+{
+	const dvertex_t	*in = (const dvertex_t *) stage->in;
+	mvertex_t	*out = (mvertex_t *) stage->out;
+	int			i;
+
+	for (i=0 ; i<stage->count ; i++, in++, out++)
+	{
+		out->position[0] = LittleFloat (in->point[0]);
+		out->position[1] = LittleFloat (in->point[1]);
+		out->position[2] = LittleFloat (in->point[2]);
+	}
+}
+
+modstage_t *Mod_LoadVertexes (lump_t *l)
 {
 	dvertex_t	*in;
 	mvertex_t	*out;
-	int			i, count;
+	int			count;
 
 	in = (dvertex_t *)(mod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
@@ -937,12 +1788,7 @@ void Mod_LoadVertexes (lump_t *l)
 	loadmodel->vertexes = out;
 	loadmodel->numvertexes = count;
 
-	for (i=0 ; i<count ; i++, in++, out++)
-	{
-		out->position[0] = LittleFloat (in->point[0]);
-		out->position[1] = LittleFloat (in->point[1]);
-		out->position[2] = LittleFloat (in->point[2]);
-	}
+	return Mod_StartStage ("vertexes", Mod_FillVertexes, in, out, count);
 }
 
 /*
@@ -950,25 +1796,16 @@ void Mod_LoadVertexes (lump_t *l)
 Mod_LoadEdges
 =================
 */
-void Mod_LoadEdges (lump_t *l, int bsp2)
+static void Mod_FillEdges (modstage_t *stage)
 {
-	medge_t *out;
-	int 	i, count;
+	medge_t *out = (medge_t *) stage->out;
+	int 	i;
 
-	if (bsp2)
+	if (stage->bsp2)
 	{
-		dledge_t *in = (dledge_t *)(mod_base + l->fileofs);
-
-		if (l->filelen % sizeof(*in))
-			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
+		const dledge_t *in = (const dledge_t *) stage->in;
 
-		count = l->filelen / sizeof(*in);
-		out = (medge_t *) Hunk_AllocName ( (count + 1) * sizeof(*out), loadname);
-
-		loadmodel->edges = out;
-		loadmodel->numedges = count;
-
-		for (i=0 ; i<count ; i++, in++, out++)
+		for (i=0 ; i<stage->count ; i++, in++, out++)
 		{
 			out->v[0] = LittleLong(in->v[0]);
 			out->v[1] = LittleLong(in->v[1]);
@@ -976,18 +1813,9 @@ void Mod_LoadEdges (lump_t *l, int bsp2)
 	}
 	else
 	{
-		dsedge_t *in = (dsedge_t *)(mod_base + l->fileofs);
-
-		if (l->filelen % sizeof(*in))
-			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-
-		count = l->filelen / sizeof(*in);
-		out = (medge_t *) Hunk_AllocName ( (count + 1) * sizeof(*out), loadname);
+		const dsedge_t *in = (const dsedge_t *) stage->in;
 
-		loadmodel->edges = out;
-		loadmodel->numedges = count;
-
-		for (i=0 ; i<count ; i++, in++, out++)
+		for (i=0 ; i<stage->count ; i++, in++, out++)
 		{
 			out->v[0] = (unsigned short)LittleShort(in->v[0]);
 			out->v[1] = (unsigned short)LittleShort(in->v[1]);
@@ -995,6 +1823,31 @@ void Mod_LoadEdges (lump_t *l, int bsp2)
 	}
 }
 
+modstage_t *Mod_LoadEdges (lump_t *l, int bsp2)
+{
+	medge_t *out;
+	modstage_t *stage;
+	int 	count;
+	size_t	insize = bsp2 ? sizeof(dledge_t) : sizeof(dsedge_t);
+
+	if (l->filelen % insize)
+		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
+
+	count = l->filelen / insize;
+	out = (medge_t *) Hunk_AllocName ( (count + 1) * sizeof(*out), loadname);
+
+	loadmodel->edges = out;
+	loadmodel->numedges = count;
+
+	stage = Mod_NewStage ("edges");
+	stage->fill = Mod_FillEdges;
+	stage->in = mod_base + l->fileofs;
+	stage->out = out;
+	stage->count = count;
+	stage->bsp2 = bsp2;
+	return Mod_QueueStage (stage);
+}
+
 /*
 =================
 Mod_LoadTexinfo
@@ -1204,6 +2057,311 @@ void Mod_CalcSurfaceBounds (msurface_t *s)
 	}
 }
 
+/*
+===============================================================================
+
+					MODEL CACHE
+
+===============================================================================
+*/
+
+/*
+With mod_cache 1, what a brush model load derives from the bsp rather than
+copies out of it is saved to cache/<name>.qmc in the game directory: the
+extents and bounds of every surface, the sky and water polys with their
+subdivisions, and the point grid.  The next load of the same file reads
+them back instead.  A cache only counts when the bsp's size and CRC, the
+engine version and gl_subdivide_size all match; anything else rewrites it.
+*/
+#define	MODCACHE_IDENT		(('C'<<24)+('M'<<16)+('S'<<8)+'Q')
+#define	MODCACHE_VERSION	1
+
+typedef struct
+{
+	int		ident;
+	int		version;
+	char	engine[16];	// QUAKESPASM_VER_STRING
+	int		filesize;	// of the bsp
+	int		crc;
+	float	subdivide;
+	int		numsurfaces;
+	int		numnodes;
+	int		numleafs;
+	int		numpolys;
+	int		numpolyverts;
+	int		pointgridsize[3];	// 0 0 0 for no grid
+	vec3_t	pointgridmins;
+	float	pointgridscale;
+} modcacheheader_t;
+
+typedef struct modcachesurf_s
+{
+	short	texturemins[2];
+	short	extents[2];
+	float	mins[3], maxs[3];
+	int		numpolys;
+} modcachesurf_t;
+
+// followed by numsurfaces modcachesurf_t, numpolys vertex counts,
+// numpolyverts * VERTEXSIZE floats and the point grid cells
+
+static byte	*mod_cachedata;		// malloced cache of the model being loaded, NULL if none
+static modcacheheader_t	mod_cachehdr;	// what the cache of the model being loaded has to match
+
+static void Mod_CachePath (const char *name, char *path, size_t size)
+{
+	char	base[MAX_QPATH];
+
+	COM_StripExtension (name, base, sizeof(base));
+	q_snprintf (path, size, "%s/cache/%s.qmc", com_gamedir, base);
+}
+
+static void Mod_FreeCache (void)
+{
+	free (mod_cachedata);
+	mod_cachedata = NULL;
+}
+
+/*
+=================
+Mod_OpenCache
+
+Called with the untouched bsp, reads its cache if there is one that fits.
+=================
+*/
+static void Mod_OpenCache (qmodel_t *mod, const byte *buffer, int filesize)
+{
+	char	path[MAX_OSPATH];
+	modcacheheader_t	*hdr;
+	FILE	*f;
+	long	len;
+
+	Mod_FreeCache ();
+	memset (&mod_cachehdr, 0, sizeof(mod_cachehdr));
+	if (!mod_cache.value || filesize <= 0)
+		return;
+
+	mod_cachehdr.ident = MODCACHE_IDENT;
+	mod_cachehdr.version = MODCACHE_VERSION;
+	q_strlcpy (mod_cachehdr.engine, QUAKESPASM_VER_STRING, sizeof(mod_cachehdr.engine));
+	mod_cachehdr.filesize = filesize;
+	mod_cachehdr.crc = CRC_Block (buffer, filesize);
+	mod_cachehdr.subdivide = gl_subdivide_size.value;
+
+	Mod_CachePath (mod->name, path, sizeof(path));
+	f = fopen (path, "rb");
+	if (!f)
+		return;
+	fseek (f, 0, SEEK_END);
+	len = ftell (f);
+	fseek (f, 0, SEEK_SET);
+	if (len >= (long) sizeof(*hdr))
+	{
+		mod_cachedata = (byte *) malloc (len);
+		if (mod_cachedata && fread (mod_cachedata, 1, len, f) != (size_t) len)
+			Mod_FreeCache ();
+	}
+	fclose (f);
+	if (!mod_cachedata)
+		return;
+
+	hdr = (modcacheheader_t *) mod_cachedata;
+	if (hdr->ident != mod_cachehdr.ident || hdr->version != mod_cachehdr.version ||
+		strncmp (hdr->engine, mod_cachehdr.engine, sizeof(hdr->engine)) ||
+		hdr->filesize != filesize || hdr->crc != mod_cachehdr.crc || hdr->subdivide != mod_cachehdr.subdivide ||
+		hdr->numsurfaces < 0 || hdr->numpolys < 0 || hdr->numpolyverts < 0 ||
+		hdr->pointgridsize[0] < 0 || hdr->pointgridsize[1] < 0 || hdr->pointgridsize[2] < 0 ||
+		len != (long) (sizeof(*hdr) + hdr->numsurfaces * sizeof(modcachesurf_t) + hdr->numpolys * sizeof(int) +
+			((double) hdr->numpolyverts * VERTEXSIZE + (double) hdr->pointgridsize[0] * hdr->pointgridsize[1] * hdr->pointgridsize[2]) * 4))
+	{
+		Con_DPrintf ("%s is out of date\n", path);
+		Mod_FreeCache ();
+		return;
+	}
+}
+
+/*
+=================
+Mod_CachedSurfaces
+
+The cached surfaces if the cache is for count of them, for Mod_LoadFaces
+=================
+*/
+static const modcachesurf_t *Mod_CachedSurfaces (int count)
+{
+	if (!mod_cachedata)
+		return NULL;
+	if (((modcacheheader_t *) mod_cachedata)->numsurfaces != count)
+	{
+		Mod_FreeCache ();
+		return NULL;
+	}
+	return (const modcachesurf_t *) (mod_cachedata + sizeof(modcacheheader_t));
+}
+
+static void Mod_CopyCachedSurface (msurface_t *s, const modcachesurf_t *in)
+{
+	s->texturemins[0] = in->texturemins[0];
+	s->texturemins[1] = in->texturemins[1];
+	s->extents[0] = in->extents[0];
+	s->extents[1] = in->extents[1];
+	VectorCopy (in->mins, s->mins);
+	VectorCopy (in->maxs, s->maxs);
+	s->polys = NULL;
+}
+
+/*
+=================
+Mod_RestoreCachedPolys
+
+Rebuilds the poly chains in the order Mod_PolyForUnlitSurface and
+GL_SubdivideSurface left them.
+=================
+*/
+static void Mod_RestoreCachedPolys (void)
+{
+	const modcacheheader_t	*hdr = (const modcacheheader_t *) mod_cachedata;
+	const modcachesurf_t	*in;
+	const int	*numverts;
+	const float	*verts, *endverts;
+	glpoly_t	*poly, **link;
+	msurface_t	*s;
+	int			i, j, polys;
+
+	in = (const modcachesurf_t *) (mod_cachedata + sizeof(*hdr));
+	numverts = (const int *) (in + hdr->numsurfaces);
+	verts = (const float *) (numverts + hdr->numpolys);
+	endverts = verts + hdr->numpolyverts * VERTEXSIZE;
+
+	for (i = 0, polys = 0, s = loadmodel->surfaces; i < loadmodel->numsurfaces; i++, in++, s++)
+	{
+		link = &s->polys;
+		for (j = 0; j < in->numpolys; j++, polys++)
+		{
+			if (polys >= hdr->numpolys || numverts[polys] < 3 || verts + numverts[polys] * VERTEXSIZE > endverts)
+				Host_Error ("Mod_RestoreCachedPolys: bad cache for %s", loadmodel->name);
+			poly = (glpoly_t *) Hunk_Alloc (sizeof(glpoly_t) + (numverts[polys]-4) * VERTEXSIZE*sizeof(float));
+			poly->numverts = numverts[polys];
+			memcpy (poly->verts, verts, poly->numverts * VERTEXSIZE * sizeof(float));
+			verts += poly->numverts * VERTEXSIZE;
+			*link = poly;
+			link = &poly->next;
+		}
+	}
+}
+
+/*
+=================
+Mod_CachedPointGrid
+
+Sets up the point grid from the cache, false if it has to be built
+=================
+*/
+static qboolean Mod_CachedPointGrid (qmodel_t *mod)
+{
+	const modcacheheader_t	*hdr = (const modcacheheader_t *) mod_cachedata;
+	const int	*cells;
+	int			size;
+
+	if (!hdr || hdr->numnodes != mod->numnodes || hdr->numleafs != mod->numleafs)
+		return false;
+
+	size = hdr->pointgridsize[0] * hdr->pointgridsize[1] * hdr->pointgridsize[2];
+	if (!size)
+	{
+		mod->pointgrid = NULL;
+		return true;
+	}
+	cells = (const int *) (mod_cachedata + sizeof(*hdr) + hdr->numsurfaces * sizeof(modcachesurf_t) + hdr->numpolys * sizeof(int)) + hdr->numpolyverts * VERTEXSIZE;
+	mod->pointgrid = (int *) Hunk_AllocName (size * sizeof(int), loadname);
+	memcpy (mod->pointgrid, cells, size * sizeof(int));
+	VectorCopy (hdr->pointgridsize, mod->pointgridsize);
+	VectorCopy (hdr->pointgridmins, mod->pointgridmins);
+	mod->pointgridscale = hdr->pointgridscale;
+	return true;
+}
+
+/*
+=================
+Mod_WriteCache
+
+Saves what the load of mod derived, unless it came from the cache
+=================
+*/
+static void Mod_WriteCache (qmodel_t *mod, qboolean cached)
+{
+	char		path[MAX_OSPATH];
+	modcacheheader_t	hdr;
+	modcachesurf_t	out;
+	msurface_t	*s;
+	glpoly_t	*poly;
+	FILE		*f;
+	int			i, size;
+	qboolean	ok;
+
+	if (cached || !mod_cache.value || !mod_cachehdr.filesize)
+		return;
+
+	hdr = mod_cachehdr;
+	hdr.numsurfaces = mod->numsurfaces;
+	hdr.numnodes = mod->numnodes;
+	hdr.numleafs = mod->numleafs;
+	for (i = 0, s = mod->surfaces; i < mod->numsurfaces; i++, s++)
+	{
+		for (poly = s->polys; poly; poly = poly->next)
+		{
+			hdr.numpolys++;
+			hdr.numpolyverts += poly->numverts;
+		}
+	}
+	if (mod->pointgrid)
+	{
+		VectorCopy (mod->pointgridsize, hdr.pointgridsize);
+		VectorCopy (mod->pointgridmins, hdr.pointgridmins);
+		hdr.pointgridscale = mod->pointgridscale;
+	}
+
+	Mod_CachePath (mod->name, path, sizeof(path));
+	COM_CreatePath (path);
+	f = fopen (path, "wb");
+	if (!f)
+	{
+		Con_DPrintf ("Couldn't write %s\n", path);
+		return;
+	}
+
+	ok = fwrite (&hdr, sizeof(hdr), 1, f) == 1;
+	for (i = 0, s = mod->surfaces; ok && i < mod->numsurfaces; i++, s++)
+	{
+		memset (&out, 0, sizeof(out));
+		out.texturemins[0] = s->texturemins[0];
+		out.texturemins[1] = s->texturemins[1];
+		out.extents[0] = s->extents[0];
+		out.extents[1] = s->extents[1];
+		VectorCopy (s->mins, out.mins);
+		VectorCopy (s->maxs, out.maxs);
+		for (poly = s->polys; poly; poly = poly->next)
+			out.numpolys++;
+		ok = fwrite (&out, sizeof(out), 1, f) == 1;
+	}
+	for (i = 0, s = mod->surfaces; ok && i < mod->numsurfaces; i++, s++)
+		for (poly = s->polys; ok && poly; poly = poly->next)
+			ok = fwrite (&poly->numverts, sizeof(int), 1, f) == 1;
+	for (i = 0, s = mod->surfaces; ok && i < mod->numsurfaces; i++, s++)
+		for (poly = s->polys; ok && poly; poly = poly->next)
+			ok = fwrite (poly->verts, VERTEXSIZE * sizeof(float), poly->numverts, f) == (size_t) poly->numverts;
+	size = hdr.pointgridsize[0] * hdr.pointgridsize[1] * hdr.pointgridsize[2];
+	if (ok && size)
+		ok = fwrite (mod->pointgrid, sizeof(int), size, f) == (size_t) size;
+	fclose (f);
+
+	if (!ok)
+	{
+		Con_DPrintf ("Couldn't write %s\n", path);
+		remove (path);
+	}
+}
+
 /*
 =================
 Mod_LoadFaces
@@ -1216,6 +2374,7 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 	msurface_t 	*out;
 	int			i, count, surfnum, lofs;
 	int			planenum, side, texinfon;
+	const modcachesurf_t	*cached;
 
 	if (bsp2)
 	{
@@ -1243,6 +2402,8 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 	loadmodel->surfaces = out;
 	loadmodel->numsurfaces = count;
 
+	cached = Mod_CachedSurfaces (count);
+
 	for (surfnum=0 ; surfnum<count ; surfnum++, out++)
 	{
 		if (bsp2)
@@ -1279,9 +2440,14 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 
 		out->texinfo = loadmodel->texinfo + texinfon;
 
-		CalcSurfaceExtents (out);
+		if (cached)
+			Mod_CopyCachedSurface (out, &cached[surfnum]);
+		else
+		{
+			CalcSurfaceExtents (out);
 
-		Mod_CalcSurfaceBounds (out); //johnfitz -- for per-surface frustum culling
+			Mod_CalcSurfaceBounds (out); //johnfitz -- for per-surface frustum culling
+		}
 
 	// lighting info
 		if (loadmodel->bspversion == BSPVERSION_QUAKE64)
@@ -1296,7 +2462,8 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 		if (!q_strncasecmp(out->texinfo->texture->name,"sky",3)) // sky surface //also note -- was Q_strncmp, changed to match qbsp
 		{
 			out->flags |= (SURF_DRAWSKY | SURF_DRAWTILED);
-			Mod_PolyForUnlitSurface (out); //no more subdivision
+			if (!cached)
+				Mod_PolyForUnlitSurface (out); //no more subdivision
 		}
 		else if (out->texinfo->texture->name[0] == '*') // warp surface
 		{
@@ -1311,8 +2478,11 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 				out->flags |= SURF_DRAWTELE;
 			else out->flags |= SURF_DRAWWATER;
 
-			Mod_PolyForUnlitSurface (out);
-			GL_SubdivideSurface (out);
+			if (!cached)
+			{
+				Mod_PolyForUnlitSurface (out);
+				GL_SubdivideSurface (out);
+			}
 		}
 		else if (out->texinfo->texture->name[0] == '{') // ericw -- fence textures
 		{
@@ -1327,11 +2497,15 @@ void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 			else // not lightmapped
 			{
 				out->flags |= (SURF_NOTEXTURE | SURF_DRAWTILED);
-				Mod_PolyForUnlitSurface (out);
+				if (!cached)
+					Mod_PolyForUnlitSurface (out);
 			}
 		}
 		//johnfitz
 	}
+
+	if (cached)
+		Mod_RestoreCachedPolys ();
 }
 
 
@@ -1564,6 +2738,7 @@ void Mod_ProcessLeafs_S (dsleaf_t *in, int filelen)
 		else
 			out->compressed_vis = loadmodel->visdata + p;
 		out->efrags = NULL;
+		out->numefrags = 0;
 
 		for (j=0 ; j<4 ; j++)
 			out->ambient_sound_level[j] = in->ambient_level[j];
@@ -1607,6 +2782,7 @@ void Mod_ProcessLeafs_L1 (dl1leaf_t *in, int filelen)
 		else
 			out->compressed_vis = loadmodel->visdata + p;
 		out->efrags = NULL;
+		out->numefrags = 0;
 
 		for (j=0 ; j<4 ; j++)
 			out->ambient_sound_level[j] = in->ambient_level[j];
@@ -1650,6 +2826,7 @@ void Mod_ProcessLeafs_L2 (dl2leaf_t *in, int filelen)
 		else
 			out->compressed_vis = loadmodel->visdata + p;
 		out->efrags = NULL;
+		out->numefrags = 0;
 
 		for (j=0 ; j<4 ; j++)
 			out->ambient_sound_level[j] = in->ambient_level[j];
@@ -1680,14 +2857,65 @@ void Mod_LoadLeafs (lump_t *l, int bsp2)
 Mod_LoadClipnodes
 =================
 */
-void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
+static void Mod_FillClipnodes (modstage_t *stage)
+{
+	mclipnode_t *out = (mclipnode_t *) stage->out;
+	int			i, count = stage->count;
+
+	if (stage->bsp2)
+	{
+		const dlclipnode_t *inl = (const dlclipnode_t *) stage->in;
+
+		for (i=0 ; i<count ; i++, out++, inl++)
+		{
+			out->planenum = LittleLong(inl->planenum);
+
+			//johnfitz -- bounds check
+			if (out->planenum < 0 || out->planenum >= stage->limit)
+				stage->error = "Mod_LoadClipnodes: planenum out of bounds";
+			//johnfitz
+
+			out->children[0] = LittleLong(inl->children[0]);
+			out->children[1] = LittleLong(inl->children[1]);
+			//Spike: FIXME: bounds check
+		}
+	}
+	else
+	{
+		const dsclipnode_t *ins = (const dsclipnode_t *) stage->in;
+
+		for (i=0 ; i<count ; i++, out++, ins++)
+		{
+			out->planenum = LittleLong(ins->planenum);
+
+			//johnfitz -- bounds check
+			if (out->planenum < 0 || out->planenum >= stage->limit)
+				stage->error = "Mod_LoadClipnodes: planenum out of bounds";
+			//johnfitz
+
+			//johnfitz -- support clipnodes > 32k
+			out->children[0] = (unsigned short)LittleShort(ins->children[0]);
+			out->children[1] = (unsigned short)LittleShort(ins->children[1]);
+
+			if (out->children[0] >= count)
+				out->children[0] -= 65536;
+			if (out->children[1] >= count)
+				out->children[1] -= 65536;
+			//johnfitz
+		}
+	}
+}
+
+modstage_t *Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 {
 	dsclipnode_t *ins;
 	dlclipnode_t *inl;
 
 	mclipnode_t *out; //johnfitz -- was dclipnode_t
-	int			i, count;
+	mhullnode_t *hullnodes;
+	int			count;
 	hull_t		*hull;
+	modstage_t	*stage;
 
 	if (bsp2)
 	{
@@ -1708,6 +2936,7 @@ void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 		count = l->filelen / sizeof(*ins);
 	}
 	out = (mclipnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
+	hullnodes = (mhullnode_t *) Hunk_AllocName ( count*sizeof(*hullnodes), loadname);
 
 	//johnfitz -- warn about exceeding old limits
 	if (count > 32767 && !bsp2)
@@ -1719,6 +2948,7 @@ void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 
 	hull = &loadmodel->hulls[1];
 	hull->clipnodes = out;
+	hull->hullnodes = hullnodes;
 	hull->firstclipnode = 0;
 	hull->lastclipnode = count-1;
 	hull->planes = loadmodel->planes;
@@ -1731,6 +2961,7 @@ void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 
 	hull = &loadmodel->hulls[2];
 	hull->clipnodes = out;
+	hull->hullnodes = hullnodes;
 	hull->firstclipnode = 0;
 	hull->lastclipnode = count-1;
 	hull->planes = loadmodel->planes;
@@ -1741,83 +2972,217 @@ void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 	hull->clip_maxs[1] = 32;
 	hull->clip_maxs[2] = 64;
 
-	if (bsp2)
+	stage = Mod_NewStage ("clipnodes");
+	stage->fill = Mod_FillClipnodes;
+	stage->in = bsp2 ? (const byte *) inl : (const byte *) ins;
+	stage->out = out;
+	stage->count = count;
+	stage->limit = loadmodel->numplanes;
+	stage->bsp2 = bsp2;
+	return Mod_QueueStage (stage);
+}
+
+/*
+=================
+Mod_LoadClipHulls
+
+Lays the clipnodes of hulls 1 and 2 out depth first, front child right
+after its parent, in the order of the submodels, so a trace walks forward
+through memory. Nodes no headnode reaches go at the end. Then copies the
+planes into the hull nodes the traces use.
+
+The bounds checks in the traces want every node of a tree numbered after
+its headnode, so the old order is kept if trees turn out to share nodes.
+=================
+*/
+static void Mod_FillHullNodes (mhullnode_t *out, const mclipnode_t *in, int count, const mplane_t *planes, int numplanes)
+{
+	const mplane_t	*plane;
+	int			i;
+
+	for (i=0 ; i<count ; i++, in++, out++)
 	{
-		for (i=0 ; i<count ; i++, out++, inl++)
-		{
-			out->planenum = LittleLong(inl->planenum);
+		out->planenum = in->planenum;
+		out->children[0] = in->children[0];
+		out->children[1] = in->children[1];
+		if (in->planenum < 0 || in->planenum >= numplanes)
+			continue;	// Mod_FillClipnodes has the error
+		plane = planes + in->planenum;
+		VectorCopy (plane->normal, out->normal);
+		out->dist = plane->dist;
+		out->type = plane->type;
+	}
+}
 
-			//johnfitz -- bounds check
-			if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
-				Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
-			//johnfitz
+static qboolean Mod_SortClipnodes (qmodel_t *mod, int *remap, int *stack)
+{
+	mclipnode_t	*node;
+	int			i, j, h, num, first, next, top, count;
 
-			out->children[0] = LittleLong(inl->children[0]);
-			out->children[1] = LittleLong(inl->children[1]);
-			//Spike: FIXME: bounds check
+	count = mod->numclipnodes;
+	for (i=0 ; i<count ; i++)
+		remap[i] = -1;
+
+	next = 0;
+	for (i=0 ; i<mod->numsubmodels ; i++)
+	{
+		for (h=1 ; h<3 ; h++)
+		{
+			num = mod->submodels[i].headnode[h];
+			if (num < 0 || num >= count || remap[num] >= 0)
+				continue;
+
+			first = next;
+			stack[0] = num;
+			top = 1;
+			while (top)
+			{
+				num = stack[--top];
+				if (remap[num] >= 0)
+					continue;
+				remap[num] = next++;
+				node = mod->clipnodes + num;
+				for (j=1 ; j>=0 ; j--)
+				{
+					num = node->children[j];
+					if (num < 0 || num >= count)
+						continue;
+					if (remap[num] >= 0)
+					{
+						if (remap[num] < first)
+							return false;	// shared with an earlier tree
+						continue;
+					}
+					stack[top++] = num;
+				}
+			}
 		}
 	}
-	else
+
+	for (i=0 ; i<count ; i++)
 	{
-		for (i=0 ; i<count ; i++, out++, ins++)
-		{
-			out->planenum = LittleLong(ins->planenum);
+		if (remap[i] < 0)
+			remap[i] = next++;
+	}
+	return true;
+}
 
-			//johnfitz -- bounds check
-			if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
-				Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
-			//johnfitz
+static void Mod_FillClipHulls (modstage_t *stage)
+{
+	qmodel_t	*mod = (qmodel_t *) stage->out;
+	mclipnode_t	*old, *out;
+	int			*remap, *stack;
+	int			i, j, h, num, count;
 
-			//johnfitz -- support clipnodes > 32k
-			out->children[0] = (unsigned short)LittleShort(ins->children[0]);
-			out->children[1] = (unsigned short)LittleShort(ins->children[1]);
+	count = mod->numclipnodes;
+	remap = (int *) malloc (count * sizeof(*remap));
+	stack = (int *) malloc ((2 * count + 1) * sizeof(*stack));
+	old = (mclipnode_t *) malloc (count * sizeof(*old));
 
-			if (out->children[0] >= count)
-				out->children[0] -= 65536;
-			if (out->children[1] >= count)
-				out->children[1] -= 65536;
-			//johnfitz
+	if (remap && stack && old && Mod_SortClipnodes (mod, remap, stack))
+	{
+		memcpy (old, mod->clipnodes, count * sizeof(*old));
+		for (i=0 ; i<count ; i++)
+		{
+			out = mod->clipnodes + remap[i];
+			*out = old[i];
+			for (j=0 ; j<2 ; j++)
+			{
+				num = out->children[j];
+				if (num >= 0 && num < count)
+					out->children[j] = remap[num];
+			}
+		}
+		for (i=0 ; i<mod->numsubmodels ; i++)
+		{
+			for (h=1 ; h<3 ; h++)
+			{
+				num = mod->submodels[i].headnode[h];
+				if (num >= 0 && num < count)
+					mod->submodels[i].headnode[h] = remap[num];
+			}
 		}
 	}
+
+	free (remap);
+	free (stack);
+	free (old);
+
+	Mod_FillHullNodes (mod->hulls[1].hullnodes, mod->clipnodes, count, mod->planes, mod->numplanes);
+}
+
+// needs the clipnodes, planes and submodels, which have to be loaded first
+void Mod_LoadClipHulls (modstage_t *clipnodes, modstage_t *planes)
+{
+	const modstage_t	*after[2];
+	modstage_t		*stage;
+
+	after[0] = clipnodes;
+	after[1] = planes;
+	stage = Mod_NewStage ("clip hulls");
+	stage->fill = Mod_FillClipHulls;
+	stage->out = loadmodel;
+	stage->count = loadmodel->numclipnodes;
+	Mod_QueueStageAfterAll (stage, after, 2);
 }
 
 /*
 =================
 Mod_MakeHull0
 
-Duplicate the drawing hull structure as a clipping hull
+Duplicate the drawing hull structure as a clipping hull. The node numbers
+have to stay those of the drawing nodes, SV_TruePointContents and the
+brush drawing go from one to the other.
 =================
 */
-void Mod_MakeHull0 (void)
+static void Mod_FillHull0 (modstage_t *stage)
 {
-	mnode_t		*in, *child;
+	hull_t		*hull = (hull_t *) stage->out;
+	const mnode_t	*in = (const mnode_t *) stage->in;
+	const mnode_t	*nodes = in, *child;
 	mclipnode_t *out; //johnfitz -- was dclipnode_t
-	int			i, j, count;
-	hull_t		*hull;
-
-	hull = &loadmodel->hulls[0];
-
-	in = loadmodel->nodes;
-	count = loadmodel->numnodes;
-	out = (mclipnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
-
-	hull->clipnodes = out;
-	hull->firstclipnode = 0;
-	hull->lastclipnode = count-1;
-	hull->planes = loadmodel->planes;
+	int			i, j;
 
-	for (i=0 ; i<count ; i++, out++, in++)
+	out = hull->clipnodes;
+	for (i=0 ; i<stage->count ; i++, out++, in++)
 	{
-		out->planenum = in->plane - loadmodel->planes;
+		out->planenum = in->plane - hull->planes;
 		for (j=0 ; j<2 ; j++)
 		{
 			child = in->children[j];
 			if (child->contents < 0)
 				out->children[j] = child->contents;
 			else
-				out->children[j] = child - loadmodel->nodes;
+				out->children[j] = child - nodes;
 		}
 	}
+
+	Mod_FillHullNodes (hull->hullnodes, hull->clipnodes, stage->count, hull->planes, stage->limit);
+}
+
+// the node planes are only filled in by the planes stage
+void Mod_MakeHull0 (modstage_t *planes)
+{
+	int			count;
+	hull_t		*hull;
+	modstage_t	*stage;
+
+	hull = &loadmodel->hulls[0];
+
+	count = loadmodel->numnodes;
+	hull->clipnodes = (mclipnode_t *) Hunk_AllocName ( count*sizeof(*hull->clipnodes), loadname);
+	hull->hullnodes = (mhullnode_t *) Hunk_AllocName ( count*sizeof(*hull->hullnodes), loadname);
+	hull->firstclipnode = 0;
+	hull->lastclipnode = count-1;
+	hull->planes = loadmodel->planes;
+
+	stage = Mod_NewStage ("hull0");
+	stage->fill = Mod_FillHull0;
+	stage->in = (const byte *) loadmodel->nodes;
+	stage->out = hull;
+	stage->count = count;
+	stage->limit = loadmodel->numplanes;
+	Mod_QueueStageAfter (stage, planes);
 }
 
 /*
@@ -1883,9 +3248,19 @@ void Mod_LoadMarksurfaces (lump_t *l, int bsp2)
 Mod_LoadSurfedges
 =================
 */
-void Mod_LoadSurfedges (lump_t *l)
+static void Mod_FillSurfedges (modstage_t *stage)
+{
+	const int	*in = (const int *) stage->in;
+	int		*out = (int *) stage->out;
+	int		i;
+
+	for (i=0 ; i<stage->count ; i++)
+		out[i] = LittleLong (in[i]);
+}
+
+modstage_t *Mod_LoadSurfedges (lump_t *l)
 {
-	int		i, count;
+	int		count;
 	int		*in, *out;
 
 	in = (int *)(mod_base + l->fileofs);
@@ -1897,8 +3272,7 @@ void Mod_LoadSurfedges (lump_t *l)
 	loadmodel->surfedges = out;
 	loadmodel->numsurfedges = count;
 
-	for (i=0 ; i<count ; i++)
-		out[i] = LittleLong (in[i]);
+	return Mod_StartStage ("surfedges", Mod_FillSurfedges, in, out, count);
 }
 
 
@@ -1907,24 +3281,14 @@ void Mod_LoadSurfedges (lump_t *l)
 Mod_LoadPlanes
 =================
 */
-void Mod_LoadPlanes (lump_t *l)
+static void Mod_FillPlanes (modstage_t *stage)
 {
 	int			i, j;
-	mplane_t	*out;
-	dplane_t 	*in;
-	int			count;
+	mplane_t	*out = (mplane_t *) stage->out;
+	const dplane_t 	*in = (const dplane_t *) stage->in;
 	int			bits;
 
-	in = (dplane_t *)(mod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
-		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-	count = l->filelen / sizeof(*in);
-	out = (mplane_t *) Hunk_AllocName ( count*2*sizeof(*out), loadname);
-
-	loadmodel->planes = out;
-	loadmodel->numplanes = count;
-
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=0 ; i<stage->count ; i++, in++, out++)
 	{
 		bits = 0;
 		for (j=0 ; j<3 ; j++)
@@ -1940,6 +3304,24 @@ void Mod_LoadPlanes (lump_t *l)
 	}
 }
 
+modstage_t *Mod_LoadPlanes (lump_t *l)
+{
+	mplane_t	*out;
+	dplane_t 	*in;
+	int			count;
+
+	in = (dplane_t *)(mod_base + l->fileofs);
+	if (l->filelen % sizeof(*in))
+		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
+	count = l->filelen / sizeof(*in);
+	out = (mplane_t *) Hunk_AllocName ( count*2*sizeof(*out), loadname);
+
+	loadmodel->planes = out;
+	loadmodel->numplanes = count;
+
+	return Mod_StartStage ("planes", Mod_FillPlanes, in, out, count);
+}
+
 /*
 =================
 RadiusFromBounds
@@ -2148,6 +3530,175 @@ static void Mod_LoadLeafsExternal(FILE* f)
 	Mod_ProcessLeafs_S((dsleaf_t *)in, filelen);
 }
 
+/*
+=================
+Mod_BuildPointGrid
+
+Splits the world bounds into cells of at least POINTGRID_MINCELL units,
+at most POINTGRID_MAXCELLS of them, and stores for each the node where
+a point lookup from the root would first depend on where in the cell the
+point is.  Planes closer than POINTGRID_EPSILON to a cell count as
+splitting it, so rounding in the lookups can't take a different path.
+=================
+*/
+#define	POINTGRID_MINCELL	64
+#define	POINTGRID_MAXCELLS	(1<<18)
+#define	POINTGRID_EPSILON	0.125
+
+static void Mod_BuildPointGrid (qmodel_t *mod)
+{
+	mnode_t		*node;
+	mplane_t	*plane;
+	vec3_t		mins, maxs, cmins, cmaxs;
+	float		cell, dmin, dmax;
+	int		i, x, y, z, size[3], *out;
+
+	mod->pointgrid = NULL;
+	if (!mod->numnodes || !mod->numsubmodels)
+		return;
+
+	for (i = 0; i < 3; i++)
+	{
+		mins[i] = mod->submodels[0].mins[i] - 1;
+		maxs[i] = mod->submodels[0].maxs[i] + 1;
+		if (!(maxs[i] > mins[i]))
+			return;
+	}
+
+	for (cell = POINTGRID_MINCELL ; ; cell *= 2)
+	{
+		for (i = 0; i < 3; i++)
+			size[i] = (int)ceil ((maxs[i] - mins[i]) / cell);
+		if ((double)size[0] * size[1] * size[2] <= POINTGRID_MAXCELLS)
+			break;
+	}
+
+	out = (int *) Hunk_AllocName (size[0] * size[1] * size[2] * sizeof(int), loadname);
+	mod->pointgrid = out;
+	VectorCopy (size, mod->pointgridsize);
+	VectorCopy (mins, mod->pointgridmins);
+	mod->pointgridscale = 1.0 / cell;
+
+	for (z = 0; z < size[2]; z++)
+	for (y = 0; y < size[1]; y++)
+	for (x = 0; x < size[0]; x++, out++)
+	{
+		cmins[0] = mins[0] + x * cell;
+		cmins[1] = mins[1] + y * cell;
+		cmins[2] = mins[2] + z * cell;
+		cmaxs[0] = cmins[0] + cell;
+		cmaxs[1] = cmins[1] + cell;
+		cmaxs[2] = cmins[2] + cell;
+
+		node = mod->nodes;
+		while (node->contents >= 0)
+		{
+			plane = node->plane;
+			dmin = dmax = -plane->dist;
+			for (i = 0; i < 3; i++)
+			{
+				if (plane->normal[i] >= 0)
+				{
+					dmin += plane->normal[i] * cmins[i];
+					dmax += plane->normal[i] * cmaxs[i];
+				}
+				else
+				{
+					dmin += plane->normal[i] * cmaxs[i];
+					dmax += plane->normal[i] * cmins[i];
+				}
+			}
+			if (dmin > POINTGRID_EPSILON)
+				node = node->children[0];
+			else if (dmax < -POINTGRID_EPSILON)
+				node = node->children[1];
+			else
+				break;
+		}
+
+		if (node->contents < 0)
+			*out = -1 - (int)((mleaf_t *)node - mod->leafs);
+		else
+			*out = node - mod->nodes;
+	}
+}
+
+/*
+=================
+Mod_PointBench_f
+
+Looks up random points in the world with and without the point grid
+=================
+*/
+static mleaf_t *Mod_PointInLeafFrom (mnode_t *node, const vec3_t p, int *depth)
+{
+	float	d;
+
+	while (node->contents >= 0)
+	{
+		d = DotProduct (p, node->plane->normal) - node->plane->dist;
+		node = (d > 0) ? node->children[0] : node->children[1];
+		(*depth)++;
+	}
+	return (mleaf_t *)node;
+}
+
+static void Mod_PointBench_f (void)
+{
+	qmodel_t	*mod;
+	vec3_t		*points;
+	double		start, rootime, gridtime;
+	int		i, j, count, rootdepth, griddepth, mismatches;
+
+	mod = sv.active ? sv.worldmodel : cl.worldmodel;
+	if (!mod || mod->type != mod_brush)
+	{
+		Con_Printf ("mod_pointbench: no map loaded\n");
+		return;
+	}
+
+	count = (Cmd_Argc () > 1) ? CLAMP (1, Q_atoi (Cmd_Argv (1)), 1<<22) : 1000000;
+	points = (vec3_t *) malloc (count * sizeof(vec3_t));
+	if (!points)
+	{
+		Con_Printf ("mod_pointbench: couldn't allocate %i points\n", count);
+		return;
+	}
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < 3; j++)
+			points[i][j] = mod->mins[j] + (mod->maxs[j] - mod->mins[j]) * (rand () & 0x7fff) / 32768.0;
+	}
+
+	rootdepth = 0;
+	start = Sys_DoubleTime ();
+	for (i = 0; i < count; i++)
+		Mod_PointInLeafFrom (mod->nodes, points[i], &rootdepth);
+	rootime = Sys_DoubleTime () - start;
+
+	griddepth = 0;
+	start = Sys_DoubleTime ();
+	for (i = 0; i < count; i++)
+		Mod_PointInLeafFrom (Mod_PointGridNode (points[i], mod), points[i], &griddepth);
+	gridtime = Sys_DoubleTime () - start;
+
+	mismatches = 0;
+	for (i = 0; i < count; i++)
+	{
+		if (Mod_PointInLeafFrom (mod->nodes, points[i], &j) != Mod_PointInLeafFrom (Mod_PointGridNode (points[i], mod), points[i], &j))
+			mismatches++;
+	}
+	free (points);
+
+	Con_Printf ("%i points: from the root %.1f ns, %.1f nodes; %s %.1f ns, %.1f nodes; %i mismatches\n",
+		count, rootime * 1e9 / count, (float)rootdepth / count,
+		(mod->pointgrid && mod_pointgrid.value) ? "with the grid" : "grid off",
+		gridtime * 1e9 / count, (float)griddepth / count, mismatches);
+	if (mod->pointgrid)
+		Con_Printf ("grid %i x %i x %i, %.0f unit cells\n", mod->pointgridsize[0],
+			mod->pointgridsize[1], mod->pointgridsize[2], 1.0 / mod->pointgridscale);
+}
+
 /*
 =================
 Mod_LoadBrushModel
@@ -2160,6 +3711,9 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 	dheader_t	*header;
 	dmodel_t 	*bm;
 	float		radius; //johnfitz
+	modstage_t	*vertexes, *edges, *surfedges, *planes, *clipnodes;
+	double		start, t;
+	qboolean	cached;
 
 	loadmodel->type = mod_brush;
 
@@ -2186,6 +3740,8 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 		break;
 	}
 
+	Mod_OpenCache (mod, (const byte *) buffer, com_filesize);
+
 // swap all the lumps
 	mod_base = (byte *)header;
 
@@ -2193,15 +3749,32 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 		((int *)header)[i] = LittleLong ( ((int *)header)[i]);
 
 // load into heap
+// the allocations are made here in the original order, the converting
+// lumps are filled in by the task workers meanwhile (see Mod_StartStage)
 
-	Mod_LoadVertexes (&header->lumps[LUMP_VERTEXES]);
-	Mod_LoadEdges (&header->lumps[LUMP_EDGES], bsp2);
-	Mod_LoadSurfedges (&header->lumps[LUMP_SURFEDGES]);
+	Mod_WaitStages ();
+	start = Sys_DoubleTime ();
+
+	vertexes = Mod_LoadVertexes (&header->lumps[LUMP_VERTEXES]);
+	edges = Mod_LoadEdges (&header->lumps[LUMP_EDGES], bsp2);
+	surfedges = Mod_LoadSurfedges (&header->lumps[LUMP_SURFEDGES]);
+	t = Sys_DoubleTime ();
+	TexMgr_BeginBatch ();
 	Mod_LoadTextures (&header->lumps[LUMP_TEXTURES]);
+	TexMgr_EndBatch ();
+	t = Mod_StageTime ("textures", t);
 	Mod_LoadLighting (&header->lumps[LUMP_LIGHTING]);
-	Mod_LoadPlanes (&header->lumps[LUMP_PLANES]);
+	t = Mod_StageTime ("lit file", t);
+	planes = Mod_LoadPlanes (&header->lumps[LUMP_PLANES]);
 	Mod_LoadTexinfo (&header->lumps[LUMP_TEXINFO]);
+	t = Mod_StageTime ("texinfo", t);
+	// surface extents and bounds need the finished geometry
+	Mod_WaitStage (vertexes);
+	Mod_WaitStage (edges);
+	Mod_WaitStage (surfedges);
+	t = Mod_StageTime ("geometry wait", t);
 	Mod_LoadFaces (&header->lumps[LUMP_FACES], bsp2);
+	t = Mod_StageTime ("faces", t);
 	Mod_LoadMarksurfaces (&header->lumps[LUMP_MARKSURFACES], bsp2);
 
 	if (mod->bspversion == BSPVERSION && external_vis.value && sv.modelname[0] && !q_strcasecmp(loadname, sv.name))
@@ -2231,11 +3804,26 @@ void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 	Mod_LoadLeafs (&header->lumps[LUMP_LEAFS], bsp2);
 visdone:
 	Mod_LoadNodes (&header->lumps[LUMP_NODES], bsp2);
-	Mod_LoadClipnodes (&header->lumps[LUMP_CLIPNODES], bsp2);
+	t = Mod_StageTime ("bsp tree", t);
+	clipnodes = Mod_LoadClipnodes (&header->lumps[LUMP_CLIPNODES], bsp2);
 	Mod_LoadEntities (&header->lumps[LUMP_ENTITIES]);
+	t = Mod_StageTime ("entities", t);
 	Mod_LoadSubmodels (&header->lumps[LUMP_MODELS]);
-
-	Mod_MakeHull0 ();
+	Mod_LoadClipHulls (clipnodes, planes);
+	Mod_MakeHull0 (planes);
+	Mod_StartPVSMatrix ();
+	t = Mod_StageTime ("submodels", t);
+	// the point grid walks the node planes
+	Mod_WaitStage (planes);
+	t = Mod_StageTime ("planes wait", t);
+	cached = Mod_CachedPointGrid (mod);
+	if (!cached)
+		Mod_BuildPointGrid (mod);
+	Mod_StageTime ("pointgrid", t);
+
+	Mod_FinishStages (start);
+	Mod_WriteCache (mod, cached);
+	Mod_FreeCache ();
 
 	mod->numframes = 2;		// regular and alternate animation
 
@@ -2795,7 +4383,9 @@ void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
 // load the skins
 //
 	pskintype = (daliasskintype_t *)&pinmodel[1];
+	TexMgr_BeginBatch ();
 	pskintype = (daliasskintype_t *) Mod_LoadAllSkins (pheader->numskins, pskintype);
+	TexMgr_EndBatch ();
 
 //
 // load base s and t vertices
@@ -2860,7 +4450,7 @@ void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
 	end = Hunk_LowMark ();
 	total = end - start;
 
-	Cache_Alloc (&mod->cache, total, loadname);
+	Cache_Alloc (&mod->cache, total, loadname, CACHE_MODEL);
 	if (!mod->cache.data)
 		return;
 	memcpy (mod->cache.data, pheader, total);
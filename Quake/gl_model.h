@@ -99,6 +99,8 @@ typedef struct texture_s
 	int					anim_min, anim_max;		// time for this frame min <=time< max
 	struct texture_s	*anim_next;		// in the animation sequence
 	struct texture_s	*alternate_anims;	// bmodels in frmae 1 use these
+	int					texarray;	// index into gl_texarrays, or -1
+	int					texlayer;	// layer in that array
 } texture_t;
 
 
@@ -163,6 +165,7 @@ typedef struct msurface_s
 	mtexinfo_t	*texinfo;
 
 	int		vbo_firstvert;		// index of this surface's first vert in the VBO
+	int		vbo_firstindex;		// of this surface's triangles in the index buffer, with multi draw indirect
 
 // lighting info
 	int			dlightframe;
@@ -173,6 +176,7 @@ typedef struct msurface_s
 	byte		styles[MAXLIGHTMAPS];
 	int			cached_light[MAXLIGHTMAPS];	// values currently used in lightmap
 	qboolean	cached_dlight;				// true if dynamic light in cache
+	qboolean	styles_changed;			// a style changed since the lightmap was built
 	byte		*samples;		// [numstyles*surfsize]
 } msurface_t;
 
@@ -209,6 +213,8 @@ typedef struct mleaf_s
 // leaf specific
 	byte		*compressed_vis;
 	efrag_t		*efrags;
+	int			firstefrag;		// static entities in the R_BuildEfragLists array
+	int			numefrags;
 
 	msurface_t	**firstmarksurface;
 	int			nummarksurfaces;
@@ -224,11 +230,24 @@ typedef struct mclipnode_s
 } mclipnode_t;
 //johnfitz
 
+// a clipnode with its plane copied in, which is what the hull traces walk.
+// 32 bytes, so two share a cache line, and laid out depth first so the
+// front child usually follows its parent
+typedef struct mhullnode_s
+{
+	float		normal[3];
+	float		dist;
+	int			type;		// PLANE_X, PLANE_Y or PLANE_Z, or >= 3 when not axial
+	int			children[2];	// negative numbers are contents
+	int			planenum;
+} mhullnode_t;
+
 // !!! if this is changed, it must be changed in asm_i386.h too !!!
 typedef struct
 {
 	mclipnode_t	*clipnodes; //johnfitz -- was dclipnode_t
 	mplane_t	*planes;
+	mhullnode_t	*hullnodes;		// same numbering as clipnodes
 	int			firstclipnode;
 	int			lastclipnode;
 	vec3_t		clip_mins;
@@ -474,10 +493,18 @@ typedef struct qmodel_s
 
 	hull_t		hulls[MAX_MAP_HULLS];
 
+	int			*pointgrid;		// node to start point lookups from per cell, -1-leaf for leafs
+	int			pointgridsize[3];
+	vec3_t		pointgridmins;
+	float		pointgridscale;		// cells per unit
+
 	int			numtextures;
 	texture_t	**textures;
 
 	byte		*visdata;
+	byte		*pvsmatrix;		// decompressed PVS of leafs 1..pvsleafs, or NULL
+	int			pvsleafs;
+	int			pvsstride;		// bytes per row, a multiple of 16
 	byte		*lightdata;
 	char		*entities;
 
@@ -494,6 +521,7 @@ typedef struct qmodel_s
 	int			vboindexofs;    // offset in vbo of the hdr->numindexes unsigned shorts
 	int			vboxyzofs;      // offset in vbo of hdr->numposes*hdr->numverts_vbo meshxyz_t
 	int			vbostofs;       // offset in vbo of hdr->numverts_vbo meshst_t
+	int			vbosize;        // bytes in meshvbo and meshindexesvbo, for memstats
 
 //
 // additional model data
@@ -504,16 +532,24 @@ typedef struct qmodel_s
 
 //============================================================================
 
+extern int	mod_lookups;	// Mod_FindName calls this frame
+
 void	Mod_Init (void);
 void	Mod_ClearAll (void);
+void	Mod_ClearAllButWorld (qmodel_t *world);
 void	Mod_ResetAll (void); // for gamedir changes (Host_Game_f)
 qmodel_t *Mod_ForName (const char *name, qboolean crash);
 void	*Mod_Extradata (qmodel_t *mod);	// handles caching
 void	Mod_TouchModel (const char *name);
+void	Mod_Prefetch (const char *name);
+void	Mod_FlushPrefetch (void);
 
 mleaf_t *Mod_PointInLeaf (vec3_t p, qmodel_t *model);
+mnode_t *Mod_PointGridNode (const vec3_t p, qmodel_t *model);
 byte	*Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model);
 byte	*Mod_NoVisPVS (qmodel_t *model);
+void	Mod_AddLeafPVS (mleaf_t *leaf, qmodel_t *model, byte *out);	// thread safe
+qboolean Mod_LeafPVSTouches (mleaf_t *leaf, qmodel_t *model, const byte *pvs);	// thread safe
 
 void Mod_SetExtraFlags (qmodel_t *mod);
 
@@ -38,7 +38,9 @@ removed, so I trimmed out unused functionality and fields in efrag_t.
 
 Now, efrags are just a linked list for each leaf of the static
 entities that touch that leaf. The efrags are hunk-allocated so there is no
-fixed limit.
+fixed limit. Once they're all in, R_BuildEfragLists flattens the lists into
+one array of entity pointers, a contiguous run per leaf, which is what the
+renderer walks.
  
 This is inspired by MH's tutorial, and code from RMQEngine.
 http://forums.insideqc.com/viewtopic.php?t=1930
@@ -50,6 +52,10 @@ vec3_t		r_emins, r_emaxs;
 
 entity_t	*r_addent;
 
+static entity_t	**r_efragents;		// every leaf's static entities, leaf by leaf
+static int	r_maxefragents;
+static qboolean	r_efraglists_valid;
+
 
 #define EXTRA_EFRAGS	128
 
@@ -189,32 +195,92 @@ void R_AddEfrags (entity_t *ent)
 	R_SplitEntityOnNode (cl.worldmodel->nodes);
 
 	ent->topnode = r_pefragtopnode;
+	r_efraglists_valid = false;
 
 	R_CheckEfrags (); //johnfitz
 }
 
 
+/*
+================
+R_ClearEfrags
+
+Empties the leafs of the world, in case the level hasn't been reloaded.
+================
+*/
+void R_ClearEfrags (void)
+{
+	int		i;
+
+	for (i=0 ; i<cl.worldmodel->numleafs ; i++)
+	{
+		cl.worldmodel->leafs[i].efrags = NULL;
+		cl.worldmodel->leafs[i].numefrags = 0;
+	}
+	r_efraglists_valid = false;
+}
+
+/*
+================
+R_BuildEfragLists
+
+Flattens the efrag lists into r_efragents after static entities were added.
+================
+*/
+void R_BuildEfragLists (void)
+{
+	mleaf_t		*leaf;
+	efrag_t		*ef;
+	int			i, total;
+
+	if (r_efraglists_valid)
+		return;
+	r_efraglists_valid = true;
+
+	total = 0;
+	for (i=0, leaf=cl.worldmodel->leafs ; i<cl.worldmodel->numleafs ; i++, leaf++)
+		for (ef = leaf->efrags; ef; ef = ef->leafnext)
+			total++;
+
+	if (total > r_maxefragents)
+	{
+		free (r_efragents);
+		r_efragents = (entity_t **) malloc (total * sizeof(entity_t *));
+		if (!r_efragents)
+			Sys_Error ("R_BuildEfragLists: out of memory");
+		r_maxefragents = total;
+	}
+
+	total = 0;
+	for (i=0, leaf=cl.worldmodel->leafs ; i<cl.worldmodel->numleafs ; i++, leaf++)
+	{
+		leaf->firstefrag = total;
+		for (ef = leaf->efrags; ef; ef = ef->leafnext)
+			r_efragents[total++] = ef->entity;
+		leaf->numefrags = total - leaf->firstefrag;
+	}
+}
+
 /*
 ================
 R_StoreEfrags -- johnfitz -- pointless switch statement removed.
 ================
 */
-void R_StoreEfrags (efrag_t **ppefrag)
+void R_StoreEfrags (mleaf_t *leaf)
 {
-	entity_t	*pent;
-	efrag_t		*pefrag;
+	entity_t	*pent, **ents;
+	int			i;
 
-	while ((pefrag = *ppefrag) != NULL)
+	ents = r_efragents + leaf->firstefrag;
+	for (i=0 ; i<leaf->numefrags ; i++)
 	{
-		pent = pefrag->entity;
+		pent = ents[i];
 
 		if ((pent->visframe != r_framecount) && (cl_numvisedicts < MAX_VISEDICTS))
 		{
 			cl_visedicts[cl_numvisedicts++] = pent;
 			pent->visframe = r_framecount;
 		}
-
-		ppefrag = &pefrag->leafnext;
 	}
 }
 
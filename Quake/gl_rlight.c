@@ -26,6 +26,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 int	r_dlightframecount;
 
 extern cvar_t r_flatlightstyles; //johnfitz
+extern cvar_t gl_farclip;
+
+/*
+==================
+R_SetLightStyleValue
+
+only the surfaces of the styles that changed need new lightmaps
+==================
+*/
+static void R_SetLightStyleValue (int style, int value)
+{
+	if (d_lightstylevalue[style] != value)
+	{
+		d_lightstylevalue[style] = value;
+		R_LightStyleChanged (style);
+	}
+}
 
 /*
 ==================
@@ -44,7 +61,7 @@ void R_AnimateLight (void)
 	{
 		if (!cl_lightstyle[j].length)
 		{
-			d_lightstylevalue[j] = 256;
+			R_SetLightStyleValue (j, 256);
 			continue;
 		}
 		//johnfitz -- r_flatlightstyles
@@ -57,7 +74,7 @@ void R_AnimateLight (void)
 			k = i % cl_lightstyle[j].length;
 			k = cl_lightstyle[j].map[k] - 'a';
 		}
-		d_lightstylevalue[j] = k*22;
+		R_SetLightStyleValue (j, k*22);
 		//johnfitz
 	}
 }
@@ -255,6 +272,179 @@ void R_PushDlights (void)
 }
 
 
+/*
+=============================================================================
+
+LIGHT CLUSTERS
+
+The view frustum is cut into screen tiles and exponential depth slices,
+each with a bit for every dynamic light whose sphere reaches into it, so
+lighting a point only has to look at the lights of its cluster.
+
+=============================================================================
+*/
+
+#define	LIGHT_CLUSTERS_X	16
+#define	LIGHT_CLUSTERS_Y	8
+#define	LIGHT_CLUSTERS_Z	16
+#define	LIGHT_CLUSTER_NEAR	32.0f	// depth where the second slice starts
+
+static lightbits_t	r_lightclusters[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_Y][LIGHT_CLUSTERS_X];
+static qboolean		r_lightclusters_empty;
+static float		r_cluster_tanx, r_cluster_tany, r_cluster_zscale;
+
+lightbits_t		r_visiblelights;	// lights in at least one cluster
+static lightbits_t	r_activelights;		// every live light, for points outside the frustum
+
+static int R_ClusterSlice (float z)
+{
+	int	k;
+
+	if (z < LIGHT_CLUSTER_NEAR)
+		return 0;
+	k = 1 + (int)(log (z / LIGHT_CLUSTER_NEAR) * r_cluster_zscale);
+	return q_min(k, LIGHT_CLUSTERS_Z - 1);
+}
+
+static float R_ClusterSliceStart (int k)
+{
+	if (k == 0)
+		return 0;
+	return LIGHT_CLUSTER_NEAR * exp ((k - 1) / r_cluster_zscale);
+}
+
+static int R_ClusterTile (float u, int count)
+{
+	int	t;
+
+	t = (int)((u + 1.0f) * 0.5f * count);
+	return CLAMP(0, t, count - 1);
+}
+
+/*
+=============
+R_BuildLightClusters
+
+Called once per frame after R_SetFrustum.
+=============
+*/
+void R_BuildLightClusters (float fovx, float fovy)
+{
+	dlight_t	*l;
+	vec3_t		origins[MAX_DLIGHTS], view[MAX_DLIGHTS];
+	int			lights[MAX_DLIGHTS], numlights;
+	float		toview[3][4];
+	float		x, y, z, r, zn, zf, umin, umax, vmin, vmax;
+	int			i, j, k, n, tx, ty, x0, x1, y0, y1, z0, z1;
+	float		farclip;
+
+	farclip = q_max(gl_farclip.value, LIGHT_CLUSTER_NEAR * 2);
+	r_cluster_tanx = tan (DEG2RAD(fovx) * 0.5);
+	r_cluster_tany = tan (DEG2RAD(fovy) * 0.5);
+	r_cluster_zscale = (LIGHT_CLUSTERS_Z - 1) / log (farclip / LIGHT_CLUSTER_NEAR);
+
+	memset (r_visiblelights, 0, sizeof(r_visiblelights));
+	memset (r_activelights, 0, sizeof(r_activelights));
+	if (!r_lightclusters_empty)
+	{
+		memset (r_lightclusters, 0, sizeof(r_lightclusters));
+		r_lightclusters_empty = true;
+	}
+
+	numlights = 0;
+	for (i=0, l=cl_dlights ; i<MAX_DLIGHTS ; i++, l++)
+	{
+		if (l->die < cl.time || !l->radius)
+			continue;
+		r_activelights[i >> 5] |= 1U << (i & 31);
+
+		for (j=0 ; j<4 ; j++)
+			if (DotProduct (l->origin, frustum[j].normal) - frustum[j].dist < -l->radius)
+				break;
+		if (j < 4)
+			continue; // outside the frustum
+
+		VectorCopy (l->origin, origins[numlights]);
+		lights[numlights++] = i;
+	}
+
+	// all the visible origins into view space at once
+	VectorCopy (vright, toview[0]);
+	VectorCopy (vup, toview[1]);
+	VectorCopy (vpn, toview[2]);
+	toview[0][3] = -DotProduct (r_origin, vright);
+	toview[1][3] = -DotProduct (r_origin, vup);
+	toview[2][3] = -DotProduct (r_origin, vpn);
+	math_kernels.transformpoints (view, (const vec3_t *) origins, numlights, toview);
+
+	for (n=0 ; n<numlights ; n++)
+	{
+		i = lights[n];
+		l = cl_dlights + i;
+		x = view[n][0];
+		y = view[n][1];
+		z = view[n][2];
+		r = l->radius;
+		if (z + r < 0)
+			continue;
+
+		r_visiblelights[i >> 5] |= 1U << (i & 31);
+		r_lightclusters_empty = false;
+
+		z0 = R_ClusterSlice (q_max(z - r, 0));
+		z1 = R_ClusterSlice (z + r);
+		for (k=z0 ; k<=z1 ; k++)
+		{
+			// the sphere's box within the slice; x/z is monotonic in z, so its
+			// extremes are at the slice's near or far end
+			zn = q_max(q_max(R_ClusterSliceStart (k), z - r), 1.0f);
+			zf = (k == LIGHT_CLUSTERS_Z - 1) ? z + r : q_min(R_ClusterSliceStart (k + 1), z + r);
+			zf = q_max(zf, zn);
+
+			umin = q_min((x - r) / (zn * r_cluster_tanx), (x - r) / (zf * r_cluster_tanx));
+			umax = q_max((x + r) / (zn * r_cluster_tanx), (x + r) / (zf * r_cluster_tanx));
+			vmin = q_min((y - r) / (zn * r_cluster_tany), (y - r) / (zf * r_cluster_tany));
+			vmax = q_max((y + r) / (zn * r_cluster_tany), (y + r) / (zf * r_cluster_tany));
+			if (umin > 1 || umax < -1 || vmin > 1 || vmax < -1)
+				continue;
+
+			x0 = R_ClusterTile (umin, LIGHT_CLUSTERS_X);
+			x1 = R_ClusterTile (umax, LIGHT_CLUSTERS_X);
+			y0 = R_ClusterTile (vmin, LIGHT_CLUSTERS_Y);
+			y1 = R_ClusterTile (vmax, LIGHT_CLUSTERS_Y);
+			for (ty=y0 ; ty<=y1 ; ty++)
+				for (tx=x0 ; tx<=x1 ; tx++)
+					r_lightclusters[k][ty][tx][i >> 5] |= 1U << (i & 31);
+		}
+	}
+}
+
+/*
+=============
+R_LightsForPoint
+
+The dynamic lights that can reach p. Outside the frustum, that's all of them.
+=============
+*/
+const unsigned int *R_LightsForPoint (vec3_t p)
+{
+	vec3_t	d;
+	float	u, v, z;
+
+	VectorSubtract (p, r_origin, d);
+	z = DotProduct (d, vpn);
+	if (z < 0)
+		return r_activelights;
+	z = q_max(z, 1.0f);
+	u = DotProduct (d, vright) / (z * r_cluster_tanx);
+	v = DotProduct (d, vup) / (z * r_cluster_tany);
+	if (u < -1 || u > 1 || v < -1 || v > 1)
+		return r_activelights;
+
+	return r_lightclusters[R_ClusterSlice (z)][R_ClusterTile (v, LIGHT_CLUSTERS_Y)][R_ClusterTile (u, LIGHT_CLUSTERS_X)];
+}
+
+
 /*
 =============================================================================
 
@@ -267,6 +457,43 @@ mplane_t		*lightplane;
 vec3_t			lightspot;
 vec3_t			lightcolor; //johnfitz -- lit support via lordhavoc
 
+static msurface_t	*lightsurf;		// where the last R_LightPoint sampled, NULL if nowhere
+static int		lightds, lightdt;
+
+int			r_lightcacheseq;	// bumped by R_NewMap, see R_LightPointCached
+
+/*
+=============
+R_SampleLightmap
+
+Adds the light at ds, dt on surf with the current light styles.
+=============
+*/
+static void R_SampleLightmap (vec3_t color, msurface_t *surf, int ds, int dt)
+{
+	// LordHavoc: enhanced to interpolate lighting
+	byte *lightmap;
+	int maps, line3, dsfrac = ds & 15, dtfrac = dt & 15, r00 = 0, g00 = 0, b00 = 0, r01 = 0, g01 = 0, b01 = 0, r10 = 0, g10 = 0, b10 = 0, r11 = 0, g11 = 0, b11 = 0;
+	float scale;
+	line3 = ((surf->extents[0]>>4)+1)*3;
+
+	lightmap = surf->samples + ((dt>>4) * ((surf->extents[0]>>4)+1) + (ds>>4))*3; // LordHavoc: *3 for color
+
+	for (maps = 0;maps < MAXLIGHTMAPS && surf->styles[maps] != 255;maps++)
+	{
+		scale = (float) d_lightstylevalue[surf->styles[maps]] * 1.0 / 256.0;
+		r00 += (float) lightmap[      0] * scale;g00 += (float) lightmap[      1] * scale;b00 += (float) lightmap[2] * scale;
+		r01 += (float) lightmap[      3] * scale;g01 += (float) lightmap[      4] * scale;b01 += (float) lightmap[5] * scale;
+		r10 += (float) lightmap[line3+0] * scale;g10 += (float) lightmap[line3+1] * scale;b10 += (float) lightmap[line3+2] * scale;
+		r11 += (float) lightmap[line3+3] * scale;g11 += (float) lightmap[line3+4] * scale;b11 += (float) lightmap[line3+5] * scale;
+		lightmap += ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1)*3; // LordHavoc: *3 for colored lighting
+	}
+
+	color[0] += (float) ((int) ((((((((r11-r10) * dsfrac) >> 4) + r10)-((((r01-r00) * dsfrac) >> 4) + r00)) * dtfrac) >> 4) + ((((r01-r00) * dsfrac) >> 4) + r00)));
+	color[1] += (float) ((int) ((((((((g11-g10) * dsfrac) >> 4) + g10)-((((g01-g00) * dsfrac) >> 4) + g00)) * dtfrac) >> 4) + ((((g01-g00) * dsfrac) >> 4) + g00)));
+	color[2] += (float) ((int) ((((((((b11-b10) * dsfrac) >> 4) + b10)-((((b01-b00) * dsfrac) >> 4) + b00)) * dtfrac) >> 4) + ((((b01-b00) * dsfrac) >> 4) + b00)));
+}
+
 /*
 =============
 RecursiveLightPoint -- johnfitz -- replaced entire function for lit support via lordhavoc
@@ -368,27 +595,10 @@ loc0:
 
 			if (dist < *maxdist)
 			{
-				// LordHavoc: enhanced to interpolate lighting
-				byte *lightmap;
-				int maps, line3, dsfrac = ds & 15, dtfrac = dt & 15, r00 = 0, g00 = 0, b00 = 0, r01 = 0, g01 = 0, b01 = 0, r10 = 0, g10 = 0, b10 = 0, r11 = 0, g11 = 0, b11 = 0;
-				float scale;
-				line3 = ((surf->extents[0]>>4)+1)*3;
-
-				lightmap = surf->samples + ((dt>>4) * ((surf->extents[0]>>4)+1) + (ds>>4))*3; // LordHavoc: *3 for color
-
-				for (maps = 0;maps < MAXLIGHTMAPS && surf->styles[maps] != 255;maps++)
-				{
-					scale = (float) d_lightstylevalue[surf->styles[maps]] * 1.0 / 256.0;
-					r00 += (float) lightmap[      0] * scale;g00 += (float) lightmap[      1] * scale;b00 += (float) lightmap[2] * scale;
-					r01 += (float) lightmap[      3] * scale;g01 += (float) lightmap[      4] * scale;b01 += (float) lightmap[5] * scale;
-					r10 += (float) lightmap[line3+0] * scale;g10 += (float) lightmap[line3+1] * scale;b10 += (float) lightmap[line3+2] * scale;
-					r11 += (float) lightmap[line3+3] * scale;g11 += (float) lightmap[line3+4] * scale;b11 += (float) lightmap[line3+5] * scale;
-					lightmap += ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1)*3; // LordHavoc: *3 for colored lighting
-				}
-
-				color[0] += (float) ((int) ((((((((r11-r10) * dsfrac) >> 4) + r10)-((((r01-r00) * dsfrac) >> 4) + r00)) * dtfrac) >> 4) + ((((r01-r00) * dsfrac) >> 4) + r00)));
-				color[1] += (float) ((int) ((((((((g11-g10) * dsfrac) >> 4) + g10)-((((g01-g00) * dsfrac) >> 4) + g00)) * dtfrac) >> 4) + ((((g01-g00) * dsfrac) >> 4) + g00)));
-				color[2] += (float) ((int) ((((((((b11-b10) * dsfrac) >> 4) + b10)-((((b01-b00) * dsfrac) >> 4) + b00)) * dtfrac) >> 4) + ((((b01-b00) * dsfrac) >> 4) + b00)));
+				R_SampleLightmap (color, surf, ds, dt);
+				lightsurf = surf;
+				lightds = ds;
+				lightdt = dt;
 			}
 			return true; // success
 		}
@@ -419,6 +629,192 @@ int R_LightPoint (vec3_t p)
 	end[2] = p[2] - maxdist;
 
 	lightcolor[0] = lightcolor[1] = lightcolor[2] = 0;
+	lightsurf = NULL;
 	RecursiveLightPoint (lightcolor, cl.worldmodel->nodes, p, p, end, &maxdist);
 	return ((lightcolor[0] + lightcolor[1] + lightcolor[2]) * (1.0f / 3.0f));
 }
+
+/*
+=============================================================================
+
+LIGHT GRID
+
+Rather than tracing down through the BSP for every moving entity every
+frame, entity light is blended from a coarse grid over the world. Each
+grid point remembers the lightmap spot R_LightPoint found below it, so
+light styles still apply, and an entity's light is the trilinear blend of
+the eight points around it. Points are traced the first time an entity
+needs them rather than all at map load. Points in solid or with nothing
+lit below them are left out of the blend; where all eight are out, the
+entity is traced as before.
+
+=============================================================================
+*/
+
+#define LIGHTGRID_SPACING		32		// units between points, doubled for large maps
+#define MAX_LIGHTGRID_POINTS	(1 << 20)
+
+typedef struct
+{
+	int				surf;		// index + 1 into the world's surfaces, 0 = not traced yet, -1 = invalid
+	unsigned short	ds, dt;
+} lightgridpoint_t;
+
+static lightgridpoint_t	*lightgrid;
+static vec3_t			lightgrid_mins;
+static int				lightgrid_size[3];
+static float			lightgrid_spacing;
+
+/*
+=============
+R_InitLightGrid
+
+Sizes the grid for the new world. Called from R_NewMap, the grid lives on
+the hunk along with the map.
+=============
+*/
+void R_InitLightGrid (void)
+{
+	int		i, numpoints;
+
+	lightgrid = NULL;
+	if (!cl.worldmodel || !cl.worldmodel->lightdata)
+		return;
+
+	lightgrid_spacing = LIGHTGRID_SPACING;
+	for (;;)
+	{
+		numpoints = 1;
+		for (i = 0; i < 3; i++)
+		{
+			lightgrid_mins[i] = floor (cl.worldmodel->mins[i] / lightgrid_spacing) * lightgrid_spacing;
+			lightgrid_size[i] = (int) ceil ((cl.worldmodel->maxs[i] - lightgrid_mins[i]) / lightgrid_spacing) + 1;
+			numpoints *= lightgrid_size[i];
+		}
+		if (numpoints <= MAX_LIGHTGRID_POINTS)
+			break;
+		lightgrid_spacing *= 2;
+	}
+
+	lightgrid = (lightgridpoint_t *) Hunk_AllocName (numpoints * sizeof(lightgridpoint_t), "lightgrid");
+}
+
+/*
+=============
+R_LightGridPoint
+
+Returns the point at grid coordinates x, y, z, tracing it first if needed
+=============
+*/
+static lightgridpoint_t *R_LightGridPoint (int x, int y, int z)
+{
+	lightgridpoint_t	*gp;
+	vec3_t				p;
+
+	gp = &lightgrid[(z * lightgrid_size[1] + y) * lightgrid_size[0] + x];
+	if (gp->surf)
+		return gp;
+
+	p[0] = lightgrid_mins[0] + x * lightgrid_spacing;
+	p[1] = lightgrid_mins[1] + y * lightgrid_spacing;
+	p[2] = lightgrid_mins[2] + z * lightgrid_spacing;
+
+	gp->surf = -1;
+	if (Mod_PointInLeaf (p, cl.worldmodel)->contents == CONTENTS_SOLID)
+		return gp;
+
+	R_LightPoint (p);
+	if (lightsurf)
+	{
+		gp->surf = (int) (lightsurf - cl.worldmodel->surfaces) + 1;
+		gp->ds = lightds;
+		gp->dt = lightdt;
+	}
+	return gp;
+}
+
+/*
+=============
+R_LightGrid
+
+Blends lightcolor at p from the grid. Returns false if p is outside the
+grid or none of the points around it are usable.
+=============
+*/
+static qboolean R_LightGrid (vec3_t p)
+{
+	lightgridpoint_t	*gp;
+	vec3_t				color;
+	float				frac[3], w, total;
+	int					i, base[3], corner;
+
+	for (i = 0; i < 3; i++)
+	{
+		frac[i] = (p[i] - lightgrid_mins[i]) / lightgrid_spacing;
+		base[i] = (int) floor (frac[i]);
+		if (base[i] < 0 || base[i] >= lightgrid_size[i] - 1)
+			return false;
+		frac[i] -= base[i];
+	}
+
+	lightcolor[0] = lightcolor[1] = lightcolor[2] = 0;
+	total = 0;
+	for (corner = 0; corner < 8; corner++)
+	{
+		w = ((corner & 1) ? frac[0] : 1 - frac[0]) *
+			((corner & 2) ? frac[1] : 1 - frac[1]) *
+			((corner & 4) ? frac[2] : 1 - frac[2]);
+		if (w <= 0)
+			continue;
+
+		gp = R_LightGridPoint (base[0] + (corner & 1), base[1] + ((corner >> 1) & 1), base[2] + ((corner >> 2) & 1));
+		if (gp->surf < 0)
+			continue;
+
+		color[0] = color[1] = color[2] = 0;
+		R_SampleLightmap (color, cl.worldmodel->surfaces + gp->surf - 1, gp->ds, gp->dt);
+		VectorMA (lightcolor, w, color, lightcolor);
+		total += w;
+	}
+
+	if (total <= 0)
+		return false;
+	if (total < 1)
+		VectorScale (lightcolor, 1 / total, lightcolor);
+	return true;
+}
+
+/*
+=============
+R_LightPointCached
+
+R_LightPoint for an entity's lighting. With r_lightgrid, the light is
+blended from the light grid where it's usable. Otherwise the trace is only
+redone when p has moved since the last call for e, and the same lightmap
+spot is sampled again with the current light styles. lightspot and
+lightplane are not updated.
+=============
+*/
+int R_LightPointCached (entity_t *e, vec3_t p)
+{
+	if (lightgrid && r_lightgrid.value && R_LightGrid (p))
+		return ((lightcolor[0] + lightcolor[1] + lightcolor[2]) * (1.0f / 3.0f));
+
+	if (!cl.worldmodel->lightdata || e->lightcacheseq != r_lightcacheseq || !VectorCompare (p, e->lightcacheorg))
+	{
+		R_LightPoint (p);
+		e->lightcacheseq = r_lightcacheseq;
+		VectorCopy (p, e->lightcacheorg);
+		e->lightcachesurf = lightsurf;
+		e->lightcacheds = lightds;
+		e->lightcachedt = lightdt;
+	}
+	else
+	{
+		lightcolor[0] = lightcolor[1] = lightcolor[2] = 0;
+		if (e->lightcachesurf)
+			R_SampleLightmap (lightcolor, e->lightcachesurf, e->lightcacheds, e->lightcachedt);
+	}
+
+	return ((lightcolor[0] + lightcolor[1] + lightcolor[2]) * (1.0f / 3.0f));
+}
@@ -35,7 +35,11 @@ mplane_t	frustum[4];
 
 //johnfitz -- rendering statistics
 int rs_brushpolys, rs_aliaspolys, rs_skypolys, rs_particles, rs_fogpolys;
-int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+int rs_dynamiclightmaps, rs_stylesurfs, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+int rs_aliasmodels;
+double rs_aliastime;	// cpu time spent submitting alias models
+int rs_pvshits, rs_pvsmisses, rs_pvsbytes;	// view leaf cache, since the map was loaded
+int rs_occludedleafs, rs_occludedents;
 float rs_megatexels;
 
 //
@@ -90,12 +94,20 @@ cvar_t	gl_fullbrights = {"gl_fullbrights", "1", CVAR_ARCHIVE};
 cvar_t	gl_farclip = {"gl_farclip", "16384", CVAR_ARCHIVE};
 cvar_t	gl_overbright = {"gl_overbright", "1", CVAR_ARCHIVE};
 cvar_t	gl_overbright_models = {"gl_overbright_models", "1", CVAR_ARCHIVE};
+cvar_t	gl_lightmap_size = {"gl_lightmap_size", "1024", CVAR_ARCHIVE};
+cvar_t	gl_packedvertices = {"gl_packedvertices", "0", CVAR_ARCHIVE};	// 20 byte brush vertices, from the next map on
+cvar_t	r_gpulighting = {"r_gpulighting", "1", CVAR_ARCHIVE};
+cvar_t	r_threads = {"r_threads", "1", CVAR_ARCHIVE};
+cvar_t	r_occlusion = {"r_occlusion", "0", CVAR_ARCHIVE};
+cvar_t	r_mergebmodels = {"r_mergebmodels", "1", CVAR_ARCHIVE};
+cvar_t	r_prepass = {"r_prepass", "0", CVAR_ARCHIVE};	// depth prepass, opaque entities front to back
 cvar_t	r_oldskyleaf = {"r_oldskyleaf", "0", CVAR_NONE};
 cvar_t	r_drawworld = {"r_drawworld", "1", CVAR_NONE};
 cvar_t	r_showtris = {"r_showtris", "0", CVAR_NONE};
 cvar_t	r_showbboxes = {"r_showbboxes", "0", CVAR_NONE};
 cvar_t	r_lerpmodels = {"r_lerpmodels", "1", CVAR_NONE};
 cvar_t	r_lerpmove = {"r_lerpmove", "1", CVAR_NONE};
+cvar_t	r_lightgrid = {"r_lightgrid", "1", CVAR_ARCHIVE};
 cvar_t	r_nolerp_list = {"r_nolerp_list", "progs/flame.mdl,progs/flame2.mdl,progs/braztall.mdl,progs/brazshrt.mdl,progs/longtrch.mdl,progs/flame_pyre.mdl,progs/v_saw.mdl,progs/v_xfist.mdl,progs/h2stuff/newfire.mdl", CVAR_NONE};
 cvar_t	r_noshadow_list = {"r_noshadow_list", "progs/flame2.mdl,progs/flame.mdl,progs/bolt1.mdl,progs/bolt2.mdl,progs/bolt3.mdl,progs/laser.mdl", CVAR_NONE};
 
@@ -111,8 +123,17 @@ cvar_t	r_slimealpha = {"r_slimealpha","0",CVAR_NONE};
 float	map_wateralpha, map_lavaalpha, map_telealpha, map_slimealpha;
 
 qboolean r_drawflat_cheatsafe, r_fullbright_cheatsafe, r_lightmap_cheatsafe, r_drawworld_cheatsafe; //johnfitz
+qboolean r_gpulightmaps;
 
 cvar_t	r_scale = {"r_scale", "1", CVAR_ARCHIVE};
+cvar_t	r_dynamicscale = {"r_dynamicscale", "0", CVAR_ARCHIVE};	// pick the scale to hold r_dynamicscale_fps
+cvar_t	r_dynamicscale_fps = {"r_dynamicscale_fps", "144", CVAR_ARCHIVE};
+cvar_t	r_dynamicscale_min = {"r_dynamicscale_min", "0.5", CVAR_ARCHIVE};	// fractions of the full resolution
+cvar_t	r_dynamicscale_max = {"r_dynamicscale_max", "1", CVAR_ARCHIVE};
+cvar_t	r_dynamicscale_show = {"r_dynamicscale_show", "0", CVAR_NONE};
+
+float	r_viewscale = 1;	// the 3D view is drawn at 1/r_viewscale of r_refdef.vrect
+float	r_dynamicfrac = 1;	// resolution fraction picked by r_dynamicscale
 
 //==============================================================================
 //
@@ -288,15 +309,27 @@ qboolean R_CullBox (vec3_t emins, vec3_t emaxs)
 	return false;
 }
 
+/*
+=================
+R_CullBoxes
+
+R_CullBox for count boxes at once, with the bounds split into separate
+mins x, y, z and maxs x, y, z arrays. Sets culled[i] to 1 for each box
+that is outside the frustum, 0 otherwise.
+=================
+*/
+void R_CullBoxes (float *const bounds[6], int count, byte *culled)
+{
+	math_kernels.cullboxes (bounds, count, frustum, 4, culled);
+}
+
 /*
 ===============
-R_CullModelForEntity -- johnfitz -- uses correct bounds based on rotation
+R_EntityBounds -- johnfitz -- uses correct bounds based on rotation
 ===============
 */
-qboolean R_CullModelForEntity (entity_t *e)
+void R_EntityBounds (entity_t *e, vec3_t mins, vec3_t maxs)
 {
-	vec3_t mins, maxs;
-
 	if (e->angles[0] || e->angles[2]) //pitch or roll
 	{
 		VectorAdd (e->origin, e->model->rmins, mins);
@@ -312,10 +345,97 @@ qboolean R_CullModelForEntity (entity_t *e)
 		VectorAdd (e->origin, e->model->mins, mins);
 		VectorAdd (e->origin, e->model->maxs, maxs);
 	}
+}
+
+/*
+===============
+R_CullModelForEntityBounds
+===============
+*/
+static qboolean R_CullModelForEntityBounds (entity_t *e)
+{
+	vec3_t mins, maxs;
 
+	R_EntityBounds (e, mins, maxs);
 	return R_CullBox (mins, maxs);
 }
 
+/*
+===============
+R_CullModelForEntity
+
+Entities on cl_visedicts were culled by R_CullEntities for this frame.
+===============
+*/
+qboolean R_CullModelForEntity (entity_t *e)
+{
+	if (e->cullframe == r_framecount)
+		return e->culled;
+
+	return R_CullModelForEntityBounds (e);
+}
+
+#define	MAX_CULL_JOBS		16
+#define	CULL_JOB_ENTITIES	64	// fewer aren't worth a task
+
+typedef struct
+{
+	int		first, count;
+} culljob_t;
+
+/*
+===============
+R_CullEntityRange
+
+Runs on a task worker, each job owns its range of cl_visedicts.
+===============
+*/
+static void R_CullEntityRange (void *data)
+{
+	culljob_t	*job = (culljob_t *) data;
+	entity_t	*e;
+	int			i;
+
+	for (i = job->first; i < job->first + job->count; i++)
+	{
+		e = cl_visedicts[i];
+		e->culled = R_CullModelForEntityBounds (e);
+		e->cullframe = r_framecount;
+	}
+}
+
+/*
+===============
+R_CullEntities
+
+Culls everything on cl_visedicts against the frustum once per frame, split
+over the task workers when r_threads is set. Needs the frame's frustum.
+===============
+*/
+void R_CullEntities (void)
+{
+	culljob_t	jobs[MAX_CULL_JOBS];
+	task_t		tasks[MAX_CULL_JOBS];
+	int			i, numjobs, first;
+
+	numjobs = 1;
+	if (r_threads.value)
+		numjobs = CLAMP (1, q_min(cl_numvisedicts / CULL_JOB_ENTITIES, Tasks_NumWorkers () + 1), MAX_CULL_JOBS);
+
+	for (i = 0, first = 0; i < numjobs; i++)
+	{
+		jobs[i].first = first;
+		jobs[i].count = (cl_numvisedicts * (i + 1)) / numjobs - first;
+		first += jobs[i].count;
+	}
+
+	for (i = 0; i < numjobs - 1; i++)
+		tasks[i] = Task_Run (R_CullEntityRange, &jobs[i], NULL, 0);
+	R_CullEntityRange (&jobs[numjobs - 1]);
+	for (i = 0; i < numjobs - 1; i++)
+		Task_Wait (tasks[i]);
+}
+
 /*
 ===============
 R_RotateForEntity -- johnfitz -- modified to take origin and angles instead of pointer to entity
@@ -447,16 +567,13 @@ R_SetupGL
 */
 void R_SetupGL (void)
 {
-	int scale;
-
 	//johnfitz -- rewrote this section
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity ();
-	scale =  CLAMP(1, (int)r_scale.value, 4); // ericw -- see R_ScaleView
-	glViewport (glx + r_refdef.vrect.x,
+	glViewport (glx + r_refdef.vrect.x, // ericw -- see R_ScaleView
 				gly + glheight - r_refdef.vrect.y - r_refdef.vrect.height,
-				r_refdef.vrect.width / scale,
-				r_refdef.vrect.height / scale);
+				(int)(r_refdef.vrect.width / r_viewscale),
+				(int)(r_refdef.vrect.height / r_viewscale));
 	//johnfitz
 
 	GL_SetFrustum (r_fovx, r_fovy); //johnfitz -- use r_fov* vars
@@ -557,12 +674,7 @@ void R_SetupView (void)
 	//johnfitz
 
 	R_SetFrustum (r_fovx, r_fovy); //johnfitz -- use r_fov* vars
-
-	R_MarkSurfaces (); //johnfitz -- create texture chains from PVS
-
-	R_UpdateWarpTextures (); //johnfitz -- do this before R_Clear
-
-	R_Clear ();
+	R_BuildLightClusters (r_fovx, r_fovy);
 
 	//johnfitz -- cheat-protect some draw modes
 	r_drawflat_cheatsafe = r_fullbright_cheatsafe = r_lightmap_cheatsafe = false;
@@ -576,6 +688,19 @@ void R_SetupView (void)
 		else if (r_lightmap.value) r_lightmap_cheatsafe = true;
 	}
 	//johnfitz
+
+	// decided before R_MarkSurfaces, which skips the CPU lightmap updates when set
+	r_gpulightmaps = GLWorld_GPULighting ();
+
+	R_MarkSurfaces (); //johnfitz -- create texture chains from PVS
+
+	R_CullEntities (); // after R_MarkSurfaces, which adds the static entities
+
+	R_MergeBrushEntities ();
+
+	R_UpdateWarpTextures (); //johnfitz -- do this before R_Clear
+
+	R_Clear ();
 }
 
 //==============================================================================
@@ -584,6 +709,58 @@ void R_SetupView (void)
 //
 //==============================================================================
 
+typedef struct
+{
+	entity_t	*ent;
+	float		dist;
+} sortedent_t;
+
+static sortedent_t	r_sortedents[MAX_VISEDICTS];
+
+static int R_SortedEntCompare (const void *a, const void *b)
+{
+	float	d = ((const sortedent_t *) a)->dist - ((const sortedent_t *) b)->dist;
+
+	return (d > 0) - (d < 0);
+}
+
+/*
+=============
+R_SortOpaqueEntities
+
+With r_prepass, the opaque entities are drawn nearest first so the ones
+behind fail the depth test instead of being shaded and then covered.
+Returns the visedicts in that order, or all of them unsorted.
+=============
+*/
+static int R_SortOpaqueEntities (qboolean alphapass)
+{
+	int		i, count;
+	entity_t	*e;
+	vec3_t		center;
+
+	for (i=0, count=0 ; i<cl_numvisedicts ; i++)
+	{
+		e = cl_visedicts[i];
+		r_sortedents[count].ent = e;
+		if (alphapass || !r_prepass.value)
+		{
+			count++;
+			continue;
+		}
+		if (ENTALPHA_DECODE(e->alpha) < 1)
+			continue;
+		VectorAdd (e->model->mins, e->model->maxs, center);
+		VectorMA (e->origin, 0.5f, center, center);
+		VectorSubtract (center, r_refdef.vieworg, center);
+		r_sortedents[count++].dist = DotProduct (center, center);
+	}
+
+	if (!alphapass && r_prepass.value)
+		qsort (r_sortedents, count, sizeof(sortedent_t), R_SortedEntCompare);
+	return count;
+}
+
 /*
 =============
 R_DrawEntitiesOnList
@@ -591,15 +768,20 @@ R_DrawEntitiesOnList
 */
 void R_DrawEntitiesOnList (qboolean alphapass) //johnfitz -- added parameter
 {
-	int		i;
+	int		i, count;
+	double	time;
 
 	if (!r_drawentities.value)
 		return;
 
+	TRACE_BEGIN ("R_DrawEntitiesOnList");
+
+	count = R_SortOpaqueEntities (alphapass);
+
 	//johnfitz -- sprites are not a special case
-	for (i=0 ; i<cl_numvisedicts ; i++)
+	for (i=0 ; i<count ; i++)
 	{
-		currententity = cl_visedicts[i];
+		currententity = r_sortedents[i].ent;
 
 		//johnfitz -- if alphapass is true, draw only alpha entites this time
 		//if alphapass is false, draw only nonalpha entities this time
@@ -615,16 +797,41 @@ void R_DrawEntitiesOnList (qboolean alphapass) //johnfitz -- added parameter
 		switch (currententity->model->type)
 		{
 			case mod_alias:
-				R_DrawAliasModel (currententity);
+				if (r_speeds.value)
+				{
+					time = Sys_DoubleTime ();
+					if (!R_BatchAliasModel (currententity))
+						R_DrawAliasModel (currententity);
+					rs_aliastime += Sys_DoubleTime () - time;
+					rs_aliasmodels++;
+				}
+				else if (!R_BatchAliasModel (currententity))
+					R_DrawAliasModel (currententity);
 				break;
 			case mod_brush:
 				R_DrawBrushModel (currententity);
 				break;
 			case mod_sprite:
-				R_DrawSpriteModel (currententity);
+				if (alphapass)
+					R_DrawSpriteModel (currententity);
+				else
+					R_BatchSpriteModel (currententity);
 				break;
 		}
 	}
+
+	R_FlushSpriteBatches ();
+
+	if (r_speeds.value)
+	{
+		time = Sys_DoubleTime ();
+		R_FlushAliasBatches ();
+		rs_aliastime += Sys_DoubleTime () - time;
+	}
+	else
+		R_FlushAliasBatches ();
+
+	TRACE_END ("R_DrawEntitiesOnList");
 }
 
 /*
@@ -865,11 +1072,14 @@ void R_DrawShadows (void)
 			continue;
 
 		if (currententity == &cl.viewent)
-			return;
+			break;
 
-		GL_DrawAliasShadow (currententity);
+		if (!R_BatchAliasShadow (currententity))
+			GL_DrawAliasShadow (currententity);
 	}
 
+	R_FlushAliasShadows ();
+
 	if (gl_stencilbits)
 	{
 		glDisable(GL_STENCIL_TEST);
@@ -885,25 +1095,44 @@ void R_RenderScene (void)
 {
 	R_SetupScene (); //johnfitz -- this does everything that should be done once per call to RenderScene
 
+	// the world's lightmaps were updated by R_MarkSurfaces, so start their
+	// transfer before the sky is drawn; brush entities upload their own later
+	R_UploadLightmaps ();
+
 	Fog_EnableGFog (); //johnfitz
 
+	GL_TimerBegin (GPU_SKY);
 	Sky_DrawSky (); //johnfitz
+	GL_TimerEnd (GPU_SKY);
 
+	GL_TimerBegin (GPU_WORLD);
+	R_DrawDepthPrepass ();
 	R_DrawWorld ();
+	GL_TimerEnd (GPU_WORLD);
 
 	S_ExtraUpdate (); // don't let sound get messed up if going slow
 
 	R_DrawShadows (); //johnfitz -- render entity shadows
 
+	GL_TimerBegin (GPU_MODELS);
 	R_DrawEntitiesOnList (false); //johnfitz -- false means this is the pass for nonalpha entities
+	GL_TimerEnd (GPU_MODELS);
+
+	R_IssueOcclusionQueries (); // against the opaque depth, read back next frame
 
+	GL_TimerBegin (GPU_WATER);
 	R_DrawWorld_Water (); //johnfitz -- drawn here since they might have transparency
+	GL_TimerEnd (GPU_WATER);
 
+	GL_TimerBegin (GPU_MODELS);
 	R_DrawEntitiesOnList (true); //johnfitz -- true means this is the pass for alpha entities
+	GL_TimerEnd (GPU_MODELS);
 
 	R_RenderDlights (); //triangle fan dlights -- johnfitz -- moved after water
 
+	GL_TimerBegin (GPU_PARTICLES);
 	R_DrawParticles ();
+	GL_TimerEnd (GPU_PARTICLES);
 
 	Fog_DisableGFog (); //johnfitz
 
@@ -928,31 +1157,85 @@ void R_ScaleView_DeleteTexture (void)
 	r_scaleview_texture = 0;
 }
 
+/*
+================
+R_UpdateViewScale
+
+Picks r_viewscale for this frame.  r_dynamicscale scales the resolution
+with the square root of how far the GPU time of the last measured frame
+is from the frame time of r_dynamicscale_fps, since that time mostly
+goes with the pixel count.  It shrinks the view when frames take over 95%
+of the target and grows it slowly under 75%, and waits for frames drawn
+at the new scale to be measured before the next change.
+================
+*/
+static void R_UpdateViewScale (void)
+{
+	static int	lastresults, settle;
+	float		target, ms, lo, hi, frac;
+	int		i;
+
+	if (!r_dynamicscale.value || !gl_timer_query_able)
+	{
+		r_viewscale = CLAMP(1, (int)r_scale.value, 4);
+		r_dynamicfrac = 1.0f / r_viewscale;
+		return;
+	}
+
+	lo = CLAMP(0.25f, r_dynamicscale_min.value, 1.0f);
+	hi = CLAMP(lo, r_dynamicscale_max.value, 1.0f);
+	frac = r_dynamicfrac;
+	if (gpu_results != lastresults && r_dynamicscale_fps.value > 0)
+	{
+		lastresults = gpu_results;
+		for (i = 0, ms = 0; i < GPU_NUMPASSES; i++)
+			ms += gpu_passms[i];
+		target = 1000.0f / r_dynamicscale_fps.value;
+		if (settle)
+			settle--;
+		else if (ms > target * 0.95f)
+			frac *= q_max(sqrt(target * 0.85f / ms), 0.8f);	// aim for 85%, at most 20% at once
+		else if (ms < target * 0.75f)
+			frac *= 1.02f;
+	}
+	frac = CLAMP(lo, frac, hi);
+	if (frac != r_dynamicfrac)
+		settle = GPU_FRAMES;	// the next results are still from the old scale
+	r_dynamicfrac = frac;
+	r_viewscale = 1.0f / frac;
+}
+
 /*
 ================
 R_ScaleView
 
-The r_scale cvar allows rendering the 3D view at 1/2, 1/3, or 1/4 resolution.
+The r_scale cvar allows rendering the 3D view at 1/2, 1/3, or 1/4 resolution,
+r_dynamicscale at any fraction of it.
 This function scales the reduced resolution 3D view back up to fill 
 r_refdef.vrect. This is for emulating a low-resolution pixellated look,
 or possibly as a perforance boost on slow graphics cards.
+
+The view blend is mixed in while scaling, instead of being another
+fullscreen pass. Returns true if it was, so V_PolyBlend can be skipped.
 ================
 */
-void R_ScaleView (void)
+qboolean R_ScaleView (void)
 {
 	float smax, tmax;
-	int scale;
 	int srcx, srcy, srcw, srch;
+	int filter;
+	qboolean blend;
 
 	// copied from R_SetupGL()
-	scale = CLAMP(1, (int)r_scale.value, 4);
 	srcx = glx + r_refdef.vrect.x;
 	srcy = gly + glheight - r_refdef.vrect.y - r_refdef.vrect.height;
-	srcw = r_refdef.vrect.width / scale;
-	srch = r_refdef.vrect.height / scale;
+	srcw = (int)(r_refdef.vrect.width / r_viewscale);
+	srch = (int)(r_refdef.vrect.height / r_viewscale);
 
-	if (scale == 1)
-		return;
+	if (srcw == r_refdef.vrect.width && srch == r_refdef.vrect.height)
+		return false;
+
+	blend = gl_polyblend.value && v_blend[3] && gl_texture_env_combine;
 
 	// make sure texture unit 0 is selected
 	GL_DisableMultitexture ();
@@ -981,10 +1264,13 @@ void R_ScaleView (void)
 		}
 
 		glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, r_scaleview_texture_width, r_scaleview_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	}
 
+	// pixellated for r_scale, smooth for the odd sizes of r_dynamicscale
+	filter = (r_dynamicscale.value && gl_timer_query_able) ? GL_LINEAR : GL_NEAREST;
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+
 	// copy the framebuffer to the texture
 	glBindTexture (GL_TEXTURE_2D, r_scaleview_texture);
 	glCopyTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, srcx, srcy, srcw, srch);
@@ -1006,6 +1292,20 @@ void R_ScaleView (void)
 	smax = srcw/(float)r_scaleview_texture_width;
 	tmax = srch/(float)r_scaleview_texture_height;
 
+	// same as the V_PolyBlend quad: blend color * blend alpha + view * (1 - blend alpha)
+	if (blend)
+	{
+		glTexEnvfv (GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, v_blend);
+		glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE_EXT);
+		glTexEnvi (GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_INTERPOLATE_EXT);
+		glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_CONSTANT_EXT);
+		glTexEnvi (GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);
+		glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE1_RGB_EXT, GL_TEXTURE);
+		glTexEnvi (GL_TEXTURE_ENV, GL_OPERAND1_RGB_EXT, GL_SRC_COLOR);
+		glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE2_RGB_EXT, GL_CONSTANT_EXT);
+		glTexEnvi (GL_TEXTURE_ENV, GL_OPERAND2_RGB_EXT, GL_SRC_ALPHA);
+	}
+
 	glBegin (GL_QUADS);
 	glTexCoord2f (0, 0);
 	glVertex2f (-1, -1);
@@ -1017,8 +1317,19 @@ void R_ScaleView (void)
 	glVertex2f (-1, 1);
 	glEnd ();
 
+	// back to the defaults the other combine users count on
+	if (blend)
+	{
+		glTexEnvi (GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_MODULATE);
+		glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_TEXTURE);
+		glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE1_RGB_EXT, GL_PREVIOUS_EXT);
+		glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	}
+
 	// clear cached binding
 	GL_ClearBindings ();
+
+	return blend;
 }
 
 /*
@@ -1036,6 +1347,8 @@ void R_RenderView (void)
 	if (!cl.worldmodel)
 		Sys_Error ("R_RenderView: NULL worldmodel");
 
+	TRACE_BEGIN ("R_RenderView");
+
 	time1 = 0; /* avoid compiler warning */
 	if (r_speeds.value)
 	{
@@ -1044,11 +1357,14 @@ void R_RenderView (void)
 
 		//johnfitz -- rendering statistics
 		rs_brushpolys = rs_aliaspolys = rs_skypolys = rs_particles = rs_fogpolys = rs_megatexels =
-		rs_dynamiclightmaps = rs_aliaspasses = rs_skypasses = rs_brushpasses = 0;
+		rs_dynamiclightmaps = rs_stylesurfs = rs_aliaspasses = rs_skypasses = rs_brushpasses = rs_aliasmodels = 0;
+		rs_occludedleafs = rs_occludedents = 0;
+		rs_aliastime = 0;
 	}
 	else if (gl_finish.value)
 		glFinish ();
 
+	R_UpdateViewScale ();
 	R_SetupView (); //johnfitz -- this does everything that should be done once per frame
 
 	//johnfitz -- stereo rendering -- full of hacky goodness
@@ -1087,7 +1403,10 @@ void R_RenderView (void)
 	}
 	//johnfitz
 
-	R_ScaleView ();
+	GL_TimerBegin (GPU_POST);
+	if (!R_ScaleView ())
+		V_PolyBlend (); //johnfitz -- moved here from R_Renderview ();
+	GL_TimerEnd (GPU_POST);
 
 	//johnfitz -- modified r_speeds output
 	time2 = Sys_DoubleTime ();
@@ -1100,16 +1419,22 @@ void R_RenderView (void)
 			(int)cl.viewangles[YAW],
 			(int)cl.viewangles[ROLL]);
 	else if (r_speeds.value == 2)
-		Con_Printf ("%3i ms  %4i/%4i wpoly %4i/%4i epoly %3i lmap %4i/%4i sky %1.1f mtex\n",
+		Con_Printf ("%3i ms  %4i/%4i wpoly %4i/%4i epoly %3i/%4i lmap %4i/%4i sky %1.1f mtex %4i us/mdl %3i%% pvs %4ik %4i/%3i occl\n",
 					(int)((time2-time1)*1000),
 					rs_brushpolys,
 					rs_brushpasses,
 					rs_aliaspolys,
 					rs_aliaspasses,
 					rs_dynamiclightmaps,
+					rs_stylesurfs,
 					rs_skypolys,
 					rs_skypasses,
-					TexMgr_FrameUsage ());
+					TexMgr_FrameUsage (),
+					rs_aliasmodels ? (int)(rs_aliastime * 1000000 / rs_aliasmodels) : 0,
+					(rs_pvshits + rs_pvsmisses) ? (int)(100.0 * rs_pvshits / (rs_pvshits + rs_pvsmisses)) : 0,
+					rs_pvsbytes / 1024,
+					rs_occludedleafs,
+					rs_occludedents);
 	else if (r_speeds.value)
 		Con_Printf ("%3i ms  %4i wpoly %4i epoly %3i lmap\n",
 					(int)((time2-time1)*1000),
@@ -1117,5 +1442,7 @@ void R_RenderView (void)
 					rs_aliaspolys,
 					rs_dynamiclightmaps);
 	//johnfitz
+
+	TRACE_END ("R_RenderView");
 }
 
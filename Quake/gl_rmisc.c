@@ -34,6 +34,10 @@ extern cvar_t gl_fullbrights;
 extern cvar_t gl_farclip;
 extern cvar_t gl_overbright;
 extern cvar_t gl_overbright_models;
+extern cvar_t gl_lightmap_size;
+extern cvar_t gl_packedvertices;
+extern cvar_t r_prepass;
+extern cvar_t r_gpulighting;
 extern cvar_t r_waterquality;
 extern cvar_t r_oldwater;
 extern cvar_t r_waterwarp;
@@ -49,6 +53,7 @@ extern cvar_t r_noshadow_list;
 extern cvar_t gl_zfix; // QuakeSpasm z-fighting fix
 
 extern gltexture_t *playertextures[MAX_SCOREBOARD]; //johnfitz
+extern gltexture_t *playercolormaps[MAX_SCOREBOARD];
 
 
 /*
@@ -69,6 +74,7 @@ GL_Fullbrights_f -- johnfitz
 static void GL_Fullbrights_f (cvar_t *var)
 {
 	TexMgr_ReloadNobrightImages ();
+	GL_FillTextureArrays ();
 }
 
 /*
@@ -167,6 +173,9 @@ void R_Init (void)
 
 	Cmd_AddCommand ("timerefresh", R_TimeRefresh_f);
 	Cmd_AddCommand ("pointfile", R_ReadPointFile_f);
+	Cmd_AddCommand ("lightmapinfo", R_LightmapInfo_f);
+	R_InitLightmapKernels ();
+	R_InitWarpTexture ();
 
 	Cvar_RegisterVariable (&r_norefresh);
 	Cvar_RegisterVariable (&r_lightmap);
@@ -211,8 +220,16 @@ void R_Init (void)
 	Cvar_SetCallback (&gl_fullbrights, GL_Fullbrights_f);
 	Cvar_SetCallback (&gl_overbright, GL_Overbright_f);
 	Cvar_RegisterVariable (&gl_overbright_models);
+	Cvar_RegisterVariable (&gl_lightmap_size);
+	Cvar_RegisterVariable (&gl_packedvertices);
+	Cvar_RegisterVariable (&r_prepass);
+	Cvar_RegisterVariable (&r_gpulighting);
+	Cvar_RegisterVariable (&r_threads);
+	Cvar_RegisterVariable (&r_occlusion);
+	Cvar_RegisterVariable (&r_mergebmodels);
 	Cvar_RegisterVariable (&r_lerpmodels);
 	Cvar_RegisterVariable (&r_lerpmove);
+	Cvar_RegisterVariable (&r_lightgrid);
 	Cvar_RegisterVariable (&r_nolerp_list);
 	Cvar_SetCallback (&r_nolerp_list, R_Model_ExtraFlags_List_f);
 	Cvar_RegisterVariable (&r_noshadow_list);
@@ -224,11 +241,17 @@ void R_Init (void)
 	Cvar_RegisterVariable (&r_telealpha);
 	Cvar_RegisterVariable (&r_slimealpha);
 	Cvar_RegisterVariable (&r_scale);
+	Cvar_RegisterVariable (&r_dynamicscale);
+	Cvar_RegisterVariable (&r_dynamicscale_fps);
+	Cvar_RegisterVariable (&r_dynamicscale_min);
+	Cvar_RegisterVariable (&r_dynamicscale_max);
+	Cvar_RegisterVariable (&r_dynamicscale_show);
 	Cvar_SetCallback (&r_lavaalpha, R_SetLavaalpha_f);
 	Cvar_SetCallback (&r_telealpha, R_SetTelealpha_f);
 	Cvar_SetCallback (&r_slimealpha, R_SetSlimealpha_f);
 
 	R_InitParticles ();
+	R_InitAliasTextures ();
 	R_SetClearColor_f (&r_clearcolor); //johnfitz
 
 	Sky_Init (); //johnfitz
@@ -247,6 +270,10 @@ void R_TranslatePlayerSkin (int playernum)
 	top = (cl.scores[playernum].colors & 0xf0)>>4;
 	bottom = cl.scores[playernum].colors &15;
 
+	//the shader picks the colors up from the scoreboard when drawing
+	if (playercolormaps[playernum])
+		return;
+
 	//FIXME: if gl_nocolors is on, then turned off, the textures may be out of sync with the scoreboard colors.
 	if (!gl_nocolors.value)
 		if (playertextures[playernum])
@@ -286,6 +313,19 @@ void R_TranslateNewPlayerSkin (int playernum)
 
 	pixels = (byte *)paliashdr + paliashdr->texels[skinnum]; // This is not a persistent place!
 
+//with the shader translation, all players with this skin share one colormap mask
+	if (r_alias_colormap)
+	{
+		q_snprintf(name, sizeof(name), "%s:frame%i_cmap", currententity->model->name, skinnum);
+		playercolormaps[playernum] = TexMgr_FindTexture (currententity->model, name);
+		if (!playercolormaps[playernum])
+			playercolormaps[playernum] = TexMgr_LoadImage (currententity->model, name, paliashdr->skinwidth, paliashdr->skinheight,
+				SRC_INDEXED, pixels, paliashdr->gltextures[skinnum][0]->source_file, paliashdr->gltextures[skinnum][0]->source_offset, TEXPREF_PAD | TEXPREF_COLORMAP);
+		playertextures[playernum] = NULL;
+		return;
+	}
+	playercolormaps[playernum] = NULL;
+
 //upload new image
 	q_snprintf(name, sizeof(name), "player_%i", playernum);
 	playertextures[playernum] = TexMgr_LoadImage (currententity->model, name, paliashdr->skinwidth, paliashdr->skinheight,
@@ -306,7 +346,10 @@ void R_NewGame (void)
 
 	//clear playertexture pointers (the textures themselves were freed by texmgr_newgame)
 	for (i=0; i<MAX_SCOREBOARD; i++)
+	{
 		playertextures[i] = NULL;
+		playercolormaps[i] = NULL;
+	}
 }
 
 /*
@@ -377,15 +420,17 @@ void R_NewMap (void)
 		d_lightstylevalue[i] = 264;		// normal light value
 
 // clear out efrags in case the level hasn't been reloaded
-// FIXME: is this one short?
-	for (i=0 ; i<cl.worldmodel->numleafs ; i++)
-		cl.worldmodel->leafs[i].efrags = NULL;
+	R_ClearEfrags ();
 
 	r_viewleaf = NULL;
 	R_ClearParticles ();
+	r_lightcacheseq++;
 
 	GL_BuildLightmaps ();
 	GL_BuildBModelVertexBuffer ();
+	R_InitLightGrid ();
+	R_InitMarkSurfaces ();
+	SV_ClearFatPVSCache (); // the world model may be in the old one's slot
 	//ericw -- no longer load alias models into a VBO here, it's done in Mod_LoadAliasModel
 
 	r_framecount = 0; //johnfitz -- paranoid?
@@ -497,21 +542,156 @@ GLint GL_GetUniformLocation (GLuint *programPtr, const char *name)
 	return location;
 }
 
+/*
+===============================================================================
+
+PROGRAM BINARY CACHE
+
+Linked programs are kept in <userdir>/shadercache, one file per program,
+named after a hash of the driver strings, the shader sources and the
+attribute bindings.  A driver update or an edited shader just misses the
+cache, and a binary the driver rejects falls back to compiling.
+
+===============================================================================
+*/
+
+#define	PROGRAMCACHE_DIR	"shadercache"
+#define	PROGRAMCACHE_MAGIC	(('B'<<24)|('P'<<16)|('S'<<8)|'Q')	// "QSPB"
+
+typedef struct
+{
+	int		magic;
+	uint32_t	key[2];
+	GLenum		format;
+	GLint		length;
+} programcacheheader_t;
+
+static void GL_HashString (uint64_t *hash, const char *s)
+{
+	if (!s)
+		s = "";
+	*hash = COM_HashBlock64 (*hash, s, strlen (s) + 1);
+}
+
+static uint64_t GL_ProgramCacheKey (const GLchar *vertSource, const GLchar *fragSource, int numbindings, const glsl_attrib_binding_t *bindings)
+{
+	uint64_t	hash = COM_HASH64_INIT;
+	int		i;
+
+	GL_HashString (&hash, (const char *) glGetString (GL_VENDOR));
+	GL_HashString (&hash, (const char *) glGetString (GL_RENDERER));
+	GL_HashString (&hash, (const char *) glGetString (GL_VERSION));
+	GL_HashString (&hash, vertSource);
+	GL_HashString (&hash, fragSource);
+	for (i = 0; i < numbindings; i++)
+	{
+		GL_HashString (&hash, bindings[i].name);
+		hash = COM_HashBlock64 (hash, &bindings[i].attrib, sizeof(bindings[i].attrib));
+	}
+	return hash;
+}
+
+static void GL_ProgramCachePath (char *path, size_t size, uint64_t key)
+{
+	q_snprintf (path, size, "%s/" PROGRAMCACHE_DIR "/%08x%08x.bin", host_parms->userdir,
+			(unsigned int) (key >> 32), (unsigned int) key);
+}
+
+static GLuint GL_LoadCachedProgram (uint64_t key)
+{
+	char			path[MAX_OSPATH];
+	programcacheheader_t	header;
+	FILE			*f;
+	void			*data;
+	GLuint			program;
+	GLint			status;
+
+	if (!gl_programbinary_able)
+		return 0;
+
+	GL_ProgramCachePath (path, sizeof(path), key);
+	f = fopen (path, "rb");
+	if (!f)
+		return 0;
+
+	data = NULL;
+	program = 0;
+	if (fread (&header, sizeof(header), 1, f) == 1 &&
+	    header.magic == PROGRAMCACHE_MAGIC &&
+	    header.key[0] == (uint32_t) (key >> 32) && header.key[1] == (uint32_t) key &&
+	    header.length > 0 && (data = malloc (header.length)) != NULL &&
+	    fread (data, header.length, 1, f) == 1)
+	{
+		program = GL_CreateProgramFunc ();
+		GL_ProgramBinaryFunc (program, header.format, data, header.length);
+		GL_GetProgramivFunc (program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			Con_DPrintf ("driver rejected cached program %s\n", path);
+			GL_DeleteProgramFunc (program);
+			program = 0;
+		}
+	}
+
+	free (data);
+	fclose (f);
+	return program;
+}
+
+static void GL_SaveCachedProgram (GLuint program, uint64_t key)
+{
+	char			path[MAX_OSPATH];
+	programcacheheader_t	header;
+	FILE			*f;
+	void			*data;
+	GLsizei			written;
+
+	if (!gl_programbinary_able)
+		return;
+
+	header.magic = PROGRAMCACHE_MAGIC;
+	header.key[0] = (uint32_t) (key >> 32);
+	header.key[1] = (uint32_t) key;
+	header.length = 0;
+	GL_GetProgramivFunc (program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+	if (header.length <= 0)
+		return;
+	data = malloc (header.length);
+	if (!data)
+		return;
+
+	written = 0;
+	GL_GetProgramBinaryFunc (program, header.length, &written, &header.format, data);
+	if (written > 0)
+	{
+		header.length = written;
+		q_snprintf (path, sizeof(path), "%s/" PROGRAMCACHE_DIR, host_parms->userdir);
+		Sys_mkdir (path);
+		GL_ProgramCachePath (path, sizeof(path), key);
+		f = fopen (path, "wb");
+		if (f)
+		{
+			if (fwrite (&header, sizeof(header), 1, f) != 1 || fwrite (data, written, 1, f) != 1)
+				Con_DPrintf ("couldn't write %s\n", path);
+			fclose (f);
+		}
+	}
+
+	free (data);
+}
+
 /*
 ====================
-GL_CreateProgram
+GL_CompileProgram
 
-Compiles and returns GLSL program.
+Compiles and links a GLSL program, 0 on failure.
 ====================
 */
-GLuint GL_CreateProgram (const GLchar *vertSource, const GLchar *fragSource, int numbindings, const glsl_attrib_binding_t *bindings)
+static GLuint GL_CompileProgram (const GLchar *vertSource, const GLchar *fragSource, int numbindings, const glsl_attrib_binding_t *bindings)
 {
 	int i;
 	GLuint program, vertShader, fragShader;
 
-	if (!gl_glsl_able)
-		return 0;
-
 	vertShader = GL_CreateShaderFunc (GL_VERTEX_SHADER);
 	GL_ShaderSourceFunc (vertShader, 1, &vertSource, NULL);
 	GL_CompileShaderFunc (vertShader);
@@ -541,6 +721,9 @@ GLuint GL_CreateProgram (const GLchar *vertSource, const GLchar *fragSource, int
 	{
 		GL_BindAttribLocationFunc (program, bindings[i].attrib, bindings[i].name);
 	}
+
+	if (gl_programbinary_able)
+		GL_ProgramParameteriFunc (program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	
 	GL_LinkProgramFunc (program);
 
@@ -549,16 +732,41 @@ GLuint GL_CreateProgram (const GLchar *vertSource, const GLchar *fragSource, int
 		GL_DeleteProgramFunc (program);
 		return 0;
 	}
-	else
-	{
-		if (gl_num_programs == (sizeof(gl_programs)/sizeof(GLuint)))
-			Host_Error ("gl_programs overflow");
+	return program;
+}
+
+/*
+====================
+GL_CreateProgram
+
+Compiles and returns GLSL program, or loads it from the program cache.
+====================
+*/
+GLuint GL_CreateProgram (const GLchar *vertSource, const GLchar *fragSource, int numbindings, const glsl_attrib_binding_t *bindings)
+{
+	GLuint program;
+	uint64_t key;
 
-		gl_programs[gl_num_programs] = program;
-		gl_num_programs++;
+	if (!gl_glsl_able)
+		return 0;
 
-		return program;
+	key = GL_ProgramCacheKey (vertSource, fragSource, numbindings, bindings);
+	program = GL_LoadCachedProgram (key);
+	if (!program)
+	{
+		program = GL_CompileProgram (vertSource, fragSource, numbindings, bindings);
+		if (!program)
+			return 0;
+		GL_SaveCachedProgram (program, key);
 	}
+
+	if (gl_num_programs == (sizeof(gl_programs)/sizeof(GLuint)))
+		Host_Error ("gl_programs overflow");
+
+	gl_programs[gl_num_programs] = program;
+	gl_num_programs++;
+
+	return program;
 }
 
 /*
@@ -583,7 +791,7 @@ void R_DeleteShaders (void)
 	gl_num_programs = 0;
 }
 
-GLuint current_array_buffer, current_element_array_buffer;
+GLuint current_array_buffer, current_element_array_buffer, current_draw_indirect_buffer;
 
 /*
 ====================
@@ -607,6 +815,9 @@ void GL_BindBuffer (GLenum target, GLuint buffer)
 		case GL_ELEMENT_ARRAY_BUFFER:
 			cache = &current_element_array_buffer;
 			break;
+		case GL_DRAW_INDIRECT_BUFFER:
+			cache = &current_draw_indirect_buffer;
+			break;
 		default:
 			Host_Error("GL_BindBuffer: unsupported target %d", (int)target);
 			return;
@@ -636,4 +847,400 @@ void GL_ClearBufferBindings ()
 	current_element_array_buffer = 0;
 	GL_BindBufferFunc (GL_ARRAY_BUFFER, 0);
 	GL_BindBufferFunc (GL_ELEMENT_ARRAY_BUFFER, 0);
+	if (gl_multidrawindirect_able)
+	{
+		current_draw_indirect_buffer = 0;
+		GL_BindBufferFunc (GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+}
+
+/*
+================================================================================
+
+	STREAMING BUFFER
+
+	Per-frame geometry is written into one ring buffer. With
+	ARB_buffer_storage it stays mapped for good, and each segment of the
+	ring is fenced when it's left and waited on before it's written again.
+	Otherwise the data goes in with glBufferSubData and the buffer is
+	orphaned when the ring wraps; without VBOs the offsets are plain
+	pointers into staging memory.
+
+================================================================================
+*/
+
+#define	STREAM_BUFFER_SIZE	(4 * 1024 * 1024)
+#define	STREAM_SEGMENTS		(STREAM_BUFFER_SIZE / MAX_STREAM_ALLOC)
+
+GLuint		gl_streambuffer;
+int		gl_memory[GLMEM_NUMTYPES];
+static byte	*stream_mapped;		// persistently mapped gl_streambuffer
+static byte	*stream_staging;	// MAX_STREAM_ALLOC bytes, when not mapped
+static int	stream_cursor;
+static int	stream_segment;
+static QS_GLsync	stream_fences[STREAM_SEGMENTS];
+
+/*
+====================
+GL_CreateStreamBuffer -- called from GL_Init
+====================
+*/
+void GL_CreateStreamBuffer (void)
+{
+	stream_cursor = 0;
+	stream_segment = 0;
+	memset (stream_fences, 0, sizeof(stream_fences));
+
+	if (gl_vbo_able)
+	{
+		GL_GenBuffersFunc (1, &gl_streambuffer);
+		GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+		if (gl_buffer_storage_able)
+		{
+			GL_BufferStorageFunc (GL_ARRAY_BUFFER, STREAM_BUFFER_SIZE, NULL,
+					GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+			stream_mapped = (byte *) GL_MapBufferRangeFunc (GL_ARRAY_BUFFER, 0, STREAM_BUFFER_SIZE,
+					GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+			if (!stream_mapped)
+			{ // buffer storage is immutable, start over with a plain buffer
+				Con_Warning ("Couldn't map streaming buffer\n");
+				GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+				GL_DeleteBuffersFunc (1, &gl_streambuffer);
+				GL_GenBuffersFunc (1, &gl_streambuffer);
+				GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+			}
+		}
+		if (!stream_mapped)
+			GL_BufferDataFunc (GL_ARRAY_BUFFER, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+		GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+		gl_memory[GLMEM_STREAM] = STREAM_BUFFER_SIZE;
+	}
+	else
+		gl_streambuffer = 0;
+
+	if (!stream_mapped && !stream_staging)
+	{
+		stream_staging = (byte *) malloc (MAX_STREAM_ALLOC);
+		if (!stream_staging)
+			Sys_Error ("GL_CreateStreamBuffer: out of memory");
+	}
+}
+
+/*
+====================
+GL_DeleteStreamBuffer
+====================
+*/
+void GL_DeleteStreamBuffer (void)
+{
+	int i;
+
+	for (i = 0; i < STREAM_SEGMENTS; i++)
+	{
+		if (stream_fences[i])
+			GL_DeleteSyncFunc (stream_fences[i]);
+		stream_fences[i] = NULL;
+	}
+
+	if (gl_streambuffer)
+	{
+		GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+		GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+		GL_DeleteBuffersFunc (1, &gl_streambuffer);	// unmaps it too
+		gl_streambuffer = 0;
+	}
+	stream_mapped = NULL;
+	gl_memory[GLMEM_STREAM] = 0;
+}
+
+/*
+====================
+GL_StreamAlloc
+
+Returns room for up to size bytes, valid until GL_StreamCommit. Only one
+allocation can be outstanding at a time.
+====================
+*/
+void *GL_StreamAlloc (int size)
+{
+	int next;
+
+	if (size > MAX_STREAM_ALLOC)
+		Sys_Error ("GL_StreamAlloc: %i bytes", size);
+
+	if (!stream_mapped)
+	{
+		if (gl_streambuffer && stream_cursor + size > STREAM_BUFFER_SIZE)
+		{ // orphan it, the driver hands out fresh memory
+			GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+			GL_BufferDataFunc (GL_ARRAY_BUFFER, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+			stream_cursor = 0;
+		}
+		return stream_staging;
+	}
+
+	if (stream_cursor + size > (stream_segment + 1) * MAX_STREAM_ALLOC)
+	{
+		// done with this segment
+		stream_fences[stream_segment] = GL_FenceSyncFunc (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		// wait for the GPU to finish drawing from the next one
+		next = (stream_segment + 1) % STREAM_SEGMENTS;
+		if (stream_fences[next])
+		{
+			if (GL_ClientWaitSyncFunc (stream_fences[next], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+				Con_DPrintf ("GL_StreamAlloc: fence timed out\n");
+			GL_DeleteSyncFunc (stream_fences[next]);
+			stream_fences[next] = NULL;
+		}
+		stream_segment = next;
+		stream_cursor = next * MAX_STREAM_ALLOC;
+	}
+
+	return stream_mapped + stream_cursor;
+}
+
+/*
+====================
+GL_StreamCommit
+
+Finishes the last GL_StreamAlloc. Returns the offset of the data in
+gl_streambuffer, or its address if there are no VBOs.
+====================
+*/
+GLintptr GL_StreamCommit (int used)
+{
+	GLintptr offset;
+
+	if (!gl_streambuffer)
+		return (GLintptr) stream_staging;
+
+	if (!stream_mapped)
+	{
+		GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+		GL_BufferSubDataFunc (GL_ARRAY_BUFFER, stream_cursor, used, stream_staging);
+	}
+
+	offset = stream_cursor;
+	stream_cursor += (used + 15) & ~15;
+	return offset;
+}
+
+/*
+====================
+GL_StreamVerts
+
+Room for numverts vertices, drawn by GL_DrawStreamVerts.
+====================
+*/
+streamvert_t *GL_StreamVerts (int numverts)
+{
+	return (streamvert_t *) GL_StreamAlloc (numverts * sizeof(streamvert_t));
+}
+
+/*
+====================
+GL_DrawStreamVerts
+
+Draws the vertices from GL_StreamVerts with fixed function vertex arrays,
+in place of a glBegin/glEnd pair. flags picks the STREAM_* attributes used
+besides the position.
+====================
+*/
+void GL_DrawStreamVerts (GLenum mode, int numverts, int flags)
+{
+	const byte *base;
+
+	base = (const byte *) GL_StreamCommit (numverts * sizeof(streamvert_t));
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+	glEnableClientState (GL_VERTEX_ARRAY);
+	glVertexPointer (3, GL_FLOAT, sizeof(streamvert_t), base + offsetof(streamvert_t, xyz));
+	if (flags & STREAM_TEXCOORDS)
+	{
+		glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer (2, GL_FLOAT, sizeof(streamvert_t), base + offsetof(streamvert_t, st));
+	}
+	if (flags & STREAM_TEXCOORDS2)
+	{
+		GL_ClientActiveTextureFunc (GL_TEXTURE1_ARB);
+		glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer (2, GL_FLOAT, sizeof(streamvert_t), base + offsetof(streamvert_t, st2));
+		GL_ClientActiveTextureFunc (GL_TEXTURE0_ARB);
+	}
+	if (flags & STREAM_COLORS)
+	{
+		glEnableClientState (GL_COLOR_ARRAY);
+		glColorPointer (4, GL_UNSIGNED_BYTE, sizeof(streamvert_t), base + offsetof(streamvert_t, color));
+	}
+
+	glDrawArrays (mode, 0, numverts);
+
+	if (flags & STREAM_COLORS)
+		glDisableClientState (GL_COLOR_ARRAY);
+	if (flags & STREAM_TEXCOORDS2)
+	{
+		GL_ClientActiveTextureFunc (GL_TEXTURE1_ARB);
+		glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+		GL_ClientActiveTextureFunc (GL_TEXTURE0_ARB);
+	}
+	if (flags & STREAM_TEXCOORDS)
+		glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState (GL_VERTEX_ARRAY);
+}
+
+/*
+==============================================================================
+
+GPU TIMERS
+
+Each pass is bracketed by a pair of GL_TIMESTAMP queries.  The queries of a
+frame are read back GPU_FRAMES - 1 frames later, once the GPU has long
+finished with them, so timing never stalls the pipeline; a frame whose
+results still aren't in is dropped.
+==============================================================================
+*/
+
+#define	MAX_GPU_SPANS	32	// begin/end pairs per frame
+
+typedef struct
+{
+	int		numspans;
+	gpupass_t	pass[MAX_GPU_SPANS];
+	GLuint		queries[MAX_GPU_SPANS * 2];	// begin, end
+} gpuframe_t;
+
+static gpuframe_t	gpu_frames[GPU_FRAMES];
+static int		gpu_frame;
+static int		gpu_openspan = -1;
+
+const char	*gpu_passnames[GPU_NUMPASSES] =
+{
+	"world", "water", "sky", "models", "particles", "2d", "post"
+};
+float		gpu_passms[GPU_NUMPASSES];
+int		gpu_results;
+qboolean	gpu_timing;
+
+/*
+====================
+GL_ReadTimerFrame
+====================
+*/
+static void GL_ReadTimerFrame (gpuframe_t *f)
+{
+	uint64_t	begin, end;
+	double		ns[GPU_NUMPASSES];
+	GLuint		available;
+	int		i;
+
+	if (!f->numspans)
+		return;
+
+	// the spans finish in order, so the last one being in means all are
+	GL_GetQueryObjectuivFunc (f->queries[f->numspans * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	memset (ns, 0, sizeof(ns));
+	for (i = 0; i < f->numspans; i++)
+	{
+		GL_GetQueryObjectui64vFunc (f->queries[i * 2], GL_QUERY_RESULT, &begin);
+		GL_GetQueryObjectui64vFunc (f->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		if (end > begin)
+			ns[f->pass[i]] += (double)(end - begin);
+	}
+	for (i = 0; i < GPU_NUMPASSES; i++)
+		gpu_passms[i] = ns[i] / 1000000.0;
+	gpu_results++;
+}
+
+/*
+====================
+GL_TimerFrame -- called at the start of every frame
+
+Timing runs while r_speeds or r_dynamicscale is set or a benchmark is
+running.
+====================
+*/
+void GL_TimerFrame (void)
+{
+	gpuframe_t	*f;
+
+	gpu_openspan = -1;
+	gpu_frame = (gpu_frame + 1) % GPU_FRAMES;
+	f = &gpu_frames[gpu_frame];
+
+	// this slot was filled GPU_FRAMES - 1 frames ago
+	if (gl_timer_query_able)
+		GL_ReadTimerFrame (f);
+	f->numspans = 0;
+
+	gpu_timing = gl_timer_query_able && (r_speeds.value || r_dynamicscale.value || cls.benchmarking);
+	if (!gpu_timing)
+		memset (gpu_passms, 0, sizeof(gpu_passms));
+}
+
+/*
+====================
+GL_TimerBegin
+
+Spans don't nest; a begin while another pass is open is ignored.
+====================
+*/
+void GL_TimerBegin (gpupass_t pass)
+{
+	gpuframe_t	*f;
+
+	if (!gpu_timing || gpu_openspan != -1)
+		return;
+
+	f = &gpu_frames[gpu_frame];
+	if (f->numspans == MAX_GPU_SPANS)
+		return;
+	if (!f->queries[0])
+		GL_GenQueriesFunc (MAX_GPU_SPANS * 2, f->queries);
+
+	gpu_openspan = f->numspans;
+	f->pass[gpu_openspan] = pass;
+	GL_QueryCounterFunc (f->queries[gpu_openspan * 2], GL_TIMESTAMP);
+}
+
+/*
+====================
+GL_TimerEnd
+====================
+*/
+void GL_TimerEnd (gpupass_t pass)
+{
+	gpuframe_t	*f;
+
+	if (gpu_openspan == -1)
+		return;
+
+	f = &gpu_frames[gpu_frame];
+	if (f->pass[gpu_openspan] != pass)
+		return;
+
+	GL_QueryCounterFunc (f->queries[gpu_openspan * 2 + 1], GL_TIMESTAMP);
+	f->numspans++;
+	gpu_openspan = -1;
+}
+
+/*
+====================
+GL_DeleteTimerQueries -- called from VID_Restart
+====================
+*/
+void GL_DeleteTimerQueries (void)
+{
+	int	i;
+
+	for (i = 0; i < GPU_FRAMES; i++)
+	{
+		if (gpu_frames[i].queries[0])
+			GL_DeleteQueriesFunc (MAX_GPU_SPANS * 2, gpu_frames[i].queries);
+		memset (&gpu_frames[i], 0, sizeof(gpu_frames[i]));
+	}
+	gpu_openspan = -1;
 }
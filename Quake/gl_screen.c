@@ -86,6 +86,7 @@ cvar_t		scr_conscale = {"scr_conscale", "1", CVAR_ARCHIVE};
 cvar_t		scr_crosshairscale = {"scr_crosshairscale", "1", CVAR_ARCHIVE};
 cvar_t		scr_showfps = {"scr_showfps", "0", CVAR_NONE};
 cvar_t		scr_clock = {"scr_clock", "0", CVAR_NONE};
+cvar_t		scr_memstats = {"scr_memstats", "0", CVAR_NONE};
 //johnfitz
 cvar_t		scr_usekfont = {"scr_usekfont", "0", CVAR_NONE}; // 2021 re-release
 
@@ -102,6 +103,8 @@ cvar_t		gl_triplebuffer = {"gl_triplebuffer", "1", CVAR_ARCHIVE};
 
 cvar_t		cl_gun_fovscale = {"cl_gun_fovscale","1",CVAR_ARCHIVE}; // Qrack
 
+cvar_t		capture_fps = {"capture_fps", "30", CVAR_ARCHIVE};
+
 extern	cvar_t	crosshair;
 
 qboolean	scr_initialized;		// ready to draw
@@ -118,10 +121,13 @@ vrect_t		scr_vrect;
 qboolean	scr_disabled_for_loading;
 qboolean	scr_drawloading;
 float		scr_disabled_time;
+double		scr_swaptime;		// spent in GL_EndRendering, for host_speeds
 
 int	scr_tileclear_updates = 0; //johnfitz
 
 void SCR_ScreenShot_f (void);
+static void SCR_CaptureStart_f (void);
+static void SCR_CaptureStop_f (void);
 
 /*
 ===============================================================================
@@ -409,6 +415,7 @@ void SCR_Init (void)
 	Cvar_RegisterVariable (&scr_conscale);
 	Cvar_RegisterVariable (&scr_crosshairscale);
 	Cvar_RegisterVariable (&scr_showfps);
+	Cvar_RegisterVariable (&scr_memstats);
 	Cvar_RegisterVariable (&scr_clock);
 	//johnfitz
 	Cvar_RegisterVariable (&scr_usekfont); // 2021 re-release
@@ -427,7 +434,11 @@ void SCR_Init (void)
 	Cvar_RegisterVariable (&gl_triplebuffer);
 	Cvar_RegisterVariable (&cl_gun_fovscale);
 
+	Cvar_RegisterVariable (&capture_fps);
+
 	Cmd_AddCommand ("screenshot",SCR_ScreenShot_f);
+	Cmd_AddCommand ("capture_start",SCR_CaptureStart_f);
+	Cmd_AddCommand ("capture_stop",SCR_CaptureStop_f);
 	Cmd_AddCommand ("sizeup",SCR_SizeUp_f);
 	Cmd_AddCommand ("sizedown",SCR_SizeDown_f);
 
@@ -482,6 +493,68 @@ void SCR_DrawFPS (void)
 	}
 }
 
+/*
+==============
+SCR_DrawSoundStats
+
+the snd_stats overlay, stacked above the fps counter
+==============
+*/
+void SCR_DrawSoundStats (void)
+{
+	char	lines[MAX_SOUND_STATS_LINES][SOUND_STATS_LINE_LEN];
+	int	i, numlines, y;
+
+	numlines = S_GetStatsLines (lines);
+	if (!numlines)
+		return;
+
+	y = 200 - 8;
+	if (scr_clock.value) y -= 8;
+	if (scr_showfps.value) y -= 8;
+	if (r_dynamicscale.value && r_dynamicscale_show.value) y -= 8;
+
+	GL_SetCanvas (CANVAS_BOTTOMRIGHT);
+	for (i = numlines - 1; i >= 0; i--, y -= 8)
+		Draw_String (320 - (strlen(lines[i])<<3), y, lines[i]);
+	scr_tileclear_updates = 0;
+}
+
+/*
+==============
+SCR_DrawDynamicScale
+
+the r_dynamicscale_show line, stacked above the fps counter
+==============
+*/
+void SCR_DrawDynamicScale (void)
+{
+	char	str[40];
+	float	ms;
+	int		i, y;
+
+	if (!r_dynamicscale.value || !r_dynamicscale_show.value)
+		return;
+
+	if (gl_timer_query_able)
+	{
+		for (i = 0, ms = 0; i < GPU_NUMPASSES; i++)
+			ms += gpu_passms[i];
+		q_snprintf (str, sizeof(str), "%3i%% %5.2f/%.2f ms", (int)(r_dynamicfrac * 100 + 0.5f), ms,
+			r_dynamicscale_fps.value > 0 ? 1000.0f / r_dynamicscale_fps.value : 0.0f);
+	}
+	else
+		q_strlcpy (str, "no timer queries", sizeof(str));
+
+	y = 200 - 8;
+	if (scr_clock.value) y -= 8;
+	if (scr_showfps.value) y -= 8;
+
+	GL_SetCanvas (CANVAS_BOTTOMRIGHT);
+	Draw_String (320 - (strlen(str)<<3), y, str);
+	scr_tileclear_updates = 0;
+}
+
 /*
 ==============
 SCR_DrawClock -- johnfitz
@@ -518,7 +591,7 @@ SCR_DrawDevStats
 void SCR_DrawDevStats (void)
 {
 	char	str[40];
-	int		y = 25-9; //9=number of lines to print
+	int		y = 25-10; //10=number of lines to print
 	int		x = 0; //margin
 
 	if (!devstats.value)
@@ -526,7 +599,7 @@ void SCR_DrawDevStats (void)
 
 	GL_SetCanvas (CANVAS_BOTTOMLEFT);
 
-	Draw_Fill (x, y*8, 19*8, 9*8, 0, 0.5); //dark rectangle
+	Draw_Fill (x, y*8, 19*8, 10*8, 0, 0.5); //dark rectangle
 
 	sprintf (str, "devstats |Curr Peak");
 	Draw_String (x, (y++)*8-x, str);
@@ -554,6 +627,143 @@ void SCR_DrawDevStats (void)
 
 	sprintf (str, "Tempents |%4i %4i", dev_stats.tempents, dev_peakstats.tempents);
 	Draw_String (x, (y++)*8-x, str);
+
+	sprintf (str, "Modlookup|%4i %4i", dev_stats.modlookups, dev_peakstats.modlookups);
+	Draw_String (x, (y++)*8-x, str);
+}
+
+/*
+==============
+SCR_DrawMemStats
+
+the memstats figures in megabytes, below the loading disc
+==============
+*/
+void SCR_DrawMemStats (void)
+{
+	memstats_t	m;
+	char	str[40];
+	int		x, y;
+
+	if (!scr_memstats.value)
+		return;
+
+	Host_GetMemStats (&m);
+
+	GL_SetCanvas (CANVAS_TOPRIGHT);
+	x = 320 - 22*8;
+	y = 4;
+
+	Draw_Fill (x, y*8, 22*8, 9*8, 0, 0.5); //dark rectangle
+
+	sprintf (str, "memstats|   MB  Peak");
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "--------+-----------");
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "Hunk    |%5.1f %5.1f", m.hunk / 1048576.0, host_mempeak.hunk / 1048576.0);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "Cache   |%5.1f %5.1f", m.cache / 1048576.0, host_mempeak.cache / 1048576.0);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "Edicts  |%5.1f %5.1f", m.edicts / 1048576.0, host_mempeak.edicts / 1048576.0);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "Textures|%5.1f %5.1f", m.textures / 1048576.0, host_mempeak.textures / 1048576.0);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "Buffers |%5.1f %5.1f", m.buffers / 1048576.0, host_mempeak.buffers / 1048576.0);
+	Draw_String (x, (y++)*8, str);
+	if (m.soundheap)
+		sprintf (str, "Sound   |%5.1f %5.1f", m.sound / 1048576.0, m.soundpeak / 1048576.0);
+	else
+		sprintf (str, "Sound   |in cache");
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "Zone KB |%5i", m.zone / 1024);
+	Draw_String (x, (y++)*8, str);
+	scr_tileclear_updates = 0;
+}
+
+/*
+==============
+SCR_DrawGPUTimes
+
+GPU milliseconds per render pass while r_speeds is set
+==============
+*/
+void SCR_DrawGPUTimes (void)
+{
+	char	str[40];
+	float	total;
+	int		i, y;
+
+	if (!gpu_timing || !r_speeds.value)
+		return;
+
+	GL_SetCanvas (CANVAS_BOTTOMLEFT);
+
+	y = 25 - (GPU_NUMPASSES + 3);
+	if (devstats.value)
+		y -= 10 + 1; // above the devstats box
+
+	Draw_Fill (0, y*8, 16*8, (GPU_NUMPASSES + 3)*8, 0, 0.5); //dark rectangle
+
+	sprintf (str, "gpu      |    ms");
+	Draw_String (0, (y++)*8, str);
+
+	sprintf (str, "---------+------");
+	Draw_String (0, (y++)*8, str);
+
+	for (i = 0, total = 0; i < GPU_NUMPASSES; i++)
+	{
+		sprintf (str, "%-9s|%6.2f", gpu_passnames[i], gpu_passms[i]);
+		Draw_String (0, (y++)*8, str);
+		total += gpu_passms[i];
+	}
+
+	sprintf (str, "total    |%6.2f", total);
+	Draw_String (0, (y++)*8, str);
+}
+
+/*
+==============
+SCR_DrawNetGraph
+
+cl_netgraph: how late each update arrived against the clock estimate,
+one column per update with the newest on the right, and the playout
+delay of the jitter buffer as a line.  Red columns came in later than
+the delay, so entities were extrapolated past them.
+==============
+*/
+void SCR_DrawNetGraph (void)
+{
+	float	lateness[128], delay, jitter, late;
+	char	str[40];
+	int		i, n, h, x, y, extrapolated;
+
+	if (!cl_netgraph.value || cls.state != ca_connected)
+		return;
+
+	n = CL_NetGraph (lateness, 128, &delay, &jitter, &extrapolated);
+
+	GL_SetCanvas (CANVAS_BOTTOMLEFT);
+
+	y = 200 - 48;
+	if (devstats.value)
+		y -= (9 + 1) * 8; // above the devstats box
+	if (gpu_timing && r_speeds.value)
+		y -= (GPU_NUMPASSES + 3 + 1) * 8;
+
+	Draw_Fill (0, y, 128, 40, 0, 0.5); //dark rectangle
+	for (i = 0; i < n; i++)
+	{
+		late = lateness[i];
+		h = CLAMP (1, (int)(late * 1000.0 / 5), 32);	// 5 ms per pixel
+		x = 128 - n + i;
+		Draw_Fill (x, y + 40 - h, 1, h, (delay && late > delay) ? 251 : 208, 1);
+	}
+	if (delay)
+		Draw_Fill (0, y + 40 - CLAMP (1, (int)(delay * 1000.0 / 5), 32), 128, 1, 254, 1);
+
+	sprintf (str, "%3.0fms %3.0fj %2ix", delay * 1000, jitter * 1000, extrapolated);
+	Draw_String (0, y - 8, str);
+	scr_tileclear_updates = 0;
 }
 
 /*
@@ -759,9 +969,414 @@ void SCR_DrawConsole (void)
 
 SCREEN SHOTS
 
+Screenshots and capture_start frames are read into a ring of pixel buffer
+objects and mapped a couple of frames later, once the copy has finished, so
+glReadPixels doesn't stall the pipeline.  Encoding and writing the files
+runs as a task.
+
 ==============================================================================
 */
 
+#define	CAPTURE_PBOS		3	// the ring; a read is mapped CAPTURE_PBOS-1 frames later
+#define	MAX_CAPTURE_JOBS	8	// writes in flight before the main thread waits for one
+#define	MAX_CAPTURE_REPEAT	8	// frames written for one read when rendering is slower than capture_fps
+
+typedef enum
+{
+	CAPTURE_TGA,
+	CAPTURE_PNG,
+	CAPTURE_JPG,
+	CAPTURE_RAW		// top-down RGB24 frames appended to one file
+} captureformat_t;
+
+typedef struct
+{
+	captureformat_t	format;
+	int		quality;
+	char		name[MAX_QPATH];	// for sequences, a format taking the frame number
+	int		firstframe;
+	int		numframes;
+	qboolean	screenshot;		// print the result when done
+} capturereq_t;
+
+typedef struct
+{
+	capturereq_t	req;
+	byte		*buffer;		// bottom-up RGB24 from glReadPixels
+	int		width, height;
+	qboolean	ok;
+	qboolean	active;
+	int		sequence;
+	task_t		task;
+} capturejob_t;
+
+typedef struct
+{
+	GLuint		pbo;
+	int		size;
+	qboolean	pending;
+	int		frame;
+	int		width, height;
+	capturereq_t	req;
+} capturepbo_t;
+
+static capturejob_t	capture_jobs[MAX_CAPTURE_JOBS];
+static int		capture_jobsequence;
+static capturepbo_t	capture_pbos[CAPTURE_PBOS];
+static int		capture_nextpbo;
+static int		capture_framecount;
+
+static qboolean		screenshot_pending;
+static capturereq_t	screenshot_req;
+static int		screenshot_num;		// first unused spasmNNNN candidate
+
+static qboolean		capture_active;
+static capturereq_t	capture_req;		// next capture_start frame
+static double		capture_time, capture_nexttime;
+static int		capture_width, capture_height;
+static FILE		*capture_rawfile;
+static task_t		capture_lastraw;	// raw frames have to be written in order
+
+/*
+==================
+SCR_CaptureJob
+
+Runs as a task, so it only writes the file and records the result.
+==================
+*/
+static void SCR_CaptureJob (void *data)
+{
+	capturejob_t	*job = (capturejob_t *) data;
+	char		name[MAX_QPATH];
+	int		i, j, y, rowbytes, temp;
+
+	rowbytes = job->width * 3;
+	job->ok = true;
+	for (i = 0; i < job->req.numframes && job->ok; i++)
+	{
+		switch (job->req.format)
+		{
+		case CAPTURE_RAW:
+			for (y = job->height - 1; y >= 0 && job->ok; y--)
+				job->ok = fwrite (job->buffer + y * rowbytes, rowbytes, 1, capture_rawfile) == 1;
+			break;
+		case CAPTURE_TGA:
+			if (i > 0)
+			{ // Image_WriteTGA swapped red and blue in place
+				for (j = 0; j < rowbytes * job->height; j += 3)
+				{
+					temp = job->buffer[j];
+					job->buffer[j] = job->buffer[j+2];
+					job->buffer[j+2] = temp;
+				}
+			}
+			q_snprintf (name, sizeof(name), job->req.name, job->req.firstframe + i);
+			job->ok = Image_WriteTGA (name, job->buffer, job->width, job->height, 24, false);
+			break;
+		case CAPTURE_PNG:
+			q_snprintf (name, sizeof(name), job->req.name, job->req.firstframe + i);
+			job->ok = Image_WritePNG (name, job->buffer, job->width, job->height, 24, false);
+			break;
+		case CAPTURE_JPG:
+			q_snprintf (name, sizeof(name), job->req.name, job->req.firstframe + i);
+			job->ok = Image_WriteJPG (name, job->buffer, job->width, job->height, 24, job->req.quality, false);
+			break;
+		}
+	}
+}
+
+static void SCR_FinishCaptureJob (capturejob_t *job)
+{
+	Task_Wait (job->task);
+
+	if (job->req.screenshot)
+	{
+		if (job->ok)
+			Con_Printf ("Wrote %s\n", job->req.name);
+		else
+			Con_Printf ("SCR_ScreenShot_f: Couldn't create %s\n", job->req.name);
+	}
+	else if (!job->ok)
+		Con_Printf ("Couldn't write capture frame %i\n", job->req.firstframe);
+
+	free (job->buffer);
+	job->buffer = NULL;
+	job->active = false;
+}
+
+static void SCR_ReapCaptureJobs (qboolean wait)
+{
+	capturejob_t	*job;
+	int		i;
+
+	for (i = 0, job = capture_jobs; i < MAX_CAPTURE_JOBS; i++, job++)
+	{
+		if (job->active && (wait || Task_Done (job->task)))
+			SCR_FinishCaptureJob (job);
+	}
+}
+
+/*
+==================
+SCR_StartCaptureJob
+
+Takes ownership of buffer.  When every job is busy the oldest one is
+waited for, which stalls the frame but never drops it.
+==================
+*/
+static void SCR_StartCaptureJob (const capturereq_t *req, byte *buffer, int width, int height)
+{
+	capturejob_t	*job, *oldest;
+	int		i;
+
+	SCR_ReapCaptureJobs (false);
+
+	oldest = NULL;
+	for (i = 0, job = capture_jobs; i < MAX_CAPTURE_JOBS; i++, job++)
+	{
+		if (!job->active)
+			break;
+		if (!oldest || job->sequence - oldest->sequence < 0)
+			oldest = job;
+	}
+	if (i == MAX_CAPTURE_JOBS)
+	{
+		job = oldest;
+		SCR_FinishCaptureJob (job);
+	}
+
+	job->req = *req;
+	job->buffer = buffer;
+	job->width = width;
+	job->height = height;
+	job->ok = false;
+	job->active = true;
+	job->sequence = capture_jobsequence++;
+
+	if (req->format == CAPTURE_RAW)
+	{
+		job->task = Task_Run (SCR_CaptureJob, job, &capture_lastraw, 1);
+		capture_lastraw = job->task;
+	}
+	else
+		job->task = Task_Run (SCR_CaptureJob, job, NULL, 0);
+}
+
+static void SCR_MapCapturePBO (capturepbo_t *p)
+{
+	byte	*buffer, *data;
+	int	size;
+
+	p->pending = false;
+	size = p->width * p->height * 3;
+	if (!(buffer = (byte *) malloc (size)))
+	{
+		Con_Printf ("SCR_MapCapturePBO: Couldn't allocate memory\n");
+		return;
+	}
+
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER, p->pbo);
+	data = (byte *) GL_MapBufferFunc (GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (data)
+	{
+		memcpy (buffer, data, size);
+		GL_UnmapBufferFunc (GL_PIXEL_PACK_BUFFER);
+	}
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER, 0);
+
+	if (!data)
+	{
+		Con_Printf ("SCR_MapCapturePBO: Couldn't map the pixel buffer\n");
+		free (buffer);
+		return;
+	}
+
+	SCR_StartCaptureJob (&p->req, buffer, p->width, p->height);
+}
+
+static void SCR_FlushCapturePBOs (void)
+{
+	int	i;
+
+	// oldest first, so raw frames stay in order
+	for (i = 0; i < CAPTURE_PBOS; i++)
+	{
+		capturepbo_t *p = &capture_pbos[(capture_nextpbo + i) % CAPTURE_PBOS];
+		if (p->pending)
+			SCR_MapCapturePBO (p);
+	}
+}
+
+/*
+==================
+SCR_ReadPixels
+==================
+*/
+static void SCR_ReadPixels (const capturereq_t *req)
+{
+	capturepbo_t	*p;
+	byte		*buffer;
+	int		size;
+
+	size = glwidth * glheight * 3;
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);/* for widths that aren't a multiple of 4 */
+
+	if (!gl_pbo_able)
+	{
+		if (!(buffer = (byte *) malloc (size)))
+		{
+			Con_Printf ("SCR_ReadPixels: Couldn't allocate memory\n");
+			return;
+		}
+		glReadPixels (glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+		SCR_StartCaptureJob (req, buffer, glwidth, glheight);
+		return;
+	}
+
+	p = &capture_pbos[capture_nextpbo];
+	capture_nextpbo = (capture_nextpbo + 1) % CAPTURE_PBOS;
+	if (p->pending)
+		SCR_MapCapturePBO (p);	// more than one read a frame, this one waits
+
+	if (!p->pbo)
+		GL_GenBuffersFunc (1, &p->pbo);
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER, p->pbo);
+	if (p->size != size)
+	{
+		GL_BufferDataFunc (GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		p->size = size;
+	}
+	glReadPixels (glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE, (void *) 0);
+	GL_BindBufferFunc (GL_PIXEL_PACK_BUFFER, 0);
+
+	p->pending = true;
+	p->frame = capture_framecount;
+	p->width = glwidth;
+	p->height = glheight;
+	p->req = *req;
+}
+
+static void SCR_CaptureStop (void)
+{
+	if (!capture_active)
+		return;
+	capture_active = false;
+
+	SCR_FlushCapturePBOs ();
+	SCR_ReapCaptureJobs (true);
+
+	if (capture_rawfile)
+	{
+		fclose (capture_rawfile);
+		capture_rawfile = NULL;
+	}
+	capture_lastraw = 0;
+
+	Con_Printf ("Captured %i frames\n", capture_req.firstframe);
+}
+
+/*
+==================
+SCR_CaptureFrame
+
+Called once the frame is complete, before it is swapped.
+==================
+*/
+void SCR_CaptureFrame (void)
+{
+	capturepbo_t	*p;
+	double		fps;
+	int		i, n;
+
+	SCR_ReapCaptureJobs (false);
+
+	for (i = 0, p = capture_pbos; i < CAPTURE_PBOS; i++, p++)
+	{
+		if (p->pending && capture_framecount - p->frame >= CAPTURE_PBOS - 1)
+			SCR_MapCapturePBO (p);
+	}
+
+	if (screenshot_pending)
+	{
+		screenshot_pending = false;
+		SCR_ReadPixels (&screenshot_req);
+	}
+
+	if (capture_active)
+	{
+		fps = CLAMP (1, capture_fps.value, 1000);
+		capture_time += host_frametime;
+
+		if (glwidth != capture_width || glheight != capture_height)
+		{
+			Con_Printf ("Window size changed, stopping capture\n");
+			SCR_CaptureStop ();
+		}
+		else if (capture_time >= capture_nexttime)
+		{
+			// repeat the frame for every capture_fps tick it covers
+			n = 1 + (int)((capture_time - capture_nexttime) * fps);
+			n = q_min (n, MAX_CAPTURE_REPEAT);
+			capture_req.numframes = n;
+			SCR_ReadPixels (&capture_req);
+			capture_req.firstframe += n;
+			capture_nexttime += n / fps;
+			if (capture_nexttime < capture_time)
+				capture_nexttime = capture_time;	// too far behind, start over from here
+		}
+	}
+
+	capture_framecount++;
+}
+
+/*
+==================
+SCR_CaptureFinish
+
+Stops capture_start and waits for everything to be written.
+==================
+*/
+void SCR_CaptureFinish (void)
+{
+	SCR_CaptureStop ();
+	SCR_FlushCapturePBOs ();
+	SCR_ReapCaptureJobs (true);
+}
+
+/*
+==================
+SCR_DeleteCaptureBuffers
+
+For vid_restart, pending reads are written out first.
+==================
+*/
+void SCR_DeleteCaptureBuffers (void)
+{
+	int	i;
+
+	SCR_FlushCapturePBOs ();
+	for (i = 0; i < CAPTURE_PBOS; i++)
+	{
+		if (capture_pbos[i].pbo)
+			GL_DeleteBuffersFunc (1, &capture_pbos[i].pbo);
+		capture_pbos[i].pbo = 0;
+		capture_pbos[i].size = 0;
+	}
+}
+
+static qboolean SCR_ParseCaptureFormat (const char *s, captureformat_t *format)
+{
+	if (!q_strcasecmp (s, "tga"))
+		*format = CAPTURE_TGA;
+	else if (!q_strcasecmp (s, "png"))
+		*format = CAPTURE_PNG;
+	else if (!q_strcasecmp (s, "jpg"))
+		*format = CAPTURE_JPG;
+	else
+		return false;
+	return true;
+}
+
 static void SCR_ScreenShot_Usage (void)
 {
 	Con_Printf ("usage: screenshot <format> <quality>\n");
@@ -773,28 +1388,30 @@ static void SCR_ScreenShot_Usage (void)
 /*
 ==================
 SCR_ScreenShot_f -- johnfitz -- rewritten to use Image_WriteTGA
+
+The shot is taken at the end of the next frame and written in the background.
 ==================
 */
 void SCR_ScreenShot_f (void)
 {
-	byte	*buffer;
-	char	ext[4];
-	char	imagename[16];  //johnfitz -- was [80]
+	captureformat_t	format;
+	const char	*ext;
 	char	checkname[MAX_OSPATH];
 	int	i, quality;
-	qboolean	ok;
 
-	Q_strncpy (ext, "png", sizeof(ext));
+	if (screenshot_pending)
+	{
+		Con_Printf ("A screenshot is already pending\n");
+		return;
+	}
+
+	ext = "png";
+	format = CAPTURE_PNG;
 
 	if (Cmd_Argc () >= 2)
 	{
-		const char	*requested_ext = Cmd_Argv (1);
-
-		if (!q_strcasecmp ("png", requested_ext)
-		    || !q_strcasecmp ("tga", requested_ext)
-		    || !q_strcasecmp ("jpg", requested_ext))
-			Q_strncpy (ext, requested_ext, sizeof(ext));
-		else
+		ext = Cmd_Argv (1);
+		if (!SCR_ParseCaptureFormat (ext, &format))
 		{
 			SCR_ScreenShot_Usage ();
 			return;
@@ -810,12 +1427,12 @@ void SCR_ScreenShot_f (void)
 		SCR_ScreenShot_Usage ();
 		return;
 	}
-	
-// find a file name to save it to
-	for (i=0; i<10000; i++)
+
+// find a file name to save it to, skipping the ones still being written
+	for (i = screenshot_num; i < 10000; i++)
 	{
-		q_snprintf (imagename, sizeof(imagename), "spasm%04i.%s", i, ext);	// "fitz%04i.tga"
-		q_snprintf (checkname, sizeof(checkname), "%s/%s", com_gamedir, imagename);
+		q_snprintf (screenshot_req.name, sizeof(screenshot_req.name), "spasm%04i.%s", i, ext);	// "fitz%04i.tga"
+		q_snprintf (checkname, sizeof(checkname), "%s/%s", com_gamedir, screenshot_req.name);
 		if (Sys_FileTime(checkname) == -1)
 			break;	// file doesn't exist
 	}
@@ -824,33 +1441,91 @@ void SCR_ScreenShot_f (void)
 		Con_Printf ("SCR_ScreenShot_f: Couldn't find an unused filename\n");
 		return;
 	}
+	screenshot_num = i + 1;
+
+	screenshot_req.format = format;
+	screenshot_req.quality = quality;
+	screenshot_req.firstframe = 0;
+	screenshot_req.numframes = 1;
+	screenshot_req.screenshot = true;
+	screenshot_pending = true;
+}
+
+/*
+==================
+SCR_CaptureStart_f
+
+capture_start [name] [tga|png|jpg|raw]
 
-//get data
-	if (!(buffer = (byte *) malloc(glwidth*glheight*3)))
+Writes a frame every 1/capture_fps seconds of game time, to name_NNNNNN.ext
+or, for raw, as top-down RGB24 frames appended to name.rgb.
+==================
+*/
+static void SCR_CaptureStart_f (void)
+{
+	const char	*name;
+	char		path[MAX_OSPATH];
+
+	if (capture_active)
 	{
-		Con_Printf ("SCR_ScreenShot_f: Couldn't allocate memory\n");
+		Con_Printf ("Already capturing, use capture_stop first\n");
 		return;
 	}
+	if (cls.state == ca_dedicated)
+		return;
 
-	glPixelStorei (GL_PACK_ALIGNMENT, 1);/* for widths that aren't a multiple of 4 */
-	glReadPixels (glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE, buffer);
-
-// now write the file
-	if (!q_strncasecmp (ext, "png", sizeof(ext)))
-		ok = Image_WritePNG (imagename, buffer, glwidth, glheight, 24, false);
-	else if (!q_strncasecmp (ext, "tga", sizeof(ext)))
-		ok = Image_WriteTGA (imagename, buffer, glwidth, glheight, 24, false);
-	else if (!q_strncasecmp (ext, "jpg", sizeof(ext)))
-		ok = Image_WriteJPG (imagename, buffer, glwidth, glheight, 24, quality, false);
-	else
-		ok = false;
+	name = (Cmd_Argc () >= 2) ? Cmd_Argv (1) : "capture";
+	if (!*name || strchr (name, '%') || strstr (name, ".."))
+	{
+		Con_Printf ("Bad capture name \"%s\"\n", name);
+		return;
+	}
 
-	if (ok)
-		Con_Printf ("Wrote %s\n", imagename);
+	memset (&capture_req, 0, sizeof(capture_req));
+	capture_req.format = CAPTURE_TGA;
+	capture_req.quality = 90;
+	if (Cmd_Argc () >= 3 && q_strcasecmp (Cmd_Argv (2), "raw")
+		&& !SCR_ParseCaptureFormat (Cmd_Argv (2), &capture_req.format))
+	{
+		Con_Printf ("usage: capture_start [name] [tga|png|jpg|raw]\n");
+		return;
+	}
+
+	if (Cmd_Argc () >= 3 && !q_strcasecmp (Cmd_Argv (2), "raw"))
+	{
+		Sys_mkdir (com_gamedir);
+		q_snprintf (path, sizeof(path), "%s/%s.rgb", com_gamedir, name);
+		if (!(capture_rawfile = fopen (path, "wb")))
+		{
+			Con_Printf ("Couldn't open %s\n", path);
+			return;
+		}
+		capture_req.format = CAPTURE_RAW;
+		q_snprintf (capture_req.name, sizeof(capture_req.name), "%s.rgb", name);
+		Con_Printf ("Capturing %ix%i RGB24 at %g fps to %s.rgb\n", glwidth, glheight, CLAMP (1, capture_fps.value, 1000), name);
+	}
 	else
-		Con_Printf ("SCR_ScreenShot_f: Couldn't create %s\n", imagename);
+	{
+		q_snprintf (capture_req.name, sizeof(capture_req.name), "%s_%%06i.%s", name,
+			capture_req.format == CAPTURE_PNG ? "png" : capture_req.format == CAPTURE_JPG ? "jpg" : "tga");
+		Con_Printf ("Capturing at %g fps to %s_NNNNNN\n", CLAMP (1, capture_fps.value, 1000), name);
+	}
+
+	capture_width = glwidth;
+	capture_height = glheight;
+	capture_time = capture_nexttime = 0;
+	capture_lastraw = 0;
+	capture_active = true;
+}
 
-	free (buffer);
+static void SCR_CaptureStop_f (void)
+{
+	if (!capture_active)
+	{
+		Con_Printf ("Not capturing\n");
+		return;
+	}
+	SCR_CaptureStop ();
 }
 
 
@@ -1053,6 +1728,7 @@ needs almost the entire 256k of stack space!
 */
 void SCR_UpdateScreen (void)
 {
+	scr_swaptime = 0;
 	vid.numpages = (gl_triplebuffer.value) ? 3 : 2;
 
 	if (scr_disabled_for_loading)
@@ -1072,6 +1748,8 @@ void SCR_UpdateScreen (void)
 
 	GL_BeginRendering (&glx, &gly, &glwidth, &glheight);
 
+	GL_TimerFrame ();
+
 	//
 	// determine size of refresh window
 	//
@@ -1083,8 +1761,11 @@ void SCR_UpdateScreen (void)
 //
 	SCR_SetUpToDrawConsole ();
 
+	TexMgr_StreamTextures ();	// what became visible last frame
+
 	V_RenderView ();
 
+	GL_TimerBegin (GPU_2D);
 	GL_Set2D ();
 
 	//FIXME: only call this when needed
@@ -1123,16 +1804,30 @@ void SCR_UpdateScreen (void)
 		SCR_CheckDrawCenterString ();
 		Sbar_Draw ();
 		SCR_DrawDevStats (); //johnfitz
+		SCR_DrawMemStats ();
+		SCR_DrawGPUTimes ();
+		SCR_DrawNetGraph ();
 		SCR_DrawFPS (); //johnfitz
+		SCR_DrawDynamicScale ();
+		SCR_DrawSoundStats ();
 		SCR_DrawClock (); //johnfitz
 		SCR_DrawConsole ();
 		M_Draw ();
 	}
 
+	Draw_Flush ();
+	GL_TimerEnd (GPU_2D);
+
 	V_UpdateBlend (); //johnfitz -- V_UpdatePalette cleaned up and renamed
 
+	GL_TimerBegin (GPU_POST);
 	GLSLGamma_GammaCorrect ();
+	GL_TimerEnd (GPU_POST);
+
+	SCR_CaptureFrame ();
 
+	scr_swaptime = Sys_DoubleTime ();
 	GL_EndRendering ();
+	scr_swaptime = Sys_DoubleTime () - scr_swaptime;
 }
 
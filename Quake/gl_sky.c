@@ -79,6 +79,10 @@ int	vec_to_st[6][3] =
 
 float	skyfog; // ericw
 
+static qboolean	sky_needbounds;	// legacy cloud layers need the clipped sky bounds
+
+static GLuint	r_skybox_program;	// samples the skybox cube map, see GLSky_CreateShaders
+
 //==============================================================================
 //
 //  INIT
@@ -208,23 +212,201 @@ void Sky_LoadTextureQ64 (texture_t *mt)
 	skyflatcolor[2] = (float)b/(count*255);
 }
 
+const char	*suf[6] = {"rt", "bk", "lf", "ft", "up", "dn"};
+
 /*
 ==================
-Sky_LoadSkyBox
+Sky_AxisForVec
+
+The skybox face a direction points into, as Sky_ProjectPoly numbers them
 ==================
 */
-const char	*suf[6] = {"rt", "bk", "lf", "ft", "up", "dn"};
-void Sky_LoadSkyBox (const char *name)
+static int Sky_AxisForVec (const vec3_t v)
 {
-	int		i, mark, width, height;
-	char	filename[MAX_OSPATH];
-	byte	*data;
-	qboolean nonefound = true;
+	vec3_t	av;
 
-	if (strcmp(skybox_name, name) == 0)
-		return; //no change
+	av[0] = fabs(v[0]);
+	av[1] = fabs(v[1]);
+	av[2] = fabs(v[2]);
+	if (av[0] > av[1] && av[0] > av[2])
+		return (v[0] < 0) ? 1 : 0;
+	else if (av[1] > av[2] && av[1] > av[0])
+		return (v[1] < 0) ? 3 : 2;
+	else
+		return (v[2] < 0) ? 5 : 4;
+}
+
+/*
+==================
+Sky_VecToST
+
+Projects v onto the face axis in the [-1,1] coordinates Sky_EmitSkyBoxVertex uses
+==================
+*/
+static void Sky_VecToST (const vec3_t v, int axis, float *s, float *t)
+{
+	int		j;
+	float	dv;
+
+	j = vec_to_st[axis][2];
+	if (j > 0)
+		dv = v[j - 1];
+	else
+		dv = -v[-j - 1];
+
+	j = vec_to_st[axis][0];
+	if (j < 0)
+		*s = -v[-j -1] / dv;
+	else
+		*s = v[j-1] / dv;
+	j = vec_to_st[axis][1];
+	if (j < 0)
+		*t = -v[-j -1] / dv;
+	else
+		*t = v[j-1] / dv;
+}
+
+//==============================================================================
+//
+//  SKYBOX LOADING
+//
+//==============================================================================
+
+// the faces are decoded on a worker, and when they are all the same square
+// size they are rearranged into one cube map there too, sampled by direction
+// in the sky shader instead of being drawn as six textured quads
+
+typedef struct
+{
+	char		name[1024];
+	qboolean	pending;
+	qboolean	wait;			// loaded with the map, don't show a frame of clouds
+	FILE		*file[6];		// opened on the main thread, in suf order
+	int			filesize[6];
+	qboolean	pcx[6];
+	byte		*data[6];		// malloced RGBA
+	int			width[6], height[6];
+	const char	*error[6];
+	byte		*cube;			// six size*size faces, GL_TEXTURE_CUBE_MAP_POSITIVE_X first
+	int			size;
+	task_t		task;
+} skyboxload_t;
+
+static skyboxload_t	skybox_load;
+
+static GLuint	skybox_cubemap;
+static char		skybox_lostname[1024];	// see Sky_DeleteCubeMap
+
+/*
+==================
+Sky_BuildCubeFace
+
+Fills one GL cube map face from the Quake faces. Both are axis aligned
+grids of the same size, so every texel center lands on a texel center.
+==================
+*/
+static void Sky_BuildCubeFace (skyboxload_t *l, int face, byte *out)
+{
+	int		x, y, n, axis, row, col;
+	float	sc, tc, s, t;
+	vec3_t	v;
+
+	n = l->size;
+	for (y=0 ; y<n ; y++)
+	{
+		tc = 2.0 * (y + 0.5) / n - 1.0;
+		for (x=0 ; x<n ; x++, out+=4)
+		{
+			sc = 2.0 * (x + 0.5) / n - 1.0;
+
+			// the direction GL looks this texel up with
+			switch (face)
+			{
+			case 0:	v[0] = 1;	v[1] = -tc;	v[2] = -sc;	break;
+			case 1:	v[0] = -1;	v[1] = -tc;	v[2] = sc;	break;
+			case 2:	v[0] = sc;	v[1] = 1;	v[2] = tc;	break;
+			case 3:	v[0] = sc;	v[1] = -1;	v[2] = -tc;	break;
+			case 4:	v[0] = sc;	v[1] = -tc;	v[2] = 1;	break;
+			default:v[0] = -sc;	v[1] = -tc;	v[2] = -1;	break;
+			}
+
+			axis = Sky_AxisForVec (v);
+			Sky_VecToST (v, axis, &s, &t);
+			col = CLAMP (0, (int)((s + 1) * 0.5 * n), n - 1);
+			row = CLAMP (0, (int)((1 - t) * 0.5 * n), n - 1);
+			memcpy (out, l->data[skytexorder[axis]] + (row * n + col) * 4, 4);
+		}
+	}
+}
+
+static void Sky_LoadSkyBoxTask (void *data)
+{
+	skyboxload_t	*l = (skyboxload_t *) data;
+	int				i;
+
+	for (i=0 ; i<6 ; i++)
+	{
+		if (!l->file[i])
+			continue;
+		l->data[i] = Image_DecodeFile (l->file[i], l->filesize[i], l->pcx[i], &l->width[i], &l->height[i], &l->error[i]);
+		l->file[i] = NULL;
+	}
+
+	l->size = l->width[0];
+	for (i=0 ; i<6 ; i++)
+	{
+		if (!l->data[i] || l->width[i] != l->size || l->height[i] != l->size)
+			return;
+	}
+
+	l->cube = (byte *) malloc (6 * l->size * l->size * 4);
+	if (!l->cube)
+		return;
+	for (i=0 ; i<6 ; i++)
+		Sky_BuildCubeFace (l, i, l->cube + i * l->size * l->size * 4);
+}
+
+/*
+==================
+Sky_FreeSkyBoxLoad
+==================
+*/
+static void Sky_FreeSkyBoxLoad (void)
+{
+	int		i;
+
+	for (i=0 ; i<6 ; i++)
+	{
+		if (skybox_load.file[i])
+			fclose (skybox_load.file[i]);
+		free (skybox_load.data[i]);
+	}
+	free (skybox_load.cube);
+	memset (&skybox_load, 0, sizeof(skybox_load));
+}
+
+/*
+==================
+Sky_CancelSkyBoxLoad
+==================
+*/
+static void Sky_CancelSkyBoxLoad (void)
+{
+	if (!skybox_load.pending)
+		return;
+	Task_Wait (skybox_load.task);
+	Sky_FreeSkyBoxLoad ();
+}
+
+/*
+==================
+Sky_FreeSkyBox
+==================
+*/
+static void Sky_FreeSkyBox (void)
+{
+	int		i;
 
-	//purge old textures
 	for (i=0; i<6; i++)
 	{
 		if (skybox_textures[i] && skybox_textures[i] != notexture)
@@ -232,45 +414,204 @@ void Sky_LoadSkyBox (const char *name)
 		skybox_textures[i] = NULL;
 	}
 
+	if (skybox_cubemap)
+	{
+		glDeleteTextures (1, &skybox_cubemap);
+		skybox_cubemap = 0;
+		gl_memory[GLMEM_SKYBOX] = 0;
+	}
+
+	skybox_name[0] = 0;
+}
+
+/*
+==================
+Sky_UploadCubeMap
+==================
+*/
+static void Sky_UploadCubeMap (void)
+{
+	int		i, facebytes;
+
+	facebytes = skybox_load.size * skybox_load.size * 4;
+
+	glGenTextures (1, &skybox_cubemap);
+	glBindTexture (GL_TEXTURE_CUBE_MAP, skybox_cubemap);
+	TexMgr_SetCubeMapFilterModes ();
+	glTexParameteri (GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	for (i=0 ; i<6 ; i++)
+		glTexImage2D (GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, skybox_load.size, skybox_load.size, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, skybox_load.cube + i * facebytes);
+	glBindTexture (GL_TEXTURE_CUBE_MAP, 0);
+
+	gl_memory[GLMEM_SKYBOX] = 6 * facebytes;
+}
+
+/*
+==================
+Sky_FinishSkyBoxLoad
+
+Swaps the loaded faces in for the current skybox
+==================
+*/
+static void Sky_FinishSkyBoxLoad (void)
+{
+	int		i;
+	char	filename[MAX_OSPATH];
+	qboolean nonefound = true;
+	GLint	maxsize;
+
+	Task_Wait (skybox_load.task);
+
+	Sky_FreeSkyBox ();
+
+	for (i=0; i<6; i++)
+	{
+		q_snprintf (filename, sizeof(filename), "gfx/env/%s%s", skybox_load.name, suf[i]);
+		if (!skybox_load.data[i] && skybox_load.error[i])
+		{
+			Con_Printf ("Couldn't load %s: ", filename);
+			Con_Printf (skybox_load.error[i], filename);
+			Con_Printf ("\n");
+		}
+	}
+
+	// too big a cube map goes back to the texture manager, which scales faces down
+	maxsize = 0;
+	if (skybox_load.cube && r_skybox_program)
+		glGetIntegerv (GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxsize);
+
+	if (skybox_load.cube && skybox_load.size <= maxsize)
+	{
+		Sky_UploadCubeMap ();
+		nonefound = false;
+	}
+	else
+	{
+		for (i=0; i<6; i++)
+		{
+			q_snprintf (filename, sizeof(filename), "gfx/env/%s%s", skybox_load.name, suf[i]);
+			if (skybox_load.data[i])
+			{
+				skybox_textures[i] = TexMgr_LoadImage (cl.worldmodel, filename, skybox_load.width[i], skybox_load.height[i],
+						SRC_RGBA, skybox_load.data[i], filename, 0, TEXPREF_NONE);
+				nonefound = false;
+			}
+			else
+				skybox_textures[i] = notexture;
+		}
+	}
+
+	// go back to scrolling sky if skybox is totally missing
+	if (nonefound)
+		Sky_FreeSkyBox ();
+	else
+		q_strlcpy (skybox_name, skybox_load.name, sizeof(skybox_name));
+
+	Sky_FreeSkyBoxLoad ();
+}
+
+/*
+==================
+Sky_LoadSkyBox
+
+The files are found now and decoded on a worker, the old skybox stays up
+until Sky_DrawSky sees the new one is done.
+==================
+*/
+void Sky_LoadSkyBox (const char *name)
+{
+	int		i;
+	char	filename[MAX_OSPATH];
+	qboolean nonefound = true;
+
+	if (strcmp(skybox_load.pending ? skybox_load.name : skybox_name, name) == 0)
+		return; //no change
+
+	Sky_CancelSkyBoxLoad ();
+
 	//turn off skybox if sky is set to ""
 	if (name[0] == 0)
 	{
-		skybox_name[0] = 0;
+		Sky_FreeSkyBox ();
 		return;
 	}
 
-	//load textures
 	for (i=0; i<6; i++)
 	{
-		mark = Hunk_LowMark ();
 		q_snprintf (filename, sizeof(filename), "gfx/env/%s%s", name, suf[i]);
-		data = Image_LoadImage (filename, &width, &height);
-		if (data)
-		{
-			skybox_textures[i] = TexMgr_LoadImage (cl.worldmodel, filename, width, height, SRC_RGBA, data, filename, 0, TEXPREF_NONE);
+		skybox_load.file[i] = Image_OpenImage (filename, &skybox_load.pcx[i], &skybox_load.filesize[i]);
+		if (skybox_load.file[i])
 			nonefound = false;
-		}
 		else
-		{
 			Con_Printf ("Couldn't load %s\n", filename);
-			skybox_textures[i] = notexture;
-		}
-		Hunk_FreeToLowMark (mark);
 	}
 
 	if (nonefound) // go back to scrolling sky if skybox is totally missing
 	{
-		for (i=0; i<6; i++)
-		{
-			if (skybox_textures[i] && skybox_textures[i] != notexture)
-				TexMgr_FreeTexture (skybox_textures[i]);
-			skybox_textures[i] = NULL;
-		}
-		skybox_name[0] = 0;
+		Sky_FreeSkyBox ();
 		return;
 	}
 
-	q_strlcpy(skybox_name, name, sizeof(skybox_name));
+	q_strlcpy (skybox_load.name, name, sizeof(skybox_load.name));
+	skybox_load.pending = true;
+	skybox_load.task = Task_Run (Sky_LoadSkyBoxTask, &skybox_load, NULL, 0);
+}
+
+/*
+==================
+Sky_SetCubeMapFilterModes -- called when gl_texturemode changes
+==================
+*/
+void Sky_SetCubeMapFilterModes (void)
+{
+	if (!skybox_cubemap)
+		return;
+	glBindTexture (GL_TEXTURE_CUBE_MAP, skybox_cubemap);
+	TexMgr_SetCubeMapFilterModes ();
+	glBindTexture (GL_TEXTURE_CUBE_MAP, 0);
+}
+
+/*
+==================
+Sky_DeleteCubeMap
+
+The cube map isn't a managed texture, so when vid_restart loses the context
+it's loaded again from the files by Sky_ReloadCubeMap.
+==================
+*/
+void Sky_DeleteCubeMap (void)
+{
+	skybox_lostname[0] = 0;
+	if (skybox_load.pending)
+	{
+		q_strlcpy (skybox_lostname, skybox_load.name, sizeof(skybox_lostname));
+		Sky_CancelSkyBoxLoad ();
+	}
+
+	if (!skybox_cubemap)
+		return;
+	if (!skybox_lostname[0])
+		q_strlcpy (skybox_lostname, skybox_name, sizeof(skybox_lostname));
+	glDeleteTextures (1, &skybox_cubemap);
+	skybox_cubemap = 0;
+	gl_memory[GLMEM_SKYBOX] = 0;
+	skybox_name[0] = 0;
+}
+
+/*
+==================
+Sky_ReloadCubeMap
+==================
+*/
+void Sky_ReloadCubeMap (void)
+{
+	if (!skybox_lostname[0])
+		return;
+	Sky_LoadSkyBox (skybox_lostname);
+	skybox_load.wait = skybox_load.pending;
+	skybox_lostname[0] = 0;
 }
 
 /*
@@ -284,6 +625,14 @@ void Sky_ClearAll (void)
 {
 	int i;
 
+	Sky_CancelSkyBoxLoad ();
+	if (skybox_cubemap)
+	{
+		glDeleteTextures (1, &skybox_cubemap);
+		skybox_cubemap = 0;
+		gl_memory[GLMEM_SKYBOX] = 0;
+	}
+
 	skybox_name[0] = 0;
 	for (i=0; i<6; i++)
 		skybox_textures[i] = NULL;
@@ -347,6 +696,9 @@ void Sky_NewMap (void)
 			Sky_LoadSkyBox(value);
 #endif
 	}
+
+	// the first frame shouldn't show the clouds for a moment
+	skybox_load.wait = skybox_load.pending;
 }
 
 /*
@@ -417,9 +769,9 @@ update sky bounds
 */
 void Sky_ProjectPoly (int nump, vec3_t vecs)
 {
-	int		i,j;
-	vec3_t	v, av;
-	float	s, t, dv;
+	int		i;
+	vec3_t	v;
+	float	s, t;
 	int		axis;
 	float	*vp;
 
@@ -429,50 +781,12 @@ void Sky_ProjectPoly (int nump, vec3_t vecs)
 	{
 		VectorAdd (vp, v, v);
 	}
-	av[0] = fabs(v[0]);
-	av[1] = fabs(v[1]);
-	av[2] = fabs(v[2]);
-	if (av[0] > av[1] && av[0] > av[2])
-	{
-		if (v[0] < 0)
-			axis = 1;
-		else
-			axis = 0;
-	}
-	else if (av[1] > av[2] && av[1] > av[0])
-	{
-		if (v[1] < 0)
-			axis = 3;
-		else
-			axis = 2;
-	}
-	else
-	{
-		if (v[2] < 0)
-			axis = 5;
-		else
-			axis = 4;
-	}
+	axis = Sky_AxisForVec (v);
 
 	// project new texture coords
 	for (i=0 ; i<nump ; i++, vecs+=3)
 	{
-		j = vec_to_st[axis][2];
-		if (j > 0)
-			dv = vecs[j - 1];
-		else
-			dv = -vecs[-j - 1];
-
-		j = vec_to_st[axis][0];
-		if (j < 0)
-			s = -vecs[-j -1] / dv;
-		else
-			s = vecs[j-1] / dv;
-		j = vec_to_st[axis][1];
-		if (j < 0)
-			t = -vecs[-j -1] / dv;
-		else
-			t = vecs[j-1] / dv;
+		Sky_VecToST (vecs, axis, &s, &t);
 
 		if (s < skymins[0][axis])
 			skymins[0][axis] = s;
@@ -596,7 +910,7 @@ void Sky_ProcessPoly (glpoly_t	*p)
 	rs_brushpasses++;
 
 	//update sky bounds
-	if (!r_fastsky.value)
+	if (sky_needbounds)
 	{
 		for (i=0 ; i<p->numverts ; i++)
 			VectorSubtract (p->verts[i], r_origin, verts[i]);
@@ -614,10 +928,14 @@ void Sky_ProcessTextureChains (void)
 	int			i;
 	msurface_t	*s;
 	texture_t	*t;
+	qboolean	batched;
 
 	if (!r_drawworld_cheatsafe)
 		return;
 
+	// without bounds to update the world's sky polys come straight from the VBO
+	batched = !sky_needbounds && R_BeginPolyBatch ();
+
 	for (i=0 ; i<cl.worldmodel->numtextures ; i++)
 	{
 		t = cl.worldmodel->textures[i];
@@ -626,8 +944,19 @@ void Sky_ProcessTextureChains (void)
 			continue;
 
 		for (s = t->texturechains[chain_world]; s; s = s->texturechain)
-			Sky_ProcessPoly (s->polys);
+		{
+			if (batched)
+			{
+				R_BatchSurface (s);
+				rs_brushpasses++;
+			}
+			else
+				Sky_ProcessPoly (s->polys);
+		}
 	}
+
+	if (batched)
+		R_EndPolyBatch ();
 }
 
 /*
@@ -658,6 +987,9 @@ void Sky_ProcessEntities (void)
 		if (R_CullModelForEntity(e))
 			continue;
 
+		if (e->mergedframe == r_framecount) // in the world chains
+			continue;
+
 		if (e->alpha == ENTALPHA_ZERO)
 			continue;
 
@@ -724,7 +1056,7 @@ void Sky_ProcessEntities (void)
 Sky_EmitSkyBoxVertex
 ==============
 */
-void Sky_EmitSkyBoxVertex (float s, float t, int axis)
+void Sky_EmitSkyBoxVertex (float s, float t, int axis, streamvert_t *out)
 {
 	vec3_t		v, b;
 	int			j, k;
@@ -755,40 +1087,40 @@ void Sky_EmitSkyBoxVertex (float s, float t, int axis)
 	t = t * (h-1)/h + 0.5/h;
 
 	t = 1.0 - t;
-	glTexCoord2f (s, t);
-	glVertex3fv (v);
+	VectorCopy (v, out->xyz);
+	out->st[0] = s;
+	out->st[1] = t;
 }
 
 /*
 ==============
 Sky_DrawSkyBox
-
-FIXME: eliminate cracks by adding an extra vert on tjuncs
 ==============
 */
 void Sky_DrawSkyBox (void)
 {
-	int i;
+	streamvert_t	*sv;
+	int		i;
 
+	if (!skybox_textures[0]) // a cube map without the shader to sample it
+		return;
+
+	// all six faces are drawn whole, the depth test against the sky
+	// surfaces does the clipping
 	for (i=0 ; i<6 ; i++)
 	{
-		if (skymins[0][i] >= skymaxs[0][i] || skymins[1][i] >= skymaxs[1][i])
-			continue;
-
 		GL_Bind (skybox_textures[skytexorder[i]]);
 
-#if 1 /* FIXME: this is to avoid tjunctions until i can do it the right way */
 		skymins[0][i] = -1;
 		skymins[1][i] = -1;
 		skymaxs[0][i] = 1;
 		skymaxs[1][i] = 1;
-#endif
-		glBegin (GL_QUADS);
-		Sky_EmitSkyBoxVertex (skymins[0][i], skymins[1][i], i);
-		Sky_EmitSkyBoxVertex (skymins[0][i], skymaxs[1][i], i);
-		Sky_EmitSkyBoxVertex (skymaxs[0][i], skymaxs[1][i], i);
-		Sky_EmitSkyBoxVertex (skymaxs[0][i], skymins[1][i], i);
-		glEnd ();
+		sv = GL_StreamVerts (4);
+		Sky_EmitSkyBoxVertex (skymins[0][i], skymins[1][i], i, &sv[0]);
+		Sky_EmitSkyBoxVertex (skymins[0][i], skymaxs[1][i], i, &sv[1]);
+		Sky_EmitSkyBoxVertex (skymaxs[0][i], skymaxs[1][i], i, &sv[2]);
+		Sky_EmitSkyBoxVertex (skymaxs[0][i], skymins[1][i], i, &sv[3]);
+		GL_DrawStreamVerts (GL_QUADS, 4, STREAM_TEXCOORDS);
 
 		rs_skypolys++;
 		rs_skypasses++;
@@ -802,12 +1134,12 @@ void Sky_DrawSkyBox (void)
 			glDisable (GL_TEXTURE_2D);
 			glColor4f (c[0],c[1],c[2], CLAMP(0.0,skyfog,1.0));
 
-			glBegin (GL_QUADS);
-			Sky_EmitSkyBoxVertex (skymins[0][i], skymins[1][i], i);
-			Sky_EmitSkyBoxVertex (skymins[0][i], skymaxs[1][i], i);
-			Sky_EmitSkyBoxVertex (skymaxs[0][i], skymaxs[1][i], i);
-			Sky_EmitSkyBoxVertex (skymaxs[0][i], skymins[1][i], i);
-			glEnd ();
+			sv = GL_StreamVerts (4);
+			Sky_EmitSkyBoxVertex (skymins[0][i], skymins[1][i], i, &sv[0]);
+			Sky_EmitSkyBoxVertex (skymins[0][i], skymaxs[1][i], i, &sv[1]);
+			Sky_EmitSkyBoxVertex (skymaxs[0][i], skymaxs[1][i], i, &sv[2]);
+			Sky_EmitSkyBoxVertex (skymaxs[0][i], skymins[1][i], i, &sv[3]);
+			GL_DrawStreamVerts (GL_QUADS, 4, 0);
 
 			glColor3f (1, 1, 1);
 			glEnable (GL_TEXTURE_2D);
@@ -880,7 +1212,7 @@ Sky_DrawFaceQuad
 */
 void Sky_DrawFaceQuad (glpoly_t *p)
 {
-	float	s, t;
+	streamvert_t	*sv;
 	float	*v;
 	int		i;
 
@@ -891,16 +1223,14 @@ void Sky_DrawFaceQuad (glpoly_t *p)
 		GL_Bind (alphaskytexture);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
 
-		glBegin (GL_QUADS);
+		sv = GL_StreamVerts (4);
 		for (i=0, v=p->verts[0] ; i<4 ; i++, v+=VERTEXSIZE)
 		{
-			Sky_GetTexCoord (v, 8, &s, &t);
-			GL_MTexCoord2fFunc (GL_TEXTURE0_ARB, s, t);
-			Sky_GetTexCoord (v, 16, &s, &t);
-			GL_MTexCoord2fFunc (GL_TEXTURE1_ARB, s, t);
-			glVertex3fv (v);
+			VectorCopy (v, sv[i].xyz);
+			Sky_GetTexCoord (v, 8, &sv[i].st[0], &sv[i].st[1]);
+			Sky_GetTexCoord (v, 16, &sv[i].st2[0], &sv[i].st2[1]);
 		}
-		glEnd ();
+		GL_DrawStreamVerts (GL_QUADS, 4, STREAM_TEXCOORDS | STREAM_TEXCOORDS2);
 
 		GL_DisableMultitexture();
 
@@ -914,14 +1244,13 @@ void Sky_DrawFaceQuad (glpoly_t *p)
 		if (r_skyalpha.value < 1.0)
 			glColor3f (1, 1, 1);
 
-		glBegin (GL_QUADS);
+		sv = GL_StreamVerts (4);
 		for (i=0, v=p->verts[0] ; i<4 ; i++, v+=VERTEXSIZE)
 		{
-			Sky_GetTexCoord (v, 8, &s, &t);
-			glTexCoord2f (s, t);
-			glVertex3fv (v);
+			VectorCopy (v, sv[i].xyz);
+			Sky_GetTexCoord (v, 8, &sv[i].st[0], &sv[i].st[1]);
 		}
-		glEnd ();
+		GL_DrawStreamVerts (GL_QUADS, 4, STREAM_TEXCOORDS);
 
 		GL_Bind (alphaskytexture);
 		glEnable (GL_BLEND);
@@ -929,14 +1258,13 @@ void Sky_DrawFaceQuad (glpoly_t *p)
 		if (r_skyalpha.value < 1.0)
 			glColor4f (1, 1, 1, r_skyalpha.value);
 
-		glBegin (GL_QUADS);
+		sv = GL_StreamVerts (4);
 		for (i=0, v=p->verts[0] ; i<4 ; i++, v+=VERTEXSIZE)
 		{
-			Sky_GetTexCoord (v, 16, &s, &t);
-			glTexCoord2f (s, t);
-			glVertex3fv (v);
+			VectorCopy (v, sv[i].xyz);
+			Sky_GetTexCoord (v, 16, &sv[i].st[0], &sv[i].st[1]);
 		}
-		glEnd ();
+		GL_DrawStreamVerts (GL_QUADS, 4, STREAM_TEXCOORDS);
 
 		glDisable (GL_BLEND);
 
@@ -953,10 +1281,10 @@ void Sky_DrawFaceQuad (glpoly_t *p)
 		glDisable (GL_TEXTURE_2D);
 		glColor4f (c[0],c[1],c[2], CLAMP(0.0,skyfog,1.0));
 
-		glBegin (GL_QUADS);
+		sv = GL_StreamVerts (4);
 		for (i=0, v=p->verts[0] ; i<4 ; i++, v+=VERTEXSIZE)
-			glVertex3fv (v);
-		glEnd ();
+			VectorCopy (v, sv[i].xyz);
+		GL_DrawStreamVerts (GL_QUADS, 4, 0);
 
 		glColor3f (1, 1, 1);
 		glEnable (GL_TEXTURE_2D);
@@ -1046,6 +1374,211 @@ void Sky_DrawSkyLayers (void)
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 }
 
+//==============================================================================
+//
+//  SHADER SKY
+//
+//==============================================================================
+
+// the cloud layers looked up per pixel from the view direction while the sky
+// surfaces themselves are drawn, so no sky bounds or face quads are needed
+
+static GLuint r_sky_program;
+static GLint skySolidTexLoc;
+static GLint skyAlphaTexLoc;
+static GLint skyEyePosLoc;
+static GLint skyScrollLoc;
+static GLint skyAlphaLoc;
+static GLint skyFogLoc;
+
+static GLint skyboxTexLoc;
+static GLint skyboxEyePosLoc;
+static GLint skyboxFogLoc;
+
+/*
+=============
+GLSky_CreateShaders
+=============
+*/
+void GLSky_CreateShaders (void)
+{
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec3 EyePos;\n"
+		"\n"
+		"varying vec3 Dir;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	Dir = gl_Vertex.xyz - EyePos;\n"
+		"	gl_Position = ftransform();\n"
+		"}\n";
+
+	// Sky_GetTexCoord per pixel
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D SolidTex;\n"
+		"uniform sampler2D AlphaTex;\n"
+		"uniform vec4 Scroll;\n"
+		"uniform float Alpha;\n"
+		"uniform vec4 Fog;\n"
+		"\n"
+		"varying vec3 Dir;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	vec3 dir = Dir;\n"
+		"	dir.z *= 3.0;\n"
+		"	vec2 st = dir.xy * ((6.0 * 63.0 / 128.0) / length(dir));\n"
+		"	vec4 solid = texture2D(SolidTex, st + Scroll.x);\n"
+		"	vec4 front = texture2D(AlphaTex, st + Scroll.y);\n"
+		"	vec3 result = mix(solid.rgb, front.rgb, front.a * Alpha);\n"
+		"	result = mix(result, Fog.rgb, Fog.a);\n"
+		"	gl_FragColor = vec4(result, 1.0);\n"
+		"}\n";
+
+	// the cube map is laid out so the world space direction looks it up
+	const GLchar *skyboxFragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform samplerCube CubeTex;\n"
+		"uniform vec4 Fog;\n"
+		"\n"
+		"varying vec3 Dir;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	vec3 result = textureCube(CubeTex, Dir).rgb;\n"
+		"	result = mix(result, Fog.rgb, Fog.a);\n"
+		"	gl_FragColor = vec4(result, 1.0);\n"
+		"}\n";
+
+	r_sky_program = 0;
+	r_skybox_program = 0;
+
+	if (!gl_glsl_able)
+		return;
+
+	r_sky_program = GL_CreateProgram (vertSource, fragSource, 0, NULL);
+	if (r_sky_program)
+	{
+		skySolidTexLoc = GL_GetUniformLocation (&r_sky_program, "SolidTex");
+		skyAlphaTexLoc = GL_GetUniformLocation (&r_sky_program, "AlphaTex");
+		skyEyePosLoc = GL_GetUniformLocation (&r_sky_program, "EyePos");
+		skyScrollLoc = GL_GetUniformLocation (&r_sky_program, "Scroll");
+		skyAlphaLoc = GL_GetUniformLocation (&r_sky_program, "Alpha");
+		skyFogLoc = GL_GetUniformLocation (&r_sky_program, "Fog");
+	}
+
+	r_skybox_program = GL_CreateProgram (vertSource, skyboxFragSource, 0, NULL);
+	if (r_skybox_program)
+	{
+		skyboxTexLoc = GL_GetUniformLocation (&r_skybox_program, "CubeTex");
+		skyboxEyePosLoc = GL_GetUniformLocation (&r_skybox_program, "EyePos");
+		skyboxFogLoc = GL_GetUniformLocation (&r_skybox_program, "Fog");
+	}
+}
+
+/*
+=============
+GLSky_GetFog
+
+rgb and blend factor of the skyfog, all zero without fog
+=============
+*/
+static void GLSky_GetFog (float *fog)
+{
+	float	*c;
+
+	if (Fog_GetDensity() > 0 && skyfog > 0)
+	{
+		c = Fog_GetColor();
+		fog[0] = c[0];
+		fog[1] = c[1];
+		fog[2] = c[2];
+		fog[3] = CLAMP(0.0,skyfog,1.0);
+	}
+	else
+		fog[0] = fog[1] = fog[2] = fog[3] = 0;
+}
+
+/*
+=============
+GLSky_BeginShader
+
+Returns false if the cloud layers have to be drawn as face quads instead.
+=============
+*/
+static qboolean GLSky_BeginShader (void)
+{
+	float	scroll8, scroll16, fog[4];
+
+	if (!r_sky_program || !solidskytexture || !alphaskytexture)
+		return false;
+
+	scroll8 = cl.time*8;
+	scroll8 -= (int)scroll8 & ~127;
+	scroll16 = cl.time*16;
+	scroll16 -= (int)scroll16 & ~127;
+
+	GLSky_GetFog (fog);
+
+	GL_UseProgramFunc (r_sky_program);
+	GL_Uniform1iFunc (skySolidTexLoc, 0);
+	GL_Uniform1iFunc (skyAlphaTexLoc, 1);
+	GL_Uniform3fFunc (skyEyePosLoc, r_origin[0], r_origin[1], r_origin[2]);
+	GL_Uniform4fFunc (skyScrollLoc, scroll8/128, scroll16/128, 0, 0);
+	GL_Uniform1fFunc (skyAlphaLoc, CLAMP(0.0,r_skyalpha.value,1.0));
+	GL_Uniform4fvFunc (skyFogLoc, 1, fog);
+
+	GL_SelectTexture (GL_TEXTURE1);
+	GL_Bind (alphaskytexture);
+	GL_SelectTexture (GL_TEXTURE0);
+	GL_Bind (solidskytexture);
+
+	return true;
+}
+
+static void GLSky_EndShader (void)
+{
+	GL_UseProgramFunc (0);
+}
+
+/*
+=============
+GLSky_BeginSkyBoxShader
+
+Returns false if the skybox has to be drawn as face quads instead.
+=============
+*/
+static qboolean GLSky_BeginSkyBoxShader (void)
+{
+	float	fog[4];
+
+	if (!r_skybox_program || !skybox_cubemap)
+		return false;
+
+	GLSky_GetFog (fog);
+
+	GL_UseProgramFunc (r_skybox_program);
+	GL_Uniform1iFunc (skyboxTexLoc, 0);
+	GL_Uniform3fFunc (skyboxEyePosLoc, r_origin[0], r_origin[1], r_origin[2]);
+	GL_Uniform4fvFunc (skyboxFogLoc, 1, fog);
+
+	GL_SelectTexture (GL_TEXTURE0);
+	glBindTexture (GL_TEXTURE_CUBE_MAP, skybox_cubemap);
+
+	return true;
+}
+
+static void GLSky_EndSkyBoxShader (void)
+{
+	glBindTexture (GL_TEXTURE_CUBE_MAP, 0);
+	GL_UseProgramFunc (0);
+}
+
 /*
 ==============
 Sky_DrawSky
@@ -1056,11 +1589,45 @@ called once per frame before drawing anything else
 void Sky_DrawSky (void)
 {
 	int i;
+	qboolean slowsky;
+
+	if (skybox_load.pending && (skybox_load.wait || Task_Done (skybox_load.task)))
+		Sky_FinishSkyBoxLoad ();
 
 	//in these special render modes, the sky faces are handled in the normal world/brush renderer
 	if (r_drawflat_cheatsafe || r_lightmap_cheatsafe)
 		return;
 
+	slowsky = !r_fastsky.value && !(Fog_GetDensity() > 0 && skyfog >= 1);
+
+	Fog_DisableGFog ();
+
+	//
+	// cloud layers in a shader: the sky surfs are drawn textured directly
+	//
+	if (slowsky && !skybox_name[0] && GLSky_BeginShader ())
+	{
+		sky_needbounds = false;
+		Sky_ProcessTextureChains ();
+		Sky_ProcessEntities ();
+		GLSky_EndShader ();
+		Fog_EnableGFog ();
+		return;
+	}
+
+	//
+	// skybox cube map in a shader: likewise, one bind and no box faces
+	//
+	if (slowsky && skybox_name[0] && GLSky_BeginSkyBoxShader ())
+	{
+		sky_needbounds = false;
+		Sky_ProcessTextureChains ();
+		Sky_ProcessEntities ();
+		GLSky_EndSkyBoxShader ();
+		Fog_EnableGFog ();
+		return;
+	}
+
 	//
 	// reset sky bounds
 	//
@@ -1072,22 +1639,26 @@ void Sky_DrawSky (void)
 
 	//
 	// process world and bmodels: draw flat-shaded sky surfs, and update skybounds
+	// a skybox covers all of them, so for that they only need to be in the depth buffer
 	//
-	Fog_DisableGFog ();
+	sky_needbounds = slowsky && !skybox_name[0];
 	glDisable (GL_TEXTURE_2D);
-	if (Fog_GetDensity() > 0)
+	if (slowsky && skybox_name[0])
+		glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	else if (Fog_GetDensity() > 0)
 		glColor3fv (Fog_GetColor());
 	else
 		glColor3fv (skyflatcolor);
 	Sky_ProcessTextureChains ();
 	Sky_ProcessEntities ();
+	glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	glColor3f (1, 1, 1);
 	glEnable (GL_TEXTURE_2D);
 
 	//
 	// render slow sky: cloud layers or skybox
 	//
-	if (!r_fastsky.value && !(Fog_GetDensity() > 0 && skyfog >= 1))
+	if (slowsky)
 	{
 		glDepthFunc(GL_GEQUAL);
 		glDepthMask(0);
@@ -31,13 +31,28 @@ static cvar_t	gl_texturemode = {"gl_texturemode", "", CVAR_ARCHIVE};
 static cvar_t	gl_texture_anisotropy = {"gl_texture_anisotropy", "1", CVAR_ARCHIVE};
 static cvar_t	gl_max_size = {"gl_max_size", "0", CVAR_NONE};
 static cvar_t	gl_picmip = {"gl_picmip", "0", CVAR_NONE};
+static cvar_t	gl_texture_threads = {"gl_texture_threads", "1", CVAR_ARCHIVE};
+static cvar_t	gl_texture_cache = {"gl_texture_cache", "0", CVAR_ARCHIVE};
+static cvar_t	gl_texture_lazy = {"gl_texture_lazy", "0", CVAR_ARCHIVE};
+static cvar_t	gl_texture_lazy_ms = {"gl_texture_lazy_ms", "4", CVAR_ARCHIVE};
+static cvar_t	gl_texture_budget = {"gl_texture_budget", "0", CVAR_ARCHIVE}; // megabytes of lazy textures, 0 is no limit
 static GLint	gl_hardware_maxsize;
 
 #define	MAX_GLTEXTURES	4096
 static int numgltextures;
 static gltexture_t	*active_gltextures, *free_gltextures;
+
+// active textures are indexed by owner and name for TexMgr_FindTexture,
+// and by owner alone for TexMgr_FreeTexturesForOwner
+#define	TEXHASH_SIZE	1024	// power of two
+#define	OWNERHASH_BITS	8
+static gltexture_t	*texmgr_namehash[TEXHASH_SIZE];
+static gltexture_t	*texmgr_ownerhash[1 << OWNERHASH_BITS];
 gltexture_t		*notexture, *nulltexture;
 
+static int	texmgr_numqueued;	// textures waiting for TexMgr_FlushUploads
+static int	texmgr_batchdepth;
+
 unsigned int d_8to24table[256];
 unsigned int d_8to24table_fbright[256];
 unsigned int d_8to24table_fbright_fence[256];
@@ -46,6 +61,7 @@ unsigned int d_8to24table_nobright_fence[256];
 unsigned int d_8to24table_conchars[256];
 unsigned int d_8to24table_shirt[256];
 unsigned int d_8to24table_pants[256];
+unsigned int d_8to24table_colormap[256];
 
 /*
 ================================================================================
@@ -119,6 +135,29 @@ static void TexMgr_SetFilterModes (gltexture_t *glt)
 	}
 }
 
+/*
+===============
+TexMgr_SetArrayFilterModes -- for the bound texture array, which is always mipmapped
+===============
+*/
+void TexMgr_SetArrayFilterModes (void)
+{
+	glTexParameterf(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAG_FILTER, glmodes[glmode_idx].magfilter);
+	glTexParameterf(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, glmodes[glmode_idx].minfilter);
+	glTexParameterf(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAX_ANISOTROPY_EXT, gl_texture_anisotropy.value);
+}
+
+/*
+===============
+TexMgr_SetCubeMapFilterModes -- for the bound cube map, which is never mipmapped
+===============
+*/
+void TexMgr_SetCubeMapFilterModes (void)
+{
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, glmodes[glmode_idx].magfilter);
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, glmodes[glmode_idx].magfilter);
+}
+
 /*
 ===============
 TexMgr_TextureMode_f -- called when gl_texturemode changes
@@ -138,6 +177,8 @@ static void TexMgr_TextureMode_f (cvar_t *var)
 				glmode_idx = i;
 				for (glt = active_gltextures; glt; glt = glt->next)
 					TexMgr_SetFilterModes (glt);
+				GL_SetTextureArrayFilterModes ();
+				Sky_SetCubeMapFilterModes ();
 				Sbar_Changed (); //sbar graphics need to be redrawn with new filter mode
 				//FIXME: warpimages need to be redrawn, too.
 			}
@@ -193,6 +234,7 @@ static void TexMgr_Anisotropy_f (cvar_t *var)
 			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, gl_texture_anisotropy.value);
 		    }
 		}
+		GL_SetTextureArrayFilterModes ();
 	}
 }
 
@@ -266,6 +308,35 @@ static void TexMgr_Imagedump_f (void)
 	Con_Printf ("dumped %i textures to %s\n", numgltextures, dirname);
 }
 
+/*
+===============
+TexMgr_Texels -- texels in the texture's mip chain
+===============
+*/
+static float TexMgr_Texels (gltexture_t *glt)
+{
+	if (glt->flags & TEXPREF_MIPMAP)
+		return glt->width * glt->height * 4.0f / 3.0f;
+	else
+		return (glt->width * glt->height);
+}
+
+/*
+===============
+TexMgr_MemoryUsed -- estimated bytes of all textures, at 4 per texel
+===============
+*/
+double TexMgr_MemoryUsed (void)
+{
+	double bytes = 0;
+	gltexture_t	*glt;
+
+	for (glt = active_gltextures; glt; glt = glt->next)
+		bytes += TexMgr_Texels (glt) * 4.0;
+
+	return bytes;
+}
+
 /*
 ===============
 TexMgr_FrameUsage -- report texture memory usage for this frame
@@ -280,12 +351,7 @@ float TexMgr_FrameUsage (void)
 	for (glt = active_gltextures; glt; glt = glt->next)
 	{
 		if (glt->visframe == r_framecount)
-		{
-			if (glt->flags & TEXPREF_MIPMAP)
-				texels += glt->width * glt->height * 4.0f / 3.0f;
-			else
-				texels += (glt->width * glt->height);
-		}
+			texels += TexMgr_Texels (glt);
 	}
 
 	mb = texels * (Cvar_VariableValue("vid_bpp") / 8.0f) / 0x100000;
@@ -300,6 +366,62 @@ float TexMgr_FrameUsage (void)
 ================================================================================
 */
 
+static unsigned int TexMgr_OwnerHash (qmodel_t *owner)
+{
+	// fibonacci hashing, the low bits of a pointer are mostly alignment
+	return ((unsigned int)((uintptr_t)owner >> 4) * 2654435761u) >> (32 - OWNERHASH_BITS);
+}
+
+static gltexture_t **TexMgr_NameHash (qmodel_t *owner, const char *name)
+{
+	return &texmgr_namehash[(COM_HashString (name) ^ TexMgr_OwnerHash (owner)) & (TEXHASH_SIZE - 1)];
+}
+
+/*
+================
+TexMgr_HashTexture
+
+Indexes a texture once its owner and name are set
+================
+*/
+static void TexMgr_HashTexture (gltexture_t *glt)
+{
+	gltexture_t	**bucket;
+
+	bucket = TexMgr_NameHash (glt->owner, glt->name);
+	glt->hashnext = *bucket;
+	*bucket = glt;
+
+	bucket = &texmgr_ownerhash[TexMgr_OwnerHash (glt->owner)];
+	glt->ownernext = *bucket;
+	*bucket = glt;
+}
+
+static void TexMgr_UnhashTexture (gltexture_t *glt)
+{
+	gltexture_t	**link;
+
+	for (link = TexMgr_NameHash (glt->owner, glt->name); *link; link = &(*link)->hashnext)
+	{
+		if (*link == glt)
+		{
+			*link = glt->hashnext;
+			break;
+		}
+	}
+
+	for (link = &texmgr_ownerhash[TexMgr_OwnerHash (glt->owner)]; *link; link = &(*link)->ownernext)
+	{
+		if (*link == glt)
+		{
+			*link = glt->ownernext;
+			break;
+		}
+	}
+
+	glt->hashnext = glt->ownernext = NULL;
+}
+
 /*
 ================
 TexMgr_FindTexture
@@ -311,7 +433,7 @@ gltexture_t *TexMgr_FindTexture (qmodel_t *owner, const char *name)
 
 	if (name)
 	{
-		for (glt = active_gltextures; glt; glt = glt->next)
+		for (glt = *TexMgr_NameHash (owner, name); glt; glt = glt->hashnext)
 		{
 			if (glt->owner == owner && !strcmp (glt->name, name))
 				return glt;
@@ -336,6 +458,9 @@ gltexture_t *TexMgr_NewTexture (void)
 	glt = free_gltextures;
 	free_gltextures = glt->next;
 	glt->next = active_gltextures;
+	glt->prev = NULL;
+	if (active_gltextures)
+		active_gltextures->prev = glt;
 	active_gltextures = glt;
 
 	glGenTextures(1, &glt->texnum);
@@ -345,9 +470,27 @@ gltexture_t *TexMgr_NewTexture (void)
 
 static void GL_DeleteTexture (gltexture_t *texture);
 
+/*
+================
+TexMgr_MutableTexture -- gives a texture with immutable storage a fresh object, before glTexImage2D
+================
+*/
+static void TexMgr_MutableTexture (gltexture_t *glt)
+{
+	if (!glt->storagelevels)
+		return;
+	GL_DeleteTexture (glt);
+	glGenTextures (1, &glt->texnum);
+}
+
 //ericw -- workaround for preventing TexMgr_FreeTexture during TexMgr_ReloadImages
 static qboolean in_reload_images;
 
+// textures that lost their gl object in a vid_restart and haven't been bound since
+static int texmgr_numdeferred;
+
+static void TexMgr_Unstream (gltexture_t *glt);
+
 /*
 ================
 TexMgr_FreeTexture
@@ -355,10 +498,15 @@ TexMgr_FreeTexture
 */
 void TexMgr_FreeTexture (gltexture_t *kill)
 {
-	gltexture_t *glt;
-
 	if (in_reload_images)
 		return;
+
+	if (!kill->texnum && texmgr_numdeferred)
+		texmgr_numdeferred--;
+	TexMgr_Unstream (kill);
+
+	if (texmgr_numqueued)
+		TexMgr_FlushUploads ();	// don't upload into a freed texture
 	
 	if (kill == NULL)
 	{
@@ -366,32 +514,27 @@ void TexMgr_FreeTexture (gltexture_t *kill)
 		return;
 	}
 
-	if (active_gltextures == kill)
+	// only the head of the active list has no prev
+	if (!kill->prev && active_gltextures != kill)
 	{
-		active_gltextures = kill->next;
-		kill->next = free_gltextures;
-		free_gltextures = kill;
-
-		GL_DeleteTexture(kill);
-		numgltextures--;
+		Con_Printf ("TexMgr_FreeTexture: not found\n");
 		return;
 	}
 
-	for (glt = active_gltextures; glt; glt = glt->next)
-	{
-		if (glt->next == kill)
-		{
-			glt->next = kill->next;
-			kill->next = free_gltextures;
-			free_gltextures = kill;
-
-			GL_DeleteTexture(kill);
-			numgltextures--;
-			return;
-		}
-	}
+	TexMgr_UnhashTexture (kill);
 
-	Con_Printf ("TexMgr_FreeTexture: not found\n");
+	if (kill->prev)
+		kill->prev->next = kill->next;
+	else
+		active_gltextures = kill->next;
+	if (kill->next)
+		kill->next->prev = kill->prev;
+	kill->prev = NULL;
+	kill->next = free_gltextures;
+	free_gltextures = kill;
+
+	GL_DeleteTexture(kill);
+	numgltextures--;
 }
 
 /*
@@ -422,10 +565,27 @@ void TexMgr_FreeTexturesForOwner (qmodel_t *owner)
 {
 	gltexture_t *glt, *next;
 
-	for (glt = active_gltextures; glt; glt = next)
+	for (glt = texmgr_ownerhash[TexMgr_OwnerHash (owner)]; glt; glt = next)
 	{
-		next = glt->next;
-		if (glt && glt->owner == owner)
+		next = glt->ownernext;
+		if (glt->owner == owner)
+			TexMgr_FreeTexture (glt);
+	}
+}
+
+/*
+================
+TexMgr_FreeLightmapsForOwner -- the world's lightmaps are rebuilt for every map, even if the model is kept
+================
+*/
+void TexMgr_FreeLightmapsForOwner (qmodel_t *owner)
+{
+	gltexture_t *glt, *next;
+
+	for (glt = texmgr_ownerhash[TexMgr_OwnerHash (owner)]; glt; glt = next)
+	{
+		next = glt->ownernext;
+		if (glt->owner == owner && glt->source_format == SRC_LIGHTMAP)
 			TexMgr_FreeTexture (glt);
 	}
 }
@@ -531,6 +691,17 @@ void TexMgr_LoadPalette (void)
 	memcpy(d_8to24table_conchars, d_8to24table, 256*4);
 	((byte *) &d_8to24table_conchars[0]) [3] = 0;
 
+	//colormap palette, red marks the shirt range and green the pants range,
+	//blue is the shade within the range; everything else is black
+	for (i = 0; i < 256; i++)
+	{
+		dst = (byte *) &d_8to24table_colormap[i];
+		dst[0] = (i >= TOP_RANGE && i < TOP_RANGE + 16) ? 255 : 0;
+		dst[1] = (i >= BOTTOM_RANGE && i < BOTTOM_RANGE + 16) ? 255 : 0;
+		dst[2] = (dst[0] || dst[1]) ? (i & 15) * 17 : 0;
+		dst[3] = 255;
+	}
+
 	Hunk_FreeToLowMark (mark);
 }
 
@@ -610,6 +781,8 @@ void TexMgr_Init (void)
 	// init texture list
 	free_gltextures = (gltexture_t *) Hunk_AllocName (MAX_GLTEXTURES * sizeof(gltexture_t), "gltextures");
 	active_gltextures = NULL;
+	memset (texmgr_namehash, 0, sizeof(texmgr_namehash));
+	memset (texmgr_ownerhash, 0, sizeof(texmgr_ownerhash));
 	for (i = 0; i < MAX_GLTEXTURES - 1; i++)
 		free_gltextures[i].next = &free_gltextures[i+1];
 	free_gltextures[i].next = NULL;
@@ -620,6 +793,11 @@ void TexMgr_Init (void)
 
 	Cvar_RegisterVariable (&gl_max_size);
 	Cvar_RegisterVariable (&gl_picmip);
+	Cvar_RegisterVariable (&gl_texture_threads);
+	Cvar_RegisterVariable (&gl_texture_cache);
+	Cvar_RegisterVariable (&gl_texture_lazy);
+	Cvar_RegisterVariable (&gl_texture_lazy_ms);
+	Cvar_RegisterVariable (&gl_texture_budget);
 	Cvar_RegisterVariable (&gl_texture_anisotropy);
 	Cvar_SetCallback (&gl_texture_anisotropy, &TexMgr_Anisotropy_f);
 	gl_texturemode.string = glmodes[glmode_idx].name;
@@ -649,9 +827,39 @@ void TexMgr_Init (void)
 
 	IMAGE LOADING
 
+The CPU side of loading an image (palette conversion, padding, resampling
+and mipmapping) works on a texprep_t with its own malloc'd buffers, so it
+can run on the task workers. Only TexMgr_UploadPrep touches GL. Between
+TexMgr_BeginBatch and TexMgr_EndBatch, TexMgr_LoadImage queues the
+preparation and the upload happens at the end of the batch.
+
 ================================================================================
 */
 
+#define	MAX_PREP_BUFFERS	8
+#define	MAX_MIPLEVELS		16
+#define	MAX_QUEUED_TEXTURES	64
+
+typedef struct
+{
+	gltexture_t	*glt;
+	byte		*data;			// source pixels
+	unsigned int	width, height, flags;	// working copy of the glt fields
+	int		picmip;
+	qboolean	fullbrights;		// cvars are read on the main thread
+	qboolean	failed;			// out of memory, reported on upload
+	GLenum		cacheformat;		// compress and store in the texture cache
+	qboolean	gpumips;		// only the base level is made, glGenerateMipmap does the rest
+	int		nummips;
+	unsigned	*mipdata[MAX_MIPLEVELS];
+	int		mipwidth[MAX_MIPLEVELS], mipheight[MAX_MIPLEVELS];
+	void		*buffers[MAX_PREP_BUFFERS];
+	int		numbuffers;
+	task_t		task;
+} texprep_t;
+
+static texprep_t	texmgr_queue[MAX_QUEUED_TEXTURES];
+
 /*
 ================
 TexMgr_Pad -- return smallest power of two greater than or equal to s
@@ -693,6 +901,30 @@ int TexMgr_PadConditional (int s)
 		return s;
 }
 
+/*
+================
+TexMgr_PrepAlloc -- working memory for a texprep_t, freed with it. may run on a worker
+================
+*/
+static void *TexMgr_PrepAlloc (texprep_t *prep, size_t size)
+{
+	void *buf;
+
+	if (prep->failed || prep->numbuffers == MAX_PREP_BUFFERS || !(buf = malloc (size)))
+	{
+		prep->failed = true;
+		return NULL;
+	}
+	prep->buffers[prep->numbuffers++] = buf;
+	return buf;
+}
+
+static void TexMgr_FreePrep (texprep_t *prep)
+{
+	while (prep->numbuffers)
+		free (prep->buffers[--prep->numbuffers]);
+}
+
 /*
 ================
 TexMgr_MipMapW
@@ -750,7 +982,7 @@ static unsigned *TexMgr_MipMapH (unsigned *data, int width, int height)
 TexMgr_ResampleTexture -- bilinear resample
 ================
 */
-static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight, qboolean alpha)
+static unsigned *TexMgr_ResampleTexture (texprep_t *prep, unsigned *in, int inwidth, int inheight, qboolean alpha)
 {
 	byte *nwpx, *nepx, *swpx, *sepx, *dest;
 	unsigned xfrac, yfrac, x, y, modx, mody, imodx, imody, injump, outjump;
@@ -762,7 +994,9 @@ static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight
 
 	outwidth = TexMgr_Pad(inwidth);
 	outheight = TexMgr_Pad(inheight);
-	out = (unsigned *) Hunk_Alloc(outwidth*outheight*4);
+	out = (unsigned *) TexMgr_PrepAlloc(prep, outwidth*outheight*4);
+	if (!out)
+		return NULL;
 
 	xfrac = ((inwidth-1) << 16) / (outwidth-1);
 	yfrac = ((inheight-1) << 16) / (outheight-1);
@@ -939,12 +1173,14 @@ static void TexMgr_PadEdgeFixH (byte *data, int width, int height)
 TexMgr_8to32
 ================
 */
-static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal)
+static unsigned *TexMgr_8to32 (texprep_t *prep, byte *in, int pixels, unsigned int *usepal)
 {
 	int i;
 	unsigned *out, *data;
 
-	out = data = (unsigned *) Hunk_Alloc(pixels*4);
+	out = data = (unsigned *) TexMgr_PrepAlloc(prep, pixels*4);
+	if (!data)
+		return NULL;
 
 	for (i = 0; i < pixels; i++)
 		*out++ = usepal[*in++];
@@ -957,7 +1193,7 @@ static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal)
 TexMgr_PadImageW -- return image with width padded up to power-of-two dimentions
 ================
 */
-static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
+static byte *TexMgr_PadImageW (texprep_t *prep, byte *in, int width, int height, byte padbyte)
 {
 	int i, j, outwidth;
 	byte *out, *data;
@@ -967,7 +1203,9 @@ static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
 
 	outwidth = TexMgr_Pad(width);
 
-	out = data = (byte *) Hunk_Alloc(outwidth*height);
+	out = data = (byte *) TexMgr_PrepAlloc(prep, outwidth*height);
+	if (!data)
+		return NULL;
 
 	for (i = 0; i < height; i++)
 	{
@@ -985,7 +1223,7 @@ static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
 TexMgr_PadImageH -- return image with height padded up to power-of-two dimentions
 ================
 */
-static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
+static byte *TexMgr_PadImageH (texprep_t *prep, byte *in, int width, int height, byte padbyte)
 {
 	int i, srcpix, dstpix;
 	byte *data, *out;
@@ -996,7 +1234,9 @@ static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
 	srcpix = width * height;
 	dstpix = width * TexMgr_Pad(height);
 
-	out = data = (byte *) Hunk_Alloc(dstpix);
+	out = data = (byte *) TexMgr_PrepAlloc(prep, dstpix);
+	if (!data)
+		return NULL;
 
 	for (i = 0; i < srcpix; i++)
 		*out++ = *in++;
@@ -1006,81 +1246,296 @@ static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
 	return data;
 }
 
+/*
+================================================================================
+
+	TEXTURE CACHE
+
+With gl_texture_cache set, mipmapped 32bit textures are uploaded in a
+compressed format and the compressed mip chain that the driver produced is
+stored in <gamedir>/texcache. Later loads of the same texture skip the
+resampling and mipmapping and upload the stored chain directly. The files
+are keyed by the texture name and source crc, and also record everything
+else that affects the result; they are in native byte order, for this
+machine only.
+
+================================================================================
+*/
+
+#define	TEXCACHE_IDENT		"QTC1"
+
+typedef struct
+{
+	char		ident[4];
+	char		name[64];
+	unsigned int	crc, source_width, source_height, flags;
+	int		picmip, maxsize, npot;
+	int		format;
+// results, not part of the key
+	int		width, height, nummips;
+} texcachehdr_t;
+
 /*
 ================
-TexMgr_LoadImage32 -- handles 32bit source data
+TexMgr_CacheFormat -- the compressed format to use, or 0 if the texture isn't cached
 ================
 */
-static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
+static GLenum TexMgr_CacheFormat (gltexture_t *glt)
 {
-	int	internalformat,	miplevel, mipwidth, mipheight, picmip;
+	if (!gl_texture_cache.value || glt->source_format != SRC_RGBA || !(glt->flags & TEXPREF_MIPMAP))
+		return 0;
+	if (gl_texture_bptc)
+		return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+	if (gl_texture_s3tc)
+		return (glt->flags & TEXPREF_ALPHA) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	return 0;
+}
+
+static void TexMgr_CachePath (gltexture_t *glt, char *path, size_t size)
+{
+	q_snprintf (path, size, "%s/texcache/%08x%04x.qtc", com_gamedir, COM_HashString (glt->name), glt->source_crc);
+}
+
+static void TexMgr_CacheHeader (texcachehdr_t *header, gltexture_t *glt, GLenum format)
+{
+	memset (header, 0, sizeof(*header));
+	memcpy (header->ident, TEXCACHE_IDENT, 4);
+	q_strlcpy (header->name, glt->name, sizeof(header->name));
+	header->crc = glt->source_crc;
+	header->source_width = glt->source_width;
+	header->source_height = glt->source_height;
+	header->flags = glt->flags;
+	header->picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
+	header->maxsize = TexMgr_SafeTextureSize (gl_hardware_maxsize);
+	header->npot = gl_texture_NPOT;
+	header->format = format;
+}
+
+/*
+================
+TexMgr_LoadCache -- uploads a stored mip chain, returns false if there is no usable one
+================
+*/
+static qboolean TexMgr_LoadCache (gltexture_t *glt, GLenum format)
+{
+	char		path[MAX_OSPATH];
+	texcachehdr_t	header, check;
+	FILE		*f;
+	byte		*buf;
+	int		miplevel, size, bufsize, width, height;
+	qboolean	ok;
+
+	TexMgr_CachePath (glt, path, sizeof(path));
+	f = fopen (path, "rb");
+	if (!f)
+		return false;
+
+	TexMgr_CacheHeader (&check, glt, format);
+	if (fread (&header, sizeof(header), 1, f) != 1 ||
+	    memcmp (&header, &check, offsetof(texcachehdr_t, width)) ||
+	    header.nummips < 1 || header.width < 1 || header.height < 1)
+	{
+		fclose (f);
+		return false;
+	}
+
+	glt->width = header.width;
+	glt->height = header.height;
+	TexMgr_MutableTexture (glt);
+	GL_Bind (glt);
+
+	ok = true;
+	buf = NULL;
+	bufsize = 0;
+	width = header.width;
+	height = header.height;
+	for (miplevel = 0; miplevel < header.nummips; miplevel++)
+	{
+		if (fread (&size, sizeof(size), 1, f) != 1 || size <= 0 || size > (1 << 28))
+		{
+			ok = false;
+			break;
+		}
+		if (size > bufsize)
+		{
+			free (buf);
+			bufsize = size;
+			buf = (byte *) malloc (bufsize);
+			if (!buf)
+				Sys_Error ("TexMgr_LoadCache: out of memory for %s", glt->name);
+		}
+		if (fread (buf, 1, size, f) != (size_t)size)
+		{
+			ok = false;
+			break;
+		}
+		GL_CompressedTexImage2DFunc (GL_TEXTURE_2D, miplevel, format, width, height, 0, size, buf);
+		width = q_max(width >> 1, 1);
+		height = q_max(height >> 1, 1);
+	}
+	free (buf);
+	fclose (f);
+
+	if (!ok)
+	{
+		Con_DPrintf ("TexMgr_LoadCache: %s is truncated\n", path);
+		glt->width = glt->source_width;
+		glt->height = glt->source_height;
+		return false;
+	}
+
+	TexMgr_SetFilterModes (glt);
+	return true;
+}
+
+/*
+================
+TexMgr_WriteCache -- stores the compressed mip chain of the bound texture
+================
+*/
+static void TexMgr_WriteCache (texprep_t *prep)
+{
+	gltexture_t	*glt = prep->glt;
+	char		path[MAX_OSPATH];
+	texcachehdr_t	header;
+	FILE		*f;
+	byte		*buf;
+	GLint		compressed, size;
+	int		miplevel;
+
+	glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED_ARB, &compressed);
+	if (!compressed)
+		return;	// the driver didn't compress it after all
+
+	TexMgr_CacheHeader (&header, glt, prep->cacheformat);
+	header.width = prep->width;
+	header.height = prep->height;
+	header.nummips = prep->nummips;
+
+	Sys_mkdir (va("%s/texcache", com_gamedir));
+	TexMgr_CachePath (glt, path, sizeof(path));
+	f = fopen (path, "wb");
+	if (!f)
+	{
+		Con_DPrintf ("TexMgr_WriteCache: couldn't open %s\n", path);
+		return;
+	}
+
+	fwrite (&header, sizeof(header), 1, f);
+	for (miplevel = 0; miplevel < prep->nummips; miplevel++)
+	{
+		glGetTexLevelParameteriv (GL_TEXTURE_2D, miplevel, GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB, &size);
+		buf = (size > 0) ? (byte *) malloc (size) : NULL;
+		if (!buf)
+			break;	// leaves a truncated file, which is rejected on load
+		GL_GetCompressedTexImageFunc (GL_TEXTURE_2D, miplevel, buf);
+		fwrite (&size, sizeof(size), 1, f);
+		fwrite (buf, 1, size, f);
+		free (buf);
+	}
+	fclose (f);
+}
+
+/*
+================
+TexMgr_Prepare32 -- handles 32bit source data, builds the mip chain. may run on a worker
+================
+*/
+static void TexMgr_Prepare32 (texprep_t *prep, unsigned *data)
+{
+	int	miplevel, mipwidth, mipheight;
+	size_t	size, chainsize;
+	byte	*chain;
 
 	if (!gl_texture_NPOT)
 	{
 		// resample up
-		data = TexMgr_ResampleTexture (data, glt->width, glt->height, glt->flags & TEXPREF_ALPHA);
-		glt->width = TexMgr_Pad(glt->width);
-		glt->height = TexMgr_Pad(glt->height);
+		data = TexMgr_ResampleTexture (prep, data, prep->width, prep->height, prep->flags & TEXPREF_ALPHA);
+		if (!data)
+			return;
+		prep->width = TexMgr_Pad(prep->width);
+		prep->height = TexMgr_Pad(prep->height);
 	}
 
+	// the texture cache stores the whole chain
+	if (prep->cacheformat)
+		prep->gpumips = false;
+
 	// mipmap down
-	picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
-	mipwidth = TexMgr_SafeTextureSize (glt->width >> picmip);
-	mipheight = TexMgr_SafeTextureSize (glt->height >> picmip);
-	while ((int) glt->width > mipwidth)
+	mipwidth = TexMgr_SafeTextureSize (prep->width >> prep->picmip);
+	mipheight = TexMgr_SafeTextureSize (prep->height >> prep->picmip);
+	while ((int) prep->width > mipwidth)
 	{
-		TexMgr_MipMapW (data, glt->width, glt->height);
-		glt->width >>= 1;
-		if (glt->flags & TEXPREF_ALPHA)
-			TexMgr_AlphaEdgeFix ((byte *)data, glt->width, glt->height);
+		TexMgr_MipMapW (data, prep->width, prep->height);
+		prep->width >>= 1;
+		if (prep->flags & TEXPREF_ALPHA)
+			TexMgr_AlphaEdgeFix ((byte *)data, prep->width, prep->height);
 	}
-	while ((int) glt->height > mipheight)
+	while ((int) prep->height > mipheight)
 	{
-		TexMgr_MipMapH (data, glt->width, glt->height);
-		glt->height >>= 1;
-		if (glt->flags & TEXPREF_ALPHA)
-			TexMgr_AlphaEdgeFix ((byte *)data, glt->width, glt->height);
+		TexMgr_MipMapH (data, prep->width, prep->height);
+		prep->height >>= 1;
+		if (prep->flags & TEXPREF_ALPHA)
+			TexMgr_AlphaEdgeFix ((byte *)data, prep->width, prep->height);
 	}
 
-	// upload
-	GL_Bind (glt);
-	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
-	glTexImage2D (GL_TEXTURE_2D, 0, internalformat, glt->width, glt->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	prep->nummips = 1;
+	prep->mipdata[0] = data;
+	prep->mipwidth[0] = prep->width;
+	prep->mipheight[0] = prep->height;
 
-	// upload mipmaps
-	if (glt->flags & TEXPREF_MIPMAP)
+	if (!(prep->flags & TEXPREF_MIPMAP) || prep->gpumips)
+		return;
+
+	// each mip level is made in place from a copy of the level above,
+	// so every slot of the chain holds the size of the previous level
+	chainsize = 0;
+	for (mipwidth = prep->width, mipheight = prep->height; mipwidth > 1 || mipheight > 1; )
+	{
+		chainsize += mipwidth * mipheight * 4;
+		mipwidth = q_max(mipwidth >> 1, 1);
+		mipheight = q_max(mipheight >> 1, 1);
+	}
+	if (!chainsize)
+		return;
+	chain = (byte *) TexMgr_PrepAlloc (prep, chainsize);
+	if (!chain)
+		return;
+
+	mipwidth = prep->width;
+	mipheight = prep->height;
+	for (miplevel=1; (mipwidth > 1 || mipheight > 1) && miplevel < MAX_MIPLEVELS; miplevel++)
 	{
-		mipwidth = glt->width;
-		mipheight = glt->height;
+		size = mipwidth * mipheight * 4;
+		memcpy (chain, data, size);
+		data = (unsigned *) chain;
+		chain += size;
 
-		for (miplevel=1; mipwidth > 1 || mipheight > 1; miplevel++)
+		if (mipwidth > 1)
 		{
-			if (mipwidth > 1)
-			{
-				TexMgr_MipMapW (data, mipwidth, mipheight);
-				mipwidth >>= 1;
-			}
-			if (mipheight > 1)
-			{
-				TexMgr_MipMapH (data, mipwidth, mipheight);
-				mipheight >>= 1;
-			}
-			glTexImage2D (GL_TEXTURE_2D, miplevel, internalformat, mipwidth, mipheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			TexMgr_MipMapW (data, mipwidth, mipheight);
+			mipwidth >>= 1;
 		}
+		if (mipheight > 1)
+		{
+			TexMgr_MipMapH (data, mipwidth, mipheight);
+			mipheight >>= 1;
+		}
+		prep->mipdata[miplevel] = data;
+		prep->mipwidth[miplevel] = mipwidth;
+		prep->mipheight[miplevel] = mipheight;
+		prep->nummips++;
 	}
-
-	// set filter modes
-	TexMgr_SetFilterModes (glt);
 }
 
 /*
 ================
-TexMgr_LoadImage8 -- handles 8bit source data, then passes it to LoadImage32
+TexMgr_Prepare8 -- handles 8bit source data, then passes it to Prepare32. may run on a worker
 ================
 */
-static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
+static void TexMgr_Prepare8 (texprep_t *prep, byte *data)
 {
-	extern cvar_t gl_fullbrights;
+	gltexture_t *glt = prep->glt;
 	qboolean padw = false, padh = false;
 	byte padbyte;
 	unsigned int *usepal;
@@ -1088,7 +1543,7 @@ static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
 
 	// HACK HACK HACK -- taken from tomazquake
 	if (strstr(glt->name, "shot1sid") &&
-	    glt->width == 32 && glt->height == 32 &&
+	    prep->width == 32 && prep->height == 32 &&
 	    CRC_Block(data, 1024) == 65393)
 	{
 		// This texture in b_shell1.bsp has some of the first 32 pixels painted white.
@@ -1098,37 +1553,42 @@ static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
 	}
 
 	// detect false alpha cases
-	if (glt->flags & TEXPREF_ALPHA && !(glt->flags & TEXPREF_CONCHARS))
+	if (prep->flags & TEXPREF_ALPHA && !(prep->flags & TEXPREF_CONCHARS))
 	{
-		for (i = 0; i < (int) (glt->width * glt->height); i++)
+		for (i = 0; i < (int) (prep->width * prep->height); i++)
 			if (data[i] == 255) //transparent index
 				break;
-		if (i == (int) (glt->width * glt->height))
-			glt->flags -= TEXPREF_ALPHA;
+		if (i == (int) (prep->width * prep->height))
+			prep->flags -= TEXPREF_ALPHA;
 	}
 
 	// choose palette and padbyte
-	if (glt->flags & TEXPREF_FULLBRIGHT)
+	if (prep->flags & TEXPREF_FULLBRIGHT)
 	{
-		if (glt->flags & TEXPREF_ALPHA)
+		if (prep->flags & TEXPREF_ALPHA)
 			usepal = d_8to24table_fbright_fence;
 		else
 			usepal = d_8to24table_fbright;
 		padbyte = 0;
 	}
-	else if (glt->flags & TEXPREF_NOBRIGHT && gl_fullbrights.value)
+	else if (prep->flags & TEXPREF_NOBRIGHT && prep->fullbrights)
 	{
-		if (glt->flags & TEXPREF_ALPHA)
+		if (prep->flags & TEXPREF_ALPHA)
 			usepal = d_8to24table_nobright_fence;
 		else
 			usepal = d_8to24table_nobright;
 		padbyte = 0;
 	}
-	else if (glt->flags & TEXPREF_CONCHARS)
+	else if (prep->flags & TEXPREF_CONCHARS)
 	{
 		usepal = d_8to24table_conchars;
 		padbyte = 0;
 	}
+	else if (prep->flags & TEXPREF_COLORMAP)
+	{
+		usepal = d_8to24table_colormap;
+		padbyte = 0;
+	}
 	else
 	{
 		usepal = d_8to24table;
@@ -1136,28 +1596,34 @@ static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
 	}
 
 	// pad each dimention, but only if it's not going to be downsampled later
-	if (glt->flags & TEXPREF_PAD)
+	if (prep->flags & TEXPREF_PAD)
 	{
-		if ((int) glt->width < TexMgr_SafeTextureSize(glt->width))
+		if ((int) prep->width < TexMgr_SafeTextureSize(prep->width))
 		{
-			data = TexMgr_PadImageW (data, glt->width, glt->height, padbyte);
-			glt->width = TexMgr_Pad(glt->width);
+			data = TexMgr_PadImageW (prep, data, prep->width, prep->height, padbyte);
+			if (!data)
+				return;
+			prep->width = TexMgr_Pad(prep->width);
 			padw = true;
 		}
-		if ((int) glt->height < TexMgr_SafeTextureSize(glt->height))
+		if ((int) prep->height < TexMgr_SafeTextureSize(prep->height))
 		{
-			data = TexMgr_PadImageH (data, glt->width, glt->height, padbyte);
-			glt->height = TexMgr_Pad(glt->height);
+			data = TexMgr_PadImageH (prep, data, prep->width, prep->height, padbyte);
+			if (!data)
+				return;
+			prep->height = TexMgr_Pad(prep->height);
 			padh = true;
 		}
 	}
 
 	// convert to 32bit
-	data = (byte *)TexMgr_8to32(data, glt->width * glt->height, usepal);
+	data = (byte *)TexMgr_8to32(prep, data, prep->width * prep->height, usepal);
+	if (!data)
+		return;
 
 	// fix edges
-	if (glt->flags & TEXPREF_ALPHA)
-		TexMgr_AlphaEdgeFix (data, glt->width, glt->height);
+	if (prep->flags & TEXPREF_ALPHA)
+		TexMgr_AlphaEdgeFix (data, prep->width, prep->height);
 	else
 	{
 		if (padw)
@@ -1166,8 +1632,213 @@ static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
 			TexMgr_PadEdgeFixH (data, glt->source_width, glt->source_height);
 	}
 
-	// upload it
-	TexMgr_LoadImage32 (glt, (unsigned *)data);
+	TexMgr_Prepare32 (prep, (unsigned *)data);
+}
+
+static void TexMgr_PrepareTask (void *data)
+{
+	texprep_t *prep = (texprep_t *) data;
+
+	if (prep->glt->source_format == SRC_INDEXED)
+		TexMgr_Prepare8 (prep, prep->data);
+	else
+		TexMgr_Prepare32 (prep, (unsigned *)prep->data);
+}
+
+static void TexMgr_InitPrep (texprep_t *prep, gltexture_t *glt, byte *data)
+{
+	extern cvar_t gl_fullbrights;
+
+	memset (prep, 0, sizeof(*prep));
+	prep->glt = glt;
+	prep->data = data;
+	prep->width = glt->width;
+	prep->height = glt->height;
+	prep->flags = glt->flags;
+	prep->picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
+	prep->fullbrights = gl_fullbrights.value != 0;
+	// the CPU chain is kept for alpha textures, whose edges the box filter
+	// of the driver may not treat the same way
+	prep->gpumips = gl_generate_mipmap_able && (glt->flags & TEXPREF_MIPMAP) && !(glt->flags & TEXPREF_ALPHA);
+}
+
+/*
+================
+TexMgr_MipLevels -- the number of levels down to 1x1
+================
+*/
+static int TexMgr_MipLevels (int width, int height)
+{
+	int	levels;
+
+	for (levels = 1; (width > 1 || height > 1) && levels < MAX_MIPLEVELS; levels++)
+	{
+		width = q_max(width >> 1, 1);
+		height = q_max(height >> 1, 1);
+	}
+	return levels;
+}
+
+
+/*
+================
+TexMgr_UploadPrep -- uploads a prepared mip chain
+================
+*/
+static void TexMgr_UploadPrep (texprep_t *prep)
+{
+	gltexture_t *glt = prep->glt;
+	int	internalformat, miplevel, levels;
+	GLenum	storageformat;
+
+	if (prep->failed)
+		Sys_Error ("TexMgr_UploadPrep: out of memory for %s", glt->name);
+
+	if (prep->cacheformat)
+		internalformat = prep->cacheformat;
+	else
+		internalformat = (prep->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
+
+	// upload it and its mipmaps
+	if (gl_texture_storage_able && !prep->cacheformat && !(prep->flags & TEXPREF_WARPIMAGE))
+	{
+		// a reload of the same size and format writes into the storage it has
+		levels = prep->gpumips ? TexMgr_MipLevels (prep->width, prep->height) : prep->nummips;
+		storageformat = (internalformat == gl_alpha_format) ? GL_RGBA8 : GL_RGB8;
+		if (glt->storagelevels != levels || glt->storageformat != storageformat ||
+		    glt->width != prep->width || glt->height != prep->height)
+		{
+			TexMgr_MutableTexture (glt);
+			GL_Bind (glt);
+			GL_TexStorage2DFunc (GL_TEXTURE_2D, levels, storageformat, prep->width, prep->height);
+			glt->storagelevels = levels;
+			glt->storageformat = storageformat;
+		}
+		else
+			GL_Bind (glt);
+		for (miplevel = 0; miplevel < prep->nummips; miplevel++)
+			glTexSubImage2D (GL_TEXTURE_2D, miplevel, 0, 0, prep->mipwidth[miplevel], prep->mipheight[miplevel], GL_RGBA, GL_UNSIGNED_BYTE, prep->mipdata[miplevel]);
+	}
+	else
+	{
+		TexMgr_MutableTexture (glt);
+		GL_Bind (glt);
+		for (miplevel = 0; miplevel < prep->nummips; miplevel++)
+			glTexImage2D (GL_TEXTURE_2D, miplevel, internalformat, prep->mipwidth[miplevel], prep->mipheight[miplevel], 0, GL_RGBA, GL_UNSIGNED_BYTE, prep->mipdata[miplevel]);
+	}
+	if (prep->gpumips)
+		GL_GenerateMipmapFunc (GL_TEXTURE_2D);
+
+	glt->width = prep->width;
+	glt->height = prep->height;
+	glt->flags = prep->flags;
+
+	if (prep->cacheformat)
+		TexMgr_WriteCache (prep);
+
+	// set filter modes
+	TexMgr_SetFilterModes (glt);
+
+	TexMgr_FreePrep (prep);
+}
+
+/*
+================
+TexMgr_LoadImage32 -- handles 32bit source data
+================
+*/
+static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
+{
+	texprep_t prep;
+	GLenum cacheformat;
+
+	cacheformat = TexMgr_CacheFormat (glt);
+	if (cacheformat && TexMgr_LoadCache (glt, cacheformat))
+		return;
+
+	TexMgr_InitPrep (&prep, glt, (byte *)data);
+	prep.cacheformat = cacheformat;
+	TexMgr_Prepare32 (&prep, data);
+	TexMgr_UploadPrep (&prep);
+}
+
+/*
+================
+TexMgr_LoadImage8 -- handles 8bit source data, then passes it to LoadImage32
+================
+*/
+static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
+{
+	texprep_t prep;
+
+	TexMgr_InitPrep (&prep, glt, data);
+	TexMgr_Prepare8 (&prep, data);
+	TexMgr_UploadPrep (&prep);
+}
+
+/*
+================
+TexMgr_QueueImage -- copies the source data and queues its preparation for the task workers
+================
+*/
+static void TexMgr_QueueImage (gltexture_t *glt, byte *data, int size)
+{
+	texprep_t *prep;
+	byte *copy;
+	GLenum cacheformat;
+
+	cacheformat = TexMgr_CacheFormat (glt);
+	if (cacheformat && TexMgr_LoadCache (glt, cacheformat))
+		return;
+
+	if (texmgr_numqueued == MAX_QUEUED_TEXTURES)
+		TexMgr_FlushUploads ();
+
+	prep = &texmgr_queue[texmgr_numqueued++];
+	TexMgr_InitPrep (prep, glt, NULL);
+	prep->cacheformat = cacheformat;
+	copy = (byte *) TexMgr_PrepAlloc (prep, size);
+	if (!copy)
+		Sys_Error ("TexMgr_QueueImage: out of memory for %s", glt->name);
+	memcpy (copy, data, size);
+	prep->data = copy;
+	prep->task = Task_Run (TexMgr_PrepareTask, prep, NULL, 0);
+}
+
+/*
+================
+TexMgr_FlushUploads -- waits for the queued textures and uploads them, in order
+================
+*/
+void TexMgr_FlushUploads (void)
+{
+	int i;
+
+	for (i = 0; i < texmgr_numqueued; i++)
+	{
+		Task_Wait (texmgr_queue[i].task);
+		TexMgr_UploadPrep (&texmgr_queue[i]);
+	}
+	texmgr_numqueued = 0;
+}
+
+/*
+================
+TexMgr_BeginBatch
+
+Textures loaded until the matching TexMgr_EndBatch are prepared by the
+task workers and uploaded at the end. They can't be drawn before that.
+================
+*/
+void TexMgr_BeginBatch (void)
+{
+	texmgr_batchdepth++;
+}
+
+void TexMgr_EndBatch (void)
+{
+	if (texmgr_batchdepth > 0 && --texmgr_batchdepth == 0)
+		TexMgr_FlushUploads ();
 }
 
 /*
@@ -1178,6 +1849,7 @@ TexMgr_LoadLightmap -- handles lightmap data
 static void TexMgr_LoadLightmap (gltexture_t *glt, byte *data)
 {
 	// upload it
+	TexMgr_MutableTexture (glt);
 	GL_Bind (glt);
 	glTexImage2D (GL_TEXTURE_2D, 0, lightmap_bytes, glt->width, glt->height, 0, gl_lightmap_format, GL_UNSIGNED_BYTE, data);
 
@@ -1185,6 +1857,54 @@ static void TexMgr_LoadLightmap (gltexture_t *glt, byte *data)
 	TexMgr_SetFilterModes (glt);
 }
 
+/*
+================
+TexMgr_AverageColor -- the color of a lazy texture's placeholder, from a sample of its pixels
+================
+*/
+static unsigned int TexMgr_AverageColor (gltexture_t *glt, byte *data)
+{
+	unsigned int	*usepal, pixels, step, count, i;
+	unsigned int	sum[3] = {0, 0, 0};
+	unsigned int	average;
+	byte		*rgba, *dst;
+
+	usepal = (glt->flags & TEXPREF_FULLBRIGHT) ? d_8to24table_fbright : d_8to24table;
+	pixels = glt->source_width * glt->source_height;
+	step = q_max(pixels / 4096, 1);
+	for (i = 0, count = 0; i < pixels; i += step, count++)
+	{
+		if (glt->source_format == SRC_INDEXED)
+			rgba = (byte *) &usepal[data[i]];
+		else
+			rgba = data + i * 4;
+		sum[0] += rgba[0];
+		sum[1] += rgba[1];
+		sum[2] += rgba[2];
+	}
+
+	dst = (byte *) &average;
+	for (i = 0; i < 3; i++)
+		dst[i] = count ? sum[i] / count : 0;
+	dst[3] = 255;
+	return average;
+}
+
+/*
+================
+TexMgr_UploadPlaceholder -- replaces a lazy texture's image with a single texel of its average color
+================
+*/
+static void TexMgr_UploadPlaceholder (gltexture_t *glt)
+{
+	TexMgr_MutableTexture (glt);
+	GL_Bind (glt);
+	glTexImage2D (GL_TEXTURE_2D, 0, gl_solid_format, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &glt->average);
+	glt->width = glt->height = 1;
+	TexMgr_SetFilterModes (glt);
+	glt->placeholder = true;
+}
+
 /*
 ================
 TexMgr_LoadImage -- the one entry point for loading all textures
@@ -1221,11 +1941,14 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 			return glt;
 	}
 	else
+	{
 		glt = TexMgr_NewTexture ();
+		glt->owner = owner;
+		q_strlcpy (glt->name, name, sizeof(glt->name));
+		TexMgr_HashTexture (glt);
+	}
 
 	// copy data
-	glt->owner = owner;
-	q_strlcpy (glt->name, name, sizeof(glt->name));
 	glt->width = width;
 	glt->height = height;
 	glt->flags = flags;
@@ -1238,7 +1961,25 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 	glt->source_height = height;
 	glt->source_crc = crc;
 
+	//world textures can wait until they are seen
+	TexMgr_Unstream (glt);
+	glt->placeholder = false;
+	glt->lazy = gl_texture_lazy.value && owner && source_file[0] && format != SRC_LIGHTMAP &&
+		(flags & TEXPREF_MIPMAP) && !(flags & (TEXPREF_ALPHA | TEXPREF_PERSIST));
+	if (glt->lazy)
+	{
+		glt->average = TexMgr_AverageColor (glt, data);
+		TexMgr_UploadPlaceholder (glt);
+		return glt;
+	}
+
 	//upload it
+	if (texmgr_batchdepth && format != SRC_LIGHTMAP && gl_texture_threads.value && Tasks_NumWorkers ())
+	{
+		TexMgr_QueueImage (glt, data, width * height * ((format == SRC_RGBA) ? 4 : 1));
+		return glt;
+	}
+
 	mark = Hunk_LowMark();
 
 	switch (glt->source_format)
@@ -1390,16 +2131,36 @@ invalid:	Con_Printf ("TexMgr_ReloadImage: invalid source for %s\n", glt->name);
 
 /*
 ================
-TexMgr_ReloadImages -- reloads all texture images. called only by vid_restart
+TexMgr_ReloadImages -- called only by vid_restart, after TexMgr_DeleteTextureObjects
+
+Rereading every source takes seconds with big texture packs, so each texture
+is only reloaded the first time it gets bound (TexMgr_ReloadDeferred). The
+external images are queued for prefetching meanwhile.
 ================
 */
 void TexMgr_ReloadImages (void)
 {
 	gltexture_t *glt;
 
+	texmgr_numdeferred = 0;
+	for (glt = active_gltextures; glt; glt = glt->next)
+	{
+		texmgr_numdeferred++;
+		if (glt->source_file[0] && !glt->source_offset && Tasks_NumWorkers ())
+			Image_Prefetch (glt->source_file);
+	}
+}
+
+/*
+================
+TexMgr_ReloadDeferred -- reloads a texture TexMgr_ReloadImages left out, from GL_Bind
+================
+*/
+static void TexMgr_ReloadDeferred (gltexture_t *glt)
+{
 // ericw -- tricky bug: if the hunk is almost full, an allocation in TexMgr_ReloadImage
 // triggers cache items to be freed, which calls back into TexMgr to free the
-// texture. If this frees 'glt' in the loop below, the active_gltextures
+// texture. If this frees a texture that is being bound, the active_gltextures
 // list gets corrupted.
 // A test case is jam3_tronyn.bsp with -heapsize 65536, and do several mode
 // switches/fullscreen toggles
@@ -1407,13 +2168,17 @@ void TexMgr_ReloadImages (void)
 // switching to a boolean flag.
 	in_reload_images = true;
 
-	for (glt = active_gltextures; glt; glt = glt->next)
-	{
-		glGenTextures(1, &glt->texnum);
+	glGenTextures(1, &glt->texnum);
+	if (glt->placeholder)
+		TexMgr_UploadPlaceholder (glt);
+	else
 		TexMgr_ReloadImage (glt, -1, -1);
-	}
-	
+
 	in_reload_images = false;
+
+	// the rest will likely never be bound, drop whatever they still have prefetched
+	if (!--texmgr_numdeferred)
+		Image_FlushPrefetch ();
 }
 
 /*
@@ -1426,10 +2191,148 @@ void TexMgr_ReloadNobrightImages (void)
 	gltexture_t *glt;
 
 	for (glt = active_gltextures; glt; glt = glt->next)
-		if (glt->flags & TEXPREF_NOBRIGHT)
+		if (glt->flags & TEXPREF_NOBRIGHT && !glt->placeholder) //placeholders get the new palette when streamed in
 			TexMgr_ReloadImage(glt, -1, -1);
 }
 
+/*
+================================================================================
+
+	LAZY RESIDENCY
+
+With gl_texture_lazy, the world textures only get a single texel of their
+average color at load time. The first GL_Bind queues them, and
+TexMgr_StreamTextures reloads the queued ones from their source, a few
+milliseconds' worth per frame. Lazy textures that have gone unused for a
+while are put back to the placeholder when they add up to more than
+gl_texture_budget.
+
+================================================================================
+*/
+
+#define	MAX_STREAMING		256
+#define	EVICT_FRAMES		60	// unused for this many frames before it can be evicted
+#define	MAX_EVICTIONS		16	// per frame
+
+static gltexture_t	*texmgr_streamqueue[MAX_STREAMING];
+static int		texmgr_numstreaming;
+
+/*
+================
+TexMgr_Stream -- queues a placeholder for TexMgr_StreamTextures, from GL_Bind
+================
+*/
+static void TexMgr_Stream (gltexture_t *glt)
+{
+	if (glt->streaming || texmgr_numstreaming == MAX_STREAMING)
+		return;	// queued already, or the next bind will retry
+	glt->streaming = true;
+	texmgr_streamqueue[texmgr_numstreaming++] = glt;
+}
+
+static void TexMgr_Unstream (gltexture_t *glt)
+{
+	int i;
+
+	if (!glt->streaming)
+		return;
+	for (i = 0; i < texmgr_numstreaming; i++)
+	{
+		if (texmgr_streamqueue[i] == glt)
+		{
+			memmove (&texmgr_streamqueue[i], &texmgr_streamqueue[i+1], (texmgr_numstreaming - i - 1) * sizeof(texmgr_streamqueue[0]));
+			texmgr_numstreaming--;
+			break;
+		}
+	}
+	glt->streaming = false;
+}
+
+/*
+================
+TexMgr_LoadResident -- uploads the full image of a placeholder
+================
+*/
+static void TexMgr_LoadResident (gltexture_t *glt)
+{
+	qboolean reloading = in_reload_images;
+
+	TexMgr_Unstream (glt);
+	glt->placeholder = false;
+
+	in_reload_images = true; // see TexMgr_ReloadDeferred
+	TexMgr_ReloadImage (glt, -1, -1);
+	in_reload_images = reloading;
+}
+
+/*
+================
+TexMgr_MakeResident -- for code that needs the real image right away, like readbacks
+================
+*/
+void TexMgr_MakeResident (gltexture_t *glt)
+{
+	if (glt && glt->placeholder)
+		TexMgr_LoadResident (glt);
+}
+
+/*
+================
+TexMgr_EvictTextures -- puts the least recently used lazy textures back to placeholders
+================
+*/
+static void TexMgr_EvictTextures (void)
+{
+	gltexture_t	*glt, *oldest;
+	float		budget, texels;
+	int		i;
+
+	// in the units TexMgr_FrameUsage reports
+	budget = gl_texture_budget.value * 0x100000 / (Cvar_VariableValue("vid_bpp") / 8.0f);
+
+	for (i = 0; i < MAX_EVICTIONS; i++)
+	{
+		texels = 0;
+		oldest = NULL;
+		for (glt = active_gltextures; glt; glt = glt->next)
+		{
+			if (!glt->lazy || glt->placeholder)
+				continue;
+			texels += TexMgr_Texels (glt);
+			if (glt->visframe < r_framecount - EVICT_FRAMES && (!oldest || glt->visframe < oldest->visframe))
+				oldest = glt;
+		}
+		if (texels <= budget || !oldest)
+			break;
+
+		// a fresh texture object, so the old mip chain is freed
+		GL_DeleteTexture (oldest);
+		glGenTextures (1, &oldest->texnum);
+		TexMgr_UploadPlaceholder (oldest);
+	}
+}
+
+/*
+================
+TexMgr_StreamTextures -- called once a frame, before rendering
+================
+*/
+void TexMgr_StreamTextures (void)
+{
+	double start;
+
+	start = Sys_DoubleTime ();
+	while (texmgr_numstreaming)
+	{
+		TexMgr_LoadResident (texmgr_streamqueue[0]);
+		if (Sys_DoubleTime () - start >= gl_texture_lazy_ms.value / 1000.0)
+			break;	// at least one a frame
+	}
+
+	if (gl_texture_budget.value > 0)
+		TexMgr_EvictTextures ();
+}
+
 /*
 ================================================================================
 
@@ -1438,7 +2341,10 @@ void TexMgr_ReloadNobrightImages (void)
 ================================================================================
 */
 
-static GLuint	currenttexture[3] = {GL_UNUSED_TEXTURE, GL_UNUSED_TEXTURE, GL_UNUSED_TEXTURE}; // to avoid unnecessary texture sets
+#define	MAX_BOUND_TMUS	6	// the world shader with per-pixel lightstyles uses units 0-5
+
+static GLuint	currenttexture[MAX_BOUND_TMUS] = {GL_UNUSED_TEXTURE, GL_UNUSED_TEXTURE, GL_UNUSED_TEXTURE,
+						  GL_UNUSED_TEXTURE, GL_UNUSED_TEXTURE, GL_UNUSED_TEXTURE}; // to avoid unnecessary texture sets
 static GLenum	currenttarget = GL_TEXTURE0_ARB;
 qboolean	mtexenabled = false;
 
@@ -1496,11 +2402,17 @@ void GL_Bind (gltexture_t *texture)
 	if (!texture)
 		texture = nulltexture;
 
+	if (!texture->texnum && texmgr_numdeferred)
+		TexMgr_ReloadDeferred (texture);
+	if (texture->placeholder)
+		TexMgr_Stream (texture);
+
+	//visframe is kept up to date even if it stays bound, for TexMgr_EvictTextures
+	texture->visframe = r_framecount;
 	if (texture->texnum != currenttexture[currenttarget - GL_TEXTURE0_ARB])
 	{
 		currenttexture[currenttarget - GL_TEXTURE0_ARB] = texture->texnum;
 		glBindTexture (GL_TEXTURE_2D, texture->texnum);
-		texture->visframe = r_framecount;
 	}
 }
 
@@ -1514,11 +2426,16 @@ from our per-TMU cached texture binding table.
 */
 static void GL_DeleteTexture (gltexture_t *texture)
 {
+	int i;
+
 	glDeleteTextures (1, &texture->texnum);
+	texture->storagelevels = 0;
 
-	if (texture->texnum == currenttexture[0]) currenttexture[0] = GL_UNUSED_TEXTURE;
-	if (texture->texnum == currenttexture[1]) currenttexture[1] = GL_UNUSED_TEXTURE;
-	if (texture->texnum == currenttexture[2]) currenttexture[2] = GL_UNUSED_TEXTURE;
+	for (i = 0; i < MAX_BOUND_TMUS; i++)
+	{
+		if (texture->texnum == currenttexture[i])
+			currenttexture[i] = GL_UNUSED_TEXTURE;
+	}
 
 	texture->texnum = 0;
 }
@@ -1535,7 +2452,7 @@ Call this after changing the binding outside of GL_Bind.
 void GL_ClearBindings(void)
 {
 	int i;
-	for (i = 0; i < 3; i++)
+	for (i = 0; i < MAX_BOUND_TMUS; i++)
 	{
 		currenttexture[i] = GL_UNUSED_TEXTURE;
 	}
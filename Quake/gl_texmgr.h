@@ -38,6 +38,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define TEXPREF_NOBRIGHT		0x0200	// use nobright mask palette
 #define TEXPREF_CONCHARS		0x0400	// use conchars palette
 #define TEXPREF_WARPIMAGE		0x0800	// resize this texture when warpimagesize changes
+#define TEXPREF_COLORMAP		0x1000	// use colormap mask palette
 
 enum srcformat {SRC_INDEXED, SRC_LIGHTMAP, SRC_RGBA};
 
@@ -46,8 +47,12 @@ typedef uintptr_t src_offset_t;
 typedef struct gltexture_s {
 //managed by texture manager
 	GLuint			texnum;
-	struct gltexture_s	*next;
+	struct gltexture_s	*next, *prev;	// active or free list, prev only while active
+	struct gltexture_s	*hashnext;	// same owner and name hash
+	struct gltexture_s	*ownernext;	// same owner hash
 	qmodel_t		*owner;
+	int			storagelevels; //levels of its immutable storage, 0 while mutable
+	GLenum			storageformat; //internal format of the immutable storage
 //managed by image loading
 	char			name[64];
 	unsigned int		width; //size of image as it exists in opengl
@@ -63,6 +68,11 @@ typedef struct gltexture_s {
 	signed char			pants; //0-13 pants color, or -1 if never colormapped
 //used for rendering
 	int			visframe; //matches r_framecount if texture was bound this frame
+//lazy residency, see TexMgr_StreamTextures
+	qboolean		lazy; //uploaded on first use, and evicted when over gl_texture_budget
+	qboolean		placeholder; //only the average color is uploaded
+	qboolean		streaming; //queued to be uploaded
+	unsigned int		average; //the placeholder color
 } gltexture_t;
 
 extern gltexture_t *notexture;
@@ -74,15 +84,18 @@ extern unsigned int d_8to24table_nobright[256];
 extern unsigned int d_8to24table_conchars[256];
 extern unsigned int d_8to24table_shirt[256];
 extern unsigned int d_8to24table_pants[256];
+extern unsigned int d_8to24table_colormap[256];
 
 // TEXTURE MANAGER
 
 float TexMgr_FrameUsage (void);
+double TexMgr_MemoryUsed (void);
 gltexture_t *TexMgr_FindTexture (qmodel_t *owner, const char *name);
 gltexture_t *TexMgr_NewTexture (void);
 void TexMgr_FreeTexture (gltexture_t *kill);
 void TexMgr_FreeTextures (unsigned int flags, unsigned int mask);
 void TexMgr_FreeTexturesForOwner (qmodel_t *owner);
+void TexMgr_FreeLightmapsForOwner (qmodel_t *owner);
 void TexMgr_NewGame (void);
 void TexMgr_Init (void);
 void TexMgr_DeleteTextureObjects (void);
@@ -93,6 +106,13 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants);
 void TexMgr_ReloadImages (void);
 void TexMgr_ReloadNobrightImages (void);
+void TexMgr_BeginBatch (void);
+void TexMgr_EndBatch (void);
+void TexMgr_FlushUploads (void);
+void TexMgr_StreamTextures (void);
+void TexMgr_MakeResident (gltexture_t *glt);
+void TexMgr_SetArrayFilterModes (void);
+void TexMgr_SetCubeMapFilterModes (void);
 
 int TexMgr_Pad(int s);
 int TexMgr_SafeTextureSize (int s);
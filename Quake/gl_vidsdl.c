@@ -103,6 +103,46 @@ qboolean gl_swap_control = false; //johnfitz
 qboolean gl_anisotropy_able = false; //johnfitz
 float gl_max_anisotropy; //johnfitz
 qboolean gl_texture_NPOT = false; //ericw
+qboolean gl_texture_s3tc = false;
+qboolean gl_texture_bptc = false;
+QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC GL_CompressedTexImage2DFunc = NULL;
+QS_PFNGLGETCOMPRESSEDTEXIMAGEPROC GL_GetCompressedTexImageFunc = NULL;
+qboolean gl_texture_storage_able = false;
+qboolean gl_generate_mipmap_able = false;
+QS_PFNGLTEXSTORAGE2DPROC GL_TexStorage2DFunc = NULL;
+QS_PFNGLGENERATEMIPMAPPROC GL_GenerateMipmapFunc = NULL;
+qboolean gl_texture_array_able = false;
+GLint gl_max_array_layers = 0;
+QS_PFNGLTEXIMAGE3DPROC GL_TexImage3DFunc = NULL;
+QS_PFNGLTEXSUBIMAGE3DPROC GL_TexSubImage3DFunc = NULL;
+qboolean gl_buffer_storage_able = false;
+QS_PFNGLBUFFERSTORAGEPROC GL_BufferStorageFunc = NULL;
+QS_PFNGLMAPBUFFERRANGEPROC GL_MapBufferRangeFunc = NULL;
+QS_PFNGLFENCESYNCPROC GL_FenceSyncFunc = NULL;
+QS_PFNGLCLIENTWAITSYNCPROC GL_ClientWaitSyncFunc = NULL;
+QS_PFNGLDELETESYNCPROC GL_DeleteSyncFunc = NULL;
+qboolean gl_instanced_arrays_able = false;
+QS_PFNGLVERTEXATTRIBDIVISORPROC GL_VertexAttribDivisorFunc = NULL;
+QS_PFNGLDRAWARRAYSINSTANCEDPROC GL_DrawArraysInstancedFunc = NULL;
+QS_PFNGLDRAWELEMENTSINSTANCEDPROC GL_DrawElementsInstancedFunc = NULL;
+qboolean gl_occlusion_query_able = false;
+QS_PFNGLQUERYCOUNTERPROC GL_QueryCounterFunc = NULL;
+QS_PFNGLGETQUERYOBJECTUI64VPROC GL_GetQueryObjectui64vFunc = NULL;
+qboolean gl_timer_query_able = false;
+QS_PFNGLMAPBUFFERPROC GL_MapBufferFunc = NULL;
+QS_PFNGLUNMAPBUFFERPROC GL_UnmapBufferFunc = NULL;
+qboolean gl_pbo_able = false;
+QS_PFNGLMULTIDRAWELEMENTSINDIRECTPROC GL_MultiDrawElementsIndirectFunc = NULL;
+qboolean gl_multidrawindirect_able = false;
+QS_PFNGLGETPROGRAMBINARYPROC GL_GetProgramBinaryFunc = NULL;
+QS_PFNGLPROGRAMBINARYPROC GL_ProgramBinaryFunc = NULL;
+QS_PFNGLPROGRAMPARAMETERIPROC GL_ProgramParameteriFunc = NULL;
+qboolean gl_programbinary_able = false;
+QS_PFNGLGENQUERIESPROC GL_GenQueriesFunc = NULL;
+QS_PFNGLDELETEQUERIESPROC GL_DeleteQueriesFunc = NULL;
+QS_PFNGLBEGINQUERYPROC GL_BeginQueryFunc = NULL;
+QS_PFNGLENDQUERYPROC GL_EndQueryFunc = NULL;
+QS_PFNGLGETQUERYOBJECTUIVPROC GL_GetQueryObjectuivFunc = NULL;
 qboolean gl_vbo_able = false; //ericw
 qboolean gl_glsl_able = false; //ericw
 GLint gl_max_texture_units = 0; //ericw
@@ -142,6 +182,7 @@ QS_PFNGLUNIFORM1IPROC GL_Uniform1iFunc = NULL; //ericw
 QS_PFNGLUNIFORM1FPROC GL_Uniform1fFunc = NULL; //ericw
 QS_PFNGLUNIFORM3FPROC GL_Uniform3fFunc = NULL; //ericw
 QS_PFNGLUNIFORM4FPROC GL_Uniform4fFunc = NULL; //ericw
+QS_PFNGLUNIFORM4FVPROC GL_Uniform4fvFunc = NULL;
 
 //====================================
 
@@ -429,12 +470,22 @@ static qboolean VID_GetDesktopFullscreen (void)
 /*
 ====================
 VID_GetVSync
+
+Returns 0 for off, 1 for on, 2 for adaptive (late frames swap immediately)
 ====================
 */
-static qboolean VID_GetVSync (void)
+static int VID_GetVSync (void)
 {
 #if defined(USE_SDL2)
-	return SDL_GL_GetSwapInterval() == 1;
+	switch (SDL_GL_GetSwapInterval())
+	{
+	case 1:
+		return 1;
+	case -1:
+		return (vid_vsync.value == 2) ? 2 : 0;	// -1 is also the failure code
+	default:
+		return 0;
+	}
 #else
 	int swap_control;
 	if (SDL_GL_GetAttribute(SDL_GL_SWAP_CONTROL, &swap_control) == 0)
@@ -678,7 +729,9 @@ static qboolean VID_SetMode (int width, int height, int refreshrate, int bpp, qb
 	}
 
 	gl_swap_control = true;
-	if (SDL_GL_SetSwapInterval ((vid_vsync.value) ? 1 : 0) == -1)
+	if (vid_vsync.value == 2 && SDL_GL_SetSwapInterval (-1) == 0)
+		;	// adaptive vsync
+	else if (SDL_GL_SetSwapInterval ((vid_vsync.value) ? 1 : 0) == -1)
 		gl_swap_control = false;
 
 #else /* !defined(USE_SDL2) */
@@ -803,13 +856,24 @@ static void VID_Restart (void)
 // We must not interleave deleting the old objects with creating new ones, because
 // one of the new objects could be given the same ID as an invalid handle
 // which is later deleted.
+// SDL2 keeps the window and the context though, so the managed textures, which
+// take by far the longest to reload, are kept as well.
 
+#if !defined(USE_SDL2)
 	TexMgr_DeleteTextureObjects ();
+	Sky_DeleteCubeMap ();
+#endif
 	GLSLGamma_DeleteTexture ();
 	R_ScaleView_DeleteTexture ();
 	R_DeleteShaders ();
 	GL_DeleteBModelVertexBuffer ();
 	GLMesh_DeleteVertexBuffers ();
+	GL_DeleteStreamBuffer ();
+	R_DeleteParticleBuffer ();
+	R_DeleteLightmapBuffers ();
+	R_DeleteOcclusionQueries ();
+	GL_DeleteTimerQueries ();
+	SCR_DeleteCaptureBuffers ();
 
 //
 // set new mode
@@ -817,7 +881,10 @@ static void VID_Restart (void)
 	VID_SetMode (width, height, refreshrate, bpp, fullscreen);
 
 	GL_Init ();
+#if !defined(USE_SDL2)
 	TexMgr_ReloadImages ();
+	Sky_ReloadCubeMap ();
+#endif
 	GL_BuildBModelVertexBuffer ();
 	GLMesh_LoadVertexBuffers ();
 	GL_SetupState ();
@@ -1094,7 +1161,7 @@ static void GL_CheckExtensions (void)
 #endif
 	}
 #if defined(USE_SDL2)
-	else if ((swap_control = SDL_GL_GetSwapInterval()) == -1)
+	else if ((swap_control = SDL_GL_GetSwapInterval()) == -1 && vid_vsync.value != 2)
 #else
 	else if (SDL_GL_GetAttribute(SDL_GL_SWAP_CONTROL, &swap_control) == -1)
 #endif
@@ -1106,7 +1173,7 @@ static void GL_CheckExtensions (void)
 		Con_Warning ("vertical sync not supported (SDL_GL_GetAttribute failed)\n");
 #endif
 	}
-	else if ((vid_vsync.value && swap_control != 1) || (!vid_vsync.value && swap_control != 0))
+	else if ((vid_vsync.value && swap_control == 0) || (!vid_vsync.value && swap_control != 0))
 	{
 		gl_swap_control = false;
 		Con_Warning ("vertical sync not supported (swap_control doesn't match vid_vsync)\n");
@@ -1175,6 +1242,80 @@ static void GL_CheckExtensions (void)
 	{
 		Con_Warning ("texture_non_power_of_two not supported\n");
 	}
+
+	// texture compression, only used by the texture cache
+	//
+	if (COM_CheckParm("-notexturecompression"))
+		Con_Warning ("texture compression disabled at command line\n");
+	else if (GL_ParseExtensionList(gl_extensions, "GL_ARB_texture_compression"))
+	{
+		GL_CompressedTexImage2DFunc = (QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) SDL_GL_GetProcAddress("glCompressedTexImage2DARB");
+		GL_GetCompressedTexImageFunc = (QS_PFNGLGETCOMPRESSEDTEXIMAGEPROC) SDL_GL_GetProcAddress("glGetCompressedTexImageARB");
+		if (GL_CompressedTexImage2DFunc && GL_GetCompressedTexImageFunc)
+		{
+			if (GL_ParseExtensionList(gl_extensions, "GL_EXT_texture_compression_s3tc"))
+			{
+				Con_Printf("FOUND: EXT_texture_compression_s3tc\n");
+				gl_texture_s3tc = true;
+			}
+			if (GL_ParseExtensionList(gl_extensions, "GL_ARB_texture_compression_bptc"))
+			{
+				Con_Printf("FOUND: ARB_texture_compression_bptc\n");
+				gl_texture_bptc = true;
+			}
+		}
+		if (!gl_texture_s3tc && !gl_texture_bptc)
+			Con_Warning ("texture compression not supported\n");
+	}
+	else
+	{
+		Con_Warning ("texture compression not supported\n");
+	}
+
+	// immutable texture storage
+	//
+	if (COM_CheckParm("-notexturestorage"))
+		Con_Warning ("texture storage disabled at command line\n");
+	else if ((gl_version_major > 4 || (gl_version_major == 4 && gl_version_minor >= 2)) ||
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_texture_storage"))
+	{
+		GL_TexStorage2DFunc = (QS_PFNGLTEXSTORAGE2DPROC) SDL_GL_GetProcAddress("glTexStorage2D");
+		if (GL_TexStorage2DFunc)
+		{
+			Con_Printf("FOUND: ARB_texture_storage\n");
+			gl_texture_storage_able = true;
+		}
+		else
+		{
+			Con_Warning ("texture storage not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("texture storage not supported\n");
+	}
+
+	// generated mipmaps
+	//
+	if (COM_CheckParm("-nogeneratemipmap"))
+		Con_Warning ("generated mipmaps disabled at command line\n");
+	else if (gl_version_major >= 3 || GL_ParseExtensionList(gl_extensions, "GL_ARB_framebuffer_object"))
+	{
+		GL_GenerateMipmapFunc = (QS_PFNGLGENERATEMIPMAPPROC) SDL_GL_GetProcAddress("glGenerateMipmap");
+		if (GL_GenerateMipmapFunc)
+		{
+			Con_Printf("FOUND: glGenerateMipmap\n");
+			gl_generate_mipmap_able = true;
+		}
+		else
+		{
+			Con_Warning ("generated mipmaps not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("generated mipmaps not supported\n");
+	}
 	
 	// GLSL
 	//
@@ -1205,6 +1346,7 @@ static void GL_CheckExtensions (void)
 		GL_Uniform1fFunc = (QS_PFNGLUNIFORM1FPROC) SDL_GL_GetProcAddress("glUniform1f");
 		GL_Uniform3fFunc = (QS_PFNGLUNIFORM3FPROC) SDL_GL_GetProcAddress("glUniform3f");
 		GL_Uniform4fFunc = (QS_PFNGLUNIFORM4FPROC) SDL_GL_GetProcAddress("glUniform4f");
+		GL_Uniform4fvFunc = (QS_PFNGLUNIFORM4FVPROC) SDL_GL_GetProcAddress("glUniform4fv");
 
 		if (GL_CreateShaderFunc &&
 			GL_DeleteShaderFunc &&
@@ -1228,7 +1370,8 @@ static void GL_CheckExtensions (void)
 			GL_Uniform1iFunc &&
 			GL_Uniform1fFunc &&
 			GL_Uniform3fFunc &&
-			GL_Uniform4fFunc)
+			GL_Uniform4fFunc &&
+			GL_Uniform4fvFunc)
 		{
 			Con_Printf("FOUND: GLSL\n");
 			gl_glsl_able = true;
@@ -1268,6 +1411,249 @@ static void GL_CheckExtensions (void)
 	{
 		Con_Warning ("GLSL alias model rendering not available, using Fitz renderer\n");
 	}
+
+	// texture arrays for the GLSL world renderer
+	//
+	if (COM_CheckParm("-notexturearray"))
+		Con_Warning ("texture arrays disabled at command line\n");
+	else if (gl_glsl_alias_able && GL_ParseExtensionList(gl_extensions, "GL_EXT_texture_array"))
+	{
+		GL_TexImage3DFunc = (QS_PFNGLTEXIMAGE3DPROC) SDL_GL_GetProcAddress("glTexImage3D");
+		GL_TexSubImage3DFunc = (QS_PFNGLTEXSUBIMAGE3DPROC) SDL_GL_GetProcAddress("glTexSubImage3D");
+		if (GL_TexImage3DFunc && GL_TexSubImage3DFunc)
+		{
+			glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS_EXT, &gl_max_array_layers);
+			Con_Printf("FOUND: EXT_texture_array (%d layers)\n", (int)gl_max_array_layers);
+			gl_texture_array_able = true;
+		}
+		else
+		{
+			Con_Warning ("texture arrays not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("texture arrays not available\n");
+	}
+
+	// persistently mapped streaming buffer
+	//
+	if (COM_CheckParm("-nobufferstorage"))
+		Con_Warning ("buffer storage disabled at command line\n");
+	else if (gl_vbo_able && (gl_version_major > 4 || (gl_version_major == 4 && gl_version_minor >= 4) ||
+		(GL_ParseExtensionList(gl_extensions, "GL_ARB_buffer_storage") &&
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_map_buffer_range") &&
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_sync"))))
+	{
+		GL_BufferStorageFunc = (QS_PFNGLBUFFERSTORAGEPROC) SDL_GL_GetProcAddress("glBufferStorage");
+		GL_MapBufferRangeFunc = (QS_PFNGLMAPBUFFERRANGEPROC) SDL_GL_GetProcAddress("glMapBufferRange");
+		GL_FenceSyncFunc = (QS_PFNGLFENCESYNCPROC) SDL_GL_GetProcAddress("glFenceSync");
+		GL_ClientWaitSyncFunc = (QS_PFNGLCLIENTWAITSYNCPROC) SDL_GL_GetProcAddress("glClientWaitSync");
+		GL_DeleteSyncFunc = (QS_PFNGLDELETESYNCPROC) SDL_GL_GetProcAddress("glDeleteSync");
+		if (GL_BufferStorageFunc && GL_MapBufferRangeFunc && GL_FenceSyncFunc && GL_ClientWaitSyncFunc && GL_DeleteSyncFunc)
+		{
+			Con_Printf("FOUND: ARB_buffer_storage\n");
+			gl_buffer_storage_able = true;
+		}
+		else
+		{
+			Con_Warning ("buffer storage not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("buffer storage not available\n");
+	}
+
+	// instanced particles
+	//
+	if (COM_CheckParm("-noinstancing"))
+		Con_Warning ("instancing disabled at command line\n");
+	else if (gl_glsl_able && gl_vbo_able && (gl_version_major > 3 || (gl_version_major == 3 && gl_version_minor >= 3)))
+	{
+		GL_VertexAttribDivisorFunc = (QS_PFNGLVERTEXATTRIBDIVISORPROC) SDL_GL_GetProcAddress("glVertexAttribDivisor");
+		GL_DrawArraysInstancedFunc = (QS_PFNGLDRAWARRAYSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawArraysInstanced");
+		GL_DrawElementsInstancedFunc = (QS_PFNGLDRAWELEMENTSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawElementsInstanced");
+		if (GL_VertexAttribDivisorFunc && GL_DrawArraysInstancedFunc && GL_DrawElementsInstancedFunc)
+		{
+			Con_Printf("FOUND: instanced arrays\n");
+			gl_instanced_arrays_able = true;
+		}
+		else
+		{
+			Con_Warning ("instanced arrays not available\n");
+		}
+	}
+	else if (gl_glsl_able && gl_vbo_able &&
+		GL_ParseExtensionList(gl_extensions, "GL_ARB_instanced_arrays") &&
+		GL_ParseExtensionList(gl_extensions, "GL_ARB_draw_instanced"))
+	{
+		GL_VertexAttribDivisorFunc = (QS_PFNGLVERTEXATTRIBDIVISORPROC) SDL_GL_GetProcAddress("glVertexAttribDivisorARB");
+		GL_DrawArraysInstancedFunc = (QS_PFNGLDRAWARRAYSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawArraysInstancedARB");
+		GL_DrawElementsInstancedFunc = (QS_PFNGLDRAWELEMENTSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawElementsInstancedARB");
+		if (GL_VertexAttribDivisorFunc && GL_DrawArraysInstancedFunc && GL_DrawElementsInstancedFunc)
+		{
+			Con_Printf("FOUND: ARB_instanced_arrays\n");
+			gl_instanced_arrays_able = true;
+		}
+		else
+		{
+			Con_Warning ("instanced arrays not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("instanced arrays not available\n");
+	}
+
+	// occlusion queries
+	//
+	if (COM_CheckParm("-noocclusion"))
+		Con_Warning ("occlusion queries disabled at command line\n");
+	else if (gl_version_major > 1 || (gl_version_major == 1 && gl_version_minor >= 5))
+	{
+		GL_GenQueriesFunc = (QS_PFNGLGENQUERIESPROC) SDL_GL_GetProcAddress("glGenQueries");
+		GL_DeleteQueriesFunc = (QS_PFNGLDELETEQUERIESPROC) SDL_GL_GetProcAddress("glDeleteQueries");
+		GL_BeginQueryFunc = (QS_PFNGLBEGINQUERYPROC) SDL_GL_GetProcAddress("glBeginQuery");
+		GL_EndQueryFunc = (QS_PFNGLENDQUERYPROC) SDL_GL_GetProcAddress("glEndQuery");
+		GL_GetQueryObjectuivFunc = (QS_PFNGLGETQUERYOBJECTUIVPROC) SDL_GL_GetProcAddress("glGetQueryObjectuiv");
+		if (GL_GenQueriesFunc && GL_DeleteQueriesFunc && GL_BeginQueryFunc && GL_EndQueryFunc && GL_GetQueryObjectuivFunc)
+		{
+			Con_Printf("FOUND: occlusion queries\n");
+			gl_occlusion_query_able = true;
+		}
+		else
+		{
+			Con_Warning ("occlusion queries not available\n");
+		}
+	}
+	else if (GL_ParseExtensionList(gl_extensions, "GL_ARB_occlusion_query"))
+	{
+		GL_GenQueriesFunc = (QS_PFNGLGENQUERIESPROC) SDL_GL_GetProcAddress("glGenQueriesARB");
+		GL_DeleteQueriesFunc = (QS_PFNGLDELETEQUERIESPROC) SDL_GL_GetProcAddress("glDeleteQueriesARB");
+		GL_BeginQueryFunc = (QS_PFNGLBEGINQUERYPROC) SDL_GL_GetProcAddress("glBeginQueryARB");
+		GL_EndQueryFunc = (QS_PFNGLENDQUERYPROC) SDL_GL_GetProcAddress("glEndQueryARB");
+		GL_GetQueryObjectuivFunc = (QS_PFNGLGETQUERYOBJECTUIVPROC) SDL_GL_GetProcAddress("glGetQueryObjectuivARB");
+		if (GL_GenQueriesFunc && GL_DeleteQueriesFunc && GL_BeginQueryFunc && GL_EndQueryFunc && GL_GetQueryObjectuivFunc)
+		{
+			Con_Printf("FOUND: ARB_occlusion_query\n");
+			gl_occlusion_query_able = true;
+		}
+		else
+		{
+			Con_Warning ("occlusion queries not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("occlusion queries not available\n");
+	}
+
+	// timer queries
+	//
+	if (COM_CheckParm("-notimerquery"))
+		Con_Warning ("timer queries disabled at command line\n");
+	else if (gl_occlusion_query_able &&
+		((gl_version_major > 3 || (gl_version_major == 3 && gl_version_minor >= 3)) ||
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_timer_query")))
+	{
+		GL_QueryCounterFunc = (QS_PFNGLQUERYCOUNTERPROC) SDL_GL_GetProcAddress("glQueryCounter");
+		GL_GetQueryObjectui64vFunc = (QS_PFNGLGETQUERYOBJECTUI64VPROC) SDL_GL_GetProcAddress("glGetQueryObjectui64v");
+		if (GL_QueryCounterFunc && GL_GetQueryObjectui64vFunc)
+		{
+			Con_Printf("FOUND: ARB_timer_query\n");
+			gl_timer_query_able = true;
+		}
+		else
+		{
+			Con_Warning ("timer queries not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("timer queries not available\n");
+	}
+
+	// pixel buffer objects
+	//
+	if (COM_CheckParm("-nopbo"))
+		Con_Warning ("pixel buffer objects disabled at command line\n");
+	else if (gl_vbo_able &&
+		((gl_version_major > 2 || (gl_version_major == 2 && gl_version_minor >= 1)) ||
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_pixel_buffer_object")))
+	{
+		GL_MapBufferFunc = (QS_PFNGLMAPBUFFERPROC) SDL_GL_GetProcAddress("glMapBufferARB");
+		GL_UnmapBufferFunc = (QS_PFNGLUNMAPBUFFERPROC) SDL_GL_GetProcAddress("glUnmapBufferARB");
+		if (GL_MapBufferFunc && GL_UnmapBufferFunc)
+		{
+			Con_Printf("FOUND: ARB_pixel_buffer_object\n");
+			gl_pbo_able = true;
+		}
+		else
+		{
+			Con_Warning ("pixel buffer objects not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("pixel buffer objects not available\n");
+	}
+
+	//
+	// multi draw indirect
+	//
+	if (COM_CheckParm("-nomdi"))
+		Con_Warning ("multi draw indirect disabled at command line\n");
+	else if (gl_vbo_able &&
+		((gl_version_major > 4 || (gl_version_major == 4 && gl_version_minor >= 3)) ||
+		 (GL_ParseExtensionList(gl_extensions, "GL_ARB_multi_draw_indirect") &&
+		  (gl_version_major >= 4 || GL_ParseExtensionList(gl_extensions, "GL_ARB_draw_indirect")))))
+	{
+		GL_MultiDrawElementsIndirectFunc = (QS_PFNGLMULTIDRAWELEMENTSINDIRECTPROC) SDL_GL_GetProcAddress("glMultiDrawElementsIndirect");
+		if (GL_MultiDrawElementsIndirectFunc)
+		{
+			Con_Printf("FOUND: ARB_multi_draw_indirect\n");
+			gl_multidrawindirect_able = true;
+		}
+		else
+		{
+			Con_Warning ("multi draw indirect not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("multi draw indirect not available\n");
+	}
+
+	//
+	// program binaries, for the GLSL program cache
+	//
+	if (COM_CheckParm("-noprogrambinary"))
+		Con_Warning ("program binaries disabled at command line\n");
+	else if (gl_glsl_able &&
+		((gl_version_major > 4 || (gl_version_major == 4 && gl_version_minor >= 1)) ||
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_get_program_binary")))
+	{
+		GLint numformats = 0;
+
+		GL_GetProgramBinaryFunc = (QS_PFNGLGETPROGRAMBINARYPROC) SDL_GL_GetProcAddress("glGetProgramBinary");
+		GL_ProgramBinaryFunc = (QS_PFNGLPROGRAMBINARYPROC) SDL_GL_GetProcAddress("glProgramBinary");
+		GL_ProgramParameteriFunc = (QS_PFNGLPROGRAMPARAMETERIPROC) SDL_GL_GetProcAddress("glProgramParameteri");
+		glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &numformats);
+		if (GL_GetProgramBinaryFunc && GL_ProgramBinaryFunc && GL_ProgramParameteriFunc && numformats > 0)
+		{
+			Con_Printf("FOUND: ARB_get_program_binary\n");
+			gl_programbinary_able = true;
+		}
+		else
+		{
+			Con_Warning ("program binaries not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("program binaries not available\n");
+	}
 }
 
 /*
@@ -1346,7 +1732,11 @@ static void GL_Init (void)
 
 	GLAlias_CreateShaders ();
 	GLWorld_CreateShaders ();
+	GLWarp_CreateShaders ();
+	GLSky_CreateShaders ();
+	GLParticles_CreateShaders ();
 	GL_ClearBufferBindings ();	
+	GL_CreateStreamBuffer ();
 }
 
 /*
@@ -1844,7 +2234,7 @@ void VID_SyncCvars (void)
 		Cvar_SetQuick (&vid_fullscreen, VID_GetFullscreen() ? "1" : "0");
 		// don't sync vid_desktopfullscreen, it's a user preference that
 		// should persist even if we are in windowed mode.
-		Cvar_SetQuick (&vid_vsync, VID_GetVSync() ? "1" : "0");
+		Cvar_SetValueQuick (&vid_vsync, VID_GetVSync());
 	}
 
 	vid_changed = false;
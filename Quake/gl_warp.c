@@ -37,6 +37,8 @@ float	turbsin[] =
 };
 
 #define WARPCALC(s,t) ((s + turbsin[(int)((t*2)+(cl.time*(128.0/M_PI))) & 255]) * (1.0/64)) //johnfitz -- correct warp
+static qboolean GLWarp_ShaderAble (void);
+
 #define WARPCALC2(s,t) ((s + turbsin[(int)((t*0.125+cl.time)*(128.0/M_PI)) & 255]) * (1.0/64)) //johnfitz -- old warp
 
 //==============================================================================
@@ -181,29 +183,25 @@ void DrawWaterPoly (glpoly_t *p)
 {
 	float	*v;
 	int		i;
+	streamvert_t	*sv;
 
-	if (load_subdivide_size > 48)
+	sv = GL_StreamVerts (p->numverts);
+	v = p->verts[0];
+	for (i=0 ; i<p->numverts ; i++, v+= VERTEXSIZE, sv++)
 	{
-		glBegin (GL_POLYGON);
-		v = p->verts[0];
-		for (i=0 ; i<p->numverts ; i++, v+= VERTEXSIZE)
+		VectorCopy (v, sv->xyz);
+		if (load_subdivide_size > 48)
 		{
-			glTexCoord2f (WARPCALC2(v[3],v[4]), WARPCALC2(v[4],v[3]));
-			glVertex3fv (v);
+			sv->st[0] = WARPCALC2(v[3],v[4]);
+			sv->st[1] = WARPCALC2(v[4],v[3]);
 		}
-		glEnd ();
-	}
-	else
-	{
-		glBegin (GL_POLYGON);
-		v = p->verts[0];
-		for (i=0 ; i<p->numverts ; i++, v+= VERTEXSIZE)
+		else
 		{
-			glTexCoord2f (WARPCALC(v[3],v[4]), WARPCALC(v[4],v[3]));
-			glVertex3fv (v);
+			sv->st[0] = WARPCALC(v[3],v[4]);
+			sv->st[1] = WARPCALC(v[4],v[3]);
 		}
-		glEnd ();
 	}
+	GL_DrawStreamVerts (GL_POLYGON, p->numverts, STREAM_TEXCOORDS);
 }
 
 //==============================================================================
@@ -225,6 +223,8 @@ void R_UpdateWarpTextures (void)
 
 	if (r_oldwater.value || cl.paused || r_drawflat_cheatsafe || r_lightmap_cheatsafe)
 		return;
+	if (GLWarp_ShaderAble ())
+		return;	// warped per pixel in R_DrawTextureChains_Water
 
 	warptess = 128.0/CLAMP (3.0, floor(r_waterquality.value), 64.0);
 
@@ -270,3 +270,153 @@ void R_UpdateWarpTextures (void)
 	//if viewsize is less than 100, we need to redraw the frame around the viewport
 	scr_tileclear_updates = 0;
 }
+
+//==============================================================================
+//
+//  SHADER WATER
+//
+//==============================================================================
+
+// the same warp R_UpdateWarpTextures renders, computed per pixel while the
+// water is drawn, so there are no warp images to update each frame
+
+static GLuint r_water_program;
+static GLint waterTexLoc;
+static GLint waterTurbTexLoc;
+static GLint waterTimeLoc;
+static GLint waterAlphaLoc;
+
+#define	TURBSIN_SCALE	20.0		// turbsin[] fits in -10..10
+static gltexture_t	*turbsin_texture;
+static byte		turbsin_data[256*4];
+
+/*
+=============
+R_InitWarpTexture
+
+turbsin[] as a 256x1 texture for the water shader
+=============
+*/
+void R_InitWarpTexture (void)
+{
+	int	i;
+	byte	v;
+
+	for (i = 0; i < 256; i++)
+	{
+		v = (byte) CLAMP (0, (turbsin[i] / TURBSIN_SCALE + 0.5) * 255.0 + 0.5, 255);
+		turbsin_data[i*4+0] = v;
+		turbsin_data[i*4+1] = v;
+		turbsin_data[i*4+2] = v;
+		turbsin_data[i*4+3] = 255;
+	}
+
+	turbsin_texture = TexMgr_LoadImage (NULL, "turbsin", 256, 1, SRC_RGBA, turbsin_data, "",
+		(src_offset_t)turbsin_data, TEXPREF_PERSIST | TEXPREF_LINEAR | TEXPREF_NOPICMIP);
+}
+
+/*
+=============
+GLWarp_CreateShaders
+=============
+*/
+void GLWarp_CreateShaders (void)
+{
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+		"	gl_Position = ftransform();\n"
+		"	FogFragCoord = gl_Position.w;\n"
+		"}\n";
+
+	// WARPCALC with the warp image's 128 units per texture coordinate
+	// folded in: index (t*2 + cl.time*128/pi) & 255 is (st.t + Time) * 256
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Tex;\n"
+		"uniform sampler2D TurbTex;\n"
+		"uniform float Time;\n"
+		"uniform float Alpha;\n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"float Turb(float index)\n"
+		"{\n"
+		"	return (texture2D(TurbTex, vec2(index + 0.5 / 256.0, 0.5)).r - 0.5) * " QS_STRINGIFY(TURBSIN_SCALE) ";\n"
+		"}\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	vec2 st = gl_TexCoord[0].xy;\n"
+		"	vec2 uv = st * 2.0 + vec2(Turb(st.y + Time), Turb(st.x + Time)) * (1.0 / 64.0);\n"
+		"	vec4 result = texture2D(Tex, uv);\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * FogFragCoord * FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	result = mix(gl_Fog.color, result, fog);\n"
+		"	result.a = Alpha;\n"
+		"	gl_FragColor = result;\n"
+		"}\n";
+
+	r_water_program = 0;
+
+	if (!gl_glsl_able)
+		return;
+
+	r_water_program = GL_CreateProgram (vertSource, fragSource, 0, NULL);
+	if (!r_water_program)
+		return;
+
+	waterTexLoc = GL_GetUniformLocation (&r_water_program, "Tex");
+	waterTurbTexLoc = GL_GetUniformLocation (&r_water_program, "TurbTex");
+	waterTimeLoc = GL_GetUniformLocation (&r_water_program, "Time");
+	waterAlphaLoc = GL_GetUniformLocation (&r_water_program, "Alpha");
+}
+
+static qboolean GLWarp_ShaderAble (void)
+{
+	return r_water_program && turbsin_texture;
+}
+
+/*
+=============
+GLWarp_BeginShader
+
+Returns false if the warp images have to be used instead.
+=============
+*/
+qboolean GLWarp_BeginShader (void)
+{
+	double	time;
+
+	if (!GLWarp_ShaderAble ())
+		return false;
+
+	GL_UseProgramFunc (r_water_program);
+	GL_Uniform1iFunc (waterTexLoc, 0);
+	GL_Uniform1iFunc (waterTurbTexLoc, 1);
+	time = cl.time / (2.0 * M_PI);
+	GL_Uniform1fFunc (waterTimeLoc, time - floor (time));
+	GL_Uniform1fFunc (waterAlphaLoc, 1.0f);
+
+	GL_SelectTexture (GL_TEXTURE1);
+	GL_Bind (turbsin_texture);
+	GL_SelectTexture (GL_TEXTURE0);
+
+	return true;
+}
+
+void GLWarp_SetAlpha (float alpha)
+{
+	GL_Uniform1fFunc (waterAlphaLoc, alpha);
+}
+
+void GLWarp_EndShader (void)
+{
+	GL_UseProgramFunc (0);
+}
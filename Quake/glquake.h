@@ -85,20 +85,6 @@ typedef enum {
 	pt_static, pt_grav, pt_slowgrav, pt_fire, pt_explode, pt_explode2, pt_blob, pt_blob2
 } ptype_t;
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
-typedef struct particle_s
-{
-// driver-usable fields
-	vec3_t		org;
-	float		color;
-// drivers never touch the following fields
-	struct particle_s	*next;
-	vec3_t		vel;
-	float		ramp;
-	float		die;
-	ptype_t		type;
-} particle_t;
-
 
 //====================================================
 
@@ -129,6 +115,7 @@ extern	cvar_t	r_drawentities;
 extern	cvar_t	r_drawworld;
 extern	cvar_t	r_drawviewmodel;
 extern	cvar_t	r_speeds;
+extern	cvar_t	r_lightgrid;
 extern	cvar_t	r_pos;
 extern	cvar_t	r_waterwarp;
 extern	cvar_t	r_fullbright;
@@ -141,6 +128,11 @@ extern	cvar_t	r_slimealpha;
 extern	cvar_t	r_dynamic;
 extern	cvar_t	r_novis;
 extern	cvar_t	r_scale;
+extern	cvar_t	r_dynamicscale, r_dynamicscale_fps, r_dynamicscale_min, r_dynamicscale_max, r_dynamicscale_show;
+extern	float	r_viewscale, r_dynamicfrac;
+extern	cvar_t	r_threads;
+extern	cvar_t	r_occlusion;
+extern	cvar_t	r_mergebmodels;
 
 extern	cvar_t	gl_clear;
 extern	cvar_t	gl_cull;
@@ -206,6 +198,7 @@ typedef void (APIENTRYP QS_PFNGLUNIFORM1IPROC) (GLint location, GLint v0);
 typedef void (APIENTRYP QS_PFNGLUNIFORM1FPROC) (GLint location, GLfloat v0);
 typedef void (APIENTRYP QS_PFNGLUNIFORM3FPROC) (GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
 typedef void (APIENTRYP QS_PFNGLUNIFORM4FPROC) (GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+typedef void (APIENTRYP QS_PFNGLUNIFORM4FVPROC) (GLint location, GLsizei count, const GLfloat *value);
 
 extern QS_PFNGLCREATESHADERPROC GL_CreateShaderFunc;
 extern QS_PFNGLDELETESHADERPROC GL_DeleteShaderFunc;
@@ -230,6 +223,7 @@ extern QS_PFNGLUNIFORM1IPROC GL_Uniform1iFunc;
 extern QS_PFNGLUNIFORM1FPROC GL_Uniform1fFunc;
 extern QS_PFNGLUNIFORM3FPROC GL_Uniform3fFunc;
 extern QS_PFNGLUNIFORM4FPROC GL_Uniform4fFunc;
+extern QS_PFNGLUNIFORM4FVPROC GL_Uniform4fvFunc;
 extern	qboolean	gl_glsl_able;
 extern	qboolean	gl_glsl_gamma_able;
 extern	qboolean	gl_glsl_alias_able;
@@ -238,7 +232,266 @@ extern	qboolean	gl_glsl_alias_able;
 //ericw -- NPOT texture support
 extern	qboolean	gl_texture_NPOT;
 
+// texture compression, used by the texture cache
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM_ARB
+#define GL_COMPRESSED_RGBA_BPTC_UNORM_ARB	0x8E8C
+#endif
+#ifndef GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB
+#define GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB	0x86A0
+#define GL_TEXTURE_COMPRESSED_ARB		0x86A1
+#endif
+typedef void (APIENTRYP QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data);
+typedef void (APIENTRYP QS_PFNGLGETCOMPRESSEDTEXIMAGEPROC) (GLenum target, GLint level, void *img);
+extern QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC GL_CompressedTexImage2DFunc;
+extern QS_PFNGLGETCOMPRESSEDTEXIMAGEPROC GL_GetCompressedTexImageFunc;
+extern	qboolean	gl_texture_s3tc;
+extern	qboolean	gl_texture_bptc;
+
+// immutable texture storage and generated mipmaps, used by the texture manager
+#ifndef GL_RGB8
+#define GL_RGB8					0x8051
+#endif
+#ifndef GL_RGBA8
+#define GL_RGBA8				0x8058
+#endif
+typedef void (APIENTRYP QS_PFNGLTEXSTORAGE2DPROC) (GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP QS_PFNGLGENERATEMIPMAPPROC) (GLenum target);
+extern QS_PFNGLTEXSTORAGE2DPROC GL_TexStorage2DFunc;
+extern QS_PFNGLGENERATEMIPMAPPROC GL_GenerateMipmapFunc;
+extern	qboolean	gl_texture_storage_able;
+extern	qboolean	gl_generate_mipmap_able;
+
+// texture arrays, used to batch world textures of the same size
+#ifndef GL_TEXTURE_2D_ARRAY_EXT
+#define GL_TEXTURE_2D_ARRAY_EXT			0x8C1A
+#define GL_MAX_ARRAY_TEXTURE_LAYERS_EXT		0x88FF
+#endif
+
+#ifndef GL_MAX_TEXTURE_IMAGE_UNITS
+#define GL_MAX_TEXTURE_IMAGE_UNITS		0x8872
+#endif
+#ifndef GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS
+#define GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS	0x8B4C
+#endif
+typedef void (APIENTRYP QS_PFNGLTEXIMAGE3DPROC) (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void *pixels);
+typedef void (APIENTRYP QS_PFNGLTEXSUBIMAGE3DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void *pixels);
+extern QS_PFNGLTEXIMAGE3DPROC GL_TexImage3DFunc;
+extern QS_PFNGLTEXSUBIMAGE3DPROC GL_TexSubImage3DFunc;
+extern	qboolean	gl_texture_array_able;
+extern	GLint		gl_max_array_layers;
+
+#define	MAX_TEXARRAYS	64
+
+typedef struct
+{
+	GLuint		texnum;
+	GLuint		fbtexnum;	// 0 if none of the layers has a fullbright mask
+	qboolean	fullbrights;
+	int		width, height;
+	int		texwidth, texheight;	// GL_TexCoordSize of its textures
+	int		numlayers, nummips;
+} texarray_t;
+
+extern	texarray_t	gl_texarrays[MAX_TEXARRAYS];
+extern	int		gl_numtexarrays;
+extern	GLuint		gl_bmodel_layer_vbo;
+extern	GLuint		gl_bmodel_style_vbo;
+
+// gl_bmodel_vbo layout with gl_packedvertices
+typedef struct
+{
+	float		xyz[3];
+	short		st[2];		// texels from GL_SurfaceTexOrigin, << gl_bmodel_texbits
+	unsigned short	lmst[2];	// lightmap coords, normalized
+} packedvert_t;
+
+extern	int		gl_bmodel_texbits;	// 0 for VERTEXSIZE floats
+
+// persistently mapped streaming buffer (ARB_buffer_storage + ARB_sync)
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_WRITE_BIT			0x0002
+#define GL_MAP_PERSISTENT_BIT			0x0040
+#define GL_MAP_COHERENT_BIT			0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE		0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT		0x00000001
+#define GL_TIMEOUT_EXPIRED			0x911B
+#endif
+typedef struct __GLsync *QS_GLsync;
+typedef void (APIENTRYP QS_PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void *(APIENTRYP QS_PFNGLMAPBUFFERRANGEPROC) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef QS_GLsync (APIENTRYP QS_PFNGLFENCESYNCPROC) (GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRYP QS_PFNGLCLIENTWAITSYNCPROC) (QS_GLsync sync, GLbitfield flags, uint64_t timeout);
+typedef void (APIENTRYP QS_PFNGLDELETESYNCPROC) (QS_GLsync sync);
+extern QS_PFNGLBUFFERSTORAGEPROC GL_BufferStorageFunc;
+extern QS_PFNGLMAPBUFFERRANGEPROC GL_MapBufferRangeFunc;
+extern QS_PFNGLFENCESYNCPROC GL_FenceSyncFunc;
+extern QS_PFNGLCLIENTWAITSYNCPROC GL_ClientWaitSyncFunc;
+extern QS_PFNGLDELETESYNCPROC GL_DeleteSyncFunc;
+extern	qboolean	gl_buffer_storage_able;
+
+// instanced drawing (ARB_instanced_arrays + ARB_draw_instanced)
+typedef void (APIENTRYP QS_PFNGLVERTEXATTRIBDIVISORPROC) (GLuint index, GLuint divisor);
+typedef void (APIENTRYP QS_PFNGLDRAWARRAYSINSTANCEDPROC) (GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+typedef void (APIENTRYP QS_PFNGLDRAWELEMENTSINSTANCEDPROC) (GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount);
+extern QS_PFNGLVERTEXATTRIBDIVISORPROC GL_VertexAttribDivisorFunc;
+extern QS_PFNGLDRAWARRAYSINSTANCEDPROC GL_DrawArraysInstancedFunc;
+extern QS_PFNGLDRAWELEMENTSINSTANCEDPROC GL_DrawElementsInstancedFunc;
+extern	qboolean	gl_instanced_arrays_able;
+
+// occlusion queries (ARB_occlusion_query, core in GL 1.5)
+#ifndef GL_SAMPLES_PASSED
+#define GL_SAMPLES_PASSED			0x8914
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT				0x8866
+#define GL_QUERY_RESULT_AVAILABLE	0x8867
+#endif
+typedef void (APIENTRYP QS_PFNGLGENQUERIESPROC) (GLsizei n, GLuint *ids);
+typedef void (APIENTRYP QS_PFNGLDELETEQUERIESPROC) (GLsizei n, const GLuint *ids);
+typedef void (APIENTRYP QS_PFNGLBEGINQUERYPROC) (GLenum target, GLuint id);
+typedef void (APIENTRYP QS_PFNGLENDQUERYPROC) (GLenum target);
+typedef void (APIENTRYP QS_PFNGLGETQUERYOBJECTUIVPROC) (GLuint id, GLenum pname, GLuint *params);
+extern QS_PFNGLGENQUERIESPROC GL_GenQueriesFunc;
+extern QS_PFNGLDELETEQUERIESPROC GL_DeleteQueriesFunc;
+extern QS_PFNGLBEGINQUERYPROC GL_BeginQueryFunc;
+extern QS_PFNGLENDQUERYPROC GL_EndQueryFunc;
+extern QS_PFNGLGETQUERYOBJECTUIVPROC GL_GetQueryObjectuivFunc;
+extern	qboolean	gl_occlusion_query_able;
+
+// timer queries (ARB_timer_query, core in GL 3.3), uses the query functions above
+#ifndef GL_TIMESTAMP
+#define GL_TIME_ELAPSED				0x88BF
+#define GL_TIMESTAMP				0x8E28
+#endif
+typedef void (APIENTRYP QS_PFNGLQUERYCOUNTERPROC) (GLuint id, GLenum target);
+typedef void (APIENTRYP QS_PFNGLGETQUERYOBJECTUI64VPROC) (GLuint id, GLenum pname, uint64_t *params);
+extern QS_PFNGLQUERYCOUNTERPROC GL_QueryCounterFunc;
+extern QS_PFNGLGETQUERYOBJECTUI64VPROC GL_GetQueryObjectui64vFunc;
+extern	qboolean	gl_timer_query_able;
+
+// pixel buffer objects (ARB_pixel_buffer_object, core in GL 2.1), for async glReadPixels
+// and lightmap uploads
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER			0x88EB
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER			0x88EC
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY				0x88B9
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ				0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY				0x88B8
+#endif
+typedef void *(APIENTRYP QS_PFNGLMAPBUFFERPROC) (GLenum target, GLenum access);
+typedef GLboolean (APIENTRYP QS_PFNGLUNMAPBUFFERPROC) (GLenum target);
+extern QS_PFNGLMAPBUFFERPROC GL_MapBufferFunc;
+extern QS_PFNGLUNMAPBUFFERPROC GL_UnmapBufferFunc;
+extern	qboolean	gl_pbo_able;
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER			0x8F3F
+#endif
+typedef void (APIENTRYP QS_PFNGLMULTIDRAWELEMENTSINDIRECTPROC) (GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+extern QS_PFNGLMULTIDRAWELEMENTSINDIRECTPROC GL_MultiDrawElementsIndirectFunc;
+extern	qboolean	gl_multidrawindirect_able;
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT	0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH		0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS		0x87FE
+#endif
+typedef void (APIENTRYP QS_PFNGLGETPROGRAMBINARYPROC) (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP QS_PFNGLPROGRAMBINARYPROC) (GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP QS_PFNGLPROGRAMPARAMETERIPROC) (GLuint program, GLenum pname, GLint value);
+extern QS_PFNGLGETPROGRAMBINARYPROC GL_GetProgramBinaryFunc;
+extern QS_PFNGLPROGRAMBINARYPROC GL_ProgramBinaryFunc;
+extern QS_PFNGLPROGRAMPARAMETERIPROC GL_ProgramParameteriFunc;
+extern	qboolean	gl_programbinary_able;
+
+// gpu time per render pass, for r_speeds and benchmark
+typedef enum
+{
+	GPU_WORLD,
+	GPU_WATER,
+	GPU_SKY,
+	GPU_MODELS,
+	GPU_PARTICLES,
+	GPU_2D,
+	GPU_POST,
+	GPU_NUMPASSES
+} gpupass_t;
+#define	GPU_FRAMES		3	// frames of timer queries in flight
+
+extern	const char	*gpu_passnames[GPU_NUMPASSES];
+extern	float		gpu_passms[GPU_NUMPASSES];	// milliseconds, a few frames old
+extern	int		gpu_results;			// counts the frames read into gpu_passms
+extern	qboolean	gpu_timing;			// gpu_passms is being updated
+void GL_TimerFrame (void);
+void GL_TimerBegin (gpupass_t pass);
+void GL_TimerEnd (gpupass_t pass);
+void GL_DeleteTimerQueries (void);
+
+// per-frame geometry is written to gl_streambuffer instead of using
+// client memory or glBegin/glEnd; use the returned offset as the pointer
+// argument of gl*Pointer/glDrawElements with gl_streambuffer bound
+#define	MAX_STREAM_ALLOC	(1024 * 1024)
+
+extern	GLuint		gl_streambuffer;
+
+// bytes of GPU memory outside the texture manager, for memstats
+typedef enum
+{
+	GLMEM_TEXARRAYS,	// the world texture arrays
+	GLMEM_SKYBOX,		// the skybox cube map
+	GLMEM_BRUSH,		// the brush model vertex and index buffers
+	GLMEM_ALIAS,		// alias model vertex buffers
+	GLMEM_STREAM,		// gl_streambuffer
+	GLMEM_PBO,		// lightmap upload buffers
+	GLMEM_PARTICLES,	// r_gpuparticles ring
+	GLMEM_NUMTYPES
+} glmemtype_t;
+
+extern	int		gl_memory[GLMEM_NUMTYPES];
+
+void GL_CreateStreamBuffer (void);
+void GL_DeleteStreamBuffer (void);
+void *GL_StreamAlloc (int size);	// room for up to size bytes, until GL_StreamCommit
+GLintptr GL_StreamCommit (int used);
+
+// fixed function arrays on top of the streaming buffer
+typedef struct
+{
+	float	xyz[3];
+	float	st[2];
+	float	st2[2];		// texture unit 1
+	GLubyte	color[4];
+} streamvert_t;
+
+#define	MAX_STREAM_VERTS	(MAX_STREAM_ALLOC / (int)sizeof(streamvert_t))
+
+#define	STREAM_TEXCOORDS	1
+#define	STREAM_TEXCOORDS2	2
+#define	STREAM_COLORS		4
+
+streamvert_t *GL_StreamVerts (int numverts);
+void GL_DrawStreamVerts (GLenum mode, int numverts, int flags);
+
 //johnfitz -- polygon offset
+#define OFFSET_PREPASS 2
 #define OFFSET_BMODEL 1
 #define OFFSET_NONE 0
 #define OFFSET_DECAL -1
@@ -252,19 +505,28 @@ void GL_PolygonOffset (int);
 #define GL_COMBINE_RGB_EXT	0x8571
 #define GL_COMBINE_ALPHA_EXT	0x8572
 #define GL_RGB_SCALE_EXT	0x8573
+#define GL_INTERPOLATE_EXT	0x8575
 #define GL_CONSTANT_EXT		0x8576
 #define GL_PRIMARY_COLOR_EXT	0x8577
 #define GL_PREVIOUS_EXT		0x8578
 #define GL_SOURCE0_RGB_EXT	0x8580
 #define GL_SOURCE1_RGB_EXT	0x8581
+#define GL_SOURCE2_RGB_EXT	0x8582
 #define GL_SOURCE0_ALPHA_EXT	0x8588
 #define GL_SOURCE1_ALPHA_EXT	0x8589
+#define GL_OPERAND0_RGB_EXT	0x8590
+#define GL_OPERAND1_RGB_EXT	0x8591
+#define GL_OPERAND2_RGB_EXT	0x8592
 extern qboolean gl_texture_env_combine;
 extern qboolean gl_texture_env_add; // for GL_EXT_texture_env_add
 
 //johnfitz -- rendering statistics
 extern int rs_brushpolys, rs_aliaspolys, rs_skypolys, rs_particles, rs_fogpolys;
-extern int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+extern int rs_dynamiclightmaps, rs_stylesurfs, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+extern int rs_aliasmodels;
+extern double rs_aliastime;
+extern int rs_pvshits, rs_pvsmisses, rs_pvsbytes;
+extern int rs_occludedleafs, rs_occludedents;
 extern float rs_megatexels;
 
 //johnfitz -- track developer statistics that vary every frame
@@ -277,6 +539,7 @@ typedef struct {
 	int		tempents;
 	int		beams;
 	int		dlights;
+	int		modlookups;	// Mod_FindName calls
 } devstats_t;
 extern devstats_t dev_stats, dev_peakstats;
 
@@ -293,8 +556,11 @@ extern overflowtimes_t dev_overflows; //this stores the last time overflow messa
 //johnfitz -- moved here from r_brush.c
 extern int gl_lightmap_format, lightmap_bytes;
 
-#define LMBLOCK_WIDTH	256	//FIXME: make dynamic. if we have a decent card there's no real reason not to use 4k or 16k (assuming there's no lightstyles/dynamics that need uploading...)
-#define LMBLOCK_HEIGHT	256 //Alternatively, use texture arrays, which would avoid the need to switch textures as often.
+#define LMBLOCK_WIDTH	256	//smallest lightmap page, also the largest lightmap a single surface can have
+#define LMBLOCK_HEIGHT	256
+#define MAX_LMBLOCK_SIZE	4096	//largest lightmap page, from gl_lightmap_size
+
+extern int lmblock_width, lmblock_height; //lightmap page size of the current map, chosen by GL_BuildLightmaps
 
 typedef struct glRect_s {
 	unsigned short l,t,w,h;
@@ -305,10 +571,17 @@ struct lightmap_s
 	glpoly_t	*polys;
 	qboolean	modified;
 	glRect_t	rectchange;
+	int		used;	// luxels handed out by AllocBlock
 
 	// the lightmap texture data needs to be kept in
 	// main memory so texsubimage can update properly
 	byte		*data;//[4*LMBLOCK_WIDTH*LMBLOCK_HEIGHT];
+
+	// raw samples of each lightstyle slot, combined per pixel by the
+	// world shader when r_gpulighting is on; slots are used in order
+	int		numstyles;
+	byte		*styledata[MAXLIGHTMAPS];
+	gltexture_t	*styletextures[MAXLIGHTMAPS];
 };
 extern struct lightmap_s *lightmaps;
 extern int lightmap_count;	//allocated lightmaps
@@ -316,6 +589,7 @@ extern int lightmap_count;	//allocated lightmaps
 extern int gl_warpimagesize; //johnfitz -- for water warp
 
 extern qboolean r_drawflat_cheatsafe, r_fullbright_cheatsafe, r_lightmap_cheatsafe, r_drawworld_cheatsafe; //johnfitz
+extern qboolean r_gpulightmaps; //lightstyles and dynamic lights are applied by the world shader this frame
 
 typedef struct glsl_attrib_binding_s {
 	const char *name;
@@ -341,13 +615,21 @@ void R_NewGame (void);
 
 void R_AnimateLight (void);
 void R_MarkSurfaces (void);
+void R_InitMarkSurfaces (void);
+void R_IssueOcclusionQueries (void);
+void R_DeleteOcclusionQueries (void);
 qboolean R_CullBox (vec3_t emins, vec3_t emaxs);
-void R_StoreEfrags (efrag_t **ppefrag);
+void R_CullBoxes (float *const bounds[6], int count, byte *culled);
+void R_StoreEfrags (mleaf_t *leaf);
 qboolean R_CullModelForEntity (entity_t *e);
+void R_CullEntities (void);
+void R_MergeBrushEntities (void);
+void R_EntityBounds (entity_t *e, vec3_t mins, vec3_t maxs);
 void R_RotateForEntity (vec3_t origin, vec3_t angles);
 void R_MarkLights (dlight_t *light, int num, mnode_t *node);
 
 void R_InitParticles (void);
+void R_InitAliasTextures (void);
 void R_DrawParticles (void);
 void CL_RunParticles (void);
 void R_ClearParticles (void);
@@ -355,11 +637,15 @@ void R_ClearParticles (void);
 void R_TranslatePlayerSkin (int playernum);
 void R_TranslateNewPlayerSkin (int playernum); //johnfitz -- this handles cases when the actual texture changes
 void R_UpdateWarpTextures (void);
+void R_InitWarpTexture (void);
 
 void R_DrawWorld (void);
+void R_DrawDepthPrepass (void);
 void R_DrawAliasModel (entity_t *e);
 void R_DrawBrushModel (entity_t *e);
 void R_DrawSpriteModel (entity_t *e);
+void R_BatchSpriteModel (entity_t *e);
+void R_FlushSpriteBatches (void);
 
 void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain);
 
@@ -367,19 +653,47 @@ void R_RenderDlights (void);
 void GL_BuildLightmaps (void);
 void GL_DeleteBModelVertexBuffer (void);
 void GL_BuildBModelVertexBuffer (void);
+void GL_TexCoordSize (texture_t *t, int *width, int *height);
+void GL_FillTextureArrays (void);
+void GL_SetTextureArrayFilterModes (void);
 void GLMesh_LoadVertexBuffers (void);
 void GLMesh_DeleteVertexBuffers (void);
 void R_RebuildAllLightmaps (void);
+void R_LightmapInfo_f (void);
 
 int R_LightPoint (vec3_t p);
+int R_LightPointCached (entity_t *e, vec3_t p);
+void R_InitLightGrid (void);
+extern	int	r_lightcacheseq;
+
+typedef unsigned int lightbits_t[(MAX_DLIGHTS + 31) >> 5];	// a bit per cl_dlights entry
+extern	lightbits_t	r_visiblelights;
+void R_BuildLightClusters (float fovx, float fovy);
+const unsigned int *R_LightsForPoint (vec3_t p);
 
 void GL_SubdivideSurface (msurface_t *fa);
 void R_BuildLightMap (msurface_t *surf, byte *dest, int stride);
 void R_RenderDynamicLightmaps (msurface_t *fa);
+void R_LightStyleChanged (int style);
 void R_UploadLightmaps (void);
+void R_DeleteLightmapBuffers (void);
+
+// lightmap building inner loops, picked for the CPU by R_InitLightmapKernels
+typedef struct
+{
+	const char	*name;
+	void	(*scalestyle) (unsigned *bl, const byte *lightmap, int count, unsigned scale);	// bl += lightmap * scale
+	void	(*adddlight) (unsigned *bl, int smax, int tmax, const float *local, float rad, float minlight, const float *color);
+	void	(*store) (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift);	// to RGBA, clamped
+} lightkernels_t;
+
+extern lightkernels_t r_lightkernels;
+void R_InitLightmapKernels (void);
+const char *R_LightmapKernelsName (void);
 
 void R_DrawWorld_ShowTris (void);
 void R_DrawBrushModel_ShowTris (entity_t *e);
+void R_DrawBrushModel_Prepass (entity_t *e);
 void R_DrawAliasModel_ShowTris (entity_t *e);
 void R_DrawParticles_ShowTris (void);
 
@@ -388,13 +702,42 @@ GLuint GL_CreateProgram (const GLchar *vertSource, const GLchar *fragSource, int
 void R_DeleteShaders (void);
 
 void GLWorld_CreateShaders (void);
+void GLWarp_CreateShaders (void);
+void GLSky_CreateShaders (void);
+qboolean GLWarp_BeginShader (void);	// false if water uses the warp images
+void GLWarp_SetAlpha (float alpha);
+void GLWarp_EndShader (void);
+qboolean GLWorld_GPULighting (void);
 void GLAlias_CreateShaders (void);
+extern qboolean r_alias_colormap; // the alias shader can translate the player colors
+qboolean R_BatchAliasModel (entity_t *e);
+void R_FlushAliasBatches (void);
+void GLParticles_CreateShaders (void);
+void R_DeleteParticleBuffer (void);
 void GL_DrawAliasShadow (entity_t *e);
+qboolean R_BatchAliasShadow (entity_t *e);
+void R_FlushAliasShadows (void);
 void DrawGLTriangleFan (glpoly_t *p);
 void DrawGLPoly (glpoly_t *p);
+qboolean R_BeginPolyBatch (void);	// false if sky and water polys can't come from the brush VBO
+void R_BatchSurface (msurface_t *s);
+void R_FlushBatch (void);
+void R_EndPolyBatch (void);
 void DrawWaterPoly (glpoly_t *p);
 void GL_MakeAliasModelDisplayLists (qmodel_t *m, aliashdr_t *hdr);
 
+#define	VCACHE_SIZE	16	// post-transform cache entries assumed for vertex ordering
+
+typedef struct
+{
+	int		slot[VCACHE_SIZE];
+	int		next;
+	int		misses;
+} vcache_t;	// FIFO vertex cache model, for ACMR figures
+
+void VCache_Reset (vcache_t *c);
+void VCache_Touch (vcache_t *c, int v);
+
 void Sky_Init (void);
 void Sky_ClearAll (void);
 void Sky_DrawSky (void);
@@ -402,6 +745,9 @@ void Sky_NewMap (void);
 void Sky_LoadTexture (texture_t *mt);
 void Sky_LoadTextureQ64 (texture_t *mt);
 void Sky_LoadSkyBox (const char *name);
+void Sky_SetCubeMapFilterModes (void);
+void Sky_DeleteCubeMap (void);
+void Sky_ReloadCubeMap (void);
 
 void TexMgr_RecalcWarpImageSize (void);
 
@@ -417,6 +763,7 @@ void GLSLGamma_DeleteTexture (void);
 void GLSLGamma_GammaCorrect (void);
 
 void R_ScaleView_DeleteTexture (void);
+qboolean R_ScaleView (void);
 
 float GL_WaterAlphaForSurface (msurface_t *fa);
 
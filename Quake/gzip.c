@@ -0,0 +1,84 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// gzip.c -- gzip file writer, built on lodepng's deflate
+
+#include "quakedef.h"
+
+// lodepng is compiled here rather than in image.c so the dedicated server
+// gets the deflate without the image code, image.c includes lodepng.h
+// with the same settings
+#define LODEPNG_NO_COMPILE_DECODER
+#define LODEPNG_NO_COMPILE_CPP
+#define LODEPNG_NO_COMPILE_ANCILLARY_CHUNKS
+#define LODEPNG_NO_COMPILE_ERROR_TEXT
+#include "lodepng.h"
+#include "lodepng.c"
+
+/*
+============
+COM_WriteGZ
+
+Writes data as a gzip file to the full path name.  Only uses malloc, so
+any thread can call it.
+============
+*/
+qboolean COM_WriteGZ (const char *name, const byte *data, size_t size)
+{
+	unsigned char	*out = NULL;
+	size_t		outsize = 0;
+	unsigned	crc, error;
+	byte		header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};	// deflate, no mtime, unknown OS
+	byte		trailer[8];
+	FILE		*f;
+	qboolean	ok;
+
+	error = lodepng_deflate (&out, &outsize, data, size, &lodepng_default_compress_settings);
+	if (error)
+	{
+		free (out);
+		return false;
+	}
+
+	crc = lodepng_crc32 (data, size);
+	trailer[0] = crc & 0xff;
+	trailer[1] = (crc >> 8) & 0xff;
+	trailer[2] = (crc >> 16) & 0xff;
+	trailer[3] = (crc >> 24) & 0xff;
+	trailer[4] = size & 0xff;
+	trailer[5] = (size >> 8) & 0xff;
+	trailer[6] = (size >> 16) & 0xff;
+	trailer[7] = (size >> 24) & 0xff;
+
+	f = fopen (name, "wb");
+	ok = f != NULL;
+	if (f)
+	{
+		ok = fwrite (header, 1, sizeof(header), f) == sizeof(header)
+			&& fwrite (out, 1, outsize, f) == outsize
+			&& fwrite (trailer, 1, sizeof(trailer), f) == sizeof(trailer);
+		if (fclose (f) != 0)
+			ok = false;
+		if (!ok)
+			remove (name);
+	}
+	free (out);
+	return ok;
+}
@@ -49,6 +49,8 @@ int		host_framecount;
 
 int		host_hunklevel;
 
+int		host_instance;	// -instances server number
+
 int		minimum_memory;
 
 client_t	*host_client;			// current client
@@ -61,9 +63,11 @@ cvar_t	host_framerate = {"host_framerate","0",CVAR_NONE};	// set for slow motion
 cvar_t	host_speeds = {"host_speeds","0",CVAR_NONE};			// set for running times
 cvar_t	host_maxfps = {"host_maxfps", "72", CVAR_ARCHIVE}; //johnfitz
 cvar_t	host_timescale = {"host_timescale", "0", CVAR_NONE}; //johnfitz
+cvar_t	host_pacing = {"host_pacing", "1", CVAR_ARCHIVE};	// sleep precisely up to the next frame
 cvar_t	max_edicts = {"max_edicts", "8192", CVAR_NONE}; //johnfitz //ericw -- changed from 2048 to 8192, removed CVAR_ARCHIVE
 
 cvar_t	sys_ticrate = {"sys_ticrate","0.05",CVAR_NONE}; // dedicated server
+cvar_t	sv_hibernate = {"sv_hibernate","1",CVAR_NONE}; // dedicated server stops the world with nobody on it
 cvar_t	serverprofile = {"serverprofile","0",CVAR_NONE};
 
 cvar_t	fraglimit = {"fraglimit","0",CVAR_NOTIFY|CVAR_SERVERINFO};
@@ -77,6 +81,8 @@ cvar_t	coop = {"coop","0",CVAR_NONE};			// 0 or 1
 
 cvar_t	pausable = {"pausable","1",CVAR_NONE};
 
+cvar_t	savegame_binary = {"savegame_binary","0",CVAR_ARCHIVE};	// save writes binary images
+
 cvar_t	developer = {"developer","0",CVAR_NONE};
 
 cvar_t	temp1 = {"temp1","0",CVAR_NONE};
@@ -192,10 +198,10 @@ void	Host_FindMaxClients (void)
 	svs.maxclients = 1;
 
 	i = COM_CheckParm ("-dedicated");
-	if (i)
+	if (i || isDedicated)	// the headless build is dedicated without -dedicated
 	{
 		cls.state = ca_dedicated;
-		if (i != (com_argc - 1))
+		if (i && i != (com_argc - 1))
 		{
 			svs.maxclients = Q_atoi (com_argv[i+1]);
 		}
@@ -238,6 +244,152 @@ void Host_Version_f (void)
 	Con_Printf ("Exe: " __TIME__ " " __DATE__ "\n");
 }
 
+#define	FRAMETIME_SAMPLES	256		// power of two
+
+static float	frametime_samples[FRAMETIME_SAMPLES];
+static int	frametime_count;
+
+/*
+===================
+Host_FrameTimes_f
+
+Frame interval statistics over the last FRAMETIME_SAMPLES frames
+===================
+*/
+static void Host_FrameTimes_f (void)
+{
+	double	sum, sumsq, mean, dev, t;
+	float	lo, hi;
+	int	i, n;
+
+	n = q_min (frametime_count, FRAMETIME_SAMPLES);
+	if (!n)
+	{
+		Con_Printf ("no frames recorded\n");
+		return;
+	}
+
+	sum = sumsq = 0;
+	lo = hi = frametime_samples[0];
+	for (i = 0; i < n; i++)
+	{
+		t = frametime_samples[i];
+		sum += t;
+		sumsq += t * t;
+		lo = q_min (lo, frametime_samples[i]);
+		hi = q_max (hi, frametime_samples[i]);
+	}
+	mean = sum / n;
+	dev = sumsq / n - mean * mean;
+	dev = (dev > 0) ? sqrt (dev) : 0;
+
+	Con_Printf ("%i frames: mean %.3f ms, stddev %.3f ms, min %.3f ms, max %.3f ms\n",
+			n, mean * 1000.0, dev * 1000.0, lo * 1000.0, hi * 1000.0);
+}
+
+/*
+===================
+Host_GetMemStats
+
+Where the memory of the process goes, and the peaks of each since the
+last Host_LogMemPeaks.  The GL and sound figures are the engine's own
+estimates and accounting, the driver may well keep more.
+===================
+*/
+memstats_t	host_mempeak;
+static double	host_memsampletime;
+
+void Host_GetMemStats (memstats_t *m)
+{
+	int	i;
+
+	memset (m, 0, sizeof(*m));
+	m->hunk = Hunk_Used ();
+	m->hunksize = host_parms->memsize;
+	m->zone = Z_Used ();
+	m->cache = Cache_Used ();
+	m->edicts = sv.active ? sv.max_edicts * pr_edict_size : 0;
+	m->textures = TexMgr_MemoryUsed () + gl_memory[GLMEM_TEXARRAYS] + gl_memory[GLMEM_SKYBOX];
+	for (i = GLMEM_SKYBOX + 1; i < GLMEM_NUMTYPES; i++)
+		m->buffers += gl_memory[i];
+	m->soundheap = S_GetMemoryStats (&m->sound, &m->soundpeak);
+
+	host_mempeak.hunk = q_max (host_mempeak.hunk, m->hunk);
+	host_mempeak.zone = q_max (host_mempeak.zone, m->zone);
+	host_mempeak.cache = q_max (host_mempeak.cache, m->cache);
+	host_mempeak.edicts = q_max (host_mempeak.edicts, m->edicts);
+	host_mempeak.textures = q_max (host_mempeak.textures, m->textures);
+	host_mempeak.buffers = q_max (host_mempeak.buffers, m->buffers);
+	host_mempeak.sound = q_max (host_mempeak.sound, m->sound);
+}
+
+static double Host_MemTotal (const memstats_t *m)
+{
+	// the zone and the cache are inside the hunk
+	return (double) m->hunk + m->cache + m->edicts + m->textures + m->buffers + m->sound;
+}
+
+/*
+===================
+Host_LogMemPeaks
+
+Called by SV_SpawnServer, reports the high-water marks of the map that is
+being left and starts over for the next one
+===================
+*/
+void Host_LogMemPeaks (void)
+{
+	memstats_t	m;
+	char		line[256];
+
+	Host_GetMemStats (&m);
+	if (sv.active && sv.name[0])
+	{
+		q_snprintf (line, sizeof(line), "%s memory peaks: hunk %.1f, cache %.1f, edicts %.1f, textures %.1f, buffers %.1f, sound %.1f, total %.1f MB\n",
+			sv.name, host_mempeak.hunk / 1048576.0, host_mempeak.cache / 1048576.0, host_mempeak.edicts / 1048576.0,
+			host_mempeak.textures / 1048576.0, host_mempeak.buffers / 1048576.0, host_mempeak.sound / 1048576.0,
+			Host_MemTotal (&host_mempeak) / 1048576.0);
+		if (isDedicated)
+			Con_Printf ("%s", line);	// sized server instances go by these
+		else
+			Con_DPrintf ("%s", line);
+	}
+	host_mempeak = m;
+}
+
+/*
+===================
+Host_MemStats_f
+
+memstats -- current use and the peaks on this map, in megabytes
+===================
+*/
+static void Host_MemStats_f (void)
+{
+	memstats_t	m;
+	const double	mb = 1.0 / 1048576.0;
+
+	Host_GetMemStats (&m);
+	Con_Printf ("           now     peak\n");
+	Con_Printf ("hunk    %7.2f  %7.2f  of %.1f\n", m.hunk * mb, host_mempeak.hunk * mb, m.hunksize * mb);
+	Con_Printf ("zone    %7.2f  %7.2f  in the hunk\n", m.zone * mb, host_mempeak.zone * mb);
+	Con_Printf ("cache   %7.2f  %7.2f\n", m.cache * mb, host_mempeak.cache * mb);
+	Con_Printf ("edicts  %7.2f  %7.2f\n", m.edicts * mb, host_mempeak.edicts * mb);
+	if (cls.state != ca_dedicated)
+	{
+		Con_Printf ("textures%7.2f  %7.2f  estimated\n", m.textures * mb, host_mempeak.textures * mb);
+		Con_Printf ("buffers %7.2f  %7.2f  brush %.2f, alias %.2f, stream %.2f, lightmap %.2f, particles %.2f\n",
+			m.buffers * mb, host_mempeak.buffers * mb, gl_memory[GLMEM_BRUSH] * mb,
+			gl_memory[GLMEM_ALIAS] * mb, gl_memory[GLMEM_STREAM] * mb, gl_memory[GLMEM_PBO] * mb,
+			gl_memory[GLMEM_PARTICLES] * mb);
+		if (m.soundheap)
+			Con_Printf ("sound   %7.2f  %7.2f\n", m.sound * mb, m.soundpeak * mb);
+		else
+			Con_Printf ("sound      in the cache\n");
+	}
+	Con_Printf ("total   %7.2f  %7.2f\n", Host_MemTotal (&m) * mb, Host_MemTotal (&host_mempeak) * mb);
+}
+
 /* cvar callback functions : */
 void Host_Callback_Notify (cvar_t *var)
 {
@@ -253,6 +405,8 @@ Host_InitLocal
 void Host_InitLocal (void)
 {
 	Cmd_AddCommand ("version", Host_Version_f);
+	Cmd_AddCommand ("frametimes", Host_FrameTimes_f);
+	Cmd_AddCommand ("memstats", Host_MemStats_f);
 
 	Host_InitCommands ();
 
@@ -261,12 +415,14 @@ void Host_InitLocal (void)
 	Cvar_RegisterVariable (&host_maxfps); //johnfitz
 	Cvar_SetCallback (&host_maxfps, Max_Fps_f);
 	Cvar_RegisterVariable (&host_timescale); //johnfitz
+	Cvar_RegisterVariable (&host_pacing);
 
 	Cvar_RegisterVariable (&max_edicts); //johnfitz
 	Cvar_SetCallback (&max_edicts, Max_Edicts_f);
 	Cvar_RegisterVariable (&devstats); //johnfitz
 
 	Cvar_RegisterVariable (&sys_ticrate);
+	Cvar_RegisterVariable (&sv_hibernate);
 	Cvar_RegisterVariable (&sys_throttle);
 	Cvar_RegisterVariable (&serverprofile);
 
@@ -288,6 +444,7 @@ void Host_InitLocal (void)
 	Cvar_RegisterVariable (&horde);
 
 	Cvar_RegisterVariable (&pausable);
+	Cvar_RegisterVariable (&savegame_binary);
 
 	Cvar_RegisterVariable (&temp1);
 
@@ -478,6 +635,8 @@ void Host_ShutdownServer(qboolean crash)
 	byte		message[4];
 	double	start;
 
+	SV_RecordShutdown ();
+
 	if (!sv.active)
 		return;
 
@@ -536,26 +695,101 @@ void Host_ShutdownServer(qboolean crash)
 
 /*
 ================
-Host_ClearMemory
+Host_WorldStamp
+
+Something that changes when the bsp is replaced: where it was found,
+its size and, for a loose file, its time.
+================
+*/
+static void Host_WorldStamp (const char *name, int stamp[3])
+{
+	char		netpath[MAX_OSPATH];
+	unsigned int	path_id;
+	int		h;
+
+	stamp[0] = COM_OpenFile (name, &h, &path_id);
+	if (stamp[0] != -1)
+		COM_CloseFile (h);
+	stamp[1] = (int) path_id;
+	stamp[2] = COM_FullFilePath (name, netpath, sizeof(netpath)) ? Sys_FileTime (netpath) : 0;
+}
+
+/*
+================
+Host_KeepWorld
+
+Called by the server right after it has loaded the world model, with
+nothing else on the hunk above host_hunklevel yet.  The model stays
+below host_worldlevel, so that spawning the same map again (restart,
+changelevel to itself, loading a save) doesn't parse the bsp or upload
+its textures again.
+================
+*/
+static qmodel_t	*host_worldmodel;
+static int	host_worldlevel;
+static int	host_worldstamp[3];
+
+void Host_KeepWorld (qmodel_t *world)
+{
+	if (world == host_worldmodel)
+		return;
+	host_worldmodel = world;
+	host_worldlevel = Hunk_LowMark ();
+	Host_WorldStamp (world->name, host_worldstamp);
+}
+
+/*
+================
+Host_ClearMemoryForMap
 
 This clears all the memory used by both the client and server, but does
-not reinitialize anything.
+not reinitialize anything.  If worldname is the world model that was kept
+and its file hasn't changed, the world stays loaded.
 ================
 */
-void Host_ClearMemory (void)
+void Host_ClearMemoryForMap (const char *worldname)
 {
+	int	stamp[3];
+
 	Con_DPrintf ("Clearing memory\n");
+	PR_StopProfiling ();	// while the progs are still around
 	D_FlushCaches ();
-	Mod_ClearAll ();
-	Sky_ClearAll();
-/* host_hunklevel MUST be set at this point */
-	Hunk_FreeToLowMark (host_hunklevel);
+	COM_FlushDirCache ();	// pick up any files added since the last map
+
+	if (worldname && host_worldmodel && !host_worldmodel->needload &&
+		!strcmp (host_worldmodel->name, worldname))
+	{
+		Host_WorldStamp (worldname, stamp);
+		if (memcmp (stamp, host_worldstamp, sizeof(stamp)))
+			host_worldmodel = NULL;
+	}
+	else
+		host_worldmodel = NULL;
+
+	if (host_worldmodel)
+	{
+		Con_DPrintf ("Keeping %s\n", worldname);
+		Mod_ClearAllButWorld (host_worldmodel);
+		Hunk_FreeToLowMark (host_worldlevel);
+	}
+	else
+	{
+		Mod_ClearAll ();
+		Sky_ClearAll();
+	/* host_hunklevel MUST be set at this point */
+		Hunk_FreeToLowMark (host_hunklevel);
+	}
 	cls.signon = 0;
-	free(sv.edicts); // ericw -- sv.edicts switched to use malloc()
+	SV_FreeEdicts ();
 	memset (&sv, 0, sizeof(sv));
 	memset (&cl, 0, sizeof(cl));
 }
 
+void Host_ClearMemory (void)
+{
+	Host_ClearMemoryForMap (NULL);
+}
+
 
 //==============================================================================
 //
@@ -563,6 +797,26 @@ void Host_ClearMemory (void)
 //
 //==============================================================================
 
+/*
+===================
+Host_FrameDelay
+
+Returns how long the caller may sleep before a frame of 'time' seconds since
+the last call would pass Host_FilterTime.  Sleeping first and then sampling
+input keeps input latency down compared to spinning through short frames.
+===================
+*/
+double Host_FrameDelay (double time)
+{
+	double	maxfps;
+
+	if (!host_pacing.value || cls.timedemo)
+		return 0;
+
+	maxfps = CLAMP (10.0, host_maxfps.value, 1000.0);
+	return oldrealtime + 1.0/maxfps - (realtime + time);
+}
+
 /*
 ===================
 Host_FilterTime
@@ -585,6 +839,8 @@ qboolean Host_FilterTime (float time)
 	host_frametime = realtime - oldrealtime;
 	oldrealtime = realtime;
 
+	frametime_samples[frametime_count++ & (FRAMETIME_SAMPLES - 1)] = host_frametime;
+
 	//johnfitz -- host_timescale is more intuitive than host_framerate
 	if (host_timescale.value > 0)
 		host_frametime *= host_timescale.value;
@@ -610,6 +866,8 @@ void Host_GetConsoleCommands (void)
 
 	if (!isDedicated)
 		return;	// no stdin necessary in graphical mode
+	if (host_instance)
+		return;	// the first instance has the console
 
 	while (1)
 	{
@@ -620,6 +878,28 @@ void Host_GetConsoleCommands (void)
 	}
 }
 
+/*
+==================
+Host_Hibernating
+
+True for a dedicated server that has nobody on it, the world stays still
+and the main loop waits for packets instead of ticking
+==================
+*/
+qboolean Host_Hibernating (void)
+{
+	int		i;
+
+	if (!isDedicated || !sv_hibernate.value || !sv.active || LoadTest_Running ())
+		return false;
+	for (i = 0; i < svs.maxclients; i++)
+	{
+		if (svs.clients[i].active)
+			return false;
+	}
+	return true;
+}
+
 /*
 ==================
 Host_ServerFrame
@@ -629,6 +909,14 @@ void Host_ServerFrame (void)
 {
 	int		i, active; //johnfitz
 	edict_t	*ent; //johnfitz
+	qboolean	runphysics;
+	static qboolean	hibernating;
+
+	TRACE_BEGIN ("Host_ServerFrame");
+
+// always pause in single player if in console or menus
+	runphysics = svs.maxclients > 1 || key_dest == key_game;
+	SV_RecordFrame (runphysics);
 
 // run the world state
 	pr_global_struct->frametime = host_frametime;
@@ -639,13 +927,25 @@ void Host_ServerFrame (void)
 // check for new clients
 	SV_CheckForNewClients ();
 
+// a dedicated server with nobody on it doesn't need to run the world
+	if (Host_Hibernating () != hibernating)
+	{
+		hibernating = !hibernating;
+		Con_DPrintf ("%s\n", hibernating ? "No clients, hibernating" : "Waking up");
+	}
+	if (hibernating)
+	{
+		TRACE_END ("Host_ServerFrame");
+		return;
+	}
+
 // read client messages
 	SV_RunClients ();
 
 // move things around and think
-// always pause in single player if in console or menus
-	if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game) )
+	if (!sv.paused && runphysics)
 		SV_Physics ();
+	SV_PreloadChangelevels ();
 
 //johnfitz -- devstats
 	if (cls.signon == SIGNONS)
@@ -665,6 +965,8 @@ void Host_ServerFrame (void)
 
 // send all messages to the clients
 	SV_SendClientMessages ();
+
+	TRACE_END ("Host_ServerFrame");
 }
 
 /*
@@ -674,12 +976,18 @@ Host_Frame
 Runs all active servers
 ==================
 */
+#define	HOST_SERVER_FPS		72	// listen server tick rate when host_maxfps is higher
+
 void _Host_Frame (float time)
 {
 	static double		time1 = 0;
 	static double		time2 = 0;
 	static double		time3 = 0;
-	int			pass1, pass2, pass3;
+	static double		accumtime = 0;
+	double		servertime, realframetime;
+	qboolean	runserver;
+	qboolean	timing;
+	int			pass1, pass2, pass3, passserver, passswap;
 
 	if (setjmp (host_abortserver) )
 		return;			// something bad happened, or the server disconnected
@@ -691,6 +999,21 @@ void _Host_Frame (float time)
 	if (!Host_FilterTime (time))
 		return;			// don't run too fast, or packets will flood out
 
+// scratch memory from the last frame, including any left by an aborted server
+	Frame_Reset ();
+
+// keep the memstats peaks without walking everything every frame
+	if (realtime - host_memsampletime >= 1.0)
+	{
+		memstats_t	mem;
+
+		host_memsampletime = realtime;
+		Host_GetMemStats (&mem);
+	}
+
+	timing = host_speeds.value || cls.benchmarking;
+	TRACE_BEGIN ("Host_Frame");
+
 // get new key events
 	Key_UpdateForDest ();
 	IN_UpdateInputMode ();
@@ -702,10 +1025,27 @@ void _Host_Frame (float time)
 // process console commands
 	Cbuf_Execute ();
 
+	Con_PrintHeld ();
+	Host_FinishSavegame (false);
+	FileLists_Update (false);
+
 	NET_Poll();
+	LoadTest_Frame ();
 
-// if running the server locally, make intentions now
+// above 72 fps the local server keeps ticking at 72 Hz, the client
+// interpolates between its updates
+	runserver = false;
 	if (sv.active)
+	{
+		accumtime += host_frametime;
+		if (host_maxfps.value <= HOST_SERVER_FPS || cls.timedemo || accumtime >= 1.0 / HOST_SERVER_FPS)
+			runserver = true;
+	}
+	else
+		accumtime = 0;
+
+// if running the server locally, make intentions now
+	if (runserver)
 		CL_SendCmd ();
 
 //-------------------
@@ -717,8 +1057,21 @@ void _Host_Frame (float time)
 // check for commands typed to the host
 	Host_GetConsoleCommands ();
 
-	if (sv.active)
+	servertime = 0;
+	if (runserver)
+	{
+		realframetime = host_frametime;
+		host_frametime = q_min(accumtime, 0.1);	// since the last server frame
+		accumtime = 0;
+
+		if (timing)
+			servertime = Sys_DoubleTime ();
 		Host_ServerFrame ();
+		if (timing)
+			servertime = Sys_DoubleTime () - servertime;
+
+		host_frametime = realframetime;
+	}
 
 //-------------------
 //
@@ -736,14 +1089,14 @@ void _Host_Frame (float time)
 		CL_ReadFromServer ();
 
 // update video
-	if (host_speeds.value)
+	if (timing)
 		time1 = Sys_DoubleTime ();
 
 	SCR_UpdateScreen ();
 
 	CL_RunParticles (); //johnfitz -- seperated from rendering
 
-	if (host_speeds.value)
+	if (timing)
 		time2 = Sys_DoubleTime ();
 
 // update audio
@@ -758,18 +1111,34 @@ void _Host_Frame (float time)
 
 	CDAudio_Update();
 
-	if (host_speeds.value)
+	if (timing)
 	{
+		if (cls.benchmarking)
+			CL_BenchmarkFrame (time1 - time3, servertime, time2 - time1, scr_swaptime, Sys_DoubleTime () - time2);
+
 		pass1 = (time1 - time3)*1000;
 		time3 = Sys_DoubleTime ();
 		pass2 = (time2 - time1)*1000;
 		pass3 = (time3 - time2)*1000;
-		Con_Printf ("%3i tot %3i server %3i gfx %3i snd\n",
-					pass1+pass2+pass3, pass1, pass2, pass3);
+		passserver = servertime*1000;
+		passswap = scr_swaptime*1000;	// driver time, blocked in the buffer swap
 	}
 
+	if (host_speeds.value)
+	{
+		Con_Printf ("%3i tot %3i server %3i client %3i gfx %3i swap %3i snd %4i ents %3i dgram %3i slowest\n",
+					pass1+pass2+pass3, passserver, pass1 - passserver, pass2 - passswap, passswap, pass3,
+					sv.active ? sv_edictsvisited : 0,
+					sv.active ? (int)(sv_sendtime*1000) : 0, sv.active ? (int)(sv_sendtimemax*1000) : 0);
+	}
+
+	dev_stats.modlookups = mod_lookups;
+	dev_peakstats.modlookups = q_max(mod_lookups, dev_peakstats.modlookups);
+	mod_lookups = 0;
+
 	host_framecount++;
 
+	TRACE_END ("Host_Frame");
 }
 
 void Host_Frame (float time)
@@ -808,6 +1177,97 @@ void Host_Frame (float time)
 	Con_Printf ("serverprofile: %2i clients %2i msec\n",  c,  m);
 }
 
+/*
+====================
+Host_ForkInstances
+
+-instances <n> on a dedicated server forks n-1 more servers, each on
+the next port up.  This is done once the filesystem and the wad are in,
+so the pak indexes and everything else loaded so far are shared
+copy-on-write; progs, models and edicts are loaded by each instance
+when it spawns a map.  Has to run before any threads or sockets exist.
+====================
+*/
+#define	MAX_INSTANCES	64
+
+static void Host_ForkInstances (void)
+{
+	int	i, n;
+
+	i = COM_CheckParm ("-instances");
+	if (!i || cls.state != ca_dedicated)
+		return;
+	if (i >= com_argc - 1)
+		Sys_Error ("Host_Init: you must specify a number after -instances");
+	n = CLAMP (1, Q_atoi (com_argv[i + 1]), MAX_INSTANCES);
+
+	for (i = 1; i < n; i++)
+	{
+		switch (Sys_Fork ())
+		{
+		case -1:
+			Con_Printf ("Couldn't start server instance %i\n", i);
+			return;
+		case 0:
+			host_instance = i;
+			return;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+====================
+Startup profile
+
+-startupprofile times each step of Host_Init and prints the table once
+the console is up.  Steps are recorded as they finish rather than
+printed, most of them run before the console exists.
+====================
+*/
+#define	MAX_STARTUP_STEPS	64
+
+typedef struct
+{
+	const char	*name;
+	double		time;	// seconds
+} startupstep_t;
+
+static startupstep_t	startup_steps[MAX_STARTUP_STEPS];
+static int		startup_numsteps;
+static double		startup_begin, startup_last;
+static qboolean		startup_profile;
+
+static void Host_StartupStep (const char *name)
+{
+	double	now;
+
+	if (!startup_profile)
+		return;
+	now = Sys_DoubleTime ();
+	if (startup_numsteps < MAX_STARTUP_STEPS)
+	{
+		startup_steps[startup_numsteps].name = name;
+		startup_steps[startup_numsteps].time = now - startup_last;
+		startup_numsteps++;
+	}
+	startup_last = now;
+}
+
+static void Host_PrintStartupProfile (void)
+{
+	int	i;
+
+	if (!startup_profile)
+		return;
+	Con_Printf ("startup profile: %.1f ms\n", (Sys_DoubleTime () - startup_begin) * 1000.0);
+	for (i = 0; i < startup_numsteps; i++)
+		Con_Printf ("  %-24s %8.1f ms\n", startup_steps[i].name, startup_steps[i].time * 1000.0);
+}
+
+#define	HOST_STEP(call)	do { call; Host_StartupStep (#call); } while (0)
+
 /*
 ====================
 Host_Init
@@ -815,6 +1275,11 @@ Host_Init
 */
 void Host_Init (void)
 {
+	int	i;
+
+	startup_profile = COM_CheckParm ("-startupprofile") != 0;
+	startup_begin = startup_last = Sys_DoubleTime ();
+
 	if (standard_quake)
 		minimum_memory = MINIMUM_MEMORY;
 	else	minimum_memory = MINIMUM_MEMORY_LEVELPAK;
@@ -828,27 +1293,33 @@ void Host_Init (void)
 	com_argc = host_parms->argc;
 	com_argv = host_parms->argv;
 
-	Memory_Init (host_parms->membase, host_parms->memsize);
+	HOST_STEP (Memory_Init (host_parms->membase, host_parms->memsize));
 	Cbuf_Init ();
 	Cmd_Init ();
 	LOG_Init (host_parms);
 	Cvar_Init (); //johnfitz
-	COM_Init ();
-	COM_InitFilesystem ();
+	HOST_STEP (COM_Init ());
+	HOST_STEP (COM_InitFilesystem ());
 	Host_InitLocal ();
-	W_LoadWadFile (); //johnfitz -- filename is now hard-coded for honesty
+	HOST_STEP (W_LoadWadFile ()); //johnfitz -- filename is now hard-coded for honesty
 	if (cls.state != ca_dedicated)
 	{
 		Key_Init ();
-		Con_Init ();
+		HOST_STEP (Con_Init ());
 	}
-	PR_Init ();
-	Mod_Init ();
-	NET_Init ();
-	SV_Init ();
+	HOST_STEP (PR_Init ());
+	Host_ForkInstances ();
+	LOG_StartWriter ();
+	HOST_STEP (Tasks_Init ());
+	Math_Init ();
+	Trace_Init ();
+	HOST_STEP (Mod_Init ());
+	HOST_STEP (NET_Init ());
+	LoadTest_Init ();
+	HOST_STEP (SV_Init ());
 
 	Con_Printf ("Exe: " __TIME__ " " __DATE__ "\n");
-	Con_Printf ("%4.1f megabyte heap\n", host_parms->memsize/ (1024*1024.0));
+	Con_Printf ("%4.1f megabyte heap%s\n", host_parms->memsize/ (1024*1024.0), host_parms->memhuge ? " on huge pages" : host_parms->memreserved ? " reserved" : "");
 
 	if (cls.state != ca_dedicated)
 	{
@@ -858,19 +1329,22 @@ void Host_Init (void)
 
 		V_Init ();
 		Chase_Init ();
-		M_Init ();
+		HOST_STEP (M_Init ());
+	// the file list scans and the sound device open run on the task
+	// workers while the video and renderer come up
 		ExtraMaps_Init (); //johnfitz
 		Modlist_Init (); //johnfitz
 		DemoList_Init (); //ericw
-		VID_Init ();
+		HOST_STEP (S_Init ());
+		HOST_STEP (VID_Init ());
 		IN_Init ();
-		TexMgr_Init (); //johnfitz
-		Draw_Init ();
+		HOST_STEP (TexMgr_Init ()); //johnfitz
+		HOST_STEP (Draw_Init ());
 		SCR_Init ();
-		R_Init ();
-		S_Init ();
-		CDAudio_Init ();
-		BGM_Init();
+		HOST_STEP (R_Init ());
+		HOST_STEP (S_FinishStartup ());
+		HOST_STEP (CDAudio_Init ());
+		HOST_STEP (BGM_Init());
 		Sbar_Init ();
 		CL_Init ();
 	}
@@ -881,6 +1355,8 @@ void Host_Init (void)
 	host_hunklevel = Hunk_LowMark ();
 
 	host_initialized = true;
+	Host_StartupStep ("the rest");
+	Host_PrintStartupProfile ();
 	Con_Printf ("\n========= Quake Initialized =========\n\n");
 
 	if (cls.state != ca_dedicated)
@@ -889,6 +1365,16 @@ void Host_Init (void)
 	// johnfitz -- in case the vid mode was locked during vid_init, we can unlock it now.
 		// note: two leading newlines because the command buffer swallows one of them.
 		Cbuf_AddText ("\n\nvid_unlock\n");
+
+	// -benchmark <demo> [demo...] runs them through benchmark and quits
+		i = COM_CheckParm ("-benchmark");
+		if (i)
+		{
+			Cbuf_AddText ("benchmark -quit");
+			for (i++; i < com_argc && com_argv[i][0] != '-' && com_argv[i][0] != '+'; i++)
+				Cbuf_AddText (va(" %s", com_argv[i]));
+			Cbuf_AddText ("\n");
+		}
 	}
 
 	if (cls.state == ca_dedicated)
@@ -926,6 +1412,7 @@ void Host_Shutdown(void)
 
 	Host_WriteConfiguration ();
 
+	LoadTest_Shutdown ();
 	NET_Shutdown ();
 
 	if (cls.state != ca_dedicated)
@@ -936,9 +1423,14 @@ void Host_Shutdown(void)
 		CDAudio_Shutdown ();
 		S_Shutdown ();
 		IN_Shutdown ();
+		SCR_CaptureFinish ();
 		VID_Shutdown();
 	}
 
+	Host_FinishSavegame (true);
+	FileLists_Update (true);
+	Tasks_Shutdown ();
+
 	LOG_Close ();
 
 	LOC_Shutdown ();
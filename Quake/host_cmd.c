@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 
 extern cvar_t	pausable;
+extern cvar_t	savegame_binary;
 
 int	current_skill;
 
@@ -55,184 +56,119 @@ void Host_Quit_f (void)
 //==============================================================================
 
 /*
-==================
-FileList_Add
-==================
+===============================================================================
+
+FILE LIST SCANS
+
+The map, demo and mod lists are collected by a task, so big installs
+don't hold up startup or a game change.  Pak contents are already in
+memory and are gathered on the main thread, together with a copy of the
+search path directories; the task only reads the directories.  Finished
+scans are sorted once and replace the old list in FileLists_Update, until
+then the old list stays in use.
+
+===============================================================================
 */
-static void FileList_Add (const char *name, filelist_item_t **list)
+
+typedef char	filename_t[32];
+
+typedef struct
 {
-	filelist_item_t	*item,*cursor,*prev;
+	filelist_item_t	**list;
+	int		*count;
+	const char	*subdir;	// "maps/" etc, NULL to list mod directories
+	const char	*ext;
+	int		numdirs;
+	char		(*dirs)[MAX_OSPATH];
+	filename_t	*names;
+	int		numnames, maxnames;
+	qboolean	nomem;		// names were dropped
+	qboolean	pending;
+	task_t		task;
+} filescan_t;
 
-	// ignore duplicate
-	for (item = *list; item; item = item->next)
-	{
-		if (!Q_strcmp (name, item->name))
-			return;
-	}
+filelist_item_t	*extralevels;
+filelist_item_t	*modlist;
+filelist_item_t	*demolist;
+int		numextralevels, nummods, numdemos;
 
-	item = (filelist_item_t *) Z_Malloc(sizeof(filelist_item_t));
-	q_strlcpy (item->name, name, sizeof(item->name));
+static filescan_t	scan_maps = {&extralevels, &numextralevels, "maps/", "bsp"};
+static filescan_t	scan_demos = {&demolist, &numdemos, "", "dem"};
+static filescan_t	scan_mods = {&modlist, &nummods, NULL, NULL};
 
-	// insert each entry in alphabetical order
-	if (*list == NULL ||
-	    q_strcasecmp(item->name, (*list)->name) < 0) //insert at front
-	{
-		item->next = *list;
-		*list = item;
-	}
-	else //insert later
+// malloc only, this runs on worker threads
+static void FileScan_Add (filescan_t *scan, const char *name)
+{
+	filename_t	*names;
+	int		maxnames;
+
+	if (scan->numnames == scan->maxnames)
 	{
-		prev = *list;
-		cursor = (*list)->next;
-		while (cursor && (q_strcasecmp(item->name, cursor->name) > 0))
+		maxnames = scan->maxnames ? scan->maxnames * 2 : 256;
+		names = (filename_t *) realloc (scan->names, maxnames * sizeof(filename_t));
+		if (!names)
 		{
-			prev = cursor;
-			cursor = cursor->next;
+			scan->nomem = true;
+			return;
 		}
-		item->next = prev->next;
-		prev->next = item;
+		scan->names = names;
+		scan->maxnames = maxnames;
 	}
+	q_strlcpy (scan->names[scan->numnames++], name, sizeof(filename_t));
 }
 
-static void FileList_Clear (filelist_item_t **list)
+static void FileScan_AddStripped (filescan_t *scan, const char *filename)
 {
-	filelist_item_t *blah;
+	filename_t	name;
 
-	while (*list)
-	{
-		blah = (*list)->next;
-		Z_Free(*list);
-		*list = blah;
-	}
-}
-
-filelist_item_t	*extralevels;
-
-static void ExtraMaps_Add (const char *name)
-{
-	FileList_Add(name, &extralevels);
+	COM_StripExtension (filename, name, sizeof(name));
+	FileScan_Add (scan, name);
 }
 
-void ExtraMaps_Init (void)
+static void FileScan_ReadDir (filescan_t *scan, const char *dir)
 {
 #ifdef _WIN32
 	WIN32_FIND_DATA	fdat;
 	HANDLE		fhnd;
+	char		filestring[MAX_OSPATH];
+
+	q_snprintf (filestring, sizeof(filestring), "%s/%s*.%s", dir, scan->subdir, scan->ext);
+	fhnd = FindFirstFile(filestring, &fdat);
+	if (fhnd == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		FileScan_AddStripped (scan, fdat.cFileName);
+	} while (FindNextFile(fhnd, &fdat));
+	FindClose(fhnd);
 #else
 	DIR		*dir_p;
 	struct dirent	*dir_t;
-#endif
 	char		filestring[MAX_OSPATH];
-	char		mapname[32];
-	char		ignorepakdir[32];
-	searchpath_t	*search;
-	pack_t		*pak;
-	int		i;
 
-	// we don't want to list the maps in id1 pakfiles,
-	// because these are not "add-on" levels
-	q_snprintf (ignorepakdir, sizeof(ignorepakdir), "/%s/", GAMENAME);
-
-	for (search = com_searchpaths; search; search = search->next)
+	q_snprintf (filestring, sizeof(filestring), "%s/%s", dir, scan->subdir);
+	dir_p = opendir(filestring);
+	if (dir_p == NULL)
+		return;
+	while ((dir_t = readdir(dir_p)) != NULL)
 	{
-		if (*search->filename) //directory
-		{
-#ifdef _WIN32
-			q_snprintf (filestring, sizeof(filestring), "%s/maps/*.bsp", search->filename);
-			fhnd = FindFirstFile(filestring, &fdat);
-			if (fhnd == INVALID_HANDLE_VALUE)
-				continue;
-			do
-			{
-				COM_StripExtension(fdat.cFileName, mapname, sizeof(mapname));
-				ExtraMaps_Add (mapname);
-			} while (FindNextFile(fhnd, &fdat));
-			FindClose(fhnd);
-#else
-			q_snprintf (filestring, sizeof(filestring), "%s/maps/", search->filename);
-			dir_p = opendir(filestring);
-			if (dir_p == NULL)
-				continue;
-			while ((dir_t = readdir(dir_p)) != NULL)
-			{
-				if (q_strcasecmp(COM_FileGetExtension(dir_t->d_name), "bsp") != 0)
-					continue;
-				COM_StripExtension(dir_t->d_name, mapname, sizeof(mapname));
-				ExtraMaps_Add (mapname);
-			}
-			closedir(dir_p);
-#endif
-		}
-		else //pakfile
-		{
-			if (!strstr(search->pack->filename, ignorepakdir))
-			{ //don't list standard id maps
-				for (i = 0, pak = search->pack; i < pak->numfiles; i++)
-				{
-					if (!strcmp(COM_FileGetExtension(pak->files[i].name), "bsp"))
-					{
-						if (pak->files[i].filelen > 32*1024)
-						{ // don't list files under 32k (ammo boxes etc)
-							COM_StripExtension(pak->files[i].name + 5, mapname, sizeof(mapname));
-							ExtraMaps_Add (mapname);
-						}
-					}
-				}
-			}
-		}
+		if (q_strcasecmp(COM_FileGetExtension(dir_t->d_name), scan->ext) != 0)
+			continue;
+		FileScan_AddStripped (scan, dir_t->d_name);
 	}
-}
-
-static void ExtraMaps_Clear (void)
-{
-	FileList_Clear(&extralevels);
-}
-
-void ExtraMaps_NewGame (void)
-{
-	ExtraMaps_Clear ();
-	ExtraMaps_Init ();
-}
-
-/*
-==================
-Host_Maps_f
-==================
-*/
-static void Host_Maps_f (void)
-{
-	int i;
-	filelist_item_t	*level;
-
-	for (level = extralevels, i = 0; level; level = level->next, i++)
-		Con_SafePrintf ("   %s\n", level->name);
-
-	if (i)
-		Con_SafePrintf ("%i map(s)\n", i);
-	else
-		Con_SafePrintf ("no maps found\n");
-}
-
-//==============================================================================
-//johnfitz -- modlist management
-//==============================================================================
-
-filelist_item_t	*modlist;
-
-static void Modlist_Add (const char *name)
-{
-	FileList_Add(name, &modlist);
+	closedir(dir_p);
+#endif
 }
 
 #ifdef _WIN32
-void Modlist_Init (void)
+static void FileScan_ReadMods (filescan_t *scan, const char *basedir)
 {
 	WIN32_FIND_DATA	fdat;
 	HANDLE		fhnd;
 	DWORD		attribs;
 	char		dir_string[MAX_OSPATH], mod_string[MAX_OSPATH];
 
-	q_snprintf (dir_string, sizeof(dir_string), "%s/*", com_basedir);
+	q_snprintf (dir_string, sizeof(dir_string), "%s/*", basedir);
 	fhnd = FindFirstFile(dir_string, &fdat);
 	if (fhnd == INVALID_HANDLE_VALUE)
 		return;
@@ -241,24 +177,24 @@ void Modlist_Init (void)
 	{
 		if (!strcmp(fdat.cFileName, ".") || !strcmp(fdat.cFileName, ".."))
 			continue;
-		q_snprintf (mod_string, sizeof(mod_string), "%s/%s", com_basedir, fdat.cFileName);
+		q_snprintf (mod_string, sizeof(mod_string), "%s/%s", basedir, fdat.cFileName);
 		attribs = GetFileAttributes (mod_string);
 		if (attribs != INVALID_FILE_ATTRIBUTES && (attribs & FILE_ATTRIBUTE_DIRECTORY)) {
 			/* don't bother testing for pak files / progs.dat */
-			Modlist_Add(fdat.cFileName);
+			FileScan_Add (scan, fdat.cFileName);
 		}
 	} while (FindNextFile(fhnd, &fdat));
 
 	FindClose(fhnd);
 }
 #else
-void Modlist_Init (void)
+static void FileScan_ReadMods (filescan_t *scan, const char *basedir)
 {
 	DIR		*dir_p, *mod_dir_p;
 	struct dirent	*dir_t;
 	char		dir_string[MAX_OSPATH], mod_string[MAX_OSPATH];
 
-	q_snprintf (dir_string, sizeof(dir_string), "%s/", com_basedir);
+	q_snprintf (dir_string, sizeof(dir_string), "%s/", basedir);
 	dir_p = opendir(dir_string);
 	if (dir_p == NULL)
 		return;
@@ -274,7 +210,7 @@ void Modlist_Init (void)
 		if (mod_dir_p == NULL)
 			continue;
 		/* don't bother testing for pak files / progs.dat */
-		Modlist_Add(dir_t->d_name);
+		FileScan_Add (scan, dir_t->d_name);
 		closedir(mod_dir_p);
 	}
 
@@ -282,89 +218,226 @@ void Modlist_Init (void)
 }
 #endif
 
-//==============================================================================
-//ericw -- demo list management
-//==============================================================================
+static void FileScan_Task (void *data)
+{
+	filescan_t	*scan = (filescan_t *) data;
+	int		i;
 
-filelist_item_t	*demolist;
+	for (i = 0; i < scan->numdirs; i++)
+	{
+		if (scan->subdir)
+			FileScan_ReadDir (scan, scan->dirs[i]);
+		else
+			FileScan_ReadMods (scan, scan->dirs[i]);
+	}
+}
 
-static void DemoList_Clear (void)
+static int FileScan_Compare (const void *a, const void *b)
 {
-	FileList_Clear (&demolist);
+	int	c;
+
+	c = q_strcasecmp ((const char *) a, (const char *) b);
+	if (!c)	// same case next to each other, for dropping duplicates
+		c = strcmp ((const char *) a, (const char *) b);
+	return c;
 }
 
-void DemoList_Rebuild (void)
+/*
+==================
+FileScan_Finish
+
+Replaces the list with the sorted scan results; the whole list is one
+zone block, freed through the head item.
+==================
+*/
+static void FileScan_Finish (filescan_t *scan)
 {
-	DemoList_Clear ();
-	DemoList_Init ();
+	filelist_item_t	*items;
+	int		i, count;
+
+	Task_Wait (scan->task);
+	scan->pending = false;
+
+	if (scan->nomem)
+		Con_Warning ("out of memory listing %s files\n", scan->ext ? scan->ext : "mod");
+
+	if (*scan->list)
+		Z_Free (*scan->list);
+	*scan->list = NULL;
+	*scan->count = 0;
+
+	if (scan->numnames)
+	{
+		qsort (scan->names, scan->numnames, sizeof(filename_t), FileScan_Compare);
+		items = (filelist_item_t *) Z_Malloc (scan->numnames * sizeof(filelist_item_t));
+		for (i = count = 0; i < scan->numnames; i++)
+		{
+			if (count && !strcmp (scan->names[i], items[count - 1].name))
+				continue;	// ignore duplicate
+			q_strlcpy (items[count].name, scan->names[i], sizeof(items[count].name));
+			if (count)
+				items[count - 1].next = &items[count];
+			count++;
+		}
+		*scan->list = items;
+		*scan->count = count;
+	}
+
+	free (scan->names);
+	free (scan->dirs);
+	scan->names = NULL;
+	scan->dirs = NULL;
+	scan->numnames = scan->maxnames = scan->numdirs = 0;
 }
 
-// TODO: Factor out to a general-purpose file searching function
-void DemoList_Init (void)
+/*
+==================
+FileScan_Start
+
+Pak files whose path contains ignorepakdir aren't listed, nor are pak
+files under minsize bytes.
+==================
+*/
+static void FileScan_Start (filescan_t *scan, const char *ignorepakdir, int minsize)
 {
-#ifdef _WIN32
-	WIN32_FIND_DATA	fdat;
-	HANDLE		fhnd;
-#else
-	DIR		*dir_p;
-	struct dirent	*dir_t;
-#endif
-	char		filestring[MAX_OSPATH];
-	char		demname[32];
-	char		ignorepakdir[32];
 	searchpath_t	*search;
 	pack_t		*pak;
-	int		i;
+	const char	*name;
+	int		i, len;
 
-	// we don't want to list the demos in id1 pakfiles,
-	// because these are not "add-on" demos
-	q_snprintf (ignorepakdir, sizeof(ignorepakdir), "/%s/", GAMENAME);
-	
-	for (search = com_searchpaths; search; search = search->next)
+	if (scan->pending)
+		FileScan_Finish (scan);
+	scan->nomem = false;
+
+	if (!scan->subdir)
 	{
-		if (*search->filename) //directory
+		scan->dirs = (char (*)[MAX_OSPATH]) malloc (sizeof(*scan->dirs));
+		if (!scan->dirs)
+			Sys_Error ("FileScan_Start: out of memory");
+		q_strlcpy (scan->dirs[0], com_basedir, sizeof(scan->dirs[0]));
+		scan->numdirs = 1;
+	}
+	else
+	{
+		for (search = com_searchpaths, i = 0; search; search = search->next)
 		{
-#ifdef _WIN32
-			q_snprintf (filestring, sizeof(filestring), "%s/*.dem", search->filename);
-			fhnd = FindFirstFile(filestring, &fdat);
-			if (fhnd == INVALID_HANDLE_VALUE)
-				continue;
-			do
+			if (*search->filename)
+				i++;
+		}
+		scan->dirs = (char (*)[MAX_OSPATH]) malloc (q_max (i, 1) * sizeof(*scan->dirs));
+		if (!scan->dirs)
+			Sys_Error ("FileScan_Start: out of memory");
+
+		len = strlen (scan->subdir);
+		for (search = com_searchpaths; search; search = search->next)
+		{
+			if (*search->filename) //directory
 			{
-				COM_StripExtension(fdat.cFileName, demname, sizeof(demname));
-				FileList_Add (demname, &demolist);
-			} while (FindNextFile(fhnd, &fdat));
-			FindClose(fhnd);
-#else
-			q_snprintf (filestring, sizeof(filestring), "%s/", search->filename);
-			dir_p = opendir(filestring);
-			if (dir_p == NULL)
+				q_strlcpy (scan->dirs[scan->numdirs++], search->filename, sizeof(scan->dirs[0]));
 				continue;
-			while ((dir_t = readdir(dir_p)) != NULL)
+			}
+			if (strstr(search->pack->filename, ignorepakdir))
+				continue;	//don't list standard id files
+			for (i = 0, pak = search->pack; i < pak->numfiles; i++)
 			{
-				if (q_strcasecmp(COM_FileGetExtension(dir_t->d_name), "dem") != 0)
+				name = pak->files[i].name;
+				if (strcmp(COM_FileGetExtension(name), scan->ext) || pak->files[i].filelen <= minsize)
 					continue;
-				COM_StripExtension(dir_t->d_name, demname, sizeof(demname));
-				FileList_Add (demname, &demolist);
-			}
-			closedir(dir_p);
-#endif
-		}
-		else //pakfile
-		{
-			if (!strstr(search->pack->filename, ignorepakdir))
-			{ //don't list standard id demos
-				for (i = 0, pak = search->pack; i < pak->numfiles; i++)
-				{
-					if (!strcmp(COM_FileGetExtension(pak->files[i].name), "dem"))
-					{
-						COM_StripExtension(pak->files[i].name, demname, sizeof(demname));
-						FileList_Add (demname, &demolist);
-					}
-				}
+				if (!strncmp (name, scan->subdir, len))
+					name += len;
+				FileScan_AddStripped (scan, name);
 			}
 		}
 	}
+
+	scan->pending = true;
+	scan->task = Task_Run (FileScan_Task, scan, NULL, 0);
+}
+
+/*
+==================
+FileLists_Update
+
+Swaps in finished scans; with wait set, waits for the pending ones.
+==================
+*/
+void FileLists_Update (qboolean wait)
+{
+	filescan_t	*scans[] = {&scan_maps, &scan_demos, &scan_mods};
+	int		i;
+
+	for (i = 0; i < (int) (sizeof(scans) / sizeof(scans[0])); i++)
+	{
+		if (scans[i]->pending && (wait || Task_Done (scans[i]->task)))
+			FileScan_Finish (scans[i]);
+	}
+}
+
+void ExtraMaps_Init (void)
+{
+	char		ignorepakdir[32];
+
+	// we don't want to list the maps in id1 pakfiles,
+	// because these are not "add-on" levels
+	q_snprintf (ignorepakdir, sizeof(ignorepakdir), "/%s/", GAMENAME);
+
+	// don't list files under 32k (ammo boxes etc)
+	FileScan_Start (&scan_maps, ignorepakdir, 32*1024);
+}
+
+// the old list stays until the new one is ready
+void ExtraMaps_NewGame (void)
+{
+	ExtraMaps_Init ();
+}
+
+/*
+==================
+Host_Maps_f
+==================
+*/
+static void Host_Maps_f (void)
+{
+	int i;
+	filelist_item_t	*level;
+
+	FileLists_Update (true);
+	for (level = extralevels, i = 0; level; level = level->next, i++)
+		Con_SafePrintf ("   %s\n", level->name);
+
+	if (i)
+		Con_SafePrintf ("%i map(s)\n", i);
+	else
+		Con_SafePrintf ("no maps found\n");
+}
+
+//==============================================================================
+//johnfitz -- modlist management
+//==============================================================================
+
+void Modlist_Init (void)
+{
+	FileScan_Start (&scan_mods, NULL, 0);
+}
+
+//==============================================================================
+//ericw -- demo list management
+//==============================================================================
+
+void DemoList_Rebuild (void)
+{
+	DemoList_Init ();
+}
+
+void DemoList_Init (void)
+{
+	char		ignorepakdir[32];
+
+	// we don't want to list the demos in id1 pakfiles,
+	// because these are not "add-on" demos
+	q_snprintf (ignorepakdir, sizeof(ignorepakdir), "/%s/", GAMENAME);
+
+	FileScan_Start (&scan_demos, ignorepakdir, -1);
 }
 
 /*
@@ -379,6 +452,7 @@ static void Host_Mods_f (void)
 	int i;
 	filelist_item_t	*mod;
 
+	FileLists_Update (true);
 	for (mod = modlist, i=0; mod; mod = mod->next, i++)
 		Con_SafePrintf ("   %s\n", mod->name);
 
@@ -464,6 +538,8 @@ static void Host_Status_f (void)
 			hours = 0;
 		print_fn ("#%-2u %-16.16s  %3i  %2i:%02i:%02i\n", j+1, client->name, (int)client->edict->v.frags, hours, minutes, seconds);
 		print_fn ("   %s\n", NET_QSocketGetAddressString(client->netconnection));
+		if (client->deferredtotal)
+			print_fn ("   %i entity updates deferred, %i last frame\n", client->deferredtotal, client->deferredents);
 	}
 }
 
@@ -852,6 +928,7 @@ static void Host_Randmap_f (void)
 	if (cmd_source != src_command)
 		return;
 
+	FileLists_Update (true);
 	for (level = extralevels, numlevels = 0; level; level = level->next)
 		numlevels++;
 
@@ -984,6 +1061,27 @@ LOAD / SAVE GAME
 */
 
 #define	SAVEGAME_VERSION	5
+#define	SAVEGAME_BINARY		105	// version line of binary saves
+
+/*
+===============
+Binary savegames
+
+Start with the version and comment lines of the text format, so the menu
+lists them the same way, followed by a savehead_t, the light styles as 0
+terminated strings and an ED_WriteImage.  quicksnap keeps the same thing
+in memory.
+===============
+*/
+typedef struct
+{
+	float		spawn_parms[NUM_SPAWN_PARMS];
+	int		skill;
+	char		mapname[MAX_QPATH];
+	double		time;
+} savehead_t;
+
+static strbuf_t	quicksnap;
 
 /*
 ===============
@@ -1024,37 +1122,181 @@ static void Host_SavegameComment (char *text)
 
 /*
 ===============
-Host_Savegame_f
+Savegame writing
+
+The save text is printed into memory on the main thread, then a task
+writes it to a temp file, syncs it and renames it over the old save, so
+the game doesn't hitch on the disk and a crash can't leave half a save.
 ===============
 */
-static void Host_Savegame_f (void)
+typedef struct
 {
-	char	name[MAX_OSPATH];
-	FILE	*f;
-	int	i;
-	char	comment[SAVEGAME_COMMENT_LENGTH+1];
+	char		path[MAX_OSPATH];
+	strbuf_t	text;		// kept allocated between saves
+	qboolean	binary;
+	qboolean	failed;
+} savejob_t;
 
-	if (cmd_source != src_command)
+static savejob_t	save_job;
+static task_t		save_task;
+static qboolean		save_pending;
+
+static void Host_WriteSavegameTask (void *data)
+{
+	savejob_t	*job = (savejob_t *) data;
+	char		temp[MAX_OSPATH + 4];
+	FILE		*f;
+	qboolean	ok;
+
+	job->failed = true;
+	q_snprintf (temp, sizeof(temp), "%s.tmp", job->path);
+	f = fopen (temp, job->binary ? "wb" : "w");
+	if (!f)
+		return;
+	ok = fwrite (job->text.data, 1, job->text.len, f) == job->text.len;
+	ok = Sys_FileCommit (f) && ok;
+	ok = (fclose (f) == 0) && ok;
+	if (ok && Sys_FileReplace (temp, job->path))
+		job->failed = false;
+	else
+		remove (temp);
+}
+
+/*
+===============
+Host_FinishSavegame
+
+Reports the result of a background save once it is written.  With wait
+set, blocks until it is, which loading or another save needs.
+===============
+*/
+void Host_FinishSavegame (qboolean wait)
+{
+	if (!save_pending)
+		return;
+	if (!wait && !Task_Done (save_task))
 		return;
 
+	Task_Wait (save_task);
+	save_pending = false;
+
+	if (save_job.failed)
+		Con_Printf ("ERROR: couldn't write %s.\n", save_job.path);
+}
+
+/*
+===============
+Host_CanSavegame
+===============
+*/
+static qboolean Host_CanSavegame (void)
+{
+	int	i;
+
 	if (!sv.active)
 	{
 		Con_Printf ("Not playing a local game.\n");
-		return;
+		return false;
 	}
 
 	if (cl.intermission)
 	{
 		Con_Printf ("Can't save in intermission.\n");
-		return;
+		return false;
 	}
 
 	if (svs.maxclients != 1)
 	{
 		Con_Printf ("Can't save multiplayer games.\n");
+		return false;
+	}
+
+	for (i=0 ; i<svs.maxclients ; i++)
+	{
+		if (svs.clients[i].active && (svs.clients[i].edict->v.health <= 0) )
+		{
+			Con_Printf ("Can't savegame with a dead player\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+===============
+Host_WriteSavegame
+
+Prints the whole save into sb, as text or as a binary image.
+===============
+*/
+static void Host_WriteSavegame (strbuf_t *sb, qboolean binary)
+{
+	savehead_t	head;
+	int	i;
+	char	comment[SAVEGAME_COMMENT_LENGTH+1];
+
+	SB_Clear (sb);
+	SB_Printf (sb, "%i\n", binary ? SAVEGAME_BINARY : SAVEGAME_VERSION);
+	Host_SavegameComment (comment);
+	SB_Printf (sb, "%s\n", comment);
+
+	if (binary)
+	{
+		memset (&head, 0, sizeof(head));
+		for (i = 0; i < NUM_SPAWN_PARMS; i++)
+			head.spawn_parms[i] = svs.clients->spawn_parms[i];
+		head.skill = current_skill;
+		q_strlcpy (head.mapname, sv.name, sizeof(head.mapname));
+		head.time = sv.time;
+		SB_Write (sb, &head, sizeof(head));
+		for (i = 0; i < MAX_LIGHTSTYLES; i++)
+		{
+			if (sv.lightstyles[i])
+				SB_Write (sb, sv.lightstyles[i], strlen (sv.lightstyles[i]) + 1);
+			else
+				SB_Write (sb, "m", 2);
+		}
+		ED_WriteImage (sb);
 		return;
 	}
 
+	for (i = 0; i < NUM_SPAWN_PARMS; i++)
+		SB_Printf (sb, "%f\n", svs.clients->spawn_parms[i]);
+	SB_Printf (sb, "%d\n", current_skill);
+	SB_Printf (sb, "%s\n", sv.name);
+	SB_Printf (sb, "%f\n",sv.time);
+
+// write the light styles
+	for (i = 0; i < MAX_LIGHTSTYLES; i++)
+	{
+		if (sv.lightstyles[i])
+			SB_Printf (sb, "%s\n", sv.lightstyles[i]);
+		else
+			SB_Printf (sb, "m\n");
+	}
+
+	ED_WriteGlobals (sb);
+	for (i = 0; i < sv.num_edicts; i++)
+		ED_Write (sb, EDICT_NUM(i));
+}
+
+/*
+===============
+Host_Savegame_f
+===============
+*/
+static void Host_Savegame_f (void)
+{
+	char	name[MAX_OSPATH];
+	char	comment[SAVEGAME_COMMENT_LENGTH+1];
+
+	if (cmd_source != src_command)
+		return;
+
+	if (!Host_CanSavegame ())
+		return;
+
 	if (Cmd_Argc() != 2)
 	{
 		Con_Printf ("save <savename> : save a game\n");
@@ -1067,52 +1309,100 @@ static void Host_Savegame_f (void)
 		return;
 	}
 
-	for (i=0 ; i<svs.maxclients ; i++)
+	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(1));
+	COM_AddExtension (name, ".sav", sizeof(name));
+
+	Con_Printf ("Saving game to %s...\n", name);
+
+	// the buffer is still in use until the previous save is written
+	Host_FinishSavegame (true);
+	save_job.binary = savegame_binary.value != 0;
+	Host_WriteSavegame (&save_job.text, save_job.binary);
+
+	q_strlcpy (save_job.path, name, sizeof(save_job.path));
+	save_task = Task_Run (Host_WriteSavegameTask, &save_job, NULL, 0);
+	save_pending = true;
+	Host_FinishSavegame (false);	// already done without worker threads
+
+	Host_SavegameComment (comment);
+	M_NoteSavegame (name, comment);	// so the menu needn't read it back
+
+	Con_Printf ("done.\n");
+}
+
+/*
+===============
+Host_LoadSavegameImage
+
+Loads a binary save from memory, len bytes at data.
+===============
+*/
+static void Host_LoadSavegameImage (const byte *data, int len)
+{
+	savehead_t	head;
+	const byte	*p, *end;
+	const char	*styles;
+	int	i, version;
+	double	parsestart;
+
+	end = data + len;
+	p = (const byte *) COM_ParseIntNewline ((const char *) data, &version);
+	p = (const byte *) COM_ParseStringNewline ((const char *) p);
+	if (version != SAVEGAME_BINARY || end - p < (int) sizeof(head))
 	{
-		if (svs.clients[i].active && (svs.clients[i].edict->v.health <= 0) )
+		Con_Printf ("Savegame is damaged\n");
+		return;
+	}
+	memcpy (&head, p, sizeof(head));
+	head.mapname[sizeof(head.mapname) - 1] = 0;
+	p += sizeof(head);
+
+	styles = (const char *) p;
+	for (i = 0; i < MAX_LIGHTSTYLES; i++)
+	{
+		if (!memchr (p, 0, end - p))
 		{
-			Con_Printf ("Can't savegame with a dead player\n");
+			Con_Printf ("Savegame is damaged\n");
 			return;
 		}
+		p += strlen ((const char *) p) + 1;
 	}
 
-	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(1));
-	COM_AddExtension (name, ".sav", sizeof(name));
+	current_skill = head.skill;
+	Cvar_SetValue ("skill", (float)current_skill);
 
-	Con_Printf ("Saving game to %s...\n", name);
-	f = fopen (name, "w");
-	if (!f)
+	CL_Disconnect_f ();
+
+	SV_SpawnServer (head.mapname);
+
+	if (!sv.active)
 	{
-		Con_Printf ("ERROR: couldn't open.\n");
+		Con_Printf ("Couldn't load map\n");
 		return;
 	}
+	sv.paused = true;		// pause until all clients connect
+	sv.loadgame = true;
 
-	fprintf (f, "%i\n", SAVEGAME_VERSION);
-	Host_SavegameComment (comment);
-	fprintf (f, "%s\n", comment);
-	for (i = 0; i < NUM_SPAWN_PARMS; i++)
-		fprintf (f, "%f\n", svs.clients->spawn_parms[i]);
-	fprintf (f, "%d\n", current_skill);
-	fprintf (f, "%s\n", sv.name);
-	fprintf (f, "%f\n",sv.time);
-
-// write the light styles
 	for (i = 0; i < MAX_LIGHTSTYLES; i++)
 	{
-		if (sv.lightstyles[i])
-			fprintf (f, "%s\n", sv.lightstyles[i]);
-		else
-			fprintf (f,"m\n");
+		sv.lightstyles[i] = (const char *)Hunk_Strdup (styles, "lightstyles");
+		styles += strlen (styles) + 1;
 	}
 
-	ED_WriteGlobals (f);
-	for (i = 0; i < sv.num_edicts; i++)
+	parsestart = Sys_DoubleTime ();
+	ED_ReadImage (p, end - p);
+	sv.time = head.time;
+	ED_ResetFreeList ();
+	Con_DPrintf ("%i edicts read in %.1f ms\n", sv.num_edicts, (Sys_DoubleTime () - parsestart) * 1000.0);
+
+	for (i = 0; i < NUM_SPAWN_PARMS; i++)
+		svs.clients->spawn_parms[i] = head.spawn_parms[i];
+
+	if (cls.state != ca_dedicated)
 	{
-		ED_Write (f, EDICT_NUM(i));
-		fflush (f);
+		CL_EstablishConnection ("local");
+		Host_Reconnect_f ();
 	}
-	fclose (f);
-	Con_Printf ("done.\n");
 }
 
 /*
@@ -1133,6 +1423,10 @@ static void Host_Loadgame_f (void)
 	int	entnum;
 	int	version;
 	float	spawn_parms[NUM_SPAWN_PARMS];
+	double	parsestart;
+	long	len;
+
+	Host_FinishSavegame (true);	// may be loading what was just saved
 
 	if (cmd_source != src_command)
 		return;
@@ -1164,6 +1458,24 @@ static void Host_Loadgame_f (void)
 	if (start != NULL)
 		free (start);
 	
+	start = (char *) COM_LoadMallocFile_OSPath (name, &len);
+	if (start == NULL)
+	{
+		Con_Printf ("ERROR: couldn't open.\n");
+		return;
+	}
+
+	COM_ParseIntNewline (start, &version);
+	if (version == SAVEGAME_BINARY)
+	{
+		Host_LoadSavegameImage ((byte *) start, (int) len);
+		free (start);
+		start = NULL;
+		return;
+	}
+
+	// again with the line endings translated
+	free (start);
 	start = (char *) COM_LoadMallocFile_TextMode_OSPath(name, NULL);
 	if (start == NULL)
 	{
@@ -1215,6 +1527,7 @@ static void Host_Loadgame_f (void)
 	}
 
 // load the edicts out of the savegame file
+	parsestart = Sys_DoubleTime ();
 	entnum = -1;		// -1 is the globals
 	while (*data)
 	{
@@ -1252,6 +1565,8 @@ static void Host_Loadgame_f (void)
 
 	sv.num_edicts = entnum;
 	sv.time = time;
+	ED_ResetFreeList ();
+	Con_DPrintf ("%i edicts parsed in %.1f ms\n", entnum, (Sys_DoubleTime () - parsestart) * 1000.0);
 
 	free (start);
 	start = NULL;
@@ -1266,6 +1581,45 @@ static void Host_Loadgame_f (void)
 	}
 }
 
+/*
+===============
+Host_Quicksnap_f
+
+Keeps a binary save in memory, for quickrestore.
+===============
+*/
+static void Host_Quicksnap_f (void)
+{
+	if (cmd_source != src_command)
+		return;
+
+	if (!Host_CanSavegame ())
+		return;
+
+	Host_WriteSavegame (&quicksnap, true);
+	Con_Printf ("Snapshot taken, %i KB.\n", (int) (quicksnap.len / 1024));
+}
+
+/*
+===============
+Host_Quickrestore_f
+===============
+*/
+static void Host_Quickrestore_f (void)
+{
+	if (cmd_source != src_command)
+		return;
+
+	if (!quicksnap.len)
+	{
+		Con_Printf ("No snapshot, use quicksnap first.\n");
+		return;
+	}
+
+	cls.demonum = -1;		// stop demo loop in case this fails
+	Host_LoadSavegameImage ((byte *) quicksnap.data, (int) quicksnap.len);
+}
+
 //============================================================================
 
 /*
@@ -2313,6 +2667,8 @@ void Host_InitCommands (void)
 	Cmd_AddCommand ("ping", Host_Ping_f);
 	Cmd_AddCommand ("load", Host_Loadgame_f);
 	Cmd_AddCommand ("save", Host_Savegame_f);
+	Cmd_AddCommand ("quicksnap", Host_Quicksnap_f);
+	Cmd_AddCommand ("quickrestore", Host_Quickrestore_f);
 	Cmd_AddCommand ("give", Host_Give_f);
 
 	Cmd_AddCommand ("startdemos", Host_Startdemos_f);
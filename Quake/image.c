@@ -31,68 +31,66 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define LODEPNG_NO_COMPILE_CPP
 #define LODEPNG_NO_COMPILE_ANCILLARY_CHUNKS
 #define LODEPNG_NO_COMPILE_ERROR_TEXT
-#include "lodepng.h"
-#include "lodepng.c"
+#include "lodepng.h"	// compiled in gzip.c, which the dedicated server links too
 
 static char loadfilename[MAX_OSPATH]; //file scope so that error messages can use it
 
-typedef struct stdio_buffer_s {
-	FILE *f;
-	unsigned char buffer[1024];
-	int size;
-	int pos;
-} stdio_buffer_t;
+typedef byte *(*imagealloc_t) (int size);
 
-static stdio_buffer_t *Buf_Alloc(FILE *f)
+typedef struct
+{
+	const byte	*data;
+	int		size;
+	int		pos;
+} imagereader_t;
+
+static inline int Reader_GetC (imagereader_t *r)
 {
-	stdio_buffer_t *buf = (stdio_buffer_t *) calloc(1, sizeof(stdio_buffer_t));
-	buf->f = f;
-	return buf;
+	if (r->pos >= r->size)
+		return 0;	// truncated file
+	return r->data[r->pos++];
 }
 
-static void Buf_Free(stdio_buffer_t *buf)
+static inline int Reader_GetLittleShort (imagereader_t *r)
 {
-	free(buf);
+	int	b1, b2;
+
+	b1 = Reader_GetC (r);
+	b2 = Reader_GetC (r);
+
+	return (short)(b1 + b2*256);
 }
 
-static inline int Buf_GetC(stdio_buffer_t *buf)
+static byte *Image_HunkAlloc (int size)
 {
-	if (buf->pos >= buf->size)
-	{
-		buf->size = fread(buf->buffer, 1, sizeof(buf->buffer), buf->f);
-		buf->pos = 0;
-		
-		if (buf->size == 0)
-			return EOF;
-	}
+	return (byte *) Hunk_Alloc (size);
+}
 
-	return buf->buffer[buf->pos++];
+static byte *Image_Malloc (int size)
+{
+	return (byte *) malloc (size);
 }
 
 /*
 ============
-Image_LoadImage
-
-returns a pointer to hunk allocated RGBA data
+Image_ReadFile
 
-TODO: search order: tga png jpg pcx lmp
+reads size bytes from the current position and closes f
 ============
 */
-byte *Image_LoadImage (const char *name, int *width, int *height)
+static byte *Image_ReadFile (FILE *f, int size)
 {
-	FILE	*f;
+	byte	*data;
 
-	q_snprintf (loadfilename, sizeof(loadfilename), "%s.tga", name);
-	COM_FOpenFile (loadfilename, &f, NULL);
-	if (f)
-		return Image_LoadTGA (f, width, height);
-
-	q_snprintf (loadfilename, sizeof(loadfilename), "%s.pcx", name);
-	COM_FOpenFile (loadfilename, &f, NULL);
-	if (f)
-		return Image_LoadPCX (f, width, height);
+	data = (byte *) malloc (size > 0 ? size : 1);
+	if (data && (int) fread (data, 1, size, f) != size)
+	{
+		free (data);
+		data = NULL;
+	}
+	fclose (f);
 
-	return NULL;
+	return data;
 }
 
 //==============================================================================
@@ -111,30 +109,6 @@ typedef struct targaheader_s {
 
 #define TARGAHEADERSIZE 18 //size on disk
 
-targaheader_t targa_header;
-
-int fgetLittleShort (FILE *f)
-{
-	byte	b1, b2;
-
-	b1 = fgetc(f);
-	b2 = fgetc(f);
-
-	return (short)(b1 + b2*256);
-}
-
-int fgetLittleLong (FILE *f)
-{
-	byte	b1, b2, b3, b4;
-
-	b1 = fgetc(f);
-	b2 = fgetc(f);
-	b3 = fgetc(f);
-	b4 = fgetc(f);
-
-	return b1 + (b2<<8) + (b3<<16) + (b4<<24);
-}
-
 /*
 ============
 Image_WriteTGA -- writes RGB or RGBA data to a TGA file
@@ -146,14 +120,16 @@ TODO: support BGRA and BGR formats (since opengl can return them, and we don't h
 */
 qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown)
 {
-	int		handle, i, size, temp, bytes;
+	int		i, size, temp, bytes;
 	char	pathname[MAX_OSPATH];
 	byte	header[TARGAHEADERSIZE];
+	FILE	*f;
+	qboolean	ok;
 
 	Sys_mkdir (com_gamedir); //if we've switched to a nonexistant gamedir, create it now so we don't crash
 	q_snprintf (pathname, sizeof(pathname), "%s/%s", com_gamedir, name);
-	handle = Sys_FileOpenWrite (pathname);
-	if (handle == -1)
+	f = fopen (pathname, "wb"); // not Sys_FileOpenWrite, screenshots are written from tasks
+	if (!f)
 		return false;
 
 	Q_memset (header, 0, TARGAHEADERSIZE);
@@ -176,206 +152,215 @@ qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, in
 		data[i+2] = temp;
 	}
 
-	Sys_FileWrite (handle, header, TARGAHEADERSIZE);
-	Sys_FileWrite (handle, data, size);
-	Sys_FileClose (handle);
+	ok = fwrite (header, TARGAHEADERSIZE, 1, f) == 1 && fwrite (data, size, 1, f) == 1;
+	if (fclose (f) != 0)
+		ok = false;
 
-	return true;
+	return ok;
 }
 
 /*
 =============
-Image_LoadTGA
+TGA_SwizzleBGR / TGA_SwizzleBGRA
+
+BGR(A) file pixels to RGBA; kept branch-free so the compiler can vectorize them
 =============
 */
-byte *Image_LoadTGA (FILE *fin, int *width, int *height)
+static void TGA_SwizzleBGR (byte *out, const byte *in, int count)
+{
+	for ( ; count > 0; count--, in += 3, out += 4)
+	{
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		out[3] = 255;
+	}
+}
+
+static void TGA_SwizzleBGRA (byte *out, const byte *in, int count)
+{
+	for ( ; count > 0; count--, in += 4, out += 4)
+	{
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		out[3] = in[3];
+	}
+}
+
+/*
+=============
+Image_FlipRows
+
+swaps rows top to bottom in place
+=============
+*/
+static void Image_FlipRows (byte *data, int rowbytes, int rows)
 {
+	byte	temp[1024];
+	byte	*top, *bottom;
+	int	ofs, n;
+
+	for (top = data, bottom = data + (rows - 1) * rowbytes; top < bottom; top += rowbytes, bottom -= rowbytes)
+	{
+		for (ofs = 0; ofs < rowbytes; ofs += n)
+		{
+			n = q_min ((int) sizeof(temp), rowbytes - ofs);
+			memcpy (temp, top + ofs, n);
+			memcpy (top + ofs, bottom + ofs, n);
+			memcpy (bottom + ofs, temp, n);
+		}
+	}
+}
+
+/*
+=============
+Image_DecodeTGA
+
+Safe to call from a task: allocates with alloc and returns NULL with an
+error format (taking the file name) instead of calling Sys_Error.
+=============
+*/
+static byte *Image_DecodeTGA (const byte *in, int insize, int *width, int *height, imagealloc_t alloc, const char **error)
+{
+	targaheader_t	targa_header;
+	imagereader_t	reader, *buf;
 	int				columns, rows, numPixels;
-	byte			*pixbuf;
-	int				row, column;
-	byte			*targa_rgba;
-	int				realrow; //johnfitz -- fix for upside-down targas
+	int				bytes, remaining, count;
+	const byte		*src;
+	byte			*targa_rgba, *out;
 	qboolean		upside_down; //johnfitz -- fix for upside-down targas
-	stdio_buffer_t	*buf;
-
-	targa_header.id_length = fgetc(fin);
-	targa_header.colormap_type = fgetc(fin);
-	targa_header.image_type = fgetc(fin);
-
-	targa_header.colormap_index = fgetLittleShort(fin);
-	targa_header.colormap_length = fgetLittleShort(fin);
-	targa_header.colormap_size = fgetc(fin);
-	targa_header.x_origin = fgetLittleShort(fin);
-	targa_header.y_origin = fgetLittleShort(fin);
-	targa_header.width = fgetLittleShort(fin);
-	targa_header.height = fgetLittleShort(fin);
-	targa_header.pixel_size = fgetc(fin);
-	targa_header.attributes = fgetc(fin);
+
+	buf = &reader;
+	buf->data = in;
+	buf->size = insize;
+	buf->pos = 0;
+
+	targa_header.id_length = Reader_GetC(buf);
+	targa_header.colormap_type = Reader_GetC(buf);
+	targa_header.image_type = Reader_GetC(buf);
+
+	targa_header.colormap_index = Reader_GetLittleShort(buf);
+	targa_header.colormap_length = Reader_GetLittleShort(buf);
+	targa_header.colormap_size = Reader_GetC(buf);
+	targa_header.x_origin = Reader_GetLittleShort(buf);
+	targa_header.y_origin = Reader_GetLittleShort(buf);
+	targa_header.width = Reader_GetLittleShort(buf);
+	targa_header.height = Reader_GetLittleShort(buf);
+	targa_header.pixel_size = Reader_GetC(buf);
+	targa_header.attributes = Reader_GetC(buf);
 
 	if (targa_header.image_type!=2 && targa_header.image_type!=10)
-		Sys_Error ("Image_LoadTGA: %s is not a type 2 or type 10 targa\n", loadfilename);
+	{
+		*error = "Image_LoadTGA: %s is not a type 2 or type 10 targa\n";
+		return NULL;
+	}
 
 	if (targa_header.colormap_type !=0 || (targa_header.pixel_size!=32 && targa_header.pixel_size!=24))
-		Sys_Error ("Image_LoadTGA: %s is not a 24bit or 32bit targa\n", loadfilename);
+	{
+		*error = "Image_LoadTGA: %s is not a 24bit or 32bit targa\n";
+		return NULL;
+	}
 
 	columns = targa_header.width;
 	rows = targa_header.height;
 	numPixels = columns * rows;
 	upside_down = !(targa_header.attributes & 0x20); //johnfitz -- fix for upside-down targas
 
-	targa_rgba = (byte *) Hunk_Alloc (numPixels*4);
+	targa_rgba = alloc (numPixels*4);
+	if (!targa_rgba)
+	{
+		*error = "Image_LoadTGA: not enough memory for %s\n";
+		return NULL;
+	}
 
-	if (targa_header.id_length != 0)
-		fseek(fin, targa_header.id_length, SEEK_CUR);  // skip TARGA image comment
+	buf->pos += targa_header.id_length;  // skip TARGA image comment
 
-	buf = Buf_Alloc(fin);
+	// decode in file order, then flip if the file is bottom-up
+	bytes = targa_header.pixel_size / 8;
+	src = in + q_min (buf->pos, insize);
+	remaining = q_max (0, insize - buf->pos);
+	out = targa_rgba;
+	count = 0;
 
 	if (targa_header.image_type==2) // Uncompressed, RGB images
 	{
-		for(row=rows-1; row>=0; row--)
-		{
-			//johnfitz -- fix for upside-down targas
-			realrow = upside_down ? row : rows - 1 - row;
-			pixbuf = targa_rgba + realrow*columns*4;
-			//johnfitz
-			for(column=0; column<columns; column++)
-			{
-				unsigned char red,green,blue,alphabyte;
-				switch (targa_header.pixel_size)
-				{
-				case 24:
-					blue = Buf_GetC(buf);
-					green = Buf_GetC(buf);
-					red = Buf_GetC(buf);
-					*pixbuf++ = red;
-					*pixbuf++ = green;
-					*pixbuf++ = blue;
-					*pixbuf++ = 255;
-					break;
-				case 32:
-					blue = Buf_GetC(buf);
-					green = Buf_GetC(buf);
-					red = Buf_GetC(buf);
-					alphabyte = Buf_GetC(buf);
-					*pixbuf++ = red;
-					*pixbuf++ = green;
-					*pixbuf++ = blue;
-					*pixbuf++ = alphabyte;
-					break;
-				}
-			}
-		}
+		count = q_min (numPixels, remaining / bytes);
+		if (bytes == 3)
+			TGA_SwizzleBGR (out, src, count);
+		else
+			TGA_SwizzleBGRA (out, src, count);
 	}
 	else if (targa_header.image_type==10) // Runlength encoded RGB images
 	{
-		unsigned char red,green,blue,alphabyte,packetHeader,packetSize,j;
-		for(row=rows-1; row>=0; row--)
+		const byte	*end = src + remaining;
+		byte		pixel[4];
+		int		packetsize, i;
+
+		while (count < numPixels && src < end)
 		{
-			//johnfitz -- fix for upside-down targas
-			realrow = upside_down ? row : rows - 1 - row;
-			pixbuf = targa_rgba + realrow*columns*4;
-			//johnfitz
-			for(column=0; column<columns; )
+			packetsize = 1 + (*src & 0x7f);
+			packetsize = q_min (packetsize, numPixels - count);
+			if (*src++ & 0x80) // run-length packet
+			{
+				if (end - src < bytes)
+					break;
+				if (bytes == 3)
+					TGA_SwizzleBGR (pixel, src, 1);
+				else
+					TGA_SwizzleBGRA (pixel, src, 1);
+				src += bytes;
+				for (i = 0; i < packetsize; i++, out += 4)
+					memcpy (out, pixel, 4);
+			}
+			else // non run-length packet
 			{
-				packetHeader=Buf_GetC(buf);
-				packetSize = 1 + (packetHeader & 0x7f);
-				if (packetHeader & 0x80) // run-length packet
-				{
-					switch (targa_header.pixel_size)
-					{
-					case 24:
-						blue = Buf_GetC(buf);
-						green = Buf_GetC(buf);
-						red = Buf_GetC(buf);
-						alphabyte = 255;
-						break;
-					case 32:
-						blue = Buf_GetC(buf);
-						green = Buf_GetC(buf);
-						red = Buf_GetC(buf);
-						alphabyte = Buf_GetC(buf);
-						break;
-					default: /* avoid compiler warnings */
-						blue = red = green = alphabyte = 0;
-					}
-
-					for(j=0;j<packetSize;j++)
-					{
-						*pixbuf++=red;
-						*pixbuf++=green;
-						*pixbuf++=blue;
-						*pixbuf++=alphabyte;
-						column++;
-						if (column==columns) // run spans across rows
-						{
-							column=0;
-							if (row>0)
-								row--;
-							else
-								goto breakOut;
-							//johnfitz -- fix for upside-down targas
-							realrow = upside_down ? row : rows - 1 - row;
-							pixbuf = targa_rgba + realrow*columns*4;
-							//johnfitz
-						}
-					}
-				}
-				else // non run-length packet
-				{
-					for(j=0;j<packetSize;j++)
-					{
-						switch (targa_header.pixel_size)
-						{
-						case 24:
-							blue = Buf_GetC(buf);
-							green = Buf_GetC(buf);
-							red = Buf_GetC(buf);
-							*pixbuf++ = red;
-							*pixbuf++ = green;
-							*pixbuf++ = blue;
-							*pixbuf++ = 255;
-							break;
-						case 32:
-							blue = Buf_GetC(buf);
-							green = Buf_GetC(buf);
-							red = Buf_GetC(buf);
-							alphabyte = Buf_GetC(buf);
-							*pixbuf++ = red;
-							*pixbuf++ = green;
-							*pixbuf++ = blue;
-							*pixbuf++ = alphabyte;
-							break;
-						default: /* avoid compiler warnings */
-							blue = red = green = alphabyte = 0;
-						}
-						column++;
-						if (column==columns) // pixel packet run spans across rows
-						{
-							column=0;
-							if (row>0)
-								row--;
-							else
-								goto breakOut;
-							//johnfitz -- fix for upside-down targas
-							realrow = upside_down ? row : rows - 1 - row;
-							pixbuf = targa_rgba + realrow*columns*4;
-							//johnfitz
-						}
-					}
-				}
+				packetsize = q_min (packetsize, (int)(end - src) / bytes);
+				if (bytes == 3)
+					TGA_SwizzleBGR (out, src, packetsize);
+				else
+					TGA_SwizzleBGRA (out, src, packetsize);
+				src += packetsize * bytes;
+				out += packetsize * 4;
 			}
-			breakOut:;
+			count += packetsize;
 		}
 	}
 
-	Buf_Free(buf);
-	fclose(fin);
+	// truncated file
+	if (count < numPixels)
+		memset (targa_rgba + count * 4, 0, (numPixels - count) * 4);
+
+	//johnfitz -- fix for upside-down targas
+	if (upside_down)
+		Image_FlipRows (targa_rgba, columns * 4, rows);
 
 	*width = (int)(targa_header.width);
 	*height = (int)(targa_header.height);
 	return targa_rgba;
 }
 
+/*
+=============
+Image_LoadTGA
+=============
+*/
+byte *Image_LoadTGA (FILE *fin, int *width, int *height)
+{
+	const char	*error;
+	byte		*in, *data;
+	int		size = com_filesize;
+
+	if (!(in = Image_ReadFile (fin, size)))
+		Sys_Error ("Image_LoadTGA: couldn't read %s\n", loadfilename);
+	data = Image_DecodeTGA (in, size, width, height, Image_HunkAlloc, &error);
+	free (in);
+	if (!data)
+		Sys_Error (error, loadfilename);
+
+	return data;
+}
+
 //==============================================================================
 //
 //  PCX
@@ -400,20 +385,26 @@ typedef struct
 
 /*
 ============
-Image_LoadPCX
+Image_DecodePCX
+
+like Image_DecodeTGA
 ============
 */
-byte *Image_LoadPCX (FILE *f, int *width, int *height)
+static byte *Image_DecodePCX (const byte *in, int insize, int *width, int *height, imagealloc_t alloc, const char **error)
 {
 	pcxheader_t	pcx;
-	int			x, y, w, h, readbyte, runlength, start;
+	int			x, y, w, h, readbyte, runlength;
 	byte		*p, *data;
-	byte		palette[768];
-	stdio_buffer_t  *buf;
+	const byte	*palette;
+	imagereader_t	reader, *buf;
 
-	start = ftell (f); //save start of file (since we might be inside a pak file, SEEK_SET might not be the start of the pcx)
+	if (insize < (int) sizeof(pcx) + 768)
+	{
+		*error = "'%s' is not a valid PCX file";
+		return NULL;
+	}
 
-	fread(&pcx, sizeof(pcx), 1, f);
+	memcpy (&pcx, in, sizeof(pcx));
 	pcx.xmin = (unsigned short)LittleShort (pcx.xmin);
 	pcx.ymin = (unsigned short)LittleShort (pcx.ymin);
 	pcx.xmax = (unsigned short)LittleShort (pcx.xmax);
@@ -421,27 +412,41 @@ byte *Image_LoadPCX (FILE *f, int *width, int *height)
 	pcx.bytes_per_line = (unsigned short)LittleShort (pcx.bytes_per_line);
 
 	if (pcx.signature != 0x0A)
-		Sys_Error ("'%s' is not a valid PCX file", loadfilename);
+	{
+		*error = "'%s' is not a valid PCX file";
+		return NULL;
+	}
 
 	if (pcx.version != 5)
-		Sys_Error ("'%s' is version %i, should be 5", loadfilename, pcx.version);
+	{
+		*error = "'%s' is not version 5";
+		return NULL;
+	}
 
 	if (pcx.encoding != 1 || pcx.bits_per_pixel != 8 || pcx.color_planes != 1)
-		Sys_Error ("'%s' has wrong encoding or bit depth", loadfilename);
+	{
+		*error = "'%s' has wrong encoding or bit depth";
+		return NULL;
+	}
 
 	w = pcx.xmax - pcx.xmin + 1;
 	h = pcx.ymax - pcx.ymin + 1;
 
-	data = (byte *) Hunk_Alloc((w*h+1)*4); //+1 to allow reading padding byte on last line
-
-	//load palette
-	fseek (f, start + com_filesize - 768, SEEK_SET);
-	fread (palette, 1, 768, f);
+	data = alloc ((w*h+1)*4); //+1 to allow reading padding byte on last line
+	if (!data)
+	{
+		*error = "not enough memory for '%s'";
+		return NULL;
+	}
 
-	//back to start of image data
-	fseek (f, start + sizeof(pcx), SEEK_SET);
+	//palette is at the end of the file
+	palette = in + insize - 768;
 
-	buf = Buf_Alloc(f);
+	//image data follows the header
+	buf = &reader;
+	buf->data = in + sizeof(pcx);
+	buf->size = insize - sizeof(pcx) - 768;
+	buf->pos = 0;
 
 	for (y=0; y<h; y++)
 	{
@@ -449,12 +454,12 @@ byte *Image_LoadPCX (FILE *f, int *width, int *height)
 
 		for (x=0; x<(pcx.bytes_per_line); ) //read the extra padding byte if necessary
 		{
-			readbyte = Buf_GetC(buf);
+			readbyte = Reader_GetC(buf);
 
 			if(readbyte >= 0xC0)
 			{
 				runlength = readbyte & 0x3F;
-				readbyte = Buf_GetC(buf);
+				readbyte = Reader_GetC(buf);
 			}
 			else
 				runlength = 1;
@@ -471,14 +476,286 @@ byte *Image_LoadPCX (FILE *f, int *width, int *height)
 		}
 	}
 
-	Buf_Free(buf);
-	fclose(f);
-
 	*width = w;
 	*height = h;
 	return data;
 }
 
+/*
+============
+Image_LoadPCX
+============
+*/
+byte *Image_LoadPCX (FILE *f, int *width, int *height)
+{
+	const char	*error;
+	byte		*in, *data;
+	int		size = com_filesize;
+
+	if (!(in = Image_ReadFile (f, size)))
+		Sys_Error ("couldn't read '%s'", loadfilename);
+	data = Image_DecodePCX (in, size, width, height, Image_HunkAlloc, &error);
+	free (in);
+	if (!data)
+		Sys_Error (error, loadfilename);
+
+	return data;
+}
+
+//==============================================================================
+//
+//  PREFETCH
+//
+//==============================================================================
+
+#define	MAX_PREFETCH		1024
+#define	PREFETCH_AHEAD		16	// decoded or decoding, and not asked for yet
+
+typedef struct
+{
+	char		name[MAX_QPATH];	// as passed to Image_LoadImage
+	char		filename[MAX_QPATH];	// with extension, "" if there is no such image
+	qboolean	pcx;
+	qboolean	started;
+	qboolean	used;
+	FILE		*file;
+	int		filesize;
+	byte		*data;			// malloced RGBA
+	int		width, height;
+	const char	*error;
+	task_t		task;
+} prefetch_t;
+
+static prefetch_t	prefetch[MAX_PREFETCH];
+static int		prefetch_count;
+static int		prefetch_next;		// first one not started
+static int		prefetch_inflight;
+
+/*
+============
+Image_OpenImage
+
+Finds name the way Image_LoadImage does, for Image_DecodeFile. Returns NULL
+if there is no such image.
+============
+*/
+FILE *Image_OpenImage (const char *name, qboolean *pcx, int *size)
+{
+	char	filename[MAX_QPATH];
+	FILE	*f;
+
+	*pcx = false;
+	q_snprintf (filename, sizeof(filename), "%s.tga", name);
+	COM_FOpenFile (filename, &f, NULL);
+	if (!f)
+	{
+		*pcx = true;
+		q_snprintf (filename, sizeof(filename), "%s.pcx", name);
+		COM_FOpenFile (filename, &f, NULL);
+	}
+	*size = f ? com_filesize : 0;
+
+	return f;
+}
+
+/*
+============
+Image_DecodeFile
+
+Reads and decodes size bytes of tga or pcx from f, then closes it. Touches
+neither the hunk nor the console, so it can run as a task. Returns malloced
+RGBA, or NULL with error set to a format taking the file name.
+============
+*/
+byte *Image_DecodeFile (FILE *f, int size, qboolean pcx, int *width, int *height, const char **error)
+{
+	byte	*in, *data;
+
+	in = Image_ReadFile (f, size);
+	if (!in)
+	{
+		*error = "couldn't read '%s'";
+		return NULL;
+	}
+
+	if (pcx)
+		data = Image_DecodePCX (in, size, width, height, Image_Malloc, error);
+	else
+		data = Image_DecodeTGA (in, size, width, height, Image_Malloc, error);
+	free (in);
+
+	return data;
+}
+
+static void Image_DecodeTask (void *data)
+{
+	prefetch_t	*p = (prefetch_t *) data;
+
+	p->data = Image_DecodeFile (p->file, p->filesize, p->pcx, &p->width, &p->height, &p->error);
+	p->file = NULL;
+}
+
+/*
+============
+Image_StartPrefetches
+
+Keeps PREFETCH_AHEAD decodes going, so memory use stays bounded however
+many images were queued.  The files are opened here on the main thread.
+============
+*/
+static void Image_StartPrefetches (void)
+{
+	prefetch_t	*p;
+
+	while (prefetch_next < prefetch_count && prefetch_inflight < PREFETCH_AHEAD)
+	{
+		p = &prefetch[prefetch_next++];
+		if (!p->filename[0] || p->used)
+			continue;
+
+		COM_FOpenFile (p->filename, &p->file, NULL);
+		if (!p->file)
+			continue;	// Image_LoadImage will search again
+		p->filesize = com_filesize;
+		p->started = true;
+		prefetch_inflight++;
+		p->task = Task_Run (Image_DecodeTask, p, NULL, 0);
+	}
+}
+
+/*
+============
+Image_Prefetch
+
+Queues name (as it will be passed to Image_LoadImage) to be decoded on a
+worker thread.  Images should be queued in the order they will be loaded.
+Returns whether the image exists, so callers can follow the same fallbacks
+the load will.
+============
+*/
+qboolean Image_Prefetch (const char *name)
+{
+	char		filename[MAX_QPATH];
+	qboolean	pcx;
+	prefetch_t	*p;
+
+	pcx = false;
+	q_snprintf (filename, sizeof(filename), "%s.tga", name);
+	if (!COM_FileExists (filename, NULL))
+	{
+		pcx = true;
+		q_snprintf (filename, sizeof(filename), "%s.pcx", name);
+		if (!COM_FileExists (filename, NULL))
+			filename[0] = 0;
+	}
+
+	if (Tasks_NumWorkers () && prefetch_count < MAX_PREFETCH)
+	{
+		// missing ones are remembered too so the load doesn't search again
+		p = &prefetch[prefetch_count++];
+		memset (p, 0, sizeof(*p));
+		q_strlcpy (p->name, name, sizeof(p->name));
+		q_strlcpy (p->filename, filename, sizeof(p->filename));
+		p->pcx = pcx;
+		Image_StartPrefetches ();
+	}
+
+	return filename[0] != 0;
+}
+
+/*
+============
+Image_FlushPrefetch
+
+Drops whatever was queued and not loaded, once the model is done.
+============
+*/
+void Image_FlushPrefetch (void)
+{
+	prefetch_t	*p;
+	int		i;
+
+	for (i = 0, p = prefetch; i < prefetch_count; i++, p++)
+	{
+		if (p->started && !p->used)
+		{
+			Task_Wait (p->task);
+			free (p->data);
+		}
+	}
+
+	prefetch_count = prefetch_next = prefetch_inflight = 0;
+}
+
+static prefetch_t *Image_FindPrefetch (const char *name)
+{
+	prefetch_t	*p;
+	int		i;
+
+	for (i = 0, p = prefetch; i < prefetch_count; i++, p++)
+	{
+		if (!p->used && !strcmp (p->name, name))
+			return p;
+	}
+
+	return NULL;
+}
+
+/*
+============
+Image_LoadImage
+
+returns a pointer to hunk allocated RGBA data
+
+TODO: search order: tga png jpg pcx lmp
+============
+*/
+byte *Image_LoadImage (const char *name, int *width, int *height)
+{
+	FILE		*f;
+	prefetch_t	*p;
+	byte		*data;
+
+	p = Image_FindPrefetch (name);
+	if (p)
+	{
+		p->used = true;
+		if (!p->filename[0])
+			return NULL;
+		if (p->started)
+		{
+			Task_Wait (p->task);
+			prefetch_inflight--;
+			Image_StartPrefetches ();
+
+			q_strlcpy (loadfilename, p->filename, sizeof(loadfilename));
+			if (!p->data)
+				Sys_Error (p->error, loadfilename);
+
+			data = (byte *) Hunk_Alloc (p->width * p->height * 4);
+			memcpy (data, p->data, p->width * p->height * 4);
+			free (p->data);
+			p->data = NULL;
+			*width = p->width;
+			*height = p->height;
+			return data;
+		}
+		// not started yet, load it the usual way
+	}
+
+	q_snprintf (loadfilename, sizeof(loadfilename), "%s.tga", name);
+	COM_FOpenFile (loadfilename, &f, NULL);
+	if (f)
+		return Image_LoadTGA (f, width, height);
+
+	q_snprintf (loadfilename, sizeof(loadfilename), "%s.pcx", name);
+	COM_FOpenFile (loadfilename, &f, NULL);
+	if (f)
+		return Image_LoadPCX (f, width, height);
+
+	return NULL;
+}
+
 //==============================================================================
 //
 //  STB_IMAGE_WRITE
@@ -586,10 +863,7 @@ qboolean Image_WritePNG (const char *name, byte *data, int width, int height, in
 	}
 
 	error = lodepng_encode (&png, &pngsize, flipped, width, height, &state);
-	if (error == 0) lodepng_save_file (png, pngsize, pathname);
-#ifdef LODEPNG_COMPILE_ERROR_TEXT
-	else Con_Printf("WritePNG: %s\n", lodepng_error_text (error));
-#endif
+	if (error == 0) error = lodepng_save_file (png, pngsize, pathname);
 
 	lodepng_state_cleanup (&state);
 	free (png);
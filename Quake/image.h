@@ -30,9 +30,19 @@ byte *Image_LoadTGA (FILE *f, int *width, int *height);
 byte *Image_LoadPCX (FILE *f, int *width, int *height);
 byte *Image_LoadImage (const char *name, int *width, int *height);
 
+// decode ahead on worker threads, consumed by Image_LoadImage
+qboolean Image_Prefetch (const char *name);
+void Image_FlushPrefetch (void);
+
+// open on the main thread, decode anywhere; the data is malloced
+FILE *Image_OpenImage (const char *name, qboolean *pcx, int *size);
+byte *Image_DecodeFile (FILE *f, int size, qboolean pcx, int *width, int *height, const char **error);
+
+// the write functions don't touch the console or the hunk, so they can run as tasks
 qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown);
 qboolean Image_WritePNG (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown);
 qboolean Image_WriteJPG (const char *name, byte *data, int width, int height, int bpp, int quality, qboolean upsidedown);
 
+
 #endif	/* GL_IMAGE_H */
 
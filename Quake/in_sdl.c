@@ -82,6 +82,27 @@ static int buttonremap[] =
 /* total accumulated mouse movement since last frame */
 static int	total_dx, total_dy = 0;
 
+#if defined(USE_SDL2)
+/* with in_motionaccum, relative motion is summed up straight from the
+ * event filter while SDL pumps events and never reaches the event queue,
+ * so high rate mice don't flood it between frames. the filter may run on
+ * any thread that pushes events, hence the atomics. */
+static cvar_t	in_motionaccum = {"in_motionaccum", "1", CVAR_ARCHIVE};
+static SDL_atomic_t	accum_dx, accum_dy;
+
+static int SDLCALL IN_SDL2_AccumulateMouseEvents (void *userdata, SDL_Event *event)
+{
+	if (event->type == SDL_MOUSEMOTION)
+	{
+		SDL_AtomicAdd (&accum_dx, event->motion.xrel);
+		SDL_AtomicAdd (&accum_dy, event->motion.yrel);
+		return 0;
+	}
+
+	return 1;
+}
+#endif
+
 static int SDLCALL IN_FilterMouseEvents (const SDL_Event *event)
 {
 	switch (event->type)
@@ -120,10 +141,15 @@ static void IN_BeginIgnoringMouseEvents(void)
 static void IN_EndIgnoringMouseEvents(void)
 {
 #if defined(USE_SDL2)
-	SDL_EventFilter currentFilter;
+	SDL_EventFilter currentFilter = NULL;
+	SDL_EventFilter wantFilter;
 	void *currentUserdata;
-	if (SDL_GetEventFilter(&currentFilter, &currentUserdata) == SDL_TRUE)
-		SDL_SetEventFilter(NULL, NULL);
+
+	wantFilter = (in_motionaccum.value) ? IN_SDL2_AccumulateMouseEvents : NULL;
+	if (SDL_GetEventFilter(&currentFilter, &currentUserdata) == SDL_FALSE)
+		currentFilter = NULL;
+	if (currentFilter != wantFilter)
+		SDL_SetEventFilter(wantFilter, NULL);
 #else
 	if (SDL_GetEventFilter() != NULL)
 		SDL_SetEventFilter(NULL);
@@ -236,8 +262,26 @@ void IN_Activate (void)
 
 	total_dx = 0;
 	total_dy = 0;
+#if defined(USE_SDL2)
+	SDL_AtomicSet(&accum_dx, 0);
+	SDL_AtomicSet(&accum_dy, 0);
+#endif
 }
 
+#if defined(USE_SDL2)
+static void IN_MotionAccum_f (cvar_t *var)
+{
+	SDL_EventFilter currentFilter;
+	void *currentUserdata;
+
+	/* while mouse events are ignored, the change is picked up by IN_Activate */
+	if (SDL_GetEventFilter(&currentFilter, &currentUserdata) == SDL_TRUE &&
+	    currentFilter == IN_SDL2_FilterMouseEvents)
+		return;
+	IN_EndIgnoringMouseEvents();
+}
+#endif
+
 void IN_Deactivate (qboolean free_cursor)
 {
 	if (no_mouse)
@@ -365,6 +409,10 @@ void IN_Init (void)
 	Cvar_RegisterVariable(&in_disablemacosxmouseaccel);
 #endif
 	Cvar_RegisterVariable(&in_debugkeys);
+#if defined(USE_SDL2)
+	Cvar_RegisterVariable(&in_motionaccum);
+	Cvar_SetCallback(&in_motionaccum, IN_MotionAccum_f);
+#endif
 	Cvar_RegisterVariable(&joy_sensitivity_yaw);
 	Cvar_RegisterVariable(&joy_sensitivity_pitch);
 	Cvar_RegisterVariable(&joy_deadzone);
@@ -702,6 +750,10 @@ void IN_MouseMove(usercmd_t *cmd)
 {
 	float	dmx, dmy;
 
+#if defined(USE_SDL2)
+	total_dx += SDL_AtomicSet(&accum_dx, 0);
+	total_dy += SDL_AtomicSet(&accum_dy, 0);
+#endif
 	dmx = total_dx * sensitivity.value;
 	dmy = total_dy * sensitivity.value;
 
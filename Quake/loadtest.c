@@ -0,0 +1,682 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// loadtest.c -- synthetic clients for measuring server capacity
+
+// "loadtest <host> <count> [seconds]" opens count datagram connections to
+// a server, takes each of them through the signon and then sends clc_move
+// at loadtest_rate per second, like a player running around.  The server
+// round trip is timed off the reliable acks, every client keeps a clc_nop
+// in flight for that, and the report lists the percentiles along with the
+// sizes of what the server sends back.
+//
+// The clients don't keep any game state.  They only go as far into the
+// server messages as they need to: the protocol from svc_serverinfo, the
+// next svc_signonnum, and for PROTOCOL_DELTA the number of the last entity
+// frame so the server can keep sending deltas.  The signon number is
+// looked for as a byte pair instead of parsing the whole signon, so a
+// signon can come a message early now and then, which the server doesn't
+// mind since it runs the commands in order anyway.
+//
+// "make dedicated" builds it headless, and the dedicated main loop keeps
+// polling the clients between server frames so the timing isn't tied to
+// sys_ticrate.
+
+#include "quakedef.h"
+
+#define	MAX_LOADCLIENTS		256
+#define	MAX_LOADSAMPLES		65536		// power of two, latency ring
+#define	LOADTEST_PING		0.25		// seconds between timed clc_nops
+#define	LOADTEST_SIGNONTIME	30		// seconds before a stuck signon is dropped
+
+typedef struct
+{
+	struct qsocket_s	*netcon;
+	qboolean	spawned;
+	int			signon;			// last svc_signonnum seen
+	double		signontime;		// when that happened
+	int			protocol;
+	unsigned int	protocolflags;
+	int			entframe;		// PROTOCOL_DELTA frame to acknowledge
+	float		servertime;		// last svc_time, echoed in clc_move for the server's ping
+
+	sizebuf_t	message;		// reliable commands waiting to go
+	byte		msgbuf[256];
+	double		reliabletime;	// when the reliable in flight went out, 0 if none
+	qboolean	timed;			// it's a clc_nop that counts for the latency
+	double		nextping;
+	double		nextmove;
+
+	// wandering
+	float		yaw;
+	float		turn;			// degrees per second
+	int			forward, side;
+	double		nextchange;
+} loadclient_t;
+
+typedef struct
+{
+	int		messages;
+	int		bytes;
+	int		maxsize;
+} loadcount_t;
+
+static loadclient_t	*lt_clients;
+static int			lt_numclients;	// connected so far
+static int			lt_target;
+static int			lt_dropped;
+static int			lt_failed;
+static char			lt_host[NET_NAMELEN];
+static double		lt_starttime;
+static double		lt_endtime;		// 0 to run until "loadtest stop"
+static double		lt_nextconnect;
+static double		lt_reporttime;
+
+static float		lt_samples[MAX_LOADSAMPLES];	// round trips in seconds
+static unsigned int	lt_numsamples;
+static unsigned int	lt_reportsample;
+
+// since the last report
+static loadcount_t	lt_reliable, lt_datagram;
+static int			lt_moves;
+static int			lt_spawns;
+static double		lt_spawntotal;
+
+static cvar_t	loadtest_rate = {"loadtest_rate", "72", CVAR_NONE};
+static cvar_t	loadtest_move = {"loadtest_move", "1", CVAR_NONE};	// 0 stand still, 1 run around, 2 also fire
+static cvar_t	loadtest_report = {"loadtest_report", "5", CVAR_NONE};
+
+static int LT_CompareSamples (const void *a, const void *b)
+{
+	float	fa = *(const float *)a, fb = *(const float *)b;
+
+	return (fa > fb) - (fa < fb);
+}
+
+/*
+===================
+LT_Report
+
+Prints what happened since the last report
+===================
+*/
+static void LT_Report (const char *title)
+{
+	double	now, elapsed;
+	float	*sorted;
+	int		i, n, mark, spawned;
+	unsigned int	first;
+
+	now = Sys_DoubleTime ();
+	elapsed = q_max (now - lt_reporttime, 0.001);
+
+	for (i = spawned = 0; i < lt_numclients; i++)
+		if (lt_clients[i].netcon && lt_clients[i].spawned)
+			spawned++;
+
+	Con_Printf ("%s: %.0fs, %i/%i spawned, %i dropped, %i failed\n", title, now - lt_starttime,
+		spawned, lt_target, lt_dropped, lt_failed);
+
+	first = lt_reportsample;
+	if (lt_numsamples - first > MAX_LOADSAMPLES)
+		first = lt_numsamples - MAX_LOADSAMPLES;
+	n = lt_numsamples - first;
+	if (n)
+	{
+		mark = Frame_LowMark ();
+		sorted = (float *) Frame_Alloc (n * sizeof(float));
+		for (i = 0; i < n; i++)
+			sorted[i] = lt_samples[(first + i) & (MAX_LOADSAMPLES - 1)];
+		qsort (sorted, n, sizeof(float), LT_CompareSamples);
+		Con_Printf ("  round trip ms: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f  (%i samples)\n",
+			sorted[n / 2] * 1000, sorted[n * 9 / 10] * 1000, sorted[n * 99 / 100] * 1000, sorted[n - 1] * 1000, n);
+		Frame_FreeToLowMark (mark);
+	}
+
+	if (lt_spawns)
+		Con_Printf ("  signon: %i in %.2fs avg\n", lt_spawns, lt_spawntotal / lt_spawns);
+	if (lt_datagram.messages)
+		Con_Printf ("  datagrams: %.1f/s, %i bytes avg, %i max\n", lt_datagram.messages / elapsed,
+			lt_datagram.bytes / lt_datagram.messages, lt_datagram.maxsize);
+	if (lt_reliable.messages)
+		Con_Printf ("  reliable: %.1f/s, %i bytes avg, %i max\n", lt_reliable.messages / elapsed,
+			lt_reliable.bytes / lt_reliable.messages, lt_reliable.maxsize);
+	if (spawned)
+		Con_Printf ("  per client: %.2f KB/s in, %.1f moves/s out\n",
+			(lt_datagram.bytes + lt_reliable.bytes) / elapsed / 1024 / spawned, lt_moves / elapsed / spawned);
+
+	memset (&lt_reliable, 0, sizeof(lt_reliable));
+	memset (&lt_datagram, 0, sizeof(lt_datagram));
+	lt_moves = lt_spawns = 0;
+	lt_spawntotal = 0;
+	lt_reportsample = lt_numsamples;
+	lt_reporttime = now;
+}
+
+static void LT_Drop (loadclient_t *lc, const char *reason)
+{
+	Con_Printf ("loadtest client %i %s\n", (int)(lc - lt_clients), reason);
+	NET_Close (lc->netcon);
+	lc->netcon = NULL;
+	lc->spawned = false;
+	lt_dropped++;
+}
+
+/*
+===================
+LT_Disconnect
+
+Same as CL_Disconnect, the server is told a few times in case one gets lost
+===================
+*/
+static void LT_Disconnect (loadclient_t *lc)
+{
+	sizebuf_t	buf;
+	byte		data[4];
+	int			i;
+
+	buf.data = data;
+	buf.maxsize = sizeof(data);
+	buf.cursize = 0;
+	MSG_WriteByte (&buf, clc_disconnect);
+	for (i = 0; i < 3; i++)
+		NET_SendUnreliableMessage (lc->netcon, &buf);
+	NET_Close (lc->netcon);
+	lc->netcon = NULL;
+}
+
+static void LT_StringCmd (loadclient_t *lc, const char *cmd)
+{
+	MSG_WriteByte (&lc->message, clc_stringcmd);
+	MSG_WriteString (&lc->message, cmd);
+}
+
+/*
+===================
+LT_SignonReply
+
+Same answers as CL_SignonReply
+===================
+*/
+static void LT_SignonReply (loadclient_t *lc, int signon)
+{
+	double	now;
+
+	now = Sys_DoubleTime ();
+	lc->signon = signon;
+	lc->signontime = now;
+
+	switch (signon)
+	{
+	case 1:
+		LT_StringCmd (lc, "prespawn");
+		break;
+
+	case 2:
+		LT_StringCmd (lc, va("name \"loadtest%i\"\n", (int)(lc - lt_clients)));
+		LT_StringCmd (lc, va("color %i %i\n", rand() & 15, rand() & 15));
+		LT_StringCmd (lc, "spawn ");
+		break;
+
+	case 3:
+		LT_StringCmd (lc, "begin");
+		lc->spawned = true;
+		lc->nextmove = lc->nextping = now;
+		lt_spawns++;
+		lt_spawntotal += now - NET_QSocketGetTime (lc->netcon);
+		break;
+	}
+}
+
+/*
+===================
+LT_ParseReliable
+
+Only looks at the start for a new serverinfo and at the end for the next
+signon
+===================
+*/
+static void LT_ParseReliable (loadclient_t *lc)
+{
+	int		i, cmd;
+
+	MSG_BeginReading ();
+	cmd = MSG_ReadByte ();
+	if (cmd == svc_disconnect)
+	{
+		LT_Drop (lc, "disconnected by the server");
+		return;
+	}
+	if (cmd == svc_print)
+	{
+		MSG_ReadString ();
+		cmd = MSG_ReadByte ();
+	}
+	if (cmd == svc_serverinfo)
+	{
+		// first connect or a level change
+		lc->protocol = MSG_ReadLong ();
+		lc->protocolflags = (lc->protocol == PROTOCOL_RMQ) ? (unsigned int) MSG_ReadLong () : 0;
+		lc->spawned = false;
+		lc->signon = 0;
+		lc->entframe = 0;
+	}
+
+	for (i = net_message.cursize - 2; i >= 0 && lc->signon < SIGNONS - 1; i--)
+	{
+		if (net_message.data[i] == svc_signonnum && net_message.data[i+1] == lc->signon + 1)
+		{
+			LT_SignonReply (lc, lc->signon + 1);
+			break;
+		}
+	}
+}
+
+/*
+===================
+LT_ParseDatagram
+
+Reads up to the entity frame number, in the order SV_BeginClientDatagram
+and SV_WriteClientdataToMessage put things
+===================
+*/
+static void LT_ParseDatagram (loadclient_t *lc)
+{
+	int		i, cmd, bits, skip;
+
+	MSG_BeginReading ();
+	while (!msg_badread)
+	{
+		cmd = MSG_ReadByte ();
+		switch (cmd)
+		{
+		case svc_time:
+			lc->servertime = MSG_ReadFloat ();
+			break;
+
+		case svc_damage:
+			MSG_ReadByte ();
+			MSG_ReadByte ();
+			for (i = 0; i < 3; i++)
+				MSG_ReadCoord (lc->protocolflags);
+			break;
+
+		case svc_setangle:
+			for (i = 0; i < 3; i++)
+				MSG_ReadAngle (lc->protocolflags);
+			break;
+
+		case svc_clientdata:
+			bits = (unsigned short)MSG_ReadShort ();
+			if (bits & SU_EXTEND1)
+				bits |= (MSG_ReadByte() << 16);
+			if (bits & SU_EXTEND2)
+				bits |= (MSG_ReadByte() << 24);
+
+			skip = 4 + 2 + 5 + 1;	// items, health, ammo, weapon
+			for (i = 0; i < 32; i++)
+			{
+				if (!(bits & (1<<i)))
+					continue;
+				if ((1<<i) & (SU_VIEWHEIGHT|SU_IDEALPITCH|SU_PUNCH1|SU_PUNCH2|SU_PUNCH3|SU_VELOCITY1|SU_VELOCITY2|SU_VELOCITY3|
+						SU_WEAPONFRAME|SU_ARMOR|SU_WEAPON|SU_WEAPON2|SU_ARMOR2|SU_AMMO2|SU_SHELLS2|SU_NAILS2|SU_ROCKETS2|
+						SU_CELLS2|SU_WEAPONFRAME2|SU_WEAPONALPHA))
+					skip++;
+			}
+			MSG_ReadData (skip);
+			break;
+
+		case svc_entityframe:
+			i = MSG_ReadLong ();
+			if (!msg_badread)
+				lc->entframe = i;
+			return;
+
+		default:
+			return;		// the entities, nothing more the client needs
+		}
+	}
+}
+
+/*
+===================
+LT_SendMove
+
+Wanders around, turning and strafing at random
+===================
+*/
+static void LT_SendMove (loadclient_t *lc, double now)
+{
+	sizebuf_t	buf;
+	byte		data[128];
+	int			i, bits;
+	vec3_t		angles;
+
+	if (now >= lc->nextchange)
+	{
+		lc->turn = (rand() % 181) - 90;
+		lc->forward = (rand() % 4) ? 200 : -200;
+		lc->side = ((rand() % 3) - 1) * 350;
+		lc->nextchange = now + 0.5 + (rand() % 2500) * 0.001;
+	}
+	lc->yaw = anglemod (lc->yaw + lc->turn / q_max (loadtest_rate.value, 1));
+
+	buf.data = data;
+	buf.maxsize = sizeof(data);
+	buf.cursize = 0;
+
+	MSG_WriteByte (&buf, clc_move);
+	MSG_WriteFloat (&buf, lc->servertime);
+
+	angles[PITCH] = angles[ROLL] = 0;
+	angles[YAW] = lc->yaw;
+	for (i = 0; i < 3; i++)
+		if (lc->protocol == PROTOCOL_NETQUAKE)
+			MSG_WriteAngle (&buf, angles[i], lc->protocolflags);
+		else
+			MSG_WriteAngle16 (&buf, angles[i], lc->protocolflags);
+
+	if (loadtest_move.value > 0)
+	{
+		MSG_WriteShort (&buf, lc->forward);
+		MSG_WriteShort (&buf, lc->side);
+	}
+	else
+	{
+		MSG_WriteShort (&buf, 0);
+		MSG_WriteShort (&buf, 0);
+	}
+	MSG_WriteShort (&buf, 0);
+
+	bits = 0;
+	if (loadtest_move.value > 0 && !(rand() % 64))
+		bits |= 2;	// jump
+	if (loadtest_move.value >= 2 && (rand() & 1))
+		bits |= 1;	// attack
+	MSG_WriteByte (&buf, bits);
+	MSG_WriteByte (&buf, 0);	// impulse
+
+	if (lc->protocol == PROTOCOL_DELTA)
+		MSG_WriteLong (&buf, lc->entframe);
+
+	if (NET_SendUnreliableMessage (lc->netcon, &buf) == -1)
+		LT_Drop (lc, "lost the server connection");
+	else
+		lt_moves++;
+}
+
+static void LT_AddSample (double rtt)
+{
+	lt_samples[lt_numsamples & (MAX_LOADSAMPLES - 1)] = rtt;
+	lt_numsamples++;
+}
+
+static void LT_RunClient (loadclient_t *lc, double now)
+{
+	int		ret;
+
+	while (lc->netcon)
+	{
+		ret = NET_GetMessage (lc->netcon);
+		if (ret == -1)
+		{
+			LT_Drop (lc, "lost the server connection");
+			return;
+		}
+		if (!ret)
+			break;
+
+		if (ret == 1)
+		{
+			lt_reliable.messages++;
+			lt_reliable.bytes += net_message.cursize;
+			lt_reliable.maxsize = q_max (lt_reliable.maxsize, net_message.cursize);
+			LT_ParseReliable (lc);
+		}
+		else
+		{
+			lt_datagram.messages++;
+			lt_datagram.bytes += net_message.cursize;
+			lt_datagram.maxsize = q_max (lt_datagram.maxsize, net_message.cursize);
+			LT_ParseDatagram (lc);
+		}
+	}
+	if (!lc->netcon)
+		return;
+
+	if (!lc->spawned && now - lc->signontime > LOADTEST_SIGNONTIME)
+	{
+		LT_Drop (lc, va("stuck at signon %i", lc->signon));
+		return;
+	}
+
+// the reliable in flight got acked
+	if (lc->reliabletime && NET_CanSendMessage (lc->netcon))
+	{
+		if (lc->timed)
+			LT_AddSample (Sys_DoubleTime () - lc->reliabletime);
+		lc->reliabletime = 0;
+	}
+
+	if (!lc->reliabletime && NET_CanSendMessage (lc->netcon))
+	{
+		// only the pings are timed, the signon commands make the server work
+		lc->timed = false;
+		if (!lc->message.cursize && lc->spawned && now >= lc->nextping)
+		{
+			MSG_WriteByte (&lc->message, clc_nop);
+			lc->timed = true;
+			lc->nextping = now + LOADTEST_PING;
+		}
+
+		if (lc->message.cursize)
+		{
+			if (NET_SendMessage (lc->netcon, &lc->message) == -1)
+			{
+				LT_Drop (lc, "lost the server connection");
+				return;
+			}
+			lc->reliabletime = Sys_DoubleTime ();
+			SZ_Clear (&lc->message);
+		}
+	}
+
+	if (lc->spawned && now >= lc->nextmove)
+	{
+		LT_SendMove (lc, now);
+		lc->nextmove += 1.0 / CLAMP (1, loadtest_rate.value, 1000);
+		if (lc->nextmove < now)
+			lc->nextmove = now;	// fell behind, don't send a burst
+	}
+}
+
+static void LT_Connect (void)
+{
+	loadclient_t	*lc;
+
+	lc = &lt_clients[lt_numclients];
+	memset (lc, 0, sizeof(*lc));
+	lc->netcon = NET_ConnectAddress (lt_host);
+	if (!lc->netcon)
+	{
+		// probably full, stop trying
+		lt_failed += lt_target - lt_numclients;
+		lt_target = lt_numclients;
+		Con_Printf ("loadtest: couldn't connect client %i to %s\n", lt_numclients, lt_host);
+		return;
+	}
+	lc->message.data = lc->msgbuf;
+	lc->message.maxsize = sizeof(lc->msgbuf);
+	lc->signontime = Sys_DoubleTime ();
+	lc->yaw = rand() % 360;
+	lt_numclients++;
+}
+
+/*
+===================
+LoadTest_Stop
+===================
+*/
+static void LoadTest_Stop (void)
+{
+	int		i;
+
+	if (!lt_clients)
+		return;
+
+	LT_Report ("loadtest done");
+	for (i = 0; i < lt_numclients; i++)
+	{
+		if (lt_clients[i].netcon)
+			LT_Disconnect (&lt_clients[i]);
+	}
+	free (lt_clients);
+	lt_clients = NULL;
+	lt_numclients = lt_target = 0;
+}
+
+/*
+===================
+LoadTest_Frame
+
+Called every host frame, and more often on a dedicated server
+===================
+*/
+void LoadTest_Frame (void)
+{
+	double	now;
+	int		i;
+
+	if (!lt_clients)
+		return;
+
+	now = Sys_DoubleTime ();
+
+// one new connection a frame, they're blocking
+	if (lt_numclients < lt_target && now >= lt_nextconnect)
+	{
+		LT_Connect ();
+		lt_nextconnect = Sys_DoubleTime () + 0.05;
+	}
+
+	for (i = 0; i < lt_numclients; i++)
+	{
+		if (lt_clients[i].netcon)
+			LT_RunClient (&lt_clients[i], now);
+	}
+
+	if (loadtest_report.value > 0 && now - lt_reporttime >= loadtest_report.value)
+		LT_Report ("loadtest");
+
+	if (lt_endtime && now >= lt_endtime)
+		LoadTest_Stop ();
+}
+
+qboolean LoadTest_Running (void)
+{
+	return lt_clients != NULL;
+}
+
+/*
+===================
+LoadTest_f
+===================
+*/
+static void LoadTest_f (void)
+{
+	int		count;
+
+	if (Cmd_Argc () == 2 && !q_strcasecmp (Cmd_Argv (1), "stop"))
+	{
+		LoadTest_Stop ();
+		return;
+	}
+
+	if (Cmd_Argc () == 1)
+	{
+		if (lt_clients)
+			LT_Report ("loadtest");
+		else
+			Con_Printf ("usage: loadtest <host> <count> [seconds]\n       loadtest stop\n");
+		return;
+	}
+
+	if (Cmd_Argc () < 3)
+	{
+		Con_Printf ("usage: loadtest <host> <count> [seconds]\n");
+		return;
+	}
+
+	if (!q_strcasecmp (Cmd_Argv (1), "local"))
+	{
+		Con_Printf ("loadtest needs a network address, the loopback only takes one client\n");
+		return;
+	}
+
+	count = Q_atoi (Cmd_Argv (2));
+	if (count < 1 || count > MAX_LOADCLIENTS)
+	{
+		Con_Printf ("loadtest: count must be 1 to %i\n", MAX_LOADCLIENTS);
+		return;
+	}
+
+	LoadTest_Stop ();
+
+	lt_clients = (loadclient_t *) calloc (count, sizeof(loadclient_t));
+	if (!lt_clients)
+		Sys_Error ("LoadTest_f: out of memory");
+	NET_ReserveQSockets (count);
+
+	q_strlcpy (lt_host, Cmd_Argv (1), sizeof(lt_host));
+	lt_target = count;
+	lt_numclients = lt_dropped = lt_failed = 0;
+	lt_starttime = lt_reporttime = lt_nextconnect = Sys_DoubleTime ();
+	lt_endtime = (Cmd_Argc () > 3) ? lt_starttime + Q_atof (Cmd_Argv (3)) : 0;
+	lt_numsamples = lt_reportsample = 0;
+	memset (&lt_reliable, 0, sizeof(lt_reliable));
+	memset (&lt_datagram, 0, sizeof(lt_datagram));
+	lt_moves = lt_spawns = 0;
+	lt_spawntotal = 0;
+
+	Con_Printf ("loadtest: connecting %i clients to %s\n", count, lt_host);
+}
+
+/*
+===================
+LoadTest_Init
+===================
+*/
+void LoadTest_Init (void)
+{
+	Cvar_RegisterVariable (&loadtest_rate);
+	Cvar_RegisterVariable (&loadtest_move);
+	Cvar_RegisterVariable (&loadtest_report);
+	Cmd_AddCommand ("loadtest", LoadTest_f);
+}
+
+/*
+===================
+LoadTest_Shutdown
+===================
+*/
+void LoadTest_Shutdown (void)
+{
+	LoadTest_Stop ();
+}
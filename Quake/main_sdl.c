@@ -54,6 +54,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #endif
 
+#define HIBERNATE_WAKEUP	0.1	/* seconds an idle dedicated server waits at most */
+
 static void Sys_AtExit (void)
 {
 	SDL_Quit();
@@ -88,6 +90,8 @@ static void Sys_InitSDL (void)
 }
 
 #define DEFAULT_MEMORY (256 * 1024 * 1024) // ericw -- was 72MB (64-bit) / 64MB (32-bit)
+// the hunk only commits what it uses, so 64-bit builds can reserve plenty
+#define DEFAULT_RESERVE (sizeof(void *) > 4 ? 1024 * 1024 * 1024 : DEFAULT_MEMORY)
 
 static quakeparms_t	parms;
 
@@ -112,13 +116,17 @@ int main(int argc, char *argv[])
 
 	COM_InitArgv(parms.argc, parms.argv);
 
+#ifdef SERVERONLY
+	isDedicated = true;	// the headless build has no client to run
+#else
 	isDedicated = (COM_CheckParm("-dedicated") != 0);
+#endif
 
 	Sys_InitSDL ();
 
 	Sys_Init();
 
-	parms.memsize = DEFAULT_MEMORY;
+	parms.memsize = DEFAULT_RESERVE;
 	if (COM_CheckParm("-heapsize"))
 	{
 		t = COM_CheckParm("-heapsize") + 1;
@@ -126,7 +134,29 @@ int main(int argc, char *argv[])
 			parms.memsize = Q_atoi(com_argv[t]) * 1024;
 	}
 
-	parms.membase = malloc (parms.memsize);
+	// reserve the address space and let the hunk commit pages as it
+	// grows, falling back to one malloc'ed block
+	parms.memsize = (parms.memsize + 0xfffff) & ~0xfffff;
+	if (COM_CheckParm("-hugepages"))
+	{
+		// a fixed block like the malloc'ed one, committing in chunks
+		// would split the huge pages up again
+		if (parms.memsize > DEFAULT_MEMORY && !COM_CheckParm("-heapsize"))
+			parms.memsize = DEFAULT_MEMORY;
+		parms.membase = Sys_MemAllocHuge (parms.memsize);
+		parms.memhuge = (parms.membase != NULL);
+	}
+	if (!parms.membase)
+	{
+		parms.membase = Sys_MemReserve (parms.memsize);
+		parms.memreserved = (parms.membase != NULL);
+	}
+	if (!parms.membase)
+	{
+		if (parms.memsize > DEFAULT_MEMORY && !COM_CheckParm("-heapsize"))
+			parms.memsize = DEFAULT_MEMORY;
+		parms.membase = malloc (parms.memsize);
+	}
 
 	if (!parms.membase)
 		Sys_Error ("Not enough memory free; check disk space\n");
@@ -145,11 +175,23 @@ int main(int argc, char *argv[])
 	{
 		while (1)
 		{
+			if (Host_Hibernating ())
+			{
+				// nobody to simulate for, sleep until a packet comes in
+				// or it's time to look at the console input again
+				NET_WaitForPackets (HIBERNATE_WAKEUP);
+				newtime = Sys_DoubleTime ();
+				Host_Frame (newtime - oldtime);
+				oldtime = newtime;
+				continue;
+			}
+
 			newtime = Sys_DoubleTime ();
 			time = newtime - oldtime;
 
 			while (time < sys_ticrate.value )
 			{
+				LoadTest_Frame ();	// the loadtest clients are timed finer than the server
 				SDL_Delay(1);
 				newtime = Sys_DoubleTime ();
 				time = newtime - oldtime;
@@ -159,9 +201,12 @@ int main(int argc, char *argv[])
 			oldtime = newtime;
 		}
 	}
+#ifndef SERVERONLY
 	else
 	while (1)
 	{
+		double	delay;
+
 		/* If we have no input focus at all, sleep a bit */
 		if (!VID_HasMouseOrInputFocus() || cl.paused)
 		{
@@ -180,13 +225,23 @@ int main(int argc, char *argv[])
 		newtime = Sys_DoubleTime ();
 		time = newtime - oldtime;
 
+		/* sleep right up to the next frame, so input is read just before it runs */
+		delay = Host_FrameDelay (time);
+		if (delay > 0)
+		{
+			Sys_SleepUntil (newtime + delay);
+			newtime = Sys_DoubleTime ();
+			time = newtime - oldtime;
+		}
+
 		Host_Frame (time);
 
-		if (time < sys_throttle.value && !cls.timedemo)
+		if (time < sys_throttle.value && !cls.timedemo && !host_pacing.value)
 			SDL_Delay(1);
 
 		oldtime = newtime;
 	}
+#endif
 
 	return 0;
 }
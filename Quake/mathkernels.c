@@ -0,0 +1,364 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// mathkernels.c -- CPU feature detection and batched versions of the
+// mathlib functions that get called for many points or boxes at once
+//
+// The SIMD versions give the same results as the plain C ones: the
+// multiplies and adds happen in the same order, one rounding each.
+
+#include "quakedef.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+int	cpu_features;
+
+static void Math_TransformPoints_C (vec3_t *out, const vec3_t *in, int count, const float matrix[3][4]);
+static void Math_CullBoxes_C (float *const bounds[6], int count, const mplane_t *planes, int numplanes, byte *culled);
+
+mathkernels_t	math_kernels = {
+	"C", Math_TransformPoints_C, Math_CullBoxes_C
+};
+
+static cvar_t	math_simd = {"math_simd", "1", CVAR_ARCHIVE};
+
+// the corner of each box furthest along each plane normal, as in R_CullBox
+static void Math_CullBoxCorners (float *const bounds[6], const mplane_t *planes, int numplanes, const float *sel[MAX_CULLPLANES][3])
+{
+	int	j, k;
+
+	for (j = 0; j < numplanes; j++)
+		for (k = 0; k < 3; k++)
+			sel[j][k] = (planes[j].signbits & (1 << k)) ? bounds[k] : bounds[3 + k];
+}
+
+/*
+=============================================================
+
+	PLAIN C
+
+=============================================================
+*/
+
+static void Math_TransformPoints_C (vec3_t *out, const vec3_t *in, int count, const float matrix[3][4])
+{
+	int	i, k;
+
+	for (i = 0; i < count; i++)
+		for (k = 0; k < 3; k++)
+			out[i][k] = matrix[k][0]*in[i][0] + matrix[k][1]*in[i][1] + matrix[k][2]*in[i][2] + matrix[k][3];
+}
+
+static void Math_CullBoxesRange (const float *sel[MAX_CULLPLANES][3], int first, int count,
+				 const mplane_t *planes, int numplanes, byte *culled)
+{
+	int	i, j;
+
+	for (i = first; i < count; i++)
+	{
+		culled[i] = 0;
+		for (j = 0; j < numplanes; j++)
+		{
+			if (planes[j].normal[0]*sel[j][0][i] + planes[j].normal[1]*sel[j][1][i] + planes[j].normal[2]*sel[j][2][i] < planes[j].dist)
+			{
+				culled[i] = 1;
+				break;
+			}
+		}
+	}
+}
+
+static void Math_CullBoxes_C (float *const bounds[6], int count, const mplane_t *planes, int numplanes, byte *culled)
+{
+	const float	*sel[MAX_CULLPLANES][3];
+
+	Math_CullBoxCorners (bounds, planes, numplanes, sel);
+	Math_CullBoxesRange (sel, 0, count, planes, numplanes, culled);
+}
+
+/*
+=============================================================
+
+	SSE2
+
+=============================================================
+*/
+
+#ifdef USE_SSE2
+// a point a time, the rows across the lanes; lane 3 of each store lands
+// on the next point's x, which its own store puts right again, and the
+// last point is stored lane by lane so nothing past out is written
+static void Math_TransformPoints_SSE2 (vec3_t *out, const vec3_t *in, int count, const float matrix[3][4])
+{
+	__m128	c0, c1, c2, c3, p;
+	float	last[4];
+	int		i;
+
+	if (count <= 0)
+		return;
+
+	c0 = _mm_setr_ps (matrix[0][0], matrix[1][0], matrix[2][0], 0);
+	c1 = _mm_setr_ps (matrix[0][1], matrix[1][1], matrix[2][1], 0);
+	c2 = _mm_setr_ps (matrix[0][2], matrix[1][2], matrix[2][2], 0);
+	c3 = _mm_setr_ps (matrix[0][3], matrix[1][3], matrix[2][3], 0);
+
+	for (i = 0; i < count; i++)
+	{
+		p = _mm_mul_ps (c0, _mm_set1_ps (in[i][0]));
+		p = _mm_add_ps (p, _mm_mul_ps (c1, _mm_set1_ps (in[i][1])));
+		p = _mm_add_ps (p, _mm_mul_ps (c2, _mm_set1_ps (in[i][2])));
+		p = _mm_add_ps (p, c3);
+		if (i < count - 1)
+			_mm_storeu_ps (out[i], p);
+		else
+		{
+			_mm_storeu_ps (last, p);
+			out[i][0] = last[0];
+			out[i][1] = last[1];
+			out[i][2] = last[2];
+		}
+	}
+}
+
+static void Math_CullBoxes_SSE2 (float *const bounds[6], int count, const mplane_t *planes, int numplanes, byte *culled)
+{
+	const float	*sel[MAX_CULLPLANES][3];
+	__m128		d, out;
+	int			i, j, bits;
+
+	Math_CullBoxCorners (bounds, planes, numplanes, sel);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		out = _mm_setzero_ps ();
+		for (j = 0; j < numplanes; j++)
+		{
+			d = _mm_mul_ps (_mm_loadu_ps (sel[j][0] + i), _mm_set1_ps (planes[j].normal[0]));
+			d = _mm_add_ps (d, _mm_mul_ps (_mm_loadu_ps (sel[j][1] + i), _mm_set1_ps (planes[j].normal[1])));
+			d = _mm_add_ps (d, _mm_mul_ps (_mm_loadu_ps (sel[j][2] + i), _mm_set1_ps (planes[j].normal[2])));
+			out = _mm_or_ps (out, _mm_cmplt_ps (d, _mm_set1_ps (planes[j].dist)));
+		}
+		bits = _mm_movemask_ps (out);
+		culled[i] = bits & 1;
+		culled[i+1] = (bits >> 1) & 1;
+		culled[i+2] = (bits >> 2) & 1;
+		culled[i+3] = (bits >> 3) & 1;
+	}
+	Math_CullBoxesRange (sel, i, count, planes, numplanes, culled);
+}
+#endif	/* USE_SSE2 */
+
+/*
+=============================================================
+
+	NEON
+
+=============================================================
+*/
+
+#ifdef USE_NEON
+// same layout as the SSE2 version
+static void Math_TransformPoints_NEON (vec3_t *out, const vec3_t *in, int count, const float matrix[3][4])
+{
+	float32x4_t	c0, c1, c2, c3, p;
+	float		col[4][4], last[4];
+	int			i, k;
+
+	if (count <= 0)
+		return;
+
+	for (k = 0; k < 4; k++)
+	{
+		col[k][0] = matrix[0][k];
+		col[k][1] = matrix[1][k];
+		col[k][2] = matrix[2][k];
+		col[k][3] = 0;
+	}
+	c0 = vld1q_f32 (col[0]);
+	c1 = vld1q_f32 (col[1]);
+	c2 = vld1q_f32 (col[2]);
+	c3 = vld1q_f32 (col[3]);
+
+	for (i = 0; i < count; i++)
+	{
+		p = vmulq_n_f32 (c0, in[i][0]);
+		p = vaddq_f32 (p, vmulq_n_f32 (c1, in[i][1]));
+		p = vaddq_f32 (p, vmulq_n_f32 (c2, in[i][2]));
+		p = vaddq_f32 (p, c3);
+		if (i < count - 1)
+			vst1q_f32 (out[i], p);
+		else
+		{
+			vst1q_f32 (last, p);
+			out[i][0] = last[0];
+			out[i][1] = last[1];
+			out[i][2] = last[2];
+		}
+	}
+}
+
+static void Math_CullBoxes_NEON (float *const bounds[6], int count, const mplane_t *planes, int numplanes, byte *culled)
+{
+	const float	*sel[MAX_CULLPLANES][3];
+	float32x4_t	d;
+	uint32x4_t	out;
+	uint32_t	bits[4];
+	int			i, j;
+
+	Math_CullBoxCorners (bounds, planes, numplanes, sel);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		out = vdupq_n_u32 (0);
+		for (j = 0; j < numplanes; j++)
+		{
+			d = vmulq_n_f32 (vld1q_f32 (sel[j][0] + i), planes[j].normal[0]);
+			d = vaddq_f32 (d, vmulq_n_f32 (vld1q_f32 (sel[j][1] + i), planes[j].normal[1]));
+			d = vaddq_f32 (d, vmulq_n_f32 (vld1q_f32 (sel[j][2] + i), planes[j].normal[2]));
+			out = vorrq_u32 (out, vcltq_f32 (d, vdupq_n_f32 (planes[j].dist)));
+		}
+		vst1q_u32 (bits, out);
+		culled[i] = bits[0] != 0;
+		culled[i+1] = bits[1] != 0;
+		culled[i+2] = bits[2] != 0;
+		culled[i+3] = bits[3] != 0;
+	}
+	Math_CullBoxesRange (sel, i, count, planes, numplanes, culled);
+}
+#endif	/* USE_NEON */
+
+//==============================================================================
+
+/*
+=============
+Math_DetectCPU
+=============
+*/
+static void Math_DetectCPU (void)
+{
+	cpu_features = 0;
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	if (SDL_HasSSE2 ())
+		cpu_features |= CPU_SSE2;
+#if defined(USE_SDL2)
+	if (SDL_HasSSE41 ())
+		cpu_features |= CPU_SSE41;
+	if (SDL_HasAVX ())
+		cpu_features |= CPU_AVX;
+#if SDL_VERSION_ATLEAST(2,0,4)
+	if (SDL_HasAVX2 ())
+		cpu_features |= CPU_AVX2;
+#endif
+#endif
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+	cpu_features |= CPU_NEON;	// always there
+#elif defined(USE_SDL2) && (defined(__arm__) || defined(_M_ARM))
+	if (SDL_HasNEON ())
+		cpu_features |= CPU_NEON;
+#endif
+}
+
+/*
+=============
+Math_PickKernels
+
+Picks the fastest kernels the CPU supports, unless math_simd is 0. Only
+what the compiler targets for the whole build can be picked, the wider
+instruction sets are reported by cpuinfo but have no kernels of their own.
+=============
+*/
+static void Math_PickKernels (void)
+{
+	math_kernels.name = "C";
+	math_kernels.transformpoints = Math_TransformPoints_C;
+	math_kernels.cullboxes = Math_CullBoxes_C;
+
+	if (!math_simd.value)
+		return;
+
+#ifdef USE_SSE2
+	if (cpu_features & CPU_SSE2)
+	{
+		math_kernels.name = "SSE2";
+		math_kernels.transformpoints = Math_TransformPoints_SSE2;
+		math_kernels.cullboxes = Math_CullBoxes_SSE2;
+	}
+#endif
+#ifdef USE_NEON
+	if (cpu_features & CPU_NEON)
+	{
+		math_kernels.name = "NEON";
+		math_kernels.transformpoints = Math_TransformPoints_NEON;
+		math_kernels.cullboxes = Math_CullBoxes_NEON;
+	}
+#endif
+}
+
+static void Math_SIMD_f (cvar_t *var)
+{
+	Math_PickKernels ();
+}
+
+/*
+=============
+Math_CPUInfo_f
+
+cpuinfo -- what the CPU has and which kernels each subsystem picked
+=============
+*/
+static void Math_CPUInfo_f (void)
+{
+#if defined(USE_SDL2)
+	Con_Printf ("cores:      %i, %i task workers\n", SDL_GetCPUCount (), Tasks_NumWorkers ());
+#else
+	Con_Printf ("task workers: %i\n", Tasks_NumWorkers ());
+#endif
+	Con_Printf ("features:  %s%s%s%s%s%s\n",
+			(cpu_features & CPU_SSE2) ? " SSE2" : "",
+			(cpu_features & CPU_SSE41) ? " SSE4.1" : "",
+			(cpu_features & CPU_AVX) ? " AVX" : "",
+			(cpu_features & CPU_AVX2) ? " AVX2" : "",
+			(cpu_features & CPU_NEON) ? " NEON" : "",
+			cpu_features ? "" : " none");
+	Con_Printf ("math:       %s\n", math_kernels.name);
+	Con_Printf ("lightmaps:  %s\n", R_LightmapKernelsName ());
+	Con_Printf ("mixer:      %s\n", SND_MixKernelsName ());
+}
+
+void Math_Init (void)
+{
+	Cvar_RegisterVariable (&math_simd);
+	Cvar_SetCallback (&math_simd, Math_SIMD_f);
+	Cmd_AddCommand ("cpuinfo", Math_CPUInfo_f);
+
+	Math_DetectCPU ();
+	Math_PickKernels ();
+	Con_Printf ("Math kernels: %s\n", math_kernels.name);
+}
@@ -119,5 +119,31 @@ float	anglemod(float a);
 	:										\
 		BoxOnPlaneSide( (emins), (emaxs), (p)))
 
+// mathkernels.c -- batched versions, picked for the CPU at startup
+#define	CPU_SSE2	1
+#define	CPU_SSE41	2
+#define	CPU_AVX		4
+#define	CPU_AVX2	8
+#define	CPU_NEON	16
+
+extern int cpu_features;	// CPU_* bits
+
+#define	MAX_CULLPLANES	6
+
+typedef struct
+{
+	const char	*name;
+	// out[i] = matrix * in[i] + the last column; out must not overlap in
+	void	(*transformpoints) (vec3_t *out, const vec3_t *in, int count, const float matrix[3][4]);
+	// culled[i] = 1 for each box behind any of the numplanes (at most
+	// MAX_CULLPLANES) planes, with the bounds as separate mins x, y, z and
+	// maxs x, y, z arrays
+	void	(*cullboxes) (float *const bounds[6], int count, const struct mplane_s *planes, int numplanes, byte *culled);
+} mathkernels_t;
+
+extern mathkernels_t math_kernels;
+
+void Math_Init (void);
+
 #endif	/* __MATHLIB_H */
 
@@ -423,36 +423,155 @@ int		load_cursor;		// 0 < load_cursor < MAX_SAVEGAMES
 char	m_filenames[MAX_SAVEGAMES][SAVEGAME_COMMENT_LENGTH+1];
 int		loadable[MAX_SAVEGAMES];
 
-void M_ScanSaves (void)
+/*
+The slots are kept between visits to the menu with the modification time
+of the file they were read from.  Opening the menu restats the files on a
+worker thread and only reads the ones that changed, meanwhile the menu
+shows what it had; a save from this session is noted straight away.
+*/
+#define	SAVETIME_UNKNOWN	-2	// stat the file again and read it if it's there
+
+typedef struct
+{
+	double		mtime;		// -1 if there was no file
+	char		comment[SAVEGAME_COMMENT_LENGTH+1];
+} savemeta_t;
+
+static savemeta_t	savemeta[MAX_SAVEGAMES];	// for savemeta_dir
+static char		savemeta_dir[MAX_OSPATH];
+static savemeta_t	savescan[MAX_SAVEGAMES];	// M_ScanSavesTask works on this copy
+static char		savescan_dir[MAX_OSPATH];
+static task_t		savescan_task;
+static qboolean		savescan_pending;
+
+static void M_SaveComment (savemeta_t *meta, const char *comment)
+{
+	int	j;
+
+	q_strlcpy (meta->comment, comment, sizeof(meta->comment));
+
+	// change _ back to space
+	for (j = 0; meta->comment[j]; j++)
+	{
+		if (meta->comment[j] == '_')
+			meta->comment[j] = ' ';
+	}
+}
+
+static void M_ScanSavesTask (void *unused)
 {
-	int	i, j;
+	int	i;
 	char	name[MAX_OSPATH];
 	FILE	*f;
 	int	version;
+	double	mtime;
 
 	for (i = 0; i < MAX_SAVEGAMES; i++)
 	{
-		strcpy (m_filenames[i], "--- UNUSED SLOT ---");
-		loadable[i] = false;
-		q_snprintf (name, sizeof(name), "%s/s%i.sav", com_gamedir, i);
+		q_snprintf (name, sizeof(name), "%s/s%i.sav", savescan_dir, i);
+		mtime = Sys_FileModTime (name);
+		if (mtime == savescan[i].mtime)
+			continue;
+		savescan[i].mtime = -1;
 		f = fopen (name, "r");
 		if (!f)
 			continue;
-		fscanf (f, "%i\n", &version);
-		fscanf (f, "%79s\n", name);
-		q_strlcpy (m_filenames[i], name, SAVEGAME_COMMENT_LENGTH+1);
-
-	// change _ back to space
-		for (j = 0; j < SAVEGAME_COMMENT_LENGTH; j++)
+		if (fscanf (f, "%i\n", &version) == 1 && fscanf (f, "%79s\n", name) == 1)
 		{
-			if (m_filenames[i][j] == '_')
-				m_filenames[i][j] = ' ';
+			savescan[i].mtime = mtime;
+			M_SaveComment (&savescan[i], name);
 		}
-		loadable[i] = true;
 		fclose (f);
 	}
 }
 
+/*
+================
+M_FinishScanSaves
+
+Takes the results of the last M_ScanSaves once they're in, or waits for them
+================
+*/
+static void M_FinishScanSaves (qboolean wait)
+{
+	int	i;
+
+	if (!savescan_pending)
+		return;
+	if (!wait && !Task_Done (savescan_task))
+		return;
+
+	Task_Wait (savescan_task);
+	savescan_pending = false;
+	if (strcmp (savescan_dir, com_gamedir))
+		return; // the game changed meanwhile
+
+	memcpy (savemeta, savescan, sizeof(savemeta));
+	q_strlcpy (savemeta_dir, savescan_dir, sizeof(savemeta_dir));
+	for (i = 0; i < MAX_SAVEGAMES; i++)
+	{
+		loadable[i] = savemeta[i].mtime != -1;
+		if (loadable[i])
+			q_strlcpy (m_filenames[i], savemeta[i].comment, sizeof(m_filenames[i]));
+		else
+			strcpy (m_filenames[i], "--- UNUSED SLOT ---");
+	}
+}
+
+void M_ScanSaves (void)
+{
+	int	i;
+	qboolean	first;
+
+	Host_FinishSavegame (true);
+	if (savescan_pending)
+		return;
+
+	first = strcmp (savemeta_dir, com_gamedir) != 0;
+	if (first)
+	{
+		for (i = 0; i < MAX_SAVEGAMES; i++)
+			savemeta[i].mtime = SAVETIME_UNKNOWN;
+	}
+
+	memcpy (savescan, savemeta, sizeof(savescan));
+	q_strlcpy (savescan_dir, com_gamedir, sizeof(savescan_dir));
+	savescan_task = Task_Run (M_ScanSavesTask, NULL, NULL, 0);
+	savescan_pending = true;
+
+	// nothing to show for a new game dir yet
+	M_FinishScanSaves (first);
+}
+
+/*
+================
+M_NoteSavegame
+
+Called by Host_Savegame_f: the menu slot of a save is up to date without
+reading it back, and it is only restatted the next time
+================
+*/
+void M_NoteSavegame (const char *path, const char *comment)
+{
+	int	i;
+	char	name[MAX_OSPATH];
+
+	M_FinishScanSaves (true);
+	if (strcmp (savemeta_dir, com_gamedir))
+		return; // scanned in full the next time anyway
+
+	for (i = 0; i < MAX_SAVEGAMES; i++)
+	{
+		q_snprintf (name, sizeof(name), "%s/s%i.sav", com_gamedir, i);
+		if (strcmp (name, path))
+			continue;
+		savemeta[i].mtime = SAVETIME_UNKNOWN;
+		M_SaveComment (&savemeta[i], comment);
+		q_strlcpy (m_filenames[i], savemeta[i].comment, sizeof(m_filenames[i]));
+		loadable[i] = true;
+	}
+}
+
 void M_Menu_Load_f (void)
 {
 	m_entersound = true;
@@ -486,6 +605,8 @@ void M_Load_Draw (void)
 	int		i;
 	qpic_t	*p;
 
+	M_FinishScanSaves (false);
+
 	p = Draw_CachePic ("gfx/p_load.lmp");
 	M_DrawPic ( (320-p->width)/2, 4, p);
 
@@ -502,6 +623,8 @@ void M_Save_Draw (void)
 	int		i;
 	qpic_t	*p;
 
+	M_FinishScanSaves (false);
+
 	p = Draw_CachePic ("gfx/p_save.lmp");
 	M_DrawPic ( (320-p->width)/2, 4, p);
 
@@ -60,6 +60,7 @@ void M_ToggleMenu_f (void);
 void M_Menu_Main_f (void);
 void M_Menu_Options_f (void);
 void M_Menu_Quit_f (void);
+void M_NoteSavegame (const char *path, const char *comment);
 
 void M_Print (int cx, int cy, const char *str);
 void M_PrintWhite (int cx, int cy, const char *str);
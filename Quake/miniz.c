@@ -2011,12 +2011,12 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc(mz_zip_archive *pZip, mz_uint file
 {
     return mz_zip_reader_extract_to_mem_no_alloc1(pZip, file_index, pBuf, buf_size, flags, pUser_read_buf, user_read_buf_size, NULL);
 }
+#endif
 
 mz_bool mz_zip_reader_extract_to_mem(mz_zip_archive *pZip, mz_uint file_index, void *pBuf, size_t buf_size, mz_uint flags)
 {
     return mz_zip_reader_extract_to_mem_no_alloc1(pZip, file_index, pBuf, buf_size, flags, NULL, 0, NULL);
 }
-#endif
 
 void *mz_zip_reader_extract_to_heap(mz_zip_archive *pZip, mz_uint file_index, size_t *pSize, mz_uint flags)
 {
@@ -2068,6 +2068,11 @@ void *mz_zip_reader_extract_file_to_heap(mz_zip_archive *pZip, const char *pFile
 
 /* ------------------- Misc utils */
 
+mz_uint mz_zip_reader_get_num_files(mz_zip_archive *pZip)
+{
+    return pZip ? pZip->m_total_files : 0;
+}
+
 #if 0 /* unused for now */
 mz_zip_mode mz_zip_get_mode(mz_zip_archive *pZip)
 {
@@ -2210,11 +2215,6 @@ size_t mz_zip_get_central_dir_size(mz_zip_archive *pZip)
     return pZip->m_pState->m_central_dir.m_size;
 }
 
-mz_uint mz_zip_reader_get_num_files(mz_zip_archive *pZip)
-{
-    return pZip ? pZip->m_total_files : 0;
-}
-
 mz_uint64 mz_zip_get_archive_size(mz_zip_archive *pZip)
 {
     if (!pZip)
@@ -55,8 +55,14 @@ struct qsocket_s	*NET_CheckNewConnections (void);
 struct qsocket_s	*NET_Connect (const char *host);
 // called by client to connect to a host.  Returns -1 if not able to
 
+struct qsocket_s	*NET_ConnectAddress (const char *host);
+void	NET_ReserveQSockets (int count);
+// for the loadtest clients
+
 double NET_QSocketGetTime (const struct qsocket_s *sock);
 const char *NET_QSocketGetAddressString (const struct qsocket_s *sock);
+double NET_Latency (const struct qsocket_s *sock);
+// smoothed round trip of the reliable messages, 0 until one was measured
 
 qboolean NET_CanSendMessage (struct qsocket_s *sock);
 // Returns true or false if the given qsocket can currently accept a
@@ -90,6 +96,8 @@ void	NET_Close (struct qsocket_s *sock);
 
 void	NET_Poll (void);
 
+qboolean NET_WaitForPackets (double timeout);
+
 
 // Server list related globals:
 extern	qboolean	slistInProgress;
@@ -104,6 +112,13 @@ const char *NET_SlistPrintServer (int n);
 const char *NET_SlistPrintServerName (int n);
 
 
+// loadtest.c -- synthetic clients for measuring server capacity
+void	LoadTest_Init (void);
+void	LoadTest_Frame (void);
+qboolean LoadTest_Running (void);
+void	LoadTest_Shutdown (void);
+
+
 /* FIXME: driver related, but public:
  */
 extern	qboolean	ipxAvailable;
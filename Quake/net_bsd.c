@@ -79,6 +79,7 @@ net_landriver_t	net_landrivers[] =
 		UDP_CloseSocket,
 		UDP_Connect,
 		UDP_CheckNewConnections,
+		UDP_WaitForPackets,
 		UDP_Read,
 		UDP_Write,
 		UDP_Broadcast,
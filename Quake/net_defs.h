@@ -53,6 +53,17 @@ struct qsockaddr
 
 #define NET_PROTOCOL_VERSION	3
 
+// windowed reliable mode, negotiated in CCREQ_CONNECT / CCREP_ACCEPT
+#define NET_EXT_WINDOW		0x57
+#define NET_MAXWINDOW		32		// fragments in flight, power of two
+#define NET_WINDOWFRAG		1200		// payload per fragment, below common MTUs
+#define NET_MAXWINDOWFRAGS	((NET_MAXRELIABLE + NET_WINDOWFRAG - 1) / NET_WINDOWFRAG)
+
+// reliable message compression, negotiated the same way
+#define NET_EXT_COMPRESS	0x5a
+#define NET_COMPRESS_HISTORY	16384		// bytes of earlier messages matches may refer to
+#define NET_MAXRELIABLE		(NET_MAXMESSAGE + 1)	// room for the compression tag
+
 /**
 
 This is the network info/connection protocol.  It is used to find Quake
@@ -67,6 +78,9 @@ General notes:
 CCREQ_CONNECT
 		string	game_name		"QUAKE"
 		byte	net_protocol_version	NET_PROTOCOL_VERSION
+		byte	NET_EXT_WINDOW		optional
+		byte	window			optional, fragments in flight
+		byte	NET_EXT_COMPRESS	optional
 
 CCREQ_SERVER_INFO
 		string	game_name		"QUAKE"
@@ -80,6 +94,9 @@ CCREQ_RULE_INFO
 
 CCREP_ACCEPT
 		long	port
+		byte	NET_EXT_WINDOW		optional, only if requested
+		byte	window			optional, agreed fragments in flight
+		byte	NET_EXT_COMPRESS	optional, only if requested
 
 CCREP_REJECT
 		string	reason
@@ -147,16 +164,43 @@ typedef struct qsocket_s
 	unsigned int	sendSequence;
 	unsigned int	unreliableSendSequence;
 	int		sendMessageLength;
-	byte		sendMessage [NET_MAXMESSAGE];
+	byte		sendMessage [NET_MAXRELIABLE];
 
 	unsigned int	receiveSequence;
 	unsigned int	unreliableReceiveSequence;
 	int		receiveMessageLength;
-	byte		receiveMessage [NET_MAXMESSAGE];
+	byte		receiveMessage [NET_MAXRELIABLE];
 
 	struct qsockaddr	addr;
 	char		address[NET_NAMELEN];
 
+	// round trip of single packet reliable messages that weren't resent
+	double		reliableSendTime;	// 0 if the one in flight can't be timed
+	double		latency;		// smoothed, 0 until measured
+
+	// windowed reliable mode, window == 0 is vanilla stop-and-wait
+	int		window;
+	unsigned int	windowBase;		// sequence of the first fragment of sendMessage
+	int		windowFrags;		// fragments in sendMessage
+	int		windowFirst;		// first fragment not acked yet
+	int		windowNext;		// first fragment not sent yet
+	int		windowFast;		// fragment fast retransmitted, -1 if none
+	byte		windowAcked[NET_MAXWINDOWFRAGS];
+	short		recvWindowLength[NET_MAXWINDOW];	// -1 if the slot is empty
+	byte		recvWindowEOM[NET_MAXWINDOW];
+	byte		recvWindow[NET_MAXWINDOW][NET_WINDOWFRAG];
+
+	// reliable message compression, every message gets a tag byte
+	qboolean	compress;
+	int		sendHistoryLength;
+	byte		sendHistory[NET_COMPRESS_HISTORY];
+	int		receiveHistoryLength;
+	byte		receiveHistory[NET_COMPRESS_HISTORY];
+	unsigned int	compressIn;		// reliable bytes before and after compression
+	unsigned int	compressOut;
+
+	struct qsocket_s	*hashnext;	// net_dgrm.c table of accepted connections by address
+	qboolean	hashed;
 } qsocket_t;
 
 extern qsocket_t	*net_activeSockets;
@@ -175,6 +219,7 @@ typedef struct
 	int		(*Close_Socket) (sys_socket_t socketid);
 	int		(*Connect) (sys_socket_t socketid, struct qsockaddr *addr);
 	sys_socket_t	(*CheckNewConnections) (void);
+	qboolean	(*WaitForPackets) (double timeout);
 	int		(*Read) (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 	int		(*Write) (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 	int		(*Broadcast) (sys_socket_t socketid, byte *buf, int len);
@@ -227,6 +272,17 @@ qsocket_t *NET_NewQSocket (void);
 void NET_FreeQSocket(qsocket_t *);
 double SetNetTime(void);
 
+typedef void (*fakedeliver_t) (qsocket_t *sock, int type, const byte *data, int length, struct qsockaddr *addr);
+
+extern int		fakePacketsDelayed;
+extern int		fakePacketsDropped;
+extern int		fakePacketsQueued;
+extern int		fakePacketsQueuedMax;
+
+qboolean NET_FakeSend (qsocket_t *sock, fakedeliver_t deliver, int type, const byte *data, int length, struct qsockaddr *addr, qboolean canlose);
+void NET_FakeFlush (void);
+void NET_FakePurge (qsocket_t *sock);
+
 
 #define HOSTCACHESIZE	8
 
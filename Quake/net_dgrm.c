@@ -52,6 +52,30 @@ static struct
 
 static int myDriverLevel;
 
+static cvar_t	net_window = {"net_window", "16", CVAR_ARCHIVE};	// reliable fragments in flight, 0 for stop-and-wait
+static cvar_t	net_compress = {"net_compress", "128", CVAR_ARCHIVE};	// smallest reliable message worth packing, 0 to disable
+
+// accepted connections by remote host, port left out like the AddrCompare >= 0
+// test in _Datagram_CheckNewConnections
+#define	ADDRHASH_SIZE		256		// power of two
+static qsocket_t	*addrhash[ADDRHASH_SIZE];
+
+// CCREQ_SERVER_INFO replies are rebuilt at most this often, and no more than
+// INFO_REPLIES_PER_SEC are sent, so browser and master pings stay cheap
+#define	INFO_CACHE_TIME			1.0
+#define	INFO_REPLIES_PER_SEC	64
+#define	MAX_CONTROL_PACKETS		32		// per landriver and frame
+
+static struct
+{
+	double	time;
+	int		length;
+	byte	data[256];
+} infocache[MAX_NET_DRIVERS];
+
+static double	infotokens;
+static double	infotokentime;
+
 extern qboolean m_return_onerror;
 extern char m_return_reason[32];
 
@@ -68,6 +92,62 @@ static char *StrAddr (struct qsockaddr *addr)
 }
 
 
+static unsigned int AddrHash (struct qsockaddr *addr)
+{
+	const byte	*p;
+
+	if (addr->qsa_family != AF_INET)
+		return 0;	// AddrCompare still sorts them out
+	p = (const byte *)&((struct sockaddr_in *)addr)->sin_addr;
+	return (((unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) * 2654435761u) >> 24 & (ADDRHASH_SIZE - 1);
+}
+
+static void AddrHash_Insert (qsocket_t *sock)
+{
+	qsocket_t	**bucket = &addrhash[AddrHash (&sock->addr)];
+
+	sock->hashnext = *bucket;
+	*bucket = sock;
+	sock->hashed = true;
+}
+
+static void AddrHash_Remove (qsocket_t *sock)
+{
+	qsocket_t	**link;
+
+	if (!sock->hashed)
+		return;
+	for (link = &addrhash[AddrHash (&sock->addr)]; *link; link = &(*link)->hashnext)
+	{
+		if (*link == sock)
+		{
+			*link = sock->hashnext;
+			break;
+		}
+	}
+	sock->hashed = false;
+}
+
+/*
+============
+InfoReplyAllowed
+
+token bucket shared by all requesters, spoofed sources would get around a per-address limit
+============
+*/
+static qboolean InfoReplyAllowed (void)
+{
+	infotokens += (net_time - infotokentime) * INFO_REPLIES_PER_SEC;
+	infotokentime = net_time;
+	if (infotokens > INFO_REPLIES_PER_SEC)
+		infotokens = INFO_REPLIES_PER_SEC;
+	if (infotokens < 1)
+		return false;
+	infotokens -= 1;
+	return true;
+}
+
+
 #ifdef BAN_TEST
 
 static struct in_addr	banAddr;
@@ -128,6 +208,496 @@ static void NET_Ban_f (void)
 }
 #endif	// BAN_TEST
 
+/*
+=============================================================================
+
+RELIABLE MESSAGE COMPRESSION
+
+Negotiated at connect time when both ends set net_compress.  Every
+reliable message then starts with a tag byte: COMP_RAW for a message sent
+as is, COMP_LZ for one packed with a small LZ77 coder.  Matches may refer
+back into the last NET_COMPRESS_HISTORY bytes of earlier messages on the
+same connection, which both ends track in sendHistory / receiveHistory, so
+repeated precache names, baselines and stat updates are cheap.  Only
+messages of at least net_compress bytes are worth packing.
+
+A literal run is a byte 0..127 holding the run length - 1, followed by the
+bytes; a match is 0x80 | (length - COMP_MINMATCH), followed by the
+distance back as a little endian short.
+
+=============================================================================
+*/
+
+#define	COMP_RAW		0
+#define	COMP_LZ			1
+
+#define	COMP_MINMATCH	4
+#define	COMP_MAXMATCH	(COMP_MINMATCH + 127)
+#define	COMP_MAXLITERAL	128
+#define	COMP_MAXOFFSET	65535
+#define	COMP_HASHBITS	13
+
+static byte	comp_buf[NET_COMPRESS_HISTORY + NET_MAXMESSAGE];	// history followed by the message
+static int	comp_hash[1 << COMP_HASHBITS];
+
+static unsigned int compressIn;
+static unsigned int compressOut;
+
+static unsigned int Comp_Hash (const byte *p)
+{
+	unsigned int	v;
+
+	v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+	return (v * 2654435761u) >> (32 - COMP_HASHBITS);
+}
+
+static void Comp_AddHistory (byte *history, int *historylength, const byte *data, int length)
+{
+	int	keep;
+
+	if (length >= NET_COMPRESS_HISTORY)
+	{
+		memcpy (history, data + length - NET_COMPRESS_HISTORY, NET_COMPRESS_HISTORY);
+		*historylength = NET_COMPRESS_HISTORY;
+		return;
+	}
+
+	keep = q_min(*historylength, NET_COMPRESS_HISTORY - length);
+	memmove (history, history + *historylength - keep, keep);
+	memcpy (history + keep, data, length);
+	*historylength = keep + length;
+}
+
+/*
+==================
+Comp_Pack
+
+Packs comp_buf[start..end) into out, returns -1 if it doesn't get below maxout.
+==================
+*/
+static int Comp_Pack (int start, int end, byte *out, int maxout)
+{
+	int	i, ref, len, maxlen, lit, n, op;
+	unsigned int	h;
+
+	memset (comp_hash, 0xff, sizeof(comp_hash));
+	for (i = q_max(0, start - COMP_MAXOFFSET); i + COMP_MINMATCH <= start; i++)
+		comp_hash[Comp_Hash (comp_buf + i)] = i;
+
+	op = 0;
+	lit = i = start;
+	while (i + COMP_MINMATCH <= end)
+	{
+		h = Comp_Hash (comp_buf + i);
+		ref = comp_hash[h];
+		comp_hash[h] = i;
+		if (ref < 0 || i - ref > COMP_MAXOFFSET || memcmp (comp_buf + ref, comp_buf + i, COMP_MINMATCH))
+		{
+			i++;
+			continue;
+		}
+
+		maxlen = q_min(end - i, COMP_MAXMATCH);
+		for (len = COMP_MINMATCH; len < maxlen && comp_buf[ref + len] == comp_buf[i + len]; len++)
+			;
+
+		for ( ; lit < i; lit += n)
+		{
+			n = q_min(i - lit, COMP_MAXLITERAL);
+			if (op + 1 + n >= maxout)
+				return -1;
+			out[op++] = n - 1;
+			memcpy (out + op, comp_buf + lit, n);
+			op += n;
+		}
+		if (op + 3 >= maxout)
+			return -1;
+		out[op++] = 0x80 | (len - COMP_MINMATCH);
+		out[op++] = (i - ref) & 0xff;
+		out[op++] = (i - ref) >> 8;
+
+		for (n = i + 1, i += len; n < i && n + COMP_MINMATCH <= end; n++)
+			comp_hash[Comp_Hash (comp_buf + n)] = n;
+		lit = i;
+	}
+
+	for ( ; lit < end; lit += n)
+	{
+		n = q_min(end - lit, COMP_MAXLITERAL);
+		if (op + 1 + n >= maxout)
+			return -1;
+		out[op++] = n - 1;
+		memcpy (out + op, comp_buf + lit, n);
+		op += n;
+	}
+
+	return op;
+}
+
+/*
+==================
+Comp_Encode
+
+Fills sock->sendMessage with the tagged, possibly packed message.
+==================
+*/
+static void Comp_Encode (qsocket_t *sock, const byte *data, int length)
+{
+	int	start, packed;
+
+	packed = -1;
+	if (net_compress.value > 0 && length >= (int)net_compress.value)
+	{
+		start = sock->sendHistoryLength;
+		memcpy (comp_buf, sock->sendHistory, start);
+		memcpy (comp_buf + start, data, length);
+		packed = Comp_Pack (start, start + length, sock->sendMessage + 1, length);
+	}
+
+	if (packed < 0)
+	{
+		sock->sendMessage[0] = COMP_RAW;
+		Q_memcpy (sock->sendMessage + 1, data, length);
+		sock->sendMessageLength = length + 1;
+	}
+	else
+	{
+		sock->sendMessage[0] = COMP_LZ;
+		sock->sendMessageLength = packed + 1;
+	}
+	Comp_AddHistory (sock->sendHistory, &sock->sendHistoryLength, data, length);
+
+	sock->compressIn += length;
+	sock->compressOut += sock->sendMessageLength;
+	compressIn += length;
+	compressOut += sock->sendMessageLength;
+}
+
+/*
+==================
+Comp_Decode
+
+Unpacks a tagged message into net_message, false if it is corrupt.
+==================
+*/
+static qboolean Comp_Decode (qsocket_t *sock, const byte *data, int length)
+{
+	int	start, end, ip, op, n, ref;
+
+	if (length < 1)
+		return false;
+
+	if (data[0] == COMP_RAW)
+	{
+		if (length - 1 > NET_MAXMESSAGE)
+			return false;
+		SZ_Write (&net_message, data + 1, length - 1);
+		Comp_AddHistory (sock->receiveHistory, &sock->receiveHistoryLength, data + 1, length - 1);
+		return true;
+	}
+	if (data[0] != COMP_LZ)
+		return false;
+
+	start = sock->receiveHistoryLength;
+	end = start + NET_MAXMESSAGE;
+	memcpy (comp_buf, sock->receiveHistory, start);
+
+	for (ip = 1, op = start; ip < length; )
+	{
+		if (data[ip] & 0x80)
+		{
+			if (ip + 3 > length)
+				return false;
+			n = (data[ip] & 0x7f) + COMP_MINMATCH;
+			ref = op - (data[ip + 1] | (data[ip + 2] << 8));
+			ip += 3;
+			if (ref < 0 || ref == op || op + n > end)
+				return false;
+			for ( ; n > 0; n--)	// may overlap itself
+				comp_buf[op++] = comp_buf[ref++];
+		}
+		else
+		{
+			n = data[ip] + 1;
+			ip++;
+			if (ip + n > length || op + n > end)
+				return false;
+			memcpy (comp_buf + op, data + ip, n);
+			ip += n;
+			op += n;
+		}
+	}
+
+	SZ_Write (&net_message, comp_buf + start, op - start);
+	Comp_AddHistory (sock->receiveHistory, &sock->receiveHistoryLength, comp_buf + start, op - start);
+	return true;
+}
+
+/*
+==================
+Datagram_Write
+
+Every packet of an established connection goes out through here so
+net_fakelag and friends can hold it back.
+==================
+*/
+static void Datagram_FakeDeliver (qsocket_t *sock, int type, const byte *data, int length, struct qsockaddr *addr)
+{
+	sfunc.Write (sock->socket, (byte *)data, length, addr);
+}
+
+static int Datagram_Write (qsocket_t *sock, byte *data, int length, struct qsockaddr *addr)
+{
+	if (NET_FakeSend (sock, Datagram_FakeDeliver, 0, data, length, addr, true))
+		return length;
+	return sfunc.Write (sock->socket, data, length, addr);
+}
+
+/*
+==================
+Datagram_Deliver
+
+Hands the complete message in receiveMessage over in net_message.
+==================
+*/
+static int Datagram_Deliver (qsocket_t *sock)
+{
+	SZ_Clear(&net_message);
+	if (!sock->compress)
+		SZ_Write(&net_message, sock->receiveMessage, sock->receiveMessageLength);
+	else if (!Comp_Decode (sock, sock->receiveMessage, sock->receiveMessageLength))
+	{
+		Con_Printf("Bad compressed message from %s\n", sock->address);
+		return -1;
+	}
+	sock->receiveMessageLength = 0;
+	return 1;
+}
+
+/*
+=============================================================================
+
+WINDOWED RELIABLE MODE
+
+Negotiated at connect time when both ends set net_window.  A reliable
+message is cut into NET_WINDOWFRAG fragments with consecutive sequence
+numbers, and up to sock->window of them are in flight at once instead of
+one MAX_DATAGRAM fragment per round trip.  The receiver buffers fragments
+that arrive ahead of receiveSequence and acks every fragment it keeps, with
+its cumulative receiveSequence appended, so the sender learns about holes
+and resends just those.  A peer that does not ask for it stays on the
+original stop-and-wait scheme.
+
+=============================================================================
+*/
+
+static void Window_Start (qsocket_t *sock, int window)
+{
+	int	i;
+
+	sock->window = window;
+	for (i = 0; i < NET_MAXWINDOW; i++)
+		sock->recvWindowLength[i] = -1;
+}
+
+static int Window_Choose (int requested)
+{
+	int	window;
+
+	window = q_min(requested, (int)net_window.value);
+	window = q_min(window, NET_MAXWINDOW);
+	if (window < 2)
+		return 0;
+	return window;
+}
+
+static int Window_SendFragment (qsocket_t *sock, int frag)
+{
+	unsigned int	packetLen;
+	unsigned int	dataLen;
+	unsigned int	eom;
+	int		offset;
+
+	offset = frag * NET_WINDOWFRAG;
+	dataLen = q_min(sock->sendMessageLength - offset, NET_WINDOWFRAG);
+	eom = (frag == sock->windowFrags - 1) ? NETFLAG_EOM : 0;
+	packetLen = NET_HEADERSIZE + dataLen;
+
+	packetBuffer.length = BigLong(packetLen | (NETFLAG_DATA | eom));
+	packetBuffer.sequence = BigLong(sock->windowBase + frag);
+	Q_memcpy (packetBuffer.data, sock->sendMessage + offset, dataLen);
+
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+		return -1;
+
+	sock->lastSendTime = net_time;
+	return 1;
+}
+
+// sends new fragments while there is room in the window
+static int Window_Fill (qsocket_t *sock)
+{
+	while (sock->windowNext < sock->windowFrags && sock->windowNext - sock->windowFirst < sock->window)
+	{
+		if (Window_SendFragment (sock, sock->windowNext) == -1)
+			return -1;
+		sock->windowNext++;
+		packetsSent++;
+	}
+	return 1;
+}
+
+static int Window_SendMessage (qsocket_t *sock)
+{
+	sock->windowFrags = (sock->sendMessageLength + NET_WINDOWFRAG - 1) / NET_WINDOWFRAG;
+	sock->windowBase = sock->sendSequence;
+	sock->sendSequence += sock->windowFrags;
+	sock->windowFirst = 0;
+	sock->windowNext = 0;
+	sock->windowFast = -1;
+	memset (sock->windowAcked, 0, sock->windowFrags);
+
+	sock->canSend = false;
+
+	return Window_Fill (sock);
+}
+
+// resends everything in flight that hasn't been acked
+static int Window_ReSend (qsocket_t *sock)
+{
+	int	i;
+
+	sock->reliableSendTime = 0;	// the ack could be for either copy
+	for (i = sock->windowFirst; i < sock->windowNext; i++)
+	{
+		if (sock->windowAcked[i])
+			continue;
+		if (Window_SendFragment (sock, i) == -1)
+			return -1;
+		packetsReSent++;
+	}
+	return 1;
+}
+
+// a reliable message got through, feeds its round trip into sock->latency
+static void Datagram_TimeAck (qsocket_t *sock)
+{
+	double	rtt;
+
+	if (!sock->reliableSendTime)
+		return;
+	rtt = net_time - sock->reliableSendTime;
+	sock->reliableSendTime = 0;
+	if (sock->latency)
+		sock->latency += (rtt - sock->latency) * 0.25;
+	else
+		sock->latency = rtt;
+}
+
+static void Window_Ack (qsocket_t *sock, unsigned int sequence, unsigned int cumulative)
+{
+	int	i, later;
+
+	if (sock->canSend)
+	{
+		Con_DPrintf("Stale ACK received\n");
+		return;
+	}
+
+	for (i = sock->windowFirst; i < sock->windowNext; i++)
+	{
+		if (sock->windowBase + i == sequence || (int)(cumulative - (sock->windowBase + i)) > 0)
+			sock->windowAcked[i] = true;
+	}
+	while (sock->windowFirst < sock->windowNext && sock->windowAcked[sock->windowFirst])
+		sock->windowFirst++;
+
+	if (sock->windowFirst == sock->windowFrags)
+	{
+		sock->ackSequence = sock->sendSequence;
+		sock->sendMessageLength = 0;
+		sock->canSend = true;
+		Datagram_TimeAck (sock);
+		return;
+	}
+
+	// fragments after a hole keep getting through, so the hole is a loss
+	// rather than a delay: resend it once without waiting for the timeout
+	if (sock->windowFast != sock->windowFirst)
+	{
+		for (i = sock->windowFirst + 1, later = 0; i < sock->windowNext; i++)
+			later += sock->windowAcked[i];
+		if (later >= 3)
+		{
+			sock->windowFast = sock->windowFirst;
+			if (Window_SendFragment (sock, sock->windowFirst) != -1)
+				packetsReSent++;
+		}
+	}
+
+	Window_Fill (sock);
+}
+
+// moves buffered fragments into receiveMessage, returns 1 when a message is complete
+static int Window_Drain (qsocket_t *sock)
+{
+	int	slot, length;
+
+	while (1)
+	{
+		slot = sock->receiveSequence & (NET_MAXWINDOW - 1);
+		length = sock->recvWindowLength[slot];
+		if (length < 0)
+			return 0;
+		if (sock->receiveMessageLength + length > (int)sizeof(sock->receiveMessage))
+		{
+			Con_Printf("Reliable message overflow\n");
+			return -1;
+		}
+
+		Q_memcpy(sock->receiveMessage + sock->receiveMessageLength, sock->recvWindow[slot], length);
+		sock->receiveMessageLength += length;
+		sock->recvWindowLength[slot] = -1;
+		sock->receiveSequence++;
+
+		if (sock->recvWindowEOM[slot])
+			return Datagram_Deliver (sock);
+	}
+}
+
+static int Window_Receive (qsocket_t *sock, unsigned int sequence, qboolean eom, unsigned int length, struct qsockaddr *addr)
+{
+	int	offset, slot, ret;
+
+	offset = (int)(sequence - sock->receiveSequence);
+	if (offset >= sock->window || length > NET_WINDOWFRAG)
+		return 0;	// no room, so don't ack it and let it come again
+
+	if (offset < 0)
+		receivedDuplicateCount++;
+	else
+	{
+		slot = sequence & (NET_MAXWINDOW - 1);
+		if (sock->recvWindowLength[slot] >= 0)
+			receivedDuplicateCount++;
+		else
+		{
+			Q_memcpy(sock->recvWindow[slot], packetBuffer.data, length);
+			sock->recvWindowLength[slot] = length;
+			sock->recvWindowEOM[slot] = eom;
+		}
+	}
+
+	ret = Window_Drain (sock);
+
+	packetBuffer.length = BigLong((NET_HEADERSIZE + 4) | NETFLAG_ACK);
+	packetBuffer.sequence = BigLong(sequence);
+	*(int *)packetBuffer.data = BigLong(sock->receiveSequence);
+	Datagram_Write (sock, (byte *)&packetBuffer, NET_HEADERSIZE + 4, addr);
+
+	return ret;
+}
+
 
 int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 {
@@ -146,12 +716,22 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 		Sys_Error("SendMessage: called with canSend == false\n");
 #endif
 
-	Q_memcpy(sock->sendMessage, data->data, data->cursize);
-	sock->sendMessageLength = data->cursize;
+	if (sock->compress)
+		Comp_Encode (sock, data->data, data->cursize);
+	else
+	{
+		Q_memcpy(sock->sendMessage, data->data, data->cursize);
+		sock->sendMessageLength = data->cursize;
+	}
+
+	sock->reliableSendTime = (sock->sendMessageLength <= (sock->window ? NET_WINDOWFRAG : MAX_DATAGRAM)) ? net_time : 0;
 
-	if (data->cursize <= MAX_DATAGRAM)
+	if (sock->window)
+		return Window_SendMessage (sock);
+
+	if (sock->sendMessageLength <= MAX_DATAGRAM)
 	{
-		dataLen = data->cursize;
+		dataLen = sock->sendMessageLength;
 		eom = NETFLAG_EOM;
 	}
 	else
@@ -167,7 +747,7 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 
 	sock->canSend = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -200,7 +780,7 @@ static int SendMessageNext (qsocket_t *sock)
 
 	sock->sendNext = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -232,8 +812,9 @@ static int ReSendMessage (qsocket_t *sock)
 	Q_memcpy (packetBuffer.data, sock->sendMessage, dataLen);
 
 	sock->sendNext = false;
+	sock->reliableSendTime = 0;	// the ack could be for either copy
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -275,7 +856,7 @@ int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 	packetBuffer.sequence = BigLong(sock->unreliableSendSequence++);
 	Q_memcpy (packetBuffer.data, data->data, data->cursize);
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	packetsSent++;
@@ -294,7 +875,16 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 	if (!sock->canSend)
 		if ((net_time - sock->lastSendTime) > 1.0)
-			ReSendMessage (sock);
+		{
+			if (sock->window)
+				Window_ReSend (sock);
+			else
+				ReSendMessage (sock);
+		}
+
+	// a message may be left complete in the window from the last call
+	if (sock->window && (ret = Window_Drain (sock)) != 0)
+		return ret;
 
 	while (1)
 	{
@@ -364,6 +954,12 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 		if (flags & NETFLAG_ACK)
 		{
+			if (sock->window)
+			{
+				length -= NET_HEADERSIZE;
+				Window_Ack (sock, sequence, length >= 4 ? (unsigned int)BigLong(*(int *)packetBuffer.data) : sequence);
+				continue;
+			}
 			if (sequence != (sock->sendSequence - 1))
 			{
 				Con_DPrintf("Stale ACK received\n");
@@ -390,15 +986,24 @@ int	Datagram_GetMessage (qsocket_t *sock)
 			{
 				sock->sendMessageLength = 0;
 				sock->canSend = true;
+				Datagram_TimeAck (sock);
 			}
 			continue;
 		}
 
 		if (flags & NETFLAG_DATA)
 		{
+			if (sock->window)
+			{
+				ret = Window_Receive (sock, sequence, (flags & NETFLAG_EOM) != 0, length - NET_HEADERSIZE, &readaddr);
+				if (ret)
+					break;
+				continue;
+			}
+
 			packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
 			packetBuffer.sequence = BigLong(sequence);
-			sfunc.Write (sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
+			Datagram_Write (sock, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
 
 			if (sequence != sock->receiveSequence)
 			{
@@ -411,6 +1016,19 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 			if (flags & NETFLAG_EOM)
 			{
+				if (sock->compress)
+				{
+					if (sock->receiveMessageLength + length > sizeof(sock->receiveMessage))
+					{
+						Con_Printf("Reliable message overflow\n");
+						return -1;
+					}
+					Q_memcpy(sock->receiveMessage + sock->receiveMessageLength, packetBuffer.data, length);
+					sock->receiveMessageLength += length;
+					ret = Datagram_Deliver (sock);
+					break;
+				}
+
 				SZ_Clear(&net_message);
 				SZ_Write(&net_message, sock->receiveMessage, sock->receiveMessageLength);
 				SZ_Write(&net_message, packetBuffer.data, length);
@@ -438,6 +1056,8 @@ static void PrintStats(qsocket_t *s)
 	Con_Printf("canSend = %4u   \n", s->canSend);
 	Con_Printf("sendSeq = %4u   ", s->sendSequence);
 	Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
+	if (s->compress && s->compressIn)
+		Con_Printf("packed  = %u -> %u (%.0f%%)\n", s->compressIn, s->compressOut, 100.0 * s->compressOut / s->compressIn);
 	Con_Printf("\n");
 }
 
@@ -457,6 +1077,14 @@ static void NET_Stats_f (void)
 		Con_Printf("receivedDuplicateCount     = %i\n", receivedDuplicateCount);
 		Con_Printf("shortPacketCount           = %i\n", shortPacketCount);
 		Con_Printf("droppedDatagrams           = %i\n", droppedDatagrams);
+		if (fakePacketsDelayed || fakePacketsDropped)
+		{
+			Con_Printf("fakePacketsDelayed         = %i\n", fakePacketsDelayed);
+			Con_Printf("fakePacketsDropped         = %i\n", fakePacketsDropped);
+			Con_Printf("fakePacketsQueued          = %i (max %i)\n", fakePacketsQueued, fakePacketsQueuedMax);
+		}
+		if (compressIn)
+			Con_Printf("compression                = %u -> %u (%.0f%%)\n", compressIn, compressOut, 100.0 * compressOut / compressIn);
 	}
 	else if (Q_strcmp(Cmd_Argv(1), "*") == 0)
 	{
@@ -790,6 +1418,8 @@ int Datagram_Init (void)
 	myDriverLevel = net_driverlevel;
 
 	Cmd_AddCommand ("net_stats", NET_Stats_f);
+	Cvar_RegisterVariable (&net_window);
+	Cvar_RegisterVariable (&net_compress);
 
 	if (safemode || COM_CheckParm("-nolan"))
 		return -1;
@@ -838,6 +1468,7 @@ void Datagram_Shutdown (void)
 
 void Datagram_Close (qsocket_t *sock)
 {
+	AddrHash_Remove (sock);
 	sfunc.Close_Socket(sock->socket);
 }
 
@@ -854,7 +1485,14 @@ void Datagram_Listen (qboolean state)
 }
 
 
-static qsocket_t *_Datagram_CheckNewConnections (void)
+/*
+============
+_Datagram_CheckNewConnections
+
+Handles one control packet, *read is false if there wasn't one
+============
+*/
+static qsocket_t *_Datagram_CheckNewConnections (qboolean *read)
 {
 	struct qsockaddr clientaddr;
 	struct qsockaddr newaddr;
@@ -866,7 +1504,10 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	int			command;
 	int			control;
 	int			ret;
+	int			window;
+	qboolean	compress;
 
+	*read = false;
 	acceptsock = dfunc.CheckNewConnections();
 	if (acceptsock == INVALID_SOCKET)
 		return NULL;
@@ -874,6 +1515,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	SZ_Clear(&net_message);
 
 	len = dfunc.Read (acceptsock, net_message.data, net_message.maxsize, &clientaddr);
+	*read = len > 0;
 	if (len < (int) sizeof(int))
 		return NULL;
 	net_message.cursize = len;
@@ -894,19 +1536,29 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		if (Q_strcmp(MSG_ReadString(), "QUAKE") != 0)
 			return NULL;
 
-		SZ_Clear(&net_message);
-		// save space for the header, filled in later
-		MSG_WriteLong(&net_message, 0);
-		MSG_WriteByte(&net_message, CCREP_SERVER_INFO);
-		dfunc.GetSocketAddr(acceptsock, &newaddr);
-		MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
-		MSG_WriteString(&net_message, hostname.string);
-		MSG_WriteString(&net_message, sv.name);
-		MSG_WriteByte(&net_message, net_activeconnections);
-		MSG_WriteByte(&net_message, svs.maxclients);
-		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
-		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+		if (!InfoReplyAllowed ())
+			return NULL;
+
+		if (!infocache[net_landriverlevel].length || net_time - infocache[net_landriverlevel].time > INFO_CACHE_TIME)
+		{
+			SZ_Clear(&net_message);
+			// save space for the header, filled in later
+			MSG_WriteLong(&net_message, 0);
+			MSG_WriteByte(&net_message, CCREP_SERVER_INFO);
+			dfunc.GetSocketAddr(acceptsock, &newaddr);
+			MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
+			MSG_WriteString(&net_message, hostname.string);
+			MSG_WriteString(&net_message, sv.name);
+			MSG_WriteByte(&net_message, net_activeconnections);
+			MSG_WriteByte(&net_message, svs.maxclients);
+			MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
+			*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
+
+			infocache[net_landriverlevel].time = net_time;
+			infocache[net_landriverlevel].length = q_min(net_message.cursize, (int)sizeof(infocache[0].data));
+			memcpy (infocache[net_landriverlevel].data, net_message.data, infocache[net_landriverlevel].length);
+		}
+		dfunc.Write (acceptsock, infocache[net_landriverlevel].data, infocache[net_landriverlevel].length, &clientaddr);
 		SZ_Clear(&net_message);
 		return NULL;
 	}
@@ -1017,8 +1669,21 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	}
 #endif
 
+	// a client that can use the extensions lists them after the version
+	window = 0;
+	compress = false;
+	while ((ret = MSG_ReadByte()) != -1)
+	{
+		if (ret == NET_EXT_WINDOW)
+			window = Window_Choose (MSG_ReadByte());
+		else if (ret == NET_EXT_COMPRESS)
+			compress = net_compress.value > 0;
+		else
+			break;
+	}
+
 	// see if this guy is already connected
-	for (s = net_activeSockets; s; s = s->next)
+	for (s = addrhash[AddrHash (&clientaddr)]; s; s = s->hashnext)
 	{
 		if (s->driver != net_driverlevel)
 			continue;
@@ -1035,6 +1700,13 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 				MSG_WriteByte(&net_message, CCREP_ACCEPT);
 				dfunc.GetSocketAddr(s->socket, &newaddr);
 				MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
+				if (s->window)
+				{
+					MSG_WriteByte(&net_message, NET_EXT_WINDOW);
+					MSG_WriteByte(&net_message, s->window);
+				}
+				if (s->compress)
+					MSG_WriteByte(&net_message, NET_EXT_COMPRESS);
 				*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 				dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
 				SZ_Clear(&net_message);
@@ -1084,6 +1756,10 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	sock->landriver = net_landriverlevel;
 	sock->addr = clientaddr;
 	Q_strcpy(sock->address, dfunc.AddrToString(&clientaddr));
+	AddrHash_Insert (sock);
+	if (window)
+		Window_Start (sock, window);
+	sock->compress = compress;
 
 	// send him back the info about the server connection he has been allocated
 	SZ_Clear(&net_message);
@@ -1093,6 +1769,13 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	dfunc.GetSocketAddr(newsock, &newaddr);
 	MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
 //	MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
+	if (window)
+	{
+		MSG_WriteByte(&net_message, NET_EXT_WINDOW);
+		MSG_WriteByte(&net_message, window);
+	}
+	if (compress)
+		MSG_WriteByte(&net_message, NET_EXT_COMPRESS);
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 	dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
 	SZ_Clear(&net_message);
@@ -1103,12 +1786,20 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 qsocket_t *Datagram_CheckNewConnections (void)
 {
 	qsocket_t *ret = NULL;
+	qboolean	read;
+	int			i;
 
 	for (net_landriverlevel = 0; net_landriverlevel < net_numlandrivers; net_landriverlevel++)
 	{
 		if (net_landrivers[net_landriverlevel].initialized)
 		{
-			if ((ret = _Datagram_CheckNewConnections ()) != NULL)
+			// keep going through info requests and the like, so a burst of them doesn't back up
+			for (i = 0; i < MAX_CONTROL_PACKETS; i++)
+			{
+				if ((ret = _Datagram_CheckNewConnections (&read)) != NULL || !read)
+					break;
+			}
+			if (ret)
 				break;
 		}
 	}
@@ -1276,6 +1967,13 @@ static qsocket_t *_Datagram_Connect (const char *host)
 		MSG_WriteByte(&net_message, CCREQ_CONNECT);
 		MSG_WriteString(&net_message, "QUAKE");
 		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
+		if (Window_Choose (NET_MAXWINDOW))
+		{
+			MSG_WriteByte(&net_message, NET_EXT_WINDOW);
+			MSG_WriteByte(&net_message, Window_Choose (NET_MAXWINDOW));
+		}
+		if (net_compress.value > 0)
+			MSG_WriteByte(&net_message, NET_EXT_COMPRESS);
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 		dfunc.Write (newsock, net_message.data, net_message.cursize, &sendaddr);
 		SZ_Clear(&net_message);
@@ -1363,6 +2061,19 @@ static qsocket_t *_Datagram_Connect (const char *host)
 	{
 		Q_memcpy(&sock->addr, &sendaddr, sizeof(struct qsockaddr));
 		dfunc.SetSocketPort (&sock->addr, MSG_ReadLong());
+		while ((ret = MSG_ReadByte()) != -1)
+		{
+			if (ret == NET_EXT_WINDOW)
+			{
+				ret = Window_Choose (MSG_ReadByte());
+				if (ret)
+					Window_Start (sock, ret);
+			}
+			else if (ret == NET_EXT_COMPRESS)
+				sock->compress = net_compress.value > 0;
+			else
+				break;
+		}
 	}
 	else
 	{
@@ -30,10 +30,56 @@ static qboolean	localconnectpending = false;
 static qsocket_t	*loop_client = NULL;
 static qsocket_t	*loop_server = NULL;
 
+/*
+Messages travel in whole NET_MAXMESSAGE blocks.  The sender copies into a
+free block and queues it for the peer.  Loop_GetMessage doesn't copy again,
+it trades the block for the one net_message was using, so the reader parses
+the block the message was written into.  Every block is the size of
+net_message's, so whichever one it ends up with, it can be read into.
+*/
+#define	LOOP_BLOCKS		16		// shared by both directions
+#define	LOOP_RESERVE	2		// free blocks unreliable messages leave for reliable ones
+#define	LOOP_QUEUE		LOOP_BLOCKS
+
+typedef struct
+{
+	int		type;		// 1 reliable, 2 unreliable
+	int		length;
+	byte	*block;
+} loopmsg_t;
+
+typedef struct
+{
+	loopmsg_t	msgs[LOOP_QUEUE];
+	int			head, count;
+} loopqueue_t;
+
+static byte			*loop_free[LOOP_BLOCKS + 1];	// + net_message's first buffer
+static int			loop_numfree;
+static loopqueue_t	loop_queues[2];		// to the client, to the server
+
+static loopqueue_t *Loop_Queue (qsocket_t *sock)
+{
+	return sock == loop_client ? &loop_queues[0] : &loop_queues[1];
+}
+
+static void Loop_ClearQueue (loopqueue_t *q)
+{
+	for ( ; q->count; q->count--, q->head = (q->head + 1) % LOOP_QUEUE)
+		loop_free[loop_numfree++] = q->msgs[q->head].block;
+	q->head = 0;
+}
+
 int Loop_Init (void)
 {
+	int		i;
+
 	if (cls.state == ca_dedicated)
 		return -1;
+
+	for (i = 0; i < LOOP_BLOCKS; i++)
+		loop_free[i] = (byte *) Hunk_AllocName (NET_MAXMESSAGE, "loopbuf");
+	loop_numfree = LOOP_BLOCKS;
 	return 0;
 }
 
@@ -82,7 +128,7 @@ qsocket_t *Loop_Connect (const char *host)
 		}
 		Q_strcpy (loop_client->address, "localhost");
 	}
-	loop_client->receiveMessageLength = 0;
+	Loop_ClearQueue (&loop_queues[0]);
 	loop_client->sendMessageLength = 0;
 	loop_client->canSend = true;
 
@@ -95,7 +141,7 @@ qsocket_t *Loop_Connect (const char *host)
 		}
 		Q_strcpy (loop_server->address, "LOCAL");
 	}
-	loop_server->receiveMessageLength = 0;
+	Loop_ClearQueue (&loop_queues[1]);
 	loop_server->sendMessageLength = 0;
 	loop_server->canSend = true;
 
@@ -113,40 +159,35 @@ qsocket_t *Loop_CheckNewConnections (void)
 
 	localconnectpending = false;
 	loop_server->sendMessageLength = 0;
-	loop_server->receiveMessageLength = 0;
+	Loop_ClearQueue (&loop_queues[1]);
 	loop_server->canSend = true;
 	loop_client->sendMessageLength = 0;
-	loop_client->receiveMessageLength = 0;
+	Loop_ClearQueue (&loop_queues[0]);
 	loop_client->canSend = true;
 	return loop_server;
 }
 
 
-static int IntAlign(int value)
-{
-	return (value + (sizeof(int) - 1)) & (~(sizeof(int) - 1));
-}
-
-
 int Loop_GetMessage (qsocket_t *sock)
 {
+	loopqueue_t	*q;
+	loopmsg_t	*m;
 	int		ret;
-	int		length;
 
-	if (sock->receiveMessageLength == 0)
+	q = Loop_Queue (sock);
+	if (!q->count)
 		return 0;
 
-	ret = sock->receiveMessage[0];
-	length = sock->receiveMessage[1] + (sock->receiveMessage[2] << 8);
-	// alignment byte skipped here
-	SZ_Clear (&net_message);
-	SZ_Write (&net_message, &sock->receiveMessage[4], length);
-
-	length = IntAlign(length + 4);
-	sock->receiveMessageLength -= length;
+	m = &q->msgs[q->head];
+	q->head = (q->head + 1) % LOOP_QUEUE;
+	q->count--;
+	ret = m->type;
 
-	if (sock->receiveMessageLength)
-		memmove (sock->receiveMessage, &sock->receiveMessage[length], sock->receiveMessageLength);
+	// swap blocks with net_message, the one it had goes back to the pool
+	loop_free[loop_numfree++] = net_message.data;
+	net_message.data = m->block;
+	net_message.cursize = m->length;
+	net_message.overflowed = false;
 
 	if (sock->driverdata && ret == 1)
 		((qsocket_t *)sock->driverdata)->canSend = true;
@@ -155,69 +196,68 @@ int Loop_GetMessage (qsocket_t *sock)
 }
 
 
-int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
+/*
+==================
+Loop_Deliver
+
+Queues a message of the given type for the peer.  The fake network queue
+calls back into here once the message is due.
+==================
+*/
+static int Loop_Deliver (qsocket_t *peer, int type, const byte *data, int length)
 {
-	byte *buffer;
-	int  *bufferLength;
+	loopqueue_t	*q;
+	loopmsg_t	*m;
 
-	if (!sock->driverdata)
+	if (!peer)
 		return -1;
 
-	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-	if ((*bufferLength + data->cursize + 4) > NET_MAXMESSAGE)
-		Sys_Error("Loop_SendMessage: overflow");
-
-	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
+	q = Loop_Queue (peer);
+	if (q->count == LOOP_QUEUE || length > NET_MAXMESSAGE
+		|| loop_numfree <= (type == 1 ? 0 : LOOP_RESERVE))
+	{
+		if (type == 1)
+			Sys_Error("Loop_SendMessage: overflow");
+		return 0;
+	}
 
-	// message type
-	*buffer++ = 1;
+	m = &q->msgs[(q->head + q->count) % LOOP_QUEUE];
+	q->count++;
+	m->type = type;
+	m->length = length;
+	m->block = loop_free[--loop_numfree];
+	Q_memcpy(m->block, data, length);
+	return 1;
+}
 
-	// length
-	*buffer++ = data->cursize & 0xff;
-	*buffer++ = data->cursize >> 8;
+static void Loop_FakeDeliver (qsocket_t *sock, int type, const byte *data, int length, struct qsockaddr *addr)
+{
+	Loop_Deliver ((qsocket_t *)sock->driverdata, type, data, length);
+}
 
-	// align
-	buffer++;
 
-	// message
-	Q_memcpy(buffer, data->data, data->cursize);
-	*bufferLength = IntAlign(*bufferLength + data->cursize + 4);
+int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
+{
+	if (!sock->driverdata)
+		return -1;
 
 	sock->canSend = false;
-	return 1;
+
+	// there is no resend on the loopback, so reliable messages are only delayed
+	if (NET_FakeSend (sock, Loop_FakeDeliver, 1, data->data, data->cursize, NULL, false))
+		return 1;
+	return Loop_Deliver ((qsocket_t *)sock->driverdata, 1, data->data, data->cursize);
 }
 
 
 int Loop_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 {
-	byte *buffer;
-	int  *bufferLength;
-
 	if (!sock->driverdata)
 		return -1;
 
-	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-	if ((*bufferLength + data->cursize + sizeof(byte) + sizeof(short)) > NET_MAXMESSAGE)
-		return 0;
-
-	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-	// message type
-	*buffer++ = 2;
-
-	// length
-	*buffer++ = data->cursize & 0xff;
-	*buffer++ = data->cursize >> 8;
-
-	// align
-	buffer++;
-
-	// message
-	Q_memcpy(buffer, data->data, data->cursize);
-	*bufferLength = IntAlign(*bufferLength + data->cursize + 4);
-	return 1;
+	if (NET_FakeSend (sock, Loop_FakeDeliver, 2, data->data, data->cursize, NULL, true))
+		return 1;
+	return Loop_Deliver ((qsocket_t *)sock->driverdata, 2, data->data, data->cursize);
 }
 
 
@@ -239,7 +279,7 @@ void Loop_Close (qsocket_t *sock)
 {
 	if (sock->driverdata)
 		((qsocket_t *)sock->driverdata)->driverdata = NULL;
-	sock->receiveMessageLength = 0;
+	Loop_ClearQueue (Loop_Queue (sock));
 	sock->sendMessageLength = 0;
 	sock->canSend = true;
 	if (sock == loop_client)
@@ -60,6 +60,9 @@ int		unreliableMessagesSent		= 0;
 int		unreliableMessagesReceived	= 0;
 
 static	cvar_t	net_messagetimeout = {"net_messagetimeout","300",CVAR_NONE};
+static	cvar_t	net_fakelag = {"net_fakelag", "0", CVAR_NONE};		// milliseconds added to everything sent
+static	cvar_t	net_fakejitter = {"net_fakejitter", "0", CVAR_NONE};	// up to this many more, at random
+static	cvar_t	net_fakeloss = {"net_fakeloss", "0", CVAR_NONE};		// percent of packets thrown away
 cvar_t	hostname = {"hostname", "UNNAMED", CVAR_NONE};
 
 // these two macros are to make the code more readable
@@ -120,6 +123,15 @@ qsocket_t *NET_NewQSocket (void)
 	sock->receiveSequence = 0;
 	sock->unreliableReceiveSequence = 0;
 	sock->receiveMessageLength = 0;
+	sock->hashed = false;
+	sock->window = 0;
+	sock->compress = false;
+	sock->reliableSendTime = 0;
+	sock->latency = 0;
+	sock->sendHistoryLength = 0;
+	sock->receiveHistoryLength = 0;
+	sock->compressIn = 0;
+	sock->compressOut = 0;
 
 	return sock;
 }
@@ -147,6 +159,8 @@ void NET_FreeQSocket(qsocket_t *sock)
 			Sys_Error ("NET_FreeQSocket: not active");
 	}
 
+	NET_FakePurge (sock);
+
 	// add it to free list
 	sock->next = net_freeSockets;
 	net_freeSockets = sock;
@@ -166,6 +180,12 @@ const char *NET_QSocketGetAddressString (const qsocket_t *s)
 }
 
 
+double NET_Latency (const qsocket_t *s)
+{
+	return s ? s->latency : 0;
+}
+
+
 static void NET_Listen_f (void)
 {
 	if (Cmd_Argc () != 2)
@@ -492,6 +512,63 @@ JustDoIt:
 }
 
 
+/*
+===================
+NET_ConnectAddress
+
+Connects straight to an address without the server list search that
+NET_Connect does, for the loadtest clients.  The loopback driver is
+skipped, it only has the one connection.
+===================
+*/
+qsocket_t *NET_ConnectAddress (const char *host)
+{
+	qsocket_t	*ret;
+
+	SetNetTime();
+
+	for (net_driverlevel = 0; net_driverlevel < net_numdrivers; net_driverlevel++)
+	{
+		if (IS_LOOP_DRIVER(net_driverlevel) || net_drivers[net_driverlevel].initialized == false)
+			continue;
+		ret = dfunc.Connect (host);
+		if (ret)
+			return ret;
+	}
+
+	return NULL;
+}
+
+
+/*
+===================
+NET_ReserveQSockets
+
+Makes sure there are at least count free qsockets.  NET_Init only makes
+enough for the server and the local client, the extra ones are never
+freed.
+===================
+*/
+void NET_ReserveQSockets (int count)
+{
+	qsocket_t	*s;
+
+	for (s = net_freeSockets; s && count > 0; s = s->next)
+		count--;
+
+	for ( ; count > 0; count--)
+	{
+		s = (qsocket_t *) calloc (1, sizeof(qsocket_t));
+		if (!s)
+			Sys_Error ("NET_ReserveQSockets: out of memory");
+		s->next = net_freeSockets;
+		net_freeSockets = s;
+		s->disconnected = true;
+		net_numsockets++;
+	}
+}
+
+
 /*
 ===================
 NET_CheckNewConnections
@@ -519,6 +596,157 @@ qsocket_t *NET_CheckNewConnections (void)
 	return NULL;
 }
 
+/*
+=============================================================================
+
+FAKE NETWORK CONDITIONS
+
+net_fakelag, net_fakejitter and net_fakeloss hold back or throw away what
+this end sends, so reliable channel and delta changes can be tried against
+a bad line from a LAN or a listen game.  Set them on both ends to shape
+both directions.  Jitter reorders packets.  The drivers hand each packet to
+NET_FakeSend and only put it on the wire themselves when it declines.
+
+The random stream restarts whenever one of the cvars changes, so the same
+settings and the same traffic drop and delay the same packets.
+
+=============================================================================
+*/
+
+typedef struct fakepacket_s
+{
+	struct fakepacket_s	*next;
+	double			time;
+	qsocket_t		*sock;
+	fakedeliver_t	deliver;
+	int				type;
+	struct qsockaddr	addr;
+	int				length;
+	byte			data[1];
+} fakepacket_t;
+
+static fakepacket_t	*fake_queue;		// sorted by delivery time
+static unsigned int	fake_seed;
+
+int		fakePacketsDelayed;
+int		fakePacketsDropped;
+int		fakePacketsQueued;
+int		fakePacketsQueuedMax;
+
+static void NET_FakeReseed (cvar_t *var)
+{
+	fake_seed = 0x2545f491;
+}
+
+static unsigned int NET_FakeRandom (void)
+{
+	fake_seed = fake_seed * 1103515245 + 12345;
+	return (fake_seed >> 16) & 0x7fff;
+}
+
+/*
+===================
+NET_FakeSend
+
+Returns true if the packet was dropped or queued for deliver to put on the
+wire later, false if the caller should send it now.  Packets that must not
+go missing pass canlose false.
+===================
+*/
+qboolean NET_FakeSend (qsocket_t *sock, fakedeliver_t deliver, int type, const byte *data, int length, struct qsockaddr *addr, qboolean canlose)
+{
+	fakepacket_t	*p, **link;
+	double			delay;
+
+	if (net_fakelag.value <= 0 && net_fakejitter.value <= 0 && net_fakeloss.value <= 0)
+		return false;
+
+	if (canlose && net_fakeloss.value > 0 && NET_FakeRandom () % 10000 < net_fakeloss.value * 100)
+	{
+		fakePacketsDropped++;
+		return true;
+	}
+
+	delay = q_max (net_fakelag.value, 0);
+	if (net_fakejitter.value > 0)
+		delay += net_fakejitter.value * NET_FakeRandom () / 32767.0;
+	if (delay <= 0)
+		return false;
+
+	p = (fakepacket_t *) malloc (sizeof (fakepacket_t) + length);
+	if (!p)
+		Sys_Error ("NET_FakeSend: out of memory");
+	p->time = Sys_DoubleTime () + delay * 0.001;
+	p->sock = sock;
+	p->deliver = deliver;
+	p->type = type;
+	if (addr)
+		p->addr = *addr;
+	p->length = length;
+	memcpy (p->data, data, length);
+
+	// equal times keep their send order
+	for (link = &fake_queue; *link && (*link)->time <= p->time; link = &(*link)->next)
+		;
+	p->next = *link;
+	*link = p;
+
+	fakePacketsDelayed++;
+	if (++fakePacketsQueued > fakePacketsQueuedMax)
+		fakePacketsQueuedMax = fakePacketsQueued;
+	return true;
+}
+
+/*
+===================
+NET_FakeFlush
+
+Puts every queued packet that has waited long enough on the wire
+===================
+*/
+void NET_FakeFlush (void)
+{
+	fakepacket_t	*p;
+	double			now;
+
+	if (!fake_queue)
+		return;
+
+	now = Sys_DoubleTime ();
+	while ((p = fake_queue) != NULL && p->time <= now)
+	{
+		fake_queue = p->next;
+		fakePacketsQueued--;
+		p->deliver (p->sock, p->type, p->data, p->length, &p->addr);
+		free (p);
+	}
+}
+
+/*
+===================
+NET_FakePurge
+
+Forgets the packets of a socket that is going away
+===================
+*/
+void NET_FakePurge (qsocket_t *sock)
+{
+	fakepacket_t	*p, **link;
+
+	for (link = &fake_queue; (p = *link) != NULL; )
+	{
+		if (p->sock == sock)
+		{
+			*link = p->next;
+			fakePacketsQueued--;
+			free (p);
+		}
+		else
+			link = &p->next;
+	}
+}
+
+
 /*
 ===================
 NET_Close
@@ -566,6 +794,7 @@ int	NET_GetMessage (qsocket_t *sock)
 	}
 
 	SetNetTime();
+	NET_FakeFlush ();
 
 	ret = sfunc.QGetMessage(sock);
 
@@ -775,6 +1004,7 @@ void NET_Init (void)
 		else
 			Sys_Error ("NET_Init: you must specify a number after -port");
 	}
+	DEFAULTnet_hostport += host_instance;	// -instances servers count up from -port
 	net_hostport = DEFAULTnet_hostport;
 
 	net_numsockets = svs.maxclientslimit;
@@ -797,6 +1027,13 @@ void NET_Init (void)
 	SZ_Alloc (&net_message, NET_MAXMESSAGE);
 
 	Cvar_RegisterVariable (&net_messagetimeout);
+	Cvar_RegisterVariable (&net_fakelag);
+	Cvar_RegisterVariable (&net_fakejitter);
+	Cvar_RegisterVariable (&net_fakeloss);
+	Cvar_SetCallback (&net_fakelag, NET_FakeReseed);
+	Cvar_SetCallback (&net_fakejitter, NET_FakeReseed);
+	Cvar_SetCallback (&net_fakeloss, NET_FakeReseed);
+	NET_FakeReseed (NULL);
 	Cvar_RegisterVariable (&hostname);
 
 	Cmd_AddCommand ("slist", NET_Slist_f);
@@ -863,6 +1100,39 @@ void NET_Shutdown (void)
 }
 
 
+/*
+===================
+NET_WaitForPackets
+
+Sleeps until a packet for the server arrives or timeout seconds pass, for a
+dedicated server with nobody on it.  With more than one lan driver each one
+gets its share of the time.
+===================
+*/
+qboolean NET_WaitForPackets (double timeout)
+{
+	int		i, n;
+
+	for (i = 0, n = 0; i < net_numlandrivers; i++)
+	{
+		if (net_landrivers[i].initialized)
+			n++;
+	}
+	if (!n || !listening)
+	{
+		Sys_Sleep ((unsigned long)(timeout * 1000));
+		return false;
+	}
+
+	for (i = 0; i < net_numlandrivers; i++)
+	{
+		if (net_landrivers[i].initialized && net_landrivers[i].WaitForPackets (timeout / n))
+			return true;
+	}
+	return false;
+}
+
+
 static PollProcedure *pollProcedureList = NULL;
 
 void NET_Poll(void)
@@ -870,6 +1140,7 @@ void NET_Poll(void)
 	PollProcedure *pp;
 
 	SetNetTime();
+	NET_FakeFlush ();
 
 	for (pp = pollProcedureList; pp; pp = pp->next)
 	{
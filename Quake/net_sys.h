@@ -56,6 +56,8 @@
 #include <sys/sockio.h>
 #endif	/* __sunos__ */
 #include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -20,6 +20,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* recvmmsg */
+#endif
+
 #include "q_stdinc.h"
 #include "arch_def.h"
 #include "net_sys.h"
@@ -35,6 +39,107 @@ static in_addr_t	myAddr;
 
 #include "net_udp.h"
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define	UDP_RECVMMSG
+
+// each connection has a socket of its own, so UDP_Read drains everything a
+// socket has with one recvmmsg and hands the packets out one at a time
+#define	UDP_BATCH		8
+#define	UDP_MAXRINGS	64		// sockets with a ring, power of two
+
+typedef struct
+{
+	sys_socket_t		socket;		// INVALID_SOCKET = free slot
+	int					head, count;
+	int					lengths[UDP_BATCH];
+	struct sockaddr_in	addrs[UDP_BATCH];
+	byte				data[UDP_BATCH][NET_DATAGRAMSIZE];
+} udpring_t;
+
+static udpring_t	*udp_rings[UDP_MAXRINGS];
+static qboolean		udp_nobatch;
+
+/*
+============
+UDP_FindRing
+
+by socket hash, NULL if the table is full and the socket has to do without
+============
+*/
+static udpring_t *UDP_FindRing (sys_socket_t socketid, qboolean create)
+{
+	udpring_t	*ring;
+	int			i, slot, freeslot;
+
+	freeslot = -1;
+	for (i = 0; i < UDP_MAXRINGS; i++)
+	{
+		slot = ((unsigned int)socketid * 2654435761u + i) & (UDP_MAXRINGS - 1);
+		ring = udp_rings[slot];
+		if (!ring)
+		{
+			if (freeslot == -1)
+				freeslot = slot;
+			break;
+		}
+		if (ring->socket == socketid)
+			return ring;
+		if (ring->socket == INVALID_SOCKET && freeslot == -1)
+			freeslot = slot;
+	}
+
+	if (!create || freeslot == -1)
+		return NULL;
+
+	ring = udp_rings[freeslot];
+	if (!ring)
+	{
+		ring = (udpring_t *) malloc (sizeof(udpring_t));
+		if (!ring)
+			return NULL;
+		udp_rings[freeslot] = ring;
+	}
+	ring->socket = socketid;
+	ring->head = ring->count = 0;
+	return ring;
+}
+
+/*
+============
+UDP_FillRing
+
+returns the number of packets read, 0 if there weren't any, or SOCKET_ERROR
+============
+*/
+static int UDP_FillRing (udpring_t *ring)
+{
+	struct mmsghdr	msgs[UDP_BATCH];
+	struct iovec	iov[UDP_BATCH];
+	int				i, ret;
+
+	memset (msgs, 0, sizeof(msgs));
+	for (i = 0; i < UDP_BATCH; i++)
+	{
+		iov[i].iov_base = ring->data[i];
+		iov[i].iov_len = NET_DATAGRAMSIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &ring->addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(ring->addrs[i]);
+	}
+
+	ret = recvmmsg (ring->socket, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+	if (ret == SOCKET_ERROR)
+		return ret;
+
+	for (i = 0; i < ret; i++)
+		ring->lengths[i] = msgs[i].msg_len;
+	ring->head = 0;
+	ring->count = ret;
+	return ret;
+}
+#endif	/* UDP_RECVMMSG */
+
 //=============================================================================
 
 sys_socket_t UDP_Init (void)
@@ -48,6 +153,10 @@ sys_socket_t UDP_Init (void)
 	if (COM_CheckParm ("-noudp"))
 		return INVALID_SOCKET;
 
+#ifdef UDP_RECVMMSG
+	udp_nobatch = COM_CheckParm ("-noudpbatch") != 0;
+#endif
+
 	// determine my name & address
 	myAddr = htonl(INADDR_LOOPBACK);
 	if (gethostname(buff, MAXHOSTNAMELEN) != 0)
@@ -172,6 +281,13 @@ ErrorReturn:
 
 int UDP_CloseSocket (sys_socket_t socketid)
 {
+#ifdef UDP_RECVMMSG
+	udpring_t	*ring = UDP_FindRing (socketid, false);
+
+	if (ring)
+		ring->socket = INVALID_SOCKET;	// kept for the next socket, anything unread goes
+#endif
+
 	if (socketid == net_broadcastsocket)
 		net_broadcastsocket = 0;
 	return closesocket (socketid);
@@ -252,6 +368,15 @@ sys_socket_t UDP_CheckNewConnections (void)
 	if (net_acceptsocket == INVALID_SOCKET)
 		return INVALID_SOCKET;
 
+#ifdef UDP_RECVMMSG
+	{
+		udpring_t	*ring = UDP_FindRing (net_acceptsocket, false);
+
+		if (ring && ring->count)
+			return net_acceptsocket;	// already read in, FIONREAD doesn't know
+	}
+#endif
+
 	if (ioctl (net_acceptsocket, FIONREAD, &available) == -1)
 	{
 		int err = SOCKETERRNO;
@@ -264,13 +389,66 @@ sys_socket_t UDP_CheckNewConnections (void)
 	return INVALID_SOCKET;
 }
 
+/*
+blocks until something arrives on the accept socket or timeout seconds
+pass, for an idle dedicated server.  returns true if something arrived.
+*/
+qboolean UDP_WaitForPackets (double timeout)
+{
+	fd_set		fds;
+	struct timeval	tv;
+
+	if (net_acceptsocket == INVALID_SOCKET)
+	{
+		Sys_Sleep ((unsigned long)(timeout * 1000));
+		return false;
+	}
+
+#ifdef UDP_RECVMMSG
+	{
+		udpring_t	*ring = UDP_FindRing (net_acceptsocket, false);
+
+		if (ring && ring->count)
+			return true;
+	}
+#endif
+
+	FD_ZERO (&fds);
+	FD_SET (net_acceptsocket, &fds);
+	tv.tv_sec = (long) timeout;
+	tv.tv_usec = (long) ((timeout - tv.tv_sec) * 1000000);
+	return select (net_acceptsocket + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
 //=============================================================================
 
 int UDP_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr)
 {
 	socklen_t addrlen = sizeof(struct qsockaddr);
 	int ret;
+#ifdef UDP_RECVMMSG
+	udpring_t	*ring;
 
+	ring = udp_nobatch ? NULL : UDP_FindRing (socketid, true);
+	if (ring)
+	{
+		if (!ring->count)
+			ret = UDP_FillRing (ring);
+		else
+			ret = 1;
+		if (ret > 0)
+		{
+			ret = q_min(ring->lengths[ring->head], len);
+			memcpy (buf, ring->data[ring->head], ret);
+			memset (addr, 0, sizeof(struct qsockaddr));
+			memcpy (addr, &ring->addrs[ring->head], sizeof(struct sockaddr_in));
+			ring->head++;
+			ring->count--;
+			return ret;
+		}
+	}
+	else
+#endif
 	ret = recvfrom (socketid, buf, len, 0, (struct sockaddr *)addr, &addrlen);
 	if (ret == SOCKET_ERROR)
 	{
@@ -29,6 +29,7 @@ sys_socket_t  UDP_OpenSocket (int port);
 int  UDP_CloseSocket (sys_socket_t socketid);
 int  UDP_Connect (sys_socket_t socketid, struct qsockaddr *addr);
 sys_socket_t  UDP_CheckNewConnections (void);
+qboolean UDP_WaitForPackets (double timeout);
 int  UDP_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  UDP_Write (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  UDP_Broadcast (sys_socket_t socketid, byte *buf, int len);
@@ -81,6 +81,7 @@ net_landriver_t	net_landrivers[] =
 		WINS_CloseSocket,
 		WINS_Connect,
 		WINS_CheckNewConnections,
+		WINS_WaitForPackets,
 		WINS_Read,
 		WINS_Write,
 		WINS_Broadcast,
@@ -104,6 +105,7 @@ net_landriver_t	net_landrivers[] =
 		WIPX_CloseSocket,
 		WIPX_Connect,
 		WIPX_CheckNewConnections,
+		WIPX_WaitForPackets,
 		WIPX_Read,
 		WIPX_Write,
 		WIPX_Broadcast,
@@ -346,6 +346,28 @@ sys_socket_t WINS_CheckNewConnections (void)
 	return INVALID_SOCKET;
 }
 
+/*
+blocks until something arrives on the accept socket or timeout seconds
+pass, for an idle dedicated server.  returns true if something arrived.
+*/
+qboolean WINS_WaitForPackets (double timeout)
+{
+	fd_set		fds;
+	struct timeval	tv;
+
+	if (net_acceptsocket == INVALID_SOCKET)
+	{
+		Sys_Sleep ((unsigned long)(timeout * 1000));
+		return false;
+	}
+
+	FD_ZERO (&fds);
+	FD_SET (net_acceptsocket, &fds);
+	tv.tv_sec = (long) timeout;
+	tv.tv_usec = (long) ((timeout - tv.tv_sec) * 1000000);
+	return select (0, &fds, NULL, NULL, &tv) > 0;	// winsock ignores nfds
+}
+
 //=============================================================================
 
 int WINS_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr)
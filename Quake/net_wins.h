@@ -29,6 +29,7 @@ sys_socket_t  WINS_OpenSocket (int port);
 int  WINS_CloseSocket (sys_socket_t socketid);
 int  WINS_Connect (sys_socket_t socketid, struct qsockaddr *addr);
 sys_socket_t  WINS_CheckNewConnections (void);
+qboolean WINS_WaitForPackets (double timeout);
 int  WINS_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  WINS_Write (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  WINS_Broadcast (sys_socket_t socketid, byte *buf, int len);
@@ -29,6 +29,7 @@ sys_socket_t  WIPX_OpenSocket (int port);
 int  WIPX_CloseSocket (sys_socket_t socketid);
 int  WIPX_Connect (sys_socket_t socketid, struct qsockaddr *addr);
 sys_socket_t  WIPX_CheckNewConnections (void);
+qboolean WIPX_WaitForPackets (double timeout);
 int  WIPX_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  WIPX_Write (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  WIPX_Broadcast (sys_socket_t socketid, byte *buf, int len);
@@ -294,7 +294,7 @@ setmodel(entity, model)
 static void PF_setmodel (void)
 {
 	int		i;
-	const char	*m, **check;
+	const char	*m;
 	qmodel_t	*mod;
 	edict_t		*e;
 
@@ -302,17 +302,12 @@ static void PF_setmodel (void)
 	m = G_STRING(OFS_PARM1);
 
 // check to see if model was properly precached
-	for (i = 0, check = sv.model_precache; *check; i++, check++)
-	{
-		if (!strcmp(*check, m))
-			break;
-	}
-
-	if (!*check)
+	i = SV_FindModelPrecache (m);
+	if (i == -1)
 	{
 		PR_RunError ("no precache: %s", m);
 	}
-	e->v.model = PR_SetEngineString(*check);
+	e->v.model = PR_SetEngineString(sv.model_precache[i]);
 	e->v.modelindex = i; //SV_ModelIndex (m);
 
 	mod = sv.models[ (int)e->v.modelindex];  // Mod_ForName (m, true);
@@ -956,6 +951,14 @@ static void PF_cvar_set (void)
 	Cvar_Set (var, val);
 }
 
+static int PF_FindRadiusCompare (const void *a, const void *b)
+{
+	const edict_t	*ea = *(const edict_t **)a;
+	const edict_t	*eb = *(const edict_t **)b;
+
+	return (ea > eb) - (ea < eb);
+}
+
 /*
 =================
 PF_findradius
@@ -968,20 +971,36 @@ findradius (origin, radius)
 static void PF_findradius (void)
 {
 	edict_t	*ent, *chain;
+	edict_t	**list;
 	float	rad;
 	float	*org;
-	int		i;
+	vec3_t	mins, maxs;
+	int		i, count, mark;
 
 	chain = (edict_t *)sv.edicts;
 
 	org = G_VECTOR(OFS_PARM0);
 	rad = G_FLOAT(OFS_PARM1);
+
+	// only SOLID_NOT edicts are left out of the area nodes, and they are skipped anyway
+	for (i = 0; i < 3; i++)
+	{
+		mins[i] = org[i] - fabs(rad) - 1;
+		maxs[i] = org[i] + fabs(rad) + 1;
+	}
 	rad *= rad;
 
-	ent = NEXT_EDICT(sv.edicts);
-	for (i = 1; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent))
+	mark = Frame_LowMark ();
+	list = (edict_t **) Frame_Alloc (sv.num_edicts*sizeof(edict_t *));
+	count = SV_AreaEdicts (mins, maxs, list, sv.num_edicts);
+
+	// the chain is built in edict order, like a walk over all of them would
+	qsort (list, count, sizeof(edict_t *), PF_FindRadiusCompare);
+
+	for (i = 0; i < count; i++)
 	{
 		float d, lensq;
+		ent = list[i];
 		if (ent->free)
 			continue;
 		if (ent->v.solid == SOLID_NOT)
@@ -1004,6 +1023,8 @@ static void PF_findradius (void)
 		chain = ent;
 	}
 
+	Frame_FreeToLowMark (mark);
+
 	RETURN_EDICT(chain);
 }
 
@@ -1079,6 +1100,16 @@ static void PF_Find (void)
 	if (!s)
 		PR_RunError ("PF_Find: bad search string");
 
+	if (f == FIELD_CLASSNAME)
+	{
+		ed = ED_FindClassname (e, s);
+		if (ed)
+		{
+			RETURN_EDICT(ed);
+			return;
+		}
+	}
+
 	for (e++ ; e < sv.num_edicts ; e++)
 	{
 		ed = EDICT_NUM(e);
@@ -1145,16 +1176,16 @@ static void PF_precache_model (void)
 	G_INT(OFS_RETURN) = G_INT(OFS_PARM0);
 	PR_CheckEmptyString (s);
 
+	if (SV_FindModelPrecache (s) != -1)
+		return;
 	for (i = 0; i < MAX_MODELS; i++)
 	{
 		if (!sv.model_precache[i])
 		{
-			sv.model_precache[i] = s;
+			SV_SetModelPrecache (i, s);
 			sv.models[i] = Mod_ForName (s, true);
 			return;
 		}
-		if (!strcmp(sv.model_precache[i], s))
-			return;
 	}
 	PR_RunError ("PF_precache_model: overflow");
 }
@@ -1541,44 +1572,68 @@ static sizebuf_t *WriteDest (void)
 	return NULL;
 }
 
+/*
+==============
+WriteDestKind
+
+WriteDest, except that writes to MSG_BROADCAST go by SV_BroadcastDest so
+temp entities can be multicast.  kind is what's being written, see
+SV_BroadcastDest.
+==============
+*/
+static sizebuf_t *WriteDestKind (int kind, float value)
+{
+	if (G_FLOAT(OFS_PARM0) == MSG_BROADCAST)
+		return SV_BroadcastDest (kind, value);
+	return WriteDest ();
+}
+
 static void PF_WriteByte (void)
 {
-	MSG_WriteByte (WriteDest(), G_FLOAT(OFS_PARM1));
+	MSG_WriteByte (WriteDestKind('b', G_FLOAT(OFS_PARM1)), G_FLOAT(OFS_PARM1));
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteChar (void)
 {
-	MSG_WriteChar (WriteDest(), G_FLOAT(OFS_PARM1));
+	MSG_WriteChar (WriteDestKind('h', G_FLOAT(OFS_PARM1)), G_FLOAT(OFS_PARM1));
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteShort (void)
 {
-	MSG_WriteShort (WriteDest(), G_FLOAT(OFS_PARM1));
+	MSG_WriteShort (WriteDestKind('s', G_FLOAT(OFS_PARM1)), G_FLOAT(OFS_PARM1));
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteLong (void)
 {
-	MSG_WriteLong (WriteDest(), G_FLOAT(OFS_PARM1));
+	MSG_WriteLong (WriteDestKind('l', G_FLOAT(OFS_PARM1)), G_FLOAT(OFS_PARM1));
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteAngle (void)
 {
-	MSG_WriteAngle (WriteDest(), G_FLOAT(OFS_PARM1), sv.protocolflags);
+	MSG_WriteAngle (WriteDestKind('a', G_FLOAT(OFS_PARM1)), G_FLOAT(OFS_PARM1), sv.protocolflags);
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteCoord (void)
 {
-	MSG_WriteCoord (WriteDest(), G_FLOAT(OFS_PARM1), sv.protocolflags);
+	MSG_WriteCoord (WriteDestKind('c', G_FLOAT(OFS_PARM1)), G_FLOAT(OFS_PARM1), sv.protocolflags);
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteString (void)
 {
-	MSG_WriteString (WriteDest(), LOC_GetString(G_STRING(OFS_PARM1)));
+	MSG_WriteString (WriteDestKind('t', 0), LOC_GetString(G_STRING(OFS_PARM1)));
+	SV_BroadcastWritten ();
 }
 
 static void PF_WriteEntity (void)
 {
-	MSG_WriteShort (WriteDest(), G_EDICTNUM(OFS_PARM1));
+	MSG_WriteShort (WriteDestKind('s', 0), G_EDICTNUM(OFS_PARM1));
+	SV_BroadcastWritten ();
 }
 
 //=============================================================================
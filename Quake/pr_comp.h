@@ -132,6 +132,8 @@ enum
 	OP_BITOR
 };
 
+#define	OP_NUMOPS	(OP_BITOR + 1)
+
 typedef struct statement_s
 {
 	unsigned short	op;
@@ -31,6 +31,10 @@ static	int		pr_stringssize;
 static	const char	**pr_knownstrings;
 static	int		pr_maxknownstrings;
 static	int		pr_numknownstrings;
+
+static void PR_ResetStringIndex (void);
+static string_t PR_InternString (const char *s);
+static void PR_Strings_f (void);
 static	ddef_t		*pr_fielddefs;
 static	ddef_t		*pr_globaldefs;
 
@@ -38,6 +42,7 @@ qboolean	pr_alpha_supported; //johnfitz
 int		pr_effects_mask; // only enable 2021 rerelease quad/penta dlights when applicable
 
 dstatement_t	*pr_statements;
+prinstr_t	*pr_code;
 globalvars_t	*pr_global_struct;
 float		*pr_globals;		// same as pr_global_struct
 int		pr_edict_size;		// in bytes
@@ -84,6 +89,44 @@ cvar_t	saved2 = {"saved2", "0", CVAR_ARCHIVE};
 cvar_t	saved3 = {"saved3", "0", CVAR_ARCHIVE};
 cvar_t	saved4 = {"saved4", "0", CVAR_ARCHIVE};
 
+static int	ed_allocs, ed_frees;	// since ed_ratestart, for edictcount
+static double	ed_ratestart;
+
+static void ED_UnlinkFree (edict_t *e)
+{
+	if (e->freelink.next)
+	{
+		RemoveLink (&e->freelink);
+		e->freelink.prev = e->freelink.next = NULL;
+	}
+}
+
+/*
+=================
+ED_ResetFreeList
+
+Queues the free edicts in number order, after the edicts were set up
+without ED_Alloc and ED_Free, i.e. a new map or a loaded game.
+=================
+*/
+void ED_ResetFreeList (void)
+{
+	edict_t	*e;
+	int	i;
+
+	ClearLink (&sv.free_edicts);
+	for (i = 0; i < sv.num_edicts; i++)
+	{
+		e = EDICT_NUM(i);
+		e->freelink.prev = e->freelink.next = NULL;
+		if (e->free && i > svs.maxclients)
+			InsertLinkBefore (&e->freelink, &sv.free_edicts);
+	}
+
+	ed_allocs = ed_frees = 0;
+	ed_ratestart = sv.time;
+}
+
 /*
 =================
 ED_ClearEdict
@@ -95,6 +138,9 @@ void ED_ClearEdict (edict_t *e)
 {
 	memset (&e->v, 0, progs->entityfields * 4);
 	e->free = false;
+	ED_UnlinkFree (e);
+	ED_ClassnameChanged (e);
+	SV_WakeEdict (e);
 }
 
 /*
@@ -106,6 +152,9 @@ Try to avoid reusing an entity that was recently freed, because it
 can cause the client to think the entity morphed into something else
 instead of being removed and recreated, which can cause interpolated
 angles and bad trails.
+
+ED_Free queues edicts in the order they were freed, so only the oldest
+one needs checking.
 =================
 */
 edict_t *ED_Alloc (void)
@@ -113,24 +162,28 @@ edict_t *ED_Alloc (void)
 	int			i;
 	edict_t		*e;
 
-	for (i = svs.maxclients + 1; i < sv.num_edicts; i++)
+	ed_allocs++;
+
+	if (sv.free_edicts.next != &sv.free_edicts)
 	{
-		e = EDICT_NUM(i);
+		e = EDICT_FROM_FREELINK(sv.free_edicts.next);
 		// the first couple seconds of server time can involve a lot of
 		// freeing and allocating, so relax the replacement policy
-		if (e->free && ( e->freetime < 2 || sv.time - e->freetime > 0.5 ) )
+		if (e->freetime < 2 || sv.time - e->freetime > 0.5)
 		{
 			ED_ClearEdict (e);
 			return e;
 		}
 	}
 
+	i = sv.num_edicts;
 	if (i == sv.max_edicts) //johnfitz -- use sv.max_edicts instead of MAX_EDICTS
 		Host_Error ("ED_Alloc: no free edicts (max_edicts is %i)", sv.max_edicts);
 
 	sv.num_edicts++;
 	e = EDICT_NUM(i);
 	memset(e, 0, pr_edict_size); // ericw -- switched sv.edicts to malloc(), so we are accessing uninitialized memory and must fully zero it, not just ED_ClearEdict
+	SV_WakeEdict (e);
 
 	return e;
 }
@@ -161,6 +214,241 @@ void ED_Free (edict_t *ed)
 	ed->alpha = ENTALPHA_DEFAULT; //johnfitz -- reset alpha for next entity
 
 	ed->freetime = sv.time;
+	ED_ClassnameChanged (ed);
+
+	// to the back of the queue, freeing it again restarts its delay
+	ED_UnlinkFree (ed);
+	if (NUM_FOR_EDICT(ed) > svs.maxclients)
+		InsertLinkBefore (&ed->freelink, &sv.free_edicts);
+	ed_frees++;
+}
+
+/*
+===============================================================================
+
+CLASSNAME INDEX
+
+Edicts are kept on one list per classname, in edict order, so PF_Find can
+look for a classname without walking every edict.  QuakeC can only write
+to a field through OP_ADDRESS, which flags the edict when it takes the
+address of .classname; flagged edicts are re-indexed before each lookup
+and stay flagged until the frame is done, since the actual store may only
+happen after a lookup.  Edicts cleared behind the index's back linger on
+their old list, so lookups still compare the names.
+
+===============================================================================
+*/
+
+#define	MAX_ED_CLASSES		1024	// power of two
+#define	MAX_ED_CLASSNAME	64
+
+typedef struct
+{
+	char	name[MAX_ED_CLASSNAME];
+	int	head, tail;		// edict numbers, 0 = none
+} edclass_t;
+
+static edclass_t	ed_classes[MAX_ED_CLASSES];
+static int		ed_numclasses;
+static qboolean		ed_classoverflow;	// the index is incomplete, search the slow way
+static int		ed_changed[MAX_EDICTS];
+static int		ed_numchanged;
+
+static void ED_ResetClassnames (void)
+{
+	memset (ed_classes, 0, sizeof(ed_classes));
+	ed_numclasses = 0;
+	ed_classoverflow = false;
+	ed_numchanged = 0;
+}
+
+/*
+=================
+ED_ClassForName
+
+Returns the class number (slot + 1) of a name, 0 if it's not there and
+create is false, or -1 if it can't be indexed.
+=================
+*/
+static int ED_ClassForName (const char *name, qboolean create)
+{
+	unsigned	pos;
+	edclass_t	*c;
+
+	if (strlen (name) >= MAX_ED_CLASSNAME)
+		return -1;
+
+	for (pos = COM_HashString (name) & (MAX_ED_CLASSES - 1); ; pos = (pos + 1) & (MAX_ED_CLASSES - 1))
+	{
+		c = &ed_classes[pos];
+		if (!c->name[0])
+			break;
+		if (!strcmp (c->name, name))
+			return pos + 1;
+	}
+
+	if (!create)
+		return 0;
+	if (ed_numclasses == MAX_ED_CLASSES - 1)	// keep a free slot to end the probing
+		return -1;
+
+	q_strlcpy (c->name, name, sizeof(c->name));
+	c->head = c->tail = 0;
+	ed_numclasses++;
+	return pos + 1;
+}
+
+static void ED_UnlinkClass (edict_t *ed)
+{
+	edclass_t	*c;
+
+	if (!ed->classnum)
+		return;
+
+	c = &ed_classes[ed->classnum - 1];
+	if (ed->classprev)
+		EDICT_NUM(ed->classprev)->classnext = ed->classnext;
+	else
+		c->head = ed->classnext;
+	if (ed->classnext)
+		EDICT_NUM(ed->classnext)->classprev = ed->classprev;
+	else
+		c->tail = ed->classprev;
+
+	ed->classnum = ed->classprev = ed->classnext = 0;
+}
+
+static void ED_LinkClass (edict_t *ed, int classnum)
+{
+	edclass_t	*c;
+	int		num, prev;
+
+	num = NUM_FOR_EDICT(ed);
+	c = &ed_classes[classnum - 1];
+
+	// usually goes at the end, edicts tend to be allocated in order
+	for (prev = c->tail; prev > num; prev = EDICT_NUM(prev)->classprev)
+		;
+
+	ed->classnum = classnum;
+	ed->classprev = prev;
+	ed->classnext = prev ? EDICT_NUM(prev)->classnext : c->head;
+	if (ed->classprev)
+		EDICT_NUM(ed->classprev)->classnext = num;
+	else
+		c->head = num;
+	if (ed->classnext)
+		EDICT_NUM(ed->classnext)->classprev = num;
+	else
+		c->tail = num;
+}
+
+static void ED_IndexClassname (edict_t *ed)
+{
+	const char	*name;
+	int		classnum;
+
+	if (ed == sv.edicts)
+		return;		// never found by PF_Find
+
+	name = ed->free ? "" : PR_GetString (ed->v.classname);
+	classnum = *name ? ED_ClassForName (name, true) : 0;
+	if (classnum == -1)
+	{
+		ed_classoverflow = true;
+		classnum = 0;
+	}
+	if (classnum == ed->classnum)
+		return;
+
+	ED_UnlinkClass (ed);
+	if (classnum)
+		ED_LinkClass (ed, classnum);
+}
+
+/*
+=================
+ED_ClassnameChanged
+=================
+*/
+void ED_ClassnameChanged (edict_t *ed)
+{
+	if (ed->classchanged)
+		return;
+	if (ed_numchanged == MAX_EDICTS)
+	{ // only if edicts were cleared wholesale since the last frame
+		ed_classoverflow = true;
+		return;
+	}
+	ed->classchanged = true;
+	// not NUM_FOR_EDICT, loading a savegame parses edicts past sv.num_edicts
+	ed_changed[ed_numchanged++] = ((byte *)ed - (byte *)sv.edicts) / pr_edict_size;
+}
+
+/*
+=================
+ED_UpdateClassnames
+
+Re-indexes the edicts whose classname may have changed.  framedone may
+only be set when no QuakeC is running.
+=================
+*/
+void ED_UpdateClassnames (qboolean framedone)
+{
+	edict_t	*ed;
+	int	i;
+
+	for (i = 0; i < ed_numchanged; i++)
+	{
+		ed = EDICT_NUM(ed_changed[i]);
+		ED_IndexClassname (ed);
+		if (framedone)
+			ed->classchanged = false;
+	}
+	if (framedone)
+		ed_numchanged = 0;
+}
+
+/*
+=================
+ED_FindClassname
+
+Returns the first edict after start with the given classname, sv.edicts
+if there is none, or NULL if the index can't tell.
+=================
+*/
+edict_t *ED_FindClassname (int start, const char *name)
+{
+	edict_t	*ed;
+	int	classnum, e;
+
+	ED_UpdateClassnames (false);
+	if (ed_classoverflow || !*name)
+		return NULL;
+
+	classnum = ED_ClassForName (name, false);
+	if (classnum == -1)
+		return NULL;
+	if (!classnum)
+		return sv.edicts;
+
+	ed = EDICT_NUM(start);
+	if (start > 0 && ed->classnum == classnum)
+		e = ed->classnext;
+	else
+	{
+		for (e = ed_classes[classnum - 1].head; e && e <= start; e = EDICT_NUM(e)->classnext)
+			;
+	}
+
+	for ( ; e; e = ed->classnext)
+	{
+		ed = EDICT_NUM(e);
+		if (!ed->free && !strcmp (PR_GetString (ed->v.classname), name))
+			return ed;
+	}
+
+	return sv.edicts;
 }
 
 //===========================================================================
@@ -203,6 +491,63 @@ static ddef_t *ED_FieldAtOfs (int ofs)
 	return NULL;
 }
 
+/*
+===============================================================================
+
+NAME INDEX
+
+Field, global and function names are hashed once in PR_LoadProgs, so the
+entity and savegame parsers don't scan all the defs for every key.  Names
+are inserted in def order, so a duplicate name finds the first def like
+the linear search did.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	int		*slots;		// def number + 1, 0 = empty
+	unsigned	mask;
+} prnameindex_t;
+
+static prnameindex_t	pr_fieldindex, pr_globalindex, pr_functionindex;
+
+static void PR_AllocNameIndex (prnameindex_t *index, int count)
+{
+	unsigned	size;
+
+	for (size = 64; size < (unsigned) count * 2; size <<= 1)
+		;
+	index->slots = (int *) Hunk_AllocName (size * sizeof(int), "prindex");
+	index->mask = size - 1;
+}
+
+static void PR_IndexName (prnameindex_t *index, const char *name, int num)
+{
+	unsigned	pos;
+
+	for (pos = COM_HashString (name) & index->mask; index->slots[pos]; pos = (pos + 1) & index->mask)
+		;
+	index->slots[pos] = num + 1;
+}
+
+static void PR_BuildNameIndex (void)
+{
+	int	i;
+
+	PR_AllocNameIndex (&pr_fieldindex, progs->numfielddefs);
+	for (i = 0; i < progs->numfielddefs; i++)
+		PR_IndexName (&pr_fieldindex, PR_GetString (pr_fielddefs[i].s_name), i);
+
+	PR_AllocNameIndex (&pr_globalindex, progs->numglobaldefs);
+	for (i = 0; i < progs->numglobaldefs; i++)
+		PR_IndexName (&pr_globalindex, PR_GetString (pr_globaldefs[i].s_name), i);
+
+	PR_AllocNameIndex (&pr_functionindex, progs->numfunctions);
+	for (i = 0; i < progs->numfunctions; i++)
+		PR_IndexName (&pr_functionindex, PR_GetString (pr_functions[i].s_name), i);
+}
+
 /*
 ============
 ED_FindField
@@ -211,11 +556,12 @@ ED_FindField
 static ddef_t *ED_FindField (const char *name)
 {
 	ddef_t		*def;
+	unsigned	pos;
 	int			i;
 
-	for (i = 0; i < progs->numfielddefs; i++)
+	for (pos = COM_HashString (name) & pr_fieldindex.mask; (i = pr_fieldindex.slots[pos]) != 0; pos = (pos + 1) & pr_fieldindex.mask)
 	{
-		def = &pr_fielddefs[i];
+		def = &pr_fielddefs[i - 1];
 		if ( !strcmp(PR_GetString(def->s_name), name) )
 			return def;
 	}
@@ -231,11 +577,12 @@ ED_FindGlobal
 static ddef_t *ED_FindGlobal (const char *name)
 {
 	ddef_t		*def;
+	unsigned	pos;
 	int			i;
 
-	for (i = 0; i < progs->numglobaldefs; i++)
+	for (pos = COM_HashString (name) & pr_globalindex.mask; (i = pr_globalindex.slots[pos]) != 0; pos = (pos + 1) & pr_globalindex.mask)
 	{
-		def = &pr_globaldefs[i];
+		def = &pr_globaldefs[i - 1];
 		if ( !strcmp(PR_GetString(def->s_name), name) )
 			return def;
 	}
@@ -251,11 +598,12 @@ ED_FindFunction
 static dfunction_t *ED_FindFunction (const char *fn_name)
 {
 	dfunction_t		*func;
+	unsigned		pos;
 	int				i;
 
-	for (i = 0; i < progs->numfunctions; i++)
+	for (pos = COM_HashString (fn_name) & pr_functionindex.mask; (i = pr_functionindex.slots[pos]) != 0; pos = (pos + 1) & pr_functionindex.mask)
 	{
-		func = &pr_functions[i];
+		func = &pr_functions[i - 1];
 		if ( !strcmp(PR_GetString(func->s_name), fn_name) )
 			return func;
 	}
@@ -514,7 +862,7 @@ ED_Write
 For savegames
 =============
 */
-void ED_Write (FILE *f, edict_t *ed)
+void ED_Write (strbuf_t *sb, edict_t *ed)
 {
 	ddef_t	*d;
 	int		*v;
@@ -522,11 +870,11 @@ void ED_Write (FILE *f, edict_t *ed)
 	const char	*name;
 	int		type;
 
-	fprintf (f, "{\n");
+	SB_Printf (sb, "{\n");
 
 	if (ed->free)
 	{
-		fprintf (f, "}\n");
+		SB_Printf (sb, "}\n");
 		return;
 	}
 
@@ -550,16 +898,16 @@ void ED_Write (FILE *f, edict_t *ed)
 		if (j == type_size[type])
 			continue;
 
-		fprintf (f, "\"%s\" ", name);
-		fprintf (f, "\"%s\"\n", PR_UglyValueString(d->type, (eval_t *)v));
+		SB_Printf (sb, "\"%s\" ", name);
+		SB_Printf (sb, "\"%s\"\n", PR_UglyValueString(d->type, (eval_t *)v));
 	}
 
 	//johnfitz -- save entity alpha manually when progs.dat doesn't know about alpha
 	if (!pr_alpha_supported && ed->alpha != ENTALPHA_DEFAULT)
-		fprintf (f, "\"alpha\" \"%f\"\n", ENTALPHA_TOSAVE(ed->alpha));
+		SB_Printf (sb, "\"alpha\" \"%f\"\n", ENTALPHA_TOSAVE(ed->alpha));
 	//johnfitz
 
-	fprintf (f, "}\n");
+	SB_Printf (sb, "}\n");
 }
 
 void ED_PrintNum (int ent)
@@ -613,13 +961,14 @@ static void ED_PrintEdict_f (void)
 =============
 ED_Count
 
-For debugging
+For debugging, the rates are since the map started or the last edictcount
 =============
 */
 static void ED_Count (void)
 {
 	edict_t	*ent;
 	int	i, active, models, solid, step;
+	double	elapsed;
 
 	if (!sv.active)
 		return;
@@ -644,6 +993,15 @@ static void ED_Count (void)
 	Con_Printf ("view      :%3i\n", models);
 	Con_Printf ("touch     :%3i\n", solid);
 	Con_Printf ("step      :%3i\n", step);
+
+	elapsed = sv.time - ed_ratestart;
+	if (elapsed > 0)
+	{
+		Con_Printf ("allocs    :%3i (%.1f/s)\n", ed_allocs, ed_allocs / elapsed);
+		Con_Printf ("frees     :%3i (%.1f/s)\n", ed_frees, ed_frees / elapsed);
+	}
+	ed_allocs = ed_frees = 0;
+	ed_ratestart = sv.time;
 }
 
 
@@ -661,14 +1019,14 @@ FIXME: need to tag constants, doesn't really work
 ED_WriteGlobals
 =============
 */
-void ED_WriteGlobals (FILE *f)
+void ED_WriteGlobals (strbuf_t *sb)
 {
 	ddef_t		*def;
 	int			i;
 	const char		*name;
 	int			type;
 
-	fprintf (f, "{\n");
+	SB_Printf (sb, "{\n");
 	for (i = 0; i < progs->numglobaldefs; i++)
 	{
 		def = &pr_globaldefs[i];
@@ -681,10 +1039,101 @@ void ED_WriteGlobals (FILE *f)
 			continue;
 
 		name = PR_GetString(def->s_name);
-		fprintf (f, "\"%s\" ", name);
-		fprintf (f, "\"%s\"\n", PR_UglyValueString(type, (eval_t *)&pr_globals[def->ofs]));
+		SB_Printf (sb, "\"%s\" ", name);
+		SB_Printf (sb, "\"%s\"\n", PR_UglyValueString(type, (eval_t *)&pr_globals[def->ofs]));
+	}
+	SB_Printf (sb, "}\n");
+}
+
+/*
+=============
+ED_ParseToken
+
+Same tokens as COM_Parse, but points token and len into data instead of
+copying into com_token.  Returns NULL at the end of data.
+=============
+*/
+static const char *ED_ParseToken (const char *data, const char **token, int *len)
+{
+	const char	*start;
+	int		c;
+
+	*token = "";
+	*len = 0;
+
+	if (!data)
+		return NULL;
+
+// skip whitespace
+skipwhite:
+	while ((c = *data) <= ' ')
+	{
+		if (c == 0)
+			return NULL;	// end of file
+		data++;
+	}
+
+// skip // comments
+	if (c == '/' && data[1] == '/')
+	{
+		while (*data && *data != '\n')
+			data++;
+		goto skipwhite;
+	}
+
+// skip /*..*/ comments
+	if (c == '/' && data[1] == '*')
+	{
+		data += 2;
+		while (*data && !(*data == '*' && data[1] == '/'))
+			data++;
+		if (*data)
+			data += 2;
+		goto skipwhite;
+	}
+
+// handle quoted strings specially
+	if (c == '\"')
+	{
+		start = ++data;
+		while ((c = *data) != 0 && c != '\"')
+			data++;
+		*token = start;
+		*len = data - start;
+		return c ? data + 1 : data;
+	}
+
+// parse single characters
+	if (c == '{' || c == '}'|| c == '('|| c == ')' || c == '\'' || c == ':')
+	{
+		*token = data;
+		*len = 1;
+		return data + 1;
 	}
-	fprintf (f, "}\n");
+
+// parse a regular word
+	start = data;
+	do
+	{
+		data++;
+		c = *data;
+		if (c == '{' || c == '}'|| c == '('|| c == ')' || c == '\'')
+			break;
+	} while (c > 32);
+
+	*token = start;
+	*len = data - start;
+	return data;
+}
+
+// copies a token into a string, cut to fit, returns the copied length
+static int ED_CopyToken (char *dst, size_t size, const char *token, int len)
+{
+	if ((size_t) len >= size)
+		len = (int) size - 1;
+	memcpy (dst, token, len);
+	dst[len] = 0;
+	return len;
 }
 
 /*
@@ -695,25 +1144,28 @@ ED_ParseGlobals
 const char *ED_ParseGlobals (const char *data)
 {
 	char	keyname[64];
+	char	value[1024];
+	const char	*token;
+	int	len;
 	ddef_t	*key;
 
 	while (1)
 	{
 	// parse key
-		data = COM_Parse (data);
-		if (com_token[0] == '}')
+		data = ED_ParseToken (data, &token, &len);
+		if (len && token[0] == '}')
 			break;
 		if (!data)
 			Host_Error ("ED_ParseEntity: EOF without closing brace");
 
-		q_strlcpy (keyname, com_token, sizeof(keyname));
+		ED_CopyToken (keyname, sizeof(keyname), token, len);
 
 	// parse value
-		data = COM_Parse (data);
+		data = ED_ParseToken (data, &token, &len);
 		if (!data)
 			Host_Error ("ED_ParseEntity: EOF without closing brace");
 
-		if (com_token[0] == '}')
+		if (len && token[0] == '}')
 			Host_Error ("ED_ParseEntity: closing brace without data");
 
 		key = ED_FindGlobal (keyname);
@@ -723,7 +1175,8 @@ const char *ED_ParseGlobals (const char *data)
 			continue;
 		}
 
-		if (!ED_ParseEpair ((void *)pr_globals, key, com_token))
+		ED_CopyToken (value, sizeof(value), token, len);
+		if (!ED_ParseEpair ((void *)pr_globals, key, value))
 			Host_Error ("ED_ParseGlobals: parse error");
 	}
 	return data;
@@ -739,11 +1192,31 @@ ED_NewString
 */
 static string_t ED_NewString (const char *string)
 {
+	char	temp[1024];
 	char	*new_p;
 	int		i, l;
 	string_t	num;
 
 	l = strlen(string) + 1;
+	if (l <= (int) sizeof(temp))
+	{ // unescape, then share the copy with every other edict using the same text
+		new_p = temp;
+		for (i = 0; i < l; i++)
+		{
+			if (string[i] == '\\' && i < l-1)
+			{
+				i++;
+				if (string[i] == 'n')
+					*new_p++ = '\n';
+				else
+					*new_p++ = '\\';
+			}
+			else
+				*new_p++ = string[i];
+		}
+		return PR_InternString (temp);
+	}
+
 	num = PR_AllocString (l, &new_p);
 
 	for (i = 0; i < l; i++)
@@ -864,8 +1337,10 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 {
 	ddef_t		*key;
 	char		keyname[256];
+	char		value[1024];
+	const char	*token;
 	qboolean	anglehack, init;
-	int		n;
+	int		n, len;
 
 	init = false;
 
@@ -877,30 +1352,29 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 	while (1)
 	{
 		// parse key
-		data = COM_Parse (data);
-		if (com_token[0] == '}')
+		data = ED_ParseToken (data, &token, &len);
+		if (len && token[0] == '}')
 			break;
 		if (!data)
 			Host_Error ("ED_ParseEntity: EOF without closing brace");
 
+		n = ED_CopyToken (keyname, sizeof(keyname), token, len);
+
 		// anglehack is to allow QuakeEd to write single scalar angles
 		// and allow them to be turned into vectors. (FIXME...)
-		if (!strcmp(com_token, "angle"))
+		if (!strcmp(keyname, "angle"))
 		{
-			strcpy (com_token, "angles");
+			n = (int) q_strlcpy (keyname, "angles", sizeof(keyname));
 			anglehack = true;
 		}
 		else
 			anglehack = false;
 
 		// FIXME: change light to _light to get rid of this hack
-		if (!strcmp(com_token, "light"))
-			strcpy (com_token, "light_lev");	// hack for single light def
-
-		q_strlcpy (keyname, com_token, sizeof(keyname));
+		if (!strcmp(keyname, "light"))
+			n = (int) q_strlcpy (keyname, "light_lev", sizeof(keyname));	// hack for single light def
 
 		// another hack to fix keynames with trailing spaces
-		n = strlen(keyname);
 		while (n && keyname[n-1] == ' ')
 		{
 			keyname[n-1] = 0;
@@ -908,13 +1382,15 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 		}
 
 		// parse value
-		data = COM_Parse (data);
+		data = ED_ParseToken (data, &token, &len);
 		if (!data)
 			Host_Error ("ED_ParseEntity: EOF without closing brace");
 
-		if (com_token[0] == '}')
+		if (len && token[0] == '}')
 			Host_Error ("ED_ParseEntity: closing brace without data");
 
+		ED_CopyToken (value, sizeof(value), token, len);
+
 		init = true;
 
 		// keynames with a leading underscore are used for utility comments,
@@ -924,7 +1400,7 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 
 		//johnfitz -- hack to support .alpha even when progs.dat doesn't know about it
 		if (!strcmp(keyname, "alpha"))
-			ent->alpha = ENTALPHA_ENCODE(atof(com_token));
+			ent->alpha = ENTALPHA_ENCODE(atof(value));
 		//johnfitz
 
 		key = ED_FindField (keyname);
@@ -939,20 +1415,275 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 		if (anglehack)
 		{
 			char	temp[32];
-			strcpy (temp, com_token);
-			sprintf (com_token, "0 %s 0", temp);
+			q_strlcpy (temp, value, sizeof(temp));
+			q_snprintf (value, sizeof(value), "0 %s 0", temp);
 		}
 
-		if (!ED_ParseEpair ((void *)&ent->v, key, com_token))
+		if (!ED_ParseEpair ((void *)&ent->v, key, value))
 			Host_Error ("ED_ParseEdict: parse error");
 	}
 
 	if (!init)
 		ent->free = true;
+	ED_ClassnameChanged (ent);
+	SV_WakeEdict (ent);
 
 	return data;
 }
 
+/*
+===============================================================================
+
+BINARY IMAGES
+
+The globals and edicts as they are in memory, for binary savegames and
+quicksnap.  Only the same progs.dat can read an image back, so function
+and field numbers and progs strings are stored as they are.  Strings the
+engine made are written out as text and interned again when loading.
+
+===============================================================================
+*/
+
+#define	ED_IMAGE_MAGIC	(('I'<<24) | ('D'<<16) | ('E'<<8) | 'Q')	// also catches another byte order
+
+typedef struct
+{
+	int		magic;
+	int		crc;		// pr_crc
+	int		layout;		// hash of the field names, types and offsets
+	int		numglobals;
+	int		entityfields;
+	int		numedicts;
+	int		numstrings;	// engine strings, written out as text
+	int		stringbytes;
+} edimage_t;
+
+static int	*ed_stringdefs;		// ev_string globals, then fields
+static int	ed_numstringglobals, ed_numstringfields;
+
+static int ED_ImageLayout (void)
+{
+	unsigned	hash;
+	int		i;
+
+	hash = progs->entityfields;
+	for (i = 0; i < progs->numfielddefs; i++)
+	{
+		hash = hash * 31 + COM_HashString (PR_GetString (pr_fielddefs[i].s_name));
+		hash = hash * 31 + pr_fielddefs[i].ofs;
+		hash = hash * 31 + (pr_fielddefs[i].type & ~DEF_SAVEGLOBAL);
+	}
+	return (int) hash;
+}
+
+// finds the globals and fields that hold strings, once per progs
+static void ED_FindStringDefs (void)
+{
+	int	i, n;
+
+	if (ed_stringdefs)
+		return;
+	ed_stringdefs = (int *) Hunk_AllocName ((progs->numglobaldefs + progs->numfielddefs) * sizeof(int), "strdefs");
+	for (i = n = 0; i < progs->numglobaldefs; i++)
+	{
+		if ((pr_globaldefs[i].type & ~DEF_SAVEGLOBAL) == ev_string)
+			ed_stringdefs[n++] = pr_globaldefs[i].ofs;
+	}
+	ed_numstringglobals = n;
+	for (i = 0; i < progs->numfielddefs; i++)
+	{
+		if ((pr_fielddefs[i].type & ~DEF_SAVEGLOBAL) == ev_string)
+			ed_stringdefs[n++] = pr_fielddefs[i].ofs;
+	}
+	ed_numstringfields = n - ed_numstringglobals;
+}
+
+// replaces the engine strings in the count words at base with -1 - their
+// number in the image
+static void ED_ImageStrings (int *base, const int *ofs, int count, int *remap, strbuf_t *text, int *numstrings)
+{
+	int	i, num;
+
+	for (i = 0; i < count; i++)
+	{
+		num = base[ofs[i]];
+		if (num >= 0)
+			continue;	// in the progs strings
+		if (!PR_StringValid (num))
+		{
+			base[ofs[i]] = 0;
+			continue;
+		}
+		if (!remap[-1 - num])
+		{
+			SB_Write (text, PR_GetString (num), strlen (PR_GetString (num)) + 1);
+			remap[-1 - num] = ++*numstrings;
+		}
+		base[ofs[i]] = -remap[-1 - num];
+	}
+}
+
+// and back, to the strings interned when loading
+static void ED_FixImageStrings (int *base, const int *ofs, int count, const int *strings, int numstrings)
+{
+	int	i, num;
+
+	for (i = 0; i < count; i++)
+	{
+		num = base[ofs[i]];
+		if (num < 0)
+			base[ofs[i]] = (-num <= numstrings) ? strings[-1 - num] : 0;
+	}
+}
+
+/*
+=============
+ED_WriteImage
+
+Appends the globals and sv.num_edicts edicts to sb.
+=============
+*/
+void ED_WriteImage (strbuf_t *sb)
+{
+	static strbuf_t	text, body;
+	edimage_t	header;
+	int		*remap, *v, i;
+	edict_t		*ed;
+	byte		flags[4];	// keeps the fields aligned in body
+
+	ED_FindStringDefs ();
+	remap = (int *) calloc (pr_numknownstrings + 1, sizeof(int));
+	if (!remap)
+		Sys_Error ("ED_WriteImage: out of memory");
+	SB_Clear (&text);
+	SB_Clear (&body);
+
+	header.magic = ED_IMAGE_MAGIC;
+	header.crc = pr_crc;
+	header.layout = ED_ImageLayout ();
+	header.numglobals = progs->numglobals;
+	header.entityfields = progs->entityfields;
+	header.numedicts = sv.num_edicts;
+	header.numstrings = 0;
+
+	SB_Write (&body, pr_globals, progs->numglobals * 4);
+	ED_ImageStrings ((int *)body.data, ed_stringdefs, ed_numstringglobals, remap, &text, &header.numstrings);
+
+	for (i = 0; i < sv.num_edicts; i++)
+	{
+		ed = EDICT_NUM(i);
+		flags[0] = ed->free;
+		flags[1] = ed->alpha;
+		flags[2] = flags[3] = 0;
+		SB_Write (&body, flags, 4);
+		if (ed->free)
+			continue;
+		SB_Write (&body, &ed->v, progs->entityfields * 4);
+		v = (int *)(body.data + body.len - progs->entityfields * 4);
+		ED_ImageStrings (v, ed_stringdefs + ed_numstringglobals, ed_numstringfields, remap, &text, &header.numstrings);
+	}
+	free (remap);
+
+	header.stringbytes = text.len;
+	SB_Write (sb, &header, sizeof(header));
+	SB_Write (sb, text.data, text.len);
+	SB_Write (sb, body.data, body.len);
+}
+
+/*
+=============
+ED_ReadImage
+
+Loads an image made by ED_WriteImage into the globals and edicts of the
+freshly spawned server.  Returns the number of bytes read, sets
+sv.num_edicts and links the edicts into the world.
+=============
+*/
+int ED_ReadImage (const byte *data, int len)
+{
+	edimage_t	header;
+	const byte	*p, *end;
+	const char	*s;
+	int		*strings, *v, i, entnum, size;
+	edict_t		*ent;
+
+	end = data + len;
+	if (len < (int) sizeof(header))
+		Host_Error ("ED_ReadImage: truncated savegame");
+	memcpy (&header, data, sizeof(header));
+	if (header.magic != ED_IMAGE_MAGIC)
+		Host_Error ("ED_ReadImage: not a savegame image");
+	if (header.crc != pr_crc || header.layout != ED_ImageLayout () ||
+	    header.numglobals != progs->numglobals || header.entityfields != progs->entityfields)
+		Host_Error ("Savegame was made with a different progs.dat");
+	if (header.numedicts < 1 || header.numedicts > sv.max_edicts)
+		Host_Error ("ED_ReadImage: %i edicts, max is %i", header.numedicts, sv.max_edicts);
+	if (header.numstrings < 0 || header.stringbytes < 0 || header.stringbytes > end - data - (int) sizeof(header))
+		Host_Error ("ED_ReadImage: truncated savegame");
+
+	// intern the engine strings again
+	ED_FindStringDefs ();
+	strings = (int *) malloc ((header.numstrings + 1) * sizeof(int));
+	if (!strings)
+		Sys_Error ("ED_ReadImage: out of memory");
+	p = data + sizeof(header);
+	s = (const char *) p;
+	for (i = 0; i < header.numstrings; i++)
+	{
+		if (!memchr (s, 0, (const char *) p + header.stringbytes - s))
+			Host_Error ("ED_ReadImage: bad string table");
+		strings[i] = PR_InternString (s);
+		s += strlen (s) + 1;
+	}
+	p += header.stringbytes;
+
+	size = progs->numglobals * 4;
+	if (end - p < size)
+		Host_Error ("ED_ReadImage: truncated savegame");
+	memcpy (pr_globals, p, size);
+	p += size;
+	ED_FixImageStrings ((int *)pr_globals, ed_stringdefs, ed_numstringglobals, strings, header.numstrings);
+
+	size = progs->entityfields * 4;
+	for (entnum = 0; entnum < header.numedicts; entnum++)
+	{
+		if (end - p < 4)
+			Host_Error ("ED_ReadImage: truncated savegame");
+
+		// same as the text loader
+		ent = EDICT_NUM(entnum);
+		if (entnum < sv.num_edicts)
+		{
+			ent->free = false;
+			memset (&ent->v, 0, size);
+		}
+		else
+			memset (ent, 0, pr_edict_size);
+		ent->alpha = p[1];
+		if (p[0])
+			ent->free = true;
+		else
+		{
+			if (end - p < 4 + size)
+				Host_Error ("ED_ReadImage: truncated savegame");
+			memcpy (&ent->v, p + 4, size);
+			v = (int *)&ent->v;
+			ED_FixImageStrings (v, ed_stringdefs + ed_numstringglobals, ed_numstringfields, strings, header.numstrings);
+			p += size;
+		}
+		p += 4;
+
+		ED_ClassnameChanged (ent);
+		SV_WakeEdict (ent);
+		if (!ent->free)
+			SV_LinkEdict (ent, false);
+	}
+	free (strings);
+
+	sv.num_edicts = header.numedicts;
+	return p - data;
+}
+
 
 /*
 ================
@@ -974,7 +1705,10 @@ void ED_LoadFromFile (const char *data)
 	dfunction_t	*func;
 	edict_t		*ent = NULL;
 	int		inhibit = 0;
+	int		count = 0;
+	double		start, parsestart, parsetime = 0;
 
+	start = Sys_DoubleTime ();
 	pr_global_struct->time = sv.time;
 
 	// parse ents
@@ -991,7 +1725,10 @@ void ED_LoadFromFile (const char *data)
 			ent = EDICT_NUM(0);
 		else
 			ent = ED_Alloc ();
+		parsestart = Sys_DoubleTime ();
 		data = ED_ParseEdict (data, ent);
+		parsetime += Sys_DoubleTime () - parsestart;
+		count++;
 
 		// remove things from different skill levels or deathmatch
 		if (deathmatch.value)
@@ -1039,6 +1776,8 @@ void ED_LoadFromFile (const char *data)
 	}
 
 	Con_DPrintf ("%i entities inhibited\n", inhibit);
+	Con_DPrintf ("%i entities loaded in %.1f ms, %.1f ms parsing\n", count,
+			(Sys_DoubleTime () - start) * 1000.0, parsetime * 1000.0);
 }
 
 
@@ -1129,6 +1868,210 @@ static void PR_PatchRereleaseBuiltins (void)
 }
 
 
+/*
+====================
+PR_GlobalIsConstant
+
+A global nothing can write to: it's not a system global, parm or local,
+isn't restored from savegames and no statement stores to it.
+====================
+*/
+static qboolean PR_GlobalIsConstant (const byte *written, int ofs)
+{
+	return ofs >= (int)(sizeof(globalvars_t) / 4) && ofs < progs->numglobals && !written[ofs];
+}
+
+static void PR_MarkWritten (byte *written, int ofs, int size)
+{
+	for ( ; size > 0; size--, ofs++)
+	{
+		if (ofs >= 0 && ofs < progs->numglobals)
+			written[ofs] = 1;
+	}
+}
+
+static qboolean PR_IsBranchTarget (const byte *target, int i)
+{
+	return i >= progs->numstatements || target[i];
+}
+
+/*
+====================
+PR_TranslateProgs
+
+Builds pr_code from pr_statements: operands become pointers into
+pr_globals, branches on constants are resolved and some common sequences
+are fused into one instruction.
+====================
+*/
+static void PR_TranslateProgs (void)
+{
+	dstatement_t	*s;
+	prinstr_t	*in;
+	dfunction_t	*f;
+	ddef_t		*def;
+	byte		*written, *target;
+	int		i, n, numfolded, numfused;
+
+	n = progs->numstatements;
+	pr_code = (prinstr_t *) Hunk_AllocName (n * sizeof(prinstr_t), "progcode");
+
+	written = (byte *) Hunk_TempAlloc (progs->numglobals + n);
+	target = written + progs->numglobals;
+	memset (written, 0, progs->numglobals + n);
+
+	// find out which globals can change and where branches land
+	for (i = 0, f = pr_functions; i < progs->numfunctions; i++, f++)
+	{
+		PR_MarkWritten (written, f->parm_start, f->locals);
+		if (f->first_statement >= 0 && f->first_statement < n)
+			target[f->first_statement] = 1;
+	}
+	for (i = 0, def = pr_globaldefs; i < progs->numglobaldefs; i++, def++)
+	{
+		if (def->type & DEF_SAVEGLOBAL)
+			PR_MarkWritten (written, def->ofs, (def->type & ~DEF_SAVEGLOBAL) == ev_vector ? 3 : 1);
+	}
+	for (i = 0, s = pr_statements; i < n; i++, s++)
+	{
+		switch (s->op)
+		{
+		case OP_IF:
+		case OP_IFNOT:
+			if (i + s->b >= 0 && i + s->b < n)
+				target[i + s->b] = 1;
+			break;
+		case OP_GOTO:
+			if (i + s->a >= 0 && i + s->a < n)
+				target[i + s->a] = 1;
+			break;
+		case OP_STORE_V:
+			PR_MarkWritten (written, (unsigned short)s->b, 3);
+			break;
+		case OP_STORE_F:
+		case OP_STORE_ENT:
+		case OP_STORE_FLD:
+		case OP_STORE_S:
+		case OP_STORE_FNC:
+			PR_MarkWritten (written, (unsigned short)s->b, 1);
+			break;
+		case OP_ADD_V:
+		case OP_SUB_V:
+		case OP_MUL_FV:
+		case OP_MUL_VF:
+		case OP_LOAD_V:
+			PR_MarkWritten (written, (unsigned short)s->c, 3);
+			break;
+		case OP_DONE:
+		case OP_RETURN:
+		case OP_STATE:
+		case OP_STOREP_F:
+		case OP_STOREP_V:
+		case OP_STOREP_S:
+		case OP_STOREP_ENT:
+		case OP_STOREP_FLD:
+		case OP_STOREP_FNC:
+		case OP_CALL0:
+		case OP_CALL1:
+		case OP_CALL2:
+		case OP_CALL3:
+		case OP_CALL4:
+		case OP_CALL5:
+		case OP_CALL6:
+		case OP_CALL7:
+		case OP_CALL8:
+			break;	// write no globals, or only system ones
+		default:
+			PR_MarkWritten (written, (unsigned short)s->c, 1);
+			break;
+		}
+	}
+
+	numfolded = numfused = 0;
+	for (i = 0, s = pr_statements, in = pr_code; i < n; i++, s++, in++)
+	{
+		in->op = s->op;
+		in->a = (eval_t *)&pr_globals[(unsigned short)s->a];
+		in->b = (eval_t *)&pr_globals[(unsigned short)s->b];
+		in->c = (eval_t *)&pr_globals[(unsigned short)s->c];
+		in->jump = 0;
+
+		if (s->op == OP_GOTO)
+		{
+			in->a = in->b = in->c = (eval_t *)pr_globals;
+			in->jump = s->a;
+		}
+		else if (s->op == OP_IF || s->op == OP_IFNOT)
+		{
+			in->b = in->c = (eval_t *)pr_globals;
+			in->jump = s->b;
+			if (PR_GlobalIsConstant (written, (unsigned short)s->a))
+			{
+				if (!in->a->_int == (s->op == OP_IFNOT))
+					in->op = OP_GOTO;
+				else
+					in->op = OPX_NOP;
+				numfolded++;
+			}
+		}
+	}
+
+	for (i = 0, s = pr_statements, in = pr_code; i < n - 1; i++, s++, in++)
+	{
+		if (PR_IsBranchTarget (target, i + 1))
+			continue;
+
+		if (in->op == OP_LOAD_F && !PR_IsBranchTarget (target, i + 2) &&
+			s[1].op == OP_EQ_F && (s[1].a == s->c || s[1].b == s->c) &&
+			in[2].op == OP_IFNOT && s[2].a == s[1].c)
+		{
+			in->op = OPX_LOAD_F_EQ_F_IFNOT;
+			numfused++;
+			i++, s++, in++;	// the EQ_F is part of this one
+			continue;
+		}
+
+		if (in[1].op == OP_IFNOT && s[1].a == s->c)
+		{
+			switch (in->op)
+			{
+			case OP_EQ_F:	in->op = OPX_EQ_F_IFNOT; break;
+			case OP_NE_F:	in->op = OPX_NE_F_IFNOT; break;
+			case OP_LT:	in->op = OPX_LT_IFNOT; break;
+			case OP_LE:	in->op = OPX_LE_IFNOT; break;
+			case OP_GT:	in->op = OPX_GT_IFNOT; break;
+			case OP_GE:	in->op = OPX_GE_IFNOT; break;
+			}
+			if (in->op >= OP_NUMOPS)
+			{
+				numfused++;
+				continue;
+			}
+		}
+
+		if (in->op == OP_ADDRESS && s[1].b == s->c)
+		{
+			switch (in[1].op)
+			{
+			case OP_STOREP_F:
+			case OP_STOREP_ENT:
+			case OP_STOREP_FLD:
+			case OP_STOREP_S:
+			case OP_STOREP_FNC:
+				in->op = OPX_ADDRESS_STOREP;
+				numfused++;
+				break;
+			case OP_STOREP_V:
+				in->op = OPX_ADDRESS_STOREP_V;
+				numfused++;
+				break;
+			}
+		}
+	}
+
+	Con_DPrintf ("Progs: %i statements, %i fused, %i constant branches\n", n, numfused, numfolded);
+}
+
 /*
 ===============
 PR_LoadProgs
@@ -1144,6 +2087,8 @@ void PR_LoadProgs (void)
 
 	CRC_Init (&pr_crc);
 
+	ED_ResetClassnames ();
+
 	progs = (dprograms_t *)COM_LoadHunkFile ("progs.dat", NULL);
 	if (!progs)
 		Host_Error ("PR_LoadProgs: couldn't load progs.dat");
@@ -1173,6 +2118,8 @@ void PR_LoadProgs (void)
 	if (pr_knownstrings)
 		Z_Free ((void *)pr_knownstrings);
 	pr_knownstrings = NULL;
+	PR_ResetStringIndex ();
+	ed_stringdefs = NULL;	// was on the hunk
 	PR_SetEngineString("");
 
 	pr_globaldefs = (ddef_t *)((byte *)progs + progs->ofs_globaldefs);
@@ -1189,6 +2136,8 @@ void PR_LoadProgs (void)
 		pr_statements[i].a = LittleShort(pr_statements[i].a);
 		pr_statements[i].b = LittleShort(pr_statements[i].b);
 		pr_statements[i].c = LittleShort(pr_statements[i].c);
+		if (pr_statements[i].op >= OP_NUMOPS)	// the interpreter doesn't check them
+			Host_Error ("PR_LoadProgs: bad opcode %i in statement %i", pr_statements[i].op, i);
 	}
 
 	for (i = 0; i < progs->numfunctions; i++)
@@ -1228,17 +2177,90 @@ void PR_LoadProgs (void)
 		((int *)pr_globals)[i] = LittleLong (((int *)pr_globals)[i]);
 
 	pr_edict_size = progs->entityfields * 4 + sizeof(edict_t) - sizeof(entvars_t);
-	// round off to next highest whole word address (esp for Alpha)
-	// this ensures that pointers in the engine data area are always
-	// properly aligned
-	pr_edict_size += sizeof(void *) - 1;
-	pr_edict_size &= ~(sizeof(void *) - 1);
+	// round off to a whole cache line, which also keeps the pointers in
+	// the engine data area properly aligned (esp for Alpha)
+	pr_edict_size += EDICT_ALIGN - 1;
+	pr_edict_size &= ~(EDICT_ALIGN - 1);
+
+	PR_BuildNameIndex ();
 
 	PR_PatchRereleaseBuiltins ();
 	pr_effects_mask = PR_FindSupportedEffects ();
+
+	PR_TranslateProgs ();
+	PR_JitCompile ();
 }
 
 
+/*
+=============
+PR_Bench_f
+
+Calls a QuakeC function a number of times and reports the time it took.
+The function runs with self and other set to world, so only use it on
+code that doesn't mind.
+=============
+*/
+static void PR_Bench_f (void)
+{
+	dfunction_t	*f;
+	int		i, count, statements;
+	double		start, elapsed;
+
+	if (!sv.active)
+		return;
+
+	if (Cmd_Argc () < 2)
+	{
+		Con_Printf ("usage: pr_bench <function> [count]\n");
+		return;
+	}
+
+	f = ED_FindFunction (Cmd_Argv (1));
+	if (!f)
+	{
+		Con_Printf ("pr_bench: no function %s\n", Cmd_Argv (1));
+		return;
+	}
+	if (f->first_statement < 0)
+	{
+		Con_Printf ("pr_bench: %s is a builtin\n", Cmd_Argv (1));
+		return;
+	}
+
+	count = (Cmd_Argc () > 2) ? Q_atoi (Cmd_Argv (2)) : 1000;
+	if (count < 1)
+		count = 1;
+
+	statements = 0;
+	for (i = 0; i < progs->numfunctions; i++)
+	{
+		if (pr_functions[i].first_statement >= 0)	// builtins count calls
+			statements -= pr_functions[i].profile;
+	}
+
+	start = Sys_DoubleTime ();
+	for (i = 0; i < count; i++)
+	{
+		pr_global_struct->self = EDICT_TO_PROG(sv.edicts);
+		pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
+		pr_global_struct->time = sv.time;
+		PR_ExecuteProgram (f - pr_functions);
+	}
+	elapsed = Sys_DoubleTime () - start;
+
+	for (i = 0; i < progs->numfunctions; i++)
+	{
+		if (pr_functions[i].first_statement >= 0)
+			statements += pr_functions[i].profile;
+	}
+
+	Con_Printf ("%s: %i calls, %.0f ns/op", Cmd_Argv (1), count, elapsed * 1e9 / count);
+	if (statements > 0)
+		Con_Printf (", %i statements/op, %.1f ns/statement", statements / count, elapsed * 1e9 / statements);
+	Con_Printf ("\n");
+}
+
 /*
 ===============
 PR_Init
@@ -1249,7 +2271,11 @@ void PR_Init (void)
 	Cmd_AddCommand ("edict", ED_PrintEdict_f);
 	Cmd_AddCommand ("edicts", ED_PrintEdicts);
 	Cmd_AddCommand ("edictcount", ED_Count);
+	Cmd_AddCommand ("pr_strings", PR_Strings_f);
 	Cmd_AddCommand ("profile", PR_Profile_f);
+	Cmd_AddCommand ("pr_bench", PR_Bench_f);
+	Cmd_AddCommand ("prof_start", PR_ProfStart_f);
+	Cmd_AddCommand ("prof_stop", PR_ProfStop_f);
 	Cvar_RegisterVariable (&nomonsters);
 	Cvar_RegisterVariable (&gamecfg);
 	Cvar_RegisterVariable (&scratch1);
@@ -1261,6 +2287,7 @@ void PR_Init (void)
 	Cvar_RegisterVariable (&saved2);
 	Cvar_RegisterVariable (&saved3);
 	Cvar_RegisterVariable (&saved4);
+	PR_JitInit ();
 }
 
 
@@ -1288,6 +2315,145 @@ int NUM_FOR_EDICT(edict_t *e)
 
 #define	PR_STRING_ALLOCSLOTS	256
 
+/*
+===============================================================================
+
+KNOWN STRING INDEX
+
+Known strings are hashed twice: by address for PR_SetEngineString, which
+used to scan the whole list, and by text for the strings interned by
+PR_InternString, so 2000 edicts with the same classname share one copy.
+Interned strings must never be written to; progs can't, and the engine
+only fills PR_AllocString buffers it allocated for itself.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	int		*slots;		// known string number + 1, 0 = empty
+	int		size;		// power of two
+	int		count;
+	qboolean	bytext;
+} prstringindex_t;
+
+static prstringindex_t	pr_stringsbyaddr = {NULL, 0, 0, false};
+static prstringindex_t	pr_stringsbytext = {NULL, 0, 0, true};
+
+static int	pr_interncalls, pr_internbytes, pr_internsaved;
+
+static unsigned PR_StringKey (prstringindex_t *index, const char *s)
+{
+	uintptr_t	addr;
+
+	if (index->bytext)
+		return COM_HashString (s);
+
+	addr = (uintptr_t) s;
+	return (unsigned) (addr ^ (addr >> 16)) * 2654435761u;
+}
+
+// returns the slot holding s, or the empty slot where it belongs
+static int PR_FindStringSlot (prstringindex_t *index, const char *s)
+{
+	unsigned	pos, mask;
+	const char	*known;
+	int		i;
+
+	mask = index->size - 1;
+	for (pos = PR_StringKey (index, s) & mask; (i = index->slots[pos]) != 0; pos = (pos + 1) & mask)
+	{
+		known = pr_knownstrings[i - 1];
+		if (index->bytext ? !strcmp (known, s) : known == s)
+			break;
+	}
+	return pos;
+}
+
+static void PR_IndexString (prstringindex_t *index, int num)
+{
+	int	*oldslots, oldsize, i;
+
+	if ((index->count + 1) * 2 > index->size)
+	{
+		oldslots = index->slots;
+		oldsize = index->size;
+		index->size = oldsize ? oldsize * 2 : 1024;
+		index->slots = (int *) Z_Malloc (index->size * sizeof(int));
+		for (i = 0; i < oldsize; i++)
+		{
+			if (oldslots[i])
+				index->slots[PR_FindStringSlot (index, pr_knownstrings[oldslots[i] - 1])] = oldslots[i];
+		}
+		if (oldslots)
+			Z_Free (oldslots);
+	}
+
+	index->slots[PR_FindStringSlot (index, pr_knownstrings[num])] = num + 1;
+	index->count++;
+}
+
+static void PR_ClearStringIndex (prstringindex_t *index)
+{
+	if (index->slots)
+		Z_Free (index->slots);
+	index->slots = NULL;
+	index->size = index->count = 0;
+}
+
+static void PR_ResetStringIndex (void)
+{
+	PR_ClearStringIndex (&pr_stringsbyaddr);
+	PR_ClearStringIndex (&pr_stringsbytext);
+	pr_interncalls = pr_internbytes = pr_internsaved = 0;
+}
+
+/*
+=============
+PR_InternString
+
+Returns a known string with the text of s, allocating one only for text
+that wasn't interned yet.
+=============
+*/
+static string_t PR_InternString (const char *s)
+{
+	string_t	num;
+	char		*p;
+	int		l, slot;
+
+	l = strlen (s) + 1;
+	pr_interncalls++;
+	pr_internbytes += l;
+
+	if (pr_stringsbytext.size)
+	{
+		slot = PR_FindStringSlot (&pr_stringsbytext, s);
+		if (pr_stringsbytext.slots[slot])
+		{
+			pr_internsaved += l;
+			return -pr_stringsbytext.slots[slot];	// -1 - (slot value - 1)
+		}
+	}
+
+	num = PR_AllocString (l, &p);
+	memcpy (p, s, l);
+	PR_IndexString (&pr_stringsbytext, -1 - num);
+	return num;
+}
+
+/*
+=============
+PR_Strings_f
+=============
+*/
+static void PR_Strings_f (void)
+{
+	Con_Printf ("%i known strings, %i interned\n", pr_numknownstrings, pr_stringsbytext.count);
+	Con_Printf ("%i edict strings parsed, %i bytes, %i bytes saved by sharing\n",
+			pr_interncalls, pr_internbytes, pr_internsaved);
+}
+
 static void PR_AllocStringSlots (void)
 {
 	pr_maxknownstrings += PR_STRING_ALLOCSLOTS;
@@ -1315,6 +2481,14 @@ const char *PR_GetString (int num)
 	}
 }
 
+// whether PR_GetString would take num without an error
+qboolean PR_StringValid (int num)
+{
+	if (num >= 0)
+		return num < pr_stringssize;
+	return num >= -pr_numknownstrings && pr_knownstrings[-1 - num];
+}
+
 int PR_SetEngineString (const char *s)
 {
 	int		i;
@@ -1328,27 +2502,20 @@ int PR_SetEngineString (const char *s)
 	if (s >= pr_strings && s <= pr_strings + pr_stringssize - 2)
 		return (int)(s - pr_strings);
 #endif
-	for (i = 0; i < pr_numknownstrings; i++)
+	if (pr_stringsbyaddr.size)
 	{
-		if (pr_knownstrings[i] == s)
-			return -1 - i;
+		i = pr_stringsbyaddr.slots[PR_FindStringSlot (&pr_stringsbyaddr, s)];
+		if (i)
+			return -i;
 	}
 	// new unknown engine string
 	//Con_DPrintf ("PR_SetEngineString: new engine string %p\n", s);
-#if 0
-	for (i = 0; i < pr_numknownstrings; i++)
-	{
-		if (!pr_knownstrings[i])
-			break;
-	}
-#endif
-//	if (i >= pr_numknownstrings)
-//	{
-		if (i >= pr_maxknownstrings)
-			PR_AllocStringSlots();
-		pr_numknownstrings++;
-//	}
+	i = pr_numknownstrings;	// slots are never freed
+	if (i >= pr_maxknownstrings)
+		PR_AllocStringSlots();
+	pr_numknownstrings++;
 	pr_knownstrings[i] = s;
+	PR_IndexString (&pr_stringsbyaddr, i);
 	return -1 - i;
 }
 
@@ -1358,18 +2525,12 @@ int PR_AllocString (int size, char **ptr)
 
 	if (!size)
 		return 0;
-	for (i = 0; i < pr_numknownstrings; i++)
-	{
-		if (!pr_knownstrings[i])
-			break;
-	}
-//	if (i >= pr_numknownstrings)
-//	{
-		if (i >= pr_maxknownstrings)
-			PR_AllocStringSlots();
-		pr_numknownstrings++;
-//	}
+	i = pr_numknownstrings;	// slots are never freed
+	if (i >= pr_maxknownstrings)
+		PR_AllocStringSlots();
+	pr_numknownstrings++;
 	pr_knownstrings[i] = (char *)Hunk_AllocName(size, "string");
+	PR_IndexString (&pr_stringsbyaddr, i);
 	if (ptr)
 		*ptr = (char *) pr_knownstrings[i];
 	return -1 - i;
@@ -215,35 +215,340 @@ PR_Profile_f
 */
 void PR_Profile_f (void)
 {
-	int		i, num;
+	int		i, num, builtins;
 	int		pmax;
 	dfunction_t	*f, *best;
 
 	if (!sv.active)
 		return;
 
-	num = 0;
-	do
+	for (builtins = 0; builtins < 2; builtins++)
 	{
-		pmax = 0;
-		best = NULL;
-		for (i = 0; i < progs->numfunctions; i++)
+		if (builtins)
+			Con_Printf("builtin calls:\n");
+		num = 0;
+		do
 		{
-			f = &pr_functions[i];
-			if (f->profile > pmax)
+			pmax = 0;
+			best = NULL;
+			for (i = 0; i < progs->numfunctions; i++)
+			{
+				f = &pr_functions[i];
+				if ((f->first_statement < 0) != builtins)
+					continue;
+				if (f->profile > pmax)
+				{
+					pmax = f->profile;
+					best = f;
+				}
+			}
+			if (best)
 			{
-				pmax = f->profile;
-				best = f;
+				if (num < 10)
+					Con_Printf("%7i %s\n", best->profile, PR_GetString(best->s_name));
+				num++;
+				best->profile = 0;
 			}
+		} while (best);
+	}
+}
+
+
+/*
+===============================================================================
+
+TRACING PROFILER
+
+prof_start begins timing every QuakeC function and builtin call, prof_stop
+writes <name>.folded (collapsed stacks with exclusive microseconds, for
+flamegraph.pl) and <name>.json (Chrome trace events) to the game dir.
+Calls are aggregated into a call tree as they happen, the trace file is
+written as calls return.
+
+===============================================================================
+*/
+
+#define	MAX_PROF_NODES		65536
+#define	MAX_PROF_DEPTH		(MAX_STACK_DEPTH * 2 + 2)	// a builtin frame for every QuakeC one
+#define	MAX_PROF_EVENTS		1000000
+
+typedef struct
+{
+	int		func;			// pr_functions index, -1 for the root
+	int		parent, child, sibling;	// node numbers, 0 = none past the root
+	int		calls;
+	double		self;
+} profnode_t;
+
+typedef struct
+{
+	int		node;
+	double		start;
+	double		children;
+} profframe_t;
+
+typedef struct
+{
+	int		calls;
+	double		self, total;
+} proffunc_t;
+
+static qboolean		prof_active;
+static char		prof_name[MAX_OSPATH];
+static double		prof_starttime;
+static profnode_t	*prof_nodes;
+static int		prof_numnodes;
+static qboolean		prof_nodesfull;
+static proffunc_t	*prof_funcs;
+static profframe_t	prof_stack[MAX_PROF_DEPTH];
+static int		prof_depth;
+static FILE		*prof_trace;
+static int		prof_numevents;
+
+static int PR_ProfChild (int parent, int func)
+{
+	profnode_t	*n;
+	int		i;
+
+	for (i = prof_nodes[parent].child; i; i = prof_nodes[i].sibling)
+	{
+		if (prof_nodes[i].func == func)
+			return i;
+	}
+
+	if (prof_numnodes == MAX_PROF_NODES)
+	{
+		prof_nodesfull = true;
+		return parent;	// charge it to the caller
+	}
+
+	i = prof_numnodes++;
+	n = &prof_nodes[i];
+	n->func = func;
+	n->parent = parent;
+	n->child = 0;
+	n->sibling = prof_nodes[parent].child;
+	n->calls = 0;
+	n->self = 0;
+	prof_nodes[parent].child = i;
+	return i;
+}
+
+static void PR_ProfEnter (dfunction_t *f)
+{
+	profframe_t	*fr;
+	int		parent;
+
+	if (prof_depth >= MAX_PROF_DEPTH)
+	{
+		prof_depth++;	// too deep, just keep the count
+		return;
+	}
+
+	parent = prof_depth ? prof_stack[prof_depth - 1].node : 0;
+	fr = &prof_stack[prof_depth++];
+	fr->node = PR_ProfChild (parent, f - pr_functions);
+	fr->children = 0;
+	fr->start = Sys_DoubleTime ();
+}
+
+static void PR_ProfLeave (void)
+{
+	profframe_t	*fr;
+	proffunc_t	*pf;
+	profnode_t	*n;
+	double		now, total;
+
+	if (!prof_depth)
+		return;
+	if (--prof_depth >= MAX_PROF_DEPTH)
+		return;
+
+	now = Sys_DoubleTime ();
+	fr = &prof_stack[prof_depth];
+	total = now - fr->start;
+	if (prof_depth)
+		prof_stack[prof_depth - 1].children += total;
+
+	n = &prof_nodes[fr->node];
+	n->calls++;
+	n->self += total - fr->children;
+
+	if (n->func >= 0)
+	{
+		pf = &prof_funcs[n->func];
+		pf->calls++;
+		pf->self += total - fr->children;
+		pf->total += total;	// recursive calls are counted at every level
+
+		if (prof_trace && prof_numevents < MAX_PROF_EVENTS)
+		{
+			fprintf (prof_trace, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+				prof_numevents ? ",\n" : "",
+				PR_GetString (pr_functions[n->func].s_name),
+				pr_functions[n->func].first_statement < 0 ? "builtin" : "qc",
+				(fr->start - prof_starttime) * 1e6, total * 1e6);
+			prof_numevents++;
 		}
-		if (best)
+	}
+}
+
+/*
+============
+PR_ProfWritePath
+
+Writes the ;-separated function names from the root down to node
+============
+*/
+static void PR_ProfWritePath (FILE *f, int node)
+{
+	if (prof_nodes[node].parent)
+	{
+		PR_ProfWritePath (f, prof_nodes[node].parent);
+		fputc (';', f);
+	}
+	fputs (PR_GetString (pr_functions[prof_nodes[node].func].s_name), f);
+}
+
+/*
+============
+PR_StopProfiling
+
+Writes out the results, called before progs go away
+============
+*/
+void PR_StopProfiling (void)
+{
+	char		path[MAX_OSPATH];
+	FILE		*f;
+	proffunc_t	*pf, *best;
+	int		i, num, value;
+
+	if (!prof_active)
+		return;
+	prof_active = false;
+
+	if (prof_trace)
+	{
+		fprintf (prof_trace, "\n]}\n");
+		fclose (prof_trace);
+		prof_trace = NULL;
+	}
+
+	q_snprintf (path, sizeof(path), "%s/%s.folded", com_gamedir, prof_name);
+	f = fopen (path, "w");
+	if (f)
+	{
+		for (i = 1; i < prof_numnodes; i++)
+		{
+			value = (int)(prof_nodes[i].self * 1e6 + 0.5);
+			if (value <= 0)
+				continue;
+			PR_ProfWritePath (f, i);
+			fprintf (f, " %i\n", value);
+		}
+		fclose (f);
+		Con_Printf ("Wrote %s\n", path);
+	}
+	else
+		Con_Printf ("Couldn't write %s\n", path);
+
+	if (prof_numevents)
+		Con_Printf ("Wrote %s/%s.json, %i calls%s\n", com_gamedir, prof_name, prof_numevents,
+			prof_numevents == MAX_PROF_EVENTS ? " (truncated)" : "");
+	if (prof_nodesfull)
+		Con_Printf ("Call tree was full, deeper calls were charged to their callers\n");
+
+	Con_Printf ("%8s %10s %10s  %s\n", "calls", "self ms", "total ms", "function");
+	for (num = 0; num < 20; num++)
+	{
+		best = NULL;
+		for (i = 0; i < progs->numfunctions; i++)
 		{
-			if (num < 10)
-				Con_Printf("%7i %s\n", best->profile, PR_GetString(best->s_name));
-			num++;
-			best->profile = 0;
+			pf = &prof_funcs[i];
+			if (pf->calls && (!best || pf->self > best->self))
+				best = pf;
 		}
-	} while (best);
+		if (!best)
+			break;
+		Con_Printf ("%8i %10.3f %10.3f  %s%s\n", best->calls, best->self * 1000, best->total * 1000,
+			PR_GetString (pr_functions[best - prof_funcs].s_name),
+			pr_functions[best - prof_funcs].first_statement < 0 ? " (builtin)" : "");
+		best->calls = 0;
+	}
+
+	free (prof_nodes);
+	prof_nodes = NULL;
+	free (prof_funcs);
+	prof_funcs = NULL;
+}
+
+/*
+============
+PR_ProfStart_f
+============
+*/
+void PR_ProfStart_f (void)
+{
+	char	path[MAX_OSPATH];
+
+	if (!sv.active)
+	{
+		Con_Printf ("prof_start: no server running\n");
+		return;
+	}
+	if (prof_active)
+	{
+		Con_Printf ("prof_start: already profiling\n");
+		return;
+	}
+
+	q_strlcpy (prof_name, (Cmd_Argc () > 1) ? Cmd_Argv (1) : "qcprof", sizeof(prof_name));
+	COM_StripExtension (prof_name, prof_name, sizeof(prof_name));
+
+	prof_nodes = (profnode_t *) malloc (MAX_PROF_NODES * sizeof(profnode_t));
+	prof_funcs = (proffunc_t *) calloc (progs->numfunctions, sizeof(proffunc_t));
+	if (!prof_nodes || !prof_funcs)
+	{
+		free (prof_nodes);
+		free (prof_funcs);
+		prof_nodes = NULL;
+		prof_funcs = NULL;
+		Con_Printf ("prof_start: out of memory\n");
+		return;
+	}
+	memset (&prof_nodes[0], 0, sizeof(profnode_t));
+	prof_nodes[0].func = -1;
+	prof_numnodes = 1;
+	prof_nodesfull = false;
+	prof_depth = 0;
+	prof_numevents = 0;
+
+	q_snprintf (path, sizeof(path), "%s/%s.json", com_gamedir, prof_name);
+	prof_trace = fopen (path, "w");
+	if (prof_trace)
+		fprintf (prof_trace, "{\"traceEvents\":[\n");
+	else
+		Con_Printf ("Couldn't write %s, only collecting stacks\n", path);
+
+	prof_starttime = Sys_DoubleTime ();
+	prof_active = true;
+	Con_Printf ("Profiling QuakeC, prof_stop to write %s\n", prof_name);
+}
+
+/*
+============
+PR_ProfStop_f
+============
+*/
+void PR_ProfStop_f (void)
+{
+	if (!prof_active)
+	{
+		Con_Printf ("prof_stop: not profiling\n");
+		return;
+	}
+	PR_StopProfiling ();
 }
 
 
@@ -310,6 +615,9 @@ static int PR_EnterFunction (dfunction_t *f)
 		}
 	}
 
+	if (prof_active)
+		PR_ProfEnter (f);
+
 	pr_xfunction = f;
 	return f->first_statement - 1;	// offset the s++
 }
@@ -335,6 +643,9 @@ static int PR_LeaveFunction (void)
 	for (i = 0; i < c; i++)
 		((int *)pr_globals)[pr_xfunction->parm_start + i] = localstack[localstack_used + i];
 
+	if (prof_active)
+		PR_ProfLeave ();
+
 	// up stack
 	pr_depth--;
 	pr_xfunction = pr_stack[pr_depth].f;
@@ -346,21 +657,110 @@ static int PR_LeaveFunction (void)
 ====================
 PR_ExecuteProgram
 
-The interpretation main loop
+The interpretation main loop.  GCC and clang jump straight from one
+opcode's handler to the next through a table of label addresses, other
+compilers go round the switch.  Statements are only counted when control
+flow leaves a straight run of code (taken branches, calls and returns),
+which is where the runaway check and function profiling happen too.
 ====================
 */
-#define OPA ((eval_t *)&pr_globals[(unsigned short)st->a])
-#define OPB ((eval_t *)&pr_globals[(unsigned short)st->b])
-#define OPC ((eval_t *)&pr_globals[(unsigned short)st->c])
+#define OPA (st->a)
+#define OPB (st->b)
+#define OPC (st->c)
+
+#define PR_RUNAWAY_LIMIT	100000
+
+#if defined(__GNUC__)
+#define PR_COMPUTED_GOTO	1
+#endif
+
+#if PR_COMPUTED_GOTO
+#define OPCASE(op)	lbl_##op:
+#define DISPATCH()	do {				\
+		st++;					\
+		if (pr_trace)				\
+		{					\
+			PR_PrintStatement(&pr_statements[st - pr_code]);	\
+			goto *dispatch[pr_statements[st - pr_code].op];		\
+		}					\
+		goto *dispatch[st->op];			\
+	} while (0)
+#define NEXT()		DISPATCH()
+#else
+#define OPCASE(op)	case op:
+#define NEXT()		break
+#endif
+
+// counts the run of statements that ends at st
+#define PR_COUNT()	(profile += st - runstart + 1)
+
+// taken branch: st is moved so that the next dispatch lands on the target
+#define PR_JUMP(ofs)	do {				\
+		PR_COUNT();				\
+		if (profile > PR_RUNAWAY_LIMIT)		\
+		{					\
+			pr_xstatement = st - pr_code;	\
+			PR_RunError("runaway loop error");	\
+		}					\
+		st += (ofs) - 1;			\
+		runstart = st + 1;			\
+	} while (0)
+
+// runs native code from the next statement when there is any, st is left
+// on the statement before the one it handed back
+#define PR_NATIVE()	do {				\
+		if (pr_jitentry && pr_jitentry[st + 1 - pr_code] && !pr_trace)	\
+		{					\
+			st = &pr_code[PR_JitRun(st + 1 - pr_code, &profile)] - 1;	\
+			runstart = st + 1;		\
+		}					\
+	} while (0)
 
 void PR_ExecuteProgram (func_t fnum)
 {
 	eval_t		*ptr;
-	dstatement_t	*st;
+	prinstr_t	*st, *runstart;
 	dfunction_t	*f, *newf;
-	int profile, startprofile;
+	int		profile, startprofile;
 	edict_t		*ed;
 	int		exitdepth;
+#if PR_COMPUTED_GOTO
+	static const void *const dispatch[PR_NUMOPS] =
+	{
+		&&lbl_OP_DONE,
+		&&lbl_OP_MUL_F, &&lbl_OP_MUL_V, &&lbl_OP_MUL_FV, &&lbl_OP_MUL_VF,
+		&&lbl_OP_DIV_F,
+		&&lbl_OP_ADD_F, &&lbl_OP_ADD_V,
+		&&lbl_OP_SUB_F, &&lbl_OP_SUB_V,
+		&&lbl_OP_EQ_F, &&lbl_OP_EQ_V, &&lbl_OP_EQ_S, &&lbl_OP_EQ_E, &&lbl_OP_EQ_FNC,
+		&&lbl_OP_NE_F, &&lbl_OP_NE_V, &&lbl_OP_NE_S, &&lbl_OP_NE_E, &&lbl_OP_NE_FNC,
+		&&lbl_OP_LE, &&lbl_OP_GE, &&lbl_OP_LT, &&lbl_OP_GT,
+		&&lbl_OP_LOAD_F, &&lbl_OP_LOAD_V, &&lbl_OP_LOAD_S,
+		&&lbl_OP_LOAD_ENT, &&lbl_OP_LOAD_FLD, &&lbl_OP_LOAD_FNC,
+		&&lbl_OP_ADDRESS,
+		&&lbl_OP_STORE_F, &&lbl_OP_STORE_V, &&lbl_OP_STORE_S,
+		&&lbl_OP_STORE_ENT, &&lbl_OP_STORE_FLD, &&lbl_OP_STORE_FNC,
+		&&lbl_OP_STOREP_F, &&lbl_OP_STOREP_V, &&lbl_OP_STOREP_S,
+		&&lbl_OP_STOREP_ENT, &&lbl_OP_STOREP_FLD, &&lbl_OP_STOREP_FNC,
+		&&lbl_OP_RETURN,
+		&&lbl_OP_NOT_F, &&lbl_OP_NOT_V, &&lbl_OP_NOT_S, &&lbl_OP_NOT_ENT, &&lbl_OP_NOT_FNC,
+		&&lbl_OP_IF, &&lbl_OP_IFNOT,
+		&&lbl_OP_CALL0, &&lbl_OP_CALL1, &&lbl_OP_CALL2, &&lbl_OP_CALL3, &&lbl_OP_CALL4,
+		&&lbl_OP_CALL5, &&lbl_OP_CALL6, &&lbl_OP_CALL7, &&lbl_OP_CALL8,
+		&&lbl_OP_STATE,
+		&&lbl_OP_GOTO,
+		&&lbl_OP_AND, &&lbl_OP_OR,
+		&&lbl_OP_BITAND, &&lbl_OP_BITOR,
+
+		&&lbl_OPX_NOP,
+		&&lbl_OPX_EQ_F_IFNOT, &&lbl_OPX_NE_F_IFNOT,
+		&&lbl_OPX_LT_IFNOT, &&lbl_OPX_LE_IFNOT, &&lbl_OPX_GT_IFNOT, &&lbl_OPX_GE_IFNOT,
+		&&lbl_OPX_LOAD_F_EQ_F_IFNOT,
+		&&lbl_OPX_ADDRESS_STOREP, &&lbl_OPX_ADDRESS_STOREP_V
+	};
+#else
+	int		op;
+#endif
 
 	if (!fnum || fnum >= progs->numfunctions)
 	{
@@ -372,202 +772,214 @@ void PR_ExecuteProgram (func_t fnum)
 	f = &pr_functions[fnum];
 
 	pr_trace = false;
+	TRACE_BEGIN ("PR_ExecuteProgram");
 
 // make a stack frame
 	exitdepth = pr_depth;
+	if (!exitdepth)
+		prof_depth = 0;	// an error may have left calls open
 
-	st = &pr_statements[PR_EnterFunction(f)];
+	st = &pr_code[PR_EnterFunction(f)];
+	runstart = st + 1;
 	startprofile = profile = 0;
+	PR_NATIVE ();
 
+#if PR_COMPUTED_GOTO
+	DISPATCH();
+	{
+#else
     while (1)
     {
 	st++;	/* next statement */
-
-	if (++profile > 100000)
-	{
-		pr_xstatement = st - pr_statements;
-		PR_RunError("runaway loop error");
-	}
+	op = st->op;
 
 	if (pr_trace)
-		PR_PrintStatement(st);
+	{ // step through the original statements, not fused ones
+		PR_PrintStatement(&pr_statements[st - pr_code]);
+		op = pr_statements[st - pr_code].op;
+	}
 
-	switch (st->op)
+	switch (op)
 	{
-	case OP_ADD_F:
+#endif
+	OPCASE(OP_ADD_F)
 		OPC->_float = OPA->_float + OPB->_float;
-		break;
-	case OP_ADD_V:
+		NEXT();
+	OPCASE(OP_ADD_V)
 		OPC->vector[0] = OPA->vector[0] + OPB->vector[0];
 		OPC->vector[1] = OPA->vector[1] + OPB->vector[1];
 		OPC->vector[2] = OPA->vector[2] + OPB->vector[2];
-		break;
+		NEXT();
 
-	case OP_SUB_F:
+	OPCASE(OP_SUB_F)
 		OPC->_float = OPA->_float - OPB->_float;
-		break;
-	case OP_SUB_V:
+		NEXT();
+	OPCASE(OP_SUB_V)
 		OPC->vector[0] = OPA->vector[0] - OPB->vector[0];
 		OPC->vector[1] = OPA->vector[1] - OPB->vector[1];
 		OPC->vector[2] = OPA->vector[2] - OPB->vector[2];
-		break;
+		NEXT();
 
-	case OP_MUL_F:
+	OPCASE(OP_MUL_F)
 		OPC->_float = OPA->_float * OPB->_float;
-		break;
-	case OP_MUL_V:
+		NEXT();
+	OPCASE(OP_MUL_V)
 		OPC->_float = OPA->vector[0] * OPB->vector[0] +
 			      OPA->vector[1] * OPB->vector[1] +
 			      OPA->vector[2] * OPB->vector[2];
-		break;
-	case OP_MUL_FV:
+		NEXT();
+	OPCASE(OP_MUL_FV)
 		OPC->vector[0] = OPA->_float * OPB->vector[0];
 		OPC->vector[1] = OPA->_float * OPB->vector[1];
 		OPC->vector[2] = OPA->_float * OPB->vector[2];
-		break;
-	case OP_MUL_VF:
+		NEXT();
+	OPCASE(OP_MUL_VF)
 		OPC->vector[0] = OPB->_float * OPA->vector[0];
 		OPC->vector[1] = OPB->_float * OPA->vector[1];
 		OPC->vector[2] = OPB->_float * OPA->vector[2];
-		break;
+		NEXT();
 
-	case OP_DIV_F:
+	OPCASE(OP_DIV_F)
 		OPC->_float = OPA->_float / OPB->_float;
-		break;
+		NEXT();
 
-	case OP_BITAND:
+	OPCASE(OP_BITAND)
 		OPC->_float = (int)OPA->_float & (int)OPB->_float;
-		break;
+		NEXT();
 
-	case OP_BITOR:
+	OPCASE(OP_BITOR)
 		OPC->_float = (int)OPA->_float | (int)OPB->_float;
-		break;
+		NEXT();
 
-	case OP_GE:
+	OPCASE(OP_GE)
 		OPC->_float = OPA->_float >= OPB->_float;
-		break;
-	case OP_LE:
+		NEXT();
+	OPCASE(OP_LE)
 		OPC->_float = OPA->_float <= OPB->_float;
-		break;
-	case OP_GT:
+		NEXT();
+	OPCASE(OP_GT)
 		OPC->_float = OPA->_float > OPB->_float;
-		break;
-	case OP_LT:
+		NEXT();
+	OPCASE(OP_LT)
 		OPC->_float = OPA->_float < OPB->_float;
-		break;
-	case OP_AND:
+		NEXT();
+	OPCASE(OP_AND)
 		OPC->_float = OPA->_float && OPB->_float;
-		break;
-	case OP_OR:
+		NEXT();
+	OPCASE(OP_OR)
 		OPC->_float = OPA->_float || OPB->_float;
-		break;
+		NEXT();
 
-	case OP_NOT_F:
+	OPCASE(OP_NOT_F)
 		OPC->_float = !OPA->_float;
-		break;
-	case OP_NOT_V:
+		NEXT();
+	OPCASE(OP_NOT_V)
 		OPC->_float = !OPA->vector[0] && !OPA->vector[1] && !OPA->vector[2];
-		break;
-	case OP_NOT_S:
+		NEXT();
+	OPCASE(OP_NOT_S)
 		OPC->_float = !OPA->string || !*PR_GetString(OPA->string);
-		break;
-	case OP_NOT_FNC:
+		NEXT();
+	OPCASE(OP_NOT_FNC)
 		OPC->_float = !OPA->function;
-		break;
-	case OP_NOT_ENT:
+		NEXT();
+	OPCASE(OP_NOT_ENT)
 		OPC->_float = (PROG_TO_EDICT(OPA->edict) == sv.edicts);
-		break;
+		NEXT();
 
-	case OP_EQ_F:
+	OPCASE(OP_EQ_F)
 		OPC->_float = OPA->_float == OPB->_float;
-		break;
-	case OP_EQ_V:
+		NEXT();
+	OPCASE(OP_EQ_V)
 		OPC->_float = (OPA->vector[0] == OPB->vector[0]) &&
 			      (OPA->vector[1] == OPB->vector[1]) &&
 			      (OPA->vector[2] == OPB->vector[2]);
-		break;
-	case OP_EQ_S:
+		NEXT();
+	OPCASE(OP_EQ_S)
 		OPC->_float = !strcmp(PR_GetString(OPA->string), PR_GetString(OPB->string));
-		break;
-	case OP_EQ_E:
+		NEXT();
+	OPCASE(OP_EQ_E)
 		OPC->_float = OPA->_int == OPB->_int;
-		break;
-	case OP_EQ_FNC:
+		NEXT();
+	OPCASE(OP_EQ_FNC)
 		OPC->_float = OPA->function == OPB->function;
-		break;
+		NEXT();
 
-	case OP_NE_F:
+	OPCASE(OP_NE_F)
 		OPC->_float = OPA->_float != OPB->_float;
-		break;
-	case OP_NE_V:
+		NEXT();
+	OPCASE(OP_NE_V)
 		OPC->_float = (OPA->vector[0] != OPB->vector[0]) ||
 			      (OPA->vector[1] != OPB->vector[1]) ||
 			      (OPA->vector[2] != OPB->vector[2]);
-		break;
-	case OP_NE_S:
+		NEXT();
+	OPCASE(OP_NE_S)
 		OPC->_float = strcmp(PR_GetString(OPA->string), PR_GetString(OPB->string));
-		break;
-	case OP_NE_E:
+		NEXT();
+	OPCASE(OP_NE_E)
 		OPC->_float = OPA->_int != OPB->_int;
-		break;
-	case OP_NE_FNC:
+		NEXT();
+	OPCASE(OP_NE_FNC)
 		OPC->_float = OPA->function != OPB->function;
-		break;
+		NEXT();
 
-	case OP_STORE_F:
-	case OP_STORE_ENT:
-	case OP_STORE_FLD:	// integers
-	case OP_STORE_S:
-	case OP_STORE_FNC:	// pointers
+	OPCASE(OP_STORE_F)
+	OPCASE(OP_STORE_ENT)
+	OPCASE(OP_STORE_FLD)	// integers
+	OPCASE(OP_STORE_S)
+	OPCASE(OP_STORE_FNC)	// pointers
 		OPB->_int = OPA->_int;
-		break;
-	case OP_STORE_V:
+		NEXT();
+	OPCASE(OP_STORE_V)
 		OPB->vector[0] = OPA->vector[0];
 		OPB->vector[1] = OPA->vector[1];
 		OPB->vector[2] = OPA->vector[2];
-		break;
+		NEXT();
 
-	case OP_STOREP_F:
-	case OP_STOREP_ENT:
-	case OP_STOREP_FLD:	// integers
-	case OP_STOREP_S:
-	case OP_STOREP_FNC:	// pointers
+	OPCASE(OP_STOREP_F)
+	OPCASE(OP_STOREP_ENT)
+	OPCASE(OP_STOREP_FLD)	// integers
+	OPCASE(OP_STOREP_S)
+	OPCASE(OP_STOREP_FNC)	// pointers
 		ptr = (eval_t *)((byte *)sv.edicts + OPB->_int);
 		ptr->_int = OPA->_int;
-		break;
-	case OP_STOREP_V:
+		NEXT();
+	OPCASE(OP_STOREP_V)
 		ptr = (eval_t *)((byte *)sv.edicts + OPB->_int);
 		ptr->vector[0] = OPA->vector[0];
 		ptr->vector[1] = OPA->vector[1];
 		ptr->vector[2] = OPA->vector[2];
-		break;
+		NEXT();
 
-	case OP_ADDRESS:
+	OPCASE(OP_ADDRESS)
 		ed = PROG_TO_EDICT(OPA->edict);
 #ifdef PARANOID
 		NUM_FOR_EDICT(ed);	// Make sure it's in range
 #endif
 		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
 		{
-			pr_xstatement = st - pr_statements;
+			pr_xstatement = st - pr_code;
 			PR_RunError("assignment to world entity");
 		}
+		if (OPB->_int == FIELD_CLASSNAME)
+			ED_ClassnameChanged (ed);
+		else if (OPB->_int == FIELD_NEXTTHINK || OPB->_int == FIELD_MOVETYPE)
+			SV_WakeEdict (ed);
 		OPC->_int = (byte *)((int *)&ed->v + OPB->_int) - (byte *)sv.edicts;
-		break;
+		NEXT();
 
-	case OP_LOAD_F:
-	case OP_LOAD_FLD:
-	case OP_LOAD_ENT:
-	case OP_LOAD_S:
-	case OP_LOAD_FNC:
+	OPCASE(OP_LOAD_F)
+	OPCASE(OP_LOAD_FLD)
+	OPCASE(OP_LOAD_ENT)
+	OPCASE(OP_LOAD_S)
+	OPCASE(OP_LOAD_FNC)
 		ed = PROG_TO_EDICT(OPA->edict);
 #ifdef PARANOID
 		NUM_FOR_EDICT(ed);	// Make sure it's in range
 #endif
 		OPC->_int = ((eval_t *)((int *)&ed->v + OPB->_int))->_int;
-		break;
+		NEXT();
 
-	case OP_LOAD_V:
+	OPCASE(OP_LOAD_V)
 		ed = PROG_TO_EDICT(OPA->edict);
 #ifdef PARANOID
 		NUM_FOR_EDICT(ed);	// Make sure it's in range
@@ -576,34 +988,35 @@ void PR_ExecuteProgram (func_t fnum)
 		OPC->vector[0] = ptr->vector[0];
 		OPC->vector[1] = ptr->vector[1];
 		OPC->vector[2] = ptr->vector[2];
-		break;
+		NEXT();
 
-	case OP_IFNOT:
+	OPCASE(OP_IFNOT)
 		if (!OPA->_int)
-			st += st->b - 1;	/* -1 to offset the st++ */
-		break;
+			PR_JUMP(st->jump);
+		NEXT();
 
-	case OP_IF:
+	OPCASE(OP_IF)
 		if (OPA->_int)
-			st += st->b - 1;	/* -1 to offset the st++ */
-		break;
-
-	case OP_GOTO:
-		st += st->a - 1;		/* -1 to offset the st++ */
-		break;
-
-	case OP_CALL0:
-	case OP_CALL1:
-	case OP_CALL2:
-	case OP_CALL3:
-	case OP_CALL4:
-	case OP_CALL5:
-	case OP_CALL6:
-	case OP_CALL7:
-	case OP_CALL8:
+			PR_JUMP(st->jump);
+		NEXT();
+
+	OPCASE(OP_GOTO)
+		PR_JUMP(st->jump);
+		NEXT();
+
+	OPCASE(OP_CALL0)
+	OPCASE(OP_CALL1)
+	OPCASE(OP_CALL2)
+	OPCASE(OP_CALL3)
+	OPCASE(OP_CALL4)
+	OPCASE(OP_CALL5)
+	OPCASE(OP_CALL6)
+	OPCASE(OP_CALL7)
+	OPCASE(OP_CALL8)
+		PR_COUNT();
 		pr_xfunction->profile += profile - startprofile;
 		startprofile = profile;
-		pr_xstatement = st - pr_statements;
+		pr_xstatement = st - pr_code;
 		pr_argc = st->op - OP_CALL0;
 		if (!OPA->function)
 			PR_RunError("NULL function");
@@ -613,42 +1026,154 @@ void PR_ExecuteProgram (func_t fnum)
 			int i = -newf->first_statement;
 			if (i >= pr_numbuiltins)
 				PR_RunError("Bad builtin call number %d", i);
-			pr_builtins[i]();
-			break;
+			newf->profile++;	// calls, not statements
+			if (prof_active)
+			{
+				PR_ProfEnter (newf);
+				pr_builtins[i]();
+				PR_ProfLeave ();
+			}
+			else
+				pr_builtins[i]();
+			runstart = st + 1;
+			PR_NATIVE ();
+			NEXT();
 		}
 		// Normal function
-		st = &pr_statements[PR_EnterFunction(newf)];
-		break;
-
-	case OP_DONE:
-	case OP_RETURN:
+		st = &pr_code[PR_EnterFunction(newf)];
+		runstart = st + 1;
+		PR_NATIVE ();
+		NEXT();
+
+	OPCASE(OP_DONE)
+	OPCASE(OP_RETURN)
+		PR_COUNT();
 		pr_xfunction->profile += profile - startprofile;
 		startprofile = profile;
-		pr_xstatement = st - pr_statements;
-		pr_globals[OFS_RETURN] = pr_globals[(unsigned short)st->a];
-		pr_globals[OFS_RETURN + 1] = pr_globals[(unsigned short)st->a + 1];
-		pr_globals[OFS_RETURN + 2] = pr_globals[(unsigned short)st->a + 2];
-		st = &pr_statements[PR_LeaveFunction()];
+		pr_xstatement = st - pr_code;
+		pr_globals[OFS_RETURN] = OPA->vector[0];
+		pr_globals[OFS_RETURN + 1] = OPA->vector[1];
+		pr_globals[OFS_RETURN + 2] = OPA->vector[2];
+		st = &pr_code[PR_LeaveFunction()];
+		runstart = st + 1;
 		if (pr_depth == exitdepth)
 		{ // Done
+			TRACE_END ("PR_ExecuteProgram");
 			return;
 		}
-		break;
+		PR_NATIVE ();
+		NEXT();
 
-	case OP_STATE:
+	OPCASE(OP_STATE)
 		ed = PROG_TO_EDICT(pr_global_struct->self);
+		SV_WakeEdict (ed);
 		ed->v.nextthink = pr_global_struct->time + 0.1;
 		ed->v.frame = OPA->_float;
 		ed->v.think = OPB->function;
-		break;
+		NEXT();
+
+	// branches resolved at load time
+	OPCASE(OPX_NOP)
+		NEXT();
 
+	// fused sequences, each step runs with the operands of its own statement
+	OPCASE(OPX_EQ_F_IFNOT)
+		OPC->_float = OPA->_float == OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+	OPCASE(OPX_NE_F_IFNOT)
+		OPC->_float = OPA->_float != OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+	OPCASE(OPX_LT_IFNOT)
+		OPC->_float = OPA->_float < OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+	OPCASE(OPX_LE_IFNOT)
+		OPC->_float = OPA->_float <= OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+	OPCASE(OPX_GT_IFNOT)
+		OPC->_float = OPA->_float > OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+	OPCASE(OPX_GE_IFNOT)
+		OPC->_float = OPA->_float >= OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+
+	OPCASE(OPX_LOAD_F_EQ_F_IFNOT)
+		ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		OPC->_int = ((eval_t *)((int *)&ed->v + OPB->_int))->_int;
+		st++;
+		OPC->_float = OPA->_float == OPB->_float;
+		st++;
+		if (!OPA->_int)
+			PR_JUMP(st->jump);
+		NEXT();
+
+	OPCASE(OPX_ADDRESS_STOREP)
+	OPCASE(OPX_ADDRESS_STOREP_V)
+		ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			pr_xstatement = st - pr_code;
+			PR_RunError("assignment to world entity");
+		}
+		if (OPB->_int == FIELD_CLASSNAME)
+			ED_ClassnameChanged (ed);
+		else if (OPB->_int == FIELD_NEXTTHINK || OPB->_int == FIELD_MOVETYPE)
+			SV_WakeEdict (ed);
+		ptr = (eval_t *)((int *)&ed->v + OPB->_int);
+		OPC->_int = (byte *)ptr - (byte *)sv.edicts;
+		if (st->op == OPX_ADDRESS_STOREP_V)
+		{
+			st++;
+			ptr->vector[0] = OPA->vector[0];
+			ptr->vector[1] = OPA->vector[1];
+			ptr->vector[2] = OPA->vector[2];
+		}
+		else
+		{
+			st++;
+			ptr->_int = OPA->_int;
+		}
+		NEXT();
+
+#if !PR_COMPUTED_GOTO
 	default:
-		pr_xstatement = st - pr_statements;
+		pr_xstatement = st - pr_code;
 		PR_RunError("Bad opcode %i", st->op);
 	}
     }	/* end of while(1) loop */
+#else
+	}	/* opcodes are range checked by PR_LoadProgs */
+#endif
 }
 #undef OPA
 #undef OPB
 #undef OPC
+#undef OPCASE
+#undef NEXT
+#undef DISPATCH
+#undef PR_COUNT
+#undef PR_JUMP
 
@@ -0,0 +1,1213 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_jit.c -- native code for QuakeC functions
+
+#include "quakedef.h"
+
+/*
+===============================================================================
+
+QUAKEC JIT
+
+With pr_jit set, PR_LoadProgs translates every function body to x86-64
+code.  The native code runs everything but calls and returns: at CALL*,
+RETURN and DONE it hands the statement number back to PR_ExecuteProgram,
+which does the call with its own stack frames and comes back into native
+code at the start of the callee, or after the call once it returns.  So
+builtins, the profiler, the stack trace and PR_RunError all work as
+before.  Statements are counted per straight run like the interpreter
+does, and a taken branch past PR_RUNAWAY_LIMIT hands the branch back too,
+for the interpreter to raise the error.
+
+Native code never raises errors itself, so Host_Error never has to unwind
+through it: anything that would fail (assignment to world, bad strings)
+is handed back to the interpreter, which runs the statement again and
+fails the usual way.  A function with a branch out of its own body is
+left to the interpreter.
+
+pr_jit 2 checks every native run against a plain C evaluation of the same
+statements, undoing the native run's writes in between, and drops the
+native code of any function where the two disagree.
+
+Only x86-64 has a code generator; elsewhere pr_jit does nothing.
+
+===============================================================================
+*/
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PR_JIT_X64
+#endif
+
+#define PR_RUNAWAY_LIMIT	100000	// same as pr_exec.c
+
+cvar_t	pr_jit = {"pr_jit", "0", CVAR_NONE};	// 1 = native code, 2 = also check it
+
+byte	**pr_jitentry;	// per statement: native code entry, or NULL
+
+static int	*jit_funcend;	// per function: first statement past its body
+static qboolean	jit_checking;	// code was compiled for pr_jit 2
+
+/*
+===============================================================================
+
+EVALUATION
+
+The op a statement really runs, and the helpers native code calls for
+the statements that need the C library or can fail.  The helpers return
+0 to hand their statement back to the interpreter.
+
+===============================================================================
+*/
+
+/*
+====================
+PR_JitOp
+
+Fused instructions are run one statement at a time, constant branches
+keep their resolved form.
+====================
+*/
+static int PR_JitOp (int s)
+{
+	int	op = pr_code[s].op;
+
+	if (op == OPX_NOP || op < OP_NUMOPS)
+		return op;
+	return pr_statements[s].op;
+}
+
+static qboolean PR_JitIsExit (int op)
+{
+	return op == OP_DONE || op == OP_RETURN || (op >= OP_CALL0 && op <= OP_CALL8);
+}
+
+static qboolean PR_JitIsBranch (int op)
+{
+	return op == OP_IF || op == OP_IFNOT || op == OP_GOTO;
+}
+
+#define	MAX_JIT_LOG	4096
+
+typedef struct
+{
+	int		*addr;
+	int		old;
+	int		value;	// after the native run
+} jitwrite_t;
+
+static jitwrite_t	jit_log[MAX_JIT_LOG];
+static int		jit_numlog;
+static qboolean		jit_logfull;
+
+// remembers what a write in pr_jit 2 is about to replace
+static void PR_JitLog (int *addr)
+{
+	if (jit_numlog == MAX_JIT_LOG)
+	{
+		jit_logfull = true;
+		return;
+	}
+	jit_log[jit_numlog].addr = addr;
+	jit_log[jit_numlog].old = *addr;
+	jit_numlog++;
+}
+
+static int PR_JitAddress (prinstr_t *st)
+{
+	edict_t	*ed;
+
+	ed = PROG_TO_EDICT(st->a->edict);
+	if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		return 0;
+	if (st->b->_int == FIELD_CLASSNAME)
+		ED_ClassnameChanged (ed);
+	else if (st->b->_int == FIELD_NEXTTHINK || st->b->_int == FIELD_MOVETYPE)
+		SV_WakeEdict (ed);
+	st->c->_int = (byte *)((int *)&ed->v + st->b->_int) - (byte *)sv.edicts;
+	return 1;
+}
+
+static int PR_JitNotS (prinstr_t *st)
+{
+	if (st->a->string && !PR_StringValid (st->a->string))
+		return 0;
+	st->c->_float = !st->a->string || !*PR_GetString(st->a->string);
+	return 1;
+}
+
+static int PR_JitEqS (prinstr_t *st)
+{
+	if (!PR_StringValid (st->a->string) || !PR_StringValid (st->b->string))
+		return 0;
+	st->c->_float = !strcmp(PR_GetString(st->a->string), PR_GetString(st->b->string));
+	return 1;
+}
+
+static int PR_JitNeS (prinstr_t *st)
+{
+	if (!PR_StringValid (st->a->string) || !PR_StringValid (st->b->string))
+		return 0;
+	st->c->_float = strcmp(PR_GetString(st->a->string), PR_GetString(st->b->string));
+	return 1;
+}
+
+static int PR_JitState (prinstr_t *st)
+{
+	edict_t	*ed;
+
+	ed = PROG_TO_EDICT(pr_global_struct->self);
+	if (jit_checking)
+	{
+		PR_JitLog ((int *)&ed->v.nextthink);
+		PR_JitLog ((int *)&ed->v.frame);
+		PR_JitLog ((int *)&ed->v.think);
+	}
+	SV_WakeEdict (ed);
+	ed->v.nextthink = pr_global_struct->time + 0.1;
+	ed->v.frame = st->a->_float;
+	ed->v.think = st->b->function;
+	return 1;
+}
+
+// STOREP_* for pr_jit 2, which needs every edict write logged
+static int PR_JitStoreP (prinstr_t *st)
+{
+	eval_t	*ptr;
+
+	ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+	PR_JitLog (&ptr->_int);
+	ptr->_int = st->a->_int;
+	return 1;
+}
+
+static int PR_JitStorePV (prinstr_t *st)
+{
+	eval_t	*ptr;
+	int	i;
+
+	ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+	for (i = 0; i < 3; i++)
+	{
+		PR_JitLog ((int *)&ptr->vector[i]);
+		ptr->vector[i] = st->a->vector[i];
+	}
+	return 1;
+}
+
+/*
+====================
+PR_JitEvaluate
+
+The reference for pr_jit 2: runs statements from s in C, the way
+PR_ExecuteProgram does, up to where native code would hand over or to
+end, the end of the function.  Returns that statement.
+====================
+*/
+static int PR_JitEvaluate (int s, int end, int *profile)
+{
+	prinstr_t	*st;
+	eval_t		*ptr;
+	edict_t		*ed;
+	int		runstart;
+
+	for (runstart = s ; s < end ; s++)
+	{
+		st = &pr_code[s];
+		switch (PR_JitOp (s))
+		{
+		case OP_ADD_F:	st->c->_float = st->a->_float + st->b->_float; break;
+		case OP_SUB_F:	st->c->_float = st->a->_float - st->b->_float; break;
+		case OP_MUL_F:	st->c->_float = st->a->_float * st->b->_float; break;
+		case OP_DIV_F:	st->c->_float = st->a->_float / st->b->_float; break;
+		case OP_ADD_V:
+			st->c->vector[0] = st->a->vector[0] + st->b->vector[0];
+			st->c->vector[1] = st->a->vector[1] + st->b->vector[1];
+			st->c->vector[2] = st->a->vector[2] + st->b->vector[2];
+			break;
+		case OP_SUB_V:
+			st->c->vector[0] = st->a->vector[0] - st->b->vector[0];
+			st->c->vector[1] = st->a->vector[1] - st->b->vector[1];
+			st->c->vector[2] = st->a->vector[2] - st->b->vector[2];
+			break;
+		case OP_MUL_V:
+			st->c->_float = st->a->vector[0] * st->b->vector[0] +
+					st->a->vector[1] * st->b->vector[1] +
+					st->a->vector[2] * st->b->vector[2];
+			break;
+		case OP_MUL_FV:
+			st->c->vector[0] = st->a->_float * st->b->vector[0];
+			st->c->vector[1] = st->a->_float * st->b->vector[1];
+			st->c->vector[2] = st->a->_float * st->b->vector[2];
+			break;
+		case OP_MUL_VF:
+			st->c->vector[0] = st->b->_float * st->a->vector[0];
+			st->c->vector[1] = st->b->_float * st->a->vector[1];
+			st->c->vector[2] = st->b->_float * st->a->vector[2];
+			break;
+		case OP_BITAND:	st->c->_float = (int)st->a->_float & (int)st->b->_float; break;
+		case OP_BITOR:	st->c->_float = (int)st->a->_float | (int)st->b->_float; break;
+		case OP_GE:	st->c->_float = st->a->_float >= st->b->_float; break;
+		case OP_LE:	st->c->_float = st->a->_float <= st->b->_float; break;
+		case OP_GT:	st->c->_float = st->a->_float > st->b->_float; break;
+		case OP_LT:	st->c->_float = st->a->_float < st->b->_float; break;
+		case OP_AND:	st->c->_float = st->a->_float && st->b->_float; break;
+		case OP_OR:	st->c->_float = st->a->_float || st->b->_float; break;
+		case OP_NOT_F:	st->c->_float = !st->a->_float; break;
+		case OP_NOT_V:	st->c->_float = !st->a->vector[0] && !st->a->vector[1] && !st->a->vector[2]; break;
+		case OP_NOT_FNC: st->c->_float = !st->a->function; break;
+		case OP_NOT_ENT: st->c->_float = (PROG_TO_EDICT(st->a->edict) == sv.edicts); break;
+		case OP_EQ_F:	st->c->_float = st->a->_float == st->b->_float; break;
+		case OP_NE_F:	st->c->_float = st->a->_float != st->b->_float; break;
+		case OP_EQ_V:
+			st->c->_float = (st->a->vector[0] == st->b->vector[0]) &&
+					(st->a->vector[1] == st->b->vector[1]) &&
+					(st->a->vector[2] == st->b->vector[2]);
+			break;
+		case OP_NE_V:
+			st->c->_float = (st->a->vector[0] != st->b->vector[0]) ||
+					(st->a->vector[1] != st->b->vector[1]) ||
+					(st->a->vector[2] != st->b->vector[2]);
+			break;
+		case OP_EQ_E:	st->c->_float = st->a->_int == st->b->_int; break;
+		case OP_NE_E:	st->c->_float = st->a->_int != st->b->_int; break;
+		case OP_EQ_FNC:	st->c->_float = st->a->function == st->b->function; break;
+		case OP_NE_FNC:	st->c->_float = st->a->function != st->b->function; break;
+		case OP_NOT_S:
+			if (!PR_JitNotS (st))
+				goto handover;
+			break;
+		case OP_EQ_S:
+			if (!PR_JitEqS (st))
+				goto handover;
+			break;
+		case OP_NE_S:
+			if (!PR_JitNeS (st))
+				goto handover;
+			break;
+		case OP_ADDRESS:
+			if (!PR_JitAddress (st))
+				goto handover;
+			break;
+		case OP_STATE:
+			PR_JitState (st);
+			break;
+		case OP_STORE_F:
+		case OP_STORE_ENT:
+		case OP_STORE_FLD:
+		case OP_STORE_S:
+		case OP_STORE_FNC:
+			st->b->_int = st->a->_int;
+			break;
+		case OP_STORE_V:
+			st->b->vector[0] = st->a->vector[0];
+			st->b->vector[1] = st->a->vector[1];
+			st->b->vector[2] = st->a->vector[2];
+			break;
+		case OP_STOREP_F:
+		case OP_STOREP_ENT:
+		case OP_STOREP_FLD:
+		case OP_STOREP_S:
+		case OP_STOREP_FNC:
+			PR_JitStoreP (st);
+			break;
+		case OP_STOREP_V:
+			PR_JitStorePV (st);
+			break;
+		case OP_LOAD_F:
+		case OP_LOAD_FLD:
+		case OP_LOAD_ENT:
+		case OP_LOAD_S:
+		case OP_LOAD_FNC:
+			ed = PROG_TO_EDICT(st->a->edict);
+			st->c->_int = ((eval_t *)((int *)&ed->v + st->b->_int))->_int;
+			break;
+		case OP_LOAD_V:
+			ed = PROG_TO_EDICT(st->a->edict);
+			ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+			st->c->vector[0] = ptr->vector[0];
+			st->c->vector[1] = ptr->vector[1];
+			st->c->vector[2] = ptr->vector[2];
+			break;
+		case OP_IF:
+			if (!st->a->_int)
+				break;
+			goto jump;
+		case OP_IFNOT:
+			if (st->a->_int)
+				break;
+			goto jump;
+		case OP_GOTO:
+		jump:
+			*profile += s - runstart + 1;
+			if (*profile > PR_RUNAWAY_LIMIT)
+			{
+				*profile -= 1;	// the interpreter counts it again
+				return s;
+			}
+			s += st->jump - 1;
+			runstart = s + 1;
+			break;
+		case OPX_NOP:
+			break;
+		default:	// calls and returns
+			goto handover;
+		}
+	}
+
+handover:
+	*profile += s - runstart;
+	return s;
+}
+
+#ifdef PR_JIT_X64
+
+/*
+===============================================================================
+
+X86-64 CODE GENERATOR
+
+Native code keeps the profile counter address in rbx, pr_globals in r13
+and &sv.edicts in r14, all saved by the entry stub, and addresses the
+QuakeC globals as [r13 + disp32].  It only uses caller saved registers
+besides those, and keeps the stack aligned for the C helpers.
+
+===============================================================================
+*/
+
+enum { RAX, RCX, RDX, RBX };
+enum { XMM0, XMM1, XMM2, XMM3 };
+
+typedef struct
+{
+	int		pos;		// of the rel32
+	int		statement;	// it jumps to
+} jitfixup_t;
+
+static byte		*jit_buf;
+static int		jit_len, jit_max;
+static jitfixup_t	*jit_fixups;
+static int		jit_numfixups, jit_maxfixups;
+static int		*jit_offs;	// per statement: native offset, or -1
+static int		jit_exitpos;	// offset of the shared exit code
+
+static byte		*jit_exec;	// the sealed copy
+static int		jit_execsize;
+
+static void Jit_Byte (int b)
+{
+	if (jit_len == jit_max)
+	{
+		jit_max = jit_max ? jit_max * 2 : 65536;
+		jit_buf = (byte *) realloc (jit_buf, jit_max);
+		if (!jit_buf)
+			Sys_Error ("Jit_Byte: out of memory");
+	}
+	jit_buf[jit_len++] = b;
+}
+
+static void Jit_Bytes (const char *s, int n)
+{
+	while (n--)
+		Jit_Byte ((byte)*s++);
+}
+
+static void Jit_Int (int v)
+{
+	Jit_Byte (v & 255);
+	Jit_Byte ((v >> 8) & 255);
+	Jit_Byte ((v >> 16) & 255);
+	Jit_Byte ((v >> 24) & 255);
+}
+
+static void Jit_Ptr (const void *p)
+{
+	uint64_t	v = (uint64_t)(uintptr_t)p;
+	int		i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		Jit_Byte ((int)(v & 255));
+}
+
+static int Jit_Disp (const void *p)
+{
+	return (int)((const byte *)p - (const byte *)pr_globals);
+}
+
+// op reg, [r13 + disp], with an optional prefix and the 0F escape
+static void Jit_Mem (int prefix, qboolean escape, int op, int reg, const void *p, int ofs)
+{
+	if (prefix)
+		Jit_Byte (prefix);
+	Jit_Byte (0x41);	// REX.B for r13
+	if (escape)
+		Jit_Byte (0x0f);
+	Jit_Byte (op);
+	Jit_Byte (0x80 | (reg << 3) | 5);
+	Jit_Int (Jit_Disp (p) + ofs);
+}
+
+#define	Jit_LoadInt(reg, p, ofs)	Jit_Mem (0, false, 0x8b, reg, p, ofs)
+#define	Jit_StoreInt(p, ofs, reg)	Jit_Mem (0, false, 0x89, reg, p, ofs)
+#define	Jit_CmpInt(reg, p, ofs)		Jit_Mem (0, false, 0x3b, reg, p, ofs)
+#define	Jit_LoadSS(xmm, p, ofs)		Jit_Mem (0xf3, true, 0x10, xmm, p, ofs)
+#define	Jit_StoreSS(p, ofs, xmm)	Jit_Mem (0xf3, true, 0x11, xmm, p, ofs)
+#define	Jit_ArithSS(op, xmm, p, ofs)	Jit_Mem (0xf3, true, op, xmm, p, ofs)
+#define	Jit_UcomiSS(xmm, p, ofs)	Jit_Mem (0, true, 0x2e, xmm, p, ofs)
+#define	Jit_TruncSS(reg, p, ofs)	Jit_Mem (0xf3, true, 0x2c, reg, p, ofs)
+
+#define	SS_ADD	0x58
+#define	SS_MUL	0x59
+#define	SS_SUB	0x5c
+#define	SS_DIV	0x5e
+
+#define	CC_E	0x4
+#define	CC_NE	0x5
+#define	CC_AE	0x3
+#define	CC_A	0x7
+#define	CC_P	0xa
+#define	CC_NP	0xb
+#define	CC_LE	0xe
+
+// setcc on al, cl or dl
+static void Jit_Set (int cc, int reg)
+{
+	Jit_Byte (0x0f);
+	Jit_Byte (0x90 | cc);
+	Jit_Byte (0xc0 | reg);
+}
+
+// and / or of two byte registers into the first
+static void Jit_And8 (int dst, int src)
+{
+	Jit_Byte (0x20);
+	Jit_Byte (0xc0 | (src << 3) | dst);
+}
+
+static void Jit_Or8 (int dst, int src)
+{
+	Jit_Byte (0x08);
+	Jit_Byte (0xc0 | (src << 3) | dst);
+}
+
+static void Jit_ZeroXMM3 (void)
+{
+	Jit_Bytes ("\x0f\x57\xdb", 3);		// xorps xmm3, xmm3
+}
+
+// reg = (xmm0 == 0), ordered only, like !f in C
+static void Jit_IsZero (int reg)
+{
+	Jit_Bytes ("\x0f\x2e\xc3", 3);		// ucomiss xmm0, xmm3
+	Jit_Set (CC_E, reg);
+	Jit_Set (CC_NP, RCX);
+	Jit_And8 (reg, RCX);
+}
+
+// reg = (xmm0 != 0), true for NaN, like f used as a condition in C
+static void Jit_IsTrue (int reg)
+{
+	Jit_Bytes ("\x0f\x2e\xc3", 3);		// ucomiss xmm0, xmm3
+	Jit_Set (CC_NE, reg);
+	Jit_Set (CC_P, RCX);
+	Jit_Or8 (reg, RCX);
+}
+
+// al = a <op> b on floats, with C's NaN rules
+static void Jit_CompareF (int op, const eval_t *a, const eval_t *b, int ofs)
+{
+	switch (op)
+	{
+	case OP_EQ_F:
+	case OP_NE_F:
+		Jit_LoadSS (XMM0, a, ofs);
+		Jit_UcomiSS (XMM0, b, ofs);
+		if (op == OP_EQ_F)
+		{
+			Jit_Set (CC_E, RAX);
+			Jit_Set (CC_NP, RCX);
+			Jit_And8 (RAX, RCX);
+		}
+		else
+		{
+			Jit_Set (CC_NE, RAX);
+			Jit_Set (CC_P, RCX);
+			Jit_Or8 (RAX, RCX);
+		}
+		break;
+	case OP_LT:	// b > a
+	case OP_LE:	// b >= a
+		Jit_LoadSS (XMM0, b, ofs);
+		Jit_UcomiSS (XMM0, a, ofs);
+		Jit_Set (op == OP_LT ? CC_A : CC_AE, RAX);
+		break;
+	case OP_GT:
+	case OP_GE:
+		Jit_LoadSS (XMM0, a, ofs);
+		Jit_UcomiSS (XMM0, b, ofs);
+		Jit_Set (op == OP_GT ? CC_A : CC_AE, RAX);
+		break;
+	}
+}
+
+// c = al ? 1.0 : 0.0
+static void Jit_StoreBool (const eval_t *c)
+{
+	Jit_Bytes ("\x0f\xb6\xc0", 3);		// movzx eax, al
+	Jit_Bytes ("\xf7\xd8", 2);		// neg eax
+	Jit_Byte (0x25);			// and eax, 1.0f
+	Jit_Int (0x3f800000);
+	Jit_StoreInt (c, 0, RAX);
+}
+
+// rax = sv.edicts
+static void Jit_LoadEdicts (void)
+{
+	Jit_Bytes ("\x49\x8b\x06", 3);		// mov rax, [r14]
+}
+
+// rcx / rdx = sign extended int global
+static void Jit_LoadOffset (int reg, const eval_t *p)
+{
+	Jit_Byte (0x49);			// movsxd reg, [r13 + disp]
+	Jit_Byte (0x63);
+	Jit_Byte (0x80 | (reg << 3) | 5);
+	Jit_Int (Jit_Disp (p));
+}
+
+static void Jit_AddCount (int n)
+{
+	if (n <= 0)
+		return;
+	Jit_Bytes ("\x81\x03", 2);		// add dword [rbx], n
+	Jit_Int (n);
+}
+
+// hands statement s back to the interpreter
+static void Jit_Exit (int s)
+{
+	Jit_Byte (0xb8);			// mov eax, s
+	Jit_Int (s);
+	Jit_Byte (0xe9);			// jmp exit
+	Jit_Int (jit_exitpos - (jit_len + 4));
+}
+
+// jump, or jcc, to statement s, patched once its offset is known
+static void Jit_Branch (int cc, int s)
+{
+	if (cc < 0)
+		Jit_Byte (0xe9);
+	else
+	{
+		Jit_Byte (0x0f);
+		Jit_Byte (0x80 | cc);
+	}
+	if (jit_numfixups == jit_maxfixups)
+	{
+		jit_maxfixups = jit_maxfixups ? jit_maxfixups * 2 : 1024;
+		jit_fixups = (jitfixup_t *) realloc (jit_fixups, jit_maxfixups * sizeof(*jit_fixups));
+		if (!jit_fixups)
+			Sys_Error ("Jit_Branch: out of memory");
+	}
+	jit_fixups[jit_numfixups].pos = jit_len;
+	jit_fixups[jit_numfixups].statement = s;
+	jit_numfixups++;
+	Jit_Int (0);
+}
+
+// calls helper (st), handing st back if it returns 0
+static void Jit_Helper (int (*helper) (prinstr_t *), int s, int pending)
+{
+	int	skip;
+
+#ifdef _WIN64
+	Jit_Bytes ("\x48\xb9", 2);		// mov rcx, &pr_code[s]
+#else
+	Jit_Bytes ("\x48\xbf", 2);		// mov rdi, &pr_code[s]
+#endif
+	Jit_Ptr (&pr_code[s]);
+	Jit_Bytes ("\x48\xb8", 2);		// mov rax, helper
+	Jit_Ptr ((const void *)helper);
+	Jit_Bytes ("\xff\xd0", 2);		// call rax
+	Jit_Bytes ("\x85\xc0", 2);		// test eax, eax
+	Jit_Bytes ("\x0f\x85", 2);		// jnz past the exit
+	skip = jit_len;
+	Jit_Int (0);
+	Jit_AddCount (pending);
+	Jit_Exit (s);
+	*(int *)(jit_buf + skip) = jit_len - (skip + 4);
+}
+
+/*
+====================
+Jit_Statement
+
+Emits statement s.  pending is the number of statements run since the
+last count, not including s.  Returns false for statements that end the
+straight run, which counted everything themselves.
+====================
+*/
+static qboolean Jit_Statement (int s, int pending)
+{
+	prinstr_t	*st = &pr_code[s];
+	int		op, i, skip;
+
+	op = PR_JitOp (s);
+	switch (op)
+	{
+	case OP_ADD_F:	case OP_SUB_F:	case OP_MUL_F:	case OP_DIV_F:
+		Jit_LoadSS (XMM0, st->a, 0);
+		Jit_ArithSS (op == OP_ADD_F ? SS_ADD : op == OP_SUB_F ? SS_SUB : op == OP_MUL_F ? SS_MUL : SS_DIV, XMM0, st->b, 0);
+		Jit_StoreSS (st->c, 0, XMM0);
+		break;
+	case OP_ADD_V:	case OP_SUB_V:
+		for (i = 0; i < 12; i += 4)
+		{
+			Jit_LoadSS (XMM0, st->a, i);
+			Jit_ArithSS (op == OP_ADD_V ? SS_ADD : SS_SUB, XMM0, st->b, i);
+			Jit_StoreSS (st->c, i, XMM0);
+		}
+		break;
+	case OP_MUL_V:
+		Jit_LoadSS (XMM0, st->a, 0);
+		Jit_ArithSS (SS_MUL, XMM0, st->b, 0);
+		for (i = 4; i < 12; i += 4)
+		{
+			Jit_LoadSS (XMM1, st->a, i);
+			Jit_ArithSS (SS_MUL, XMM1, st->b, i);
+			Jit_Bytes ("\xf3\x0f\x58\xc1", 4);	// addss xmm0, xmm1
+		}
+		Jit_StoreSS (st->c, 0, XMM0);
+		break;
+	case OP_MUL_FV:
+		for (i = 0; i < 12; i += 4)
+		{
+			Jit_LoadSS (XMM0, st->a, 0);
+			Jit_ArithSS (SS_MUL, XMM0, st->b, i);
+			Jit_StoreSS (st->c, i, XMM0);
+		}
+		break;
+	case OP_MUL_VF:
+		for (i = 0; i < 12; i += 4)
+		{
+			Jit_LoadSS (XMM0, st->b, 0);
+			Jit_ArithSS (SS_MUL, XMM0, st->a, i);
+			Jit_StoreSS (st->c, i, XMM0);
+		}
+		break;
+	case OP_BITAND:	case OP_BITOR:
+		Jit_TruncSS (RAX, st->a, 0);
+		Jit_TruncSS (RCX, st->b, 0);
+		Jit_Bytes (op == OP_BITAND ? "\x21\xc8" : "\x09\xc8", 2);	// and / or eax, ecx
+		Jit_Bytes ("\xf3\x0f\x2a\xc0", 4);	// cvtsi2ss xmm0, eax
+		Jit_StoreSS (st->c, 0, XMM0);
+		break;
+
+	case OP_EQ_F:	case OP_NE_F:
+	case OP_LT:	case OP_LE:	case OP_GT:	case OP_GE:
+		Jit_CompareF (op, st->a, st->b, 0);
+		Jit_StoreBool (st->c);
+		break;
+	case OP_EQ_V:	case OP_NE_V:
+		Jit_CompareF (op == OP_EQ_V ? OP_EQ_F : OP_NE_F, st->a, st->b, 0);
+		Jit_Bytes ("\x88\xc2", 2);		// mov dl, al
+		for (i = 4; i < 12; i += 4)
+		{
+			Jit_CompareF (op == OP_EQ_V ? OP_EQ_F : OP_NE_F, st->a, st->b, i);
+			if (op == OP_EQ_V)
+				Jit_And8 (RDX, RAX);
+			else
+				Jit_Or8 (RDX, RAX);
+		}
+		Jit_Bytes ("\x88\xd0", 2);		// mov al, dl
+		Jit_StoreBool (st->c);
+		break;
+	case OP_EQ_E:	case OP_NE_E:	case OP_EQ_FNC:	case OP_NE_FNC:
+		Jit_LoadInt (RAX, st->a, 0);
+		Jit_CmpInt (RAX, st->b, 0);
+		Jit_Set (op == OP_EQ_E || op == OP_EQ_FNC ? CC_E : CC_NE, RAX);
+		Jit_StoreBool (st->c);
+		break;
+	case OP_AND:	case OP_OR:
+		Jit_ZeroXMM3 ();
+		Jit_LoadSS (XMM0, st->a, 0);
+		Jit_IsTrue (RAX);
+		Jit_LoadSS (XMM0, st->b, 0);
+		Jit_IsTrue (RDX);
+		if (op == OP_AND)
+			Jit_And8 (RAX, RDX);
+		else
+			Jit_Or8 (RAX, RDX);
+		Jit_StoreBool (st->c);
+		break;
+	case OP_NOT_F:
+		Jit_ZeroXMM3 ();
+		Jit_LoadSS (XMM0, st->a, 0);
+		Jit_IsZero (RAX);
+		Jit_StoreBool (st->c);
+		break;
+	case OP_NOT_V:
+		Jit_ZeroXMM3 ();
+		Jit_LoadSS (XMM0, st->a, 0);
+		Jit_IsZero (RAX);
+		for (i = 4; i < 12; i += 4)
+		{
+			Jit_LoadSS (XMM0, st->a, i);
+			Jit_IsZero (RDX);
+			Jit_And8 (RAX, RDX);
+		}
+		Jit_StoreBool (st->c);
+		break;
+	case OP_NOT_FNC:	case OP_NOT_ENT:
+		Jit_Mem (0, false, 0x83, 7, st->a, 0);	// cmp dword [a], 0
+		Jit_Byte (0);
+		Jit_Set (CC_E, RAX);
+		Jit_StoreBool (st->c);
+		break;
+	case OP_NOT_S:
+		Jit_Helper (PR_JitNotS, s, pending);
+		break;
+	case OP_EQ_S:
+		Jit_Helper (PR_JitEqS, s, pending);
+		break;
+	case OP_NE_S:
+		Jit_Helper (PR_JitNeS, s, pending);
+		break;
+
+	case OP_STORE_F:	case OP_STORE_ENT:	case OP_STORE_FLD:
+	case OP_STORE_S:	case OP_STORE_FNC:
+		Jit_LoadInt (RAX, st->a, 0);
+		Jit_StoreInt (st->b, 0, RAX);
+		break;
+	case OP_STORE_V:
+		for (i = 0; i < 12; i += 4)
+		{
+			Jit_LoadInt (RAX, st->a, i);
+			Jit_StoreInt (st->b, i, RAX);
+		}
+		break;
+	case OP_STOREP_F:	case OP_STOREP_ENT:	case OP_STOREP_FLD:
+	case OP_STOREP_S:	case OP_STOREP_FNC:	case OP_STOREP_V:
+		if (jit_checking)
+		{
+			Jit_Helper (op == OP_STOREP_V ? PR_JitStorePV : PR_JitStoreP, s, pending);
+			break;
+		}
+		Jit_LoadEdicts ();
+		Jit_LoadOffset (RCX, st->b);
+		for (i = 0; i < (op == OP_STOREP_V ? 12 : 4); i += 4)
+		{
+			Jit_LoadInt (RDX, st->a, i);
+			Jit_Bytes ("\x89\x94\x08", 3);	// mov [rax + rcx + i], edx
+			Jit_Int (i);
+		}
+		break;
+	case OP_ADDRESS:
+		Jit_Helper (PR_JitAddress, s, pending);
+		break;
+	case OP_LOAD_F:		case OP_LOAD_FLD:	case OP_LOAD_ENT:
+	case OP_LOAD_S:		case OP_LOAD_FNC:	case OP_LOAD_V:
+		Jit_LoadEdicts ();
+		Jit_LoadOffset (RCX, st->a);
+		Jit_Bytes ("\x48\x01\xc8", 3);		// add rax, rcx
+		Jit_LoadOffset (RDX, st->b);
+		for (i = 0; i < (op == OP_LOAD_V ? 12 : 4); i += 4)
+		{
+			Jit_Bytes ("\x8b\x8c\x90", 3);	// mov ecx, [rax + rdx*4 + v + i]
+			Jit_Int ((int)offsetof(edict_t, v) + i);
+			Jit_StoreInt (st->c, i, RCX);
+		}
+		break;
+	case OP_STATE:
+		Jit_Helper (PR_JitState, s, pending);
+		break;
+
+	case OP_IF:	case OP_IFNOT:	case OP_GOTO:
+		skip = -1;
+		if (op != OP_GOTO)
+		{
+			Jit_Mem (0, false, 0x83, 7, st->a, 0);	// cmp dword [a], 0
+			Jit_Byte (0);
+			Jit_Bytes (op == OP_IF ? "\x0f\x84" : "\x0f\x85", 2);	// skip the taken path
+			skip = jit_len;
+			Jit_Int (0);
+		}
+		Jit_AddCount (pending + 1);
+		Jit_Bytes ("\x81\x3b", 2);		// cmp dword [rbx], limit
+		Jit_Int (PR_RUNAWAY_LIMIT);
+		Jit_Branch (CC_LE, s + st->jump);
+		Jit_Bytes ("\x83\x2b\x01", 3);		// sub dword [rbx], 1, the interpreter counts it again
+		Jit_Exit (s);
+		if (skip < 0)
+			return false;
+		*(int *)(jit_buf + skip) = jit_len - (skip + 4);
+		break;
+	case OPX_NOP:
+		break;
+
+	default:	// calls and returns
+		Jit_AddCount (pending);
+		Jit_Exit (s);
+		return false;
+	}
+	return true;
+}
+
+/*
+====================
+Jit_Function
+
+Emits the body of f, statements start to end.  Returns false, with
+nothing emitted, for bodies native code doesn't handle.
+====================
+*/
+static qboolean Jit_Function (int start, int end, byte *label)
+{
+	int	s, t, op, runstart, fixups, len;
+
+	for (s = start; s < end; s++)
+	{
+		op = PR_JitOp (s);
+		if (op < 0 || (op >= OP_NUMOPS && op != OPX_NOP))
+			return false;
+		if (PR_JitIsBranch (op))
+		{
+			t = s + pr_code[s].jump;
+			if (t < start || t >= end)
+				return false;
+			label[t - start] = 1;
+		}
+		if (PR_JitIsExit (op) && s + 1 < end)
+			label[s + 1 - start] = 1;	// calls come back here, after a return only branches do
+	}
+	label[0] = 1;
+
+	len = jit_len;
+	fixups = jit_numfixups;
+	for (s = runstart = start; s < end; s++)
+	{
+		if (label[s - start])
+		{
+			Jit_AddCount (s - runstart);
+			runstart = s;
+			jit_offs[s] = jit_len;
+		}
+		if (!Jit_Statement (s, s - runstart))
+			runstart = s + 1;
+	}
+	Jit_AddCount (end - runstart);
+	Jit_Exit (end);	// ran off the end, like the interpreter would
+
+	for (t = fixups; t < jit_numfixups; t++)
+	{
+		s = jit_fixups[t].statement;
+		if (jit_offs[s] < 0)
+		{	// can't happen, targets are labels
+			jit_len = len;
+			jit_numfixups = fixups;
+			return false;
+		}
+		*(int *)(jit_buf + jit_fixups[t].pos) = jit_offs[s] - (jit_fixups[t].pos + 4);
+	}
+	jit_numfixups = fixups;
+	return true;
+}
+
+/*
+====================
+Jit_Stub
+
+int enter (const byte *code, int *profile) at offset 0, the shared exit
+at jit_exitpos.
+====================
+*/
+static void Jit_Stub (void)
+{
+	Jit_Bytes ("\x53\x41\x55\x41\x56", 5);	// push rbx, r13, r14
+	Jit_Bytes ("\x48\x83\xec\x20", 4);	// sub rsp, 32: aligned, with the win64 shadow space
+#ifdef _WIN64
+	Jit_Bytes ("\x48\x89\xd3", 3);		// mov rbx, rdx
+#else
+	Jit_Bytes ("\x48\x89\xf3", 3);		// mov rbx, rsi
+#endif
+	Jit_Bytes ("\x49\xbd", 2);		// mov r13, pr_globals
+	Jit_Ptr (pr_globals);
+	Jit_Bytes ("\x49\xbe", 2);		// mov r14, &sv.edicts
+	Jit_Ptr (&sv.edicts);
+#ifdef _WIN64
+	Jit_Bytes ("\xff\xe1", 2);		// jmp rcx
+#else
+	Jit_Bytes ("\xff\xe7", 2);		// jmp rdi
+#endif
+
+	jit_exitpos = jit_len;
+	Jit_Bytes ("\x48\x83\xc4\x20", 4);	// add rsp, 32
+	Jit_Bytes ("\x41\x5e\x41\x5d\x5b", 5);	// pop r14, r13, rbx
+	Jit_Byte (0xc3);			// ret
+}
+
+static int PR_JitStartCompare (const void *a, const void *b)
+{
+	return pr_functions[*(const int *)a].first_statement - pr_functions[*(const int *)b].first_statement;
+}
+
+static void PR_JitFree (void)
+{
+	if (jit_exec)
+		Sys_CodeFree (jit_exec, jit_execsize);
+	jit_exec = NULL;
+	jit_execsize = 0;
+	free (pr_jitentry);
+	free (jit_funcend);
+	pr_jitentry = NULL;
+	jit_funcend = NULL;
+}
+
+/*
+====================
+PR_JitCompile
+
+(Re)builds the native code of the loaded progs for the current pr_jit.
+====================
+*/
+void PR_JitCompile (void)
+{
+	int		*order, *entry;
+	byte		*label;
+	int		i, n, start, end, compiled, numstatements;
+
+	PR_JitFree ();
+	if (!pr_jit.value || !progs || !pr_code)
+		return;
+
+	numstatements = progs->numstatements;
+	jit_checking = (pr_jit.value >= 2);
+	jit_len = jit_numfixups = 0;
+
+	order = (int *) malloc (progs->numfunctions * sizeof(int));
+	entry = (int *) malloc (numstatements * sizeof(int) * 2);
+	label = (byte *) malloc (numstatements + 1);
+	jit_funcend = (int *) calloc (progs->numfunctions, sizeof(int));
+	if (!order || !entry || !label || !jit_funcend)
+		Sys_Error ("PR_JitCompile: out of memory");
+	jit_offs = entry + numstatements;
+
+	for (i = n = 0; i < progs->numfunctions; i++)
+	{
+		if (pr_functions[i].first_statement > 0 && pr_functions[i].first_statement < numstatements)
+			order[n++] = i;
+	}
+	qsort (order, n, sizeof(int), PR_JitStartCompare);
+
+	// a body runs up to the next one, functions may share one
+	for (i = n - 1, end = numstatements; i >= 0; i--)
+	{
+		start = pr_functions[order[i]].first_statement;
+		if (i + 1 < n && pr_functions[order[i + 1]].first_statement > start)
+			end = pr_functions[order[i + 1]].first_statement;
+		jit_funcend[order[i]] = end;
+	}
+
+	Jit_Stub ();
+	memset (entry, 0xff, numstatements * sizeof(int) * 2);
+	for (i = compiled = 0; i < n; i++)
+	{
+		start = pr_functions[order[i]].first_statement;
+		end = jit_funcend[order[i]];
+		if (i + 1 < n && pr_functions[order[i + 1]].first_statement == start)
+			continue;	// done with the next one
+		memset (label, 0, end - start + 1);
+		if (!Jit_Function (start, end, label))
+			continue;
+		for (end--; end >= start; end--)
+		{
+			if (label[end - start])
+				entry[end] = jit_offs[end];
+		}
+		compiled++;
+	}
+	free (order);
+	free (label);
+
+	jit_execsize = jit_len;
+	jit_exec = (byte *) Sys_CodeAlloc (jit_execsize);
+	pr_jitentry = (byte **) calloc (numstatements, sizeof(byte *));
+	if (!jit_exec || !pr_jitentry)
+	{
+		Con_Warning ("pr_jit: couldn't get %i KB for native code\n", jit_len / 1024);
+		free (entry);
+		PR_JitFree ();
+		return;
+	}
+	memcpy (jit_exec, jit_buf, jit_len);
+	Sys_CodeSeal (jit_exec, jit_execsize);
+	for (i = 0; i < numstatements; i++)
+	{
+		if (entry[i] >= 0)
+			pr_jitentry[i] = jit_exec + entry[i];
+	}
+	free (entry);
+
+	free (jit_buf);
+	free (jit_fixups);
+	jit_buf = NULL;
+	jit_fixups = NULL;
+	jit_max = jit_maxfixups = 0;
+
+	Con_DPrintf ("pr_jit: %i of %i functions, %i KB of native code%s\n", compiled, n, jit_execsize / 1024,
+		jit_checking ? ", checked" : "");
+}
+
+static int PR_JitEnter (int s, int *profile)
+{
+	return ((int (*) (const byte *, int *)) jit_exec) (pr_jitentry[s], profile);
+}
+
+#else	// !PR_JIT_X64
+
+void PR_JitCompile (void)
+{
+	if (pr_jit.value && progs)
+		Con_DPrintf ("pr_jit: no native code generator for this CPU\n");
+}
+
+static int PR_JitEnter (int s, int *profile)
+{
+	return s;
+}
+
+#endif	// PR_JIT_X64
+
+/*
+====================
+PR_JitCheck
+
+Runs native code from s, undoes what it did and runs the C evaluation
+instead, then compares the two.  The function is left to the
+interpreter from then on if they differ.
+====================
+*/
+static float	*jit_globals[2];
+static int	jit_globalssize;
+
+static int PR_JitCheck (int s, int *profile)
+{
+	int		i, j, size, exit, checkexit, checkprofile, numlog;
+	float		*before, *after;
+	const char	*what;
+
+	size = progs->numglobals * sizeof(float);
+	if (size > jit_globalssize)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			jit_globals[i] = (float *) realloc (jit_globals[i], size);
+			if (!jit_globals[i])
+				Sys_Error ("PR_JitCheck: out of memory");
+		}
+		jit_globalssize = size;
+	}
+	before = jit_globals[0];
+	after = jit_globals[1];
+
+	checkprofile = *profile;
+	memcpy (before, pr_globals, size);
+	jit_numlog = 0;
+	jit_logfull = false;
+	exit = PR_JitEnter (s, profile);
+	if (jit_logfull)
+		return exit;	// too much to undo, trust it
+
+	// undo it
+	memcpy (after, pr_globals, size);
+	for (i = 0; i < jit_numlog; i++)
+		jit_log[i].value = *jit_log[i].addr;
+	for (i = jit_numlog - 1; i >= 0; i--)
+		*jit_log[i].addr = jit_log[i].old;
+	memcpy (pr_globals, before, size);
+
+	// and do it again
+	numlog = jit_numlog;
+	checkexit = PR_JitEvaluate (s, jit_funcend[pr_xfunction - pr_functions], &checkprofile);
+
+	what = NULL;
+	if (checkexit != exit)
+		what = "exit";
+	else if (checkprofile != *profile)
+		what = "statement count";
+	else if (memcmp (after, pr_globals, size))
+		what = "globals";
+	else
+	{
+		for (i = 0; i < numlog && !what; i++)
+		{
+			if (*jit_log[i].addr != jit_log[i].value)
+				what = "edict fields";
+		}
+		for (i = numlog; i < jit_numlog && !what && !jit_logfull; i++)
+		{	// written by the evaluation only
+			for (j = 0; j < numlog; j++)
+			{
+				if (jit_log[j].addr == jit_log[i].addr)
+					break;
+			}
+			if (j == numlog && *jit_log[i].addr != jit_log[i].old)
+				what = "edict fields";
+		}
+	}
+
+	*profile = checkprofile;
+	if (what)
+	{
+		Con_Warning ("pr_jit: %s at statement %i of %s differ, native code dropped\n",
+			what, s, PR_GetString (pr_xfunction->s_name));
+		for (i = pr_xfunction->first_statement; i < jit_funcend[pr_xfunction - pr_functions]; i++)
+			pr_jitentry[i] = NULL;
+	}
+	return checkexit;
+}
+
+/*
+====================
+PR_JitRun
+
+Runs native code from statement s, which must have an entry.  Adds the
+statements run to profile and returns the one the interpreter carries on
+with.
+====================
+*/
+int PR_JitRun (int s, int *profile)
+{
+	if (jit_checking)
+		return PR_JitCheck (s, profile);
+	return PR_JitEnter (s, profile);
+}
+
+static void PR_JitChanged_f (cvar_t *var)
+{
+	if (sv.active)
+		PR_JitCompile ();	// otherwise the next PR_LoadProgs does
+}
+
+void PR_JitInit (void)
+{
+	Cvar_RegisterVariable (&pr_jit);
+	Cvar_SetCallback (&pr_jit, PR_JitChanged_f);
+}
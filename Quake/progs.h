@@ -39,16 +39,28 @@ typedef union eval_s
 #define	MAX_ENT_LEAFS	32
 typedef struct edict_s
 {
-	qboolean	free;
 	link_t		area;			/* linked to a division node or leaf */
+	int		areaproxy;		/* leaf in the dynamic area tree + 1, 0 = none */
+	qboolean	areatrigger;		/* that leaf is in the trigger tree */
 
-	int		num_leafs;
-	int		leafnums[MAX_ENT_LEAFS];
+	int		num_leafs;		/* PVS leafs touched, MAX_ENT_LEAFS = too many to cull */
+	int		num_leafwords;
+	int		leafwords[MAX_ENT_LEAFS];	/* those leafs as 32 bit words of a PVS ... */
+	unsigned int	leafbits[MAX_ENT_LEAFS];	/* ... and the bits in them, see SV_EdictInPVS */
 
 	entity_state_t	baseline;
 	unsigned char	alpha;			/* johnfitz -- hack to support alpha since it's not part of entvars_t */
 	qboolean	sendinterval;		/* johnfitz -- send time until nextthink to client for better lerp timing */
 
+	int		classnum;		/* classname index the edict is listed under, 0 = none */
+	int		classprev, classnext;	/* edict numbers of the same class in order, 0 = none */
+	qboolean	classchanged;		/* classname may have been written to */
+
+	link_t		freelink;		/* in sv.free_edicts while free, NULLs otherwise */
+
+	/* SV_Physics reads free and v.movetype of every edict each frame,
+	 * keep them close so they usually share a cache line */
+	qboolean	free;
 	float		freetime;		/* sv.time when the object was freed */
 	entvars_t	v;			/* C exported fields from progs */
 
@@ -56,6 +68,7 @@ typedef struct edict_s
 } edict_t;
 
 #define	EDICT_FROM_AREA(l)	STRUCT_FROM_LINK(l,edict_t,area)
+#define	EDICT_FROM_FREELINK(l)	STRUCT_FROM_LINK(l,edict_t,freelink)
 
 //============================================================================
 
@@ -67,6 +80,46 @@ extern	float		*pr_globals;	/* same as pr_global_struct */
 
 extern	int		pr_edict_size;	/* in bytes */
 
+/* pr_edict_size is a multiple of this and sv.edicts starts on one, so no
+ * edict shares a cache line with its neighbours */
+#define	EDICT_ALIGN		64
+
+/* internal opcodes made by PR_TranslateProgs, after the ones in progs.dat */
+enum
+{
+	OPX_NOP = OP_NUMOPS,	/* branch on a constant that never jumps */
+	OPX_EQ_F_IFNOT,
+	OPX_NE_F_IFNOT,
+	OPX_LT_IFNOT,
+	OPX_LE_IFNOT,
+	OPX_GT_IFNOT,
+	OPX_GE_IFNOT,
+	OPX_LOAD_F_EQ_F_IFNOT,
+	OPX_ADDRESS_STOREP,	/* followed by STOREP_F, _ENT, _FLD, _S or _FNC */
+	OPX_ADDRESS_STOREP_V,
+
+	PR_NUMOPS
+};
+
+/* one per dstatement_t, so statement numbers are the same in both.
+ * A fused instruction runs the statements it covers itself, using their
+ * operands, and the statements after the first are never branched to. */
+typedef struct
+{
+	int		op;
+	int		jump;	/* branch offset for IF, IFNOT and GOTO */
+	eval_t		*a, *b, *c;
+} prinstr_t;
+
+extern	prinstr_t	*pr_code;
+
+/* pr_jit.c: native code entry per statement, NULL where there is none */
+extern	byte		**pr_jitentry;
+
+void PR_JitInit (void);
+void PR_JitCompile (void);
+int PR_JitRun (int statement, int *profile);
+
 
 void PR_Init (void);
 
@@ -74,23 +127,40 @@ void PR_ExecuteProgram (func_t fnum);
 void PR_LoadProgs (void);
 
 const char *PR_GetString (int num);
+qboolean PR_StringValid (int num);
 int PR_SetEngineString (const char *s);
 int PR_AllocString (int bufferlength, char **ptr);
 
 void PR_Profile_f (void);
+void PR_ProfStart_f (void);
+void PR_ProfStop_f (void);
+void PR_StopProfiling (void);
 
 edict_t *ED_Alloc (void);
 void ED_Free (edict_t *ed);
+void ED_ResetFreeList (void);
 
 void ED_Print (edict_t *ed);
-void ED_Write (FILE *f, edict_t *ed);
+void ED_Write (strbuf_t *sb, edict_t *ed);
 const char *ED_ParseEdict (const char *data, edict_t *ent);
 
-void ED_WriteGlobals (FILE *f);
+void ED_WriteGlobals (strbuf_t *sb);
 const char *ED_ParseGlobals (const char *data);
 
+void ED_WriteImage (strbuf_t *sb);
+int ED_ReadImage (const byte *data, int len);
+
 void ED_LoadFromFile (const char *data);
 
+/* fields the engine keeps track of writes to */
+#define	FIELD_CLASSNAME		((int)(offsetof(entvars_t, classname) / 4))	/* classname index, for PF_Find */
+#define	FIELD_NEXTTHINK		((int)(offsetof(entvars_t, nextthink) / 4))	/* think schedule */
+#define	FIELD_MOVETYPE		((int)(offsetof(entvars_t, movetype) / 4))
+
+void ED_ClassnameChanged (edict_t *ed);
+void ED_UpdateClassnames (qboolean framedone);
+edict_t *ED_FindClassname (int start, const char *name);
+
 /*
 #define EDICT_NUM(n)		((edict_t *)(sv.edicts+ (n)*pr_edict_size))
 #define NUM_FOR_EDICT(e)	(((byte *)(e) - sv.edicts) / pr_edict_size)
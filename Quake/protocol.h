@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	PROTOCOL_NETQUAKE	15 //johnfitz -- standard quake protocol
 #define PROTOCOL_FITZQUAKE	666 //johnfitz -- added new protocol for fitzquake 0.85
 #define PROTOCOL_RMQ		999
+#define PROTOCOL_DELTA		1000	// PROTOCOL_FITZQUAKE, with entities sent as changes from a frame the client has acknowledged
 
 // PROTOCOL_RMQ protocol flags
 #define PRFL_SHORTANGLE		(1 << 1)
@@ -64,7 +65,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define U_MODEL2		(1<<18) // 1 byte, this is .modelindex & 0xFF00 (second byte)
 #define U_LERPFINISH	(1<<19) // 1 byte, 0.0-1.0 maps to 0-255, not sent if exactly 0.1, this is ent->v.nextthink - sv.time, used for lerping
 #define U_SCALE			(1<<20) // 1 byte, for PROTOCOL_RMQ PRFL_EDICTSCALE, currently read but ignored
-#define U_UNUSED21		(1<<21)
+#define U_REMOVE		(1<<21) // PROTOCOL_DELTA: entity was in the reference frame but isn't in this one, no data follows
 #define U_UNUSED22		(1<<22)
 #define U_EXTEND2		(1<<23) // another byte to follow, future expansion
 //johnfitz
@@ -201,6 +202,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	svc_spawnstaticsound2	44	// [coord3] [short] samp [byte] vol [byte] aten
 //johnfitz
 
+#define	svc_entityframe			45	// PROTOCOL_DELTA: [long] frame [long] reference frame, 0 = baselines
+
 //used by the 2021 rerelease
 //Note: same value as svcdp_effect!
 #define svc_achievement				52		// [string] id
@@ -211,8 +214,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	clc_bad			0
 #define	clc_nop 		1
 #define	clc_disconnect	2
-#define	clc_move		3		// [usercmd_t]
+#define	clc_move		3		// [usercmd_t], PROTOCOL_DELTA adds [long] last complete entity frame
 #define	clc_stringcmd	4		// [string] message
+#define	clc_moves		5		// PROTOCOL_DELTA: [float] time [byte] count [long] sequence of the last,
+								// count of [angle16 x3 short x3 byte byte] oldest first, [long] entity frame
 
 //
 // temp entity events
@@ -247,6 +252,26 @@ typedef struct
 	int		effects;
 } entity_state_t;
 
+// PROTOCOL_DELTA -- both sides keep the last ENTFRAMES entity frames, the
+// server sends each entity as a change from how it was in the frame the
+// client last acknowledged, or from its baseline if it wasn't in it, and
+// leaves out the ones that didn't change
+#define	ENTFRAMES	16	// power of two
+
+typedef struct
+{
+	int		num;
+	int		bits;		// U_STEP
+	entity_state_t	state;
+} entframeent_t;
+
+typedef struct
+{
+	int		sequence;	// 0 = not a complete frame
+	int		numents, maxents;
+	entframeent_t	*ents;		// sorted by num
+} entframe_t;
+
 typedef struct
 {
 	vec3_t	viewangles;
@@ -27,6 +27,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #if USE_FMOD
 typedef struct FMOD_SOUND FMOD_SOUND;
+typedef struct FMOD_CHANNEL FMOD_CHANNEL;
+
+#define	MAX_SFX_INSTANCES	16	// upper bound for snd_maxinstances
 #endif
 
 /* !!! if this is changed, it must be changed in asm_i386.h too !!! */
@@ -45,6 +48,15 @@ typedef struct sfx_s
 	unsigned int length;	// milliseconds
 	int loopstart;
 	int loopend;
+	qboolean pending;	// background load in progress
+	byte *loaddata;		// what FMOD's loading thread reads from while pending, freed when it's done
+	byte *view;		// mapped file the sample data is played from, if any
+	int viewlength;
+	int resampled;		// bytes of output rate PCM16 made for snd_resample, 0 if not resampled
+	int resampledsrc;	// bytes of source PCM it was made from
+	int numinstances;	// channels recently started with this sound, for snd_maxinstances
+	FMOD_CHANNEL *instances[MAX_SFX_INSTANCES];
+	double instancetime[MAX_SFX_INSTANCES];
 #endif
 } sfx_t;
 
@@ -101,6 +113,7 @@ typedef struct
 
 void S_Init (void);
 void S_Startup (void);
+void S_FinishStartup (void);	// waits for a device S_Startup left opening
 void S_Shutdown (void);
 void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation);
 void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation);
@@ -118,7 +131,32 @@ void S_TouchSound (const char *sample);
 void S_ClearPrecache (void);
 void S_BeginPrecaching (void);
 void S_EndPrecaching (void);
+
+#define	MAX_SOUND_STATS_LINES	8
+#define	SOUND_STATS_LINE_LEN	24
+/* fills in the snd_stats overlay text, returns the number of lines */
+int S_GetStatsLines (char lines[MAX_SOUND_STATS_LINES][SOUND_STATS_LINE_LEN]);
+/* bytes in the sound system's own heap, false if the sounds are in the cache */
+qboolean S_GetMemoryStats (int *current, int *peak);
 void S_PaintChannels (int endtime);
+
+#define	PAINTBUFFER_SIZE	2048
+
+// software mixer inner loops, picked for the CPU by SND_InitMixKernels
+typedef struct
+{
+	const char	*name;
+	void	(*paint8) (int *pb, const byte *sfx, int count, const int *lscale, const int *rscale);	// pb += snd_scaletable entries
+	void	(*paint16) (int *pb, const short *sfx, int count, int leftvol, int rightvol);	// pb += sample * vol
+	void	(*clip) (int *pb, int count);	// clamp to 0dB and halve
+	void	(*lowpass) (int *data, int stride, int count, const float *input, const float *kernel, int kernelsize, int parity);
+	void	(*transfer16) (short *out, const int *in, int count);	// to 16 bit, clamped
+} mixkernels_t;
+
+extern mixkernels_t snd_mixkernels;
+extern int snd_scaletable[32][256];
+void SND_InitMixKernels (void);
+const char *SND_MixKernelsName (void);	/* "FMOD" when FMOD does the mixing */
 void S_InitPaintChannels (void);
 
 /* picks a channel based on priorities, empty slots, number of channels */
@@ -127,6 +165,9 @@ channel_t *SND_PickChannel (int entnum, int entchannel);
 /* spatializes a channel */
 void SND_Spatialize (channel_t *ch);
 
+/* sample data for the mixer, NULL while it isn't cached */
+sfxcache_t *SND_CachedSound (sfx_t *sfx);
+
 /* music stream support */
 void S_RawSamples(int samples, int rate, int width, int channels, byte * data, float volume);
 				/* Expects data in signed 16 bit, or unsigned 8 bit format. */
@@ -193,6 +234,36 @@ extern	cvar_t		nosound;
 extern	cvar_t		ambient_level;
 extern	cvar_t		ambient_fade;
 
+#if USE_FMOD
+extern	cvar_t		snd_asyncload;
+extern	cvar_t		snd_updaterate;
+extern	cvar_t		snd_maxinstances;
+extern	cvar_t		snd_voicesteal;
+extern	cvar_t		snd_occlusion;
+extern	cvar_t		snd_pvscull;
+extern	cvar_t		snd_reverb;
+extern	cvar_t		snd_soundbanks;
+extern	cvar_t		snd_compressedsamples;
+extern	cvar_t		snd_resample;
+extern	cvar_t		snd_staticcluster;
+extern	cvar_t		snd_voicebudget;
+extern	cvar_t		snd_virtualvol;
+extern	cvar_t		snd_memory;
+extern	cvar_t		snd_stats;
+extern	cvar_t		snd_statslog;
+extern	cvar_t		snd_doppler;
+extern	cvar_t		snd_output;
+extern	cvar_t		snd_dspbuffersize;
+extern	cvar_t		snd_dspbuffers;
+extern	cvar_t		snd_samplerate;
+
+void S_SoundList (void);
+#if USE_FMOD
+void S_MemStats_f (void);
+void S_Restart_f (void);
+#endif
+#endif
+
 void S_LocalSound (const char *name);
 sfxcache_t *S_LoadSound (sfx_t *s);
 
@@ -200,5 +271,8 @@ wavinfo_t GetWavinfo (const char *name, byte *wav, int wavlength);
 
 void SND_InitScaletable (void);
 
+/* prints S_FindName lookup counters */
+void SND_PrintLookupStats (void);
+
 #endif	/* __QUAKE_SOUND__ */
 
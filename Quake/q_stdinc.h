@@ -235,6 +235,13 @@ typedef ptrdiff_t	ssize_t;
 #define FUNC_NOCLONE
 #endif
 
+/* a cache hint only, compiles to nothing where it isn't supported */
+#if defined(__GNUC__)
+#define Q_PREFETCH(p)	__builtin_prefetch(p)
+#else
+#define Q_PREFETCH(p)	((void)0)
+#endif
+
 #if defined(_MSC_VER) && !defined(__cplusplus)
 #define inline __inline
 #endif	/* _MSC_VER */
@@ -202,6 +202,8 @@ typedef struct
 	char	**argv;
 	void	*membase;
 	int	memsize;
+	qboolean	memreserved;	// membase is reserved address space, see Hunk_Commit
+	qboolean	memhuge;	// membase is from Sys_MemAllocHuge (-hugepages)
 	int	numcpus;
 	int	errstate;
 } quakeparms_t;
@@ -209,6 +211,8 @@ typedef struct
 #include "common.h"
 #include "bspfile.h"
 #include "sys.h"
+#include "tasks.h"
+#include "trace.h"
 #include "zone.h"
 #include "mathlib.h"
 #include "cvar.h"
@@ -277,6 +281,7 @@ extern	quakeparms_t *host_parms;
 
 extern	cvar_t		sys_ticrate;
 extern	cvar_t		sys_throttle;
+extern	cvar_t		host_pacing;
 extern	cvar_t		sys_nostdout;
 extern	cvar_t		developer;
 extern	cvar_t		max_edicts; //johnfitz
@@ -297,10 +302,31 @@ typedef struct filelist_item_s
 extern filelist_item_t	*modlist;
 extern filelist_item_t	*extralevels;
 extern filelist_item_t	*demolist;
+extern int		nummods, numextralevels, numdemos;	// items in the lists, which are arrays
 
 void Host_ClearMemory (void);
+void Host_ClearMemoryForMap (const char *worldname);
+void Host_KeepWorld (qmodel_t *world);
 void Host_ServerFrame (void);
+qboolean Host_Hibernating (void);
+
+typedef struct
+{
+	int		hunk, hunksize;	// low and high hunk in use, the whole hunk
+	int		zone;		// in the hunk
+	int		cache;		// cached data of all categories
+	int		edicts;		// sv.edicts, malloced
+	double	textures;	// GL textures and texture arrays, estimated
+	int		buffers;	// GL vertex, index and pixel buffers
+	int		sound, soundpeak;	// the sound system's own heap
+	qboolean	soundheap;	// false with the sounds in the cache
+} memstats_t;
+
+extern memstats_t	host_mempeak;	// since the last map change
+void Host_GetMemStats (memstats_t *m);
+void Host_LogMemPeaks (void);
 void Host_InitCommands (void);
+void Host_FinishSavegame (qboolean wait);
 void Host_Init (void);
 void Host_Shutdown(void);
 void Host_Callback_Notify (cvar_t *var);	/* callback function for CVAR_NOTIFY */
@@ -311,6 +337,7 @@ FUNC_NORETURN void Host_EndGame (const char *message, ...) FUNC_PRINTF(1,2);
 #pragma aux Host_EndGame aborts;
 #endif
 void Host_Frame (float time);
+double Host_FrameDelay (double time);
 void Host_Quit_f (void);
 void Host_ClientCommands (const char *fmt, ...) FUNC_PRINTF(1,2);
 void Host_ShutdownServer (qboolean crash);
@@ -322,12 +349,14 @@ void DemoList_Init (void);
 
 void ExtraMaps_NewGame (void);
 void DemoList_Rebuild (void);
+void FileLists_Update (qboolean wait);
 
 extern int		current_skill;	// skill level for currently loaded level (in case
 					//  the user changes the cvar while the level is
 					//  running, this reflects the level actually in use)
 
 extern qboolean		isDedicated;
+extern int		host_instance;	// which of the -instances servers this is, 0 for the first
 
 extern int		minimum_memory;
 
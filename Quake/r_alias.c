@@ -30,6 +30,11 @@ extern cvar_t scr_fov, cl_gun_fovscale;
 //up to 16 color translated skins
 gltexture_t *playertextures[MAX_SCOREBOARD]; //johnfitz -- changed to an array of pointers
 
+// shirt and pants masks of the player skins, when the shader does the
+// translation instead (r_alias_colormap), see R_TranslateNewPlayerSkin
+gltexture_t *playercolormaps[MAX_SCOREBOARD];
+qboolean r_alias_colormap;
+
 #define NUMVERTEXNORMALS	162
 
 float	r_avertexnormals[NUMVERTEXNORMALS][3] =
@@ -67,53 +72,79 @@ typedef struct {
 } lerpdata_t;
 //johnfitz
 
-static GLuint r_alias_program;
-
-// uniforms used in vert shader
-static GLuint blendLoc;
-static GLuint shadevectorLoc;
-static GLuint lightColorLoc;
-
-// uniforms used in frag shader
-static GLuint texLoc;
-static GLuint fullbrightTexLoc;
-static GLuint useFullbrightTexLoc;
-static GLuint useOverbrightLoc;
-static GLuint useAlphaTestLoc;
+typedef struct
+{
+	GLuint	program;
+
+	// uniforms used in vert shader, per instance attributes when instanced
+	GLuint	blendLoc;
+	GLuint	shadevectorLoc;
+	GLuint	lightColorLoc;
+
+	GLuint	shadeDotsLoc;
+
+	// uniforms used in frag shader
+	GLuint	texLoc;
+	GLuint	fullbrightTexLoc;
+	GLuint	useFullbrightTexLoc;
+	GLuint	useOverbrightLoc;
+	GLuint	useAlphaTestLoc;
+	GLuint	useColormapLoc;
+	GLuint	colormapTexLoc;
+	GLuint	colorRampsLoc;
+	GLuint	shirtRowLoc;
+	GLuint	pantsRowLoc;
+} aliasprogram_t;
+
+static aliasprogram_t r_alias_program;
+static aliasprogram_t r_alias_instanced_program;
 
 #define pose1VertexAttrIndex 0
 #define pose1NormalAttrIndex 1
 #define pose2VertexAttrIndex 2
 #define pose2NormalAttrIndex 3
 #define texCoordsAttrIndex 4
-
-/*
-=============
-GLARB_GetXYZOffset
-
-Returns the offset of the first vertex's meshxyz_t.xyz in the vbo for the given
-model and pose.
-=============
-*/
-static void *GLARB_GetXYZOffset (aliashdr_t *hdr, int pose)
+#define modelRow0AttrIndex 5
+#define modelRow1AttrIndex 6
+#define modelRow2AttrIndex 7
+#define shadeBlendAttrIndex 8
+#define lightColorAttrIndex 9
+#define pose1NormalIndexAttrIndex 10
+#define pose2NormalIndexAttrIndex 11
+
+// r_avertexnormal_dots as a texture, looked up in the vertex shader when
+// the hardware can (SHADEDOTS), see R_InitAliasTextures
+static gltexture_t	*r_shadedots_texture;
+static gltexture_t	*r_white_texture;
+static qboolean		r_alias_shadedots;
+
+// the shirt and pants color ramps of the palette, a row per color
+static gltexture_t	*r_colorramps_texture;
+
+// shirt and pants rows for the colormap of the next GL_DrawAliasFrame_GLSL
+static float		colormaprows[2];
+
+// per instance data of the instanced shader, in attribute order
+typedef struct
 {
-	const int xyzoffs = offsetof (meshxyz_t, xyz);
-	return (void *) (currententity->model->vboxyzofs + (hdr->numverts_vbo * pose * sizeof (meshxyz_t)) + xyzoffs);
-}
+	float	rows[3][4];	// model to world transform
+	float	shadeblend[4];	// shade vector, blend
+	float	lightcolor[4];
+} aliasinstancedata_t;
 
-/*
-=============
-GLARB_GetNormalOffset
-
-Returns the offset of the first vertex's meshxyz_t.normal in the vbo for the
-given model and pose.
-=============
-*/
-static void *GLARB_GetNormalOffset (aliashdr_t *hdr, int pose)
+typedef struct
 {
-	const int normaloffs = offsetof (meshxyz_t, normal);
-	return (void *)(currententity->model->vboxyzofs + (hdr->numverts_vbo * pose * sizeof (meshxyz_t)) + normaloffs);
-}
+	qmodel_t	*model;
+	aliashdr_t	*paliashdr;
+	gltexture_t	*tx, *fb;
+	short		pose1, pose2;
+	aliasinstancedata_t	data;
+} aliasinstance_t;
+
+// opaque alias models queued by R_BatchAliasModel
+static aliasinstance_t	r_aliasinstances[MAX_VISEDICTS];
+static aliasinstance_t	*r_aliasinstance_order[MAX_VISEDICTS];
+static int		r_numaliasinstances;
 
 /*
 =============
@@ -127,23 +158,57 @@ void GLAlias_CreateShaders (void)
 		{ "Pose1Vert", pose1VertexAttrIndex },
 		{ "Pose1Normal", pose1NormalAttrIndex },
 		{ "Pose2Vert", pose2VertexAttrIndex },
-		{ "Pose2Normal", pose2NormalAttrIndex }
+		{ "Pose2Normal", pose2NormalAttrIndex },
+		{ "ModelRow0", modelRow0AttrIndex },
+		{ "ModelRow1", modelRow1AttrIndex },
+		{ "ModelRow2", modelRow2AttrIndex },
+		{ "ShadeBlend", shadeBlendAttrIndex },
+		{ "InstanceLightColor", lightColorAttrIndex },
+		{ "Pose1NormalIndex", pose1NormalIndexAttrIndex },
+		{ "Pose2NormalIndex", pose2NormalIndexAttrIndex }
 	};
 
+	// INSTANCED: the entity transform, lerp and lighting come from per
+	// instance attributes (see aliasinstancedata_t) instead of the
+	// modelview matrix and uniforms.
+	// SHADEDOTS: the shading comes from the anorm_dots table, indexed by
+	// the vertex normal and the row ShadeVector points at, like
+	// GL_DrawAliasFrame does. A zero ShadeVector turns shading off in
+	// both versions.
 	const GLchar *vertSource = \
-		"#version 110\n"
-		"\n"
+		"#ifdef INSTANCED\n"
+		"attribute vec4 ModelRow0;\n"
+		"attribute vec4 ModelRow1;\n"
+		"attribute vec4 ModelRow2;\n"
+		"attribute vec4 ShadeBlend;\n"
+		"attribute vec4 InstanceLightColor;\n"
+		"#define Blend ShadeBlend.w\n"
+		"#define ShadeVector ShadeBlend.xyz\n"
+		"#define LightColor InstanceLightColor\n"
+		"#else\n"
 		"uniform float Blend;\n"
 		"uniform vec3 ShadeVector;\n"
 		"uniform vec4 LightColor;\n"
+		"#endif\n"
 		"attribute vec4 TexCoords; // only xy are used \n"
 		"attribute vec4 Pose1Vert;\n"
 		"attribute vec3 Pose1Normal;\n"
 		"attribute vec4 Pose2Vert;\n"
 		"attribute vec3 Pose2Normal;\n"
+		"#ifdef SHADEDOTS\n"
+		"attribute float Pose1NormalIndex;\n"
+		"attribute float Pose2NormalIndex;\n"
+		"uniform sampler2D ShadeDots;\n"
+		"#endif\n"
 		"\n"
 		"varying float FogFragCoord;\n"
 		"\n"
+		"#ifdef SHADEDOTS\n"
+		"float r_avertexnormal_dot(float index, float row)\n"
+		"{\n"
+		"	return texture2DLod(ShadeDots, vec2((index + 0.5) / 256.0, (row + 0.5) / 16.0), 0.0).r * 2.0;\n"
+		"}\n"
+		"#endif\n"
 		"float r_avertexnormal_dot(vec3 vertexnormal) // from MH \n"
 		"{\n"
 		"        float dot = dot(vertexnormal, ShadeVector);\n"
@@ -157,21 +222,38 @@ void GLAlias_CreateShaders (void)
 		"{\n"
 		"	gl_TexCoord[0] = TexCoords;\n"
 		"	vec4 lerpedVert = mix(vec4(Pose1Vert.xyz, 1.0), vec4(Pose2Vert.xyz, 1.0), Blend);\n"
+		"#ifdef INSTANCED\n"
+		"	lerpedVert = vec4(dot(ModelRow0, lerpedVert), dot(ModelRow1, lerpedVert), dot(ModelRow2, lerpedVert), 1.0);\n"
+		"#endif\n"
 		"	gl_Position = gl_ModelViewProjectionMatrix * lerpedVert;\n"
 		"	FogFragCoord = gl_Position.w;\n"
+		"#ifdef SHADEDOTS\n"
+		"	float dot1 = 1.0;\n"
+		"	float dot2 = 1.0;\n"
+		"	if (ShadeVector != vec3(0.0))\n"
+		"	{\n"
+		"		float row = mod(floor(-atan(ShadeVector.y, ShadeVector.x) * (16.0 / 6.283185)), 16.0);\n"
+		"		dot1 = r_avertexnormal_dot(Pose1NormalIndex, row);\n"
+		"		dot2 = r_avertexnormal_dot(Pose2NormalIndex, row);\n"
+		"	}\n"
+		"#else\n"
 		"	float dot1 = r_avertexnormal_dot(Pose1Normal);\n"
 		"	float dot2 = r_avertexnormal_dot(Pose2Normal);\n"
+		"#endif\n"
 		"	gl_FrontColor = LightColor * vec4(vec3(mix(dot1, dot2, Blend)), 1.0);\n"
 		"}\n";
 
 	const GLchar *fragSource = \
-		"#version 110\n"
-		"\n"
 		"uniform sampler2D Tex;\n"
 		"uniform sampler2D FullbrightTex;\n"
 		"uniform bool UseFullbrightTex;\n"
 		"uniform bool UseOverbright;\n"
 		"uniform bool UseAlphaTest;\n"
+		"uniform bool UseColormap;\n"
+		"uniform sampler2D ColormapTex;\n"
+		"uniform sampler2D ColorRamps;\n"
+		"uniform float ShirtRow;\n"
+		"uniform float PantsRow;\n"
 		"\n"
 		"varying float FogFragCoord;\n"
 		"\n"
@@ -180,6 +262,18 @@ void GLAlias_CreateShaders (void)
 		"	vec4 result = texture2D(Tex, gl_TexCoord[0].xy);\n"
 		"	if (UseAlphaTest && (result.a < 0.666))\n"
 		"		discard;\n"
+		"	if (UseColormap)\n"
+		"	{\n"
+		"		vec3 mask = texture2D(ColormapTex, gl_TexCoord[0].xy).rgb;\n"
+		"		float cover = mask.r + mask.g;\n"
+		"		if (cover > 0.0)\n"
+		"		{\n"
+		"			float shade = (mask.b / cover * 15.0 + 0.5) / 16.0;\n"
+		"			vec3 shirt = texture2D(ColorRamps, vec2(shade, ShirtRow)).rgb;\n"
+		"			vec3 pants = texture2D(ColorRamps, vec2(shade, PantsRow)).rgb;\n"
+		"			result.rgb = mix(result.rgb, (shirt * mask.r + pants * mask.g) / cover, min(cover, 1.0));\n"
+		"		}\n"
+		"	}\n"
 		"	result *= gl_Color;\n"
 		"	if (UseOverbright)\n"
 		"		result.rgb *= 2.0;\n"
@@ -193,22 +287,157 @@ void GLAlias_CreateShaders (void)
 		"	gl_FragColor = result;\n"
 		"}\n";
 
+	char	vert[4096], frag[4096];
+	int		i;
+	GLint	vertexunits, fragmentunits;
+	aliasprogram_t	*p;
+
+	memset (&r_alias_program, 0, sizeof(r_alias_program));
+	memset (&r_alias_instanced_program, 0, sizeof(r_alias_instanced_program));
+	r_alias_shadedots = false;
+	r_alias_colormap = false;
+
 	if (!gl_glsl_alias_able)
 		return;
 
-	r_alias_program = GL_CreateProgram (vertSource, fragSource, sizeof(bindings)/sizeof(bindings[0]), bindings);
+	vertexunits = 0;
+	glGetIntegerv (GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertexunits);
+	r_alias_shadedots = vertexunits > 0;
+
+	// the colormap mask and the ramps go in units 3 and 4
+	fragmentunits = 0;
+	glGetIntegerv (GL_MAX_TEXTURE_IMAGE_UNITS, &fragmentunits);
+	r_alias_colormap = fragmentunits >= 5;
 
-	if (r_alias_program != 0)
+	for (i = 0; i < 2; i++)
 	{
+		if (i && !gl_instanced_arrays_able)
+			break;
+
+		p = i ? &r_alias_instanced_program : &r_alias_program;
+		q_snprintf (vert, sizeof(vert), "#version 110\n%s%s\n%s", i ? "#define INSTANCED\n" : "",
+				r_alias_shadedots ? "#define SHADEDOTS\n" : "", vertSource);
+		q_snprintf (frag, sizeof(frag), "#version 110\n\n%s", fragSource);
+
+		p->program = GL_CreateProgram (vert, frag, sizeof(bindings)/sizeof(bindings[0]), bindings);
+		if (p->program == 0)
+			continue;
+
 	// get uniform locations
-		blendLoc = GL_GetUniformLocation (&r_alias_program, "Blend");
-		shadevectorLoc = GL_GetUniformLocation (&r_alias_program, "ShadeVector");
-		lightColorLoc = GL_GetUniformLocation (&r_alias_program, "LightColor");
-		texLoc = GL_GetUniformLocation (&r_alias_program, "Tex");
-		fullbrightTexLoc = GL_GetUniformLocation (&r_alias_program, "FullbrightTex");
-		useFullbrightTexLoc = GL_GetUniformLocation (&r_alias_program, "UseFullbrightTex");
-		useOverbrightLoc = GL_GetUniformLocation (&r_alias_program, "UseOverbright");
-		useAlphaTestLoc = GL_GetUniformLocation (&r_alias_program, "UseAlphaTest");
+		if (!i)
+		{
+			p->blendLoc = GL_GetUniformLocation (&p->program, "Blend");
+			p->shadevectorLoc = GL_GetUniformLocation (&p->program, "ShadeVector");
+			p->lightColorLoc = GL_GetUniformLocation (&p->program, "LightColor");
+		}
+		if (r_alias_shadedots)
+			p->shadeDotsLoc = GL_GetUniformLocation (&p->program, "ShadeDots");
+		p->texLoc = GL_GetUniformLocation (&p->program, "Tex");
+		p->fullbrightTexLoc = GL_GetUniformLocation (&p->program, "FullbrightTex");
+		p->useFullbrightTexLoc = GL_GetUniformLocation (&p->program, "UseFullbrightTex");
+		p->useOverbrightLoc = GL_GetUniformLocation (&p->program, "UseOverbright");
+		p->useAlphaTestLoc = GL_GetUniformLocation (&p->program, "UseAlphaTest");
+		if (!i)
+		{
+			p->useColormapLoc = GL_GetUniformLocation (&p->program, "UseColormap");
+			p->colormapTexLoc = GL_GetUniformLocation (&p->program, "ColormapTex");
+			p->colorRampsLoc = GL_GetUniformLocation (&p->program, "ColorRamps");
+			p->shirtRowLoc = GL_GetUniformLocation (&p->program, "ShirtRow");
+			p->pantsRowLoc = GL_GetUniformLocation (&p->program, "PantsRow");
+		}
+	}
+
+	// instanced drawing is only used alongside the plain path
+	if (!r_alias_program.program)
+	{
+		memset (&r_alias_instanced_program, 0, sizeof(r_alias_instanced_program));
+		r_alias_colormap = false;
+	}
+}
+
+/*
+=============
+R_InitAliasTextures
+
+The shadedots texture holds r_avertexnormal_dots halved, so the values fit
+in a byte; a row per quantized angle, a column per normal.
+
+The color ramps texture has a row per player color, running from light to
+dark the same way TexMgr_ReloadImage translates the skins. It's indexed,
+so it follows the palette.
+=============
+*/
+void R_InitAliasTextures (void)
+{
+	static byte	shadedots_data[SHADEDOT_QUANT * 256 * 4];
+	static byte	white_data[4] = {255, 255, 255, 255};
+	static byte	colorramps_data[16 * 16];
+	byte	*dst;
+	int		i, j;
+
+	for (i = 0, dst = shadedots_data; i < SHADEDOT_QUANT; i++)
+	{
+		for (j = 0; j < 256; j++, dst += 4)
+			dst[0] = dst[1] = dst[2] = dst[3] = (byte) CLAMP (0, (int) (r_avertexnormal_dots[i][j] * 127.5f + 0.5f), 255);
+	}
+
+	r_shadedots_texture = TexMgr_LoadImage (NULL, "shadedots", 256, SHADEDOT_QUANT, SRC_RGBA, shadedots_data, "", (src_offset_t)shadedots_data, TEXPREF_NEAREST | TEXPREF_PERSIST | TEXPREF_NOPICMIP);
+	r_white_texture = TexMgr_LoadImage (NULL, "white", 1, 1, SRC_RGBA, white_data, "", (src_offset_t)white_data, TEXPREF_NEAREST | TEXPREF_PERSIST | TEXPREF_NOPICMIP);
+
+	for (i = 0, dst = colorramps_data; i < 16; i++)
+	{
+		for (j = 0; j < 16; j++)
+			*dst++ = (i < 8) ? i * 16 + j : i * 16 + 15 - j;
+	}
+
+	r_colorramps_texture = TexMgr_LoadImage (NULL, "colorramps", 16, 16, SRC_INDEXED, colorramps_data, "", (src_offset_t)colorramps_data, TEXPREF_LINEAR | TEXPREF_PERSIST | TEXPREF_NOPICMIP);
+}
+
+/*
+=============
+GLAlias_EnableVertexArrays
+=============
+*/
+static void GLAlias_EnableVertexArrays (qboolean enable)
+{
+	void (APIENTRY *func) (GLuint) = enable ? GL_EnableVertexAttribArrayFunc : GL_DisableVertexAttribArrayFunc;
+
+	func (texCoordsAttrIndex);
+	func (pose1VertexAttrIndex);
+	func (pose2VertexAttrIndex);
+	func (pose1NormalAttrIndex);
+	func (pose2NormalAttrIndex);
+	if (r_alias_shadedots)
+	{
+		func (pose1NormalIndexAttrIndex);
+		func (pose2NormalIndexAttrIndex);
+	}
+}
+
+/*
+=============
+GLAlias_SetupVertexArrays
+
+Points the per vertex attributes at the given poses of the model's vbo,
+which must be bound.
+=============
+*/
+static void GLAlias_SetupVertexArrays (qmodel_t *m, aliashdr_t *hdr, int pose1, int pose2)
+{
+	const byte	*xyz1 = (const byte *)(intptr_t)m->vboxyzofs + hdr->numverts_vbo * pose1 * sizeof (meshxyz_t);
+	const byte	*xyz2 = (const byte *)(intptr_t)m->vboxyzofs + hdr->numverts_vbo * pose2 * sizeof (meshxyz_t);
+
+	GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)(intptr_t)m->vbostofs);
+	GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), xyz1 + offsetof (meshxyz_t, xyz));
+	GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), xyz2 + offsetof (meshxyz_t, xyz));
+// GL_TRUE to normalize the signed bytes to [-1 .. 1]
+	GL_VertexAttribPointerFunc (pose1NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), xyz1 + offsetof (meshxyz_t, normal));
+	GL_VertexAttribPointerFunc (pose2NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), xyz2 + offsetof (meshxyz_t, normal));
+	if (r_alias_shadedots)
+	{
+	// the normal index is kept in the fourth normal byte
+		GL_VertexAttribPointerFunc (pose1NormalIndexAttrIndex, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), xyz1 + offsetof (meshxyz_t, normal[3]));
+		GL_VertexAttribPointerFunc (pose2NormalIndexAttrIndex, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), xyz2 + offsetof (meshxyz_t, normal[3]));
 	}
 }
 
@@ -221,12 +450,13 @@ Compared to the original GL_DrawAliasFrame, this makes 1 draw call,
 no vertex data is uploaded (it's already in the r_meshvbo and r_meshindexesvbo
 static VBOs), and lerping and lighting is done in the vertex shader.
 
-Supports optional overbright, optional fullbright pixels.
+Supports optional overbright, optional fullbright pixels, and translating
+the player colors with a colormap mask (cm) instead of a translated skin.
 
 Based on code by MH from RMQEngine
 =============
 */
-void GL_DrawAliasFrame_GLSL (aliashdr_t *paliashdr, lerpdata_t lerpdata, gltexture_t *tx, gltexture_t *fb)
+void GL_DrawAliasFrame_GLSL (aliashdr_t *paliashdr, lerpdata_t lerpdata, gltexture_t *tx, gltexture_t *fb, gltexture_t *cm)
 {
 	float	blend;
 
@@ -239,35 +469,47 @@ void GL_DrawAliasFrame_GLSL (aliashdr_t *paliashdr, lerpdata_t lerpdata, gltextu
 		blend = 0;
 	}
 
-	GL_UseProgramFunc (r_alias_program);
+	GL_UseProgramFunc (r_alias_program.program);
 
 	GL_BindBuffer (GL_ARRAY_BUFFER, currententity->model->meshvbo);
 	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, currententity->model->meshindexesvbo);
 
-	GL_EnableVertexAttribArrayFunc (texCoordsAttrIndex);
-	GL_EnableVertexAttribArrayFunc (pose1VertexAttrIndex);
-	GL_EnableVertexAttribArrayFunc (pose2VertexAttrIndex);
-	GL_EnableVertexAttribArrayFunc (pose1NormalAttrIndex);
-	GL_EnableVertexAttribArrayFunc (pose2NormalAttrIndex);
-
-	GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)(intptr_t)currententity->model->vbostofs);
-	GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (paliashdr, lerpdata.pose1));
-	GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (paliashdr, lerpdata.pose2));
-// GL_TRUE to normalize the signed bytes to [-1 .. 1]
-	GL_VertexAttribPointerFunc (pose1NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (paliashdr, lerpdata.pose1));
-	GL_VertexAttribPointerFunc (pose2NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (paliashdr, lerpdata.pose2));
+	GLAlias_EnableVertexArrays (true);
+	GLAlias_SetupVertexArrays (currententity->model, paliashdr, lerpdata.pose1, lerpdata.pose2);
 
 // set uniforms
-	GL_Uniform1fFunc (blendLoc, blend);
-	GL_Uniform3fFunc (shadevectorLoc, shadevector[0], shadevector[1], shadevector[2]);
-	GL_Uniform4fFunc (lightColorLoc, lightcolor[0], lightcolor[1], lightcolor[2], entalpha);
-	GL_Uniform1iFunc (texLoc, 0);
-	GL_Uniform1iFunc (fullbrightTexLoc, 1);
-	GL_Uniform1iFunc (useFullbrightTexLoc, (fb != NULL) ? 1 : 0);
-	GL_Uniform1fFunc (useOverbrightLoc, overbright ? 1 : 0);
-	GL_Uniform1iFunc (useAlphaTestLoc, (currententity->model->flags & MF_HOLEY) ? 1 : 0);
+	GL_Uniform1fFunc (r_alias_program.blendLoc, blend);
+	GL_Uniform3fFunc (r_alias_program.shadevectorLoc, shadevector[0], shadevector[1], shadevector[2]);
+	GL_Uniform4fFunc (r_alias_program.lightColorLoc, lightcolor[0], lightcolor[1], lightcolor[2], entalpha);
+	GL_Uniform1iFunc (r_alias_program.texLoc, 0);
+	GL_Uniform1iFunc (r_alias_program.fullbrightTexLoc, 1);
+	GL_Uniform1iFunc (r_alias_program.useFullbrightTexLoc, (fb != NULL) ? 1 : 0);
+	GL_Uniform1fFunc (r_alias_program.useOverbrightLoc, overbright ? 1 : 0);
+	GL_Uniform1iFunc (r_alias_program.useAlphaTestLoc, (currententity->model->flags & MF_HOLEY) ? 1 : 0);
+	if (r_alias_shadedots)
+		GL_Uniform1iFunc (r_alias_program.shadeDotsLoc, 2);
+	GL_Uniform1iFunc (r_alias_program.useColormapLoc, (cm != NULL) ? 1 : 0);
+	if (cm)
+	{
+		GL_Uniform1iFunc (r_alias_program.colormapTexLoc, 3);
+		GL_Uniform1iFunc (r_alias_program.colorRampsLoc, 4);
+		GL_Uniform1fFunc (r_alias_program.shirtRowLoc, colormaprows[0]);
+		GL_Uniform1fFunc (r_alias_program.pantsRowLoc, colormaprows[1]);
+	}
 
 // set textures
+	if (r_alias_shadedots)
+	{
+		GL_SelectTexture (GL_TEXTURE2);
+		GL_Bind (r_shadedots_texture);
+	}
+	if (cm)
+	{
+		GL_SelectTexture (GL_TEXTURE3);
+		GL_Bind (cm);
+		GL_SelectTexture (GL_TEXTURE4);
+		GL_Bind (r_colorramps_texture);
+	}
 	GL_SelectTexture (GL_TEXTURE0);
 	GL_Bind (tx);
 
@@ -281,11 +523,7 @@ void GL_DrawAliasFrame_GLSL (aliashdr_t *paliashdr, lerpdata_t lerpdata, gltextu
 	glDrawElements (GL_TRIANGLES, paliashdr->numindexes, GL_UNSIGNED_SHORT, (void *)(intptr_t)currententity->model->vboindexofs);
 
 // clean up
-	GL_DisableVertexAttribArrayFunc (texCoordsAttrIndex);
-	GL_DisableVertexAttribArrayFunc (pose1VertexAttrIndex);
-	GL_DisableVertexAttribArrayFunc (pose2VertexAttrIndex);
-	GL_DisableVertexAttribArrayFunc (pose1NormalAttrIndex);
-	GL_DisableVertexAttribArrayFunc (pose2NormalAttrIndex);
+	GLAlias_EnableVertexArrays (false);
 
 	GL_UseProgramFunc (0);
 	GL_SelectTexture (GL_TEXTURE0);
@@ -293,6 +531,19 @@ void GL_DrawAliasFrame_GLSL (aliashdr_t *paliashdr, lerpdata_t lerpdata, gltextu
 	rs_aliaspasses += paliashdr->numtris;
 }
 
+/*
+=============
+GLAlias_SetFlatLighting
+
+Unshaded, uniform light for the next GL_DrawAliasFrame_GLSL.
+=============
+*/
+static void GLAlias_SetFlatLighting (float light)
+{
+	shadevector[0] = shadevector[1] = shadevector[2] = 0;
+	lightcolor[0] = lightcolor[1] = lightcolor[2] = light;
+}
+
 /*
 =============
 GL_DrawAliasFrame -- johnfitz -- rewritten to support colored light, lerping, entalpha, multitexture, and r_drawflat
@@ -548,17 +799,26 @@ void R_SetupAliasLighting (entity_t	*e)
 	int		quantizedangle;
 	float		radiansangle;
 	vec3_t		lpos;
+	const unsigned int	*lights;
 
 	VectorCopy (e->origin, lpos);
 	// start the light trace from slightly above the origin
 	// this helps with models whose origin is below ground level, but are otherwise visible
 	// (e.g. some of the candles in the DOTM start map, which would otherwise appear black)
 	lpos[2] += e->model->maxs[2] * 0.5f;
-	R_LightPoint (lpos);
+	R_LightPointCached (e, lpos);
 
 	//add dlights
+	lights = R_LightsForPoint (currententity->origin);
 	for (i=0 ; i<MAX_DLIGHTS ; i++)
 	{
+		if (!lights[i >> 5])
+		{
+			i |= 31; // none in this word
+			continue;
+		}
+		if (!(lights[i >> 5] & (1U << (i & 31))))
+			continue;
 		if (cl_dlights[i].die >= cl.time)
 		{
 			VectorSubtract (currententity->origin, cl_dlights[i].origin, dist);
@@ -624,6 +884,63 @@ void R_SetupAliasLighting (entity_t	*e)
 	VectorScale (lightcolor, 1.0f / 200.0f, lightcolor);
 }
 
+/*
+=================
+R_AliasPlayerNum
+
+Returns the player number + 1 if the entity is drawn in that player's
+colors, 0 otherwise.
+=================
+*/
+static int R_AliasPlayerNum (entity_t *e)
+{
+	int			i;
+
+	if (e->colormap == vid.colormap || gl_nocolors.value)
+		return 0;
+	i = e - cl_entities;
+	if (i < 1 || i > cl.maxclients /* || strcmp (currententity->model->name, "progs/player.mdl") */)
+		return 0;
+	return i;
+}
+
+/*
+=================
+R_SetupAliasSkins
+
+Picks the skin and fullbright textures for this frame, and the colormap
+mask if the shader translates the colors.
+=================
+*/
+static void R_SetupAliasSkins (entity_t *e, aliashdr_t *paliashdr, gltexture_t **tx, gltexture_t **fb, gltexture_t **cm)
+{
+	int			i, anim, skinnum, colors;
+
+	anim = (int)(cl.time*10) & 3;
+	skinnum = e->skinnum;
+	if ((skinnum >= paliashdr->numskins) || (skinnum < 0))
+	{
+		Con_DPrintf ("R_DrawAliasModel: no such skin # %d for '%s'\n", skinnum, e->model->name);
+		// ericw -- display skin 0 for winquake compatibility
+		skinnum = 0;
+	}
+	*tx = paliashdr->gltextures[skinnum][anim];
+	*fb = paliashdr->fbtextures[skinnum][anim];
+	*cm = NULL;
+	i = R_AliasPlayerNum (e);
+	if (i && r_alias_colormap && playercolormaps[i - 1])
+	{
+		*cm = playercolormaps[i - 1];
+		colors = cl.scores[i - 1].colors;
+		colormaprows[0] = (((colors & 0xf0) >> 4) + 0.5f) / 16.0f;
+		colormaprows[1] = ((colors & 15) + 0.5f) / 16.0f;
+	}
+	else if (i && playertextures[i - 1])
+		*tx = playertextures[i - 1];
+	if (!gl_fullbrights.value)
+		*fb = NULL;
+}
+
 /*
 =================
 R_DrawAliasModel -- johnfitz -- almost completely rewritten
@@ -632,8 +949,7 @@ R_DrawAliasModel -- johnfitz -- almost completely rewritten
 void R_DrawAliasModel (entity_t *e)
 {
 	aliashdr_t	*paliashdr;
-	int			i, anim, skinnum;
-	gltexture_t	*tx, *fb;
+	gltexture_t	*tx, *fb, *cm;
 	lerpdata_t	lerpdata;
 	qboolean	alphatest = !!(e->model->flags & MF_HOLEY);
 	float		fovscale = 1.0f;
@@ -700,24 +1016,7 @@ void R_DrawAliasModel (entity_t *e)
 	// set up textures
 	//
 	GL_DisableMultitexture();
-	anim = (int)(cl.time*10) & 3;
-	skinnum = e->skinnum;
-	if ((skinnum >= paliashdr->numskins) || (skinnum < 0))
-	{
-		Con_DPrintf ("R_DrawAliasModel: no such skin # %d for '%s'\n", skinnum, e->model->name);
-		// ericw -- display skin 0 for winquake compatibility
-		skinnum = 0;
-	}
-	tx = paliashdr->gltextures[skinnum][anim];
-	fb = paliashdr->fbtextures[skinnum][anim];
-	if (e->colormap != vid.colormap && !gl_nocolors.value)
-	{
-		i = e - cl_entities;
-		if (i >= 1 && i<=cl.maxclients /* && !strcmp (currententity->model->name, "progs/player.mdl") */)
-		    tx = playertextures[i - 1];
-	}
-	if (!gl_fullbrights.value)
-		fb = NULL;
+	R_SetupAliasSkins (e, paliashdr, &tx, &fb, &cm);
 
 	//
 	// draw it
@@ -729,6 +1028,19 @@ void R_DrawAliasModel (entity_t *e)
 		glEnable (GL_TEXTURE_2D);
 		srand((int) (cl.time * 1000)); //restore randomness
 	}
+// the debug modes go through the shader as well, with the lighting replaced
+	else if (r_fullbright_cheatsafe && r_alias_program.program != 0)
+	{
+		GLAlias_SetFlatLighting (1.0f);
+		overbright = false;
+		GL_DrawAliasFrame_GLSL (paliashdr, lerpdata, tx, fb, cm);
+	}
+	else if (r_lightmap_cheatsafe && r_alias_program.program != 0)
+	{
+		GLAlias_SetFlatLighting (1.0f);
+		overbright = false;
+		GL_DrawAliasFrame_GLSL (paliashdr, lerpdata, r_white_texture, NULL, NULL);
+	}
 	else if (r_fullbright_cheatsafe)
 	{
 		GL_Bind (tx);
@@ -761,9 +1073,9 @@ void R_DrawAliasModel (entity_t *e)
 	}
 // call fast path if possible. if the shader compliation failed for some reason,
 // r_alias_program will be 0.
-	else if (r_alias_program != 0)
+	else if (r_alias_program.program != 0)
 	{
-		GL_DrawAliasFrame_GLSL (paliashdr, lerpdata, tx, fb);
+		GL_DrawAliasFrame_GLSL (paliashdr, lerpdata, tx, fb, cm);
 	}
 	else if (overbright)
 	{
@@ -905,6 +1217,263 @@ cleanup:
 	glPopMatrix ();
 }
 
+/*
+=================
+R_SetupInstanceTransform
+
+Builds the same model to world matrix R_DrawAliasModel sets up with
+R_RotateForEntity, glTranslatef and glScalef.
+=================
+*/
+static void R_SetupInstanceTransform (aliashdr_t *paliashdr, lerpdata_t *lerpdata, float rows[3][4])
+{
+	float	sp, cp, sy, cy, sr, cr;
+	float	rot[3][3];
+	int		i, j;
+
+	sy = sin (lerpdata->angles[1] * (M_PI / 180));
+	cy = cos (lerpdata->angles[1] * (M_PI / 180));
+	sp = sin (-lerpdata->angles[0] * (M_PI / 180));
+	cp = cos (-lerpdata->angles[0] * (M_PI / 180));
+	sr = sin (lerpdata->angles[2] * (M_PI / 180));
+	cr = cos (lerpdata->angles[2] * (M_PI / 180));
+
+	// yaw around z, then pitch around y, then roll around x
+	rot[0][0] = cy*cp;	rot[0][1] = cy*sp*sr - sy*cr;	rot[0][2] = cy*sp*cr + sy*sr;
+	rot[1][0] = sy*cp;	rot[1][1] = sy*sp*sr + cy*cr;	rot[1][2] = sy*sp*cr - cy*sr;
+	rot[2][0] = -sp;	rot[2][1] = cp*sr;		rot[2][2] = cp*cr;
+
+	for (i = 0; i < 3; i++)
+	{
+		rows[i][3] = lerpdata->origin[i];
+		for (j = 0; j < 3; j++)
+		{
+			rows[i][j] = rot[i][j] * paliashdr->scale[j];
+			rows[i][3] += rot[i][j] * paliashdr->scale_origin[j];
+		}
+	}
+}
+
+/*
+=================
+R_BatchAliasModel
+
+Queues an opaque alias model for R_FlushAliasBatches, which draws all
+entities sharing a model, skin and pose pair with one instanced draw.
+Returns false if the entity has to go through R_DrawAliasModel.
+=================
+*/
+qboolean R_BatchAliasModel (entity_t *e)
+{
+	aliashdr_t	*paliashdr;
+	aliasinstance_t	*inst;
+	gltexture_t	*cm;
+	lerpdata_t	lerpdata;
+
+	if (!r_alias_instanced_program.program || r_numaliasinstances == MAX_VISEDICTS)
+		return false;
+	if (r_drawflat_cheatsafe || r_fullbright_cheatsafe || r_lightmap_cheatsafe)
+		return false;
+	if (e == &cl.viewent || ENTALPHA_DECODE(e->alpha) != 1)
+		return false;
+	if (r_alias_colormap && R_AliasPlayerNum (e))
+		return false;	// each player has its own colors
+
+	//
+	// setup pose/lerp data -- do it first so we don't miss updates due to culling
+	//
+	paliashdr = (aliashdr_t *)Mod_Extradata (e->model);
+	R_SetupAliasFrame (paliashdr, e->frame, &lerpdata);
+	R_SetupEntityTransform (e, &lerpdata);
+
+	if (R_CullModelForEntity(e))
+		return true;
+
+	overbright = gl_overbright_models.value;
+	rs_aliaspolys += paliashdr->numtris;
+	R_SetupAliasLighting (e);
+
+	inst = &r_aliasinstances[r_numaliasinstances];
+	r_aliasinstance_order[r_numaliasinstances] = inst;
+	r_numaliasinstances++;
+
+	inst->model = e->model;
+	inst->paliashdr = paliashdr;
+	R_SetupAliasSkins (e, paliashdr, &inst->tx, &inst->fb, &cm);
+	inst->pose1 = lerpdata.pose1;
+	inst->pose2 = lerpdata.pose2;
+
+	R_SetupInstanceTransform (paliashdr, &lerpdata, inst->data.rows);
+	inst->data.shadeblend[0] = shadevector[0];
+	inst->data.shadeblend[1] = shadevector[1];
+	inst->data.shadeblend[2] = shadevector[2];
+	inst->data.shadeblend[3] = (lerpdata.pose1 != lerpdata.pose2) ? lerpdata.blend : 0;
+	inst->data.lightcolor[0] = lightcolor[0];
+	inst->data.lightcolor[1] = lightcolor[1];
+	inst->data.lightcolor[2] = lightcolor[2];
+	inst->data.lightcolor[3] = 1;
+
+	return true;
+}
+
+static int R_CompareAliasInstances (const void *a, const void *b)
+{
+	const aliasinstance_t *ia = *(const aliasinstance_t **) a;
+	const aliasinstance_t *ib = *(const aliasinstance_t **) b;
+
+	if (ia->model != ib->model)
+		return (uintptr_t) ia->model < (uintptr_t) ib->model ? -1 : 1;
+	if (ia->tx != ib->tx)
+		return (uintptr_t) ia->tx < (uintptr_t) ib->tx ? -1 : 1;
+	if (ia->fb != ib->fb)
+		return (uintptr_t) ia->fb < (uintptr_t) ib->fb ? -1 : 1;
+	if (ia->pose1 != ib->pose1)
+		return ia->pose1 - ib->pose1;
+	return ia->pose2 - ib->pose2;
+}
+
+/*
+=================
+R_DrawAliasInstances
+
+Draws count instances that share a model, skin and pose pair.
+=================
+*/
+static void R_DrawAliasInstances (aliasinstance_t **list, int count)
+{
+	aliasinstance_t	*first = list[0];
+	aliashdr_t	*paliashdr = first->paliashdr;
+	qmodel_t	*m = first->model;
+	aliasinstancedata_t	*data;
+	const byte	*ofs;
+	qboolean	alphatest = !!(m->flags & MF_HOLEY);
+	int			i, n, chunk;
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, m->meshvbo);
+	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, m->meshindexesvbo);
+
+	GLAlias_SetupVertexArrays (m, paliashdr, first->pose1, first->pose2);
+
+	GL_Uniform1iFunc (r_alias_instanced_program.useFullbrightTexLoc, (first->fb != NULL) ? 1 : 0);
+	GL_Uniform1iFunc (r_alias_instanced_program.useAlphaTestLoc, alphatest ? 1 : 0);
+
+	GL_SelectTexture (GL_TEXTURE0);
+	GL_Bind (first->tx);
+	if (first->fb)
+	{
+		GL_SelectTexture (GL_TEXTURE1);
+		GL_Bind (first->fb);
+	}
+
+	if (alphatest)
+		glEnable (GL_ALPHA_TEST);
+
+	for (i = 0; i < count; i += chunk)
+	{
+		chunk = q_min (count - i, MAX_STREAM_ALLOC / (int) sizeof(aliasinstancedata_t));
+
+		data = (aliasinstancedata_t *) GL_StreamAlloc (chunk * sizeof(aliasinstancedata_t));
+		for (n = 0; n < chunk; n++)
+			data[n] = list[i + n]->data;
+		ofs = (const byte *) GL_StreamCommit (chunk * sizeof(aliasinstancedata_t));
+
+		GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+		GL_VertexAttribPointerFunc (modelRow0AttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(aliasinstancedata_t), ofs + offsetof(aliasinstancedata_t, rows[0]));
+		GL_VertexAttribPointerFunc (modelRow1AttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(aliasinstancedata_t), ofs + offsetof(aliasinstancedata_t, rows[1]));
+		GL_VertexAttribPointerFunc (modelRow2AttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(aliasinstancedata_t), ofs + offsetof(aliasinstancedata_t, rows[2]));
+		GL_VertexAttribPointerFunc (shadeBlendAttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(aliasinstancedata_t), ofs + offsetof(aliasinstancedata_t, shadeblend));
+		GL_VertexAttribPointerFunc (lightColorAttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(aliasinstancedata_t), ofs + offsetof(aliasinstancedata_t, lightcolor));
+
+		GL_DrawElementsInstancedFunc (GL_TRIANGLES, paliashdr->numindexes, GL_UNSIGNED_SHORT, (void *)(intptr_t)m->vboindexofs, chunk);
+	}
+
+	if (alphatest)
+		glDisable (GL_ALPHA_TEST);
+	GL_SelectTexture (GL_TEXTURE0);
+
+	rs_aliaspasses += paliashdr->numtris * count;
+}
+
+/*
+=================
+R_DrawQueuedInstances
+
+Draws and clears the instance queue, sorted into runs that share a model,
+skin and pose pair.
+=================
+*/
+static void R_DrawQueuedInstances (qboolean useoverbright)
+{
+	aliasprogram_t	*p = &r_alias_instanced_program;
+	int		i, j, count;
+
+	qsort (r_aliasinstance_order, r_numaliasinstances, sizeof(r_aliasinstance_order[0]), R_CompareAliasInstances);
+
+	GL_DisableMultitexture ();
+	if (gl_smoothmodels.value)
+		glShadeModel (GL_SMOOTH);
+	if (gl_affinemodels.value)
+		glHint (GL_PERSPECTIVE_CORRECTION_HINT, GL_FASTEST);
+
+	GL_UseProgramFunc (p->program);
+	GL_Uniform1iFunc (p->texLoc, 0);
+	GL_Uniform1iFunc (p->fullbrightTexLoc, 1);
+	GL_Uniform1fFunc (p->useOverbrightLoc, useoverbright ? 1 : 0);
+	if (r_alias_shadedots)
+	{
+		GL_Uniform1iFunc (p->shadeDotsLoc, 2);
+		GL_SelectTexture (GL_TEXTURE2);
+		GL_Bind (r_shadedots_texture);
+		GL_SelectTexture (GL_TEXTURE0);
+	}
+
+	GLAlias_EnableVertexArrays (true);
+	for (i = modelRow0AttrIndex; i <= lightColorAttrIndex; i++)
+	{
+		GL_EnableVertexAttribArrayFunc (i);
+		GL_VertexAttribDivisorFunc (i, 1);
+	}
+
+	for (i = 0; i < r_numaliasinstances; i += count)
+	{
+		for (j = i + 1; j < r_numaliasinstances; j++)
+		{
+			if (R_CompareAliasInstances (&r_aliasinstance_order[i], &r_aliasinstance_order[j]))
+				break;
+		}
+		count = j - i;
+		R_DrawAliasInstances (&r_aliasinstance_order[i], count);
+	}
+
+	for (i = modelRow0AttrIndex; i <= lightColorAttrIndex; i++)
+	{
+		GL_VertexAttribDivisorFunc (i, 0);
+		GL_DisableVertexAttribArrayFunc (i);
+	}
+	GLAlias_EnableVertexArrays (false);
+
+	GL_UseProgramFunc (0);
+	glHint (GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+	glShadeModel (GL_FLAT);
+
+	r_numaliasinstances = 0;
+}
+
+/*
+=================
+R_FlushAliasBatches
+
+Draws and clears the queue of R_BatchAliasModel.
+=================
+*/
+void R_FlushAliasBatches (void)
+{
+	if (!r_numaliasinstances)
+		return;
+
+	R_DrawQueuedInstances (gl_overbright_models.value != 0);
+}
+
 //johnfitz -- values for shadow matrix
 #define SHADOW_SKEW_X -0.7 //skew along x axis. -0.7 to mimic glquake shadows
 #define SHADOW_SKEW_Y 0 //skew along y axis. 0 to mimic glquake shadows
@@ -961,10 +1530,21 @@ void GL_DrawAliasShadow (entity_t *e)
 	glEnable (GL_BLEND);
 	GL_DisableMultitexture ();
 	glDisable (GL_TEXTURE_2D);
-	shading = false;
-	glColor4f(0,0,0,entalpha * 0.5);
-	GL_DrawAliasFrame (paliashdr, lerpdata);
-	glEnable (GL_TEXTURE_2D);
+	if (r_alias_program.program != 0)
+	{
+		glEnable (GL_TEXTURE_2D);
+		GLAlias_SetFlatLighting (0.0f);
+		overbright = false;
+		entalpha *= 0.5;
+		GL_DrawAliasFrame_GLSL (paliashdr, lerpdata, r_white_texture, NULL, NULL);
+	}
+	else
+	{
+		shading = false;
+		glColor4f(0,0,0,entalpha * 0.5);
+		GL_DrawAliasFrame (paliashdr, lerpdata);
+		glEnable (GL_TEXTURE_2D);
+	}
 	glDisable (GL_BLEND);
 	glDepthMask(GL_TRUE);
 
@@ -972,6 +1552,97 @@ void GL_DrawAliasShadow (entity_t *e)
 	glPopMatrix ();
 }
 
+/*
+=============
+R_BatchAliasShadow
+
+Queues the shadow of an alias model for R_FlushAliasShadows. The shadow
+matrix of GL_DrawAliasShadow is folded into the instance's model to world
+transform, which flattens the model onto the floor below it in the vertex
+shader, and the shadow is drawn untextured in half the entity's alpha.
+Returns false if the shadow has to go through GL_DrawAliasShadow.
+=============
+*/
+qboolean R_BatchAliasShadow (entity_t *e)
+{
+	aliashdr_t	*paliashdr;
+	aliasinstance_t	*inst;
+	lerpdata_t	lerpdata;
+	float		(*rows)[4];
+	float		lheight, oz;
+	int			i;
+
+	if (!r_alias_instanced_program.program || r_numaliasinstances == MAX_VISEDICTS)
+		return false;
+
+	if (R_CullModelForEntity(e))
+		return true;
+
+	if (e == &cl.viewent || e->model->flags & MOD_NOSHADOW)
+		return true;
+
+	entalpha = ENTALPHA_DECODE(e->alpha);
+	if (entalpha == 0)
+		return true;
+
+	paliashdr = (aliashdr_t *)Mod_Extradata (e->model);
+	R_SetupAliasFrame (paliashdr, e->frame, &lerpdata);
+	R_SetupEntityTransform (e, &lerpdata);
+	R_LightPoint (e->origin);
+	lheight = e->origin[2] - lightspot[2];
+
+	inst = &r_aliasinstances[r_numaliasinstances];
+	r_aliasinstance_order[r_numaliasinstances] = inst;
+	r_numaliasinstances++;
+
+	inst->model = e->model;
+	inst->paliashdr = paliashdr;
+	inst->tx = r_white_texture;
+	inst->fb = NULL;
+	inst->pose1 = lerpdata.pose1;
+	inst->pose2 = lerpdata.pose2;
+
+	// world = origin + shadow * (model - origin + lheight up) - lheight up
+	rows = inst->data.rows;
+	R_SetupInstanceTransform (paliashdr, &lerpdata, rows);
+	oz = lerpdata.origin[2];
+	for (i = 0; i < 4; i++)
+	{
+		rows[0][i] += SHADOW_SKEW_X * rows[2][i];
+		rows[1][i] += SHADOW_SKEW_Y * rows[2][i];
+		rows[2][i] *= SHADOW_VSCALE;
+	}
+	rows[0][3] += SHADOW_SKEW_X * (lheight - oz);
+	rows[1][3] += SHADOW_SKEW_Y * (lheight - oz);
+	rows[2][3] += oz + SHADOW_VSCALE * (lheight - oz) + SHADOW_HEIGHT - lheight;
+
+	inst->data.shadeblend[0] = inst->data.shadeblend[1] = inst->data.shadeblend[2] = 0;
+	inst->data.shadeblend[3] = (lerpdata.pose1 != lerpdata.pose2) ? lerpdata.blend : 0;
+	inst->data.lightcolor[0] = inst->data.lightcolor[1] = inst->data.lightcolor[2] = 0;
+	inst->data.lightcolor[3] = entalpha * 0.5;
+
+	return true;
+}
+
+/*
+=============
+R_FlushAliasShadows
+
+Draws and clears the queue of R_BatchAliasShadow.
+=============
+*/
+void R_FlushAliasShadows (void)
+{
+	if (!r_numaliasinstances)
+		return;
+
+	glDepthMask (GL_FALSE);
+	glEnable (GL_BLEND);
+	R_DrawQueuedInstances (false);
+	glDisable (GL_BLEND);
+	glDepthMask (GL_TRUE);
+}
+
 /*
 =================
 R_DrawAliasModel_ShowTris -- johnfitz
@@ -26,6 +26,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 extern cvar_t gl_fullbrights, r_drawflat, gl_overbright, r_oldwater; //johnfitz
 extern cvar_t gl_zfix; // QuakeSpasm z-fighting fix
+extern cvar_t gl_lightmap_size;
+extern cvar_t gl_packedvertices;
 
 int		gl_lightmap_format;
 int		lightmap_bytes;
@@ -34,7 +36,8 @@ int		lightmap_bytes;
 struct lightmap_s	*lightmaps;
 int					lightmap_count;
 int					last_lightmap_allocated;
-int					allocated[LMBLOCK_WIDTH];
+int					allocated[MAX_LMBLOCK_SIZE];
+int					lmblock_width = LMBLOCK_WIDTH, lmblock_height = LMBLOCK_HEIGHT;
 
 unsigned	blocklights[LMBLOCK_WIDTH*LMBLOCK_HEIGHT*3]; //johnfitz -- was 18*18, added lit support (*3) and loosened surface extents maximum (LMBLOCK_WIDTH*LMBLOCK_HEIGHT)
 
@@ -253,6 +256,14 @@ void R_DrawSequentialPoly (msurface_t *s)
 			}
 			rs_brushpasses++;
 		}
+		else if (GLWarp_BeginShader ())
+		{
+			GLWarp_SetAlpha (entalpha);
+			GL_Bind (s->texinfo->texture->gltexture);
+			DrawGLPoly (s->polys);
+			GLWarp_EndShader ();
+			rs_brushpasses++;
+		}
 		else
 		{
 			GL_Bind (s->texinfo->texture->warpimage);
@@ -507,6 +518,10 @@ void R_DrawBrushModel (entity_t *e)
 
 	if (R_CullModelForEntity(e))
 		return;
+	if (e->occludedframe == r_framecount) // hidden last frame, see R_IssueOcclusionQueries
+		return;
+	if (e->mergedframe == r_framecount) // drawn with the world, see R_MergeBrushEntities
+		return;
 
 	currententity = e;
 	clmodel = e->model;
@@ -578,6 +593,77 @@ void R_DrawBrushModel (entity_t *e)
 	glPopMatrix ();
 }
 
+/*
+=================
+R_MergeBrushEntities
+
+Brush entities that are where the map put them, with no offset, rotation,
+alpha or texture frame, chain their visible surfaces into chain_world so
+they go out in the world's batches instead of one R_DrawTextureChains
+each. Once one moves it is drawn on its own again by R_DrawBrushModel.
+Called after R_MarkSurfaces and R_CullEntities.
+=================
+*/
+void R_MergeBrushEntities (void)
+{
+	entity_t	*e;
+	qmodel_t	*clmodel;
+	msurface_t	*psurf;
+	mplane_t	*pplane;
+	float		dot;
+	int			i, j, k;
+
+	// gl_zfix offsets brush entities from the world, that can't be merged
+	if (!r_mergebmodels.value || !r_drawentities.value || !r_drawworld_cheatsafe || gl_zfix.value)
+		return;
+
+	for (i=0 ; i<cl_numvisedicts ; i++)
+	{
+		e = cl_visedicts[i];
+		clmodel = e->model;
+
+		if (clmodel->type != mod_brush || clmodel->name[0] != '*' || clmodel->firstmodelsurface == 0)
+			continue;
+		if (e->origin[0] || e->origin[1] || e->origin[2] || e->angles[0] || e->angles[1] || e->angles[2])
+			continue;
+		if (e->alpha != ENTALPHA_DEFAULT || e->frame != 0)
+			continue;
+		if (R_CullModelForEntity(e) || e->occludedframe == r_framecount)
+			continue;
+
+		e->mergedframe = r_framecount;
+
+		if (!gl_flashblend.value)
+		{
+			for (k=0 ; k<MAX_DLIGHTS ; k++)
+			{
+				if ((cl_dlights[k].die < cl.time) ||
+					(!cl_dlights[k].radius))
+					continue;
+
+				R_MarkLights (&cl_dlights[k], k,
+					clmodel->nodes + clmodel->hulls[0].firstclipnode);
+			}
+		}
+
+		psurf = &clmodel->surfaces[clmodel->firstmodelsurface];
+		for (j=0 ; j<clmodel->nummodelsurfaces ; j++, psurf++)
+		{
+			pplane = psurf->plane;
+			dot = DotProduct (r_refdef.vieworg, pplane->normal) - pplane->dist;
+			if (((psurf->flags & SURF_PLANEBACK) && (dot < -BACKFACE_EPSILON)) ||
+				(!(psurf->flags & SURF_PLANEBACK) && (dot > BACKFACE_EPSILON)))
+			{
+				R_ChainSurface (psurf, chain_world);
+				R_RenderDynamicLightmaps (psurf);
+				if (psurf->texinfo->texture->warpimage)
+					psurf->texinfo->texture->update_warp = true;
+				rs_brushpolys++;
+			}
+		}
+	}
+}
+
 /*
 =================
 R_DrawBrushModel_ShowTris -- johnfitz
@@ -594,6 +680,8 @@ void R_DrawBrushModel_ShowTris (entity_t *e)
 
 	if (R_CullModelForEntity(e))
 		return;
+	if (e->mergedframe == r_framecount)
+		return;
 
 	currententity = e;
 	clmodel = e->model;
@@ -639,6 +727,76 @@ void R_DrawBrushModel_ShowTris (entity_t *e)
 	glPopMatrix ();
 }
 
+/*
+=================
+R_DrawBrushModel_Prepass
+
+Adds the opaque surfaces R_DrawBrushModel would draw to the depth prepass
+=================
+*/
+void R_DrawBrushModel_Prepass (entity_t *e)
+{
+	int			i;
+	msurface_t	*psurf;
+	float		dot;
+	mplane_t	*pplane;
+	qmodel_t	*clmodel;
+
+	if (R_CullModelForEntity(e))
+		return;
+	if (e->occludedframe == r_framecount || e->mergedframe == r_framecount)
+		return;
+
+	clmodel = e->model;
+
+	VectorSubtract (r_refdef.vieworg, e->origin, modelorg);
+	if (e->angles[0] || e->angles[1] || e->angles[2])
+	{
+		vec3_t	temp;
+		vec3_t	forward, right, up;
+
+		VectorCopy (modelorg, temp);
+		AngleVectors (e->angles, forward, right, up);
+		modelorg[0] = DotProduct (temp, forward);
+		modelorg[1] = -DotProduct (temp, right);
+		modelorg[2] = DotProduct (temp, up);
+	}
+
+	psurf = &clmodel->surfaces[clmodel->firstmodelsurface];
+
+	// the same placement as R_DrawBrushModel, or the depth wouldn't match
+	glPushMatrix ();
+	e->angles[0] = -e->angles[0];	// stupid quake bug
+	if (gl_zfix.value)
+	{
+		e->origin[0] -= DIST_EPSILON;
+		e->origin[1] -= DIST_EPSILON;
+		e->origin[2] -= DIST_EPSILON;
+	}
+	R_RotateForEntity (e->origin, e->angles);
+	if (gl_zfix.value)
+	{
+		e->origin[0] += DIST_EPSILON;
+		e->origin[1] += DIST_EPSILON;
+		e->origin[2] += DIST_EPSILON;
+	}
+	e->angles[0] = -e->angles[0];	// stupid quake bug
+
+	for (i=0 ; i<clmodel->nummodelsurfaces ; i++, psurf++)
+	{
+		if (psurf->flags & (SURF_DRAWTURB | SURF_DRAWSKY | SURF_DRAWFENCE))
+			continue;
+		pplane = psurf->plane;
+		dot = DotProduct (modelorg, pplane->normal) - pplane->dist;
+		if (((psurf->flags & SURF_PLANEBACK) && (dot < -BACKFACE_EPSILON)) ||
+			(!(psurf->flags & SURF_PLANEBACK) && (dot > BACKFACE_EPSILON)))
+			R_BatchSurface (psurf);
+	}
+	R_FlushBatch ();
+
+	glPopMatrix ();
+}
+
 /*
 =============================================================
 
@@ -656,7 +814,6 @@ called during rendering
 void R_RenderDynamicLightmaps (msurface_t *fa)
 {
 	byte		*base;
-	int			maps;
 	glRect_t    *theRect;
 	int smax, tmax;
 
@@ -667,10 +824,12 @@ void R_RenderDynamicLightmaps (msurface_t *fa)
 	fa->polys->chain = lightmaps[fa->lightmaptexturenum].polys;
 	lightmaps[fa->lightmaptexturenum].polys = fa->polys;
 
+	if (r_gpulightmaps)
+		return; // the world shader applies styles and dlights itself
+
 	// check for lightmap modification
-	for (maps=0; maps < MAXLIGHTMAPS && fa->styles[maps] != 255; maps++)
-		if (d_lightstylevalue[fa->styles[maps]] != fa->cached_light[maps])
-			goto dynamic;
+	if (fa->styles_changed)
+		goto dynamic;
 
 	if (fa->dlightframe == r_framecount	// dynamic this frame
 		|| fa->cached_dlight)			// dynamic previously
@@ -698,8 +857,8 @@ dynamic:
 			if ((theRect->h + theRect->t) < (fa->light_t + tmax))
 				theRect->h = (fa->light_t-theRect->t)+tmax;
 			base = lm->data;
-			base += fa->light_t * LMBLOCK_WIDTH * lightmap_bytes + fa->light_s * lightmap_bytes;
-			R_BuildLightMap (fa, base, LMBLOCK_WIDTH*lightmap_bytes);
+			base += fa->light_t * lmblock_width * lightmap_bytes + fa->light_s * lightmap_bytes;
+			R_BuildLightMap (fa, base, lmblock_width*lightmap_bytes);
 		}
 	}
 }
@@ -727,13 +886,15 @@ int AllocBlock (int w, int h, int *x, int *y)
 			lightmap_count++;
 			lightmaps = (struct lightmap_s *) realloc(lightmaps, sizeof(*lightmaps)*lightmap_count);
 			memset(&lightmaps[texnum], 0, sizeof(lightmaps[texnum]));
-			lightmaps[texnum].data = (byte *) calloc(1, 4*LMBLOCK_WIDTH*LMBLOCK_HEIGHT);
+			lightmaps[texnum].data = (byte *) calloc(1, 4*lmblock_width*lmblock_height);
+			if (!lightmaps[texnum].data)
+				Sys_Error ("AllocBlock: out of memory for %ix%i lightmap", lmblock_width, lmblock_height);
 			//as we're only tracking one texture, we don't need multiple copies of allocated any more.
 			memset(allocated, 0, sizeof(allocated));
 		}
-		best = LMBLOCK_HEIGHT;
+		best = lmblock_height;
 
-		for (i=0 ; i<LMBLOCK_WIDTH-w ; i++)
+		for (i=0 ; i<lmblock_width-w ; i++)
 		{
 			best2 = 0;
 
@@ -751,11 +912,12 @@ int AllocBlock (int w, int h, int *x, int *y)
 			}
 		}
 
-		if (best + h > LMBLOCK_HEIGHT)
+		if (best + h > lmblock_height)
 			continue;
 
 		for (i=0 ; i<w ; i++)
 			allocated[*x + i] = best + h;
+		lightmaps[texnum].used += w * h;
 
 		last_lightmap_allocated = texnum;
 		return texnum;
@@ -771,6 +933,53 @@ qmodel_t	*currentmodel;
 
 int	nColinElim;
 
+/*
+========================
+GL_CreateSurfaceStyles
+
+Copies the raw samples of each lightstyle slot to the style pages, so the
+world shader can scale them by the current lightstyle values instead of
+R_BuildLightMap combining them every time a style changes
+========================
+*/
+static void GL_CreateSurfaceStyles (msurface_t *surf)
+{
+	struct lightmap_s *lm;
+	int		smax, tmax, maps, s, t;
+	byte	*lightmap, *dest;
+
+	if (!surf->samples)
+		return;
+
+	smax = (surf->extents[0]>>4)+1;
+	tmax = (surf->extents[1]>>4)+1;
+	lm = &lightmaps[surf->lightmaptexturenum];
+	lightmap = surf->samples;
+
+	for (maps = 0 ; maps < MAXLIGHTMAPS && surf->styles[maps] != 255 ; maps++)
+	{
+		if (!lm->styledata[maps])
+		{
+			lm->styledata[maps] = (byte *) calloc(1, 4*lmblock_width*lmblock_height);
+			if (!lm->styledata[maps])
+				Sys_Error ("GL_CreateSurfaceStyles: out of memory for %ix%i lightmap", lmblock_width, lmblock_height);
+		}
+		lm->numstyles = q_max(lm->numstyles, maps + 1);
+
+		for (t = 0 ; t < tmax ; t++)
+		{
+			dest = lm->styledata[maps] + ((surf->light_t + t) * lmblock_width + surf->light_s) * 4;
+			for (s = 0 ; s < smax ; s++)
+			{
+				*dest++ = *lightmap++;
+				*dest++ = *lightmap++;
+				*dest++ = *lightmap++;
+				*dest++ = 255;
+			}
+		}
+	}
+}
+
 /*
 ========================
 GL_CreateSurfaceLightmap
@@ -786,8 +995,11 @@ void GL_CreateSurfaceLightmap (msurface_t *surf)
 
 	surf->lightmaptexturenum = AllocBlock (smax, tmax, &surf->light_s, &surf->light_t);
 	base = lightmaps[surf->lightmaptexturenum].data;
-	base += (surf->light_t * LMBLOCK_WIDTH + surf->light_s) * lightmap_bytes;
-	R_BuildLightMap (surf, base, LMBLOCK_WIDTH*lightmap_bytes);
+	base += (surf->light_t * lmblock_width + surf->light_s) * lightmap_bytes;
+	R_BuildLightMap (surf, base, lmblock_width*lightmap_bytes);
+
+	if (gl_glsl_alias_able && cl.worldmodel->lightdata)
+		GL_CreateSurfaceStyles (surf);
 }
 
 /*
@@ -853,13 +1065,13 @@ void BuildSurfaceDisplayList (msurface_t *fa)
 		s -= fa->texturemins[0];
 		s += fa->light_s*16;
 		s += 8;
-		s /= LMBLOCK_WIDTH*16; //fa->texinfo->texture->width;
+		s /= lmblock_width*16; //fa->texinfo->texture->width;
 
 		t = DotProduct (vec, fa->texinfo->vecs[1]) + fa->texinfo->vecs[1][3];
 		t -= fa->texturemins[1];
 		t += fa->light_t*16;
 		t += 8;
-		t /= LMBLOCK_HEIGHT*16; //fa->texinfo->texture->height;
+		t /= lmblock_height*16; //fa->texinfo->texture->height;
 
 		poly->verts[i][5] = s;
 		poly->verts[i][6] = t;
@@ -870,6 +1082,11 @@ void BuildSurfaceDisplayList (msurface_t *fa)
 	poly->numverts = lnumverts;
 }
 
+static msurface_t	**r_stylesurfs;		// the surfaces of style i from r_stylesurfofs[i] on
+static int		r_stylesurfofs[256+1];
+
+static void GL_BuildStyleLists (void);
+
 /*
 ==================
 GL_BuildLightmaps -- called at level load time
@@ -880,8 +1097,9 @@ with all the surfaces from all brush models
 */
 void GL_BuildLightmaps (void)
 {
-	char	name[24];
-	int		i, j;
+	char	name[40];
+	int		i, j, k, size;
+	GLint	maxsize;
 	struct lightmap_s *lm;
 	qmodel_t	*m;
 
@@ -889,7 +1107,11 @@ void GL_BuildLightmaps (void)
 
 	//Spike -- wipe out all the lightmap data (johnfitz -- the gltexture objects were already freed by Mod_ClearAll)
 	for (i=0; i < lightmap_count; i++)
+	{
 		free(lightmaps[i].data);
+		for (k=0; k < MAXLIGHTMAPS; k++)
+			free(lightmaps[i].styledata[k]);
+	}
 	free(lightmaps);
 	lightmaps = NULL;
 	last_lightmap_allocated = 0;
@@ -909,6 +1131,13 @@ void GL_BuildLightmaps (void)
 		Sys_Error ("GL_BuildLightmaps: bad lightmap format");
 	}
 
+	// bigger pages mean fewer lightmap switches while drawing, but more to
+	// upload for each changed lightmap row
+	glGetIntegerv (GL_MAX_TEXTURE_SIZE, &maxsize);
+	size = TexMgr_Pad (q_max((int)gl_lightmap_size.value, 1));
+	size = CLAMP (LMBLOCK_WIDTH, size, q_min((int)maxsize, MAX_LMBLOCK_SIZE));
+	lmblock_width = lmblock_height = size;
+
 	for (j=1 ; j<MAX_MODELS ; j++)
 	{
 		m = cl.model_precache[j];
@@ -936,25 +1165,133 @@ void GL_BuildLightmaps (void)
 	{
 		lm = &lightmaps[i];
 		lm->modified = false;
-		lm->rectchange.l = LMBLOCK_WIDTH;
-		lm->rectchange.t = LMBLOCK_HEIGHT;
+		lm->rectchange.l = lmblock_width;
+		lm->rectchange.t = lmblock_height;
 		lm->rectchange.w = 0;
 		lm->rectchange.h = 0;
 
 		//johnfitz -- use texture manager
-		sprintf(name, "lightmap%07i",i);
-		lm->texture = TexMgr_LoadImage (cl.worldmodel, name, LMBLOCK_WIDTH, LMBLOCK_HEIGHT,
+		q_snprintf (name, sizeof(name), "lightmap%07i", i);
+		lm->texture = TexMgr_LoadImage (cl.worldmodel, name, lmblock_width, lmblock_height,
 						SRC_LIGHTMAP, lm->data, "", (src_offset_t)lm->data, TEXPREF_LINEAR | TEXPREF_NOPICMIP);
 		//johnfitz
+
+		for (k=0; k<lm->numstyles; k++)
+		{
+			q_snprintf (name, sizeof(name), "lightmap%07i_style%i", i, k);
+			lm->styletextures[k] = TexMgr_LoadImage (cl.worldmodel, name, lmblock_width, lmblock_height,
+						SRC_LIGHTMAP, lm->styledata[k], "", (src_offset_t)lm->styledata[k], TEXPREF_LINEAR | TEXPREF_NOPICMIP);
+		}
 	}
 
 	//johnfitz -- warn about exceeding old limits
 	//GLQuake limit was 64 textures of 128x128. Estimate how many 128x128 textures we would need
-	//given that we are using lightmap_count of LMBLOCK_WIDTH x LMBLOCK_HEIGHT
-	i = lightmap_count * ((LMBLOCK_WIDTH / 128) * (LMBLOCK_HEIGHT / 128));
+	//given that we are using lightmap_count of lmblock_width x lmblock_height
+	i = lightmap_count * ((lmblock_width / 128) * (lmblock_height / 128));
 	if (i > 64)
 		Con_DWarning("%i lightmaps exceeds standard limit of 64.\n",i);
 	//johnfitz
+
+	GL_BuildStyleLists ();
+
+	if (developer.value)
+		R_LightmapInfo_f ();
+}
+
+/*
+==================
+GL_BuildStyleLists
+
+Lists the lightmapped surfaces of every lightstyle, so R_LightStyleChanged
+only has to visit those of the styles that changed
+==================
+*/
+static void GL_BuildStyleLists (void)
+{
+	int		i, j, k, count[256];
+	qmodel_t	*m;
+	msurface_t	*s;
+
+	free (r_stylesurfs);
+	memset (count, 0, sizeof(count));
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m)
+			break;
+		if (m->name[0] == '*' || m->type != mod_brush)
+			continue;
+		for (i=0, s=m->surfaces ; i<m->numsurfaces ; i++, s++)
+		{
+			if (s->flags & SURF_DRAWTILED)
+				continue;
+			for (k=0 ; k<MAXLIGHTMAPS && s->styles[k] != 255 ; k++)
+				count[s->styles[k]]++;
+		}
+	}
+
+	r_stylesurfofs[0] = 0;
+	for (i=0 ; i<256 ; i++)
+		r_stylesurfofs[i+1] = r_stylesurfofs[i] + count[i];
+	r_stylesurfs = (msurface_t **) malloc (q_max(r_stylesurfofs[256], 1) * sizeof(msurface_t *));
+	if (!r_stylesurfs)
+		Sys_Error ("GL_BuildStyleLists: out of memory");
+
+	memcpy (count, r_stylesurfofs, sizeof(count));
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m)
+			break;
+		if (m->name[0] == '*' || m->type != mod_brush)
+			continue;
+		for (i=0, s=m->surfaces ; i<m->numsurfaces ; i++, s++)
+		{
+			if (s->flags & SURF_DRAWTILED)
+				continue;
+			for (k=0 ; k<MAXLIGHTMAPS && s->styles[k] != 255 ; k++)
+				r_stylesurfs[count[s->styles[k]]++] = s;
+		}
+	}
+}
+
+/*
+==================
+R_LightStyleChanged
+
+Called by R_AnimateLight when the value of a style changes: flags its
+surfaces, which R_RenderDynamicLightmaps then rebuilds once they are seen.
+The surfaces of the styles that stayed the same cost nothing.
+==================
+*/
+void R_LightStyleChanged (int style)
+{
+	int	i;
+
+	for (i = r_stylesurfofs[style]; i < r_stylesurfofs[style+1]; i++)
+		r_stylesurfs[i]->styles_changed = true;
+	rs_stylesurfs += r_stylesurfofs[style+1] - r_stylesurfofs[style];
+}
+
+/*
+==================
+R_LightmapInfo_f -- reports how full the lightmap pages are
+==================
+*/
+void R_LightmapInfo_f (void)
+{
+	int	i, used;
+	float	page;
+
+	page = (float)lmblock_width * lmblock_height;
+	for (i = 0, used = 0; i < lightmap_count; i++)
+	{
+		used += lightmaps[i].used;
+		if (Cmd_Argc () > 1)
+			Con_SafePrintf ("   %4i: %5.1f%%\n", i, 100.0f * lightmaps[i].used / page);
+	}
+	Con_Printf ("%i lightmap pages of %ix%i, %.1f%% used\n", lightmap_count, lmblock_width, lmblock_height,
+			lightmap_count ? 100.0f * used / (page * lightmap_count) : 0.0f);
 }
 
 /*
@@ -966,6 +1303,256 @@ void GL_BuildLightmaps (void)
 */
 
 GLuint gl_bmodel_vbo = 0;
+GLuint gl_bmodel_layer_vbo = 0;	// texture array layer of each vertex in gl_bmodel_vbo
+GLuint gl_bmodel_style_vbo = 0;	// lightstyle of each lightmap slot, per vertex in gl_bmodel_vbo
+GLuint gl_bmodel_ibo = 0;	// every surface's triangles, for multi draw indirect
+int gl_bmodel_texbits = 0;	// fraction bits of the packedvert_t texel coords, 0 if gl_bmodel_vbo holds VERTEXSIZE floats
+
+texarray_t	gl_texarrays[MAX_TEXARRAYS];
+int		gl_numtexarrays;
+
+/*
+==================
+GL_TextureArrayable
+
+Whether a texture can be drawn from a texture array. Animated, liquid,
+sky and fence textures keep their own bind.
+==================
+*/
+static qboolean GL_TextureArrayable (texture_t *t)
+{
+	gltexture_t	*glt;
+
+	if (!t || !(glt = t->gltexture) || !(glt->flags & TEXPREF_MIPMAP))
+		return false;
+	if (t->anim_total || t->alternate_anims)
+		return false;
+	if (t->name[0] == '*' || t->name[0] == '{' || !q_strncasecmp (t->name, "sky", 3))
+		return false;
+	if (t->fullbright && (t->fullbright->width != glt->width || t->fullbright->height != glt->height))
+		return false;
+	return true;
+}
+
+static void GL_DeleteTextureArrays (void)
+{
+	int	i;
+
+	for (i = 0; i < gl_numtexarrays; i++)
+	{
+		glDeleteTextures (1, &gl_texarrays[i].texnum);
+		if (gl_texarrays[i].fbtexnum)
+			glDeleteTextures (1, &gl_texarrays[i].fbtexnum);
+	}
+	gl_numtexarrays = 0;
+	gl_memory[GLMEM_TEXARRAYS] = 0;
+}
+
+/*
+==================
+GL_AssignTextureArrays
+
+Puts every texture that can use one in an array with the other textures
+of the same size, and sets texture_t->texarray and texlayer.
+==================
+*/
+static void GL_AssignTextureArrays (void)
+{
+	int		i, j, k, w, h;
+	qmodel_t	*m;
+	texture_t	*t;
+	texarray_t	*a;
+
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m || m->name[0] == '*' || m->type != mod_brush)
+			continue;
+
+		for (i=0 ; i<m->numtextures ; i++)
+		{
+			if (m->textures[i])
+				m->textures[i]->texarray = -1;
+		}
+	}
+
+	if (!gl_texture_array_able)
+		return;
+
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m || m->name[0] == '*' || m->type != mod_brush)
+			continue;
+
+		for (i=0 ; i<m->numtextures ; i++)
+		{
+			t = m->textures[i];
+			if (!t || t->texarray != -1 || !GL_TextureArrayable (t))
+				continue;	// shared textures are only added once
+
+			// the arrays are sized from the real images, not lazy placeholders
+			TexMgr_MakeResident (t->gltexture);
+			TexMgr_MakeResident (t->fullbright);
+			if (!GL_TextureArrayable (t))
+				continue;
+
+			for (k=0, a=gl_texarrays ; k<gl_numtexarrays ; k++, a++)
+			{
+				if (a->width == (int)t->gltexture->width && a->height == (int)t->gltexture->height && a->numlayers < gl_max_array_layers)
+				{
+					GL_TexCoordSize (t, &w, &h);
+					if (w == a->texwidth && h == a->texheight) // one TexScale per array
+						break;
+				}
+			}
+			if (k == gl_numtexarrays)
+			{
+				if (gl_numtexarrays == MAX_TEXARRAYS)
+					continue;
+				gl_numtexarrays++;
+				memset (a, 0, sizeof(*a));
+				a->width = t->gltexture->width;
+				a->height = t->gltexture->height;
+				GL_TexCoordSize (t, &a->texwidth, &a->texheight);
+				a->nummips = 1;
+				while ((a->width >> a->nummips) || (a->height >> a->nummips))
+					a->nummips++;
+			}
+			if (t->fullbright)
+				a->fullbrights = true;
+			t->texarray = k;
+			t->texlayer = a->numlayers++;
+		}
+	}
+}
+
+/*
+==================
+GL_CopyTextureLayer -- reads back a mipmapped texture and stores it in a layer of the bound array
+==================
+*/
+static void GL_CopyTextureLayer (gltexture_t *glt, texarray_t *a, GLuint texnum, int layer, byte *buf)
+{
+	int	miplevel, width, height;
+
+	for (miplevel = 0, width = a->width, height = a->height; miplevel < a->nummips; miplevel++)
+	{
+		if (glt)
+		{
+			TexMgr_MakeResident (glt);
+			GL_Bind (glt);
+			glGetTexImage (GL_TEXTURE_2D, miplevel, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+		}
+		glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, texnum);
+		GL_TexSubImage3DFunc (GL_TEXTURE_2D_ARRAY_EXT, miplevel, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+		width = q_max(width >> 1, 1);
+		height = q_max(height >> 1, 1);
+	}
+}
+
+static GLuint GL_NewTextureArray (texarray_t *a)
+{
+	GLuint	texnum;
+	int	miplevel, width, height;
+
+	glGenTextures (1, &texnum);
+	glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, texnum);
+	for (miplevel = 0, width = a->width, height = a->height; miplevel < a->nummips; miplevel++)
+	{
+		GL_TexImage3DFunc (GL_TEXTURE_2D_ARRAY_EXT, miplevel, GL_RGB8, width, height, a->numlayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		gl_memory[GLMEM_TEXARRAYS] += width * height * a->numlayers * 4;
+		width = q_max(width >> 1, 1);
+		height = q_max(height >> 1, 1);
+	}
+	TexMgr_SetArrayFilterModes ();
+	return texnum;
+}
+
+/*
+==================
+GL_FillTextureArrays
+
+(Re)creates the texture arrays from the uploaded textures. Called when the
+arrays are built and whenever the world textures are reloaded.
+==================
+*/
+void GL_FillTextureArrays (void)
+{
+	int		i, j, maxsize;
+	qmodel_t	*m;
+	texture_t	*t;
+	texarray_t	*a;
+	byte		*buf, *black;
+
+	if (!gl_numtexarrays)
+		return;
+
+	maxsize = 0;
+	gl_memory[GLMEM_TEXARRAYS] = 0;
+	for (i = 0, a = gl_texarrays; i < gl_numtexarrays; i++, a++)
+	{
+		if (a->texnum)
+			glDeleteTextures (1, &a->texnum);
+		if (a->fbtexnum)
+			glDeleteTextures (1, &a->fbtexnum);
+		a->texnum = GL_NewTextureArray (a);
+		a->fbtexnum = a->fullbrights ? GL_NewTextureArray (a) : 0;
+		maxsize = q_max(maxsize, a->width * a->height * 4);
+	}
+
+	buf = (byte *) malloc (maxsize);
+	black = (byte *) calloc (1, maxsize);
+	if (!buf || !black)
+		Sys_Error ("GL_FillTextureArrays: out of memory");
+
+	GL_SelectTexture (GL_TEXTURE0);
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m || m->name[0] == '*' || m->type != mod_brush)
+			continue;
+
+		for (i=0 ; i<m->numtextures ; i++)
+		{
+			t = m->textures[i];
+			if (!t || t->texarray == -1)
+				continue;
+			a = &gl_texarrays[t->texarray];
+			GL_CopyTextureLayer (t->gltexture, a, a->texnum, t->texlayer, buf);
+			if (t->fullbright)
+				GL_CopyTextureLayer (t->fullbright, a, a->fbtexnum, t->texlayer, buf);
+			else if (a->fbtexnum)
+				GL_CopyTextureLayer (NULL, a, a->fbtexnum, t->texlayer, black);
+		}
+	}
+	glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, 0);
+
+	free (black);
+	free (buf);
+}
+
+/*
+==================
+GL_SetTextureArrayFilterModes -- called when the texture mode or anisotropy changes
+==================
+*/
+void GL_SetTextureArrayFilterModes (void)
+{
+	int	i;
+
+	for (i = 0; i < gl_numtexarrays; i++)
+	{
+		glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, gl_texarrays[i].texnum);
+		TexMgr_SetArrayFilterModes ();
+		if (gl_texarrays[i].fbtexnum)
+		{
+			glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, gl_texarrays[i].fbtexnum);
+			TexMgr_SetArrayFilterModes ();
+		}
+	}
+	glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, 0);
+}
 
 void GL_DeleteBModelVertexBuffer (void)
 {
@@ -974,10 +1561,112 @@ void GL_DeleteBModelVertexBuffer (void)
 
 	GL_DeleteBuffersFunc (1, &gl_bmodel_vbo);
 	gl_bmodel_vbo = 0;
+	GL_DeleteBuffersFunc (1, &gl_bmodel_layer_vbo);
+	gl_bmodel_layer_vbo = 0;
+	GL_DeleteBuffersFunc (1, &gl_bmodel_style_vbo);
+	gl_bmodel_style_vbo = 0;
+	GL_DeleteBuffersFunc (1, &gl_bmodel_ibo);
+	gl_bmodel_ibo = 0;
+	GL_DeleteTextureArrays ();
 
 	GL_ClearBufferBindings ();
 }
 
+/*
+==================
+GL_TexCoordSize
+
+The texels in one unit of the texture coords BuildSurfaceDisplayList gives
+the surfaces of t.  A packed gl_bmodel_vbo stores texel coords instead,
+which the world shader scales back by their inverse.
+==================
+*/
+void GL_TexCoordSize (texture_t *t, int *width, int *height)
+{
+	int	k = (t->shift > 0) ? 2 * t->shift : 1; // Q64 RERELEASE texture shift
+
+	*width = t->width * k;
+	*height = t->height * k;
+}
+
+/*
+==================
+GL_SurfaceTexOrigin
+
+The whole number of texture repeats nearest the middle of a surface, which
+its packed texel coords are measured from.  Returns the largest distance
+of a vertex from it, in texels.
+==================
+*/
+static float GL_SurfaceTexOrigin (msurface_t *s, float origin[2])
+{
+	float	*v, mins[2], maxs[2], d, dist;
+	int	i, k, size[2];
+
+	GL_TexCoordSize (s->texinfo->texture, &size[0], &size[1]);
+	mins[0] = mins[1] = 999999;
+	maxs[0] = maxs[1] = -999999;
+	for (i=0, v=s->polys->verts[0] ; i<s->polys->numverts ; i++, v+=VERTEXSIZE)
+	{
+		for (k=0 ; k<2 ; k++)
+		{
+			mins[k] = q_min (mins[k], v[3 + k]);
+			maxs[k] = q_max (maxs[k], v[3 + k]);
+		}
+	}
+
+	dist = 0;
+	for (k=0 ; k<2 ; k++)
+	{
+		origin[k] = floor ((mins[k] + maxs[k]) * 0.5f + 0.5f);
+		d = q_max (maxs[k] - origin[k], origin[k] - mins[k]) * size[k];
+		dist = q_max (dist, d);
+	}
+	return dist;
+}
+
+/*
+==================
+GL_PackedTexBits
+
+The fraction bits packed texel coords can have so every surface of every
+brush model fits in a short, or 0 if that is too coarse for the packed
+layout; also 0 if it isn't wanted or the world shader wouldn't read it.
+Sky and water are drawn from the polys with a packed layout, since their
+fixed-function batches read float texture coords.
+==================
+*/
+static int GL_PackedTexBits (void)
+{
+	int		i, j, bits;
+	float		dist, origin[2];
+	qmodel_t	*m;
+
+	if (!gl_packedvertices.value || !gl_glsl_alias_able)
+		return 0;
+
+	dist = 1;
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m || m->name[0] == '*' || m->type != mod_brush)
+			continue;
+
+		for (i=0 ; i<m->numsurfaces ; i++)
+			dist = q_max (dist, GL_SurfaceTexOrigin (&m->surfaces[i], origin));
+	}
+
+	// an eighth of a texel at worst, a 32nd at best
+	for (bits = 5; bits >= 3 && dist * (1 << bits) >= 32767; bits--)
+		;
+	if (bits < 3)
+	{
+		Con_DPrintf ("a surface spans %.0f texels, not packing brush vertices\n", dist * 2);
+		return 0;
+	}
+	return bits;
+}
+
 /*
 ==================
 GL_BuildBModelVertexBuffer
@@ -988,10 +1677,14 @@ surfaces from world + all brush models
 */
 void GL_BuildBModelVertexBuffer (void)
 {
-	unsigned int	numverts, varray_bytes, varray_index;
-	int		i, j;
+	unsigned int	numverts, numindices, varray_bytes, varray_index, iarray_index;
+	int		i, j, k, size[2];
 	qmodel_t	*m;
-	float		*varray;
+	float		*varray, *larray, layer, origin[2], *v;
+	packedvert_t	*parray, *pv;
+	byte		*sarray;
+	unsigned int	*iarray;
+	vcache_t	vcache;
 
 	if (!(gl_vbo_able && gl_mtexable && gl_max_texture_units >= 3))
 		return;
@@ -999,9 +1692,22 @@ void GL_BuildBModelVertexBuffer (void)
 // ask GL for a name for our VBO
 	GL_DeleteBuffersFunc (1, &gl_bmodel_vbo);
 	GL_GenBuffersFunc (1, &gl_bmodel_vbo);
+	GL_DeleteBuffersFunc (1, &gl_bmodel_layer_vbo);
+	GL_GenBuffersFunc (1, &gl_bmodel_layer_vbo);
+	GL_DeleteBuffersFunc (1, &gl_bmodel_style_vbo);
+	GL_GenBuffersFunc (1, &gl_bmodel_style_vbo);
+	GL_DeleteBuffersFunc (1, &gl_bmodel_ibo);
+	gl_bmodel_ibo = 0;
+	if (gl_multidrawindirect_able)
+		GL_GenBuffersFunc (1, &gl_bmodel_ibo);
+
+// sort the textures into arrays
+	GL_DeleteTextureArrays ();
+	GL_AssignTextureArrays ();
+	GL_FillTextureArrays ();
 	
 // count all verts in all models
-	numverts = 0;
+	numverts = numindices = 0;
 	for (j=1 ; j<MAX_MODELS ; j++)
 	{
 		m = cl.model_precache[j];
@@ -1011,13 +1717,28 @@ void GL_BuildBModelVertexBuffer (void)
 		for (i=0 ; i<m->numsurfaces ; i++)
 		{
 			numverts += m->surfaces[i].numedges;
+			numindices += 3 * (m->surfaces[i].numedges - 2);
 		}
 	}
 	
 // build vertex array
-	varray_bytes = VERTEXSIZE * sizeof(float) * numverts;
-	varray = (float *) malloc (varray_bytes);
-	varray_index = 0;
+	gl_bmodel_texbits = GL_PackedTexBits ();
+	if (gl_bmodel_texbits)
+	{
+		varray_bytes = sizeof(packedvert_t) * numverts;
+		parray = (packedvert_t *) malloc (varray_bytes);
+		varray = NULL;
+	}
+	else
+	{
+		varray_bytes = VERTEXSIZE * sizeof(float) * numverts;
+		varray = (float *) malloc (varray_bytes);
+		parray = NULL;
+	}
+	larray = (float *) malloc (sizeof(float) * numverts);
+	sarray = (byte *) malloc (MAXLIGHTMAPS * numverts);
+	iarray = gl_bmodel_ibo ? (unsigned int *) malloc (sizeof(unsigned int) * numindices) : NULL;
+	varray_index = iarray_index = 0;
 	
 	for (j=1 ; j<MAX_MODELS ; j++)
 	{
@@ -1025,19 +1746,76 @@ void GL_BuildBModelVertexBuffer (void)
 		if (!m || m->name[0] == '*' || m->type != mod_brush)
 			continue;
 
+		VCache_Reset (&vcache);
 		for (i=0 ; i<m->numsurfaces ; i++)
 		{
 			msurface_t *s = &m->surfaces[i];
 			s->vbo_firstvert = varray_index;
-			memcpy (&varray[VERTEXSIZE * varray_index], s->polys->verts, VERTEXSIZE * sizeof(float) * s->numedges);
+			if (parray)
+			{
+				GL_SurfaceTexOrigin (s, origin);
+				GL_TexCoordSize (s->texinfo->texture, &size[0], &size[1]);
+				pv = &parray[varray_index];
+				for (k=0, v=s->polys->verts[0] ; k<s->numedges ; k++, v+=VERTEXSIZE, pv++)
+				{
+					VectorCopy (v, pv->xyz);
+					pv->st[0] = Q_rint ((v[3] - origin[0]) * size[0] * (1 << gl_bmodel_texbits));
+					pv->st[1] = Q_rint ((v[4] - origin[1]) * size[1] * (1 << gl_bmodel_texbits));
+					pv->lmst[0] = Q_rint (CLAMP (0.0f, v[5], 1.0f) * 65535);
+					pv->lmst[1] = Q_rint (CLAMP (0.0f, v[6], 1.0f) * 65535);
+				}
+			}
+			else
+				memcpy (&varray[VERTEXSIZE * varray_index], s->polys->verts, VERTEXSIZE * sizeof(float) * s->numedges);
+			layer = (s->texinfo->texture->texarray != -1) ? s->texinfo->texture->texlayer : 0;
+			for (k=0 ; k<s->numedges ; k++)
+			{
+				larray[varray_index + k] = layer;
+				memcpy (&sarray[MAXLIGHTMAPS * (varray_index + k)], s->styles, MAXLIGHTMAPS);
+			}
+			//the same triangle fan R_TriangleIndicesForSurf streams
+			s->vbo_firstindex = iarray_index;
+			for (k=2 ; k<s->numedges ; k++)
+			{
+				VCache_Touch (&vcache, varray_index);
+				VCache_Touch (&vcache, varray_index + k - 1);
+				VCache_Touch (&vcache, varray_index + k);
+				if (!iarray)
+					continue;
+				iarray[iarray_index++] = varray_index;
+				iarray[iarray_index++] = varray_index + k - 1;
+				iarray[iarray_index++] = varray_index + k;
+			}
 			varray_index += s->numedges;
 		}
+
+		//no surface shares a vertex with another, so no order beats the fans:
+		//each vertex is transformed once unless a polygon outgrows the cache
+		for (i=0, k=0 ; i<m->numsurfaces ; i++)
+			k += m->surfaces[i].numedges - 2;
+		if (k > 0)
+			Con_DPrintf ("%s: %d tris, ACMR %.2f\n", m->name, k, (float) vcache.misses / k);
 	}
 
 // upload to GPU
 	GL_BindBufferFunc (GL_ARRAY_BUFFER, gl_bmodel_vbo);
-	GL_BufferDataFunc (GL_ARRAY_BUFFER, varray_bytes, varray, GL_STATIC_DRAW);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, varray_bytes, parray ? (void *) parray : (void *) varray, GL_STATIC_DRAW);
 	free (varray);
+	free (parray);
+	GL_BindBufferFunc (GL_ARRAY_BUFFER, gl_bmodel_layer_vbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, sizeof(float) * numverts, larray, GL_STATIC_DRAW);
+	free (larray);
+	GL_BindBufferFunc (GL_ARRAY_BUFFER, gl_bmodel_style_vbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, MAXLIGHTMAPS * numverts, sarray, GL_STATIC_DRAW);
+	free (sarray);
+	if (gl_bmodel_ibo)
+	{
+		GL_BindBufferFunc (GL_ELEMENT_ARRAY_BUFFER, gl_bmodel_ibo);
+		GL_BufferDataFunc (GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numindices, iarray, GL_STATIC_DRAW);
+		free (iarray);
+	}
+	gl_memory[GLMEM_BRUSH] = varray_bytes + (sizeof(float) + MAXLIGHTMAPS) * numverts +
+		(gl_bmodel_ibo ? sizeof(unsigned int) * numindices : 0);
 	
 // invalidate the cached bindings
 	GL_ClearBufferBindings ();
@@ -1051,17 +1829,12 @@ R_AddDynamicLights
 void R_AddDynamicLights (msurface_t *surf)
 {
 	int			lnum;
-	int			sd, td;
 	float		dist, rad, minlight;
 	vec3_t		impact, local;
-	int			s, t;
 	int			i;
 	int			smax, tmax;
 	mtexinfo_t	*tex;
-	//johnfitz -- lit support via lordhavoc
-	float		cred, cgreen, cblue, brightness;
-	unsigned	*bl;
-	//johnfitz
+	vec3_t		color; //johnfitz -- lit support via lordhavoc
 
 	smax = (surf->extents[0]>>4)+1;
 	tmax = (surf->extents[1]>>4)+1;
@@ -1094,37 +1867,11 @@ void R_AddDynamicLights (msurface_t *surf)
 		local[1] -= surf->texturemins[1];
 
 		//johnfitz -- lit support via lordhavoc
-		bl = blocklights;
-		cred = cl_dlights[lnum].color[0] * 256.0f;
-		cgreen = cl_dlights[lnum].color[1] * 256.0f;
-		cblue = cl_dlights[lnum].color[2] * 256.0f;
+		color[0] = cl_dlights[lnum].color[0] * 256.0f;
+		color[1] = cl_dlights[lnum].color[1] * 256.0f;
+		color[2] = cl_dlights[lnum].color[2] * 256.0f;
 		//johnfitz
-		for (t = 0 ; t<tmax ; t++)
-		{
-			td = local[1] - t*16;
-			if (td < 0)
-				td = -td;
-			for (s=0 ; s<smax ; s++)
-			{
-				sd = local[0] - s*16;
-				if (sd < 0)
-					sd = -sd;
-				if (sd > td)
-					dist = sd + (td>>1);
-				else
-					dist = td + (sd>>1);
-				if (dist < minlight)
-				//johnfitz -- lit support via lordhavoc
-				{
-					brightness = rad - dist;
-					bl[0] += (int) (brightness * cred);
-					bl[1] += (int) (brightness * cgreen);
-					bl[2] += (int) (brightness * cblue);
-				}
-				bl += 3;
-				//johnfitz
-			}
-		}
+		r_lightkernels.adddlight (blocklights, smax, tmax, local, rad, minlight, color);
 	}
 }
 
@@ -1147,6 +1894,7 @@ void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
 	unsigned	*bl;
 
 	surf->cached_dlight = (surf->dlightframe == r_framecount);
+	surf->styles_changed = false;
 
 	smax = (surf->extents[0]>>4)+1;
 	tmax = (surf->extents[1]>>4)+1;
@@ -1166,15 +1914,8 @@ void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
 			{
 				scale = d_lightstylevalue[surf->styles[maps]];
 				surf->cached_light[maps] = scale;	// 8.8 fraction
-				//johnfitz -- lit support via lordhavoc
-				bl = blocklights;
-				for (i=0 ; i<size ; i++)
-				{
-					*bl++ += *lightmap++ * scale;
-					*bl++ += *lightmap++ * scale;
-					*bl++ += *lightmap++ * scale;
-				}
-				//johnfitz
+				r_lightkernels.scalestyle (blocklights, lightmap, size*3, scale); //johnfitz -- lit support via lordhavoc
+				lightmap += size*3;
 			}
 		}
 
@@ -1193,30 +1934,7 @@ void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
 	switch (gl_lightmap_format)
 	{
 	case GL_RGBA:
-		stride -= smax * 4;
-		bl = blocklights;
-		for (i=0 ; i<tmax ; i++, dest += stride)
-		{
-			for (j=0 ; j<smax ; j++)
-			{
-				if (gl_overbright.value)
-				{
-					r = *bl++ >> 8;
-					g = *bl++ >> 8;
-					b = *bl++ >> 8;
-				}
-				else
-				{
-					r = *bl++ >> 7;
-					g = *bl++ >> 7;
-					b = *bl++ >> 7;
-				}
-				*dest++ = (r > 255)? 255 : r;
-				*dest++ = (g > 255)? 255 : g;
-				*dest++ = (b > 255)? 255 : b;
-				*dest++ = 255;
-			}
-		}
+		r_lightkernels.store (dest, stride, blocklights, smax, tmax, gl_overbright.value ? 8 : 7);
 		break;
 	case GL_BGRA:
 		stride -= smax * 4;
@@ -1265,20 +1983,129 @@ static void R_UploadLightmap(int lmap)
 
 	lm->modified = false;
 
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, lm->rectchange.t, LMBLOCK_WIDTH, lm->rectchange.h, gl_lightmap_format,
-			GL_UNSIGNED_BYTE, lm->data+lm->rectchange.t*LMBLOCK_WIDTH*lightmap_bytes);
-	lm->rectchange.l = LMBLOCK_WIDTH;
-	lm->rectchange.t = LMBLOCK_HEIGHT;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, lm->rectchange.t, lmblock_width, lm->rectchange.h, gl_lightmap_format,
+			GL_UNSIGNED_BYTE, lm->data+lm->rectchange.t*lmblock_width*lightmap_bytes);
+	lm->rectchange.l = lmblock_width;
+	lm->rectchange.t = lmblock_height;
 	lm->rectchange.h = 0;
 	lm->rectchange.w = 0;
 
 	rs_dynamiclightmaps++;
 }
 
+#define LIGHTMAP_PBOS	3
+
+static GLuint	lightmap_pbos[LIGHTMAP_PBOS];
+static int	lightmap_pbosize[LIGHTMAP_PBOS];
+static int	lightmap_nextpbo;
+
+/*
+================
+R_UploadLightmapsPBO
+
+Copies the changed rows of every page into one pixel buffer and sources
+the glTexSubImage2D calls from it, so the driver can return at once and
+transfer them while the frame is still being built instead of copying
+out of lightmaps[].data on the spot. The buffers are taken in turn and
+orphaned before being written, so one the GPU still reads never stalls.
+Returns false when it can't, for R_UploadLightmaps to do it directly.
+================
+*/
+static qboolean R_UploadLightmapsPBO (void)
+{
+	struct lightmap_s *lm;
+	int	lmap, size, rowsize, ofs, i;
+	byte	*data;
+
+	rowsize = lmblock_width * lightmap_bytes;
+	size = 0;
+	for (lmap = 0, lm = lightmaps; lmap < lightmap_count; lmap++, lm++)
+		if (lm->modified)
+			size += lm->rectchange.h * rowsize;
+	if (!size)
+		return true;
+
+	i = lightmap_nextpbo;
+	lightmap_nextpbo = (lightmap_nextpbo + 1) % LIGHTMAP_PBOS;
+	if (!lightmap_pbos[i])
+		GL_GenBuffersFunc (1, &lightmap_pbos[i]);
+	GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER, lightmap_pbos[i]);
+	if (lightmap_pbosize[i] < size)
+	{
+		gl_memory[GLMEM_PBO] += size - lightmap_pbosize[i];
+		lightmap_pbosize[i] = size;
+	}
+	GL_BufferDataFunc (GL_PIXEL_UNPACK_BUFFER, lightmap_pbosize[i], NULL, GL_STREAM_DRAW);
+	data = (byte *) GL_MapBufferFunc (GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (!data)
+	{
+		GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	// the dirty rectangles of a page are already merged into one band
+	// of whole rows, which is a single contiguous run of lm->data
+	ofs = 0;
+	for (lmap = 0, lm = lightmaps; lmap < lightmap_count; lmap++, lm++)
+	{
+		if (!lm->modified)
+			continue;
+		memcpy (data + ofs, lm->data + lm->rectchange.t * rowsize, lm->rectchange.h * rowsize);
+		ofs += lm->rectchange.h * rowsize;
+	}
+	if (!GL_UnmapBufferFunc (GL_PIXEL_UNPACK_BUFFER))
+	{
+		GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;	// contents were lost, the lightmaps stay modified
+	}
+
+	ofs = 0;
+	for (lmap = 0, lm = lightmaps; lmap < lightmap_count; lmap++, lm++)
+	{
+		if (!lm->modified)
+			continue;
+		GL_Bind (lm->texture);
+		glTexSubImage2D (GL_TEXTURE_2D, 0, 0, lm->rectchange.t, lmblock_width, lm->rectchange.h, gl_lightmap_format,
+				GL_UNSIGNED_BYTE, (void *)(intptr_t) ofs);
+		ofs += lm->rectchange.h * rowsize;
+
+		lm->modified = false;
+		lm->rectchange.l = lmblock_width;
+		lm->rectchange.t = lmblock_height;
+		lm->rectchange.h = 0;
+		lm->rectchange.w = 0;
+		rs_dynamiclightmaps++;
+	}
+	GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER, 0);
+	return true;
+}
+
+/*
+================
+R_DeleteLightmapBuffers -- for vid_restart
+================
+*/
+void R_DeleteLightmapBuffers (void)
+{
+	int	i;
+
+	for (i = 0; i < LIGHTMAP_PBOS; i++)
+	{
+		if (lightmap_pbos[i])
+			GL_DeleteBuffersFunc (1, &lightmap_pbos[i]);
+		lightmap_pbos[i] = 0;
+		lightmap_pbosize[i] = 0;
+	}
+	gl_memory[GLMEM_PBO] = 0;
+}
+
 void R_UploadLightmaps (void)
 {
 	int lmap;
 
+	if (gl_pbo_able && R_UploadLightmapsPBO ())
+		return;
+
 	for (lmap = 0; lmap < lightmap_count; lmap++)
 	{
 		if (!lightmaps[lmap].modified)
@@ -1315,8 +2142,8 @@ void R_RebuildAllLightmaps (void)
 			if (fa->flags & SURF_DRAWTILED)
 				continue;
 			base = lightmaps[fa->lightmaptexturenum].data;
-			base += fa->light_t * LMBLOCK_WIDTH * lightmap_bytes + fa->light_s * lightmap_bytes;
-			R_BuildLightMap (fa, base, LMBLOCK_WIDTH*lightmap_bytes);
+			base += fa->light_t * lmblock_width * lightmap_bytes + fa->light_s * lightmap_bytes;
+			R_BuildLightMap (fa, base, lmblock_width*lightmap_bytes);
 		}
 	}
 
@@ -1324,7 +2151,7 @@ void R_RebuildAllLightmaps (void)
 	for (i=0; i<lightmap_count; i++)
 	{
 		GL_Bind (lightmaps[i].texture);
-		glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, LMBLOCK_WIDTH, LMBLOCK_HEIGHT, gl_lightmap_format,
+		glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, lmblock_width, lmblock_height, gl_lightmap_format,
 				 GL_UNSIGNED_BYTE, lightmaps[i].data);
 	}
 }
@@ -0,0 +1,475 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_lightkernels.c -- inner loops of R_BuildLightMap and R_AddDynamicLights
+//
+// blocklights holds RGB triplets in 8.8 fixed point. The SIMD versions give
+// the same results as the plain C ones, bit for bit.
+
+#include "quakedef.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+static void R_ScaleLightmapStyle_C (unsigned *bl, const byte *lightmap, int count, unsigned scale);
+static void R_AddDynamicLight_C (unsigned *bl, int smax, int tmax, const float *local,
+				 float rad, float minlight, const float *color);
+static void R_StoreLightmap_C (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift);
+
+lightkernels_t	r_lightkernels = {
+	"C", R_ScaleLightmapStyle_C, R_AddDynamicLight_C, R_StoreLightmap_C
+};
+
+static cvar_t	r_lightmap_simd = {"r_lightmap_simd", "1", CVAR_ARCHIVE};
+
+/*
+=============================================================
+
+	PLAIN C
+
+=============================================================
+*/
+
+static void R_ScaleLightmapStyle_C (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	int	i;
+
+	for (i = 0 ; i < count ; i++)
+		*bl++ += *lightmap++ * scale;
+}
+
+// luxels s to smax-1 of a row, bl points at luxel s
+static void R_AddDynamicLightSpan (unsigned *bl, int s, int smax, int td, float local0,
+				   float rad, float minlight, const float *color)
+{
+	int	sd;
+	float	dist, brightness;
+
+	for ( ; s<smax ; s++)
+	{
+		sd = local0 - s*16;
+		if (sd < 0)
+			sd = -sd;
+		if (sd > td)
+			dist = sd + (td>>1);
+		else
+			dist = td + (sd>>1);
+		if (dist < minlight)
+		{
+			brightness = rad - dist;
+			bl[0] += (int) (brightness * color[0]);
+			bl[1] += (int) (brightness * color[1]);
+			bl[2] += (int) (brightness * color[2]);
+		}
+		bl += 3;
+	}
+}
+
+static void R_AddDynamicLight_C (unsigned *bl, int smax, int tmax, const float *local,
+				 float rad, float minlight, const float *color)
+{
+	int	t, td;
+
+	for (t = 0 ; t<tmax ; t++, bl += smax*3)
+	{
+		td = local[1] - t*16;
+		if (td < 0)
+			td = -td;
+		R_AddDynamicLightSpan (bl, 0, smax, td, local[0], rad, minlight, color);
+	}
+}
+
+static void R_StoreLightmap_C (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift)
+{
+	int	i, j, r, g, b;
+
+	stride -= smax * 4;
+	for (i=0 ; i<tmax ; i++, dest += stride)
+	{
+		for (j=0 ; j<smax ; j++)
+		{
+			r = *bl++ >> shift;
+			g = *bl++ >> shift;
+			b = *bl++ >> shift;
+			*dest++ = (r > 255)? 255 : r;
+			*dest++ = (g > 255)? 255 : g;
+			*dest++ = (b > 255)? 255 : b;
+			*dest++ = 255;
+		}
+	}
+}
+
+/*
+=============================================================
+
+	SSE2
+
+=============================================================
+*/
+
+#ifdef USE_SSE2
+
+static void R_ScaleLightmapStyle_SSE2 (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	__m128i	zero, vscale, v, lo, hi, p0, p1;
+	int	i;
+
+	if (scale > 0xffff)
+	{ // doesn't fit the 16 bit multiplies, lightstyles never get there
+		R_ScaleLightmapStyle_C (bl, lightmap, count, scale);
+		return;
+	}
+
+	zero = _mm_setzero_si128 ();
+	vscale = _mm_set1_epi16 ((short)scale);
+	for (i = 0 ; i + 8 <= count ; i += 8)
+	{
+		v = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(lightmap + i)), zero);
+		lo = _mm_mullo_epi16 (v, vscale);
+		hi = _mm_mulhi_epu16 (v, vscale);
+		p0 = _mm_unpacklo_epi16 (lo, hi);
+		p1 = _mm_unpackhi_epi16 (lo, hi);
+		_mm_storeu_si128 ((__m128i *)(bl + i), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + i)), p0));
+		_mm_storeu_si128 ((__m128i *)(bl + i + 4), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + i + 4)), p1));
+	}
+
+	R_ScaleLightmapStyle_C (bl + i, lightmap + i, count - i, scale);
+}
+
+static void R_AddDynamicLight_SSE2 (unsigned *bl, int smax, int tmax, const float *local,
+				    float rad, float minlight, const float *color)
+{
+	__m128	vlocal, vrad, vminlight, c0, c1, c2, dist, bright;
+	__m128i	sstep, sd, td, sign, halfs, halft, mask;
+	int	s, t, tdi;
+
+	vlocal = _mm_set1_ps (local[0]);
+	vrad = _mm_set1_ps (rad);
+	vminlight = _mm_set1_ps (minlight);
+	sstep = _mm_setr_epi32 (0, 16, 32, 48);
+	// colors lined up with 4 interleaved RGB luxels, see below
+	c0 = _mm_setr_ps (color[0], color[1], color[2], color[0]);
+	c1 = _mm_setr_ps (color[1], color[2], color[0], color[1]);
+	c2 = _mm_setr_ps (color[2], color[0], color[1], color[2]);
+
+	for (t = 0 ; t<tmax ; t++)
+	{
+		tdi = local[1] - t*16;
+		if (tdi < 0)
+			tdi = -tdi;
+		td = _mm_set1_epi32 (tdi);
+		halft = _mm_set1_epi32 (tdi >> 1);
+
+		for (s = 0 ; s + 4 <= smax ; s += 4, bl += 12)
+		{
+			sd = _mm_add_epi32 (_mm_set1_epi32 (s*16), sstep);
+			sd = _mm_cvttps_epi32 (_mm_sub_ps (vlocal, _mm_cvtepi32_ps (sd)));
+			sign = _mm_srai_epi32 (sd, 31);
+			sd = _mm_sub_epi32 (_mm_xor_si128 (sd, sign), sign);
+			halfs = _mm_srai_epi32 (sd, 1);
+
+			// sd > td ? sd + td/2 : td + sd/2
+			mask = _mm_cmpgt_epi32 (sd, td);
+			dist = _mm_cvtepi32_ps (_mm_or_si128 (_mm_and_si128 (mask, _mm_add_epi32 (sd, halft)),
+							_mm_andnot_si128 (mask, _mm_add_epi32 (td, halfs))));
+
+			// luxels the light doesn't reach add nothing
+			bright = _mm_and_ps (_mm_cmplt_ps (dist, vminlight), _mm_sub_ps (vrad, dist));
+
+			// b0 b0 b0 b1 | b1 b1 b2 b2 | b2 b3 b3 b3 against r g b r | g b r g | b r g b
+			_mm_storeu_si128 ((__m128i *)(bl + 0), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + 0)),
+						_mm_cvttps_epi32 (_mm_mul_ps (_mm_shuffle_ps (bright, bright, _MM_SHUFFLE(1,0,0,0)), c0))));
+			_mm_storeu_si128 ((__m128i *)(bl + 4), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + 4)),
+						_mm_cvttps_epi32 (_mm_mul_ps (_mm_shuffle_ps (bright, bright, _MM_SHUFFLE(2,2,1,1)), c1))));
+			_mm_storeu_si128 ((__m128i *)(bl + 8), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + 8)),
+						_mm_cvttps_epi32 (_mm_mul_ps (_mm_shuffle_ps (bright, bright, _MM_SHUFFLE(3,3,3,2)), c2))));
+		}
+
+		// leftover luxels of the row
+		R_AddDynamicLightSpan (bl, s, smax, tdi, local[0], rad, minlight, color);
+		bl += (smax - s) * 3;
+	}
+}
+
+static void R_StoreLightmap_SSE2 (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift)
+{
+	__m128i	alpha, vshift, v0, v1, v2, v3;
+	int	i, j, last;
+
+	alpha = _mm_set1_epi32 ((int)0xff000000);
+	vshift = _mm_cvtsi32_si128 (shift);
+	for (i=0 ; i<tmax ; i++, dest += stride)
+	{
+		// each luxel is read as r g b plus the next red, which the alpha
+		// overwrites, so stay clear of the last luxel of the surface
+		last = (i == tmax - 1) ? smax - 1 : smax;
+		for (j = 0 ; j + 4 <= last ; j += 4)
+		{
+			v0 = _mm_srl_epi32 (_mm_loadu_si128 ((const __m128i *)(bl + 0)), vshift);
+			v1 = _mm_srl_epi32 (_mm_loadu_si128 ((const __m128i *)(bl + 3)), vshift);
+			v2 = _mm_srl_epi32 (_mm_loadu_si128 ((const __m128i *)(bl + 6)), vshift);
+			v3 = _mm_srl_epi32 (_mm_loadu_si128 ((const __m128i *)(bl + 9)), vshift);
+			// blocklights stay well below 2^31, so signed saturation is fine
+			v0 = _mm_packus_epi16 (_mm_packs_epi32 (v0, v1), _mm_packs_epi32 (v2, v3));
+			_mm_storeu_si128 ((__m128i *)(dest + j*4), _mm_or_si128 (v0, alpha));
+			bl += 12;
+		}
+		if (j < smax)
+		{
+			R_StoreLightmap_C (dest + j*4, (smax - j) * 4, bl, smax - j, 1, shift);
+			bl += (smax - j) * 3;
+		}
+	}
+}
+
+#endif /* USE_SSE2 */
+
+/*
+=============================================================
+
+	NEON
+
+=============================================================
+*/
+
+#ifdef USE_NEON
+
+static void R_ScaleLightmapStyle_NEON (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	uint16x8_t	v;
+	uint16x4_t	vscale;
+	int		i;
+
+	if (scale > 0xffff)
+	{ // doesn't fit the 16 bit multiplies, lightstyles never get there
+		R_ScaleLightmapStyle_C (bl, lightmap, count, scale);
+		return;
+	}
+
+	vscale = vdup_n_u16 ((uint16_t)scale);
+	for (i = 0 ; i + 8 <= count ; i += 8)
+	{
+		v = vmovl_u8 (vld1_u8 (lightmap + i));
+		vst1q_u32 (bl + i, vmlal_u16 (vld1q_u32 (bl + i), vget_low_u16 (v), vscale));
+		vst1q_u32 (bl + i + 4, vmlal_u16 (vld1q_u32 (bl + i + 4), vget_high_u16 (v), vscale));
+	}
+
+	R_ScaleLightmapStyle_C (bl + i, lightmap + i, count - i, scale);
+}
+
+static void R_AddDynamicLight_NEON (unsigned *bl, int smax, int tmax, const float *local,
+				    float rad, float minlight, const float *color)
+{
+	static const int32_t	steps[4] = {0, 16, 32, 48};
+	float32x4_t	soff, dist, bright;
+	int32x4_t	sstep, sd, td, halft;
+	uint32x4_t	mask;
+	uint32x4x3_t	rgb;
+	int		s, t, tdi;
+
+	sstep = vld1q_s32 (steps);
+	for (t = 0 ; t<tmax ; t++)
+	{
+		tdi = local[1] - t*16;
+		if (tdi < 0)
+			tdi = -tdi;
+		td = vdupq_n_s32 (tdi);
+		halft = vdupq_n_s32 (tdi >> 1);
+
+		for (s = 0 ; s + 4 <= smax ; s += 4, bl += 12)
+		{
+			soff = vcvtq_f32_s32 (vaddq_s32 (vdupq_n_s32 (s*16), sstep));
+			sd = vabsq_s32 (vcvtq_s32_f32 (vsubq_f32 (vdupq_n_f32 (local[0]), soff)));
+
+			// sd > td ? sd + td/2 : td + sd/2
+			mask = vcgtq_s32 (sd, td);
+			dist = vcvtq_f32_s32 (vbslq_s32 (mask, vaddq_s32 (sd, halft), vaddq_s32 (td, vshrq_n_s32 (sd, 1))));
+
+			// luxels the light doesn't reach add nothing
+			bright = vsubq_f32 (vdupq_n_f32 (rad), dist);
+			bright = vreinterpretq_f32_u32 (vandq_u32 (vcltq_f32 (dist, vdupq_n_f32 (minlight)), vreinterpretq_u32_f32 (bright)));
+
+			rgb = vld3q_u32 (bl);
+			rgb.val[0] = vaddq_u32 (rgb.val[0], vreinterpretq_u32_s32 (vcvtq_s32_f32 (vmulq_n_f32 (bright, color[0]))));
+			rgb.val[1] = vaddq_u32 (rgb.val[1], vreinterpretq_u32_s32 (vcvtq_s32_f32 (vmulq_n_f32 (bright, color[1]))));
+			rgb.val[2] = vaddq_u32 (rgb.val[2], vreinterpretq_u32_s32 (vcvtq_s32_f32 (vmulq_n_f32 (bright, color[2]))));
+			vst3q_u32 (bl, rgb);
+		}
+
+		// leftover luxels of the row
+		R_AddDynamicLightSpan (bl, s, smax, tdi, local[0], rad, minlight, color);
+		bl += (smax - s) * 3;
+	}
+}
+
+static void R_StoreLightmap_NEON (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift)
+{
+	int32x4_t	vshift;
+	uint32x4x3_t	lo, hi;
+	uint8x8x4_t	out;
+	int		i, j, k;
+
+	vshift = vdupq_n_s32 (-shift);
+	out.val[3] = vdup_n_u8 (255);
+	for (i=0 ; i<tmax ; i++, dest += stride)
+	{
+		for (j = 0 ; j + 8 <= smax ; j += 8, bl += 24)
+		{
+			lo = vld3q_u32 (bl);
+			hi = vld3q_u32 (bl + 12);
+			for (k = 0 ; k < 3 ; k++)
+				out.val[k] = vqmovn_u16 (vcombine_u16 (vqmovn_u32 (vshlq_u32 (lo.val[k], vshift)),
+								       vqmovn_u32 (vshlq_u32 (hi.val[k], vshift))));
+			vst4_u8 (dest + j*4, out);
+		}
+		if (j < smax)
+		{
+			R_StoreLightmap_C (dest + j*4, (smax - j) * 4, bl, smax - j, 1, shift);
+			bl += (smax - j) * 3;
+		}
+	}
+}
+
+#endif /* USE_NEON */
+
+//==============================================================================
+
+/*
+=============
+R_InitLightKernels
+
+Picks the fastest kernels the CPU supports, unless r_lightmap_simd is 0.
+=============
+*/
+static void R_InitLightKernels (void)
+{
+	r_lightkernels.name = "C";
+	r_lightkernels.scalestyle = R_ScaleLightmapStyle_C;
+	r_lightkernels.adddlight = R_AddDynamicLight_C;
+	r_lightkernels.store = R_StoreLightmap_C;
+
+	if (!r_lightmap_simd.value)
+		return;
+
+#ifdef USE_SSE2
+	if (SDL_HasSSE2 ())
+	{
+		r_lightkernels.name = "SSE2";
+		r_lightkernels.scalestyle = R_ScaleLightmapStyle_SSE2;
+		r_lightkernels.adddlight = R_AddDynamicLight_SSE2;
+		r_lightkernels.store = R_StoreLightmap_SSE2;
+	}
+#endif
+#ifdef USE_NEON
+#if defined(USE_SDL2) && !defined(__aarch64__)
+	if (SDL_HasNEON ())
+#endif
+	{
+		r_lightkernels.name = "NEON";
+		r_lightkernels.scalestyle = R_ScaleLightmapStyle_NEON;
+		r_lightkernels.adddlight = R_AddDynamicLight_NEON;
+		r_lightkernels.store = R_StoreLightmap_NEON;
+	}
+#endif
+}
+
+static void R_LightmapSIMD_f (cvar_t *var)
+{
+	R_InitLightKernels ();
+}
+
+/*
+=============
+R_LightmapBench_f
+
+Rebuilds every lightmap n times with the current kernels and reports the
+time taken, for comparing r_lightmap_simd 0 and 1.
+=============
+*/
+static void R_LightmapBench_f (void)
+{
+	int		i, j, n, pass, surfaces;
+	qmodel_t	*mod;
+	msurface_t	*fa;
+	byte		*base;
+	double		start, time;
+
+	if (cls.state != ca_connected || !cl.worldmodel)
+	{
+		Con_Printf ("no map loaded\n");
+		return;
+	}
+
+	n = (Cmd_Argc () > 1) ? Q_atoi (Cmd_Argv (1)) : 10;
+	if (n < 1)
+		n = 1;
+
+	surfaces = 0;
+	start = Sys_DoubleTime ();
+	for (pass = 0; pass < n; pass++)
+	{
+		for (i=1; i<MAX_MODELS; i++)
+		{
+			if (!(mod = cl.model_precache[i]))
+				continue;
+			fa = &mod->surfaces[mod->firstmodelsurface];
+			for (j=0; j<mod->nummodelsurfaces; j++, fa++)
+			{
+				if (fa->flags & SURF_DRAWTILED)
+					continue;
+				base = lightmaps[fa->lightmaptexturenum].data;
+				base += fa->light_t * lmblock_width * lightmap_bytes + fa->light_s * lightmap_bytes;
+				R_BuildLightMap (fa, base, lmblock_width*lightmap_bytes);
+				if (!pass)
+					surfaces++;
+			}
+		}
+	}
+	time = (Sys_DoubleTime () - start) * 1000.0;
+
+	// the data is unchanged, but keep the textures in step with it
+	R_RebuildAllLightmaps ();
+
+	Con_Printf ("%s: %i surfaces x %i in %.2f ms, %.3f ms per rebuild\n",
+			r_lightkernels.name, surfaces, n, time, time / n);
+}
+
+void R_InitLightmapKernels (void)
+{
+	Cvar_RegisterVariable (&r_lightmap_simd);
+	Cvar_SetCallback (&r_lightmap_simd, R_LightmapSIMD_f);
+	Cmd_AddCommand ("r_lightmapbench", R_LightmapBench_f);
+
+	R_InitLightKernels ();
+	Con_SafePrintf ("Lightmap kernels: %s\n", r_lightkernels.name);
+}
+
+const char *R_LightmapKernelsName (void)
+{
+	return r_lightkernels.name;
+}
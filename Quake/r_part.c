@@ -23,26 +23,113 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
-#define MAX_PARTICLES			2048	// default max # of particles at one
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+#define MAX_PARTICLES			16384	// default max # of particles at one
 										//  time
 #define ABSOLUTE_MIN_PARTICLES	512		// no fewer than this no matter what's
 										//  on the command line
+#define ABSOLUTE_MAX_PARTICLES	1048576
+
+#define NUM_PTYPES				(pt_blob2 + 1)
 
 int		ramp1[8] = {0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61};
 int		ramp2[8] = {0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66};
 int		ramp3[8] = {0x6d, 0x6b, 6, 5, 4, 3};
 
-particle_t	*active_particles, *free_particles, *particles;
+// live particles are packed at the front of each array, a dead one is
+// replaced by the last live one
+typedef struct
+{
+	int		numactive;
+	int		max;
+	float	*org[3];	// one array per axis
+	float	*vel[3];
+	float	*ramp;
+	float	*die;
+	byte	*color;
+	byte	*type;
+} particlepool_t;
+
+static particlepool_t	part;
+
+// instance data for the GLSL path
+typedef struct
+{
+	float	org[3];
+	GLubyte	color[4];
+} partinstance_t;
+
+#define MAX_PARTICLE_INSTANCES	(MAX_STREAM_ALLOC / (int) sizeof(partinstance_t))
+
+#define cornerAttrIndex 0
+#define originAttrIndex 1
+#define colorAttrIndex 2
+
+static GLuint r_particle_program;
+
+// uniforms used in particle shader
+static GLuint upLoc;
+static GLuint rightLoc;
+static GLuint viewOriginLoc;
+static GLuint viewForwardLoc;
+static GLuint scaleLoc;
+static GLuint texScaleLoc;
+static GLuint particleTexLoc;
+
+// r_gpuparticles: particles are uploaded once when spawned and moved by the
+// vertex shader from their spawn state, see GLParticles_CreateShaders
+typedef struct
+{
+	float	org[3];
+	float	vel[3];
+	float	life[4];	// spawn time, die time, starting ramp, type
+	GLubyte	color[4];
+} gpuparticle_t;
+
+#define velocityAttrIndex 3
+#define lifeAttrIndex 4
+
+#define NUM_RAMP_COLORS		22	// ramp3, ramp1, ramp2 in the order the shader indexes them
+
+static GLuint r_gpuparticle_program;
+
+static GLuint gpuUpLoc;
+static GLuint gpuRightLoc;
+static GLuint gpuViewOriginLoc;
+static GLuint gpuViewForwardLoc;
+static GLuint gpuScaleLoc;
+static GLuint gpuTexScaleLoc;
+static GLuint gpuParticleTexLoc;
+static GLuint gpuTimeLoc;
+static GLuint gpuGravityLoc;
+static GLuint gpuRampColorsLoc;
+
+// ring of spawned particles, the oldest are overwritten when it's full
+static GLuint			gpu_particlebuffer;
+static gpuparticle_t	*gpu_staging;	// one frame of spawns
+static int				gpu_capacity;
+static int				gpu_head;		// next slot to write
+static int				gpu_used;		// slots written since the ring was last empty
+static double			gpu_timebase;	// times are uploaded relative to this
+static double			gpu_lastdie;	// every particle in the ring is dead after this
 
 vec3_t			r_pright, r_pup, r_ppn;
 
-int			r_numparticles;
-
 gltexture_t *particletexture, *particletexture1, *particletexture2, *particletexture3, *particletexture4; //johnfitz
 float texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
 
 cvar_t	r_particles = {"r_particles","1", CVAR_ARCHIVE}; //johnfitz
 cvar_t	r_quadparticles = {"r_quadparticles","1", CVAR_ARCHIVE}; //johnfitz
+cvar_t	r_gpuparticles = {"r_gpuparticles","0", CVAR_ARCHIVE};
 
 /*
 ===============
@@ -148,31 +235,87 @@ R_InitParticles
 */
 void R_InitParticles (void)
 {
-	int		i;
+	int		i, max;
 
 	i = COM_CheckParm ("-particles");
 
-	if (i)
+	if (i && i < com_argc-1)
 	{
-		r_numparticles = (int)(Q_atoi(com_argv[i+1]));
-		if (r_numparticles < ABSOLUTE_MIN_PARTICLES)
-			r_numparticles = ABSOLUTE_MIN_PARTICLES;
+		max = (int)(Q_atoi(com_argv[i+1]));
+		max = CLAMP (ABSOLUTE_MIN_PARTICLES, max, ABSOLUTE_MAX_PARTICLES);
 	}
 	else
 	{
-		r_numparticles = MAX_PARTICLES;
+		max = MAX_PARTICLES;
 	}
 
-	particles = (particle_t *)
-			Hunk_AllocName (r_numparticles * sizeof(particle_t), "particles");
+	part.max = max;
+	part.numactive = 0;
+	for (i=0 ; i<3 ; i++)
+	{
+		part.org[i] = (float *) Hunk_AllocName (max * sizeof(float), "particles");
+		part.vel[i] = (float *) Hunk_AllocName (max * sizeof(float), "particles");
+	}
+	part.ramp = (float *) Hunk_AllocName (max * sizeof(float), "particles");
+	part.die = (float *) Hunk_AllocName (max * sizeof(float), "particles");
+	part.color = (byte *) Hunk_AllocName (max, "particles");
+	part.type = (byte *) Hunk_AllocName (max, "particles");
 
 	Cvar_RegisterVariable (&r_particles); //johnfitz
 	Cvar_SetCallback (&r_particles, R_SetParticleTexture_f);
 	Cvar_RegisterVariable (&r_quadparticles); //johnfitz
+	Cvar_RegisterVariable (&r_gpuparticles);
 
 	R_InitParticleTextures (); //johnfitz
 }
 
+/*
+===============
+R_AllocParticle
+
+Returns the index of a new particle with no velocity, or -1 if the pool
+is full.
+===============
+*/
+static int R_AllocParticle (void)
+{
+	int		n;
+
+	if (part.numactive == part.max)
+		return -1;
+
+	n = part.numactive++;
+	part.vel[0][n] = part.vel[1][n] = part.vel[2][n] = 0;
+	part.ramp[n] = 0;
+	return n;
+}
+
+/*
+===============
+R_KillParticle
+
+Moves the last live particle into slot n.
+===============
+*/
+static void R_KillParticle (int n)
+{
+	int		last, i;
+
+	last = --part.numactive;
+	if (n == last)
+		return;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		part.org[i][n] = part.org[i][last];
+		part.vel[i][n] = part.vel[i][last];
+	}
+	part.ramp[n] = part.ramp[last];
+	part.die[n] = part.die[last];
+	part.color[n] = part.color[last];
+	part.type[n] = part.type[last];
+}
+
 /*
 ===============
 R_EntityParticles
@@ -188,8 +331,7 @@ float	timescale = 0.01;
 
 void R_EntityParticles (entity_t *ent)
 {
-	int		i;
-	particle_t	*p;
+	int		i, n;
 	float		angle;
 	float		sp, sy, cp, cy;
 //	float		sr, cr;
@@ -226,20 +368,16 @@ void R_EntityParticles (entity_t *ent)
 		forward[1] = cp*sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 0.01;
-		p->color = 0x6f;
-		p->type = pt_explode;
-
-		p->org[0] = ent->origin[0] + r_avertexnormals[i][0]*dist + forward[0]*beamlength;
-		p->org[1] = ent->origin[1] + r_avertexnormals[i][1]*dist + forward[1]*beamlength;
-		p->org[2] = ent->origin[2] + r_avertexnormals[i][2]*dist + forward[2]*beamlength;
+
+		part.die[n] = cl.time + 0.01;
+		part.color[n] = 0x6f;
+		part.type[n] = pt_explode;
+
+		part.org[0][n] = ent->origin[0] + r_avertexnormals[i][0]*dist + forward[0]*beamlength;
+		part.org[1][n] = ent->origin[1] + r_avertexnormals[i][1]*dist + forward[1]*beamlength;
+		part.org[2][n] = ent->origin[2] + r_avertexnormals[i][2]*dist + forward[2]*beamlength;
 	}
 }
 
@@ -250,14 +388,21 @@ R_ClearParticles
 */
 void R_ClearParticles (void)
 {
-	int		i;
+	part.numactive = 0;
+	gpu_head = gpu_used = 0;
+}
 
-	free_particles = &particles[0];
-	active_particles = NULL;
+/*
+===============
+R_GPUParticles
 
-	for (i=0 ;i<r_numparticles ; i++)
-		particles[i].next = &particles[i+1];
-	particles[r_numparticles-1].next = NULL;
+True when the vertex shader moves the particles, the CPU pool then only
+holds the particles spawned since the last R_DrawParticles.
+===============
+*/
+static qboolean R_GPUParticles (void)
+{
+	return r_gpuparticles.value && r_gpuparticle_program;
 }
 
 /*
@@ -270,8 +415,7 @@ void R_ReadPointFile_f (void)
 	FILE	*f;
 	vec3_t	org;
 	int		r;
-	int		c;
-	particle_t	*p;
+	int		c, n;
 	char	name[MAX_QPATH];
 
 	if (cls.state != ca_connected)
@@ -296,21 +440,18 @@ void R_ReadPointFile_f (void)
 			break;
 		c++;
 
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 		{
 			Con_Printf ("Not enough free particles\n");
 			break;
 		}
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = 99999;
-		p->color = (-c)&15;
-		p->type = pt_static;
-		VectorCopy (vec3_origin, p->vel);
-		VectorCopy (org, p->org);
+
+		part.die[n] = 99999;
+		part.color[n] = (-c)&15;
+		part.type[n] = pt_static;
+		part.org[0][n] = org[0];
+		part.org[1][n] = org[1];
+		part.org[2][n] = org[2];
 	}
 
 	fclose (f);
@@ -351,37 +492,32 @@ R_ParticleExplosion
 */
 void R_ParticleExplosion (vec3_t org)
 {
-	int			i, j;
-	particle_t	*p;
+	int			i, j, n;
 
 	for (i=0 ; i<1024 ; i++)
 	{
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 5;
-		p->color = ramp1[0];
-		p->ramp = rand()&3;
+
+		part.die[n] = cl.time + 5;
+		part.color[n] = ramp1[0];
+		part.ramp[n] = rand()&3;
 		if (i & 1)
 		{
-			p->type = pt_explode;
+			part.type[n] = pt_explode;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				part.org[j][n] = org[j] + ((rand()%32)-16);
+				part.vel[j][n] = (rand()%512)-256;
 			}
 		}
 		else
 		{
-			p->type = pt_explode2;
+			part.type[n] = pt_explode2;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				part.org[j][n] = org[j] + ((rand()%32)-16);
+				part.vel[j][n] = (rand()%512)-256;
 			}
 		}
 	}
@@ -394,28 +530,23 @@ R_ParticleExplosion2
 */
 void R_ParticleExplosion2 (vec3_t org, int colorStart, int colorLength)
 {
-	int			i, j;
-	particle_t	*p;
+	int			i, j, n;
 	int			colorMod = 0;
 
 	for (i=0; i<512; i++)
 	{
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
-		p->die = cl.time + 0.3;
-		p->color = colorStart + (colorMod % colorLength);
+		part.die[n] = cl.time + 0.3;
+		part.color[n] = colorStart + (colorMod % colorLength);
 		colorMod++;
 
-		p->type = pt_blob;
+		part.type[n] = pt_blob;
 		for (j=0 ; j<3 ; j++)
 		{
-			p->org[j] = org[j] + ((rand()%32)-16);
-			p->vel[j] = (rand()%512)-256;
+			part.org[j][n] = org[j] + ((rand()%32)-16);
+			part.vel[j][n] = (rand()%512)-256;
 		}
 	}
 }
@@ -427,38 +558,33 @@ R_BlobExplosion
 */
 void R_BlobExplosion (vec3_t org)
 {
-	int			i, j;
-	particle_t	*p;
+	int			i, j, n;
 
 	for (i=0 ; i<1024 ; i++)
 	{
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
-		p->die = cl.time + 1 + (rand()&8)*0.05;
+		part.die[n] = cl.time + 1 + (rand()&8)*0.05;
 
 		if (i & 1)
 		{
-			p->type = pt_blob;
-			p->color = 66 + rand()%6;
+			part.type[n] = pt_blob;
+			part.color[n] = 66 + rand()%6;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				part.org[j][n] = org[j] + ((rand()%32)-16);
+				part.vel[j][n] = (rand()%512)-256;
 			}
 		}
 		else
 		{
-			p->type = pt_blob2;
-			p->color = 150 + rand()%6;
+			part.type[n] = pt_blob2;
+			part.color[n] = 150 + rand()%6;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()%32)-16);
-				p->vel[j] = (rand()%512)-256;
+				part.org[j][n] = org[j] + ((rand()%32)-16);
+				part.vel[j][n] = (rand()%512)-256;
 			}
 		}
 	}
@@ -471,51 +597,46 @@ R_RunParticleEffect
 */
 void R_RunParticleEffect (vec3_t org, vec3_t dir, int color, int count)
 {
-	int			i, j;
-	particle_t	*p;
+	int			i, j, n;
 
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		if (count == 1024)
 		{	// rocket explosion
-			p->die = cl.time + 5;
-			p->color = ramp1[0];
-			p->ramp = rand()&3;
+			part.die[n] = cl.time + 5;
+			part.color[n] = ramp1[0];
+			part.ramp[n] = rand()&3;
 			if (i & 1)
 			{
-				p->type = pt_explode;
+				part.type[n] = pt_explode;
 				for (j=0 ; j<3 ; j++)
 				{
-					p->org[j] = org[j] + ((rand()%32)-16);
-					p->vel[j] = (rand()%512)-256;
+					part.org[j][n] = org[j] + ((rand()%32)-16);
+					part.vel[j][n] = (rand()%512)-256;
 				}
 			}
 			else
 			{
-				p->type = pt_explode2;
+				part.type[n] = pt_explode2;
 				for (j=0 ; j<3 ; j++)
 				{
-					p->org[j] = org[j] + ((rand()%32)-16);
-					p->vel[j] = (rand()%512)-256;
+					part.org[j][n] = org[j] + ((rand()%32)-16);
+					part.vel[j][n] = (rand()%512)-256;
 				}
 			}
 		}
 		else
 		{
-			p->die = cl.time + 0.1*(rand()%5);
-			p->color = (color&~7) + (rand()&7);
-			p->type = pt_slowgrav;
+			part.die[n] = cl.time + 0.1*(rand()%5);
+			part.color[n] = (color&~7) + (rand()&7);
+			part.type[n] = pt_slowgrav;
 			for (j=0 ; j<3 ; j++)
 			{
-				p->org[j] = org[j] + ((rand()&15)-8);
-				p->vel[j] = dir[j]*15;// + (rand()%300)-150;
+				part.org[j][n] = org[j] + ((rand()&15)-8);
+				part.vel[j][n] = dir[j]*15;// + (rand()%300)-150;
 			}
 		}
 	}
@@ -528,8 +649,7 @@ R_LavaSplash
 */
 void R_LavaSplash (vec3_t org)
 {
-	int			i, j, k;
-	particle_t	*p;
+	int			i, j, k, n;
 	float		vel;
 	vec3_t		dir;
 
@@ -537,28 +657,26 @@ void R_LavaSplash (vec3_t org)
 		for (j=-16 ; j<16 ; j++)
 			for (k=0 ; k<1 ; k++)
 			{
-				if (!free_particles)
+				if ((n = R_AllocParticle ()) < 0)
 					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
 
-				p->die = cl.time + 2 + (rand()&31) * 0.02;
-				p->color = 224 + (rand()&7);
-				p->type = pt_slowgrav;
+				part.die[n] = cl.time + 2 + (rand()&31) * 0.02;
+				part.color[n] = 224 + (rand()&7);
+				part.type[n] = pt_slowgrav;
 
 				dir[0] = j*8 + (rand()&7);
 				dir[1] = i*8 + (rand()&7);
 				dir[2] = 256;
 
-				p->org[0] = org[0] + dir[0];
-				p->org[1] = org[1] + dir[1];
-				p->org[2] = org[2] + (rand()&63);
+				part.org[0][n] = org[0] + dir[0];
+				part.org[1][n] = org[1] + dir[1];
+				part.org[2][n] = org[2] + (rand()&63);
 
 				VectorNormalize (dir);
 				vel = 50 + (rand()&63);
-				VectorScale (dir, vel, p->vel);
+				part.vel[0][n] = dir[0] * vel;
+				part.vel[1][n] = dir[1] * vel;
+				part.vel[2][n] = dir[2] * vel;
 			}
 }
 
@@ -569,8 +687,7 @@ R_TeleportSplash
 */
 void R_TeleportSplash (vec3_t org)
 {
-	int			i, j, k;
-	particle_t	*p;
+	int			i, j, k, n;
 	float		vel;
 	vec3_t		dir;
 
@@ -578,28 +695,26 @@ void R_TeleportSplash (vec3_t org)
 		for (j=-16 ; j<16 ; j+=4)
 			for (k=-24 ; k<32 ; k+=4)
 			{
-				if (!free_particles)
+				if ((n = R_AllocParticle ()) < 0)
 					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
 
-				p->die = cl.time + 0.2 + (rand()&7) * 0.02;
-				p->color = 7 + (rand()&7);
-				p->type = pt_slowgrav;
+				part.die[n] = cl.time + 0.2 + (rand()&7) * 0.02;
+				part.color[n] = 7 + (rand()&7);
+				part.type[n] = pt_slowgrav;
 
 				dir[0] = j*8;
 				dir[1] = i*8;
 				dir[2] = k*8;
 
-				p->org[0] = org[0] + i + (rand()&3);
-				p->org[1] = org[1] + j + (rand()&3);
-				p->org[2] = org[2] + k + (rand()&3);
+				part.org[0][n] = org[0] + i + (rand()&3);
+				part.org[1][n] = org[1] + j + (rand()&3);
+				part.org[2][n] = org[2] + k + (rand()&3);
 
 				VectorNormalize (dir);
 				vel = 50 + (rand()&63);
-				VectorScale (dir, vel, p->vel);
+				part.vel[0][n] = dir[0] * vel;
+				part.vel[1][n] = dir[1] * vel;
+				part.vel[2][n] = dir[2] * vel;
 			}
 }
 
@@ -614,8 +729,7 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 {
 	vec3_t		vec;
 	float		len;
-	int			j;
-	particle_t	*p;
+	int			j, n;
 	int			dec;
 	static int	tracercount;
 
@@ -633,79 +747,75 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		if ((n = R_AllocParticle ()) < 0)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
-		VectorCopy (vec3_origin, p->vel);
-		p->die = cl.time + 2;
+				part.die[n] = cl.time + 2;
 
 		switch (type)
 		{
 			case 0:	// rocket trail
-				p->ramp = (rand()&3);
-				p->color = ramp3[(int)p->ramp];
-				p->type = pt_fire;
+				part.ramp[n] = (rand()&3);
+				part.color[n] = ramp3[(int)part.ramp[n]];
+				part.type[n] = pt_fire;
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					part.org[j][n] = start[j] + ((rand()%6)-3);
 				break;
 
 			case 1:	// smoke smoke
-				p->ramp = (rand()&3) + 2;
-				p->color = ramp3[(int)p->ramp];
-				p->type = pt_fire;
+				part.ramp[n] = (rand()&3) + 2;
+				part.color[n] = ramp3[(int)part.ramp[n]];
+				part.type[n] = pt_fire;
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					part.org[j][n] = start[j] + ((rand()%6)-3);
 				break;
 
 			case 2:	// blood
-				p->type = pt_grav;
-				p->color = 67 + (rand()&3);
+				part.type[n] = pt_grav;
+				part.color[n] = 67 + (rand()&3);
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					part.org[j][n] = start[j] + ((rand()%6)-3);
 				break;
 
 			case 3:
 			case 5:	// tracer
-				p->die = cl.time + 0.5;
-				p->type = pt_static;
+				part.die[n] = cl.time + 0.5;
+				part.type[n] = pt_static;
 				if (type == 3)
-					p->color = 52 + ((tracercount&4)<<1);
+					part.color[n] = 52 + ((tracercount&4)<<1);
 				else
-					p->color = 230 + ((tracercount&4)<<1);
+					part.color[n] = 230 + ((tracercount&4)<<1);
 
 				tracercount++;
 
-				VectorCopy (start, p->org);
+				for (j=0 ; j<3 ; j++)
+					part.org[j][n] = start[j];
 				if (tracercount & 1)
 				{
-					p->vel[0] = 30*vec[1];
-					p->vel[1] = 30*-vec[0];
+					part.vel[0][n] = 30*vec[1];
+					part.vel[1][n] = 30*-vec[0];
 				}
 				else
 				{
-					p->vel[0] = 30*-vec[1];
-					p->vel[1] = 30*vec[0];
+					part.vel[0][n] = 30*-vec[1];
+					part.vel[1][n] = 30*vec[0];
 				}
 				break;
 
 			case 4:	// slight blood
-				p->type = pt_grav;
-				p->color = 67 + (rand()&3);
+				part.type[n] = pt_grav;
+				part.color[n] = 67 + (rand()&3);
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()%6)-3);
+					part.org[j][n] = start[j] + ((rand()%6)-3);
 				len -= 3;
 				break;
 
 			case 6:	// voor trail
-				p->color = 9*16 + 8 + (rand()&3);
-				p->type = pt_static;
-				p->die = cl.time + 0.3;
+				part.color[n] = 9*16 + 8 + (rand()&3);
+				part.type[n] = pt_static;
+				part.die[n] = cl.time + 0.3;
 				for (j=0 ; j<3 ; j++)
-					p->org[j] = start[j] + ((rand()&15)-8);
+					part.org[j][n] = start[j] + ((rand()&15)-8);
 				break;
 		}
 
@@ -715,227 +825,740 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 
 /*
 ===============
-CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
+R_MoveParticles
+
+Moves the first count particles and applies the drag and gravity of
+their type, four at a time where SIMD is available.
 ===============
 */
-void CL_RunParticles (void)
+static void R_MoveParticles (int count, float frametime, const float *dragxy, const float *dragz, const float *accel)
 {
-	particle_t		*p, *kill;
-	int				i;
-	float			time1, time2, time3, dvel, frametime, grav;
-	extern	cvar_t	sv_gravity;
-
-	frametime = cl.time - cl.oldtime;
-	time3 = frametime * 15;
-	time2 = frametime * 10;
-	time1 = frametime * 5;
-	grav = frametime * sv_gravity.value * 0.05;
-	dvel = 4*frametime;
+	float		*ox = part.org[0], *oy = part.org[1], *oz = part.org[2];
+	float		*vx = part.vel[0], *vy = part.vel[1], *vz = part.vel[2];
+	const byte	*type = part.type;
+	int			i, t;
 
-	for ( ;; )
+	i = 0;
+#if defined(USE_SSE2)
 	{
-		kill = active_particles;
-		if (kill && kill->die < cl.time)
+		__m128	ft = _mm_set1_ps (frametime);
+		__m128	x, y, z, sxy, sz, az;
+
+		for ( ; i + 4 <= count ; i += 4)
 		{
-			active_particles = kill->next;
-			kill->next = free_particles;
-			free_particles = kill;
-			continue;
+			sxy = _mm_set_ps (dragxy[type[i+3]], dragxy[type[i+2]], dragxy[type[i+1]], dragxy[type[i]]);
+			sz = _mm_set_ps (dragz[type[i+3]], dragz[type[i+2]], dragz[type[i+1]], dragz[type[i]]);
+			az = _mm_set_ps (accel[type[i+3]], accel[type[i+2]], accel[type[i+1]], accel[type[i]]);
+			x = _mm_loadu_ps (vx + i);
+			y = _mm_loadu_ps (vy + i);
+			z = _mm_loadu_ps (vz + i);
+			_mm_storeu_ps (ox + i, _mm_add_ps (_mm_loadu_ps (ox + i), _mm_mul_ps (x, ft)));
+			_mm_storeu_ps (oy + i, _mm_add_ps (_mm_loadu_ps (oy + i), _mm_mul_ps (y, ft)));
+			_mm_storeu_ps (oz + i, _mm_add_ps (_mm_loadu_ps (oz + i), _mm_mul_ps (z, ft)));
+			_mm_storeu_ps (vx + i, _mm_mul_ps (x, sxy));
+			_mm_storeu_ps (vy + i, _mm_mul_ps (y, sxy));
+			_mm_storeu_ps (vz + i, _mm_add_ps (_mm_mul_ps (z, sz), az));
 		}
-		break;
 	}
-
-	for (p=active_particles ; p ; p=p->next)
+#elif defined(USE_NEON)
 	{
-		for ( ;; )
+		float32x4_t	x, y, z, sxy, sz, az;
+		float		tmp[3][4];
+		int			j;
+
+		for ( ; i + 4 <= count ; i += 4)
 		{
-			kill = p->next;
-			if (kill && kill->die < cl.time)
+			for (j=0 ; j<4 ; j++)
 			{
-				p->next = kill->next;
-				kill->next = free_particles;
-				free_particles = kill;
-				continue;
+				t = type[i+j];
+				tmp[0][j] = dragxy[t];
+				tmp[1][j] = dragz[t];
+				tmp[2][j] = accel[t];
 			}
-			break;
+			sxy = vld1q_f32 (tmp[0]);
+			sz = vld1q_f32 (tmp[1]);
+			az = vld1q_f32 (tmp[2]);
+			x = vld1q_f32 (vx + i);
+			y = vld1q_f32 (vy + i);
+			z = vld1q_f32 (vz + i);
+			vst1q_f32 (ox + i, vaddq_f32 (vld1q_f32 (ox + i), vmulq_n_f32 (x, frametime)));
+			vst1q_f32 (oy + i, vaddq_f32 (vld1q_f32 (oy + i), vmulq_n_f32 (y, frametime)));
+			vst1q_f32 (oz + i, vaddq_f32 (vld1q_f32 (oz + i), vmulq_n_f32 (z, frametime)));
+			vst1q_f32 (vx + i, vmulq_f32 (x, sxy));
+			vst1q_f32 (vy + i, vmulq_f32 (y, sxy));
+			vst1q_f32 (vz + i, vaddq_f32 (vmulq_f32 (z, sz), az));
 		}
+	}
+#endif
 
-		p->org[0] += p->vel[0]*frametime;
-		p->org[1] += p->vel[1]*frametime;
-		p->org[2] += p->vel[2]*frametime;
-
-		switch (p->type)
-		{
-		case pt_static:
-			break;
-		case pt_fire:
-			p->ramp += time1;
-			if (p->ramp >= 6)
-				p->die = -1;
-			else
-				p->color = ramp3[(int)p->ramp];
-			p->vel[2] += grav;
-			break;
+	for ( ; i < count ; i++)
+	{
+		t = type[i];
+		ox[i] += vx[i]*frametime;
+		oy[i] += vy[i]*frametime;
+		oz[i] += vz[i]*frametime;
+		vx[i] *= dragxy[t];
+		vy[i] *= dragxy[t];
+		vz[i] = vz[i]*dragz[t] + accel[t];
+	}
+}
 
-		case pt_explode:
-			p->ramp += time2;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp1[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+/*
+===============
+CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
+===============
+*/
+void CL_RunParticles (void)
+{
+	static const int	*ramps[NUM_PTYPES] = {NULL, NULL, NULL, ramp3, ramp1, ramp2, NULL, NULL};
+	static const float	ramplimit[NUM_PTYPES] = {0, 0, 0, 6, 8, 8, 0, 0};
+	float			dragxy[NUM_PTYPES], dragz[NUM_PTYPES], accel[NUM_PTYPES], ramprate[NUM_PTYPES];
+	int				i, t;
+	float			dvel, frametime, grav;
+	extern	cvar_t	sv_gravity;
 
-		case pt_explode2:
-			p->ramp += time3;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp2[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] -= p->vel[i]*frametime;
-			p->vel[2] -= grav;
-			break;
+	if (R_GPUParticles ())
+	{
+		// nothing uploads them while particles aren't drawn
+		if (!r_particles.value)
+			part.numactive = 0;
+		return;
+	}
 
-		case pt_blob:
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+	frametime = cl.time - cl.oldtime;
+	grav = frametime * sv_gravity.value * 0.05;
+	dvel = 4*frametime;
 
-		case pt_blob2:
-			for (i=0 ; i<2 ; i++)
-				p->vel[i] -= p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+	for (i=0 ; i<part.numactive ; )
+	{
+		if (part.die[i] < cl.time)
+			R_KillParticle (i);
+		else
+			i++;
+	}
 
-		case pt_grav:
-		case pt_slowgrav:
-			p->vel[2] -= grav;
-			break;
-		}
+	// per type velocity scale and z acceleration
+	for (t=0 ; t<NUM_PTYPES ; t++)
+	{
+		dragxy[t] = dragz[t] = 1;
+		accel[t] = -grav;
+		ramprate[t] = 0;
+	}
+	accel[pt_static] = 0;
+	accel[pt_fire] = grav;
+	ramprate[pt_fire] = frametime * 5;
+	dragxy[pt_explode] = dragz[pt_explode] = 1 + dvel;
+	ramprate[pt_explode] = frametime * 10;
+	dragxy[pt_explode2] = dragz[pt_explode2] = 1 - frametime;
+	ramprate[pt_explode2] = frametime * 15;
+	dragxy[pt_blob] = dragz[pt_blob] = 1 + dvel;
+	dragxy[pt_blob2] = 1 - dvel;
+
+	R_MoveParticles (part.numactive, frametime, dragxy, dragz, accel);
+
+	for (i=0 ; i<part.numactive ; i++)
+	{
+		t = part.type[i];
+		if (!ramps[t])
+			continue;
+		part.ramp[i] += ramprate[t];
+		if (part.ramp[i] >= ramplimit[t])
+			part.die[i] = -1;
+		else
+			part.color[i] = ramps[t][(int)part.ramp[i]];
 	}
 }
 
 /*
 ===============
-R_DrawParticles -- johnfitz -- moved all non-drawing code to CL_RunParticles
+R_ParticleScale
+
+Size of a particle's triangle, or quad side when quads is set
 ===============
 */
-void R_DrawParticles (void)
+static float R_ParticleScale (int n, qboolean quads)
 {
-	particle_t		*p;
-	float			scale;
-	vec3_t			up, right, p_up, p_right, p_upright; //johnfitz -- p_ vectors
-	GLubyte			color[4], *c; //johnfitz -- particle transparency
-	extern	cvar_t	r_particles; //johnfitz
-	//float			alpha; //johnfitz -- particle transparency
+	float	scale;
+
+	// hack a scale up to keep particles from disapearing
+	scale = (part.org[0][n] - r_origin[0]) * vpn[0]
+		  + (part.org[1][n] - r_origin[1]) * vpn[1]
+		  + (part.org[2][n] - r_origin[2]) * vpn[2];
+	if (scale < 20)
+		scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
+	else
+		scale = 1 + scale * 0.004;
 
-	if (!r_particles.value)
+	if (quads)
+		scale /= 2.0; //quad is half the size of triangle
+
+	return scale * texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
+}
+
+/*
+=============
+GLParticles_CreateShaders
+
+The GLSL path draws every particle as an instance of one triangle or quad,
+sized in the vertex shader the same way R_ParticleScale does.
+
+The r_gpuparticles program also does the work of CL_RunParticles. Every
+particle type has constant drag and z acceleration, so its position is a
+closed form of the time since it spawned: a per frame velocity scale of
+1 + k*frametime becomes exp(k*t), and the ramps advance linearly.
+=============
+*/
+void GLParticles_CreateShaders (void)
+{
+	const glsl_attrib_binding_t bindings[] = {
+		{ "Corner", cornerAttrIndex },
+		{ "Origin", originAttrIndex },
+		{ "Color", colorAttrIndex }
+	};
+
+	const glsl_attrib_binding_t gpubindings[] = {
+		{ "Corner", cornerAttrIndex },
+		{ "Origin", originAttrIndex },
+		{ "Color", colorAttrIndex },
+		{ "Velocity", velocityAttrIndex },
+		{ "Life", lifeAttrIndex }
+	};
+
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec3 Up;\n"
+		"uniform vec3 Right;\n"
+		"uniform vec3 ViewOrigin;\n"
+		"uniform vec3 ViewForward;\n"
+		"uniform float Scale;\n"
+		"uniform float TexScale;\n"
+		"attribute vec2 Corner;\n"
+		"attribute vec3 Origin;\n"
+		"attribute vec4 Color;\n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	float dist = dot(Origin - ViewOrigin, ViewForward);\n"
+		"	float scale = (dist < 20.0 ? 1.08 : 1.0 + dist * 0.004) * Scale;\n"
+		"	vec3 pos = Origin + (Corner.x * Up + Corner.y * Right) * scale;\n"
+		"	gl_TexCoord[0] = vec4(Corner * TexScale, 0.0, 1.0);\n"
+		"	gl_FrontColor = Color;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * vec4(pos, 1.0);\n"
+		"	FogFragCoord = gl_Position.w;\n"
+		"}\n";
+
+	const GLchar *gpuVertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec3 Up;\n"
+		"uniform vec3 Right;\n"
+		"uniform vec3 ViewOrigin;\n"
+		"uniform vec3 ViewForward;\n"
+		"uniform float Scale;\n"
+		"uniform float TexScale;\n"
+		"uniform float Time;\n"
+		"uniform float Gravity;\n"
+		"uniform vec4 RampColors[22];\n"
+		"attribute vec2 Corner;\n"
+		"attribute vec3 Origin;\n"
+		"attribute vec4 Color;\n"
+		"attribute vec3 Velocity;\n"
+		"attribute vec4 Life;\n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	float t = Time - Life.x;\n"
+		"	int type = int(Life.w + 0.5);\n"
+		"	bool dead = t < 0.0 || Time > Life.y;\n"
+		"	vec4 color = Color;\n"
+		"	vec3 org = Origin + Velocity * t;\n"
+		"	float g = 0.5 * Gravity * t * t;\n"
+		"	float ramp;\n"
+		"	float s;\n"
+		"\n"
+		"	if (type == 1 || type == 2)\n" // pt_grav, pt_slowgrav
+		"		org.z -= g;\n"
+		"	else if (type == 3)\n" // pt_fire
+		"	{\n"
+		"		org.z += g;\n"
+		"		ramp = Life.z + 5.0 * t;\n"
+		"		dead = dead || ramp >= 6.0;\n"
+		"		color = RampColors[int(clamp(ramp, 0.0, 5.0))];\n"
+		"	}\n"
+		"	else if (type == 4 || type == 6)\n" // pt_explode, pt_blob
+		"	{\n"
+		"		s = (exp(4.0 * t) - 1.0) * 0.25;\n"
+		"		org = Origin + Velocity * s;\n"
+		"		org.z -= Gravity * 0.25 * (s - t);\n"
+		"		if (type == 4)\n"
+		"		{\n"
+		"			ramp = Life.z + 10.0 * t;\n"
+		"			dead = dead || ramp >= 8.0;\n"
+		"			color = RampColors[6 + int(clamp(ramp, 0.0, 7.0))];\n"
+		"		}\n"
+		"	}\n"
+		"	else if (type == 5)\n" // pt_explode2
+		"	{\n"
+		"		s = 1.0 - exp(-t);\n"
+		"		org = Origin + Velocity * s;\n"
+		"		org.z += Gravity * (s - t);\n"
+		"		ramp = Life.z + 15.0 * t;\n"
+		"		dead = dead || ramp >= 8.0;\n"
+		"		color = RampColors[14 + int(clamp(ramp, 0.0, 7.0))];\n"
+		"	}\n"
+		"	else if (type == 7)\n" // pt_blob2
+		"	{\n"
+		"		org.xy = Origin.xy + Velocity.xy * ((1.0 - exp(-4.0 * t)) * 0.25);\n"
+		"		org.z -= g;\n"
+		"	}\n"
+		"\n"
+		"	float dist = dot(org - ViewOrigin, ViewForward);\n"
+		"	float scale = (dist < 20.0 ? 1.08 : 1.0 + dist * 0.004) * Scale;\n"
+		"	if (dead)\n"
+		"		scale = 0.0;\n" // degenerate, nothing is rasterized
+		"	vec3 pos = org + (Corner.x * Up + Corner.y * Right) * scale;\n"
+		"	gl_TexCoord[0] = vec4(Corner * TexScale, 0.0, 1.0);\n"
+		"	gl_FrontColor = color;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * vec4(pos, 1.0);\n"
+		"	FogFragCoord = gl_Position.w;\n"
+		"}\n";
+
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Tex;\n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 result = texture2D(Tex, gl_TexCoord[0].xy) * gl_Color;\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * FogFragCoord * FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	result.rgb = mix(gl_Fog.color.rgb, result.rgb, fog);\n"
+		"	gl_FragColor = result;\n"
+		"}\n";
+
+	r_particle_program = 0;
+	r_gpuparticle_program = 0;
+
+	if (!gl_instanced_arrays_able)
 		return;
 
-	//ericw -- avoid empty glBegin(),glEnd() pair below; causes issues on AMD
-	if (!active_particles)
+	r_particle_program = GL_CreateProgram (vertSource, fragSource, sizeof(bindings)/sizeof(bindings[0]), bindings);
+
+	if (r_particle_program != 0)
+	{
+	// get uniform locations
+		upLoc = GL_GetUniformLocation (&r_particle_program, "Up");
+		rightLoc = GL_GetUniformLocation (&r_particle_program, "Right");
+		viewOriginLoc = GL_GetUniformLocation (&r_particle_program, "ViewOrigin");
+		viewForwardLoc = GL_GetUniformLocation (&r_particle_program, "ViewForward");
+		scaleLoc = GL_GetUniformLocation (&r_particle_program, "Scale");
+		texScaleLoc = GL_GetUniformLocation (&r_particle_program, "TexScale");
+		particleTexLoc = GL_GetUniformLocation (&r_particle_program, "Tex");
+	}
+
+	// the ring lives in its own buffer object
+	if (!gl_vbo_able)
 		return;
 
-	VectorScale (vup, 1.5, up);
-	VectorScale (vright, 1.5, right);
+	r_gpuparticle_program = GL_CreateProgram (gpuVertSource, fragSource, sizeof(gpubindings)/sizeof(gpubindings[0]), gpubindings);
 
-	GL_Bind(particletexture);
-	glEnable (GL_BLEND);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	glDepthMask (GL_FALSE); //johnfitz -- fix for particle z-buffer bug
+	if (r_gpuparticle_program != 0)
+	{
+	// get uniform locations
+		gpuUpLoc = GL_GetUniformLocation (&r_gpuparticle_program, "Up");
+		gpuRightLoc = GL_GetUniformLocation (&r_gpuparticle_program, "Right");
+		gpuViewOriginLoc = GL_GetUniformLocation (&r_gpuparticle_program, "ViewOrigin");
+		gpuViewForwardLoc = GL_GetUniformLocation (&r_gpuparticle_program, "ViewForward");
+		gpuScaleLoc = GL_GetUniformLocation (&r_gpuparticle_program, "Scale");
+		gpuTexScaleLoc = GL_GetUniformLocation (&r_gpuparticle_program, "TexScale");
+		gpuParticleTexLoc = GL_GetUniformLocation (&r_gpuparticle_program, "Tex");
+		gpuTimeLoc = GL_GetUniformLocation (&r_gpuparticle_program, "Time");
+		gpuGravityLoc = GL_GetUniformLocation (&r_gpuparticle_program, "Gravity");
+		gpuRampColorsLoc = GL_GetUniformLocation (&r_gpuparticle_program, "RampColors");
+	}
+}
+
+/*
+===============
+R_DrawParticles_GLSL
 
-	if (r_quadparticles.value) //johnitz -- quads save fillrate
+One instanced draw per MAX_PARTICLE_INSTANCES particles; only the origin
+and color of each particle are uploaded.
+===============
+*/
+static void R_DrawParticles_GLSL (vec3_t up, vec3_t right, qboolean quads)
+{
+	// fan order, the first three make up the triangle
+	static const float corners[4][2] = {{0, 1}, {0, 0}, {1, 0}, {1, 1}};
+	partinstance_t	*inst;
+	GLintptr		cornerofs, instofs;
+	int				first, count, i, n;
+	byte			*c;
+
+	GL_UseProgramFunc (r_particle_program);
+	GL_Uniform3fFunc (upLoc, up[0], up[1], up[2]);
+	GL_Uniform3fFunc (rightLoc, right[0], right[1], right[2]);
+	GL_Uniform3fFunc (viewOriginLoc, r_origin[0], r_origin[1], r_origin[2]);
+	GL_Uniform3fFunc (viewForwardLoc, vpn[0], vpn[1], vpn[2]);
+	GL_Uniform1fFunc (scaleLoc, quads ? texturescalefactor / 2.0 : texturescalefactor);
+	GL_Uniform1fFunc (texScaleLoc, quads ? 0.5 : 1.0);
+	GL_Uniform1iFunc (particleTexLoc, 0);
+
+	memcpy (GL_StreamAlloc (sizeof(corners)), corners, sizeof(corners));
+	cornerofs = GL_StreamCommit (sizeof(corners));
+
+	GL_EnableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_EnableVertexAttribArrayFunc (originAttrIndex);
+	GL_EnableVertexAttribArrayFunc (colorAttrIndex);
+	GL_VertexAttribDivisorFunc (originAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (colorAttrIndex, 1);
+
+	for (first=0 ; first<part.numactive ; first+=count)
 	{
-		glBegin (GL_QUADS);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
+		count = q_min (part.numactive - first, MAX_PARTICLE_INSTANCES);
 
-			scale /= 2.0; //quad is half the size of triangle
+		inst = (partinstance_t *) GL_StreamAlloc (count * sizeof(partinstance_t));
+		for (i=0, n=first ; i<count ; i++, n++)
+		{
+			inst[i].org[0] = part.org[0][n];
+			inst[i].org[1] = part.org[1][n];
+			inst[i].org[2] = part.org[2][n];
+			c = (byte *) &d_8to24table[part.color[n]];
+			inst[i].color[0] = c[0];
+			inst[i].color[1] = c[1];
+			inst[i].color[2] = c[2];
+			inst[i].color[3] = 255;
+		}
+		instofs = GL_StreamCommit (count * sizeof(partinstance_t));
 
-			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
+		// commits can move to another buffer segment, so point at both every time
+		GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+		GL_VertexAttribPointerFunc (cornerAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (const void *) cornerofs);
+		GL_VertexAttribPointerFunc (originAttrIndex, 3, GL_FLOAT, GL_FALSE, sizeof(partinstance_t), (const byte *) instofs + offsetof(partinstance_t, org));
+		GL_VertexAttribPointerFunc (colorAttrIndex, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(partinstance_t), (const byte *) instofs + offsetof(partinstance_t, color));
 
-			//johnfitz -- particle transparency and fade out
-			c = (GLubyte *) &d_8to24table[(int)p->color];
-			color[0] = c[0];
-			color[1] = c[1];
-			color[2] = c[2];
-			//alpha = CLAMP(0, p->die + 0.5 - cl.time, 1);
-			color[3] = 255; //(int)(alpha * 255);
-			glColor4ubv(color);
-			//johnfitz
+		GL_DrawArraysInstancedFunc (GL_TRIANGLE_FAN, 0, quads ? 4 : 3, count);
+	}
 
-			glTexCoord2f (0,0);
-			glVertex3fv (p->org);
+	GL_VertexAttribDivisorFunc (originAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (colorAttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_DisableVertexAttribArrayFunc (originAttrIndex);
+	GL_DisableVertexAttribArrayFunc (colorAttrIndex);
 
-			glTexCoord2f (0.5,0);
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+	GL_UseProgramFunc (0);
+}
 
-			glTexCoord2f (0.5,0.5);
-			VectorMA (p_up, scale, right, p_upright);
-			glVertex3fv (p_upright);
+/*
+===============
+R_UploadGPUParticles
 
-			glTexCoord2f (0,0.5);
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
+Appends the particles spawned since the last call to the ring and empties
+the CPU pool.
+===============
+*/
+static void R_UploadGPUParticles (void)
+{
+	gpuparticle_t	*p;
+	int				first, count, n;
+	byte			*c;
 
-			rs_particles++; //johnfitz //FIXME: just use r_numparticles
+	if (!gpu_particlebuffer)
+	{
+		// a frame's spawns can never wrap onto themselves
+		gpu_capacity = CLAMP (part.max, part.max * 8, ABSOLUTE_MAX_PARTICLES);
+		if (!gpu_staging)
+		{
+			gpu_staging = (gpuparticle_t *) malloc (part.max * sizeof(gpuparticle_t));
+			if (!gpu_staging)
+				Sys_Error ("R_UploadGPUParticles: out of memory");
 		}
-		glEnd ();
+		GL_GenBuffersFunc (1, &gpu_particlebuffer);
+		GL_BindBuffer (GL_ARRAY_BUFFER, gpu_particlebuffer);
+		GL_BufferDataFunc (GL_ARRAY_BUFFER, gpu_capacity * sizeof(gpuparticle_t), NULL, GL_DYNAMIC_DRAW);
+		gl_memory[GLMEM_PARTICLES] = gpu_capacity * sizeof(gpuparticle_t);
+		gpu_head = gpu_used = 0;
 	}
-	else //johnitz --  triangles save verts
+
+	// everything in the ring has died, start over from the front
+	if (gpu_used && cl.time > gpu_lastdie)
+		gpu_head = gpu_used = 0;
+
+	if (!part.numactive)
+		return;
+
+	if (!gpu_used)
+		gpu_timebase = gpu_lastdie = cl.time;
+
+	for (n=0, p=gpu_staging ; n<part.numactive ; n++, p++)
 	{
-		glBegin (GL_TRIANGLES);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
+		p->org[0] = part.org[0][n];
+		p->org[1] = part.org[1][n];
+		p->org[2] = part.org[2][n];
+		p->vel[0] = part.vel[0][n];
+		p->vel[1] = part.vel[1][n];
+		p->vel[2] = part.vel[2][n];
+		p->life[0] = cl.time - gpu_timebase;
+		p->life[1] = part.die[n] - gpu_timebase;
+		p->life[2] = part.ramp[n];
+		p->life[3] = part.type[n];
+		c = (byte *) &d_8to24table[part.color[n]];
+		p->color[0] = c[0];
+		p->color[1] = c[1];
+		p->color[2] = c[2];
+		p->color[3] = 255;
+		if (part.die[n] > gpu_lastdie)
+			gpu_lastdie = part.die[n];
+	}
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gpu_particlebuffer);
+	for (first=0 ; first<part.numactive ; first+=count)
+	{
+		count = q_min (part.numactive - first, gpu_capacity - gpu_head);
+		GL_BufferSubDataFunc (GL_ARRAY_BUFFER, gpu_head * sizeof(gpuparticle_t), count * sizeof(gpuparticle_t), gpu_staging + first);
+		gpu_head = (gpu_head + count) % gpu_capacity;
+	}
+	gpu_used = q_min (gpu_used + part.numactive, gpu_capacity);
+	part.numactive = 0;
+}
+
+/*
+===============
+R_DrawParticles_GPU
 
-			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
+One instanced draw of the whole ring, dead particles collapse to a point
+in the vertex shader.
+===============
+*/
+static void R_DrawParticles_GPU (vec3_t up, vec3_t right, qboolean quads)
+{
+	static const float corners[4][2] = {{0, 1}, {0, 0}, {1, 0}, {1, 1}};
+	float			rampcolors[NUM_RAMP_COLORS][4];
+	GLintptr		cornerofs;
+	int				i, index;
+	byte			*c;
+	extern	cvar_t	sv_gravity;
 
-			//johnfitz -- particle transparency and fade out
-			c = (GLubyte *) &d_8to24table[(int)p->color];
-			color[0] = c[0];
-			color[1] = c[1];
-			color[2] = c[2];
-			//alpha = CLAMP(0, p->die + 0.5 - cl.time, 1);
-			color[3] = 255; //(int)(alpha * 255);
-			glColor4ubv(color);
-			//johnfitz
+	for (i=0 ; i<NUM_RAMP_COLORS ; i++)
+	{
+		if (i < 6)
+			index = ramp3[i];
+		else if (i < 14)
+			index = ramp1[i - 6];
+		else
+			index = ramp2[i - 14];
+		c = (byte *) &d_8to24table[index];
+		rampcolors[i][0] = c[0] / 255.0;
+		rampcolors[i][1] = c[1] / 255.0;
+		rampcolors[i][2] = c[2] / 255.0;
+		rampcolors[i][3] = 1.0;
+	}
 
-			glTexCoord2f (0,0);
-			glVertex3fv (p->org);
+	GL_UseProgramFunc (r_gpuparticle_program);
+	GL_Uniform3fFunc (gpuUpLoc, up[0], up[1], up[2]);
+	GL_Uniform3fFunc (gpuRightLoc, right[0], right[1], right[2]);
+	GL_Uniform3fFunc (gpuViewOriginLoc, r_origin[0], r_origin[1], r_origin[2]);
+	GL_Uniform3fFunc (gpuViewForwardLoc, vpn[0], vpn[1], vpn[2]);
+	GL_Uniform1fFunc (gpuScaleLoc, quads ? texturescalefactor / 2.0 : texturescalefactor);
+	GL_Uniform1fFunc (gpuTexScaleLoc, quads ? 0.5 : 1.0);
+	GL_Uniform1iFunc (gpuParticleTexLoc, 0);
+	GL_Uniform1fFunc (gpuTimeLoc, cl.time - gpu_timebase);
+	GL_Uniform1fFunc (gpuGravityLoc, sv_gravity.value * 0.05);
+	GL_Uniform4fvFunc (gpuRampColorsLoc, NUM_RAMP_COLORS, &rampcolors[0][0]);
+
+	memcpy (GL_StreamAlloc (sizeof(corners)), corners, sizeof(corners));
+	cornerofs = GL_StreamCommit (sizeof(corners));
+
+	GL_EnableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_EnableVertexAttribArrayFunc (originAttrIndex);
+	GL_EnableVertexAttribArrayFunc (colorAttrIndex);
+	GL_EnableVertexAttribArrayFunc (velocityAttrIndex);
+	GL_EnableVertexAttribArrayFunc (lifeAttrIndex);
+	GL_VertexAttribDivisorFunc (originAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (colorAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (velocityAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (lifeAttrIndex, 1);
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+	GL_VertexAttribPointerFunc (cornerAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (const void *) cornerofs);
+	GL_BindBuffer (GL_ARRAY_BUFFER, gpu_particlebuffer);
+	GL_VertexAttribPointerFunc (originAttrIndex, 3, GL_FLOAT, GL_FALSE, sizeof(gpuparticle_t), (const void *) offsetof(gpuparticle_t, org));
+	GL_VertexAttribPointerFunc (colorAttrIndex, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(gpuparticle_t), (const void *) offsetof(gpuparticle_t, color));
+	GL_VertexAttribPointerFunc (velocityAttrIndex, 3, GL_FLOAT, GL_FALSE, sizeof(gpuparticle_t), (const void *) offsetof(gpuparticle_t, vel));
+	GL_VertexAttribPointerFunc (lifeAttrIndex, 4, GL_FLOAT, GL_FALSE, sizeof(gpuparticle_t), (const void *) offsetof(gpuparticle_t, life));
+
+	GL_DrawArraysInstancedFunc (GL_TRIANGLE_FAN, 0, quads ? 4 : 3, gpu_used);
+
+	GL_VertexAttribDivisorFunc (originAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (colorAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (velocityAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (lifeAttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (cornerAttrIndex);
+	GL_DisableVertexAttribArrayFunc (originAttrIndex);
+	GL_DisableVertexAttribArrayFunc (colorAttrIndex);
+	GL_DisableVertexAttribArrayFunc (velocityAttrIndex);
+	GL_DisableVertexAttribArrayFunc (lifeAttrIndex);
+
+	GL_UseProgramFunc (0);
+}
 
-			glTexCoord2f (1,0);
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+/*
+===============
+R_DeleteParticleBuffer
 
-			glTexCoord2f (0,1);
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
+The ring is recreated by the next R_UploadGPUParticles, whatever was in it
+is lost.
+===============
+*/
+void R_DeleteParticleBuffer (void)
+{
+	if (gpu_particlebuffer)
+	{
+		GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+		GL_DeleteBuffersFunc (1, &gpu_particlebuffer);
+		gpu_particlebuffer = 0;
+	}
+	gpu_head = gpu_used = 0;
+	gl_memory[GLMEM_PARTICLES] = 0;
+}
 
-			rs_particles++; //johnfitz //FIXME: just use r_numparticles
+/*
+===============
+R_DrawParticles_Arrays
+
+Fixed function path, builds the triangles or quads on the CPU.
+===============
+*/
+static void R_DrawParticles_Arrays (vec3_t up, vec3_t right, qboolean quads)
+{
+	float			scale;
+	vec3_t			org, p_up, p_right, p_upright; //johnfitz -- p_ vectors
+	GLubyte			color[4], *c; //johnfitz -- particle transparency
+	//float			alpha; //johnfitz -- particle transparency
+	streamvert_t	*v;
+	int				i, n, numverts, maxverts, pverts;
+	GLenum			mode;
+
+	mode = quads ? GL_QUADS : GL_TRIANGLES;
+	pverts = quads ? 4 : 3;
+
+	// streamed in batches of whole particles
+	maxverts = q_min(part.numactive * pverts, MAX_STREAM_VERTS - MAX_STREAM_VERTS % pverts);
+	v = GL_StreamVerts (maxverts);
+	numverts = 0;
+	for (n=0 ; n<part.numactive ; n++)
+	{
+		if (numverts == maxverts)
+		{
+			GL_DrawStreamVerts (mode, numverts, STREAM_TEXCOORDS | STREAM_COLORS);
+			v = GL_StreamVerts (maxverts);
+			numverts = 0;
 		}
-		glEnd ();
+
+		scale = R_ParticleScale (n, quads);
+
+		//johnfitz -- particle transparency and fade out
+		c = (GLubyte *) &d_8to24table[part.color[n]];
+		color[0] = c[0];
+		color[1] = c[1];
+		color[2] = c[2];
+		//alpha = CLAMP(0, part.die[n] + 0.5 - cl.time, 1);
+		color[3] = 255; //(int)(alpha * 255);
+		//johnfitz
+
+		org[0] = part.org[0][n];
+		org[1] = part.org[1][n];
+		org[2] = part.org[2][n];
+		VectorMA (org, scale, up, p_up);
+		VectorMA (org, scale, right, p_right);
+
+		VectorCopy (org, v[0].xyz);
+		v[0].st[0] = 0;
+		v[0].st[1] = 0;
+		if (quads)
+		{
+			VectorMA (p_up, scale, right, p_upright);
+			VectorCopy (p_up, v[1].xyz);
+			v[1].st[0] = 0.5;
+			v[1].st[1] = 0;
+			VectorCopy (p_upright, v[2].xyz);
+			v[2].st[0] = 0.5;
+			v[2].st[1] = 0.5;
+			VectorCopy (p_right, v[3].xyz);
+			v[3].st[0] = 0;
+			v[3].st[1] = 0.5;
+		}
+		else
+		{
+			VectorCopy (p_up, v[1].xyz);
+			v[1].st[0] = 1;
+			v[1].st[1] = 0;
+			VectorCopy (p_right, v[2].xyz);
+			v[2].st[0] = 0;
+			v[2].st[1] = 1;
+		}
+		for (i = 0 ; i < pverts ; i++, v++)
+			memcpy (v->color, color, 4);
+		numverts += pverts;
 	}
+	GL_DrawStreamVerts (mode, numverts, STREAM_TEXCOORDS | STREAM_COLORS);
+}
+
+/*
+===============
+R_DrawParticles -- johnfitz -- moved all non-drawing code to CL_RunParticles
+===============
+*/
+void R_DrawParticles (void)
+{
+	vec3_t			up, right;
+	extern	cvar_t	r_particles; //johnfitz
+	qboolean		quads, gpu;
+	int				count;
+
+	if (!r_particles.value)
+		return;
+
+	gpu = R_GPUParticles ();
+	if (gpu)
+	{
+		R_UploadGPUParticles ();
+		count = gpu_used;
+	}
+	else
+	{
+		gpu_head = gpu_used = 0;
+		count = part.numactive;
+	}
+
+	//ericw -- avoid empty glBegin(),glEnd() pair below; causes issues on AMD
+	if (!count)
+		return;
+
+	VectorScale (vup, 1.5, up);
+	VectorScale (vright, 1.5, right);
+
+	GL_Bind(particletexture);
+	glEnable (GL_BLEND);
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	glDepthMask (GL_FALSE); //johnfitz -- fix for particle z-buffer bug
+
+	quads = r_quadparticles.value != 0; //johnitz -- quads save fillrate, triangles save verts
+	if (gpu)
+		R_DrawParticles_GPU (up, right, quads);
+	else if (r_particle_program)
+		R_DrawParticles_GLSL (up, right, quads);
+	else
+		R_DrawParticles_Arrays (up, right, quads);
+	rs_particles += count; //johnfitz
 
 	glDepthMask (GL_TRUE); //johnfitz -- fix for particle z-buffer bug
 	glDisable (GL_BLEND);
@@ -951,10 +1574,10 @@ R_DrawParticles_ShowTris -- johnfitz
 */
 void R_DrawParticles_ShowTris (void)
 {
-	particle_t		*p;
 	float			scale;
-	vec3_t			up, right, p_up, p_right, p_upright;
+	vec3_t			up, right, org, p_up, p_right, p_upright;
 	extern	cvar_t	r_particles;
+	int				n;
 
 	if (!r_particles.value)
 		return;
@@ -964,32 +1587,24 @@ void R_DrawParticles_ShowTris (void)
 
 	if (r_quadparticles.value)
 	{
-		for (p=active_particles ; p ; p=p->next)
+		for (n=0 ; n<part.numactive ; n++)
 		{
 			glBegin (GL_TRIANGLE_FAN);
 
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
-
-			scale /= 2.0; //quad is half the size of triangle
-
-			scale *= texturescalefactor; //compensate for apparent size of different particle textures
+			scale = R_ParticleScale (n, true);
+			org[0] = part.org[0][n];
+			org[1] = part.org[1][n];
+			org[2] = part.org[2][n];
 
-			glVertex3fv (p->org);
+			glVertex3fv (org);
 
-			VectorMA (p->org, scale, up, p_up);
+			VectorMA (org, scale, up, p_up);
 			glVertex3fv (p_up);
 
 			VectorMA (p_up, scale, right, p_upright);
 			glVertex3fv (p_upright);
 
-			VectorMA (p->org, scale, right, p_right);
+			VectorMA (org, scale, right, p_right);
 			glVertex3fv (p_right);
 
 			glEnd ();
@@ -998,28 +1613,21 @@ void R_DrawParticles_ShowTris (void)
 	else
 	{
 		glBegin (GL_TRIANGLES);
-		for (p=active_particles ; p ; p=p->next)
+		for (n=0 ; n<part.numactive ; n++)
 		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
-
-			scale *= texturescalefactor; //compensate for apparent size of different particle textures
+			scale = R_ParticleScale (n, false);
+			org[0] = part.org[0][n];
+			org[1] = part.org[1][n];
+			org[2] = part.org[2][n];
 
-			glVertex3fv (p->org);
+			glVertex3fv (org);
 
-			VectorMA (p->org, scale, up, p_up);
+			VectorMA (org, scale, up, p_up);
 			glVertex3fv (p_up);
 
-			VectorMA (p->org, scale, right, p_right);
+			VectorMA (org, scale, right, p_right);
 			glVertex3fv (p_right);
 		}
 		glEnd ();
 	}
 }
-
@@ -76,22 +76,18 @@ mspriteframe_t *R_GetSpriteFrame (entity_t *currentent)
 
 /*
 =================
-R_DrawSpriteModel -- johnfitz -- rewritten: now supports all orientations
+R_SetupSpriteQuad
+
+Fills in the corners of the sprite's quad, in the order down left, up left, up right, down right.
+Returns false for unknown sprite types.
 =================
 */
-void R_DrawSpriteModel (entity_t *e)
+static qboolean R_SetupSpriteQuad (entity_t *e, msprite_t *psprite, mspriteframe_t *frame, vec3_t corners[4])
 {
 	vec3_t			point, v_forward, v_right, v_up;
-	msprite_t		*psprite;
-	mspriteframe_t	*frame;
 	float			*s_up, *s_right;
 	float			angle, sr, cr;
 
-	//TODO: frustum cull it?
-
-	frame = R_GetSpriteFrame (e);
-	psprite = (msprite_t *) currententity->model->cache.data;
-
 	switch(psprite->type)
 	{
 	case SPR_VP_PARALLEL_UPRIGHT: //faces view plane, up is towards the heavens
@@ -102,7 +98,7 @@ void R_DrawSpriteModel (entity_t *e)
 		s_right = vright;
 		break;
 	case SPR_FACING_UPRIGHT: //faces camera origin, up is towards the heavens
-		VectorSubtract(currententity->origin, r_origin, v_forward);
+		VectorSubtract(e->origin, r_origin, v_forward);
 		v_forward[2] = 0;
 		VectorNormalizeFast(v_forward);
 		v_right[0] = v_forward[1];
@@ -119,12 +115,12 @@ void R_DrawSpriteModel (entity_t *e)
 		s_right = vright;
 		break;
 	case SPR_ORIENTED: //pitch yaw roll are independent of camera
-		AngleVectors (currententity->angles, v_forward, v_right, v_up);
+		AngleVectors (e->angles, v_forward, v_right, v_up);
 		s_up = v_up;
 		s_right = v_right;
 		break;
 	case SPR_VP_PARALLEL_ORIENTED: //faces view plane, but obeys roll value
-		angle = currententity->angles[ROLL] * M_PI_DIV_180;
+		angle = e->angles[ROLL] * M_PI_DIV_180;
 		sr = sin(angle);
 		cr = cos(angle);
 		v_right[0] = vright[0] * cr + vup[0] * sr;
@@ -137,9 +133,40 @@ void R_DrawSpriteModel (entity_t *e)
 		s_right = v_right;
 		break;
 	default:
-		return;
+		return false;
 	}
 
+	VectorMA (e->origin, frame->down, s_up, point);
+	VectorMA (point, frame->left, s_right, corners[0]);
+	VectorMA (e->origin, frame->up, s_up, point);
+	VectorMA (point, frame->left, s_right, corners[1]);
+	VectorMA (e->origin, frame->up, s_up, point);
+	VectorMA (point, frame->right, s_right, corners[2]);
+	VectorMA (e->origin, frame->down, s_up, point);
+	VectorMA (point, frame->right, s_right, corners[3]);
+
+	return true;
+}
+
+/*
+=================
+R_DrawSpriteModel -- johnfitz -- rewritten: now supports all orientations
+=================
+*/
+void R_DrawSpriteModel (entity_t *e)
+{
+	vec3_t			corners[4];
+	msprite_t		*psprite;
+	mspriteframe_t	*frame;
+
+	//TODO: frustum cull it?
+
+	frame = R_GetSpriteFrame (e);
+	psprite = (msprite_t *) e->model->cache.data;
+
+	if (!R_SetupSpriteQuad (e, psprite, frame, corners))
+		return;
+
 	//johnfitz: offset decals
 	if (psprite->type == SPR_ORIENTED)
 		GL_PolygonOffset (OFFSET_DECAL);
@@ -154,24 +181,16 @@ void R_DrawSpriteModel (entity_t *e)
 	glBegin (GL_TRIANGLE_FAN); //was GL_QUADS, but changed to support r_showtris
 
 	glTexCoord2f (0, frame->tmax);
-	VectorMA (e->origin, frame->down, s_up, point);
-	VectorMA (point, frame->left, s_right, point);
-	glVertex3fv (point);
+	glVertex3fv (corners[0]);
 
 	glTexCoord2f (0, 0);
-	VectorMA (e->origin, frame->up, s_up, point);
-	VectorMA (point, frame->left, s_right, point);
-	glVertex3fv (point);
+	glVertex3fv (corners[1]);
 
 	glTexCoord2f (frame->smax, 0);
-	VectorMA (e->origin, frame->up, s_up, point);
-	VectorMA (point, frame->right, s_right, point);
-	glVertex3fv (point);
+	glVertex3fv (corners[2]);
 
 	glTexCoord2f (frame->smax, frame->tmax);
-	VectorMA (e->origin, frame->down, s_up, point);
-	VectorMA (point, frame->right, s_right, point);
-	glVertex3fv (point);
+	glVertex3fv (corners[3]);
 
 	glEnd ();
 	glDisable (GL_ALPHA_TEST);
@@ -180,3 +199,142 @@ void R_DrawSpriteModel (entity_t *e)
 	if (psprite->type == SPR_ORIENTED)
 		GL_PolygonOffset (OFFSET_NONE);
 }
+
+/*
+=============================================================================
+
+SPRITE BATCHES
+
+Opaque sprites are queued by R_BatchSpriteModel while the entity list is
+walked, and R_FlushSpriteBatches draws them sorted by frame texture, one
+streaming buffer draw per texture. Oriented sprites are decals and keep
+their polygon offset, so they are batched separately.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	gltexture_t		*gltexture;
+	qboolean		decal;
+	float			smax, tmax;
+	vec3_t			corners[4];
+} spritebatch_t;
+
+static spritebatch_t	r_spritebatches[MAX_VISEDICTS];
+static spritebatch_t	*r_spritebatch_order[MAX_VISEDICTS];
+static int				r_numspritebatches;
+
+/*
+=================
+R_BatchSpriteModel
+
+Queues an opaque sprite for R_FlushSpriteBatches
+=================
+*/
+void R_BatchSpriteModel (entity_t *e)
+{
+	msprite_t		*psprite;
+	mspriteframe_t	*frame;
+	spritebatch_t	*sb;
+
+	if (r_numspritebatches == MAX_VISEDICTS)
+	{
+		R_DrawSpriteModel (e);
+		return;
+	}
+
+	frame = R_GetSpriteFrame (e);
+	psprite = (msprite_t *) e->model->cache.data;
+
+	sb = &r_spritebatches[r_numspritebatches];
+	if (!R_SetupSpriteQuad (e, psprite, frame, sb->corners))
+		return;
+
+	sb->gltexture = frame->gltexture;
+	sb->decal = (psprite->type == SPR_ORIENTED);
+	sb->smax = frame->smax;
+	sb->tmax = frame->tmax;
+	r_spritebatch_order[r_numspritebatches++] = sb;
+}
+
+static int R_CompareSpriteBatches (const void *a, const void *b)
+{
+	const spritebatch_t *sa = *(const spritebatch_t **) a;
+	const spritebatch_t *sb = *(const spritebatch_t **) b;
+
+	if (sa->decal != sb->decal)
+		return sa->decal - sb->decal;
+	if (sa->gltexture != sb->gltexture)
+		return (uintptr_t) sa->gltexture < (uintptr_t) sb->gltexture ? -1 : 1;
+	return 0;
+}
+
+static void R_SpriteVert (streamvert_t *v, const float *xyz, float s, float t)
+{
+	VectorCopy (xyz, v->xyz);
+	v->st[0] = s;
+	v->st[1] = t;
+}
+
+/*
+=================
+R_FlushSpriteBatches
+
+Draws and clears the queue of R_BatchSpriteModel.
+=================
+*/
+void R_FlushSpriteBatches (void)
+{
+	const int		maxsprites = MAX_STREAM_VERTS / 4;
+	spritebatch_t	*sb;
+	streamvert_t	*v;
+	qboolean		decal;
+	int				i, j, count;
+
+	if (!r_numspritebatches)
+		return;
+
+	qsort (r_spritebatch_order, r_numspritebatches, sizeof(r_spritebatch_order[0]), R_CompareSpriteBatches);
+
+	glColor3f (1,1,1);
+	GL_DisableMultitexture();
+	glEnable (GL_ALPHA_TEST);
+
+	decal = false;
+	for (i = 0; i < r_numspritebatches; i += count)
+	{
+		sb = r_spritebatch_order[i];
+		for (count = 1; i + count < r_numspritebatches && count < maxsprites; count++)
+		{
+			if (r_spritebatch_order[i + count]->gltexture != sb->gltexture || r_spritebatch_order[i + count]->decal != sb->decal)
+				break;
+		}
+
+		//johnfitz: offset decals
+		if (sb->decal != decal)
+		{
+			decal = sb->decal;
+			GL_PolygonOffset (decal ? OFFSET_DECAL : OFFSET_NONE);
+		}
+
+		GL_Bind (sb->gltexture);
+
+		v = GL_StreamVerts (count * 4);
+		for (j = 0; j < count; j++, v += 4)
+		{
+			sb = r_spritebatch_order[i + j];
+			R_SpriteVert (&v[0], sb->corners[0], 0, sb->tmax);
+			R_SpriteVert (&v[1], sb->corners[1], 0, 0);
+			R_SpriteVert (&v[2], sb->corners[2], sb->smax, 0);
+			R_SpriteVert (&v[3], sb->corners[3], sb->smax, sb->tmax);
+		}
+		GL_DrawStreamVerts (GL_QUADS, count * 4, STREAM_TEXCOORDS);
+	}
+
+	if (decal)
+		GL_PolygonOffset (OFFSET_NONE);
+	glDisable (GL_ALPHA_TEST);
+
+	r_numspritebatches = 0;
+}
@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 
 extern cvar_t gl_fullbrights, r_drawflat, gl_overbright, r_oldwater, r_oldskyleaf, r_showtris; //johnfitz
+extern cvar_t r_gpulighting, r_dynamic, gl_flashblend, r_prepass;
 
 byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel);
 
@@ -87,23 +88,460 @@ qboolean R_BackFaceCull (msurface_t *surf)
 	return false;
 }
 
+#define	MAX_MARK_JOBS	16
+
+// the leafs and surfaces the view leaf's PVS can reach. their bounds are
+// kept as separate mins x, y, z and maxs x, y, z arrays for R_CullBoxes
+typedef struct
+{
+	mleaf_t		*leaf;
+	int			leafnum;				// vis bit, leafs[1 + leafnum] == leaf
+	int			firstsurf, numsurfs;	// in r_pvscache.surfs
+} markleaf_t;
+
+typedef enum
+{
+	PVS_NOVIS,
+	PVS_LEAF,
+	PVS_FAT		// depends on the view origin, so never reused
+} pvsmode_t;
+
+static struct
+{
+	qboolean	valid;
+	mleaf_t		*viewleaf;
+	pvsmode_t	mode;
+	qboolean	oldskyleaf;
+	markleaf_t	*leafs;
+	float		*leafbounds[6];
+	int			numleafs;
+	msurface_t	**surfs;
+	float		*surfbounds[6];
+	int			numsurfs;
+} r_pvscache;
+
+typedef struct
+{
+	int			firstleaf, lastleaf;	// in r_pvscache.leafs
+	msurface_t	**surfs;				// surfaces that passed the culling, may repeat
+	int			numsurfs;
+	mleaf_t		**efragleafs;			// visible leafs with static entities
+	int			numefragleafs;
+	int			*queryleafs;			// leafs in the frustum, in r_pvscache.leafs
+	int			numqueryleafs;
+	int			numoccluded;
+} markjob_t;
+
+// per-level buffers the jobs fill in, see R_InitMarkSurfaces
+static msurface_t	**r_marksurfs;
+static mleaf_t		**r_markleafs;
+static byte			*r_leafculled, *r_surfculled;	// R_CullBoxes results
+
+// occlusion queries, see R_IssueOcclusionQueries
+static int			*r_leafoccludedframe;	// by leafnum, r_framecount when the leaf was hidden
+static int			*r_queryleafs;			// this frame's candidates, in r_pvscache.leafs
+static int			r_numqueryleafs;
+static qboolean		r_occlusion_active;
+
+/*
+===============================================================================
+
+OCCLUSION QUERIES
+
+With r_occlusion set, the bounding box of every PVS leaf in the frustum and
+of the larger brush entities is drawn against the opaque depth buffer once
+per frame, without writing color or depth. The results are only read back
+on the next frame, and only if the GPU has them by then, so nothing ever
+waits on a query. A leaf or entity whose query passed no samples is skipped
+for that frame, and queried again so it shows up once it comes into view.
+
+===============================================================================
+*/
+
+#define	MAX_OCCLUSION_QUERIES		4096
+#define	OCCLUSION_BOX_EPSILON		2	// grow the boxes so their faces don't z-fight
+#define	OCCLUSION_MIN_ENTITY_SIZE	256	// smaller brush entities aren't worth a query
+
+typedef struct
+{
+	int			leafnum;	// -1 for entities
+	entity_t	*ent;
+	vec3_t		mins, maxs;
+} occlusionquery_t;
+
+static GLuint			r_occlusionqueries[MAX_OCCLUSION_QUERIES];
+static occlusionquery_t	r_occlusioninfo[MAX_OCCLUSION_QUERIES];
+static int				r_numocclusionqueries;
+static int				r_occlusionframe;
+
+/*
+===============
+R_ResetOcclusionQueries
+
+Drops the outstanding results, they refer to the previous map.
+===============
+*/
+static void R_ResetOcclusionQueries (void)
+{
+	r_numocclusionqueries = 0;
+}
+
+/*
+===============
+R_DeleteOcclusionQueries -- called from VID_Restart
+===============
+*/
+void R_DeleteOcclusionQueries (void)
+{
+	if (r_occlusionqueries[0])
+		GL_DeleteQueriesFunc (MAX_OCCLUSION_QUERIES, r_occlusionqueries);
+	memset (r_occlusionqueries, 0, sizeof(r_occlusionqueries));
+	r_numocclusionqueries = 0;
+}
+
+/*
+===============
+R_ReadOcclusionQueries
+
+Collects last frame's results that are ready, marking what was hidden.
+===============
+*/
+static void R_ReadOcclusionQueries (void)
+{
+	occlusionquery_t	*info;
+	GLuint	available, samples;
+	int		i;
+
+	for (i = 0, info = r_occlusioninfo; i < r_numocclusionqueries; i++, info++)
+	{
+		GL_GetQueryObjectuivFunc (r_occlusionqueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+		GL_GetQueryObjectuivFunc (r_occlusionqueries[i], GL_QUERY_RESULT, &samples);
+		if (samples)
+			continue;
+
+		if (info->leafnum >= 0)
+			r_leafoccludedframe[info->leafnum] = r_framecount;
+		else
+		{
+			info->ent->occludedframe = r_framecount;
+			rs_occludedents++;
+		}
+	}
+	r_numocclusionqueries = 0;
+}
+
+/*
+===============
+R_EmitOcclusionBox
+
+36 vertices for the triangles of the box, grown by OCCLUSION_BOX_EPSILON.
+===============
+*/
+static void R_EmitOcclusionBox (float *out, const vec3_t mins, const vec3_t maxs)
+{
+	static const byte faces[6][4] = {
+		{0, 2, 6, 4}, {1, 5, 7, 3},	// x
+		{0, 4, 5, 1}, {2, 3, 7, 6},	// y
+		{0, 1, 3, 2}, {4, 6, 7, 5}	// z
+	};
+	static const byte tris[6] = {0, 1, 2, 0, 2, 3};
+	vec3_t	corners[8];
+	int		i, j;
+
+	for (i = 0; i < 8; i++)
+	{
+		corners[i][0] = (i & 1) ? maxs[0] + OCCLUSION_BOX_EPSILON : mins[0] - OCCLUSION_BOX_EPSILON;
+		corners[i][1] = (i & 2) ? maxs[1] + OCCLUSION_BOX_EPSILON : mins[1] - OCCLUSION_BOX_EPSILON;
+		corners[i][2] = (i & 4) ? maxs[2] + OCCLUSION_BOX_EPSILON : mins[2] - OCCLUSION_BOX_EPSILON;
+	}
+
+	for (i = 0; i < 6; i++)
+		for (j = 0; j < 6; j++, out += 3)
+			VectorCopy (corners[faces[i][tris[j]]], out);
+}
+
+/*
+===============
+R_AddOcclusionQuery
+
+Boxes the camera is in or right next to are never hidden, so they are
+not queried.
+===============
+*/
+static void R_AddOcclusionQuery (const vec3_t mins, const vec3_t maxs, int leafnum, entity_t *ent)
+{
+	occlusionquery_t	*info;
+	int		i;
+
+	if (r_numocclusionqueries == MAX_OCCLUSION_QUERIES)
+		return;
+
+	for (i = 0; i < 3; i++)
+	{
+		if (r_origin[i] < mins[i] - 8 - OCCLUSION_BOX_EPSILON || r_origin[i] > maxs[i] + 8 + OCCLUSION_BOX_EPSILON)
+			break;
+	}
+	if (i == 3)
+		return;
+
+	info = &r_occlusioninfo[r_numocclusionqueries++];
+	info->leafnum = leafnum;
+	info->ent = ent;
+	VectorCopy (mins, info->mins);
+	VectorCopy (maxs, info->maxs);
+}
+
+/*
+===============
+R_IssueOcclusionQueries -- called after the opaque entities are drawn
+===============
+*/
+void R_IssueOcclusionQueries (void)
+{
+	float		*verts;
+	const byte	*base;
+	entity_t	*e;
+	markleaf_t	*ml;
+	vec3_t		mins, maxs;
+	int			i, k, first, count;
+
+	if (!r_occlusion_active || r_occlusionframe == r_framecount)
+		return;	// not on, or the second eye of r_stereo
+	r_occlusionframe = r_framecount;
+
+	if (!r_occlusionqueries[0])
+		GL_GenQueriesFunc (MAX_OCCLUSION_QUERIES, r_occlusionqueries);
+
+	// pick the boxes
+	r_numocclusionqueries = 0;
+	for (i = 0; i < r_numqueryleafs; i++)
+	{
+		ml = &r_pvscache.leafs[r_queryleafs[i]];
+		for (k = 0; k < 3; k++)
+		{
+			mins[k] = r_pvscache.leafbounds[k][r_queryleafs[i]];
+			maxs[k] = r_pvscache.leafbounds[3 + k][r_queryleafs[i]];
+		}
+		R_AddOcclusionQuery (mins, maxs, ml->leafnum, NULL);
+	}
+	for (i = 0; i < cl_numvisedicts; i++)
+	{
+		e = cl_visedicts[i];
+		if (e->model->type != mod_brush || e->model->name[0] != '*' || R_CullModelForEntity (e))
+			continue;
+		R_EntityBounds (e, mins, maxs);
+		if (maxs[0] - mins[0] < OCCLUSION_MIN_ENTITY_SIZE && maxs[1] - mins[1] < OCCLUSION_MIN_ENTITY_SIZE &&
+			maxs[2] - mins[2] < OCCLUSION_MIN_ENTITY_SIZE)
+			continue;
+		R_AddOcclusionQuery (mins, maxs, -1, e);
+	}
+	if (!r_numocclusionqueries)
+		return;
+
+	GL_DisableMultitexture ();
+	glDisable (GL_TEXTURE_2D);
+	glDisable (GL_CULL_FACE);
+	glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask (GL_FALSE);
+	glEnableClientState (GL_VERTEX_ARRAY);
+
+	for (first = 0; first < r_numocclusionqueries; first += count)
+	{
+		count = q_min(r_numocclusionqueries - first, MAX_STREAM_ALLOC / (36 * 3 * (int)sizeof(float)));
+		verts = (float *) GL_StreamAlloc (count * 36 * 3 * sizeof(float));
+		for (i = 0; i < count; i++)
+			R_EmitOcclusionBox (verts + i * 36 * 3, r_occlusioninfo[first + i].mins, r_occlusioninfo[first + i].maxs);
+		base = (const byte *) GL_StreamCommit (count * 36 * 3 * sizeof(float));
+
+		GL_BindBuffer (GL_ARRAY_BUFFER, gl_streambuffer);
+		glVertexPointer (3, GL_FLOAT, 0, base);
+		for (i = 0; i < count; i++)
+		{
+			GL_BeginQueryFunc (GL_SAMPLES_PASSED, r_occlusionqueries[first + i]);
+			glDrawArrays (GL_TRIANGLES, i * 36, 36);
+			GL_EndQueryFunc (GL_SAMPLES_PASSED);
+		}
+	}
+
+	glDisableClientState (GL_VERTEX_ARRAY);
+	GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+	glDepthMask (GL_TRUE);
+	glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	if (gl_cull.value)
+		glEnable (GL_CULL_FACE);
+	glEnable (GL_TEXTURE_2D);
+}
+
+/*
+===============
+R_InitMarkSurfaces
+
+Called from R_NewMap, the buffers live on the level's hunk.
+===============
+*/
+void R_InitMarkSurfaces (void)
+{
+	int		i, numleafs = cl.worldmodel->numleafs;
+	int		nummarks;
+	mleaf_t	*leaf;
+
+	for (i = 0, nummarks = 0, leaf = &cl.worldmodel->leafs[1]; i < numleafs; i++, leaf++)
+		nummarks += leaf->nummarksurfaces;
+	nummarks = q_max(nummarks, 1);
+	numleafs = q_max(numleafs, 1);
+
+	memset (&r_pvscache, 0, sizeof(r_pvscache));
+	r_pvscache.leafs = (markleaf_t *) Hunk_AllocName (numleafs * sizeof(markleaf_t), "pvscache");
+	r_pvscache.surfs = (msurface_t **) Hunk_AllocName (nummarks * sizeof(msurface_t *), "pvscache");
+	for (i = 0; i < 6; i++)
+	{
+		r_pvscache.leafbounds[i] = (float *) Hunk_AllocName (numleafs * sizeof(float), "pvscache");
+		r_pvscache.surfbounds[i] = (float *) Hunk_AllocName (nummarks * sizeof(float), "pvscache");
+	}
+
+	r_marksurfs = (msurface_t **) Hunk_AllocName (nummarks * sizeof(msurface_t *), "marksurfs");
+	r_markleafs = (mleaf_t **) Hunk_AllocName (numleafs * sizeof(mleaf_t *), "marksurfs");
+	r_leafculled = (byte *) Hunk_AllocName (numleafs, "marksurfs");
+	r_surfculled = (byte *) Hunk_AllocName (nummarks, "marksurfs");
+	r_leafoccludedframe = (int *) Hunk_AllocName (numleafs * sizeof(int), "marksurfs");
+	r_queryleafs = (int *) Hunk_AllocName (numleafs * sizeof(int), "marksurfs");
+	r_numqueryleafs = 0;
+	R_ResetOcclusionQueries ();
+
+	rs_pvshits = rs_pvsmisses = 0;
+	rs_pvsbytes = numleafs * (sizeof(markleaf_t) + 6 * sizeof(float)) + nummarks * (sizeof(msurface_t *) + 6 * sizeof(float));
+}
+
+/*
+===============
+R_BuildPVSCache
+
+Gathers the leafs the PVS reaches and their surfaces.
+===============
+*/
+static void R_BuildPVSCache (byte *vis)
+{
+	markleaf_t	*ml;
+	mleaf_t		*leaf;
+	msurface_t	**mark;
+	int			i, j, k, n;
+
+	r_pvscache.numleafs = r_pvscache.numsurfs = 0;
+
+	leaf = &cl.worldmodel->leafs[1];
+	for (i=0 ; i<cl.worldmodel->numleafs ; i++, leaf++)
+	{
+		if (!(vis[i>>3] & (1<<(i&7))))
+			continue;
+
+		n = r_pvscache.numleafs++;
+		for (k = 0; k < 6; k++)
+			r_pvscache.leafbounds[k][n] = leaf->minmaxs[k];
+		ml = &r_pvscache.leafs[n];
+		ml->leaf = leaf;
+		ml->leafnum = i;
+		ml->firstsurf = r_pvscache.numsurfs;
+		ml->numsurfs = 0;
+
+		if (r_oldskyleaf.value || leaf->contents != CONTENTS_SKY)
+			for (j=0, mark = leaf->firstmarksurface; j<leaf->nummarksurfaces; j++, mark++)
+			{
+				n = r_pvscache.numsurfs++;
+				for (k = 0; k < 3; k++)
+				{
+					r_pvscache.surfbounds[k][n] = (*mark)->mins[k];
+					r_pvscache.surfbounds[3 + k][n] = (*mark)->maxs[k];
+				}
+				r_pvscache.surfs[n] = *mark;
+				ml->numsurfs++;
+			}
+	}
+}
+
+/*
+===============
+R_MarkLeafs
+
+Culls a range of the cached leafs and their surfaces. Runs on a task
+worker, so it only reads the shared state; R_MarkSurfaces chains the
+results.
+===============
+*/
+static void R_MarkLeafs (void *data)
+{
+	markjob_t	*job = (markjob_t *) data;
+	markleaf_t	*ml;
+	float		*bounds[6];
+	int			i, j, k;
+
+	job->numsurfs = job->numefragleafs = job->numqueryleafs = job->numoccluded = 0;
+
+	for (k = 0; k < 6; k++)
+		bounds[k] = r_pvscache.leafbounds[k] + job->firstleaf;
+	R_CullBoxes (bounds, job->lastleaf - job->firstleaf, r_leafculled + job->firstleaf);
+
+	ml = &r_pvscache.leafs[job->firstleaf];
+	for (i = job->firstleaf ; i < job->lastleaf ; i++, ml++)
+	{
+		if (r_leafculled[i])
+			continue;
+
+		if (r_occlusion_active)
+		{ // queried again even when hidden, to find out when it shows up
+			job->queryleafs[job->numqueryleafs++] = i;
+			if (r_leafoccludedframe[ml->leafnum] == r_framecount)
+			{
+				job->numoccluded++;
+				continue;
+			}
+		}
+
+		for (k = 0; k < 6; k++)
+			bounds[k] = r_pvscache.surfbounds[k] + ml->firstsurf;
+		R_CullBoxes (bounds, ml->numsurfs, r_surfculled + ml->firstsurf);
+
+		for (j = ml->firstsurf; j < ml->firstsurf + ml->numsurfs; j++)
+		{
+			if (!r_surfculled[j] && !R_BackFaceCull (r_pvscache.surfs[j]))
+				job->surfs[job->numsurfs++] = r_pvscache.surfs[j];
+		}
+
+		// add static models
+		if (ml->leaf->numefrags)
+			job->efragleafs[job->numefragleafs++] = ml->leaf;
+	}
+}
+
 /*
 ===============
 R_MarkSurfaces -- johnfitz -- mark surfaces based on PVS and rebuild texture chains
+
+The PVS is only decompressed and walked when the view leaf changes. The
+cached leafs are split into ranges with about the same number of surfaces,
+culled in parallel when r_threads is set, and chained here in leaf order.
 ===============
 */
 void R_MarkSurfaces (void)
 {
-	byte		*vis;
-	mleaf_t		*leaf;
+	markjob_t	jobs[MAX_MARK_JOBS];
+	task_t		tasks[MAX_MARK_JOBS];
 	msurface_t	*surf, **mark;
-	int			i, j;
+	markjob_t	*job;
+	pvsmode_t	mode;
+	int			i, j, numjobs, numleafs, total;
 	qboolean	nearwaterportal;
 
+	TRACE_BEGIN ("R_MarkSurfaces");
+
 	// clear lightmap chains
 	for (i=0 ; i<lightmap_count ; i++)
 		lightmaps[i].polys = NULL;
 
+	// the leafs' static entity lists, if any were added since
+	R_BuildEfragLists ();
+
 	// check this leaf for water portals
 	// TODO: loop through all water surfs and use distance to leaf cullbox
 	nearwaterportal = false;
@@ -113,11 +551,30 @@ void R_MarkSurfaces (void)
 
 	// choose vis data
 	if (r_novis.value || r_viewleaf->contents == CONTENTS_SOLID || r_viewleaf->contents == CONTENTS_SKY)
-		vis = Mod_NoVisPVS (cl.worldmodel);
+		mode = PVS_NOVIS;
 	else if (nearwaterportal)
-		vis = SV_FatPVS (r_origin, cl.worldmodel);
+		mode = PVS_FAT;
 	else
-		vis = Mod_LeafPVS (r_viewleaf, cl.worldmodel);
+		mode = PVS_LEAF;
+
+	if (r_pvscache.valid && mode != PVS_FAT && r_pvscache.mode == mode &&
+		r_pvscache.viewleaf == r_viewleaf && r_pvscache.oldskyleaf == !!r_oldskyleaf.value)
+		rs_pvshits++;
+	else
+	{
+		if (mode == PVS_NOVIS)
+			R_BuildPVSCache (Mod_NoVisPVS (cl.worldmodel));
+		else if (mode == PVS_FAT)
+			R_BuildPVSCache (SV_FatPVS (r_origin, cl.worldmodel));
+		else
+			R_BuildPVSCache (Mod_LeafPVS (r_viewleaf, cl.worldmodel));
+
+		r_pvscache.valid = true;
+		r_pvscache.viewleaf = r_viewleaf;
+		r_pvscache.mode = mode;
+		r_pvscache.oldskyleaf = !!r_oldskyleaf.value;
+		rs_pvsmisses++;
+	}
 
 	r_visframecount++;
 
@@ -126,38 +583,66 @@ void R_MarkSurfaces (void)
 		if (cl.worldmodel->textures[i])
 			cl.worldmodel->textures[i]->texturechains[chain_world] = NULL;
 
-	// iterate through leaves, marking surfaces
-	leaf = &cl.worldmodel->leafs[1];
-	for (i=0 ; i<cl.worldmodel->numleafs ; i++, leaf++)
+	// split the leafs by surface count
+	numleafs = r_pvscache.numleafs;
+	total = r_pvscache.numsurfs;
+	numjobs = r_threads.value ? q_min(Tasks_NumWorkers () + 1, MAX_MARK_JOBS) : 1;
+	for (i = 0, j = 0; i < numjobs; i++)
 	{
-		if (vis[i>>3] & (1<<(i&7)))
+		job = &jobs[i];
+		job->firstleaf = j;
+		if (i == numjobs - 1)
+			j = numleafs;
+		else
 		{
-			if (R_CullBox(leaf->minmaxs, leaf->minmaxs + 3))
-				continue;
+			int target = (int)((double)total * (i + 1) / numjobs);
+			while (j < numleafs && r_pvscache.leafs[j].firstsurf < target)
+				j++;
+		}
+		job->lastleaf = j;
+		job->surfs = r_marksurfs + (job->firstleaf < numleafs ? r_pvscache.leafs[job->firstleaf].firstsurf : total);
+		job->efragleafs = r_markleafs + job->firstleaf;
+		job->queryleafs = r_queryleafs + job->firstleaf;
+	}
 
-			if (r_oldskyleaf.value || leaf->contents != CONTENTS_SKY)
-				for (j=0, mark = leaf->firstmarksurface; j<leaf->nummarksurfaces; j++, mark++)
-				{
-					surf = *mark;
-					if (surf->visframe != r_visframecount)
-					{
-						surf->visframe = r_visframecount;
-						if (!R_CullBox(surf->mins, surf->maxs) && !R_BackFaceCull (surf))
-						{
-							rs_brushpolys++; //count wpolys here
-							R_ChainSurface(surf, chain_world);
-							R_RenderDynamicLightmaps(surf);
-							if (surf->texinfo->texture->warpimage)
-								surf->texinfo->texture->update_warp = true;
-						}
-					}
-				}
+	r_occlusion_active = r_occlusion.value && gl_occlusion_query_able;
+	if (r_occlusion_active)
+		R_ReadOcclusionQueries ();
+
+	// the last range is culled here while the workers do the others
+	for (i = 0; i < numjobs - 1; i++)
+		tasks[i] = Task_Run (R_MarkLeafs, &jobs[i], NULL, 0);
+	R_MarkLeafs (&jobs[numjobs - 1]);
+	for (i = 0; i < numjobs - 1; i++)
+		Task_Wait (tasks[i]);
 
-			// add static models
-			if (leaf->efrags)
-				R_StoreEfrags (&leaf->efrags);
+	// chain the surfaces in leaf order, a surface may be in several leafs
+	r_numqueryleafs = 0;
+	for (i = 0, job = jobs; i < numjobs; i++, job++)
+	{
+		memmove (r_queryleafs + r_numqueryleafs, job->queryleafs, job->numqueryleafs * sizeof(int));
+		r_numqueryleafs += job->numqueryleafs;
+		rs_occludedleafs += job->numoccluded;
+
+		for (j = 0; j < job->numsurfs; j++)
+		{
+			surf = job->surfs[j];
+			if (surf->visframe != r_visframecount)
+			{
+				surf->visframe = r_visframecount;
+				rs_brushpolys++; //count wpolys here
+				R_ChainSurface(surf, chain_world);
+				R_RenderDynamicLightmaps(surf);
+				if (surf->texinfo->texture->warpimage)
+					surf->texinfo->texture->update_warp = true;
+			}
 		}
+
+		for (j = 0; j < job->numefragleafs; j++)
+			R_StoreEfrags (job->efragleafs[j]);
 	}
+
+	TRACE_END ("R_MarkSurfaces");
 }
 
 //==============================================================================
@@ -319,6 +804,8 @@ void R_DrawTextureChains_Glow (qmodel_t *model, entity_t *ent, texchain_t chain)
 //
 //==============================================================================
 
+extern GLuint gl_bmodel_vbo, gl_bmodel_ibo;
+
 static unsigned int R_NumTriangleIndicesForSurf (msurface_t *s)
 {
 	return 3 * (s->numedges - 2);
@@ -344,10 +831,25 @@ static void R_TriangleIndicesForSurf (msurface_t *s, unsigned int *dest)
 }
 
 #define MAX_BATCH_SIZE 4096
+#define MAX_BATCH_CMDS 1024
 
 static unsigned int vbo_indices[MAX_BATCH_SIZE];
 static unsigned int num_vbo_indices;
 
+// with multi draw indirect, a batch is a list of index ranges in
+// gl_bmodel_ibo instead, one command per run of adjacent surfaces
+typedef struct
+{
+	GLuint	count;
+	GLuint	instancecount;
+	GLuint	firstindex;
+	GLint	basevertex;
+	GLuint	baseinstance;
+} drawcmd_t;
+
+static drawcmd_t vbo_cmds[MAX_BATCH_CMDS];
+static int num_vbo_cmds;
+
 /*
 ================
 R_ClearBatch
@@ -356,6 +858,7 @@ R_ClearBatch
 static void R_ClearBatch ()
 {
 	num_vbo_indices = 0;
+	num_vbo_cmds = 0;
 }
 
 /*
@@ -365,11 +868,26 @@ R_FlushBatch
 Draw the current batch if non-empty and clears it, ready for more R_BatchSurface calls.
 ================
 */
-static void R_FlushBatch ()
+void R_FlushBatch (void)
 {
+	GLintptr	offset;
+
+	if (num_vbo_cmds > 0)
+	{
+		memcpy (GL_StreamAlloc (num_vbo_cmds * sizeof(drawcmd_t)), vbo_cmds, num_vbo_cmds * sizeof(drawcmd_t));
+		offset = GL_StreamCommit (num_vbo_cmds * sizeof(drawcmd_t));
+		GL_BindBuffer (GL_DRAW_INDIRECT_BUFFER, gl_streambuffer);
+		GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, gl_bmodel_ibo);
+		GL_MultiDrawElementsIndirectFunc (GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid *) offset, num_vbo_cmds, 0);
+		num_vbo_cmds = 0;
+	}
+
 	if (num_vbo_indices > 0)
 	{
-		glDrawElements (GL_TRIANGLES, num_vbo_indices, GL_UNSIGNED_INT, vbo_indices);
+		memcpy (GL_StreamAlloc (num_vbo_indices * sizeof(unsigned int)), vbo_indices, num_vbo_indices * sizeof(unsigned int));
+		offset = GL_StreamCommit (num_vbo_indices * sizeof(unsigned int));
+		GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, gl_streambuffer);
+		glDrawElements (GL_TRIANGLES, num_vbo_indices, GL_UNSIGNED_INT, (const GLvoid *) offset);
 		num_vbo_indices = 0;
 	}
 }
@@ -382,12 +900,37 @@ Add the surface to the current batch, or just draw it immediately if we're not
 using VBOs.
 ================
 */
-static void R_BatchSurface (msurface_t *s)
+void R_BatchSurface (msurface_t *s)
 {
 	int num_surf_indices;
+	drawcmd_t *cmd;
 
 	num_surf_indices = R_NumTriangleIndicesForSurf (s);
 
+	if (gl_bmodel_ibo)
+	{
+		if (num_vbo_cmds)
+		{
+			cmd = &vbo_cmds[num_vbo_cmds - 1];
+			if (cmd->firstindex + cmd->count == (unsigned int)s->vbo_firstindex)
+			{ // follows the last one in the index buffer
+				cmd->count += num_surf_indices;
+				return;
+			}
+		}
+
+		if (num_vbo_cmds == MAX_BATCH_CMDS)
+			R_FlushBatch ();
+
+		cmd = &vbo_cmds[num_vbo_cmds++];
+		cmd->count = num_surf_indices;
+		cmd->instancecount = 1;
+		cmd->firstindex = s->vbo_firstindex;
+		cmd->basevertex = 0;
+		cmd->baseinstance = 0;
+		return;
+	}
+
 	if (num_vbo_indices + num_surf_indices > MAX_BATCH_SIZE)
 		R_FlushBatch();
 
@@ -395,6 +938,44 @@ static void R_BatchSurface (msurface_t *s)
 	num_vbo_indices += num_surf_indices;
 }
 
+/*
+================
+R_BeginPolyBatch
+
+Sets up drawing the undivided sky and water polys straight from the brush
+VBO, through the fixed-function vertex arrays DrawGLPoly would feed.
+Returns false if there is no VBO or it holds packed vertices, DrawGLPoly
+has to be used then.
+================
+*/
+qboolean R_BeginPolyBatch (void)
+{
+	if (!gl_bmodel_vbo || gl_bmodel_texbits)
+		return false;
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_vbo);
+	glEnableClientState (GL_VERTEX_ARRAY);
+	glVertexPointer (3, GL_FLOAT, VERTEXSIZE * sizeof(float), ((float *)0));
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer (2, GL_FLOAT, VERTEXSIZE * sizeof(float), ((float *)0) + 3);
+
+	R_ClearBatch ();
+	return true;
+}
+
+/*
+================
+R_EndPolyBatch
+================
+*/
+void R_EndPolyBatch (void)
+{
+	R_FlushBatch ();
+
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState (GL_VERTEX_ARRAY);
+}
+
 /*
 ================
 R_DrawTextureChains_Multitexture -- johnfitz
@@ -552,7 +1133,7 @@ void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain
 	msurface_t	*s;
 	texture_t	*t;
 	glpoly_t	*p;
-	qboolean	bound;
+	qboolean	bound, batched;
 	float entalpha;
 
 	if (r_drawflat_cheatsafe || r_lightmap_cheatsafe) // ericw -- !r_drawworld_cheatsafe check moved to R_DrawWorld_Water ()
@@ -585,8 +1166,43 @@ void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain
 			R_EndTransparentDrawing (entalpha);
 		}
 	}
+	else if (GLWarp_BeginShader ())
+	{
+		batched = R_BeginPolyBatch ();
+		for (i=0 ; i<model->numtextures ; i++)
+		{
+			t = model->textures[i];
+			if (!t || !t->texturechains[chain] || !(t->texturechains[chain]->flags & SURF_DRAWTURB))
+				continue;
+			bound = false;
+			entalpha = 1.0f;
+			for (s = t->texturechains[chain]; s; s = s->texturechain)
+			{
+				if (!bound) //only bind once we are sure we need this texture
+				{
+					entalpha = GL_WaterAlphaForEntitySurface (ent, s);
+					R_BeginTransparentDrawing (entalpha);
+					GLWarp_SetAlpha (entalpha);
+					GL_Bind (t->gltexture);
+					bound = true;
+				}
+				if (batched)
+					R_BatchSurface (s);
+				else
+					DrawGLPoly (s->polys);
+				rs_brushpasses++;
+			}
+			if (batched)
+				R_FlushBatch ();
+			R_EndTransparentDrawing (entalpha);
+		}
+		if (batched)
+			R_EndPolyBatch ();
+		GLWarp_EndShader ();
+	}
 	else
 	{
+		batched = R_BeginPolyBatch ();
 		for (i=0 ; i<model->numtextures ; i++)
 		{
 			t = model->textures[i];
@@ -612,11 +1228,18 @@ void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain
 
 					bound = true;
 				}
-				DrawGLPoly (s->polys);
+				if (batched)
+					R_BatchSurface (s);
+				else
+					DrawGLPoly (s->polys);
 				rs_brushpasses++;
 			}
+			if (batched)
+				R_FlushBatch ();
 			R_EndTransparentDrawing (entalpha);
 		}
+		if (batched)
+			R_EndPolyBatch ();
 	}
 }
 
@@ -680,22 +1303,49 @@ void R_DrawLightmapChains (void)
 	}
 }
 
-static GLuint r_world_program;
+// world shader variants, built from the same sources by GLWorld_CreateShaders
+#define WORLD_TEXARRAY		1	// textures come from gl_texarrays
+#define WORLD_GPULIGHTING	2	// lightstyles and dynamic lights are applied per pixel
+#define NUM_WORLD_PROGRAMS	4
 
-// uniforms used in vert shader
+#define MAX_WORLD_DLIGHTS	32	// dynamic lights the per-pixel lighting shader handles
 
-// uniforms used in frag shader
-static GLuint texLoc;
-static GLuint LMTexLoc;
-static GLuint fullbrightTexLoc;
-static GLuint useFullbrightTexLoc;
-static GLuint useOverbrightLoc;
-static GLuint useAlphaTestLoc;
-static GLuint alphaLoc;
+typedef struct
+{
+	GLuint	program;
+
+	// uniforms used in vert shader
+	GLuint	lightStylesLoc;
+	GLuint	texScaleLoc;
+
+	// uniforms used in frag shader
+	GLuint	texLoc;
+	GLuint	LMTexLoc;
+	GLuint	fullbrightTexLoc;
+	GLuint	useFullbrightTexLoc;
+	GLuint	useOverbrightLoc;
+	GLuint	useAlphaTestLoc;
+	GLuint	alphaLoc;
+	GLuint	styleTexLoc[MAXLIGHTMAPS];
+	GLuint	numStylesLoc;
+	GLuint	numLightsLoc;
+	GLuint	lightPosLoc;
+	GLuint	lightColorLoc;
+} worldprogram_t;
+
+static worldprogram_t r_world_programs[NUM_WORLD_PROGRAMS];
 
 #define vertAttrIndex 0
 #define texCoordsAttrIndex 1
 #define LMCoordsAttrIndex 2
+#define layerAttrIndex 3
+#define stylesAttrIndex 4
+
+// per-pixel lighting uniforms, see R_SetupWorldLights
+static float	r_world_lightstyles[256];
+static float	r_world_lightpos[MAX_WORLD_DLIGHTS][4];		// origin, radius
+static float	r_world_lightcolor[MAX_WORLD_DLIGHTS][4];	// color, minlight
+static int	r_world_numlights;
 
 /*
 =============
@@ -707,7 +1357,9 @@ void GLWorld_CreateShaders (void)
 	const glsl_attrib_binding_t bindings[] = {
 		{ "Vert", vertAttrIndex },
 		{ "TexCoords", texCoordsAttrIndex },
-		{ "LMCoords", LMCoordsAttrIndex }
+		{ "LMCoords", LMCoordsAttrIndex },
+		{ "Layer", layerAttrIndex },
+		{ "Styles", stylesAttrIndex }
 	};
 
 	// Driver bug workarounds:
@@ -715,46 +1367,127 @@ void GLWorld_CreateShaders (void)
 	//    crashing on glUseProgram with `vec3 Vert` and
 	//    `gl_ModelViewProjectionMatrix * vec4(Vert, 1.0);`. Work around with
 	//    making Vert a vec4. (https://sourceforge.net/p/quakespasm/bugs/39/)
+	//
+	// TexScale turns the packed texel coords back into texture coords, it
+	// is 1 for float ones.
+	// TEXARRAY: the layer goes in the third texture coordinate.
+	// GPULIGHTING: each vertex carries the styles of its surface; the
+	// lightstyle values are looked up here and interpolated unchanged.
 	const GLchar *vertSource = \
-		"#version 110\n"
-		"\n"
 		"attribute vec4 Vert;\n"
 		"attribute vec2 TexCoords;\n"
 		"attribute vec2 LMCoords;\n"
+		"uniform vec4 TexScale;\n"
+		"#ifdef TEXARRAY\n"
+		"attribute float Layer;\n"
+		"#endif\n"
+		"#ifdef GPULIGHTING\n"
+		"attribute vec4 Styles;\n"
+		"uniform vec4 LightStyles[64];\n"
+		"varying vec4 StyleScale;\n"
+		"varying vec3 Position;\n"
+		"\n"
+		"float StyleValue(float style)\n"
+		"{\n"
+		"	vec4 values = LightStyles[int(style / 4.0)];\n"
+		"	return dot(values, vec4(equal(vec4(mod(style, 4.0)), vec4(0.0, 1.0, 2.0, 3.0))));\n"
+		"}\n"
+		"#endif\n"
 		"\n"
 		"varying float FogFragCoord;\n"
 		"\n"
 		"void main()\n"
 		"{\n"
-		"	gl_TexCoord[0] = vec4(TexCoords, 0.0, 0.0);\n"
+		"#ifdef TEXARRAY\n"
+		"	gl_TexCoord[0] = vec4(TexCoords * TexScale.xy, Layer, 0.0);\n"
+		"#else\n"
+		"	gl_TexCoord[0] = vec4(TexCoords * TexScale.xy, 0.0, 0.0);\n"
+		"#endif\n"
 		"	gl_TexCoord[1] = vec4(LMCoords, 0.0, 0.0);\n"
+		"#ifdef GPULIGHTING\n"
+		"	StyleScale = vec4(StyleValue(Styles.x), StyleValue(Styles.y), StyleValue(Styles.z), StyleValue(Styles.w));\n"
+		"	Position = Vert.xyz;\n"
+		"#endif\n"
 		"	gl_Position = gl_ModelViewProjectionMatrix * Vert;\n"
 		"	FogFragCoord = gl_Position.w;\n"
 		"}\n";
-	
+
+	// TEXARRAY: fence textures aren't in arrays, so there's no alpha test.
+	// GPULIGHTING: the style pages are summed like R_BuildLightMap does,
+	// then dynamic lights are added with the same falloff as
+	// R_AddDynamicLights, measured with true distances in model space
+	// instead of in lightmap samples.
 	const GLchar *fragSource = \
-		"#version 110\n"
+		"#ifdef TEXARRAY\n"
+		"#extension GL_EXT_texture_array : require\n"
+		"#define TEXSAMPLER sampler2DArray\n"
+		"#define TEXLOOKUP(tex) texture2DArray(tex, gl_TexCoord[0].xyz)\n"
+		"#else\n"
+		"#define TEXSAMPLER sampler2D\n"
+		"#define TEXLOOKUP(tex) texture2D(tex, gl_TexCoord[0].xy)\n"
+		"uniform bool UseAlphaTest;\n"
+		"#endif\n"
 		"\n"
-		"uniform sampler2D Tex;\n"
-		"uniform sampler2D LMTex;\n"
-		"uniform sampler2D FullbrightTex;\n"
+		"uniform TEXSAMPLER Tex;\n"
+		"uniform TEXSAMPLER FullbrightTex;\n"
 		"uniform bool UseFullbrightTex;\n"
 		"uniform bool UseOverbright;\n"
-		"uniform bool UseAlphaTest;\n"
 		"uniform float Alpha;\n"
+		"#ifdef GPULIGHTING\n"
+		"uniform sampler2D StyleTex0;\n"
+		"uniform sampler2D StyleTex1;\n"
+		"uniform sampler2D StyleTex2;\n"
+		"uniform sampler2D StyleTex3;\n"
+		"uniform int NumStyles;\n"
+		"uniform int NumLights;\n"
+		"uniform vec4 LightPos[MAX_DLIGHTS];\n"
+		"uniform vec4 LightColor[MAX_DLIGHTS];\n"
+		"varying vec4 StyleScale;\n"
+		"varying vec3 Position;\n"
+		"#else\n"
+		"uniform sampler2D LMTex;\n"
+		"#endif\n"
 		"\n"
 		"varying float FogFragCoord;\n"
 		"\n"
 		"void main()\n"
 		"{\n"
-		"	vec4 result = texture2D(Tex, gl_TexCoord[0].xy);\n"
+		"	vec4 result = TEXLOOKUP(Tex);\n"
+		"#ifndef TEXARRAY\n"
 		"	if (UseAlphaTest && (result.a < 0.666))\n"
 		"		discard;\n"
+		"#endif\n"
+		"#ifdef GPULIGHTING\n"
+		"	vec3 light = vec3(0.0);\n"
+		"	if (NumStyles > 0)\n"
+		"		light += texture2D(StyleTex0, gl_TexCoord[1].xy).rgb * StyleScale.x;\n"
+		"	if (NumStyles > 1)\n"
+		"		light += texture2D(StyleTex1, gl_TexCoord[1].xy).rgb * StyleScale.y;\n"
+		"	if (NumStyles > 2)\n"
+		"		light += texture2D(StyleTex2, gl_TexCoord[1].xy).rgb * StyleScale.z;\n"
+		"	if (NumStyles > 3)\n"
+		"		light += texture2D(StyleTex3, gl_TexCoord[1].xy).rgb * StyleScale.w;\n"
+		"	vec3 normal = normalize(cross(dFdx(Position), dFdy(Position)));\n"
+		"	for (int i = 0; i < MAX_DLIGHTS; i++)\n"
+		"	{\n"
+		"		if (i >= NumLights)\n"
+		"			break;\n"
+		"		vec3 delta = LightPos[i].xyz - Position;\n"
+		"		float dist = dot(delta, normal);\n"
+		"		float brightness = LightPos[i].w - abs(dist) - length(delta - normal * dist);\n"
+		"		if (brightness > LightColor[i].w)\n"
+		"			light += brightness * LightColor[i].rgb;\n"
+		"	}\n"
+		"	if (!UseOverbright)\n"
+		"		light *= 2.0;\n"
+		"	result.rgb *= min(light, vec3(1.0));\n"
+		"#else\n"
 		"	result *= texture2D(LMTex, gl_TexCoord[1].xy);\n"
+		"#endif\n"
 		"	if (UseOverbright)\n"
 		"		result.rgb *= 2.0;\n"
 		"	if (UseFullbrightTex)\n"
-		"		result += texture2D(FullbrightTex, gl_TexCoord[0].xy);\n"
+		"		result += TEXLOOKUP(FullbrightTex);\n"
 		"	result = clamp(result, 0.0, 1.0);\n"
 		"	float fog = exp(-gl_Fog.density * gl_Fog.density * FogFragCoord * FogFragCoord);\n"
 		"	fog = clamp(fog, 0.0, 1.0);\n"
@@ -763,32 +1496,320 @@ void GLWorld_CreateShaders (void)
 		"	gl_FragColor = result;\n"
 		"}\n";
 
+	char	header[128], vert[4096], frag[4096];
+	int	i, k;
+	GLint	units;
+	worldprogram_t	*p;
+
+	memset (r_world_programs, 0, sizeof(r_world_programs));
+
 	if (!gl_glsl_alias_able)
 		return;
 
-	r_world_program = GL_CreateProgram (vertSource, fragSource, sizeof(bindings)/sizeof(bindings[0]), bindings);
-	
-	if (r_world_program != 0)
+	glGetIntegerv (GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+
+	for (i = 0, p = r_world_programs; i < NUM_WORLD_PROGRAMS; i++, p++)
 	{
+		if ((i & WORLD_TEXARRAY) && !gl_texture_array_able)
+			continue;
+		if ((i & WORLD_GPULIGHTING) && units < 3 + MAXLIGHTMAPS - 1)
+			continue; // style pages go on units 1, 3, 4 and 5
+
+		q_snprintf (header, sizeof(header), "#version 110\n%s%s#define MAX_DLIGHTS %i\n",
+				(i & WORLD_TEXARRAY) ? "#define TEXARRAY\n" : "",
+				(i & WORLD_GPULIGHTING) ? "#define GPULIGHTING\n" : "",
+				MAX_WORLD_DLIGHTS);
+		q_snprintf (vert, sizeof(vert), "%s%s", header, vertSource);
+		q_snprintf (frag, sizeof(frag), "%s%s", header, fragSource);
+
+		p->program = GL_CreateProgram (vert, frag, sizeof(bindings)/sizeof(bindings[0]), bindings);
+		if (p->program == 0)
+			continue;
+
 		// get uniform locations
-		texLoc = GL_GetUniformLocation (&r_world_program, "Tex");
-		LMTexLoc = GL_GetUniformLocation (&r_world_program, "LMTex");
-		fullbrightTexLoc = GL_GetUniformLocation (&r_world_program, "FullbrightTex");
-		useFullbrightTexLoc = GL_GetUniformLocation (&r_world_program, "UseFullbrightTex");
-		useOverbrightLoc = GL_GetUniformLocation (&r_world_program, "UseOverbright");
-		useAlphaTestLoc = GL_GetUniformLocation (&r_world_program, "UseAlphaTest");
-		alphaLoc = GL_GetUniformLocation (&r_world_program, "Alpha");
+		p->texLoc = GL_GetUniformLocation (&p->program, "Tex");
+		p->fullbrightTexLoc = GL_GetUniformLocation (&p->program, "FullbrightTex");
+		p->useFullbrightTexLoc = GL_GetUniformLocation (&p->program, "UseFullbrightTex");
+		p->useOverbrightLoc = GL_GetUniformLocation (&p->program, "UseOverbright");
+		p->alphaLoc = GL_GetUniformLocation (&p->program, "Alpha");
+		p->texScaleLoc = GL_GetUniformLocation (&p->program, "TexScale");
+		if (!(i & WORLD_TEXARRAY))
+			p->useAlphaTestLoc = GL_GetUniformLocation (&p->program, "UseAlphaTest");
+		if (i & WORLD_GPULIGHTING)
+		{
+			p->lightStylesLoc = GL_GetUniformLocation (&p->program, "LightStyles");
+			for (k = 0; k < MAXLIGHTMAPS; k++)
+				p->styleTexLoc[k] = GL_GetUniformLocation (&p->program, va("StyleTex%i", k));
+			p->numStylesLoc = GL_GetUniformLocation (&p->program, "NumStyles");
+			p->numLightsLoc = GL_GetUniformLocation (&p->program, "NumLights");
+			p->lightPosLoc = GL_GetUniformLocation (&p->program, "LightPos");
+			p->lightColorLoc = GL_GetUniformLocation (&p->program, "LightColor");
+		}
+		else
+			p->LMTexLoc = GL_GetUniformLocation (&p->program, "LMTex");
+	}
+
+	// the other variants are only used alongside the plain one, and the
+	// per-pixel lighting ones must cover both texture paths
+	if (!r_world_programs[0].program)
+		memset (r_world_programs, 0, sizeof(r_world_programs));
+	if (r_world_programs[WORLD_TEXARRAY].program && !r_world_programs[WORLD_TEXARRAY | WORLD_GPULIGHTING].program)
+		memset (&r_world_programs[WORLD_GPULIGHTING], 0, sizeof(worldprogram_t));
+}
+
+/*
+=============
+GLWorld_GPULighting
+
+Whether lightstyles and dynamic lights are left to the world shader this
+frame. Called once per frame, after the cheat-protected draw modes are set.
+Maps without light data have no style pages, the CPU path draws them
+fullbright.
+=============
+*/
+qboolean GLWorld_GPULighting (void)
+{
+	return r_gpulighting.value && r_dynamic.value
+		&& cl.worldmodel && cl.worldmodel->lightdata
+		&& r_world_programs[WORLD_GPULIGHTING].program
+		&& !r_drawflat_cheatsafe && !r_fullbright_cheatsafe && !r_lightmap_cheatsafe;
+}
+
+/*
+================
+R_SetupWorldLights
+
+Fills the uniforms of the per-pixel lighting shader. The vertices are in
+the entity's model space, so the dynamic lights are moved there too.
+================
+*/
+static void R_SetupWorldLights (entity_t *ent)
+{
+	int		i, k;
+	dlight_t	*l;
+	vec3_t		org, temp, forward, right, up, mins, maxs;
+	qboolean	rotated;
+
+	for (i = 0; i < 256; i++)
+		r_world_lightstyles[i] = d_lightstylevalue[i] / 256.0f;
+
+	r_world_numlights = 0;
+	if (gl_flashblend.value)
+		return;
+
+	rotated = ent && (ent->angles[0] || ent->angles[1] || ent->angles[2]);
+	if (rotated)
+		AngleVectors (ent->angles, forward, right, up);
+	if (ent)
+		R_EntityBounds (ent, mins, maxs);
+
+	// only lights that reach into the view, and the entity, take up one of the slots
+	for (i = 0, l = cl_dlights; i < MAX_DLIGHTS && r_world_numlights < MAX_WORLD_DLIGHTS; i++, l++)
+	{
+		if (!(r_visiblelights[i >> 5] & (1U << (i & 31))))
+			continue;
+		if (l->die < cl.time || !l->radius)
+			continue;
+		if (ent)
+		{
+			for (k = 0; k < 3; k++)
+				if (l->origin[k] + l->radius < mins[k] || l->origin[k] - l->radius > maxs[k])
+					break;
+			if (k < 3)
+				continue;
+		}
+
+		if (ent)
+		{
+			VectorSubtract (l->origin, ent->origin, org);
+			if (rotated)
+			{
+				VectorCopy (org, temp);
+				org[0] = DotProduct (temp, forward);
+				org[1] = -DotProduct (temp, right);
+				org[2] = DotProduct (temp, up);
+			}
+		}
+		else
+			VectorCopy (l->origin, org);
+
+		r_world_lightpos[r_world_numlights][0] = org[0];
+		r_world_lightpos[r_world_numlights][1] = org[1];
+		r_world_lightpos[r_world_numlights][2] = org[2];
+		r_world_lightpos[r_world_numlights][3] = l->radius;
+		r_world_lightcolor[r_world_numlights][0] = l->color[0] / 255.0f;
+		r_world_lightcolor[r_world_numlights][1] = l->color[1] / 255.0f;
+		r_world_lightcolor[r_world_numlights][2] = l->color[2] / 255.0f;
+		r_world_lightcolor[r_world_numlights][3] = l->minlight;
+		r_world_numlights++;
+	}
+}
+
+/*
+================
+R_UseWorldProgram
+
+Binds a world shader variant and sets the uniforms that stay the same for
+the whole model.
+================
+*/
+static worldprogram_t *R_UseWorldProgram (int variant, float entalpha)
+{
+	worldprogram_t	*p = &r_world_programs[variant];
+	int		k;
+
+	GL_UseProgramFunc (p->program);
+
+	GL_Uniform1iFunc (p->texLoc, 0);
+	GL_Uniform1iFunc (p->fullbrightTexLoc, 2);
+	GL_Uniform1iFunc (p->useFullbrightTexLoc, 0);
+	GL_Uniform1iFunc (p->useOverbrightLoc, (int)gl_overbright.value);
+	GL_Uniform1fFunc (p->alphaLoc, entalpha);
+	GL_Uniform4fFunc (p->texScaleLoc, 1, 1, 0, 0);
+	if (!(variant & WORLD_TEXARRAY))
+		GL_Uniform1iFunc (p->useAlphaTestLoc, 0);
+
+	if (variant & WORLD_GPULIGHTING)
+	{
+		GL_Uniform1iFunc (p->styleTexLoc[0], 1);
+		for (k = 1; k < MAXLIGHTMAPS; k++)
+			GL_Uniform1iFunc (p->styleTexLoc[k], 2 + k);
+		GL_Uniform4fvFunc (p->lightStylesLoc, 64, r_world_lightstyles);
+		GL_Uniform1iFunc (p->numLightsLoc, r_world_numlights);
+		if (r_world_numlights)
+		{
+			GL_Uniform4fvFunc (p->lightPosLoc, r_world_numlights, r_world_lightpos[0]);
+			GL_Uniform4fvFunc (p->lightColorLoc, r_world_numlights, r_world_lightcolor[0]);
+		}
 	}
+	else
+		GL_Uniform1iFunc (p->LMTexLoc, 1);
+
+	return p;
 }
 
-extern GLuint gl_bmodel_vbo;
+/*
+================
+R_SetWorldTexScale
+
+Sets TexScale for surfaces whose GL_TexCoordSize is width x height
+================
+*/
+static void R_SetWorldTexScale (worldprogram_t *p, int width, int height)
+{
+	float	fraction;
+
+	if (!gl_bmodel_texbits)
+		return;
+	fraction = 1 << gl_bmodel_texbits;
+	GL_Uniform4fFunc (p->texScaleLoc, 1.0f / (width * fraction), 1.0f / (height * fraction), 0, 0);
+}
+
+/*
+================
+R_BindWorldLightmap
+
+Binds the lightmap page, or its style pages for per-pixel lighting, to the
+texture units R_UseWorldProgram set up.
+================
+*/
+static void R_BindWorldLightmap (worldprogram_t *p, int lightmapnum)
+{
+	struct lightmap_s *lm = &lightmaps[lightmapnum];
+	int		k;
+
+	if (!r_gpulightmaps)
+	{
+		GL_SelectTexture (GL_TEXTURE1);
+		GL_Bind (lm->texture);
+		return;
+	}
+
+	GL_Uniform1iFunc (p->numStylesLoc, lm->numstyles);
+	for (k = 0; k < lm->numstyles; k++)
+	{
+		GL_SelectTexture (k ? GL_TEXTURE2 + k : GL_TEXTURE1);
+		GL_Bind (lm->styletextures[k]);
+	}
+}
+
+/*
+================
+R_DrawTextureArrays_GLSL
+
+Draws the surfaces whose textures are in gl_texarrays, one batch per
+array and lightmap instead of one per texture. Called from
+R_DrawTextureChains_GLSL with the vertex attributes set up.
+================
+*/
+static void R_DrawTextureArrays_GLSL (qmodel_t *model, texchain_t chain, float entalpha)
+{
+	int			i, j;
+	msurface_t	*s;
+	texture_t	*t;
+	texarray_t	*a;
+	int			lastlightmap;
+	qboolean	fullbrights;
+	worldprogram_t	*p;
+
+	p = R_UseWorldProgram (WORLD_TEXARRAY | (r_gpulightmaps ? WORLD_GPULIGHTING : 0), entalpha);
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_layer_vbo);
+	GL_EnableVertexAttribArrayFunc (layerAttrIndex);
+	GL_VertexAttribPointerFunc (layerAttrIndex, 1, GL_FLOAT, GL_FALSE, sizeof(float), ((float *)0));
+
+	for (j=0, a=gl_texarrays ; j<gl_numtexarrays ; j++, a++)
+	{
+		R_ClearBatch ();
+
+		lastlightmap = -1;
+		for (i=0 ; i<model->numtextures ; i++)
+		{
+			t = model->textures[i];
+
+			if (!t || t->texarray != j || !t->texturechains[chain] || t->texturechains[chain]->flags & (SURF_DRAWTILED | SURF_NOTEXTURE))
+				continue;
+
+			if (lastlightmap == -1) //only bind once we are sure we need this array
+			{
+				fullbrights = gl_fullbrights.value && a->fbtexnum;
+				GL_Uniform1iFunc (p->useFullbrightTexLoc, fullbrights);
+				if (fullbrights)
+				{
+					GL_SelectTexture (GL_TEXTURE2);
+					glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, a->fbtexnum);
+				}
+				GL_SelectTexture (GL_TEXTURE0);
+				glBindTexture (GL_TEXTURE_2D_ARRAY_EXT, a->texnum);
+				R_SetWorldTexScale (p, a->texwidth, a->texheight);
+				lastlightmap = t->texturechains[chain]->lightmaptexturenum;
+			}
+
+			for (s = t->texturechains[chain]; s; s = s->texturechain)
+			{
+				if (s->lightmaptexturenum != lastlightmap)
+					R_FlushBatch ();
+
+				R_BindWorldLightmap (p, s->lightmaptexturenum);
+				lastlightmap = s->lightmaptexturenum;
+				R_BatchSurface (s);
+
+				rs_brushpasses++;
+			}
+		}
+
+		R_FlushBatch ();
+	}
+
+	GL_DisableVertexAttribArrayFunc (layerAttrIndex);
+}
 
 /*
 ================
 R_DrawTextureChains_GLSL -- ericw
 
 Draw lightmapped surfaces with fulbrights in one pass, using VBO.
-Requires 3 TMUs, OpenGL 2.0
+Requires 3 TMUs, OpenGL 2.0; per-pixel lighting uses 6.
 ================
 */
 void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
@@ -800,6 +1821,8 @@ void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
 	int		lastlightmap;
 	gltexture_t	*fullbright = NULL;
 	float		entalpha;
+	worldprogram_t	*p;
+	int		texsize[2];
 
 	entalpha = (ent != NULL) ? ENTALPHA_DECODE(ent->alpha) : 1.0f;
 
@@ -810,28 +1833,38 @@ void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
 		glEnable (GL_BLEND);
 	}
 
-	GL_UseProgramFunc (r_world_program);
+	if (r_gpulightmaps)
+		R_SetupWorldLights (ent);
+
+	p = R_UseWorldProgram (r_gpulightmaps ? WORLD_GPULIGHTING : 0, entalpha);
 
 // Bind the buffers
 	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_vbo);
-	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0); // indices come from client memory!
+	// indices are streamed by R_FlushBatch
 
 	GL_EnableVertexAttribArrayFunc (vertAttrIndex);
 	GL_EnableVertexAttribArrayFunc (texCoordsAttrIndex);
 	GL_EnableVertexAttribArrayFunc (LMCoordsAttrIndex);
 
-	GL_VertexAttribPointerFunc (vertAttrIndex,      3, GL_FLOAT, GL_FALSE, VERTEXSIZE * sizeof(float), ((float *)0));
-	GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_FLOAT, GL_FALSE, VERTEXSIZE * sizeof(float), ((float *)0) + 3);
-	GL_VertexAttribPointerFunc (LMCoordsAttrIndex,  2, GL_FLOAT, GL_FALSE, VERTEXSIZE * sizeof(float), ((float *)0) + 5);
+	if (gl_bmodel_texbits)
+	{
+		GL_VertexAttribPointerFunc (vertAttrIndex,      3, GL_FLOAT, GL_FALSE, sizeof(packedvert_t), ((byte *)0) + offsetof(packedvert_t, xyz));
+		GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_SHORT, GL_FALSE, sizeof(packedvert_t), ((byte *)0) + offsetof(packedvert_t, st));
+		GL_VertexAttribPointerFunc (LMCoordsAttrIndex,  2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packedvert_t), ((byte *)0) + offsetof(packedvert_t, lmst));
+	}
+	else
+	{
+		GL_VertexAttribPointerFunc (vertAttrIndex,      3, GL_FLOAT, GL_FALSE, VERTEXSIZE * sizeof(float), ((float *)0));
+		GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_FLOAT, GL_FALSE, VERTEXSIZE * sizeof(float), ((float *)0) + 3);
+		GL_VertexAttribPointerFunc (LMCoordsAttrIndex,  2, GL_FLOAT, GL_FALSE, VERTEXSIZE * sizeof(float), ((float *)0) + 5);
+	}
 
-// set uniforms
-	GL_Uniform1iFunc (texLoc, 0);
-	GL_Uniform1iFunc (LMTexLoc, 1);
-	GL_Uniform1iFunc (fullbrightTexLoc, 2);
-	GL_Uniform1iFunc (useFullbrightTexLoc, 0);
-	GL_Uniform1iFunc (useOverbrightLoc, (int)gl_overbright.value);
-	GL_Uniform1iFunc (useAlphaTestLoc, 0);
-	GL_Uniform1fFunc (alphaLoc, entalpha);
+	if (r_gpulightmaps)
+	{
+		GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_style_vbo);
+		GL_EnableVertexAttribArrayFunc (stylesAttrIndex);
+		GL_VertexAttribPointerFunc (stylesAttrIndex, MAXLIGHTMAPS, GL_UNSIGNED_BYTE, GL_FALSE, MAXLIGHTMAPS, ((byte *)0));
+	}
 
 	for (i=0 ; i<model->numtextures ; i++)
 	{
@@ -840,16 +1873,19 @@ void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
 		if (!t || !t->texturechains[chain] || t->texturechains[chain]->flags & (SURF_DRAWTILED | SURF_NOTEXTURE))
 			continue;
 
+		if (t->texarray != -1 && r_world_programs[WORLD_TEXARRAY].program)
+			continue; // drawn by R_DrawTextureArrays_GLSL
+
 	// Enable/disable TMU 2 (fullbrights)
 	// FIXME: Move below to where we bind GL_TEXTURE0
 		if (gl_fullbrights.value && (fullbright = R_TextureAnimation(t, ent != NULL ? ent->frame : 0)->fullbright))
 		{
 			GL_SelectTexture (GL_TEXTURE2);
 			GL_Bind (fullbright);
-			GL_Uniform1iFunc (useFullbrightTexLoc, 1);
+			GL_Uniform1iFunc (p->useFullbrightTexLoc, 1);
 		}
 		else
-			GL_Uniform1iFunc (useFullbrightTexLoc, 0);
+			GL_Uniform1iFunc (p->useFullbrightTexLoc, 0);
 
 		R_ClearBatch ();
 
@@ -861,9 +1897,11 @@ void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
 			{
 				GL_SelectTexture (GL_TEXTURE0);
 				GL_Bind ((R_TextureAnimation(t, ent != NULL ? ent->frame : 0))->gltexture);
+				GL_TexCoordSize (t, &texsize[0], &texsize[1]);
+				R_SetWorldTexScale (p, texsize[0], texsize[1]);
 					
 				if (t->texturechains[chain]->flags & SURF_DRAWFENCE)
-					GL_Uniform1iFunc (useAlphaTestLoc, 1); // Flip alpha test back on
+					GL_Uniform1iFunc (p->useAlphaTestLoc, 1); // Flip alpha test back on
 										
 				bound = true;
 				lastlightmap = s->lightmaptexturenum;
@@ -872,8 +1910,7 @@ void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
 			if (s->lightmaptexturenum != lastlightmap)
 				R_FlushBatch ();
 
-			GL_SelectTexture (GL_TEXTURE1);
-			GL_Bind (lightmaps[s->lightmaptexturenum].texture);
+			R_BindWorldLightmap (p, s->lightmaptexturenum);
 			lastlightmap = s->lightmaptexturenum;
 			R_BatchSurface (s);
 
@@ -883,13 +1920,18 @@ void R_DrawTextureChains_GLSL (qmodel_t *model, entity_t *ent, texchain_t chain)
 		R_FlushBatch ();
 
 		if (bound && t->texturechains[chain]->flags & SURF_DRAWFENCE)
-			GL_Uniform1iFunc (useAlphaTestLoc, 0); // Flip alpha test back off
+			GL_Uniform1iFunc (p->useAlphaTestLoc, 0); // Flip alpha test back off
 	}
 
+	if (r_world_programs[WORLD_TEXARRAY].program && gl_numtexarrays)
+		R_DrawTextureArrays_GLSL (model, chain, entalpha);
+
 	// clean up
 	GL_DisableVertexAttribArrayFunc (vertAttrIndex);
 	GL_DisableVertexAttribArrayFunc (texCoordsAttrIndex);
 	GL_DisableVertexAttribArrayFunc (LMCoordsAttrIndex);
+	if (r_gpulightmaps)
+		GL_DisableVertexAttribArrayFunc (stylesAttrIndex);
 
 	GL_UseProgramFunc (0);
 	GL_SelectTexture (GL_TEXTURE0);
@@ -955,7 +1997,7 @@ void R_DrawTextureChains (qmodel_t *model, entity_t *ent, texchain_t chain)
 	R_DrawTextureChains_NoTexture (model, chain);
 
 	// OpenGL 2 fast path
-	if (r_world_program != 0)
+	if (r_world_programs[0].program != 0)
 	{
 		R_EndTransparentDrawing (entalpha);
 		
@@ -1090,6 +2132,68 @@ void R_DrawWorld (void)
 	R_DrawTextureChains (cl.worldmodel, NULL, chain_world);
 }
 
+/*
+=============
+R_DrawDepthPrepass
+
+r_prepass lays down the depth of the opaque world and of big brush
+entities with color writes off, so the passes after it shade each pixel
+about once instead of for every surface drawn over it.  Fences, sky and
+water are left out.  The positions come from the fixed-function pipeline
+and the world shader may round them differently, so the prepass is
+pushed back by OFFSET_PREPASS; the real passes test and write depth as
+before, so at worst a little overdraw remains.
+=============
+*/
+#define PREPASS_MIN_SURFS	32	// brush entities smaller than this aren't worth a draw
+
+void R_DrawDepthPrepass (void)
+{
+	int		i;
+	msurface_t	*s;
+	texture_t	*t;
+	entity_t	*e;
+
+	if (!r_prepass.value || !gl_bmodel_vbo)
+		return;
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_vbo);
+	glEnableClientState (GL_VERTEX_ARRAY);
+	glVertexPointer (3, GL_FLOAT, gl_bmodel_texbits ? sizeof(packedvert_t) : VERTEXSIZE * sizeof(float), ((float *)0));
+	glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable (GL_TEXTURE_2D);
+	GL_PolygonOffset (OFFSET_PREPASS);
+
+	R_ClearBatch ();
+	if (r_drawworld_cheatsafe)
+	{
+		for (i=0 ; i<cl.worldmodel->numtextures ; i++)
+		{
+			t = cl.worldmodel->textures[i];
+			if (!t || !t->texturechains[chain_world] || t->texturechains[chain_world]->flags & (SURF_DRAWTURB | SURF_DRAWSKY | SURF_DRAWFENCE))
+				continue;
+			for (s = t->texturechains[chain_world]; s; s = s->texturechain)
+				R_BatchSurface (s);
+		}
+		R_FlushBatch ();
+	}
+
+	for (i=0 ; r_drawentities.value && i<cl_numvisedicts ; i++)
+	{
+		e = cl_visedicts[i];
+		if (e->model->type != mod_brush || e->model->nummodelsurfaces < PREPASS_MIN_SURFS)
+			continue;
+		if (ENTALPHA_DECODE(e->alpha) < 1)
+			continue;
+		R_DrawBrushModel_Prepass (e);
+	}
+
+	GL_PolygonOffset (OFFSET_NONE);
+	glEnable (GL_TEXTURE_2D);
+	glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDisableClientState (GL_VERTEX_ARRAY);
+}
+
 /*
 =============
 R_DrawWorld_Water -- ericw -- moved from R_DrawTextureChains_Water, which is no longer specific to the world.
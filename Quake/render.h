@@ -91,6 +91,16 @@ typedef struct entity_s
 	vec3_t					currentorigin;	//johnfitz -- transform lerping
 	vec3_t					previousangles;	//johnfitz -- transform lerping
 	vec3_t					currentangles;	//johnfitz -- transform lerping
+
+	int						cullframe;		// r_framecount when culled was set
+	qboolean				culled;			// cached R_CullModelForEntity result
+	int						occludedframe;	// r_framecount when last frame's occlusion query came back empty
+	int						mergedframe;	// r_framecount when its surfaces went into the world's chains
+
+	int						lightcacheseq;	// R_LightPointCached, valid while r_lightcacheseq matches
+	vec3_t					lightcacheorg;
+	struct msurface_s		*lightcachesurf;	// where the light was sampled, NULL if nowhere
+	int						lightcacheds, lightcachedt;
 } entity_t;
 
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
@@ -145,6 +155,8 @@ void R_ViewChanged (vrect_t *pvrect, int lineadj, float aspect);
 
 void R_CheckEfrags (void); //johnfitz
 void R_AddEfrags (entity_t *ent);
+void R_ClearEfrags (void);
+void R_BuildEfragLists (void);
 
 void R_NewMap (void);
 
@@ -25,6 +25,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 int		sb_updates;		// if >= vid.numpages, no update needed
 
+static cvar_t	scr_sbarcache = {"scr_sbarcache", "1", CVAR_NONE};	// replay an unchanged sbar
+
 #define STAT_MINUS		10	// num frame for '-' stats digit
 
 qpic_t		*sb_nums[2][11];
@@ -256,6 +258,8 @@ void Sbar_Init (void)
 	Cmd_AddCommand ("+showscores", Sbar_ShowScores);
 	Cmd_AddCommand ("-showscores", Sbar_DontShowScores);
 
+	Cvar_RegisterVariable (&scr_sbarcache);
+
 	Sbar_LoadPics ();
 }
 
@@ -281,13 +285,7 @@ Sbar_DrawPicAlpha -- johnfitz
 */
 void Sbar_DrawPicAlpha (int x, int y, qpic_t *pic, float alpha)
 {
-	glDisable (GL_ALPHA_TEST);
-	glEnable (GL_BLEND);
-	glColor4f(1,1,1,alpha);
-	Draw_Pic (x, y + 24, pic);
-	glColor4f(1,1,1,1); // ericw -- changed from glColor3f to work around intel 855 bug with "r_oldwater 0" and "scr_sbaralpha 0"
-	glDisable (GL_BLEND);
-	glEnable (GL_ALPHA_TEST);
+	Draw_PicAlpha (x, y + 24, pic, alpha);
 }
 
 /*
@@ -327,6 +325,8 @@ void Sbar_DrawScrollString (int x, int y, int width, const char *str)
 	if (cl.gametype != GAME_DEATHMATCH)
 		left += (((float)glwidth - 320.0 * scale) / 2);
 
+	Draw_Flush (); // the scissor only applies to this string
+	Draw_CancelRecord ();
 	glEnable (GL_SCISSOR_TEST);
 	glScissor (left, 0, width * scale, glheight);
 
@@ -338,6 +338,7 @@ void Sbar_DrawScrollString (int x, int y, int width, const char *str)
 	Sbar_DrawCharacter (x - ofs + len - 16, y, '/');
 	Sbar_DrawString (x - ofs + len, y, str);
 
+	Draw_Flush ();
 	glDisable (GL_SCISSOR_TEST);
 }
 
@@ -918,14 +919,46 @@ void Sbar_DrawFace (void)
 	Sbar_DrawPic (112, 0, sb_faces[f][anim]);
 }
 
+/*
+===============
+Sbar_SameLayout
+
+True if nothing that moves the sbar around on screen has changed since
+the last call.
+===============
+*/
+static qboolean Sbar_SameLayout (void)
+{
+	static float	last[8];
+	float		current[8];
+
+	current[0] = glwidth;
+	current[1] = glheight;
+	current[2] = sb_lines;
+	current[3] = scr_sbarscale.value;
+	current[4] = scr_sbaralpha.value;
+	current[5] = scr_viewsize.value;
+	current[6] = cl.gametype;
+	current[7] = scr_sbarcache.value;
+
+	if (!memcmp (current, last, sizeof(current)))
+		return true;
+	memcpy (last, current, sizeof(last));
+	return false;
+}
+
 /*
 ===============
 Sbar_Draw
+
+With scr_sbarcache, the quads of an unchanged sbar are replayed from the
+last frame instead of being built again.
 ===============
 */
 void Sbar_Draw (void)
 {
 	float w; //johnfitz
+	qboolean samelayout;
 
 	if (scr_con_current == vid.height)
 		return;		// console is full screen
@@ -937,8 +970,18 @@ void Sbar_Draw (void)
         && !(gl_glsl_gamma_able && vid_gamma.value != 1))                         //ericw -- must draw sbar every frame if doing glsl gamma
 		return;
 
+	samelayout = Sbar_SameLayout ();
+	if (scr_sbarcache.value && sb_updates && samelayout && Draw_Replay ())
+	{
+		sb_updates++;
+		return;
+	}
+
 	sb_updates++;
 
+	if (scr_sbarcache.value)
+		Draw_BeginRecord ();
+
 	GL_SetCanvas (CANVAS_DEFAULT); //johnfitz
 
 	//johnfitz -- don't waste fillrate by clearing the area behind the sbar
@@ -1061,6 +1104,9 @@ void Sbar_Draw (void)
 	//johnfitz -- removed the vid.width > 320 check here
 	if (cl.gametype == GAME_DEATHMATCH)
 			Sbar_MiniDeathmatchOverlay ();
+
+	if (scr_sbarcache.value)
+		Draw_EndRecord ();
 }
 
 //=============================================================================
@@ -29,6 +29,9 @@ void SCR_Init (void);
 void SCR_LoadPics (void);
 
 void SCR_UpdateScreen (void);
+void SCR_CaptureFrame (void);
+void SCR_CaptureFinish (void);		// stops capture_start, waits for pending screenshots
+void SCR_DeleteCaptureBuffers (void);
 
 
 void SCR_SizeUp (void);
@@ -49,6 +52,7 @@ extern	int			sb_lines;
 extern	int			clearnotify;	// set to 0 whenever notify text is drawn
 extern	qboolean	scr_disabled_for_loading;
 extern	qboolean	scr_skipupdate;
+extern	double		scr_swaptime;
 
 extern	cvar_t		scr_viewsize;
 
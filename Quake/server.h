@@ -38,6 +38,8 @@ typedef struct
 
 typedef enum {ss_loading, ss_active} server_state_t;
 
+#define	MODEL_HASH_SIZE	(MAX_MODELS * 2)	// 50% load factor, must be a power of two
+
 typedef struct
 {
 	qboolean	active;				// false if only a net client
@@ -54,6 +56,7 @@ typedef struct
 	char		modelname[64];		// maps/<name>.bsp, for model_precache[0]
 	struct qmodel_s	*worldmodel;
 	const char	*model_precache[MAX_MODELS];	// NULL terminated
+	unsigned short	model_hash[MODEL_HASH_SIZE];	// index into model_precache + 1, 0 == empty
 	struct qmodel_s	*models[MAX_MODELS];
 	const char	*sound_precache[MAX_SOUNDS];	// NULL terminated
 	const char	*lightstyles[MAX_LIGHTSTYLES];
@@ -62,6 +65,7 @@ typedef struct
 	edict_t		*edicts;			// can NOT be array indexed, because
 									// edict_t is variable sized, but can
 									// be used to reference the world ent
+	link_t		free_edicts;		// freed edicts past the clients, oldest first
 	server_state_t	state;			// some actions are only valid during load
 
 	sizebuf_t	datagram;
@@ -75,6 +79,7 @@ typedef struct
 
 	unsigned	protocol; //johnfitz
 	unsigned	protocolflags;
+	msgcodec_t	codec;		// coord and angle encodings for protocolflags
 } server_t;
 
 
@@ -111,6 +116,14 @@ typedef struct client_s
 
 // client known data for deltas
 	int				old_frags;
+	int				entframe;			// PROTOCOL_DELTA: last entity frame sent
+	int				entframeack;		// last one the client has, 0 = none
+	int				movesequence;		// PROTOCOL_DELTA: last clc_moves move applied
+
+// entity updates that didn't fit and waited for a later datagram
+	double			ratetime;			// last datagram, for sv_rate
+	int				deferredents;		// in the last one
+	int				deferredtotal;		// since the level started
 } client_t;
 
 
@@ -193,6 +206,7 @@ extern	edict_t		*sv_player;
 //===========================================================
 
 void SV_Init (void);
+void SV_ClearFatPVSCache (void);
 
 void SV_StartParticle (vec3_t org, vec3_t dir, int color, int count);
 void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume,
@@ -204,6 +218,8 @@ void SV_SendClientMessages (void);
 void SV_ClearDatagram (void);
 
 int SV_ModelIndex (const char *name);
+int SV_FindModelPrecache (const char *name);
+void SV_SetModelPrecache (int index, const char *name);
 
 void SV_SetIdealPitch (void);
 
@@ -212,10 +228,32 @@ void SV_AddUpdates (void);
 void SV_ClientThink (void);
 void SV_AddClientToServer (struct qsocket_s	*ret);
 
+void SV_Multicast (vec3_t origin, sizebuf_t *msg, qboolean phs);
+sizebuf_t *SV_BroadcastDest (int kind, float value);	// for QuakeC writes to MSG_BROADCAST
+void SV_BroadcastWritten (void);
+void SV_FlushTempEntity (void);
+
 void SV_ClientPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 void SV_BroadcastPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 
 void SV_Physics (void);
+int ClipVelocity (vec3_t in, vec3_t normal, vec3_t out, float overbounce);
+void SV_ResetThinkSchedule (void);
+void SV_WakeEdict (edict_t *ent);	// nextthink or movetype may have changed
+
+#define	SVPROF_THINK	0
+#define	SVPROF_TOUCH	1
+#define	SVPROF_PHYSICS	2
+#define	SVPROF_MOVE		3
+#define	SVPROF_KINDS	4
+extern qboolean sv_profiling;
+void SV_ProfileEnter (edict_t *ent, int kind);
+void SV_ProfileLeave (void);
+void SV_Profile_f (void);
+#define	SV_PROFILE_BEGIN(ent,kind)	do { if (sv_profiling) SV_ProfileEnter (ent, kind); } while (0)
+#define	SV_PROFILE_END()		do { if (sv_profiling) SV_ProfileLeave (); } while (0)
+extern int sv_edictsvisited;
+extern double sv_sendtime, sv_sendtimemax;	// building client datagrams, all and the slowest
 
 qboolean SV_CheckBottom (edict_t *ent);
 qboolean SV_movestep (edict_t *ent, vec3_t move, qboolean relink);
@@ -224,10 +262,27 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg);
 
 void SV_MoveToGoal (void);
 
+void SV_ConnectClient (int clientnum);
 void SV_CheckForNewClients (void);
 void SV_RunClients (void);
 void SV_SaveSpawnparms ();
 void SV_SpawnServer (const char *server);
+void SV_FreeEdicts (void);
+void SV_PreloadChangelevels (void);
+extern int sv_protocol;
+
+// sv_replay.c
+extern qboolean sv_replaying;
+void SV_ReplayInit (void);
+void SV_RecordSpawn (const char *server);
+void SV_RecordSpawned (void);
+void SV_RecordFrame (qboolean runphysics);
+void SV_RecordConnect (client_t *client);
+void SV_RecordMessage (int ret);
+void SV_RecordShutdown (void);
+void SV_ReplayNewClients (void);
+int SV_ReplayGetMessage (void);
+void SV_ReplayFlushClient (void);
 
 #endif	/* _QUAKE_SERVER_H */
 
@@ -37,6 +37,8 @@ static void S_SoundList (void);
 static void S_Update_ (void);
 void S_StopAllSounds (qboolean clear);
 static void S_StopAllSoundsC (void);
+static void S_StartMixThread (void);
+static void S_StopMixThread (void);
 
 // =======================================================================
 // Internal sound data & structures
@@ -63,12 +65,77 @@ int		paintedtime;	// sample PAIRS
 int		s_rawend;
 portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
 
+static int	snd_viewentity;	// cl.viewentity as of the last listener update
+static int	snd_numstatics;	// S_StaticSound calls since the last S_StopAllSounds
+static int	snd_shown;	// audible channels, for snd_show
+
+/*
+The channels, the listener and paintedtime belong to the mixer.  With
+snd_mixthread that is a thread of its own, which gets starts, stops and
+listener updates from the main thread through a command ring and sends
+back the sounds the cache has thrown out: sounds are only ever loaded on
+the main thread.  Without it the commands run straight away.
+*/
+typedef struct
+{
+	vec3_t		origin, forward, right, up;
+	int		viewentity;
+	qboolean	ambients;			// false leaves the ambients alone
+	int		ambientvol[NUM_AMBIENTS];	// -1 silences it
+	int		ambientstep;			// most the volume moves toward ambientvol
+} sndlistener_t;
+
+typedef enum
+{
+	SNDCMD_START,
+	SNDCMD_STATIC,
+	SNDCMD_STOP,
+	SNDCMD_STOPALL,
+	SNDCMD_LISTENER
+} sndcmdtype_t;
+
+typedef struct
+{
+	sndcmdtype_t	type;
+	int		entnum;
+	int		entchannel;
+	sfx_t		*sfx;
+	int		length;		// of the sfx, in samples
+	vec3_t		origin;
+	float		vol;
+	float		attenuation;
+	qboolean	clear;		// SNDCMD_STOPALL clears the dma buffer
+	sndlistener_t	listener;
+} sndcmd_t;
+
+#if defined(USE_SDL2)
+#define	MAX_SND_COMMANDS	256	// power of two, one slot always stays free
+static sndcmd_t		snd_commands[MAX_SND_COMMANDS];
+static SDL_atomic_t	snd_commandhead;	// only written by the main thread
+static SDL_atomic_t	snd_commandtail;	// only written by the mixer thread
+
+#define	MAX_SND_RELOADS		64	// power of two, one slot always stays free
+static sfx_t		*snd_reloads[MAX_SND_RELOADS];
+static SDL_atomic_t	snd_reloadhead;		// only written by the mixer thread
+static SDL_atomic_t	snd_reloadtail;		// only written by the main thread
+
+#define	SND_MIXTHREAD_MSEC	5	// between mixes, well within _snd_mixahead
+
+static SDL_Thread	*snd_mixerthread;
+static SDL_atomic_t	snd_mixerquit;
+#endif
+static qboolean		snd_mixthreadactive;	// only changed while the thread isn't running
+
 #endif	// USE_FMOD
 
 #define	MAX_SFX		1024
 sfx_t	*known_sfx = NULL;	// hunk allocated [MAX_SFX]
 int		num_sfx;
 
+#define	SFX_HASH_SIZE	(MAX_SFX * 2)	// 50% load factor, must be a power of two
+static unsigned short	sfx_hash[SFX_HASH_SIZE];	// index into known_sfx + 1, 0 == empty
+static int		sfx_lookups, sfx_compares;
+
 static sfx_t	*ambient_sfx[NUM_AMBIENTS];
 
 qboolean	sound_started = false;
@@ -101,6 +168,7 @@ cvar_t		snd_filterquality = {"snd_filterquality", SND_FILTERQUALITY_DEFAULT,
 static	cvar_t	snd_noextraupdate = {"snd_noextraupdate", "0", CVAR_NONE};
 static	cvar_t	snd_show = {"snd_show", "0", CVAR_NONE};
 static	cvar_t	_snd_mixahead = {"_snd_mixahead", "0.1", CVAR_ARCHIVE};
+static	cvar_t	snd_mixthread = {"snd_mixthread", "1", CVAR_ARCHIVE};
 
 static void S_SoundInfo_f (void)
 {
@@ -134,6 +202,14 @@ static void SND_Callback_snd_filterquality (cvar_t *var)
 	}
 }
 
+static void SND_Callback_snd_mixthread (cvar_t *var)
+{
+	if (var->value)
+		S_StartMixThread ();
+	else
+		S_StopMixThread ();
+}
+
 /*
 ================
 S_Startup
@@ -159,6 +235,11 @@ void S_Startup (void)
 	}
 }
 
+// the dma backend opens its device in S_Startup
+void S_FinishStartup (void)
+{
+}
+
 #endif	// USE_FMOD
 
 /*
@@ -191,6 +272,29 @@ void S_Init (void)
 	Cvar_RegisterVariable(&sndspeed);
 	Cvar_RegisterVariable(&snd_mixspeed);
 	Cvar_RegisterVariable(&snd_filterquality);
+	Cvar_RegisterVariable(&snd_mixthread);
+#else
+	Cvar_RegisterVariable(&snd_asyncload);
+	Cvar_RegisterVariable(&snd_updaterate);
+	Cvar_RegisterVariable(&snd_maxinstances);
+	Cvar_RegisterVariable(&snd_voicesteal);
+	Cvar_RegisterVariable(&snd_occlusion);
+	Cvar_RegisterVariable(&snd_pvscull);
+	Cvar_RegisterVariable(&snd_reverb);
+	Cvar_RegisterVariable(&snd_soundbanks);
+	Cvar_RegisterVariable(&snd_compressedsamples);
+	Cvar_RegisterVariable(&snd_resample);
+	Cvar_RegisterVariable(&snd_staticcluster);
+	Cvar_RegisterVariable(&snd_voicebudget);
+	Cvar_RegisterVariable(&snd_virtualvol);
+	Cvar_RegisterVariable(&snd_memory);
+	Cvar_RegisterVariable(&snd_stats);
+	Cvar_RegisterVariable(&snd_statslog);
+	Cvar_RegisterVariable(&snd_doppler);
+	Cvar_RegisterVariable(&snd_output);
+	Cvar_RegisterVariable(&snd_dspbuffersize);
+	Cvar_RegisterVariable(&snd_dspbuffers);
+	Cvar_RegisterVariable(&snd_samplerate);
 #endif	// USE_FMOD
 	
 	if (safemode || COM_CheckParm("-nosound"))
@@ -200,9 +304,9 @@ void S_Init (void)
 
 	Cmd_AddCommand("play", S_Play);
 	Cmd_AddCommand("playvol", S_PlayVol);
+	Cmd_AddCommand("soundlist", S_SoundList);
 #ifndef USE_FMOD
 	Cmd_AddCommand("stopsound", S_StopAllSoundsC);
-	Cmd_AddCommand("soundlist", S_SoundList);
 	Cmd_AddCommand("soundinfo", S_SoundInfo_f);
 
 	i = COM_CheckParm("-sndspeed");
@@ -225,12 +329,18 @@ void S_Init (void)
 
 	Cvar_SetCallback(&sfxvolume, SND_Callback_sfxvolume);
 	Cvar_SetCallback(&snd_filterquality, &SND_Callback_snd_filterquality);
+	Cvar_SetCallback(&snd_mixthread, SND_Callback_snd_mixthread);
 
 	SND_InitScaletable ();
+	SND_InitMixKernels ();
+#else
+	Cmd_AddCommand("snd_memstats", S_MemStats_f);
+	Cmd_AddCommand("snd_restart", S_Restart_f);
 #endif	// USE_FMOD
 
 	known_sfx = (sfx_t *) Hunk_AllocName (MAX_SFX*sizeof(sfx_t), "sfx_t");
 	num_sfx = 0;
+	memset (sfx_hash, 0, sizeof(sfx_hash));
 
 	snd_initialized = true;
 
@@ -250,6 +360,11 @@ void S_Init (void)
 #endif	// USE_FMOD
 
 	S_StopAllSounds (true);
+
+#ifndef USE_FMOD
+	if (snd_mixthread.value)
+		S_StartMixThread ();
+#endif
 }
 
 #ifndef USE_FMOD
@@ -262,6 +377,8 @@ void S_Shutdown (void)
 	if (!sound_started)
 		return;
 
+	S_StopMixThread ();
+
 	sound_started = 0;
 	snd_blocked = 0;
 
@@ -285,7 +402,7 @@ S_FindName
 */
 sfx_t *S_FindName (const char *name)
 {
-	int		i;
+	unsigned	pos;
 	sfx_t	*sfx;
 
 	if (!name)
@@ -294,26 +411,40 @@ sfx_t *S_FindName (const char *name)
 	if (Q_strlen(name) >= MAX_QPATH)
 		Sys_Error ("Sound name too long: %s", name);
 
+	sfx_lookups++;
+
 // see if already loaded
-	for (i = 0; i < num_sfx; i++)
+	for (pos = COM_HashString (name) & (SFX_HASH_SIZE - 1); sfx_hash[pos]; pos = (pos + 1) & (SFX_HASH_SIZE - 1))
 	{
-		if (!Q_strcmp(known_sfx[i].name, name))
-		{
-			return &known_sfx[i];
-		}
+		sfx_compares++;
+		sfx = &known_sfx[sfx_hash[pos] - 1];
+		if (!Q_strcmp(sfx->name, name))
+			return sfx;
 	}
 
 	if (num_sfx == MAX_SFX)
 		Sys_Error ("S_FindName: out of sfx_t");
 
-	sfx = &known_sfx[i];
+	sfx = &known_sfx[num_sfx];
 	q_strlcpy (sfx->name, name, sizeof(sfx->name));
 
 	num_sfx++;
+	sfx_hash[pos] = num_sfx;
 
 	return sfx;
 }
 
+/*
+==================
+SND_PrintLookupStats
+
+==================
+*/
+void SND_PrintLookupStats (void)
+{
+	Con_Printf ("%i name lookups, %i string compares\n", sfx_lookups, sfx_compares);
+}
+
 #ifndef USE_FMOD
 
 /*
@@ -388,7 +519,7 @@ channel_t *SND_PickChannel (int entnum, int entchannel)
 		}
 
 		// don't let monster sounds override player sounds
-		if (snd_channels[ch_idx].entnum == cl.viewentity && entnum != cl.viewentity && snd_channels[ch_idx].sfx)
+		if (snd_channels[ch_idx].entnum == snd_viewentity && entnum != snd_viewentity && snd_channels[ch_idx].sfx)
 			continue;
 
 		if (snd_channels[ch_idx].end - paintedtime < life_left)
@@ -422,7 +553,7 @@ void SND_Spatialize (channel_t *ch)
 	vec3_t	source_vec;
 
 // anything coming from the view entity will always be full volume
-	if (ch->entnum == cl.viewentity)
+	if (ch->entnum == snd_viewentity)
 	{
 		ch->leftvol = ch->master_vol;
 		ch->rightvol = ch->master_vol;
@@ -457,55 +588,71 @@ void SND_Spatialize (channel_t *ch)
 		ch->leftvol = 0;
 }
 
+/*
+=================
+SND_CachedSound
+
+The sample data the mixer paints from.  The mixer thread can't load
+sounds, one the cache has thrown out goes back to the main thread and
+stays silent until it is loaded again.
+=================
+*/
+sfxcache_t *SND_CachedSound (sfx_t *sfx)
+{
+#if defined(USE_SDL2)
+	sfxcache_t	*sc;
+	int		head;
+
+	if (snd_mixthreadactive)
+	{
+		sc = (sfxcache_t *) Cache_Check (&sfx->cache);
+		if (!sc)
+		{
+			head = SDL_AtomicGet (&snd_reloadhead);
+			if (((head + 1) & (MAX_SND_RELOADS - 1)) != SDL_AtomicGet (&snd_reloadtail))
+			{	// else it is asked for again on the next mix
+				snd_reloads[head] = sfx;
+				SDL_AtomicSet (&snd_reloadhead, (head + 1) & (MAX_SND_RELOADS - 1));
+			}
+		}
+		return sc;
+	}
+#endif
+	return S_LoadSound (sfx);
+}
+
 
 // =======================================================================
-// Start a sound effect
+// Mixer side of the sound commands
 // =======================================================================
 
-void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)
+static void SND_StartChannel (const sndcmd_t *cmd)
 {
 	channel_t	*target_chan, *check;
-	sfxcache_t	*sc;
 	int		ch_idx;
 	int		skip;
 
-	if (!sound_started)
-		return;
-
-	if (!sfx)
-		return;
-
-	if (nosound.value)
-		return;
-
 // pick a channel to play on
-	target_chan = SND_PickChannel(entnum, entchannel);
+	target_chan = SND_PickChannel(cmd->entnum, cmd->entchannel);
 	if (!target_chan)
 		return;
 
 // spatialize
 	memset (target_chan, 0, sizeof(*target_chan));
-	VectorCopy(origin, target_chan->origin);
-	target_chan->dist_mult = attenuation / sound_nominal_clip_dist;
-	target_chan->master_vol = (int) (fvol * 255);
-	target_chan->entnum = entnum;
-	target_chan->entchannel = entchannel;
+	VectorCopy(cmd->origin, target_chan->origin);
+	target_chan->dist_mult = cmd->attenuation / sound_nominal_clip_dist;
+	target_chan->master_vol = (int) (cmd->vol * 255);
+	target_chan->entnum = cmd->entnum;
+	target_chan->entchannel = cmd->entchannel;
 	SND_Spatialize(target_chan);
 
 	if (!target_chan->leftvol && !target_chan->rightvol)
 		return;		// not audible at all
 
 // new channel
-	sc = S_LoadSound (sfx);
-	if (!sc)
-	{
-		target_chan->sfx = NULL;
-		return;		// couldn't load the sound's data
-	}
-
-	target_chan->sfx = sfx;
+	target_chan->sfx = cmd->sfx;
 	target_chan->pos = 0.0;
-	target_chan->end = paintedtime + sc->length;
+	target_chan->end = paintedtime + cmd->length;
 
 // if an identical sound has also been started this frame, offset the pos
 // a bit to keep it from just making the first one louder
@@ -514,7 +661,7 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 	{
 		if (check == target_chan)
 			continue;
-		if (check->sfx == sfx && !check->pos)
+		if (check->sfx == cmd->sfx && !check->pos)
 		{
 			/*
 			skip = rand () % (int)(0.1 * shm->speed);
@@ -523,8 +670,8 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 			*/
 			/* LordHavoc: fixed skip calculations */
 			skip = 0.1 * shm->speed; /* 0.1 * sc->speed */
-			if (skip > sc->length)
-				skip = sc->length;
+			if (skip > cmd->length)
+				skip = cmd->length;
 			if (skip > 0)
 				skip = rand() % skip;
 			target_chan->pos += skip;
@@ -534,7 +681,26 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 	}
 }
 
-void S_StopSound (int entnum, int entchannel)
+static void SND_StaticChannel (const sndcmd_t *cmd)
+{
+	channel_t	*ss;
+
+	if (total_channels == MAX_CHANNELS)
+		return;		// S_StaticSound has warned already
+
+	ss = &snd_channels[total_channels];
+	total_channels++;
+
+	ss->sfx = cmd->sfx;
+	VectorCopy (cmd->origin, ss->origin);
+	ss->master_vol = (int)cmd->vol;
+	ss->dist_mult = (cmd->attenuation / 64) / sound_nominal_clip_dist;
+	ss->end = paintedtime + cmd->length;
+
+	SND_Spatialize (ss);
+}
+
+static void SND_StopChannel (int entnum, int entchannel)
 {
 	int	i;
 
@@ -550,13 +716,28 @@ void S_StopSound (int entnum, int entchannel)
 	}
 }
 
-void S_StopAllSounds (qboolean clear)
+static void SND_ClearDMA (void)
 {
-	int		i;
+	int		clear;
 
-	if (!sound_started)
+	SNDDMA_LockBuffer ();
+	if (! shm->buffer)
 		return;
 
+	if (shm->samplebits == 8 && !shm->signed8)
+		clear = 0x80;
+	else
+		clear = 0;
+
+	memset(shm->buffer, clear, shm->samples * shm->samplebits / 8);
+
+	SNDDMA_Submit ();
+}
+
+static void SND_StopAllChannels (qboolean clear)
+{
+	int		i;
+
 	total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
 
 	for (i = 0; i < MAX_CHANNELS; i++)
@@ -568,35 +749,341 @@ void S_StopAllSounds (qboolean clear)
 	memset(snd_channels, 0, MAX_CHANNELS * sizeof(channel_t));
 
 	if (clear)
-		S_ClearBuffer ();
+		SND_ClearDMA ();
 }
 
-static void S_StopAllSoundsC (void)
+static void SND_UpdateAmbientSounds (const sndlistener_t *l)
 {
-	S_StopAllSounds (true);
+	int		vol, ambient_channel;
+	channel_t	*chan;
+
+	if (!l->ambients)
+		return;
+
+	for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS; ambient_channel++)
+	{
+		chan = &snd_channels[ambient_channel];
+		vol = l->ambientvol[ambient_channel];
+		if (vol < 0)
+		{
+			chan->sfx = NULL;
+			continue;
+		}
+		chan->sfx = ambient_sfx[ambient_channel];
+
+	// don't adjust volume too fast
+		if (chan->master_vol < vol)
+		{
+			chan->master_vol += l->ambientstep;
+			if (chan->master_vol > vol)
+				chan->master_vol = vol;
+		}
+		else if (chan->master_vol > vol)
+		{
+			chan->master_vol -= l->ambientstep;
+			if (chan->master_vol < vol)
+				chan->master_vol = vol;
+		}
+
+		chan->leftvol = chan->rightvol = chan->master_vol;
+	}
 }
 
-void S_ClearBuffer (void)
+static void SND_SetListener (const sndlistener_t *l)
 {
-	int		clear;
+	int			i, j;
+	channel_t	*ch;
+	channel_t	*combine;
 
-	if (!sound_started || !shm)
+	VectorCopy(l->origin, listener_origin);
+	VectorCopy(l->forward, listener_forward);
+	VectorCopy(l->right, listener_right);
+	VectorCopy(l->up, listener_up);
+	snd_viewentity = l->viewentity;
+
+// update general area ambient sound sources
+	SND_UpdateAmbientSounds (l);
+
+	combine = NULL;
+
+// update spatialization for static and dynamic sounds
+	ch = snd_channels + NUM_AMBIENTS;
+	for (i = NUM_AMBIENTS; i < total_channels; i++, ch++)
+	{
+		if (!ch->sfx)
+			continue;
+		SND_Spatialize(ch);	// respatialize channel
+		if (!ch->leftvol && !ch->rightvol)
+			continue;
+
+	// try to combine static sounds with a previous channel of the same
+	// sound effect so we don't mix five torches every frame
+
+		if (i >= MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS)
+		{
+		// see if it can just use the last one
+			if (combine && combine->sfx == ch->sfx)
+			{
+				combine->leftvol += ch->leftvol;
+				combine->rightvol += ch->rightvol;
+				ch->leftvol = ch->rightvol = 0;
+				continue;
+			}
+		// search for one
+			combine = snd_channels + MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
+			for (j = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS; j < i; j++, combine++)
+			{
+				if (combine->sfx == ch->sfx)
+					break;
+			}
+
+			if (j == total_channels)
+			{
+				combine = NULL;
+			}
+			else
+			{
+				if (combine != ch)
+				{
+					combine->leftvol += ch->leftvol;
+					combine->rightvol += ch->rightvol;
+					ch->leftvol = ch->rightvol = 0;
+				}
+				continue;
+			}
+		}
+	}
+
+// count for snd_show, printed by S_Update
+	snd_shown = 0;
+	ch = snd_channels;
+	for (i = 0; i < total_channels; i++, ch++)
+	{
+		if (ch->sfx && (ch->leftvol || ch->rightvol) )
+			snd_shown++;
+	}
+}
+
+static void SND_RunCommand (const sndcmd_t *cmd)
+{
+	switch (cmd->type)
+	{
+	case SNDCMD_START:
+		SND_StartChannel (cmd);
+		break;
+	case SNDCMD_STATIC:
+		SND_StaticChannel (cmd);
+		break;
+	case SNDCMD_STOP:
+		SND_StopChannel (cmd->entnum, cmd->entchannel);
+		break;
+	case SNDCMD_STOPALL:
+		SND_StopAllChannels (cmd->clear);
+		break;
+	case SNDCMD_LISTENER:
+		SND_SetListener (&cmd->listener);
+		break;
+	}
+}
+
+
+// =======================================================================
+// Mixer thread
+// =======================================================================
+
+#if defined(USE_SDL2)
+
+/*
+=================
+SND_RunCommands
+
+Mixer thread side of the command ring, also used to drain it once the
+thread has stopped.
+=================
+*/
+static void SND_RunCommands (void)
+{
+	int	tail, head;
+
+	tail = SDL_AtomicGet (&snd_commandtail);
+	head = SDL_AtomicGet (&snd_commandhead);
+	for ( ; tail != head; tail = (tail + 1) & (MAX_SND_COMMANDS - 1))
+		SND_RunCommand (&snd_commands[tail]);
+	SDL_AtomicSet (&snd_commandtail, tail);
+}
+
+static int SDLCALL SND_MixThread (void *unused)
+{
+	while (!SDL_AtomicGet (&snd_mixerquit))
+	{
+		SND_RunCommands ();
+		S_Update_ ();
+		SDL_Delay (SND_MIXTHREAD_MSEC);
+	}
+
+	return 0;
+}
+
+/*
+=================
+S_LoadEvicted
+
+Loads the sounds the mixer thread found thrown out of the cache.
+=================
+*/
+static void S_LoadEvicted (void)
+{
+	int	tail, head;
+
+	tail = SDL_AtomicGet (&snd_reloadtail);
+	head = SDL_AtomicGet (&snd_reloadhead);
+	for ( ; tail != head; tail = (tail + 1) & (MAX_SND_RELOADS - 1))
+		S_LoadSound (snd_reloads[tail]);
+	SDL_AtomicSet (&snd_reloadtail, tail);
+}
+
+#endif	// USE_SDL2
+
+static void S_StartMixThread (void)
+{
+#if defined(USE_SDL2)
+	if (snd_mixthreadactive || !sound_started)
 		return;
 
-	SNDDMA_LockBuffer ();
-	if (! shm->buffer)
+	Cache_CreateLock ();
+
+	SDL_AtomicSet (&snd_mixerquit, 0);
+	snd_mixthreadactive = true;
+	snd_mixerthread = SDL_CreateThread (SND_MixThread, "mixer", NULL);
+	if (!snd_mixerthread)
+	{
+		snd_mixthreadactive = false;
+		Con_Printf ("Couldn't start the mixer thread: %s\n", SDL_GetError ());
+	}
+#endif
+}
+
+static void S_StopMixThread (void)
+{
+#if defined(USE_SDL2)
+	if (!snd_mixthreadactive)
 		return;
 
-	s_rawend = 0;
+	SDL_AtomicSet (&snd_mixerquit, 1);
+	SDL_WaitThread (snd_mixerthread, NULL);
+	snd_mixerthread = NULL;
+	snd_mixthreadactive = false;
 
-	if (shm->samplebits == 8 && !shm->signed8)
-		clear = 0x80;
-	else
-		clear = 0;
+	// whatever the thread didn't get to
+	SND_RunCommands ();
+	S_LoadEvicted ();
+#endif
+}
 
-	memset(shm->buffer, clear, shm->samples * shm->samplebits / 8);
+/*
+=================
+S_SendCommand
 
-	SNDDMA_Submit ();
+Hands a command to the mixer thread, or runs it if there is none.
+=================
+*/
+static void S_SendCommand (const sndcmd_t *cmd)
+{
+#if defined(USE_SDL2)
+	int	head;
+
+	if (snd_mixthreadactive)
+	{
+		head = SDL_AtomicGet (&snd_commandhead);
+		while (((head + 1) & (MAX_SND_COMMANDS - 1)) == SDL_AtomicGet (&snd_commandtail))
+			SDL_Delay (1);	// full, the mixer drains all of it on its next pass
+		snd_commands[head] = *cmd;
+		SDL_AtomicSet (&snd_commandhead, (head + 1) & (MAX_SND_COMMANDS - 1));
+		return;
+	}
+#endif
+	SND_RunCommand (cmd);
+}
+
+
+// =======================================================================
+// Start a sound effect
+// =======================================================================
+
+void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)
+{
+	sndcmd_t	cmd;
+	sfxcache_t	*sc;
+
+	if (cls.demoseeking)
+		return;	// fast forwarding a demo
+
+	if (!sound_started)
+		return;
+
+	if (!sfx)
+		return;
+
+	if (nosound.value)
+		return;
+
+// loaded here, the mixer can't
+	sc = S_LoadSound (sfx);
+	if (!sc)
+		return;		// couldn't load the sound's data
+
+	cmd.type = SNDCMD_START;
+	cmd.entnum = entnum;
+	cmd.entchannel = entchannel;
+	cmd.sfx = sfx;
+	cmd.length = sc->length;
+	VectorCopy (origin, cmd.origin);
+	cmd.vol = fvol;
+	cmd.attenuation = attenuation;
+	S_SendCommand (&cmd);
+}
+
+void S_StopSound (int entnum, int entchannel)
+{
+	sndcmd_t	cmd;
+
+	if (!sound_started)
+		return;
+
+	cmd.type = SNDCMD_STOP;
+	cmd.entnum = entnum;
+	cmd.entchannel = entchannel;
+	S_SendCommand (&cmd);
+}
+
+void S_StopAllSounds (qboolean clear)
+{
+	sndcmd_t	cmd;
+
+	if (!sound_started)
+		return;
+
+	snd_numstatics = 0;
+	if (clear && shm)
+		s_rawend = 0;
+
+	cmd.type = SNDCMD_STOPALL;
+	cmd.clear = clear;
+	S_SendCommand (&cmd);
+}
+
+static void S_StopAllSoundsC (void)
+{
+	S_StopAllSounds (true);
+}
+
+void S_ClearBuffer (void)
+{
+	if (!sound_started || !shm)
+		return;
+
+	s_rawend = 0;
+	SND_ClearDMA ();
 }
 
 
@@ -607,20 +1094,18 @@ S_StaticSound
 */
 void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 {
-	channel_t	*ss;
-	sfxcache_t		*sc;
+	sndcmd_t	cmd;
+	sfxcache_t	*sc;
 
 	if (!sfx)
 		return;
 
-	if (total_channels == MAX_CHANNELS)
+	if (MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS + snd_numstatics == MAX_CHANNELS)
 	{
 		Con_Printf ("total_channels == MAX_CHANNELS\n");
 		return;
 	}
-
-	ss = &snd_channels[total_channels];
-	total_channels++;
+	snd_numstatics++;
 
 	sc = S_LoadSound (sfx);
 	if (!sc)
@@ -632,13 +1117,13 @@ void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 		return;
 	}
 
-	ss->sfx = sfx;
-	VectorCopy (origin, ss->origin);
-	ss->master_vol = (int)vol;
-	ss->dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
-	ss->end = paintedtime + sc->length;
-
-	SND_Spatialize (ss);
+	cmd.type = SNDCMD_STATIC;
+	cmd.sfx = sfx;
+	cmd.length = sc->length;
+	VectorCopy (origin, cmd.origin);
+	cmd.vol = vol;
+	cmd.attenuation = attenuation;
+	S_SendCommand (&cmd);
 }
 
 
@@ -646,14 +1131,17 @@ void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 
 /*
 ===================
-S_UpdateAmbientSounds
+S_AmbientLevels
+
+Where the ambients should fade to for the listener's leaf.
 ===================
 */
-static void S_UpdateAmbientSounds (void)
+static void S_AmbientLevels (sndlistener_t *l)
 {
-	mleaf_t		*l;
+	mleaf_t		*leaf;
 	int		vol, ambient_channel;
-	channel_t	*chan;
+
+	l->ambients = false;
 
 // no ambients when disconnected
 	if (cls.state != ca_connected)
@@ -662,38 +1150,22 @@ static void S_UpdateAmbientSounds (void)
 	if (!cl.worldmodel)
 		return;
 
-	l = Mod_PointInLeaf (listener_origin, cl.worldmodel);
-	if (!l || !ambient_level.value)
-	{
-		for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS; ambient_channel++)
-			snd_channels[ambient_channel].sfx = NULL;
-		return;
-	}
+	l->ambients = true;
+	l->ambientstep = (int) (host_frametime * ambient_fade.value);
 
+	leaf = Mod_PointInLeaf (l->origin, cl.worldmodel);
 	for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS; ambient_channel++)
 	{
-		chan = &snd_channels[ambient_channel];
-		chan->sfx = ambient_sfx[ambient_channel];
-
-		vol = (int) (ambient_level.value * l->ambient_sound_level[ambient_channel]);
-		if (vol < 8)
-			vol = 0;
-
-	// don't adjust volume too fast
-		if (chan->master_vol < vol)
+		if (!leaf || !ambient_level.value)
 		{
-			chan->master_vol += (int) (host_frametime * ambient_fade.value);
-			if (chan->master_vol > vol)
-				chan->master_vol = vol;
-		}
-		else if (chan->master_vol > vol)
-		{
-			chan->master_vol -= (int) (host_frametime * ambient_fade.value);
-			if (chan->master_vol < vol)
-				chan->master_vol = vol;
+			l->ambientvol[ambient_channel] = -1;
+			continue;
 		}
 
-		chan->leftvol = chan->rightvol = chan->master_vol;
+		vol = (int) (ambient_level.value * leaf->ambient_sound_level[ambient_channel]);
+		if (vol < 8)
+			vol = 0;
+		l->ambientvol[ambient_channel] = vol;
 	}
 }
 
@@ -714,9 +1186,11 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 	int src, dst;
 	float scale;
 	int intVolume;
+	int rawend;
 
-	if (s_rawend < paintedtime)
-		s_rawend = paintedtime;
+	rawend = s_rawend;
+	if (rawend < paintedtime)
+		rawend = paintedtime;
 
 	scale = (float) rate / shm->speed;
 	intVolume = (int) (256 * volume);
@@ -728,8 +1202,8 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = rawend & (MAX_RAW_SAMPLES - 1);
+			rawend++;
 			s_rawsamples [dst].left = ((short *) data)[src * 2] * intVolume;
 			s_rawsamples [dst].right = ((short *) data)[src * 2 + 1] * intVolume;
 		}
@@ -741,8 +1215,8 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = rawend & (MAX_RAW_SAMPLES - 1);
+			rawend++;
 			s_rawsamples [dst].left = ((short *) data)[src] * intVolume;
 			s_rawsamples [dst].right = ((short *) data)[src] * intVolume;
 		}
@@ -756,8 +1230,8 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = rawend & (MAX_RAW_SAMPLES - 1);
+			rawend++;
 		//	s_rawsamples [dst].left = ((signed char *) data)[src * 2] * intVolume;
 		//	s_rawsamples [dst].right = ((signed char *) data)[src * 2 + 1] * intVolume;
 			s_rawsamples [dst].left = (((byte *) data)[src * 2] - 128) * intVolume;
@@ -773,14 +1247,20 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = rawend & (MAX_RAW_SAMPLES - 1);
+			rawend++;
 		//	s_rawsamples [dst].left = ((signed char *) data)[src] * intVolume;
 		//	s_rawsamples [dst].right = ((signed char *) data)[src] * intVolume;
 			s_rawsamples [dst].left = (((byte *) data)[src] - 128) * intVolume;
 			s_rawsamples [dst].right = (((byte *) data)[src] - 128) * intVolume;
 		}
 	}
+
+// the samples have to be there before a mixer thread sees them
+#if defined(USE_SDL2)
+	SDL_MemoryBarrierRelease ();
+#endif
+	s_rawend = rawend;
 }
 
 /*
@@ -792,96 +1272,45 @@ Called once each time through the main loop
 */
 void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 {
-	int			i, j;
-	int			total;
-	channel_t	*ch;
-	channel_t	*combine;
+	sndcmd_t	cmd;
 
 	if (!sound_started || (snd_blocked > 0))
 		return;
 
-	VectorCopy(origin, listener_origin);
-	VectorCopy(forward, listener_forward);
-	VectorCopy(right, listener_right);
-	VectorCopy(up, listener_up);
-
-// update general area ambient sound sources
-	S_UpdateAmbientSounds ();
-
-	combine = NULL;
+	TRACE_BEGIN ("S_Update");
 
-// update spatialization for static and dynamic sounds
-	ch = snd_channels + NUM_AMBIENTS;
-	for (i = NUM_AMBIENTS; i < total_channels; i++, ch++)
-	{
-		if (!ch->sfx)
-			continue;
-		SND_Spatialize(ch);	// respatialize channel
-		if (!ch->leftvol && !ch->rightvol)
-			continue;
-
-	// try to combine static sounds with a previous channel of the same
-	// sound effect so we don't mix five torches every frame
-
-		if (i >= MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS)
-		{
-		// see if it can just use the last one
-			if (combine && combine->sfx == ch->sfx)
-			{
-				combine->leftvol += ch->leftvol;
-				combine->rightvol += ch->rightvol;
-				ch->leftvol = ch->rightvol = 0;
-				continue;
-			}
-		// search for one
-			combine = snd_channels + MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
-			for (j = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS; j < i; j++, combine++)
-			{
-				if (combine->sfx == ch->sfx)
-					break;
-			}
+#if defined(USE_SDL2)
+	if (snd_mixthreadactive)
+		S_LoadEvicted ();
+#endif
 
-			if (j == total_channels)
-			{
-				combine = NULL;
-			}
-			else
-			{
-				if (combine != ch)
-				{
-					combine->leftvol += ch->leftvol;
-					combine->rightvol += ch->rightvol;
-					ch->leftvol = ch->rightvol = 0;
-				}
-				continue;
-			}
-		}
-	}
+	cmd.type = SNDCMD_LISTENER;
+	VectorCopy(origin, cmd.listener.origin);
+	VectorCopy(forward, cmd.listener.forward);
+	VectorCopy(right, cmd.listener.right);
+	VectorCopy(up, cmd.listener.up);
+	cmd.listener.viewentity = cl.viewentity;
+	S_AmbientLevels (&cmd.listener);
+	S_SendCommand (&cmd);
 
 //
 // debugging output
 //
 	if (snd_show.value)
-	{
-		total = 0;
-		ch = snd_channels;
-		for (i = 0; i < total_channels; i++, ch++)
-		{
-			if (ch->sfx && (ch->leftvol || ch->rightvol) )
-			{
-			//	Con_Printf ("%3i %3i %s\n", ch->leftvol, ch->rightvol, ch->sfx->name);
-				total++;
-			}
-		}
+		Con_Printf ("----(%i)----\n", snd_shown);
 
-		Con_Printf ("----(%i)----\n", total);
-	}
+// paintedtime went back, see GetSoundtime
+	if (s_rawend > paintedtime + MAX_RAW_SAMPLES)
+		s_rawend = 0;
 
 // add raw data from streamed samples
 //	BGM_Update();	// moved to the main loop just before S_Update ()
 
 // mix some sound
-	S_Update_();
+	if (!snd_mixthreadactive)
+		S_Update_();
+
+	TRACE_END ("S_Update");
 }
 
 static void GetSoundtime (void)
@@ -905,7 +1334,7 @@ static void GetSoundtime (void)
 		{	// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			paintedtime = fullsamples;
-			S_StopAllSounds (true);
+			SND_StopAllChannels (true);
 		}
 	}
 	oldsamplepos = samplepos;
@@ -917,9 +1346,19 @@ void S_ExtraUpdate (void)
 {
 	if (snd_noextraupdate.value)
 		return;		// don't pollute timings
+	if (snd_mixthreadactive)
+		return;		// keeps mixing by itself
 	S_Update_();
 }
 
+/*
+============
+S_Update_
+
+One mix, on the mixer thread if there is one.  The cache is locked
+meanwhile so the sample data can't move.
+============
+*/
 static void S_Update_ (void)
 {
 	unsigned int	endtime;
@@ -928,9 +1367,13 @@ static void S_Update_ (void)
 	if (!sound_started || (snd_blocked > 0))
 		return;
 
+	Cache_Lock ();
 	SNDDMA_LockBuffer ();
 	if (! shm->buffer)
+	{
+		Cache_Unlock ();
 		return;
+	}
 
 // Updates DMA time
 	GetSoundtime();
@@ -950,6 +1393,7 @@ static void S_Update_ (void)
 	S_PaintChannels (endtime);
 
 	SNDDMA_Submit ();
+	Cache_Unlock ();
 }
 
 void S_BlockSound (void)
@@ -978,6 +1422,17 @@ void S_UnblockSound (void)
 	}
 }
 
+int S_GetStatsLines (char lines[MAX_SOUND_STATS_LINES][SOUND_STATS_LINE_LEN])
+{
+	return 0;
+}
+
+qboolean S_GetMemoryStats (int *current, int *peak)
+{
+	*current = *peak = 0;
+	return false;	// sfxcache_t lives in the cache
+}
+
 #endif	// USE_FMOD
 
 /*
@@ -1056,6 +1511,7 @@ static void S_SoundList (void)
 		Con_SafePrintf("(%2db) %6i : %s\n", sc->width*8, size, sfx->name); //johnfitz -- was Con_Printf
 	}
 	Con_Printf ("%i sounds, %i bytes\n", num_sfx, total); //johnfitz -- added count
+	SND_PrintLookupStats ();
 }
 
 #endif	// USE_FMOD
@@ -1084,6 +1540,7 @@ void S_ClearPrecache (void)
 }
 
 
+#ifndef USE_FMOD
 void S_BeginPrecaching (void)
 {
 }
@@ -1092,3 +1549,4 @@ void S_BeginPrecaching (void)
 void S_EndPrecaching (void)
 {
 }
+#endif	// USE_FMOD
@@ -21,14 +21,18 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "quakedef.h"
+#include "cfgfile.h"
+#include "bgmusic.h"
 
 #ifdef USE_FMOD
 #include "fmod.h"
 #include "fmod_errors.h"
 
 extern qboolean sound_started;	// in snd_dma.c
+extern cvar_t precache;
 extern sfx_t *known_sfx;
 extern int num_sfx;
+extern sfx_t *S_FindName(const char *name);
 
 FMOD_SYSTEM *fmod_system = NULL;
 
@@ -39,9 +43,35 @@ static FMOD_CHANNELGROUP *sfx_channelGroup = NULL;
 
 vec3_t listener_origin;
 
+cvar_t snd_asyncload = {"snd_asyncload", "1", CVAR_ARCHIVE};
+cvar_t snd_updaterate = {"snd_updaterate", "100", CVAR_ARCHIVE};
+cvar_t snd_maxinstances = {"snd_maxinstances", "8", CVAR_ARCHIVE};	// 0 = unlimited
+cvar_t snd_voicesteal = {"snd_voicesteal", "0", CVAR_ARCHIVE};	// 0 = steal oldest, 1 = steal quietest
+cvar_t snd_occlusion = {"snd_occlusion", "0", CVAR_ARCHIVE};
+cvar_t snd_pvscull = {"snd_pvscull", "1", CVAR_ARCHIVE};
+cvar_t snd_reverb = {"snd_reverb", "0", CVAR_ARCHIVE};
+cvar_t snd_soundbanks = {"snd_soundbanks", "0", CVAR_ARCHIVE};
+cvar_t snd_compressedsamples = {"snd_compressedsamples", "0", CVAR_ARCHIVE};
+cvar_t snd_resample = {"snd_resample", "0", CVAR_ARCHIVE};	// convert short sounds to the output rate at load
+cvar_t snd_staticcluster = {"snd_staticcluster", "0", CVAR_ARCHIVE};	// radius of static sound clusters, 0 = off
+cvar_t snd_voicebudget = {"snd_voicebudget", "0", CVAR_ARCHIVE};	// target dsp %, 0 = mix every voice FMOD can
+cvar_t snd_virtualvol = {"snd_virtualvol", "0", CVAR_ARCHIVE};	// volume below which FMOD makes a voice virtual
+cvar_t snd_memory = {"snd_memory", "0", CVAR_ARCHIVE};	// MB, 0 = use the system heap
+cvar_t snd_stats = {"snd_stats", "0", CVAR_NONE};
+cvar_t snd_statslog = {"snd_statslog", "0", CVAR_NONE};
+cvar_t snd_doppler = {"snd_doppler", "1", CVAR_ARCHIVE};	// scales emitter velocities, 0 = no doppler
+cvar_t snd_output = {"snd_output", "auto", CVAR_ARCHIVE};
+cvar_t snd_dspbuffersize = {"snd_dspbuffersize", "0", CVAR_ARCHIVE};	// samples per block, 0 = FMOD default
+cvar_t snd_dspbuffers = {"snd_dspbuffers", "0", CVAR_ARCHIVE};	// blocks, 0 = FMOD default
+cvar_t snd_samplerate = {"snd_samplerate", "0", CVAR_ARCHIVE};	// Hz, 0 = FMOD default
+
 static const char *FMOD_SpeakerModeString(FMOD_SPEAKERMODE speakermode);
 static float F_CALL SND_FMOD_Attenuation(FMOD_CHANNELCONTROL *channelControl, float distance);
 static void SND_StartAmbientSounds();
+static void SND_InitSlotPool(void);
+static void SND_FreeOcclusionGeometry(void);
+static void SND_FreeReverb(void);
+static void SND_FreeLoadData(sfx_t *s);
 
 // Copy and convert coordinate system
 #define FMOD_VectorCopy(a, b)	{(b).x=(a)[0];(b).y=(a)[2];(b).z=(a)[1];}
@@ -49,11 +79,21 @@ static void SND_StartAmbientSounds();
 
 typedef struct soundslot_s
 {
-	qboolean zone;
+	qboolean pooled;
 	FMOD_CHANNEL *channel;
 	float dist_mult;
+	struct soundslot_s *next;	// free list link for pooled slots
+
+	// entity channel sounds follow their entity, see SND_UpdateEmitters
+	qboolean tracking;
+	qboolean moving;	// was last given a velocity
+	vec3_t offset;		// from the entity origin, brush models play from their center
+	vec3_t position;	// as last given to FMOD
+	double movetime;	// cl.time it was given
 } soundslot_t;
 
+static void SND_FreeSoundSlot(soundslot_t *slot);
+
 typedef struct entsounds_s
 {
 	soundslot_t slots[8];
@@ -62,17 +102,597 @@ typedef struct entsounds_s
 static entsounds_t entsounds[MAX_CHANNELS];
 static FMOD_CHANNEL *ambients[NUM_AMBIENTS];
 
+// Slots for sounds that aren't tied to an entity channel, i.e. static sounds and entchannel 0.
+// These take the channel range that the original mixer reserved for them beyond the dynamic channels.
+#define MAX_POOLED_SLOTS	(MAX_CHANNELS - MAX_DYNAMIC_CHANNELS)
+
+static soundslot_t slotPool[MAX_POOLED_SLOTS];
+static soundslot_t *freeSlots;
+static int numPoolExhausted;
+
 // Keep track of all the sounds started each frame
 static sfx_t *sfxThisFrame[16];
 static int numSfxThisFrame;
 
+typedef enum
+{
+	SFX_UNAVAILABLE,
+	SFX_LOADING,
+	SFX_READY
+} sfxstate_t;
+
+// Sounds that were started while their sample was still being loaded in the background
+#define MAX_DEFERRED_SOUNDS		64
+#define DEFERRED_SOUND_TIMEOUT	0.1	// entity sounds that take longer than this to load are dropped
+
+typedef struct deferredsound_s
+{
+	sfx_t *sfx;
+	int entnum;
+	int entchannel;
+	vec3_t origin;
+	float vol;
+	float attenuation;
+	qboolean isstatic;
+	double time;
+} deferredsound_t;
+
+static deferredsound_t deferredSounds[MAX_DEFERRED_SOUNDS];
+static int numDeferredSounds;
+static int numFailedLoads;
+static int numMappedSamples;	// played straight from a mapped file
+static int numResampledSamples;	// converted to the output rate for snd_resample
+static int resampledBytes;		// 16-bit output rate data
+static int resampledSrcBytes;	// the source data it replaced
+
+// Static sounds, see SND_StartStaticSound
+static int numStaticSounds;
+static int numStaticPaused;
+static int numStaticClusters;	// channels representing more than one static
+static int numClusteredStatics;	// statics without a channel of their own
+
+// Entity sounds that were rejected for being inaudible or over snd_maxinstances, and older instances cut off to make room
+static int numVoicesDropped;
+static int numVoicesStolen;
+
+// Voices muted to hold snd_voicebudget, see SND_UpdateVoiceBudget
+static int voice_budget = MAX_DYNAMIC_CHANNELS;
+static double voice_budgettime, voice_ranktime;
+static int numVoicesMuted;
+
+// Moving emitters
+#define EMITTER_MOVE_DIST	2.0f	// units an emitter has to move before FMOD hears of it
+#define EMITTER_REST_TIME	0.1	// seconds without moving before its velocity is cleared
+#define SND_UNITS_PER_METER	32.0f	// FMOD's doppler works in meters
+static int numEmitterUpdates;		// since the last stats sample
+
+/*
+=================
+Update thread
+
+FMOD_System_Update and the 3D listener run on their own thread at snd_updaterate Hz,
+so positioning stays smooth at low frame rates and FMOD isn't updated thousands of times
+per second at high ones. FMOD's API is thread safe, so sounds are still started and stopped
+from the main thread. The listener glides from where it was to each new client position
+over the length of a client frame.
+Channel callbacks now run on the update thread, so the slot pool is guarded by snd_lock.
+=================
+*/
+typedef struct listener_s
+{
+	vec3_t origin, forward, up;
+} listener_t;
+
+static SDL_Thread *snd_thread = NULL;
+static SDL_mutex *snd_lock = NULL;
+static qboolean snd_thread_quit;
+static int snd_update_msec;
+
+static listener_t listener_from, listener_to, listener_current;
+static double listener_starttime, listener_duration, listener_lasttime;
+
+static void SND_LerpListener(listener_t *out, const listener_t *from, const listener_t *to, float frac)
+{
+	float d;
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		out->origin[i] = from->origin[i] + (to->origin[i] - from->origin[i]) * frac;
+		out->forward[i] = from->forward[i] + (to->forward[i] - from->forward[i]) * frac;
+		out->up[i] = from->up[i] + (to->up[i] - from->up[i]) * frac;
+	}
+
+	// FMOD wants an orthonormal basis
+	if (VectorNormalize(out->forward) > 0.0f)
+	{
+		d = DotProduct(out->up, out->forward);
+		VectorMA(out->up, -d, out->forward, out->up);
+		VectorNormalize(out->up);
+	}
+}
+
+static void SND_SetListener(const listener_t *l)
+{
+	FMOD_VECTOR fmod_pos, fmod_forward, fmod_up;
+
+	FMOD_VectorCopy(l->origin, fmod_pos);
+	FMOD_VectorCopy(l->forward, fmod_forward);
+	FMOD_VectorCopy(l->up, fmod_up);
+
+	FMOD_System_Set3DListenerAttributes(fmod_system, 0, &fmod_pos, NULL, &fmod_forward, &fmod_up);
+}
+
+static int SDLCALL SND_UpdateThread(void *unused)
+{
+	listener_t listener;
+	double start;
+	float frac;
+	int msec, elapsed;
+
+	while (1)
+	{
+		start = Sys_DoubleTime();
+
+		SDL_LockMutex(snd_lock);
+		if (snd_thread_quit)
+		{
+			SDL_UnlockMutex(snd_lock);
+			break;
+		}
+		frac = listener_duration > 0 ? (start - listener_starttime) / listener_duration : 1.0f;
+		frac = CLAMP(0.0f, frac, 1.0f);
+		SND_LerpListener(&listener_current, &listener_from, &listener_to, frac);
+		listener = listener_current;
+		msec = snd_update_msec;
+		SDL_UnlockMutex(snd_lock);
+
+		SND_SetListener(&listener);
+		FMOD_System_Update(fmod_system);
+
+		elapsed = (int)((Sys_DoubleTime() - start) * 1000);
+		if (elapsed < msec)
+			SDL_Delay(msec - elapsed);
+	}
+
+	return 0;
+}
+
+static void SND_StartUpdateThread(void)
+{
+	snd_thread_quit = false;
+	snd_update_msec = 10;
+	memset(&listener_from, 0, sizeof(listener_from));
+	listener_to = listener_current = listener_from;
+	listener_starttime = listener_lasttime = Sys_DoubleTime();
+	listener_duration = 0;
+
+	snd_lock = SDL_CreateMutex();
+	if (!snd_lock)
+	{
+		Con_Printf("Couldn't create sound lock, updating sound on the main thread\n");
+		return;
+	}
+
+#if defined(USE_SDL2)
+	snd_thread = SDL_CreateThread(SND_UpdateThread, "sound", NULL);
+#else
+	snd_thread = SDL_CreateThread(SND_UpdateThread, NULL);
+#endif
+	if (!snd_thread)
+	{
+		Con_Printf("Couldn't create sound thread, updating sound on the main thread\n");
+		SDL_DestroyMutex(snd_lock);
+		snd_lock = NULL;
+	}
+}
+
+static void SND_StopUpdateThread(void)
+{
+	if (!snd_thread)
+		return;
+
+	SDL_LockMutex(snd_lock);
+	snd_thread_quit = true;
+	SDL_UnlockMutex(snd_lock);
+	SDL_WaitThread(snd_thread, NULL);
+
+	snd_thread = NULL;
+	SDL_DestroyMutex(snd_lock);
+	snd_lock = NULL;
+}
+
+/*
+=================
+Stats
+
+Once a second, FMOD's CPU and voice usage are sampled for the snd_stats overlay. Drift is how far the
+mixer's DSP clock got ahead of (or fell behind) the wall clock over that second. With snd_statslog set,
+each sample is also appended to sndstats.csv in the game directory, along with the average frame time,
+so audio load can be lined up against frame rate over a long session.
+=================
+*/
+typedef struct sndstats_s
+{
+	FMOD_CPU_USAGE cpu;
+	int channels, realchannels;
+	int loading;
+	qboolean starving;
+	float drift;		// ms over the last second
+	float frametime;	// ms
+	float emitters;		// moved emitters per frame
+	int statics;		// static sounds, and the channels playing them
+	int staticchannels;
+} sndstats_t;
+
+static sndstats_t snd_stats_current;
+static qboolean snd_stats_valid;
+static double stats_lasttime;
+static unsigned long long stats_lastclock;
+static int stats_lastframecount;
+static FILE *stats_log = NULL;
+
+static void SND_WriteStatsLog(const sndstats_t *st)
+{
+	char path[MAX_OSPATH];
+
+	if (!snd_statslog.value)
+	{
+		if (stats_log)
+		{
+			fclose(stats_log);
+			stats_log = NULL;
+		}
+		return;
+	}
+
+	if (!stats_log)
+	{
+		q_snprintf(path, sizeof(path), "%s/sndstats.csv", com_gamedir);
+		stats_log = fopen(path, "a");
+		if (!stats_log)
+		{
+			Con_Printf("Couldn't open %s\n", path);
+			Cvar_SetQuick(&snd_statslog, "0");
+			return;
+		}
+		fprintf(stats_log, "time,frame_ms,dsp,stream,update,geometry,channels,real,loading,starving,drift_ms,emitters,statics,static_channels\n");
+	}
+
+	fprintf(stats_log, "%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%d,%d,%d,%d,%.1f,%.1f,%d,%d\n", realtime, st->frametime,
+		st->cpu.dsp, st->cpu.stream, st->cpu.update, st->cpu.geometry, st->channels, st->realchannels, st->loading, st->starving, st->drift,
+		st->emitters, st->statics, st->staticchannels);
+	fflush(stats_log);
+}
+
+static void SND_UpdateStats(void)
+{
+	FMOD_CHANNELGROUP *master;
+	unsigned long long dspclock;
+	sndstats_t *st = &snd_stats_current;
+	double elapsed;
+	int i;
+
+	if (!snd_stats.value && !snd_statslog.value)
+	{
+		SND_WriteStatsLog(NULL);	// closes the log
+		snd_stats_valid = false;
+		stats_lasttime = 0;
+		return;
+	}
+
+	FMOD_System_GetMasterChannelGroup(fmod_system, &master);
+	FMOD_ChannelGroup_GetDSPClock(master, &dspclock, NULL);
+
+	elapsed = realtime - stats_lasttime;
+	if (!stats_lasttime || elapsed < 0 || elapsed > 5)
+	{
+		// (Re)start sampling
+		stats_lasttime = realtime;
+		stats_lastclock = dspclock;
+		stats_lastframecount = host_framecount;
+		numEmitterUpdates = 0;
+		return;
+	}
+	if (elapsed < 1.0)
+		return;
+
+	memset(st, 0, sizeof(*st));
+	FMOD_System_GetCPUUsage(fmod_system, &st->cpu);
+	FMOD_System_GetChannelsPlaying(fmod_system, &st->channels, &st->realchannels);
+	st->starving = BGM_IsStarving();
+	for (i = 0; i < num_sfx; i++)
+	{
+		if (known_sfx[i].sound && known_sfx[i].pending)
+			st->loading++;
+	}
+	st->drift = ((double)(dspclock - stats_lastclock) / fmod_samplerate - elapsed) * 1000.0;
+	st->statics = numStaticSounds;
+	st->staticchannels = numStaticSounds - numClusteredStatics;
+	if (host_framecount > stats_lastframecount)
+	{
+		st->frametime = elapsed * 1000.0 / (host_framecount - stats_lastframecount);
+		st->emitters = (float)numEmitterUpdates / (host_framecount - stats_lastframecount);
+	}
+	numEmitterUpdates = 0;
+	snd_stats_valid = true;
+
+	stats_lasttime = realtime;
+	stats_lastclock = dspclock;
+	stats_lastframecount = host_framecount;
+
+	SND_WriteStatsLog(st);
+}
+
+/*
+=================
+FMOD memory
+
+With snd_memory set, FMOD is handed a fixed arena to run its own allocator in, so that its allocations
+during playback don't mix with the engine's on the system heap. The arena is malloc'd rather than taken
+from the hunk, so that a bad setting can't keep the game from starting. Otherwise allocations are passed
+through to the system heap and counted. FMOD_Memory_Initialize can only be called before the FMOD system
+is created, so snd_memory is read from config.cfg early, and changes require a restart.
+=================
+*/
+#define MIN_FMOD_ARENA_MB	8
+
+static byte *fmod_arena = NULL;
+static int fmod_arenasize;
+
+#if defined(USE_SDL2)
+static SDL_atomic_t fmod_numallocs, fmod_numfrees;
+
+static void* F_CALL SND_FMOD_Alloc(unsigned int size, FMOD_MEMORY_TYPE type, const char *sourcestr)
+{
+	SDL_AtomicAdd(&fmod_numallocs, 1);
+	return malloc(size);
+}
+
+static void* F_CALL SND_FMOD_Realloc(void *ptr, unsigned int size, FMOD_MEMORY_TYPE type, const char *sourcestr)
+{
+	if (!ptr)
+		SDL_AtomicAdd(&fmod_numallocs, 1);
+	return realloc(ptr, size);
+}
+
+static void F_CALL SND_FMOD_Free(void *ptr, FMOD_MEMORY_TYPE type, const char *sourcestr)
+{
+	if (ptr)
+		SDL_AtomicAdd(&fmod_numfrees, 1);
+	free(ptr);
+}
+#endif
+
+static void SND_InitMemory(void)
+{
+	static qboolean initialized = false;
+	FMOD_RESULT result;
+	int mb;
+
+	if (initialized)
+		return;
+	initialized = true;
+
+	mb = (int)snd_memory.value;
+	if (mb > 0)
+	{
+		mb = q_max(mb, MIN_FMOD_ARENA_MB);
+		fmod_arenasize = mb * 1024 * 1024;
+		fmod_arena = (byte *) malloc(fmod_arenasize);
+		if (!fmod_arena)
+		{
+			Con_Printf("Couldn't allocate %i MB for FMOD, using the system heap\n", mb);
+		}
+		else
+		{
+			result = FMOD_Memory_Initialize(fmod_arena, fmod_arenasize, NULL, NULL, NULL, FMOD_MEMORY_ALL);
+			if (result == FMOD_OK)
+				return;
+
+			Con_Printf("Failed to initialize FMOD memory arena: %s\n", FMOD_ErrorString(result));
+			free(fmod_arena);
+			fmod_arena = NULL;
+		}
+	}
+
+	fmod_arenasize = 0;
+#if defined(USE_SDL2)
+	FMOD_Memory_Initialize(NULL, 0, SND_FMOD_Alloc, SND_FMOD_Realloc, SND_FMOD_Free, FMOD_MEMORY_ALL);
+#endif
+}
+
+qboolean S_GetMemoryStats(int *current, int *peak)
+{
+	if (fmod_system && FMOD_Memory_GetStats(current, peak, 0) == FMOD_OK)
+		return true;
+
+	*current = *peak = 0;
+	return false;
+}
+
+void S_MemStats_f(void)
+{
+	int current, peak;
+
+	if (FMOD_Memory_GetStats(&current, &peak, 0) != FMOD_OK)
+	{
+		Con_Printf("FMOD memory stats unavailable\n");
+		return;
+	}
+
+	Con_Printf("FMOD memory: %.2f MB, peak %.2f MB\n", current / (1024.0f * 1024.0f), peak / (1024.0f * 1024.0f));
+	if (fmod_arena)
+		Con_Printf("arena: %i MB, %.1f%% in use\n", fmod_arenasize / (1024 * 1024), 100.0f * current / fmod_arenasize);
+#if defined(USE_SDL2)
+	else
+		Con_Printf("system heap: %i allocations, %i frees\n", SDL_AtomicGet(&fmod_numallocs), SDL_AtomicGet(&fmod_numfrees));
+#endif
+}
+
+/*
+=================
+Output configuration
+
+The output type, DSP buffer size and mixer rate can only be set between creating the FMOD system and
+initializing it, so these are read from config.cfg early along with snd_memory, and changes to them are
+applied with snd_restart. A smaller or shorter DSP buffer lowers the mixing latency, at the cost of more
+frequent mixer wakeups and a higher risk of starving the output.
+=================
+*/
+typedef struct
+{
+	const char *name;
+	FMOD_OUTPUTTYPE type;
+} sndoutput_t;
+
+static const sndoutput_t sndOutputs[] =
+{
+	{ "auto", FMOD_OUTPUTTYPE_AUTODETECT },
+	{ "nosound", FMOD_OUTPUTTYPE_NOSOUND },
+	{ "wasapi", FMOD_OUTPUTTYPE_WASAPI },
+	{ "asio", FMOD_OUTPUTTYPE_ASIO },
+	{ "alsa", FMOD_OUTPUTTYPE_ALSA },
+	{ "pulseaudio", FMOD_OUTPUTTYPE_PULSEAUDIO },
+	{ "coreaudio", FMOD_OUTPUTTYPE_COREAUDIO },
+};
+
+#define DEFAULT_DSP_BUFFERS		4
+#define MAX_DSP_BUFFERSIZE		8192
+
+static void SND_ReadConfig(void)
+{
+	static qboolean initialized = false;
+	const char *read_vars[] = { "snd_memory", "snd_output", "snd_dspbuffersize", "snd_dspbuffers", "snd_samplerate", "snd_virtualvol" };
+	const int num_readvars = sizeof(read_vars) / sizeof(read_vars[0]);
+
+	if (initialized)
+		return;
+	initialized = true;
+
+	if (CFG_OpenConfig("config.cfg") == 0)
+	{
+		CFG_ReadCvars(read_vars, num_readvars);
+		CFG_CloseConfig();
+	}
+	CFG_ReadCvarOverrides(read_vars, num_readvars);
+}
+
+static const char *SND_OutputName(FMOD_OUTPUTTYPE type)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(sndOutputs) / sizeof(sndOutputs[0])); i++)
+	{
+		if (sndOutputs[i].type == type)
+			return sndOutputs[i].name;
+	}
+	return "unknown";
+}
+
+static void SND_ConfigureOutput(void)
+{
+	FMOD_RESULT result;
+	unsigned int bufferlength;
+	int i, numbuffers, rate;
+
+	if (*snd_output.string && q_strcasecmp(snd_output.string, "auto"))
+	{
+		for (i = 0; i < (int)(sizeof(sndOutputs) / sizeof(sndOutputs[0])); i++)
+		{
+			if (!q_strcasecmp(snd_output.string, sndOutputs[i].name))
+				break;
+		}
+
+		if (i == (int)(sizeof(sndOutputs) / sizeof(sndOutputs[0])))
+		{
+			Con_Printf("Unknown snd_output \"%s\", using auto\n", snd_output.string);
+		}
+		else
+		{
+			result = FMOD_System_SetOutput(fmod_system, sndOutputs[i].type);
+			if (result != FMOD_OK)
+				Con_Printf("Couldn't select FMOD output %s: %s\n", sndOutputs[i].name, FMOD_ErrorString(result));
+		}
+	}
+
+	if (snd_dspbuffersize.value > 0 || snd_dspbuffers.value > 0)
+	{
+		FMOD_System_GetDSPBufferSize(fmod_system, &bufferlength, &numbuffers);
+		if (snd_dspbuffersize.value > 0)
+			bufferlength = CLAMP(64, (int)snd_dspbuffersize.value, MAX_DSP_BUFFERSIZE);
+		if (snd_dspbuffers.value > 0)
+			numbuffers = CLAMP(2, (int)snd_dspbuffers.value, 16);
+
+		result = FMOD_System_SetDSPBufferSize(fmod_system, bufferlength, numbuffers);
+		if (result != FMOD_OK)
+			Con_Printf("Couldn't set FMOD DSP buffer size: %s\n", FMOD_ErrorString(result));
+	}
+
+	rate = (int)snd_samplerate.value;
+	if (rate > 0)
+	{
+		rate = CLAMP(8000, rate, 192000);
+		result = FMOD_System_SetSoftwareFormat(fmod_system, rate, FMOD_SPEAKERMODE_DEFAULT, 0);
+		if (result != FMOD_OK)
+			Con_Printf("Couldn't set FMOD mixer rate to %d Hz: %s\n", rate, FMOD_ErrorString(result));
+	}
+}
+
+static void SND_PrintLatency(void)
+{
+	FMOD_OUTPUTTYPE output;
+	unsigned int bufferlength;
+	int numbuffers;
+
+	if (FMOD_System_GetOutput(fmod_system, &output) != FMOD_OK ||
+		FMOD_System_GetDSPBufferSize(fmod_system, &bufferlength, &numbuffers) != FMOD_OK || fmod_samplerate <= 0)
+	{
+		Con_Printf("FMOD output latency unavailable\n");
+		return;
+	}
+
+	// The mixer runs one block at a time and the output holds up to numbuffers of them, so a sound can be
+	// started up to a full ring later, on top of whatever the device itself adds
+	Con_Printf("FMOD %s output, %d Hz mixer, %u x %d sample DSP buffer: %.1f ms per block, %.1f ms buffered\n",
+		SND_OutputName(output), fmod_samplerate, bufferlength, numbuffers,
+		bufferlength * 1000.0 / fmod_samplerate, bufferlength * numbuffers * 1000.0 / fmod_samplerate);
+}
+
+/*
+====================
+SND_InitSystemTask
+
+Opens the output device, which can take a good part of a second with some drivers, so it runs on a task worker
+while the host carries on with video init. No console or cvars in here, S_FinishStartup reports the results.
+====================
+*/
+static task_t fmod_inittask;
+static qboolean fmod_initpending;
+static qboolean fmod_initretry;			// a specific snd_output was asked for, fall back to autodetect
+static FMOD_RESULT fmod_initresult;
+static FMOD_RESULT fmod_outputresult;	// result of the requested output when it had to fall back
+
+static void SND_InitSystemTask(void *data)
+{
+	fmod_outputresult = FMOD_OK;
+	fmod_initresult = FMOD_System_Init(fmod_system, MAX_CHANNELS, FMOD_INIT_VOL0_BECOMES_VIRTUAL, NULL);
+	if (fmod_initresult != FMOD_OK && fmod_initretry)
+	{
+		fmod_outputresult = fmod_initresult;
+		FMOD_System_SetOutput(fmod_system, FMOD_OUTPUTTYPE_AUTODETECT);
+		fmod_initresult = FMOD_System_Init(fmod_system, MAX_CHANNELS, FMOD_INIT_VOL0_BECOMES_VIRTUAL, NULL);
+	}
+}
+
 void S_Startup(void)
 {
+	FMOD_ADVANCEDSETTINGS advanced;
 	FMOD_RESULT result;
-	FMOD_SPEAKERMODE speakermode;
 	unsigned int version;
-	int driver, numchannels;
-	char name[1024];
+
+	SND_ReadConfig();
+	SND_InitMemory();
 
 	result = FMOD_System_Create(&fmod_system, FMOD_VERSION);
 	if (result != FMOD_OK)
@@ -101,13 +721,54 @@ void S_Startup(void)
 		return;
 	}
 
-	result = FMOD_System_Init(fmod_system, MAX_CHANNELS, FMOD_INIT_VOL0_BECOMES_VIRTUAL, NULL);
-	if (result != FMOD_OK)
+	if (snd_virtualvol.value > 0)
+	{
+		memset(&advanced, 0, sizeof(advanced));
+		advanced.cbSize = sizeof(advanced);
+		advanced.vol0virtualvol = snd_virtualvol.value;
+		result = FMOD_System_SetAdvancedSettings(fmod_system, &advanced);
+		if (result != FMOD_OK)
+			Con_Printf("Failed to set FMOD virtual voice volume: %s\n", FMOD_ErrorString(result));
+	}
+
+	SND_ConfigureOutput();
+
+	fmod_initretry = *snd_output.string && q_strcasecmp(snd_output.string, "auto");
+	fmod_initpending = true;
+	fmod_inittask = Task_Run(SND_InitSystemTask, NULL, NULL, 0);
+}
+
+/*
+====================
+S_FinishStartup
+
+Waits for the output device opened by S_Startup and sets up the rest of the sound system; until then sound_started
+stays false and nothing is played.
+====================
+*/
+void S_FinishStartup(void)
+{
+	FMOD_RESULT result;
+	FMOD_SPEAKERMODE speakermode;
+	unsigned int version;
+	int driver, numchannels, driverrate;
+	char name[1024];
+
+	if (!fmod_initpending)
+		return;
+	Task_Wait(fmod_inittask);
+	fmod_initpending = false;
+
+	if (fmod_outputresult != FMOD_OK)
+		Con_Printf("Failed to initialize FMOD %s output: %s, trying auto\n", snd_output.string, FMOD_ErrorString(fmod_outputresult));
+	if (fmod_initresult != FMOD_OK)
 	{
-		Con_Printf("Failed to initialize FMOD System: %s\n", FMOD_ErrorString(result));
+		Con_Printf("Failed to initialize FMOD System: %s\n", FMOD_ErrorString(fmod_initresult));
 		return;
 	}
 
+	FMOD_System_GetVersion(fmod_system, &version);
+
 	result = FMOD_System_GetDriver(fmod_system, &driver);
 	if (result != FMOD_OK)
 	{
@@ -115,15 +776,19 @@ void S_Startup(void)
 		return;
 	}
 
-	result = FMOD_System_GetDriverInfo(fmod_system, driver, name, sizeof(name), NULL, &fmod_samplerate, &speakermode, &numchannels);
+	result = FMOD_System_GetDriverInfo(fmod_system, driver, name, sizeof(name), NULL, &driverrate, &speakermode, &numchannels);
 	if (result != FMOD_OK)
 	{
 		Con_Printf("Failed to retrieve FMOD driver info: %s\n", FMOD_ErrorString(result));
 		return;
 	}
 
+	// The DSP clock runs at the mixer rate, which need not be the driver's
+	FMOD_System_GetSoftwareFormat(fmod_system, &fmod_samplerate, NULL, NULL);
+
 	Con_Printf("FMOD version %01x.%02x.%02x, driver '%s', %s speaker mode, %d Hz, %d channels\n",
-		(version >> 16) & 0xff, (version >> 8) & 0xff, version & 0xff, name, FMOD_SpeakerModeString(speakermode), fmod_samplerate, numchannels);
+		(version >> 16) & 0xff, (version >> 8) & 0xff, version & 0xff, name, FMOD_SpeakerModeString(speakermode), driverrate, numchannels);
+	SND_PrintLatency();
 
 	result = FMOD_System_CreateChannelGroup(fmod_system, "SFX", &sfx_channelGroup);
 	if (result != FMOD_OK)
@@ -137,10 +802,22 @@ void S_Startup(void)
 	FMOD_System_Set3DRolloffCallback(fmod_system, &SND_FMOD_Attenuation);
 
 	memset(entsounds, 0, sizeof(entsounds));
+	SND_InitSlotPool();
 	memset(sfxThisFrame, 0, sizeof(sfxThisFrame));
 	numSfxThisFrame = 0;
+	numDeferredSounds = 0;
+	numFailedLoads = 0;
+	numVoicesDropped = 0;
+	numVoicesStolen = 0;
+	numVoicesMuted = 0;
+	voice_budget = MAX_DYNAMIC_CHANNELS;
+	voice_budgettime = voice_ranktime = 0;
+	stats_lasttime = 0;
+
+	SND_StartUpdateThread();
 
 	sound_started = true;
+	S_StopAllSounds(true);
 }
 
 void S_Shutdown(void)
@@ -150,7 +827,20 @@ void S_Shutdown(void)
 
 	Con_DPrintf("[FMOD] Shutdown\n");
 
+	if (fmod_initpending)
+	{
+		Task_Wait(fmod_inittask);
+		fmod_initpending = false;
+	}
 	S_StopAllSounds(false);
+	SND_StopUpdateThread();
+	if (stats_log)
+	{
+		fclose(stats_log);
+		stats_log = NULL;
+	}
+	SND_FreeOcclusionGeometry();
+	SND_FreeReverb();
 
 	// Release all sounds that were loaded and attached to sfx_t's
 	for (i = 0; i < num_sfx; i++)
@@ -159,8 +849,26 @@ void S_Shutdown(void)
 
 		if (sfx->sound)
 		{
+			// Note: this will block until any pending background load has finished
 			FMOD_Sound_Release(sfx->sound);
 			sfx->sound = NULL;
+			sfx->pending = false;
+		}
+		SND_FreeLoadData(sfx);
+
+		if (sfx->view)
+		{
+			COM_UnmapFileView(sfx->view, sfx->viewlength);
+			sfx->view = NULL;
+			numMappedSamples--;
+		}
+
+		if (sfx->resampled)
+		{
+			numResampledSamples--;
+			resampledBytes -= sfx->resampled;
+			resampledSrcBytes -= sfx->resampledsrc;
+			sfx->resampled = sfx->resampledsrc = 0;
 		}
 	}
 
@@ -170,7 +878,8 @@ void S_Shutdown(void)
 		sfx_channelGroup = NULL;
 	}
 
-	FMOD_System_Close(fmod_system);
+	// Release rather than just close, so that snd_restart can create a new system
+	FMOD_System_Release(fmod_system);
 	fmod_system = NULL;
 }
 
@@ -242,9 +951,10 @@ static FMOD_RESULT F_CALL SND_FMOD_Callback(FMOD_CHANNELCONTROL *channelcontrol,
 	}
 
 	soundslot = (soundslot_t *)userdata;
-	if (soundslot->zone)
+	if (soundslot->pooled)
 	{
-		Z_Free(soundslot);
+		FMOD_Channel_SetUserData((FMOD_CHANNEL*)channelcontrol, NULL);
+		SND_FreeSoundSlot(soundslot);
 	}
 
 	return FMOD_OK;
@@ -269,17 +979,74 @@ static void SND_FMOD_SetChannelAttributes(FMOD_CHANNEL *channel, sfx_t *sfx, vec
 	}
 }
 
-static soundslot_t *SND_PickSoundSlot(int entnum, int entchannel)
-{
+/*
+=================
+Slot pool
+
+Pooled slots are returned from the channel callback, which runs on the update thread,
+so the free list is only touched with snd_lock held (when there is an update thread).
+=================
+*/
+static void SND_InitSlotPool(void)
+{
+	int i;
+
+	freeSlots = NULL;
+	for (i = MAX_POOLED_SLOTS - 1; i >= 0; i--)
+	{
+		slotPool[i].pooled = true;
+		slotPool[i].channel = NULL;
+		slotPool[i].next = freeSlots;
+		freeSlots = &slotPool[i];
+	}
+	numPoolExhausted = 0;
+}
+
+static soundslot_t *SND_AllocSoundSlot(void)
+{
+	soundslot_t *slot;
+
+	if (snd_lock)
+		SDL_LockMutex(snd_lock);
+	slot = freeSlots;
+	if (slot)
+		freeSlots = slot->next;
+	else
+		numPoolExhausted++;
+	if (snd_lock)
+		SDL_UnlockMutex(snd_lock);
+
+	if (slot)
+	{
+		slot->channel = NULL;
+		slot->next = NULL;
+	}
+	return slot;
+}
+
+static void SND_FreeSoundSlot(soundslot_t *slot)
+{
+	if (!slot->pooled)
+		return;
+
+	if (snd_lock)
+		SDL_LockMutex(snd_lock);
+	slot->channel = NULL;
+	slot->next = freeSlots;
+	freeSlots = slot;
+	if (snd_lock)
+		SDL_UnlockMutex(snd_lock);
+}
+
+static soundslot_t *SND_PickSoundSlot(int entnum, int entchannel)
+{
 	soundslot_t *slot;
 	unsigned long long dspclock;
 
 	if (entnum < 0 || entnum >= MAX_CHANNELS || entchannel == 0 || entchannel > 7)
 	{
-		// Just play on any free channel
-		slot = (soundslot_t*)Z_Malloc(sizeof(soundslot_t));
-		slot->zone = true;
-		return slot;
+		// Just play on any free channel, NULL if the pool has run dry
+		return SND_AllocSoundSlot();
 	}
 
 	// Local sound, use the first slot and override anything already playing
@@ -287,6 +1054,7 @@ static soundslot_t *SND_PickSoundSlot(int entnum, int entchannel)
 		entchannel = 0;
 
 	slot = &entsounds[entnum].slots[entchannel];
+	slot->tracking = false;
 	if (slot->channel)
 	{
 		// Stop any sound already playing on this slot
@@ -296,10 +1064,132 @@ static soundslot_t *SND_PickSoundSlot(int entnum, int entchannel)
 		slot->channel = NULL;
 	}
 
-	slot->zone = false;
+	slot->pooled = false;
 	return slot;
 }
 
+static void SND_SoundLoaded(sfx_t *s)
+{
+#if _DEBUG
+	FMOD_SOUND_TYPE type;
+	FMOD_SOUND_FORMAT format;
+	int channels, bits;
+#endif
+
+	FMOD_Sound_GetLength(s->sound, &s->length, FMOD_TIMEUNIT_MS);
+
+#if _DEBUG
+	FMOD_Sound_GetFormat(s->sound, &type, &format, &channels, &bits);
+	Con_DPrintf("[FMOD] Loaded sound '%s': type %d, format %d, %d channel(s), %d bits, %d ms, loopstart = %d\n", s->name, type, format, channels, bits, s->length, s->loopstart);
+#endif
+}
+
+static void SND_FreeLoadData(sfx_t *s)
+{
+	free(s->loaddata);
+	s->loaddata = NULL;
+}
+
+/*
+=================
+SND_GetSoundState
+
+Checks whether a sound's sample data is available for playback.
+Sounds that failed to load in the background are released, so that they may be retried later.
+=================
+*/
+static sfxstate_t SND_GetSoundState(sfx_t *s)
+{
+	FMOD_OPENSTATE openstate;
+	FMOD_RESULT result;
+
+	if (!s->sound)
+		return SFX_UNAVAILABLE;
+
+	if (!s->pending)
+		return SFX_READY;
+
+	result = FMOD_Sound_GetOpenState(s->sound, &openstate, NULL, NULL, NULL);
+	if (result == FMOD_OK && openstate == FMOD_OPENSTATE_LOADING)
+		return SFX_LOADING;
+
+	s->pending = false;
+	SND_FreeLoadData(s);
+
+	if (result != FMOD_OK || openstate == FMOD_OPENSTATE_ERROR)
+	{
+		Con_Printf("Failed to load FMOD sound %s: %s\n", s->name, FMOD_ErrorString(result));
+		FMOD_Sound_Release(s->sound);
+		s->sound = NULL;
+		numFailedLoads++;
+		return SFX_UNAVAILABLE;
+	}
+
+	SND_SoundLoaded(s);
+	return SFX_READY;
+}
+
+static sfxstate_t SND_WaitForSound(sfx_t *s)
+{
+	sfxstate_t state;
+
+	while ((state = SND_GetSoundState(s)) == SFX_LOADING)
+		Sys_Sleep(1);
+
+	return state;
+}
+
+/*
+=================
+Deferred sounds
+
+When a sound is started before its background load has completed, we hold on to it for a little while.
+Static sounds are kept until they become available, as they would otherwise go missing for the rest of the level.
+=================
+*/
+static void SND_CancelDeferredSounds(int entnum, int entchannel)
+{
+	deferredsound_t *ds;
+	int i, j;
+
+	for (i = 0, j = 0; i < numDeferredSounds; i++)
+	{
+		ds = &deferredSounds[i];
+		if (!ds->isstatic && ds->entnum == entnum && ds->entchannel == entchannel)
+			continue;
+
+		if (i != j)
+			deferredSounds[j] = *ds;
+		j++;
+	}
+
+	numDeferredSounds = j;
+}
+
+static void SND_DeferSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float vol, float attenuation, qboolean isstatic)
+{
+	deferredsound_t *ds;
+
+	if (!isstatic && entchannel != 0)
+		SND_CancelDeferredSounds(entnum, entchannel);
+
+	if (numDeferredSounds >= MAX_DEFERRED_SOUNDS)
+	{
+		Con_DPrintf("[FMOD] Too many deferred sounds, dropping %s\n", sfx->name);
+		return;
+	}
+
+	ds = &deferredSounds[numDeferredSounds++];
+	ds->sfx = sfx;
+	ds->entnum = entnum;
+	ds->entchannel = entchannel;
+	VectorCopy(origin, ds->origin);
+	ds->vol = vol;
+	ds->attenuation = attenuation;
+	ds->isstatic = isstatic;
+	ds->time = realtime;
+}
+
 /*
 ==============
 Ambient sounds
@@ -319,7 +1209,7 @@ static FMOD_CHANNEL *SND_StartAmbientSound(const char *samplename)
 		return NULL;
 
 	S_LoadSound(sfx);
-	if (!sfx->sound)
+	if (SND_WaitForSound(sfx) != SFX_READY)
 		return NULL;
 
 	result = FMOD_System_PlaySound(fmod_system, sfx->sound, sfx_channelGroup, 1, &channel);
@@ -391,165 +1281,1201 @@ static void S_UpdateAmbientSounds()
 
 /*
 =============
-Entity sounds
+PVS audibility
 
-These are your typical 3D sounds generated by entities in the world, including the player.
-Each entity has a number of preset voice channels, each of which can only play one sound at a time.
+Static sounds in leafs outside of the listener's PVS are paused until they come back into view,
+and entity sounds from such leafs aren't started at all. Leaf 0 (solid) always counts as audible.
 =============
 */
-void S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)	// Note: volume and attenuation are properly normalized here
+typedef struct staticsound_s
 {
-	int i;
-	FMOD_CHANNEL *channel;
-	FMOD_RESULT result;
-	soundslot_t *slot;
-	unsigned long long dspclock;
+	FMOD_CHANNEL *channel;	// NULL for a static played through another one's cluster
+	int leafnum;
+	qboolean paused;
+	sfx_t *sfx;	// for restarting it after snd_restart
+	vec3_t origin;
+	float vol, attenuation;
+	int cluster;	// static whose channel it plays through, its own index if it has a channel
+	int next;		// next member of the cluster, -1 at the end
+	int nummembers;	// on the cluster's first static, including itself
+	int active;		// on the cluster's first static, member the channel is placed at
+} staticsound_t;
+
+static staticsound_t staticSounds[MAX_POOLED_SLOTS];
+
+static qmodel_t *audibility_model = NULL;
+static mleaf_t *audibility_leaf = NULL;
+static byte *audibility_pvs = NULL;
+static int audibility_pvsbytes;
+
+static int SND_PointLeafnum(vec3_t origin)
+{
+	if (!cl.worldmodel || !cl.worldmodel->nodes)
+		return -1;
 
-	if (!fmod_system || !sfx)
-		return;
+	return (int)(Mod_PointInLeaf(origin, cl.worldmodel) - cl.worldmodel->leafs) - 1;
+}
 
-	if (nosound.value)
-		return;
+static qboolean SND_LeafAudible(int leafnum)
+{
+	if (leafnum < 0 || !audibility_model || audibility_model != cl.worldmodel)
+		return true;
 
-	S_LoadSound(sfx);
-	if (!sfx->sound)
+	return (audibility_pvs[leafnum >> 3] & (1 << (leafnum & 7))) != 0;
+}
+
+static void SND_SetStaticPaused(staticsound_t *ss, qboolean paused)
+{
+	if (ss->paused == paused || !ss->channel)
 		return;
 
-	// Choose a slot to play the sound on, and stop any conflicting sound on the same entchannel
-	// Do this before playing the new sound, so that any previous sound will be stopped in time
-	slot = SND_PickSoundSlot(entnum, entchannel);
+	FMOD_Channel_SetPaused(ss->channel, paused);
+	ss->paused = paused;
+	numStaticPaused += paused ? 1 : -1;
+}
 
-	result = FMOD_System_PlaySound(fmod_system, sfx->sound, sfx_channelGroup, 1, &channel);
-	if (result != FMOD_OK)
+static void SND_UpdateAudibility(void)
+{
+	qmodel_t *mod;
+	mleaf_t *leaf;
+	byte *pvs;
+	int i;
+
+	if (snd_pvscull.value && cls.state == ca_connected && cl.worldmodel && cl.worldmodel->nodes)
+		mod = cl.worldmodel;
+	else
+		mod = NULL;
+
+	if (!mod)
 	{
-		Con_Printf("Failed to play FMOD sound: %s\n", FMOD_ErrorString(result));
+		audibility_model = NULL;
+		audibility_leaf = NULL;
+		for (i = 0; i < numStaticSounds; i++)
+		{
+			if (staticSounds[i].nummembers < 2)
+				SND_SetStaticPaused(&staticSounds[i], false);
+		}
 		return;
 	}
 
-	SND_FMOD_SetChannelAttributes(channel, sfx, origin, fvol);
-
-	// Set up callback data for rolloff and cleanup
-	slot->channel = channel;
-	slot->dist_mult = attenuation / sound_nominal_clip_dist;
-	FMOD_Channel_SetUserData(channel, slot);
-	FMOD_Channel_SetCallback(channel, &SND_FMOD_Callback);
+	leaf = Mod_PointInLeaf(listener_origin, mod);
+	if (mod == audibility_model && leaf == audibility_leaf)
+		return;
 
-	// Anything coming from the view entity will always be full volume, and entchannel -1 is used for local sounds (e.g. menu sounds)
-	if (entchannel < 0 || entnum == cl.viewentity)
+	// Keep a copy, the decompression buffer is shared with the renderer
+	pvs = Mod_LeafPVS(leaf, mod);
+	if ((mod->numleafs + 7) >> 3 > audibility_pvsbytes)
 	{
-		FMOD_Channel_Set3DLevel(channel, 0.0f);
-		FMOD_Channel_SetPriority(channel, 64);	// Ensure local sounds always get priority over other entities
+		audibility_pvsbytes = (mod->numleafs + 7) >> 3;
+		audibility_pvs = (byte *) realloc(audibility_pvs, audibility_pvsbytes);
+		if (!audibility_pvs)
+			Sys_Error("SND_UpdateAudibility: realloc() failed on %d bytes", audibility_pvsbytes);
 	}
-	
-	for (i = 0; i < numSfxThisFrame; i++)
+	memcpy(audibility_pvs, pvs, (mod->numleafs + 7) >> 3);
+	audibility_model = mod;
+	audibility_leaf = leaf;
+
+	// Clusters are paused by SND_UpdateStaticClusters once none of their members are audible
+	for (i = 0; i < numStaticSounds; i++)
 	{
-		// if an identical sound has also been started this frame, offset the pos
-		// a bit to keep it from just making the first one louder
-		if (sfxThisFrame[i] == sfx)
-		{
-			FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
-			FMOD_Channel_SetDelay(channel, dspclock + SND_GetDelay(sfx, 0.1f), 0, 0);
-			break;
-		}
+		if (staticSounds[i].nummembers < 2)
+			SND_SetStaticPaused(&staticSounds[i], !SND_LeafAudible(staticSounds[i].leafnum));
 	}
-
-	if (numSfxThisFrame < 16)
-		sfxThisFrame[numSfxThisFrame++] = sfx;
-
-	FMOD_Channel_SetPaused(channel, 0);
 }
 
 /*
 =============
-Static sounds
+Reverb zones
 
-These are sounds that have a fixed position in the world and loop continuously.
-They typically start playing immediately on level load.
+Every leaf is classified into a reverb zone once per map, from its contents, whether it can see the sky
+and a rough estimate of the room size from its bounds. As the listener moves between zones, the properties
+of FMOD's single global reverb are crossfaded towards the new zone's preset, and being underwater also fades
+in a lowpass filter on the SFX group. The cost doesn't depend on the number of channels playing.
 =============
 */
-void S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)	// Note: volume and attenuation are in 0-255 range here
+#define REVERB_FADE_TIME		0.5		// seconds
+#define REVERB_SMALL_SIZE		192.0f	// cube root of the leaf volume
+#define REVERB_LARGE_SIZE		512.0f
+#define LOWPASS_OPEN			22000.0f
+#define LOWPASS_UNDERWATER		1200.0f
+
+typedef enum
 {
-	FMOD_CHANNEL *channel;
-	FMOD_RESULT result;
-	soundslot_t *slot;
-	unsigned long long dspclock;
+	REVERB_OUTDOORS,
+	REVERB_SMALL,
+	REVERB_MEDIUM,
+	REVERB_LARGE,
+	REVERB_UNDERWATER,
+	NUM_REVERB_ZONES
+} reverbzone_t;
+
+static const FMOD_REVERB_PROPERTIES reverbPresets[NUM_REVERB_ZONES] =
+{
+	FMOD_PRESET_PLAIN,
+	FMOD_PRESET_ROOM,
+	FMOD_PRESET_STONEROOM,
+	FMOD_PRESET_CAVE,
+	FMOD_PRESET_UNDERWATER,
+};
+static const FMOD_REVERB_PROPERTIES reverbOff = FMOD_PRESET_OFF;
+
+static qmodel_t *reverb_model = NULL;
+static byte *reverb_leafzones = NULL;
+static int reverb_leafcapacity;
+static FMOD_REVERB_PROPERTIES reverb_current;
+static float lowpass_current;
+static FMOD_DSP *lowpass_dsp = NULL;
+static qboolean reverb_active;
+
+static reverbzone_t SND_ClassifyLeaf(mleaf_t *leaf)
+{
+	float size;
 
-	if (!fmod_system || !sfx)
-		return;
+	if (leaf->contents == CONTENTS_WATER || leaf->contents == CONTENTS_SLIME || leaf->contents == CONTENTS_LAVA)
+		return REVERB_UNDERWATER;
 
-	S_LoadSound(sfx);
-	if (!sfx->sound)
-		return;
+	if (leaf->ambient_sound_level[AMBIENT_SKY])
+		return REVERB_OUTDOORS;
 
-	if (sfx->loopstart < 0)
+	size = (leaf->minmaxs[3] - leaf->minmaxs[0]) * (leaf->minmaxs[4] - leaf->minmaxs[1]) * (leaf->minmaxs[5] - leaf->minmaxs[2]);
+	size = pow(q_max(size, 0.0f), 1.0 / 3.0);
+	if (size < REVERB_SMALL_SIZE)
+		return REVERB_SMALL;
+	if (size < REVERB_LARGE_SIZE)
+		return REVERB_MEDIUM;
+	return REVERB_LARGE;
+}
+
+static void SND_BuildReverbZones(qmodel_t *mod)
+{
+	int i;
+
+	if (mod->numleafs + 1 > reverb_leafcapacity)
 	{
-		Con_Printf("Sound %s not looped\n", sfx->name);
-		return;
+		reverb_leafcapacity = mod->numleafs + 1;
+		reverb_leafzones = (byte *) realloc(reverb_leafzones, reverb_leafcapacity);
+		if (!reverb_leafzones)
+			Sys_Error("SND_BuildReverbZones: realloc() failed on %d bytes", reverb_leafcapacity);
 	}
 
-	result = FMOD_System_PlaySound(fmod_system, sfx->sound, sfx_channelGroup, 1, &channel);
-	if (result != FMOD_OK)
+	for (i = 0; i <= mod->numleafs; i++)
+		reverb_leafzones[i] = SND_ClassifyLeaf(&mod->leafs[i]);
+
+	reverb_model = mod;
+}
+
+static void SND_FreeReverb(void)
+{
+	if (lowpass_dsp)
 	{
-		Con_Printf("Failed to play static FMOD sound: %s\n", FMOD_ErrorString(result));
-		return;
+		FMOD_ChannelGroup_RemoveDSP(sfx_channelGroup, lowpass_dsp);
+		FMOD_DSP_Release(lowpass_dsp);
+		lowpass_dsp = NULL;
 	}
+	reverb_model = NULL;
+	reverb_active = false;
+}
 
-	SND_FMOD_SetChannelAttributes(channel, sfx, origin, vol / 255);
+static void SND_UpdateReverb(void)
+{
+	const FMOD_REVERB_PROPERTIES *target;
+	float *cur, lowpass, frac;
+	const float *to;
+	qboolean done;
+	mleaf_t *leaf;
+	int i;
 
-	// Set up attenuation info for use by the rolloff callback
-	slot = SND_PickSoundSlot(-1, -1);
-	slot->channel = channel;
-	slot->dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
-	FMOD_Channel_SetUserData(channel, slot);
-	FMOD_Channel_SetCallback(channel, &SND_FMOD_Callback);
+	if (snd_reverb.value && cls.state == ca_connected && cl.worldmodel && cl.worldmodel->nodes)
+	{
+		if (cl.worldmodel != reverb_model)
+			SND_BuildReverbZones(cl.worldmodel);
 
-	// Add a random delay so that similar sounds don't phase together
-	// Note: this isn't really authentic to the original Quake sound system, but it does improve the sense of directionality
-	FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
-	FMOD_Channel_SetDelay(channel, dspclock + SND_GetDelay(sfx, 0.2f), 0, 0);
+		if (!reverb_active)
+		{
+			reverb_current = reverbOff;
+			lowpass_current = LOWPASS_OPEN;
+			reverb_active = true;
+		}
 
-	FMOD_Channel_SetPaused(channel, 0);
+		if (!lowpass_dsp && FMOD_System_CreateDSPByType(fmod_system, FMOD_DSP_TYPE_LOWPASS_SIMPLE, &lowpass_dsp) == FMOD_OK)
+		{
+			FMOD_DSP_SetParameterFloat(lowpass_dsp, FMOD_DSP_LOWPASS_SIMPLE_CUTOFF, lowpass_current);
+			FMOD_ChannelGroup_AddDSP(sfx_channelGroup, 0, lowpass_dsp);
+		}
+
+		leaf = Mod_PointInLeaf(listener_origin, cl.worldmodel);
+		i = reverb_leafzones[leaf - cl.worldmodel->leafs];
+		target = &reverbPresets[i];
+		lowpass = (i == REVERB_UNDERWATER) ? LOWPASS_UNDERWATER : LOWPASS_OPEN;
+	}
+	else if (reverb_active)
+	{
+		// Fade back out before switching off
+		target = &reverbOff;
+		lowpass = LOWPASS_OPEN;
+	}
+	else
+	{
+		return;
+	}
+
+	frac = CLAMP(0.0f, host_frametime / REVERB_FADE_TIME, 1.0f);
+
+	done = true;
+	cur = (float *)&reverb_current;
+	to = (const float *)target;
+	for (i = 0; i < (int)(sizeof(FMOD_REVERB_PROPERTIES) / sizeof(float)); i++)
+	{
+		if (cur[i] == to[i])
+			continue;
+		cur[i] += (to[i] - cur[i]) * frac;
+		if (fabs(to[i] - cur[i]) < 0.01f)
+			cur[i] = to[i];
+		done = false;
+	}
+	if (!done)
+		FMOD_System_SetReverbProperties(fmod_system, 0, &reverb_current);
+
+	if (lowpass_current != lowpass)
+	{
+		lowpass_current += (lowpass - lowpass_current) * frac;
+		if (fabs(lowpass - lowpass_current) < 1.0f)
+			lowpass_current = lowpass;
+		done = false;
+		if (lowpass_dsp)
+			FMOD_DSP_SetParameterFloat(lowpass_dsp, FMOD_DSP_LOWPASS_SIMPLE_CUTOFF, lowpass_current);
+	}
 
-	// Note: we can forget about the channel we just created, because all SFX channels will be stopped and released on level change through S_StopAllSounds
+	if (done && target == &reverbOff)
+		SND_FreeReverb();
 }
 
-void S_StopSound(int entnum, int entchannel)
+/*
+=============
+Occlusion geometry
+
+With snd_occlusion enabled, the larger world surfaces are handed to FMOD as occluding polygons once per map.
+FMOD then traces sounds against them itself as part of System_Update, on the update thread.
+Sky and liquid surfaces are left out, and the polygon count is capped by keeping only the largest surfaces.
+=============
+*/
+#define MAX_OCCLUSION_POLYS		8192
+#define MAX_OCCLUSION_VERTS		64		// per polygon
+#define OCCLUSION_MIN_AREA		1024.0f	// smaller surfaces hardly block anything
+#define OCCLUSION_DIRECT		0.5f	// per surface, a wall being two of them
+
+typedef struct occlusionsurf_s
 {
-	soundslot_t *slot;
-	unsigned long long dspclock;
+	msurface_t *surf;
+	float area;
+} occlusionsurf_t;
 
-	if (!fmod_system)
-		return;
+static FMOD_GEOMETRY *occlusion_geometry = NULL;
+static qmodel_t *occlusion_model = NULL;
+static int occlusion_numpolys;
 
-	if (entnum < 0 || entnum >= MAX_CHANNELS || entchannel < 0 || entchannel > 7)
-		return;
+static int SND_GetSurfaceVerts(qmodel_t *mod, msurface_t *surf, FMOD_VECTOR *verts)
+{
+	int i, lindex;
+	float *vec;
 
-	slot = &entsounds[entnum].slots[entchannel];
-	if (slot->channel)
+	if (surf->numedges > MAX_OCCLUSION_VERTS)
+		return 0;
+
+	for (i = 0; i < surf->numedges; i++)
 	{
-		// Instead of immediately stopping the sound, we fade it down to 0 volume over several samples and let it play out
-		// This prevents an annoying popping noise, which is especially noticeable on rapid-fire weapons
-		FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
-		FMOD_Channel_SetFadePointRamp(slot->channel, dspclock + 64, 0.0f);
-		FMOD_Channel_SetMode(slot->channel, FMOD_LOOP_OFF);
-		slot->channel = NULL;
+		lindex = mod->surfedges[surf->firstedge + i];
+		if (lindex > 0)
+			vec = mod->vertexes[mod->edges[lindex].v[0]].position;
+		else
+			vec = mod->vertexes[mod->edges[-lindex].v[1]].position;
+		verts[i].x = vec[0];
+		verts[i].y = vec[2];
+		verts[i].z = vec[1];
 	}
+
+	return surf->numedges;
 }
 
-void S_StopAllSounds(qboolean clear)
+static float SND_SurfaceArea(qmodel_t *mod, msurface_t *surf)
 {
-	if (!fmod_system)
-		return;
+	FMOD_VECTOR verts[MAX_OCCLUSION_VERTS];
+	vec3_t v0, v1, v2, e1, e2, cross, sum;
+	int i, numverts;
 
-	// Stopping all sounds also ensures that any associated zone memory is freed
-	FMOD_ChannelGroup_Stop(sfx_channelGroup);
+	numverts = SND_GetSurfaceVerts(mod, surf, verts);
+	if (numverts < 3)
+		return 0.0f;
 
-	if (clear)	// We're abusing the clear flag to also mean "keep ambients alive"
+	sum[0] = sum[1] = sum[2] = 0.0f;
+	v0[0] = verts[0].x; v0[1] = verts[0].y; v0[2] = verts[0].z;
+	for (i = 1; i < numverts - 1; i++)
 	{
-		S_ClearBuffer();
-
-		// Ambient sounds need to be restarted, as they are always "playing"
-		SND_StartAmbientSounds();
+		v1[0] = verts[i].x; v1[1] = verts[i].y; v1[2] = verts[i].z;
+		v2[0] = verts[i+1].x; v2[1] = verts[i+1].y; v2[2] = verts[i+1].z;
+		VectorSubtract(v1, v0, e1);
+		VectorSubtract(v2, v0, e2);
+		CrossProduct(e1, e2, cross);
+		VectorAdd(sum, cross, sum);
+	}
+
+	return 0.5f * VectorLength(sum);
+}
+
+static int SND_CompareOcclusionSurfs(const void *a, const void *b)
+{
+	float areaA = ((const occlusionsurf_t *)a)->area;
+	float areaB = ((const occlusionsurf_t *)b)->area;
+
+	return (areaA < areaB) - (areaA > areaB);	// largest first
+}
+
+static void SND_FreeOcclusionGeometry(void)
+{
+	if (occlusion_geometry)
+	{
+		FMOD_Geometry_Release(occlusion_geometry);
+		occlusion_geometry = NULL;
+	}
+	occlusion_model = NULL;
+	occlusion_numpolys = 0;
+}
+
+static void SND_BuildOcclusionGeometry(qmodel_t *mod)
+{
+	FMOD_VECTOR verts[MAX_OCCLUSION_VERTS];
+	FMOD_RESULT result;
+	occlusionsurf_t *surfs;
+	msurface_t *surf;
+	float worldsize;
+	int i, numsurfs, numverts;
+	double time1;
+
+	SND_FreeOcclusionGeometry();
+	occlusion_model = mod;
+
+	time1 = Sys_DoubleTime();
+
+	surfs = (occlusionsurf_t *) malloc(mod->nummodelsurfaces * sizeof(occlusionsurf_t));
+	if (!surfs)
+		return;
+
+	numsurfs = 0;
+	numverts = 0;
+	for (i = 0, surf = mod->surfaces + mod->firstmodelsurface; i < mod->nummodelsurfaces; i++, surf++)
+	{
+		if (surf->flags & (SURF_DRAWSKY | SURF_DRAWTURB))
+			continue;
+
+		surfs[numsurfs].surf = surf;
+		surfs[numsurfs].area = SND_SurfaceArea(mod, surf);
+		if (surfs[numsurfs].area < OCCLUSION_MIN_AREA)
+			continue;
+
+		numsurfs++;
+	}
+
+	if (numsurfs > MAX_OCCLUSION_POLYS)
+	{
+		qsort(surfs, numsurfs, sizeof(occlusionsurf_t), SND_CompareOcclusionSurfs);
+		numsurfs = MAX_OCCLUSION_POLYS;
+	}
+
+	for (i = 0; i < numsurfs; i++)
+		numverts += surfs[i].surf->numedges;
+
+	if (!numsurfs)
+	{
+		free(surfs);
+		return;
+	}
+
+	// FMOD wants the distance from the origin to the edge of the world
+	worldsize = 0.0f;
+	for (i = 0; i < 3; i++)
+	{
+		worldsize = q_max(worldsize, fabs(mod->mins[i]));
+		worldsize = q_max(worldsize, fabs(mod->maxs[i]));
+	}
+	FMOD_System_SetGeometrySettings(fmod_system, worldsize);
+
+	result = FMOD_System_CreateGeometry(fmod_system, numsurfs, numverts, &occlusion_geometry);
+	if (result != FMOD_OK)
+	{
+		Con_Printf("Failed to create FMOD occlusion geometry: %s\n", FMOD_ErrorString(result));
+		occlusion_geometry = NULL;
+		free(surfs);
+		return;
+	}
+
+	for (i = 0; i < numsurfs; i++)
+	{
+		numverts = SND_GetSurfaceVerts(mod, surfs[i].surf, verts);
+		if (FMOD_Geometry_AddPolygon(occlusion_geometry, OCCLUSION_DIRECT, 0.0f, 1, numverts, verts, NULL) == FMOD_OK)
+			occlusion_numpolys++;
+	}
+
+	free(surfs);
+
+	Con_DPrintf("[FMOD] %d occlusion polygons in %.1f ms\n", occlusion_numpolys, (Sys_DoubleTime() - time1) * 1000.0);
+}
+
+static void SND_UpdateOcclusionGeometry(void)
+{
+	qmodel_t *mod;
+
+	mod = (snd_occlusion.value && cls.state == ca_connected) ? cl.worldmodel : NULL;
+	if (mod && mod->type != mod_brush)
+		mod = NULL;
+
+	if (mod == occlusion_model)
+		return;
+
+	if (mod)
+		SND_BuildOcclusionGeometry(mod);
+	else
+		SND_FreeOcclusionGeometry();
+}
+
+/*
+=============
+Voice limiting
+
+Large fights can start the same sample dozens of times over, filling up the software voices with inaudible duplicates.
+Entity sounds are capped at snd_maxinstances channels per sfx; once that is reached, either the oldest instance
+or the quietest one (if the new sound is louder than it) gets cut off.
+=============
+*/
+static qboolean SND_LimitInstances(sfx_t *sfx, float audible)
+{
+	FMOD_BOOL playing;
+	float audibility, lowest;
+	unsigned long long dspclock;
+	int i, j, max, victim;
+
+	max = q_min((int)snd_maxinstances.value, MAX_SFX_INSTANCES);
+	if (max <= 0)
+		return true;
+
+	// Forget about instances that have finished playing or were stolen by FMOD
+	for (i = j = 0; i < sfx->numinstances; i++)
+	{
+		if (FMOD_Channel_IsPlaying(sfx->instances[i], &playing) != FMOD_OK || !playing)
+			continue;
+
+		sfx->instances[j] = sfx->instances[i];
+		sfx->instancetime[j] = sfx->instancetime[i];
+		j++;
+	}
+	sfx->numinstances = j;
+
+	if (sfx->numinstances < max)
+		return true;
+
+	victim = 0;
+	if (snd_voicesteal.value)
+	{
+		lowest = 1.0f;
+		for (i = 0; i < sfx->numinstances; i++)
+		{
+			if (FMOD_Channel_GetAudibility(sfx->instances[i], &audibility) != FMOD_OK)
+				audibility = 0.0f;
+			if (audibility < lowest)
+			{
+				lowest = audibility;
+				victim = i;
+			}
+		}
+
+		// Audibility includes the SFX group volume
+		if (audible * sfxvolume.value <= lowest)
+		{
+			numVoicesDropped++;
+			return false;
+		}
+	}
+	else
+	{
+		for (i = 1; i < sfx->numinstances; i++)
+		{
+			if (sfx->instancetime[i] < sfx->instancetime[victim])
+				victim = i;
+		}
+	}
+
+	// Quickly fade out and stop the victim, to prevent a popping noise
+	FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
+	FMOD_Channel_SetFadePointRamp(sfx->instances[victim], dspclock + 64, 0.0f);
+	FMOD_Channel_SetDelay(sfx->instances[victim], 0, dspclock + 64, 1);
+	numVoicesStolen++;
+
+	sfx->numinstances--;
+	sfx->instances[victim] = sfx->instances[sfx->numinstances];
+	sfx->instancetime[victim] = sfx->instancetime[sfx->numinstances];
+	return true;
+}
+
+static void SND_AddInstance(sfx_t *sfx, FMOD_CHANNEL *channel)
+{
+	if (snd_maxinstances.value <= 0 || sfx->numinstances >= MAX_SFX_INSTANCES)
+		return;
+
+	sfx->instances[sfx->numinstances] = channel;
+	sfx->instancetime[sfx->numinstances] = realtime;
+	sfx->numinstances++;
+}
+
+/*
+=============
+Voice budget
+
+With snd_voicebudget set to a target FMOD dsp percentage, the number of voices that get mixed is adjusted every
+half second to hold the mixer near it: cut by an eighth while over the target, and grown again while well under.
+Ten times a second, the unpaused channels are ranked by priority and by their volume under Quake's rolloff, and
+those past the budget are muted, which FMOD_INIT_VOL0_BECOMES_VIRTUAL turns into virtual voices that keep playing
+silently at no mixing cost. They are unmuted once they rank within the budget again. Channels more important than
+the default priority, like the player's own sounds, are never muted. snd_virtualvol additionally sets FMOD's own
+threshold below which a voice goes virtual, which can only be given before the system is initialized.
+=============
+*/
+#define VOICEBUDGET_MIN			16	// never mix fewer voices than this
+#define VOICEBUDGET_INTERVAL	0.5	// seconds between budget adjustments
+#define VOICEBUDGET_RANK		0.1	// seconds between rankings
+
+typedef struct
+{
+	FMOD_CHANNEL *channel;
+	int priority;
+	float audible;
+} budgetvoice_t;
+
+static budgetvoice_t budget_voices[MAX_CHANNELS];
+
+static int SND_CompareBudgetVoices(const void *a, const void *b)
+{
+	const budgetvoice_t *va = (const budgetvoice_t *)a;
+	const budgetvoice_t *vb = (const budgetvoice_t *)b;
+
+	// A lower priority value is more important
+	if (va->priority != vb->priority)
+		return va->priority - vb->priority;
+	return (va->audible < vb->audible) - (va->audible > vb->audible);
+}
+
+static float SND_EstimateAudible(FMOD_CHANNEL *channel, const FMOD_VECTOR *listener)
+{
+	FMOD_VECTOR position;
+	void *userdata;
+	float volume, dx, dy, dz, scale;
+
+	if (FMOD_Channel_GetVolume(channel, &volume) != FMOD_OK)
+		return 0.0f;
+
+	// Channels without a slot have no rolloff, see SND_FMOD_Attenuation
+	if (FMOD_Channel_GetUserData(channel, &userdata) != FMOD_OK || !userdata ||
+		FMOD_Channel_Get3DAttributes(channel, &position, NULL) != FMOD_OK)
+		return volume;
+
+	dx = position.x - listener->x;
+	dy = position.y - listener->y;
+	dz = position.z - listener->z;
+	scale = 1.0f - sqrt(dx * dx + dy * dy + dz * dz) * ((soundslot_t *)userdata)->dist_mult;
+	return volume * q_max(scale, 0.0f);
+}
+
+static void SND_UpdateVoiceBudget(void)
+{
+	FMOD_CPU_USAGE usage;
+	FMOD_CHANNEL *channel;
+	FMOD_VECTOR listener;
+	FMOD_BOOL paused;
+	budgetvoice_t *v;
+	qboolean mute;
+	int i, n, numchannels, step;
+
+	if (snd_voicebudget.value <= 0)
+	{
+		voice_budget = MAX_DYNAMIC_CHANNELS;
+	}
+	else if (realtime - voice_budgettime >= VOICEBUDGET_INTERVAL || realtime < voice_budgettime)
+	{
+		voice_budgettime = realtime;
+		if (FMOD_System_GetCPUUsage(fmod_system, &usage) == FMOD_OK)
+		{
+			step = q_max(voice_budget / 8, 1);
+			if (usage.dsp > snd_voicebudget.value)
+				voice_budget -= step;
+			else if (usage.dsp < snd_voicebudget.value * 0.75f)
+				voice_budget += step;
+			voice_budget = CLAMP(VOICEBUDGET_MIN, voice_budget, MAX_DYNAMIC_CHANNELS);
+		}
+	}
+
+	// Nothing to do until the budget is below what FMOD mixes anyway, or to undo
+	if (voice_budget >= MAX_DYNAMIC_CHANNELS && !numVoicesMuted)
+		return;
+	if (realtime - voice_ranktime < VOICEBUDGET_RANK && realtime >= voice_ranktime)
+		return;
+	voice_ranktime = realtime;
+
+	if (FMOD_ChannelGroup_GetNumChannels(sfx_channelGroup, &numchannels) != FMOD_OK)
+		return;
+
+	FMOD_VectorCopy(listener_origin, listener);
+	for (i = n = 0; i < numchannels && n < MAX_CHANNELS; i++)
+	{
+		if (FMOD_ChannelGroup_GetChannel(sfx_channelGroup, i, &channel) != FMOD_OK)
+			continue;
+		if (FMOD_Channel_GetPaused(channel, &paused) == FMOD_OK && paused)
+			continue;
+
+		v = &budget_voices[n++];
+		v->channel = channel;
+		if (FMOD_Channel_GetPriority(channel, &v->priority) != FMOD_OK)
+			v->priority = 128;
+		v->audible = SND_EstimateAudible(channel, &listener);
+	}
+
+	qsort(budget_voices, n, sizeof(budgetvoice_t), SND_CompareBudgetVoices);
+
+	numVoicesMuted = 0;
+	for (i = 0; i < n; i++)
+	{
+		mute = i >= voice_budget && budget_voices[i].priority >= 128;
+		FMOD_Channel_SetMute(budget_voices[i].channel, mute);
+		if (mute)
+			numVoicesMuted++;
+	}
+}
+
+/*
+=============
+Entity sounds
+
+These are your typical 3D sounds generated by entities in the world, including the player.
+Each entity has a number of preset voice channels, each of which can only play one sound at a time.
+=============
+*/
+static void SND_StartEntitySound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)
+{
+	int i;
+	FMOD_CHANNEL *channel;
+	FMOD_RESULT result;
+	soundslot_t *slot;
+	unsigned long long dspclock;
+	qboolean local;
+	float audible;
+	vec3_t dir;
+
+	// Choose a slot to play the sound on, and stop any conflicting sound on the same entchannel
+	// Do this before playing the new sound, so that any previous sound will be stopped in time
+	slot = SND_PickSoundSlot(entnum, entchannel);
+	if (!slot)
+		return;
+
+	// Like the original mixer, don't bother starting sounds that are out of earshot, using the same rolloff as SND_FMOD_Attenuation
+	local = entchannel < 0 || entnum == cl.viewentity;
+	audible = fvol;
+	if (!local)
+	{
+		VectorSubtract(origin, listener_origin, dir);
+		audible *= 1.0f - VectorLength(dir) * (attenuation / sound_nominal_clip_dist);
+		if (audible <= 0.0f || !SND_LeafAudible(SND_PointLeafnum(origin)))
+		{
+			numVoicesDropped++;
+			SND_FreeSoundSlot(slot);
+			return;
+		}
+	}
+
+	if (!SND_LimitInstances(sfx, audible))
+	{
+		SND_FreeSoundSlot(slot);
+		return;
+	}
+
+	result = FMOD_System_PlaySound(fmod_system, sfx->sound, sfx_channelGroup, 1, &channel);
+	if (result != FMOD_OK)
+	{
+		Con_Printf("Failed to play FMOD sound: %s\n", FMOD_ErrorString(result));
+		SND_FreeSoundSlot(slot);
+		return;
+	}
+
+	SND_AddInstance(sfx, channel);
+
+	SND_FMOD_SetChannelAttributes(channel, sfx, origin, fvol);
+
+	// Set up callback data for rolloff and cleanup
+	slot->channel = channel;
+	slot->dist_mult = attenuation / sound_nominal_clip_dist;
+	FMOD_Channel_SetUserData(channel, slot);
+	FMOD_Channel_SetCallback(channel, &SND_FMOD_Callback);
+
+	// Entity channel 1-7 sounds keep following the entity that made them
+	if (!slot->pooled && !local && entnum > 0 && entnum < cl.num_entities && cl_entities[entnum].model)
+	{
+		slot->tracking = true;
+		slot->moving = false;
+		VectorSubtract(origin, cl_entities[entnum].origin, slot->offset);
+		VectorCopy(origin, slot->position);
+		slot->movetime = cl.time;
+	}
+
+	// Anything coming from the view entity will always be full volume, and entchannel -1 is used for local sounds (e.g. menu sounds)
+	if (local)
+	{
+		FMOD_Channel_SetMode(channel, FMOD_3D_IGNOREGEOMETRY);
+		if (entchannel < 0)
+			FMOD_Channel_SetReverbProperties(channel, 0, 0.0f);	// menu sounds stay dry
+		FMOD_Channel_Set3DLevel(channel, 0.0f);
+		FMOD_Channel_SetPriority(channel, 64);	// Ensure local sounds always get priority over other entities
+	}
+	
+	for (i = 0; i < numSfxThisFrame; i++)
+	{
+		// if an identical sound has also been started this frame, offset the pos
+		// a bit to keep it from just making the first one louder
+		if (sfxThisFrame[i] == sfx)
+		{
+			FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
+			FMOD_Channel_SetDelay(channel, dspclock + SND_GetDelay(sfx, 0.1f), 0, 0);
+			break;
+		}
+	}
+
+	if (numSfxThisFrame < 16)
+		sfxThisFrame[numSfxThisFrame++] = sfx;
+
+	FMOD_Channel_SetPaused(channel, 0);
+}
+
+/*
+=============
+SND_UpdateEmitters
+
+Moves entity sounds along with their entities, once a frame. Only the ones whose entity has moved
+more than EMITTER_MOVE_DIST since FMOD was last told are updated, with a velocity for doppler.
+Entities missing from the last server message leave their sounds where they were.
+=============
+*/
+static void SND_UpdateEmitters(void)
+{
+	entity_t *ent;
+	soundslot_t *slot;
+	vec3_t position, delta, velocity;
+	FMOD_VECTOR fmod_pos, fmod_vel;
+	FMOD_BOOL playing;
+	qboolean moved;
+	double dt;
+	int e, c, numents;
+
+	if (cls.state != ca_connected)
+		return;
+
+	numents = q_min(cl.num_entities, MAX_CHANNELS);
+	for (e = 1; e < numents; e++)
+	{
+		ent = &cl_entities[e];
+		for (c = 1; c < 8; c++)
+		{
+			slot = &entsounds[e].slots[c];
+			if (!slot->tracking)
+				continue;
+			if (FMOD_Channel_IsPlaying(slot->channel, &playing) != FMOD_OK || !playing)
+			{
+				slot->tracking = false;
+				continue;
+			}
+			if (ent->msgtime != cl.mtime[0])
+				continue;
+
+			VectorAdd(ent->origin, slot->offset, position);
+			VectorSubtract(position, slot->position, delta);
+			moved = DotProduct(delta, delta) >= EMITTER_MOVE_DIST * EMITTER_MOVE_DIST;
+			dt = cl.time - slot->movetime;
+			if (!moved && (!slot->moving || dt < EMITTER_REST_TIME))
+				continue;
+
+			if (moved && dt > 0 && snd_doppler.value)
+				VectorScale(delta, snd_doppler.value / (dt * SND_UNITS_PER_METER), velocity);
+			else
+				VectorCopy(vec3_origin, velocity);	// came to rest
+			if (!moved)
+				VectorCopy(slot->position, position);
+
+			FMOD_VectorCopy(position, fmod_pos);
+			FMOD_VectorCopy(velocity, fmod_vel);
+			FMOD_Channel_Set3DAttributes(slot->channel, &fmod_pos, &fmod_vel);
+			numEmitterUpdates++;
+
+			VectorCopy(position, slot->position);
+			slot->moving = velocity[0] || velocity[1] || velocity[2];
+			slot->movetime = cl.time;
+		}
+	}
+}
+
+void S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)	// Note: volume and attenuation are properly normalized here
+{
+	if (!fmod_system || !sfx)
+		return;
+
+	if (cls.demoseeking)
+		return;	// fast forwarding a demo
+
+	if (nosound.value)
+		return;
+
+	S_LoadSound(sfx);
+	switch (SND_GetSoundState(sfx))
+	{
+	case SFX_LOADING:
+		SND_DeferSound(entnum, entchannel, sfx, origin, fvol, attenuation, false);
+		return;
+	case SFX_READY:
+		if (entchannel != 0)
+			SND_CancelDeferredSounds(entnum, entchannel);
+		SND_StartEntitySound(entnum, entchannel, sfx, origin, fvol, attenuation);
+		return;
+	default:
+		return;
+	}
+}
+
+/*
+=============
+Static sounds
+
+These are sounds that have a fixed position in the world and loop continuously.
+They typically start playing immediately on level load.
+
+With snd_staticcluster set, a static sound within that many units of an earlier one with the same sound
+and attenuation joins its cluster instead of starting a channel of its own, so that a hall of torches
+takes one voice rather than dozens. As the listener moves, the cluster's channel is placed at whichever
+audible member would be loudest, and paused once none of them are. Clusters are formed as the statics
+arrive, so a change only applies from the next map or snd_restart.
+=============
+*/
+static vec3_t cluster_listener;
+static qboolean cluster_dirty;
+
+static float SND_StaticLoudness(const staticsound_t *ss)
+{
+	vec3_t dir;
+
+	VectorSubtract(ss->origin, listener_origin, dir);
+	return ss->vol * (1.0f - VectorLength(dir) * (ss->attenuation / 64) / sound_nominal_clip_dist);
+}
+
+static qboolean SND_JoinStaticCluster(sfx_t *sfx, vec3_t origin, float vol, float attenuation)
+{
+	staticsound_t *head, *ss;
+	vec3_t dir;
+	int i, j;
+
+	if (snd_staticcluster.value <= 0 || numStaticSounds >= MAX_POOLED_SLOTS)
+		return false;
+
+	for (i = 0; i < numStaticSounds; i++)
+	{
+		head = &staticSounds[i];
+		if (head->cluster != i || head->sfx != sfx || head->attenuation != attenuation)
+			continue;
+
+		// Measured from the first member, so a cluster can't creep across the map
+		VectorSubtract(origin, head->origin, dir);
+		if (VectorLength(dir) > snd_staticcluster.value)
+			continue;
+
+		ss = &staticSounds[numStaticSounds];
+		memset(ss, 0, sizeof(*ss));
+		ss->leafnum = SND_PointLeafnum(origin);
+		ss->sfx = sfx;
+		VectorCopy(origin, ss->origin);
+		ss->vol = vol;
+		ss->attenuation = attenuation;
+		ss->cluster = i;
+		ss->next = -1;
+
+		for (j = i; staticSounds[j].next >= 0; j = staticSounds[j].next)
+			;
+		staticSounds[j].next = numStaticSounds++;
+
+		if (head->nummembers++ == 1)
+			numStaticClusters++;
+		numClusteredStatics++;
+		cluster_dirty = true;
+		return true;
+	}
+
+	return false;
+}
+
+static void SND_UpdateStaticClusters(void)
+{
+	FMOD_VECTOR position;
+	staticsound_t *head, *ss;
+	float loudness, best;
+	int i, j, active;
+
+	if (!numStaticClusters)
+		return;
+	if (!cluster_dirty && VectorCompare(listener_origin, cluster_listener))
+		return;
+
+	for (i = 0; i < numStaticSounds; i++)
+	{
+		head = &staticSounds[i];
+		if (head->nummembers < 2)
+			continue;
+
+		active = -1;
+		best = 0;
+		for (j = i; j >= 0; j = staticSounds[j].next)
+		{
+			ss = &staticSounds[j];
+			if (!SND_LeafAudible(ss->leafnum))
+				continue;
+
+			loudness = SND_StaticLoudness(ss);
+			if (active < 0 || loudness > best)
+			{
+				active = j;
+				best = loudness;
+			}
+		}
+
+		if (active >= 0 && active != head->active)
+		{
+			ss = &staticSounds[active];
+			FMOD_VectorCopy(ss->origin, position);
+			FMOD_Channel_Set3DAttributes(head->channel, &position, NULL);
+			FMOD_Channel_SetVolume(head->channel, ss->vol / 255);
+			head->active = active;
+		}
+		SND_SetStaticPaused(head, active < 0);
+	}
+
+	VectorCopy(listener_origin, cluster_listener);
+	cluster_dirty = false;
+}
+
+static void SND_StartStaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)
+{
+	FMOD_CHANNEL *channel;
+	FMOD_RESULT result;
+	soundslot_t *slot;
+	staticsound_t *ss;
+	unsigned long long dspclock;
+	qboolean paused;
+	int leafnum;
+
+	if (SND_JoinStaticCluster(sfx, origin, vol, attenuation))
+		return;
+
+	// Without a slot there is no attenuation info, so don't play it at full volume everywhere
+	slot = SND_AllocSoundSlot();
+	if (!slot)
+		return;
+
+	result = FMOD_System_PlaySound(fmod_system, sfx->sound, sfx_channelGroup, 1, &channel);
+	if (result != FMOD_OK)
+	{
+		Con_Printf("Failed to play static FMOD sound: %s\n", FMOD_ErrorString(result));
+		SND_FreeSoundSlot(slot);
+		return;
+	}
+
+	SND_FMOD_SetChannelAttributes(channel, sfx, origin, vol / 255);
+
+	// Set up attenuation info for use by the rolloff callback
+	slot->channel = channel;
+	slot->dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
+	FMOD_Channel_SetUserData(channel, slot);
+	FMOD_Channel_SetCallback(channel, &SND_FMOD_Callback);
+
+	// Add a random delay so that similar sounds don't phase together
+	// Note: this isn't really authentic to the original Quake sound system, but it does improve the sense of directionality
+	FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
+	FMOD_Channel_SetDelay(channel, dspclock + SND_GetDelay(sfx, 0.2f), 0, 0);
+
+	// Remember where it is, so it can be paused while out of the listener's PVS
+	leafnum = SND_PointLeafnum(origin);
+	paused = !SND_LeafAudible(leafnum);
+	if (numStaticSounds < MAX_POOLED_SLOTS)
+	{
+		ss = &staticSounds[numStaticSounds++];
+		ss->channel = channel;
+		ss->leafnum = leafnum;
+		ss->paused = paused;
+		ss->sfx = sfx;
+		VectorCopy(origin, ss->origin);
+		ss->vol = vol;
+		ss->attenuation = attenuation;
+		ss->cluster = numStaticSounds - 1;
+		ss->next = -1;
+		ss->nummembers = 1;
+		ss->active = numStaticSounds - 1;
+		if (paused)
+			numStaticPaused++;
+	}
+	else
+	{
+		paused = false;
+	}
+
+	FMOD_Channel_SetPaused(channel, paused);
+
+	// Note: static channels are all stopped and released on level change through S_StopAllSounds
+}
+
+void S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)	// Note: volume and attenuation are in 0-255 range here
+{
+	sfxstate_t state;
+
+	if (!fmod_system || !sfx)
+		return;
+
+	S_LoadSound(sfx);
+	state = SND_GetSoundState(sfx);
+	if (state == SFX_UNAVAILABLE)
+		return;
+
+	// Loop points are known as soon as the WAV header has been parsed, even if the sample itself is still loading
+	if (sfx->loopstart < 0)
+	{
+		Con_Printf("Sound %s not looped\n", sfx->name);
+		return;
+	}
+
+	if (state == SFX_LOADING)
+		SND_DeferSound(-1, -1, sfx, origin, vol, attenuation, true);
+	else
+		SND_StartStaticSound(sfx, origin, vol, attenuation);
+}
+
+/*
+=================
+S_Restart_f
+
+Shuts FMOD down and starts it up again, to apply changes to snd_output, snd_dspbuffersize, snd_dspbuffers
+and snd_samplerate. Static sounds, ambients and the music track are started over; other sound effects are
+reloaded as they are next played.
+=================
+*/
+void S_Restart_f(void)
+{
+	staticsound_t *statics;
+	int i, numstatics;
+
+	numstatics = numStaticSounds;
+	statics = NULL;
+	if (numstatics > 0)
+	{
+		statics = (staticsound_t *) malloc(numstatics * sizeof(staticsound_t));
+		if (statics)
+			memcpy(statics, staticSounds, numstatics * sizeof(staticsound_t));
+		else
+			numstatics = 0;
+	}
+
+	BGM_Detach();
+	S_Shutdown();
+	S_Startup();
+	S_FinishStartup();
+
+	if (!fmod_system)
+	{
+		Con_Printf("FMOD failed to restart, sound is disabled\n");
+		free(statics);
+		return;
+	}
+
+	S_StopAllSounds(true);
+	for (i = 0; i < numstatics; i++)
+		S_StaticSound(statics[i].sfx, statics[i].origin, statics[i].vol, statics[i].attenuation);
+	free(statics);
+
+	BGM_Reattach();
+}
+
+static void SND_UpdateDeferredSounds(void)
+{
+	deferredsound_t *ds;
+	sfxstate_t state;
+	int i, j;
+
+	for (i = 0, j = 0; i < numDeferredSounds; i++)
+	{
+		ds = &deferredSounds[i];
+		state = SND_GetSoundState(ds->sfx);
+
+		if (state == SFX_LOADING && (ds->isstatic || realtime - ds->time < DEFERRED_SOUND_TIMEOUT))
+		{
+			// Keep waiting
+			if (i != j)
+				deferredSounds[j] = *ds;
+			j++;
+			continue;
+		}
+
+		if (state == SFX_READY)
+		{
+			if (ds->isstatic)
+				SND_StartStaticSound(ds->sfx, ds->origin, ds->vol, ds->attenuation);
+			else
+				SND_StartEntitySound(ds->entnum, ds->entchannel, ds->sfx, ds->origin, ds->vol, ds->attenuation);
+		}
+	}
+
+	numDeferredSounds = j;
+}
+
+void S_StopSound(int entnum, int entchannel)
+{
+	soundslot_t *slot;
+	unsigned long long dspclock;
+
+	if (!fmod_system)
+		return;
+
+	if (entnum < 0 || entnum >= MAX_CHANNELS || entchannel < 0 || entchannel > 7)
+		return;
+
+	SND_CancelDeferredSounds(entnum, entchannel);
+
+	slot = &entsounds[entnum].slots[entchannel];
+	if (slot->channel)
+	{
+		// Instead of immediately stopping the sound, we fade it down to 0 volume over several samples and let it play out
+		// This prevents an annoying popping noise, which is especially noticeable on rapid-fire weapons
+		FMOD_ChannelGroup_GetDSPClock(sfx_channelGroup, &dspclock, NULL);
+		FMOD_Channel_SetFadePointRamp(slot->channel, dspclock + 64, 0.0f);
+		FMOD_Channel_SetMode(slot->channel, FMOD_LOOP_OFF);
+		slot->channel = NULL;
+	}
+}
+
+void S_StopAllSounds(qboolean clear)
+{
+	if (!fmod_system)
+		return;
+
+	// Stopping all sounds also ensures that any pooled slots are returned
+	FMOD_ChannelGroup_Stop(sfx_channelGroup);
+	numDeferredSounds = 0;
+	numStaticSounds = 0;
+	numStaticPaused = 0;
+	numStaticClusters = 0;
+	numClusteredStatics = 0;
+
+	if (clear)	// We're abusing the clear flag to also mean "keep ambients alive"
+	{
+		S_ClearBuffer();
+
+		// Ambient sounds need to be restarted, as they are always "playing"
+		SND_StartAmbientSounds();
 	}
 }
 
@@ -561,66 +2487,625 @@ void S_ClearBuffer(void)
 
 void S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 {
-	if (!fmod_system)
-		return;
+	listener_t listener;
+	double now;
+
+	if (!fmod_system)
+		return;
+
+	TRACE_BEGIN ("S_Update");
+
+	if (old_volume != sfxvolume.value)
+	{
+		if (sfxvolume.value < 0)
+			Cvar_SetQuick(&sfxvolume, "0");
+		else if (sfxvolume.value > 1)
+			Cvar_SetQuick(&sfxvolume, "1");
+
+		old_volume = sfxvolume.value;
+	}
+
+	VectorCopy(origin, listener_origin);
+
+	VectorCopy(origin, listener.origin);
+	VectorCopy(forward, listener.forward);
+	VectorCopy(up, listener.up);
+
+	if (snd_thread)
+	{
+		// Glide from wherever the update thread has got to towards the new position
+		now = Sys_DoubleTime();
+		SDL_LockMutex(snd_lock);
+		listener_from = listener_current;
+		listener_to = listener;
+		listener_starttime = now;
+		listener_duration = CLAMP(0.0, now - listener_lasttime, 0.1);
+		listener_lasttime = now;
+		snd_update_msec = 1000 / CLAMP(20, (int)snd_updaterate.value, 500);
+		SDL_UnlockMutex(snd_lock);
+	}
+	else
+	{
+		SND_SetListener(&listener);
+	}
+
+	FMOD_ChannelGroup_SetVolume(sfx_channelGroup, sfxvolume.value);
+
+	S_UpdateAmbientSounds();
+
+	SND_UpdateEmitters();
+
+	SND_UpdateOcclusionGeometry();
+
+	SND_UpdateAudibility();
+
+	SND_UpdateStaticClusters();
+
+	SND_UpdateVoiceBudget();
+
+	SND_UpdateReverb();
+
+	SND_UpdateDeferredSounds();
+
+	SND_UpdateStats();
+
+	if (!snd_thread)
+		FMOD_System_Update(fmod_system);
+
+	// Reset sounds played for the next frame
+	memset(sfxThisFrame, 0, sizeof(sfxThisFrame));
+	numSfxThisFrame = 0;
+
+	TRACE_END ("S_Update");
+}
+
+int S_GetStatsLines(char lines[MAX_SOUND_STATS_LINES][SOUND_STATS_LINE_LEN])
+{
+	const sndstats_t *st = &snd_stats_current;
+	int n;
+
+	if (!fmod_system || !snd_stats.value || !snd_stats_valid)
+		return 0;
+
+	q_snprintf(lines[0], SOUND_STATS_LINE_LEN, "%4.1f%% dsp %4.1f%% upd", st->cpu.dsp, st->cpu.update);
+	q_snprintf(lines[1], SOUND_STATS_LINE_LEN, "%3i/%3i voices", st->realchannels, st->channels);
+	q_snprintf(lines[2], SOUND_STATS_LINE_LEN, "%+5.0f ms drift", st->drift);
+	q_snprintf(lines[3], SOUND_STATS_LINE_LEN, "%3i loading%s", st->loading, st->starving ? " starve" : "");
+	q_snprintf(lines[4], SOUND_STATS_LINE_LEN, "%5.1f moved/frame", st->emitters);
+	n = 5;
+	if (st->statics)
+		q_snprintf(lines[n++], SOUND_STATS_LINE_LEN, "%3i/%3i static ch", st->staticchannels, st->statics);
+	if (snd_voicebudget.value > 0)
+		q_snprintf(lines[n++], SOUND_STATS_LINE_LEN, "%3i budget %3i muted", voice_budget, numVoicesMuted);
+	if (numResampledSamples)
+		q_snprintf(lines[n++], SOUND_STATS_LINE_LEN, "%3i rsmp %+6iK", numResampledSamples, (resampledBytes - resampledSrcBytes) / 1024);
+	return n;
+}
+
+void S_ExtraUpdate(void)
+{
+	if (!fmod_system || snd_thread)
+		return;
+
+	FMOD_System_Update(fmod_system);
+}
+
+static void S_SetMasterMute(FMOD_BOOL mute)
+{
+	FMOD_CHANNELGROUP *master;
+
+	if (!fmod_system)
+		return;
+
+	FMOD_System_GetMasterChannelGroup(fmod_system, &master);
+	FMOD_ChannelGroup_SetMute(master, mute);
+}
+
+void S_BlockSound(void)
+{
+	S_SetMasterMute(1);
+}
+
+void S_UnblockSound(void)
+{
+	S_SetMasterMute(0);
+}
+
+/*
+=================
+Compressed samples
+
+With snd_compressedsamples enabled, long 16-bit mono sounds are transcoded to IMA ADPCM, which FMOD
+can keep compressed in memory and decode while mixing, at a quarter of the size. The transcoded WAV
+is cached as sndcache/<name>.ima in the game directory, along with a CRC of the source file so that
+a changed sound gets transcoded again.
+=================
+*/
+#define ADPCM_CACHE_IDENT		(('C'<<24)+('A'<<16)+('S'<<8)+'Q')	// little-endian "QSAC"
+#define ADPCM_CACHE_VERSION		1
+#define ADPCM_MIN_SECONDS		2		// shorter sounds aren't worth the decoding
+#define ADPCM_BLOCK_ALIGN		512
+#define ADPCM_BLOCK_SAMPLES		((ADPCM_BLOCK_ALIGN - 4) * 2 + 1)
+#define ADPCM_WAV_HEADER		60		// RIFF + fmt (20) + fact + data chunk headers
+
+typedef struct
+{
+	int ident;
+	int version;
+	int crc;
+	int srclen;
+} adpcmcacheheader_t;
+
+static const int ima_index_table[16] =
+{
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int ima_step_table[89] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+	12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static int numCompressedSamples;
+
+static byte *SND_PutLong(byte *p, int l)
+{
+	p[0] = l & 0xff;
+	p[1] = (l >> 8) & 0xff;
+	p[2] = (l >> 16) & 0xff;
+	p[3] = (l >> 24) & 0xff;
+	return p + 4;
+}
+
+static byte *SND_PutShort(byte *p, int s)
+{
+	p[0] = s & 0xff;
+	p[1] = (s >> 8) & 0xff;
+	return p + 2;
+}
+
+static int SND_EncodeADPCMSample(int sample, int *predictor, int *index)
+{
+	int diff, step, vpdiff, nibble;
+
+	step = ima_step_table[*index];
+	diff = sample - *predictor;
+	nibble = 0;
+	if (diff < 0)
+	{
+		nibble = 8;
+		diff = -diff;
+	}
+
+	vpdiff = step >> 3;
+	if (diff >= step)
+	{
+		nibble |= 4;
+		diff -= step;
+		vpdiff += step;
+	}
+	step >>= 1;
+	if (diff >= step)
+	{
+		nibble |= 2;
+		diff -= step;
+		vpdiff += step;
+	}
+	step >>= 1;
+	if (diff >= step)
+	{
+		nibble |= 1;
+		vpdiff += step;
+	}
+
+	*predictor += (nibble & 8) ? -vpdiff : vpdiff;
+	*predictor = CLAMP(-32768, *predictor, 32767);
+	*index = CLAMP(0, *index + ima_index_table[nibble], 88);
+
+	return nibble;
+}
+
+/*
+=================
+SND_EncodeADPCM
+
+Returns a cache file (header followed by an IMA ADPCM WAV) in malloc'd memory
+=================
+*/
+static byte *SND_EncodeADPCM(const byte *pcm, int numsamples, int rate, int crc, int srclen, int *outlen)
+{
+	byte *buf, *p;
+	adpcmcacheheader_t *header;
+	int numblocks, datalen, block, i, n, sample, predictor, index, nibble;
 
-	if (old_volume != sfxvolume.value)
+	numblocks = (numsamples + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+	datalen = numblocks * ADPCM_BLOCK_ALIGN;
+	*outlen = sizeof(adpcmcacheheader_t) + ADPCM_WAV_HEADER + datalen;
+
+	buf = (byte *) calloc(1, *outlen);
+	if (!buf)
+		return NULL;
+
+	header = (adpcmcacheheader_t *)buf;
+	header->ident = LittleLong(ADPCM_CACHE_IDENT);
+	header->version = LittleLong(ADPCM_CACHE_VERSION);
+	header->crc = LittleLong(crc);
+	header->srclen = LittleLong(srclen);
+
+	p = buf + sizeof(adpcmcacheheader_t);
+	memcpy(p, "RIFF", 4);
+	p = SND_PutLong(p + 4, ADPCM_WAV_HEADER - 8 + datalen);
+	memcpy(p, "WAVEfmt ", 8);
+	p = SND_PutLong(p + 8, 20);
+	p = SND_PutShort(p, 0x0011);	// WAVE_FORMAT_IMA_ADPCM
+	p = SND_PutShort(p, 1);
+	p = SND_PutLong(p, rate);
+	p = SND_PutLong(p, rate * ADPCM_BLOCK_ALIGN / ADPCM_BLOCK_SAMPLES);
+	p = SND_PutShort(p, ADPCM_BLOCK_ALIGN);
+	p = SND_PutShort(p, 4);
+	p = SND_PutShort(p, 2);
+	p = SND_PutShort(p, ADPCM_BLOCK_SAMPLES);
+	memcpy(p, "fact", 4);
+	p = SND_PutLong(p + 4, 4);
+	p = SND_PutLong(p, numsamples);
+	memcpy(p, "data", 4);
+	p = SND_PutLong(p + 4, datalen);
+
+	predictor = index = 0;
+	for (block = 0; block < numblocks; block++)
 	{
-		if (sfxvolume.value < 0)
-			Cvar_SetQuick(&sfxvolume, "0");
-		else if (sfxvolume.value > 1)
-			Cvar_SetQuick(&sfxvolume, "1");
+		n = block * ADPCM_BLOCK_SAMPLES;
 
-		old_volume = sfxvolume.value;
+		// The block header holds the first sample as is; the step index carries over from the previous block
+		predictor = (short)(pcm[n * 2] | (pcm[n * 2 + 1] << 8));
+		p = SND_PutShort(p, predictor);
+		*p++ = index;
+		*p++ = 0;
+
+		for (i = 1; i < ADPCM_BLOCK_SAMPLES; i++)
+		{
+			if (n + i < numsamples)
+				sample = (short)(pcm[(n + i) * 2] | (pcm[(n + i) * 2 + 1] << 8));
+			else
+				sample = 0;
+
+			nibble = SND_EncodeADPCMSample(sample, &predictor, &index);
+			if (i & 1)
+				*p = nibble;
+			else
+				*p++ |= nibble << 4;
+		}
 	}
 
-	VectorCopy(origin, listener_origin);
+	return buf;
+}
 
-	FMOD_VECTOR fmod_pos, fmod_forward, fmod_up;
-	FMOD_VectorCopy(origin, fmod_pos);
-	FMOD_VectorCopy(forward, fmod_forward);
-	FMOD_VectorCopy(up, fmod_up);
+/*
+=================
+SND_GetCompressedWav
 
-	FMOD_System_Set3DListenerAttributes(fmod_system, 0, &fmod_pos, NULL, &fmod_forward, &fmod_up);
+Returns the cached or freshly transcoded ADPCM version of a WAV file, or NULL to use the PCM data as is
+=================
+*/
+static byte *SND_GetCompressedWav(sfx_t *s, byte *data, int length, const wavinfo_t *info, byte **wav, int *wavlen)
+{
+	char cachename[MAX_QPATH + 16], path[MAX_OSPATH];
+	adpcmcacheheader_t *header;
+	byte *cache;
+	int crc, cachelen, numsamples;
 
-	FMOD_ChannelGroup_SetVolume(sfx_channelGroup, sfxvolume.value);
+	if (!snd_compressedsamples.value || info->width != 2 || info->channels != 1 || info->samples < info->rate * ADPCM_MIN_SECONDS)
+		return NULL;
 
-	S_UpdateAmbientSounds();
+	numsamples = q_min(info->samples, (length - info->dataofs) / 2);
+	if (numsamples <= 0)
+		return NULL;
 
-	FMOD_System_Update(fmod_system);
+	crc = CRC_Block(data, length);
 
-	// Reset sounds played for the next frame
-	memset(sfxThisFrame, 0, sizeof(sfxThisFrame));
-	numSfxThisFrame = 0;
-}
+	q_snprintf(cachename, sizeof(cachename), "sndcache/%s", s->name);
+	COM_StripExtension(cachename, cachename, sizeof(cachename));
+	q_strlcat(cachename, ".ima", sizeof(cachename));
 
-void S_ExtraUpdate(void)
-{
-	if (!fmod_system)
-		return;
+	cache = COM_LoadMallocFile(cachename, NULL);
+	if (cache)
+	{
+		cachelen = com_filesize;
+		header = (adpcmcacheheader_t *)cache;
+		if (cachelen > (int)sizeof(adpcmcacheheader_t) + ADPCM_WAV_HEADER &&
+			LittleLong(header->ident) == ADPCM_CACHE_IDENT && LittleLong(header->version) == ADPCM_CACHE_VERSION &&
+			LittleLong(header->crc) == crc && LittleLong(header->srclen) == length)
+		{
+			*wav = cache + sizeof(adpcmcacheheader_t);
+			*wavlen = cachelen - sizeof(adpcmcacheheader_t);
+			return cache;
+		}
+		free(cache);
+	}
 
-	FMOD_System_Update(fmod_system);
+	cache = SND_EncodeADPCM(data + info->dataofs, numsamples, info->rate, crc, length, &cachelen);
+	if (!cache)
+		return NULL;
+
+	q_snprintf(path, sizeof(path), "%s/%s", com_gamedir, cachename);
+	COM_CreatePath(path);
+	COM_WriteFile(cachename, cache, cachelen);
+
+	*wav = cache + sizeof(adpcmcacheheader_t);
+	*wavlen = cachelen - sizeof(adpcmcacheheader_t);
+	return cache;
 }
 
-static void S_SetMasterMute(FMOD_BOOL mute)
+/*
+=================
+Resampled samples
+
+With snd_resample enabled, short sounds below the output rate are converted once at load to 16-bit PCM
+at the output rate, so that FMOD mixes them without resampling each voice in every block. The windowed
+sinc filter keeps the original band and rejects the images that FMOD's linear interpolation lets through.
+The price is memory: an 11 kHz 8-bit sound grows eightfold at 44.1 kHz, which snd_stats shows next to the
+dsp time it saves.
+=================
+*/
+#define RESAMPLE_MAX_SECONDS	3		// longer sounds cost more memory than their mixing is worth
+#define RESAMPLE_TAPS			16		// input samples on each side of an output sample
+#define RESAMPLE_PHASES			512		// fractional positions the filter is tabulated at
+#define RESAMPLE_CUTOFF			0.95	// of the source Nyquist frequency, leaves room for the transition band
+
+static float resample_kernel[RESAMPLE_PHASES + 1][RESAMPLE_TAPS * 2];
+static qboolean resample_kernel_ready;
+
+static void SND_InitResampleKernel(void)
 {
-	FMOD_CHANNELGROUP *master;
+	double d, x, w, sum;
+	int p, k;
 
-	if (!fmod_system)
-		return;
+	for (p = 0; p <= RESAMPLE_PHASES; p++)
+	{
+		sum = 0;
+		for (k = 0; k < RESAMPLE_TAPS * 2; k++)
+		{
+			// Distance from the output position to input sample k, in [-RESAMPLE_TAPS, RESAMPLE_TAPS]
+			d = (k - RESAMPLE_TAPS + 1) - (double)p / RESAMPLE_PHASES;
+			x = d * RESAMPLE_CUTOFF;
+			w = 0.42 + 0.5 * cos(M_PI * d / RESAMPLE_TAPS) + 0.08 * cos(2 * M_PI * d / RESAMPLE_TAPS);	// Blackman
+			resample_kernel[p][k] = (float)(w * (fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x)));
+			sum += resample_kernel[p][k];
+		}
 
-	FMOD_System_GetMasterChannelGroup(fmod_system, &master);
-	FMOD_ChannelGroup_SetMute(master, mute);
+		// Unity gain at every phase, so that a constant signal stays constant
+		for (k = 0; k < RESAMPLE_TAPS * 2; k++)
+			resample_kernel[p][k] /= sum;
+	}
+
+	resample_kernel_ready = true;
 }
 
-void S_BlockSound(void)
+/*
+=================
+SND_GetResampledWav
+
+Returns a malloc'd buffer of 16-bit PCM at outrate for the WAV data, or NULL if the sound is left as it is.
+=================
+*/
+static short *SND_GetResampledWav(const byte *data, int length, const wavinfo_t *info, int outrate, int *outbytes)
 {
-	S_SetMasterMute(1);
+	const byte *pcm;
+	const float *kern;
+	float *src, sum;
+	short *out;
+	double step, pos, frac;
+	int i, j, k, c, first, numsamples, numout, channels, s;
+
+	if (!snd_resample.value || info->rate <= 0 || info->rate >= outrate)
+		return NULL;
+	if (info->width != 1 && info->width != 2)
+		return NULL;
+	if (info->samples > info->rate * RESAMPLE_MAX_SECONDS)
+		return NULL;
+
+	channels = info->channels;
+	numsamples = q_min(info->samples, (length - info->dataofs) / (info->width * channels));
+	if (numsamples <= 0)
+		return NULL;
+
+	numout = (int)((double)numsamples * outrate / info->rate);
+	src = (float *) malloc(numsamples * channels * sizeof(float));
+	out = (short *) malloc(numout * channels * sizeof(short));
+	if (!src || !out)
+	{
+		free(src);
+		free(out);
+		return NULL;
+	}
+
+	if (!resample_kernel_ready)
+		SND_InitResampleKernel();
+
+	pcm = data + info->dataofs;
+	for (i = 0; i < numsamples * channels; i++)
+	{
+		if (info->width == 1)
+			src[i] = (float)((pcm[i] - 128) << 8);
+		else
+			src[i] = (float)(short)(pcm[i * 2] | (pcm[i * 2 + 1] << 8));
+	}
+
+	step = (double)info->rate / outrate;
+	for (i = 0; i < numout; i++)
+	{
+		pos = i * step;
+		first = (int)pos;
+		frac = pos - first;
+		kern = resample_kernel[(int)(frac * RESAMPLE_PHASES + 0.5)];
+		first -= RESAMPLE_TAPS - 1;
+
+		for (c = 0; c < channels; c++)
+		{
+			sum = 0;
+			for (k = 0; k < RESAMPLE_TAPS * 2; k++)
+			{
+				j = first + k;
+				if (j >= 0 && j < numsamples)	// silence beyond the ends
+					sum += kern[k] * src[j * channels + c];
+			}
+
+			s = (int)floor(sum + 0.5f);
+			out[i * channels + c] = CLAMP(-32768, s, 32767);
+		}
+	}
+
+	free(src);
+
+	numResampledSamples++;
+	resampledSrcBytes += numsamples * info->width * channels;
+	resampledBytes += numout * channels * sizeof(short);
+	*outbytes = numout * channels * sizeof(short);
+	return out;
 }
 
-void S_UnblockSound(void)
+/*
+=================
+SND_CreateSound
+
+Creates the FMOD sound for an sfx from a WAV file in memory.
+
+If the file is a view that stays mapped (mappable), uncompressed PCM is handed to FMOD as raw data with
+FMOD_OPENMEMORY_POINT, so that it's played in place instead of copied into an FMOD sample, and the sfx takes
+over the view. FMOD's 8 bit PCM is signed where WAV's is unsigned, so 8 bit samples are flipped in place,
+which only touches the copy-on-write view. A sound resampled for snd_resample is copied instead, since its
+data no longer lives in the file.
+=================
+*/
+static qboolean SND_CreateSound(sfx_t *s, byte *data, int length, const char *filename, qboolean mappable)
 {
-	S_SetMasterMute(0);
+	wavinfo_t info;
+	FMOD_CREATESOUNDEXINFO exinfo;
+	FMOD_MODE mode;
+	FMOD_RESULT result;
+	byte *compressed, *wav;
+	short *resampled;
+	int i, wavlen, numsamples;
+
+	info = GetWavinfo(s->name, data, length);
+	if (!info.channels)
+	{
+		Con_Printf("Invalid WAV file: %s\n", filename);
+		numFailedLoads++;
+		return false;
+	}
+
+	memset(&exinfo, 0, sizeof(FMOD_CREATESOUNDEXINFO));
+	exinfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+
+	wav = data;
+	wavlen = length;
+	mode = FMOD_3D | FMOD_OPENMEMORY | FMOD_CREATESAMPLE;
+	numsamples = 0;
+	if (mappable && !host_bigendian && (info.width == 1 || info.width == 2))	// raw PCM16 is native endian
+		numsamples = q_min(info.samples, (length - info.dataofs) / (info.width * info.channels));
+
+	resampled = NULL;
+	compressed = SND_GetCompressedWav(s, data, length, &info, &wav, &wavlen);
+	if (compressed)
+	{
+		mode = FMOD_3D | FMOD_OPENMEMORY | FMOD_CREATECOMPRESSEDSAMPLE;
+		numCompressedSamples++;
+	}
+	else if ((resampled = SND_GetResampledWav(data, length, &info, fmod_samplerate, &wavlen)) != NULL)
+	{
+		wav = (byte *)resampled;
+		s->resampled = wavlen;
+		s->resampledsrc = numsamples * info.width * info.channels;
+
+		mode = FMOD_3D | FMOD_OPENMEMORY | FMOD_OPENRAW | FMOD_CREATESAMPLE;
+		exinfo.format = FMOD_SOUND_FORMAT_PCM16;
+		exinfo.numchannels = info.channels;
+		exinfo.defaultfrequency = fmod_samplerate;
+	}
+	else if (numsamples > 0)
+	{
+		wav = data + info.dataofs;
+		wavlen = numsamples * info.width * info.channels;
+		if (info.width == 1)
+		{
+			for (i = 0; i < wavlen; i++)
+				wav[i] ^= 0x80;
+		}
+
+		mode = FMOD_3D | FMOD_OPENMEMORY_POINT | FMOD_OPENRAW | FMOD_CREATESAMPLE;
+		exinfo.format = (info.width == 2) ? FMOD_SOUND_FORMAT_PCM16 : FMOD_SOUND_FORMAT_PCM8;
+		exinfo.numchannels = info.channels;
+		exinfo.defaultfrequency = info.rate;
+	}
+	exinfo.length = wavlen;
+
+	// Decode the sample on FMOD's async loading thread; pointed samples have nothing to decode.
+	// That thread keeps reading the data until the sound is ready, while the file buffer is reused
+	// as soon as this returns, so the sfx holds on to the data until SND_GetSoundState sees it done.
+	if (snd_asyncload.value && !(mode & FMOD_OPENMEMORY_POINT))
+	{
+		if (compressed || resampled)
+		{
+			s->loaddata = compressed ? compressed : (byte *)resampled;
+			compressed = NULL;
+			resampled = NULL;
+			mode |= FMOD_NONBLOCKING;
+		}
+		else if ((s->loaddata = (byte *)malloc(wavlen)) != NULL)
+		{
+			memcpy(s->loaddata, wav, wavlen);
+			wav = s->loaddata;
+			mode |= FMOD_NONBLOCKING;
+		}
+	}
+
+	// Unless it's pointed at, this will copy the sound data into FMOD's internal buffers, so there's no need to keep it around in hunk memory
+	result = FMOD_System_CreateSound(fmod_system, (const char*)wav, mode, &exinfo, &s->sound);
+	if (compressed)
+		free(compressed);
+	if (resampled)
+		free(resampled);
+	if (result != FMOD_OK)
+	{
+		Con_Printf("Failed to create FMOD sound: %s\n", FMOD_ErrorString(result));
+		SND_FreeLoadData(s);
+		s->sound = NULL;
+		numFailedLoads++;
+		return false;
+	}
+
+	if (mode & FMOD_OPENMEMORY_POINT)
+	{
+		s->view = data;
+		s->viewlength = length;
+		numMappedSamples++;
+	}
+
+	// Collect data required for looping and delay
+	if (info.loopstart >= 0)
+	{
+		s->loopstart = info.loopstart * 1000 / info.rate;
+		s->loopend = info.samples * 1000 / info.rate;
+	}
+	else
+	{
+		s->loopstart = s->loopend = -1;
+	}
+
+	// Length is filled in once the sound has finished loading; until then make a best guess from the WAV header
+	s->length = info.samples * 1000 / info.rate;
+	s->pending = (mode & FMOD_NONBLOCKING) != 0;
+	if (!s->pending)
+		SND_SoundLoaded(s);
+
+	return true;
 }
 
 sfxcache_t *S_LoadSound(sfx_t *s)
@@ -628,69 +3113,279 @@ sfxcache_t *S_LoadSound(sfx_t *s)
 	char namebuffer[256];
 	byte *data;
 	byte stackbuf[1 * 1024]; // avoid dirtying the cache heap
-	wavinfo_t info;
-	FMOD_CREATESOUNDEXINFO exinfo;
-	FMOD_RESULT result;
-#if _DEBUG
-	FMOD_SOUND_TYPE type;
-	FMOD_SOUND_FORMAT format;
-	int channels, bits;
-#endif
+	qboolean mapped;
+	int length;
 
 	if (!fmod_system)
 		return NULL;
 
-	// Check if it's already loaded
+	// Check if it's already loaded, or being loaded
 	if (s->sound)
 		return NULL;
 
 	q_strlcpy(namebuffer, "sound/", sizeof(namebuffer));
 	q_strlcat(namebuffer, s->name, sizeof(namebuffer));
 
-	data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+	// A view that stays mapped is kept if FMOD can play the samples from it directly
+	data = COM_MapFileView(namebuffer, &length);
+	mapped = (data != NULL);
+	if (!mapped)
+	{
+		data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+		length = com_filesize;
+	}
 	if (!data)
 	{
 		Con_Printf("Couldn't load %s\n", namebuffer);
+		numFailedLoads++;
 		return NULL;
 	}
 
-	info = GetWavinfo(s->name, data, com_filesize);
-	if (!info.channels)
+	SND_CreateSound(s, data, length, namebuffer, mapped);
+	if (mapped && s->view != data)
+		COM_UnmapFileView(data, length);
+
+	return NULL;	// Return value is unused; FMOD has its own internal cache, we never need to use Quake's sfxcache_t
+}
+
+/*
+=================
+Sound banks
+
+With snd_soundbanks enabled, the first visit to a map writes all of its precached WAV files into
+sndbanks/<map>.bank in the game directory. Later visits read that file in one go and create every
+sound from it, instead of looking up and reading each file separately. Sounds that are missing from
+the bank are loaded as usual, and the bank is rewritten with them at the end of precaching.
+Delete the bank after changing any of a map's sounds.
+=================
+*/
+#define SOUNDBANK_IDENT		(('K'<<24)+('B'<<16)+('S'<<8)+'Q')	// little-endian "QSBK"
+#define SOUNDBANK_VERSION	1
+
+typedef struct
+{
+	int ident;
+	int version;
+	int numsounds;
+} soundbankheader_t;
+
+typedef struct
+{
+	char name[MAX_QPATH];
+	int filepos;
+	int filelen;
+} soundbankentry_t;
+
+static byte *soundbank = NULL;
+static soundbankentry_t *soundbank_entries;
+static int soundbank_numsounds;
+
+static void SND_SoundBankPath(char *path, size_t size)
+{
+	q_snprintf(path, size, "sndbanks/%s.bank", cl.mapname);
+}
+
+static qboolean SND_InSoundBank(const char *name)
+{
+	int i;
+
+	for (i = 0; i < soundbank_numsounds; i++)
 	{
-		Con_Printf("Invalid WAV file: %s\n", namebuffer);
-		return NULL;
+		if (!strcmp(soundbank_entries[i].name, name))
+			return true;
 	}
+	return false;
+}
 
-	memset(&exinfo, 0, sizeof(FMOD_CREATESOUNDEXINFO));
-	exinfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
-	exinfo.length = com_filesize;
+static void SND_LoadSoundBank(void)
+{
+	char path[MAX_OSPATH];
+	soundbankheader_t *header;
+	soundbankentry_t *entry;
+	sfx_t *sfx;
+	int i, length, loaded;
 
-	// This will copy the sound data into FMOD's internal buffers, so there's no need to keep it around in hunk memory
-	result = FMOD_System_CreateSound(fmod_system, (const char*)data, FMOD_3D | FMOD_OPENMEMORY | FMOD_CREATESAMPLE, &exinfo, &s->sound);
-	if (result != FMOD_OK)
+	SND_SoundBankPath(path, sizeof(path));
+	soundbank = COM_LoadMallocFile(path, NULL);
+	if (!soundbank)
+		return;
+	length = com_filesize;
+
+	header = (soundbankheader_t *)soundbank;
+	if (length < (int)sizeof(soundbankheader_t) || LittleLong(header->ident) != SOUNDBANK_IDENT || LittleLong(header->version) != SOUNDBANK_VERSION)
 	{
-		Con_Printf("Failed to create FMOD sound: %s\n", FMOD_ErrorString(result));
-		return NULL;
+		Con_Printf("%s is not a valid sound bank\n", path);
+		free(soundbank);
+		soundbank = NULL;
+		return;
 	}
 
-	// Collect data required for looping and delay
-	if (info.loopstart >= 0)
+	soundbank_numsounds = LittleLong(header->numsounds);
+	soundbank_entries = (soundbankentry_t *)(header + 1);
+	if (soundbank_numsounds < 0 || sizeof(soundbankheader_t) + soundbank_numsounds * sizeof(soundbankentry_t) > (size_t)length)
 	{
-		s->loopstart = info.loopstart * 1000 / info.rate;
-		s->loopend = info.samples * 1000 / info.rate;
+		Con_Printf("%s is truncated\n", path);
+		free(soundbank);
+		soundbank = NULL;
+		soundbank_numsounds = 0;
+		return;
 	}
-	else
+
+	loaded = 0;
+	for (i = 0, entry = soundbank_entries; i < soundbank_numsounds; i++, entry++)
 	{
-		s->loopstart = s->loopend = -1;
+		entry->name[MAX_QPATH - 1] = 0;
+		entry->filepos = LittleLong(entry->filepos);
+		entry->filelen = LittleLong(entry->filelen);
+		if (entry->filepos < 0 || entry->filelen <= 0 || entry->filepos > length - entry->filelen)
+		{
+			entry->name[0] = 0;	// gets loaded from its own file, and the bank rewritten
+			continue;
+		}
+
+		sfx = S_FindName(entry->name);
+		if (sfx->sound || SND_CreateSound(sfx, soundbank + entry->filepos, entry->filelen, path, false))
+			loaded++;
 	}
-	FMOD_Sound_GetLength(s->sound, &s->length, FMOD_TIMEUNIT_MS);
 
-#if _DEBUG
-	FMOD_Sound_GetFormat(s->sound, &type, &format, &channels, &bits);
-	Con_DPrintf("[FMOD] Loaded sound '%s': type %d, format %d, %d channel(s), %d bits, %d ms, %d samples, loopstart = %d\n", s->name, type, format, channels, bits, s->length, info.samples, s->loopstart);
-#endif
+	Con_DPrintf("[FMOD] %d sounds from %s\n", loaded, path);
+}
 
-	return NULL;	// Return value is unused; FMOD has its own internal cache, we never need to use Quake's sfxcache_t
+static void SND_WriteSoundBank(void)
+{
+	char path[MAX_OSPATH];
+	char filename[MAX_QPATH + 8];
+	soundbankheader_t *header;
+	soundbankentry_t *entries;
+	byte *buf, *data;
+	int i, numsounds, size, filepos;
+
+	for (numsounds = 0; numsounds + 1 < MAX_SOUNDS && cl.sound_precache[numsounds + 1]; numsounds++)
+		;
+	if (!numsounds)
+		return;
+
+	// Read everything back in first, in precache order
+	size = sizeof(soundbankheader_t) + numsounds * sizeof(soundbankentry_t);
+	buf = (byte *) calloc(1, size);
+	if (!buf)
+		return;
+
+	filepos = size;
+	for (i = 0; i < numsounds; i++)
+	{
+		q_snprintf(filename, sizeof(filename), "sound/%s", cl.sound_precache[i + 1]->name);
+		data = COM_LoadMallocFile(filename, NULL);
+		if (!data)
+			continue;
+
+		buf = (byte *) realloc(buf, filepos + com_filesize);
+		if (!buf)
+			Sys_Error("SND_WriteSoundBank: realloc() failed on %d bytes", filepos + com_filesize);
+
+		entries = (soundbankentry_t *)(buf + sizeof(soundbankheader_t));
+		q_strlcpy(entries[i].name, cl.sound_precache[i + 1]->name, MAX_QPATH);
+		entries[i].filepos = LittleLong(filepos);
+		entries[i].filelen = LittleLong(com_filesize);
+		memcpy(buf + filepos, data, com_filesize);
+		filepos += com_filesize;
+		free(data);
+	}
+
+	header = (soundbankheader_t *)buf;
+	header->ident = LittleLong(SOUNDBANK_IDENT);
+	header->version = LittleLong(SOUNDBANK_VERSION);
+	header->numsounds = LittleLong(numsounds);
+
+	q_snprintf(path, sizeof(path), "%s/sndbanks", com_gamedir);
+	Sys_mkdir(path);
+	SND_SoundBankPath(path, sizeof(path));
+	COM_WriteFile(path, buf, filepos);
+	free(buf);
+}
+
+void S_BeginPrecaching(void)
+{
+	soundbank_numsounds = 0;
+	if (!fmod_system || !snd_soundbanks.value || !precache.value || !cl.mapname[0])
+		return;
+
+	SND_LoadSoundBank();
+}
+
+void S_EndPrecaching(void)
+{
+	qboolean complete;
+	int i;
+
+	if (!fmod_system || !snd_soundbanks.value || !precache.value || !cl.mapname[0])
+		return;
+
+	complete = (soundbank != NULL);
+	for (i = 1; complete && i < MAX_SOUNDS && cl.sound_precache[i]; i++)
+	{
+		if (cl.sound_precache[i]->sound && !SND_InSoundBank(cl.sound_precache[i]->name))
+			complete = false;
+	}
+
+	if (soundbank)
+	{
+		free(soundbank);
+		soundbank = NULL;
+		soundbank_numsounds = 0;
+	}
+
+	if (!complete)
+		SND_WriteSoundBank();
+}
+
+/*
+=================
+S_SoundList
+
+Lists all sounds known to FMOD, along with the state of any background loads
+=================
+*/
+void S_SoundList(void)
+{
+	sfx_t *sfx;
+	int i, loaded, pending;
+	FMOD_CPU_USAGE usage;
+	int memcurrent, memmax;
+
+	loaded = pending = 0;
+	for (sfx = known_sfx, i = 0; i < num_sfx; i++, sfx++)
+	{
+		if (!sfx->sound)
+			continue;
+
+		SND_GetSoundState(sfx);
+		if (!sfx->sound)
+			continue;
+
+		if (sfx->pending)
+			pending++;
+		else
+			loaded++;
+
+		Con_SafePrintf("%c%c %6u ms : %s\n", sfx->loopstart >= 0 ? 'L' : ' ', sfx->pending ? '*' : ' ', sfx->length, sfx->name);
+	}
+	Con_Printf("%i sounds, %i loaded, %i loading, %i failed\n", num_sfx, loaded, pending, numFailedLoads);
+	Con_Printf("%i voices dropped, %i stolen\n", numVoicesDropped, numVoicesStolen);
+	if (snd_voicebudget.value > 0)
+		Con_Printf("voice budget %i for %g%% dsp, %i voices muted\n", voice_budget, snd_voicebudget.value, numVoicesMuted);
+	Con_Printf("%i of %i static sounds paused\n", numStaticPaused, numStaticSounds);
+	if (numStaticClusters)
+		Con_Printf("%i static sounds played through %i clusters\n", numClusteredStatics + numStaticClusters, numStaticClusters);
+	if (occlusion_geometry && FMOD_System_GetCPUUsage(fmod_system, &usage) == FMOD_OK)
+		Con_Printf("%i occlusion polygons, %.2f%% cpu\n", occlusion_numpolys, usage.geometry);
+	if (numPoolExhausted)
+		Con_Printf("sound slot pool exhausted %i times\n", numPoolExhausted);
+	if (FMOD_Memory_GetStats(&memcurrent, &memmax, 0) == FMOD_OK)
+		Con_Printf("FMOD memory: %.1f MB, peak %.1f MB, %i compressed and %i mapped samples loaded\n", memcurrent / (1024.0f * 1024.0f), memmax / (1024.0f * 1024.0f), numCompressedSamples, numMappedSamples);
+	if (numResampledSamples)
+		Con_Printf("%i samples resampled to %i Hz: %i KB, was %i KB\n", numResampledSamples, fmod_samplerate, resampledBytes / 1024, resampledSrcBytes / 1024);
+	SND_PrintLookupStats();
 }
 
 void S_TouchSound(const char *sample)
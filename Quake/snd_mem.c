@@ -89,41 +89,19 @@ static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 
 /*
 ==============
-S_LoadSound
+S_CacheWav
+
+Parses the WAV file in data and resamples it into the sound's cache entry
 ==============
 */
-sfxcache_t *S_LoadSound (sfx_t *s)
+static sfxcache_t *S_CacheWav (sfx_t *s, byte *data, int datalen)
 {
-	char	namebuffer[256];
-	byte	*data;
 	wavinfo_t	info;
 	int		len;
 	float	stepscale;
 	sfxcache_t	*sc;
-	byte	stackbuf[1*1024];		// avoid dirtying the cache heap
-
-// see if still in memory
-	sc = (sfxcache_t *) Cache_Check (&s->cache);
-	if (sc)
-		return sc;
-
-//	Con_Printf ("S_LoadSound: %x\n", (int)stackbuf);
-
-// load it in
-	q_strlcpy(namebuffer, "sound/", sizeof(namebuffer));
-	q_strlcat(namebuffer, s->name, sizeof(namebuffer));
-
-//	Con_Printf ("loading %s\n",namebuffer);
-
-	data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
-
-	if (!data)
-	{
-		Con_Printf ("Couldn't load %s\n", namebuffer);
-		return NULL;
-	}
 
-	info = GetWavinfo (s->name, data, com_filesize);
+	info = GetWavinfo (s->name, data, datalen);
 	if (info.channels != 1)
 	{
 		Con_Printf ("%s is a stereo sample\n",s->name);
@@ -147,7 +125,7 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 		return NULL;
 	}
 
-	sc = (sfxcache_t *) Cache_Alloc ( &s->cache, len + sizeof(sfxcache_t), s->name);
+	sc = (sfxcache_t *) Cache_Alloc ( &s->cache, len + sizeof(sfxcache_t), s->name, CACHE_SOUND);
 	if (!sc)
 		return NULL;
 
@@ -162,6 +140,51 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 	return sc;
 }
 
+/*
+==============
+S_LoadSound
+==============
+*/
+sfxcache_t *S_LoadSound (sfx_t *s)
+{
+	char	namebuffer[256];
+	byte	*data;
+	sfxcache_t	*sc;
+	qboolean	mapped;
+	byte	stackbuf[1*1024];		// avoid dirtying the cache heap
+
+// see if still in memory
+	sc = (sfxcache_t *) Cache_Check (&s->cache);
+	if (sc)
+		return sc;
+
+//	Con_Printf ("S_LoadSound: %x\n", (int)stackbuf);
+
+// load it in
+	q_strlcpy(namebuffer, "sound/", sizeof(namebuffer));
+	q_strlcat(namebuffer, s->name, sizeof(namebuffer));
+
+//	Con_Printf ("loading %s\n",namebuffer);
+
+	data = COM_MapFile(namebuffer, NULL);
+	mapped = (data != NULL);
+	if (!mapped)
+		data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+
+	if (!data)
+	{
+		Con_Printf ("Couldn't load %s\n", namebuffer);
+		return NULL;
+	}
+
+	sc = S_CacheWav (s, data, com_filesize);
+
+	if (mapped)
+		COM_UnmapFile (data);
+
+	return sc;
+}
+
 #endif	// USE_FMOD
 
 /*
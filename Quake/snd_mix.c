@@ -25,9 +25,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #ifndef USE_FMOD
 
-#define	PAINTBUFFER_SIZE	2048
 portable_samplepair_t paintbuffer[PAINTBUFFER_SIZE];
-int		snd_scaletable[32][256];
+int		snd_scaletable[32][256];	// sample * scale, the SIMD mixers rely on that
 int		*snd_p, snd_linear_count;
 short		*snd_out;
 
@@ -35,27 +34,7 @@ static int	snd_vol;
 
 static void Snd_WriteLinearBlastStereo16 (void)
 {
-	int		i;
-	int		val;
-
-	for (i = 0; i < snd_linear_count; i += 2)
-	{
-		val = snd_p[i] / 256;
-		if (val > 0x7fff)
-			snd_out[i] = 0x7fff;
-		else if (val < (short)0x8000)
-			snd_out[i] = (short)0x8000;
-		else
-			snd_out[i] = val;
-
-		val = snd_p[i+1] / 256;
-		if (val > 0x7fff)
-			snd_out[i+1] = 0x7fff;
-		else if (val < (short)0x8000)
-			snd_out[i+1] = (short)0x8000;
-		else
-			snd_out[i+1] = val;
-	}
+	snd_mixkernels.transfer16 (snd_out, snd_p, snd_linear_count);
 }
 
 static void S_TransferStereo16 (int endtime)
@@ -239,11 +218,8 @@ known to be 0 and skip 3/4 of the filter kernel.
 */
 static void S_ApplyFilter(filter_t *filter, int *data, int stride, int count)
 {
-	int i, j;
+	int i;
 	float *input;
-	const int kernelsize = filter->kernelsize;
-	const float *kernel = filter->kernel;
-	int parity;
 
 	input = (float *) malloc(sizeof(float) * (filter->kernelsize + count));
 
@@ -260,30 +236,9 @@ static void S_ApplyFilter(filter_t *filter, int *data, int stride, int count)
 	memcpy(filter->memory, input + count, filter->kernelsize * sizeof(float));
 
 // apply the filter
-	parity = filter->parity;
-
-	for (i=0; i<count; i++)
-	{
-		const float *input_plus_i = input + i;
-		float val[4] = {0, 0, 0, 0};
-
-		for (j = (4 - parity) % 4; j < kernelsize; j+=16)
-		{
-			val[0] += kernel[j] * input_plus_i[j];
-			val[1] += kernel[j+4] * input_plus_i[j+4];
-			val[2] += kernel[j+8] * input_plus_i[j+8];
-			val[3] += kernel[j+12] * input_plus_i[j+12];
-		}
-
-	// 4.0 factor is to increase volume by 12 dB; this is to make up the
-	// volume drop caused by the zero-filling this filter does.
-		data[i * stride] = (val[0] + val[1] + val[2] + val[3])
-			* (32768.0 * 256.0 * 4.0);
+	snd_mixkernels.lowpass (data, stride, count, input, filter->kernel, filter->kernelsize, filter->parity);
 
-		parity = (parity + 1) % 4;
-	}
-
-	filter->parity = parity;
+	filter->parity = (filter->parity + count) % 4;
 
 	free(input);
 }
@@ -339,6 +294,7 @@ void S_PaintChannels (int endtime)
 {
 	int		i;
 	int		end, ltime, count;
+	int		rawend;
 	channel_t	*ch;
 	sfxcache_t	*sc;
 
@@ -362,7 +318,7 @@ void S_PaintChannels (int endtime)
 				continue;
 			if (!ch->leftvol && !ch->rightvol)
 				continue;
-			sc = S_LoadSound (ch->sfx);
+			sc = SND_CachedSound (ch->sfx);
 			if (!sc)
 				continue;
 
@@ -407,11 +363,7 @@ void S_PaintChannels (int endtime)
 	// clip each sample to 0dB, then reduce by 6dB (to leave some headroom for
 	// the lowpass filter and the music). the lowpass will smooth out the
 	// clipping
-		for (i=0; i<end-paintedtime; i++)
-		{
-			paintbuffer[i].left = CLAMP(-32768 * 256, paintbuffer[i].left, 32767 * 256) / 2;
-			paintbuffer[i].right = CLAMP(-32768 * 256, paintbuffer[i].right, 32767 * 256) / 2;
-		}
+		snd_mixkernels.clip ((int *)paintbuffer, (end - paintedtime) * 2);
 
 	// apply a lowpass filter
 		if (sndspeed.value == 11025 && shm->speed == 44100)
@@ -421,13 +373,17 @@ void S_PaintChannels (int endtime)
 			S_LowpassFilter(((int *)paintbuffer) + 1, 2, end - paintedtime, &memory_r);
 		}
 
-	// paint in the music
-		if (s_rawend >= paintedtime)
+	// paint in the music, S_RawSamples may be adding to it meanwhile
+		rawend = s_rawend;
+#if defined(USE_SDL2)
+		SDL_MemoryBarrierAcquire ();
+#endif
+		if (rawend >= paintedtime)
 		{	// copy from the streaming sound source
 			int		s;
 			int		stop;
 
-			stop = (end < s_rawend) ? end : s_rawend;
+			stop = (end < rawend) ? end : rawend;
 
 			for (i = paintedtime; i < stop; i++)
 			{
@@ -473,10 +429,8 @@ void SND_InitScaletable (void)
 
 static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
 {
-	int	data;
 	int		*lscale, *rscale;
 	unsigned char	*sfx;
-	int		i;
 
 	if (ch->leftvol > 255)
 		ch->leftvol = 255;
@@ -487,23 +441,15 @@ static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int
 	rscale = snd_scaletable[ch->rightvol >> 3];
 	sfx = (unsigned char *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
-	{
-		data = sfx[i];
-		paintbuffer[paintbufferstart + i].left += lscale[data];
-		paintbuffer[paintbufferstart + i].right += rscale[data];
-	}
+	snd_mixkernels.paint8 ((int *)&paintbuffer[paintbufferstart], sfx, count, lscale, rscale);
 
 	ch->pos += count;
 }
 
 static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
 {
-	int	data;
-	int	left, right;
 	int	leftvol, rightvol;
 	signed short	*sfx;
-	int	i;
 
 	leftvol = ch->leftvol * snd_vol;
 	rightvol = ch->rightvol * snd_vol;
@@ -511,18 +457,11 @@ static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, in
 	rightvol /= 256;
 	sfx = (signed short *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
-	{
-		data = sfx[i];
 	// this was causing integer overflow as observed in quakespasm
 	// with the warpspasm mod moved >>8 to left/right volume above.
 	//	left = (data * leftvol) >> 8;
 	//	right = (data * rightvol) >> 8;
-		left = data * leftvol;
-		right = data * rightvol;
-		paintbuffer[paintbufferstart + i].left += left;
-		paintbuffer[paintbufferstart + i].right += right;
-	}
+	snd_mixkernels.paint16 ((int *)&paintbuffer[paintbufferstart], sfx, count, leftvol, rightvol);
 
 	ch->pos += count;
 }
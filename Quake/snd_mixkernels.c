@@ -0,0 +1,669 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2011 O. Sezer <sezero@users.sourceforge.net>
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// snd_mixkernels.c -- inner loops of the software mixer in snd_mix.c
+//
+// The paint buffer holds 24 bit samples in ints, left and right
+// interleaved. The SIMD versions give the same results as the plain C
+// ones: the integer ones are exact and the lowpass adds its products up
+// in the same order.
+
+#include "quakedef.h"
+
+#ifndef USE_FMOD
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+#define	MAX_FILTER_KERNEL	256	// filter_t kernelsize for snd_filterquality 5 is 224
+#define	MAX_FILTER_INPUT	((MAX_FILTER_KERNEL + PAINTBUFFER_SIZE) / 4 + 4)
+
+static void SND_Paint8_C (int *pb, const byte *sfx, int count, const int *lscale, const int *rscale);
+static void SND_Paint16_C (int *pb, const short *sfx, int count, int leftvol, int rightvol);
+static void SND_Clip_C (int *pb, int count);
+static void SND_Lowpass_C (int *data, int stride, int count, const float *input,
+			   const float *kernel, int kernelsize, int parity);
+static void SND_Transfer16_C (short *out, const int *in, int count);
+
+mixkernels_t	snd_mixkernels = {
+	"C", SND_Paint8_C, SND_Paint16_C, SND_Clip_C, SND_Lowpass_C, SND_Transfer16_C
+};
+
+static cvar_t	snd_mixsimd = {"snd_mixsimd", "1", CVAR_ARCHIVE};
+
+/*
+=============================================================
+
+	PLAIN C
+
+=============================================================
+*/
+
+static void SND_Paint8_C (int *pb, const byte *sfx, int count, const int *lscale, const int *rscale)
+{
+	int	i, data;
+
+	for (i = 0; i < count; i++, pb += 2)
+	{
+		data = sfx[i];
+		pb[0] += lscale[data];
+		pb[1] += rscale[data];
+	}
+}
+
+static void SND_Paint16_C (int *pb, const short *sfx, int count, int leftvol, int rightvol)
+{
+	int	i, data;
+
+	for (i = 0; i < count; i++, pb += 2)
+	{
+		data = sfx[i];
+		pb[0] += data * leftvol;
+		pb[1] += data * rightvol;
+	}
+}
+
+// clip each sample to 0dB, then reduce by 6dB
+static void SND_Clip_C (int *pb, int count)
+{
+	int	i;
+
+	for (i = 0; i < count; i++)
+		pb[i] = CLAMP(-32768 * 256, pb[i], 32767 * 256) / 2;
+}
+
+// the convolution of S_ApplyFilter, see there
+static void SND_Lowpass_C (int *data, int stride, int count, const float *input,
+			   const float *kernel, int kernelsize, int parity)
+{
+	int	i, j;
+
+	for (i=0; i<count; i++)
+	{
+		const float *input_plus_i = input + i;
+		float val[4] = {0, 0, 0, 0};
+
+		for (j = (4 - parity) % 4; j < kernelsize; j+=16)
+		{
+			val[0] += kernel[j] * input_plus_i[j];
+			val[1] += kernel[j+4] * input_plus_i[j+4];
+			val[2] += kernel[j+8] * input_plus_i[j+8];
+			val[3] += kernel[j+12] * input_plus_i[j+12];
+		}
+
+	// 4.0 factor is to increase volume by 12 dB; this is to make up the
+	// volume drop caused by the zero-filling this filter does.
+		data[i * stride] = (val[0] + val[1] + val[2] + val[3])
+			* (32768.0 * 256.0 * 4.0);
+
+		parity = (parity + 1) % 4;
+	}
+}
+
+// to 16 bit, clamped
+static void SND_Transfer16_C (short *out, const int *in, int count)
+{
+	int	i, val;
+
+	for (i = 0; i < count; i++)
+	{
+		val = in[i] / 256;
+		if (val > 0x7fff)
+			out[i] = 0x7fff;
+		else if (val < (short)0x8000)
+			out[i] = (short)0x8000;
+		else
+			out[i] = val;
+	}
+}
+
+/*
+=============
+SND_SplitKernel
+
+The output at parity p only uses the taps at (4 - p) % 4 + 4m of the
+kernel, and all outputs read the same quarter of the input, the samples
+that weren't zero-filled.  Splitting both into contiguous arrays turns
+each output into a plain dot product, with lane l of a 4 wide sum doing
+what val[l] does in the C version.  Returns the taps per phase.
+=============
+*/
+static float	snd_kernelphases[4][MAX_FILTER_KERNEL / 4];
+static float	snd_decimated[MAX_FILTER_INPUT];
+
+static int SND_SplitKernel (const float *input, int count, const float *kernel, int kernelsize, int parity)
+{
+	int	i, j, r, taps;
+
+	taps = kernelsize / 4;
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < taps; j++)
+			snd_kernelphases[i][j] = kernel[i + j*4];
+	}
+
+	r = (4 - parity) % 4;
+	for (j = 0; r + j*4 < kernelsize + count; j++)
+		snd_decimated[j] = input[r + j*4];
+
+	return taps;
+}
+
+/*
+=============================================================
+
+	SSE2
+
+=============================================================
+*/
+
+#ifdef USE_SSE2
+
+// pb += samples * scale, for 2 interleaved stereo pairs
+static void SND_AddScaled_SSE2 (int *pb, __m128i samples, __m128 vscale)
+{
+	__m128i	v;
+
+	v = _mm_cvttps_epi32 (_mm_mul_ps (_mm_cvtepi32_ps (samples), vscale));
+	_mm_storeu_si128 ((__m128i *)pb, _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *)pb), v));
+}
+
+static void SND_Paint8_SSE2 (int *pb, const byte *sfx, int count, const int *lscale, const int *rscale)
+{
+	__m128	vscale;
+	__m128i	v, lo, hi;
+	int	i;
+
+	// the tables hold sample * scale, so entry 1 is the scale.  the
+	// products stay below 2^24, exact in a float, while it's below 2^17
+	if (abs (lscale[1]) >= 0x20000 || abs (rscale[1]) >= 0x20000)
+	{
+		SND_Paint8_C (pb, sfx, count, lscale, rscale);
+		return;
+	}
+
+	vscale = _mm_setr_ps ((float)lscale[1], (float)rscale[1], (float)lscale[1], (float)rscale[1]);
+	for (i = 0; i + 8 <= count; i += 8, pb += 16)
+	{
+		// 8 signed samples, each twice for left and right
+		v = _mm_loadl_epi64 ((const __m128i *)(sfx + i));
+		v = _mm_srai_epi16 (_mm_unpacklo_epi8 (v, v), 8);
+		lo = _mm_unpacklo_epi16 (v, v);
+		hi = _mm_unpackhi_epi16 (v, v);
+		SND_AddScaled_SSE2 (pb + 0, _mm_srai_epi32 (_mm_unpacklo_epi16 (lo, lo), 16), vscale);
+		SND_AddScaled_SSE2 (pb + 4, _mm_srai_epi32 (_mm_unpackhi_epi16 (lo, lo), 16), vscale);
+		SND_AddScaled_SSE2 (pb + 8, _mm_srai_epi32 (_mm_unpacklo_epi16 (hi, hi), 16), vscale);
+		SND_AddScaled_SSE2 (pb + 12, _mm_srai_epi32 (_mm_unpackhi_epi16 (hi, hi), 16), vscale);
+	}
+
+	SND_Paint8_C (pb, sfx + i, count - i, lscale, rscale);
+}
+
+static void SND_Paint16_SSE2 (int *pb, const short *sfx, int count, int leftvol, int rightvol)
+{
+	__m128i	vvol, v, lo, hi;
+	int	i;
+
+	// the multiply-adds take 16 bit volumes
+	if (leftvol <= -32768 || leftvol > 32767 || rightvol <= -32768 || rightvol > 32767)
+	{
+		SND_Paint16_C (pb, sfx, count, leftvol, rightvol);
+		return;
+	}
+
+	// with each sample in both halves of a pair, madd gives sample * vol
+	vvol = _mm_setr_epi16 ((short)leftvol, 0, (short)rightvol, 0, (short)leftvol, 0, (short)rightvol, 0);
+	for (i = 0; i + 8 <= count; i += 8, pb += 16)
+	{
+		v = _mm_loadu_si128 ((const __m128i *)(sfx + i));
+		lo = _mm_unpacklo_epi16 (v, v);
+		hi = _mm_unpackhi_epi16 (v, v);
+		_mm_storeu_si128 ((__m128i *)(pb + 0), _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *)(pb + 0)),
+					_mm_madd_epi16 (_mm_unpacklo_epi32 (lo, lo), vvol)));
+		_mm_storeu_si128 ((__m128i *)(pb + 4), _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *)(pb + 4)),
+					_mm_madd_epi16 (_mm_unpackhi_epi32 (lo, lo), vvol)));
+		_mm_storeu_si128 ((__m128i *)(pb + 8), _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *)(pb + 8)),
+					_mm_madd_epi16 (_mm_unpacklo_epi32 (hi, hi), vvol)));
+		_mm_storeu_si128 ((__m128i *)(pb + 12), _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *)(pb + 12)),
+					_mm_madd_epi16 (_mm_unpackhi_epi32 (hi, hi), vvol)));
+	}
+
+	SND_Paint16_C (pb, sfx + i, count - i, leftvol, rightvol);
+}
+
+static void SND_Clip_SSE2 (int *pb, int count)
+{
+	__m128i	vmin, vmax, v, mask;
+	int	i;
+
+	vmin = _mm_set1_epi32 (-32768 * 256);
+	vmax = _mm_set1_epi32 (32767 * 256);
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		v = _mm_loadu_si128 ((const __m128i *)(pb + i));
+		mask = _mm_cmpgt_epi32 (v, vmax);
+		v = _mm_or_si128 (_mm_and_si128 (mask, vmax), _mm_andnot_si128 (mask, v));
+		mask = _mm_cmplt_epi32 (v, vmin);
+		v = _mm_or_si128 (_mm_and_si128 (mask, vmin), _mm_andnot_si128 (mask, v));
+		// halve, rounding towards zero like the division does
+		v = _mm_srai_epi32 (_mm_add_epi32 (v, _mm_srli_epi32 (v, 31)), 1);
+		_mm_storeu_si128 ((__m128i *)(pb + i), v);
+	}
+
+	SND_Clip_C (pb + i, count - i);
+}
+
+static void SND_Lowpass_SSE2 (int *data, int stride, int count, const float *input,
+			      const float *kernel, int kernelsize, int parity)
+{
+	const float	*phase, *in;
+	__m128	sum;
+	float	val[4];
+	int	i, j, s, r, taps;
+
+	if (kernelsize > MAX_FILTER_KERNEL || count > PAINTBUFFER_SIZE)
+	{
+		SND_Lowpass_C (data, stride, count, input, kernel, kernelsize, parity);
+		return;
+	}
+
+	taps = SND_SplitKernel (input, count, kernel, kernelsize, parity);
+	r = (4 - parity) % 4;
+	for (i=0; i<count; i++)
+	{
+		s = (4 - parity) % 4;
+		phase = snd_kernelphases[s];
+		in = snd_decimated + (i + s - r) / 4;
+
+		sum = _mm_setzero_ps ();
+		for (j = 0; j < taps; j += 4)
+			sum = _mm_add_ps (sum, _mm_mul_ps (_mm_loadu_ps (phase + j), _mm_loadu_ps (in + j)));
+		_mm_storeu_ps (val, sum);
+
+		data[i * stride] = (val[0] + val[1] + val[2] + val[3])
+			* (32768.0 * 256.0 * 4.0);
+
+		parity = (parity + 1) % 4;
+	}
+}
+
+static void SND_Transfer16_SSE2 (short *out, const int *in, int count)
+{
+	__m128i	round, a, b;
+	int	i;
+
+	// divide by 256 rounding towards zero, then saturate to shorts
+	round = _mm_set1_epi32 (255);
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		a = _mm_loadu_si128 ((const __m128i *)(in + i));
+		b = _mm_loadu_si128 ((const __m128i *)(in + i + 4));
+		a = _mm_srai_epi32 (_mm_add_epi32 (a, _mm_and_si128 (_mm_srai_epi32 (a, 31), round)), 8);
+		b = _mm_srai_epi32 (_mm_add_epi32 (b, _mm_and_si128 (_mm_srai_epi32 (b, 31), round)), 8);
+		_mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (a, b));
+	}
+
+	SND_Transfer16_C (out + i, in + i, count - i);
+}
+
+#endif /* USE_SSE2 */
+
+/*
+=============================================================
+
+	NEON
+
+=============================================================
+*/
+
+#ifdef USE_NEON
+
+static void SND_Paint8_NEON (int *pb, const byte *sfx, int count, const int *lscale, const int *rscale)
+{
+	int16x8_t	v;
+	int32x4_t	lo, hi;
+	int32x4x2_t	p;
+	int		i;
+
+	// the tables hold sample * scale, so entry 1 is the scale
+	for (i = 0; i + 8 <= count; i += 8, pb += 16)
+	{
+		v = vmovl_s8 (vreinterpret_s8_u8 (vld1_u8 (sfx + i)));
+		lo = vmovl_s16 (vget_low_s16 (v));
+		hi = vmovl_s16 (vget_high_s16 (v));
+
+		p = vld2q_s32 (pb);
+		p.val[0] = vaddq_s32 (p.val[0], vmulq_n_s32 (lo, lscale[1]));
+		p.val[1] = vaddq_s32 (p.val[1], vmulq_n_s32 (lo, rscale[1]));
+		vst2q_s32 (pb, p);
+
+		p = vld2q_s32 (pb + 8);
+		p.val[0] = vaddq_s32 (p.val[0], vmulq_n_s32 (hi, lscale[1]));
+		p.val[1] = vaddq_s32 (p.val[1], vmulq_n_s32 (hi, rscale[1]));
+		vst2q_s32 (pb + 8, p);
+	}
+
+	SND_Paint8_C (pb, sfx + i, count - i, lscale, rscale);
+}
+
+static void SND_Paint16_NEON (int *pb, const short *sfx, int count, int leftvol, int rightvol)
+{
+	int16x8_t	v;
+	int32x4x2_t	p;
+	int		i;
+
+	for (i = 0; i + 8 <= count; i += 8, pb += 16)
+	{
+		v = vld1q_s16 (sfx + i);
+
+		p = vld2q_s32 (pb);
+		p.val[0] = vaddq_s32 (p.val[0], vmulq_n_s32 (vmovl_s16 (vget_low_s16 (v)), leftvol));
+		p.val[1] = vaddq_s32 (p.val[1], vmulq_n_s32 (vmovl_s16 (vget_low_s16 (v)), rightvol));
+		vst2q_s32 (pb, p);
+
+		p = vld2q_s32 (pb + 8);
+		p.val[0] = vaddq_s32 (p.val[0], vmulq_n_s32 (vmovl_s16 (vget_high_s16 (v)), leftvol));
+		p.val[1] = vaddq_s32 (p.val[1], vmulq_n_s32 (vmovl_s16 (vget_high_s16 (v)), rightvol));
+		vst2q_s32 (pb + 8, p);
+	}
+
+	SND_Paint16_C (pb, sfx + i, count - i, leftvol, rightvol);
+}
+
+static void SND_Clip_NEON (int *pb, int count)
+{
+	int32x4_t	vmin, vmax, v;
+	int		i;
+
+	vmin = vdupq_n_s32 (-32768 * 256);
+	vmax = vdupq_n_s32 (32767 * 256);
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		v = vminq_s32 (vmaxq_s32 (vld1q_s32 (pb + i), vmin), vmax);
+		// halve, rounding towards zero like the division does
+		v = vshrq_n_s32 (vaddq_s32 (v, vreinterpretq_s32_u32 (vshrq_n_u32 (vreinterpretq_u32_s32 (v), 31))), 1);
+		vst1q_s32 (pb + i, v);
+	}
+
+	SND_Clip_C (pb + i, count - i);
+}
+
+static void SND_Lowpass_NEON (int *data, int stride, int count, const float *input,
+			      const float *kernel, int kernelsize, int parity)
+{
+	const float	*phase, *in;
+	float32x4_t	sum;
+	float		val[4];
+	int		i, j, s, r, taps;
+
+	if (kernelsize > MAX_FILTER_KERNEL || count > PAINTBUFFER_SIZE)
+	{
+		SND_Lowpass_C (data, stride, count, input, kernel, kernelsize, parity);
+		return;
+	}
+
+	taps = SND_SplitKernel (input, count, kernel, kernelsize, parity);
+	r = (4 - parity) % 4;
+	for (i=0; i<count; i++)
+	{
+		s = (4 - parity) % 4;
+		phase = snd_kernelphases[s];
+		in = snd_decimated + (i + s - r) / 4;
+
+		// separate multiplies and adds, a fused one would round differently
+		sum = vdupq_n_f32 (0);
+		for (j = 0; j < taps; j += 4)
+			sum = vaddq_f32 (sum, vmulq_f32 (vld1q_f32 (phase + j), vld1q_f32 (in + j)));
+		vst1q_f32 (val, sum);
+
+		data[i * stride] = (val[0] + val[1] + val[2] + val[3])
+			* (32768.0 * 256.0 * 4.0);
+
+		parity = (parity + 1) % 4;
+	}
+}
+
+static void SND_Transfer16_NEON (short *out, const int *in, int count)
+{
+	int32x4_t	a, b;
+	int		i;
+
+	// divide by 256 rounding towards zero, then saturate to shorts
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		a = vld1q_s32 (in + i);
+		b = vld1q_s32 (in + i + 4);
+		a = vshrq_n_s32 (vaddq_s32 (a, vandq_s32 (vshrq_n_s32 (a, 31), vdupq_n_s32 (255))), 8);
+		b = vshrq_n_s32 (vaddq_s32 (b, vandq_s32 (vshrq_n_s32 (b, 31), vdupq_n_s32 (255))), 8);
+		vst1q_s16 (out + i, vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b)));
+	}
+
+	SND_Transfer16_C (out + i, in + i, count - i);
+}
+
+#endif /* USE_NEON */
+
+//==============================================================================
+
+/*
+=============
+SND_PickMixKernels
+
+Picks the fastest kernels the CPU supports, unless snd_mixsimd is 0.
+=============
+*/
+static void SND_PickMixKernels (void)
+{
+	snd_mixkernels.name = "C";
+	snd_mixkernels.paint8 = SND_Paint8_C;
+	snd_mixkernels.paint16 = SND_Paint16_C;
+	snd_mixkernels.clip = SND_Clip_C;
+	snd_mixkernels.lowpass = SND_Lowpass_C;
+	snd_mixkernels.transfer16 = SND_Transfer16_C;
+
+	if (!snd_mixsimd.value)
+		return;
+
+#ifdef USE_SSE2
+	if (SDL_HasSSE2 ())
+	{
+		snd_mixkernels.name = "SSE2";
+		snd_mixkernels.paint8 = SND_Paint8_SSE2;
+		snd_mixkernels.paint16 = SND_Paint16_SSE2;
+		snd_mixkernels.clip = SND_Clip_SSE2;
+		snd_mixkernels.lowpass = SND_Lowpass_SSE2;
+		snd_mixkernels.transfer16 = SND_Transfer16_SSE2;
+	}
+#endif
+#ifdef USE_NEON
+#if defined(USE_SDL2) && !defined(__aarch64__)
+	if (SDL_HasNEON ())
+#endif
+	{
+		snd_mixkernels.name = "NEON";
+		snd_mixkernels.paint8 = SND_Paint8_NEON;
+		snd_mixkernels.paint16 = SND_Paint16_NEON;
+		snd_mixkernels.clip = SND_Clip_NEON;
+		snd_mixkernels.lowpass = SND_Lowpass_NEON;
+		snd_mixkernels.transfer16 = SND_Transfer16_NEON;
+	}
+#endif
+}
+
+static void SND_MixSIMD_f (cvar_t *var)
+{
+	SND_PickMixKernels ();
+}
+
+/*
+=============
+SND_MixBench_f
+
+Runs a paint buffer's worth of mixing for 128 channels through the
+current kernels and the plain C ones n times, and reports the time
+taken and whether both came out the same.
+=============
+*/
+#define	BENCH_CHANNELS	128
+#define	BENCH_KERNEL	224
+
+typedef struct
+{
+	int		paint[PAINTBUFFER_SIZE * 2];
+	short		out[PAINTBUFFER_SIZE * 2];
+	double		paintms, clipms, lowpassms, transferms;
+} mixbench_t;
+
+static void SND_MixBenchRun (const mixkernels_t *k, mixbench_t *b, int n, const byte *sfx8, const short *sfx16,
+			     const float *input, const float *kernel)
+{
+	double	t;
+	int	pass, i;
+
+	b->paintms = b->clipms = b->lowpassms = b->transferms = 0;
+	for (pass = 0; pass < n; pass++)
+	{
+		memset (b->paint, 0, sizeof(b->paint));
+
+		t = Sys_DoubleTime ();
+		for (i = 0; i < BENCH_CHANNELS; i++)
+		{
+			if (i & 1)
+				k->paint16 (b->paint, sfx16 + i, PAINTBUFFER_SIZE - BENCH_CHANNELS, 37 + i, 200 - i);
+			else
+				k->paint8 (b->paint, sfx8 + i, PAINTBUFFER_SIZE - BENCH_CHANNELS,
+					   snd_scaletable[i & 31], snd_scaletable[31 - (i & 31)]);
+		}
+		b->paintms += Sys_DoubleTime () - t;
+
+		t = Sys_DoubleTime ();
+		k->clip (b->paint, PAINTBUFFER_SIZE * 2);
+		b->clipms += Sys_DoubleTime () - t;
+
+		t = Sys_DoubleTime ();
+		k->lowpass (b->paint, 2, PAINTBUFFER_SIZE, input, kernel, BENCH_KERNEL, pass & 3);
+		k->lowpass (b->paint + 1, 2, PAINTBUFFER_SIZE, input, kernel, BENCH_KERNEL, pass & 3);
+		b->lowpassms += Sys_DoubleTime () - t;
+
+		t = Sys_DoubleTime ();
+		k->transfer16 (b->out, b->paint, PAINTBUFFER_SIZE * 2);
+		b->transferms += Sys_DoubleTime () - t;
+	}
+
+	b->paintms *= 1000.0 / n;
+	b->clipms *= 1000.0 / n;
+	b->lowpassms *= 1000.0 / n;
+	b->transferms *= 1000.0 / n;
+}
+
+static void SND_MixBench_f (void)
+{
+	mixkernels_t	plain;
+	mixbench_t	*cur, *ref;
+	byte		*sfx8;
+	short		*sfx16;
+	float		*input, *kernel;
+	int		i, n;
+
+	n = (Cmd_Argc () > 1) ? Q_atoi (Cmd_Argv (1)) : 100;
+	if (n < 1)
+		n = 1;
+
+	cur = (mixbench_t *) malloc (sizeof(mixbench_t) * 2);
+	sfx8 = (byte *) malloc (PAINTBUFFER_SIZE);
+	sfx16 = (short *) malloc (PAINTBUFFER_SIZE * sizeof(short));
+	input = (float *) malloc ((BENCH_KERNEL + PAINTBUFFER_SIZE) * sizeof(float));
+	kernel = (float *) malloc (BENCH_KERNEL * sizeof(float));
+	if (!cur || !sfx8 || !sfx16 || !input || !kernel)
+	{
+		Con_Printf ("snd_mixbench: out of memory\n");
+		free (cur); free (sfx8); free (sfx16); free (input); free (kernel);
+		return;
+	}
+	ref = cur + 1;
+
+	// loud noise, so the clipping has something to do
+	srand (1);
+	for (i = 0; i < PAINTBUFFER_SIZE; i++)
+	{
+		sfx8[i] = rand () & 255;
+		sfx16[i] = (rand () & 0xffff) - 0x8000;
+	}
+	for (i = 0; i < BENCH_KERNEL + PAINTBUFFER_SIZE; i++)
+		input[i] = (rand () & 0xffff) / 65536.0f - 0.5f;
+	for (i = 0; i < BENCH_KERNEL; i++)
+		kernel[i] = (i < BENCH_KERNEL - 1) ? 1.0f / BENCH_KERNEL : 0;
+
+	plain.name = "C";
+	plain.paint8 = SND_Paint8_C;
+	plain.paint16 = SND_Paint16_C;
+	plain.clip = SND_Clip_C;
+	plain.lowpass = SND_Lowpass_C;
+	plain.transfer16 = SND_Transfer16_C;
+
+	SND_MixBenchRun (&snd_mixkernels, cur, n, sfx8, sfx16, input, kernel);
+	SND_MixBenchRun (&plain, ref, n, sfx8, sfx16, input, kernel);
+
+	Con_Printf ("%i channels, %i samples, ms per pass:\n", BENCH_CHANNELS, PAINTBUFFER_SIZE);
+	Con_Printf ("%-5s paint %.3f  clip %.3f  lowpass %.3f  transfer %.3f\n",
+			snd_mixkernels.name, cur->paintms, cur->clipms, cur->lowpassms, cur->transferms);
+	Con_Printf ("%-5s paint %.3f  clip %.3f  lowpass %.3f  transfer %.3f\n",
+			plain.name, ref->paintms, ref->clipms, ref->lowpassms, ref->transferms);
+	if (memcmp (cur->paint, ref->paint, sizeof(cur->paint)) || memcmp (cur->out, ref->out, sizeof(cur->out)))
+		Con_Printf ("results differ from the C kernels\n");
+
+	free (cur);
+	free (sfx8);
+	free (sfx16);
+	free (input);
+	free (kernel);
+}
+
+void SND_InitMixKernels (void)
+{
+	Cvar_RegisterVariable (&snd_mixsimd);
+	Cvar_SetCallback (&snd_mixsimd, SND_MixSIMD_f);
+	Cmd_AddCommand ("snd_mixbench", SND_MixBench_f);
+
+	SND_PickMixKernels ();
+	Con_SafePrintf ("Mixer kernels: %s\n", snd_mixkernels.name);
+}
+
+const char *SND_MixKernelsName (void)
+{
+	return snd_mixkernels.name;
+}
+
+#else	// USE_FMOD
+
+const char *SND_MixKernelsName (void)
+{
+	return "FMOD";
+}
+
+#endif	// USE_FMOD
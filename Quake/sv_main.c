@@ -22,12 +22,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // sv_main.c -- server main program
 
 #include "quakedef.h"
+#include "bgmusic.h"
 
 server_t	sv;
 server_static_t	svs;
 
 static char	localmodels[MAX_MODELS][8];	// inline model names for precache
 
+static sizebuf_t	sv_multicast[MAX_SCOREBOARD];	// see SV_Multicast
+static byte			sv_multicast_buf[MAX_SCOREBOARD][MAX_DATAGRAM];
+
 int		sv_protocol = PROTOCOL_FITZQUAKE; //johnfitz
 
 extern qboolean	pr_alpha_supported; //johnfitz
@@ -51,8 +55,8 @@ void SV_Protocol_f (void)
 		break;
 	case 2:
 		i = atoi(Cmd_Argv(1));
-		if (i != PROTOCOL_NETQUAKE && i != PROTOCOL_FITZQUAKE && i != PROTOCOL_RMQ)
-			Con_Printf ("sv_protocol must be %i or %i or %i\n", PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ);
+		if (i != PROTOCOL_NETQUAKE && i != PROTOCOL_FITZQUAKE && i != PROTOCOL_RMQ && i != PROTOCOL_DELTA)
+			Con_Printf ("sv_protocol must be %i or %i or %i or %i\n", PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ, PROTOCOL_DELTA);
 		else
 		{
 			sv_protocol = i;
@@ -79,6 +83,14 @@ void SV_Init (void)
 	extern	cvar_t	sv_gravity;
 	extern	cvar_t	sv_nostep;
 	extern	cvar_t	sv_freezenonclients;
+	extern	cvar_t	sv_parallelphysics;
+	extern	cvar_t	sv_pushquery;
+	extern	cvar_t	sv_parallelsend;
+	extern	cvar_t	sv_rate;
+	extern	cvar_t	sv_phs;
+	extern	cvar_t	sv_preloadmaps;
+	extern	cvar_t	sv_areatree;
+	extern	cvar_t	sv_tracecache;
 	extern	cvar_t	sv_friction;
 	extern	cvar_t	sv_edgefriction;
 	extern	cvar_t	sv_stopspeed;
@@ -104,9 +116,23 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_aim);
 	Cvar_RegisterVariable (&sv_nostep);
 	Cvar_RegisterVariable (&sv_freezenonclients);
+	Cvar_RegisterVariable (&sv_parallelphysics);
+	Cvar_RegisterVariable (&sv_pushquery);
+	Cvar_RegisterVariable (&sv_parallelsend);
+	Cvar_RegisterVariable (&sv_rate);
+	Cvar_RegisterVariable (&sv_phs);
+	Cvar_RegisterVariable (&sv_preloadmaps);
+	Cvar_RegisterVariable (&sv_areatree);
+	Cvar_SetCallback (&sv_areatree, SV_AreaTree_f);
+	Cvar_RegisterVariable (&sv_tracecache);
 	Cvar_RegisterVariable (&sv_altnoclip); //johnfitz
 
 	Cmd_AddCommand ("sv_protocol", &SV_Protocol_f); //johnfitz
+	Cmd_AddCommand ("sv_areastats", &SV_AreaStats_f);
+	Cmd_AddCommand ("sv_profile", &SV_Profile_f);
+	Cmd_AddCommand ("sv_tracecapture", &SV_TraceCapture_f);
+	Cmd_AddCommand ("sv_tracebench", &SV_TraceBench_f);
+	SV_ReplayInit ();
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
@@ -125,9 +151,12 @@ void SV_Init (void)
 	case PROTOCOL_RMQ:
 		p = "RMQ";
 		break;
+	case PROTOCOL_DELTA:
+		p = "Delta";
+		break;
 	default:
-		Sys_Error ("Bad protocol version request %i. Accepted values: %i, %i, %i.",
-				sv_protocol, PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ);
+		Sys_Error ("Bad protocol version request %i. Accepted values: %i, %i, %i, %i.",
+				sv_protocol, PROTOCOL_NETQUAKE, PROTOCOL_FITZQUAKE, PROTOCOL_RMQ, PROTOCOL_DELTA);
 		return; /* silence compiler */
 	}
 	Sys_Printf ("Server using protocol %i (%s)\n", sv_protocol, p);
@@ -150,14 +179,20 @@ Make sure the event gets sent to all clients
 */
 void SV_StartParticle (vec3_t org, vec3_t dir, int color, int count)
 {
-	int		i, v;
+	int			i, v;
+	sizebuf_t	msg;
+	byte		buf[32];
 
-	if (sv.datagram.cursize > MAX_DATAGRAM-16)
-		return;
-	MSG_WriteByte (&sv.datagram, svc_particle);
-	MSG_WriteCoord (&sv.datagram, org[0], sv.protocolflags);
-	MSG_WriteCoord (&sv.datagram, org[1], sv.protocolflags);
-	MSG_WriteCoord (&sv.datagram, org[2], sv.protocolflags);
+	msg.data = buf;
+	msg.maxsize = sizeof(buf);
+	msg.cursize = 0;
+	msg.allowoverflow = false;
+	msg.overflowed = false;
+
+	MSG_WriteByte (&msg, svc_particle);
+	MSG_WriteCoord (&msg, org[0], sv.protocolflags);
+	MSG_WriteCoord (&msg, org[1], sv.protocolflags);
+	MSG_WriteCoord (&msg, org[2], sv.protocolflags);
 	for (i=0 ; i<3 ; i++)
 	{
 		v = dir[i]*16;
@@ -165,10 +200,12 @@ void SV_StartParticle (vec3_t org, vec3_t dir, int color, int count)
 			v = 127;
 		else if (v < -128)
 			v = -128;
-		MSG_WriteChar (&sv.datagram, v);
+		MSG_WriteChar (&msg, v);
 	}
-	MSG_WriteByte (&sv.datagram, count);
-	MSG_WriteByte (&sv.datagram, color);
+	MSG_WriteByte (&msg, count);
+	MSG_WriteByte (&msg, color);
+
+	SV_Multicast (org, &msg, true);
 }
 
 /*
@@ -190,6 +227,9 @@ void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume
 {
 	int			sound_num, ent;
 	int			i, field_mask;
+	vec3_t		org;
+	sizebuf_t	msg;
+	byte		buf[32];
 
 	if (volume < 0 || volume > 255)
 		Host_Error ("SV_StartSound: volume = %i", volume);
@@ -200,9 +240,6 @@ void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume
 	if (channel < 0 || channel > 7)
 		Host_Error ("SV_StartSound: channel = %i", channel);
 
-	if (sv.datagram.cursize > MAX_DATAGRAM-16)
-		return;
-
 // find precache number for sound
 	for (sound_num = 1; sound_num < MAX_SOUNDS && sv.sound_precache[sound_num]; sound_num++)
 	{
@@ -242,29 +279,41 @@ void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume
 	//johnfitz
 
 // directed messages go only to the entity the are targeted on
-	MSG_WriteByte (&sv.datagram, svc_sound);
-	MSG_WriteByte (&sv.datagram, field_mask);
+	msg.data = buf;
+	msg.maxsize = sizeof(buf);
+	msg.cursize = 0;
+	msg.allowoverflow = false;
+	msg.overflowed = false;
+
+	MSG_WriteByte (&msg, svc_sound);
+	MSG_WriteByte (&msg, field_mask);
 	if (field_mask & SND_VOLUME)
-		MSG_WriteByte (&sv.datagram, volume);
+		MSG_WriteByte (&msg, volume);
 	if (field_mask & SND_ATTENUATION)
-		MSG_WriteByte (&sv.datagram, attenuation*64);
+		MSG_WriteByte (&msg, attenuation*64);
 
 	//johnfitz -- PROTOCOL_FITZQUAKE
 	if (field_mask & SND_LARGEENTITY)
 	{
-		MSG_WriteShort (&sv.datagram, ent);
-		MSG_WriteByte (&sv.datagram, channel);
+		MSG_WriteShort (&msg, ent);
+		MSG_WriteByte (&msg, channel);
 	}
 	else
-		MSG_WriteShort (&sv.datagram, (ent<<3) | channel);
+		MSG_WriteShort (&msg, (ent<<3) | channel);
 	if (field_mask & SND_LARGESOUND)
-		MSG_WriteShort (&sv.datagram, sound_num);
+		MSG_WriteShort (&msg, sound_num);
 	else
-		MSG_WriteByte (&sv.datagram, sound_num);
+		MSG_WriteByte (&msg, sound_num);
 	//johnfitz
 
 	for (i = 0; i < 3; i++)
-		MSG_WriteCoord (&sv.datagram, entity->v.origin[i]+0.5*(entity->v.mins[i]+entity->v.maxs[i]), sv.protocolflags);
+	{
+		org[i] = entity->v.origin[i]+0.5*(entity->v.mins[i]+entity->v.maxs[i]);
+		MSG_WriteCoord (&msg, org[i], sv.protocolflags);
+	}
+
+// sounds at no attenuation are heard everywhere
+	SV_Multicast (org, &msg, attenuation != 0);
 }
 
 /*
@@ -275,6 +324,35 @@ CLIENT SPAWNING
 ==============================================================================
 */
 
+static entframe_t	sv_entframes[MAX_SCOREBOARD][ENTFRAMES];	// PROTOCOL_DELTA, kept out of client_t so they survive SV_ConnectClient
+static float		sv_entsenttime[MAX_SCOREBOARD][MAX_EDICTS];	// sv.time each entity was last current on the client
+
+/*
+=============
+SV_ResetEntFrames
+
+Called when the client gets a serverinfo, all of its frames refer to the old level
+=============
+*/
+static void SV_ResetEntFrames (client_t *client)
+{
+	entframe_t	*frames;
+	int			i;
+
+	frames = sv_entframes[client - svs.clients];
+	for (i = 0; i < ENTFRAMES; i++)
+	{
+		frames[i].sequence = 0;
+		frames[i].numents = 0;
+	}
+	client->entframe = 0;
+	client->entframeack = 0;
+
+	memset (sv_entsenttime[client - svs.clients], 0, sizeof(sv_entsenttime[0]));
+	client->deferredents = 0;
+	client->deferredtotal = 0;
+}
+
 /*
 ================
 SV_SendServerinfo
@@ -337,6 +415,8 @@ void SV_SendServerinfo (client_t *client)
 
 	client->sendsignon = true;
 	client->spawned = false;		// need prespawn, spawn, etc
+
+	SV_ResetEntFrames (client);
 }
 
 /*
@@ -405,6 +485,12 @@ void SV_CheckForNewClients (void)
 	struct qsocket_s	*ret;
 	int				i;
 
+	if (sv_replaying)
+	{
+		SV_ReplayNewClients ();
+		return;
+	}
+
 //
 // check for new connections
 //
@@ -425,6 +511,7 @@ void SV_CheckForNewClients (void)
 
 		svs.clients[i].netconnection = ret;
 		SV_ConnectClient (i);
+		SV_RecordConnect (&svs.clients[i]);
 
 		net_activeconnections++;
 	}
@@ -447,7 +534,11 @@ SV_ClearDatagram
 */
 void SV_ClearDatagram (void)
 {
+	int		i;
+
 	SZ_Clear (&sv.datagram);
+	for (i=0 ; i<MAX_SCOREBOARD ; i++)
+		SZ_Clear (&sv_multicast[i]);
 }
 
 /*
@@ -461,29 +552,78 @@ crosses a waterline.
 =============================================================================
 */
 
-static int	fatbytes;
-static byte	*fatpvs;
-static int	fatpvs_capacity;
+#define	FATPVS_CACHE		64		// must be more than MAX_SCOREBOARD, see SV_FatPVS
+#define	FATPVS_MAXLEAFS		32
 
-void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
+typedef struct
+{
+	qboolean	valid;
+	int			numleafs;		// -1 = too many to key on, never matches
+	int			leafs[FATPVS_MAXLEAFS];
+	int			lastused;
+	byte		*pvs;
+	int			capacity;
+} fatpvsentry_t;
+
+static fatpvsentry_t	fatpvscache[FATPVS_CACHE];
+static qmodel_t			*fatpvsmodel;
+static int				fatpvsframe;
+static int				fatpvsclears;	// for SV_VisibleToClient, cached pointers die here
+
+void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel, byte *pvs) //johnfitz -- added worldmodel as a parameter
 {
-	int		i;
-	byte	*pvs;
 	mplane_t	*plane;
 	float	d;
 
 	while (1)
 	{
 	// if this is a leaf, accumulate the pvs bits
+		if (node->contents < 0)
+		{
+			if (node->contents != CONTENTS_SOLID)
+				Mod_AddLeafPVS ((mleaf_t *)node, worldmodel, pvs);
+			return;
+		}
+
+		plane = node->plane;
+		d = DotProduct (org, plane->normal) - plane->dist;
+		if (d > 8)
+			node = node->children[0];
+		else if (d < -8)
+			node = node->children[1];
+		else
+		{	// go down both
+			SV_AddToFatPVS (org, node->children[0], worldmodel, pvs); //johnfitz -- worldmodel as a parameter
+			node = node->children[1];
+		}
+	}
+}
+
+/*
+=============
+SV_FatPVSLeafs
+
+The leafs SV_AddToFatPVS would use, in the order it would use them.  The
+order only depends on the tree, so the same leafs always give the same list.
+Returns -1 if there are more than FATPVS_MAXLEAFS.
+=============
+*/
+static int SV_FatPVSLeafs (vec3_t org, mnode_t *node, qmodel_t *worldmodel, int *leafs, int numleafs)
+{
+	mplane_t	*plane;
+	float	d;
+
+	while (numleafs >= 0)
+	{
 		if (node->contents < 0)
 		{
 			if (node->contents != CONTENTS_SOLID)
 			{
-				pvs = Mod_LeafPVS ( (mleaf_t *)node, worldmodel); //johnfitz -- worldmodel as a parameter
-				for (i=0 ; i<fatbytes ; i++)
-					fatpvs[i] |= pvs[i];
+				if (numleafs == FATPVS_MAXLEAFS)
+					return -1;
+				leafs[numleafs++] = (mleaf_t *)node - worldmodel->leafs;
 			}
-			return;
+			break;
 		}
 
 		plane = node->plane;
@@ -494,10 +634,29 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz
 			node = node->children[1];
 		else
 		{	// go down both
-			SV_AddToFatPVS (org, node->children[0], worldmodel); //johnfitz -- worldmodel as a parameter
+			numleafs = SV_FatPVSLeafs (org, node->children[0], worldmodel, leafs, numleafs);
 			node = node->children[1];
 		}
 	}
+
+	return numleafs;
+}
+
+/*
+=============
+SV_ClearFatPVSCache
+
+Called on map changes, a new world model can reuse the old one's slot
+=============
+*/
+void SV_ClearFatPVSCache (void)
+{
+	int		i;
+
+	for (i=0 ; i<FATPVS_CACHE ; i++)
+		fatpvscache[i].valid = false;
+	fatpvsmodel = NULL;
+	fatpvsclears++;
 }
 
 /*
@@ -506,22 +665,101 @@ SV_FatPVS
 
 Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
 given point.
+
+The result is kept in a small LRU cache keyed on the leafs it came from, so
+clients that stay in the same leafs don't rebuild it every frame.  It stays
+valid for the next FATPVS_CACHE - 1 calls at least, which lets
+SV_SendClientMessages look up every client's before handing them to tasks.
+The buffer is padded to whole words of zeros for SV_EdictInPVS.
 =============
 */
 byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
 {
-	fatbytes = (worldmodel->numleafs+7)>>3; // ericw -- was +31, assumed to be a bug/typo
-	if (fatpvs == NULL || fatbytes > fatpvs_capacity)
+	int		i, j, numleafs, fatbytes;
+	int		leafs[FATPVS_MAXLEAFS];
+	fatpvsentry_t	*e, *best;
+
+	if (worldmodel != fatpvsmodel)
 	{
-		fatpvs_capacity = fatbytes;
-		fatpvs = (byte *) realloc (fatpvs, fatpvs_capacity);
-		if (!fatpvs)
-			Sys_Error ("SV_FatPVS: realloc() failed on %d bytes", fatpvs_capacity);
+		SV_ClearFatPVSCache ();
+		fatpvsmodel = worldmodel;
 	}
-	
-	Q_memset (fatpvs, 0, fatbytes);
-	SV_AddToFatPVS (org, worldmodel->nodes, worldmodel); //johnfitz -- worldmodel as a parameter
-	return fatpvs;
+	fatpvsframe++;
+
+	numleafs = SV_FatPVSLeafs (org, worldmodel->nodes, worldmodel, leafs, 0);
+
+	best = NULL;
+	for (i=0, e=fatpvscache ; i<FATPVS_CACHE ; i++, e++)
+	{
+		if (!e->valid)
+		{
+			if (!best || best->valid)
+				best = e;
+			continue;
+		}
+		if (numleafs >= 0 && e->numleafs == numleafs)
+		{
+			for (j=0 ; j<numleafs ; j++)
+				if (e->leafs[j] != leafs[j])
+					break;
+			if (j == numleafs)
+			{
+				e->lastused = fatpvsframe;
+				return e->pvs;
+			}
+		}
+		if (!best || (best->valid && e->lastused - best->lastused < 0))
+			best = e;
+	}
+
+// build it in the least recently used entry
+	e = best;
+	fatbytes = ((worldmodel->numleafs+31)>>5)<<2; // whole words, SV_EdictInPVS reads them that way
+	if (e->pvs == NULL || fatbytes > e->capacity)
+	{
+		e->capacity = fatbytes;
+		e->pvs = (byte *) realloc (e->pvs, e->capacity);
+		if (!e->pvs)
+			Sys_Error ("SV_FatPVS: realloc() failed on %d bytes", e->capacity);
+	}
+
+	Q_memset (e->pvs, 0, fatbytes);
+	if (numleafs >= 0)
+	{
+		for (j=0 ; j<numleafs ; j++)
+			Mod_AddLeafPVS (worldmodel->leafs + leafs[j], worldmodel, e->pvs);
+		memcpy (e->leafs, leafs, numleafs * sizeof(int));
+	}
+	else
+		SV_AddToFatPVS (org, worldmodel->nodes, worldmodel, e->pvs); //johnfitz -- worldmodel as a parameter
+
+	e->valid = true;
+	e->numleafs = numleafs;
+	e->lastused = fatpvsframe;
+	return e->pvs;
+}
+
+/*
+=============
+SV_EdictInPVS
+
+True if the edict touches a leaf in the PVS.  SV_FindTouchedLeafs keeps its
+leafs as masks over whole words of the PVS, so this is one AND per word
+rather than one test per leaf.
+=============
+*/
+static qboolean SV_EdictInPVS (edict_t *ent, byte *pvs)
+{
+	unsigned int	word;
+	int		i;
+
+	for (i=0 ; i < ent->num_leafwords ; i++)
+	{
+		memcpy (&word, pvs + (ent->leafwords[i] << 2), sizeof(word));
+		if (word & ent->leafbits[i])
+			return true;
+	}
+	return false;
 }
 
 /*
@@ -529,127 +767,889 @@ byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel) //johnfitz -- added worldmode
 SV_VisibleToClient -- johnfitz
 
 PVS test encapsulated in a nice function
+
+Each client's PVS is remembered for as long as it stays put and SV_FatPVS
+promises to keep the entry, so testing many edicts against one client
+only looks it up once.
 =============
 */
-qboolean SV_VisibleToClient (edict_t *client, edict_t *test, qmodel_t *worldmodel)
+typedef struct
 {
-	byte	*pvs;
+	vec3_t		org;
+	qmodel_t	*worldmodel;
+	byte		*pvs;
+	int			frame;		// fatpvsframe it was looked up on
+	int			clears;		// fatpvsclears it was looked up on
+} clientpvs_t;
+
+static clientpvs_t	clientpvs[MAX_SCOREBOARD];
+
+static byte *SV_ClientPVS (edict_t *client, qmodel_t *worldmodel)
+{
+	clientpvs_t	*c;
 	vec3_t	org;
-	int		i;
+	int		num;
 
 	VectorAdd (client->v.origin, client->v.view_ofs, org);
-	pvs = SV_FatPVS (org, worldmodel);
 
-	for (i=0 ; i < test->num_leafs ; i++)
-		if (pvs[test->leafnums[i] >> 3] & (1 << (test->leafnums[i]&7) ))
-			return true;
+	num = NUM_FOR_EDICT(client) - 1;
+	if (num < 0 || num >= MAX_SCOREBOARD)
+		return SV_FatPVS (org, worldmodel);
 
-	return false;
+	c = &clientpvs[num];
+	if (!c->pvs || c->worldmodel != worldmodel || c->clears != fatpvsclears
+		|| fatpvsframe - c->frame >= FATPVS_CACHE - 1 || !VectorCompare (c->org, org))
+	{
+		c->pvs = SV_FatPVS (org, worldmodel);
+		c->worldmodel = worldmodel;
+		c->clears = fatpvsclears;
+		c->frame = fatpvsframe;
+		VectorCopy (org, c->org);
+	}
+	return c->pvs;
+}
+
+qboolean SV_VisibleToClient (edict_t *client, edict_t *test, qmodel_t *worldmodel)
+{
+	return SV_EdictInPVS (test, SV_ClientPVS (client, worldmodel));
+}
+
+/*
+=============================================================================
+
+MULTICAST
+
+Sounds, particles and temp entities only go to the clients that could hear
+or see them, the ones with a leaf in their PVS from which the origin's leaf
+is visible.  That is the origin in the client's PVS grown by one hop, the
+potentially hearable set, tested without building it: the client's fat PVS
+against the origin leaf's row.  Each client gets its own buffer, appended
+to its next datagram after sv.datagram, so a busy corner of a coop map
+doesn't use up everybody's datagram.
+
+=============================================================================
+*/
+
+cvar_t	sv_phs = {"sv_phs", "1", CVAR_NONE};	// cull sounds, particles and temp entities per client
+
+/*
+=============
+SV_Multicast
+
+Sends msg to every client whose PHS holds origin, or to everyone through
+sv.datagram if phs is false.  Messages that don't fit are dropped, as
+they always were.
+=============
+*/
+void SV_Multicast (vec3_t origin, sizebuf_t *msg, qboolean phs)
+{
+	client_t	*client;
+	mleaf_t		*leaf;
+	sizebuf_t	*buf;
+	int			i;
+
+	if (!phs || !sv_phs.value || !sv.worldmodel)
+	{
+		if (sv.datagram.cursize + msg->cursize <= sv.datagram.maxsize)
+			SZ_Write (&sv.datagram, msg->data, msg->cursize);
+		return;
+	}
+
+	leaf = Mod_PointInLeaf (origin, sv.worldmodel);
+	for (i=0, client = svs.clients ; i<svs.maxclients ; i++, client++)
+	{
+		if (!client->active || !client->spawned)
+			continue;
+		buf = &sv_multicast[i];
+		if (buf->cursize + msg->cursize > buf->maxsize)
+			continue;
+		if (!Mod_LeafPVSTouches (leaf, sv.worldmodel, SV_ClientPVS (client->edict, sv.worldmodel)))
+			continue;
+		SZ_Write (buf, msg->data, msg->cursize);
+	}
+}
+
+/*
+Temp entities come from QuakeC one write at a time.  The ones written to
+MSG_BROADCAST are held back until complete so their origin is known, then
+multicast.  The layouts list the writes of each type: b byte, s short
+(entity), c coord.  Anything else breaks the hold and goes to sv.datagram
+as written.
+*/
+static const char *sv_tempentlayouts[] =
+{
+	"bbccc",		// TE_SPIKE
+	"bbccc",		// TE_SUPERSPIKE
+	"bbccc",		// TE_GUNSHOT
+	"bbccc",		// TE_EXPLOSION
+	"bbccc",		// TE_TAREXPLOSION
+	"bbscccccc",	// TE_LIGHTNING1
+	"bbscccccc",	// TE_LIGHTNING2
+	"bbccc",		// TE_WIZSPIKE
+	"bbccc",		// TE_KNIGHTSPIKE
+	"bbscccccc",	// TE_LIGHTNING3
+	"bbccc",		// TE_LAVASPLASH
+	"bbccc",		// TE_TELEPORT
+	"bbcccbb",		// TE_EXPLOSION2
+	"bbscccccc",	// TE_BEAM
+};
+
+static sizebuf_t	sv_tempent;
+static byte			sv_tempent_buf[64];
+static const char	*sv_tempentlayout;	// NULL = not holding one
+static int			sv_tempentwrites, sv_tempentcoords;
+static vec3_t		sv_tempentorg;
+
+/*
+=============
+SV_FlushTempEntity
+
+Lets a partial temp entity go to everyone as it is
+=============
+*/
+void SV_FlushTempEntity (void)
+{
+	if (!sv_tempentwrites)
+		return;
+	if (sv.datagram.cursize + sv_tempent.cursize <= sv.datagram.maxsize)
+		SZ_Write (&sv.datagram, sv_tempent.data, sv_tempent.cursize);
+	sv_tempentwrites = 0;
+	sv_tempentlayout = NULL;
+}
+
+/*
+=============
+SV_BroadcastDest
+
+Where a QuakeC write of the given kind to MSG_BROADCAST goes.  Call
+SV_BroadcastWritten after writing.
+=============
+*/
+sizebuf_t *SV_BroadcastDest (int kind, float value)
+{
+	int		type;
+
+	if (!sv_tempentwrites)
+	{
+		if (kind != 'b' || (int)value != svc_temp_entity || !sv_phs.value)
+			return &sv.datagram;
+		sv_tempent.data = sv_tempent_buf;
+		sv_tempent.maxsize = sizeof(sv_tempent_buf);
+		sv_tempent.cursize = 0;
+		sv_tempent.allowoverflow = false;
+		sv_tempent.overflowed = false;
+		sv_tempentlayout = "b";
+		sv_tempentwrites = 1;
+		sv_tempentcoords = 0;
+		return &sv_tempent;
+	}
+
+	if (sv_tempentwrites == 1)
+	{
+		type = (int)value;
+		if (kind != 'b' || type < 0 || type >= (int)(sizeof(sv_tempentlayouts) / sizeof(sv_tempentlayouts[0])))
+		{
+			SV_FlushTempEntity ();
+			return &sv.datagram;
+		}
+		sv_tempentlayout = sv_tempentlayouts[type];
+	}
+	else if (sv_tempentlayout[sv_tempentwrites] != kind)
+	{
+		SV_FlushTempEntity ();
+		return &sv.datagram;
+	}
+
+	if (kind == 'c' && sv_tempentcoords < 3)
+		sv_tempentorg[sv_tempentcoords++] = value;
+	sv_tempentwrites++;
+	return &sv_tempent;
+}
+
+void SV_BroadcastWritten (void)
+{
+	if (!sv_tempentlayout || sv_tempentlayout[sv_tempentwrites])
+		return;
+	sv_tempentwrites = 0;
+	sv_tempentlayout = NULL;
+	SV_Multicast (sv_tempentorg, &sv_tempent, true);
 }
 
 //=============================================================================
 
+cvar_t	sv_parallelsend = {"sv_parallelsend", "1", CVAR_NONE};	// build client datagrams on the task workers
+cvar_t	sv_rate = {"sv_rate", "0", CVAR_NONE};	// entity bytes per second for each remote client, 0 = as many as fit
+
+typedef struct
+{
+	edict_t		*ent;
+	int			num;
+	qboolean	visible;	// has a model other clients can see
+} sendent_t;
+
+static sendent_t	sv_sendents[MAX_EDICTS];	// candidates for every client, from SV_PrepareSendEntities
+static int			sv_numsendents;
+
+typedef struct
+{
+	int			num;
+	int			size;		// of its update
+	float		priority;
+} sendcand_t;
+
+typedef struct
+{
+	client_t	*client;
+	sizebuf_t	msg;
+	byte		buf[MAX_DATAGRAM];
+	byte		*pvs;		// from SV_FatPVS
+	vec3_t		org, forward;	// the client's view, for SV_EntityPriority
+	int			ratelimit;	// entity bytes sv_rate allows this time
+	qboolean	overflowed;	// for the nonspammy warning, tasks can't print
+	qboolean	nomem;
+	double		time;		// building it, for host_speeds
+
+	// only used when the entities don't all fit
+	sendcand_t	*cands;
+	int			numcands, maxcands;
+	int			removebytes;
+	byte		deferred[(MAX_EDICTS + 7) / 8];
+	int			numdeferred;
+} svdatagram_t;
+
+static svdatagram_t	sv_datagrams[MAX_SCOREBOARD];
+
+double		sv_sendtime, sv_sendtimemax;	// for host_speeds
+
 /*
 =============
-SV_WriteEntitiesToClient
+SV_EntFrameAdd
+=============
+*/
+static entframeent_t *SV_EntFrameAdd (entframe_t *frame)
+{
+	entframeent_t	*ents;
+	int				maxents;
+
+	if (frame->numents == frame->maxents)
+	{
+		maxents = frame->maxents ? frame->maxents * 2 : 64;
+		ents = (entframeent_t *) realloc (frame->ents, maxents * sizeof(entframeent_t));
+		if (!ents)
+			return NULL;	// called from tasks, the caller reports it
+		frame->ents = ents;
+		frame->maxents = maxents;
+	}
+
+	return &frame->ents[frame->numents++];
+}
+
+/*
+=============
+SV_EntityState
+=============
+*/
+static void SV_EntityState (edict_t *ent, entity_state_t *to)
+{
+	VectorCopy (ent->v.origin, to->origin);
+	VectorCopy (ent->v.angles, to->angles);
+	to->modelindex = ent->v.modelindex;
+	to->frame = ent->v.frame;
+	to->colormap = ent->v.colormap;
+	to->skin = ent->v.skin;
+	to->alpha = ent->alpha;
+	to->effects = ent->v.effects;
+}
+
+/*
+=============
+SV_EntityBits
 
+Which fields of to need sending to a client that has from
 =============
 */
-void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
+static int SV_EntityBits (const entity_state_t *from, const entity_state_t *to, edict_t *ent)
 {
-	int		e, i;
+	int		i;
 	int		bits;
-	byte	*pvs;
-	vec3_t	org;
 	float	miss;
-	edict_t	*ent;
 
-// find the client's PVS
-	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
-	pvs = SV_FatPVS (org, sv.worldmodel);
+	bits = 0;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		miss = to->origin[i] - from->origin[i];
+		if ( miss < -0.1 || miss > 0.1 )
+			bits |= U_ORIGIN1<<i;
+	}
+
+	if ( to->angles[0] != from->angles[0] )
+		bits |= U_ANGLE1;
+
+	if ( to->angles[1] != from->angles[1] )
+		bits |= U_ANGLE2;
+
+	if ( to->angles[2] != from->angles[2] )
+		bits |= U_ANGLE3;
+
+	if (ent->v.movetype == MOVETYPE_STEP)
+		bits |= U_STEP;	// don't mess up the step animation
+
+	if (from->colormap != to->colormap)
+		bits |= U_COLORMAP;
+
+	if (from->skin != to->skin)
+		bits |= U_SKIN;
+
+	if (from->frame != to->frame)
+		bits |= U_FRAME;
+
+	if ((from->effects ^ to->effects) & pr_effects_mask)
+		bits |= U_EFFECTS;
+
+	if (from->modelindex != to->modelindex)
+		bits |= U_MODEL;
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (sv.protocol != PROTOCOL_NETQUAKE)
+	{
+		if (from->alpha != to->alpha) bits |= U_ALPHA;
+		if (bits & U_FRAME && to->frame & 0xFF00) bits |= U_FRAME2;
+		if (bits & U_MODEL && to->modelindex & 0xFF00) bits |= U_MODEL2;
+		if (ent->sendinterval) bits |= U_LERPFINISH;
+	}
+	//johnfitz
+
+	return bits;
+}
+
+/*
+=============
+SV_MergeEntityState
+
+What the client ends up with after getting the bits fields of to on top of from
+=============
+*/
+static void SV_MergeEntityState (entity_state_t *out, const entity_state_t *from, const entity_state_t *to, int bits)
+{
+	*out = *from;
+	if (bits & U_ORIGIN1) out->origin[0] = to->origin[0];
+	if (bits & U_ORIGIN2) out->origin[1] = to->origin[1];
+	if (bits & U_ORIGIN3) out->origin[2] = to->origin[2];
+	if (bits & U_ANGLE1) out->angles[0] = to->angles[0];
+	if (bits & U_ANGLE2) out->angles[1] = to->angles[1];
+	if (bits & U_ANGLE3) out->angles[2] = to->angles[2];
+	if (bits & U_MODEL) out->modelindex = to->modelindex;
+	if (bits & U_FRAME) out->frame = to->frame;
+	if (bits & U_COLORMAP) out->colormap = to->colormap;
+	if (bits & U_SKIN) out->skin = to->skin;
+	if (bits & U_EFFECTS) out->effects = to->effects & pr_effects_mask;
+	if (bits & U_ALPHA) out->alpha = to->alpha;
+}
+
+/*
+=============
+SV_WriteEntityUpdate
+
+ent and to are unused for U_REMOVE.  Reserves room for the largest update
+the protocol can produce and writes the fields straight into it, returns
+false and leaves msg alone if that doesn't fit.
+=============
+*/
+static qboolean SV_WriteEntityUpdate (sizebuf_t *msg, edict_t *ent, int e, int bits, const entity_state_t *to)
+{
+	const msgcodec_t	*c = &sv.codec;
+	byte	*p;
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (sv.protocol != PROTOCOL_NETQUAKE)
+	{
+		if (bits >= 65536) bits |= U_EXTEND1;
+		if (bits >= 16777216) bits |= U_EXTEND2;
+	}
+	//johnfitz
+
+	if (e >= 256)
+		bits |= U_LONGENTITY;
+
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	// bits and the entity number take up to 6 bytes, then 5 single byte
+	// fields, the origin and angles, and 4 more bytes for PROTOCOL_FITZQUAKE
+	if (bits & U_REMOVE)
+		p = SZ_Reserve (msg, 5);
+	else
+		p = SZ_Reserve (msg, 15 + 3 * c->coordsize + 3 * c->anglesize);
+	if (!p)
+		return false;
+
+//
+// write the message
+//
+	*p++ = bits | U_SIGNAL;
+
+	if (bits & U_MOREBITS)
+		*p++ = bits>>8;
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & U_EXTEND1)
+		*p++ = bits>>16;
+	if (bits & U_EXTEND2)
+		*p++ = bits>>24;
+	//johnfitz
+
+	if (bits & U_LONGENTITY)
+	{
+		*p++ = e&0xff;
+		*p++ = (e>>8)&0xff;
+	}
+	else
+		*p++ = e;
+
+	if (bits & U_MODEL)
+		*p++ = to->modelindex;
+	if (bits & U_FRAME)
+		*p++ = to->frame;
+	if (bits & U_COLORMAP)
+		*p++ = to->colormap;
+	if (bits & U_SKIN)
+		*p++ = to->skin;
+	if (bits & U_EFFECTS)
+		*p++ = to->effects & pr_effects_mask;
+	if (bits & U_ORIGIN1)
+		p = c->writecoord (p, to->origin[0]);
+	if (bits & U_ANGLE1)
+		p = c->writeangle (p, to->angles[0]);
+	if (bits & U_ORIGIN2)
+		p = c->writecoord (p, to->origin[1]);
+	if (bits & U_ANGLE2)
+		p = c->writeangle (p, to->angles[1]);
+	if (bits & U_ORIGIN3)
+		p = c->writecoord (p, to->origin[2]);
+	if (bits & U_ANGLE3)
+		p = c->writeangle (p, to->angles[2]);
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & U_ALPHA)
+		*p++ = to->alpha;
+	if (bits & U_FRAME2)
+		*p++ = to->frame >> 8;
+	if (bits & U_MODEL2)
+		*p++ = to->modelindex >> 8;
+	if (bits & U_LERPFINISH)
+		*p++ = (byte)(Q_rint((ent->v.nextthink-sv.time)*255));
+	//johnfitz
+
+	SZ_Commit (msg, p);
+	return true;
+}
+
+/*
+=============
+SV_EntityUpdateSize
+
+What SV_WriteEntityUpdate writes for an update with bits, to fit the most
+important ones into the datagram when they don't all go
+=============
+*/
+static int SV_EntityUpdateSize (int e, int bits)
+{
+	const msgcodec_t	*c = &sv.codec;
+	int	size;
+
+	if (sv.protocol != PROTOCOL_NETQUAKE)
+	{
+		if (bits >= 65536) bits |= U_EXTEND1;
+		if (bits >= 16777216) bits |= U_EXTEND2;
+	}
+	if (e >= 256)
+		bits |= U_LONGENTITY;
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	size = 2;
+	if (bits & U_MOREBITS) size++;
+	if (bits & U_EXTEND1) size++;
+	if (bits & U_EXTEND2) size++;
+	if (bits & U_LONGENTITY) size++;
+	if (bits & U_MODEL) size++;
+	if (bits & U_FRAME) size++;
+	if (bits & U_COLORMAP) size++;
+	if (bits & U_SKIN) size++;
+	if (bits & U_EFFECTS) size++;
+	if (bits & U_ORIGIN1) size += c->coordsize;
+	if (bits & U_ORIGIN2) size += c->coordsize;
+	if (bits & U_ORIGIN3) size += c->coordsize;
+	if (bits & U_ANGLE1) size += c->anglesize;
+	if (bits & U_ANGLE2) size += c->anglesize;
+	if (bits & U_ANGLE3) size += c->anglesize;
+	if (bits & U_ALPHA) size++;
+	if (bits & U_FRAME2) size++;
+	if (bits & U_MODEL2) size++;
+	if (bits & U_LERPFINISH) size++;
+	return size;
+}
+
+/*
+=============
+SV_EntityPriority
+
+Nearby entities in front of the client that it hasn't been told about for
+a while come first
+=============
+*/
+static float SV_EntityPriority (svdatagram_t *dg, edict_t *ent, int e)
+{
+	vec3_t	center, dir;
+	float	dist, stale;
+
+	if (ent == dg->client->edict)
+		return 1e30f;
+
+	VectorAdd (ent->v.absmin, ent->v.absmax, center);
+	VectorScale (center, 0.5, center);
+	VectorSubtract (center, dg->org, dir);
+	dist = VectorNormalize (dir);
+	stale = sv.time - sv_entsenttime[dg->client - svs.clients][e];
+	stale = CLAMP (0, stale, 1);
+
+	// within about 60 degrees of where it looks counts as on screen
+	return (stale + 0.1f) * (DotProduct (dir, dg->forward) > 0.5f ? 4.0f : 1.0f) / (1.0f + dist / 256.0f);
+}
+
+static void SV_AddSendCandidate (svdatagram_t *dg, int e, int size, float priority)
+{
+	sendcand_t	*cands;
+	int			maxcands;
+
+	if (dg->numcands == dg->maxcands)
+	{
+		maxcands = dg->maxcands ? dg->maxcands * 2 : 256;
+		cands = (sendcand_t *) realloc (dg->cands, maxcands * sizeof(sendcand_t));
+		if (!cands)
+		{
+			dg->nomem = true;	// called from tasks, SV_SendClientDatagram reports it
+			return;
+		}
+		dg->cands = cands;
+		dg->maxcands = maxcands;
+	}
+
+	dg->cands[dg->numcands].num = e;
+	dg->cands[dg->numcands].size = size;
+	dg->cands[dg->numcands].priority = priority;
+	dg->numcands++;
+}
+
+/*
+=============
+SV_WriteEntityList
+
+For PROTOCOL_DELTA each entity is sent as a change from the last frame the
+client acknowledged, entities that didn't change aren't sent at all and the
+ones that went away get a U_REMOVE.  Without a usable frame it falls back to
+the baselines, like the other protocols.
+
+Entities in dg->deferred are left as the client has them.  With measure set
+nothing is written, the updates it would send are listed in dg->cands
+instead.  Returns false if msg overflowed.
+=============
+*/
+static qboolean SV_WriteEntityList (svdatagram_t *dg, entframe_t *frame, entframeent_t *refent, entframeent_t *refend, qboolean measure)
+{
+	int		e, bits;
+	client_t	*client;
+	sizebuf_t	*msg;
+	edict_t	*clent, *ent;
+	sendent_t	*s;
+	entity_state_t	to;
+	const entity_state_t	*from;
+	entframeent_t	*rec;
+	float		*senttime;
+
+	client = dg->client;
+	msg = &dg->msg;
+	clent = client->edict;
+	senttime = sv_entsenttime[client - svs.clients];
 
 // send over all entities (excpet the client) that touch the pvs
-	ent = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	for (s = sv_sendents ; s < sv_sendents + sv_numsendents ; s++)
 	{
+		ent = s->ent;
+		e = s->num;
 
 		if (ent != clent)	// clent is ALLWAYS sent
 		{
 			// ignore ents without visible models
-			if (!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
-				continue;
-
-			//johnfitz -- don't send model>255 entities if protocol is 15
-			if (sv.protocol == PROTOCOL_NETQUAKE && (int)ent->v.modelindex & 0xFF00)
+			if (!s->visible)
 				continue;
 
 			// ignore if not touching a PV leaf
-			for (i=0 ; i < ent->num_leafs ; i++)
-				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
-					break;
-			
+			//
 			// ericw -- added ent->num_leafs < MAX_ENT_LEAFS condition.
 			//
 			// if ent->num_leafs == MAX_ENT_LEAFS, the ent is visible from too many leafs
 			// for us to say whether it's in the PVS, so don't try to vis cull it.
 			// this commonly happens with rotators, because they often have huge bboxes
 			// spanning the entire map, or really tall lifts, etc.
-			if (i == ent->num_leafs && ent->num_leafs < MAX_ENT_LEAFS)
+			if (ent->num_leafs < MAX_ENT_LEAFS && !SV_EdictInPVS (ent, dg->pvs))
 				continue;		// not visible
 		}
 
-		// johnfitz -- max size for protocol 15 is 18 bytes, not 16 as originally
-		// assumed here.  And, for protocol 85 the max size is actually 24 bytes.
-		// For float coords and angles the limit is 39. 
-		// FIXME: Use tighter limit according to protocol flags and send bits.
-		if (msg->cursize + 39 > msg->maxsize)
+	// the ones before this that aren't in the reference frame anymore
+		for ( ; refent < refend && refent->num < e ; refent++)
 		{
-			//johnfitz -- less spammy overflow message
-			if (!dev_overflows.packetsize || dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime )
+			if (measure)
+				dg->removebytes += 5;
+			else if (!SV_WriteEntityUpdate (msg, NULL, refent->num, U_REMOVE, NULL))
+				goto overflow;
+		}
+
+		if (dg->numdeferred && (dg->deferred[e >> 3] & (1 << (e & 7))))
+		{ // the client keeps what it has, if anything
+			if (refent < refend && refent->num == e)
+			{
+				if (!(rec = SV_EntFrameAdd (frame)))
+					goto nomem;
+				*rec = *refent++;
+			}
+			continue;
+		}
+
+		SV_EntityState (ent, &to);
+		if (refent < refend && refent->num == e)
+			from = &refent->state;
+		else
+			from = &ent->baseline;
+		bits = SV_EntityBits (from, &to, ent);
+
+		if (from != &ent->baseline && !(bits & ~U_STEP) && (bits & U_STEP) == refent->bits)
+		{ // the client still has it from the reference frame
+			if (measure)
 			{
-				Con_Printf ("Packet overflow!\n");
-				dev_overflows.packetsize = realtime;
+				refent++;
+				continue;
 			}
-			goto stats;
-			//johnfitz
+			if (!(rec = SV_EntFrameAdd (frame)))
+				goto nomem;
+			*rec = *refent++;
+			senttime[e] = sv.time;
+			continue;
+		}
+
+		if (measure)
+		{
+			SV_AddSendCandidate (dg, e, SV_EntityUpdateSize (e, bits), SV_EntityPriority (dg, ent, e));
+			if (dg->nomem)
+				return true;
+			if (from != &ent->baseline)
+				refent++;
+			continue;
+		}
+
+// send an update
+		if (!SV_WriteEntityUpdate (msg, ent, e, bits, &to))
+			goto overflow;
+		senttime[e] = sv.time;
+
+		if (frame)
+		{
+			if (!(rec = SV_EntFrameAdd (frame)))
+				goto nomem;
+			rec->num = e;
+			rec->bits = bits & U_STEP;
+			SV_MergeEntityState (&rec->state, from, &to, bits);
+			if (from != &ent->baseline)
+				refent++;
+		}
+	}
+
+// the rest of the reference frame went away
+	for ( ; refent < refend ; refent++)
+	{
+		if (measure)
+			dg->removebytes += 5;
+		else if (!SV_WriteEntityUpdate (msg, NULL, refent->num, U_REMOVE, NULL))
+			goto overflow;
+	}
+	return true;
+
+overflow:
+	// the client keeps what it wasn't told about
+	for ( ; refent < refend ; refent++)
+	{
+		if (!(rec = SV_EntFrameAdd (frame)))
+			goto nomem;
+		*rec = *refent;
+	}
+	return false;
+
+nomem:
+	dg->nomem = true;
+	return true;
+}
+
+static int SV_CompareSendCandidates (const void *a, const void *b)
+{
+	float	pa = ((const sendcand_t *) a)->priority;
+	float	pb = ((const sendcand_t *) b)->priority;
+
+	return (pa < pb) - (pa > pb);
+}
+
+/*
+=============
+SV_DeferEntities
+
+Picks the updates that fit in room bytes, most important first, and marks
+the others in dg->deferred for SV_WriteEntityList to leave out
+=============
+*/
+static void SV_DeferEntities (svdatagram_t *dg, entframeent_t *refent, entframeent_t *refend, int room)
+{
+	sendcand_t	*c;
+	int			i, used;
+
+	dg->numcands = 0;
+	dg->removebytes = 0;
+	dg->numdeferred = 0;
+	SV_WriteEntityList (dg, NULL, refent, refend, true);
+	if (dg->nomem)
+		return;
+
+	qsort (dg->cands, dg->numcands, sizeof(sendcand_t), SV_CompareSendCandidates);
+
+	// SV_WriteEntityUpdate reserves room for the largest update, so keep that spare
+	room -= dg->removebytes + 15 + 3 * sv.codec.coordsize + 3 * sv.codec.anglesize;
+	memset (dg->deferred, 0, (sv.num_edicts + 7) >> 3);
+	used = 0;
+	for (i = 0, c = dg->cands; i < dg->numcands; i++, c++)
+	{
+		if (used + c->size <= room || c->num == NUM_FOR_EDICT(dg->client->edict))
+			used += c->size;
+		else
+		{
+			dg->deferred[c->num >> 3] |= 1 << (c->num & 7);
+			dg->numdeferred++;
+		}
+	}
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+
+When the updates don't all fit in the datagram, or in the bytes sv_rate
+allows, they are ranked by SV_EntityPriority and the least important ones
+wait for a later frame instead of whatever comes last in edict order.
+
+Runs on a worker thread when there are enough clients, so anything that
+needs reporting goes in dg
+=============
+*/
+static void SV_WriteEntitiesToClient (svdatagram_t *dg)
+{
+	int		i, start, maxsize;
+	client_t	*client;
+	sizebuf_t	*msg;
+	entframe_t	*frames, *frame, *ref;
+	entframeent_t	*refent, *refend;
+
+	client = dg->client;
+	msg = &dg->msg;
+	dg->numdeferred = 0;
+
+// pick the frame to delta from
+	frame = NULL;
+	refent = refend = NULL;
+	if (sv.protocol == PROTOCOL_DELTA)
+	{
+		frames = sv_entframes[client - svs.clients];
+		frame = &frames[++client->entframe & (ENTFRAMES - 1)];
+		frame->sequence = 0;
+		frame->numents = 0;
+
+		i = client->entframeack;
+		ref = &frames[i & (ENTFRAMES - 1)];
+		if (i && client->entframe - i < ENTFRAMES && ref->sequence == i)
+		{
+			refent = ref->ents;
+			refend = ref->ents + ref->numents;
 		}
+		else
+			i = 0;
 
-// send an update
-		bits = 0;
+		MSG_WriteByte (msg, svc_entityframe);
+		MSG_WriteLong (msg, client->entframe);
+		MSG_WriteLong (msg, i);
+	}
 
-		for (i=0 ; i<3 ; i++)
-		{
-			miss = ent->v.origin[i] - ent->baseline.origin[i];
-			if ( miss < -0.1 || miss > 0.1 )
-				bits |= U_ORIGIN1<<i;
-		}
+	start = msg->cursize;
+	maxsize = msg->maxsize;
+	if (dg->ratelimit < maxsize - start)
+		msg->maxsize = start + dg->ratelimit;
+
+	if (!SV_WriteEntityList (dg, frame, refent, refend, false) && !dg->nomem)
+	{
+		// start over with only what fits
+		msg->cursize = start;
+		if (frame)
+			frame->numents = 0;
+		SV_DeferEntities (dg, refent, refend, msg->maxsize - start);
+		if (!dg->nomem && !SV_WriteEntityList (dg, frame, refent, refend, false))
+			dg->overflowed = true;
+	}
 
-		if ( ent->v.angles[0] != ent->baseline.angles[0] )
-			bits |= U_ANGLE1;
+	msg->maxsize = maxsize;
+	if (frame)
+		frame->sequence = client->entframe;
+}
 
-		if ( ent->v.angles[1] != ent->baseline.angles[1] )
-			bits |= U_ANGLE2;
+/*
+=============
+SV_BuildClientDatagram
 
-		if ( ent->v.angles[2] != ent->baseline.angles[2] )
-			bits |= U_ANGLE3;
+Task for SV_SendClientMessages
+=============
+*/
+static void SV_BuildClientDatagram (void *data)
+{
+	svdatagram_t	*dg = (svdatagram_t *) data;
+	double			start;
 
-		if (ent->v.movetype == MOVETYPE_STEP)
-			bits |= U_STEP;	// don't mess up the step animation
+	start = Sys_DoubleTime ();
+	SV_WriteEntitiesToClient (dg);
+	dg->time = Sys_DoubleTime () - start;
+}
 
-		if (ent->baseline.colormap != ent->v.colormap)
-			bits |= U_COLORMAP;
+/*
+=============
+SV_PrepareSendEntities
 
-		if (ent->baseline.skin != ent->v.skin)
-			bits |= U_SKIN;
+Everything in the entity loop that touches progs, done once for all clients
+before it goes to the workers
+=============
+*/
+static void SV_PrepareSendEntities (void)
+{
+	int		e;
+	edict_t	*ent;
+	sendent_t	*s;
+	qboolean	visible;
 
-		if (ent->baseline.frame != ent->v.frame)
-			bits |= U_FRAME;
+	sv_numsendents = 0;
+	ent = NEXT_EDICT(sv.edicts);
+	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	{
+		visible = ent->v.modelindex && PR_GetString(ent->v.model)[0];
 
-		if ((ent->baseline.effects ^ (int)ent->v.effects) & pr_effects_mask)
-			bits |= U_EFFECTS;
+		//johnfitz -- don't send model>255 entities if protocol is 15
+		if (sv.protocol == PROTOCOL_NETQUAKE && (int)ent->v.modelindex & 0xFF00)
+			visible = false;
 
-		if (ent->baseline.modelindex != ent->v.modelindex)
-			bits |= U_MODEL;
+		if (!visible && e > svs.maxclients)
+			continue;	// only goes to its own client
 
 		//johnfitz -- alpha
 		if (pr_alpha_supported)
@@ -666,87 +1666,11 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 			continue;
 		//johnfitz
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (sv.protocol != PROTOCOL_NETQUAKE)
-		{
-
-			if (ent->baseline.alpha != ent->alpha) bits |= U_ALPHA;
-			if (bits & U_FRAME && (int)ent->v.frame & 0xFF00) bits |= U_FRAME2;
-			if (bits & U_MODEL && (int)ent->v.modelindex & 0xFF00) bits |= U_MODEL2;
-			if (ent->sendinterval) bits |= U_LERPFINISH;
-			if (bits >= 65536) bits |= U_EXTEND1;
-			if (bits >= 16777216) bits |= U_EXTEND2;
-		}
-		//johnfitz
-
-		if (e >= 256)
-			bits |= U_LONGENTITY;
-
-		if (bits >= 256)
-			bits |= U_MOREBITS;
-
-	//
-	// write the message
-	//
-		MSG_WriteByte (msg, bits | U_SIGNAL);
-
-		if (bits & U_MOREBITS)
-			MSG_WriteByte (msg, bits>>8);
-
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits & U_EXTEND1)
-			MSG_WriteByte(msg, bits>>16);
-		if (bits & U_EXTEND2)
-			MSG_WriteByte(msg, bits>>24);
-		//johnfitz
-
-		if (bits & U_LONGENTITY)
-			MSG_WriteShort (msg,e);
-		else
-			MSG_WriteByte (msg,e);
-
-		if (bits & U_MODEL)
-			MSG_WriteByte (msg,	ent->v.modelindex);
-		if (bits & U_FRAME)
-			MSG_WriteByte (msg, ent->v.frame);
-		if (bits & U_COLORMAP)
-			MSG_WriteByte (msg, ent->v.colormap);
-		if (bits & U_SKIN)
-			MSG_WriteByte (msg, ent->v.skin);
-		if (bits & U_EFFECTS)
-			MSG_WriteByte (msg, (int)ent->v.effects & pr_effects_mask);
-		if (bits & U_ORIGIN1)
-			MSG_WriteCoord (msg, ent->v.origin[0], sv.protocolflags);
-		if (bits & U_ANGLE1)
-			MSG_WriteAngle(msg, ent->v.angles[0], sv.protocolflags);
-		if (bits & U_ORIGIN2)
-			MSG_WriteCoord (msg, ent->v.origin[1], sv.protocolflags);
-		if (bits & U_ANGLE2)
-			MSG_WriteAngle(msg, ent->v.angles[1], sv.protocolflags);
-		if (bits & U_ORIGIN3)
-			MSG_WriteCoord (msg, ent->v.origin[2], sv.protocolflags);
-		if (bits & U_ANGLE3)
-			MSG_WriteAngle(msg, ent->v.angles[2], sv.protocolflags);
-
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits & U_ALPHA)
-			MSG_WriteByte(msg, ent->alpha);
-		if (bits & U_FRAME2)
-			MSG_WriteByte(msg, (int)ent->v.frame >> 8);
-		if (bits & U_MODEL2)
-			MSG_WriteByte(msg, (int)ent->v.modelindex >> 8);
-		if (bits & U_LERPFINISH)
-			MSG_WriteByte(msg, (byte)(Q_rint((ent->v.nextthink-sv.time)*255)));
-		//johnfitz
+		s = &sv_sendents[sv_numsendents++];
+		s->ent = ent;
+		s->num = e;
+		s->visible = visible;
 	}
-
-	//johnfitz -- devstats
-stats:
-	if (msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
-		Con_DWarning ("%i byte packet exceeds standard limit of 1024 (max = %d).\n", msg->cursize, msg->maxsize);
-	dev_stats.packetsize = msg->cursize;
-	dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
-	//johnfitz
 }
 
 /*
@@ -951,37 +1875,99 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
 
 /*
 =======================
-SV_SendClientDatagram
+SV_BeginClientDatagram
+
+The parts of the datagram that can't be built on a worker thread
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+static void SV_BeginClientDatagram (client_t *client, svdatagram_t *dg)
 {
-	byte		buf[MAX_DATAGRAM];
-	sizebuf_t	msg;
+	vec3_t	org, right, up;
 
-	msg.data = buf;
-	msg.maxsize = sizeof(buf);
-	msg.cursize = 0;
+	dg->client = client;
+	dg->msg.data = dg->buf;
+	dg->msg.maxsize = sizeof(dg->buf);
+	dg->msg.cursize = 0;
+	dg->msg.allowoverflow = false;
+	dg->msg.overflowed = false;
+	dg->overflowed = false;
+	dg->nomem = false;
+	dg->time = 0;
+
+	dg->ratelimit = MAX_DATAGRAM;
 
 	//johnfitz -- if client is nonlocal, use smaller max size so packets aren't fragmented
 	if (Q_strcmp(NET_QSocketGetAddressString(client->netconnection), "LOCAL") != 0)
-		msg.maxsize = DATAGRAM_MTU;
+	{
+		dg->msg.maxsize = DATAGRAM_MTU;
+		if (sv_rate.value > 0)
+			dg->ratelimit = (int) q_min(sv_rate.value * (realtime - client->ratetime), (double)MAX_DATAGRAM);
+	}
 	//johnfitz
+	client->ratetime = realtime;
 
-	MSG_WriteByte (&msg, svc_time);
-	MSG_WriteFloat (&msg, sv.time);
+// find the client's PVS, it stays put until the tasks are done
+	VectorAdd (client->edict->v.origin, client->edict->v.view_ofs, org);
+	dg->pvs = SV_FatPVS (org, sv.worldmodel);
+	VectorCopy (org, dg->org);
+	AngleVectors (client->edict->v.v_angle, dg->forward, right, up);
+
+	MSG_WriteByte (&dg->msg, svc_time);
+	MSG_WriteFloat (&dg->msg, sv.time);
 
 // add the client specific data to the datagram
-	SV_WriteClientdataToMessage (client->edict, &msg);
+	SV_WriteClientdataToMessage (client->edict, &dg->msg);
+}
+
+/*
+=======================
+SV_SendClientDatagram
+
+Sends what SV_SendClientMessages built
+=======================
+*/
+qboolean SV_SendClientDatagram (client_t *client)
+{
+	svdatagram_t	*dg;
+	sizebuf_t		*msg;
+
+	dg = &sv_datagrams[client - svs.clients];
+	msg = &dg->msg;
+
+	if (dg->nomem)
+		Sys_Error ("SV_WriteEntitiesToClient: out of memory");
+
+	client->deferredents = dg->numdeferred;
+	client->deferredtotal += dg->numdeferred;
+
+	if (dg->overflowed)
+	{
+		//johnfitz -- less spammy overflow message
+		if (!dev_overflows.packetsize || dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime )
+		{
+			Con_Printf ("Packet overflow!\n");
+			dev_overflows.packetsize = realtime;
+		}
+		//johnfitz
+	}
 
-	SV_WriteEntitiesToClient (client->edict, &msg);
+	//johnfitz -- devstats
+	if (msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
+		Con_DWarning ("%i byte packet exceeds standard limit of 1024 (max = %d).\n", msg->cursize, msg->maxsize);
+	dev_stats.packetsize = msg->cursize;
+	dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
+	//johnfitz
 
 // copy the server datagram if there is space
-	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
-		SZ_Write (&msg, sv.datagram.data, sv.datagram.cursize);
+	if (msg->cursize + sv.datagram.cursize < msg->maxsize)
+		SZ_Write (msg, sv.datagram.data, sv.datagram.cursize);
+
+// and what was multicast to this client
+	if (msg->cursize + sv_multicast[client - svs.clients].cursize < msg->maxsize)
+		SZ_Write (msg, sv_multicast[client - svs.clients].data, sv_multicast[client - svs.clients].cursize);
 
 // send the datagram
-	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
+	if (NET_SendUnreliableMessage (client->netconnection, msg) == -1)
 	{
 		SV_DropClient (true);// if the message couldn't send, kick off
 		return false;
@@ -1060,17 +2046,57 @@ SV_SendClientMessages
 */
 void SV_SendClientMessages (void)
 {
-	int			i;
+	int			i, numtasks;
+	qboolean	parallel;
+	task_t		tasks[MAX_SCOREBOARD];
 
 // update frags, names, etc
 	SV_UpdateToReliableMessages ();
+	SV_FlushTempEntity ();
+
+// build the datagrams, on the workers if there is more than one
+	SV_PrepareSendEntities ();
+	numtasks = 0;
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (host_client->active && host_client->spawned)
+			SV_BeginClientDatagram (host_client, &sv_datagrams[i]);
+	}
+	parallel = sv_parallelsend.value && Tasks_NumWorkers ();
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active || !host_client->spawned)
+			continue;
+		if (parallel)
+			tasks[numtasks++] = Task_Run (SV_BuildClientDatagram, &sv_datagrams[i], NULL, 0);
+		else
+			SV_BuildClientDatagram (&sv_datagrams[i]);
+	}
+	for (i = 0; i < numtasks; i++)
+		Task_Wait (tasks[i]);
+
+	sv_sendtime = sv_sendtimemax = 0;
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (host_client->active && host_client->spawned)
+		{
+			sv_sendtime += sv_datagrams[i].time;
+			sv_sendtimemax = q_max(sv_sendtimemax, sv_datagrams[i].time);
+		}
+	}
 
-// build individual updates
+// send individual updates
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 	{
 		if (!host_client->active)
 			continue;
 
+		if (sv_replaying)
+		{
+			SV_ReplayFlushClient ();	// no networking
+			continue;
+		}
+
 		if (host_client->spawned)
 		{
 			if (!SV_SendClientDatagram (host_client))
@@ -1150,14 +2176,82 @@ int SV_ModelIndex (const char *name)
 	if (!name || !name[0])
 		return 0;
 
-	for (i=0 ; i<MAX_MODELS && sv.model_precache[i] ; i++)
-		if (!strcmp(sv.model_precache[i], name))
-			return i;
-	if (i==MAX_MODELS || !sv.model_precache[i])
+	i = SV_FindModelPrecache (name);
+	if (i == -1)
 		Sys_Error ("SV_ModelIndex: model %s not precached", name);
 	return i;
 }
 
+/*
+================
+SV_ModelHashSlot
+
+The sv.model_hash slot holding name, or the empty one it would go in.
+================
+*/
+static int SV_ModelHashSlot (const char *name)
+{
+	int		pos;
+
+	for (pos = COM_HashString (name) & (MODEL_HASH_SIZE - 1); sv.model_hash[pos]; pos = (pos + 1) & (MODEL_HASH_SIZE - 1))
+	{
+		if (!strcmp (sv.model_precache[sv.model_hash[pos] - 1], name))
+			break;
+	}
+
+	return pos;
+}
+
+/*
+================
+SV_FindModelPrecache
+
+Returns the index of name in sv.model_precache, or -1.
+================
+*/
+int SV_FindModelPrecache (const char *name)
+{
+	return sv.model_hash[SV_ModelHashSlot (name)] - 1;
+}
+
+/*
+================
+SV_SetModelPrecache
+
+Every entry of sv.model_precache has to go in through here.
+================
+*/
+void SV_SetModelPrecache (int index, const char *name)
+{
+	int		pos;
+
+	sv.model_precache[index] = name;
+	pos = SV_ModelHashSlot (name);
+	if (!sv.model_hash[pos])
+		sv.model_hash[pos] = index + 1;
+}
+
+/*
+================
+SV_EdictModelIndex
+
+v.modelindex is what setmodel found for v.model, so it can be used as
+long as progs haven't changed v.model on their own since.
+================
+*/
+static int SV_EdictModelIndex (edict_t *ent)
+{
+	const char	*name;
+	int		i;
+
+	name = PR_GetString (ent->v.model);
+	i = (int) ent->v.modelindex;
+	if (i > 0 && i < MAX_MODELS && sv.model_precache[i] == name)
+		return i;
+
+	return SV_ModelIndex (name);
+}
+
 /*
 ================
 SV_CreateBaseline
@@ -1169,6 +2263,9 @@ void SV_CreateBaseline (void)
 	edict_t		*svent;
 	int			entnum;
 	int			bits; //johnfitz -- PROTOCOL_FITZQUAKE
+	int			playermodel;
+
+	playermodel = SV_ModelIndex ("progs/player.mdl");
 
 	for (entnum = 0; entnum < sv.num_edicts ; entnum++)
 	{
@@ -1189,13 +2286,13 @@ void SV_CreateBaseline (void)
 		if (entnum > 0 && entnum <= svs.maxclients)
 		{
 			svent->baseline.colormap = entnum;
-			svent->baseline.modelindex = SV_ModelIndex("progs/player.mdl");
+			svent->baseline.modelindex = playermodel;
 			svent->baseline.alpha = ENTALPHA_DEFAULT; //johnfitz -- alpha support
 		}
 		else
 		{
 			svent->baseline.colormap = 0;
-			svent->baseline.modelindex = SV_ModelIndex(PR_GetString(svent->v.model));
+			svent->baseline.modelindex = SV_EdictModelIndex (svent);
 			svent->baseline.alpha = svent->alpha; //johnfitz -- alpha support
 		}
 
@@ -1315,6 +2412,165 @@ void SV_SaveSpawnparms (void)
 	}
 }
 
+/*
+==============================================================================
+
+CHANGELEVEL PRELOAD
+
+The maps the trigger_changelevels of a level lead to are noted when it
+spawns.  Once a player gets within PRELOAD_DIST of one, its bsp is read on
+a worker thread with Mod_Prefetch, so the changelevel only has to parse it.
+
+==============================================================================
+*/
+
+cvar_t	sv_preloadmaps = {"sv_preloadmaps", "1", CVAR_ARCHIVE};
+
+#define	MAX_PRELOADS	8
+#define	PRELOAD_DIST	512
+
+typedef struct
+{
+	int		entnum;		// the trigger
+	char		map[MAX_QPATH];
+	qboolean	started;
+} svpreload_t;
+
+static svpreload_t	sv_preloads[MAX_PRELOADS];
+static int		sv_numpreloads;
+
+static void SV_FindChangelevelTargets (void)
+{
+	int		i, j;
+	edict_t		*ent;
+	eval_t		*val;
+	const char	*map;
+
+	sv_numpreloads = 0;
+	for (i = 1; i < sv.num_edicts && sv_numpreloads < MAX_PRELOADS; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (ent->free || strcmp (PR_GetString (ent->v.classname), "trigger_changelevel"))
+			continue;
+		val = GetEdictFieldValue (ent, "map");
+		if (!val || !val->string)
+			continue;
+		map = PR_GetString (val->string);
+		if (!map[0] || strchr (map, '.') || !strcmp (map, sv.name))
+			continue;
+		for (j = 0; j < sv_numpreloads; j++)
+		{
+			if (!strcmp (sv_preloads[j].map, map))
+				break;
+		}
+		if (j < sv_numpreloads)
+			continue;
+		sv_preloads[sv_numpreloads].entnum = i;
+		q_strlcpy (sv_preloads[sv_numpreloads].map, map, MAX_QPATH);
+		sv_preloads[sv_numpreloads].started = false;
+		sv_numpreloads++;
+	}
+}
+
+/*
+================
+SV_PreloadChangelevels
+
+Called every server frame
+================
+*/
+void SV_PreloadChangelevels (void)
+{
+	int		i, j, k;
+	svpreload_t	*p;
+	edict_t		*trigger, *player;
+	float		d;
+
+	if (!sv_preloadmaps.value)
+		return;
+
+	for (i = 0, p = sv_preloads; i < sv_numpreloads; i++, p++)
+	{
+		if (p->started || p->entnum >= sv.num_edicts)
+			continue;
+		trigger = EDICT_NUM(p->entnum);
+		if (trigger->free)
+			continue;
+
+		for (j = 0; j < svs.maxclients; j++)
+		{
+			if (!svs.clients[j].active || !svs.clients[j].spawned)
+				continue;
+			player = svs.clients[j].edict;
+			for (k = 0; k < 3; k++)
+			{
+				d = q_max (trigger->v.absmin[k] - player->v.origin[k], player->v.origin[k] - trigger->v.absmax[k]);
+				if (d > PRELOAD_DIST)
+					break;
+			}
+			if (k == 3)
+				break;
+		}
+		if (j == svs.maxclients)
+			continue;
+
+		Con_DPrintf ("Preloading %s\n", p->map);
+		Mod_Prefetch (va("maps/%s.bsp", p->map));
+		p->started = true;
+	}
+}
+
+
+//============================================================================
+
+static void		*sv_edictblock;		// sv.edicts is carved from this
+static int		sv_edictblocksize;
+static qboolean	sv_edictblockhuge;
+
+/*
+================
+SV_AllocEdicts
+
+sv.edicts for sv.max_edicts, aligned to EDICT_ALIGN, and on huge pages
+with -hugepages where the system has them. ericw -- sv.edicts switched to
+use malloc()
+================
+*/
+static void SV_AllocEdicts (void)
+{
+	sv_edictblocksize = sv.max_edicts * pr_edict_size + EDICT_ALIGN - 1;
+	sv_edictblock = NULL;
+	sv_edictblockhuge = false;
+	if (COM_CheckParm ("-hugepages"))
+	{
+		sv_edictblock = Sys_MemAllocHuge (sv_edictblocksize);
+		sv_edictblockhuge = (sv_edictblock != NULL);
+	}
+	if (!sv_edictblock)
+		sv_edictblock = malloc (sv_edictblocksize);
+	if (!sv_edictblock)
+		Sys_Error ("SV_AllocEdicts: couldn't allocate %i edicts", sv.max_edicts);
+
+	sv.edicts = (edict_t *) (((uintptr_t) sv_edictblock + EDICT_ALIGN - 1) & ~(uintptr_t) (EDICT_ALIGN - 1));
+}
+
+/*
+================
+SV_FreeEdicts
+================
+*/
+void SV_FreeEdicts (void)
+{
+	if (sv_edictblock)
+	{
+		if (sv_edictblockhuge)
+			Sys_MemFreeHuge (sv_edictblock, sv_edictblocksize);
+		else
+			free (sv_edictblock);
+	}
+	sv_edictblock = NULL;
+	sv.edicts = NULL;
+}
 
 /*
 ================
@@ -1329,6 +2585,7 @@ void SV_SpawnServer (const char *server)
 	static char	dummy[8] = { 0,0,0,0,0,0,0,0 };
 	edict_t		*ent;
 	int			i;
+	double		start, worldtime, loadtime, enttime, physicstime, baselinetime;
 
 	// let's not have any servers with no name
 	if (hostname.string[0] == 0)
@@ -1338,6 +2595,8 @@ void SV_SpawnServer (const char *server)
 	Con_DPrintf ("SpawnServer: %s\n",server);
 	svs.changelevel_issued = false;		// now safe to issue another
 
+	Host_LogMemPeaks ();
+
 //
 // tell all connected clients that we are going to a new level
 //
@@ -1359,13 +2618,29 @@ void SV_SpawnServer (const char *server)
 
 	Cvar_SetValue ("skill", (float)current_skill);
 
+	SV_RecordSpawn (server);
+
 //
 // set up the new server
 //
 	//memset (&sv, 0, sizeof(sv));
-	Host_ClearMemory ();
+	start = Sys_DoubleTime ();
+	Host_ClearMemoryForMap (va("maps/%s.bsp", server));
 
 	q_strlcpy (sv.name, server, sizeof(sv.name));
+	q_snprintf (sv.modelname, sizeof(sv.modelname), "maps/%s.bsp", server);
+
+// the world goes first on the hunk, so it can be kept for the next spawn
+	sv.worldmodel = Mod_ForName (sv.modelname, false);
+	if (!sv.worldmodel)
+	{
+		Con_Printf ("Couldn't spawn server %s\n", sv.modelname);
+		sv.active = false;
+		return;
+	}
+	Host_KeepWorld (sv.worldmodel);
+	Mod_FlushPrefetch ();	// preloads of the maps not taken
+	worldtime = Sys_DoubleTime ();
 
 	sv.protocol = sv_protocol; // johnfitz
 	
@@ -1376,6 +2651,7 @@ void SV_SpawnServer (const char *server)
 		sv.protocolflags = PRFL_INT32COORD | PRFL_SHORTANGLE;
 	}
 	else sv.protocolflags = 0;
+	MSG_InitCodec (&sv.codec, sv.protocolflags);
 
 // load progs to get entity field count
 	PR_LoadProgs ();
@@ -1383,12 +2659,21 @@ void SV_SpawnServer (const char *server)
 // allocate server memory
 	/* Host_ClearMemory() called above already cleared the whole sv structure */
 	sv.max_edicts = CLAMP (MIN_EDICTS,(int)max_edicts.value,MAX_EDICTS); //johnfitz -- max_edicts cvar
-	sv.edicts = (edict_t *) malloc (sv.max_edicts*pr_edict_size); // ericw -- sv.edicts switched to use malloc()
+	SV_AllocEdicts ();
 
 	sv.datagram.maxsize = sizeof(sv.datagram_buf);
 	sv.datagram.cursize = 0;
 	sv.datagram.data = sv.datagram_buf;
 
+	for (i = 0; i < MAX_SCOREBOARD; i++)
+	{
+		sv_multicast[i].maxsize = sizeof(sv_multicast_buf[i]);
+		sv_multicast[i].cursize = 0;
+		sv_multicast[i].data = sv_multicast_buf[i];
+	}
+	sv_tempentwrites = 0;
+	sv_tempentlayout = NULL;
+
 	sv.reliable_datagram.maxsize = sizeof(sv.reliable_datagram_buf);
 	sv.reliable_datagram.cursize = 0;
 	sv.reliable_datagram.data = sv.reliable_datagram_buf;
@@ -1400,6 +2685,7 @@ void SV_SpawnServer (const char *server)
 // leave slots at start for clients only
 	sv.num_edicts = svs.maxclients+1;
 	memset(sv.edicts, 0, sv.num_edicts*pr_edict_size); // ericw -- sv.edicts switched to use malloc()
+	ED_ResetFreeList ();
 	for (i=0 ; i<svs.maxclients ; i++)
 	{
 		ent = EDICT_NUM(i+1);
@@ -1411,28 +2697,21 @@ void SV_SpawnServer (const char *server)
 
 	sv.time = 1.0;
 
-	q_strlcpy (sv.name, server, sizeof(sv.name));
-	q_snprintf (sv.modelname, sizeof(sv.modelname), "maps/%s.bsp", server);
-	sv.worldmodel = Mod_ForName (sv.modelname, false);
-	if (!sv.worldmodel)
-	{
-		Con_Printf ("Couldn't spawn server %s\n", sv.modelname);
-		sv.active = false;
-		return;
-	}
 	sv.models[1] = sv.worldmodel;
 
 //
 // clear world interaction links
 //
 	SV_ClearWorld ();
+	SV_ClearFatPVSCache ();
+	SV_ResetThinkSchedule ();
 
 	sv.sound_precache[0] = dummy;
-	sv.model_precache[0] = dummy;
-	sv.model_precache[1] = sv.modelname;
+	SV_SetModelPrecache (0, dummy);
+	SV_SetModelPrecache (1, sv.modelname);
 	for (i=1 ; i<sv.worldmodel->numsubmodels ; i++)
 	{
-		sv.model_precache[1+i] = localmodels[i];
+		SV_SetModelPrecache (1+i, localmodels[i]);
 		sv.models[i+1] = Mod_ForName (localmodels[i], false);
 	}
 
@@ -1457,7 +2736,14 @@ void SV_SpawnServer (const char *server)
 // serverflags are for cross level information (sigils)
 	pr_global_struct->serverflags = svs.serverflags;
 
+	loadtime = Sys_DoubleTime ();
 	ED_LoadFromFile (sv.worldmodel->entities);
+	SV_FindChangelevelTargets ();
+	enttime = Sys_DoubleTime ();
+
+	// the local client will ask for this track once it has loaded the map, get the stream opening meanwhile
+	if (!isDedicated)
+		BGM_PrefetchCDtrack ((byte)sv.edicts->v.sounds);
 
 	sv.active = true;
 
@@ -1468,9 +2754,11 @@ void SV_SpawnServer (const char *server)
 	host_frametime = 0.1;
 	SV_Physics ();
 	SV_Physics ();
+	physicstime = Sys_DoubleTime ();
 
 // create a baseline for more efficient communications
 	SV_CreateBaseline ();
+	baselinetime = Sys_DoubleTime ();
 
 	//johnfitz -- warn if signon buffer larger than standard server can handle
 	if (sv.signon.cursize > 8000-2) //max size that will fit into 8000-sized client->message buffer with 2 extra bytes on the end
@@ -1481,7 +2769,11 @@ void SV_SpawnServer (const char *server)
 	for (i=0,host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 		if (host_client->active)
 			SV_SendServerinfo (host_client);
+	SV_RecordSpawned ();
 
-	Con_DPrintf ("Server spawned.\n");
+	Con_DPrintf ("Server spawned in %.1f ms: world %.1f, progs %.1f, entities %.1f, settle %.1f, baseline %.1f, serverinfo %.1f\n",
+		(Sys_DoubleTime () - start) * 1000.0, (worldtime - start) * 1000.0, (loadtime - worldtime) * 1000.0,
+		(enttime - loadtime) * 1000.0, (physicstime - enttime) * 1000.0, (baselinetime - physicstime) * 1000.0,
+		(Sys_DoubleTime () - baselinetime) * 1000.0);
 }
 
@@ -47,12 +47,233 @@ cvar_t	sv_gravity = {"sv_gravity","800",CVAR_NOTIFY|CVAR_SERVERINFO};
 cvar_t	sv_maxvelocity = {"sv_maxvelocity","2000",CVAR_NONE};
 cvar_t	sv_nostep = {"sv_nostep","0",CVAR_NONE};
 cvar_t	sv_freezenonclients = {"sv_freezenonclients","0",CVAR_NONE};
+cvar_t	sv_parallelphysics = {"sv_parallelphysics","0",CVAR_NONE};
+cvar_t	sv_pushquery = {"sv_pushquery","1",CVAR_NONE};
 
 
 #define	MOVE_EPSILON	0.01
 
 void SV_Physics_Toss (edict_t *ent);
 
+/*
+=============================================================================
+
+CLASSNAME PROFILING
+
+sv_profile start charges the time spent thinking, touching, running
+physics and tracing to the classname of the edict it was done for, so
+a slow map shows whether it's the trains, the monsters or the
+triggers.  Nested work is not counted twice, a think run from inside
+SV_Physics_Step is charged to thinking only.  Off it costs a test per
+call site.
+
+=============================================================================
+*/
+
+#define	MAX_PROFCLASSES		512		// power of two
+#define	MAX_PROFDEPTH		32
+
+typedef struct
+{
+	char	name[64];
+	double	time[SVPROF_KINDS];
+	int		calls[SVPROF_KINDS];
+} profclass_t;
+
+typedef struct
+{
+	profclass_t	*pc;
+	int			kind;
+	double		start;
+} profframe_t;
+
+qboolean			sv_profiling;
+static profclass_t	sv_profclasses[MAX_PROFCLASSES];
+static int			sv_numprofclasses;
+static profframe_t	sv_profstack[MAX_PROFDEPTH];
+static int			sv_profdepth, sv_profdeeper;
+static double		sv_profstart, sv_profelapsed;
+
+static profclass_t *SV_ProfileClass (edict_t *ent)
+{
+	const char	*name;
+	unsigned	pos;
+	profclass_t	*pc;
+
+	if (!ent || ent->free || !ent->v.classname)
+		name = "(none)";
+	else
+		name = PR_GetString (ent->v.classname);
+
+	for (pos = COM_HashString (name) & (MAX_PROFCLASSES - 1); ; pos = (pos + 1) & (MAX_PROFCLASSES - 1))
+	{
+		pc = &sv_profclasses[pos];
+		if (!pc->name[0])
+			break;
+		if (!strncmp (pc->name, name, sizeof(pc->name) - 1))
+			return pc;
+	}
+
+	if (sv_numprofclasses == MAX_PROFCLASSES - 1)	// keep a free slot to end the probing
+		return SV_ProfileClass (NULL);
+	q_strlcpy (pc->name, name, sizeof(pc->name));
+	sv_numprofclasses++;
+	return pc;
+}
+
+void SV_ProfileEnter (edict_t *ent, int kind)
+{
+	double	now;
+
+	if (sv_profdepth == MAX_PROFDEPTH)
+	{
+		sv_profdeeper++;	// charged to the caller
+		return;
+	}
+
+	now = Sys_DoubleTime ();
+	if (sv_profdepth)
+	{
+		profframe_t *parent = &sv_profstack[sv_profdepth - 1];
+		parent->pc->time[parent->kind] += now - parent->start;
+	}
+
+	sv_profstack[sv_profdepth].pc = SV_ProfileClass (ent);
+	sv_profstack[sv_profdepth].kind = kind;
+	sv_profstack[sv_profdepth].pc->calls[kind]++;
+	sv_profstack[sv_profdepth].start = Sys_DoubleTime ();
+	sv_profdepth++;
+}
+
+void SV_ProfileLeave (void)
+{
+	double		now;
+	profframe_t	*top;
+
+	if (sv_profdeeper)
+	{
+		sv_profdeeper--;
+		return;
+	}
+	if (!sv_profdepth)
+		return;		// started in the middle of a call
+
+	now = Sys_DoubleTime ();
+	top = &sv_profstack[--sv_profdepth];
+	top->pc->time[top->kind] += now - top->start;
+	if (sv_profdepth)
+		sv_profstack[sv_profdepth - 1].start = now;
+}
+
+static int SV_ProfileCompare (const void *a, const void *b, qboolean bycalls)
+{
+	const profclass_t	*pa = *(const profclass_t **)a;
+	const profclass_t	*pb = *(const profclass_t **)b;
+	double	ta = 0, tb = 0;
+	int		i;
+
+	for (i = 0; i < SVPROF_KINDS; i++)
+	{
+		ta += bycalls ? pa->calls[i] : pa->time[i];
+		tb += bycalls ? pb->calls[i] : pb->time[i];
+	}
+	return (ta < tb) - (ta > tb);
+}
+
+static int SV_ProfileCompareTime (const void *a, const void *b)
+{
+	return SV_ProfileCompare (a, b, false);
+}
+
+static int SV_ProfileCompareCalls (const void *a, const void *b)
+{
+	return SV_ProfileCompare (a, b, true);
+}
+
+/*
+================
+SV_Profile_f
+
+sv_profile [start | stop | reset | calls] [count]
+================
+*/
+void SV_Profile_f (void)
+{
+	profclass_t	**sorted;
+	profclass_t	*pc;
+	double		elapsed, total;
+	int			i, j, n, count, calls;
+	qboolean	bycalls;
+	const char	*arg;
+
+	arg = Cmd_Argv (1);
+	if (!strcmp (arg, "start"))
+	{
+		if (!sv_profiling)
+		{
+			sv_profiling = true;
+			sv_profdepth = sv_profdeeper = 0;
+			sv_profstart = Sys_DoubleTime ();
+		}
+		Con_Printf ("server profiling on\n");
+		return;
+	}
+	if (!strcmp (arg, "stop"))
+	{
+		if (sv_profiling)
+		{
+			sv_profiling = false;
+			sv_profelapsed += Sys_DoubleTime () - sv_profstart;
+		}
+		Con_Printf ("server profiling off\n");
+		return;
+	}
+	if (!strcmp (arg, "reset"))
+	{
+		memset (sv_profclasses, 0, sizeof(sv_profclasses));
+		sv_numprofclasses = 0;
+		sv_profelapsed = 0;
+		sv_profstart = Sys_DoubleTime ();
+		return;
+	}
+
+	bycalls = !strcmp (arg, "calls");
+	count = Cmd_Argc () > (bycalls ? 2 : 1) ? atoi (Cmd_Argv (bycalls ? 2 : 1)) : 25;
+
+	elapsed = sv_profelapsed;
+	if (sv_profiling)
+		elapsed += Sys_DoubleTime () - sv_profstart;
+	if (!sv_numprofclasses || elapsed <= 0)
+	{
+		Con_Printf ("nothing profiled, use \"sv_profile start\"\n");
+		return;
+	}
+
+	sorted = (profclass_t **) Frame_Alloc (sv_numprofclasses * sizeof(*sorted));
+	for (i = n = 0; i < MAX_PROFCLASSES; i++)
+		if (sv_profclasses[i].name[0])
+			sorted[n++] = &sv_profclasses[i];
+	qsort (sorted, n, sizeof(*sorted), bycalls ? SV_ProfileCompareCalls : SV_ProfileCompareTime);
+
+	Con_Printf ("%.1f seconds, msec per second:\n", elapsed);
+	Con_Printf (" total  think  touch   phys   move  calls/s classname\n");
+	for (i = 0; i < n && i < count; i++)
+	{
+		pc = sorted[i];
+		total = 0;
+		calls = 0;
+		for (j = 0; j < SVPROF_KINDS; j++)
+		{
+			total += pc->time[j];
+			calls += pc->calls[j];
+		}
+		Con_Printf ("%6.2f %6.2f %6.2f %6.2f %6.2f %8.0f %s\n", total * 1000 / elapsed,
+			pc->time[SVPROF_THINK] * 1000 / elapsed, pc->time[SVPROF_TOUCH] * 1000 / elapsed,
+			pc->time[SVPROF_PHYSICS] * 1000 / elapsed, pc->time[SVPROF_MOVE] * 1000 / elapsed,
+			calls / elapsed, pc->name);
+	}
+}
+
 /*
 ================
 SV_CheckAllEnts
@@ -141,7 +362,9 @@ qboolean SV_RunThink (edict_t *ent)
 	pr_global_struct->time = thinktime;
 	pr_global_struct->self = EDICT_TO_PROG(ent);
 	pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
+	SV_PROFILE_BEGIN (ent, SVPROF_THINK);
 	PR_ExecuteProgram (ent->v.think);
+	SV_PROFILE_END ();
 
 //johnfitz -- PROTOCOL_FITZQUAKE
 //capture interval to nextthink here and send it to client for better
@@ -177,14 +400,18 @@ void SV_Impact (edict_t *e1, edict_t *e2)
 	{
 		pr_global_struct->self = EDICT_TO_PROG(e1);
 		pr_global_struct->other = EDICT_TO_PROG(e2);
+		SV_PROFILE_BEGIN (e1, SVPROF_TOUCH);
 		PR_ExecuteProgram (e1->v.touch);
+		SV_PROFILE_END ();
 	}
 
 	if (e2->v.touch && e2->v.solid != SOLID_NOT)
 	{
 		pr_global_struct->self = EDICT_TO_PROG(e2);
 		pr_global_struct->other = EDICT_TO_PROG(e1);
+		SV_PROFILE_BEGIN (e2, SVPROF_TOUCH);
 		PR_ExecuteProgram (e2->v.touch);
+		SV_PROFILE_END ();
 	}
 
 	pr_global_struct->self = old_self;
@@ -441,17 +668,29 @@ trace_t SV_PushEntity (edict_t *ent, vec3_t push)
 /*
 ============
 SV_PushMove
+
+With sv_pushquery set, only the edicts the area nodes have around the
+pusher's start and end positions are checked instead of every edict.
+The query box is padded by PUSH_RIDERMARGIN so riders still standing on
+a pusher that moves away from under them are found too.  The candidates
+come back in edict order, so everything gets pushed in the same order
+as the full scan.
 ============
 */
+#define	PUSH_RIDERMARGIN	16
+
 void SV_PushMove (edict_t *pusher, float movetime)
 {
 	int			i, e;
 	edict_t		*check, *block;
 	vec3_t		mins, maxs, move;
+	vec3_t		qmins, qmaxs;
 	vec3_t		entorig, pushorig;
 	int			num_moved;
 	edict_t		**moved_edict; //johnfitz -- dynamically allocate
 	vec3_t		*moved_from; //johnfitz -- dynamically allocate
+	edict_t		**checks;
+	int			num_checks;
 	int			mark; //johnfitz
 
 	if (!pusher->v.velocity[0] && !pusher->v.velocity[1] && !pusher->v.velocity[2])
@@ -465,6 +704,8 @@ void SV_PushMove (edict_t *pusher, float movetime)
 		move[i] = pusher->v.velocity[i] * movetime;
 		mins[i] = pusher->v.absmin[i] + move[i];
 		maxs[i] = pusher->v.absmax[i] + move[i];
+		qmins[i] = q_min (pusher->v.absmin[i], mins[i]) - PUSH_RIDERMARGIN;
+		qmaxs[i] = q_max (pusher->v.absmax[i], maxs[i]) + PUSH_RIDERMARGIN;
 	}
 
 	VectorCopy (pusher->v.origin, pushorig);
@@ -476,16 +717,27 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	SV_LinkEdict (pusher, false);
 
 	//johnfitz -- dynamically allocate
-	mark = Hunk_LowMark ();
-	moved_edict = (edict_t **) Hunk_Alloc (sv.num_edicts*sizeof(edict_t *));
-	moved_from = (vec3_t *) Hunk_Alloc (sv.num_edicts*sizeof(vec3_t));
+	mark = Frame_LowMark ();
+	moved_edict = (edict_t **) Frame_Alloc (sv.num_edicts*sizeof(edict_t *));
+	moved_from = (vec3_t *) Frame_Alloc (sv.num_edicts*sizeof(vec3_t));
 	//johnfitz
+	checks = (edict_t **) Frame_Alloc (sv.num_edicts*sizeof(edict_t *));
+
+	if (sv_pushquery.value)
+		num_checks = SV_PushEdicts (qmins, qmaxs, checks, sv.num_edicts);
+	else
+	{
+		num_checks = 0;
+		check = NEXT_EDICT(sv.edicts);
+		for (e=1 ; e<sv.num_edicts ; e++, check = NEXT_EDICT(check))
+			checks[num_checks++] = check;
+	}
 
 // see if any solid entities are inside the final position
 	num_moved = 0;
-	check = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, check = NEXT_EDICT(check))
+	for (e=0 ; e<num_checks ; e++)
 	{
+		check = checks[e];
 		if (check->free)
 			continue;
 		if (check->v.movetype == MOVETYPE_PUSH
@@ -559,12 +811,12 @@ void SV_PushMove (edict_t *pusher, float movetime)
 				VectorCopy (moved_from[i], moved_edict[i]->v.origin);
 				SV_LinkEdict (moved_edict[i], false);
 			}
-			Hunk_FreeToLowMark (mark); //johnfitz
+			Frame_FreeToLowMark (mark); //johnfitz
 			return;
 		}
 	}
 
-	Hunk_FreeToLowMark (mark); //johnfitz
+	Frame_FreeToLowMark (mark); //johnfitz
 
 }
 
@@ -1163,8 +1415,213 @@ void SV_Physics_Step (edict_t *ent)
 }
 
 
+//============================================================================
+
+/*
+===============================================================================
+
+THINK SCHEDULING
+
+Most edicts are MOVETYPE_NONE and only need a visit when they are due to
+think, so SV_Physics only looks at edicts flagged awake.  Edicts that are
+waiting to think sit in a heap ordered by nextthink and are woken when
+they come due.  QuakeC can only write nextthink or movetype through
+OP_ADDRESS or OP_STATE, which wake the edict, and so do spawning and
+clearing; the visit then sorts out what to do with it, so a spurious wake
+never does more than the old walk over every edict would have.
+
+===============================================================================
+*/
+
+#define	MAX_THINK_HEAP	(MAX_EDICTS * 2)
+
+typedef struct
+{
+	float	time;
+	int	num;
+} thinkentry_t;
+
+static unsigned int	sv_awake[(MAX_EDICTS + 31) / 32];
+static thinkentry_t	sv_thinkheap[MAX_THINK_HEAP];
+static int		sv_numthinks;
+static qboolean		sv_wakeall;	// next frame visits every edict
+
+int			sv_edictsvisited;	// for host_speeds
+
+#define	SV_IsAwake(n)	(sv_awake[(n) >> 5] & (1u << ((n) & 31)))
+
+/*
+================
+SV_ResetThinkSchedule
+
+Called for a new map, the first frame visits every edict
+================
+*/
+void SV_ResetThinkSchedule (void)
+{
+	memset (sv_awake, 0, sizeof(sv_awake));
+	sv_numthinks = 0;
+	sv_wakeall = true;
+}
+
+/*
+================
+SV_WakeEdict
+================
+*/
+void SV_WakeEdict (edict_t *ent)
+{
+	int	num = ((byte *)ent - (byte *)sv.edicts) / pr_edict_size;	// may be past sv.num_edicts while loading
+
+	sv_awake[num >> 5] |= 1u << (num & 31);
+}
+
+static void SV_PushThink (int num, float time)
+{
+	thinkentry_t	e;
+	int		i, parent;
+
+	if (sv_numthinks == MAX_THINK_HEAP)
+	{ // lots of stale entries, start over
+		sv_wakeall = true;
+		sv_numthinks = 0;
+		return;
+	}
+
+	e.time = time;
+	e.num = num;
+	for (i = sv_numthinks++; i > 0; i = parent)
+	{
+		parent = (i - 1) / 2;
+		if (sv_thinkheap[parent].time <= time)
+			break;
+		sv_thinkheap[i] = sv_thinkheap[parent];
+	}
+	sv_thinkheap[i] = e;
+}
+
+static void SV_PopThink (void)
+{
+	thinkentry_t	last;
+	int		i, child;
+
+	last = sv_thinkheap[--sv_numthinks];
+	for (i = 0; (child = i * 2 + 1) < sv_numthinks; i = child)
+	{
+		if (child + 1 < sv_numthinks && sv_thinkheap[child + 1].time < sv_thinkheap[child].time)
+			child++;
+		if (last.time <= sv_thinkheap[child].time)
+			break;
+		sv_thinkheap[i] = sv_thinkheap[child];
+	}
+	sv_thinkheap[i] = last;
+}
+
+/*
+================
+SV_WakeDueThinks
+
+Wakes the edicts that SV_RunThink would let think this frame.  An entry
+may be stale if nextthink was changed since, the visit checks again.
+================
+*/
+static void SV_WakeDueThinks (void)
+{
+	int	num;
+
+	while (sv_numthinks && sv_thinkheap[0].time <= sv.time + host_frametime)
+	{
+		num = sv_thinkheap[0].num;
+		sv_awake[num >> 5] |= 1u << (num & 31);
+		SV_PopThink ();
+	}
+}
+
+/*
+================
+SV_ScheduleEdict
+
+Decides whether an edict that was just visited needs to be looked at
+next frame, or only once it is due to think.
+================
+*/
+static void SV_ScheduleEdict (edict_t *ent, int num)
+{
+	if (!ent->free && (ent->v.movetype != MOVETYPE_NONE || (num > 0 && num <= svs.maxclients)))
+		return;	// moves every frame
+
+	sv_awake[num >> 5] &= ~(1u << (num & 31));
+	if (!ent->free && ent->v.nextthink > 0)
+		SV_PushThink (num, ent->v.nextthink);
+}
+
 //============================================================================
 
+/*
+================
+SV_PredictTossMoves
+
+Works out the moves the airborne toss entities will make this frame if
+their think functions leave them alone, and traces those against the
+world on the worker threads.  SV_Move picks a result up only when the
+real move matches it exactly, so a bad guess just costs a trace.
+================
+*/
+static void SV_PredictTossMoves (qboolean wakeall)
+{
+	int	i, j;
+	edict_t	*ent;
+	vec3_t	vel, move, end;
+	float	ent_gravity;
+	eval_t	*val;
+
+	for (i = svs.maxclients + 1; i < sv.num_edicts; i++)
+	{
+		if (!wakeall && !SV_IsAwake(i))
+			continue;
+		ent = EDICT_NUM(i);
+		if (ent->free || ((int)ent->v.flags & FL_ONGROUND))
+			continue;
+		if (ent->v.movetype != MOVETYPE_TOSS
+		&& ent->v.movetype != MOVETYPE_GIB
+		&& ent->v.movetype != MOVETYPE_BOUNCE
+		&& ent->v.movetype != MOVETYPE_FLY
+		&& ent->v.movetype != MOVETYPE_FLYMISSILE)
+			continue;
+
+	// same steps as SV_CheckVelocity and SV_AddGravity
+		for (j = 0; j < 3; j++)
+		{
+			if (IS_NAN(ent->v.velocity[j]) || IS_NAN(ent->v.origin[j]))
+				break;	// gets fixed and reported in the real move
+			vel[j] = ent->v.velocity[j];
+			if (vel[j] > sv_maxvelocity.value)
+				vel[j] = sv_maxvelocity.value;
+			else if (vel[j] < -sv_maxvelocity.value)
+				vel[j] = -sv_maxvelocity.value;
+		}
+		if (j < 3)
+			continue;
+
+		if (ent->v.movetype != MOVETYPE_FLY
+		&& ent->v.movetype != MOVETYPE_FLYMISSILE)
+		{
+			val = GetEdictFieldValue(ent, "gravity");
+			if (val && val->_float)
+				ent_gravity = val->_float;
+			else
+				ent_gravity = 1.0;
+			vel[2] -= ent_gravity * sv_gravity.value * host_frametime;
+		}
+
+		VectorScale (vel, host_frametime, move);
+		VectorAdd (ent->v.origin, move, end);
+		SV_AddWorldTrace (ent, ent->v.origin, end);
+	}
+
+	SV_RunWorldTraces ();
+}
+
 /*
 ================
 SV_Physics
@@ -1176,6 +1633,9 @@ void SV_Physics (void)
 	int	i;
 	int	entity_cap; // For sv_freezenonclients 
 	edict_t	*ent;
+	qboolean	wakeall;
+
+	TRACE_BEGIN ("SV_Physics");
 
 // let the progs know that a new frame has started
 	pr_global_struct->self = EDICT_TO_PROG(sv.edicts);
@@ -1185,27 +1645,58 @@ void SV_Physics (void)
 
 //SV_CheckAllEnts ();
 
+	SV_WakeDueThinks ();
+	wakeall = sv_wakeall;
+	sv_wakeall = false;
+	sv_edictsvisited = 0;
+	sv_profdepth = sv_profdeeper = 0;	// in case an error left some open
+
+	if (sv_parallelphysics.value && Tasks_NumWorkers () && !sv_freezenonclients.value)
+		SV_PredictTossMoves (wakeall);
+
 //
 // treat each object in turn
 //
-	ent = sv.edicts;
-
 	if (sv_freezenonclients.value)
 	  entity_cap = svs.maxclients + 1; // Only run physics on clients and the world
 	else
 	  entity_cap = sv.num_edicts; 
 
 	//for (i=0 ; i<sv.num_edicts ; i++, ent = NEXT_EDICT(ent))
-	for (i=0 ; i<entity_cap ; i++, ent = NEXT_EDICT(ent))
+	for (i=0 ; i<entity_cap ; i++)
 	{
+		// force_retouch may be set by any think, from then on every edict is relinked
+		if (!wakeall && !pr_global_struct->force_retouch && !SV_IsAwake(i) && (i == 0 || i > svs.maxclients))
+		{
+			if (!sv_awake[i >> 5] && i > svs.maxclients)
+				i |= 31;	// skip the rest of this word
+			continue;
+		}
+
+		ent = (edict_t *)((byte *)sv.edicts + i*pr_edict_size);
+		sv_edictsvisited++;
+
+		// records are hundreds of bytes apart, so start fetching the
+		// parts of the next ones that get looked at
+		if (i + 2 < entity_cap && (wakeall || SV_IsAwake(i + 2)))
+		{
+			edict_t *ahead = (edict_t *)((byte *)ent + 2*pr_edict_size);
+			Q_PREFETCH (&ahead->free);
+			Q_PREFETCH (&ahead->v.nextthink);
+		}
+
 		if (ent->free)
+		{
+			SV_ScheduleEdict (ent, i);
 			continue;
+		}
 
 		if (pr_global_struct->force_retouch)
 		{
 			SV_LinkEdict (ent, true);	// force retouch even for stationary
 		}
 
+		SV_PROFILE_BEGIN (ent, SVPROF_PHYSICS);
 		if (i > 0 && i <= svs.maxclients)
 			SV_Physics_Client (ent, i);
 		else if (ent->v.movetype == MOVETYPE_PUSH)
@@ -1224,11 +1715,20 @@ void SV_Physics (void)
 			SV_Physics_Toss (ent);
 		else
 			Sys_Error ("SV_Physics: bad movetype %i", (int)ent->v.movetype);
+		SV_PROFILE_END ();
+
+		SV_ScheduleEdict (ent, i);
 	}
 
+	SV_EndWorldTraces ();
+
 	if (pr_global_struct->force_retouch)
 		pr_global_struct->force_retouch--;
 
+	ED_UpdateClassnames (true);
+
 	if (!sv_freezenonclients.value) 
 	  sv.time += host_frametime;
+
+	TRACE_END ("SV_Physics");
 }
@@ -0,0 +1,618 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_replay.c -- recorded client input for repeatable server benchmarks
+
+#include "q_stdinc.h"
+#include "arch_def.h"
+#include "net_sys.h"
+#include "quakedef.h"
+#include "net_defs.h"
+
+/*
+===============================================================================
+
+SERVER REPLAY
+
+"sv_record <name>" records the next level the server spawns: every
+message SV_ReadClientMessage takes from a client, the connections and
+drops, and the frame times.  "sv_replay <name>" spawns the same level
+again and feeds the recording back through the same code with no
+networking, as fast as it goes, printing the time spent reading the
+clients, in the physics and building the datagrams.
+
+rand is reseeded from the recording at the spawn and at the start of
+every frame, so the replay does exactly what the recorded server did.
+Each frame also records a hash of the edicts, and the replay reports the
+first frame that doesn't match.  Console commands typed on the server
+while recording and cvars other than the ones in the header aren't
+recorded, so changing them breaks the match.
+
+The file is in native byte order, it's meant to be replayed on the same
+kind of machine.
+
+===============================================================================
+*/
+
+#define	REPLAY_VERSION	1
+
+typedef struct
+{
+	char		magic[4];		// "QSVR"
+	int			version;
+	char		map[MAX_QPATH];
+	int			protocol;
+	int			maxclients;
+	int			serverflags;
+	float		skill, deathmatch, coop, teamplay;
+	unsigned int	seed;
+} replayheader_t;
+
+enum
+{
+	RE_FRAME,		// double frametime, uint64_t edict hash; kind is set if the physics ran
+	RE_CONNECT,		// spawn parms; kind is set for the local client
+	RE_MESSAGE,		// the message; kind is the NET_GetMessage result
+	RE_DROP,		// NET_GetMessage failed
+	RE_END
+};
+
+typedef struct
+{
+	byte		type;
+	byte		slot;
+	byte		kind;
+	byte		pad;
+	int			length;			// of the data that follows
+} replayevent_t;
+
+qboolean		sv_replaying;
+
+static char		sv_recordname[MAX_OSPATH];	// armed for the next spawn
+static FILE		*sv_recordfile;
+static FILE		*sv_replayfile;
+static int		sv_replayleft;				// bytes left, the file can be in a pak
+static replayheader_t	sv_replayheader;
+static unsigned int	sv_replayframe;
+
+static replayevent_t	sv_replayevent;		// lookahead
+static byte		sv_replaydata[NET_MAXMESSAGE];
+static qboolean	sv_replaypeeked;
+
+static qsocket_t	sv_replaysockets[MAX_SCOREBOARD];
+
+/*
+================
+SV_EdictHash
+
+Everything the progs can see that changes from frame to frame
+================
+*/
+static uint64_t SV_EdictHash (void)
+{
+	uint64_t	hash;
+	edict_t		*ent;
+	int			i;
+
+	hash = COM_HashBlock64 (COM_HASH64_INIT, &sv.time, sizeof(sv.time));
+	hash = COM_HashBlock64 (hash, &sv.num_edicts, sizeof(sv.num_edicts));
+	for (i = 0; i < sv.num_edicts; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (ent->free)
+			continue;
+		hash = COM_HashBlock64 (hash, &i, sizeof(i));
+		hash = COM_HashBlock64 (hash, &ent->v, progs->entityfields * 4);
+	}
+	return hash;
+}
+
+static void SV_RecordEvent (int type, int slot, int kind, const void *data, int length)
+{
+	replayevent_t	ev;
+
+	ev.type = type;
+	ev.slot = slot;
+	ev.kind = kind;
+	ev.pad = 0;
+	ev.length = length;
+	fwrite (&ev, sizeof(ev), 1, sv_recordfile);
+	if (length)
+		fwrite (data, length, 1, sv_recordfile);
+}
+
+static void SV_RecordStop (void)
+{
+	SV_RecordEvent (RE_END, 0, 0, NULL, 0);
+	fclose (sv_recordfile);
+	sv_recordfile = NULL;
+	Con_Printf ("sv_record: %u frames recorded\n", sv_replayframe);
+}
+
+static void SV_RecordConnectEvent (client_t *client)
+{
+	qboolean	local;
+
+	local = !Q_strcmp (NET_QSocketGetAddressString (client->netconnection), "LOCAL");
+	SV_RecordEvent (RE_CONNECT, client - svs.clients, local, client->spawn_parms, sizeof(client->spawn_parms));
+}
+
+/*
+================
+SV_RecordSpawn
+
+Start of SV_SpawnServer, ends a recording of the last level and starts
+an armed one
+================
+*/
+void SV_RecordSpawn (const char *server)
+{
+	replayheader_t	*h;
+
+	if (sv_recordfile)
+		SV_RecordStop ();
+
+	h = &sv_replayheader;
+	if (sv_replaying)
+	{
+		srand (h->seed);
+		return;
+	}
+	if (!sv_recordname[0])
+		return;
+
+	sv_recordfile = fopen (sv_recordname, "wb");
+	if (!sv_recordfile)
+	{
+		Con_Printf ("sv_record: couldn't create %s\n", sv_recordname);
+		sv_recordname[0] = 0;
+		return;
+	}
+	Con_Printf ("sv_record: recording %s to %s\n", server, sv_recordname);
+	sv_recordname[0] = 0;
+
+	memset (h, 0, sizeof(*h));
+	memcpy (h->magic, "QSVR", 4);
+	h->version = REPLAY_VERSION;
+	q_strlcpy (h->map, server, sizeof(h->map));
+	h->protocol = sv_protocol;
+	h->maxclients = svs.maxclients;
+	h->serverflags = svs.serverflags;
+	h->skill = skill.value;
+	h->deathmatch = deathmatch.value;
+	h->coop = coop.value;
+	h->teamplay = teamplay.value;
+	h->seed = (unsigned int) (Sys_DoubleTime () * 1000);
+	fwrite (h, sizeof(*h), 1, sv_recordfile);
+
+	srand (h->seed);
+	sv_replayframe = 0;
+}
+
+/*
+================
+SV_RecordSpawned
+
+End of SV_SpawnServer, clients that stay over from the last level don't
+go through SV_CheckForNewClients
+================
+*/
+void SV_RecordSpawned (void)
+{
+	int		i;
+
+	if (!sv_recordfile)
+		return;
+	for (i = 0; i < svs.maxclients; i++)
+		if (svs.clients[i].active)
+			SV_RecordConnectEvent (&svs.clients[i]);
+}
+
+/*
+================
+SV_RecordFrame
+
+Start of Host_ServerFrame
+================
+*/
+void SV_RecordFrame (qboolean runphysics)
+{
+	byte		data[sizeof(double) + sizeof(uint64_t)];
+	uint64_t	hash;
+
+	if (!sv_recordfile)
+		return;
+
+	srand (sv_replayheader.seed + ++sv_replayframe);
+	hash = SV_EdictHash ();
+	memcpy (data, &host_frametime, sizeof(double));
+	memcpy (data + sizeof(double), &hash, sizeof(hash));
+	SV_RecordEvent (RE_FRAME, 0, runphysics, data, sizeof(data));
+}
+
+void SV_RecordConnect (client_t *client)
+{
+	if (sv_recordfile)
+		SV_RecordConnectEvent (client);
+}
+
+/*
+================
+SV_RecordMessage
+
+ret is what NET_GetMessage gave host_client, the message is in net_message
+================
+*/
+void SV_RecordMessage (int ret)
+{
+	if (!sv_recordfile || !ret)
+		return;
+	if (ret == -1)
+		SV_RecordEvent (RE_DROP, host_client - svs.clients, 0, NULL, 0);
+	else
+		SV_RecordEvent (RE_MESSAGE, host_client - svs.clients, ret, net_message.data, net_message.cursize);
+}
+
+/*
+================
+SV_RecordShutdown
+
+Host_ShutdownServer, also on errors
+================
+*/
+void SV_RecordShutdown (void)
+{
+	if (sv_recordfile)
+		SV_RecordStop ();
+	if (sv_replayfile)
+	{
+		fclose (sv_replayfile);
+		sv_replayfile = NULL;
+	}
+	sv_replaying = false;
+}
+
+/*
+================
+SV_Record_f
+================
+*/
+static void SV_Record_f (void)
+{
+	if (cmd_source != src_command)
+		return;
+
+	if (Cmd_Argc () != 2)
+	{
+		if (sv_recordfile)
+			Con_Printf ("sv_record: %u frames recorded so far\n", sv_replayframe);
+		else if (sv_recordname[0])
+			Con_Printf ("sv_record: %s starts with the next map\n", sv_recordname);
+		Con_Printf ("usage: sv_record <name>, or sv_record stop\n");
+		return;
+	}
+
+	if (!strcmp (Cmd_Argv (1), "stop"))
+	{
+		sv_recordname[0] = 0;
+		if (sv_recordfile)
+			SV_RecordStop ();
+		return;
+	}
+
+	if (strstr (Cmd_Argv (1), ".."))
+	{
+		Con_Printf ("Relative pathnames are not allowed.\n");
+		return;
+	}
+
+	q_snprintf (sv_recordname, sizeof(sv_recordname), "%s/%s", com_gamedir, Cmd_Argv (1));
+	COM_AddExtension (sv_recordname, ".svr", sizeof(sv_recordname));
+	Con_Printf ("sv_record: %s starts with the next map\n", sv_recordname);
+}
+
+//============================================================================
+
+static qboolean SV_ReplayRead (void *data, int length)
+{
+	if (length > sv_replayleft || fread (data, 1, length, sv_replayfile) != (size_t)length)
+		return false;
+	sv_replayleft -= length;
+	return true;
+}
+
+/*
+================
+SV_ReplayPeek
+
+The type of the next event, RE_END at the end or on a bad file
+================
+*/
+static int SV_ReplayPeek (void)
+{
+	if (sv_replaypeeked)
+		return sv_replayevent.type;
+
+	if (!SV_ReplayRead (&sv_replayevent, sizeof(sv_replayevent)) ||
+		sv_replayevent.type >= RE_END || sv_replayevent.slot >= svs.maxclients ||
+		sv_replayevent.length < 0 || sv_replayevent.length > (int) sizeof(sv_replaydata) ||
+		!SV_ReplayRead (sv_replaydata, sv_replayevent.length))
+	{
+		sv_replayevent.type = RE_END;
+	}
+	sv_replaypeeked = true;
+	return sv_replayevent.type;
+}
+
+static void SV_ReplayNext (void)
+{
+	sv_replaypeeked = false;
+}
+
+/*
+================
+SV_ReplayNewClients
+
+SV_CheckForNewClients while replaying
+================
+*/
+void SV_ReplayNewClients (void)
+{
+	client_t	*client;
+	qsocket_t	*sock;
+
+	while (SV_ReplayPeek () == RE_CONNECT)
+	{
+		client = &svs.clients[sv_replayevent.slot];
+		sock = &sv_replaysockets[sv_replayevent.slot];
+		memset (sock, 0, sizeof(*sock));
+		sock->disconnected = true;	// keeps the net functions off it
+		sock->connecttime = net_time;
+		q_strlcpy (sock->address, sv_replayevent.kind ? "LOCAL" : "REPLAY", sizeof(sock->address));
+
+		if (!client->active)
+			net_activeconnections++;
+		client->netconnection = sock;
+		SV_ConnectClient (sv_replayevent.slot);
+		memcpy (client->spawn_parms, sv_replaydata, sizeof(client->spawn_parms));
+		SV_ReplayNext ();
+	}
+}
+
+/*
+================
+SV_ReplayGetMessage
+
+NET_GetMessage for host_client while replaying
+================
+*/
+int SV_ReplayGetMessage (void)
+{
+	int		type;
+
+	type = SV_ReplayPeek ();
+	if ((type != RE_MESSAGE && type != RE_DROP) || sv_replayevent.slot != host_client - svs.clients)
+		return 0;
+
+	SV_ReplayNext ();
+	if (type == RE_DROP)
+		return -1;
+	SZ_Clear (&net_message);
+	SZ_Write (&net_message, sv_replaydata, sv_replayevent.length);
+	return sv_replayevent.kind;
+}
+
+/*
+================
+SV_ReplayFlushClient
+
+The end of SV_SendClientMessages for host_client while replaying, nothing
+is sent
+================
+*/
+void SV_ReplayFlushClient (void)
+{
+	if (host_client->message.overflowed)
+	{
+		SV_DropClient (true);
+		host_client->message.overflowed = false;
+		return;
+	}
+	if (host_client->dropasap)
+	{
+		SV_DropClient (false);
+		return;
+	}
+	SZ_Clear (&host_client->message);
+	host_client->last_message = realtime;
+	host_client->sendsignon = false;
+}
+
+/*
+================
+SV_Replay_f
+================
+*/
+static void SV_Replay_f (void)
+{
+	replayheader_t	header, *h;
+	FILE		*f;
+	char		name[MAX_OSPATH];
+	int			length, i, mismatch;
+	int			oldprotocol, oldmaxclients;
+	float		oldskill, olddeathmatch, oldcoop, oldteamplay;
+	double		start, t, t2, clients, physics, send, total;
+	double		frametime;
+	uint64_t	hash;
+	unsigned int	frames;
+	qboolean	runphysics;
+
+	if (cmd_source != src_command)
+		return;
+
+	if (Cmd_Argc () != 2)
+	{
+		Con_Printf ("usage: sv_replay <name>\n");
+		return;
+	}
+	if (sv_recordfile)
+	{
+		Con_Printf ("sv_replay: stop the recording first\n");
+		return;
+	}
+
+	q_strlcpy (name, Cmd_Argv (1), sizeof(name));
+	COM_AddExtension (name, ".svr", sizeof(name));
+	length = COM_FOpenFile (name, &f, NULL);
+	if (!f)
+	{
+		Con_Printf ("sv_replay: couldn't open %s\n", name);
+		return;
+	}
+	if (length < (int) sizeof(header) || fread (&header, sizeof(header), 1, f) != 1 ||
+		memcmp (header.magic, "QSVR", 4) || header.version != REPLAY_VERSION)
+	{
+		Con_Printf ("sv_replay: %s is not a version %i server recording\n", name, REPLAY_VERSION);
+		fclose (f);
+		return;
+	}
+	if (header.maxclients < 1 || header.maxclients > svs.maxclientslimit)
+	{
+		Con_Printf ("sv_replay: %s needs %i clients, the limit is %i\n", name, header.maxclients, svs.maxclientslimit);
+		fclose (f);
+		return;
+	}
+	header.map[sizeof(header.map) - 1] = 0;
+
+// same as Host_Map_f, with the recorded settings
+	cls.demonum = -1;
+	CL_Disconnect ();
+	Host_ShutdownServer (false);
+
+	sv_replayfile = f;
+	sv_replayleft = length - sizeof(header);
+	sv_replayheader = header;
+	h = &sv_replayheader;
+
+	oldprotocol = sv_protocol;
+	oldmaxclients = svs.maxclients;
+	oldskill = skill.value;
+	olddeathmatch = deathmatch.value;
+	oldcoop = coop.value;
+	oldteamplay = teamplay.value;
+
+	sv_protocol = h->protocol;
+	svs.maxclients = h->maxclients;
+	svs.serverflags = h->serverflags;
+	Cvar_SetValue ("skill", h->skill);
+	Cvar_SetValue ("deathmatch", h->deathmatch);
+	Cvar_SetValue ("coop", h->coop);
+	Cvar_SetValue ("teamplay", h->teamplay);
+
+	sv_replaying = true;
+	sv_replaypeeked = false;
+	start = Sys_DoubleTime ();
+	SV_SpawnServer (h->map);
+	if (!sv.active || !sv_replaying)
+		goto done;
+	Con_Printf ("sv_replay: %s spawned in %.1f ms\n", h->map, (Sys_DoubleTime () - start) * 1000);
+
+// run the frames
+	frames = 0;
+	mismatch = 0;
+	clients = physics = send = 0;
+	start = Sys_DoubleTime ();
+	while (1)
+	{
+		i = SV_ReplayPeek ();
+		if (i == RE_END)
+			break;
+		if (i == RE_CONNECT)
+		{
+			SV_ReplayNewClients ();
+			continue;
+		}
+		if (i != RE_FRAME || sv_replayevent.length != sizeof(double) + sizeof(uint64_t))
+		{
+			Con_Printf ("sv_replay: client message outside of a frame, the replay is out of step\n");
+			break;
+		}
+		SV_ReplayNext ();
+		frames++;
+		runphysics = sv_replayevent.kind;	// the lookahead moves on in the frame
+
+		srand (h->seed + frames);
+		memcpy (&frametime, sv_replaydata, sizeof(double));
+		memcpy (&hash, sv_replaydata + sizeof(double), sizeof(hash));
+		if (!mismatch && SV_EdictHash () != hash)
+			mismatch = frames;
+
+		host_frametime = frametime;
+
+	// Host_ServerFrame, split into the phases
+		t = Sys_DoubleTime ();
+		pr_global_struct->frametime = host_frametime;
+		SV_ClearDatagram ();
+		SV_CheckForNewClients ();
+		SV_RunClients ();
+		t2 = Sys_DoubleTime ();
+		clients += t2 - t;
+
+		if (!sv.paused && runphysics)
+			SV_Physics ();
+		t = Sys_DoubleTime ();
+		physics += t - t2;
+
+		SV_SendClientMessages ();
+		send += Sys_DoubleTime () - t;
+
+		if (!sv.active || !sv_replaying)
+			goto done;	// an error, already printed
+	}
+	total = Sys_DoubleTime () - start;
+
+	Con_Printf ("sv_replay: %u frames, %.1f s of game in %.3f s, %.1fx real time\n",
+		frames, sv.time - 1.0, total, total > 0 ? (sv.time - 1.0) / total : 0);
+	if (frames)
+		Con_Printf ("  per frame: clients %.3f ms, physics %.3f ms, send %.3f ms, total %.3f ms\n",
+			clients * 1000 / frames, physics * 1000 / frames, send * 1000 / frames, total * 1000 / frames);
+	hash = SV_EdictHash ();
+	Con_Printf ("  state %08x%08x, %s\n", (unsigned int)(hash >> 32), (unsigned int)hash,
+		mismatch ? va("differs from the recording from frame %i", mismatch) : "matches the recording");
+
+done:
+	for (i = 0, host_client = svs.clients; i < svs.maxclients; i++, host_client++)
+		if (host_client->active)
+			SV_DropClient (true);
+	Host_ShutdownServer (false);	// also closes the file
+
+	sv_protocol = oldprotocol;
+	svs.maxclients = oldmaxclients;
+	Cvar_SetValue ("skill", oldskill);
+	Cvar_SetValue ("deathmatch", olddeathmatch);
+	Cvar_SetValue ("coop", oldcoop);
+	Cvar_SetValue ("teamplay", oldteamplay);
+}
+
+void SV_ReplayInit (void)
+{
+	Cmd_AddCommand ("sv_record", SV_Record_f);
+	Cmd_AddCommand ("sv_replay", SV_Replay_f);
+}
@@ -430,6 +430,16 @@ void SV_ClientThink (void)
 }
 
 
+// PROTOCOL_DELTA: the last entity frame the client has
+static void SV_ReadEntFrameAck (void)
+{
+	int		i;
+
+	i = MSG_ReadLong ();
+	if (i >= 0 && i <= host_client->entframe)
+		host_client->entframeack = i;	// newer ones are left over from the previous level
+}
+
 /*
 ===================
 SV_ReadClientMove
@@ -470,6 +480,67 @@ void SV_ReadClientMove (usercmd_t *move)
 	i = MSG_ReadByte ();
 	if (i)
 		host_client->edict->v.impulse = i;
+
+// read the last entity frame the client has
+	if (sv.protocol == PROTOCOL_DELTA)
+		SV_ReadEntFrameAck ();
+}
+
+/*
+===================
+SV_ReadClientMoves
+
+PROTOCOL_DELTA clc_moves: the client's last few moves, oldest first, each
+numbered.  The ones applied from an earlier packet are skipped, and the
+buttons of all the new ones are kept, so that a tap which was only in a
+lost packet still registers.
+===================
+*/
+void SV_ReadClientMoves (usercmd_t *move)
+{
+	int		i, j;
+	int		count, sequence, bits, buttons, impulse;
+	vec3_t	angle;
+	usercmd_t	cmd;
+
+// read ping time
+	host_client->ping_times[host_client->num_pings%NUM_PING_TIMES]
+		= sv.time - MSG_ReadFloat ();
+	host_client->num_pings++;
+
+	count = MSG_ReadByte ();
+	sequence = MSG_ReadLong ();
+
+	buttons = 0;
+	for (j = count - 1 ; j >= 0 ; j--)
+	{
+		for (i=0 ; i<3 ; i++)
+			angle[i] = MSG_ReadAngle16 (sv.protocolflags);
+		cmd.forwardmove = MSG_ReadShort ();
+		cmd.sidemove = MSG_ReadShort ();
+		cmd.upmove = MSG_ReadShort ();
+		bits = MSG_ReadByte ();
+		impulse = MSG_ReadByte ();
+
+		if (sequence - j - host_client->movesequence <= 0)
+			continue;	// already applied
+
+		VectorCopy (angle, host_client->edict->v.v_angle);
+		VectorCopy (angle, cmd.viewangles);
+		*move = cmd;
+		buttons |= bits;
+		if (impulse)
+			host_client->edict->v.impulse = impulse;
+	}
+
+	if (sequence - host_client->movesequence > 0)
+	{
+		host_client->edict->v.button0 = buttons & 1;
+		host_client->edict->v.button2 = (buttons & 2)>>1;
+		host_client->movesequence = sequence;
+	}
+
+	SV_ReadEntFrameAck ();
 }
 
 /*
@@ -488,7 +559,8 @@ qboolean SV_ReadClientMessage (void)
 	do
 	{
 nextmsg:
-		ret = NET_GetMessage (host_client->netconnection);
+		ret = sv_replaying ? SV_ReplayGetMessage () : NET_GetMessage (host_client->netconnection);
+		SV_RecordMessage (ret);
 		if (ret == -1)
 		{
 			Sys_Printf ("SV_ReadClientMessage: NET_GetMessage failed\n");
@@ -582,6 +654,15 @@ nextmsg:
 			case clc_move:
 				SV_ReadClientMove (&host_client->cmd);
 				break;
+
+			case clc_moves:
+				if (sv.protocol != PROTOCOL_DELTA)
+				{
+					Sys_Printf ("SV_ReadClientMessage: clc_moves without PROTOCOL_DELTA\n");
+					return false;
+				}
+				SV_ReadClientMoves (&host_client->cmd);
+				break;
 			}
 		}
 	} while (ret == 1);
@@ -35,6 +35,7 @@ void Sys_Init (void);
 int Sys_FileOpenRead (const char *path, int *hndl);
 
 int Sys_FileOpenWrite (const char *path);
+int Sys_FileOpenTemp (void);	// anonymous read/write file deleted on close, -1 on failure
 void Sys_FileClose (int handle);
 void Sys_FileSeek (int handle, int position);
 int Sys_FileRead (int handle, void *dest, int count);
@@ -42,6 +43,41 @@ int Sys_FileWrite (int handle,const void *data, int count);
 int Sys_FileTime (const char *path);
 void Sys_mkdir (const char *path);
 
+// these don't call Sys_Error, so they are safe from worker threads
+qboolean Sys_FileCommit (FILE *f);	// flush f all the way to the disk
+qboolean Sys_FileReplace (const char *src, const char *dst);	// rename over an existing dst
+double Sys_FileModTime (const char *path);	// modification time in seconds, -1 if there is no such file
+
+// maps length bytes of the file, starting at its current position, into
+// memory as a private copy-on-write view. returns NULL on failure.
+void *Sys_FileMapView (int handle, int length);
+void Sys_FileUnmapView (void *data, int length);
+
+// address space for the hunk and the client entities: reserves size bytes
+// without backing memory, pages of it are then committed and decommitted as
+// the user grows and shrinks. offsets and sizes passed to commit/decommit are page aligned.
+void *Sys_MemReserve (int size);
+qboolean Sys_MemCommit (void *base, int size);
+void Sys_MemDecommit (void *base, int size);
+
+// read/write memory on huge pages where the system has them, used for the
+// hunk and the edicts with -hugepages. linux still only takes pages as they
+// are touched; windows large pages need the lock pages in memory privilege
+// and are all taken at once. returns NULL where it can't.
+void *Sys_MemAllocHuge (int size);
+void Sys_MemFreeHuge (void *base, int size);
+
+// memory for generated code: allocated writable, then sealed read-only
+// and executable once the code is in. returns NULL on failure.
+void *Sys_CodeAlloc (int size);
+void Sys_CodeSeal (void *code, int size);
+void Sys_CodeFree (void *code, int size);
+
+// copy-on-write copy of the whole process: 0 in the child, the child's
+// id in the parent, -1 on failure or where there is no such thing.
+// only safe before any threads are started.
+int Sys_Fork (void);
+
 //
 // system IO
 //
@@ -63,6 +99,9 @@ const char *Sys_ConsoleInput (void);
 void Sys_Sleep (unsigned long msecs);
 // yield for about 'msecs' milliseconds.
 
+void Sys_SleepUntil (double deadline);
+// sleep until Sys_DoubleTime () reaches deadline, as closely as the OS allows
+
 void Sys_SendKeyEvents (void);
 // Perform Key_Event () callbacks until the input que is empty
 
@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <time.h>
 #ifdef DO_USERDIRS
@@ -119,6 +120,21 @@ int Sys_FileOpenWrite (const char *path)
 	return i;
 }
 
+int Sys_FileOpenTemp (void)
+{
+	FILE	*f;
+	int		i;
+
+	i = findhandle ();
+	f = tmpfile ();
+
+	if (!f)
+		return -1;
+
+	sys_handles[i] = f;
+	return i;
+}
+
 void Sys_FileClose (int handle)
 {
 	fclose (sys_handles[handle]);
@@ -155,6 +171,150 @@ int Sys_FileTime (const char *path)
 	return -1;
 }
 
+double Sys_FileModTime (const char *path)
+{
+	struct stat	st;
+
+	if (stat (path, &st) != 0)
+		return -1;
+	return (double) st.st_mtime;
+}
+
+qboolean Sys_FileCommit (FILE *f)
+{
+	if (fflush (f) != 0)
+		return false;
+	return fsync (fileno (f)) == 0;
+}
+
+qboolean Sys_FileReplace (const char *src, const char *dst)
+{
+	return rename (src, dst) == 0;
+}
+
+void *Sys_FileMapView (int handle, int length)
+{
+	struct stat	st;
+	long		pagesize, offset, delta;
+	void		*base;
+
+	offset = ftell (sys_handles[handle]);
+	if (offset < 0 || length <= 0)
+		return NULL;
+	if (fstat (fileno (sys_handles[handle]), &st) == -1 || offset + length > st.st_size)
+		return NULL;	// don't fault on truncated pak files
+
+	pagesize = sysconf (_SC_PAGESIZE);
+	delta = offset % pagesize;
+	base = mmap (NULL, length + delta, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno (sys_handles[handle]), offset - delta);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	return (byte *)base + delta;
+}
+
+void Sys_FileUnmapView (void *data, int length)
+{
+	long	delta = (long)((uintptr_t)data % sysconf (_SC_PAGESIZE));
+
+	munmap ((byte *)data - delta, length + delta);
+}
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+void *Sys_MemReserve (int size)
+{
+	void	*base;
+
+	base = mmap (NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	return base;
+}
+
+qboolean Sys_MemCommit (void *base, int size)
+{
+	return mprotect (base, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+void Sys_MemDecommit (void *base, int size)
+{
+	// mapping fresh pages over the range drops the old ones
+	mmap (base, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+}
+
+#define HUGE_PAGE_SIZE	(2 * 1024 * 1024)	// for 4K base pages on x86 and arm64
+
+void *Sys_MemAllocHuge (int size)
+{
+#if defined(MADV_HUGEPAGE)
+	byte	*base, *aligned, *end;
+	size_t	length, total;
+
+	// transparent huge pages only back whole aligned 2MB ranges, so map
+	// a page extra and trim both ends
+	length = ((size_t)size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+	total = length + HUGE_PAGE_SIZE;
+	base = (byte *) mmap (NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == (byte *) MAP_FAILED)
+		return NULL;
+
+	aligned = (byte *)(((uintptr_t)base + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	end = aligned + length;
+	if (aligned > base)
+		munmap (base, aligned - base);
+	if (base + total > end)
+		munmap (end, base + total - end);
+
+	if (madvise (aligned, length, MADV_HUGEPAGE) != 0)
+	{
+		munmap (aligned, length);
+		return NULL;
+	}
+
+	return aligned;
+#else
+	return NULL;
+#endif
+}
+
+void Sys_MemFreeHuge (void *base, int size)
+{
+	munmap (base, ((size_t)size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1));
+}
+
+void *Sys_CodeAlloc (int size)
+{
+	void	*code;
+
+	code = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED)
+		return NULL;
+
+	return code;
+}
+
+void Sys_CodeSeal (void *code, int size)
+{
+	mprotect (code, size, PROT_READ | PROT_EXEC);
+#if defined(__GNUC__)
+	__builtin___clear_cache ((char *)code, (char *)code + size);
+#endif
+}
+
+void Sys_CodeFree (void *code, int size)
+{
+	munmap (code, size);
+}
+
+int Sys_Fork (void)
+{
+	fflush (stdout);	// or the child prints it again
+	return fork ();
+}
 
 #if defined(__linux__) || defined(__sun) || defined(sun) || defined(_AIX)
 static int Sys_NumCPUs (void)
@@ -410,7 +570,15 @@ void Sys_Quit (void)
 
 double Sys_DoubleTime (void)
 {
+#if defined(USE_SDL2)
+	static Uint64	start;
+
+	if (!start)
+		start = SDL_GetPerformanceCounter ();
+	return (double)(SDL_GetPerformanceCounter () - start) / SDL_GetPerformanceFrequency ();
+#else
 	return SDL_GetTicks() / 1000.0;
+#endif
 }
 
 const char *Sys_ConsoleInput (void)
@@ -467,6 +635,29 @@ void Sys_Sleep (unsigned long msecs)
 	SDL_Delay (msecs);
 }
 
+#define	SLEEP_SPIN_TIME		0.0005	// the scheduler can oversleep by about this much
+
+void Sys_SleepUntil (double deadline)
+{
+	struct timespec	ts;
+	double		remaining;
+
+	while ((remaining = deadline - Sys_DoubleTime ()) > 0)
+	{
+		if (remaining <= SLEEP_SPIN_TIME)
+			continue;	// spin out the rest
+
+		remaining -= SLEEP_SPIN_TIME;
+		ts.tv_sec = (time_t) remaining;
+		ts.tv_nsec = (long) ((remaining - ts.tv_sec) * 1e9);
+#if defined(__linux__)
+		clock_nanosleep (CLOCK_MONOTONIC, 0, &ts, NULL);
+#else
+		nanosleep (&ts, NULL);
+#endif
+	}
+}
+
 void Sys_SendKeyEvents (void)
 {
 	IN_Commands();		//ericw -- allow joysticks to add keys so they can be used to confirm SCR_ModalMessage
@@ -118,6 +118,21 @@ int Sys_FileOpenWrite (const char *path)
 	return i;
 }
 
+int Sys_FileOpenTemp (void)
+{
+	FILE	*f;
+	int		i;
+
+	i = findhandle ();
+	f = tmpfile ();
+
+	if (!f)
+		return -1;
+
+	sys_handles[i] = f;
+	return i;
+}
+
 void Sys_FileClose (int handle)
 {
 	fclose (sys_handles[handle]);
@@ -154,6 +169,161 @@ int Sys_FileTime (const char *path)
 	return -1;
 }
 
+double Sys_FileModTime (const char *path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA	data;
+	ULARGE_INTEGER	t;
+
+	if (!GetFileAttributesExA (path, GetFileExInfoStandard, &data))
+		return -1;
+	t.LowPart = data.ftLastWriteTime.dwLowDateTime;
+	t.HighPart = data.ftLastWriteTime.dwHighDateTime;
+	return t.QuadPart / 10000000.0;	// 100ns intervals since 1601
+}
+
+qboolean Sys_FileCommit (FILE *f)
+{
+	if (fflush (f) != 0)
+		return false;
+	return _commit (_fileno (f)) == 0;
+}
+
+qboolean Sys_FileReplace (const char *src, const char *dst)
+{
+	if (MoveFileExA (src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		return true;
+	// no MoveFileEx on win9x
+	remove (dst);
+	return rename (src, dst) == 0;
+}
+
+void *Sys_FileMapView (int handle, int length)
+{
+	SYSTEM_INFO	info;
+	LARGE_INTEGER	size;
+	HANDLE		file, mapping;
+	long		offset, delta;
+	void		*base;
+
+	offset = ftell (sys_handles[handle]);
+	if (offset < 0 || length <= 0)
+		return NULL;
+	file = (HANDLE) _get_osfhandle (_fileno (sys_handles[handle]));
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx (file, &size) || offset + length > size.QuadPart)
+		return NULL;	// don't fault on truncated pak files
+
+	mapping = CreateFileMapping (file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (!mapping)
+		return NULL;
+
+	GetSystemInfo (&info);
+	delta = offset % info.dwAllocationGranularity;
+	base = MapViewOfFile (mapping, FILE_MAP_COPY, 0, offset - delta, length + delta);
+	CloseHandle (mapping);	// the view keeps the mapping object alive
+	if (!base)
+		return NULL;
+
+	return (byte *)base + delta;
+}
+
+void Sys_FileUnmapView (void *data, int length)
+{
+	SYSTEM_INFO	info;
+
+	GetSystemInfo (&info);
+	UnmapViewOfFile ((byte *)data - ((uintptr_t)data % info.dwAllocationGranularity));
+}
+
+void *Sys_MemReserve (int size)
+{
+	return VirtualAlloc (NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+qboolean Sys_MemCommit (void *base, int size)
+{
+	return VirtualAlloc (base, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void Sys_MemDecommit (void *base, int size)
+{
+	VirtualFree (base, size, MEM_DECOMMIT);
+}
+
+#ifndef MEM_LARGE_PAGES
+#define MEM_LARGE_PAGES	0x20000000
+#endif
+
+typedef SIZE_T (WINAPI *GETLARGEPAGEMINIMUM) (void);
+
+/*
+================
+Sys_EnableLockMemory
+
+Large pages can't be paged out, so the account has to hold the lock pages
+in memory right and the process has to switch it on.
+================
+*/
+static qboolean Sys_EnableLockMemory (void)
+{
+	HANDLE		token;
+	TOKEN_PRIVILEGES	tp;
+	qboolean	ok;
+
+	if (!OpenProcessToken (GetCurrentProcess (), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	ok = LookupPrivilegeValueA (NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+		AdjustTokenPrivileges (token, FALSE, &tp, 0, NULL, NULL) &&
+		GetLastError () == ERROR_SUCCESS;	// ERROR_NOT_ALL_ASSIGNED without the right
+	CloseHandle (token);
+
+	return ok;
+}
+
+void *Sys_MemAllocHuge (int size)
+{
+	GETLARGEPAGEMINIMUM	pGetLargePageMinimum;
+	SIZE_T	pagesize;
+
+	pGetLargePageMinimum = (GETLARGEPAGEMINIMUM) GetProcAddress (GetModuleHandle ("kernel32.dll"), "GetLargePageMinimum");
+	pagesize = pGetLargePageMinimum ? pGetLargePageMinimum () : 0;
+	if (!pagesize || !Sys_EnableLockMemory ())
+		return NULL;
+
+	return VirtualAlloc (NULL, ((SIZE_T)size + pagesize - 1) & ~(pagesize - 1),
+			MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
+
+void Sys_MemFreeHuge (void *base, int size)
+{
+	VirtualFree (base, 0, MEM_RELEASE);
+}
+
+void *Sys_CodeAlloc (int size)
+{
+	return VirtualAlloc (NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void Sys_CodeSeal (void *code, int size)
+{
+	DWORD	old;
+
+	VirtualProtect (code, size, PAGE_EXECUTE_READ, &old);
+	FlushInstructionCache (GetCurrentProcess (), code, size);
+}
+
+void Sys_CodeFree (void *code, int size)
+{
+	VirtualFree (code, 0, MEM_RELEASE);
+}
+
+int Sys_Fork (void)
+{
+	return -1;	// no fork on windows
+}
+
 static char	cwd[1024];
 
 static void Sys_GetBasedir (char *argv0, char *dst, size_t dstsize)
@@ -360,7 +530,15 @@ void Sys_Quit (void)
 
 double Sys_DoubleTime (void)
 {
+#if defined(USE_SDL2)
+	static Uint64	start;
+
+	if (!start)
+		start = SDL_GetPerformanceCounter ();
+	return (double)(SDL_GetPerformanceCounter () - start) / SDL_GetPerformanceFrequency ();
+#else
 	return SDL_GetTicks() / 1000.0;
+#endif
 }
 
 const char *Sys_ConsoleInput (void)
@@ -435,6 +613,51 @@ void Sys_Sleep (unsigned long msecs)
 	SDL_Delay (msecs);
 }
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION	0x00000002
+#endif
+
+typedef HANDLE (WINAPI *CREATEWAITABLETIMEREXW) (LPSECURITY_ATTRIBUTES, LPCWSTR, DWORD, DWORD);
+
+static HANDLE	sleep_timer;
+static double	sleep_spintime;		// how much the timer may oversleep
+
+static void Sys_InitSleepTimer (void)
+{
+	CREATEWAITABLETIMEREXW	pCreateWaitableTimerExW;
+
+	// high resolution timers are Windows 10 1803 and later
+	pCreateWaitableTimerExW = (CREATEWAITABLETIMEREXW) GetProcAddress (GetModuleHandle ("kernel32.dll"), "CreateWaitableTimerExW");
+	if (pCreateWaitableTimerExW)
+		sleep_timer = pCreateWaitableTimerExW (NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (sleep_timer)
+		sleep_spintime = 0.0005;
+	else
+	{
+		sleep_timer = CreateWaitableTimer (NULL, TRUE, NULL);
+		sleep_spintime = 0.002;
+	}
+}
+
+void Sys_SleepUntil (double deadline)
+{
+	LARGE_INTEGER	due;
+	double		remaining;
+
+	if (!sleep_timer)
+		Sys_InitSleepTimer ();
+
+	while ((remaining = deadline - Sys_DoubleTime ()) > 0)
+	{
+		if (remaining <= sleep_spintime || !sleep_timer)
+			continue;	// spin out the rest
+
+		due.QuadPart = -(LONGLONG) ((remaining - sleep_spintime) * 1e7);	// relative, in 100ns
+		if (SetWaitableTimer (sleep_timer, &due, 0, NULL, NULL, FALSE))
+			WaitForSingleObject (sleep_timer, INFINITE);
+	}
+}
+
 void Sys_SendKeyEvents (void)
 {
 	IN_Commands();		//ericw -- allow joysticks to add keys so they can be used to confirm SCR_ModalMessage
@@ -0,0 +1,409 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// tasks.c -- small worker thread pool
+
+#include "quakedef.h"
+
+#define	MAX_TASKS		256		// outstanding tasks, power of two
+#define	MAX_TASK_WORKERS	8
+#define	MAX_TASK_TYPES		32		// distinct names kept by task_stats
+
+typedef enum
+{
+	TASK_QUEUED,
+	TASK_RUNNING,
+	TASK_DONE
+} taskstate_t;
+
+typedef struct
+{
+	task_t		id;
+	taskstate_t	state;
+	const char	*name;
+	taskfunc_t	func;
+	void		*data;
+	double		queued;		// when Task_Run was called
+	int		numdeps;
+	task_t		deps[MAX_TASK_DEPS];
+} taskslot_t;
+
+typedef struct
+{
+	const char	*name;
+	int		count;
+	double		time, maxtime;	// running
+	double		wait;		// queued, including waiting for dependencies
+} tasktype_t;
+
+static tasktype_t	task_types[MAX_TASK_TYPES];
+static int		task_numtypes;
+
+static taskslot_t	tasks[MAX_TASKS];
+static task_t		task_nextid = 1;
+
+static SDL_mutex	*task_lock;
+static SDL_cond		*task_queued;		// signaled when a task may have become runnable
+static SDL_cond		*task_finished;		// signaled when a task is done
+static SDL_Thread	*task_workers[MAX_TASK_WORKERS];
+static int		task_numworkers;
+static qboolean		task_quit;
+
+static qboolean Task_IsDone (task_t id)
+{
+	taskslot_t	*t = &tasks[id & (MAX_TASKS - 1)];
+
+	// a slot is only reused once its task is done
+	return id == 0 || t->id != id || t->state == TASK_DONE;
+}
+
+/*
+=================
+Task_FindRunnable
+
+Returns the oldest queued task whose dependencies are done.
+Called with task_lock held.
+=================
+*/
+static taskslot_t *Task_FindRunnable (void)
+{
+	taskslot_t	*t, *best;
+	int		i, j;
+
+	best = NULL;
+	for (i = 0, t = tasks; i < MAX_TASKS; i++, t++)
+	{
+		if (t->id == 0 || t->state != TASK_QUEUED)
+			continue;
+		if (best && t->id - best->id < 0x80000000u)
+			continue;	// an older one was found already
+		for (j = 0; j < t->numdeps; j++)
+		{
+			if (!Task_IsDone (t->deps[j]))
+				break;
+		}
+		if (j == t->numdeps)
+			best = t;
+	}
+
+	return best;
+}
+
+/*
+=================
+Task_Account
+
+Adds a run to task_stats, called with task_lock held when there are workers
+=================
+*/
+static void Task_Account (const char *name, double wait, double time)
+{
+	tasktype_t	*type;
+	int		i;
+
+	for (i = 0, type = task_types; i < task_numtypes; i++, type++)
+	{
+		if (type->name == name)
+			break;
+	}
+	if (i == task_numtypes)
+	{
+		if (task_numtypes == MAX_TASK_TYPES)
+			return;
+		task_numtypes++;
+		type->name = name;
+		type->count = 0;
+		type->time = type->maxtime = type->wait = 0;
+	}
+
+	type->count++;
+	type->time += time;
+	type->maxtime = q_max(type->maxtime, time);
+	type->wait += wait;
+}
+
+/*
+=================
+Task_Execute
+
+Runs a queued task, called and returns with task_lock held.
+=================
+*/
+static void Task_Execute (taskslot_t *t)
+{
+	const char	*name;
+	double		queued, start;
+
+	t->state = TASK_RUNNING;
+	name = t->name;
+	queued = t->queued;
+	SDL_UnlockMutex (task_lock);
+
+	start = Sys_DoubleTime ();
+	TRACE_BEGIN (name);
+	t->func (t->data);
+	TRACE_END (name);
+
+	SDL_LockMutex (task_lock);
+	Task_Account (name, start - queued, Sys_DoubleTime () - start);
+	t->state = TASK_DONE;
+	SDL_CondBroadcast (task_finished);
+	SDL_CondBroadcast (task_queued);	// dependents may be runnable now
+}
+
+static int SDLCALL Task_WorkerThread (void *unused)
+{
+	taskslot_t	*t;
+
+	SDL_LockMutex (task_lock);
+	while (!task_quit)
+	{
+		t = Task_FindRunnable ();
+		if (t)
+			Task_Execute (t);
+		else
+			SDL_CondWait (task_queued, task_lock);
+	}
+	SDL_UnlockMutex (task_lock);
+
+	return 0;
+}
+
+/*
+=================
+Task_RunNamed
+
+Called through Task_Run, which names the task after its function
+=================
+*/
+task_t Task_RunNamed (const char *name, taskfunc_t func, void *data, const task_t *deps, int numdeps)
+{
+	taskslot_t	*t;
+	task_t		id;
+	int		i;
+	double		start;
+
+	if (numdeps > MAX_TASK_DEPS)
+		Sys_Error ("Task_Run: %i dependencies", numdeps);
+
+	if (!task_numworkers)
+	{ // dependencies ran inline as well, so they are done
+		start = Sys_DoubleTime ();
+		TRACE_BEGIN (name);
+		func (data);
+		TRACE_END (name);
+		Task_Account (name, 0, Sys_DoubleTime () - start);
+		return 0;
+	}
+
+	SDL_LockMutex (task_lock);
+
+	id = task_nextid++;
+	if (!task_nextid)
+		task_nextid = 1;	// 0 is reserved
+	t = &tasks[id & (MAX_TASKS - 1)];
+
+	// all slots busy, help out until this one frees up
+	while (t->id && t->state != TASK_DONE)
+	{
+		taskslot_t *other = Task_FindRunnable ();
+		if (other)
+			Task_Execute (other);
+		else
+			SDL_CondWait (task_finished, task_lock);
+	}
+
+	t->id = id;
+	t->state = TASK_QUEUED;
+	t->name = name;
+	t->func = func;
+	t->data = data;
+	t->queued = Sys_DoubleTime ();
+	t->numdeps = 0;
+	for (i = 0; i < numdeps; i++)
+	{
+		if (!Task_IsDone (deps[i]))
+			t->deps[t->numdeps++] = deps[i];
+	}
+
+	SDL_CondSignal (task_queued);
+	SDL_UnlockMutex (task_lock);
+
+	return id;
+}
+
+/*
+=================
+Task_Wait
+=================
+*/
+void Task_Wait (task_t task)
+{
+	taskslot_t	*t;
+
+	if (!task_numworkers || !task)
+		return;
+
+	SDL_LockMutex (task_lock);
+	while (!Task_IsDone (task))
+	{
+		t = Task_FindRunnable ();
+		if (t)
+			Task_Execute (t);
+		else
+			SDL_CondWait (task_finished, task_lock);
+	}
+	SDL_UnlockMutex (task_lock);
+}
+
+/*
+=================
+Task_Done
+
+Non-blocking check, for polling from the main loop.
+=================
+*/
+qboolean Task_Done (task_t task)
+{
+	qboolean	done;
+
+	if (!task_numworkers || !task)
+		return true;
+
+	SDL_LockMutex (task_lock);
+	done = Task_IsDone (task);
+	SDL_UnlockMutex (task_lock);
+
+	return done;
+}
+
+int Tasks_NumWorkers (void)
+{
+	return task_numworkers;
+}
+
+/*
+=================
+Tasks_Stats_f
+
+task_stats -- the runs of each kind of task since the last task_stats
+=================
+*/
+static void Tasks_Stats_f (void)
+{
+	tasktype_t	types[MAX_TASK_TYPES], *type;
+	int		i, numtypes;
+
+	if (task_numworkers)
+		SDL_LockMutex (task_lock);
+	numtypes = task_numtypes;
+	memcpy (types, task_types, numtypes * sizeof(tasktype_t));
+	task_numtypes = 0;
+	if (task_numworkers)
+		SDL_UnlockMutex (task_lock);
+
+	if (!numtypes)
+	{
+		Con_Printf ("No tasks have run\n");
+		return;
+	}
+
+	Con_Printf ("%i workers\n", task_numworkers);
+	Con_Printf ("   runs   avg ms   max ms  wait ms  name\n");
+	for (i = 0, type = types; i < numtypes; i++, type++)
+	{
+		Con_Printf ("%7i %8.3f %8.3f %8.3f  %s\n", type->count,
+			type->time * 1000.0 / type->count, type->maxtime * 1000.0,
+			type->wait * 1000.0 / type->count, type->name);
+	}
+}
+
+/*
+=================
+Tasks_Init
+
+The pool is sized from the number of cores, or from -threads <n>.
+-threads 0 runs every task inline on the calling thread.
+=================
+*/
+void Tasks_Init (void)
+{
+	int	i, numworkers;
+
+	i = COM_CheckParm ("-threads");
+	if (i && i < com_argc - 1)
+		numworkers = Q_atoi (com_argv[i + 1]);
+	else
+	{
+#if defined(USE_SDL2)
+		numworkers = SDL_GetCPUCount () - 1;	// leave a core for the main thread
+#else
+		numworkers = 0;
+#endif
+	}
+	Cmd_AddCommand ("task_stats", Tasks_Stats_f);
+
+	numworkers = CLAMP (0, numworkers, MAX_TASK_WORKERS);
+	if (!numworkers)
+		return;
+
+	task_lock = SDL_CreateMutex ();
+	task_queued = SDL_CreateCond ();
+	task_finished = SDL_CreateCond ();
+	if (!task_lock || !task_queued || !task_finished)
+		Sys_Error ("Tasks_Init: couldn't create locks");
+
+	task_quit = false;
+	for (i = 0; i < numworkers; i++)
+	{
+#if defined(USE_SDL2)
+		task_workers[i] = SDL_CreateThread (Task_WorkerThread, "worker", NULL);
+#else
+		task_workers[i] = SDL_CreateThread (Task_WorkerThread, NULL);
+#endif
+		if (!task_workers[i])
+			break;
+	}
+	task_numworkers = i;
+
+	Con_Printf ("Task workers: %i\n", task_numworkers);
+}
+
+void Tasks_Shutdown (void)
+{
+	int	i;
+
+	if (!task_numworkers)
+		return;
+
+	SDL_LockMutex (task_lock);
+	task_quit = true;
+	SDL_CondBroadcast (task_queued);
+	SDL_UnlockMutex (task_lock);
+
+	for (i = 0; i < task_numworkers; i++)
+		SDL_WaitThread (task_workers[i], NULL);
+	task_numworkers = 0;
+
+	SDL_DestroyCond (task_finished);
+	SDL_DestroyCond (task_queued);
+	SDL_DestroyMutex (task_lock);
+}
+
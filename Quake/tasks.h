@@ -0,0 +1,56 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef _QUAKE_TASKS_H
+#define _QUAKE_TASKS_H
+
+/* tasks.h -- small worker thread pool
+ *
+ * Tasks run on worker threads, so they must not touch the hunk, the
+ * zone, the console, cvars or GL, and must not call Sys_Error or
+ * Host_Error: record the failure and report it once the task is done.
+ * A task only starts after all of its dependencies have finished.
+ *
+ * Tasks are told apart by the name of their function: each run shows up
+ * under it with host_trace, and "task_stats" sums them up per name.
+ */
+
+#define	MAX_TASK_DEPS	8
+
+typedef void (*taskfunc_t) (void *data);
+typedef unsigned int task_t;	// 0 == no task, always done
+
+void Tasks_Init (void);
+void Tasks_Shutdown (void);
+int Tasks_NumWorkers (void);
+
+// runs the task inline if there are no worker threads
+task_t Task_RunNamed (const char *name, taskfunc_t func, void *data, const task_t *deps, int numdeps);
+#define	Task_Run(func, data, deps, numdeps)	Task_RunNamed (#func, func, data, deps, numdeps)
+
+// blocks until the task is done; the calling thread runs queued tasks meanwhile
+void Task_Wait (task_t task);
+
+// true once the task has finished, never blocks
+qboolean Task_Done (task_t task);
+
+#endif	/* _QUAKE_TASKS_H */
+
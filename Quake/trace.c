@@ -0,0 +1,169 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// trace.c -- scope timing for about:tracing
+
+#include "quakedef.h"
+
+#define	TRACE_EVENTS	(1 << 16)	// power of two
+
+typedef struct
+{
+	double		time;
+	const char	*name;
+	unsigned long	thread;
+	int		value;		// of a counter
+	char		phase;		// 'B', 'E' or 'C' for a counter
+} traceevent_t;
+
+static traceevent_t	trace_events[TRACE_EVENTS];
+#if defined(USE_SDL2)
+static SDL_atomic_t	trace_next;
+#else
+static int		trace_next;	// no worker threads without SDL2
+#endif
+
+qboolean	trace_active;
+
+static cvar_t	host_trace = {"host_trace", "0", CVAR_NONE};
+
+static int Trace_Count (void)
+{
+#if defined(USE_SDL2)
+	return SDL_AtomicGet (&trace_next);
+#else
+	return trace_next;
+#endif
+}
+
+static traceevent_t *Trace_NewEvent (void)
+{
+	int		i;
+
+#if defined(USE_SDL2)
+	i = SDL_AtomicAdd (&trace_next, 1);
+#else
+	i = trace_next++;
+#endif
+	return &trace_events[i & (TRACE_EVENTS - 1)];
+}
+
+void Trace_Event (const char *name, char phase)
+{
+	traceevent_t	*e;
+
+	e = Trace_NewEvent ();
+	e->time = Sys_DoubleTime ();
+	e->name = name;
+	e->thread = (unsigned long) SDL_ThreadID ();
+	e->phase = phase;
+}
+
+void Trace_Counter (const char *name, int value)
+{
+	traceevent_t	*e;
+
+	if (!trace_active)
+		return;
+	e = Trace_NewEvent ();
+	e->time = Sys_DoubleTime ();
+	e->name = name;
+	e->thread = (unsigned long) SDL_ThreadID ();
+	e->value = value;
+	e->phase = 'C';
+}
+
+static void Trace_Changed_f (cvar_t *var)
+{
+	if (var->value && !trace_active)
+	{
+#if defined(USE_SDL2)
+		SDL_AtomicSet (&trace_next, 0);
+#else
+		trace_next = 0;
+#endif
+	}
+	trace_active = var->value != 0;
+}
+
+/*
+=================
+Trace_Dump_f
+
+trace_dump [file] -- writes the ring in the Chrome trace event format
+=================
+*/
+static void Trace_Dump_f (void)
+{
+	char		name[MAX_OSPATH];
+	traceevent_t	*e;
+	FILE		*f;
+	double		start;
+	int		i, count, first;
+
+	count = Trace_Count ();
+	if (!count)
+	{
+		Con_Printf ("Nothing traced, set host_trace 1 first\n");
+		return;
+	}
+
+	q_strlcpy (name, Cmd_Argc () > 1 ? Cmd_Argv (1) : "trace", sizeof(name));
+	COM_AddExtension (name, ".json", sizeof(name));
+	if (strstr (name, ".."))
+	{
+		Con_Printf ("Relative pathnames are not allowed.\n");
+		return;
+	}
+
+	f = fopen (va("%s/%s", com_gamedir, name), "w");
+	if (!f)
+	{
+		Con_Printf ("Couldn't write %s.\n", name);
+		return;
+	}
+
+	first = q_max(count - TRACE_EVENTS, 0);
+	start = trace_events[first & (TRACE_EVENTS - 1)].time;
+
+	fprintf (f, "{\"traceEvents\":[\n");
+	for (i = first; i < count; i++)
+	{
+		e = &trace_events[i & (TRACE_EVENTS - 1)];
+		if (e->phase == 'C')
+			fprintf (f, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.1f,\"pid\":1,\"args\":{\"value\":%i}}%s\n",
+				e->name, (e->time - start) * 1000000.0, e->value, i < count - 1 ? "," : "");
+		else
+			fprintf (f, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.1f,\"pid\":1,\"tid\":%lu}%s\n",
+				e->name, e->phase, (e->time - start) * 1000000.0, e->thread, i < count - 1 ? "," : "");
+	}
+	fprintf (f, "]}\n");
+	fclose (f);
+
+	Con_Printf ("wrote %i events to %s/%s\n", count - first, com_gamedir, name);
+}
+
+void Trace_Init (void)
+{
+	Cvar_RegisterVariable (&host_trace);
+	Cvar_SetCallback (&host_trace, Trace_Changed_f);
+	Cmd_AddCommand ("trace_dump", Trace_Dump_f);
+}
+
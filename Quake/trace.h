@@ -0,0 +1,44 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef _QUAKE_TRACE_H
+#define _QUAKE_TRACE_H
+
+/* trace.h -- scope timing for about:tracing
+ *
+ * With host_trace set, TRACE_BEGIN / TRACE_END record timestamped markers
+ * into a ring buffer from any thread; trace_dump writes the ring out in
+ * the Chrome trace event format.  With it unset they cost one test.
+ * The names must be string literals, only the pointer is kept.
+ * Trace_Counter records a value that the viewer graphs over time.
+ */
+
+extern qboolean	trace_active;
+
+void Trace_Init (void);
+void Trace_Event (const char *name, char phase);
+void Trace_Counter (const char *name, int value);
+
+#define	TRACE_BEGIN(name)	do { if (trace_active) Trace_Event (name, 'B'); } while (0)
+#define	TRACE_END(name)		do { if (trace_active) Trace_Event (name, 'E'); } while (0)
+
+#endif	/* _QUAKE_TRACE_H */
+
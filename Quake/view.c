@@ -906,9 +906,7 @@ void V_RenderView (void)
 
 	//johnfitz -- removed lcd code
 
-	R_RenderView ();
-
-	V_PolyBlend (); //johnfitz -- moved here from R_Renderview ();
+	R_RenderView (); //also does V_PolyBlend, with the r_scale pass if there is one
 }
 
 /*
@@ -32,6 +32,7 @@ void V_Init (void);
 void V_RenderView (void);
 void V_CalcBlend (void);
 void V_UpdateBlend (void);
+void V_PolyBlend (void);
 float V_CalcRoll (vec3_t angles, vec3_t velocity);
 void V_RestoreAngles (void);
 //void V_UpdatePalette (void); //johnfitz
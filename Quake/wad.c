@@ -26,6 +26,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 int				wad_numlumps;
 lumpinfo_t		*wad_lumps;
 byte			*wad_base = NULL;
+static qboolean		wad_mapped;	// wad_base is a view from COM_MapFile
+
+static unsigned short	*wad_hash;	// index into wad_lumps + 1, 0 == empty
+static int		wad_hashsize;	// power of two
 
 void SwapPic (qpic_t *pic);
 
@@ -60,6 +64,29 @@ void W_CleanupName (const char *in, char *out)
 		out[i] = 0;
 }
 
+// lump names fill all 16 chars when they are that long
+static unsigned W_HashName (const char *cleanname)
+{
+	char	name[17];
+
+	memcpy (name, cleanname, 16);
+	name[16] = 0;
+	return COM_HashString (name);
+}
+
+// the wad_hash slot holding cleanname, or the empty one it would go in
+static unsigned W_HashSlot (const char *cleanname)
+{
+	unsigned	pos;
+
+	for (pos = W_HashName (cleanname) & (wad_hashsize - 1); wad_hash[pos]; pos = (pos + 1) & (wad_hashsize - 1))
+	{
+		if (!strncmp (wad_lumps[wad_hash[pos] - 1].name, cleanname, 16))
+			break;
+	}
+	return pos;
+}
+
 /*
 ====================
 W_LoadWadFile
@@ -71,13 +98,22 @@ void W_LoadWadFile (void) //johnfitz -- filename is now hard-coded for honesty
 	wadinfo_t		*header;
 	int			i;
 	int			infotableofs;
+	unsigned		pos;
 	const char		*filename = WADFILENAME;
 
 	//johnfitz -- modified to use malloc
 	//TODO: use cache_alloc
 	if (wad_base)
-		free (wad_base);
-	wad_base = COM_LoadMallocFile (filename, NULL);
+	{
+		if (wad_mapped)
+			COM_UnmapFile (wad_base);
+		else
+			free (wad_base);
+	}
+	wad_base = COM_MapFile (filename, NULL);
+	wad_mapped = (wad_base != NULL);
+	if (!wad_mapped)
+		wad_base = COM_LoadMallocFile (filename, NULL);
 	if (!wad_base)
 		Sys_Error ("W_LoadWadFile: couldn't load %s\n\n"
 			   "Basedir is: %s\n\n"
@@ -103,6 +139,19 @@ void W_LoadWadFile (void) //johnfitz -- filename is now hard-coded for honesty
 		if (lump_p->type == TYP_QPIC)
 			SwapPic ( (qpic_t *)(wad_base + lump_p->filepos));
 	}
+
+	free (wad_hash);
+	for (wad_hashsize = 64; wad_hashsize < wad_numlumps * 2; wad_hashsize *= 2)
+		;
+	wad_hash = (unsigned short *) calloc (wad_hashsize, sizeof(unsigned short));
+	if (!wad_hash || wad_numlumps > 65535)
+		Sys_Error ("W_LoadWadFile: couldn't index %i lumps", wad_numlumps);
+	for (i = 0; i < wad_numlumps; i++)
+	{
+		pos = W_HashSlot (wad_lumps[i].name);
+		if (!wad_hash[pos])	// the first lump of a name wins, as with the scan
+			wad_hash[pos] = i + 1;
+	}
 }
 
 
@@ -113,16 +162,16 @@ W_GetLumpinfo
 */
 lumpinfo_t	*W_GetLumpinfo (const char *name)
 {
-	int		i;
-	lumpinfo_t	*lump_p;
+	unsigned	pos;
 	char	clean[16];
 
 	W_CleanupName (name, clean);
 
-	for (lump_p=wad_lumps, i=0 ; i<wad_numlumps ; i++,lump_p++)
+	if (wad_hash)
 	{
-		if (!strcmp(clean, lump_p->name))
-			return lump_p;
+		pos = W_HashSlot (clean);
+		if (wad_hash[pos])
+			return &wad_lumps[wad_hash[pos] - 1];
 	}
 
 	Con_SafePrintf ("W_GetLumpinfo: %s not found\n", name); //johnfitz -- was Sys_Error
@@ -47,6 +47,10 @@ typedef struct
 
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p);
 
+static qboolean	sv_speculating;	// worker threads are running world traces
+static void SV_ClearCapturedTraces (void);
+static void SV_ClearTraceCache (void);
+
 /*
 ===============================================================================
 
@@ -59,6 +63,7 @@ HULL BOXES
 static	hull_t		box_hull;
 static	mclipnode_t	box_clipnodes[6]; //johnfitz -- was dclipnode_t
 static	mplane_t	box_planes[6];
+static	mhullnode_t	box_hullnodes[6];
 
 /*
 ===================
@@ -75,6 +80,7 @@ void SV_InitBoxHull (void)
 
 	box_hull.clipnodes = box_clipnodes;
 	box_hull.planes = box_planes;
+	box_hull.hullnodes = box_hullnodes;
 	box_hull.firstclipnode = 0;
 	box_hull.lastclipnode = 5;
 
@@ -92,6 +98,12 @@ void SV_InitBoxHull (void)
 
 		box_planes[i].type = i>>1;
 		box_planes[i].normal[i>>1] = 1;
+
+		box_hullnodes[i].planenum = i;
+		box_hullnodes[i].children[0] = box_clipnodes[i].children[0];
+		box_hullnodes[i].children[1] = box_clipnodes[i].children[1];
+		box_hullnodes[i].type = i>>1;
+		box_hullnodes[i].normal[i>>1] = 1;
 	}
 
 }
@@ -114,6 +126,13 @@ hull_t	*SV_HullForBox (vec3_t mins, vec3_t maxs)
 	box_planes[4].dist = maxs[2];
 	box_planes[5].dist = mins[2];
 
+	box_hullnodes[0].dist = maxs[0];
+	box_hullnodes[1].dist = mins[0];
+	box_hullnodes[2].dist = maxs[1];
+	box_hullnodes[3].dist = mins[1];
+	box_hullnodes[4].dist = maxs[2];
+	box_hullnodes[5].dist = mins[2];
+
 	return &box_hull;
 }
 
@@ -190,6 +209,7 @@ typedef struct areanode_s
 	struct areanode_s	*children[2];
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
+	link_t	notsolid_edicts;	// only gathered by SV_PushEdicts
 } areanode_t;
 
 #define	AREA_DEPTH	4
@@ -215,6 +235,7 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 
 	ClearLink (&anode->trigger_edicts);
 	ClearLink (&anode->solid_edicts);
+	ClearLink (&anode->notsolid_edicts);
 
 	if (depth == AREA_DEPTH)
 	{
@@ -243,6 +264,488 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 	return anode;
 }
 
+/*
+===============================================================================
+
+DYNAMIC AREA TREE
+
+With sv_areatree set, linked edicts are also kept in two bounding volume
+trees, one for solids and one for triggers, and SV_Move, SV_TouchLinks
+and SV_AreaEdicts query those instead of the area nodes.  The fixed area
+nodes keep every edict that straddles a split plane at that node, which
+on big maps piles dozens of them up near the root for every move to scan.
+
+Leaf boxes are padded by AREATREE_MARGIN so an edict only gets moved in
+the tree once it leaves its padded box.  The tree is kept balanced with
+AVL style rotations.  The area nodes stay linked either way, so the cvar
+can be flipped at any time.
+
+===============================================================================
+*/
+
+#define	AREATREE_NULL		-1
+#define	AREATREE_MARGIN		8
+#define	AREATREE_STACK		256
+
+typedef struct
+{
+	vec3_t		mins, maxs;	// padded for leaves
+	int		parent;		// next free node when on the free list
+	int		children[2];
+	int		height;		// 0 = leaf
+	edict_t		*ent;		// leaves only
+} areatreenode_t;
+
+typedef struct
+{
+	areatreenode_t	*nodes;
+	int		maxnodes;
+	int		root;
+	int		freelist;
+	int		numleaves;
+} areatree_t;
+
+cvar_t		sv_areatree = {"sv_areatree", "0", CVAR_NONE};
+
+static	areatree_t	sv_solidtree = {NULL, 0, AREATREE_NULL, AREATREE_NULL, 0};
+static	areatree_t	sv_triggertree = {NULL, 0, AREATREE_NULL, AREATREE_NULL, 0};
+static	qboolean	sv_areatreeactive;
+
+static struct
+{
+	int	moves;
+	int	candidates;	// linked edicts whose boxes got tested
+	int	clips;		// exact clips against them
+	int	nodes;		// area tree nodes visited
+	int	cachehits;	// sv_tracecache lookups
+	int	cachemisses;
+} sv_areastats;
+
+static void AreaTree_Clear (areatree_t *tree)
+{
+	free (tree->nodes);
+	tree->nodes = NULL;
+	tree->maxnodes = 0;
+	tree->root = AREATREE_NULL;
+	tree->freelist = AREATREE_NULL;
+	tree->numleaves = 0;
+}
+
+static int AreaTree_AllocNode (areatree_t *tree)
+{
+	areatreenode_t	*node;
+	int		i, n, newmax;
+
+	if (tree->freelist == AREATREE_NULL)
+	{
+		newmax = tree->maxnodes ? tree->maxnodes * 2 : 256;
+		node = (areatreenode_t *) realloc (tree->nodes, newmax * sizeof(areatreenode_t));
+		if (!node)
+			Sys_Error ("AreaTree_AllocNode: out of memory for %i nodes", newmax);
+		tree->nodes = node;
+		for (i = tree->maxnodes; i < newmax - 1; i++)
+			tree->nodes[i].parent = i + 1;
+		tree->nodes[newmax - 1].parent = AREATREE_NULL;
+		tree->freelist = tree->maxnodes;
+		tree->maxnodes = newmax;
+	}
+
+	n = tree->freelist;
+	node = &tree->nodes[n];
+	tree->freelist = node->parent;
+	node->parent = AREATREE_NULL;
+	node->children[0] = node->children[1] = AREATREE_NULL;
+	node->height = 0;
+	node->ent = NULL;
+	return n;
+}
+
+static void AreaTree_FreeNode (areatree_t *tree, int n)
+{
+	tree->nodes[n].parent = tree->freelist;
+	tree->nodes[n].height = -1;
+	tree->freelist = n;
+}
+
+static float AreaTree_Cost (const vec3_t mins, const vec3_t maxs)
+{
+	float	x = maxs[0] - mins[0];
+	float	y = maxs[1] - mins[1];
+	float	z = maxs[2] - mins[2];
+
+	return x*y + y*z + z*x;	// half the surface area
+}
+
+static void AreaTree_Union (const areatreenode_t *a, const areatreenode_t *b, vec3_t mins, vec3_t maxs)
+{
+	int	i;
+
+	for (i = 0; i < 3; i++)
+	{
+		mins[i] = q_min (a->mins[i], b->mins[i]);
+		maxs[i] = q_max (a->maxs[i], b->maxs[i]);
+	}
+}
+
+static qboolean AreaTree_Overlaps (const areatreenode_t *node, const vec3_t mins, const vec3_t maxs)
+{
+	return !(mins[0] > node->maxs[0] || mins[1] > node->maxs[1] || mins[2] > node->maxs[2]
+		|| maxs[0] < node->mins[0] || maxs[1] < node->mins[1] || maxs[2] < node->mins[2]);
+}
+
+// recomputes an inner node from its children
+static void AreaTree_FixNode (areatree_t *tree, int n)
+{
+	areatreenode_t	*node = &tree->nodes[n];
+	areatreenode_t	*c0 = &tree->nodes[node->children[0]];
+	areatreenode_t	*c1 = &tree->nodes[node->children[1]];
+
+	AreaTree_Union (c0, c1, node->mins, node->maxs);
+	node->height = 1 + q_max (c0->height, c1->height);
+}
+
+/*
+===============
+AreaTree_Rotate
+
+Lifts child side of a above it, returns the new subtree root
+===============
+*/
+static int AreaTree_Rotate (areatree_t *tree, int a, int side)
+{
+	areatreenode_t	*A = &tree->nodes[a];
+	int		c = A->children[side];
+	areatreenode_t	*C = &tree->nodes[c];
+	int		f = C->children[0];
+	int		g = C->children[1];
+	int		keep, give, p;
+
+	// the taller grandchild stays under c, the other one goes to a
+	if (tree->nodes[f].height > tree->nodes[g].height)
+		keep = f, give = g;
+	else
+		keep = g, give = f;
+
+	p = A->parent;
+	C->parent = p;
+	if (p == AREATREE_NULL)
+		tree->root = c;
+	else if (tree->nodes[p].children[0] == a)
+		tree->nodes[p].children[0] = c;
+	else
+		tree->nodes[p].children[1] = c;
+
+	C->children[0] = a;
+	C->children[1] = keep;
+	A->parent = c;
+	A->children[side] = give;
+	tree->nodes[give].parent = a;
+
+	AreaTree_FixNode (tree, a);
+	AreaTree_FixNode (tree, c);
+	return c;
+}
+
+// walks up from n fixing boxes and heights, rotating where unbalanced
+static void AreaTree_Refit (areatree_t *tree, int n)
+{
+	areatreenode_t	*node;
+	int		balance;
+
+	while (n != AREATREE_NULL)
+	{
+		AreaTree_FixNode (tree, n);
+		node = &tree->nodes[n];
+		balance = tree->nodes[node->children[1]].height - tree->nodes[node->children[0]].height;
+		if (balance > 1)
+			n = AreaTree_Rotate (tree, n, 1);
+		else if (balance < -1)
+			n = AreaTree_Rotate (tree, n, 0);
+		n = tree->nodes[n].parent;
+	}
+}
+
+static void AreaTree_InsertLeaf (areatree_t *tree, int leaf)
+{
+	areatreenode_t	*node, *l;
+	vec3_t		mins, maxs;
+	float		cost, inherit, childcost[2];
+	int		n, i, c, parent, oldparent;
+
+	if (tree->root == AREATREE_NULL)
+	{
+		tree->root = leaf;
+		tree->nodes[leaf].parent = AREATREE_NULL;
+		return;
+	}
+
+	parent = AreaTree_AllocNode (tree);	// may move the nodes
+	l = &tree->nodes[leaf];
+
+	// go down to the sibling that grows the tree the least
+	n = tree->root;
+	while (tree->nodes[n].height > 0)
+	{
+		node = &tree->nodes[n];
+		AreaTree_Union (node, l, mins, maxs);
+		cost = 2 * AreaTree_Cost (mins, maxs);
+		inherit = cost - 2 * AreaTree_Cost (node->mins, node->maxs);
+
+		for (i = 0; i < 2; i++)
+		{
+			c = node->children[i];
+			AreaTree_Union (&tree->nodes[c], l, mins, maxs);
+			childcost[i] = AreaTree_Cost (mins, maxs) + inherit;
+			if (tree->nodes[c].height > 0)
+				childcost[i] -= AreaTree_Cost (tree->nodes[c].mins, tree->nodes[c].maxs);
+		}
+
+		if (cost < childcost[0] && cost < childcost[1])
+			break;
+		n = (childcost[0] < childcost[1]) ? node->children[0] : node->children[1];
+	}
+
+	// give the sibling and the leaf a new common parent
+	oldparent = tree->nodes[n].parent;
+	node = &tree->nodes[parent];
+	node->parent = oldparent;
+	node->children[0] = n;
+	node->children[1] = leaf;
+	tree->nodes[n].parent = parent;
+	l->parent = parent;
+
+	if (oldparent == AREATREE_NULL)
+		tree->root = parent;
+	else if (tree->nodes[oldparent].children[0] == n)
+		tree->nodes[oldparent].children[0] = parent;
+	else
+		tree->nodes[oldparent].children[1] = parent;
+
+	AreaTree_Refit (tree, parent);
+}
+
+static void AreaTree_RemoveLeaf (areatree_t *tree, int leaf)
+{
+	int	parent, grandparent, sibling;
+
+	if (leaf == tree->root)
+	{
+		tree->root = AREATREE_NULL;
+		return;
+	}
+
+	parent = tree->nodes[leaf].parent;
+	grandparent = tree->nodes[parent].parent;
+	if (tree->nodes[parent].children[0] == leaf)
+		sibling = tree->nodes[parent].children[1];
+	else
+		sibling = tree->nodes[parent].children[0];
+
+	tree->nodes[sibling].parent = grandparent;
+	AreaTree_FreeNode (tree, parent);
+
+	if (grandparent == AREATREE_NULL)
+	{
+		tree->root = sibling;
+		return;
+	}
+
+	if (tree->nodes[grandparent].children[0] == parent)
+		tree->nodes[grandparent].children[0] = sibling;
+	else
+		tree->nodes[grandparent].children[1] = sibling;
+	AreaTree_Refit (tree, grandparent);
+}
+
+/*
+===============
+AreaTree_Edicts
+
+Adds the edicts whose padded leaf boxes touch mins/maxs to list.  They
+may still miss the box, callers do the exact test.
+===============
+*/
+static void AreaTree_Edicts (areatree_t *tree, const vec3_t mins, const vec3_t maxs, edict_t **list, int *listcount, const int listspace)
+{
+	int		stack[AREATREE_STACK];
+	int		sp;
+	areatreenode_t	*node;
+
+	if (tree->root == AREATREE_NULL)
+		return;
+
+	stack[0] = tree->root;
+	sp = 1;
+	while (sp)
+	{
+		node = &tree->nodes[stack[--sp]];
+		sv_areastats.nodes++;
+		if (!AreaTree_Overlaps (node, mins, maxs))
+			continue;
+		if (!node->height)
+		{
+			if (*listcount == listspace)
+				return; // should never happen
+			list[(*listcount)++] = node->ent;
+			continue;
+		}
+		if (sp > AREATREE_STACK - 2)
+			Sys_Error ("AreaTree_Edicts: tree too deep");
+		stack[sp++] = node->children[1];
+		stack[sp++] = node->children[0];
+	}
+}
+
+/*
+===============
+SV_RemoveAreaProxy
+
+Takes ent out of the area trees
+===============
+*/
+static void SV_RemoveAreaProxy (edict_t *ent)
+{
+	areatree_t	*tree;
+	int		leaf;
+
+	if (!ent->areaproxy)
+		return;
+
+	tree = ent->areatrigger ? &sv_triggertree : &sv_solidtree;
+	leaf = ent->areaproxy - 1;
+	AreaTree_RemoveLeaf (tree, leaf);
+	AreaTree_FreeNode (tree, leaf);
+	tree->numleaves--;
+	ent->areaproxy = 0;
+}
+
+/*
+===============
+SV_UpdateAreaProxy
+
+Puts a linked ent into the right area tree, or moves it there if its box
+has outgrown the padded one
+===============
+*/
+static void SV_UpdateAreaProxy (edict_t *ent)
+{
+	areatree_t	*tree;
+	areatreenode_t	*node;
+	qboolean	trigger;
+	int		i, leaf;
+
+	if (!sv_areatreeactive)
+		return;
+
+	trigger = (ent->v.solid == SOLID_TRIGGER);
+	if (ent->areaproxy && ent->areatrigger == trigger)
+	{
+		node = &(trigger ? &sv_triggertree : &sv_solidtree)->nodes[ent->areaproxy - 1];
+		for (i = 0; i < 3; i++)
+		{
+			if (ent->v.absmin[i] < node->mins[i] || ent->v.absmax[i] > node->maxs[i])
+				break;
+		}
+		if (i == 3)
+			return;	// still inside
+	}
+
+	SV_RemoveAreaProxy (ent);
+
+	tree = trigger ? &sv_triggertree : &sv_solidtree;
+	leaf = AreaTree_AllocNode (tree);
+	node = &tree->nodes[leaf];
+	node->ent = ent;
+	for (i = 0; i < 3; i++)
+	{
+		node->mins[i] = ent->v.absmin[i] - AREATREE_MARGIN;
+		node->maxs[i] = ent->v.absmax[i] + AREATREE_MARGIN;
+	}
+	AreaTree_InsertLeaf (tree, leaf);
+	tree->numleaves++;
+
+	ent->areaproxy = leaf + 1;
+	ent->areatrigger = trigger;
+}
+
+/*
+===============
+SV_BuildAreaTrees
+
+(Re)starts the area trees from the current sv_areatree value
+===============
+*/
+static void SV_BuildAreaTrees (void)
+{
+	edict_t	*ent;
+	int	i;
+
+	for (i = 0; sv.edicts && i < sv.num_edicts; i++)
+		EDICT_NUM(i)->areaproxy = 0;
+	AreaTree_Clear (&sv_solidtree);
+	AreaTree_Clear (&sv_triggertree);
+
+	sv_areatreeactive = (sv_areatree.value != 0);
+	if (!sv_areatreeactive || !sv.active)
+		return;
+
+	for (i = 1; i < sv.num_edicts; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (!ent->free && ent->area.prev && ent->v.solid != SOLID_NOT)
+			SV_UpdateAreaProxy (ent);
+	}
+}
+
+void SV_AreaTree_f (cvar_t *var)
+{
+	SV_BuildAreaTrees ();
+}
+
+/*
+===============
+SV_AreaStats_f
+
+Average work per SV_Move since the last call
+===============
+*/
+void SV_AreaStats_f (void)
+{
+	link_t	*l;
+	int	i, rootedicts, moves;
+
+	moves = q_max (sv_areastats.moves, 1);
+	Con_Printf ("%i moves using the %s, per move: %.1f candidates, %.1f clips",
+		sv_areastats.moves, sv_areatreeactive ? "area tree" : "area nodes",
+		(float)sv_areastats.candidates / moves, (float)sv_areastats.clips / moves);
+	if (sv_areatreeactive)
+		Con_Printf (", %.1f tree nodes", (float)sv_areastats.nodes / moves);
+	Con_Printf ("\n");
+
+	if (sv.active)
+	{
+		rootedicts = 0;
+		for (i = 0; i < 2; i++)
+		{
+			link_t *start = i ? &sv_areanodes[0].trigger_edicts : &sv_areanodes[0].solid_edicts;
+			for (l = start->next; l != start; l = l->next)
+				rootedicts++;
+		}
+		Con_Printf ("%i edicts on the root area node\n", rootedicts);
+		if (sv_areatreeactive)
+			Con_Printf ("area tree: %i solid, height %i; %i trigger, height %i\n",
+				sv_solidtree.numleaves, sv_solidtree.root == AREATREE_NULL ? 0 : sv_solidtree.nodes[sv_solidtree.root].height,
+				sv_triggertree.numleaves, sv_triggertree.root == AREATREE_NULL ? 0 : sv_triggertree.nodes[sv_triggertree.root].height);
+	}
+
+	if (sv_areastats.cachehits + sv_areastats.cachemisses)
+		Con_Printf ("trace cache: %i hits, %i misses, %.0f%% hit\n",
+			sv_areastats.cachehits, sv_areastats.cachemisses,
+			100.0 * sv_areastats.cachehits / (sv_areastats.cachehits + sv_areastats.cachemisses));
+
+	memset (&sv_areastats, 0, sizeof(sv_areastats));
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -256,6 +759,13 @@ void SV_ClearWorld (void)
 	memset (sv_areanodes, 0, sizeof(sv_areanodes));
 	sv_numareanodes = 0;
 	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+
+	AreaTree_Clear (&sv_solidtree);
+	AreaTree_Clear (&sv_triggertree);
+	sv_areatreeactive = (sv_areatree.value != 0);
+
+	SV_ClearCapturedTraces ();	// the hulls are going away
+	SV_ClearTraceCache ();
 }
 
 
@@ -267,6 +777,7 @@ SV_UnlinkEdict
 */
 void SV_UnlinkEdict (edict_t *ent)
 {
+	SV_RemoveAreaProxy (ent);
 	if (!ent->area.prev)
 		return;		// not linked in anywhere
 	RemoveLink (&ent->area);
@@ -322,6 +833,141 @@ SV_AreaTriggerEdicts ( edict_t *ent, areanode_t *node, edict_t **list, int *list
 		SV_AreaTriggerEdicts ( ent, node->children[1], list, listcount, listspace );
 }
 
+/*
+====================
+SV_AreaEdicts
+
+Fills list with the solid and trigger edicts whose linked boxes touch
+mins/maxs, returns how many were found.
+====================
+*/
+static void SV_AreaEdicts_r (areanode_t *node, const vec3_t mins, const vec3_t maxs, edict_t **list, int *listcount, const int listspace)
+{
+	link_t		*l, *start;
+	edict_t		*check;
+	int		i;
+
+	for (i = 0; i < 2; i++)
+	{
+		start = i ? &node->trigger_edicts : &node->solid_edicts;
+		for (l = start->next ; l != start ; l = l->next)
+		{
+			check = EDICT_FROM_AREA(l);
+			if (mins[0] > check->v.absmax[0]
+			|| mins[1] > check->v.absmax[1]
+			|| mins[2] > check->v.absmax[2]
+			|| maxs[0] < check->v.absmin[0]
+			|| maxs[1] < check->v.absmin[1]
+			|| maxs[2] < check->v.absmin[2] )
+				continue;
+
+			if (*listcount == listspace)
+				return; // should never happen
+
+			list[*listcount] = check;
+			(*listcount)++;
+		}
+	}
+
+// recurse down both sides
+	if (node->axis == -1)
+		return;
+
+	if ( maxs[node->axis] > node->dist )
+		SV_AreaEdicts_r (node->children[0], mins, maxs, list, listcount, listspace);
+	if ( mins[node->axis] < node->dist )
+		SV_AreaEdicts_r (node->children[1], mins, maxs, list, listcount, listspace);
+}
+
+int SV_AreaEdicts (const vec3_t mins, const vec3_t maxs, edict_t **list, int listspace)
+{
+	edict_t	*check;
+	int	i, count, listcount = 0;
+
+	if (!sv_areatreeactive)
+	{
+		SV_AreaEdicts_r (sv_areanodes, mins, maxs, list, &listcount, listspace);
+		return listcount;
+	}
+
+	AreaTree_Edicts (&sv_solidtree, mins, maxs, list, &listcount, listspace);
+	AreaTree_Edicts (&sv_triggertree, mins, maxs, list, &listcount, listspace);
+
+	// the leaf boxes are padded
+	for (i = count = 0; i < listcount; i++)
+	{
+		check = list[i];
+		if (mins[0] > check->v.absmax[0]
+		|| mins[1] > check->v.absmax[1]
+		|| mins[2] > check->v.absmax[2]
+		|| maxs[0] < check->v.absmin[0]
+		|| maxs[1] < check->v.absmin[1]
+		|| maxs[2] < check->v.absmin[2] )
+			continue;
+		list[count++] = check;
+	}
+	return count;
+}
+
+/*
+====================
+SV_PushEdicts
+
+Like SV_AreaEdicts, but also gathers the SOLID_NOT edicts that a pusher
+carries along, sorted by edict number so they get pushed in the same
+order as a scan over all edicts would.
+====================
+*/
+static void SV_NotSolidEdicts_r (areanode_t *node, const vec3_t mins, const vec3_t maxs, edict_t **list, int *listcount, const int listspace)
+{
+	link_t		*l;
+	edict_t		*check;
+
+	for (l = node->notsolid_edicts.next ; l != &node->notsolid_edicts ; l = l->next)
+	{
+		check = EDICT_FROM_AREA(l);
+		if (mins[0] > check->v.absmax[0]
+		|| mins[1] > check->v.absmax[1]
+		|| mins[2] > check->v.absmax[2]
+		|| maxs[0] < check->v.absmin[0]
+		|| maxs[1] < check->v.absmin[1]
+		|| maxs[2] < check->v.absmin[2] )
+			continue;
+
+		if (*listcount == listspace)
+			return;
+
+		list[*listcount] = check;
+		(*listcount)++;
+	}
+
+	if (node->axis == -1)
+		return;
+
+	if ( maxs[node->axis] > node->dist )
+		SV_NotSolidEdicts_r (node->children[0], mins, maxs, list, listcount, listspace);
+	if ( mins[node->axis] < node->dist )
+		SV_NotSolidEdicts_r (node->children[1], mins, maxs, list, listcount, listspace);
+}
+
+static int SV_EdictNumCompare (const void *a, const void *b)
+{
+	const edict_t	*ea = *(edict_t * const *) a;
+	const edict_t	*eb = *(edict_t * const *) b;
+
+	return (ea > eb) - (ea < eb);
+}
+
+int SV_PushEdicts (const vec3_t mins, const vec3_t maxs, edict_t **list, int listspace)
+{
+	int	listcount;
+
+	listcount = SV_AreaEdicts (mins, maxs, list, listspace);
+	SV_NotSolidEdicts_r (sv_areanodes, mins, maxs, list, &listcount, listspace);
+	qsort (list, listcount, sizeof(*list), SV_EdictNumCompare);
+	return listcount;
+}
+
 /*
 ====================
 SV_TouchLinks
@@ -340,11 +986,14 @@ void SV_TouchLinks (edict_t *ent)
 	int		i, listcount;
 	int		mark;
 	
-	mark = Hunk_LowMark ();
-	list = (edict_t **) Hunk_Alloc (sv.num_edicts*sizeof(edict_t *));
+	mark = Frame_LowMark ();
+	list = (edict_t **) Frame_Alloc (sv.num_edicts*sizeof(edict_t *));
 	
 	listcount = 0;
-	SV_AreaTriggerEdicts (ent, sv_areanodes, list, &listcount, sv.num_edicts);
+	if (sv_areatreeactive)	// checked properly below
+		AreaTree_Edicts (&sv_triggertree, ent->v.absmin, ent->v.absmax, list, &listcount, sv.num_edicts);
+	else
+		SV_AreaTriggerEdicts (ent, sv_areanodes, list, &listcount, sv.num_edicts);
 
 	for (i = 0; i < listcount; i++)
 	{
@@ -375,7 +1024,7 @@ void SV_TouchLinks (edict_t *ent)
 	}
 
 // free hunk-allocated edicts array
-	Hunk_FreeToLowMark (mark);
+	Frame_FreeToLowMark (mark);
 }
 
 
@@ -390,7 +1039,8 @@ void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
 	mplane_t	*splitplane;
 	mleaf_t		*leaf;
 	int			sides;
-	int			leafnum;
+	int			leafnum, word, i;
+	byte		*bits;
 
 	if (node->contents == CONTENTS_SOLID)
 		return;
@@ -405,8 +1055,22 @@ void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
 		leaf = (mleaf_t *)node;
 		leafnum = leaf - sv.worldmodel->leafs - 1;
 
-		ent->leafnums[ent->num_leafs] = leafnum;
 		ent->num_leafs++;
+
+	// merge it into the word of the PVS it's in, the mask is built a
+	// byte at a time so it matches the PVS bytes read as a word
+		word = leafnum >> 5;
+		for (i = 0; i < ent->num_leafwords; i++)
+			if (ent->leafwords[i] == word)
+				break;
+		if (i == ent->num_leafwords)
+		{
+			ent->leafwords[i] = word;
+			ent->leafbits[i] = 0;
+			ent->num_leafwords++;
+		}
+		bits = (byte *)&ent->leafbits[i];
+		bits[(leafnum >> 3) & 3] |= 1 << (leafnum & 7);
 		return;
 	}
 
@@ -434,13 +1098,19 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 	areanode_t	*node;
 
 	if (ent->area.prev)
-		SV_UnlinkEdict (ent);	// unlink from old position
+	{	// unlink from old position, the area tree leaf gets moved below
+		RemoveLink (&ent->area);
+		ent->area.prev = ent->area.next = NULL;
+	}
 
 	if (ent == sv.edicts)
 		return;		// don't add the world
 
 	if (ent->free)
+	{
+		SV_RemoveAreaProxy (ent);
 		return;
+	}
 
 // set the abs box
 	VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
@@ -470,11 +1140,12 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 
 // link to PVS leafs
 	ent->num_leafs = 0;
+	ent->num_leafwords = 0;
 	if (ent->v.modelindex)
 		SV_FindTouchedLeafs (ent, sv.worldmodel->nodes);
 
 	if (ent->v.solid == SOLID_NOT)
-		return;
+		SV_RemoveAreaProxy (ent);
 
 // find the first node that the ent's box crosses
 	node = sv_areanodes;
@@ -492,11 +1163,19 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 
 // link it in
 
-	if (ent->v.solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
+	if (ent->v.solid == SOLID_NOT)
+	{	// nothing clips against these, they are only kept for pushers
+		InsertLinkBefore (&ent->area, &node->notsolid_edicts);
+		return;
+	}
+
+	if (ent->v.solid == SOLID_TRIGGER)
+		InsertLinkBefore (&ent->area, &node->trigger_edicts);
+	else
 		InsertLinkBefore (&ent->area, &node->solid_edicts);
 
+	SV_UpdateAreaProxy (ent);
+
 // if touch_triggers, touch all entities at this node and decend for more
 	if (touch_triggers)
 		SV_TouchLinks ( ent );
@@ -521,21 +1200,19 @@ SV_HullPointContents
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p)
 {
 	float		d;
-	mclipnode_t	*node; //johnfitz -- was dclipnode_t
-	mplane_t	*plane;
+	mhullnode_t	*node;
 
 	while (num >= 0)
 	{
 		if (num < hull->firstclipnode || num > hull->lastclipnode)
 			Sys_Error ("SV_HullPointContents: bad node number");
 
-		node = hull->clipnodes + num;
-		plane = hull->planes + node->planenum;
+		node = hull->hullnodes + num;
 
-		if (plane->type < 3)
-			d = p[plane->type] - plane->dist;
+		if (node->type < 3)
+			d = p[node->type] - node->dist;
 		else
-			d = DoublePrecisionDotProduct (plane->normal, p) - plane->dist;
+			d = DoublePrecisionDotProduct (node->normal, p) - node->dist;
 		if (d < 0)
 			num = node->children[1];
 		else
@@ -552,21 +1229,27 @@ SV_PointContents
 
 ==================
 */
+int SV_TruePointContents (vec3_t p)
+{
+	mnode_t	*node;
+
+	// hull 0 is made from the nodes, so the node numbers match
+	node = Mod_PointGridNode (p, sv.worldmodel);
+	if (node->contents < 0)
+		return node->contents;
+	return SV_HullPointContents (&sv.worldmodel->hulls[0], node - sv.worldmodel->nodes, p);
+}
+
 int SV_PointContents (vec3_t p)
 {
 	int		cont;
 
-	cont = SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
+	cont = SV_TruePointContents (p);
 	if (cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN)
 		cont = CONTENTS_WATER;
 	return cont;
 }
 
-int SV_TruePointContents (vec3_t p)
-{
-	return SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
-}
-
 //===========================================================================
 
 /*
@@ -599,11 +1282,14 @@ LINE TESTING IN HULLS
 
 /*
 ==================
-SV_RecursiveHullCheck
+SV_RecursiveHullCheck_r
 
+The original recursive version, SV_RecursiveHullCheck falls back on it
+for hulls too deep for its stack and sv_tracebench compares against it.
+It still walks the clipnodes and planes rather than the hull nodes.
 ==================
 */
-qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
+static qboolean SV_RecursiveHullCheck_r (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
 {
 	mclipnode_t	*node; //johnfitz -- was dclipnode_t
 	mplane_t	*plane;
@@ -631,7 +1317,7 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	}
 
 	if (num < hull->firstclipnode || num > hull->lastclipnode)
-		Sys_Error ("SV_RecursiveHullCheck: bad node number");
+		Sys_Error ("SV_RecursiveHullCheck_r: bad node number");
 
 //
 // find the point distances
@@ -652,14 +1338,14 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 
 #if 1
 	if (t1 >= 0 && t2 >= 0)
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
+		return SV_RecursiveHullCheck_r (hull, node->children[0], p1f, p2f, p1, p2, trace);
 	if (t1 < 0 && t2 < 0)
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
+		return SV_RecursiveHullCheck_r (hull, node->children[1], p1f, p2f, p1, p2, trace);
 #else
 	if ( (t1 >= DIST_EPSILON && t2 >= DIST_EPSILON) || (t2 > t1 && t1 >= 0) )
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
+		return SV_RecursiveHullCheck_r (hull, node->children[0], p1f, p2f, p1, p2, trace);
 	if ( (t1 <= -DIST_EPSILON && t2 <= -DIST_EPSILON) || (t2 < t1 && t1 <= 0) )
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
+		return SV_RecursiveHullCheck_r (hull, node->children[1], p1f, p2f, p1, p2, trace);
 #endif
 
 // put the crosspoint DIST_EPSILON pixels on the near side
@@ -679,7 +1365,7 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	side = (t1 < 0);
 
 // move up to the node
-	if (!SV_RecursiveHullCheck (hull, node->children[side], p1f, midf, p1, mid, trace) )
+	if (!SV_RecursiveHullCheck_r (hull, node->children[side], p1f, midf, p1, mid, trace) )
 		return false;
 
 #ifdef PARANOID
@@ -694,7 +1380,7 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	if (SV_HullPointContents (hull, node->children[side^1], mid)
 	!= CONTENTS_SOLID)
 // go past the node
-		return SV_RecursiveHullCheck (hull, node->children[side^1], midf, p2f, mid, p2, trace);
+		return SV_RecursiveHullCheck_r (hull, node->children[side^1], midf, p2f, mid, p2, trace);
 
 	if (trace->allsolid)
 		return false;		// never got out of the solid area
@@ -721,7 +1407,8 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 		{
 			trace->fraction = midf;
 			VectorCopy (mid, trace->endpos);
-			Con_DPrintf ("backup past 0\n");
+			if (!sv_speculating)	// no console from the workers
+				Con_DPrintf ("backup past 0\n");
 			return false;
 		}
 		midf = p1f + (p2f - p1f)*frac;
@@ -736,6 +1423,329 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 }
 
 
+/*
+==================
+SV_RecursiveHullCheck
+
+Walks the hull without recursing: going down, the far half of each
+crossed node is stacked, and once a leaf is reached the last one is
+taken off and continued past the node, the same order the recursive
+version visits them in.  Returns false once the trace is stopped.
+==================
+*/
+#define	MAX_HULLSTACK	256
+
+typedef struct
+{
+	int		num;		// crossed node
+	int		side;		// side of it the segment starts on
+	float		p1f, p2f, midf, frac;
+	vec3_t		p1, p2, mid;
+} hullcross_t;
+
+qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
+{
+	hullcross_t	stack[MAX_HULLSTACK];
+	hullcross_t	*cross;
+	int		depth;
+	mhullnode_t	*node;
+	float		t1, t2;
+	float		frac, midf;
+	vec3_t		start, end, mid;
+	int		i, side;
+
+	VectorCopy (p1, start);
+	VectorCopy (p2, end);
+	depth = 0;
+
+	for (;;)
+	{
+	// go down to a leaf
+		while (num >= 0)
+		{
+			if (num < hull->firstclipnode || num > hull->lastclipnode)
+				Sys_Error ("SV_RecursiveHullCheck: bad node number");
+
+			node = hull->hullnodes + num;
+
+			if (node->type < 3)
+			{
+				t1 = start[node->type] - node->dist;
+				t2 = end[node->type] - node->dist;
+			}
+			else
+			{
+				t1 = DoublePrecisionDotProduct (node->normal, start) - node->dist;
+				t2 = DoublePrecisionDotProduct (node->normal, end) - node->dist;
+			}
+
+			if (t1 >= 0 && t2 >= 0)
+			{
+				num = node->children[0];
+				continue;
+			}
+			if (t1 < 0 && t2 < 0)
+			{
+				num = node->children[1];
+				continue;
+			}
+
+			if (depth == MAX_HULLSTACK)
+			{ // rare, finish this subtree the recursive way
+				if (!SV_RecursiveHullCheck_r (hull, num, p1f, p2f, start, end, trace))
+					return false;
+				break;
+			}
+
+		// put the crosspoint DIST_EPSILON pixels on the near side
+			if (t1 < 0)
+				frac = (t1 + DIST_EPSILON)/(t1-t2);
+			else
+				frac = (t1 - DIST_EPSILON)/(t1-t2);
+			if (frac < 0)
+				frac = 0;
+			if (frac > 1)
+				frac = 1;
+
+			cross = &stack[depth++];
+			cross->num = num;
+			cross->side = side = (t1 < 0);
+			cross->p1f = p1f;
+			cross->p2f = p2f;
+			cross->frac = frac;
+			cross->midf = p1f + (p2f - p1f)*frac;
+			for (i=0 ; i<3 ; i++)
+				cross->mid[i] = start[i] + frac*(end[i] - start[i]);
+			VectorCopy (start, cross->p1);
+			VectorCopy (end, cross->p2);
+
+		// move up to the node
+			num = node->children[side];
+			p2f = cross->midf;
+			VectorCopy (cross->mid, end);
+		}
+
+	// check for empty
+		if (num < 0)
+		{
+			if (num != CONTENTS_SOLID)
+			{
+				trace->allsolid = false;
+				if (num == CONTENTS_EMPTY)
+					trace->inopen = true;
+				else
+					trace->inwater = true;
+			}
+			else
+				trace->startsolid = true;
+		}
+
+	// the near side of the last crossed node is done
+		if (!depth)
+			return true;
+		cross = &stack[--depth];
+		node = hull->hullnodes + cross->num;
+
+		if (SV_HullPointContents (hull, node->children[cross->side^1], cross->mid)
+		!= CONTENTS_SOLID)
+		{ // go past the node
+			num = node->children[cross->side^1];
+			p1f = cross->midf;
+			p2f = cross->p2f;
+			VectorCopy (cross->mid, start);
+			VectorCopy (cross->p2, end);
+			continue;
+		}
+
+		if (trace->allsolid)
+			return false;		// never got out of the solid area
+
+	//==================
+	// the other side of the node is solid, this is the impact point
+	//==================
+		if (!cross->side)
+		{
+			VectorCopy (node->normal, trace->plane.normal);
+			trace->plane.dist = node->dist;
+		}
+		else
+		{
+			VectorSubtract (vec3_origin, node->normal, trace->plane.normal);
+			trace->plane.dist = -node->dist;
+		}
+
+		frac = cross->frac;
+		midf = cross->midf;
+		VectorCopy (cross->mid, mid);
+		while (SV_HullPointContents (hull, hull->firstclipnode, mid)
+		== CONTENTS_SOLID)
+		{ // shouldn't really happen, but does occasionally
+			frac -= 0.1;
+			if (frac < 0)
+			{
+				trace->fraction = midf;
+				VectorCopy (mid, trace->endpos);
+				if (!sv_speculating)	// no console from the workers
+					Con_DPrintf ("backup past 0\n");
+				return false;
+			}
+			midf = cross->p1f + (cross->p2f - cross->p1f)*frac;
+			for (i=0 ; i<3 ; i++)
+				mid[i] = cross->p1[i] + frac*(cross->p2[i] - cross->p1[i]);
+		}
+
+		trace->fraction = midf;
+		VectorCopy (mid, trace->endpos);
+
+		return false;
+	}
+}
+
+/*
+===============================================================================
+
+HULL TRACE BENCHMARK
+
+sv_tracecapture records the next hull traces SV_ClipMoveToEntity runs
+against bsp models, sv_tracebench replays them through both the
+iterative and the recursive hull check, timing and comparing them.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	hull_t		*hull;
+	vec3_t		start, end;
+} capturedtrace_t;
+
+#define	MAX_CAPTUREDTRACES	(1<<20)
+
+static	capturedtrace_t	*sv_capturedtraces;
+static	int		sv_numcapturedtraces, sv_maxcapturedtraces;
+
+static void SV_CaptureTrace (hull_t *hull, const vec3_t start, const vec3_t end)
+{
+	capturedtrace_t	*ct;
+
+	if (sv_speculating)
+		return;		// main thread only
+
+	ct = &sv_capturedtraces[sv_numcapturedtraces++];
+	ct->hull = hull;
+	VectorCopy (start, ct->start);
+	VectorCopy (end, ct->end);
+
+	if (sv_numcapturedtraces == sv_maxcapturedtraces)
+		Con_Printf ("sv_tracecapture: captured %i traces\n", sv_numcapturedtraces);
+}
+
+static void SV_ClearCapturedTraces (void)
+{
+	free (sv_capturedtraces);
+	sv_capturedtraces = NULL;
+	sv_numcapturedtraces = sv_maxcapturedtraces = 0;
+}
+
+/*
+==================
+SV_TraceCapture_f
+==================
+*/
+void SV_TraceCapture_f (void)
+{
+	int	count;
+
+	if (Cmd_Argc () < 2)
+	{
+		Con_Printf ("usage: sv_tracecapture <count>\n");
+		Con_Printf ("%i of %i traces captured\n", sv_numcapturedtraces, sv_maxcapturedtraces);
+		return;
+	}
+	if (!sv.active)
+	{
+		Con_Printf ("sv_tracecapture: no server running\n");
+		return;
+	}
+
+	SV_ClearCapturedTraces ();
+	count = CLAMP (1, Q_atoi (Cmd_Argv (1)), MAX_CAPTUREDTRACES);
+	sv_capturedtraces = (capturedtrace_t *) malloc (count * sizeof(capturedtrace_t));
+	if (!sv_capturedtraces)
+	{
+		Con_Printf ("sv_tracecapture: couldn't allocate %i traces\n", count);
+		return;
+	}
+	sv_maxcapturedtraces = count;
+}
+
+/*
+==================
+SV_TraceBench_f
+==================
+*/
+void SV_TraceBench_f (void)
+{
+	capturedtrace_t	*ct;
+	trace_t		a, b;
+	double		start, iterative, recursive;
+	int		i, j, repeat, mismatches;
+
+	if (!sv_numcapturedtraces)
+	{
+		Con_Printf ("sv_tracebench: no traces, use sv_tracecapture first\n");
+		return;
+	}
+	if (sv_numcapturedtraces < sv_maxcapturedtraces)
+		Con_Printf ("sv_tracecapture still running, %i traces so far\n", sv_numcapturedtraces);
+
+	repeat = (Cmd_Argc () > 1) ? q_max (Q_atoi (Cmd_Argv (1)), 1) : 10;
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < repeat; j++)
+	{
+		for (i = 0, ct = sv_capturedtraces; i < sv_numcapturedtraces; i++, ct++)
+		{
+			memset (&a, 0, sizeof(a));
+			a.fraction = 1;
+			a.allsolid = true;
+			SV_RecursiveHullCheck (ct->hull, ct->hull->firstclipnode, 0, 1, ct->start, ct->end, &a);
+		}
+	}
+	iterative = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < repeat; j++)
+	{
+		for (i = 0, ct = sv_capturedtraces; i < sv_numcapturedtraces; i++, ct++)
+		{
+			memset (&b, 0, sizeof(b));
+			b.fraction = 1;
+			b.allsolid = true;
+			SV_RecursiveHullCheck_r (ct->hull, ct->hull->firstclipnode, 0, 1, ct->start, ct->end, &b);
+		}
+	}
+	recursive = Sys_DoubleTime () - start;
+
+	mismatches = 0;
+	for (i = 0, ct = sv_capturedtraces; i < sv_numcapturedtraces; i++, ct++)
+	{
+		memset (&a, 0, sizeof(a));
+		a.fraction = 1;
+		a.allsolid = true;
+		b = a;
+		SV_RecursiveHullCheck (ct->hull, ct->hull->firstclipnode, 0, 1, ct->start, ct->end, &a);
+		SV_RecursiveHullCheck_r (ct->hull, ct->hull->firstclipnode, 0, 1, ct->start, ct->end, &b);
+		if (memcmp (&a, &b, sizeof(a)))
+			mismatches++;
+	}
+
+	Con_Printf ("%i traces x %i: iterative %.0f ns/trace, recursive %.0f ns/trace, %i mismatches\n",
+		sv_numcapturedtraces, repeat,
+		iterative * 1e9 / ((double)sv_numcapturedtraces * repeat),
+		recursive * 1e9 / ((double)sv_numcapturedtraces * repeat), mismatches);
+}
+
 /*
 ==================
 SV_ClipMoveToEntity
@@ -763,6 +1773,9 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	VectorSubtract (start, offset, start_l);
 	VectorSubtract (end, offset, end_l);
 
+	if (sv_numcapturedtraces < sv_maxcapturedtraces && hull != &box_hull)
+		SV_CaptureTrace (hull, start_l, end_l);
+
 // trace a line through the apropriate clipping hull
 	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
 
@@ -779,6 +1792,74 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 
 //===========================================================================
 
+/*
+====================
+SV_ClipToEdict
+
+Clips the move against one linked solid edict, returns false once the
+move is stuck in something and nothing else needs to be looked at
+====================
+*/
+static qboolean SV_ClipToEdict (edict_t *touch, moveclip_t *clip)
+{
+	trace_t		trace;
+
+	sv_areastats.candidates++;
+	if (touch->v.solid == SOLID_NOT)
+		return true;
+	if (touch == clip->passedict)
+		return true;
+	if (touch->v.solid == SOLID_TRIGGER)
+		Sys_Error ("Trigger in clipping list");
+
+	if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+		return true;
+
+	if (clip->boxmins[0] > touch->v.absmax[0]
+	|| clip->boxmins[1] > touch->v.absmax[1]
+	|| clip->boxmins[2] > touch->v.absmax[2]
+	|| clip->boxmaxs[0] < touch->v.absmin[0]
+	|| clip->boxmaxs[1] < touch->v.absmin[1]
+	|| clip->boxmaxs[2] < touch->v.absmin[2] )
+		return true;
+
+	if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
+		return true;	// points never interact
+
+// might intersect, so do an exact clip
+	if (clip->trace.allsolid)
+		return false;
+	if (clip->passedict)
+	{
+	 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+			return true;	// don't clip against own missiles
+		if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+			return true;	// don't clip against owner
+	}
+
+	sv_areastats.clips++;
+	if ((int)touch->v.flags & FL_MONSTER)
+		trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
+	else
+		trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
+	if (trace.allsolid || trace.startsolid ||
+	trace.fraction < clip->trace.fraction)
+	{
+		trace.ent = touch;
+	 	if (clip->trace.startsolid)
+		{
+			clip->trace = trace;
+			clip->trace.startsolid = true;
+		}
+		else
+			clip->trace = trace;
+	}
+	else if (trace.startsolid)
+		clip->trace.startsolid = true;
+
+	return true;
+}
+
 /*
 ====================
 SV_ClipToLinks
@@ -789,64 +1870,13 @@ Mins and maxs enclose the entire area swept by the move
 void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 {
 	link_t		*l, *next;
-	edict_t		*touch;
-	trace_t		trace;
 
 // touch linked edicts
 	for (l = node->solid_edicts.next ; l != &node->solid_edicts ; l = next)
 	{
 		next = l->next;
-		touch = EDICT_FROM_AREA(l);
-		if (touch->v.solid == SOLID_NOT)
-			continue;
-		if (touch == clip->passedict)
-			continue;
-		if (touch->v.solid == SOLID_TRIGGER)
-			Sys_Error ("Trigger in clipping list");
-
-		if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
-			continue;
-
-		if (clip->boxmins[0] > touch->v.absmax[0]
-		|| clip->boxmins[1] > touch->v.absmax[1]
-		|| clip->boxmins[2] > touch->v.absmax[2]
-		|| clip->boxmaxs[0] < touch->v.absmin[0]
-		|| clip->boxmaxs[1] < touch->v.absmin[1]
-		|| clip->boxmaxs[2] < touch->v.absmin[2] )
-			continue;
-
-		if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
-			continue;	// points never interact
-
-	// might intersect, so do an exact clip
-		if (clip->trace.allsolid)
+		if (!SV_ClipToEdict (EDICT_FROM_AREA(l), clip))
 			return;
-		if (clip->passedict)
-		{
-		 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
-				continue;	// don't clip against own missiles
-			if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
-				continue;	// don't clip against owner
-		}
-
-		if ((int)touch->v.flags & FL_MONSTER)
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
-		else
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
-		if (trace.allsolid || trace.startsolid ||
-		trace.fraction < clip->trace.fraction)
-		{
-			trace.ent = touch;
-		 	if (clip->trace.startsolid)
-			{
-				clip->trace = trace;
-				clip->trace.startsolid = true;
-			}
-			else
-				clip->trace = trace;
-		}
-		else if (trace.startsolid)
-			clip->trace.startsolid = true;
 	}
 
 // recurse down both sides
@@ -859,6 +1889,43 @@ void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 		SV_ClipToLinks ( node->children[1], clip );
 }
 
+/*
+====================
+SV_ClipToAreaTree
+
+SV_ClipToLinks for the solid area tree
+====================
+*/
+static void SV_ClipToAreaTree (moveclip_t *clip)
+{
+	int		stack[AREATREE_STACK];
+	int		sp;
+	areatreenode_t	*node;
+
+	if (sv_solidtree.root == AREATREE_NULL)
+		return;
+
+	stack[0] = sv_solidtree.root;
+	sp = 1;
+	while (sp)
+	{
+		node = &sv_solidtree.nodes[stack[--sp]];
+		sv_areastats.nodes++;
+		if (!AreaTree_Overlaps (node, clip->boxmins, clip->boxmaxs))
+			continue;
+		if (!node->height)
+		{
+			if (!SV_ClipToEdict (node->ent, clip))
+				return;
+			continue;
+		}
+		if (sp > AREATREE_STACK - 2)
+			Sys_Error ("SV_ClipToAreaTree: tree too deep");
+		stack[sp++] = node->children[1];
+		stack[sp++] = node->children[0];
+	}
+}
+
 
 /*
 ==================
@@ -890,6 +1957,260 @@ boxmaxs[0] = boxmaxs[1] = boxmaxs[2] = 9999;
 #endif
 }
 
+/*
+===============================================================================
+
+SPECULATIVE WORLD TRACES
+
+With sv_parallelphysics, SV_Physics guesses the moves that toss entities
+are about to make and traces them against the world on the worker threads
+before its serial pass.  The world doesn't change during a frame and a
+world trace only depends on its inputs, so SV_Move can use the guessed
+trace when the real move is bit for bit the same one, and traces as usual
+otherwise.  Entity clipping, linking and touch functions all stay in the
+serial pass, in edict order.
+
+===============================================================================
+*/
+
+#define	WORLDTRACES_PER_TASK	32
+#define	MAX_WORLDTRACE_TASKS	(MAX_EDICTS / WORLDTRACES_PER_TASK + 1)
+
+typedef struct
+{
+	int		num;		// edict making the move
+	vec3_t		start, mins, maxs, end;
+	trace_t		trace;
+} worldtrace_t;
+
+static worldtrace_t	*sv_worldtraces;
+static int		sv_numworldtraces, sv_maxworldtraces;
+static int		sv_worldtraceslot[MAX_EDICTS];	// index + 1 in sv_worldtraces, 0 = none
+static task_t		sv_worldtracetasks[MAX_WORLDTRACE_TASKS];
+
+/*
+================
+SV_AddWorldTrace
+
+Queues a world trace for the move ent is expected to make
+================
+*/
+void SV_AddWorldTrace (edict_t *ent, const vec3_t start, const vec3_t end)
+{
+	worldtrace_t	*wt;
+	int		num;
+
+	if (sv_numworldtraces == sv_maxworldtraces)
+	{
+		int newmax = sv_maxworldtraces ? sv_maxworldtraces * 2 : 256;
+		wt = (worldtrace_t *) realloc (sv_worldtraces, newmax * sizeof(worldtrace_t));
+		if (!wt)
+			return;	// it's only a guess
+		sv_worldtraces = wt;
+		sv_maxworldtraces = newmax;
+	}
+
+	num = NUM_FOR_EDICT(ent);
+	wt = &sv_worldtraces[sv_numworldtraces++];
+	wt->num = num;
+	VectorCopy (start, wt->start);
+	VectorCopy (ent->v.mins, wt->mins);
+	VectorCopy (ent->v.maxs, wt->maxs);
+	VectorCopy (end, wt->end);
+	sv_worldtraceslot[num] = sv_numworldtraces;
+}
+
+static void SV_WorldTraceTask (void *data)
+{
+	worldtrace_t	*wt = (worldtrace_t *) data;
+	worldtrace_t	*last = sv_worldtraces + sv_numworldtraces;
+	int		i;
+
+	for (i = 0; i < WORLDTRACES_PER_TASK && wt < last; i++, wt++)
+		wt->trace = SV_ClipMoveToEntity (sv.edicts, wt->start, wt->mins, wt->maxs, wt->end);
+}
+
+/*
+================
+SV_RunWorldTraces
+
+Runs the queued traces across the worker threads, returns when all are done
+================
+*/
+void SV_RunWorldTraces (void)
+{
+	int	i, numtasks;
+
+	if (sv_numworldtraces < WORLDTRACES_PER_TASK * 2)
+	{ // not worth waking the workers for
+		SV_EndWorldTraces ();
+		return;
+	}
+
+	sv_speculating = true;
+	numtasks = 0;
+	for (i = 0; i < sv_numworldtraces && numtasks < MAX_WORLDTRACE_TASKS; i += WORLDTRACES_PER_TASK)
+		sv_worldtracetasks[numtasks++] = Task_Run (SV_WorldTraceTask, &sv_worldtraces[i], NULL, 0);
+	for (i = 0; i < numtasks; i++)
+		Task_Wait (sv_worldtracetasks[i]);
+	sv_speculating = false;
+}
+
+/*
+================
+SV_EndWorldTraces
+
+Drops the guesses that weren't used
+================
+*/
+void SV_EndWorldTraces (void)
+{
+	int	i;
+
+	for (i = 0; i < sv_numworldtraces; i++)
+		sv_worldtraceslot[sv_worldtraces[i].num] = 0;
+	sv_numworldtraces = 0;
+}
+
+static qboolean SV_FindWorldTrace (edict_t *passedict, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, trace_t *trace)
+{
+	worldtrace_t	*wt;
+	int		num, slot;
+
+	if (!sv_numworldtraces || !passedict)
+		return false;
+
+	num = NUM_FOR_EDICT(passedict);
+	slot = sv_worldtraceslot[num];
+	if (!slot)
+		return false;
+	sv_worldtraceslot[num] = 0;	// one guess per edict and frame
+
+	wt = &sv_worldtraces[slot - 1];
+	if (memcmp (wt->start, start, sizeof(vec3_t)) || memcmp (wt->end, end, sizeof(vec3_t)) ||
+		memcmp (wt->mins, mins, sizeof(vec3_t)) || memcmp (wt->maxs, maxs, sizeof(vec3_t)))
+		return false;
+
+	*trace = wt->trace;
+	return true;
+}
+
+/*
+===============================================================================
+
+WORLD TRACE CACHE
+
+Monster AI keeps tracing the same lines within a frame, several monsters
+checking their line of sight to the same player for instance.  With
+sv_tracecache set, the world part of MOVE_NOMONSTERS moves is looked up
+in a small table first.  Only the world trace is kept: the world never
+moves, so a result stays right for as long as the map is up, while the
+brush entities are still clipped against every time.  The key is the
+exact start, mins, maxs and end, and the table is emptied whenever
+sv.time changes to keep it small.
+
+===============================================================================
+*/
+
+#define	TRACECACHE_SIZE		4096	// power of two
+#define	TRACECACHE_PROBES	8
+
+typedef struct
+{
+	unsigned int	frame;		// entry is valid while this matches sv_tracecacheframe
+	vec3_t		start, mins, maxs, end;
+	trace_t		trace;
+} cachedtrace_t;
+
+cvar_t		sv_tracecache = {"sv_tracecache", "0", CVAR_NONE};
+
+static	cachedtrace_t	sv_tracecachetable[TRACECACHE_SIZE];
+static	unsigned int	sv_tracecacheframe = 1;
+static	double		sv_tracecachetime = -1;
+
+static void SV_ClearTraceCache (void)
+{
+	sv_tracecacheframe++;
+	if (!sv_tracecacheframe)
+	{ // wrapped, old entries could match again
+		memset (sv_tracecachetable, 0, sizeof(sv_tracecachetable));
+		sv_tracecacheframe = 1;
+	}
+	sv_tracecachetime = -1;
+}
+
+static unsigned int SV_TraceCacheHash (const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end)
+{
+	const float	*v[4];
+	unsigned int	hash, bits;
+	int		i, j;
+
+	v[0] = start;
+	v[1] = mins;
+	v[2] = maxs;
+	v[3] = end;
+	hash = 2166136261u;
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			memcpy (&bits, &v[i][j], sizeof(bits));
+			hash = (hash ^ bits) * 16777619u;
+		}
+	}
+	return hash ^ (hash >> 15);
+}
+
+/*
+==================
+SV_CachedWorldTrace
+
+SV_ClipMoveToEntity against the world, through the cache
+==================
+*/
+static trace_t SV_CachedWorldTrace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end)
+{
+	cachedtrace_t	*ct, *slot;
+	unsigned int	hash;
+	int		i;
+
+	if (sv_tracecachetime != sv.time)
+	{
+		SV_ClearTraceCache ();
+		sv_tracecachetime = sv.time;
+	}
+
+	hash = SV_TraceCacheHash (start, mins, maxs, end);
+	slot = NULL;
+	for (i = 0; i < TRACECACHE_PROBES; i++)
+	{
+		ct = &sv_tracecachetable[(hash + i) & (TRACECACHE_SIZE - 1)];
+		if (ct->frame != sv_tracecacheframe)
+		{
+			if (!slot)
+				slot = ct;
+			continue;
+		}
+		if (!memcmp (ct->start, start, sizeof(vec3_t)) && !memcmp (ct->end, end, sizeof(vec3_t)) &&
+			!memcmp (ct->mins, mins, sizeof(vec3_t)) && !memcmp (ct->maxs, maxs, sizeof(vec3_t)))
+		{
+			sv_areastats.cachehits++;
+			return ct->trace;
+		}
+	}
+
+	sv_areastats.cachemisses++;
+	if (!slot)	// all taken, replace the first one
+		slot = &sv_tracecachetable[hash & (TRACECACHE_SIZE - 1)];
+	slot->frame = sv_tracecacheframe;
+	VectorCopy (start, slot->start);
+	VectorCopy (mins, slot->mins);
+	VectorCopy (maxs, slot->maxs);
+	VectorCopy (end, slot->end);
+	slot->trace = SV_ClipMoveToEntity (sv.edicts, start, mins, maxs, end);
+	return slot->trace;
+}
+
 /*
 ==================
 SV_Move
@@ -900,10 +2221,17 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	moveclip_t	clip;
 	int			i;
 
+	SV_PROFILE_BEGIN (passedict, SVPROF_MOVE);
 	memset ( &clip, 0, sizeof ( moveclip_t ) );
 
 // clip to world
-	clip.trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
+	if (!SV_FindWorldTrace (passedict, start, mins, maxs, end, &clip.trace))
+	{
+		if (type == MOVE_NOMONSTERS && sv_tracecache.value)
+			clip.trace = SV_CachedWorldTrace (start, mins, maxs, end);
+		else
+			clip.trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
+	}
 
 	clip.start = start;
 	clip.end = end;
@@ -930,8 +2258,13 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	SV_MoveBounds ( start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs );
 
 // clip to entities
-	SV_ClipToLinks ( sv_areanodes, &clip );
+	sv_areastats.moves++;
+	if (sv_areatreeactive)
+		SV_ClipToAreaTree (&clip);
+	else
+		SV_ClipToLinks ( sv_areanodes, &clip );
 
+	SV_PROFILE_END ();
 	return clip.trace;
 }
 
@@ -60,6 +60,13 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+int SV_AreaEdicts (const vec3_t mins, const vec3_t maxs, edict_t **list, int listspace);
+// fills list with the linked edicts whose absmin/absmax touch the box,
+// in no particular order
+
+int SV_PushEdicts (const vec3_t mins, const vec3_t maxs, edict_t **list, int listspace);
+// same, including the linked SOLID_NOT edicts, sorted by edict number
+
 int SV_PointContents (vec3_t p);
 int SV_TruePointContents (vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.
@@ -83,5 +90,16 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 
 qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
 
+// sv_areatree callback and the area and trace stats commands
+void SV_AreaTree_f (cvar_t *var);
+void SV_AreaStats_f (void);
+void SV_TraceCapture_f (void);
+void SV_TraceBench_f (void);
+
+// speculative world traces for SV_Physics, see world.c
+void SV_AddWorldTrace (edict_t *ent, const vec3_t start, const vec3_t end);
+void SV_RunWorldTraces (void);
+void SV_EndWorldTraces (void);
+
 #endif	/* _QUAKE_WORLD_H */
 
@@ -47,6 +47,209 @@ typedef struct
 void Cache_FreeLow (int new_low_hunk);
 void Cache_FreeHigh (int new_high_hunk);
 
+/*
+==============================================================================
+
+						ALLOCATION TRACKING
+
+After memtrace on, every zone and hunk allocation is counted under a tag:
+the hunk name, or the file and line of the Z_Malloc.  Frame_Reset closes
+each host frame, keeping the most any one frame did, so whatever still
+allocates every frame stands out.  Like the zone and the hunk themselves
+this is for the main thread only.
+==============================================================================
+*/
+
+#define	MEMTAG_NAME_LEN	40
+#define	MAX_MEMTAGS		512	// power of two
+
+typedef struct
+{
+	char		name[MEMTAG_NAME_LEN];	// empty for an unused slot
+	const char	*file;		// of a zone tag, NULL for a hunk one
+	int			line;
+	int			frameallocs, framebytes;
+	int			peakallocs, peakbytes;	// in one frame
+	int			allocs;
+	double		bytes;
+} memtag_t;
+
+static memtag_t	mem_tags[MAX_MEMTAGS];
+static int		mem_numtags;
+static int		mem_untagged;	// allocations that found the table full
+static int		mem_frames;
+static int		mem_frameallocs, mem_framebytes;	// of all tags, for the trace counters
+static qboolean	mem_tracing;
+
+static memtag_t *Mem_FindTag (const char *name, const char *file, int line)
+{
+	memtag_t	*tag;
+	unsigned int	hash;
+	const char	*s;
+	int		i;
+
+	if (file)
+		hash = (unsigned int) (size_t) file * 31 + line;
+	else
+	{
+		for (hash = 2166136261u, s = name; *s && s - name < MEMTAG_NAME_LEN - 1; s++)
+			hash = (hash ^ (byte) *s) * 16777619u;
+	}
+
+	for (i = 0; i < MAX_MEMTAGS; i++)
+	{
+		tag = &mem_tags[(hash + i) & (MAX_MEMTAGS - 1)];
+		if (!tag->name[0])
+		{
+			if (mem_numtags >= MAX_MEMTAGS * 3 / 4)
+				return NULL;	// keep the probes short
+			mem_numtags++;
+			tag->file = file;
+			tag->line = line;
+			if (file)
+				q_snprintf (tag->name, sizeof(tag->name), "%s:%i", COM_SkipPath (file), line);
+			else
+				q_strlcpy (tag->name, name[0] ? name : "?", sizeof(tag->name));
+			return tag;
+		}
+		if (file ? (tag->file == file && tag->line == line) :
+			(!tag->file && !strncmp (tag->name, name[0] ? name : "?", MEMTAG_NAME_LEN - 1)))
+			return tag;
+	}
+	return NULL;
+}
+
+static void Mem_Account (const char *name, const char *file, int line, int size)
+{
+	memtag_t	*tag;
+
+	mem_frameallocs++;
+	mem_framebytes += size;
+
+	tag = Mem_FindTag (name, file, line);
+	if (!tag)
+	{
+		mem_untagged++;
+		return;
+	}
+	tag->frameallocs++;
+	tag->framebytes += size;
+	tag->allocs++;
+	tag->bytes += size;
+}
+
+#define	MEM_ACCOUNT(name, file, line, size)	do { if (mem_tracing) Mem_Account (name, file, line, size); } while (0)
+
+static void Mem_EndFrame (void)
+{
+	memtag_t	*tag;
+	int		i;
+
+	if (!mem_tracing)
+		return;
+
+	if (trace_active)
+	{
+		Trace_Counter ("allocs", mem_frameallocs);
+		Trace_Counter ("alloc bytes", mem_framebytes);
+	}
+	mem_frameallocs = mem_framebytes = 0;
+
+	for (i = 0, tag = mem_tags; i < MAX_MEMTAGS; i++, tag++)
+	{
+		if (!tag->name[0])
+			continue;
+		tag->peakallocs = q_max (tag->peakallocs, tag->frameallocs);
+		tag->peakbytes = q_max (tag->peakbytes, tag->framebytes);
+		tag->frameallocs = tag->framebytes = 0;
+	}
+	mem_frames++;
+}
+
+static void Mem_ResetTags (void)
+{
+	memset (mem_tags, 0, sizeof(mem_tags));
+	mem_numtags = mem_untagged = mem_frames = 0;
+	mem_frameallocs = mem_framebytes = 0;
+}
+
+static int Mem_CompareTags (const void *a, const void *b)
+{
+	const memtag_t	*ta = *(const memtag_t **) a;
+	const memtag_t	*tb = *(const memtag_t **) b;
+
+	if (ta->allocs != tb->allocs)
+		return tb->allocs - ta->allocs;
+	return strcmp (ta->name, tb->name);
+}
+
+/*
+===================
+Mem_Trace_f
+
+memtrace [on | off | reset | all] -- without arguments lists the tags that
+allocated most often
+===================
+*/
+static void Mem_Trace_f (void)
+{
+	memtag_t	*sorted[MAX_MEMTAGS];
+	memtag_t	*tag;
+	const char	*arg;
+	int		i, n, shown;
+
+	arg = Cmd_Argc () > 1 ? Cmd_Argv (1) : "";
+	if (!strcmp (arg, "on"))
+	{
+		if (!mem_tracing)
+			Mem_ResetTags ();
+		mem_tracing = true;
+		return;
+	}
+	if (!strcmp (arg, "off"))
+	{
+		mem_tracing = false;
+		return;
+	}
+	if (!strcmp (arg, "reset"))
+	{
+		Mem_ResetTags ();
+		return;
+	}
+	if (arg[0] && strcmp (arg, "all"))
+	{
+		Con_Printf ("memtrace [on | off | reset | all]\n");
+		return;
+	}
+
+	if (!mem_numtags)
+	{
+		Con_Printf ("Nothing tracked%s\n", mem_tracing ? " yet" : ", use memtrace on first");
+		return;
+	}
+
+	for (i = 0, n = 0, tag = mem_tags; i < MAX_MEMTAGS; i++, tag++)
+		if (tag->name[0])
+			sorted[n++] = tag;
+	qsort (sorted, n, sizeof(sorted[0]), Mem_CompareTags);
+	shown = arg[0] ? n : q_min (n, 32);
+
+	Con_Printf ("%i frames%s\n", mem_frames, mem_tracing ? "" : ", stopped");
+	Con_Printf ("  allocs /frame peak    kbytes /frame  peak  tag\n");
+	for (i = 0; i < shown; i++)
+	{
+		tag = sorted[i];
+		Con_Printf ("%8i %6.1f %4i %9.0f %6.1f %5i  %s\n", tag->allocs,
+			mem_frames ? (double) tag->allocs / mem_frames : 0.0, tag->peakallocs,
+			tag->bytes / 1024, mem_frames ? tag->bytes / 1024 / mem_frames : 0.0,
+			tag->peakbytes / 1024, tag->name);
+	}
+	if (shown < n)
+		Con_Printf ("%i more, memtrace all lists them\n", n - shown);
+	if (mem_untagged)
+		Con_Printf ("%i allocations found the tag table full\n", mem_untagged);
+}
+
 
 /*
 ==============================================================================
@@ -66,6 +269,249 @@ all big things are allocated on the hunk.
 static memzone_t	*mainzone;
 
 
+/*
+==============================================================================
+
+						SLAB ALLOCATION
+
+Small zone allocations are served from fixed size slots in dedicated pages,
+one size class per page, each page keeping its own free list.  Allocating
+and freeing are O(1) and never fragment the zone.  A page goes back to the
+pool once all of its slots are free.  When the pages run out, allocations
+fall back to the zone.
+==============================================================================
+*/
+
+#define	SLAB_PAGESIZE	16384
+#define	SLAB_PAGES		64		// 1MB of pages
+#define	SLAB_CLASSES	5
+#define	SLAB_MAXSIZE	256
+#define	SLAB_FREEID		0x51ab0f4e	// marks a free slot
+
+typedef struct slabslot_s
+{
+	struct slabslot_s	*next;
+	int			id;		// SLAB_FREEID while free
+} slabslot_t;
+
+typedef struct slabpage_s
+{
+	int			sizeclass;	// -1 = not in use
+	int			used;		// slots handed out
+	slabslot_t		*free;
+	struct slabpage_s	*next, *prev;	// partly free pages of the class, or the unused pages
+} slabpage_t;
+
+typedef struct
+{
+	int		size;
+	slabpage_t	*partial;	// pages with free slots
+	int		pages;
+	int		used, peak;	// slots
+	int		allocs;
+} slabclass_t;
+
+static byte		*slab_base;
+static slabpage_t	slab_pages[SLAB_PAGES];
+static slabpage_t	*slab_unused;
+static slabclass_t	slab_classes[SLAB_CLASSES] = {{16}, {32}, {64}, {128}, {256}};
+static int		slab_fallbacks;		// small allocations that went to the zone
+
+static void Slab_Unlink (slabpage_t *page)
+{
+	slabclass_t	*c = &slab_classes[page->sizeclass];
+
+	if (page->prev)
+		page->prev->next = page->next;
+	else
+		c->partial = page->next;
+	if (page->next)
+		page->next->prev = page->prev;
+	page->next = page->prev = NULL;
+}
+
+static void Slab_Link (slabpage_t *page)
+{
+	slabclass_t	*c = &slab_classes[page->sizeclass];
+
+	page->prev = NULL;
+	page->next = c->partial;
+	if (c->partial)
+		c->partial->prev = page;
+	c->partial = page;
+}
+
+/*
+========================
+Slab_NewPage
+
+Gives an unused page to a size class and threads its free list
+========================
+*/
+static slabpage_t *Slab_NewPage (int sizeclass)
+{
+	slabpage_t	*page;
+	slabslot_t	*slot;
+	byte		*base;
+	int		i, size, count;
+
+	page = slab_unused;
+	if (!page)
+		return NULL;
+	slab_unused = page->next;
+
+	size = slab_classes[sizeclass].size;
+	count = SLAB_PAGESIZE / size;
+	base = slab_base + (page - slab_pages) * SLAB_PAGESIZE;
+
+	page->sizeclass = sizeclass;
+	page->used = 0;
+	page->free = NULL;
+	for (i = count - 1; i >= 0; i--)
+	{
+		slot = (slabslot_t *)(base + i * size);
+		slot->next = page->free;
+		slot->id = SLAB_FREEID;
+		page->free = slot;
+	}
+
+	slab_classes[sizeclass].pages++;
+	Slab_Link (page);
+	return page;
+}
+
+/*
+========================
+Slab_Alloc
+
+Returns NULL if the block is too big or the pages are all taken
+========================
+*/
+static void *Slab_Alloc (int size)
+{
+	slabclass_t	*c;
+	slabpage_t	*page;
+	slabslot_t	*slot;
+	int		i;
+
+	if (size > SLAB_MAXSIZE || !slab_base)
+		return NULL;
+
+	for (i = 0; slab_classes[i].size < size; i++)
+		;
+	c = &slab_classes[i];
+
+	page = c->partial;
+	if (!page)
+	{
+		page = Slab_NewPage (i);
+		if (!page)
+		{
+			slab_fallbacks++;
+			return NULL;
+		}
+	}
+
+	slot = page->free;
+	page->free = slot->next;
+	slot->id = 0;	// the caller may not overwrite it
+	page->used++;
+	if (!page->free)
+		Slab_Unlink (page);	// full
+
+	c->allocs++;
+	c->used++;
+	if (c->used > c->peak)
+		c->peak = c->used;
+
+	return slot;
+}
+
+static slabpage_t *Slab_PageForPointer (void *ptr)
+{
+	byte	*p = (byte *)ptr;
+
+	if (!slab_base || p < slab_base || p >= slab_base + SLAB_PAGES * SLAB_PAGESIZE)
+		return NULL;
+	return &slab_pages[(p - slab_base) / SLAB_PAGESIZE];
+}
+
+/*
+========================
+Slab_Free
+========================
+*/
+static void Slab_Free (slabpage_t *page, void *ptr)
+{
+	slabclass_t	*c;
+	slabslot_t	*slot;
+	int		offset;
+
+	if (page->sizeclass == -1)
+		Sys_Error ("Z_Free: freed a pointer in an unused slab page");
+	c = &slab_classes[page->sizeclass];
+	offset = ((byte *)ptr - slab_base) % SLAB_PAGESIZE;
+	if (offset % c->size)
+		Sys_Error ("Z_Free: freed a pointer inside a slab slot");
+
+	slot = (slabslot_t *)ptr;
+	if (slot->id == SLAB_FREEID)
+		Sys_Error ("Z_Free: freed a freed pointer");
+
+	if (!page->free)
+		Slab_Link (page);	// was full
+	slot->next = page->free;
+	slot->id = SLAB_FREEID;
+	page->free = slot;
+	page->used--;
+	c->used--;
+
+	if (!page->used)
+	{ // give the page back to the pool
+		Slab_Unlink (page);
+		page->sizeclass = -1;
+		page->next = slab_unused;
+		slab_unused = page;
+		c->pages--;
+	}
+}
+
+static void Slab_Init (void)
+{
+	int	i;
+
+	slab_base = (byte *) Hunk_AllocName (SLAB_PAGES * SLAB_PAGESIZE, "slabs");
+	slab_unused = NULL;
+	for (i = SLAB_PAGES - 1; i >= 0; i--)
+	{
+		slab_pages[i].sizeclass = -1;
+		slab_pages[i].next = slab_unused;
+		slab_unused = &slab_pages[i];
+	}
+}
+
+/*
+========================
+Slab_Print
+========================
+*/
+static void Slab_Print (void)
+{
+	slabclass_t	*c;
+	int		i, pages;
+
+	Con_Printf ("slab  pages   used   peak     allocs\n");
+	for (i = 0, pages = 0, c = slab_classes; i < SLAB_CLASSES; i++, c++)
+	{
+		Con_Printf ("%4i %6i %6i %6i %10i\n", c->size, c->pages, c->used, c->peak, c->allocs);
+		pages += c->pages;
+	}
+	Con_Printf ("%i of %i slab pages in use, %i zone fallbacks\n", pages, SLAB_PAGES, slab_fallbacks);
+}
+
+//============================================================================
+
+
 /*
 ========================
 Z_Free
@@ -74,10 +520,18 @@ Z_Free
 void Z_Free (void *ptr)
 {
 	memblock_t	*block, *other;
+	slabpage_t	*page;
 
 	if (!ptr)
 		Sys_Error ("Z_Free: NULL pointer");
 
+	page = Slab_PageForPointer (ptr);
+	if (page)
+	{
+		Slab_Free (page, ptr);
+		return;
+	}
+
 	block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 	if (block->id != ZONEID)
 		Sys_Error ("Z_Free: freed a pointer without ZONEID");
@@ -192,13 +646,22 @@ static void Z_CheckHeap (void)
 
 /*
 ========================
-Z_Malloc
+Z_MallocAt
 ========================
 */
-void *Z_Malloc (int size)
+void *Z_MallocAt (int size, const char *file, int line)
 {
 	void	*buf;
 
+	MEM_ACCOUNT (NULL, file, line, size);
+
+	buf = Slab_Alloc (size);
+	if (buf)
+	{
+		Q_memset (buf, 0, size);
+		return buf;
+	}
+
 	Z_CheckHeap ();	// DEBUG
 	buf = Z_TagMalloc (size, 1);
 	if (!buf)
@@ -210,17 +673,33 @@ void *Z_Malloc (int size)
 
 /*
 ========================
-Z_Realloc
+Z_ReallocAt
 ========================
 */
-void *Z_Realloc(void *ptr, int size)
+void *Z_ReallocAt (void *ptr, int size, const char *file, int line)
 {
 	int old_size;
 	void *old_ptr;
 	memblock_t *block;
+	slabpage_t *page;
 
 	if (!ptr)
-		return Z_Malloc (size);
+		return Z_MallocAt (size, file, line);
+
+	page = Slab_PageForPointer (ptr);
+	if (page)
+	{
+		if (page->sizeclass == -1)
+			Sys_Error ("Z_Realloc: realloced a pointer in an unused slab page");
+		old_size = slab_classes[page->sizeclass].size;
+		if (size <= old_size)
+			return ptr;
+		old_ptr = ptr;
+		ptr = Z_MallocAt (size, file, line);
+		memcpy (ptr, old_ptr, old_size);
+		Slab_Free (page, old_ptr);
+		return ptr;
+	}
 
 	block = (memblock_t *) ((byte *) ptr - sizeof (memblock_t));
 	if (block->id != ZONEID)
@@ -232,6 +711,7 @@ void *Z_Realloc(void *ptr, int size)
 	old_size -= (4 + (int)sizeof(memblock_t));	/* see Z_TagMalloc() */
 	old_ptr = ptr;
 
+	MEM_ACCOUNT (NULL, file, line, size);
 	Z_Free (ptr);
 	ptr = Z_TagMalloc (size, 1);
 	if (!ptr)
@@ -245,10 +725,10 @@ void *Z_Realloc(void *ptr, int size)
 	return ptr;
 }
 
-char *Z_Strdup (const char *s)
+char *Z_StrdupAt (const char *s, const char *file, int line)
 {
 	size_t sz = strlen(s) + 1;
-	char *ptr = (char *) Z_Malloc (sz);
+	char *ptr = (char *) Z_MallocAt (sz, file, line);
 	memcpy (ptr, s, sz);
 	return ptr;
 }
@@ -279,9 +759,35 @@ void Z_Print (memzone_t *zone)
 		if (!block->tag && !block->next->tag)
 			Con_Printf ("ERROR: two consecutive free blocks\n");
 	}
+
+	Slab_Print ();
 }
 
 
+/*
+========================
+Z_Used
+
+Bytes in allocated blocks, headers included, and in slab slots
+========================
+*/
+int Z_Used (void)
+{
+	memblock_t	*block;
+	int		used, i;
+
+	used = 0;
+	for (block = mainzone->blocklist.next ; block != &mainzone->blocklist ; block = block->next)
+	{
+		if (block->tag)
+			used += block->size;
+	}
+	for (i = 0; i < SLAB_CLASSES; i++)
+		used += slab_classes[i].used * slab_classes[i].size;
+
+	return used;
+}
+
 //============================================================================
 
 #define	HUNK_SENTINEL	0x1df001ed
@@ -303,6 +809,43 @@ int		hunk_high_used;
 qboolean	hunk_tempactive;
 int		hunk_tempmark;
 
+// with a reserved hunk, memory is committed in chunks as it gets used
+#define	HUNK_CHUNK		(1024 * 1024)
+#define	MAX_HUNK_CHUNKS	2048		// hunk_size is an int
+
+static qboolean	hunk_reserved;
+static byte	hunk_committed[MAX_HUNK_CHUNKS];
+static int	hunk_numcommitted;
+
+/*
+===================
+Hunk_Commit
+
+Makes sure the given range of the hunk is backed by memory
+===================
+*/
+static void Hunk_Commit (int offset, int size)
+{
+	int	chunk, last, length;
+
+	if (!hunk_reserved || size <= 0)
+		return;
+
+	last = (offset + size - 1) / HUNK_CHUNK;
+	for (chunk = offset / HUNK_CHUNK; chunk <= last; chunk++)
+	{
+		if (hunk_committed[chunk])
+			continue;
+		length = q_min(HUNK_CHUNK, hunk_size - chunk * HUNK_CHUNK);
+		if (!Sys_MemCommit (hunk_base + chunk * HUNK_CHUNK, length))
+			Sys_Error ("Hunk_Commit: couldn't commit %i bytes", length);
+		hunk_committed[chunk] = true;
+		hunk_numcommitted++;
+	}
+}
+
+static void Hunk_Decommit (void);
+
 /*
 ==============
 Hunk_Check
@@ -410,6 +953,253 @@ void Hunk_Print (qboolean all)
 
 }
 
+/*
+===================
+Hunk_Used
+===================
+*/
+int Hunk_Used (void)
+{
+	return hunk_low_used + hunk_high_used;
+}
+
+/*
+==============================================================================
+
+						FRAME MEMORY
+
+Scratch memory for buffers that are only needed for the rest of the host
+frame, like the edict lists of SV_TouchLinks and SV_PushMove. Allocations
+are bumped off a fixed block without clearing it, and Frame_Reset at the
+top of _Host_Frame releases everything at once. Frame_LowMark and
+Frame_FreeToLowMark release nested use early, like the hunk marks.
+
+Each thread gets an arena of its own the first time it allocates, so task
+workers can use it without locking and marks never interleave. The main
+thread's arena is set up by Memory_Init, the others are malloc'd and kept
+for good. Frame_Reset empties them all, so workers may only hold frame
+memory within tasks that are waited for in the same frame. Without SDL2
+there are no workers and the main thread's arena is the only one.
+==============================================================================
+*/
+
+#define	FRAME_DEFAULTSIZE	(4 * 1024 * 1024)
+#if defined(USE_SDL2)
+#define	MAX_FRAME_ARENAS	16
+#else
+#define	MAX_FRAME_ARENAS	1
+#endif
+
+typedef struct
+{
+#if defined(USE_SDL2)
+	SDL_threadID	thread;
+#endif
+	byte		*base;
+	int		used;
+	int		peak;		// high watermark since startup
+	int		allocs;		// in the current frame
+	int		peakallocs;
+} framearena_t;
+
+static framearena_t	frame_arenas[MAX_FRAME_ARENAS];
+static int		frame_size = FRAME_DEFAULTSIZE;
+
+#if defined(USE_SDL2)
+static SDL_atomic_t	frame_numarenas;
+static SDL_mutex	*frame_lock;	// only taken to add an arena
+
+static int Frame_NumArenas (void)
+{
+	int	n;
+
+	n = SDL_AtomicGet (&frame_numarenas);
+	SDL_MemoryBarrierAcquire ();
+	return n;
+}
+
+static framearena_t *Frame_NewArena (SDL_threadID thread)
+{
+	framearena_t	*fa;
+	int		n;
+
+	SDL_LockMutex (frame_lock);
+	n = SDL_AtomicGet (&frame_numarenas);
+	if (n == MAX_FRAME_ARENAS)
+	{
+		SDL_UnlockMutex (frame_lock);
+		Sys_Error ("Frame_Alloc: more than %i threads", MAX_FRAME_ARENAS);
+	}
+
+	fa = &frame_arenas[n];
+	fa->base = (byte *) malloc (frame_size);
+	if (!fa->base)
+	{
+		SDL_UnlockMutex (frame_lock);
+		Sys_Error ("Frame_Alloc: couldn't allocate %i bytes", frame_size);
+	}
+	fa->thread = thread;
+	fa->used = fa->peak = fa->allocs = fa->peakallocs = 0;
+
+	SDL_MemoryBarrierRelease ();
+	SDL_AtomicSet (&frame_numarenas, n + 1);
+	SDL_UnlockMutex (frame_lock);
+
+	return fa;
+}
+
+static framearena_t *Frame_Arena (void)
+{
+	SDL_threadID	thread;
+	int		i, n;
+
+	thread = SDL_ThreadID ();
+	if (frame_arenas[0].thread == thread)
+		return &frame_arenas[0];	// main thread
+
+	n = Frame_NumArenas ();
+	for (i = 1; i < n; i++)
+	{
+		if (frame_arenas[i].thread == thread)
+			return &frame_arenas[i];
+	}
+
+	return Frame_NewArena (thread);	// only this thread can add its own
+}
+#else
+static int Frame_NumArenas (void)
+{
+	return 1;
+}
+
+static framearena_t *Frame_Arena (void)
+{
+	return &frame_arenas[0];
+}
+#endif	// USE_SDL2
+
+/*
+===================
+Frame_TryAlloc
+
+Returns NULL instead of failing when the arena is full
+===================
+*/
+void *Frame_TryAlloc (int size)
+{
+	framearena_t	*fa;
+	byte		*buf;
+
+	if (size < 0)
+		Sys_Error ("Frame_Alloc: bad size: %i", size);
+
+	fa = Frame_Arena ();
+	size = (size + 15) & ~15;
+	if (size > frame_size - fa->used)
+		return NULL;
+
+	buf = fa->base + fa->used;
+	fa->used += size;
+	fa->peak = q_max (fa->peak, fa->used);
+	fa->allocs++;
+	return buf;
+}
+
+/*
+===================
+Frame_Alloc
+
+Not zero filled, unlike the hunk
+===================
+*/
+void *Frame_Alloc (int size)
+{
+	void	*buf;
+
+	buf = Frame_TryAlloc (size);
+	if (!buf)
+		Sys_Error ("Frame_Alloc: failed on %i bytes, use -framemem to raise the %i KB limit", size, frame_size / 1024);
+	return buf;
+}
+
+int Frame_LowMark (void)
+{
+	return Frame_Arena ()->used;
+}
+
+void Frame_FreeToLowMark (int mark)
+{
+	framearena_t	*fa;
+
+	fa = Frame_Arena ();
+	if (mark < 0 || mark > fa->used)
+		Sys_Error ("Frame_FreeToLowMark: bad mark %i", mark);
+	fa->used = mark;
+}
+
+/*
+===================
+Frame_Reset
+
+Releases all frame memory of every thread
+===================
+*/
+void Frame_Reset (void)
+{
+	framearena_t	*fa;
+	int		i, n;
+
+	Mem_EndFrame ();
+
+	n = Frame_NumArenas ();
+	for (i = 0, fa = frame_arenas; i < n; i++, fa++)
+	{
+		fa->used = 0;
+		fa->peakallocs = q_max (fa->peakallocs, fa->allocs);
+		fa->allocs = 0;
+	}
+}
+
+static void Frame_Init (void)
+{
+	int	p;
+
+	p = COM_CheckParm ("-framemem");
+	if (p)
+	{
+		if (p < com_argc-1)
+			frame_size = q_max (Q_atoi (com_argv[p+1]), 64) * 1024;
+		else
+			Sys_Error ("Memory_Init: you must specify a size in KB after -framemem");
+	}
+
+	frame_arenas[0].base = (byte *) Hunk_AllocName (frame_size, "frame");
+#if defined(USE_SDL2)
+	frame_lock = SDL_CreateMutex ();
+	frame_arenas[0].thread = SDL_ThreadID ();
+	SDL_AtomicSet (&frame_numarenas, 1);
+#endif
+}
+
+/*
+========================
+Frame_Print
+========================
+*/
+static void Frame_Print (void)
+{
+	framearena_t	*fa;
+	int		i, n;
+
+	n = Frame_NumArenas ();
+	Con_Printf ("frame  in use    peak  allocs  peak allocs\n");
+	for (i = 0, fa = frame_arenas; i < n; i++, fa++)
+		Con_Printf ("%5i %7i %7i %7i %12i\n", i, fa->used, fa->peak, fa->allocs, q_max (fa->peakallocs, fa->allocs));
+	Con_Printf ("%i thread arenas of %i KB\n", n, frame_size / 1024);
+}
+
+//============================================================================
+
 /*
 ===================
 Hunk_Print_f -- johnfitz -- console command to call hunk_print
@@ -418,6 +1208,11 @@ Hunk_Print_f -- johnfitz -- console command to call hunk_print
 void Hunk_Print_f (void)
 {
 	Hunk_Print (false);
+	if (hunk_reserved)
+		Con_Printf ("%8i bytes committed\n", hunk_numcommitted * HUNK_CHUNK);
+	Con_Printf ("%8i zone bytes in use\n", Z_Used ());
+	Slab_Print ();
+	Frame_Print ();
 }
 
 /*
@@ -436,12 +1231,14 @@ void *Hunk_AllocName (int size, const char *name)
 	if (size < 0)
 		Sys_Error ("Hunk_Alloc: bad size: %i", size);
 
+	MEM_ACCOUNT (name, NULL, 0, size);
 	size = sizeof(hunk_t) + ((size+15)&~15);
 
 	if (hunk_size - hunk_low_used - hunk_high_used < size)
 		Sys_Error ("Hunk_Alloc: failed on %i bytes",size);
 
 	h = (hunk_t *)(hunk_base + hunk_low_used);
+	Hunk_Commit (hunk_low_used, size);
 	hunk_low_used += size;
 
 	Cache_FreeLow (hunk_low_used);
@@ -476,6 +1273,7 @@ void Hunk_FreeToLowMark (int mark)
 		Sys_Error ("Hunk_FreeToLowMark: bad mark %i", mark);
 	memset (hunk_base + mark, 0, hunk_low_used - mark);
 	hunk_low_used = mark;
+	Hunk_Decommit ();
 }
 
 int	Hunk_HighMark (void)
@@ -525,6 +1323,7 @@ void *Hunk_HighAllocName (int size, const char *name)
 	Hunk_Check ();
 #endif
 
+	MEM_ACCOUNT (name, NULL, 0, size);
 	size = sizeof(hunk_t) + ((size+15)&~15);
 
 	if (hunk_size - hunk_low_used - hunk_high_used < size)
@@ -533,6 +1332,7 @@ void *Hunk_HighAllocName (int size, const char *name)
 		return NULL;
 	}
 
+	Hunk_Commit (hunk_size - hunk_high_used - size, size);
 	hunk_high_used += size;
 	Cache_FreeHigh (hunk_high_used);
 
@@ -599,12 +1399,102 @@ typedef struct cache_system_s
 	char			name[CACHENAME_LEN];
 	struct cache_system_s	*prev, *next;
 	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
+	cachecategory_t		category;
 } cache_system_t;
 
 cache_system_t *Cache_TryAlloc (int size, qboolean nobottom);
 
 cache_system_t	cache_head;
 
+typedef struct
+{
+	const char	*name;
+	int		used, peak;	// bytes, headers included
+	int		entries;
+	int		evictions;	// thrown out to make room
+	int		reloads;	// cached again after an eviction
+} cachestats_t;
+
+static cachestats_t	cache_stats[CACHE_NUMCATEGORIES] =
+{
+	{"models"}, {"sounds"}, {"files"}
+};
+
+// budgets in KB, 0 = only limited by the free hunk
+static cvar_t	cache_budgets[CACHE_NUMCATEGORIES] =
+{
+	{"cache_models", "0", CVAR_ARCHIVE},
+	{"cache_sounds", "0", CVAR_ARCHIVE},
+	{"cache_files", "0", CVAR_ARCHIVE}
+};
+
+// only created once another thread reads the cache, see Cache_CreateLock
+static SDL_mutex	*cache_lock;
+
+static void Cache_Account (cache_system_t *cs, cachecategory_t category)
+{
+	cachestats_t	*st = &cache_stats[category];
+
+	cs->category = category;
+	st->used += cs->size;
+	st->entries++;
+	if (st->used > st->peak)
+		st->peak = st->used;
+}
+
+/*
+============
+Cache_Evict
+
+Throws out an entry that is still wanted to make room
+============
+*/
+static void Cache_Evict (cache_system_t *cs)
+{
+	cache_user_t	*c = cs->user;
+
+	cache_stats[cs->category].evictions++;
+	Cache_Free (c, cs->category == CACHE_MODEL);
+	c->evicted = true;
+}
+
+/*
+===================
+Hunk_Decommit
+
+Gives back the chunks between the low and high hunk that hold no cache
+===================
+*/
+static void Hunk_Decommit (void)
+{
+	cache_system_t	*cs;
+	byte	*start, *end;
+	int	chunk, first, last;
+
+	if (!hunk_reserved)
+		return;
+
+	first = (hunk_low_used + HUNK_CHUNK - 1) / HUNK_CHUNK;
+	last = (hunk_size - hunk_high_used) / HUNK_CHUNK;	// exclusive
+	for (chunk = first; chunk < last; chunk++)
+	{
+		if (!hunk_committed[chunk])
+			continue;
+		start = hunk_base + chunk * HUNK_CHUNK;
+		end = start + HUNK_CHUNK;
+		for (cs = cache_head.next; cs != &cache_head; cs = cs->next)
+		{
+			if ((byte *)cs < end && (byte *)cs + cs->size > start)
+				break;
+		}
+		if (cs != &cache_head)
+			continue;	// still in use by the cache
+		Sys_MemDecommit (start, HUNK_CHUNK);
+		hunk_committed[chunk] = false;
+		hunk_numcommitted--;
+	}
+}
+
 /*
 ===========
 Cache_Move
@@ -623,6 +1513,7 @@ void Cache_Move ( cache_system_t *c)
 		Q_memcpy ( new_cs+1, c+1, c->size - sizeof(cache_system_t) );
 		new_cs->user = c->user;
 		Q_memcpy (new_cs->name, c->name, sizeof(new_cs->name));
+		Cache_Account (new_cs, c->category);
 		Cache_Free (c->user, false); //johnfitz -- added second argument
 		new_cs->user->data = (void *)(new_cs+1);
 	}
@@ -630,7 +1521,7 @@ void Cache_Move ( cache_system_t *c)
 	{
 //		Con_Printf ("cache_move failed\n");
 
-		Cache_Free (c->user, true); // tough luck... //johnfitz -- added second argument
+		Cache_Evict (c); // tough luck...
 	}
 }
 
@@ -645,15 +1536,17 @@ void Cache_FreeLow (int new_low_hunk)
 {
 	cache_system_t	*c;
 
+	Cache_Lock ();
 	while (1)
 	{
 		c = cache_head.next;
 		if (c == &cache_head)
-			return;		// nothing in cache at all
+			break;		// nothing in cache at all
 		if ((byte *)c >= hunk_base + new_low_hunk)
-			return;		// there is space to grow the hunk
+			break;		// there is space to grow the hunk
 		Cache_Move ( c );	// reclaim the space
 	}
+	Cache_Unlock ();
 }
 
 /*
@@ -668,21 +1561,23 @@ void Cache_FreeHigh (int new_high_hunk)
 	cache_system_t	*c, *prev;
 
 	prev = NULL;
+	Cache_Lock ();
 	while (1)
 	{
 		c = cache_head.prev;
 		if (c == &cache_head)
-			return;		// nothing in cache at all
+			break;		// nothing in cache at all
 		if ( (byte *)c + c->size <= hunk_base + hunk_size - new_high_hunk)
-			return;		// there is space to grow the hunk
+			break;		// there is space to grow the hunk
 		if (c == prev)
-			Cache_Free (c->user, true);	// didn't move out of the way //johnfitz -- added second argument
+			Cache_Evict (c);	// didn't move out of the way
 		else
 		{
 			Cache_Move (c);	// try to move it
 			prev = c;
 		}
 	}
+	Cache_Unlock ();
 }
 
 void Cache_UnlinkLRU (cache_system_t *cs)
@@ -727,6 +1622,7 @@ cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
 			Sys_Error ("Cache_TryAlloc: %i is greater then free hunk", size);
 
 		new_cs = (cache_system_t *) (hunk_base + hunk_low_used);
+		Hunk_Commit ((byte *)new_cs - hunk_base, size);
 		memset (new_cs, 0, sizeof(*new_cs));
 		new_cs->size = size;
 
@@ -748,6 +1644,7 @@ cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
 		{
 			if ( (byte *)cs - (byte *)new_cs >= size)
 			{	// found space
+				Hunk_Commit ((byte *)new_cs - hunk_base, size);
 				memset (new_cs, 0, sizeof(*new_cs));
 				new_cs->size = size;
 
@@ -771,6 +1668,7 @@ cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
 // try to allocate one at the very end
 	if ( hunk_base + hunk_size - hunk_high_used - (byte *)new_cs >= size)
 	{
+		Hunk_Commit ((byte *)new_cs - hunk_base, size);
 		memset (new_cs, 0, sizeof(*new_cs));
 		new_cs->size = size;
 
@@ -796,8 +1694,40 @@ Throw everything out, so new data will be demand cached
 */
 void Cache_Flush (void)
 {
+	Cache_Lock ();
 	while (cache_head.next != &cache_head)
 		Cache_Free ( cache_head.next->user, true); // reclaim the space //johnfitz -- added second argument
+	Cache_Unlock ();
+}
+
+/*
+============
+Cache_CreateLock
+
+From then on every cache call takes the lock, so a thread that holds it
+can use cached data without it moving or being thrown out underneath.
+Only the main thread may allocate or free.
+============
+*/
+void Cache_CreateLock (void)
+{
+	if (cache_lock)
+		return;
+	cache_lock = SDL_CreateMutex ();	// recursive
+	if (!cache_lock)
+		Sys_Error ("Cache_CreateLock: couldn't create lock");
+}
+
+void Cache_Lock (void)
+{
+	if (cache_lock)
+		SDL_LockMutex (cache_lock);
+}
+
+void Cache_Unlock (void)
+{
+	if (cache_lock)
+		SDL_UnlockMutex (cache_lock);
 }
 
 /*
@@ -816,6 +1746,45 @@ void Cache_Print (void)
 	}
 }
 
+/*
+============
+Cache_Stats_f
+
+Per category usage, for sizing the cache_* budgets
+============
+*/
+static void Cache_Stats_f (void)
+{
+	cachestats_t	*st;
+	int		i;
+
+	Con_Printf ("category  budget     used     peak entries evicted reloads\n");
+	for (i = 0, st = cache_stats; i < CACHE_NUMCATEGORIES; i++, st++)
+	{
+		Con_Printf ("%-8s %6ik %7ik %7ik %7i %7i %7i\n", st->name,
+			(int)cache_budgets[i].value, st->used / 1024, st->peak / 1024,
+			st->entries, st->evictions, st->reloads);
+	}
+	Con_Printf ("%4.1f megabytes free between the hunk marks\n",
+		(hunk_size - hunk_high_used - hunk_low_used) / (float)(1024*1024));
+}
+
+/*
+============
+Cache_Used
+
+Bytes of cached data, headers included
+============
+*/
+int Cache_Used (void)
+{
+	int	i, used;
+
+	for (i = 0, used = 0; i < CACHE_NUMCATEGORIES; i++)
+		used += cache_stats[i].used;
+	return used;
+}
+
 /*
 ============
 Cache_Report
@@ -835,10 +1804,15 @@ Cache_Init
 */
 void Cache_Init (void)
 {
+	int	i;
+
 	cache_head.next = cache_head.prev = &cache_head;
 	cache_head.lru_next = cache_head.lru_prev = &cache_head;
 
 	Cmd_AddCommand ("flush", Cache_Flush);
+	Cmd_AddCommand ("cache_stats", Cache_Stats_f);
+	for (i = 0; i < CACHE_NUMCATEGORIES; i++)
+		Cvar_RegisterVariable (&cache_budgets[i]);
 }
 
 /*
@@ -855,13 +1829,18 @@ void Cache_Free (cache_user_t *c, qboolean freetextures) //johnfitz -- added sec
 	if (!c->data)
 		Sys_Error ("Cache_Free: not allocated");
 
+	Cache_Lock ();
 	cs = ((cache_system_t *)c->data) - 1;
 
 	cs->prev->next = cs->next;
 	cs->next->prev = cs->prev;
 	cs->next = cs->prev = NULL;
 
+	cache_stats[cs->category].used -= cs->size;
+	cache_stats[cs->category].entries--;
+
 	c->data = NULL;
+	c->evicted = false;
 
 	Cache_UnlinkLRU (cs);
 
@@ -870,6 +1849,7 @@ void Cache_Free (cache_user_t *c, qboolean freetextures) //johnfitz -- added sec
 	//fail harmlessly if *c is actually part of an sfx_t struct.  I FEEL DIRTY
 	if (freetextures)
 		TexMgr_FreeTexturesForOwner ((qmodel_t *)(c + 1) - 1);
+	Cache_Unlock ();
 }
 
 
@@ -882,17 +1862,24 @@ Cache_Check
 void *Cache_Check (cache_user_t *c)
 {
 	cache_system_t	*cs;
+	void		*data;
 
+	Cache_Lock ();
 	if (!c->data)
+	{
+		Cache_Unlock ();
 		return NULL;
+	}
 
 	cs = ((cache_system_t *)c->data) - 1;
 
 // move to head of LRU
 	Cache_UnlinkLRU (cs);
 	Cache_MakeLRU (cs);
+	data = c->data;
+	Cache_Unlock ();
 
-	return c->data;
+	return data;
 }
 
 
@@ -901,9 +1888,10 @@ void *Cache_Check (cache_user_t *c)
 Cache_Alloc
 ==============
 */
-void *Cache_Alloc (cache_user_t *c, int size, const char *name)
+void *Cache_Alloc (cache_user_t *c, int size, const char *name, cachecategory_t category)
 {
-	cache_system_t	*cs;
+	cache_system_t	*cs, *prev;
+	int		budget;
 
 	if (c->data)
 		Sys_Error ("Cache_Alloc: already allocated");
@@ -913,6 +1901,23 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 
 	size = (size + sizeof(cache_system_t) + 15) & ~15;
 
+	Cache_Lock ();
+	if (c->evicted)
+		cache_stats[category].reloads++;
+	c->evicted = false;
+
+// keep the category within its budget, oldest of its entries first
+	budget = (int)cache_budgets[category].value * 1024;
+	if (budget > 0)
+	{
+		for (cs = cache_head.lru_prev; cs != &cache_head && cache_stats[category].used + size > budget; cs = prev)
+		{
+			prev = cs->lru_prev;
+			if (cs->category == category)
+				Cache_Evict (cs);
+		}
+	}
+
 // find memory for it
 	while (1)
 	{
@@ -922,6 +1927,7 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 			q_strlcpy (cs->name, name, CACHENAME_LEN);
 			c->data = (void *)(cs+1);
 			cs->user = c;
+			Cache_Account (cs, category);
 			break;
 		}
 
@@ -929,9 +1935,11 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 		if (cache_head.lru_prev == &cache_head)
 			Sys_Error ("Cache_Alloc: out of memory"); // not enough memory at all
 
-		Cache_Free (cache_head.lru_prev->user, true); //johnfitz -- added second argument
+		Cache_Evict (cache_head.lru_prev);
 	}
 
+	Cache_Unlock ();
+
 	return Cache_Check (c);
 }
 
@@ -972,6 +1980,8 @@ void Memory_Init (void *buf, int size)
 	hunk_low_used = 0;
 	hunk_high_used = 0;
 
+	hunk_reserved = host_parms->memreserved;
+
 	Cache_Init ();
 	p = COM_CheckParm ("-zone");
 	if (p)
@@ -983,7 +1993,10 @@ void Memory_Init (void *buf, int size)
 	}
 	mainzone = (memzone_t *) Hunk_AllocName (zonesize, "zone" );
 	Memory_InitZone (mainzone, zonesize);
+	Slab_Init ();
+	Frame_Init ();
 
 	Cmd_AddCommand ("hunk_print", Hunk_Print_f); //johnfitz
+	Cmd_AddCommand ("memtrace", Mem_Trace_f);
 }
 
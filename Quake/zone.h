@@ -92,9 +92,14 @@ Zone block
 void Memory_Init (void *buf, int size);
 
 void Z_Free (void *ptr);
-void *Z_Malloc (int size);			// returns 0 filled memory
-void *Z_Realloc (void *ptr, int size);
-char *Z_Strdup (const char *s);
+void *Z_MallocAt (int size, const char *file, int line);	// returns 0 filled memory
+void *Z_ReallocAt (void *ptr, int size, const char *file, int line);
+char *Z_StrdupAt (const char *s, const char *file, int line);
+
+// the callsite is what memtrace counts zone allocations under
+#define	Z_Malloc(size)		Z_MallocAt (size, __FILE__, __LINE__)
+#define	Z_Realloc(ptr, size)	Z_ReallocAt (ptr, size, __FILE__, __LINE__)
+#define	Z_Strdup(s)		Z_StrdupAt (s, __FILE__, __LINE__)
 
 void *Hunk_Alloc (int size);		// returns 0 filled memory
 void *Hunk_AllocName (int size, const char *name);
@@ -109,13 +114,32 @@ void Hunk_FreeToHighMark (int mark);
 
 void *Hunk_TempAlloc (int size);
 
+// scratch memory for the rest of the host frame, per thread, not zero filled
+void *Frame_Alloc (int size);
+void *Frame_TryAlloc (int size);	// NULL when the arena is full
+int Frame_LowMark (void);
+void Frame_FreeToLowMark (int mark);
+void Frame_Reset (void);		// top of _Host_Frame
+
 void Hunk_Check (void);
+int Hunk_Used (void);
+int Z_Used (void);
 
 typedef struct cache_user_s
 {
 	void	*data;
+	qboolean	evicted;	// thrown out while in use, caching it again is a reload
 } cache_user_t;
 
+// each category can be given its own budget, see cache_stats
+typedef enum
+{
+	CACHE_MODEL,	// alias models, their skins go with them
+	CACHE_SOUND,	// sfxcache_t on the dma path
+	CACHE_FILE,	// COM_LoadCacheFile
+	CACHE_NUMCATEGORIES
+} cachecategory_t;
+
 void Cache_Flush (void);
 
 void *Cache_Check (cache_user_t *c);
@@ -124,11 +148,18 @@ void *Cache_Check (cache_user_t *c);
 
 void Cache_Free (cache_user_t *c, qboolean freetextures); //johnfitz -- added second argument
 
-void *Cache_Alloc (cache_user_t *c, int size, const char *name);
+void *Cache_Alloc (cache_user_t *c, int size, const char *name, cachecategory_t category);
 // Returns NULL if all purgable data was tossed and there still
-// wasn't enough room.
+// wasn't enough room.  Entries of the same category are evicted
+// first when the category is over its budget.
 
 void Cache_Report (void);
+int Cache_Used (void);
+
+// for threads that read cached data, see Cache_CreateLock
+void Cache_CreateLock (void);
+void Cache_Lock (void);
+void Cache_Unlock (void);
 
 #endif	/* __ZZONE_H */
 